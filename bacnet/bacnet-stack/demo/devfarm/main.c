@@ -0,0 +1,1989 @@
+/*####COPYRIGHTBEGIN####
+ -------------------------------------------
+ Copyright (C) 2008 Steve Karg
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to:
+ The Free Software Foundation, Inc.
+ 59 Temple Place - Suite 330
+ Boston, MA  02111-1307
+ USA.
+
+ As a special exception, if other files instantiate templates or
+ use macros or inline functions from this file, or you compile
+ this file and link it with other works to produce a work based
+ on this file, this file does not by itself cause the resulting
+ work to be covered by the GNU General Public License. However
+ the source code for this file must still be made available in
+ accordance with section (3) of the GNU General Public License.
+
+ This exception does not invalidate any other reasons why a work
+ based on this file might be covered by the GNU General Public
+ License.
+ -------------------------------------------
+####COPYRIGHTEND####*/
+
+/* A farm of simulated BACnet devices for the load tests of a gateway:
+   the objects of the devices are read from a capture, and their values
+   are played back as they changed in the capture, at a multiple of its
+   speed.  The devices answer Who-Is, ReadProperty, ReadPropertyMultiple
+   and the COV subscriptions, from behind a virtual network routed by the
+   farm.  The throughput, the drops and the latency of the gateway are
+   scraped from its metrics endpoint.  See devfarm.txt. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+/* OS specific include*/
+#include "net.h"
+#include <netdb.h>
+#include <poll.h>
+/* local includes */
+#include "config.h"
+#include "bacdef.h"
+#include "bacdcode.h"
+#include "bacapp.h"
+#include "bacenum.h"
+#include "npdu.h"
+#include "apdu.h"
+#include "datalink.h"
+#include "bip.h"
+#include "dlenv.h"
+#include "iam.h"
+#include "whois.h"
+#include "rp.h"
+#include "rpm.h"
+#include "cov.h"
+#include "abort.h"
+#include "reject.h"
+#include "bacerror.h"
+#include "filename.h"
+#include "version.h"
+
+/* data link types of the captures */
+#define DLT_EN10MB 1
+#define DLT_RAW 101
+#define DLT_LINUX_SLL 113
+#define DLT_BACNET_MS_TP 165
+/* pcapng blocks, see the PCAP Next Generation Dump File Format */
+#define PCAPNG_SECTION_HEADER 0x0A0D0D0A
+#define PCAPNG_INTERFACE_DESCRIPTION 0x00000001
+#define PCAPNG_ENHANCED_PACKET 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPTION_IF_TSRESOL 9
+#define PCAPNG_MAX_INTERFACES 8
+/* MS/TP frames that carry an NPDU */
+#define MSTP_DATA_EXPECTING_REPLY 5
+#define MSTP_DATA_NOT_EXPECTING_REPLY 6
+/* the values of a COV notification of the capture */
+#define MAX_COV_VALUES 8
+/* the octets of the MAC of a device on the virtual network */
+#define FARM_MAC_LEN 2
+#define FARM_MAX_NODES 65535
+/* how often the subscriptions are checked for changed values */
+#define COV_TASK_NS 10000000ULL
+/* the metrics of the gateway */
+#define METRICS_BUFFER_SIZE (512 * 1024)
+#define METRICS_TIMEOUT_MS 2000
+#define METRICS_MAX_BUCKETS 32
+
+/* one value of a property, from the time it appeared in the capture */
+typedef struct farm_value {
+    uint64_t ns;        /* since the first packet of the capture */
+    uint16_t len;
+    uint8_t *data;      /* the application encoded value(s) */
+} FARM_VALUE;
+
+typedef struct farm_property {
+    BACNET_OBJECT_TYPE object_type;
+    uint32_t object_instance;
+    BACNET_PROPERTY_ID property;
+    uint32_t array_index;
+    FARM_VALUE *values;
+    unsigned count;
+    unsigned size;
+} FARM_PROPERTY;
+
+/* a device of the capture, found at its address there */
+typedef struct farm_device {
+    BACNET_ADDRESS address;
+    uint32_t instance;
+    bool instance_known;
+    unsigned max_apdu;
+    uint16_t vendor_id;
+    /* sorted by object and property */
+    FARM_PROPERTY *properties;
+    unsigned count;
+    unsigned size;
+} FARM_DEVICE;
+
+/* a device of the farm: a device of the capture, or a copy of it with
+   its instance moved by the --copies offset */
+typedef struct farm_node {
+    FARM_DEVICE *device;
+    uint32_t instance;
+    uint32_t requests;
+} FARM_NODE;
+
+/* SubscribeCOV monitors the Present_Value and the Status_Flags,
+   SubscribeCOVProperty the one property */
+typedef struct farm_subscription {
+    BACNET_ADDRESS subscriber;
+    uint32_t process_id;
+    FARM_NODE *node;
+    BACNET_OBJECT_TYPE object_type;
+    uint32_t object_instance;
+    unsigned count;
+    FARM_PROPERTY *properties[2];
+    unsigned notified[2];       /* the values sent last */
+    bool confirmed;
+    uint32_t lifetime;
+    uint64_t expires_ns;        /* 0 if it never does */
+} FARM_SUBSCRIPTION;
+
+typedef struct farm_statistics {
+    uint32_t requests;
+    uint32_t who_is;
+    uint32_t read_property;
+    uint32_t read_property_multiple;
+    uint32_t values;    /* the properties answered */
+    uint32_t unknown;   /* the properties not in the capture */
+    uint32_t subscriptions;
+    uint32_t writes;
+    uint32_t notifications;
+    uint32_t aborts;    /* the acks too large for the requester */
+    uint32_t rejects;   /* the services not simulated */
+    uint32_t unrouted;  /* to a device that isn't in the farm */
+} FARM_STATISTICS;
+
+/* the counters of the gateway, summed over their labels */
+typedef struct gateway_metrics {
+    bool valid;
+    double polls;
+    double poll_errors;
+    double poll_overruns;
+    double timeouts;
+    double sent;
+    double dropped;
+    double send_failures;
+    unsigned latency_count;
+    double latency_le[METRICS_MAX_BUCKETS];
+    double latency[METRICS_MAX_BUCKETS];
+    unsigned lateness_count;
+    double lateness_le[METRICS_MAX_BUCKETS];
+    double lateness[METRICS_MAX_BUCKETS];
+} GATEWAY_METRICS;
+
+static FARM_DEVICE *Devices;
+static unsigned Device_Count;
+static unsigned Device_Size;
+static FARM_NODE *Nodes;
+static unsigned Node_Count;
+static FARM_SUBSCRIPTION *Subscriptions;
+static unsigned Subscription_Count;
+static unsigned Subscription_Size;
+
+/* the capture, and how it's played back */
+static uint64_t Capture_First_ns;
+static uint64_t Capture_Duration_ns;
+static uint32_t Capture_Packets;
+static uint32_t Capture_Values;
+static double Speed = 1.0;
+static bool Loop = true;
+static uint16_t Virtual_Network = 5000;
+static uint64_t Start_ns;
+
+static FARM_STATISTICS Stats;
+static FARM_STATISTICS Interval_Stats;
+static uint8_t Rx_Buf[MAX_MPDU];
+static uint8_t Tx_Buf[MAX_MPDU];
+/* the largest ack the farm encodes, before it's checked against the
+   max APDU of the requester */
+static uint8_t Ack_Buf[MAX_APDU * 4];
+static uint8_t Invoke_ID;
+static volatile bool Exit_Requested;
+
+static uint64_t monotonic_ns(
+    void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static bool address_same(
+    BACNET_ADDRESS * a,
+    BACNET_ADDRESS * b)
+{
+    if (a->net != b->net) {
+        return false;
+    }
+    if (a->net) {
+        return (a->len == b->len) && (memcmp(a->adr, b->adr, a->len) == 0);
+    }
+    return (a->mac_len == b->mac_len) &&
+        (memcmp(a->mac, b->mac, a->mac_len) == 0);
+}
+
+/* the device of the capture at the source address, added if it's new */
+static FARM_DEVICE *device_at(
+    BACNET_ADDRESS * src)
+{
+    static FARM_DEVICE *last = NULL;
+    FARM_DEVICE *devices = NULL;
+    unsigned i = 0;
+
+    if (last && address_same(&last->address, src)) {
+        return last;
+    }
+    for (i = 0; i < Device_Count; i++) {
+        if (address_same(&Devices[i].address, src)) {
+            last = &Devices[i];
+            return last;
+        }
+    }
+    if (Device_Count == Device_Size) {
+        Device_Size = Device_Size ? Device_Size * 2 : 64;
+        devices = realloc(Devices, Device_Size * sizeof(FARM_DEVICE));
+        if (!devices) {
+            fprintf(stderr, "devfarm: out of memory\n");
+            exit(1);
+        }
+        Devices = devices;
+    }
+    last = &Devices[Device_Count++];
+    memset(last, 0, sizeof(FARM_DEVICE));
+    last->address = *src;
+    last->max_apdu = MAX_APDU;
+
+    return last;
+}
+
+static int property_compare(
+    FARM_PROPERTY * property,
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance,
+    BACNET_PROPERTY_ID object_property,
+    uint32_t array_index)
+{
+    if (property->object_type != object_type) {
+        return property->object_type < object_type ? -1 : 1;
+    }
+    if (property->object_instance != object_instance) {
+        return property->object_instance < object_instance ? -1 : 1;
+    }
+    if (property->property != object_property) {
+        return property->property < object_property ? -1 : 1;
+    }
+    if (property->array_index != array_index) {
+        return property->array_index < array_index ? -1 : 1;
+    }
+    return 0;
+}
+
+/* the index of the property, or of where it would be inserted */
+static unsigned property_search(
+    FARM_DEVICE * device,
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance,
+    BACNET_PROPERTY_ID object_property,
+    uint32_t array_index,
+    bool * found)
+{
+    unsigned low = 0;
+    unsigned high = device->count;
+    unsigned middle = 0;
+    int compare = 0;
+
+    *found = false;
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        compare =
+            property_compare(&device->properties[middle], object_type,
+            object_instance, object_property, array_index);
+        if (compare == 0) {
+            *found = true;
+            return middle;
+        }
+        if (compare < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static FARM_PROPERTY *property_find(
+    FARM_DEVICE * device,
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance,
+    BACNET_PROPERTY_ID object_property,
+    uint32_t array_index)
+{
+    bool found = false;
+    unsigned i = property_search(device, object_type, object_instance,
+        object_property, array_index, &found);
+
+    return found ? &device->properties[i] : NULL;
+}
+
+/* the value of the property from the time of the packet on, unless the
+   property already had the same */
+static void value_store(
+    FARM_DEVICE * device,
+    uint64_t ns,
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance,
+    BACNET_PROPERTY_ID object_property,
+    uint32_t array_index,
+    uint8_t * data,
+    int len)
+{
+    FARM_PROPERTY *property = NULL;
+    FARM_PROPERTY *properties = NULL;
+    FARM_VALUE *value = NULL;
+    FARM_VALUE *values = NULL;
+    bool found = false;
+    unsigned i = 0;
+
+    if ((len <= 0) || (len > MAX_APDU)) {
+        return;
+    }
+    i = property_search(device, object_type, object_instance,
+        object_property, array_index, &found);
+    if (!found) {
+        if (device->count == device->size) {
+            device->size = device->size ? device->size * 2 : 16;
+            properties =
+                realloc(device->properties,
+                device->size * sizeof(FARM_PROPERTY));
+            if (!properties) {
+                fprintf(stderr, "devfarm: out of memory\n");
+                exit(1);
+            }
+            device->properties = properties;
+        }
+        memmove(&device->properties[i + 1], &device->properties[i],
+            (device->count - i) * sizeof(FARM_PROPERTY));
+        device->count++;
+        property = &device->properties[i];
+        memset(property, 0, sizeof(FARM_PROPERTY));
+        property->object_type = object_type;
+        property->object_instance = object_instance;
+        property->property = object_property;
+        property->array_index = array_index;
+    }
+    property = &device->properties[i];
+    if (property->count) {
+        value = &property->values[property->count - 1];
+        if ((value->len == len) && (memcmp(value->data, data, len) == 0)) {
+            return;
+        }
+    }
+    if (property->count == property->size) {
+        property->size = property->size ? property->size * 2 : 4;
+        values = realloc(property->values, property->size * sizeof(FARM_VALUE));
+        if (!values) {
+            fprintf(stderr, "devfarm: out of memory\n");
+            exit(1);
+        }
+        property->values = values;
+    }
+    value = &property->values[property->count];
+    value->data = malloc(len);
+    if (!value->data) {
+        fprintf(stderr, "devfarm: out of memory\n");
+        exit(1);
+    }
+    memcpy(value->data, data, len);
+    value->len = (uint16_t) len;
+    value->ns = ns;
+    property->count++;
+    Capture_Values++;
+}
+
+/* the values of the properties of a ReadPropertyMultiple ack */
+static void rpm_ack_store(
+    FARM_DEVICE * device,
+    uint64_t ns,
+    uint8_t * apdu,
+    int apdu_len)
+{
+    BACNET_OBJECT_TYPE object_type = OBJECT_DEVICE;
+    uint32_t object_instance = 0;
+    BACNET_PROPERTY_ID object_property = PROP_ALL;
+    uint32_t array_index = BACNET_ARRAY_ALL;
+    int len = 0;
+    int data_len = 0;
+
+    while (apdu_len > 0) {
+        len =
+            rpm_ack_decode_object_id(apdu, apdu_len, &object_type,
+            &object_instance);
+        if (len <= 0) {
+            return;
+        }
+        apdu += len;
+        apdu_len -= len;
+        while ((apdu_len > 0) && !rpm_ack_decode_object_end(apdu, apdu_len)) {
+            len =
+                rpm_ack_decode_object_property(apdu, apdu_len,
+                &object_property, &array_index);
+            if ((len <= 0) || (len >= apdu_len)) {
+                return;
+            }
+            apdu += len;
+            apdu_len -= len;
+            /* the value [4], or the error [5] */
+            data_len = bacapp_data_len(apdu, apdu_len, object_property);
+            if ((data_len < 0) || (data_len + 2 > apdu_len)) {
+                return;
+            }
+            if (decode_is_opening_tag_number(apdu, 4)) {
+                value_store(device, ns, object_type, object_instance,
+                    object_property, array_index, &apdu[1], data_len);
+            }
+            apdu += data_len + 2;
+            apdu_len -= data_len + 2;
+        }
+        /* closing tag 1 */
+        apdu++;
+        apdu_len--;
+    }
+}
+
+/* the values of a COV notification, encoded again */
+static void cov_notification_store(
+    FARM_DEVICE * device,
+    uint64_t ns,
+    uint8_t * apdu,
+    int apdu_len)
+{
+    BACNET_PROPERTY_VALUE values[MAX_COV_VALUES];
+    BACNET_PROPERTY_VALUE *value = NULL;
+    BACNET_COV_DATA data;
+    uint8_t buffer[MAX_APDU];
+    int len = 0;
+
+    cov_data_value_list_link(&data, &values[0], MAX_COV_VALUES);
+    if (cov_notify_decode_service_request(apdu, apdu_len, &data) <= 0) {
+        return;
+    }
+    if (!device->instance_known) {
+        device->instance = data.initiatingDeviceIdentifier;
+        device->instance_known = true;
+    }
+    for (value = data.listOfValues; value; value = value->next) {
+        len = bacapp_encode_application_data(buffer, &value->value);
+        value_store(device, ns, data.monitoredObjectIdentifier.type,
+            data.monitoredObjectIdentifier.instance, value->propertyIdentifier,
+            value->propertyArrayIndex, buffer, len);
+    }
+}
+
+/* the APDUs sent by the devices of the capture */
+static void apdu_store(
+    BACNET_ADDRESS * src,
+    uint64_t ns,
+    uint8_t * apdu,
+    int apdu_len)
+{
+    BACNET_READ_PROPERTY_DATA rpdata;
+    FARM_DEVICE *device = NULL;
+    uint32_t device_id = 0;
+    unsigned max_apdu = 0;
+    int segmentation = 0;
+    uint16_t vendor_id = 0;
+
+    if (apdu_len < 2) {
+        return;
+    }
+    switch (apdu[0] & 0xF0) {
+        case PDU_TYPE_COMPLEX_ACK:
+            /* the segmented acks are not reassembled */
+            if ((apdu_len < 3) || (apdu[0] & BIT3)) {
+                return;
+            }
+            if (apdu[2] == SERVICE_CONFIRMED_READ_PROPERTY) {
+                if (rp_ack_decode_service_request(&apdu[3], apdu_len - 3,
+                        &rpdata) > 0) {
+                    value_store(device_at(src), ns, rpdata.object_type,
+                        rpdata.object_instance, rpdata.object_property,
+                        rpdata.array_index, rpdata.application_data,
+                        rpdata.application_data_len);
+                }
+            } else if (apdu[2] == SERVICE_CONFIRMED_READ_PROP_MULTIPLE) {
+                rpm_ack_store(device_at(src), ns, &apdu[3], apdu_len - 3);
+            }
+            break;
+        case PDU_TYPE_UNCONFIRMED_SERVICE_REQUEST:
+            if (apdu[1] == SERVICE_UNCONFIRMED_I_AM) {
+                if (iam_decode_service_request(&apdu[2], &device_id,
+                        &max_apdu, &segmentation, &vendor_id) > 0) {
+                    device = device_at(src);
+                    device->instance = device_id;
+                    device->instance_known = true;
+                    device->max_apdu = max_apdu;
+                    device->vendor_id = vendor_id;
+                }
+            } else if (apdu[1] == SERVICE_UNCONFIRMED_COV_NOTIFICATION) {
+                cov_notification_store(device_at(src), ns, &apdu[2],
+                    apdu_len - 2);
+            }
+            break;
+        case PDU_TYPE_CONFIRMED_SERVICE_REQUEST:
+            if ((apdu_len > 4) && !(apdu[0] & BIT3) &&
+                (apdu[3] == SERVICE_CONFIRMED_COV_NOTIFICATION)) {
+                cov_notification_store(device_at(src), ns, &apdu[4],
+                    apdu_len - 4);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void npdu_store(
+    BACNET_ADDRESS * src,
+    uint64_t ns,
+    uint8_t * npdu,
+    int npdu_len)
+{
+    BACNET_ADDRESS dest;
+    BACNET_NPDU_DATA npdu_data;
+    int offset = 0;
+
+    if ((npdu_len < 2) || (npdu[0] != BACNET_PROTOCOL_VERSION)) {
+        return;
+    }
+    offset = npdu_decode(npdu, &dest, src, &npdu_data);
+    if ((offset <= 0) || (offset >= npdu_len) ||
+        npdu_data.network_layer_message) {
+        return;
+    }
+    apdu_store(src, ns, &npdu[offset], npdu_len - offset);
+}
+
+/* the NPDU of a BACnet/IP packet, from its IPv4 header on */
+static void ip_store(
+    uint64_t ns,
+    uint8_t * packet,
+    uint32_t len)
+{
+    BACNET_ADDRESS src;
+    uint32_t ihl = 0;
+    uint8_t *udp = NULL;
+    uint8_t *bvlc = NULL;
+    uint32_t bvlc_len = 0;
+
+    if ((len < 20) || ((packet[0] >> 4) != 4) || (packet[9] != 17)) {
+        return;
+    }
+    ihl = (packet[0] & 0x0F) * 4;
+    if (len < ihl + 8 + 4) {
+        return;
+    }
+    udp = &packet[ihl];
+    bvlc = &udp[8];
+    bvlc_len = len - ihl - 8;
+    if (bvlc[0] != BVLL_TYPE_BACNET_IP) {
+        return;
+    }
+    memset(&src, 0, sizeof(src));
+    src.mac_len = 6;
+    memcpy(&src.mac[0], &packet[12], 4);
+    memcpy(&src.mac[4], &udp[0], 2);
+    switch (bvlc[1]) {
+        case BVLC_ORIGINAL_UNICAST_NPDU:
+        case BVLC_ORIGINAL_BROADCAST_NPDU:
+            npdu_store(&src, ns, &bvlc[4], bvlc_len - 4);
+            break;
+        case BVLC_FORWARDED_NPDU:
+            /* from the original source */
+            if (bvlc_len > 10) {
+                memcpy(&src.mac[0], &bvlc[4], 6);
+                npdu_store(&src, ns, &bvlc[10], bvlc_len - 10);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* a packet of the capture, of the data link type */
+static void packet_store(
+    uint32_t linktype,
+    uint64_t ns,
+    uint8_t * packet,
+    uint32_t len)
+{
+    BACNET_ADDRESS src;
+    uint32_t offset = 0;
+    uint16_t type = 0;
+    uint32_t data_len = 0;
+
+    Capture_Packets++;
+    if (!Capture_First_ns) {
+        Capture_First_ns = ns;
+    }
+    if (ns < Capture_First_ns) {
+        ns = Capture_First_ns;
+    }
+    ns -= Capture_First_ns;
+    if (ns > Capture_Duration_ns) {
+        Capture_Duration_ns = ns;
+    }
+    memset(&src, 0, sizeof(src));
+    switch (linktype) {
+        case DLT_BACNET_MS_TP:
+            /* preamble, frame type, destination, source, length, CRC */
+            if ((len < 8) || ((packet[2] != MSTP_DATA_EXPECTING_REPLY) &&
+                    (packet[2] != MSTP_DATA_NOT_EXPECTING_REPLY))) {
+                return;
+            }
+            data_len = ((uint32_t) packet[5] << 8) | packet[6];
+            if (len < 8 + data_len) {
+                return;
+            }
+            src.mac_len = 1;
+            src.mac[0] = packet[4];
+            npdu_store(&src, ns, &packet[8], data_len);
+            break;
+        case DLT_EN10MB:
+            if (len < 14) {
+                return;
+            }
+            offset = 12;
+            type = ((uint16_t) packet[offset] << 8) | packet[offset + 1];
+            if ((type == 0x8100) && (len >= 18)) {
+                offset += 4;
+                type = ((uint16_t) packet[offset] << 8) | packet[offset + 1];
+            }
+            offset += 2;
+            if (type == 0x0800) {
+                ip_store(ns, &packet[offset], len - offset);
+            } else if ((type <= 1500) && (len > offset + 3) &&
+                (packet[offset] == 0x82) && (packet[offset + 1] == 0x82)) {
+                /* BACnet Ethernet: the 802.2 LLC header, then the NPDU */
+                src.mac_len = 6;
+                memcpy(&src.mac[0], &packet[6], 6);
+                npdu_store(&src, ns, &packet[offset + 3], len - offset - 3);
+            }
+            break;
+        case DLT_LINUX_SLL:
+            if ((len > 16) && (packet[14] == 0x08) && (packet[15] == 0x00)) {
+                ip_store(ns, &packet[16], len - 16);
+            }
+            break;
+        case DLT_RAW:
+            ip_store(ns, packet, len);
+            break;
+        default:
+            break;
+    }
+}
+
+static uint16_t decode_host_u16(
+    uint8_t * buffer)
+{
+    uint16_t value = 0;
+
+    memcpy(&value, buffer, sizeof(value));
+    return value;
+}
+
+static uint32_t decode_host_u32(
+    uint8_t * buffer)
+{
+    uint32_t value = 0;
+
+    memcpy(&value, buffer, sizeof(value));
+    return value;
+}
+
+static uint8_t Packet_Buffer[65536 + 64];
+
+/* the packets of a libpcap capture, its global header already read */
+static bool pcap_load(
+    FILE * file,
+    uint32_t magic_number)
+{
+    uint32_t header[5] = { 0 }; /* version, zone, sigfigs, snaplen and
+                                   data link type */
+    uint32_t record[4] = { 0 }; /* seconds, fraction, included length
+                                   and original length */
+    uint64_t units = (magic_number == 0xa1b23c4d) ? 1 : 1000;
+
+    if (fread(header, sizeof(header), 1, file) != 1) {
+        return false;
+    }
+    while (fread(record, sizeof(record), 1, file) == 1) {
+        if ((record[2] > sizeof(Packet_Buffer)) ||
+            ((record[2] > 0) &&
+                (fread(Packet_Buffer, record[2], 1, file) != 1))) {
+            fprintf(stderr, "devfarm: truncated packet\n");
+            break;
+        }
+        packet_store(header[4], (uint64_t) record[0] * 1000000000ULL +
+            (uint64_t) record[1] * units, Packet_Buffer, record[2]);
+    }
+
+    return true;
+}
+
+/* the Enhanced Packet Blocks of a pcapng capture, of every interface */
+static bool pcapng_load(
+    FILE * file)
+{
+    uint32_t linktype[PCAPNG_MAX_INTERFACES] = { 0 };
+    uint64_t units[PCAPNG_MAX_INTERFACES] = { 0 };
+    unsigned interfaces = 0;
+    uint32_t block[2] = { 0 };  /* block type and total length */
+    uint32_t len = 0;
+    uint32_t offset = 0;
+    uint32_t iface = 0;
+    uint32_t packet_len = 0;
+    uint16_t code = 0;
+    uint16_t option_len = 0;
+    uint64_t ts = 0;
+    uint8_t tsresol = 0;
+
+    while (fread(block, sizeof(block), 1, file) == 1) {
+        if ((block[1] < 12) || ((block[1] - 8) > sizeof(Packet_Buffer))) {
+            fprintf(stderr, "devfarm: invalid block length\n");
+            return false;
+        }
+        len = block[1] - 8;
+        if (fread(Packet_Buffer, len, 1, file) != 1) {
+            break;
+        }
+        if (block[0] == PCAPNG_SECTION_HEADER) {
+            /* the interfaces are numbered again in each section */
+            interfaces = 0;
+        } else if ((block[0] == PCAPNG_INTERFACE_DESCRIPTION) && (len >= 12)) {
+            if (interfaces == PCAPNG_MAX_INTERFACES) {
+                continue;
+            }
+            linktype[interfaces] = decode_host_u16(&Packet_Buffer[0]);
+            /* microseconds, unless if_tsresol says otherwise */
+            units[interfaces] = 1000000;
+            for (offset = 8; offset + 4 <= len - 4;
+                offset += 4 + ((option_len + 3) & ~3)) {
+                code = decode_host_u16(&Packet_Buffer[offset]);
+                option_len = decode_host_u16(&Packet_Buffer[offset + 2]);
+                if (code == 0) {
+                    break;
+                }
+                if ((code == PCAPNG_OPTION_IF_TSRESOL) && (option_len >= 1)) {
+                    tsresol = Packet_Buffer[offset + 4];
+                    if (tsresol & 0x80) {
+                        units[interfaces] = 1ULL << (tsresol & 0x3F);
+                    } else {
+                        for (units[interfaces] = 1; tsresol > 0; tsresol--) {
+                            units[interfaces] *= 10;
+                        }
+                    }
+                }
+            }
+            interfaces++;
+        } else if ((block[0] == PCAPNG_ENHANCED_PACKET) && (len >= 24)) {
+            iface = decode_host_u32(&Packet_Buffer[0]);
+            packet_len = decode_host_u32(&Packet_Buffer[12]);
+            if ((iface >= interfaces) || (packet_len > len - 24)) {
+                continue;
+            }
+            ts = ((uint64_t) decode_host_u32(&Packet_Buffer[4]) << 32) |
+                decode_host_u32(&Packet_Buffer[8]);
+            packet_store(linktype[iface],
+                (ts / units[iface]) * 1000000000ULL +
+                (ts % units[iface]) * 1000000000ULL / units[iface],
+                &Packet_Buffer[20], packet_len);
+        }
+    }
+
+    return true;
+}
+
+static bool capture_load(
+    const char *filename)
+{
+    FILE *file = NULL;
+    uint32_t magic_number = 0;
+    bool status = false;
+
+    file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "devfarm: failed to open %s: %s\n", filename,
+            strerror(errno));
+        return false;
+    }
+    if (fread(&magic_number, sizeof(magic_number), 1, file) == 1) {
+        if (magic_number == PCAPNG_SECTION_HEADER) {
+            fseek(file, 0, SEEK_SET);
+            status = pcapng_load(file);
+        } else if ((magic_number == 0xa1b2c3d4) ||
+            (magic_number == 0xa1b23c4d)) {
+            status = pcap_load(file, magic_number);
+        } else {
+            fprintf(stderr, "devfarm: %s is not a pcap or pcapng capture "
+                "of this byte order\n", filename);
+        }
+    }
+    fclose(file);
+
+    return status;
+}
+
+/* the devices of the capture without an I-Am or a COV notification are
+   known by their Device object, if it was read */
+static void devices_resolve(
+    void)
+{
+    FARM_DEVICE *device = NULL;
+    unsigned i = 0;
+    unsigned j = 0;
+
+    for (i = 0; i < Device_Count; i++) {
+        device = &Devices[i];
+        for (j = 0; !device->instance_known && (j < device->count); j++) {
+            if (device->properties[j].object_type == OBJECT_DEVICE) {
+                device->instance = device->properties[j].object_instance;
+                device->instance_known = true;
+            }
+        }
+        if (!device->instance_known && device->count) {
+            fprintf(stderr, "devfarm: the device of %u properties at MAC "
+                "%02X... has no known instance, skipped\n", device->count,
+                device->address.mac[0]);
+        }
+    }
+}
+
+/* the devices of the farm: each device of the capture, then the copies */
+static bool nodes_create(
+    unsigned copies,
+    uint32_t offset)
+{
+    unsigned copy = 0;
+    unsigned i = 0;
+    uint32_t instance = 0;
+
+    Nodes = calloc((size_t) copies * (Device_Count ? Device_Count : 1),
+        sizeof(FARM_NODE));
+    if (!Nodes) {
+        return false;
+    }
+    for (copy = 0; copy < copies; copy++) {
+        for (i = 0; i < Device_Count; i++) {
+            if (!Devices[i].instance_known || !Devices[i].count) {
+                continue;
+            }
+            instance = Devices[i].instance + copy * offset;
+            if ((instance >= BACNET_MAX_INSTANCE) ||
+                (Node_Count == FARM_MAX_NODES)) {
+                fprintf(stderr, "devfarm: only %u devices fit\n",
+                    Node_Count);
+                return true;
+            }
+            Nodes[Node_Count].device = &Devices[i];
+            Nodes[Node_Count].instance = instance;
+            Node_Count++;
+        }
+    }
+
+    return true;
+}
+
+/* where the capture is now, looping at its end */
+static uint64_t replay_position(
+    uint64_t now)
+{
+    uint64_t position = (uint64_t) ((double) (now - Start_ns) * Speed);
+
+    if (Loop) {
+        return position % (Capture_Duration_ns + 1);
+    }
+    return position > Capture_Duration_ns ? Capture_Duration_ns : position;
+}
+
+/* the value the property had at the position, its first one before it
+   was seen */
+static unsigned value_index(
+    FARM_PROPERTY * property,
+    uint64_t position)
+{
+    unsigned low = 0;
+    unsigned high = property->count;
+    unsigned middle = 0;
+
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (property->values[middle].ns <= position) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low ? low - 1 : 0;
+}
+
+static FARM_VALUE *value_now(
+    FARM_PROPERTY * property,
+    uint64_t position)
+{
+    return &property->values[value_index(property, position)];
+}
+
+/* the address of the node on the virtual network */
+static void node_address(
+    FARM_NODE * node,
+    BACNET_ADDRESS * address)
+{
+    unsigned mac = (unsigned) (node - Nodes) + 1;
+
+    memset(address, 0, sizeof(BACNET_ADDRESS));
+    address->net = Virtual_Network;
+    address->len = FARM_MAC_LEN;
+    address->adr[0] = (uint8_t) (mac >> 8);
+    address->adr[1] = (uint8_t) mac;
+}
+
+static FARM_NODE *node_at(
+    BACNET_ADDRESS * dest)
+{
+    unsigned mac = 0;
+
+    if ((dest->net != Virtual_Network) || (dest->len != FARM_MAC_LEN)) {
+        return NULL;
+    }
+    mac = ((unsigned) dest->adr[0] << 8) | dest->adr[1];
+    if ((mac == 0) || (mac > Node_Count)) {
+        return NULL;
+    }
+
+    return &Nodes[mac - 1];
+}
+
+/* the APDU from the node, already in Tx_Buf after the room for the
+   NPDU header */
+static void node_send(
+    FARM_NODE * node,
+    BACNET_ADDRESS * dest,
+    bool expecting_reply,
+    unsigned apdu_len)
+{
+    BACNET_ADDRESS src;
+    BACNET_NPDU_DATA npdu_data;
+    uint8_t header[MAX_NPDU];
+    int header_len = 0;
+
+    node_address(node, &src);
+    npdu_encode_npdu_data(&npdu_data, expecting_reply, MESSAGE_PRIORITY_NORMAL);
+    header_len = npdu_encode_pdu(&header[0], dest, &src, &npdu_data);
+    memcpy(&Tx_Buf[MAX_NPDU - header_len], header, header_len);
+    datalink_send_pdu(dest, &npdu_data, &Tx_Buf[MAX_NPDU - header_len],
+        header_len + apdu_len);
+}
+
+/* the APDU of the answers, after the room for the NPDU header */
+#define TX_APDU (&Tx_Buf[MAX_NPDU])
+
+static void node_send_i_am(
+    FARM_NODE * node,
+    BACNET_ADDRESS * dest)
+{
+    unsigned max_apdu = node->device->max_apdu;
+    int len = 0;
+
+    if ((max_apdu == 0) || (max_apdu > MAX_APDU)) {
+        max_apdu = MAX_APDU;
+    }
+    len = iam_encode_apdu(TX_APDU, node->instance, max_apdu,
+        SEGMENTATION_NONE, node->device->vendor_id);
+    node_send(node, dest, false, len);
+}
+
+/* every node in the range answers, to the requester, rather than by
+   broadcast */
+static void who_is_handler(
+    BACNET_ADDRESS * src,
+    uint8_t * service_request,
+    int service_len)
+{
+    int32_t low_limit = -1;
+    int32_t high_limit = -1;
+    unsigned i = 0;
+
+    Stats.who_is++;
+    if (service_len > 0) {
+        if (whois_decode_service_request(service_request, service_len,
+                &low_limit, &high_limit) <= 0) {
+            return;
+        }
+    }
+    bip_send_batch_begin();
+    for (i = 0; i < Node_Count; i++) {
+        if ((low_limit == -1) || ((Nodes[i].instance >= (uint32_t) low_limit)
+                && (Nodes[i].instance <= (uint32_t) high_limit))) {
+            node_send_i_am(&Nodes[i], src);
+        }
+    }
+    bip_send_batch_end();
+}
+
+/* the object the request names, with the wildcard of the Device object */
+static uint32_t node_object_instance(
+    FARM_NODE * node,
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    if (object_type == OBJECT_DEVICE) {
+        if ((object_instance == BACNET_MAX_INSTANCE) ||
+            (object_instance == node->instance)) {
+            return node->device->instance;
+        }
+    }
+
+    return object_instance;
+}
+
+static void read_property_handler(
+    FARM_NODE * node,
+    BACNET_ADDRESS * src,
+    uint8_t invoke_id,
+    unsigned max_apdu,
+    uint8_t * service_request,
+    int service_len,
+    uint64_t position)
+{
+    BACNET_READ_PROPERTY_DATA rpdata;
+    FARM_PROPERTY *property = NULL;
+    FARM_VALUE *value = NULL;
+    uint32_t object_instance = 0;
+    int len = 0;
+
+    Stats.read_property++;
+    if (rp_decode_service_request(service_request, service_len,
+            &rpdata) <= 0) {
+        len = reject_encode_apdu(TX_APDU, invoke_id,
+            REJECT_REASON_MISSING_REQUIRED_PARAMETER);
+        node_send(node, src, false, len);
+        return;
+    }
+    object_instance =
+        node_object_instance(node, rpdata.object_type, rpdata.object_instance);
+    property = property_find(node->device, rpdata.object_type,
+        object_instance, rpdata.object_property, rpdata.array_index);
+    if (!property) {
+        Stats.unknown++;
+        len = bacerror_encode_apdu(TX_APDU, invoke_id,
+            SERVICE_CONFIRMED_READ_PROPERTY, ERROR_CLASS_PROPERTY,
+            ERROR_CODE_UNKNOWN_PROPERTY);
+        node_send(node, src, false, len);
+        return;
+    }
+    value = value_now(property, position);
+    if ((int) value->len + 16 > (int) max_apdu) {
+        Stats.aborts++;
+        len = abort_encode_apdu(TX_APDU, invoke_id,
+            ABORT_REASON_SEGMENTATION_NOT_SUPPORTED, true);
+        node_send(node, src, false, len);
+        return;
+    }
+    Stats.values++;
+    if (rpdata.object_type == OBJECT_DEVICE) {
+        rpdata.object_instance = node->instance;
+    }
+    len = rp_ack_encode_apdu_init(TX_APDU, invoke_id, &rpdata);
+    memcpy(&TX_APDU[len], value->data, value->len);
+    len += value->len;
+    len += rp_ack_encode_apdu_object_property_end(&TX_APDU[len]);
+    node_send(node, src, false, len);
+}
+
+/* one property of the ack, or its error */
+static int rpm_ack_encode_property(
+    uint8_t * apdu,
+    FARM_PROPERTY * property,
+    BACNET_PROPERTY_ID object_property,
+    uint32_t array_index,
+    uint64_t position)
+{
+    FARM_VALUE *value = NULL;
+    int len = 0;
+
+    len = rpm_ack_encode_apdu_object_property(apdu, object_property,
+        array_index);
+    if (!property) {
+        Stats.unknown++;
+        return len + rpm_ack_encode_apdu_object_property_error(&apdu[len],
+            ERROR_CLASS_PROPERTY, ERROR_CODE_UNKNOWN_PROPERTY);
+    }
+    Stats.values++;
+    value = value_now(property, position);
+
+    return len + rpm_ack_encode_apdu_object_property_value(&apdu[len],
+        value->data, value->len);
+}
+
+/* the ack is encoded in Ack_Buf, and aborted if it doesn't fit the
+   requester: the devices of the farm don't segment */
+static void read_property_multiple_handler(
+    FARM_NODE * node,
+    BACNET_ADDRESS * src,
+    uint8_t invoke_id,
+    unsigned max_apdu,
+    uint8_t * service_request,
+    int service_len,
+    uint64_t position)
+{
+    BACNET_RPM_DATA rpmdata;
+    FARM_DEVICE *device = node->device;
+    FARM_PROPERTY *property = NULL;
+    uint32_t object_instance = 0;
+    bool found = false;
+    unsigned i = 0;
+    int decoded = 0;
+    int len = 0;
+    int apdu_len = 0;
+    int limit = sizeof(Ack_Buf) - 64;
+
+    Stats.read_property_multiple++;
+    apdu_len = rpm_ack_encode_apdu_init(Ack_Buf, invoke_id);
+    while ((decoded < service_len) && (apdu_len < limit)) {
+        len = rpm_decode_object_id(&service_request[decoded],
+            service_len - decoded, &rpmdata);
+        if (len <= 0) {
+            break;
+        }
+        decoded += len;
+        object_instance = node_object_instance(node, rpmdata.object_type,
+            rpmdata.object_instance);
+        rpmdata.object_instance = (rpmdata.object_type == OBJECT_DEVICE) ?
+            node->instance : rpmdata.object_instance;
+        apdu_len += rpm_ack_encode_apdu_object_begin(&Ack_Buf[apdu_len],
+            &rpmdata);
+        while ((decoded < service_len) &&
+            !rpm_decode_object_end(&service_request[decoded],
+                service_len - decoded) && (apdu_len < limit)) {
+            len = rpm_decode_object_property(&service_request[decoded],
+                service_len - decoded, &rpmdata);
+            if (len <= 0) {
+                decoded = service_len;
+                break;
+            }
+            decoded += len;
+            if ((rpmdata.object_property == PROP_ALL) ||
+                (rpmdata.object_property == PROP_REQUIRED) ||
+                (rpmdata.object_property == PROP_OPTIONAL)) {
+                /* every property of the capture of the object */
+                i = property_search(device, rpmdata.object_type,
+                    object_instance, 0, 0, &found);
+                for (; (i < device->count) && (apdu_len < limit); i++) {
+                    property = &device->properties[i];
+                    if ((property->object_type != rpmdata.object_type) ||
+                        (property->object_instance != object_instance)) {
+                        break;
+                    }
+                    apdu_len += rpm_ack_encode_property(&Ack_Buf[apdu_len],
+                        property, property->property, property->array_index,
+                        position);
+                }
+            } else {
+                property = property_find(device, rpmdata.object_type,
+                    object_instance, rpmdata.object_property,
+                    rpmdata.array_index);
+                apdu_len += rpm_ack_encode_property(&Ack_Buf[apdu_len],
+                    property, rpmdata.object_property, rpmdata.array_index,
+                    position);
+            }
+        }
+        /* closing tag 1 */
+        decoded++;
+        apdu_len += rpm_ack_encode_apdu_object_end(&Ack_Buf[apdu_len]);
+    }
+    if ((apdu_len > (int) max_apdu) || (apdu_len >= limit)) {
+        Stats.aborts++;
+        len = abort_encode_apdu(TX_APDU, invoke_id,
+            ABORT_REASON_SEGMENTATION_NOT_SUPPORTED, true);
+        node_send(node, src, false, len);
+        return;
+    }
+    memcpy(TX_APDU, Ack_Buf, apdu_len);
+    node_send(node, src, false, apdu_len);
+}
+
+static FARM_SUBSCRIPTION *subscription_find(
+    BACNET_ADDRESS * subscriber,
+    FARM_NODE * node,
+    BACNET_SUBSCRIBE_COV_DATA * data,
+    BACNET_PROPERTY_ID object_property)
+{
+    FARM_SUBSCRIPTION *subscription = NULL;
+    unsigned i = 0;
+
+    for (i = 0; i < Subscription_Count; i++) {
+        subscription = &Subscriptions[i];
+        if ((subscription->node == node) &&
+            (subscription->process_id == data->subscriberProcessIdentifier) &&
+            (subscription->object_type == data->monitoredObjectIdentifier.type)
+            && (subscription->object_instance ==
+                data->monitoredObjectIdentifier.instance) &&
+            (subscription->properties[0]->property == object_property) &&
+            address_same(&subscription->subscriber, subscriber)) {
+            return subscription;
+        }
+    }
+
+    return NULL;
+}
+
+/* SubscribeCOV and SubscribeCOVProperty: the subscription is replaced
+   or cancelled, and notified at once of the values it monitors */
+static void subscribe_cov_handler(
+    FARM_NODE * node,
+    BACNET_ADDRESS * src,
+    uint8_t invoke_id,
+    uint8_t service_choice,
+    uint8_t * service_request,
+    int service_len,
+    uint64_t now)
+{
+    BACNET_SUBSCRIBE_COV_DATA data;
+    FARM_SUBSCRIPTION *subscription = NULL;
+    FARM_SUBSCRIPTION *subscriptions = NULL;
+    FARM_PROPERTY *properties[2] = { NULL, NULL };
+    BACNET_PROPERTY_ID object_property = PROP_PRESENT_VALUE;
+    uint32_t array_index = BACNET_ARRAY_ALL;
+    uint32_t object_instance = 0;
+    unsigned count = 0;
+    int len = 0;
+
+    Stats.subscriptions++;
+    memset(&data, 0, sizeof(data));
+    if (service_choice == SERVICE_CONFIRMED_SUBSCRIBE_COV_PROPERTY) {
+        len = cov_subscribe_property_decode_service_request(service_request,
+            service_len, &data);
+        object_property = data.monitoredProperty.propertyIdentifier;
+        array_index = data.monitoredProperty.propertyArrayIndex;
+    } else {
+        len = cov_subscribe_decode_service_request(service_request,
+            service_len, &data);
+    }
+    if (len <= 0) {
+        len = reject_encode_apdu(TX_APDU, invoke_id,
+            REJECT_REASON_MISSING_REQUIRED_PARAMETER);
+        node_send(node, src, false, len);
+        return;
+    }
+    object_instance = node_object_instance(node,
+        data.monitoredObjectIdentifier.type,
+        data.monitoredObjectIdentifier.instance);
+    properties[0] = property_find(node->device,
+        data.monitoredObjectIdentifier.type, object_instance, object_property,
+        array_index);
+    count = properties[0] ? 1 : 0;
+    if (count && (service_choice == SERVICE_CONFIRMED_SUBSCRIBE_COV)) {
+        properties[1] = property_find(node->device,
+            data.monitoredObjectIdentifier.type, object_instance,
+            PROP_STATUS_FLAGS, BACNET_ARRAY_ALL);
+        count = properties[1] ? 2 : 1;
+    }
+    if (!count) {
+        Stats.unknown++;
+        len = bacerror_encode_apdu(TX_APDU, invoke_id, service_choice,
+            ERROR_CLASS_OBJECT, ERROR_CODE_UNKNOWN_OBJECT);
+        node_send(node, src, false, len);
+        return;
+    }
+    subscription = subscription_find(src, node, &data, object_property);
+    if (data.cancellationRequest) {
+        if (subscription) {
+            *subscription = Subscriptions[--Subscription_Count];
+        }
+    } else {
+        if (!subscription) {
+            if (Subscription_Count == Subscription_Size) {
+                Subscription_Size =
+                    Subscription_Size ? Subscription_Size * 2 : 64;
+                subscriptions =
+                    realloc(Subscriptions,
+                    Subscription_Size * sizeof(FARM_SUBSCRIPTION));
+                if (!subscriptions) {
+                    len = bacerror_encode_apdu(TX_APDU, invoke_id,
+                        service_choice, ERROR_CLASS_RESOURCES,
+                        ERROR_CODE_NO_SPACE_TO_ADD_LIST_ELEMENT);
+                    node_send(node, src, false, len);
+                    return;
+                }
+                Subscriptions = subscriptions;
+            }
+            subscription = &Subscriptions[Subscription_Count++];
+        }
+        memset(subscription, 0, sizeof(FARM_SUBSCRIPTION));
+        subscription->subscriber = *src;
+        subscription->process_id = data.subscriberProcessIdentifier;
+        subscription->node = node;
+        subscription->object_type = data.monitoredObjectIdentifier.type;
+        subscription->object_instance =
+            data.monitoredObjectIdentifier.instance;
+        subscription->count = count;
+        subscription->properties[0] = properties[0];
+        subscription->properties[1] = properties[1];
+        /* the first notification goes out with the next check */
+        subscription->notified[0] = properties[0]->count;
+        subscription->notified[1] = properties[1] ? properties[1]->count : 0;
+        subscription->confirmed = data.issueConfirmedNotifications;
+        subscription->lifetime = data.lifetime;
+        subscription->expires_ns = data.lifetime ?
+            now + (uint64_t) data.lifetime * 1000000000ULL : 0;
+    }
+    len = encode_simple_ack(TX_APDU, invoke_id, service_choice);
+    node_send(node, src, false, len);
+}
+
+static void cov_notify(
+    FARM_SUBSCRIPTION * subscription,
+    uint64_t now,
+    uint64_t position)
+{
+    BACNET_PROPERTY_VALUE values[2];
+    BACNET_COV_DATA data;
+    FARM_VALUE *value = NULL;
+    unsigned i = 0;
+    int len = 0;
+
+    data.subscriberProcessIdentifier = subscription->process_id;
+    data.initiatingDeviceIdentifier = subscription->node->instance;
+    data.monitoredObjectIdentifier.type = subscription->object_type;
+    data.monitoredObjectIdentifier.instance = subscription->object_instance;
+    data.timeRemaining = subscription->expires_ns ?
+        (uint32_t) ((subscription->expires_ns - now) / 1000000000ULL) : 0;
+    cov_data_value_list_link(&data, &values[0], subscription->count);
+    for (i = 0; i < subscription->count; i++) {
+        value = value_now(subscription->properties[i], position);
+        values[i].propertyIdentifier = subscription->properties[i]->property;
+        values[i].propertyArrayIndex =
+            subscription->properties[i]->array_index;
+        values[i].priority = BACNET_NO_PRIORITY;
+        if (bacapp_decode_application_data(value->data, value->len,
+                &values[i].value) <= 0) {
+            return;
+        }
+    }
+    if (subscription->confirmed) {
+        /* the acks are not waited for */
+        len = ccov_notify_encode_apdu(TX_APDU, ++Invoke_ID, &data);
+    } else {
+        len = ucov_notify_encode_apdu(TX_APDU, &data);
+    }
+    Stats.notifications++;
+    node_send(subscription->node, &subscription->subscriber,
+        subscription->confirmed, len);
+}
+
+/* the subscriptions whose values changed at the position are notified,
+   the ones that expired are dropped */
+static void cov_task(
+    uint64_t now,
+    uint64_t position)
+{
+    FARM_SUBSCRIPTION *subscription = NULL;
+    unsigned index[2] = { 0, 0 };
+    unsigned i = 0;
+    unsigned j = 0;
+    bool changed = false;
+
+    bip_send_batch_begin();
+    i = 0;
+    while (i < Subscription_Count) {
+        subscription = &Subscriptions[i];
+        if (subscription->expires_ns && (subscription->expires_ns <= now)) {
+            *subscription = Subscriptions[--Subscription_Count];
+            continue;
+        }
+        changed = false;
+        for (j = 0; j < subscription->count; j++) {
+            index[j] = value_index(subscription->properties[j], position);
+            if (index[j] != subscription->notified[j]) {
+                changed = true;
+            }
+        }
+        if (changed) {
+            cov_notify(subscription, now, position);
+            for (j = 0; j < subscription->count; j++) {
+                subscription->notified[j] = index[j];
+            }
+        }
+        i++;
+    }
+    bip_send_batch_end();
+}
+
+static void confirmed_request_handler(
+    FARM_NODE * node,
+    BACNET_ADDRESS * src,
+    uint8_t * apdu,
+    int apdu_len,
+    uint64_t now)
+{
+    uint8_t invoke_id = 0;
+    uint8_t service_choice = 0;
+    unsigned max_apdu = 0;
+    uint64_t position = replay_position(now);
+    int len = 0;
+
+    if (apdu_len < 4) {
+        return;
+    }
+    max_apdu = decode_max_apdu(apdu[1]);
+    if ((max_apdu == 0) || (max_apdu > MAX_APDU)) {
+        max_apdu = MAX_APDU;
+    }
+    invoke_id = apdu[2];
+    service_choice = apdu[3];
+    node->requests++;
+    if (apdu[0] & BIT3) {
+        /* the segmented requests are not reassembled */
+        Stats.aborts++;
+        len = abort_encode_apdu(TX_APDU, invoke_id,
+            ABORT_REASON_SEGMENTATION_NOT_SUPPORTED, true);
+        node_send(node, src, false, len);
+        return;
+    }
+    switch (service_choice) {
+        case SERVICE_CONFIRMED_READ_PROPERTY:
+            read_property_handler(node, src, invoke_id, max_apdu, &apdu[4],
+                apdu_len - 4, position);
+            break;
+        case SERVICE_CONFIRMED_READ_PROP_MULTIPLE:
+            read_property_multiple_handler(node, src, invoke_id, max_apdu,
+                &apdu[4], apdu_len - 4, position);
+            break;
+        case SERVICE_CONFIRMED_SUBSCRIBE_COV:
+        case SERVICE_CONFIRMED_SUBSCRIBE_COV_PROPERTY:
+            subscribe_cov_handler(node, src, invoke_id, service_choice,
+                &apdu[4], apdu_len - 4, now);
+            break;
+        case SERVICE_CONFIRMED_WRITE_PROPERTY:
+        case SERVICE_CONFIRMED_WRITE_PROP_MULTIPLE:
+            /* accepted, the values keep playing back */
+            Stats.writes++;
+            len = encode_simple_ack(TX_APDU, invoke_id, service_choice);
+            node_send(node, src, false, len);
+            break;
+        default:
+            Stats.rejects++;
+            len = reject_encode_apdu(TX_APDU, invoke_id,
+                REJECT_REASON_UNRECOGNIZED_SERVICE);
+            node_send(node, src, false, len);
+            break;
+    }
+}
+
+static void npdu_handler(
+    BACNET_ADDRESS * src,
+    uint8_t * pdu,
+    uint16_t pdu_len,
+    uint64_t now)
+{
+    BACNET_ADDRESS dest;
+    BACNET_NPDU_DATA npdu_data;
+    FARM_NODE *node = NULL;
+    uint8_t *apdu = NULL;
+    int apdu_len = 0;
+    int offset = 0;
+
+    if ((pdu_len < 2) || (pdu[0] != BACNET_PROTOCOL_VERSION)) {
+        return;
+    }
+    offset = npdu_decode(pdu, &dest, src, &npdu_data);
+    if ((offset <= 0) || (offset >= pdu_len) ||
+        npdu_data.network_layer_message) {
+        return;
+    }
+    apdu = &pdu[offset];
+    apdu_len = pdu_len - offset;
+    Stats.requests++;
+    switch (apdu[0] & 0xF0) {
+        case PDU_TYPE_UNCONFIRMED_SERVICE_REQUEST:
+            if ((apdu_len >= 2) && (apdu[1] == SERVICE_UNCONFIRMED_WHO_IS) &&
+                ((dest.net == 0) || (dest.net == BACNET_BROADCAST_NETWORK) ||
+                    (dest.net == Virtual_Network))) {
+                who_is_handler(src, &apdu[2], apdu_len - 2);
+            }
+            break;
+        case PDU_TYPE_CONFIRMED_SERVICE_REQUEST:
+            node = node_at(&dest);
+            if (node) {
+                confirmed_request_handler(node, src, apdu, apdu_len, now);
+            } else {
+                Stats.unrouted++;
+            }
+            break;
+        default:
+            /* the acks of the confirmed notifications */
+            break;
+    }
+}
+
+static char *Metrics_Host = NULL;
+static char *Metrics_Port = NULL;
+static char *Metrics_Path = "/metrics";
+static char Metrics_Buffer[METRICS_BUFFER_SIZE];
+
+/* host:port[/path], after an optional http:// */
+static bool metrics_url_parse(
+    char *url)
+{
+    char *slash = NULL;
+    char *colon = NULL;
+
+    if (strncmp(url, "http://", 7) == 0) {
+        url += 7;
+    }
+    slash = strchr(url, '/');
+    if (slash) {
+        Metrics_Path = strdup(slash);
+        *slash = 0;
+    }
+    colon = strrchr(url, ':');
+    if (!colon) {
+        return false;
+    }
+    *colon = 0;
+    Metrics_Host = url;
+    Metrics_Port = colon + 1;
+
+    return true;
+}
+
+/* the response of the endpoint into Metrics_Buffer, 0 if it failed */
+static int metrics_fetch(
+    void)
+{
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+    struct pollfd pfd;
+    int fd = -1;
+    int len = 0;
+    int received = 0;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(Metrics_Host, Metrics_Port, &hints, &result) != 0) {
+        return 0;
+    }
+    fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if ((fd < 0) ||
+        (connect(fd, result->ai_addr, result->ai_addrlen) != 0)) {
+        freeaddrinfo(result);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+    freeaddrinfo(result);
+    len = snprintf(Metrics_Buffer, sizeof(Metrics_Buffer),
+        "GET %s HTTP/1.0\r\nHost: %s\r\n\r\n", Metrics_Path, Metrics_Host);
+    if (send(fd, Metrics_Buffer, len, 0) != len) {
+        close(fd);
+        return 0;
+    }
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (received < (int) sizeof(Metrics_Buffer) - 1) {
+        if (poll(&pfd, 1, METRICS_TIMEOUT_MS) <= 0) {
+            break;
+        }
+        len = recv(fd, &Metrics_Buffer[received],
+            sizeof(Metrics_Buffer) - 1 - received, 0);
+        if (len <= 0) {
+            break;
+        }
+        received += len;
+    }
+    close(fd);
+    Metrics_Buffer[received] = 0;
+
+    return received;
+}
+
+/* the cumulative buckets of a histogram, in the order of the text */
+static void metrics_bucket(
+    char *line,
+    double value,
+    double *le,
+    double *counts,
+    unsigned *count)
+{
+    char *bound = strstr(line, "le=\"");
+
+    if (!bound || (*count == METRICS_MAX_BUCKETS)) {
+        return;
+    }
+    bound += 4;
+    le[*count] = (strncmp(bound, "+Inf", 4) == 0) ? -1 : atof(bound);
+    counts[*count] = value;
+    (*count)++;
+}
+
+static bool metrics_scrape(
+    GATEWAY_METRICS * metrics)
+{
+    char *line = NULL;
+    char *next = NULL;
+    char *value = NULL;
+    double number = 0;
+
+    memset(metrics, 0, sizeof(GATEWAY_METRICS));
+    if (!Metrics_Host || !metrics_fetch()) {
+        return false;
+    }
+    line = strstr(Metrics_Buffer, "\r\n\r\n");
+    line = line ? line + 4 : Metrics_Buffer;
+    for (; line && *line; line = next) {
+        next = strchr(line, '\n');
+        if (next) {
+            *next++ = 0;
+        }
+        if (line[0] == '#') {
+            continue;
+        }
+        value = strrchr(line, ' ');
+        if (!value) {
+            continue;
+        }
+        number = atof(value + 1);
+#define METRIC(NAME) (strncmp(line, NAME, sizeof(NAME) - 1) == 0)
+        if (METRIC("bacnet_polls_total")) {
+            metrics->polls += number;
+        } else if (METRIC("bacnet_poll_errors_total")) {
+            metrics->poll_errors += number;
+        } else if (METRIC("bacnet_poll_overruns_total")) {
+            metrics->poll_overruns += number;
+        } else if (METRIC("bacnet_device_timeouts_total")) {
+            metrics->timeouts += number;
+        } else if (METRIC("bacnet_mqtt_sent_total")) {
+            metrics->sent += number;
+        } else if (METRIC("bacnet_mqtt_dropped_total")) {
+            metrics->dropped += number;
+        } else if (METRIC("bacnet_mqtt_send_failures_total")) {
+            metrics->send_failures += number;
+        } else if (METRIC("bacnet_publish_latency_seconds_bucket")) {
+            metrics_bucket(line, number, metrics->latency_le,
+                metrics->latency, &metrics->latency_count);
+        } else if (METRIC("bacnet_poll_lateness_seconds_bucket")) {
+            metrics_bucket(line, number, metrics->lateness_le,
+                metrics->lateness, &metrics->lateness_count);
+        }
+#undef METRIC
+    }
+    metrics->valid = true;
+
+    return true;
+}
+
+/* the upper bound of the bucket of the quantile, of the samples between
+   the two scrapes. -1 if there were none, or it's in the +Inf one */
+static double metrics_quantile(
+    double *le,
+    double *before,
+    double *after,
+    unsigned count,
+    bool have_before,
+    double quantile)
+{
+    double total = 0;
+    unsigned i = 0;
+
+    if (count == 0) {
+        return -1;
+    }
+    total = after[count - 1] - (have_before ? before[count - 1] : 0);
+    if (total <= 0) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (after[i] - (have_before ? before[i] : 0) >= total * quantile) {
+            return le[i];
+        }
+    }
+
+    return -1;
+}
+
+/* the bound in seconds, or "-" if there is none */
+static const char *quantile_text(
+    char *text,
+    size_t size,
+    double bound)
+{
+    if (bound < 0) {
+        return "-";
+    }
+    snprintf(text, size, "%gs", bound);
+
+    return text;
+}
+
+static FILE *Stats_File = NULL;
+
+static void statistics_print(
+    const char *label,
+    FARM_STATISTICS * now,
+    FARM_STATISTICS * before,
+    GATEWAY_METRICS * metrics,
+    GATEWAY_METRICS * metrics_before,
+    double seconds)
+{
+    FILE *stream = Stats_File ? Stats_File : stdout;
+    bool have_before = metrics_before->valid &&
+        (metrics_before->latency_count == metrics->latency_count);
+    char p50[32];
+    char p99[32];
+    char lateness[32];
+
+    if (seconds <= 0) {
+        return;
+    }
+    fprintf(stream, "%s %.0fs: %.1f requests/s (%.1f RPM, %.1f RP), "
+        "%.1f values/s, %u unknown, %u aborted, %u rejected, %u unrouted, "
+        "%u notifications, %u subscriptions\n", label, seconds,
+        (now->requests - before->requests) / seconds,
+        (now->read_property_multiple - before->read_property_multiple) /
+        seconds, (now->read_property - before->read_property) / seconds,
+        (now->values - before->values) / seconds,
+        now->unknown - before->unknown, now->aborts - before->aborts,
+        now->rejects - before->rejects, now->unrouted - before->unrouted,
+        now->notifications - before->notifications, Subscription_Count);
+    if (!metrics->valid) {
+        return;
+    }
+    fprintf(stream, "%s gateway: %.0f polls/s, %.0f published/s, "
+        "%.0f dropped, %.0f send failures, %.0f poll errors, "
+        "%.0f overruns, %.0f timeouts, publish latency p50 %s p99 %s, "
+        "poll lateness p99 %s\n", label,
+        (metrics->polls - metrics_before->polls) / seconds,
+        (metrics->sent - metrics_before->sent) / seconds,
+        metrics->dropped - metrics_before->dropped,
+        metrics->send_failures - metrics_before->send_failures,
+        metrics->poll_errors - metrics_before->poll_errors,
+        metrics->poll_overruns - metrics_before->poll_overruns,
+        metrics->timeouts - metrics_before->timeouts,
+        quantile_text(p50, sizeof(p50), metrics_quantile(metrics->latency_le,
+                metrics_before->latency, metrics->latency,
+                metrics->latency_count, have_before, 0.5)),
+        quantile_text(p99, sizeof(p99), metrics_quantile(metrics->latency_le,
+                metrics_before->latency, metrics->latency,
+                metrics->latency_count, have_before, 0.99)),
+        quantile_text(lateness, sizeof(lateness),
+            metrics_quantile(metrics->lateness_le, metrics_before->lateness,
+                metrics->lateness, metrics->lateness_count,
+                metrics_before->valid &&
+                (metrics_before->lateness_count == metrics->lateness_count),
+                0.99)));
+    fflush(stream);
+}
+
+static void sig_int(
+    int signo)
+{
+    (void) signo;
+    Exit_Requested = true;
+}
+
+static void print_usage(
+    char *filename)
+{
+    printf("Usage: %s --capture <filename>\n", filename);
+    printf(" [--speed multiple][--once][--copies count]"
+        "[--instance-offset offset]\n");
+    printf(" [--network number][--duration seconds]\n");
+    printf(" [--stats-interval seconds][--stats-file filename]\n");
+    printf(" [--metrics host:port[/path]]\n");
+    printf(" [--version][--help]\n");
+}
+
+static void print_help(
+    char *filename)
+{
+    printf("Simulates the devices of a BACnet capture for the load test\n"
+        "of a gateway: their objects are read from the capture, and\n"
+        "the values are played back as they changed in the capture.\n"
+        "The devices are on a virtual network behind this router.\n"
+        "\n" "Command line options:\n"
+        "--capture filename - a PCAP or PCAPNG capture of MS/TP (from\n"
+        "    mstpcap), BACnet/IP or BACnet Ethernet.\n"
+        "[--speed multiple] - play the capture back that many times as\n"
+        "    fast. Defaults to 1.\n"
+        "[--once] - stop at the end of the capture, rather than loop.\n"
+        "[--copies count] - simulate that many copies of each device.\n"
+        "    Defaults to 1.\n"
+        "[--instance-offset offset] - the instance of a copy is that\n"
+        "    much more than the one before. Defaults to 100000.\n"
+        "[--network number] - the virtual network. Defaults to 5000.\n"
+        "[--duration seconds] - stop after that long.\n"
+        "[--stats-interval seconds] - how often the statistics are\n"
+        "    printed. Defaults to 10.\n"
+        "[--stats-file filename] - append the statistics to the file.\n"
+        "[--metrics host:port[/path]] - the metrics endpoint of the\n"
+        "    gateway, for its throughput, drops and latency.\n"
+        "The environment variables of the data link, e.g. BACNET_IFACE\n"
+        "and BACNET_IP_PORT, are those of the other demos.\n");
+    (void) filename;
+}
+
+int main(
+    int argc,
+    char *argv[])
+{
+    BACNET_ADDRESS src = { 0 };
+    FARM_STATISTICS zero;
+    GATEWAY_METRICS metrics_start;
+    GATEWAY_METRICS metrics_interval;
+    GATEWAY_METRICS metrics_now;
+    char *filename = NULL;
+    char *capture = NULL;
+    unsigned copies = 1;
+    uint32_t instance_offset = 100000;
+    unsigned stats_interval = 10;
+    unsigned duration = 0;
+    uint64_t now = 0;
+    uint64_t cov_ns = 0;
+    uint64_t stats_ns = 0;
+    uint64_t interval_start_ns = 0;
+    uint16_t pdu_len = 0;
+    int argi = 0;
+
+    filename = filename_remove_path(argv[0]);
+    for (argi = 1; argi < argc; argi++) {
+        if (strcmp(argv[argi], "--help") == 0) {
+            print_usage(filename);
+            print_help(filename);
+            return 0;
+        } else if (strcmp(argv[argi], "--version") == 0) {
+            printf("devfarm %s\n", BACNET_VERSION_TEXT);
+            return 0;
+        } else if (strcmp(argv[argi], "--once") == 0) {
+            Loop = false;
+        } else if (argi + 1 >= argc) {
+            print_usage(filename);
+            return 1;
+        } else if (strcmp(argv[argi], "--capture") == 0) {
+            capture = argv[++argi];
+        } else if (strcmp(argv[argi], "--speed") == 0) {
+            Speed = atof(argv[++argi]);
+        } else if (strcmp(argv[argi], "--copies") == 0) {
+            copies = (unsigned) strtoul(argv[++argi], NULL, 0);
+        } else if (strcmp(argv[argi], "--instance-offset") == 0) {
+            instance_offset = (uint32_t) strtoul(argv[++argi], NULL, 0);
+        } else if (strcmp(argv[argi], "--network") == 0) {
+            Virtual_Network = (uint16_t) strtoul(argv[++argi], NULL, 0);
+        } else if (strcmp(argv[argi], "--duration") == 0) {
+            duration = (unsigned) strtoul(argv[++argi], NULL, 0);
+        } else if (strcmp(argv[argi], "--stats-interval") == 0) {
+            stats_interval = (unsigned) strtoul(argv[++argi], NULL, 0);
+        } else if (strcmp(argv[argi], "--stats-file") == 0) {
+            Stats_File = fopen(argv[++argi], "a");
+            if (!Stats_File) {
+                fprintf(stderr, "devfarm: failed to open %s: %s\n",
+                    argv[argi], strerror(errno));
+                return 1;
+            }
+        } else if (strcmp(argv[argi], "--metrics") == 0) {
+            if (!metrics_url_parse(argv[++argi])) {
+                fprintf(stderr, "devfarm: --metrics is host:port[/path]\n");
+                return 1;
+            }
+        } else {
+            print_usage(filename);
+            return 1;
+        }
+    }
+    if (!capture || (Speed <= 0) || (copies == 0) ||
+        (Virtual_Network == 0) ||
+        (Virtual_Network == BACNET_BROADCAST_NETWORK)) {
+        print_usage(filename);
+        return 1;
+    }
+    if (!capture_load(capture)) {
+        return 1;
+    }
+    devices_resolve();
+    if (!nodes_create(copies, instance_offset) || (Node_Count == 0)) {
+        fprintf(stderr, "devfarm: no device with values in %s\n", capture);
+        return 1;
+    }
+    printf("devfarm: %u packets, %u values of %u devices over %.1fs, "
+        "%u devices on network %u at %gx\n", (unsigned) Capture_Packets,
+        (unsigned) Capture_Values, Device_Count,
+        Capture_Duration_ns / 1e9, Node_Count, Virtual_Network, Speed);
+    fflush(stdout);
+
+    dlenv_init();
+    atexit(datalink_cleanup);
+    signal(SIGINT, sig_int);
+    signal(SIGTERM, sig_int);
+    memset(&zero, 0, sizeof(zero));
+    metrics_scrape(&metrics_start);
+    metrics_interval = metrics_start;
+    Start_ns = monotonic_ns();
+    interval_start_ns = Start_ns;
+    stats_ns = Start_ns + (uint64_t) stats_interval * 1000000000ULL;
+    while (!Exit_Requested) {
+        pdu_len = datalink_receive(&src, &Rx_Buf[0], MAX_MPDU, 1);
+        now = monotonic_ns();
+        if (pdu_len) {
+            npdu_handler(&src, &Rx_Buf[0], pdu_len, now);
+        }
+        if (now >= cov_ns) {
+            cov_task(now, replay_position(now));
+            cov_ns = now + COV_TASK_NS;
+        }
+        if (stats_interval && (now >= stats_ns)) {
+            metrics_scrape(&metrics_now);
+            statistics_print("devfarm", &Stats, &Interval_Stats,
+                &metrics_now, &metrics_interval,
+                (now - interval_start_ns) / 1e9);
+            Interval_Stats = Stats;
+            metrics_interval = metrics_now;
+            interval_start_ns = now;
+            stats_ns = now + (uint64_t) stats_interval * 1000000000ULL;
+        }
+        if (duration && (now - Start_ns >= duration * 1000000000ULL)) {
+            break;
+        }
+        if (!Loop && ((double) (now - Start_ns) * Speed >
+                (double) Capture_Duration_ns)) {
+            break;
+        }
+    }
+    now = monotonic_ns();
+    metrics_scrape(&metrics_now);
+    statistics_print("devfarm total", &Stats, &zero, &metrics_now,
+        &metrics_start, (now - Start_ns) / 1e9);
+
+    return 0;
+}
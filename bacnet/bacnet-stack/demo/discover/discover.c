@@ -0,0 +1,983 @@
+/**************************************************************************
+*
+* Copyright (C) 2017 Steve Karg <skarg@users.sourceforge.net>
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*********************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "bacdef.h"
+#include "bacapp.h"
+#include "bacdcode.h"
+#include "bacstr.h"
+#include "bactext.h"
+#include "apdu.h"
+#include "npdu.h"
+#include "tsm.h"
+#include "dcc.h"
+#include "device.h"
+#include "datalink.h"
+#include "iam.h"
+#include "rp.h"
+#include "rpm.h"
+#include "readrange.h"
+#include "client.h"
+#include "handlers.h"
+#include "txbuf.h"
+#include "discover.h"
+
+/** @file discover.c  Crawls the points of the devices of a site. */
+
+/* consecutive timeouts before a device is given up on */
+#define DISCOVER_MAX_TIMEOUTS 3
+/* the APDU of a ReadRange ack without the items, and of an object id */
+#define DISCOVER_RR_OVERHEAD 24
+#define DISCOVER_OBJECT_ID_LEN 5
+/* of an element of an RPM ack: property, index, the tags and the id */
+#define DISCOVER_ELEMENT_LEN 14
+#define DISCOVER_RPM_OVERHEAD 12
+/* the arena blocks of the RPM acks */
+#define DISCOVER_ARENA_BLOCK 4096
+
+static BACNET_DISCOVER_CONFIG Config;
+/* the devices by the order they were heard, the requests point to them */
+static BACNET_DISCOVER_DEVICE **Devices = NULL;
+static unsigned Devices_Count = 0;
+static unsigned Devices_Capacity = 0;
+/* the devices being crawled */
+static unsigned Active_Count = 0;
+/* milliseconds counted by discover_task */
+static uint32_t Clock = 0;
+/* the I-Ams are waited for until then */
+static uint32_t Bind_Until = 0;
+static bool Who_Is_Repeated = false;
+static BACNET_RPM_ARENA Arena;
+
+void discover_config_init(
+    BACNET_DISCOVER_CONFIG * config)
+{
+    config->low_limit = -1;
+    config->high_limit = -1;
+    config->bind_ms = 10000;
+    config->concurrency = 64;
+    config->window = 2;
+    config->pace_ms = 20;
+    config->chunk = 64;
+    config->granularity = DISCOVER_REQUIRED;
+}
+
+unsigned discover_device_count(
+    void)
+{
+    return Devices_Count;
+}
+
+BACNET_DISCOVER_DEVICE *discover_device(
+    unsigned index)
+{
+    return (index < Devices_Count) ? Devices[index] : NULL;
+}
+
+static BACNET_DISCOVER_DEVICE *discover_find(
+    uint32_t instance)
+{
+    unsigned i = 0;
+
+    for (i = 0; i < Devices_Count; i++) {
+        if (Devices[i]->instance == instance)
+            return Devices[i];
+    }
+
+    return NULL;
+}
+
+/* a device is heard for the first time */
+static void discover_i_am(
+    uint8_t * service_request,
+    uint16_t service_len,
+    BACNET_ADDRESS * src)
+{
+    BACNET_DISCOVER_DEVICE **devices = NULL;
+    BACNET_DISCOVER_DEVICE *device = NULL;
+    uint32_t instance = 0;
+    unsigned max_apdu = 0;
+    int segmentation = 0;
+    uint16_t vendor_id = 0;
+    unsigned i = 0;
+
+    (void) service_len;
+    if (iam_decode_service_request(service_request, &instance, &max_apdu,
+            &segmentation, &vendor_id) <= 0)
+        return;
+    if ((Config.low_limit >= 0) && ((instance < (uint32_t) Config.low_limit)
+            || (instance > (uint32_t) Config.high_limit)))
+        return;
+    /* our own I-Am, back from the broadcast */
+    if ((instance == Device_Object_Instance_Number()) ||
+        discover_find(instance))
+        return;
+    if (Devices_Count == Devices_Capacity) {
+        devices =
+            realloc(Devices,
+            (Devices_Capacity * 2 + 16) * sizeof(BACNET_DISCOVER_DEVICE *));
+        if (!devices)
+            return;
+        Devices = devices;
+        Devices_Capacity = Devices_Capacity * 2 + 16;
+    }
+    device = calloc(1, sizeof(BACNET_DISCOVER_DEVICE));
+    if (!device)
+        return;
+    device->instance = instance;
+    device->max_apdu = (max_apdu < MAX_APDU) ? max_apdu : MAX_APDU;
+    bacnet_address_copy(&device->address, src);
+    device->state = DISCOVER_QUEUED;
+    device->chunk = Config.chunk;
+    for (i = 0; i < MAX_DISCOVER_WINDOW; i++) {
+        device->requests[i].device = device;
+    }
+    Devices[Devices_Count++] = device;
+}
+
+/* the object types of the points, when their properties are not read */
+static bool discover_has_present_value(
+    BACNET_OBJECT_TYPE object_type)
+{
+    switch (object_type) {
+        case OBJECT_ANALOG_INPUT:
+        case OBJECT_ANALOG_OUTPUT:
+        case OBJECT_ANALOG_VALUE:
+        case OBJECT_BINARY_INPUT:
+        case OBJECT_BINARY_OUTPUT:
+        case OBJECT_BINARY_VALUE:
+        case OBJECT_MULTI_STATE_INPUT:
+        case OBJECT_MULTI_STATE_OUTPUT:
+        case OBJECT_MULTI_STATE_VALUE:
+        case OBJECT_LOOP:
+        case OBJECT_ACCUMULATOR:
+        case OBJECT_PULSE_CONVERTER:
+        case OBJECT_INTEGER_VALUE:
+        case OBJECT_POSITIVE_INTEGER_VALUE:
+        case OBJECT_LARGE_ANALOG_VALUE:
+        case OBJECT_LIGHTING_OUTPUT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* the phase of the device is over */
+static void discover_set_state(
+    BACNET_DISCOVER_DEVICE * device,
+    DISCOVER_STATE state)
+{
+    if ((state == DISCOVER_DONE) || (state == DISCOVER_FAILED)) {
+        if (Active_Count > 0)
+            Active_Count--;
+        fprintf(stderr, "device %lu: %s, %lu objects\n",
+            (unsigned long) device->instance,
+            (state == DISCOVER_DONE) ? "done" : "failed",
+            (unsigned long) device->count);
+    }
+    device->state = state;
+    device->next = 1;
+}
+
+/* the Object_List length, the elements are read next */
+static bool discover_alloc_points(
+    BACNET_DISCOVER_DEVICE * device,
+    uint32_t count)
+{
+    free(device->points);
+    device->count = 0;
+    device->points = calloc(count ? count : 1, sizeof(BACNET_DISCOVER_POINT));
+    if (!device->points)
+        return false;
+    device->count = count;
+
+    return true;
+}
+
+static void discover_set_point(
+    BACNET_DISCOVER_DEVICE * device,
+    uint32_t element,
+    BACNET_APPLICATION_DATA_VIEW * value)
+{
+    BACNET_DISCOVER_POINT *point = NULL;
+
+    if ((element < 1) || (element > device->count) ||
+        (value->tag != BACNET_APPLICATION_TAG_OBJECT_ID))
+        return;
+    point = &device->points[element - 1];
+    point->object_type = (BACNET_OBJECT_TYPE) value->type.Object_Id.type;
+    point->object_instance = value->type.Object_Id.instance;
+    point->known = true;
+}
+
+/* the object ids of application data, from the element first on; */
+/* returns how many */
+static uint32_t discover_decode_objects(
+    BACNET_DISCOVER_DEVICE * device,
+    uint32_t first,
+    uint8_t * apdu,
+    int apdu_len)
+{
+    BACNET_APPLICATION_DATA_VIEW value;
+    uint32_t count = 0;
+    int len = 0;
+
+    while (apdu_len > 0) {
+        len =
+            bacapp_decode_application_view(apdu, (unsigned) apdu_len,
+            &value);
+        if (len <= 0)
+            break;
+        if (device)
+            discover_set_point(device, first + count, &value);
+        count++;
+        apdu += len;
+        apdu_len -= len;
+    }
+
+    return count;
+}
+
+/* the Object_List is read, the unknown elements are dropped */
+static void discover_objects_read(
+    BACNET_DISCOVER_DEVICE * device)
+{
+    uint32_t i = 0;
+    uint32_t count = 0;
+
+    for (i = 0; i < device->count; i++) {
+        if (device->points[i].known)
+            device->points[count++] = device->points[i];
+    }
+    device->count = count;
+    if (Config.granularity == DISCOVER_OBJECTS_ONLY) {
+        for (i = 0; i < device->count; i++) {
+            device->points[i].present_value =
+                discover_has_present_value(device->points[i].object_type);
+        }
+        discover_set_state(device, DISCOVER_DONE);
+    } else {
+        discover_set_state(device, DISCOVER_PROPERTIES);
+    }
+}
+
+/* the request is sent again, from its first element or point */
+static void discover_retry(
+    BACNET_DISCOVER_DEVICE * device,
+    BACNET_DISCOVER_REQUEST * request)
+{
+    if ((request->read != DISCOVER_READ_LIST) &&
+        (request->read != DISCOVER_READ_COUNT) &&
+        (request->first < device->next))
+        device->next = request->first;
+}
+
+static void discover_copy_name(
+    BACNET_DISCOVER_POINT * point,
+    BACNET_APPLICATION_DATA_VIEW * value)
+{
+    size_t len = 0;
+
+    if (!value || (value->tag != BACNET_APPLICATION_TAG_CHARACTER_STRING) ||
+        (value->type.String.encoding != CHARACTER_UTF8))
+        return;
+    len = value->type.String.length;
+    if (len >= sizeof(point->name))
+        len = sizeof(point->name) - 1;
+    memcpy(point->name, value->type.String.value, len);
+    point->name[len] = 0;
+}
+
+/* the ReadPropertyMultiple ack of the properties of an object, false */
+/* if it can't be decoded, e.g. a constructed Event_Time_Stamps */
+static bool discover_object_ack(
+    BACNET_DISCOVER_POINT * point,
+    uint8_t * service_request,
+    uint16_t service_len)
+{
+    BACNET_READ_ACCESS_DATA *rpm_data = NULL;
+    BACNET_PROPERTY_REFERENCE *rpm_property = NULL;
+
+    rpm_arena_reset(&Arena);
+    rpm_data = rpm_arena_alloc(&Arena, sizeof(BACNET_READ_ACCESS_DATA));
+    if (!rpm_data ||
+        (rpm_ack_decode_service_request_view(service_request, service_len,
+                rpm_data, &Arena) <= 0))
+        return false;
+    for (rpm_property = rpm_data->listOfProperties; rpm_property;
+        rpm_property = rpm_property->next) {
+        if (!rpm_property->view)
+            continue;
+        if (rpm_property->propertyIdentifier == PROP_OBJECT_NAME)
+            discover_copy_name(point, rpm_property->view);
+        else if (rpm_property->propertyIdentifier == PROP_PRESENT_VALUE)
+            point->present_value = true;
+    }
+
+    return true;
+}
+
+/* the ReadPropertyMultiple ack of Object_List elements */
+static void discover_elements_ack(
+    BACNET_DISCOVER_DEVICE * device,
+    uint8_t * service_request,
+    uint16_t service_len)
+{
+    BACNET_READ_ACCESS_DATA *rpm_data = NULL;
+    BACNET_PROPERTY_REFERENCE *rpm_property = NULL;
+
+    rpm_arena_reset(&Arena);
+    rpm_data = rpm_arena_alloc(&Arena, sizeof(BACNET_READ_ACCESS_DATA));
+    if (!rpm_data ||
+        (rpm_ack_decode_service_request_view(service_request, service_len,
+                rpm_data, &Arena) <= 0))
+        return;
+    for (rpm_property = rpm_data->listOfProperties; rpm_property;
+        rpm_property = rpm_property->next) {
+        if ((rpm_property->propertyIdentifier == PROP_OBJECT_LIST) &&
+            rpm_property->view)
+            discover_set_point(device, rpm_property->propertyArrayIndex,
+                rpm_property->view);
+    }
+}
+
+/* the ack of a request, its data is valid until it returns */
+static void discover_ack(
+    BACNET_DISCOVER_DEVICE * device,
+    BACNET_DISCOVER_REQUEST * request,
+    BACNET_CONFIRMED_REPLY * reply)
+{
+    BACNET_READ_PROPERTY_DATA rp_data;
+    BACNET_READ_RANGE_DATA rr_data;
+    BACNET_APPLICATION_DATA_VIEW value;
+    BACNET_DISCOVER_POINT *point = NULL;
+    uint32_t count = 0;
+
+    switch (request->read) {
+        case DISCOVER_READ_LIST:
+        case DISCOVER_READ_COUNT:
+        case DISCOVER_READ_ELEMENT:
+        case DISCOVER_READ_NAME:
+            if (rp_ack_decode_service_request(reply->service_request,
+                    reply->service_len, &rp_data) <= 0)
+                return;
+            break;
+        default:
+            break;
+    }
+    switch (request->read) {
+        case DISCOVER_READ_LIST:
+            count =
+                discover_decode_objects(NULL, 1, rp_data.application_data,
+                rp_data.application_data_len);
+            if (!discover_alloc_points(device, count)) {
+                discover_set_state(device, DISCOVER_FAILED);
+                return;
+            }
+            discover_decode_objects(device, 1, rp_data.application_data,
+                rp_data.application_data_len);
+            discover_objects_read(device);
+            break;
+        case DISCOVER_READ_COUNT:
+            if ((bacapp_decode_application_view(rp_data.application_data,
+                        (unsigned) rp_data.application_data_len,
+                        &value) <= 0) ||
+                (value.tag != BACNET_APPLICATION_TAG_UNSIGNED_INT) ||
+                !discover_alloc_points(device, value.type.Unsigned_Int)) {
+                discover_set_state(device, DISCOVER_FAILED);
+                return;
+            }
+            discover_set_state(device,
+                device->no_read_range ? DISCOVER_OBJECT_ELEMENTS :
+                DISCOVER_OBJECT_RANGE);
+            break;
+        case DISCOVER_READ_RANGE:
+            if (rr_ack_decode_service_request(reply->service_request,
+                    reply->service_len, &rr_data) <= 0)
+                return;
+            count =
+                discover_decode_objects(device, request->first,
+                rr_data.application_data, rr_data.application_data_len);
+            /* fewer, with MORE_ITEMS: the rest is asked for again */
+            if ((count < request->count) &&
+                (request->first + count < device->next))
+                device->next = request->first + count;
+            break;
+        case DISCOVER_READ_ELEMENTS:
+            discover_elements_ack(device, reply->service_request,
+                reply->service_len);
+            break;
+        case DISCOVER_READ_ELEMENT:
+            if (bacapp_decode_application_view(rp_data.application_data,
+                    (unsigned) rp_data.application_data_len, &value) > 0)
+                discover_set_point(device, request->first, &value);
+            break;
+        case DISCOVER_READ_OBJECT:
+            point = &device->points[request->first - 1];
+            if (discover_object_ack(point, reply->service_request,
+                    reply->service_len)) {
+                point->done = true;
+                break;
+            }
+            /* fewer properties next, the Object_Name at the last */
+            if (request->property == PROP_ALL)
+                point->too_large = true;
+            else
+                point->name_only = true;
+            discover_retry(device, request);
+            break;
+        case DISCOVER_READ_NAME:
+            point = &device->points[request->first - 1];
+            if (bacapp_decode_application_view(rp_data.application_data,
+                    (unsigned) rp_data.application_data_len, &value) > 0)
+                discover_copy_name(point, &value);
+            point->present_value =
+                discover_has_present_value(point->object_type);
+            point->done = true;
+            break;
+        default:
+            break;
+    }
+}
+
+/* an Error, Reject or Abort: the next way to read it */
+static void discover_failed(
+    BACNET_DISCOVER_DEVICE * device,
+    BACNET_DISCOVER_REQUEST * request,
+    BACNET_CONFIRMED_REPLY * reply)
+{
+    BACNET_DISCOVER_POINT *point = NULL;
+    bool too_large = false;
+
+    /* the ack doesn't fit the APDU, and won't come in segments */
+    too_large = (reply->pdu_type == PDU_TYPE_ABORT) &&
+        ((reply->reason == ABORT_REASON_SEGMENTATION_NOT_SUPPORTED) ||
+        (reply->reason == ABORT_REASON_BUFFER_OVERFLOW));
+    switch (request->read) {
+        case DISCOVER_READ_LIST:
+            discover_set_state(device, DISCOVER_OBJECT_COUNT);
+            break;
+        case DISCOVER_READ_COUNT:
+            discover_set_state(device, DISCOVER_FAILED);
+            break;
+        case DISCOVER_READ_RANGE:
+            if (too_large && (device->chunk > 1)) {
+                device->chunk /= 2;
+            } else {
+                device->no_read_range = true;
+                device->state = DISCOVER_OBJECT_ELEMENTS;
+            }
+            discover_retry(device, request);
+            break;
+        case DISCOVER_READ_ELEMENTS:
+            if (too_large && (device->chunk > 1))
+                device->chunk /= 2;
+            else
+                device->no_rpm = true;
+            discover_retry(device, request);
+            break;
+        case DISCOVER_READ_OBJECT:
+            point = &device->points[request->first - 1];
+            if (too_large && (request->property == PROP_ALL)) {
+                point->too_large = true;
+            } else if ((reply->pdu_type == PDU_TYPE_REJECT) ||
+                too_large) {
+                if (reply->pdu_type == PDU_TYPE_REJECT)
+                    device->no_rpm = true;
+                point->name_only = true;
+            } else {
+                /* e.g. an unknown object */
+                point->present_value =
+                    discover_has_present_value(point->object_type);
+                point->done = true;
+                return;
+            }
+            discover_retry(device, request);
+            break;
+        case DISCOVER_READ_NAME:
+            point = &device->points[request->first - 1];
+            point->present_value =
+                discover_has_present_value(point->object_type);
+            point->done = true;
+            break;
+        default:
+            /* the element is left unknown */
+            break;
+    }
+}
+
+/* the completion of all the requests */
+static void discover_completed(
+    BACNET_ADDRESS * src,
+    uint8_t invoke_id,
+    BACNET_CONFIRMED_REPLY * reply,
+    void *context)
+{
+    BACNET_DISCOVER_REQUEST *request = (BACNET_DISCOVER_REQUEST *) context;
+    BACNET_DISCOVER_DEVICE *device = request->device;
+
+    (void) src;
+    (void) invoke_id;
+    request->busy = false;
+    device->inflight--;
+    if ((device->state == DISCOVER_DONE) ||
+        (device->state == DISCOVER_FAILED))
+        return;
+    if (reply->timeout) {
+        if (++device->timeouts >= DISCOVER_MAX_TIMEOUTS)
+            discover_set_state(device, DISCOVER_FAILED);
+        else
+            discover_retry(device, request);
+        return;
+    }
+    device->timeouts = 0;
+    if ((reply->pdu_type == PDU_TYPE_COMPLEX_ACK) && reply->service_request)
+        discover_ack(device, request, reply);
+    else
+        discover_failed(device, request, reply);
+}
+
+/* the next request of the device, false if none is due */
+static bool discover_next_request(
+    BACNET_DISCOVER_DEVICE * device,
+    BACNET_DISCOVER_REQUEST * request)
+{
+    BACNET_DISCOVER_POINT *point = NULL;
+    unsigned chunk = device->chunk;
+    unsigned fits = 0;
+
+    switch (device->state) {
+        case DISCOVER_OBJECT_LIST:
+        case DISCOVER_OBJECT_COUNT:
+            if ((device->inflight > 0) || (device->next > 1))
+                return false;
+            request->read = (device->state == DISCOVER_OBJECT_LIST) ?
+                DISCOVER_READ_LIST : DISCOVER_READ_COUNT;
+            request->first = 0;
+            request->count = 0;
+            device->next = 2;
+            return true;
+        case DISCOVER_OBJECT_RANGE:
+        case DISCOVER_OBJECT_ELEMENTS:
+            while ((device->next <= device->count) &&
+                device->points[device->next - 1].known) {
+                device->next++;
+            }
+            if (device->next > device->count)
+                return false;
+            if (device->state == DISCOVER_OBJECT_RANGE) {
+                request->read = DISCOVER_READ_RANGE;
+                fits = (device->max_apdu - DISCOVER_RR_OVERHEAD) /
+                    DISCOVER_OBJECT_ID_LEN;
+            } else if (device->no_rpm) {
+                request->read = DISCOVER_READ_ELEMENT;
+                fits = 1;
+            } else {
+                request->read = DISCOVER_READ_ELEMENTS;
+                fits = (device->max_apdu - DISCOVER_RPM_OVERHEAD) /
+                    DISCOVER_ELEMENT_LEN;
+            }
+            if (chunk > fits)
+                chunk = fits;
+            if (chunk < 1)
+                chunk = 1;
+            if (chunk > device->count - device->next + 1)
+                chunk = device->count - device->next + 1;
+            request->first = device->next;
+            request->count = chunk;
+            device->next += chunk;
+            return true;
+        case DISCOVER_PROPERTIES:
+            while ((device->next <= device->count) &&
+                device->points[device->next - 1].done) {
+                device->next++;
+            }
+            if (device->next > device->count)
+                return false;
+            point = &device->points[device->next - 1];
+            if (point->name_only || device->no_rpm) {
+                request->read = DISCOVER_READ_NAME;
+            } else {
+                request->read = DISCOVER_READ_OBJECT;
+                request->property =
+                    ((Config.granularity == DISCOVER_ALL) &&
+                    !point->too_large) ? PROP_ALL : PROP_REQUIRED;
+            }
+            request->first = device->next;
+            request->count = 1;
+            device->next++;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static int discover_encode(
+    uint8_t * apdu,
+    uint8_t invoke_id,
+    BACNET_DISCOVER_DEVICE * device,
+    BACNET_DISCOVER_REQUEST * request)
+{
+    BACNET_READ_PROPERTY_DATA rp_data;
+    BACNET_READ_RANGE_DATA rr_data;
+    BACNET_DISCOVER_POINT *point = NULL;
+    uint32_t i = 0;
+    int len = 0;
+
+    switch (request->read) {
+        case DISCOVER_READ_LIST:
+        case DISCOVER_READ_COUNT:
+        case DISCOVER_READ_ELEMENT:
+        case DISCOVER_READ_NAME:
+            rp_data.object_type = OBJECT_DEVICE;
+            rp_data.object_instance = device->instance;
+            rp_data.object_property = PROP_OBJECT_LIST;
+            rp_data.array_index = BACNET_ARRAY_ALL;
+            if (request->read == DISCOVER_READ_COUNT) {
+                rp_data.array_index = 0;
+            } else if (request->read == DISCOVER_READ_ELEMENT) {
+                rp_data.array_index = request->first;
+            } else if (request->read == DISCOVER_READ_NAME) {
+                point = &device->points[request->first - 1];
+                rp_data.object_type = point->object_type;
+                rp_data.object_instance = point->object_instance;
+                rp_data.object_property = PROP_OBJECT_NAME;
+            }
+            return rp_encode_apdu(apdu, invoke_id, &rp_data);
+        case DISCOVER_READ_RANGE:
+            memset(&rr_data, 0, sizeof(rr_data));
+            rr_data.object_type = OBJECT_DEVICE;
+            rr_data.object_instance = device->instance;
+            rr_data.object_property = PROP_OBJECT_LIST;
+            rr_data.array_index = BACNET_ARRAY_ALL;
+            rr_data.RequestType = RR_BY_POSITION;
+            rr_data.Range.RefIndex = request->first;
+            rr_data.Count = (int32_t) request->count;
+            return rr_encode_apdu(apdu, invoke_id, &rr_data);
+        case DISCOVER_READ_ELEMENTS:
+            len = rpm_encode_apdu_init(apdu, invoke_id);
+            len +=
+                rpm_encode_apdu_object_begin(&apdu[len], OBJECT_DEVICE,
+                device->instance);
+            for (i = 0; i < request->count; i++) {
+                len +=
+                    rpm_encode_apdu_object_property(&apdu[len],
+                    PROP_OBJECT_LIST, request->first + i);
+            }
+            len += rpm_encode_apdu_object_end(&apdu[len]);
+            return len;
+        case DISCOVER_READ_OBJECT:
+            point = &device->points[request->first - 1];
+            len = rpm_encode_apdu_init(apdu, invoke_id);
+            len +=
+                rpm_encode_apdu_object_begin(&apdu[len], point->object_type,
+                point->object_instance);
+            len +=
+                rpm_encode_apdu_object_property(&apdu[len],
+                request->property, BACNET_ARRAY_ALL);
+            len += rpm_encode_apdu_object_end(&apdu[len]);
+            return len;
+        default:
+            return 0;
+    }
+}
+
+/* like Send_Read_Property_Request, with a per device invoke ID and the */
+/* request as the context of the completion */
+static bool discover_send(
+    BACNET_DISCOVER_DEVICE * device,
+    BACNET_DISCOVER_REQUEST * request)
+{
+    BACNET_ADDRESS my_address;
+    BACNET_NPDU_DATA npdu_data;
+    uint8_t invoke_id = 0;
+    int pdu_len = 0;
+    int len = 0;
+
+    if (!dcc_communication_enabled())
+        return false;
+    invoke_id = tsm_next_free_invokeID_peer(&device->address);
+    if (invoke_id == 0)
+        return false;
+    datalink_get_my_address(&my_address);
+    npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_NORMAL);
+    pdu_len =
+        npdu_encode_pdu(&Handler_Transmit_Buffer[0], &device->address,
+        &my_address, &npdu_data);
+    len =
+        discover_encode(&Handler_Transmit_Buffer[pdu_len], invoke_id, device,
+        request);
+    if ((len <= 0) || ((unsigned) (pdu_len + len) >= MAX_PDU)) {
+        tsm_free_invoke_id_peer(&device->address, invoke_id);
+        return false;
+    }
+    pdu_len += len;
+    tsm_set_confirmed_unsegmented_transaction(invoke_id, &device->address,
+        &npdu_data, &Handler_Transmit_Buffer[0], (uint16_t) pdu_len);
+    tsm_set_completion(&device->address, invoke_id, discover_completed,
+        request);
+    request->busy = true;
+    device->inflight++;
+    device->sent_ms = Clock;
+    if (datalink_send_pdu(&device->address, &npdu_data,
+            &Handler_Transmit_Buffer[0], pdu_len) <= 0)
+        fprintf(stderr, "Failed to send a request to device %lu!\n",
+            (unsigned long) device->instance);
+
+    return true;
+}
+
+/* the requests of the device that its window and pace allow */
+static void discover_device_task(
+    BACNET_DISCOVER_DEVICE * device)
+{
+    BACNET_DISCOVER_REQUEST *request = NULL;
+    unsigned i = 0;
+
+    while ((device->inflight < Config.window) &&
+        ((device->inflight == 0) ||
+            ((Clock - device->sent_ms) >= Config.pace_ms)) &&
+        tsm_transaction_available()) {
+        for (i = 0; i < MAX_DISCOVER_WINDOW; i++) {
+            if (!device->requests[i].busy)
+                break;
+        }
+        request = &device->requests[i];
+        if ((i == MAX_DISCOVER_WINDOW) ||
+            !discover_next_request(device, request))
+            break;
+        if (!discover_send(device, request)) {
+            discover_retry(device, request);
+            if (request->read == DISCOVER_READ_LIST ||
+                request->read == DISCOVER_READ_COUNT)
+                device->next = 1;
+            break;
+        }
+    }
+    /* the phase is over once its last reply is in */
+    if (device->inflight > 0)
+        return;
+    switch (device->state) {
+        case DISCOVER_OBJECT_RANGE:
+        case DISCOVER_OBJECT_ELEMENTS:
+            if (device->next > device->count)
+                discover_objects_read(device);
+            break;
+        case DISCOVER_PROPERTIES:
+            if (device->next > device->count)
+                discover_set_state(device, DISCOVER_DONE);
+            break;
+        default:
+            break;
+    }
+}
+
+bool discover_start(
+    BACNET_DISCOVER_CONFIG * config)
+{
+    Config = *config;
+    if (Config.window < 1)
+        Config.window = 1;
+    if (Config.window > MAX_DISCOVER_WINDOW)
+        Config.window = MAX_DISCOVER_WINDOW;
+    if (Config.concurrency < 1)
+        Config.concurrency = 1;
+    if (Config.chunk < 1)
+        Config.chunk = 1;
+    rpm_arena_init(&Arena, DISCOVER_ARENA_BLOCK);
+    apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_I_AM, discover_i_am);
+    Clock = 0;
+    Bind_Until = Config.bind_ms;
+    Who_Is_Repeated = false;
+    Send_WhoIs(Config.low_limit, Config.high_limit);
+
+    return true;
+}
+
+void discover_task(
+    uint16_t milliseconds)
+{
+    BACNET_DISCOVER_DEVICE *device = NULL;
+    unsigned i = 0;
+
+    Clock += milliseconds;
+    /* again halfway, for the I-Ams lost in the burst of the first one */
+    if (!Who_Is_Repeated && (Clock >= Bind_Until / 2)) {
+        Send_WhoIs(Config.low_limit, Config.high_limit);
+        Who_Is_Repeated = true;
+    }
+    for (i = 0; i < Devices_Count; i++) {
+        device = Devices[i];
+        if ((device->state == DISCOVER_QUEUED) &&
+            (Active_Count < Config.concurrency)) {
+            Active_Count++;
+            discover_set_state(device, DISCOVER_OBJECT_LIST);
+        }
+        if ((device->state != DISCOVER_QUEUED) &&
+            (device->state != DISCOVER_DONE) &&
+            (device->state != DISCOVER_FAILED))
+            discover_device_task(device);
+    }
+}
+
+bool discover_done(
+    void)
+{
+    unsigned i = 0;
+
+    if (Clock < Bind_Until)
+        return false;
+    for (i = 0; i < Devices_Count; i++) {
+        if (((Devices[i]->state != DISCOVER_DONE) &&
+                (Devices[i]->state != DISCOVER_FAILED)) ||
+            (Devices[i]->inflight > 0))
+            return false;
+    }
+
+    return true;
+}
+
+/* the name of the configuration, like ANALOG_INPUT; false if it has none */
+static bool discover_config_name(
+    const char *text,
+    char *name,
+    size_t size)
+{
+    size_t i = 0;
+
+    for (i = 0; text[i] && (i < size - 1); i++) {
+        if (text[i] == '-')
+            name[i] = '_';
+        else if ((text[i] >= 'a') && (text[i] <= 'z'))
+            name[i] = (char) (text[i] - 'a' + 'A');
+        else
+            name[i] = text[i];
+    }
+    name[i] = 0;
+
+    return (i > 0);
+}
+
+static void discover_print_string(
+    FILE * stream,
+    const char *text)
+{
+    const unsigned char *p = (const unsigned char *) text;
+
+    fputc('"', stream);
+    for (; *p; p++) {
+        if ((*p == '"') || (*p == '\\'))
+            fprintf(stream, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(stream, "\\u%04x", *p);
+        else
+            fputc(*p, stream);
+    }
+    fputc('"', stream);
+}
+
+void discover_print_policies(
+    FILE * stream,
+    uint32_t my_instance,
+    unsigned interval)
+{
+    BACNET_DISCOVER_DEVICE *device = NULL;
+    BACNET_DISCOVER_POINT *point = NULL;
+    char type_name[64];
+    unsigned found = 0;
+    unsigned i = 0;
+    uint32_t j = 0;
+    bool first_policy = true;
+    bool first_point = true;
+
+    fprintf(stream, "{\n    \"bdBacVer\": 1,\n    \"device\": {\n");
+    fprintf(stream, "        \"instanceNumber\": %lu,\n",
+        (unsigned long) my_instance);
+    fprintf(stream, "        \"ip\": null,\n        \"broadcastIp\": null\n");
+    fprintf(stream, "    },\n    \"pullPolices\": [");
+    for (i = 0; i < Devices_Count; i++) {
+        device = Devices[i];
+        if (device->state != DISCOVER_DONE)
+            continue;
+        first_point = true;
+        for (j = 0; j < device->count; j++) {
+            point = &device->points[j];
+            /* the configuration only names the standard types */
+            if (!point->present_value ||
+                !discover_config_name(bactext_object_type_name(point->
+                        object_type), type_name, sizeof(type_name)) ||
+                !bactext_object_type_index(bactext_object_type_name(point->
+                        object_type), &found) ||
+                (found != (unsigned) point->object_type))
+                continue;
+            if (first_point) {
+                fprintf(stream, "%s\n        {\n", first_policy ? "" : ",");
+                fprintf(stream,
+                    "            \"targetInstanceNumber\": %lu,\n",
+                    (unsigned long) device->instance);
+                fprintf(stream, "            \"interval\": %u,\n", interval);
+                fprintf(stream, "            \"properties\": [");
+                first_policy = false;
+            }
+            fprintf(stream, "%s\n                {\n", first_point ? "" : ",");
+            fprintf(stream, "                    \"objectType\": \"%s\",\n",
+                type_name);
+            fprintf(stream, "                    \"objectInstance\": %lu,\n",
+                (unsigned long) point->object_instance);
+            fprintf(stream,
+                "                    \"property\": \"PRESENT_VALUE\"");
+            if (point->name[0]) {
+                fprintf(stream, ",\n                    \"name\": ");
+                discover_print_string(stream, point->name);
+            }
+            fprintf(stream, "\n                }");
+            first_point = false;
+        }
+        if (!first_point)
+            fprintf(stream, "\n            ]\n        }");
+    }
+    fprintf(stream, "\n    ]\n}\n");
+}
+
+void discover_cleanup(
+    void)
+{
+    unsigned i = 0;
+
+    for (i = 0; i < Devices_Count; i++) {
+        free(Devices[i]->points);
+        free(Devices[i]);
+    }
+    free(Devices);
+    Devices = NULL;
+    Devices_Count = 0;
+    Devices_Capacity = 0;
+    Active_Count = 0;
+    rpm_arena_destroy(&Arena);
+}
@@ -0,0 +1,214 @@
+/**************************************************************************
+*
+* Copyright (C) 2017 Steve Karg <skarg@users.sourceforge.net>
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*********************************************************************/
+#ifndef DISCOVER_H
+#define DISCOVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "bacdef.h"
+#include "bacenum.h"
+
+/** @defgroup DISCOVER Discovery of the points of a whole site.
+ * @ingroup Demos
+ * The objects of every device that answers a Who-Is, crawled in parallel,
+ * as the point list of a bacnet2mqtt configuration. Unlike bacepics, which
+ * waits for each ack of one device, the requests of many devices are in
+ * flight at once, each of them with its own completion (see
+ * tsm_set_completion), and every device is paced by a window of requests
+ * and a minimum gap between them.
+ *
+ * Per device, the Object_List is read
+ * - whole with ReadProperty,
+ * - or if it doesn't fit the APDU, its length (array index 0) and then its
+ *   elements by ReadRange by position,
+ * - or if the device has no ReadRange, by ReadPropertyMultiple of array
+ *   elements, or ReadProperty of each element without it,
+ * and then the properties of each object with ReadPropertyMultiple of ALL
+ * or REQUIRED, whichever granularity is configured, falling back to the
+ * Object_Name alone if the reply doesn't fit or the device has no RPM.
+ *
+ * The application owns the datalink: it calls discover_start() after
+ * dlenv_init(), gives the received PDUs to npdu_handler(), and calls
+ * tsm_timer_milliseconds() and discover_task() as time goes by, until
+ * discover_done().
+ */
+
+/** The properties read of each object. */
+typedef enum {
+    /** Only the Object_List, the points are guessed by the object type. */
+    DISCOVER_OBJECTS_ONLY,
+    /** ReadPropertyMultiple of REQUIRED. */
+    DISCOVER_REQUIRED,
+    /** ReadPropertyMultiple of ALL. */
+    DISCOVER_ALL
+} DISCOVER_GRANULARITY;
+
+typedef enum {
+    /** Heard, waiting for a turn among the devices crawled at once. */
+    DISCOVER_QUEUED,
+    /** The Object_List in one piece. */
+    DISCOVER_OBJECT_LIST,
+    /** The length of the Object_List, if it doesn't fit. */
+    DISCOVER_OBJECT_COUNT,
+    /** Its elements with ReadRange. */
+    DISCOVER_OBJECT_RANGE,
+    /** Its elements with ReadPropertyMultiple, or ReadProperty. */
+    DISCOVER_OBJECT_ELEMENTS,
+    /** The properties of the objects. */
+    DISCOVER_PROPERTIES,
+    DISCOVER_DONE,
+    DISCOVER_FAILED
+} DISCOVER_STATE;
+
+/* the most requests in flight to a device */
+#ifndef MAX_DISCOVER_WINDOW
+#define MAX_DISCOVER_WINDOW 8
+#endif
+/* the longest Object_Name kept */
+#define MAX_DISCOVER_NAME 64
+
+/** An object of a device, a point once it has a Present_Value. */
+typedef struct BACnet_Discover_Point {
+    BACNET_OBJECT_TYPE object_type;
+    uint32_t object_instance;
+    /* UTF-8, empty if not read */
+    char name[MAX_DISCOVER_NAME];
+    bool present_value;
+    /* the object is known, i.e. its Object_List element was read */
+    bool known;
+    /* the properties were read, or given up on */
+    bool done;
+    /* the properties were too many for the APDU, REQUIRED or just */
+    /* the Object_Name next */
+    bool too_large;
+    bool name_only;
+} BACNET_DISCOVER_POINT;
+
+/** What a request reads. */
+typedef enum {
+    /* ReadProperty of the Object_List */
+    DISCOVER_READ_LIST,
+    /* of Object_List[0] */
+    DISCOVER_READ_COUNT,
+    /* ReadRange by position of the Object_List */
+    DISCOVER_READ_RANGE,
+    /* ReadPropertyMultiple of Object_List elements */
+    DISCOVER_READ_ELEMENTS,
+    /* ReadProperty of one of them */
+    DISCOVER_READ_ELEMENT,
+    /* ReadPropertyMultiple of ALL or REQUIRED of an object */
+    DISCOVER_READ_OBJECT,
+    /* ReadProperty of its Object_Name */
+    DISCOVER_READ_NAME
+} DISCOVER_READ;
+
+struct BACnet_Discover_Device;
+
+/** A request in flight, the context of its completion. */
+typedef struct BACnet_Discover_Request {
+    struct BACnet_Discover_Device *device;
+    bool busy;
+    DISCOVER_READ read;
+    /* the Object_List elements, 1.., or the point (first - 1) */
+    uint32_t first;
+    uint32_t count;
+    /* PROP_ALL or PROP_REQUIRED of DISCOVER_READ_OBJECT */
+    BACNET_PROPERTY_ID property;
+} BACNET_DISCOVER_REQUEST;
+
+typedef struct BACnet_Discover_Device {
+    uint32_t instance;
+    unsigned max_apdu;
+    BACNET_ADDRESS address;
+    DISCOVER_STATE state;
+    /* the services the device turned out not to have */
+    bool no_rpm;
+    bool no_read_range;
+    BACNET_DISCOVER_REQUEST requests[MAX_DISCOVER_WINDOW];
+    unsigned inflight;
+    /* the clock of the last request sent */
+    uint32_t sent_ms;
+    /* timeouts since the last reply */
+    unsigned timeouts;
+    /* the Object_List elements a request reads, halved if too many */
+    unsigned chunk;
+    /* the objects, points[0..count) once the Object_List is read */
+    BACNET_DISCOVER_POINT *points;
+    uint32_t count;
+    /* the next element of the Object_List (1..), or point (1..), to read */
+    uint32_t next;
+} BACNET_DISCOVER_DEVICE;
+
+typedef struct BACnet_Discover_Config {
+    /* the instances of the Who-Is, -1 for all */
+    int32_t low_limit;
+    int32_t high_limit;
+    /* how long the I-Ams are waited for */
+    unsigned bind_ms;
+    /* the devices crawled at once */
+    unsigned concurrency;
+    /* the requests in flight to a device, up to MAX_DISCOVER_WINDOW */
+    unsigned window;
+    /* the least milliseconds between two requests to a device */
+    unsigned pace_ms;
+    /* the most Object_List elements of one request */
+    unsigned chunk;
+    DISCOVER_GRANULARITY granularity;
+} BACNET_DISCOVER_CONFIG;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* the defaults */
+    void discover_config_init(
+        BACNET_DISCOVER_CONFIG * config);
+/* sends the Who-Is, and takes the I-Am handler */
+    bool discover_start(
+        BACNET_DISCOVER_CONFIG * config);
+/* sends the requests due, after the milliseconds elapsed */
+    void discover_task(
+        uint16_t milliseconds);
+/* true once the I-Ams are no longer waited for and every device is done */
+    bool discover_done(
+        void);
+    unsigned discover_device_count(
+        void);
+    BACNET_DISCOVER_DEVICE *discover_device(
+        unsigned index);
+/* the points of the devices done as the configuration of bacnet2mqtt, */
+/* one pull policy of the interval, in seconds, per device */
+    void discover_print_policies(
+        FILE * stream,
+        uint32_t my_instance,
+        unsigned interval);
+    void discover_cleanup(
+        void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif
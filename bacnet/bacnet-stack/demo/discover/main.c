@@ -0,0 +1,230 @@
+/**************************************************************************
+*
+* Copyright (C) 2017 Steve Karg <skarg@users.sourceforge.net>
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*********************************************************************/
+
+/** @file discover/main.c  Command line tool that writes the pull policies
+ *                         of the points of a whole site. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "bacdef.h"
+#include "bactext.h"
+#include "address.h"
+#include "npdu.h"
+#include "apdu.h"
+#include "tsm.h"
+#include "device.h"
+#include "net.h"
+#include "datalink.h"
+#include "handlers.h"
+#include "client.h"
+#include "dlenv.h"
+#include "discover.h"
+
+/* buffer used for receive */
+static uint8_t Rx_Buf[MAX_MPDU] = { 0 };
+
+#if defined(BACDL_BIP)
+/* If set, use this as the source port. */
+static uint16_t My_BIP_Port = 0;
+#endif
+static uint32_t My_Instance = BACNET_MAX_INSTANCE;
+static unsigned Interval = 60;
+
+static void Init_Service_Handlers(
+    void)
+{
+    Device_Init(NULL);
+    /* we need to handle who-is
+       to support dynamic device binding to us */
+    apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_WHO_IS, handler_who_is);
+    /* set the handler for all the services we don't implement
+       It is required to send the proper reject message... */
+    apdu_set_unrecognized_service_handler_handler
+        (handler_unrecognized_service);
+    /* we must implement read property - it's required! */
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_READ_PROPERTY,
+        handler_read_property);
+    /* the acks, errors and aborts of the crawl go to its completions */
+}
+
+static uint32_t milliseconds(
+    void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint32_t) (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+static void PrintUsage(
+    void)
+{
+    printf("Usage: bacdiscover [options] [device-instance-min "
+        "device-instance-max]\n" "\n"
+        "Writes the bacnet2mqtt configuration of the points of every device\n"
+        "that answers the Who-Is, or of those in the range.\n" "\n"
+        "-c devices   the devices crawled at once, 64 by default\n"
+        "-w requests  the requests in flight to a device, 2 by default\n"
+        "-g objects|required|all  the properties read of each object\n"
+        "-b ms        how long the I-Ams are waited for, 10000 by default\n"
+        "-i seconds   the interval of the pull policies, 60 by default\n"
+        "-d instance  the device instance of the configuration\n"
+#if defined(BACDL_BIP)
+        "-p port      the source UDP port\n"
+#endif
+        );
+    exit(0);
+}
+
+static void CheckCommandLineArgs(
+    int argc,
+    char *argv[],
+    BACNET_DISCOVER_CONFIG * config)
+{
+    int i = 0;
+    int limits = 0;
+    long value = 0;
+
+    for (i = 1; i < argc; i++) {
+        char *anArg = argv[i];
+        if (anArg[0] == '-') {
+            if ((anArg[1] == 'h') || (++i >= argc))
+                PrintUsage();
+            value = strtol(argv[i], NULL, 0);
+            switch (anArg[1]) {
+                case 'c':
+                    config->concurrency = (unsigned) value;
+                    break;
+                case 'w':
+                    config->window = (unsigned) value;
+                    break;
+                case 'g':
+                    if (strcmp(argv[i], "objects") == 0)
+                        config->granularity = DISCOVER_OBJECTS_ONLY;
+                    else if (strcmp(argv[i], "all") == 0)
+                        config->granularity = DISCOVER_ALL;
+                    else if (strcmp(argv[i], "required") == 0)
+                        config->granularity = DISCOVER_REQUIRED;
+                    else
+                        PrintUsage();
+                    break;
+                case 'b':
+                    config->bind_ms = (unsigned) value;
+                    break;
+                case 'i':
+                    Interval = (unsigned) value;
+                    break;
+                case 'd':
+                    My_Instance = (uint32_t) value;
+                    break;
+#if defined(BACDL_BIP)
+                case 'p':
+                    My_BIP_Port = (uint16_t) value;
+                    break;
+#endif
+                default:
+                    PrintUsage();
+                    break;
+            }
+        } else {
+            value = strtol(anArg, NULL, 0);
+            if ((value < 0) || (value > BACNET_MAX_INSTANCE)) {
+                fprintf(stderr, "device-instance=%ld - it must be less "
+                    "than %u\n", value, BACNET_MAX_INSTANCE + 1);
+                exit(1);
+            }
+            if (limits == 0)
+                config->low_limit = config->high_limit = (int32_t) value;
+            else
+                config->high_limit = (int32_t) value;
+            limits++;
+        }
+    }
+}
+
+int main(
+    int argc,
+    char *argv[])
+{
+    BACNET_DISCOVER_CONFIG config;
+    BACNET_DISCOVER_DEVICE *device = NULL;
+    BACNET_ADDRESS src = {
+        0
+    };  /* address where message came from */
+    uint16_t pdu_len = 0;
+    unsigned timeout = 10;      /* milliseconds */
+    unsigned failed = 0;
+    unsigned i = 0;
+    uint32_t last_ms = 0;
+    uint32_t current_ms = 0;
+
+    discover_config_init(&config);
+    CheckCommandLineArgs(argc, argv, &config);
+    /* setup my info */
+    Device_Set_Object_Instance_Number(BACNET_MAX_INSTANCE);
+#if defined(BACDL_BIP)
+    if (My_BIP_Port > 0)
+        bip_set_port(htons(My_BIP_Port));
+#endif
+    address_init();
+    Init_Service_Handlers();
+    dlenv_init();
+    atexit(datalink_cleanup);
+    discover_start(&config);
+    last_ms = milliseconds();
+    while (!discover_done()) {
+        /* returns 0 bytes on timeout */
+        pdu_len = datalink_receive(&src, &Rx_Buf[0], MAX_MPDU, timeout);
+        if (pdu_len) {
+            npdu_handler(&src, &Rx_Buf[0], pdu_len);
+        }
+        current_ms = milliseconds();
+        if (current_ms != last_ms) {
+            tsm_timer_milliseconds((uint16_t) (current_ms - last_ms));
+            discover_task((uint16_t) (current_ms - last_ms));
+            last_ms = current_ms;
+        }
+    }
+    discover_print_policies(stdout, My_Instance, Interval);
+    for (i = 0; i < discover_device_count(); i++) {
+        device = discover_device(i);
+        if (device->state == DISCOVER_FAILED) {
+            fprintf(stderr, "device %lu failed\n",
+                (unsigned long) device->instance);
+            failed++;
+        }
+    }
+    fprintf(stderr, "%u devices, %u failed\n", discover_device_count(),
+        failed);
+    discover_cleanup();
+
+    return 0;
+}
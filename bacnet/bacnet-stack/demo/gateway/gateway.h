@@ -42,6 +42,10 @@
 #define DEV_NAME_BASE "Gateway Demo Device"
 #define DEV_DESCR_GATEWAY "Gateway Device and Router"
 #define DEV_DESCR_REMOTE  "Routed Remote Device"
+/* routed Devices unless given on the command line, up to MAX_NUM_DEVICES-1 */
+#define ROUTED_DEVICES 2
+/* Analog and Binary Inputs of each routed Device */
+#define ROUTED_DEVICE_POINTS 4
 
 
 
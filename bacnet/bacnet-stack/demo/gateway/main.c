@@ -56,6 +56,8 @@
 #include "version.h"
 /* include the device object */
 #include "device.h"
+#include "ai.h"
+#include "bi.h"
 #ifdef BACNET_TEST_VMAC
 #include "vmac.h"
 #endif
@@ -82,13 +84,18 @@ int DNET_list[2] = {
 
 
 /** Initialize the Device Objects and each of the child Object instances.
+ * Each routed Device gets its own ROUTED_DEVICE_POINTS Analog and Binary
+ * Inputs, as for the registers and coils of one downstream slave.
  * @param first_object_instance Set the first (gateway) Device to this
             instance number, and subsequent devices to incremented values.
+ * @param routed_devices The number of Devices behind the gateway.
  */
 void Devices_Init(
-    uint32_t first_object_instance)
+    uint32_t first_object_instance,
+    unsigned routed_devices)
 {
-    int i;
+    unsigned i;
+    unsigned j;
     char nameText[MAX_DEV_NAME_LEN];
     char descText[MAX_DEV_DESC_LEN];
     BACNET_CHARACTER_STRING name_string;
@@ -99,17 +106,22 @@ void Devices_Init(
         strlen(DEV_DESCR_GATEWAY));
 
     /* Now initialize the remote Device objects. */
-    for (i = 1; i < MAX_NUM_DEVICES; i++) {
+    for (i = 1; i <= routed_devices; i++) {
 #ifdef _MSC_VER
-        _snprintf(nameText, MAX_DEV_NAME_LEN, "%s %d", DEV_NAME_BASE, i + 1);
-        _snprintf(descText, MAX_DEV_DESC_LEN, "%s %d", DEV_DESCR_REMOTE, i);
+        _snprintf(nameText, MAX_DEV_NAME_LEN, "%s %u", DEV_NAME_BASE, i + 1);
+        _snprintf(descText, MAX_DEV_DESC_LEN, "%s %u", DEV_DESCR_REMOTE, i);
 #else
-        snprintf(nameText, MAX_DEV_NAME_LEN, "%s %d", DEV_NAME_BASE, i + 1);
-        snprintf(descText, MAX_DEV_DESC_LEN, "%s %d", DEV_DESCR_REMOTE, i);
+        snprintf(nameText, MAX_DEV_NAME_LEN, "%s %u", DEV_NAME_BASE, i + 1);
+        snprintf(descText, MAX_DEV_DESC_LEN, "%s %u", DEV_DESCR_REMOTE, i);
 #endif
         characterstring_init_ansi(&name_string, nameText);
 
+        /* the new Device is the one addressed, so the objects are its own */
         Add_Routed_Device((first_object_instance + i), &name_string, descText);
+        for (j = 0; j < ROUTED_DEVICE_POINTS; j++) {
+            Analog_Input_Create(j);
+            Binary_Input_Create(j);
+        }
     }
 
 }
@@ -252,7 +264,8 @@ void Initialize_Device_Addresses(
  *      tsm_timer_milliseconds
  *
  * @param argc [in] Arg count.
- * @param argv [in] Takes one argument: the Device Instance #.
+ * @param argv [in] Takes two optional arguments: the Device Instance # of
+ *                  the gateway, and the number of routed Devices.
  * @return 0 on success.
  */
 int main(
@@ -269,6 +282,8 @@ int main(
     uint32_t elapsed_seconds = 0;
     uint32_t elapsed_milliseconds = 0;
     uint32_t first_object_instance = FIRST_DEVICE_NUMBER;
+    unsigned routed_devices = ROUTED_DEVICES;
+    long value = 0;
 #ifdef BACNET_TEST_VMAC
     /* Router data */
     BACNET_DEVICE_PROFILE *device;
@@ -286,13 +301,25 @@ int main(
             exit(1);
         }
     }
+    if (argc > 2) {
+        value = strtol(argv[2], NULL, 0);
+        if ((value < 0) || (value >= MAX_NUM_DEVICES) ||
+            ((first_object_instance + value) >= BACNET_MAX_INSTANCE)) {
+            printf("Error: Invalid number of routed Devices %s \n",
+                argv[2]);
+            printf("Provide a number from 0 to %u \n",
+                (unsigned) (MAX_NUM_DEVICES - 1));
+            exit(1);
+        }
+        routed_devices = (unsigned) value;
+    }
     printf("BACnet Router Demo\n" "BACnet Stack Version %s\n"
-        "BACnet Device ID: %u\n" "Max APDU: %d\n", BACnet_Version,
-        first_object_instance, MAX_APDU);
+        "BACnet Device ID: %u\n" "Routed Devices: %u\n" "Max APDU: %d\n",
+        BACnet_Version, first_object_instance, routed_devices, MAX_APDU);
     Init_Service_Handlers(first_object_instance);
     dlenv_init();
     atexit(datalink_cleanup);
-    Devices_Init(first_object_instance);
+    Devices_Init(first_object_instance, routed_devices);
     Initialize_Device_Addresses();
 
 #ifdef BACNET_TEST_VMAC
@@ -318,6 +345,8 @@ int main(
         /* process */
         if (pdu_len) {
             routing_npdu_handler(&src, DNET_list, &Rx_Buf[0], pdu_len);
+            /* the timers below belong to the gateway Device */
+            Routed_Device_Address_Lookup(0, 0, NULL);
         }
         /* at least one second has passed */
         elapsed_seconds = current_seconds - last_seconds;
@@ -31,6 +31,12 @@
 #include "config.h"
 #include "bacdef.h"
 #include "apdu.h"
+#if defined(BACDL_MULTI)
+/* the MS/TP settings are for the MS/TP port */
+#include "dlmstp.h"
+#undef MAX_HEADER
+#undef MAX_MPDU
+#endif
 #include "datalink.h"
 #include "handlers.h"
 #include "dlenv.h"
@@ -215,6 +221,11 @@ void dlenv_maintenance_timer(
  * - BACDL_BIP: (BACnet/IP)
  *   - BACNET_IP_PORT - UDP/IP port number (0..65534) used for BACnet/IP
  *     communications.  Default is 47808 (0xBAC0).
+ *   - BACNET_IP_RCVBUF, BACNET_IP_SNDBUF - sizes in bytes of the socket
+ *     receive and send buffers.  Default is the system default.
+ *   - BACNET_IP_LANES - on Linux, the number of sockets sharing the port,
+ *     for an application that reads each with its own thread (see
+ *     bip_set_lane).  Default is 1.
  *   - BACNET_BBMD_PORT - UDP/IP port number (0..65534) used for Foreign
  *       Device Registration.  Defaults to 47808 (0xBAC0).
  *   - BACNET_BBMD_TIMETOLIVE - number of seconds used in Foreign Device
@@ -226,11 +237,33 @@ void dlenv_maintenance_timer(
  *   - BACNET_MAX_MASTER
  *   - BACNET_MSTP_BAUD
  *   - BACNET_MSTP_MAC
+ *   - BACNET_MSTP_PRIORITY - on Linux, the SCHED_FIFO priority of the
+ *       MS/TP task, which also locks the memory of the process.
+ *   - BACNET_MSTP_CPUS - on Linux, the mask of the CPUs of the MS/TP task.
+ *   - BACNET_MSTP_RS485 - on Linux, 1 has the kernel switch the transceiver
+ *       with RTS high while sending (TIOCSRS485), 2 with RTS low.  Default
+ *       is the adapter switching it.
+ *   - BACNET_MSTP_RTS_DELAY - with BACNET_MSTP_RS485, the milliseconds RTS
+ *       is set before a frame and held after it, as "before[,after]".
+ *   - BACNET_MSTP_LOW_LATENCY - on Linux, 0 leaves the latency timer of the
+ *       serial driver on.  Default is ASYNC_LOW_LATENCY.
+ *   - BACNET_MSTP_AUTO_TUNE - on Linux, 1 lets the node lower the
+ *       Max_Master it polls up to the highest master on the link, and raise
+ *       its Max_Info_Frames while it has frames queued.
+ * - BACDL_MULTI: (several datalinks at once)
+ *   - BACNET_DATALINKS - the ports, as comma separated type[:ifname[:net]]
+ *     with the types bip, mstp and ethernet, for example
+ *     "bip:eth0,mstp:/dev/ttyUSB0:2001".  The first port is the local
+ *     network; the others need their network numbers.  Default is "bip".
+ *     The BACDL_BIP and BACDL_MSTP variables set up those ports.
  */
 void dlenv_init(
     void)
 {
     char *pEnv = NULL;
+#if defined(BACDL_BIP)
+    char *pEnv2 = NULL;
+#endif
 
 #if defined(BACDL_ALL)
     pEnv = getenv("BACNET_DATALINK");
@@ -257,7 +290,18 @@ void dlenv_init(
         if (ntohs(bip_get_port()) < 1024)
             bip_set_port(htons(0xBAC0));
     }
-#elif defined(BACDL_MSTP)
+    pEnv = getenv("BACNET_IP_RCVBUF");
+    pEnv2 = getenv("BACNET_IP_SNDBUF");
+    if (pEnv || pEnv2) {
+        bip_set_socket_buffers(pEnv ? (int) strtol(pEnv, NULL, 0) : 0,
+            pEnv2 ? (int) strtol(pEnv2, NULL, 0) : 0);
+    }
+    pEnv = getenv("BACNET_IP_LANES");
+    if (pEnv) {
+        bip_set_lanes((unsigned) strtol(pEnv, NULL, 0));
+    }
+#endif
+#if defined(BACDL_MSTP) || defined(BACDL_MULTI)
     pEnv = getenv("BACNET_MAX_INFO_FRAMES");
     if (pEnv) {
         dlmstp_set_max_info_frames(strtol(pEnv, NULL, 0));
@@ -295,7 +339,12 @@ void dlenv_init(
     if (pEnv) {
         apdu_retries_set((uint8_t) strtol(pEnv, NULL, 0));
     }
-    if (!datalink_init(getenv("BACNET_IFACE"))) {
+#if defined(BACDL_MULTI)
+    pEnv = getenv("BACNET_DATALINKS");
+#else
+    pEnv = getenv("BACNET_IFACE");
+#endif
+    if (!datalink_init(pEnv)) {
         exit(1);
     }
 #if (MAX_TSM_TRANSACTIONS)
@@ -0,0 +1,434 @@
+/**************************************************************************
+*
+* Copyright (C) 2006 Steve Karg <skarg@users.sourceforge.net>
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*********************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "bacdef.h"
+#include "bacdcode.h"
+#include "bacstr.h"
+#include "address.h"
+#include "apdu.h"
+#include "npdu.h"
+#include "tsm.h"
+#include "dcc.h"
+#include "datalink.h"
+#include "arf.h"
+#include "awf.h"
+#include "txbuf.h"
+#include "filexfer.h"
+
+/** @file filexfer.c  Pipelined AtomicReadFile and AtomicWriteFile of a
+ * whole file, see filexfer.h. */
+
+/* the header of a segment, and the encoding of a read ack around its data */
+#define FILE_TRANSFER_SEGMENT_HEADER_LEN 5
+#define FILE_TRANSFER_READ_ACK_OVERHEAD 32
+/* the smallest chunk a reply too large for the device is cut down to */
+#define FILE_TRANSFER_MIN_CHUNK 16
+
+uint32_t file_transfer_chunk_size(
+    unsigned max_apdu,
+    bool segmentation,
+    bool write)
+{
+    uint32_t size = 0;
+
+    if ((max_apdu == 0) || (max_apdu > MAX_APDU))
+        max_apdu = MAX_APDU;
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+    if (segmentation && !write) {
+        /* the segments come in our max APDU, or the device's if smaller */
+        return MAX_SEGMENTS_ACCEPTED * (max_apdu -
+            FILE_TRANSFER_SEGMENT_HEADER_LEN) -
+            FILE_TRANSFER_READ_ACK_OVERHEAD;
+    }
+#else
+    (void) segmentation;
+#endif
+    /* keep the request, or its ack, in one APDU.
+       Typical sizes are 50, 128, 206, 480, 1024, and 1476 octets */
+    if (max_apdu <= 50) {
+        size = max_apdu - 20;
+    } else if (max_apdu <= 480) {
+        size = max_apdu - 32;
+    } else if (max_apdu <= 1476) {
+        size = max_apdu - 64;
+    } else {
+        size = max_apdu / 2;
+    }
+    if (write && (size > MAX_OCTET_STRING_BYTES))
+        size = MAX_OCTET_STRING_BYTES;
+
+    return size;
+}
+
+void file_transfer_init(
+    BACNET_FILE_TRANSFER * transfer,
+    uint32_t device_id,
+    uint32_t file_instance,
+    FILE * file,
+    bool write,
+    unsigned window)
+{
+    long size = 0;
+    unsigned i = 0;
+
+    memset(transfer, 0, sizeof(*transfer));
+    transfer->device_id = device_id;
+    transfer->file_instance = file_instance;
+    transfer->file = file;
+    transfer->write = write;
+    if (window < 1)
+        window = 1;
+    if (window > MAX_FILE_TRANSFER_WINDOW)
+        window = MAX_FILE_TRANSFER_WINDOW;
+    transfer->window = window;
+    transfer->size = -1;
+    if (write) {
+        if ((fseek(file, 0L, SEEK_END) == 0) && ((size = ftell(file)) >= 0) &&
+            (size <= INT32_MAX)) {
+            transfer->size = (int32_t) size;
+        } else {
+            transfer->state = FILE_TRANSFER_FAILED;
+        }
+    }
+    for (i = 0; i < MAX_FILE_TRANSFER_WINDOW; i++) {
+        transfer->chunks[i].transfer = transfer;
+    }
+}
+
+bool file_transfer_done(
+    BACNET_FILE_TRANSFER * transfer)
+{
+    return transfer->state != FILE_TRANSFER_RUNNING;
+}
+
+static void file_transfer_fail(
+    BACNET_FILE_TRANSFER * transfer,
+    BACNET_CONFIRMED_REPLY * reply)
+{
+    transfer->state = FILE_TRANSFER_FAILED;
+    if (reply) {
+        transfer->timeout = reply->timeout;
+        transfer->pdu_type = reply->pdu_type;
+        transfer->error_class = reply->error_class;
+        transfer->error_code = reply->error_code;
+        transfer->reason = reply->reason;
+    }
+}
+
+/* the chunk is sent again, unless it has been too often */
+static void file_transfer_retry(
+    BACNET_FILE_TRANSFER * transfer,
+    BACNET_FILE_TRANSFER_CHUNK * chunk,
+    BACNET_CONFIRMED_REPLY * reply)
+{
+    if (chunk->retries >= FILE_TRANSFER_RETRIES) {
+        file_transfer_fail(transfer, reply);
+        return;
+    }
+    chunk->retries++;
+    transfer->retries++;
+}
+
+/* the ack of a read goes to the local file at its offset; false if it is
+   not the ack of the request */
+static bool file_transfer_read_ack(
+    BACNET_FILE_TRANSFER * transfer,
+    BACNET_FILE_TRANSFER_CHUNK * chunk,
+    BACNET_CONFIRMED_REPLY * reply)
+{
+    bool end_of_file = false;
+    int32_t start = 0;
+    uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    int32_t end = 0;
+
+    if ((arf_ack_decode_stream(reply->service_request, reply->service_len,
+                &end_of_file, &start, &data, &data_len) <= 0) ||
+        (start != chunk->offset) || (data_len > chunk->requested))
+        return false;
+    if ((data_len == 0) && !end_of_file)
+        return false;
+    if (data_len > 0) {
+        if ((fseek(transfer->file, start, SEEK_SET) != 0) ||
+            (fwrite(data, 1, data_len, transfer->file) != data_len)) {
+            file_transfer_fail(transfer, NULL);
+            return true;
+        }
+    }
+    transfer->done += data_len;
+    chunk->offset += (int32_t) data_len;
+    chunk->length -= data_len;
+    if (end_of_file) {
+        end = start + (int32_t) data_len;
+        if ((transfer->size < 0) || (end < transfer->size))
+            transfer->size = end;
+    }
+    if ((chunk->length == 0) || ((transfer->size >= 0) &&
+            (chunk->offset >= transfer->size)))
+        chunk->busy = false;
+
+    return true;
+}
+
+static bool file_transfer_write_ack(
+    BACNET_FILE_TRANSFER * transfer,
+    BACNET_FILE_TRANSFER_CHUNK * chunk,
+    BACNET_CONFIRMED_REPLY * reply)
+{
+    BACNET_ATOMIC_WRITE_FILE_DATA data;
+
+    if ((awf_ack_decode_service_request(reply->service_request,
+                reply->service_len, &data) <= 0) ||
+        (data.access != FILE_STREAM_ACCESS) ||
+        (data.type.stream.fileStartPosition != chunk->offset))
+        return false;
+    transfer->done += chunk->requested;
+    chunk->offset += (int32_t) chunk->requested;
+    chunk->length -= chunk->requested;
+    if (chunk->length == 0)
+        chunk->busy = false;
+
+    return true;
+}
+
+static void file_transfer_completed(
+    BACNET_ADDRESS * src,
+    uint8_t invoke_id,
+    BACNET_CONFIRMED_REPLY * reply,
+    void *context)
+{
+    BACNET_FILE_TRANSFER_CHUNK *chunk = (BACNET_FILE_TRANSFER_CHUNK *) context;
+    BACNET_FILE_TRANSFER *transfer = chunk->transfer;
+    bool acked = false;
+    bool too_large = false;
+
+    (void) src;
+    (void) invoke_id;
+    chunk->inflight = false;
+    if (transfer->state != FILE_TRANSFER_RUNNING) {
+        chunk->busy = false;
+        return;
+    }
+    if ((reply->pdu_type == PDU_TYPE_COMPLEX_ACK) && reply->service_request) {
+        if (transfer->write)
+            acked = file_transfer_write_ack(transfer, chunk, reply);
+        else
+            acked = file_transfer_read_ack(transfer, chunk, reply);
+        if (!acked)
+            file_transfer_retry(transfer, chunk, reply);
+        return;
+    }
+    /* the reads past the end of the file sent before it was known */
+    if (!transfer->write && (transfer->size >= 0) &&
+        (chunk->offset >= transfer->size)) {
+        chunk->busy = false;
+        return;
+    }
+    if (reply->timeout) {
+        file_transfer_retry(transfer, chunk, reply);
+        return;
+    }
+    /* the reply doesn't fit, in segments or at all */
+    too_large = (reply->pdu_type == PDU_TYPE_ABORT) &&
+        ((reply->reason == ABORT_REASON_SEGMENTATION_NOT_SUPPORTED) ||
+        (reply->reason == ABORT_REASON_BUFFER_OVERFLOW));
+    if (too_large && transfer->segmentation) {
+        transfer->segmentation = false;
+        transfer->chunk_size =
+            file_transfer_chunk_size(transfer->max_apdu, false,
+            transfer->write);
+        return;
+    }
+    if (too_large && (transfer->chunk_size > FILE_TRANSFER_MIN_CHUNK)) {
+        transfer->chunk_size /= 2;
+        return;
+    }
+    file_transfer_fail(transfer, reply);
+}
+
+/* sends the next request of the chunk; false if there is no invoke id */
+static bool file_transfer_send(
+    BACNET_FILE_TRANSFER * transfer,
+    BACNET_FILE_TRANSFER_CHUNK * chunk)
+{
+    BACNET_ADDRESS my_address;
+    BACNET_NPDU_DATA npdu_data;
+    BACNET_ATOMIC_READ_FILE_DATA read_data;
+    BACNET_ATOMIC_WRITE_FILE_DATA write_data;
+    uint8_t buffer[MAX_APDU];
+    uint32_t count = chunk->length;
+    uint8_t invoke_id = 0;
+    int pdu_len = 0;
+    int len = 0;
+
+    if (count > transfer->chunk_size)
+        count = transfer->chunk_size;
+    if (transfer->write) {
+        if (count > sizeof(buffer))
+            count = sizeof(buffer);
+        if ((count > 0) && ((fseek(transfer->file, chunk->offset,
+                        SEEK_SET) != 0) ||
+                (fread(buffer, 1, count, transfer->file) != count))) {
+            file_transfer_fail(transfer, NULL);
+            return false;
+        }
+    }
+    invoke_id = tsm_next_free_invokeID_peer(&transfer->dest);
+    if (invoke_id == 0)
+        return false;
+    datalink_get_my_address(&my_address);
+    npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_NORMAL);
+    pdu_len =
+        npdu_encode_pdu(&Handler_Transmit_Buffer[0], &transfer->dest,
+        &my_address, &npdu_data);
+    if (transfer->write) {
+        write_data.object_type = OBJECT_FILE;
+        write_data.object_instance = transfer->file_instance;
+        write_data.access = FILE_STREAM_ACCESS;
+        write_data.type.stream.fileStartPosition = chunk->offset;
+        octetstring_init(&write_data.fileData, buffer, count);
+        len =
+            awf_encode_apdu(&Handler_Transmit_Buffer[pdu_len], invoke_id,
+            &write_data);
+    } else {
+        read_data.object_type = OBJECT_FILE;
+        read_data.object_instance = transfer->file_instance;
+        read_data.access = FILE_STREAM_ACCESS;
+        read_data.type.stream.fileStartPosition = chunk->offset;
+        read_data.type.stream.requestedOctetCount = count;
+        len =
+            arf_encode_apdu(&Handler_Transmit_Buffer[pdu_len], invoke_id,
+            &read_data);
+    }
+    /* the chunk size keeps the request in the APDU of the device */
+    if ((len <= 0) || ((unsigned) (pdu_len + len) >= transfer->max_apdu) ||
+        ((unsigned) (pdu_len + len) > MAX_PDU)) {
+        tsm_free_invoke_id_peer(&transfer->dest, invoke_id);
+        file_transfer_fail(transfer, NULL);
+        return false;
+    }
+    pdu_len += len;
+    tsm_set_confirmed_unsegmented_transaction(invoke_id, &transfer->dest,
+        &npdu_data, &Handler_Transmit_Buffer[0], (uint16_t) pdu_len);
+    tsm_set_completion(&transfer->dest, invoke_id, file_transfer_completed,
+        chunk);
+    chunk->inflight = true;
+    chunk->requested = count;
+    transfer->requests++;
+    datalink_send_pdu(&transfer->dest, &npdu_data,
+        &Handler_Transmit_Buffer[0], pdu_len);
+
+    return true;
+}
+
+/* the next range of the file, NULL if the window is full or it has been
+   given out to the end */
+static BACNET_FILE_TRANSFER_CHUNK *file_transfer_next_chunk(
+    BACNET_FILE_TRANSFER * transfer,
+    unsigned busy)
+{
+    BACNET_FILE_TRANSFER_CHUNK *chunk = NULL;
+    uint32_t length = transfer->chunk_size;
+    unsigned i = 0;
+
+    if (busy >= transfer->window)
+        return NULL;
+    if ((transfer->size >= 0) && (transfer->next >= transfer->size) &&
+        (transfer->requests > 0))
+        return NULL;
+    /* the server may truncate the file on a write at 0, so the others
+       wait for its ack */
+    if (transfer->write && (transfer->next > 0) && (transfer->done == 0))
+        return NULL;
+    if ((transfer->size >= 0) &&
+        ((uint32_t) (transfer->size - transfer->next) < length))
+        length = (uint32_t) (transfer->size - transfer->next);
+    for (i = 0; i < transfer->window; i++) {
+        if (!transfer->chunks[i].busy) {
+            chunk = &transfer->chunks[i];
+            chunk->busy = true;
+            chunk->inflight = false;
+            chunk->offset = transfer->next;
+            chunk->length = length;
+            chunk->requested = 0;
+            chunk->retries = 0;
+            transfer->next += (int32_t) length;
+            return chunk;
+        }
+    }
+
+    return NULL;
+}
+
+void file_transfer_task(
+    BACNET_FILE_TRANSFER * transfer)
+{
+    BACNET_FILE_TRANSFER_CHUNK *chunk = NULL;
+    unsigned busy = 0;
+    unsigned i = 0;
+
+    if (transfer->state != FILE_TRANSFER_RUNNING)
+        return;
+    if (!transfer->bound) {
+        transfer->bound =
+            address_get_by_device(transfer->device_id, &transfer->max_apdu,
+            &transfer->dest);
+        if (!transfer->bound)
+            return;
+        if (transfer->chunk_size == 0) {
+            transfer->chunk_size =
+                file_transfer_chunk_size(transfer->max_apdu,
+                transfer->segmentation, transfer->write);
+        }
+    }
+    if (!dcc_communication_enabled())
+        return;
+    /* the chunks waiting for a request first, the new ones after */
+    for (i = 0; i < transfer->window; i++) {
+        chunk = &transfer->chunks[i];
+        if (!chunk->busy)
+            continue;
+        if (!chunk->inflight && !transfer->write && (transfer->size >= 0) &&
+            (chunk->offset >= transfer->size)) {
+            chunk->busy = false;
+            continue;
+        }
+        busy++;
+        if (!chunk->inflight && !file_transfer_send(transfer, chunk))
+            return;
+    }
+    while ((chunk = file_transfer_next_chunk(transfer, busy)) != NULL) {
+        busy++;
+        if (!file_transfer_send(transfer, chunk))
+            return;
+    }
+    if ((busy == 0) && (transfer->size >= 0) &&
+        (transfer->next >= transfer->size) && (transfer->requests > 0))
+        transfer->state = FILE_TRANSFER_DONE;
+}
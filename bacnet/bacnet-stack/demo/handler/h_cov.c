@@ -25,6 +25,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include "config.h"
@@ -40,6 +41,9 @@
 #include "cov.h"
 #include "tsm.h"
 #include "dcc.h"
+#if defined(BACDL_BIP)
+#include "bip.h"
+#endif
 #if PRINT_ENABLED
 #include "bactext.h"
 #endif
@@ -49,8 +53,12 @@
 
 /** @file h_cov.c  Handles Change of Value (COV) services. */
 
+/* index of no subscription or no address */
+#define COV_NONE 0xFFFFFFFFU
+
 typedef struct BACnet_COV_Address{
     bool valid:1;
+    unsigned refs;      /* subscriptions notified at this address */
     BACNET_ADDRESS dest;
 } BACNET_COV_ADDRESS;
 
@@ -64,21 +72,63 @@ typedef struct BACnet_COV_Subscription_Flags {
 
 typedef struct BACnet_COV_Subscription {
     BACNET_COV_SUBSCRIPTION_FLAGS flag;
-    uint8_t dest_index;
     uint8_t invokeID;   /* for confirmed COV */
+    uint32_t dest_index;
     uint32_t subscriberProcessIdentifier;
     uint32_t lifetime;  /* optional */
     BACNET_OBJECT_ID monitoredObjectIdentifier;
+    /* the next subscription in the same object hash bucket, or the next
+       free entry; COV_NONE at the end */
+    uint32_t next;
 } BACNET_COV_SUBSCRIPTION;
 
+/* The subscriptions and the addresses are allocated on demand and grow
+   by doubling, up to these limits.  The subscriptions are found through
+   a hash of the monitored object, so a change only visits the
+   subscriptions of its own object. */
 #ifndef MAX_COV_SUBCRIPTIONS
-#define MAX_COV_SUBCRIPTIONS 128
+#define MAX_COV_SUBCRIPTIONS 65536
 #endif
-static BACNET_COV_SUBSCRIPTION COV_Subscriptions[MAX_COV_SUBCRIPTIONS];
 #ifndef MAX_COV_ADDRESSES
-#define MAX_COV_ADDRESSES 16
+#define MAX_COV_ADDRESSES 1024
+#endif
+#ifndef COV_SUBSCRIPTIONS_INITIAL
+#define COV_SUBSCRIPTIONS_INITIAL 64
+#endif
+#ifndef COV_ADDRESSES_INITIAL
+#define COV_ADDRESSES_INITIAL 8
+#endif
+static BACNET_COV_SUBSCRIPTION *COV_Subscriptions;
+static unsigned COV_Subscription_Capacity;
+static unsigned COV_Subscription_Count;
+static uint32_t COV_Subscription_Free = COV_NONE;
+/* head of each object hash bucket, as many buckets as subscriptions */
+static uint32_t *COV_Object_Hash;
+/* scratch for sending, the subscriptions ordered by address */
+static uint32_t *COV_Send_Order;
+static BACNET_COV_ADDRESS *COV_Addresses;
+static unsigned COV_Address_Capacity;
+/* scratch for sending, the first subscription of each address */
+static unsigned *COV_Address_First;
+
+/* some subscription may have a notification to send,
+   or a confirmed notification outstanding */
+static bool COV_Send_Pending;
+static bool COV_Confirm_Pending;
+/* notifications sent by one call of the COV task; MS/TP ports that can
+   send only one frame per task cycle should set this to 1 */
+#ifndef MAX_COV_NOTIFICATIONS_PER_TASK
+#define MAX_COV_NOTIFICATIONS_PER_TASK 16
+#endif
+
+/* the objects changed by a batch of writes, marked once at its end; past
+   these, the changed objects are marked right away */
+#ifndef MAX_COV_BATCH_OBJECTS
+#define MAX_COV_BATCH_OBJECTS 64
 #endif
-static BACNET_COV_ADDRESS COV_Addresses[MAX_COV_ADDRESSES];
+static bool COV_Batch_Active;
+static unsigned COV_Batch_Count;
+static BACNET_OBJECT_ID COV_Batch_Objects[MAX_COV_BATCH_OBJECTS];
 
 /**
 * Gets the address from the list of COV addresses
@@ -89,11 +139,11 @@ static BACNET_COV_ADDRESS COV_Addresses[MAX_COV_ADDRESSES];
 * @return true if valid address, false if not valid or not found
 */
 static BACNET_ADDRESS *cov_address_get(
-    int index)
+    uint32_t index)
 {
     BACNET_ADDRESS *cov_dest = NULL;
 
-    if (index < MAX_COV_ADDRESSES) {
+    if (index < COV_Address_Capacity) {
         if (COV_Addresses[index].valid) {
             cov_dest = &COV_Addresses[index].dest;
         }
@@ -103,73 +153,297 @@ static BACNET_ADDRESS *cov_address_get(
 }
 
 /**
- * Removes the address from the list of COV addresses, if it is not
- * used by other COV subscriptions
- */
-static void cov_address_remove_unused(void)
+* Finds the address in the list of COV addresses
+*
+* @param  dest - address to look for
+*
+* @return index number 0..N, or COV_NONE if not found
+*/
+static uint32_t cov_address_find(
+    BACNET_ADDRESS * dest)
 {
-    unsigned index = 0;
-    unsigned cov_index = 0;
-    bool found = false;
-
-    for (cov_index = 0; cov_index < MAX_COV_ADDRESSES; cov_index++) {
-        if (COV_Addresses[cov_index].valid) {
-            found = false;
-            for (index = 0; index < MAX_COV_SUBCRIPTIONS; index++) {
-                if ((COV_Subscriptions[index].flag.valid) &&
-                    (COV_Subscriptions[index].dest_index == cov_index)) {
-                    found = true;
-                    break;
-                }
-            }
-            if (!found) {
-                COV_Addresses[cov_index].valid = false;
+    uint32_t i = 0;
+
+    if (dest) {
+        for (i = 0; i < COV_Address_Capacity; i++) {
+            if (COV_Addresses[i].valid &&
+                bacnet_address_same(dest, &COV_Addresses[i].dest)) {
+                return i;
             }
         }
     }
+
+    return COV_NONE;
+}
+
+static bool cov_address_grow(
+    void)
+{
+    unsigned capacity = 0;
+    unsigned i = 0;
+    BACNET_COV_ADDRESS *addresses = NULL;
+    unsigned *first = NULL;
+
+    capacity = COV_Address_Capacity ? COV_Address_Capacity * 2 :
+        COV_ADDRESSES_INITIAL;
+    if (capacity > MAX_COV_ADDRESSES) {
+        capacity = MAX_COV_ADDRESSES;
+    }
+    if (capacity <= COV_Address_Capacity) {
+        return false;
+    }
+    addresses = realloc(COV_Addresses, capacity * sizeof(*addresses));
+    if (!addresses) {
+        return false;
+    }
+    COV_Addresses = addresses;
+    first = realloc(COV_Address_First, (capacity + 1) * sizeof(*first));
+    if (!first) {
+        return false;
+    }
+    COV_Address_First = first;
+    for (i = COV_Address_Capacity; i < capacity; i++) {
+        COV_Addresses[i].valid = false;
+        COV_Addresses[i].refs = 0;
+    }
+    COV_Address_Capacity = capacity;
+
+    return true;
 }
 
 /**
-* Adds the address to the list of COV addresses
+* Adds a reference to the address in the list of COV addresses,
+* adding the address if there is room in the list
 *
-* @param  dest - address to be added if there is room in the list
+* @param  dest - address to be added
 *
-* @return index number 0..N, or -1 if unable to add
+* @return index number 0..N, or COV_NONE if unable to add
 */
-static int cov_address_add(
-    BACNET_ADDRESS *dest)
+static uint32_t cov_address_add(
+    BACNET_ADDRESS * dest)
 {
-    int index = -1;
-    unsigned i = 0;
-    bool found = false;
-    bool valid = false;
-    BACNET_ADDRESS *cov_dest = NULL;
+    uint32_t index = COV_NONE;
+    uint32_t i = 0;
 
-    if (dest) {
-        for (i = 0; i < MAX_COV_ADDRESSES; i++) {
-            valid = COV_Addresses[i].valid;
-            if (valid) {
-                cov_dest = &COV_Addresses[i].dest;
-                found = bacnet_address_same(dest, cov_dest);
-                if (found) {
-                    index = i;
-                    break;
-                }
+    if (!dest) {
+        return COV_NONE;
+    }
+    index = cov_address_find(dest);
+    if (index == COV_NONE) {
+        /* find a free place to add a new address */
+        for (i = 0; i < COV_Address_Capacity; i++) {
+            if (!COV_Addresses[i].valid) {
+                index = i;
+                break;
             }
         }
-        if (!found) {
-            /* find a free place to add a new address */
-            for (i = 0; i < MAX_COV_ADDRESSES; i++) {
-                valid = COV_Addresses[i].valid;
-                if (!valid) {
-                    index = i;
-                    cov_dest = &COV_Addresses[i].dest;
-                    bacnet_address_copy(cov_dest, dest);
-                    COV_Addresses[i].valid = true;
-                    break;
-                }
+        if (index == COV_NONE) {
+            i = COV_Address_Capacity;
+            if (cov_address_grow()) {
+                index = i;
             }
         }
+        if (index != COV_NONE) {
+            bacnet_address_copy(&COV_Addresses[index].dest, dest);
+            COV_Addresses[index].valid = true;
+            COV_Addresses[index].refs = 0;
+        }
+    }
+    if (index != COV_NONE) {
+        COV_Addresses[index].refs++;
+    }
+
+    return index;
+}
+
+/**
+ * Drops a reference to the address, and removes the address from the
+ * list of COV addresses once no subscription uses it.
+ */
+static void cov_address_release(
+    uint32_t index)
+{
+    if ((index < COV_Address_Capacity) && COV_Addresses[index].valid) {
+        if (COV_Addresses[index].refs) {
+            COV_Addresses[index].refs--;
+        }
+        if (COV_Addresses[index].refs == 0) {
+            COV_Addresses[index].valid = false;
+        }
+    }
+}
+
+static uint32_t cov_object_bucket(
+    uint32_t object_type,
+    uint32_t object_instance)
+{
+    uint32_t key = (object_type << 22) ^ object_instance;
+
+    /* Fibonacci hashing, then the high bits folded in */
+    key *= 2654435769U;
+    key ^= key >> 16;
+
+    return key % COV_Subscription_Capacity;
+}
+
+static void cov_object_link(
+    uint32_t index)
+{
+    uint32_t bucket = 0;
+
+    bucket =
+        cov_object_bucket(COV_Subscriptions[index].
+        monitoredObjectIdentifier.type,
+        COV_Subscriptions[index].monitoredObjectIdentifier.instance);
+    COV_Subscriptions[index].next = COV_Object_Hash[bucket];
+    COV_Object_Hash[bucket] = index;
+}
+
+static void cov_object_unlink(
+    uint32_t index)
+{
+    uint32_t *link = NULL;
+
+    link =
+        &COV_Object_Hash[cov_object_bucket(COV_Subscriptions[index].
+            monitoredObjectIdentifier.type,
+            COV_Subscriptions[index].monitoredObjectIdentifier.instance)];
+    while (*link != COV_NONE) {
+        if (*link == index) {
+            *link = COV_Subscriptions[index].next;
+            break;
+        }
+        link = &COV_Subscriptions[*link].next;
+    }
+    COV_Subscriptions[index].next = COV_NONE;
+}
+
+/* doubles the subscriptions, and rebuilds the object hash */
+static bool cov_subscription_grow(
+    void)
+{
+    unsigned capacity = 0;
+    unsigned i = 0;
+    BACNET_COV_SUBSCRIPTION *subscriptions = NULL;
+    uint32_t *hash = NULL;
+    uint32_t *order = NULL;
+
+    capacity = COV_Subscription_Capacity ? COV_Subscription_Capacity * 2 :
+        COV_SUBSCRIPTIONS_INITIAL;
+    if (capacity > MAX_COV_SUBCRIPTIONS) {
+        capacity = MAX_COV_SUBCRIPTIONS;
+    }
+    if (capacity <= COV_Subscription_Capacity) {
+        return false;
+    }
+    hash = malloc(capacity * sizeof(*hash));
+    order = realloc(COV_Send_Order, capacity * sizeof(*order));
+    if (order) {
+        COV_Send_Order = order;
+    }
+    subscriptions = NULL;
+    if (hash && order) {
+        subscriptions =
+            realloc(COV_Subscriptions, capacity * sizeof(*subscriptions));
+    }
+    if (!subscriptions) {
+        free(hash);
+        return false;
+    }
+    COV_Subscriptions = subscriptions;
+    free(COV_Object_Hash);
+    COV_Object_Hash = hash;
+    /* the new entries go to the free list, lowest index first */
+    for (i = capacity; i > COV_Subscription_Capacity; i--) {
+        COV_Subscriptions[i - 1].flag.valid = false;
+        COV_Subscriptions[i - 1].flag.send_requested = false;
+        COV_Subscriptions[i - 1].invokeID = 0;
+        COV_Subscriptions[i - 1].next = COV_Subscription_Free;
+        COV_Subscription_Free = i - 1;
+    }
+    COV_Subscription_Capacity = capacity;
+    for (i = 0; i < capacity; i++) {
+        COV_Object_Hash[i] = COV_NONE;
+    }
+    for (i = 0; i < capacity; i++) {
+        if (COV_Subscriptions[i].flag.valid) {
+            cov_object_link(i);
+        }
+    }
+
+    return true;
+}
+
+/* takes a free subscription, or COV_NONE if out of resources */
+static uint32_t cov_subscription_alloc(
+    void)
+{
+    uint32_t index = COV_NONE;
+
+    if (COV_Subscription_Free == COV_NONE) {
+        (void) cov_subscription_grow();
+    }
+    if (COV_Subscription_Free != COV_NONE) {
+        index = COV_Subscription_Free;
+        COV_Subscription_Free = COV_Subscriptions[index].next;
+        COV_Subscriptions[index].next = COV_NONE;
+    }
+
+    return index;
+}
+
+/* removes the subscription, with its address and its invoke id */
+static void cov_subscription_free(
+    uint32_t index)
+{
+    cov_object_unlink(index);
+    cov_address_release(COV_Subscriptions[index].dest_index);
+    COV_Subscriptions[index].dest_index = COV_NONE;
+    if (COV_Subscriptions[index].invokeID) {
+        tsm_free_invoke_id(COV_Subscriptions[index].invokeID);
+        COV_Subscriptions[index].invokeID = 0;
+    }
+    COV_Subscriptions[index].flag.valid = false;
+    COV_Subscriptions[index].flag.send_requested = false;
+    COV_Subscriptions[index].next = COV_Subscription_Free;
+    COV_Subscription_Free = index;
+    COV_Subscription_Count--;
+}
+
+/* the subscription of the subscriber to the object, or COV_NONE */
+static uint32_t cov_subscription_find(
+    BACNET_ADDRESS * src,
+    BACNET_SUBSCRIBE_COV_DATA * cov_data)
+{
+    uint32_t index = COV_NONE;
+    uint32_t dest_index = COV_NONE;
+    bool address_match = false;
+
+    if (COV_Subscription_Count == 0) {
+        return COV_NONE;
+    }
+    dest_index = cov_address_find(src);
+    index =
+        COV_Object_Hash[cov_object_bucket(cov_data->
+            monitoredObjectIdentifier.type,
+            cov_data->monitoredObjectIdentifier.instance)];
+    while (index != COV_NONE) {
+        if (cov_address_get(COV_Subscriptions[index].dest_index)) {
+            address_match =
+                (COV_Subscriptions[index].dest_index == dest_index);
+        } else {
+            /* skip address matching - we don't have an address */
+            address_match = true;
+        }
+        if ((COV_Subscriptions[index].monitoredObjectIdentifier.type ==
+                cov_data->monitoredObjectIdentifier.type) &&
+            (COV_Subscriptions[index].monitoredObjectIdentifier.instance ==
+                cov_data->monitoredObjectIdentifier.instance) &&
+            (COV_Subscriptions[index].subscriberProcessIdentifier ==
+                cov_data->subscriberProcessIdentifier) && address_match) {
+            break;
+        }
+        index = COV_Subscriptions[index].next;
     }
 
     return index;
@@ -308,7 +582,7 @@ int handler_cov_encode_subscriptions(
     unsigned index = 0;
 
     if (apdu) {
-        for (index = 0; index < MAX_COV_SUBCRIPTIONS; index++) {
+        for (index = 0; index < COV_Subscription_Capacity; index++) {
             if (COV_Subscriptions[index].flag.valid) {
                 len =
                     cov_encode_subscription(&apdu[apdu_len],
@@ -333,21 +607,26 @@ void handler_cov_init(
 {
     unsigned index = 0;
 
-    for (index = 0; index < MAX_COV_SUBCRIPTIONS; index++) {
-        COV_Subscriptions[index].flag.valid = false;
-        COV_Subscriptions[index].dest_index = -1;
-        COV_Subscriptions[index].subscriberProcessIdentifier = 0;
-        COV_Subscriptions[index].monitoredObjectIdentifier.type =
-            OBJECT_ANALOG_INPUT;
-        COV_Subscriptions[index].monitoredObjectIdentifier.instance = 0;
-        COV_Subscriptions[index].flag.issueConfirmedNotifications = false;
-        COV_Subscriptions[index].invokeID = 0;
-        COV_Subscriptions[index].lifetime = 0;
-        COV_Subscriptions[index].flag.send_requested = false;
+    /* the memory is kept for the next subscriptions */
+    COV_Subscription_Count = 0;
+    COV_Subscription_Free = COV_NONE;
+    for (index = COV_Subscription_Capacity; index > 0; index--) {
+        COV_Subscriptions[index - 1].flag.valid = false;
+        COV_Subscriptions[index - 1].flag.send_requested = false;
+        COV_Subscriptions[index - 1].flag.issueConfirmedNotifications = false;
+        COV_Subscriptions[index - 1].dest_index = COV_NONE;
+        COV_Subscriptions[index - 1].invokeID = 0;
+        COV_Subscriptions[index - 1].lifetime = 0;
+        COV_Subscriptions[index - 1].next = COV_Subscription_Free;
+        COV_Subscription_Free = index - 1;
+        COV_Object_Hash[index - 1] = COV_NONE;
     }
-    for (index = 0; index < MAX_COV_ADDRESSES; index++) {
+    for (index = 0; index < COV_Address_Capacity; index++) {
         COV_Addresses[index].valid = false;
+        COV_Addresses[index].refs = 0;
     }
+    COV_Send_Pending = false;
+    COV_Confirm_Pending = false;
 }
 
 static bool cov_list_subscribe(
@@ -356,62 +635,53 @@ static bool cov_list_subscribe(
     BACNET_ERROR_CLASS * error_class,
     BACNET_ERROR_CODE * error_code)
 {
-    bool existing_entry = false;
-    int index;
-    int first_invalid_index = -1;
+    uint32_t index = COV_NONE;
+    uint32_t dest_index = COV_NONE;
     bool found = true;
-    bool address_match = false;
-    BACNET_ADDRESS *dest = NULL;
 
     /* unable to subscribe - resources? */
     /* unable to cancel subscription - other? */
 
     /* existing? - match Object ID and Process ID and address */
-    for (index = 0; index < MAX_COV_SUBCRIPTIONS; index++) {
-        if (COV_Subscriptions[index].flag.valid) {
-            dest = cov_address_get(COV_Subscriptions[index].dest_index);
-            if (dest) {
-                address_match = bacnet_address_same(src, dest);
-            } else {
-                /* skip address matching - we don't have an address */
-                address_match = true;
-            }
-            if ((COV_Subscriptions[index].monitoredObjectIdentifier.type ==
-                    cov_data->monitoredObjectIdentifier.type) &&
-                (COV_Subscriptions[index].monitoredObjectIdentifier.instance ==
-                    cov_data->monitoredObjectIdentifier.instance) &&
-                (COV_Subscriptions[index].subscriberProcessIdentifier ==
-                    cov_data->subscriberProcessIdentifier) && address_match) {
-                existing_entry = true;
-                if (cov_data->cancellationRequest) {
-                    COV_Subscriptions[index].flag.valid = false;
-                    COV_Subscriptions[index].dest_index = -1;
-                    cov_address_remove_unused();
-                } else {
-                    COV_Subscriptions[index].dest_index = cov_address_add(src);
-                    COV_Subscriptions[index].flag.issueConfirmedNotifications =
-                        cov_data->issueConfirmedNotifications;
-                    COV_Subscriptions[index].lifetime = cov_data->lifetime;
-                    COV_Subscriptions[index].flag.send_requested = true;
-                }
-                if (COV_Subscriptions[index].invokeID) {
-                    tsm_free_invoke_id(COV_Subscriptions[index].invokeID);
-                    COV_Subscriptions[index].invokeID = 0;
-                }
-                break;
-            }
+    index = cov_subscription_find(src, cov_data);
+    if (index != COV_NONE) {
+        if (cov_data->cancellationRequest) {
+            cov_subscription_free(index);
         } else {
-            if (first_invalid_index < 0) {
-                first_invalid_index = index;
+            dest_index = cov_address_add(src);
+            cov_address_release(COV_Subscriptions[index].dest_index);
+            COV_Subscriptions[index].dest_index = dest_index;
+            COV_Subscriptions[index].flag.issueConfirmedNotifications =
+                cov_data->issueConfirmedNotifications;
+            COV_Subscriptions[index].lifetime = cov_data->lifetime;
+            COV_Subscriptions[index].flag.send_requested = true;
+            COV_Send_Pending = true;
+            if (COV_Subscriptions[index].invokeID) {
+                tsm_free_invoke_id(COV_Subscriptions[index].invokeID);
+                COV_Subscriptions[index].invokeID = 0;
             }
         }
-    }
-    if (!existing_entry && (first_invalid_index >= 0) &&
-        (!cov_data->cancellationRequest)) {
-        index = first_invalid_index;
+    } else if (cov_data->cancellationRequest) {
+        /* cancellationRequest - valid object not subscribed */
+        /* From BACnet Standard 135-2010-13.14.2
+           ...Cancellations that are issued for which no matching COV
+           context can be found shall succeed as if a context had
+           existed, returning 'Result(+)'. */
         found = true;
+    } else {
+        dest_index = cov_address_add(src);
+        if (dest_index != COV_NONE) {
+            index = cov_subscription_alloc();
+        }
+        if (index == COV_NONE) {
+            /* Out of resources */
+            cov_address_release(dest_index);
+            *error_class = ERROR_CLASS_RESOURCES;
+            *error_code = ERROR_CODE_NO_SPACE_TO_ADD_LIST_ELEMENT;
+            return false;
+        }
         COV_Subscriptions[index].flag.valid = true;
-        COV_Subscriptions[index].dest_index = cov_address_add(src);
+        COV_Subscriptions[index].dest_index = dest_index;
         COV_Subscriptions[index].monitoredObjectIdentifier.type =
             cov_data->monitoredObjectIdentifier.type;
         COV_Subscriptions[index].monitoredObjectIdentifier.instance =
@@ -423,20 +693,15 @@ static bool cov_list_subscribe(
         COV_Subscriptions[index].invokeID = 0;
         COV_Subscriptions[index].lifetime = cov_data->lifetime;
         COV_Subscriptions[index].flag.send_requested = true;
-    } else if (!existing_entry) {
-        if (first_invalid_index < 0) {
-            /* Out of resources */
-            *error_class = ERROR_CLASS_RESOURCES;
-            *error_code = ERROR_CODE_NO_SPACE_TO_ADD_LIST_ELEMENT;
-            found = false;
-        } else {
-            /* cancellationRequest - valid object not subscribed */
-            /* From BACnet Standard 135-2010-13.14.2
-               ...Cancellations that are issued for which no matching COV
-               context can be found shall succeed as if a context had
-               existed, returning 'Result(+)'. */
-            found = true;
-        }
+        cov_object_link(index);
+        COV_Subscription_Count++;
+        COV_Send_Pending = true;
+        /* the first notification carries the current value; a change
+           the object flagged while nobody watched it is dropped, so
+           that the next change is reported again */
+        Device_COV_Clear((BACNET_OBJECT_TYPE)
+            cov_data->monitoredObjectIdentifier.type,
+            cov_data->monitoredObjectIdentifier.instance);
     }
 
     return found;
@@ -492,6 +757,7 @@ static bool cov_send_request(
         invoke_id = tsm_next_free_invokeID();
         if (invoke_id) {
             cov_subscription->invokeID = invoke_id;
+            COV_Confirm_Pending = true;
             len =
                 ccov_notify_encode_apdu(&Handler_Transmit_Buffer[pdu_len],
                 invoke_id, &cov_data);
@@ -529,7 +795,7 @@ static void cov_lifetime_expiration_handler(
     uint32_t elapsed_seconds,
     uint32_t lifetime_seconds)
 {
-    if (index < MAX_COV_SUBCRIPTIONS) {
+    if (index < COV_Subscription_Capacity) {
         /* handle lifetime expiration */
         if (lifetime_seconds >= elapsed_seconds) {
             COV_Subscriptions[index].lifetime -= elapsed_seconds;
@@ -553,15 +819,7 @@ static void cov_lifetime_expiration_handler(
                 COV_Subscriptions[index].lifetime);
             fprintf(stderr, "\n");
 #endif
-            COV_Subscriptions[index].flag.valid = false;
-            COV_Subscriptions[index].dest_index = -1;
-            cov_address_remove_unused();
-            if (COV_Subscriptions[index].flag.issueConfirmedNotifications) {
-                if (COV_Subscriptions[index].invokeID) {
-                    tsm_free_invoke_id(COV_Subscriptions[index].invokeID);
-                    COV_Subscriptions[index].invokeID = 0;
-                }
-            }
+            cov_subscription_free(index);
         }
     }
 }
@@ -595,7 +853,7 @@ void handler_cov_timer_seconds(
 
     if (elapsed_seconds) {
         /* handle the subscription timeouts */
-        for (index = 0; index < MAX_COV_SUBCRIPTIONS; index++) {
+        for (index = 0; index < COV_Subscription_Capacity; index++) {
             if (COV_Subscriptions[index].flag.valid) {
                 lifetime_seconds = COV_Subscriptions[index].lifetime;
                 if (lifetime_seconds) {
@@ -608,139 +866,239 @@ void handler_cov_timer_seconds(
     }
 }
 
-void handler_cov_task(
+/* set send_requested on the subscriptions of the object */
+static void cov_object_mark(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    uint32_t index = COV_NONE;
+
+    index =
+        COV_Object_Hash[cov_object_bucket(object_type, object_instance)];
+    while (index != COV_NONE) {
+        if ((COV_Subscriptions[index].monitoredObjectIdentifier.type ==
+                object_type) &&
+            (COV_Subscriptions[index].monitoredObjectIdentifier.instance ==
+                object_instance)) {
+            COV_Subscriptions[index].flag.send_requested = true;
+            COV_Send_Pending = true;
+#if PRINT_ENABLED
+            fprintf(stderr, "COVtask: Marking...\n");
+#endif
+        }
+        index = COV_Subscriptions[index].next;
+    }
+}
+
+/** Mark the subscriptions of an object whose COV flag has just been set.
+ * @ingroup DSCOV
+ * Called through Device_COV_Changed() by the objects, so that the COV task
+ * only sends for the objects that changed instead of asking every
+ * subscribed object on every cycle.  Only the subscriptions of the object
+ * are visited, through the object hash.  Within a batch of writes, the
+ * object is only noted, and marked at the end of the batch.
+ *
+ * @param object_type [in] The type of the changed object.
+ * @param object_instance [in] The instance of the changed object.
+ */
+void handler_cov_object_changed(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    unsigned i = 0;
+
+    if (COV_Subscription_Count == 0) {
+        return;
+    }
+    if (COV_Batch_Active) {
+        for (i = 0; i < COV_Batch_Count; i++) {
+            if ((COV_Batch_Objects[i].type == object_type) &&
+                (COV_Batch_Objects[i].instance == object_instance)) {
+                return;
+            }
+        }
+        if (COV_Batch_Count < MAX_COV_BATCH_OBJECTS) {
+            COV_Batch_Objects[COV_Batch_Count].type = object_type;
+            COV_Batch_Objects[COV_Batch_Count].instance = object_instance;
+            COV_Batch_Count++;
+            return;
+        }
+    }
+    cov_object_mark(object_type, object_instance);
+}
+
+/** Hold the COV marks of the objects changed by a batch of writes, such as
+ * the ones of a WritePropertyMultiple request, until handler_cov_batch_end().
+ * @ingroup DSCOV
+ * Each changed object is then marked once, after all the writes, so that
+ * its notification carries the values of the whole batch.
+ */
+void handler_cov_batch_begin(
+    void)
+{
+    COV_Batch_Active = true;
+    COV_Batch_Count = 0;
+}
+
+/** Mark the subscriptions of the objects changed since
+ * handler_cov_batch_begin(), once each.
+ * @ingroup DSCOV
+ */
+void handler_cov_batch_end(
+    void)
+{
+    unsigned i = 0;
+
+    COV_Batch_Active = false;
+    for (i = 0; i < COV_Batch_Count; i++) {
+        cov_object_mark((BACNET_OBJECT_TYPE) COV_Batch_Objects[i].type,
+            COV_Batch_Objects[i].instance);
+    }
+    COV_Batch_Count = 0;
+}
+
+/* confirmed notification house keeping */
+static void cov_free_confirmed(
+    void)
+{
+    unsigned index = 0;
+    bool outstanding = false;
+
+    for (index = 0; index < COV_Subscription_Capacity; index++) {
+        if ((COV_Subscriptions[index].flag.valid) &&
+            (COV_Subscriptions[index].flag.issueConfirmedNotifications) &&
+            (COV_Subscriptions[index].invokeID)) {
+            if (tsm_invoke_id_free(COV_Subscriptions[index].invokeID)) {
+                COV_Subscriptions[index].invokeID = 0;
+            } else if (tsm_invoke_id_failed(COV_Subscriptions[index].
+                    invokeID)) {
+                tsm_free_invoke_id(COV_Subscriptions[index].invokeID);
+                COV_Subscriptions[index].invokeID = 0;
+            } else {
+                outstanding = true;
+            }
+        }
+    }
+    COV_Confirm_Pending = outstanding;
+}
+
+/* send the requested notifications, grouped by subscriber address: the
+   notifications of one cycle for a peer go out back to back, and on
+   BACnet/IP in one batch of datagrams */
+static void cov_send_requested(
     void)
 {
-    static int index = 0;
+    unsigned *first = COV_Address_First;
+    unsigned index = 0;
+    unsigned count = 0;
+    unsigned sent = 0;
+    unsigned dest = 0;
+    bool send = false;
+    bool status = false;
     BACNET_OBJECT_TYPE object_type = MAX_BACNET_OBJECT_TYPE;
     uint32_t object_instance = 0;
-    bool status = false;
-    bool send = false;
+    BACNET_COV_SUBSCRIPTION *cov_subscription = NULL;
     BACNET_PROPERTY_VALUE value_list[2];
-    /* states for transmitting */
-    static enum {
-        COV_STATE_IDLE = 0,
-        COV_STATE_MARK,
-        COV_STATE_CLEAR,
-        COV_STATE_FREE,
-        COV_STATE_SEND
-    } cov_task_state = COV_STATE_IDLE;
-
-    switch (cov_task_state) {
-        case COV_STATE_IDLE:
-            index = 0;
-            cov_task_state = COV_STATE_MARK;
-            break;
-        case COV_STATE_MARK:
-            /* mark any subscriptions where the value has changed */
-            if (COV_Subscriptions[index].flag.valid) {
-                object_type = (BACNET_OBJECT_TYPE)
-                    COV_Subscriptions[index].monitoredObjectIdentifier.type;
-                object_instance =
-                    COV_Subscriptions[index].
-                    monitoredObjectIdentifier.instance;
-                status = Device_COV(object_type, object_instance);
-                if (status) {
-                    COV_Subscriptions[index].flag.send_requested = true;
-#if PRINT_ENABLED
-                    fprintf(stderr, "COVtask: Marking...\n");
+
+    COV_Send_Pending = false;
+    if (!first) {
+        return;
+    }
+    /* counting sort of the requested subscriptions by address */
+    memset(first, 0, (COV_Address_Capacity + 1) * sizeof(*first));
+    for (index = 0; index < COV_Subscription_Capacity; index++) {
+        if ((COV_Subscriptions[index].flag.valid) &&
+            (COV_Subscriptions[index].flag.send_requested) &&
+            (COV_Subscriptions[index].dest_index < COV_Address_Capacity)) {
+            first[COV_Subscriptions[index].dest_index + 1]++;
+            count++;
+        }
+    }
+    for (dest = 0; dest < COV_Address_Capacity; dest++) {
+        first[dest + 1] += first[dest];
+    }
+    for (index = 0; index < COV_Subscription_Capacity; index++) {
+        if ((COV_Subscriptions[index].flag.valid) &&
+            (COV_Subscriptions[index].flag.send_requested) &&
+            (COV_Subscriptions[index].dest_index < COV_Address_Capacity)) {
+            COV_Send_Order[first[COV_Subscriptions[index].dest_index]++] =
+                index;
+        }
+    }
+#if defined(BACDL_BIP)
+    bip_send_batch_begin();
 #endif
-                }
-            }
-            index++;
-            if (index >= MAX_COV_SUBCRIPTIONS) {
-                index = 0;
-                cov_task_state = COV_STATE_CLEAR;
-            }
-            break;
-        case COV_STATE_CLEAR:
-            /* clear the COV flag after checking all subscriptions */
-            if ((COV_Subscriptions[index].flag.valid) &&
-                (COV_Subscriptions[index].flag.send_requested)) {
-                object_type = (BACNET_OBJECT_TYPE)
-                    COV_Subscriptions[index].monitoredObjectIdentifier.type;
-                object_instance =
-                    COV_Subscriptions[index].
-                    monitoredObjectIdentifier.instance;
-                Device_COV_Clear(object_type, object_instance);
-            }
-            index++;
-            if (index >= MAX_COV_SUBCRIPTIONS) {
-                index = 0;
-                cov_task_state = COV_STATE_FREE;
-            }
+    for (index = 0; index < count; index++) {
+        cov_subscription = &COV_Subscriptions[COV_Send_Order[index]];
+        if (sent >= MAX_COV_NOTIFICATIONS_PER_TASK) {
+            /* the rest go out on the next call */
+            COV_Send_Pending = true;
             break;
-        case COV_STATE_FREE:
-            /* confirmed notification house keeping */
-            if ((COV_Subscriptions[index].flag.valid) &&
-                (COV_Subscriptions[index].flag.issueConfirmedNotifications) &&
-                (COV_Subscriptions[index].invokeID)) {
-                if (tsm_invoke_id_free(COV_Subscriptions[index].invokeID)) {
-                    COV_Subscriptions[index].invokeID = 0;
-                } else
-                    if (tsm_invoke_id_failed(COV_Subscriptions
-                        [index].invokeID)) {
-                    tsm_free_invoke_id(COV_Subscriptions[index].invokeID);
-                    COV_Subscriptions[index].invokeID = 0;
-                }
+        }
+        send = true;
+        if (cov_subscription->flag.issueConfirmedNotifications) {
+            if (cov_subscription->invokeID != 0) {
+                /* already sending */
+                send = false;
             }
-            index++;
-            if (index >= MAX_COV_SUBCRIPTIONS) {
-                index = 0;
-                cov_task_state = COV_STATE_SEND;
+            if (!tsm_transaction_available()) {
+                /* no transactions available - can't send now */
+                send = false;
             }
-            break;
-        case COV_STATE_SEND:
-            /* send any COVs that are requested */
-            if ((COV_Subscriptions[index].flag.valid) &&
-                (COV_Subscriptions[index].flag.send_requested)) {
-                send = true;
-                if (COV_Subscriptions[index].flag.issueConfirmedNotifications) {
-                    if (COV_Subscriptions[index].invokeID != 0) {
-                        /* already sending */
-                        send = false;
-                    }
-                    if (!tsm_transaction_available()) {
-                        /* no transactions available - can't send now */
-                        send = false;
-                    }
-                }
-                if (send) {
-                    object_type = (BACNET_OBJECT_TYPE)
-                        COV_Subscriptions[index].
-                        monitoredObjectIdentifier.type;
-                    object_instance =
-                        COV_Subscriptions[index].
-                        monitoredObjectIdentifier.instance;
+        }
+        if (!send) {
+            COV_Send_Pending = true;
+            continue;
+        }
+        object_type = (BACNET_OBJECT_TYPE)
+            cov_subscription->monitoredObjectIdentifier.type;
+        object_instance = cov_subscription->monitoredObjectIdentifier.instance;
 #if PRINT_ENABLED
-                    fprintf(stderr, "COVtask: Sending...\n");
+        fprintf(stderr, "COVtask: Sending...\n");
 #endif
-                    /* configure the linked list for the two properties */
-                    value_list[0].next = &value_list[1];
-                    value_list[1].next = NULL;
-                    (void) Device_Encode_Value_List(object_type,
-                        object_instance, &value_list[0]);
-                    status =
-                        cov_send_request(&COV_Subscriptions[index],
-                        &value_list[0]);
-                    if (status) {
-                        COV_Subscriptions[index].flag.send_requested = false;
-                    }
-                }
-            }
-            index++;
-            if (index >= MAX_COV_SUBCRIPTIONS) {
-                index = 0;
-                cov_task_state = COV_STATE_IDLE;
-            }
-            break;
-        default:
-            index = 0;
-            cov_task_state = COV_STATE_IDLE;
-            break;
+        /* configure the linked list for the two properties */
+        value_list[0].next = &value_list[1];
+        value_list[1].next = NULL;
+        (void) Device_Encode_Value_List(object_type, object_instance,
+            &value_list[0]);
+        /* the value is taken, the next change of the object marks its
+           subscriptions again */
+        Device_COV_Clear(object_type, object_instance);
+        status = cov_send_request(cov_subscription, &value_list[0]);
+        sent++;
+        if (status) {
+            cov_subscription->flag.send_requested = false;
+        } else {
+            COV_Send_Pending = true;
+        }
     }
+#if defined(BACDL_BIP)
+    bip_send_batch_end();
+#endif
+}
 
-    return;
+/** Handler to send the notifications of the objects that have changed.
+ * @ingroup DSCOV
+ * This handler will be invoked by the main program every loop.
+ * The objects mark their subscriptions through Device_COV_Changed(), so
+ * only the marked subscriptions are visited:
+ *  - Release the invoke IDs of the confirmed notifications answered.
+ *  - Send the marked notices with cov_send_request(), grouped by
+ *    subscriber address, up to MAX_COV_NOTIFICATIONS_PER_TASK per call,
+ *    clearing the COV flag of each object sent
+ *    (eg, with Binary_Input_Change_Of_Value_Clear() ).
+ *    - Will be confirmed or unconfirmed, as per the subscription.
+ * An idle call costs nothing but two flag checks.
+ */
+void handler_cov_task(
+    void)
+{
+    if (COV_Confirm_Pending) {
+        cov_free_confirmed();
+    }
+    if (COV_Send_Pending) {
+        cov_send_requested();
+    }
 }
 
 static bool cov_subscribe(
@@ -95,7 +95,11 @@ void handler_i_am_bind(
     int segmentation = 0;
     uint16_t vendor_id = 0;
 
-    (void) service_len;
+    /* a Who-Is of the site brings the I-Ams of every device; only the
+       cached ones are decoded */
+    if (!iam_decode_device_id(service_request, service_len, &device_id) ||
+        !address_bind_wanted(device_id))
+        return;
     len =
         iam_decode_service_request(service_request, &device_id, &max_apdu,
         &segmentation, &vendor_id);
@@ -31,7 +31,6 @@
 #include <errno.h>
 #include "config.h"
 #include "txbuf.h"
-#include "memcopy.h"
 #include "bacdef.h"
 #include "bacdcode.h"
 #include "apdu.h"
@@ -41,12 +40,29 @@
 #include "bacerror.h"
 #include "rpm.h"
 #include "handlers.h"
+#include "tsm.h"
 /* device object has custom handler for all objects */
 #include "device.h"
 
 /** @file h_rpm.c  Handles Read Property Multiple requests. */
 
-static uint8_t Temp_Buf[MAX_APDU] = { 0 };
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+/* a reply too big for one APDU is encoded whole, and sent in segments */
+#define RPM_REPLY_MAX (MAX_SEGMENTS_ACCEPTED * MAX_APDU)
+#else
+#define RPM_REPLY_MAX MAX_APDU
+#endif
+
+/* The reply is encoded in place: each property value is read straight into
+   its slot in the ACK instead of a scratch buffer.  The object read-property
+   functions only promise to stay within MAX_APDU of where they start, so the
+   buffer keeps that much headroom past the largest reply we will send. */
+#if defined(HANDLER_TRANSMIT_BUFFER_SHARED)
+#define RPM_Buffer Handler_Transmit_Buffer
+#else
+static BACNET_THREAD_LOCAL uint8_t RPM_Buffer[MAX_NPDU + RPM_REPLY_MAX +
+    MAX_APDU];
+#endif
 
 static BACNET_PROPERTY_ID RPM_Object_Property(
     struct special_property_list_t *pPropertyList,
@@ -101,8 +117,9 @@ static unsigned RPM_Object_Property_Count(
     return count;
 }
 
-/** Encode the RPM property returning the length of the encoding,
-   or 0 if there is no room to fit the encoding.  */
+/** Encode the RPM property in place at apdu[offset], returning the length
+   of the encoding, or an abort status if there is no room to fit it.
+   The apdu buffer must have MAX_APDU of headroom past max_apdu. */
 static int RPM_Encode_Property(
     uint8_t * apdu,
     uint16_t offset,
@@ -110,28 +127,26 @@ static int RPM_Encode_Property(
     BACNET_RPM_DATA * rpmdata)
 {
     int len = 0;
-    size_t copy_len = 0;
     int apdu_len = 0;
     BACNET_READ_PROPERTY_DATA rpdata;
 
-    len =
-        rpm_ack_encode_apdu_object_property(&Temp_Buf[0],
+    apdu_len =
+        rpm_ack_encode_apdu_object_property(&apdu[offset],
         rpmdata->object_property, rpmdata->array_index);
-    copy_len = memcopy(&apdu[0], &Temp_Buf[0], offset, len, max_apdu);
-    if (copy_len == 0) {
+    /* room for the header and the opening and closing value tags */
+    if ((offset + apdu_len + 2) > max_apdu) {
         rpmdata->error_code = ERROR_CODE_ABORT_SEGMENTATION_NOT_SUPPORTED;
         return BACNET_STATUS_ABORT;
     }
-    apdu_len += len;
-    len = 0;
     rpdata.error_class = ERROR_CLASS_OBJECT;
     rpdata.error_code = ERROR_CODE_UNKNOWN_OBJECT;
     rpdata.object_type = rpmdata->object_type;
     rpdata.object_instance = rpmdata->object_instance;
     rpdata.object_property = rpmdata->object_property;
     rpdata.array_index = rpmdata->array_index;
-    rpdata.application_data = &Temp_Buf[0];
-    rpdata.application_data_len = sizeof(Temp_Buf);
+    /* read the value straight into place, after its opening tag */
+    rpdata.application_data = &apdu[offset + apdu_len + 1];
+    rpdata.application_data_len = max_apdu - (offset + apdu_len + 2);
     len = Device_Read_Property(&rpdata);
     if (len < 0) {
         if ((len == BACNET_STATUS_ABORT) || (len == BACNET_STATUS_REJECT)) {
@@ -141,20 +156,17 @@ static int RPM_Encode_Property(
         }
         /* error was returned - encode that for the response */
         len =
-            rpm_ack_encode_apdu_object_property_error(&Temp_Buf[0],
-            rpdata.error_class, rpdata.error_code);
-        copy_len =
-            memcopy(&apdu[0], &Temp_Buf[0], offset + apdu_len, len, max_apdu);
-
-        if (copy_len == 0) {
+            rpm_ack_encode_apdu_object_property_error(&apdu[offset +
+                apdu_len], rpdata.error_class, rpdata.error_code);
+        if ((offset + apdu_len + len) > max_apdu) {
             rpmdata->error_code = ERROR_CODE_ABORT_SEGMENTATION_NOT_SUPPORTED;
             return BACNET_STATUS_ABORT;
         }
-    } else if ((offset + apdu_len + 1 + len + 1) < max_apdu) {
+    } else if ((offset + apdu_len + 1 + len + 1) <= max_apdu) {
         /* enough room to fit the property value and tags */
         len =
             rpm_ack_encode_apdu_object_property_value(&apdu[offset + apdu_len],
-            &Temp_Buf[0], len);
+            rpdata.application_data, len);
     } else {
         /* not enough room - abort! */
         rpmdata->error_code = ERROR_CODE_ABORT_SEGMENTATION_NOT_SUPPORTED;
@@ -191,25 +203,23 @@ void handler_read_property_multiple(
     BACNET_CONFIRMED_SERVICE_DATA * service_data)
 {
     int len = 0;
-    uint16_t copy_len = 0;
     uint16_t decode_len = 0;
     int pdu_len = 0;
     BACNET_NPDU_DATA npdu_data;
     int bytes_sent;
     BACNET_ADDRESS my_address;
     BACNET_RPM_DATA rpmdata;
+    uint8_t *apdu = NULL;
     int apdu_len = 0;
+    uint16_t max_apdu = MAX_APDU;
     int npdu_len = 0;
     int error = 0;
 
-    /* jps_debug - see if we are utilizing all the buffer */
-    /* memset(&Handler_Transmit_Buffer[0], 0xff, sizeof(Handler_Transmit_Buffer)); */
     /* encode the NPDU portion of the packet */
     datalink_get_my_address(&my_address);
     npdu_encode_npdu_data(&npdu_data, false, MESSAGE_PRIORITY_NORMAL);
-    npdu_len =
-        npdu_encode_pdu(&Handler_Transmit_Buffer[0], src, &my_address,
-        &npdu_data);
+    npdu_len = npdu_encode_pdu(&RPM_Buffer[0], src, &my_address, &npdu_data);
+    apdu = &RPM_Buffer[npdu_len];
     if (service_data->segmented_message) {
         rpmdata.error_code = ERROR_CODE_ABORT_SEGMENTATION_NOT_SUPPORTED;
         error = BACNET_STATUS_ABORT;
@@ -218,11 +228,18 @@ void handler_read_property_multiple(
 #endif
         goto RPM_FAILURE;
     }
+    /* a reply bigger than the sender accepts is aborted anyway,
+       so stop encoding as soon as it would not fit */
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+    max_apdu = (uint16_t) tsm_segmented_response_limit(service_data);
+#else
+    if (service_data->max_resp < max_apdu) {
+        max_apdu = (uint16_t) service_data->max_resp;
+    }
+#endif
     /* decode apdu request & encode apdu reply
        encode complex ack, invoke id, service choice */
-    apdu_len =
-        rpm_ack_encode_apdu_init(&Handler_Transmit_Buffer[npdu_len],
-        service_data->invoke_id);
+    apdu_len = rpm_ack_encode_apdu_init(&apdu[0], service_data->invoke_id);
     for (;;) {
         /* Start by looking for an object ID */
         len =
@@ -247,11 +264,8 @@ void handler_read_property_multiple(
         }
 
         /* Stick this object id into the reply - if it will fit */
-        len = rpm_ack_encode_apdu_object_begin(&Temp_Buf[0], &rpmdata);
-        copy_len =
-            memcopy(&Handler_Transmit_Buffer[npdu_len], &Temp_Buf[0], apdu_len,
-            len, MAX_APDU);
-        if (copy_len == 0) {
+        len = rpm_ack_encode_apdu_object_begin(&apdu[apdu_len], &rpmdata);
+        if ((apdu_len + len) > max_apdu) {
 #if PRINT_ENABLED
             fprintf(stderr, "RPM: Response too big!\r\n");
 #endif
@@ -259,8 +273,7 @@ void handler_read_property_multiple(
             error = BACNET_STATUS_ABORT;
             goto RPM_FAILURE;
         }
-
-        apdu_len += copy_len;
+        apdu_len += len;
         /* do each property of this object of the RPM request */
         for (;;) {
             /* Fetch a property */
@@ -280,7 +293,7 @@ void handler_read_property_multiple(
             if ((rpmdata.object_property == PROP_ALL) ||
                 (rpmdata.object_property == PROP_REQUIRED) ||
                 (rpmdata.object_property == PROP_OPTIONAL)) {
-                struct special_property_list_t property_list;
+                struct special_property_list_t PropertyList;
                 unsigned property_count = 0;
                 unsigned index = 0;
                 BACNET_PROPERTY_ID special_object_property;
@@ -289,30 +302,13 @@ void handler_read_property_multiple(
                     /*  No array index options for this special property.
                        Encode error for this object property response */
                     len =
-                        rpm_ack_encode_apdu_object_property(&Temp_Buf[0],
+                        rpm_ack_encode_apdu_object_property(&apdu[apdu_len],
                         rpmdata.object_property, rpmdata.array_index);
-                    copy_len =
-                        memcopy(&Handler_Transmit_Buffer[npdu_len],
-                        &Temp_Buf[0], apdu_len, len, MAX_APDU);
-                    if (copy_len == 0) {
-#if PRINT_ENABLED
-                        fprintf(stderr,
-                            "RPM: Too full to encode property!\r\n");
-#endif
-                        rpmdata.error_code =
-                            ERROR_CODE_ABORT_SEGMENTATION_NOT_SUPPORTED;
-                        error = BACNET_STATUS_ABORT;
-                        goto RPM_FAILURE;
-                    }
-                    apdu_len += len;
-                    len =
-                        rpm_ack_encode_apdu_object_property_error(&Temp_Buf[0],
-                        ERROR_CLASS_PROPERTY,
+                    len +=
+                        rpm_ack_encode_apdu_object_property_error(&apdu
+                        [apdu_len + len], ERROR_CLASS_PROPERTY,
                         ERROR_CODE_PROPERTY_IS_NOT_AN_ARRAY);
-                    copy_len =
-                        memcopy(&Handler_Transmit_Buffer[npdu_len],
-                        &Temp_Buf[0], apdu_len, len, MAX_APDU);
-                    if (copy_len == 0) {
+                    if ((apdu_len + len) > max_apdu) {
 #if PRINT_ENABLED
                         fprintf(stderr, "RPM: Too full to encode error!\r\n");
 #endif
@@ -324,17 +320,17 @@ void handler_read_property_multiple(
                     apdu_len += len;
                 } else {
                     special_object_property = rpmdata.object_property;
+                    /* the lists and their counts are set up by Device_Init */
                     Device_Objects_Property_List(rpmdata.object_type,
-                        &property_list);
+                        &PropertyList);
                     property_count =
-                        RPM_Object_Property_Count(&property_list,
+                        RPM_Object_Property_Count(&PropertyList,
                         special_object_property);
                     if (property_count == 0) {
                         /* handle the error code - but use the special property */
                         len =
-                            RPM_Encode_Property(&Handler_Transmit_Buffer
-                            [npdu_len], (uint16_t) apdu_len, MAX_APDU,
-                            &rpmdata);
+                            RPM_Encode_Property(apdu, (uint16_t) apdu_len,
+                            max_apdu, &rpmdata);
                         if (len > 0) {
                             apdu_len += len;
                         } else {
@@ -348,12 +344,11 @@ void handler_read_property_multiple(
                     } else {
                         for (index = 0; index < property_count; index++) {
                             rpmdata.object_property =
-                                RPM_Object_Property(&property_list,
+                                RPM_Object_Property(&PropertyList,
                                 special_object_property, index);
                             len =
-                                RPM_Encode_Property(&Handler_Transmit_Buffer
-                                [npdu_len], (uint16_t) apdu_len, MAX_APDU,
-                                &rpmdata);
+                                RPM_Encode_Property(apdu, (uint16_t) apdu_len,
+                                max_apdu, &rpmdata);
                             if (len > 0) {
                                 apdu_len += len;
                             } else {
@@ -370,8 +365,8 @@ void handler_read_property_multiple(
             } else {
                 /* handle an individual property */
                 len =
-                    RPM_Encode_Property(&Handler_Transmit_Buffer[npdu_len],
-                    (uint16_t) apdu_len, MAX_APDU, &rpmdata);
+                    RPM_Encode_Property(apdu, (uint16_t) apdu_len, max_apdu,
+                    &rpmdata);
                 if (len > 0) {
                     apdu_len += len;
                 } else {
@@ -386,11 +381,8 @@ void handler_read_property_multiple(
             if (decode_is_closing_tag_number(&service_request[decode_len], 1)) {
                 /* Reached end of property list so cap the result list */
                 decode_len++;
-                len = rpm_ack_encode_apdu_object_end(&Temp_Buf[0]);
-                copy_len =
-                    memcopy(&Handler_Transmit_Buffer[npdu_len], &Temp_Buf[0],
-                    apdu_len, len, MAX_APDU);
-                if (copy_len == 0) {
+                len = rpm_ack_encode_apdu_object_end(&apdu[apdu_len]);
+                if ((apdu_len + len) > max_apdu) {
 #if PRINT_ENABLED
                     fprintf(stderr, "RPM: Too full to encode object end!\r\n");
 #endif
@@ -398,9 +390,8 @@ void handler_read_property_multiple(
                         ERROR_CODE_ABORT_SEGMENTATION_NOT_SUPPORTED;
                     error = BACNET_STATUS_ABORT;
                     goto RPM_FAILURE;
-                } else {
-                    apdu_len += copy_len;
                 }
+                apdu_len += len;
                 break;  /* finished with this property list */
             }
         }
@@ -409,39 +400,39 @@ void handler_read_property_multiple(
             break;
         }
     }
-
-    if (apdu_len > service_data->max_resp) {
-        /* too big for the sender - send an abort */
-        rpmdata.error_code = ERROR_CODE_ABORT_SEGMENTATION_NOT_SUPPORTED;
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+    if ((apdu_len > MAX_APDU) || (apdu_len > service_data->max_resp)) {
+        if (tsm_segmented_response(src, &npdu_data, service_data, apdu,
+                (unsigned) apdu_len)) {
+            return;
+        }
+        /* too many replies are being sent in segments already */
+        rpmdata.error_code =
+            ERROR_CODE_ABORT_PREEMPTED_BY_HIGHER_PRIORITY_TASK;
         error = BACNET_STATUS_ABORT;
-#if PRINT_ENABLED
-        fprintf(stderr, "RPM: Message too large.  Sending Abort!\n");
-#endif
-        goto RPM_FAILURE;
     }
+#endif
 
   RPM_FAILURE:
     if (error) {
         if (error == BACNET_STATUS_ABORT) {
             apdu_len =
-                abort_encode_apdu(&Handler_Transmit_Buffer[npdu_len],
-                service_data->invoke_id,
+                abort_encode_apdu(&apdu[0], service_data->invoke_id,
                 abort_convert_error_code(rpmdata.error_code), true);
 #if PRINT_ENABLED
             fprintf(stderr, "RPM: Sending Abort!\n");
 #endif
         } else if (error == BACNET_STATUS_ERROR) {
             apdu_len =
-                bacerror_encode_apdu(&Handler_Transmit_Buffer[npdu_len],
-                service_data->invoke_id, SERVICE_CONFIRMED_READ_PROP_MULTIPLE,
-                rpmdata.error_class, rpmdata.error_code);
+                bacerror_encode_apdu(&apdu[0], service_data->invoke_id,
+                SERVICE_CONFIRMED_READ_PROP_MULTIPLE, rpmdata.error_class,
+                rpmdata.error_code);
 #if PRINT_ENABLED
             fprintf(stderr, "RPM: Sending Error!\n");
 #endif
         } else if (error == BACNET_STATUS_REJECT) {
             apdu_len =
-                reject_encode_apdu(&Handler_Transmit_Buffer[npdu_len],
-                service_data->invoke_id,
+                reject_encode_apdu(&apdu[0], service_data->invoke_id,
                 reject_convert_error_code(rpmdata.error_code));
 #if PRINT_ENABLED
             fprintf(stderr, "RPM: Sending Reject!\n");
@@ -450,9 +441,7 @@ void handler_read_property_multiple(
     }
 
     pdu_len = apdu_len + npdu_len;
-    bytes_sent =
-        datalink_send_pdu(src, &npdu_data, &Handler_Transmit_Buffer[0],
-        pdu_len);
+    bytes_sent = datalink_send_pdu(src, &npdu_data, &RPM_Buffer[0], pdu_len);
 #if PRINT_ENABLED
     if (bytes_sent <= 0) {
         fprintf(stderr, "RPM: Failed to send PDU (%s)!\n", strerror(errno));
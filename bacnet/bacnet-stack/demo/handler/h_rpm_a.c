@@ -25,6 +25,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include "config.h"
 #include "txbuf.h"
@@ -44,19 +45,83 @@
 
 /** @file h_rpm_a.c  Handles Read Property Multiple Acknowledgments. */
 
-/** Decode the received RPM data and make a linked list of the results.
- * @ingroup DSRPM
- *
- * @param apdu [in] The received apdu data.
- * @param apdu_len [in] Total length of the apdu.
- * @param read_access_data [out] Pointer to the head of the linked list
- * 			where the RPM data is to be stored.
- * @return The number of bytes decoded, or -1 on error
- */
-int rpm_ack_decode_service_request(
+/* the nodes come from the arena if there is one, else from the heap */
+static void *rpm_ack_alloc(
+    BACNET_RPM_ARENA * arena,
+    size_t size)
+{
+    if (arena) {
+        return rpm_arena_alloc(arena, size);
+    }
+    return calloc(1, size);
+}
+
+static void rpm_ack_free(
+    BACNET_RPM_ARENA * arena,
+    void *ptr)
+{
+    if (!arena) {
+        free(ptr);
+    }
+}
+
+/* decode the elements of a propertyValue into a list of views from the
+   arena, up to and including its closing tag; constructed data is
+   flattened, as it is for the values */
+static int rpm_ack_decode_views(
     uint8_t * apdu,
     int apdu_len,
-    BACNET_READ_ACCESS_DATA * read_access_data)
+    BACNET_PROPERTY_REFERENCE * rpm_property,
+    BACNET_RPM_ARENA * arena)
+{
+    int decoded_len = 0;
+    int len = 0;
+    uint8_t tag_number = 0;
+    uint32_t len_value = 0;
+    BACNET_APPLICATION_DATA_VIEW *view = NULL;
+    BACNET_APPLICATION_DATA_VIEW **tail = &rpm_property->view;
+
+    while (apdu_len > 0) {
+        if (decode_is_closing_tag_number(apdu, 4)) {
+            return decoded_len + 1;
+        }
+        if (decode_is_opening_tag(apdu) || decode_is_closing_tag(apdu)) {
+            len =
+                decode_tag_number_and_value_safe(apdu, apdu_len,
+                &tag_number, &len_value);
+        } else {
+            view = rpm_arena_alloc(arena, sizeof(BACNET_APPLICATION_DATA_VIEW));
+            if (!view) {
+                return BACNET_STATUS_ERROR;
+            }
+            if (IS_CONTEXT_SPECIFIC(*apdu)) {
+                len =
+                    bacapp_decode_context_view(apdu, apdu_len, view,
+                    rpm_property->propertyIdentifier);
+            } else {
+                len = bacapp_decode_application_view(apdu, apdu_len, view);
+            }
+            *tail = view;
+            tail = &view->next;
+        }
+        if (len <= 0) {
+            return BACNET_STATUS_ERROR;
+        }
+        decoded_len += len;
+        apdu_len -= len;
+        apdu += len;
+    }
+
+    /* the closing tag is missing */
+    return BACNET_STATUS_ERROR;
+}
+
+static int rpm_ack_decode_service_request_data(
+    uint8_t * apdu,
+    int apdu_len,
+    BACNET_READ_ACCESS_DATA * read_access_data,
+    BACNET_RPM_ARENA * arena,
+    bool views)
 {
     int decoded_len = 0;        /* return value */
     uint32_t error_value = 0;   /* decoded error value */
@@ -79,13 +144,13 @@ int rpm_ack_decode_service_request(
             &rpm_object->object_instance);
         if (len <= 0) {
             old_rpm_object->next = NULL;
-            free(rpm_object);
+            rpm_ack_free(arena, rpm_object);
             break;
         }
         decoded_len += len;
         apdu_len -= len;
         apdu += len;
-        rpm_property = calloc(1, sizeof(BACNET_PROPERTY_REFERENCE));
+        rpm_property = rpm_ack_alloc(arena, sizeof(BACNET_PROPERTY_REFERENCE));
         rpm_object->listOfProperties = rpm_property;
         old_rpm_property = rpm_property;
         while (rpm_property && apdu_len) {
@@ -99,23 +164,38 @@ int rpm_ack_decode_service_request(
                     /* was this the only property in the list? */
                     rpm_object->listOfProperties = NULL;
                 }
-                free(rpm_property);
+                rpm_ack_free(arena, rpm_property);
                 break;
             }
             decoded_len += len;
             apdu_len -= len;
             apdu += len;
-            if (apdu_len && decode_is_opening_tag_number(apdu, 4)) {
+            if (views && apdu_len && decode_is_opening_tag_number(apdu, 4)) {
+                /* propertyValue, left in the apdu */
+                decoded_len++;
+                apdu_len--;
+                apdu++;
+                len =
+                    rpm_ack_decode_views(apdu, apdu_len, rpm_property, arena);
+                if (len < 0) {
+                    return BACNET_STATUS_ERROR;
+                }
+                decoded_len += len;
+                apdu_len -= len;
+                apdu += len;
+            } else if (apdu_len && decode_is_opening_tag_number(apdu, 4)) {
                 /* propertyValue */
                 decoded_len++;
                 apdu_len--;
                 apdu++;
                 /* note: if this is an array, there will be
                    more than one element to decode */
-                value = calloc(1, sizeof(BACNET_APPLICATION_DATA_VALUE));
+                value = rpm_ack_alloc(arena, sizeof(BACNET_APPLICATION_DATA_VALUE));
                 rpm_property->value = value;
                 old_value = value;
                 while (value && (apdu_len > 0)) {
+                    unsigned run = 0;
+                    BACNET_APPLICATION_DATA_VALUE *rest = NULL;
                     if (IS_CONTEXT_SPECIFIC(*apdu)) {
                         len =
                             bacapp_decode_context_data(apdu, apdu_len, value,
@@ -131,6 +211,25 @@ int rpm_ack_decode_service_request(
                         /* calling function will free the memory */
                         return BACNET_STATUS_ERROR;
                     }
+                    /* the rest of an array of REALs or Unsigneds encoded
+                       like this element goes into one allocation from the
+                       arena, and is decoded in one loop */
+                    if (arena && (len > 0) && (len < apdu_len) &&
+                        (apdu[len] == apdu[0])) {
+                        run =
+                            bacapp_application_run_count(&apdu[len],
+                            apdu_len - len);
+                        rest = run ? rpm_arena_alloc(arena,
+                            run * sizeof(BACNET_APPLICATION_DATA_VALUE)) :
+                            NULL;
+                    }
+                    if (rest) {
+                        len +=
+                            bacapp_decode_application_run(&apdu[len], run,
+                            rest);
+                        value->next = rest;
+                        value = &rest[run - 1];
+                    }
                     decoded_len += len;
                     apdu_len -= len;
                     apdu += len;
@@ -142,7 +241,7 @@ int rpm_ack_decode_service_request(
                     } else {
                         old_value = value;
                         value =
-                            calloc(1, sizeof(BACNET_APPLICATION_DATA_VALUE));
+                            rpm_ack_alloc(arena, sizeof(BACNET_APPLICATION_DATA_VALUE));
                         old_value->next = value;
                     }
                 }
@@ -181,7 +280,7 @@ int rpm_ack_decode_service_request(
                 }
             }
             old_rpm_property = rpm_property;
-            rpm_property = calloc(1, sizeof(BACNET_PROPERTY_REFERENCE));
+            rpm_property = rpm_ack_alloc(arena, sizeof(BACNET_PROPERTY_REFERENCE));
             old_rpm_property->next = rpm_property;
         }
         len = rpm_decode_object_end(apdu, apdu_len);
@@ -192,7 +291,7 @@ int rpm_ack_decode_service_request(
         }
         if (apdu_len) {
             old_rpm_object = rpm_object;
-            rpm_object = calloc(1, sizeof(BACNET_READ_ACCESS_DATA));
+            rpm_object = rpm_ack_alloc(arena, sizeof(BACNET_READ_ACCESS_DATA));
             old_rpm_object->next = rpm_object;
         }
     }
@@ -200,6 +299,130 @@ int rpm_ack_decode_service_request(
     return decoded_len;
 }
 
+/** Decode the received RPM data and make a linked list of the results.
+ * @ingroup DSRPM
+ *
+ * @param apdu [in] The received apdu data.
+ * @param apdu_len [in] Total length of the apdu.
+ * @param read_access_data [out] Pointer to the head of the linked list
+ * 			where the RPM data is to be stored.
+ * @param arena [in] The nodes are allocated from it, and released by
+ *              rpm_arena_reset() instead of freeing each one, or NULL
+ *              to calloc them.
+ * @return The number of bytes decoded, or -1 on error
+ */
+int rpm_ack_decode_service_request_arena(
+    uint8_t * apdu,
+    int apdu_len,
+    BACNET_READ_ACCESS_DATA * read_access_data,
+    BACNET_RPM_ARENA * arena)
+{
+    return rpm_ack_decode_service_request_data(apdu, apdu_len,
+        read_access_data, arena, false);
+}
+
+/** Decode the received RPM data into a linked list of views, whose strings
+ *  are left in the apdu, instead of values.
+ * @ingroup DSRPM
+ *
+ * @param apdu [in] The received apdu data, which must outlive the list.
+ * @param apdu_len [in] Total length of the apdu.
+ * @param read_access_data [out] Pointer to the head of the linked list,
+ *              the property references have views and no values.
+ * @param arena [in] All of the nodes are allocated from it.
+ * @return The number of bytes decoded, or -1 on error
+ */
+int rpm_ack_decode_service_request_view(
+    uint8_t * apdu,
+    int apdu_len,
+    BACNET_READ_ACCESS_DATA * read_access_data,
+    BACNET_RPM_ARENA * arena)
+{
+    if (!arena) {
+        return BACNET_STATUS_ERROR;
+    }
+    return rpm_ack_decode_service_request_data(apdu, apdu_len,
+        read_access_data, arena, true);
+}
+
+/* the octets of the strings of the views are copied into the arena */
+static bool rpm_ack_views_detach(
+    BACNET_READ_ACCESS_DATA * rpm_object,
+    BACNET_RPM_ARENA * arena)
+{
+    BACNET_PROPERTY_REFERENCE *rpm_property;
+    BACNET_APPLICATION_DATA_VIEW *view;
+    uint8_t *octets;
+
+    for (; rpm_object; rpm_object = rpm_object->next) {
+        for (rpm_property = rpm_object->listOfProperties; rpm_property;
+            rpm_property = rpm_property->next) {
+            for (view = rpm_property->view; view; view = view->next) {
+                if (((view->tag != BACNET_APPLICATION_TAG_OCTET_STRING) &&
+                        (view->tag !=
+                            BACNET_APPLICATION_TAG_CHARACTER_STRING)) ||
+                    (view->type.String.length == 0)) {
+                    continue;
+                }
+                octets = rpm_arena_alloc(arena, view->type.String.length);
+                if (!octets) {
+                    return false;
+                }
+                memcpy(octets, view->type.String.value,
+                    view->type.String.length);
+                view->type.String.value = octets;
+            }
+        }
+    }
+
+    return true;
+}
+
+/** Decode the received RPM data into a linked list of compact views whose
+ *  strings are copied into the arena, so that unlike
+ *  rpm_ack_decode_service_request_view() the list outlives the apdu.
+ *  An element takes tens of octets, instead of the size of a
+ *  BACNET_APPLICATION_DATA_VALUE with its string buffers.
+ * @ingroup DSRPM
+ *
+ * @param apdu [in] The received apdu data.
+ * @param apdu_len [in] Total length of the apdu.
+ * @param read_access_data [out] Pointer to the head of the linked list,
+ *              the property references have views and no values.
+ * @param arena [in] All of the nodes and strings are allocated from it.
+ * @return The number of bytes decoded, or -1 on error
+ */
+int rpm_ack_decode_service_request_compact(
+    uint8_t * apdu,
+    int apdu_len,
+    BACNET_READ_ACCESS_DATA * read_access_data,
+    BACNET_RPM_ARENA * arena)
+{
+    int len = 0;
+
+    len =
+        rpm_ack_decode_service_request_view(apdu, apdu_len, read_access_data,
+        arena);
+    if ((len > 0) && !rpm_ack_views_detach(read_access_data, arena)) {
+        len = BACNET_STATUS_ERROR;
+    }
+
+    return len;
+}
+
+/** Decode the received RPM data into a linked list of calloc'd nodes.
+ * @ingroup DSRPM
+ * @see rpm_ack_decode_service_request_arena()
+ */
+int rpm_ack_decode_service_request(
+    uint8_t * apdu,
+    int apdu_len,
+    BACNET_READ_ACCESS_DATA * read_access_data)
+{
+    return rpm_ack_decode_service_request_arena(apdu, apdu_len,
+        read_access_data, NULL);
+}
+
 /* for debugging... */
 void rpm_ack_print_data(
     BACNET_READ_ACCESS_DATA * rpm_data)
@@ -207,7 +430,10 @@ void rpm_ack_print_data(
     BACNET_OBJECT_PROPERTY_VALUE object_value;  /* for bacapp printing */
     BACNET_PROPERTY_REFERENCE *listOfProperties;
     BACNET_APPLICATION_DATA_VALUE *value;
+    BACNET_APPLICATION_DATA_VIEW *view;
+    BACNET_APPLICATION_DATA_VALUE view_value;   /* a view is printed from */
     bool array_value = false;
+    bool more = false;
 
     if (rpm_data) {
 #if PRINT_ENABLED
@@ -234,9 +460,10 @@ void rpm_ack_print_data(
 #endif
             }
             value = listOfProperties->value;
-            if (value) {
+            view = listOfProperties->view;
+            if (value || view) {
 #if PRINT_ENABLED
-                if (value->next) {
+                if ((value && value->next) || (!value && view->next)) {
                     fprintf(stdout, "{");
                     array_value = true;
                 } else {
@@ -245,15 +472,26 @@ void rpm_ack_print_data(
 #endif
                 object_value.object_type = rpm_data->object_type;
                 object_value.object_instance = rpm_data->object_instance;
-                while (value) {
+                while (value || view) {
                     object_value.object_property =
                         listOfProperties->propertyIdentifier;
                     object_value.array_index =
                         listOfProperties->propertyArrayIndex;
-                    object_value.value = value;
+                    if (value) {
+                        object_value.value = value;
+                        more = (value->next != NULL);
+                        value = value->next;
+                    } else {
+                        if (!bacapp_view_to_value(view, &view_value)) {
+                            view_value.tag = MAX_BACNET_APPLICATION_TAG;
+                        }
+                        object_value.value = &view_value;
+                        more = (view->next != NULL);
+                        view = view->next;
+                    }
                     bacapp_print_value(stdout, &object_value);
 #if PRINT_ENABLED
-                    if (value->next) {
+                    if (more) {
                         fprintf(stdout, ",\r\n        ");
                     } else {
                         if (array_value) {
@@ -263,7 +501,6 @@ void rpm_ack_print_data(
                         }
                     }
 #endif
-                    value = value->next;
                 }
             } else {
 #if PRINT_ENABLED
@@ -285,8 +522,9 @@ void rpm_ack_print_data(
 
 /** Handler for a ReadPropertyMultiple ACK.
  * @ingroup DSRPM
- * For each read property, print out the ACK'd data for debugging,
- * and free the request data items from linked property list.
+ * For each read property, print out the ACK'd data for debugging.
+ * The data is decoded into compact views in an arena that is kept for
+ * the next ack.
  *
  * @param service_request [in] The contents of the service request.
  * @param service_len [in] The length of the service_request.
@@ -300,65 +538,33 @@ void handler_read_property_multiple_ack(
     BACNET_ADDRESS * src,
     BACNET_CONFIRMED_SERVICE_ACK_DATA * service_data)
 {
+    static BACNET_RPM_ARENA arena;
     int len = 0;
     BACNET_READ_ACCESS_DATA *rpm_data;
-    BACNET_READ_ACCESS_DATA *old_rpm_data;
-    BACNET_PROPERTY_REFERENCE *rpm_property;
-    BACNET_PROPERTY_REFERENCE *old_rpm_property;
-    BACNET_APPLICATION_DATA_VALUE *value;
-    BACNET_APPLICATION_DATA_VALUE *old_value;
 
     (void) src;
     (void) service_data;        /* we could use these... */
 
-    rpm_data = calloc(1, sizeof(BACNET_READ_ACCESS_DATA));
+    if (arena.block_size == 0) {
+        rpm_arena_init(&arena, MAX_APDU * 2);
+    }
+    rpm_arena_reset(&arena);
+    rpm_data = rpm_arena_alloc(&arena, sizeof(BACNET_READ_ACCESS_DATA));
     if (rpm_data) {
         len =
-            rpm_ack_decode_service_request(service_request, service_len,
-            rpm_data);
+            rpm_ack_decode_service_request_compact(service_request,
+            service_len, rpm_data, &arena);
     }
 #if 1
     fprintf(stderr, "Received Read-Property-Multiple Ack!\n");
 #endif
     if (len > 0) {
-        while (rpm_data) {
+        for (; rpm_data; rpm_data = rpm_data->next) {
             rpm_ack_print_data(rpm_data);
-            rpm_property = rpm_data->listOfProperties;
-            while (rpm_property) {
-                value = rpm_property->value;
-                while (value) {
-                    old_value = value;
-                    value = value->next;
-                    free(old_value);
-                }
-                old_rpm_property = rpm_property;
-                rpm_property = rpm_property->next;
-                free(old_rpm_property);
-            }
-            old_rpm_data = rpm_data;
-            rpm_data = rpm_data->next;
-            free(old_rpm_data);
         }
     } else {
 #if 1
-        fprintf(stderr, "RPM Ack Malformed! Freeing memory...\n");
+        fprintf(stderr, "RPM Ack Malformed!\n");
 #endif
-        while (rpm_data) {
-            rpm_property = rpm_data->listOfProperties;
-            while (rpm_property) {
-                value = rpm_property->value;
-                while (value) {
-                    old_value = value;
-                    value = value->next;
-                    free(old_value);
-                }
-                old_rpm_property = rpm_property;
-                rpm_property = rpm_property->next;
-                free(old_rpm_property);
-            }
-            old_rpm_data = rpm_data;
-            rpm_data = rpm_data->next;
-            free(old_rpm_data);
-        }
     }
 }
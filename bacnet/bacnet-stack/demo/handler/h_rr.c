@@ -38,10 +38,22 @@
 #include "readrange.h"
 #include "device.h"
 #include "handlers.h"
+#include "tsm.h"
 
 /** @file h_rr.c  Handles Read Range requests. */
 
-static uint8_t Temp_Buf[MAX_APDU] = { 0 };
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+/* a reply too big for one APDU is encoded whole, and sent in segments */
+#define RR_REPLY_MAX (MAX_SEGMENTS_ACCEPTED * MAX_APDU)
+static BACNET_THREAD_LOCAL uint8_t RR_Transmit_Buffer[MAX_NPDU +
+    RR_REPLY_MAX];
+#define RR_Buffer RR_Transmit_Buffer
+#else
+#define RR_REPLY_MAX MAX_APDU
+#define RR_Buffer Handler_Transmit_Buffer
+#endif
+
+static uint8_t Temp_Buf[RR_REPLY_MAX] = { 0 };
 
 /* Encodes the property APDU and returns the length,
    or sets the error, and returns -1 */
@@ -107,12 +119,12 @@ void handler_read_range(
     datalink_get_my_address(&my_address);
     npdu_encode_npdu_data(&npdu_data, false, MESSAGE_PRIORITY_NORMAL);
     pdu_len =
-        npdu_encode_pdu(&Handler_Transmit_Buffer[0], src, &my_address,
+        npdu_encode_pdu(&RR_Buffer[0], src, &my_address,
         &npdu_data);
     if (service_data->segmented_message) {
         /* we don't support segmentation - send an abort */
         len =
-            abort_encode_apdu(&Handler_Transmit_Buffer[pdu_len],
+            abort_encode_apdu(&RR_Buffer[pdu_len],
             service_data->invoke_id, ABORT_REASON_SEGMENTATION_NOT_SUPPORTED,
             true);
 #if PRINT_ENABLED
@@ -122,6 +134,9 @@ void handler_read_range(
     }
     memset(&data, 0, sizeof(data));     /* start with blank canvas */
     len = rr_decode_service_request(service_request, service_len, &data);
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+    data.MaxAPDU = (int) tsm_segmented_response_limit(service_data);
+#endif
 #if PRINT_ENABLED
     if (len <= 0)
         fprintf(stderr, "RR: Unable to decode Request!\n");
@@ -129,7 +144,7 @@ void handler_read_range(
     if (len < 0) {
         /* bad decoding - send an abort */
         len =
-            abort_encode_apdu(&Handler_Transmit_Buffer[pdu_len],
+            abort_encode_apdu(&RR_Buffer[pdu_len],
             service_data->invoke_id, ABORT_REASON_OTHER, true);
 #if PRINT_ENABLED
         fprintf(stderr, "RR: Bad Encoding.  Sending Abort!\n");
@@ -146,18 +161,31 @@ void handler_read_range(
         data.application_data_len = len;
         /* FIXME: probably need a length limitation sent with encode */
         len =
-            rr_ack_encode_apdu(&Handler_Transmit_Buffer[pdu_len],
+            rr_ack_encode_apdu(&RR_Buffer[pdu_len],
             service_data->invoke_id, &data);
 #if PRINT_ENABLED
         fprintf(stderr, "RR: Sending Ack!\n");
 #endif
         error = false;
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+        if ((len > MAX_APDU) || (len > service_data->max_resp)) {
+            if (tsm_segmented_response(src, &npdu_data, service_data,
+                    &RR_Buffer[pdu_len], (unsigned) len)) {
+                return;
+            }
+            /* too many replies are being sent in segments already */
+            len =
+                abort_encode_apdu(&RR_Buffer[pdu_len],
+                service_data->invoke_id,
+                ABORT_REASON_PREEMPTED_BY_HIGHER_PRIORITY_TASK, true);
+        }
+#endif
     }
     if (error) {
         if (len == -2) {
             /* BACnet APDU too small to fit data, so proper response is Abort */
             len =
-                abort_encode_apdu(&Handler_Transmit_Buffer[pdu_len],
+                abort_encode_apdu(&RR_Buffer[pdu_len],
                 service_data->invoke_id,
                 ABORT_REASON_SEGMENTATION_NOT_SUPPORTED, true);
 #if PRINT_ENABLED
@@ -165,7 +193,7 @@ void handler_read_range(
 #endif
         } else {
             len =
-                bacerror_encode_apdu(&Handler_Transmit_Buffer[pdu_len],
+                bacerror_encode_apdu(&RR_Buffer[pdu_len],
                 service_data->invoke_id, SERVICE_CONFIRMED_READ_RANGE,
                 data.error_class, data.error_code);
 #if PRINT_ENABLED
@@ -176,7 +204,7 @@ void handler_read_range(
   RR_ABORT:
     pdu_len += len;
     bytes_sent =
-        datalink_send_pdu(src, &npdu_data, &Handler_Transmit_Buffer[0],
+        datalink_send_pdu(src, &npdu_data, &RR_Buffer[0],
         pdu_len);
 #if PRINT_ENABLED
     if (bytes_sent <= 0)
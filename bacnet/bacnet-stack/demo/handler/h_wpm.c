@@ -45,16 +45,106 @@
 /** @file h_wpm.c  Handles Write Property Multiple requests. */
 
 
+/* Walk the write access specifications of the request.  The first pass,
+   without apply, checks that all of them decode and that their objects
+   exist, so that a bad request writes nothing; the second calls
+   Device_Write_Property() for each of them.  Returns 0, or the
+   BACNET_STATUS_ of the first that failed, which wp_data then holds. */
+static int wpm_process(
+    uint8_t * service_request,
+    uint16_t service_len,
+    BACNET_WRITE_PROPERTY_DATA * wp_data,
+    bool apply)
+{
+    int len = 0;
+    int decode_len = 0;
+    uint8_t tag_number = 0;
+
+    do {
+        /* decode Object Identifier */
+        len =
+            wpm_decode_object_id(&service_request[decode_len],
+            service_len - decode_len, wp_data);
+        if (len <= 0) {
+#if PRINT_ENABLED
+            fprintf(stderr, "WPM: Bad Encoding!\n");
+#endif
+            return BACNET_STATUS_REJECT;
+        }
+        decode_len += len;
+        /* Opening tag 1 - List of Properties */
+        if (decode_is_opening_tag_number(&service_request[decode_len++], 1)) {
+            do {
+                /* decode a 'Property Identifier'; (3) an optional 'Property Array Index' */
+                /* (4) a 'Property Value'; and (5) an optional 'Priority'. */
+                len =
+                    wpm_decode_object_property(&service_request[decode_len],
+                    service_len - decode_len, wp_data);
+                if ((len > 0) && ((wp_data->application_data_len < 0) ||
+                        ((decode_len + len) >= service_len))) {
+                    /* the value or the closing tag run past the request */
+                    wp_data->error_code =
+                        ERROR_CODE_REJECT_MISSING_REQUIRED_PARAMETER;
+                    len = BACNET_STATUS_REJECT;
+                }
+                if (len <= 0) {
+#if PRINT_ENABLED
+                    fprintf(stderr, "WPM: Bad Encoding!\n");
+#endif
+                    return BACNET_STATUS_REJECT;
+                }
+                decode_len += len;
+                if (!apply) {
+                    if (!Device_Valid_Object_Id(wp_data->object_type,
+                            wp_data->object_instance)) {
+                        wp_data->error_class = ERROR_CLASS_OBJECT;
+                        wp_data->error_code = ERROR_CODE_UNKNOWN_OBJECT;
+                        return BACNET_STATUS_ERROR;
+                    }
+                } else {
+#if PRINT_ENABLED
+                    fprintf(stderr,
+                        "WPM: type=%lu instance=%lu property=%lu priority=%lu index=%ld\n",
+                        (unsigned long) wp_data->object_type,
+                        (unsigned long) wp_data->object_instance,
+                        (unsigned long) wp_data->object_property,
+                        (unsigned long) wp_data->priority,
+                        (long) wp_data->array_index);
+#endif
+                    if (Device_Write_Property(wp_data) == false) {
+                        return BACNET_STATUS_ERROR;
+                    }
+                }
+                /* Closing tag 1 - List of Properties */
+                if (decode_is_closing_tag_number(&service_request[decode_len],
+                        1)) {
+                    tag_number = 1;
+                    decode_len++;
+                } else {
+                    /* it was not tag 1, decode next Property Identifier ... */
+                    tag_number = 0;
+                }
+            } while (tag_number != 1);  /* end decoding List of Properties for "that" object */
+        }
+    } while (decode_len < service_len);
+
+    return 0;
+}
+
 /** Handler for a WriteProperty Service request.
  * @ingroup DSWP
  * This handler will be invoked by apdu_handler() if it has been enabled
  * by a call to apdu_set_confirmed_handler().
+ * The whole request is decoded, and its objects checked, before anything
+ * is written, then the properties are written in order, and the objects
+ * they changed are marked for COV once, after the last write.
  * This handler builds a response packet, which is
  * - an Abort if
  *   - the message is segmented
- *   - if decoding fails
- * - an ACK if Device_Write_Property_Multiple() succeeds
- * - an Error if Device_Write_PropertyMultiple() encounters an error
+ * - a Reject if decoding fails
+ * - an ACK if Device_Write_Property() succeeds for all the properties
+ * - an Error if an object is unknown, or Device_Write_Property()
+ *   encounters an error; the writes before that one stay
  *
  * @param service_request [in] The contents of the service request.
  * @param service_len [in] The length of the service_request.
@@ -72,7 +162,6 @@ void handler_write_property_multiple(
     int apdu_len = 0;
     int npdu_len = 0;
     int pdu_len = 0;
-    int decode_len = 0;
     bool error = false;
     BACNET_WRITE_PROPERTY_DATA wp_data;
     BACNET_NPDU_DATA npdu_data;
@@ -82,79 +171,23 @@ void handler_write_property_multiple(
     if (service_data->segmented_message) {
         wp_data.error_code = ERROR_CODE_ABORT_SEGMENTATION_NOT_SUPPORTED;
         len = BACNET_STATUS_ABORT;
+        error = true;
 #if PRINT_ENABLED
         fprintf(stderr, "WPM: Segmented message.  Sending Abort!\n");
 #endif
         goto WPM_ABORT;
     }
 
-    /* decode service request */
-    decode_len = 0;
-    do {
-        /* decode Object Identifier */
-        len =
-            wpm_decode_object_id(&service_request[decode_len],
-            service_len - decode_len, &wp_data);
-        if (len > 0) {
-            uint8_t tag_number = 0;
-
-            decode_len += len;
-            /* Opening tag 1 - List of Properties */
-            if (decode_is_opening_tag_number(&service_request[decode_len++],
-                    1)) {
-                do {
-                    /* decode a 'Property Identifier'; (3) an optional 'Property Array Index' */
-                    /* (4) a 'Property Value'; and (5) an optional 'Priority'. */
-                    len =
-                        wpm_decode_object_property(&service_request
-                        [decode_len], service_len - decode_len, &wp_data);
-                    if (len > 0) {
-                        decode_len += len;
-#if PRINT_ENABLED
-                        fprintf(stderr,
-                            "WPM: type=%lu instance=%lu property=%lu priority=%lu index=%ld\n",
-                            (unsigned long) wp_data.object_type,
-                            (unsigned long) wp_data.object_instance,
-                            (unsigned long) wp_data.object_property,
-                            (unsigned long) wp_data.priority,
-                            (long) wp_data.array_index);
-#endif
-                        if (Device_Write_Property(&wp_data) == false) {
-                            error = true;
-                            len = BACNET_STATUS_ERROR;
-                            goto WPM_ABORT;
-                        }
-                    } else {
-#if PRINT_ENABLED
-                        fprintf(stderr, "WPM: Bad Encoding!\n");
-#endif
-                        error = true;
-                        goto WPM_ABORT;
-                    }
-
-                    /* Closing tag 1 - List of Properties */
-                    if (decode_is_closing_tag_number(&service_request
-                            [decode_len], 1)) {
-                        tag_number = 1;
-                        decode_len++;
-                    } else
-                        tag_number = 0; /* it was not tag 1, decode next Property Identifier ... */
-
-                }
-                while (tag_number != 1);        /* end decoding List of Properties for "that" object */
-
-                if (error) {
-                    goto WPM_ABORT;
-                }
-            }
-        } else {
-#if PRINT_ENABLED
-            fprintf(stderr, "WPM: Bad Encoding!\n");
-#endif
-            error = true;
-            goto WPM_ABORT;
-        }
-    } while (decode_len < service_len);
+    /* validate the whole request, then apply it */
+    len = wpm_process(service_request, service_len, &wp_data, false);
+    if (len == 0) {
+        handler_cov_batch_begin();
+        len = wpm_process(service_request, service_len, &wp_data, true);
+        handler_cov_batch_end();
+    }
+    if (len != 0) {
+        error = true;
+    }
 
   WPM_ABORT:
     /* encode the NPDU portion of the packet */
@@ -121,3 +121,143 @@ uint8_t Send_Read_Property_Multiple_Request(
 
     return invoke_id;
 }
+
+/* stamps the NPDU header of the destination and an invoke id onto a copy
+   of the encoded confirmed request, and sends it */
+static uint8_t Send_Encoded_Request(
+    BACNET_ADDRESS * dest,
+    unsigned max_apdu,
+    uint8_t * apdu,
+    unsigned apdu_len)
+{
+    BACNET_ADDRESS my_address;
+    BACNET_NPDU_DATA npdu_data;
+    uint8_t *pdu = &Handler_Transmit_Buffer[0];
+    uint8_t invoke_id = 0;
+    int pdu_len = 0;
+    int bytes_sent = 0;
+
+    invoke_id = tsm_next_free_invokeID_peer(dest);
+    if (!invoke_id) {
+        return 0;
+    }
+    datalink_get_my_address(&my_address);
+    npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_NORMAL);
+    pdu_len = npdu_encode_pdu(&pdu[0], dest, &my_address, &npdu_data);
+    if (((unsigned) pdu_len + apdu_len >= max_apdu) ||
+        ((unsigned) pdu_len + apdu_len > sizeof(Handler_Transmit_Buffer))) {
+        tsm_free_invoke_id_peer(dest, invoke_id);
+        return 0;
+    }
+    memcpy(&pdu[pdu_len], apdu, apdu_len);
+    /* the third octet of a confirmed request is its invoke id */
+    pdu[pdu_len + 2] = invoke_id;
+    pdu_len += apdu_len;
+    tsm_set_confirmed_unsegmented_transaction(invoke_id, dest, &npdu_data,
+        &pdu[0], (uint16_t) pdu_len);
+    bytes_sent = datalink_send_pdu(dest, &npdu_data, &pdu[0], pdu_len);
+#if PRINT_ENABLED
+    if (bytes_sent <= 0)
+        fprintf(stderr, "Failed to Send Confirmed Request (%s)!\n",
+            strerror(errno));
+#else
+    (void) bytes_sent;
+#endif
+
+    return invoke_id;
+}
+
+/** Sends the same encoded confirmed request, e.g. the ReadPropertyMultiple
+ * of a set of identical controllers, to each of a list of addresses.
+ * Only the NPDU header and the invoke id are encoded for each of them, and
+ * on BACnet/IP the datagrams go out in send batches.
+ * @ingroup DSRPM
+ *
+ * @param dests [in] The addresses of the devices.
+ * @param count [in] The number of addresses.
+ * @param max_apdu [in] The smallest max APDU of the devices.
+ * @param apdu [in] The confirmed request, its invoke id is replaced.
+ * @param apdu_len [in] The length of the request.
+ * @param invoke_ids [out] The invoke id of each device (unique for the
+ *        device, see tsm_invoke_id_free_peer()), or 0 if it wasn't sent.
+ * @return The number of requests sent.
+ */
+unsigned Send_Confirmed_Request_List(
+    BACNET_ADDRESS * dests,
+    unsigned count,
+    unsigned max_apdu,
+    uint8_t * apdu,
+    unsigned apdu_len,
+    uint8_t * invoke_ids)
+{
+    unsigned sent = 0;
+    unsigned i = 0;
+
+    memset(invoke_ids, 0, count);
+    if (!dcc_communication_enabled() || (apdu_len < 3))
+        return 0;
+#if defined(BACDL_BIP)
+    bip_send_batch_begin();
+#endif
+    for (i = 0; i < count; i++) {
+        invoke_ids[i] = Send_Encoded_Request(&dests[i], max_apdu, apdu,
+            apdu_len);
+        if (invoke_ids[i])
+            sent++;
+    }
+#if defined(BACDL_BIP)
+    bip_send_batch_end();
+#endif
+
+    return sent;
+}
+
+/** Sends a Read Property Multiple request to each of a list of devices,
+ * encoding it once.
+ * @ingroup DSRPM
+ *
+ * @param device_ids [in] The IDs of the destination devices.
+ * @param count [in] The number of devices.
+ * @param read_access_data [in] Ptr to structure with the linked list of
+ *        properties to be read.
+ * @param invoke_ids [out] The invoke id of each device (unique for the
+ *        device, see tsm_invoke_id_free_peer()), or 0 if the device is not
+ *        bound or no tsm is available.
+ * @return The number of requests sent.
+ */
+unsigned Send_Read_Property_Multiple_Request_List(
+    uint32_t * device_ids,
+    unsigned count,
+    BACNET_READ_ACCESS_DATA * read_access_data,
+    uint8_t * invoke_ids)
+{
+    uint8_t apdu[MAX_APDU];
+    BACNET_ADDRESS dest;
+    unsigned max_apdu = 0;
+    unsigned sent = 0;
+    unsigned i = 0;
+    int apdu_len = 0;
+
+    memset(invoke_ids, 0, count);
+    if (!dcc_communication_enabled())
+        return 0;
+    apdu_len = rpm_encode_apdu(&apdu[0], sizeof(apdu), 0, read_access_data);
+    if (apdu_len <= 0)
+        return 0;
+#if defined(BACDL_BIP)
+    bip_send_batch_begin();
+#endif
+    for (i = 0; i < count; i++) {
+        if (address_get_by_device(device_ids[i], &max_apdu, &dest)) {
+            invoke_ids[i] = Send_Encoded_Request(&dest, max_apdu, apdu,
+                (unsigned) apdu_len);
+        }
+        if (invoke_ids[i])
+            sent++;
+    }
+#if defined(BACDL_BIP)
+    bip_send_batch_end();
+#endif
+
+    return sent;
+}
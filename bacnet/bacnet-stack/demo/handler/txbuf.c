@@ -26,7 +26,9 @@
 #include <stdint.h>
 #include "config.h"
 #include "datalink.h"
+#include "txbuf.h"
 
 /** @file txbuf.c  Declare the global Transmit Buffer for handler functions. */
 
-uint8_t Handler_Transmit_Buffer[MAX_PDU] = { 0 };
+BACNET_THREAD_LOCAL uint8_t
+    Handler_Transmit_Buffer[HANDLER_TRANSMIT_BUFFER_SIZE] = { 0 };
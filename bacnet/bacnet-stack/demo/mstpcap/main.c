@@ -41,6 +41,9 @@
 #include <time.h>
 /* OS specific include*/
 #include "net.h"
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
 #include "timer.h"
 /* local includes */
 #include "bytes.h"
@@ -59,6 +62,20 @@
 
 /* define our Data Link Type for libPCAP */
 #define DLT_BACNET_MS_TP 165
+/* pcapng blocks, see the PCAP Next Generation Dump File Format */
+#define PCAPNG_SECTION_HEADER 0x0A0D0D0A
+#define PCAPNG_INTERFACE_DESCRIPTION 0x00000001
+#define PCAPNG_ENHANCED_PACKET 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPTION_IF_TSRESOL 9
+/* the length of the Enhanced Packet Block of a frame, padded to 32 bits */
+#define PCAPNG_PACKET_BLOCK_LEN(len) (32 + (((len) + 3) & ~3))
+/* the timestamps are nanoseconds */
+#define CAPTURE_TSRESOL 9
+/* the blocks given to the pipe at once, and the longest they wait */
+#define CAPTURE_BATCH_SIZE 8192
+#define CAPTURE_BATCH_NS 100000000ULL
+#define MAX_RING_FILES 1024
 /* local min/max macros */
 #ifndef max
 #define max(a,b) (((a) (b)) ? (a) : (b))
@@ -126,18 +143,15 @@ struct mstp_statistics {
 #define MAX_MSTP_DEVICES 256
 static struct mstp_statistics MSTP_Statistics[MAX_MSTP_DEVICES];
 static uint32_t Invalid_Frame_Count;
+/* frames that found no capture file open */
+static uint32_t Dropped_Frame_Count;
 
-static uint32_t timeval_diff_ms(
-    struct timeval *old,
-    struct timeval *now)
+static uint32_t timestamp_diff_ms(
+    uint64_t old_ns,
+    uint64_t now_ns)
 {
-    uint32_t ms = 0;
-
     /* convert to milliseconds */
-    ms = (now->tv_sec - old->tv_sec) * 1000 + (now->tv_usec -
-        old->tv_usec) / 1000;
-
-    return ms;
+    return (uint32_t) ((now_ns - old_ns) / 1000000);
 }
 
 static void mstp_monitor_i_am(
@@ -183,10 +197,10 @@ static void mstp_monitor_i_am(
 }
 
 static void packet_statistics(
-    struct timeval *tv,
+    uint64_t ns,
     volatile struct mstp_port_struct_t *mstp_port)
 {
-    static struct timeval old_tv = { 0 };
+    static uint64_t old_ns = 0;
     static uint8_t old_frame = 255;
     static uint8_t old_src = 255;
     static uint8_t old_dst = 255;
@@ -210,13 +224,13 @@ static void packet_statistics(
                     /* repeated token */
                     MSTP_Statistics[dst].token_retries++;
                     /* Tusage_timeout */
-                    delta = timeval_diff_ms(&old_tv, tv);
+                    delta = timestamp_diff_ms(old_ns, ns);
                     if (delta > MSTP_Statistics[src].tusage_timeout) {
                         MSTP_Statistics[src].tusage_timeout = delta;
                     }
                 } else if (old_dst == src) {
                     /* token to token response time */
-                    delta = timeval_diff_ms(&old_tv, tv);
+                    delta = timestamp_diff_ms(old_ns, ns);
                     if (delta > MSTP_Statistics[src].token_reply) {
                         MSTP_Statistics[src].token_reply = delta;
                     }
@@ -224,7 +238,7 @@ static void packet_statistics(
             } else if ((old_frame == FRAME_TYPE_POLL_FOR_MASTER) &&
                 (old_src == src)) {
                 /* Tusage_timeout */
-                delta = timeval_diff_ms(&old_tv, tv);
+                delta = timestamp_diff_ms(old_ns, ns);
                 if (delta > MSTP_Statistics[src].tusage_timeout) {
                     MSTP_Statistics[src].tusage_timeout = delta;
                 }
@@ -252,7 +266,7 @@ static void packet_statistics(
             }
             if ((old_frame == FRAME_TYPE_POLL_FOR_MASTER) && (old_src == src)) {
                 /* Tusage_timeout - sole master */
-                delta = timeval_diff_ms(&old_tv, tv);
+                delta = timestamp_diff_ms(old_ns, ns);
                 if (delta > MSTP_Statistics[src].tusage_timeout) {
                     MSTP_Statistics[src].tusage_timeout = delta;
                 }
@@ -261,7 +275,7 @@ static void packet_statistics(
         case FRAME_TYPE_REPLY_TO_POLL_FOR_MASTER:
             MSTP_Statistics[src].rpfm_count++;
             if (old_frame == FRAME_TYPE_POLL_FOR_MASTER) {
-                delta = timeval_diff_ms(&old_tv, tv);
+                delta = timestamp_diff_ms(old_ns, ns);
                 if (delta > MSTP_Statistics[src].pfm_reply) {
                     MSTP_Statistics[src].pfm_reply = delta;
                 }
@@ -281,7 +295,7 @@ static void packet_statistics(
             if ((old_frame == FRAME_TYPE_BACNET_DATA_EXPECTING_REPLY) &&
                 (old_dst == src)) {
                 /* DER response time */
-                delta = timeval_diff_ms(&old_tv, tv);
+                delta = timestamp_diff_ms(old_ns, ns);
                 if (delta > MSTP_Statistics[src].der_reply) {
                     MSTP_Statistics[src].der_reply = delta;
                 }
@@ -300,7 +314,7 @@ static void packet_statistics(
             if ((old_frame == FRAME_TYPE_BACNET_DATA_EXPECTING_REPLY) &&
                 (old_dst == src)) {
                 /* Postponed response time */
-                delta = timeval_diff_ms(&old_tv, tv);
+                delta = timestamp_diff_ms(old_ns, ns);
                 if (delta > MSTP_Statistics[src].reply_postponed) {
                     MSTP_Statistics[src].reply_postponed = delta;
                 }
@@ -314,56 +328,55 @@ static void packet_statistics(
     old_dst = dst;
     old_src = src;
     old_frame = frame;
-    old_tv.tv_sec = tv->tv_sec;
-    old_tv.tv_usec = tv->tv_usec;
+    old_ns = ns;
 }
 
 static void packet_statistics_print(
-    void)
+    FILE * stream)
 {
     unsigned i; /* loop counter */
     unsigned node_count = 0;
     long unsigned int self_or_ooo_count;
 
-    fprintf(stdout, "\n");
-    fprintf(stdout, "==== MS/TP Frame Counts ====\n");
-    fprintf(stdout, "%-8s%-8s%-8s%-8s%-8s%-8s%-8s%-8s%-8s%-7s", "MAC",
+    fprintf(stream, "\n");
+    fprintf(stream, "==== MS/TP Frame Counts ====\n");
+    fprintf(stream, "%-8s%-8s%-8s%-8s%-8s%-8s%-8s%-8s%-8s%-7s", "MAC",
         "Device", "Tokens", "PFM", "RPFM", "DER", "Postpd", "DNER", "TestReq",
         "TestRsp");
-    fprintf(stdout, "\n");
+    fprintf(stream, "\n");
     for (i = 0; i < MAX_MSTP_DEVICES; i++) {
         /* check for masters or slaves */
         if ((MSTP_Statistics[i].token_count) || (MSTP_Statistics[i].der_reply)
             || (MSTP_Statistics[i].pfm_count)) {
             node_count++;
-            fprintf(stdout, "%-8u", i);
+            fprintf(stream, "%-8u", i);
             if (MSTP_Statistics[i].device_id <= 4194303) {
-                fprintf(stdout, "%-8lu",
+                fprintf(stream, "%-8lu",
                     (long unsigned int) MSTP_Statistics[i].device_id);
             } else {
-                fprintf(stdout, "%-8s", "-");
+                fprintf(stream, "%-8s", "-");
             }
-            fprintf(stdout, "%-8lu%-8lu%-8lu%-8lu",
+            fprintf(stream, "%-8lu%-8lu%-8lu%-8lu",
                 (long unsigned int) MSTP_Statistics[i].token_count,
                 (long unsigned int) MSTP_Statistics[i].pfm_count,
                 (long unsigned int) MSTP_Statistics[i].rpfm_count,
                 (long unsigned int) MSTP_Statistics[i].der_count);
-            fprintf(stdout, "%-8lu%-8lu%-8lu%-7lu",
+            fprintf(stream, "%-8lu%-8lu%-8lu%-7lu",
                 (long unsigned int) MSTP_Statistics[i].reply_postponed_count,
                 (long unsigned int) MSTP_Statistics[i].dner_count,
                 (long unsigned int) MSTP_Statistics[i].test_request_count,
                 (long unsigned int) MSTP_Statistics[i].test_response_count);
-            fprintf(stdout, "\n");
+            fprintf(stream, "\n");
         }
     }
-    fprintf(stdout, "Node Count: %u\n", node_count);
+    fprintf(stream, "Node Count: %u\n", node_count);
     node_count = 0;
-    fprintf(stdout, "\n");
-    fprintf(stdout, "==== MS/TP Usage and Timing Maximums ====\n");
-    fprintf(stdout, "%-8s%-8s%-8s%-8s%-8s%-8s%-8s%-8s%-8s%-7s", "MAC",
+    fprintf(stream, "\n");
+    fprintf(stream, "==== MS/TP Usage and Timing Maximums ====\n");
+    fprintf(stream, "%-8s%-8s%-8s%-8s%-8s%-8s%-8s%-8s%-8s%-7s", "MAC",
         "MaxMstr", "Retries", "Npoll", "Self/TT", "Treply", "Tusage", "Trpfm",
         "Tder", "Tpostpd");
-    fprintf(stdout, "\n");
+    fprintf(stream, "\n");
     for (i = 0; i < MAX_MSTP_DEVICES; i++) {
         /* check for masters or slaves */
         if ((MSTP_Statistics[i].token_count) || (MSTP_Statistics[i].der_reply)
@@ -371,24 +384,26 @@ static void packet_statistics_print(
             node_count++;
             self_or_ooo_count = MSTP_Statistics[i].self_token_count +
                 MSTP_Statistics[i].ooo_token_count;
-            fprintf(stdout, "%-8u", i);
-            fprintf(stdout, "%-8lu%-8lu%-8lu%-8lu%-8lu",
+            fprintf(stream, "%-8u", i);
+            fprintf(stream, "%-8lu%-8lu%-8lu%-8lu%-8lu",
                 (long unsigned int) MSTP_Statistics[i].max_master,
                 (long unsigned int) MSTP_Statistics[i].token_retries,
                 (long unsigned int) MSTP_Statistics[i].npoll,
                 self_or_ooo_count,
                 (long unsigned int) MSTP_Statistics[i].token_reply);
-            fprintf(stdout, "%-8lu%-8lu%-8lu%-7lu",
+            fprintf(stream, "%-8lu%-8lu%-8lu%-7lu",
                 (long unsigned int) MSTP_Statistics[i].tusage_timeout,
                 (long unsigned int) MSTP_Statistics[i].pfm_reply,
                 (long unsigned int) MSTP_Statistics[i].der_reply,
                 (long unsigned int) MSTP_Statistics[i].reply_postponed);
-            fprintf(stdout, "\n");
+            fprintf(stream, "\n");
         }
     }
-    fprintf(stdout, "Node Count: %u\n", node_count);
-    fprintf(stdout, "Invalid Frame Count: %lu\n",
+    fprintf(stream, "Node Count: %u\n", node_count);
+    fprintf(stream, "Invalid Frame Count: %lu\n",
         (long unsigned int) Invalid_Frame_Count);
+    fprintf(stream, "Dropped Frame Count: %lu\n",
+        (long unsigned int) Dropped_Frame_Count);
 }
 
 static void packet_statistics_clear(
@@ -401,6 +416,7 @@ static void packet_statistics_clear(
         MSTP_Statistics[i].device_id = 0xFFFFFFFF;
     }
     Invalid_Frame_Count = 0;
+    Dropped_Frame_Count = 0;
 }
 
 static uint32_t Timer_Silence(
@@ -444,9 +460,64 @@ uint16_t MSTP_Get_Reply(
     return 0;
 }
 
-static char Capture_Filename[32] = "mstp_20090123091200.cap";
+/* the statistics are exported every Stats_Interval seconds, to
+   Stats_Filename or else to stdout */
+static uint32_t Stats_Interval = 60;
+static char *Stats_Filename = NULL;
+static char Stats_Temp_Filename[256];
+
+static void packet_statistics_export(
+    void)
+{
+    FILE *stream = NULL;
+
+    if (!Stats_Filename) {
+        packet_statistics_print(stdout);
+        return;
+    }
+    stream = fopen(Stats_Temp_Filename, "w");
+    if (!stream) {
+        fprintf(stderr, "mstpcap[stats]: failed to open %s: %s\n",
+            Stats_Temp_Filename, strerror(errno));
+        return;
+    }
+    packet_statistics_print(stream);
+    fclose(stream);
+    /* a reader gets one export or the other, never a part of one */
+#if defined(_WIN32)
+    (void) remove(Stats_Filename);
+#endif
+    if (rename(Stats_Temp_Filename, Stats_Filename) != 0) {
+        fprintf(stderr, "mstpcap[stats]: failed to rename %s: %s\n",
+            Stats_Temp_Filename, strerror(errno));
+    }
+}
+
+static char Capture_Filename[64] = "mstp_00000_20090123091200.pcapng";
 static FILE *pFile = NULL;      /* stream pointer */
+/* the ring of capture files: the newest Ring_Files of them are kept,
+   each one up to Ring_Size octets and Ring_Seconds old */
+static unsigned Ring_Files = 0;
+static uint32_t Ring_Size = 16UL * 1024UL * 1024UL;
+static uint32_t Ring_Seconds = 0;
+static char Ring_Names[MAX_RING_FILES][64];
+static unsigned Ring_Count = 0;
+static unsigned Ring_Oldest = 0;
+static unsigned Ring_Sequence = 0;
+/* the blocks are encoded in place: into the mapping of the file,
+   or into a batch that is written to the file when it is full */
+static uint8_t *Capture_Base = NULL;
+static size_t Capture_Size = 0;
+static size_t Capture_Used = 0;
+/* the octets of Capture_Base already given to the pipe */
+static size_t Capture_Flushed = 0;
+static uint32_t Capture_File_Bytes = 0;
+static uint64_t Capture_Opened_ns = 0;
+static uint64_t Capture_Flush_ns = 0;
+/* the pipe gets the header blocks of the first file only */
+static bool Pipe_Header_Sent = false;
 #if defined(_WIN32)
+static uint8_t Capture_Batch[4 * CAPTURE_BATCH_SIZE];
 static HANDLE hPipe = INVALID_HANDLE_VALUE;     /* pipe handle */
 static void named_pipe_create(
     char *pipe_name)
@@ -480,42 +551,33 @@ static void named_pipe_create(
     ConnectNamedPipe(hPipe, NULL);
 }
 
-size_t data_write(
-    const void *ptr,
-    size_t size,
-    size_t nitems)
+static void pipe_write(
+    const uint8_t * data,
+    size_t len)
 {
     DWORD cbWritten = 0;
     if (hPipe != INVALID_HANDLE_VALUE) {
         (void) WriteFile(hPipe, /* handle to pipe  */
-            ptr,        /* buffer to write from  */
-            size * nitems,      /* number of bytes to write  */
+            data,       /* buffer to write from  */
+            len,        /* number of bytes to write  */
             &cbWritten, /* number of bytes written  */
             NULL);      /* not overlapped I/O  */
     }
-
-    return fwrite(ptr, size, nitems, pFile);
 }
 
-size_t data_write_header(
-    const void *ptr,
-    size_t size,
-    size_t nitems,
-    bool pipe_enable)
+static uint64_t capture_timestamp_ns(
+    void)
 {
-    DWORD cbWritten = 0;
-    if (pipe_enable && (hPipe != INVALID_HANDLE_VALUE)) {
-        (void) WriteFile(hPipe, /* handle to pipe  */
-            ptr,        /* buffer to write from  */
-            size * nitems,      /* number of bytes to write  */
-            &cbWritten, /* number of bytes written  */
-            NULL);      /* not overlapped I/O  */
-    }
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
 
-    return fwrite(ptr, size, nitems, pFile);
+    return (uint64_t) tv.tv_sec * 1000000000ULL +
+        (uint64_t) tv.tv_usec * 1000ULL;
 }
 #else
 static int FD_Pipe = -1;
+static int FD_Capture = -1;
 static void named_pipe_create(
     char *name)
 {
@@ -532,34 +594,71 @@ static void named_pipe_create(
     }
 }
 
-size_t data_write(
-    const void *ptr,
-    size_t size,
-    size_t nitems)
+static void pipe_write(
+    const uint8_t * data,
+    size_t len)
 {
-    ssize_t bytes = 0;
     if (FD_Pipe != -1) {
-        bytes = write(FD_Pipe, ptr, size * nitems);
-        bytes = bytes;
+        if (write(FD_Pipe, data, len) < 0) {
+            perror("mstpcap: pipe");
+            close(FD_Pipe);
+            FD_Pipe = -1;
+        }
     }
-    return fwrite(ptr, size, nitems, pFile);
 }
 
-size_t data_write_header(
-    const void *ptr,
-    size_t size,
-    size_t nitems,
-    bool pipe_enable)
+/* the wall clock when the capture started, moved on by the monotonic
+   clock so that the timestamps never step back */
+static uint64_t capture_timestamp_ns(
+    void)
 {
-    ssize_t bytes = 0;
-    if (pipe_enable && (FD_Pipe != -1)) {
-        bytes = write(FD_Pipe, ptr, size * nitems);
-        bytes = bytes;
+    static uint64_t offset_ns = 0;
+    struct timespec now;
+    struct timespec wall;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (offset_ns == 0) {
+        clock_gettime(CLOCK_REALTIME, &wall);
+        offset_ns =
+            ((uint64_t) wall.tv_sec * 1000000000ULL + wall.tv_nsec) -
+            ((uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec);
     }
-    return fwrite(ptr, size, nitems, pFile);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec + offset_ns;
 }
 #endif
 
+/* pcapng is written in the byte order of the host */
+static void encode_host_u32(
+    uint8_t * buf,
+    uint32_t value)
+{
+    memcpy(buf, &value, sizeof(value));
+}
+
+static void encode_host_u16(
+    uint8_t * buf,
+    uint16_t value)
+{
+    memcpy(buf, &value, sizeof(value));
+}
+
+static uint32_t decode_host_u32(
+    const uint8_t * buf)
+{
+    uint32_t value = 0;
+    memcpy(&value, buf, sizeof(value));
+    return value;
+}
+
+static uint16_t decode_host_u16(
+    const uint8_t * buf)
+{
+    uint16_t value = 0;
+    memcpy(&value, buf, sizeof(value));
+    return value;
+}
+
 static void filename_create(
     char *filename)
 {
@@ -569,99 +668,290 @@ static void filename_create(
     if (filename) {
         my_time = time(NULL);
         today = localtime(&my_time);
-        sprintf(filename, "mstp_%04d%02d%02d%02d%02d%02d.cap",
-            1900 + today->tm_year, 1 + today->tm_mon, today->tm_mday,
-            today->tm_hour, today->tm_min, today->tm_sec);
+        sprintf(filename, "mstp_%05u_%04d%02d%02d%02d%02d%02d.pcapng",
+            Ring_Sequence % 100000, 1900 + today->tm_year, 1 + today->tm_mon,
+            today->tm_mday, today->tm_hour, today->tm_min, today->tm_sec);
+        Ring_Sequence++;
     }
 }
 
-/* write packet to file in libpcap format */
-static void write_global_header(
-    const char *filename)
+/* the Section Header Block, and the Interface Description Block of
+   MS/TP with nanosecond timestamps; returns their length */
+static size_t write_global_header(
+    uint8_t * buf)
 {
-    static bool pipe_enable = true;     /* don't write more than one header */
-    uint32_t magic_number = 0xa1b2c3d4; /* magic number */
-    uint16_t version_major = 2; /* major version number */
-    uint16_t version_minor = 4; /* minor version number */
-    int32_t thiszone = 0;       /* GMT to local correction */
-    uint32_t sigfigs = 0;       /* accuracy of timestamps */
-    uint32_t snaplen = 65535;   /* max length of captured packets, in octets */
-    uint32_t network = DLT_BACNET_MS_TP;     /* data link type - BACNET_MS_TP */
+    encode_host_u32(&buf[0], PCAPNG_SECTION_HEADER);
+    encode_host_u32(&buf[4], 28);
+    encode_host_u32(&buf[8], PCAPNG_BYTE_ORDER_MAGIC);
+    encode_host_u16(&buf[12], 1);       /* major version number */
+    encode_host_u16(&buf[14], 0);       /* minor version number */
+    /* section length not specified */
+    encode_host_u32(&buf[16], 0xFFFFFFFF);
+    encode_host_u32(&buf[20], 0xFFFFFFFF);
+    encode_host_u32(&buf[24], 28);
+    encode_host_u32(&buf[28], PCAPNG_INTERFACE_DESCRIPTION);
+    encode_host_u32(&buf[32], 32);
+    encode_host_u16(&buf[36], DLT_BACNET_MS_TP);
+    encode_host_u16(&buf[38], 0);
+    encode_host_u32(&buf[40], 65535);   /* snaplen */
+    encode_host_u16(&buf[44], PCAPNG_OPTION_IF_TSRESOL);
+    encode_host_u16(&buf[46], 1);
+    buf[48] = CAPTURE_TSRESOL;
+    buf[49] = buf[50] = buf[51] = 0;    /* padding */
+    encode_host_u32(&buf[52], 0);       /* opt_endofopt */
+    encode_host_u32(&buf[56], 32);
 
-    /* create a new file. */
-    pFile = fopen(filename, "wb");
+    return 60;
+}
+
+/* the blocks not given to the pipe yet, in one write */
+static void capture_flush(
+    void)
+{
+#if !defined(_WIN32)
+    size_t page = 0;
+#endif
+
+    if (!Capture_Base || (Capture_Used == Capture_Flushed)) {
+        return;
+    }
+    pipe_write(&Capture_Base[Capture_Flushed],
+        Capture_Used - Capture_Flushed);
+#if defined(_WIN32)
+    (void) fwrite(Capture_Base, Capture_Used, 1, pFile);
+    fflush(pFile);
+    Capture_Used = 0;
+#else
+    /* start the writeback of the pages, without waiting for it */
+    page = Capture_Flushed & ~((size_t) sysconf(_SC_PAGESIZE) - 1);
+    (void) msync(&Capture_Base[page], Capture_Used - page, MS_ASYNC);
+#endif
+    Capture_Flushed = Capture_Used;
+}
+
+static void capture_close(
+    void)
+{
+    capture_flush();
+#if defined(_WIN32)
     if (pFile) {
-        (void) data_write_header(&magic_number, sizeof(magic_number), 1,
-            pipe_enable);
-        (void) data_write_header(&version_major, sizeof(version_major), 1,
-            pipe_enable);
-        (void) data_write_header(&version_minor, sizeof(version_minor), 1,
-            pipe_enable);
-        (void) data_write_header(&thiszone, sizeof(thiszone), 1, pipe_enable);
-        (void) data_write_header(&sigfigs, sizeof(sigfigs), 1, pipe_enable);
-        (void) data_write_header(&snaplen, sizeof(snaplen), 1, pipe_enable);
-        (void) data_write_header(&network, sizeof(network), 1, pipe_enable);
-        fflush(pFile);
-        fprintf(stdout, "mstpcap: saving capture to %s\n", filename);
-    } else {
+        fclose(pFile);
+    }
+    pFile = NULL;
+#else
+    if (Capture_Base) {
+        (void) munmap(Capture_Base, Capture_Size);
+    }
+    if (FD_Capture != -1) {
+        /* the file was allocated for Ring_Size octets */
+        if (ftruncate(FD_Capture, Capture_Used) != 0) {
+            fprintf(stderr, "mstpcap: failed to truncate %s: %s\n",
+                Capture_Filename, strerror(errno));
+        }
+        close(FD_Capture);
+        FD_Capture = -1;
+    }
+#endif
+    Capture_Base = NULL;
+    Capture_Size = 0;
+    Capture_Used = 0;
+    Capture_Flushed = 0;
+}
+
+static bool capture_open(
+    const char *filename,
+    uint64_t ns)
+{
+    uint8_t header[64];
+    size_t len = 0;
+#if !defined(_WIN32)
+    int rv = 0;
+    void *map = NULL;
+#endif
+
+    len = write_global_header(header);
+#if defined(_WIN32)
+    pFile = fopen(filename, "wb");
+    if (!pFile) {
         fprintf(stderr, "mstpcap[header]: failed to open %s: %s\n", filename,
             strerror(errno));
+        return false;
+    }
+    (void) fwrite(header, len, 1, pFile);
+    Capture_Base = Capture_Batch;
+    Capture_Size = sizeof(Capture_Batch);
+    Capture_Used = 0;
+#else
+    FD_Capture = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (FD_Capture == -1) {
+        fprintf(stderr, "mstpcap[header]: failed to open %s: %s\n", filename,
+            strerror(errno));
+        return false;
     }
-    if (pipe_enable) {
-        pipe_enable = false;
+    /* allocated up front, a full disk fails here rather than
+       with a SIGBUS on a store into the mapping */
+    rv = posix_fallocate(FD_Capture, 0, Ring_Size);
+    if (rv == 0) {
+        map =
+            mmap(NULL, Ring_Size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            FD_Capture, 0);
+        if (map == MAP_FAILED) {
+            rv = errno;
+        }
     }
+    if (rv != 0) {
+        fprintf(stderr, "mstpcap[header]: failed to map %s: %s\n", filename,
+            strerror(rv));
+        close(FD_Capture);
+        FD_Capture = -1;
+        return false;
+    }
+    Capture_Base = map;
+    Capture_Size = Ring_Size;
+    memcpy(Capture_Base, header, len);
+    Capture_Used = len;
+#endif
+    Capture_Flushed = Capture_Used;
+    Capture_File_Bytes = len;
+    Capture_Opened_ns = ns;
+    if (!Pipe_Header_Sent) {
+        pipe_write(header, len);
+        Pipe_Header_Sent = true;
+    }
+    fprintf(stdout, "mstpcap: saving capture to %s\n", filename);
+
+    return true;
 }
 
+static void filename_create_new(
+    uint64_t ns)
+{
+    unsigned index = 0;
 
+    capture_close();
+    if (Ring_Files) {
+        /* the oldest file makes room for this one */
+        if (Ring_Count == Ring_Files) {
+            (void) remove(Ring_Names[Ring_Oldest]);
+            Ring_Oldest = (Ring_Oldest + 1) % Ring_Files;
+            Ring_Count--;
+        }
+        index = (Ring_Oldest + Ring_Count) % Ring_Files;
+        Ring_Count++;
+    }
+    filename_create(&Capture_Filename[0]);
+    strcpy(Ring_Names[index], Capture_Filename);
+    Capture_Opened_ns = ns;
+    (void) capture_open(&Capture_Filename[0], ns);
+}
+
+/* room for a block of len octets, or NULL */
+static uint8_t *capture_reserve(
+    size_t len)
+{
+    if (!Capture_Base) {
+        return NULL;
+    }
+#if defined(_WIN32)
+    if (Capture_Used + len > Capture_Size) {
+        capture_flush();
+    }
+#endif
+    if (Capture_Used + len > Capture_Size) {
+        return NULL;
+    }
+
+    return &Capture_Base[Capture_Used];
+}
+
+/* write packet to file in pcapng format */
 static void write_received_packet(
-    volatile struct mstp_port_struct_t *mstp_port)
+    volatile struct mstp_port_struct_t *mstp_port,
+    uint64_t ns)
 {
-    uint32_t ts_sec;    /* timestamp seconds */
-    uint32_t ts_usec;   /* timestamp microseconds */
-    uint32_t incl_len;  /* number of octets of packet saved in file */
-    uint32_t orig_len;  /* actual length of packet */
-    uint8_t header[8];  /* MS/TP header */
-    struct timeval tv;
+    uint32_t frame_len; /* number of octets of packet saved in file */
+    uint32_t block_len;
+    uint8_t *block = NULL;
+    uint8_t *frame = NULL;
     size_t max_data = 0;
 
-    if (pFile) {
-        gettimeofday(&tv, NULL);
-        ts_sec = tv.tv_sec;
-        ts_usec = tv.tv_usec;
-        if ((mstp_port->ReceivedValidFrame) ||
-            (mstp_port->ReceivedValidFrameNotForUs)) {
-            packet_statistics(&tv, mstp_port);
-        }
-        (void) data_write(&ts_sec, sizeof(ts_sec), 1);
-        (void) data_write(&ts_usec, sizeof(ts_usec), 1);
-        if (mstp_port->DataLength) {
-            max_data = min(mstp_port->InputBufferSize, mstp_port->DataLength);
-            incl_len = orig_len = 8 + max_data + 2;
-        } else {
-            incl_len = orig_len = 8;
-        }
-        (void) data_write(&incl_len, sizeof(incl_len), 1);
-        (void) data_write(&orig_len, sizeof(orig_len), 1);
-        header[0] = 0x55;
-        header[1] = 0xFF;
-        header[2] = mstp_port->FrameType;
-        header[3] = mstp_port->DestinationAddress;
-        header[4] = mstp_port->SourceAddress;
-        header[5] = HI_BYTE(mstp_port->DataLength);
-        header[6] = LO_BYTE(mstp_port->DataLength);
-        header[7] = mstp_port->HeaderCRCActual;
-        (void) data_write(header, sizeof(header), 1);
-        if (mstp_port->DataLength) {
-            (void) data_write(mstp_port->InputBuffer, max_data, 1);
-            (void) data_write((char *) &mstp_port->DataCRCActualMSB, 1, 1);
-            (void) data_write((char *) &mstp_port->DataCRCActualLSB, 1, 1);
-        }
+    if (mstp_port->DataLength) {
+        max_data = min(mstp_port->InputBufferSize, mstp_port->DataLength);
+        frame_len = 8 + max_data + 2;
     } else {
-        fprintf(stderr, "mstpcap[packet]: failed to open %s: %s\n",
-            Capture_Filename, strerror(errno));
+        frame_len = 8;
+    }
+    block_len = PCAPNG_PACKET_BLOCK_LEN(frame_len);
+    if (Capture_Base && (Capture_File_Bytes + block_len > Ring_Size)) {
+        packet_statistics_export();
+        packet_statistics_clear();
+        filename_create_new(ns);
+    }
+    block = capture_reserve(block_len);
+    if (!block) {
+        Dropped_Frame_Count++;
+        return;
+    }
+    encode_host_u32(&block[0], PCAPNG_ENHANCED_PACKET);
+    encode_host_u32(&block[4], block_len);
+    encode_host_u32(&block[8], 0);      /* interface */
+    encode_host_u32(&block[12], (uint32_t) (ns >> 32));
+    encode_host_u32(&block[16], (uint32_t) ns);
+    encode_host_u32(&block[20], frame_len);
+    encode_host_u32(&block[24], frame_len);
+    frame = &block[28];
+    frame[0] = 0x55;
+    frame[1] = 0xFF;
+    frame[2] = mstp_port->FrameType;
+    frame[3] = mstp_port->DestinationAddress;
+    frame[4] = mstp_port->SourceAddress;
+    frame[5] = HI_BYTE(mstp_port->DataLength);
+    frame[6] = LO_BYTE(mstp_port->DataLength);
+    frame[7] = mstp_port->HeaderCRCActual;
+    if (mstp_port->DataLength) {
+        memcpy(&frame[8], mstp_port->InputBuffer, max_data);
+        frame[8 + max_data] = mstp_port->DataCRCActualMSB;
+        frame[8 + max_data + 1] = mstp_port->DataCRCActualLSB;
+    }
+    /* the padding, then the length again */
+    memset(&frame[frame_len], 0, block_len - 32 - frame_len);
+    encode_host_u32(&block[block_len - 4], block_len);
+    Capture_Used += block_len;
+    Capture_File_Bytes += block_len;
+    if (Capture_Used - Capture_Flushed >= CAPTURE_BATCH_SIZE) {
+        capture_flush();
+        Capture_Flush_ns = ns;
     }
 }
 
+/* the time based part of the capture: a frame doesn't wait for the pipe
+   longer than CAPTURE_BATCH_NS, and a file is no older than Ring_Seconds */
+static void capture_task(
+    uint64_t ns)
+{
+    if ((ns - Capture_Flush_ns) >= CAPTURE_BATCH_NS) {
+        capture_flush();
+        Capture_Flush_ns = ns;
+    }
+    if (!Capture_Base) {
+        /* the last file failed to open, try again every second */
+        if ((ns - Capture_Opened_ns) >= 1000000000ULL) {
+            filename_create_new(ns);
+        }
+    } else if (Ring_Seconds &&
+        ((ns - Capture_Opened_ns) >= (uint64_t) Ring_Seconds * 1000000000ULL)) {
+        packet_statistics_export();
+        packet_statistics_clear();
+        filename_create_new(ns);
+    }
+}
+
+/* the file being scanned: a pcapng one, and the units per second of
+   the timestamps of its interface */
+static bool Scan_Pcapng = false;
+static uint64_t Scan_Units = 1000000;
+static uint8_t Scan_Buffer[65536];
+
 /* write packet to file in libpcap format */
 static bool test_global_header(
     const char *filename)
@@ -673,12 +963,26 @@ static bool test_global_header(
     uint32_t sigfigs = 0;       /* accuracy of timestamps */
     uint32_t snaplen = 0;       /* max length of captured packets, in octets */
     uint32_t network = 0;       /* data link type - BACNET_MS_TP */
+    uint32_t block[2] = { 0 };  /* block length and byte-order magic */
     size_t count = 0;
 
     /* create a new file. */
     pFile = fopen(filename, "rb");
     if (pFile) {
         count = fread(&magic_number, sizeof(magic_number), 1, pFile);
+        if ((count == 1) && (magic_number == PCAPNG_SECTION_HEADER)) {
+            count = fread(block, sizeof(block), 1, pFile);
+            if ((count != 1) || (block[1] != PCAPNG_BYTE_ORDER_MAGIC)) {
+                fprintf(stderr, "mstpcap: invalid byte order\n");
+                fclose(pFile);
+                pFile = NULL;
+                return false;
+            }
+            /* the blocks are read from the Section Header on */
+            Scan_Pcapng = true;
+            fseek(pFile, 0, SEEK_SET);
+            return true;
+        }
         if ((count != 1) || (magic_number != 0xa1b2c3d4)) {
             fprintf(stderr, "mstpcap: invalid magic number\n");
             fclose(pFile);
@@ -736,111 +1040,172 @@ static bool test_global_header(
     return true;
 }
 
-static bool read_received_packet(
-    volatile struct mstp_port_struct_t *mstp_port)
+/* a libpcap record into Scan_Buffer */
+static bool pcap_read_packet(
+    uint32_t * frame_len,
+    uint64_t * ns)
 {
-    uint32_t ts_sec = 0;        /* timestamp seconds */
-    uint32_t ts_usec = 0;       /* timestamp microseconds */
-    uint32_t incl_len = 0;      /* number of octets of packet saved in file */
-    uint32_t orig_len = 0;      /* actual length of packet */
-    uint8_t header[8] = { 0 };  /* MS/TP header */
-    struct timeval tv;
-    size_t count = 0;
-    unsigned i = 0;
+    uint32_t record[4] = { 0 }; /* seconds, microseconds, included length
+                                   and original length */
 
-    if (pFile) {
-        count = fread(&ts_sec, sizeof(ts_sec), 1, pFile);
-        if (count != 1) {
-            fclose(pFile);
-            pFile = NULL;
-            return false;
-        }
-        count = fread(&ts_usec, sizeof(ts_usec), 1, pFile);
-        if (count != 1) {
-            fclose(pFile);
-            pFile = NULL;
-            return false;
-        }
-        tv.tv_sec = ts_sec;
-        tv.tv_usec = ts_usec;
-        count = fread(&incl_len, sizeof(incl_len), 1, pFile);
-        if (count != 1) {
-            fclose(pFile);
-            pFile = NULL;
+    if (fread(record, sizeof(record), 1, pFile) != 1) {
+        return false;
+    }
+    if (record[2] > sizeof(Scan_Buffer)) {
+        return false;
+    }
+    if ((record[2] > 0) && (fread(Scan_Buffer, record[2], 1, pFile) != 1)) {
+        return false;
+    }
+    *frame_len = record[2];
+    *ns = (uint64_t) record[0] * 1000000000ULL +
+        (uint64_t) record[1] * 1000ULL;
+
+    return true;
+}
+
+/* the next Enhanced Packet Block into Scan_Buffer, past the others */
+static bool pcapng_read_packet(
+    uint32_t * frame_len,
+    uint64_t * ns)
+{
+    uint32_t block[2] = { 0 };  /* block type and total length */
+    uint32_t len = 0;
+    uint32_t offset = 0;
+    uint16_t code = 0;
+    uint16_t option_len = 0;
+    uint64_t ts = 0;
+    uint8_t tsresol = 0;
+
+    for (;;) {
+        if (fread(block, sizeof(block), 1, pFile) != 1) {
             return false;
         }
-        count = fread(&orig_len, sizeof(orig_len), 1, pFile);
-        if (count != 1) {
-            fclose(pFile);
-            pFile = NULL;
+        if ((block[1] < 12) || ((block[1] - 8) > sizeof(Scan_Buffer))) {
+            fprintf(stderr, "mstpcap: invalid block length\n");
             return false;
         }
-        count = fread(&header, sizeof(header), 1, pFile);
-        if (count != 1) {
-            fclose(pFile);
-            pFile = NULL;
+        len = block[1] - 8;
+        if (fread(Scan_Buffer, len, 1, pFile) != 1) {
             return false;
         }
-        mstp_port->FrameType = header[2];
-        mstp_port->DestinationAddress = header[3];
-        mstp_port->SourceAddress = header[4];
-        mstp_port->DataLength = MAKE_WORD(header[6], header[5]);
-        mstp_port->HeaderCRCActual = header[7];
-        mstp_port->HeaderCRC = 0xFF;
-        for (i = 2; i < 8; i++) {
-            mstp_port->HeaderCRC =
-                CRC_Calc_Header(header[i], mstp_port->HeaderCRC);
-        }
-        if (mstp_port->HeaderCRC != 0x55) {
-            mstp_port->ReceivedInvalidFrame = true;
-        } else if (mstp_port->DataLength == 0) {
-            mstp_port->ReceivedInvalidFrame = false;
-            mstp_port->ReceivedValidFrame = true;
-            mstp_port->ReceivedValidFrameNotForUs = true;
-        }
-        if (orig_len > 8) {
-            /* packet includes data */
-            mstp_port->DataLength = orig_len - 8 - 2;
-            count =
-                fread(mstp_port->InputBuffer, mstp_port->DataLength, 1, pFile);
-            if (count != 1) {
-                fclose(pFile);
-                pFile = NULL;
+        if ((block[0] == PCAPNG_INTERFACE_DESCRIPTION) && (len >= 12)) {
+            if (decode_host_u16(&Scan_Buffer[0]) != DLT_BACNET_MS_TP) {
+                fprintf(stderr, "mstpcap: invalid data link type (DLT)\n");
                 return false;
             }
-            count = fread((char *) &mstp_port->DataCRCActualMSB, 1, 1, pFile);
-            if (count != 1) {
-                fclose(pFile);
-                pFile = NULL;
-                return false;
+            /* microseconds, unless if_tsresol says otherwise */
+            Scan_Units = 1000000;
+            for (offset = 8; offset + 4 <= len - 4;
+                offset += 4 + ((option_len + 3) & ~3)) {
+                code = decode_host_u16(&Scan_Buffer[offset]);
+                option_len = decode_host_u16(&Scan_Buffer[offset + 2]);
+                if (code == 0) {
+                    break;
+                }
+                if ((code == PCAPNG_OPTION_IF_TSRESOL) && (option_len >= 1)) {
+                    tsresol = Scan_Buffer[offset + 4];
+                    if (tsresol & 0x80) {
+                        Scan_Units = 1ULL << (tsresol & 0x3F);
+                    } else {
+                        for (Scan_Units = 1; tsresol > 0; tsresol--) {
+                            Scan_Units *= 10;
+                        }
+                    }
+                }
             }
-            count = fread((char *) &mstp_port->DataCRCActualLSB, 1, 1, pFile);
-            if (count != 1) {
-                fclose(pFile);
-                pFile = NULL;
+        } else if ((block[0] == PCAPNG_ENHANCED_PACKET) && (len >= 24)) {
+            *frame_len = decode_host_u32(&Scan_Buffer[12]);
+            if (*frame_len > len - 24) {
+                fprintf(stderr, "mstpcap: invalid packet length\n");
                 return false;
             }
-            mstp_port->DataCRC = 0xFFFF;
-            for (i = 0; i < mstp_port->DataLength; i++) {
-                mstp_port->DataCRC =
-                    CRC_Calc_Data(mstp_port->InputBuffer[i],
-                    mstp_port->DataCRC);
-            }
-            mstp_port->DataCRC =
-                CRC_Calc_Data(mstp_port->DataCRCActualMSB, mstp_port->DataCRC);
-            mstp_port->DataCRC =
-                CRC_Calc_Data(mstp_port->DataCRCActualLSB, mstp_port->DataCRC);
-            if (mstp_port->DataCRC != 0xF0B8) {
-                mstp_port->ReceivedInvalidFrame = true;
-            }
+            ts = ((uint64_t) decode_host_u32(&Scan_Buffer[4]) << 32) |
+                decode_host_u32(&Scan_Buffer[8]);
+            *ns = (ts / Scan_Units) * 1000000000ULL +
+                (ts % Scan_Units) * 1000000000ULL / Scan_Units;
+            memmove(Scan_Buffer, &Scan_Buffer[20], *frame_len);
+            return true;
+        }
+    }
+}
+
+/* the MS/TP frame of a packet, as the receive state machine would have
+   left it */
+static void frame_decode(
+    volatile struct mstp_port_struct_t *mstp_port,
+    uint8_t * frame,
+    uint32_t frame_len)
+{
+    unsigned i = 0;
+
+    mstp_port->ReceivedInvalidFrame = false;
+    mstp_port->ReceivedValidFrame = false;
+    mstp_port->ReceivedValidFrameNotForUs = false;
+    mstp_port->DataLength = 0;
+    if ((frame_len < 8) || ((frame_len > 8) && ((frame_len < 8 + 2) ||
+                ((frame_len - 8 - 2) > mstp_port->InputBufferSize)))) {
+        mstp_port->ReceivedInvalidFrame = true;
+        return;
+    }
+    mstp_port->FrameType = frame[2];
+    mstp_port->DestinationAddress = frame[3];
+    mstp_port->SourceAddress = frame[4];
+    mstp_port->HeaderCRCActual = frame[7];
+    mstp_port->HeaderCRC = 0xFF;
+    for (i = 2; i < 8; i++) {
+        mstp_port->HeaderCRC = CRC_Calc_Header(frame[i], mstp_port->HeaderCRC);
+    }
+    if (mstp_port->HeaderCRC != 0x55) {
+        mstp_port->ReceivedInvalidFrame = true;
+    }
+    if (frame_len > 8) {
+        /* packet includes data */
+        mstp_port->DataLength = frame_len - 8 - 2;
+        memcpy(mstp_port->InputBuffer, &frame[8], mstp_port->DataLength);
+        mstp_port->DataCRCActualMSB = frame[8 + mstp_port->DataLength];
+        mstp_port->DataCRCActualLSB = frame[8 + mstp_port->DataLength + 1];
+        mstp_port->DataCRC =
+            CRC_Calc_Data_Block(&mstp_port->InputBuffer[0],
+            mstp_port->DataLength, 0xFFFF);
+        mstp_port->DataCRC =
+            CRC_Calc_Data(mstp_port->DataCRCActualMSB, mstp_port->DataCRC);
+        mstp_port->DataCRC =
+            CRC_Calc_Data(mstp_port->DataCRCActualLSB, mstp_port->DataCRC);
+        if (mstp_port->DataCRC != 0xF0B8) {
+            mstp_port->ReceivedInvalidFrame = true;
+        }
+    }
+    if (!mstp_port->ReceivedInvalidFrame) {
+        mstp_port->ReceivedValidFrame = true;
+        mstp_port->ReceivedValidFrameNotForUs = true;
+    }
+}
+
+static bool read_received_packet(
+    volatile struct mstp_port_struct_t *mstp_port)
+{
+    uint32_t frame_len = 0;
+    uint64_t ns = 0;
+    bool status = false;
+
+    if (pFile) {
+        if (Scan_Pcapng) {
+            status = pcapng_read_packet(&frame_len, &ns);
         } else {
-            mstp_port->DataLength = 0;
+            status = pcap_read_packet(&frame_len, &ns);
         }
+        if (!status) {
+            fclose(pFile);
+            pFile = NULL;
+            return false;
+        }
+        frame_decode(mstp_port, Scan_Buffer, frame_len);
         if (mstp_port->ReceivedInvalidFrame) {
             Invalid_Frame_Count++;
         } else if ((mstp_port->ReceivedValidFrame) ||
             (mstp_port->ReceivedValidFrameNotForUs)) {
-            packet_statistics(&tv, mstp_port);
+            packet_statistics(ns, mstp_port);
         }
     } else {
         return false;
@@ -852,7 +1217,8 @@ static bool read_received_packet(
 static void cleanup(
     void)
 {
-    packet_statistics_print();
+    packet_statistics_export();
+    capture_close();
     if (pFile) {
         fflush(pFile);  /* stream pointer */
         fclose(pFile);  /* stream pointer */
@@ -902,17 +1268,6 @@ void signal_init(
 }
 #endif
 
-void filename_create_new(
-    void)
-{
-    if (pFile) {
-        fclose(pFile);
-    }
-    pFile = NULL;
-    filename_create(&Capture_Filename[0]);
-    write_global_header(&Capture_Filename[0]);
-}
-
 static void print_usage(
     char *filename)
 {
@@ -921,6 +1276,8 @@ static void print_usage(
     printf(" [--extcap-interface port]\n");
     printf(" [--extcap-interfaces][--extcap-dlts][--extcap-config]\n");
     printf(" [--capture][--baud baud][--fifo pipe]\n");
+    printf(" [--ring-files count][--ring-size MB][--ring-seconds seconds]\n");
+    printf(" [--stats-interval seconds][--stats-file filename]\n");
     printf(" [--version][--help]\n");
 }
 
@@ -930,9 +1287,10 @@ static void print_help(char *filename) {
         filename);
     printf("\n");
     printf("Captures MS/TP packets from a serial interface\n"
-        "and saves them to a file. Saves packets in a\n"
-        "filename mstp_20090123091200.cap that has data and time.\n"
-        "After receiving 65535 packets, a new file is created.\n" "\n"
+        "and saves them to a file. Saves packets in a pcapng\n"
+        "filename mstp_00000_20090123091200.pcapng that has a sequence\n"
+        "number, data and time, and nanosecond timestamps.\n"
+        "A new file is created when the file is full or old.\n" "\n"
         "Command line options:\n"
         "[--extcap-interface port] - serial interface.\n"
 #if defined(_WIN32)
@@ -949,7 +1307,17 @@ static void print_help(char *filename) {
 #else
         "    Supported values: any file name\n"
 #endif
-        "    Use that name as the interface name in Wireshark.\n");
+        "    Use that name as the interface name in Wireshark.\n"
+        "[--ring-files count] - keep only the newest count files.\n"
+        "    Defaults to 0, keep them all.\n"
+        "[--ring-size MB] - size of a file before the next one.\n"
+        "    Defaults to 16.\n"
+        "[--ring-seconds seconds] - age of a file before the next one.\n"
+        "    Defaults to 0, no limit.\n"
+        "[--stats-interval seconds] - how often the statistics are printed.\n"
+        "    Defaults to 60, 0 for only when a file is closed.\n"
+        "[--stats-file filename] - print the statistics to the file\n"
+        "    rather than to stdout, replacing it each time.\n");
     printf("\n");
     printf("%s [--extcap-interfaces][--extcap-dlts][--extcap-config]\n"
         "[--capture][--baud baud][--fifo pipe]\n"
@@ -966,6 +1334,9 @@ int main(
     volatile struct mstp_port_struct_t *mstp_port;
     long my_baud = 38400;
     uint32_t packet_count = 0;
+    uint64_t now = 0;
+    uint64_t progress_ns = 0;
+    uint64_t stats_ns = 0;
     int argi = 0;
     char *filename = NULL;
 
@@ -1013,7 +1384,7 @@ int main(
                         (unsigned) packet_count);
                 }
                 if (packet_count) {
-                    packet_statistics_print();
+                    packet_statistics_print(stdout);
                 }
                 Exit_Requested = true;
             } else {
@@ -1098,6 +1469,57 @@ int main(
             }
             named_pipe_create(argv[argi]);
         }
+        if (strcmp(argv[argi], "--ring-files") == 0) {
+            argi++;
+            if (argi >= argc) {
+                printf("A number of files must be provided.\n");
+                return 0;
+            }
+            Ring_Files = strtoul(argv[argi], NULL, 0);
+            if (Ring_Files > MAX_RING_FILES) {
+                Ring_Files = MAX_RING_FILES;
+            }
+        }
+        if (strcmp(argv[argi], "--ring-size") == 0) {
+            argi++;
+            if (argi >= argc) {
+                printf("A file size must be provided.\n");
+                return 0;
+            }
+            Ring_Size = strtoul(argv[argi], NULL, 0);
+            /* room for the largest frame, and below 4 GB */
+            if ((Ring_Size < 1) || (Ring_Size > 4095)) {
+                printf("The file size must be 1 to 4095 MB.\n");
+                return 1;
+            }
+            Ring_Size *= 1024UL * 1024UL;
+        }
+        if (strcmp(argv[argi], "--ring-seconds") == 0) {
+            argi++;
+            if (argi >= argc) {
+                printf("A number of seconds must be provided.\n");
+                return 0;
+            }
+            Ring_Seconds = strtoul(argv[argi], NULL, 0);
+        }
+        if (strcmp(argv[argi], "--stats-interval") == 0) {
+            argi++;
+            if (argi >= argc) {
+                printf("A number of seconds must be provided.\n");
+                return 0;
+            }
+            Stats_Interval = strtoul(argv[argi], NULL, 0);
+        }
+        if (strcmp(argv[argi], "--stats-file") == 0) {
+            argi++;
+            if ((argi >= argc) ||
+                (strlen(argv[argi]) + 5 > sizeof(Stats_Temp_Filename))) {
+                printf("A file name must be provided.\n");
+                return 0;
+            }
+            Stats_Filename = argv[argi];
+            sprintf(Stats_Temp_Filename, "%s.tmp", Stats_Filename);
+        }
     }
     if (Exit_Requested) {
         return 0;
@@ -1117,35 +1539,43 @@ int main(
 #else
     signal_init();
 #endif
-    filename_create_new();
+    now = capture_timestamp_ns();
+    progress_ns = stats_ns = Capture_Flush_ns = now;
+    filename_create_new(now);
     /* run forever */
     for (;;) {
         RS485_Check_UART_Data(mstp_port);
         MSTP_Receive_Frame_FSM(mstp_port);
+        now = capture_timestamp_ns();
         /* process the data portion of the frame */
         if (mstp_port->ReceivedValidFrame) {
-            write_received_packet(mstp_port);
+            write_received_packet(mstp_port, now);
+            packet_statistics(now, mstp_port);
             mstp_port->ReceivedValidFrame = false;
             packet_count++;
         } else if (mstp_port->ReceivedValidFrameNotForUs) {
-            write_received_packet(mstp_port);
+            write_received_packet(mstp_port, now);
+            packet_statistics(now, mstp_port);
             mstp_port->ReceivedValidFrameNotForUs = false;
             packet_count++;
         } else if (mstp_port->ReceivedInvalidFrame) {
-            write_received_packet(mstp_port);
+            write_received_packet(mstp_port, now);
             Invalid_Frame_Count++;
             mstp_port->ReceivedInvalidFrame = false;
             packet_count++;
         }
-        if (!(packet_count % 100)) {
-            fprintf(stdout, "\r%hu packets, %hu invalid frames", packet_count,
-                Invalid_Frame_Count);
+        capture_task(now);
+        if ((now - progress_ns) >= 1000000000ULL) {
+            fprintf(stdout, "\r%lu packets, %lu invalid frames",
+                (unsigned long) packet_count,
+                (unsigned long) Invalid_Frame_Count);
+            fflush(stdout);
+            progress_ns = now;
         }
-        if (packet_count >= 65535) {
-            packet_statistics_print();
-            packet_statistics_clear();
-            filename_create_new();
-            packet_count = 0;
+        if (Stats_Interval &&
+            ((now - stats_ns) >= (uint64_t) Stats_Interval * 1000000000ULL)) {
+            packet_statistics_export();
+            stats_ns = now;
         }
         if (Exit_Requested) {
             break;
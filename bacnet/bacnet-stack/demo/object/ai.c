@@ -29,6 +29,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "bacdef.h"
 #include "bacdcode.h"
@@ -38,15 +39,19 @@
 #include "device.h"
 #include "handlers.h"
 #include "timestamp.h"
+#include "objstore.h"
 #include "ai.h"
 
 
+/* number of objects created by Analog_Input_Init() */
 #ifndef MAX_ANALOG_INPUTS
 #define MAX_ANALOG_INPUTS 4
 #endif
 
 
-ANALOG_INPUT_DESCR AI_Descr[MAX_ANALOG_INPUTS];
+static OBJECT_STORE AI_Default_Store;
+/* the objects being addressed, see Analog_Input_Store_Select() */
+static OBJECT_STORE *AI_Store = &AI_Default_Store;
 
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int Properties_Required[] = {
@@ -103,89 +108,139 @@ void Analog_Input_Property_Lists(
 }
 
 
-void Analog_Input_Init(
-    void)
+static ANALOG_INPUT_DESCR *Analog_Input_Descr(
+    unsigned index)
 {
-    unsigned i;
+    return (ANALOG_INPUT_DESCR *) Object_Store_Element(AI_Store, index);
+}
+
+/* add an object with the default property values */
+static bool Analog_Input_Add(
+    uint32_t object_instance)
+{
+    ANALOG_INPUT_DESCR *pObject;
 #if defined(INTRINSIC_REPORTING)
     unsigned j;
 #endif
 
-    for (i = 0; i < MAX_ANALOG_INPUTS; i++) {
-        AI_Descr[i].Present_Value = 0.0f;
-        AI_Descr[i].Out_Of_Service = false;
-        AI_Descr[i].Units = UNITS_PERCENT;
-        AI_Descr[i].Reliability = RELIABILITY_NO_FAULT_DETECTED;
-        AI_Descr[i].Prior_Value = 0.0f;
-        AI_Descr[i].COV_Increment = 1.0f;
-        AI_Descr[i].Changed = false;
+    pObject = Object_Store_Add(AI_Store, object_instance);
+    if (!pObject) {
+        return false;
+    }
+    sprintf(pObject->Object_Name, "ANALOG INPUT %lu",
+        (unsigned long) object_instance);
+    pObject->Present_Value = 0.0f;
+    pObject->Out_Of_Service = false;
+    pObject->Units = UNITS_PERCENT;
+    pObject->Reliability = RELIABILITY_NO_FAULT_DETECTED;
+    pObject->Prior_Value = 0.0f;
+    pObject->COV_Increment = 1.0f;
+    pObject->Changed = false;
 #if defined(INTRINSIC_REPORTING)
-        AI_Descr[i].Event_State = EVENT_STATE_NORMAL;
-        /* notification class not connected */
-        AI_Descr[i].Notification_Class = BACNET_MAX_INSTANCE;
-        /* initialize Event time stamps using wildcards
-           and set Acked_transitions */
-        for (j = 0; j < MAX_BACNET_EVENT_TRANSITION; j++) {
-            datetime_wildcard_set(&AI_Descr[i].Event_Time_Stamps[j]);
-            AI_Descr[i].Acked_Transitions[j].bIsAcked = true;
-        }
-
-        /* Set handler for GetEventInformation function */
-        handler_get_event_information_set(OBJECT_ANALOG_INPUT,
-            Analog_Input_Event_Information);
-        /* Set handler for AcknowledgeAlarm function */
-        handler_alarm_ack_set(OBJECT_ANALOG_INPUT, Analog_Input_Alarm_Ack);
-        /* Set handler for GetAlarmSummary Service */
-        handler_get_alarm_summary_set(OBJECT_ANALOG_INPUT,
-            Analog_Input_Alarm_Summary);
+    pObject->Event_State = EVENT_STATE_NORMAL;
+    /* notification class not connected */
+    pObject->Notification_Class = BACNET_MAX_INSTANCE;
+    /* initialize Event time stamps using wildcards
+       and set Acked_transitions */
+    for (j = 0; j < MAX_BACNET_EVENT_TRANSITION; j++) {
+        datetime_wildcard_set(&pObject->Event_Time_Stamps[j]);
+        pObject->Acked_Transitions[j].bIsAcked = true;
+    }
 #endif
+
+    return true;
+}
+
+/* create an object at run time, e.g. from a configuration file */
+bool Analog_Input_Create(
+    uint32_t object_instance)
+{
+    if ((object_instance >= BACNET_MAX_INSTANCE) ||
+        !Analog_Input_Add(object_instance)) {
+        return false;
     }
+    Device_Object_Created(OBJECT_ANALOG_INPUT, object_instance);
+
+    return true;
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need validate that the */
-/* given instance exists */
-bool Analog_Input_Valid_Instance(
+bool Analog_Input_Delete(
     uint32_t object_instance)
 {
-    unsigned int index;
+    if (!Object_Store_Remove(AI_Store, object_instance)) {
+        return false;
+    }
+    Device_Object_Deleted(OBJECT_ANALOG_INPUT, object_instance);
 
-    index = Analog_Input_Instance_To_Index(object_instance);
-    if (index < MAX_ANALOG_INPUTS)
-        return true;
+    return true;
+}
 
-    return false;
+void Analog_Input_Cleanup(
+    void)
+{
+    Object_Store_Cleanup(AI_Store);
+}
+
+void Analog_Input_Init(
+    void)
+{
+    unsigned i;
+
+    Object_Store_Cleanup(AI_Store);
+    Object_Store_Init(AI_Store, sizeof(ANALOG_INPUT_DESCR));
+    for (i = 0; i < MAX_ANALOG_INPUTS; i++) {
+        Analog_Input_Add(i);
+    }
+#if defined(INTRINSIC_REPORTING)
+    /* Set handler for GetEventInformation function */
+    handler_get_event_information_set(OBJECT_ANALOG_INPUT,
+        Analog_Input_Event_Information);
+    /* Set handler for AcknowledgeAlarm function */
+    handler_alarm_ack_set(OBJECT_ANALOG_INPUT, Analog_Input_Alarm_Ack);
+    /* Set handler for GetAlarmSummary Service */
+    handler_get_alarm_summary_set(OBJECT_ANALOG_INPUT,
+        Analog_Input_Alarm_Summary);
+#endif
+}
+
+/* Address the objects in another store, eg. those of one of the Devices
+   behind a gateway, or NULL for the objects of Analog_Input_Init().
+   A zeroed store is ready for use. */
+void Analog_Input_Store_Select(
+    OBJECT_STORE * store)
+{
+    if (store == NULL) {
+        store = &AI_Default_Store;
+    } else if (store->element_size == 0) {
+        Object_Store_Init(store, sizeof(ANALOG_INPUT_DESCR));
+    }
+    AI_Store = store;
+}
+
+bool Analog_Input_Valid_Instance(
+    uint32_t object_instance)
+{
+    return (Object_Store_Find(AI_Store, object_instance) != NULL);
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then count how many you have */
 unsigned Analog_Input_Count(
     void)
 {
-    return MAX_ANALOG_INPUTS;
+    return Object_Store_Count(AI_Store);
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the instance */
-/* that correlates to the correct index */
+/* the index is only good until the next object is deleted */
 uint32_t Analog_Input_Index_To_Instance(
     unsigned index)
 {
-    return index;
+    return Object_Store_Instance(AI_Store, index);
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the index */
-/* that correlates to the correct instance number */
+/* returns Analog_Input_Count() if there is no such instance */
 unsigned Analog_Input_Instance_To_Index(
     uint32_t object_instance)
 {
-    unsigned index = MAX_ANALOG_INPUTS;
-
-    if (object_instance < MAX_ANALOG_INPUTS)
-        index = object_instance;
-
-    return index;
+    return Object_Store_Index(AI_Store, object_instance);
 }
 
 float Analog_Input_Present_Value(
@@ -195,8 +250,8 @@ float Analog_Input_Present_Value(
     unsigned int index;
 
     index = Analog_Input_Instance_To_Index(object_instance);
-    if (index < MAX_ANALOG_INPUTS) {
-        value = AI_Descr[index].Present_Value;
+    if (index < Object_Store_Count(AI_Store)) {
+        value = Analog_Input_Descr(index)->Present_Value;
     }
 
     return value;
@@ -209,17 +264,21 @@ static void Analog_Input_COV_Detect(unsigned int index,
     float cov_increment = 0.0;
     float cov_delta = 0.0;
 
-    if (index < MAX_ANALOG_INPUTS) {
-        prior_value = AI_Descr[index].Prior_Value;
-        cov_increment = AI_Descr[index].COV_Increment;
+    if (index < Object_Store_Count(AI_Store)) {
+        prior_value = Analog_Input_Descr(index)->Prior_Value;
+        cov_increment = Analog_Input_Descr(index)->COV_Increment;
         if (prior_value > value) {
             cov_delta = prior_value - value;
         } else {
             cov_delta = value - prior_value;
         }
         if (cov_delta >= cov_increment) {
-            AI_Descr[index].Changed = true;
-            AI_Descr[index].Prior_Value = value;
+            if (!Analog_Input_Descr(index)->Changed) {
+                Analog_Input_Descr(index)->Changed = true;
+                Device_COV_Changed(OBJECT_ANALOG_INPUT,
+                    Analog_Input_Index_To_Instance(index));
+            }
+            Analog_Input_Descr(index)->Prior_Value = value;
         }
     }
 }
@@ -231,9 +290,9 @@ void Analog_Input_Present_Value_Set(
     unsigned int index = 0;
 
     index = Analog_Input_Instance_To_Index(object_instance);
-    if (index < MAX_ANALOG_INPUTS) {
+    if (index < Object_Store_Count(AI_Store)) {
         Analog_Input_COV_Detect(index, value);
-        AI_Descr[index].Present_Value = value;
+        Analog_Input_Descr(index)->Present_Value = value;
     }
 }
 
@@ -241,19 +300,49 @@ bool Analog_Input_Object_Name(
     uint32_t object_instance,
     BACNET_CHARACTER_STRING * object_name)
 {
-    static char text_string[32] = "";   /* okay for single thread */
-    unsigned int index;
+    ANALOG_INPUT_DESCR *pObject;
     bool status = false;
 
-    index = Analog_Input_Instance_To_Index(object_instance);
-    if (index < MAX_ANALOG_INPUTS) {
-        sprintf(text_string, "ANALOG INPUT %lu", (unsigned long) index);
-        status = characterstring_init_ansi(object_name, text_string);
+    pObject = Object_Store_Find(AI_Store, object_instance);
+    if (pObject) {
+        status = characterstring_init_ansi(object_name, pObject->Object_Name);
     }
 
     return status;
 }
 
+/* the name left in place, see BACNET_STRING_VIEW; false if not found */
+bool Analog_Input_Object_Name_View(
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view)
+{
+    ANALOG_INPUT_DESCR *pObject;
+
+    pObject = Object_Store_Find(AI_Store, object_instance);
+    stringview_init_ansi(view, pObject ? pObject->Object_Name : NULL);
+
+    return (pObject != NULL);
+}
+
+/* note: the object name must be unique within this device */
+bool Analog_Input_Name_Set(
+    uint32_t object_instance,
+    char *new_name)
+{
+    ANALOG_INPUT_DESCR *pObject;
+
+    pObject = Object_Store_Find(AI_Store, object_instance);
+    if (!pObject || !new_name ||
+        (strlen(new_name) >= sizeof(pObject->Object_Name))) {
+        return false;
+    }
+    strcpy(pObject->Object_Name, new_name);
+    /* a new name for the index, and a new Database_Revision */
+    Device_Object_Created(OBJECT_ANALOG_INPUT, object_instance);
+
+    return true;
+}
+
 bool Analog_Input_Change_Of_Value(
     uint32_t object_instance)
 {
@@ -261,8 +350,8 @@ bool Analog_Input_Change_Of_Value(
     bool changed = false;
 
     index = Analog_Input_Instance_To_Index(object_instance);
-    if (index < MAX_ANALOG_INPUTS) {
-        changed = AI_Descr[index].Changed;
+    if (index < Object_Store_Count(AI_Store)) {
+        changed = Analog_Input_Descr(index)->Changed;
     }
 
     return changed;
@@ -274,8 +363,8 @@ void Analog_Input_Change_Of_Value_Clear(
     unsigned index = 0;
 
     index = Analog_Input_Instance_To_Index(object_instance);
-    if (index < MAX_ANALOG_INPUTS) {
-        AI_Descr[index].Changed = false;
+    if (index < Object_Store_Count(AI_Store)) {
+        Analog_Input_Descr(index)->Changed = false;
     }
 }
 
@@ -332,8 +421,8 @@ float Analog_Input_COV_Increment(
     float value = 0;
 
     index = Analog_Input_Instance_To_Index(object_instance);
-    if (index < MAX_ANALOG_INPUTS) {
-        value = AI_Descr[index].COV_Increment;
+    if (index < Object_Store_Count(AI_Store)) {
+        value = Analog_Input_Descr(index)->COV_Increment;
     }
 
     return value;
@@ -346,9 +435,10 @@ void Analog_Input_COV_Increment_Set(
     unsigned index = 0;
 
     index = Analog_Input_Instance_To_Index(object_instance);
-    if (index < MAX_ANALOG_INPUTS) {
-        AI_Descr[index].COV_Increment = value;
-        Analog_Input_COV_Detect(index, AI_Descr[index].Present_Value);
+    if (index < Object_Store_Count(AI_Store)) {
+        Analog_Input_Descr(index)->COV_Increment = value;
+        Analog_Input_COV_Detect(index,
+            Analog_Input_Descr(index)->Present_Value);
     }
 }
 
@@ -359,8 +449,8 @@ bool Analog_Input_Out_Of_Service(
     bool value = false;
 
     index = Analog_Input_Instance_To_Index(object_instance);
-    if (index < MAX_ANALOG_INPUTS) {
-        value = AI_Descr[index].Out_Of_Service;
+    if (index < Object_Store_Count(AI_Store)) {
+        value = Analog_Input_Descr(index)->Out_Of_Service;
     }
 
     return value;
@@ -373,8 +463,8 @@ void Analog_Input_Out_Of_Service_Set(
     unsigned index = 0;
 
     index = Analog_Input_Instance_To_Index(object_instance);
-    if (index < MAX_ANALOG_INPUTS) {
-        AI_Descr[index].Out_Of_Service = value;
+    if (index < Object_Store_Count(AI_Store)) {
+        Analog_Input_Descr(index)->Out_Of_Service = value;
     }
 }
 
@@ -385,7 +475,7 @@ int Analog_Input_Read_Property(
 {
     int apdu_len = 0;   /* return value */
     BACNET_BIT_STRING bit_string;
-    BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     ANALOG_INPUT_DESCR *CurrentAI;
     unsigned object_index = 0;
 #if defined(INTRINSIC_REPORTING)
@@ -400,8 +490,8 @@ int Analog_Input_Read_Property(
     }
 
     object_index = Analog_Input_Instance_To_Index(rpdata->object_instance);
-    if (object_index < MAX_ANALOG_INPUTS)
-        CurrentAI = &AI_Descr[object_index];
+    if (object_index < Object_Store_Count(AI_Store))
+        CurrentAI = Analog_Input_Descr(object_index);
     else
         return BACNET_STATUS_ERROR;
 
@@ -415,9 +505,10 @@ int Analog_Input_Read_Property(
 
         case PROP_OBJECT_NAME:
         case PROP_DESCRIPTION:
-            Analog_Input_Object_Name(rpdata->object_instance, &char_string);
+            Analog_Input_Object_Name_View(rpdata->object_instance, &name_view);
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
 
         case PROP_OBJECT_TYPE:
@@ -661,8 +752,8 @@ bool Analog_Input_Write_Property(
         return false;
     }
     object_index = Analog_Input_Instance_To_Index(wp_data->object_instance);
-    if (object_index < MAX_ANALOG_INPUTS) {
-        CurrentAI = &AI_Descr[object_index];
+    if (object_index < Object_Store_Count(AI_Store)) {
+        CurrentAI = Analog_Input_Descr(object_index);
     } else {
         return false;
     }
@@ -871,8 +962,8 @@ void Analog_Input_Intrinsic_Reporting(
 
 
     object_index = Analog_Input_Instance_To_Index(object_instance);
-    if (object_index < MAX_ANALOG_INPUTS)
-        CurrentAI = &AI_Descr[object_index];
+    if (object_index < Object_Store_Count(AI_Store))
+        CurrentAI = Analog_Input_Descr(object_index);
     else
         return;
 
@@ -1161,21 +1252,23 @@ int Analog_Input_Event_Information(
     bool IsNotAckedTransitions;
     bool IsActiveEvent;
     int i;
+    ANALOG_INPUT_DESCR *CurrentAI;
 
 
     /* check index */
-    if (index < MAX_ANALOG_INPUTS) {
+    if (index < Object_Store_Count(AI_Store)) {
+        CurrentAI = Analog_Input_Descr(index);
         /* Event_State not equal to NORMAL */
-        IsActiveEvent = (AI_Descr[index].Event_State != EVENT_STATE_NORMAL);
+        IsActiveEvent = (CurrentAI->Event_State != EVENT_STATE_NORMAL);
 
         /* Acked_Transitions property, which has at least one of the bits
            (TO-OFFNORMAL, TO-FAULT, TONORMAL) set to FALSE. */
         IsNotAckedTransitions =
-            (AI_Descr[index].Acked_Transitions[TRANSITION_TO_OFFNORMAL].
+            (CurrentAI->Acked_Transitions[TRANSITION_TO_OFFNORMAL].
             bIsAcked ==
-            false) | (AI_Descr[index].Acked_Transitions[TRANSITION_TO_FAULT].
+            false) | (CurrentAI->Acked_Transitions[TRANSITION_TO_FAULT].
             bIsAcked ==
-            false) | (AI_Descr[index].Acked_Transitions[TRANSITION_TO_NORMAL].
+            false) | (CurrentAI->Acked_Transitions[TRANSITION_TO_NORMAL].
             bIsAcked == false);
     } else
         return -1;      /* end of list  */
@@ -1186,40 +1279,40 @@ int Analog_Input_Event_Information(
         getevent_data->objectIdentifier.instance =
             Analog_Input_Index_To_Instance(index);
         /* Event State */
-        getevent_data->eventState = AI_Descr[index].Event_State;
+        getevent_data->eventState = CurrentAI->Event_State;
         /* Acknowledged Transitions */
         bitstring_init(&getevent_data->acknowledgedTransitions);
         bitstring_set_bit(&getevent_data->acknowledgedTransitions,
             TRANSITION_TO_OFFNORMAL,
-            AI_Descr[index].Acked_Transitions[TRANSITION_TO_OFFNORMAL].
+            CurrentAI->Acked_Transitions[TRANSITION_TO_OFFNORMAL].
             bIsAcked);
         bitstring_set_bit(&getevent_data->acknowledgedTransitions,
             TRANSITION_TO_FAULT,
-            AI_Descr[index].Acked_Transitions[TRANSITION_TO_FAULT].bIsAcked);
+            CurrentAI->Acked_Transitions[TRANSITION_TO_FAULT].bIsAcked);
         bitstring_set_bit(&getevent_data->acknowledgedTransitions,
             TRANSITION_TO_NORMAL,
-            AI_Descr[index].Acked_Transitions[TRANSITION_TO_NORMAL].bIsAcked);
+            CurrentAI->Acked_Transitions[TRANSITION_TO_NORMAL].bIsAcked);
         /* Event Time Stamps */
         for (i = 0; i < 3; i++) {
             getevent_data->eventTimeStamps[i].tag = TIME_STAMP_DATETIME;
             getevent_data->eventTimeStamps[i].value.dateTime =
-                AI_Descr[index].Event_Time_Stamps[i];
+                CurrentAI->Event_Time_Stamps[i];
         }
         /* Notify Type */
-        getevent_data->notifyType = AI_Descr[index].Notify_Type;
+        getevent_data->notifyType = CurrentAI->Notify_Type;
         /* Event Enable */
         bitstring_init(&getevent_data->eventEnable);
         bitstring_set_bit(&getevent_data->eventEnable, TRANSITION_TO_OFFNORMAL,
-            (AI_Descr[index].
+            (CurrentAI->
                 Event_Enable & EVENT_ENABLE_TO_OFFNORMAL) ? true : false);
         bitstring_set_bit(&getevent_data->eventEnable, TRANSITION_TO_FAULT,
-            (AI_Descr[index].
+            (CurrentAI->
                 Event_Enable & EVENT_ENABLE_TO_FAULT) ? true : false);
         bitstring_set_bit(&getevent_data->eventEnable, TRANSITION_TO_NORMAL,
-            (AI_Descr[index].
+            (CurrentAI->
                 Event_Enable & EVENT_ENABLE_TO_NORMAL) ? true : false);
         /* Event Priorities */
-        Notification_Class_Get_Priorities(AI_Descr[index].Notification_Class,
+        Notification_Class_Get_Priorities(CurrentAI->Notification_Class,
             getevent_data->eventPriorities);
 
         return 1;       /* active event */
@@ -1240,8 +1333,8 @@ int Analog_Input_Alarm_Ack(
         Analog_Input_Instance_To_Index(alarmack_data->eventObjectIdentifier.
         instance);
 
-    if (object_index < MAX_ANALOG_INPUTS)
-        CurrentAI = &AI_Descr[object_index];
+    if (object_index < Object_Store_Count(AI_Store))
+        CurrentAI = Analog_Input_Descr(object_index);
     else {
         *error_code = ERROR_CODE_UNKNOWN_OBJECT;
         return -1;
@@ -1332,32 +1425,34 @@ int Analog_Input_Alarm_Summary(
     unsigned index,
     BACNET_GET_ALARM_SUMMARY_DATA * getalarm_data)
 {
+    ANALOG_INPUT_DESCR *CurrentAI;
 
     /* check index */
-    if (index < MAX_ANALOG_INPUTS) {
+    if (index < Object_Store_Count(AI_Store)) {
+        CurrentAI = Analog_Input_Descr(index);
         /* Event_State is not equal to NORMAL  and
            Notify_Type property value is ALARM */
-        if ((AI_Descr[index].Event_State != EVENT_STATE_NORMAL) &&
-            (AI_Descr[index].Notify_Type == NOTIFY_ALARM)) {
+        if ((CurrentAI->Event_State != EVENT_STATE_NORMAL) &&
+            (CurrentAI->Notify_Type == NOTIFY_ALARM)) {
             /* Object Identifier */
             getalarm_data->objectIdentifier.type = OBJECT_ANALOG_INPUT;
             getalarm_data->objectIdentifier.instance =
                 Analog_Input_Index_To_Instance(index);
             /* Alarm State */
-            getalarm_data->alarmState = AI_Descr[index].Event_State;
+            getalarm_data->alarmState = CurrentAI->Event_State;
             /* Acknowledged Transitions */
             bitstring_init(&getalarm_data->acknowledgedTransitions);
             bitstring_set_bit(&getalarm_data->acknowledgedTransitions,
                 TRANSITION_TO_OFFNORMAL,
-                AI_Descr[index].Acked_Transitions[TRANSITION_TO_OFFNORMAL].
+                CurrentAI->Acked_Transitions[TRANSITION_TO_OFFNORMAL].
                 bIsAcked);
             bitstring_set_bit(&getalarm_data->acknowledgedTransitions,
                 TRANSITION_TO_FAULT,
-                AI_Descr[index].
+                CurrentAI->
                 Acked_Transitions[TRANSITION_TO_FAULT].bIsAcked);
             bitstring_set_bit(&getalarm_data->acknowledgedTransitions,
                 TRANSITION_TO_NORMAL,
-                AI_Descr[index].
+                CurrentAI->
                 Acked_Transitions[TRANSITION_TO_NORMAL].bIsAcked);
 
             return 1;   /* active alarm */
@@ -1396,6 +1491,27 @@ bool WPValidateArgType(
     return (bResult);
 }
 
+void Device_Object_Created(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+}
+
+void Device_Object_Deleted(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+}
+
+static unsigned COV_Changed_Count;
+
+void Device_COV_Changed(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    COV_Changed_Count++;
+}
+
 void testAnalogInput(
     Test * pTest)
 {
@@ -1406,6 +1522,8 @@ void testAnalogInput(
     uint32_t decoded_instance = 0;
     uint16_t decoded_type = 0;
     BACNET_READ_PROPERTY_DATA rpdata;
+    BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW view;
 
     Analog_Input_Init();
     rpdata.application_data = &apdu[0];
@@ -1421,6 +1539,51 @@ void testAnalogInput(
     len = decode_object_id(&apdu[len], &decoded_type, &decoded_instance);
     ct_test(pTest, decoded_type == rpdata.object_type);
     ct_test(pTest, decoded_instance == rpdata.object_instance);
+    /* the name is read where the object keeps it */
+    rpdata.object_property = PROP_OBJECT_NAME;
+    len = Analog_Input_Read_Property(&rpdata);
+    ct_test(pTest, len > 0);
+    len = decode_tag_number_and_value(&apdu[0], &tag_number, &len_value);
+    ct_test(pTest, tag_number == BACNET_APPLICATION_TAG_CHARACTER_STRING);
+    decode_character_string(&apdu[len], len_value, &char_string);
+    ct_test(pTest, characterstring_ansi_same(&char_string, "ANALOG INPUT 1"));
+    ct_test(pTest, Analog_Input_Name_Set(1, "Outside Air"));
+    ct_test(pTest, Analog_Input_Object_Name_View(1, &view));
+    characterstring_init_ansi(&char_string, "Outside Air");
+    ct_test(pTest, characterstring_view_same(&view, &char_string));
+    ct_test(pTest, Analog_Input_Name_Set(2, NULL) == false);
+    ct_test(pTest, !Analog_Input_Object_Name_View(100000, &view));
+    ct_test(pTest, view.length == 0);
+    rpdata.object_property = PROP_OBJECT_IDENTIFIER;
+
+    /* objects created at run time */
+    ct_test(pTest, Analog_Input_Count() == MAX_ANALOG_INPUTS);
+    ct_test(pTest, Analog_Input_Create(1) == false);
+    ct_test(pTest, Analog_Input_Create(100000));
+    ct_test(pTest, Analog_Input_Count() == (MAX_ANALOG_INPUTS + 1));
+    Analog_Input_Present_Value_Set(100000, 42.0f);
+    ct_test(pTest, Analog_Input_Present_Value(100000) == 42.0f);
+    /* the device hears of a change once, until the flag is cleared */
+    ct_test(pTest, COV_Changed_Count == 1);
+    Analog_Input_Present_Value_Set(100000, 50.0f);
+    ct_test(pTest, COV_Changed_Count == 1);
+    Analog_Input_Change_Of_Value_Clear(100000);
+    Analog_Input_Present_Value_Set(100000, 50.5f);
+    ct_test(pTest, COV_Changed_Count == 1);
+    Analog_Input_Present_Value_Set(100000, 42.0f);
+    ct_test(pTest, COV_Changed_Count == 2);
+    ct_test(pTest, Analog_Input_Valid_Instance(100000));
+    ct_test(pTest, Analog_Input_Delete(0));
+    ct_test(pTest, !Analog_Input_Valid_Instance(0));
+    ct_test(pTest, Analog_Input_Present_Value(100000) == 42.0f);
+    ct_test(pTest,
+        Analog_Input_Index_To_Instance(Analog_Input_Instance_To_Index
+            (100000)) == 100000);
+    ct_test(pTest, Analog_Input_Instance_To_Index(0) == Analog_Input_Count());
+    rpdata.object_instance = 0;
+    ct_test(pTest, Analog_Input_Read_Property(&rpdata) == BACNET_STATUS_ERROR);
+    Analog_Input_Cleanup();
+    ct_test(pTest, Analog_Input_Count() == 0);
 
     return;
 }
@@ -29,6 +29,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "bacdef.h"
+#include "objstore.h"
 #include "rp.h"
 #include "wp.h"
 #if defined(INTRINSIC_REPORTING)
@@ -51,6 +52,7 @@ extern "C" {
         float Prior_Value;
         float COV_Increment;
         bool Changed;
+        char Object_Name[64];
 #if defined(INTRINSIC_REPORTING)
         uint32_t Time_Delay;
         uint32_t Notification_Class;
@@ -88,6 +90,9 @@ extern "C" {
     bool Analog_Input_Object_Name(
         uint32_t object_instance,
         BACNET_CHARACTER_STRING * object_name);
+    bool Analog_Input_Object_Name_View(
+        uint32_t object_instance,
+        BACNET_STRING_VIEW * view);
     bool Analog_Input_Name_Set(
         uint32_t object_instance,
         char *new_name);
@@ -161,6 +166,8 @@ extern "C" {
         void);
     void Analog_Input_Init(
         void);
+    void Analog_Input_Store_Select(
+        OBJECT_STORE * store);
 
 #ifdef TEST
 #include "ctest.h"
@@ -48,6 +48,10 @@
 /* When all the priorities are level null, the present value returns */
 /* the Relinquish Default value */
 #define AO_RELINQUISH_DEFAULT 0
+
+/* the names, set once by the Init */
+static char Analog_Output_Names[MAX_ANALOG_OUTPUTS][64];
+
 /* Here is our Priority Array.  They are supposed to be Real, but */
 /* we don't have that kind of memory, so we will use a single byte */
 /* and load a Real for returning the value when asked. */
@@ -107,6 +111,7 @@ void Analog_Output_Init(
 
         /* initialize all the analog output priority arrays to NULL */
         for (i = 0; i < MAX_ANALOG_OUTPUTS; i++) {
+            sprintf(Analog_Output_Names[i], "ANALOG OUTPUT %u", i);
             for (j = 0; j < BACNET_MAX_PRIORITY; j++) {
                 Analog_Output_Level[i][j] = AO_LEVEL_NULL;
             }
@@ -256,18 +261,32 @@ bool Analog_Output_Object_Name(
     uint32_t object_instance,
     BACNET_CHARACTER_STRING * object_name)
 {
-    static char text_string[32] = "";   /* okay for single thread */
     bool status = false;
 
     if (object_instance < MAX_ANALOG_OUTPUTS) {
-        sprintf(text_string, "ANALOG OUTPUT %lu",
-            (unsigned long) object_instance);
-        status = characterstring_init_ansi(object_name, text_string);
+        status =
+            characterstring_init_ansi(object_name,
+            Analog_Output_Names[object_instance]);
     }
 
     return status;
 }
 
+/* the name left in place, see BACNET_STRING_VIEW; false if not found */
+bool Analog_Output_Object_Name_View(
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view)
+{
+    const char *name = NULL;
+
+    if (object_instance < MAX_ANALOG_OUTPUTS) {
+        name = Analog_Output_Names[object_instance];
+    }
+    stringview_init_ansi(view, name);
+
+    return (name != NULL);
+}
+
 /* return apdu len, or BACNET_STATUS_ERROR on error */
 int Analog_Output_Read_Property(
     BACNET_READ_PROPERTY_DATA * rpdata)
@@ -275,7 +294,7 @@ int Analog_Output_Read_Property(
     int len = 0;
     int apdu_len = 0;   /* return value */
     BACNET_BIT_STRING bit_string;
-    BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     float real_value = (float) 1.414;
     unsigned object_index = 0;
     unsigned i = 0;
@@ -295,9 +314,10 @@ int Analog_Output_Read_Property(
             break;
         case PROP_OBJECT_NAME:
         case PROP_DESCRIPTION:
-            Analog_Output_Object_Name(rpdata->object_instance, &char_string);
+            Analog_Output_Object_Name_View(rpdata->object_instance, &name_view);
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
         case PROP_OBJECT_TYPE:
             apdu_len =
@@ -66,6 +66,9 @@ extern "C" {
     bool Analog_Output_Object_Name(
         uint32_t object_instance,
         BACNET_CHARACTER_STRING * object_name);
+    bool Analog_Output_Object_Name_View(
+        uint32_t object_instance,
+        BACNET_STRING_VIEW * view);
     bool Analog_Output_Name_Set(
         uint32_t object_instance,
         char *new_name);
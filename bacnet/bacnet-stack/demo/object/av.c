@@ -39,14 +39,18 @@
 #include "config.h"     /* the custom stuff */
 #include "device.h"
 #include "handlers.h"
+#include "objstore.h"
 #include "av.h"
 
 
+/* number of objects created by Analog_Value_Init() */
 #ifndef MAX_ANALOG_VALUES
 #define MAX_ANALOG_VALUES 4
 #endif
 
-ANALOG_VALUE_DESCR AV_Descr[MAX_ANALOG_VALUES];
+static OBJECT_STORE AV_Default_Store;
+/* the objects being addressed, see Analog_Value_Store_Select() */
+static OBJECT_STORE *AV_Store = &AV_Default_Store;
 
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int Analog_Value_Properties_Required[] = {
@@ -97,82 +101,134 @@ void Analog_Value_Property_Lists(
     return;
 }
 
-void Analog_Value_Init(
-    void)
+static ANALOG_VALUE_DESCR *Analog_Value_Descr(
+    unsigned index)
+{
+    return (ANALOG_VALUE_DESCR *) Object_Store_Element(AV_Store, index);
+}
+
+/* add an object with the default property values */
+static bool Analog_Value_Add(
+    uint32_t object_instance)
 {
-	unsigned i;
+    ANALOG_VALUE_DESCR *pObject;
 #if defined(INTRINSIC_REPORTING)
-	unsigned j;
+    unsigned j;
 #endif
 
-    for (i = 0; i < MAX_ANALOG_VALUES; i++) {
-        memset(&AV_Descr[i], 0x00, sizeof(ANALOG_VALUE_DESCR));
-        AV_Descr[i].Present_Value = 0.0;
-        AV_Descr[i].Units = UNITS_NO_UNITS;
+    pObject = Object_Store_Add(AV_Store, object_instance);
+    if (!pObject) {
+        return false;
+    }
+    sprintf(pObject->Object_Name, "ANALOG VALUE %lu",
+        (unsigned long) object_instance);
+    pObject->Present_Value = 0.0;
+    pObject->Units = UNITS_NO_UNITS;
 #if defined(INTRINSIC_REPORTING)
-        AV_Descr[i].Event_State = EVENT_STATE_NORMAL;
-        /* notification class not connected */
-        AV_Descr[i].Notification_Class = BACNET_MAX_INSTANCE;
-        /* initialize Event time stamps using wildcards
-           and set Acked_transitions */
-        for (j = 0; j < MAX_BACNET_EVENT_TRANSITION; j++) {
-            datetime_wildcard_set(&AV_Descr[i].Event_Time_Stamps[j]);
-            AV_Descr[i].Acked_Transitions[j].bIsAcked = true;
-        }
+    pObject->Event_State = EVENT_STATE_NORMAL;
+    /* notification class not connected */
+    pObject->Notification_Class = BACNET_MAX_INSTANCE;
+    /* initialize Event time stamps using wildcards
+       and set Acked_transitions */
+    for (j = 0; j < MAX_BACNET_EVENT_TRANSITION; j++) {
+        datetime_wildcard_set(&pObject->Event_Time_Stamps[j]);
+        pObject->Acked_Transitions[j].bIsAcked = true;
+    }
+#endif
+
+    return true;
+}
+
+/* create an object at run time, e.g. from a configuration file */
+bool Analog_Value_Create(
+    uint32_t object_instance)
+{
+    if ((object_instance >= BACNET_MAX_INSTANCE) ||
+        !Analog_Value_Add(object_instance)) {
+        return false;
+    }
+    Device_Object_Created(OBJECT_ANALOG_VALUE, object_instance);
+
+    return true;
+}
+
+bool Analog_Value_Delete(
+    uint32_t object_instance)
+{
+    if (!Object_Store_Remove(AV_Store, object_instance)) {
+        return false;
+    }
+    Device_Object_Deleted(OBJECT_ANALOG_VALUE, object_instance);
+
+    return true;
+}
+
+void Analog_Value_Cleanup(
+    void)
+{
+    Object_Store_Cleanup(AV_Store);
+}
+
+void Analog_Value_Init(
+    void)
+{
+    unsigned i;
 
-        /* Set handler for GetEventInformation function */
-        handler_get_event_information_set(OBJECT_ANALOG_VALUE,
-            Analog_Value_Event_Information);
-        /* Set handler for AcknowledgeAlarm function */
-        handler_alarm_ack_set(OBJECT_ANALOG_VALUE, Analog_Value_Alarm_Ack);
-        /* Set handler for GetAlarmSummary Service */
-        handler_get_alarm_summary_set(OBJECT_ANALOG_VALUE,
-            Analog_Value_Alarm_Summary);
+    Object_Store_Cleanup(AV_Store);
+    Object_Store_Init(AV_Store, sizeof(ANALOG_VALUE_DESCR));
+    for (i = 0; i < MAX_ANALOG_VALUES; i++) {
+        Analog_Value_Add(i);
+    }
+#if defined(INTRINSIC_REPORTING)
+    /* Set handler for GetEventInformation function */
+    handler_get_event_information_set(OBJECT_ANALOG_VALUE,
+        Analog_Value_Event_Information);
+    /* Set handler for AcknowledgeAlarm function */
+    handler_alarm_ack_set(OBJECT_ANALOG_VALUE, Analog_Value_Alarm_Ack);
+    /* Set handler for GetAlarmSummary Service */
+    handler_get_alarm_summary_set(OBJECT_ANALOG_VALUE,
+        Analog_Value_Alarm_Summary);
 #endif
+}
+
+/* Address the objects in another store, eg. those of one of the Devices
+   behind a gateway, or NULL for the objects of Analog_Value_Init().
+   A zeroed store is ready for use. */
+void Analog_Value_Store_Select(
+    OBJECT_STORE * store)
+{
+    if (store == NULL) {
+        store = &AV_Default_Store;
+    } else if (store->element_size == 0) {
+        Object_Store_Init(store, sizeof(ANALOG_VALUE_DESCR));
     }
+    AV_Store = store;
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need validate that the */
-/* given instance exists */
 bool Analog_Value_Valid_Instance(
     uint32_t object_instance)
 {
-    if (object_instance < MAX_ANALOG_VALUES)
-        return true;
-
-    return false;
+    return (Object_Store_Find(AV_Store, object_instance) != NULL);
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then count how many you have */
 unsigned Analog_Value_Count(
     void)
 {
-    return MAX_ANALOG_VALUES;
+    return Object_Store_Count(AV_Store);
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the instance */
-/* that correlates to the correct index */
+/* the index is only good until the next object is deleted */
 uint32_t Analog_Value_Index_To_Instance(
     unsigned index)
 {
-    return index;
+    return Object_Store_Instance(AV_Store, index);
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the index */
-/* that correlates to the correct instance number */
+/* returns Analog_Value_Count() if there is no such instance */
 unsigned Analog_Value_Instance_To_Index(
     uint32_t object_instance)
 {
-    unsigned index = MAX_ANALOG_VALUES;
-
-    if (object_instance < MAX_ANALOG_VALUES)
-        index = object_instance;
-
-    return index;
+    return Object_Store_Index(AV_Store, object_instance);
 }
 
 /**
@@ -194,8 +250,8 @@ bool Analog_Value_Present_Value_Set(
     bool status = false;
 
     index = Analog_Value_Instance_To_Index(object_instance);
-    if (index < MAX_ANALOG_VALUES) {
-        AV_Descr[index].Present_Value = value;
+    if (index < Object_Store_Count(AV_Store)) {
+        Analog_Value_Descr(index)->Present_Value = value;
         status = true;
     }
     return status;
@@ -208,8 +264,8 @@ float Analog_Value_Present_Value(
     unsigned index = 0;
 
     index = Analog_Value_Instance_To_Index(object_instance);
-    if (index < MAX_ANALOG_VALUES) {
-        value = AV_Descr[index].Present_Value;
+    if (index < Object_Store_Count(AV_Store)) {
+        value = Analog_Value_Descr(index)->Present_Value;
     }
 
     return value;
@@ -220,25 +276,56 @@ bool Analog_Value_Object_Name(
     uint32_t object_instance,
     BACNET_CHARACTER_STRING * object_name)
 {
-    static char text_string[32] = "";   /* okay for single thread */
+    ANALOG_VALUE_DESCR *pObject;
     bool status = false;
 
-    if (object_instance < MAX_ANALOG_VALUES) {
-        sprintf(text_string, "ANALOG VALUE %lu",
-            (unsigned long) object_instance);
-        status = characterstring_init_ansi(object_name, text_string);
+    pObject = Object_Store_Find(AV_Store, object_instance);
+    if (pObject) {
+        status = characterstring_init_ansi(object_name, pObject->Object_Name);
     }
 
     return status;
 }
 
+/* the name left in place, see BACNET_STRING_VIEW; false if not found */
+bool Analog_Value_Object_Name_View(
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view)
+{
+    ANALOG_VALUE_DESCR *pObject;
+
+    pObject = Object_Store_Find(AV_Store, object_instance);
+    stringview_init_ansi(view, pObject ? pObject->Object_Name : NULL);
+
+    return (pObject != NULL);
+}
+
+/* note: the object name must be unique within this device */
+bool Analog_Value_Name_Set(
+    uint32_t object_instance,
+    char *new_name)
+{
+    ANALOG_VALUE_DESCR *pObject;
+
+    pObject = Object_Store_Find(AV_Store, object_instance);
+    if (!pObject || !new_name ||
+        (strlen(new_name) >= sizeof(pObject->Object_Name))) {
+        return false;
+    }
+    strcpy(pObject->Object_Name, new_name);
+    /* a new name for the index, and a new Database_Revision */
+    Device_Object_Created(OBJECT_ANALOG_VALUE, object_instance);
+
+    return true;
+}
+
 /* return apdu len, or BACNET_STATUS_ERROR on error */
 int Analog_Value_Read_Property(
     BACNET_READ_PROPERTY_DATA * rpdata)
 {
     int apdu_len = 0;   /* return value */
     BACNET_BIT_STRING bit_string;
-    BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     float real_value = (float) 1.414;
     unsigned object_index = 0;
     bool state = false;
@@ -257,8 +344,8 @@ int Analog_Value_Read_Property(
     apdu = rpdata->application_data;
 
     object_index = Analog_Value_Instance_To_Index(rpdata->object_instance);
-    if (object_index < MAX_ANALOG_VALUES)
-        CurrentAV = &AV_Descr[object_index];
+    if (object_index < Object_Store_Count(AV_Store))
+        CurrentAV = Analog_Value_Descr(object_index);
     else
         return BACNET_STATUS_ERROR;
 
@@ -271,9 +358,10 @@ int Analog_Value_Read_Property(
 
         case PROP_OBJECT_NAME:
         case PROP_DESCRIPTION:
-            Analog_Value_Object_Name(rpdata->object_instance, &char_string);
+            Analog_Value_Object_Name_View(rpdata->object_instance, &name_view);
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
 
         case PROP_OBJECT_TYPE:
@@ -494,8 +582,8 @@ bool Analog_Value_Write_Property(
         return false;
     }
     object_index = Analog_Value_Instance_To_Index(wp_data->object_instance);
-    if (object_index < MAX_ANALOG_VALUES)
-        CurrentAV = &AV_Descr[object_index];
+    if (object_index < Object_Store_Count(AV_Store))
+        CurrentAV = Analog_Value_Descr(object_index);
     else
         return false;
 
@@ -690,8 +778,8 @@ void Analog_Value_Intrinsic_Reporting(
 
 
     object_index = Analog_Value_Instance_To_Index(object_instance);
-    if (object_index < MAX_ANALOG_VALUES)
-        CurrentAV = &AV_Descr[object_index];
+    if (object_index < Object_Store_Count(AV_Store))
+        CurrentAV = Analog_Value_Descr(object_index);
     else
         return;
 
@@ -977,24 +1065,26 @@ int Analog_Value_Event_Information(
     unsigned index,
     BACNET_GET_EVENT_INFORMATION_DATA * getevent_data)
 {
+    ANALOG_VALUE_DESCR *CurrentAV;
     bool IsNotAckedTransitions;
     bool IsActiveEvent;
     int i;
 
 
     /* check index */
-    if (index < MAX_ANALOG_VALUES) {
+    if (index < Object_Store_Count(AV_Store)) {
+        CurrentAV = Analog_Value_Descr(index);
         /* Event_State not equal to NORMAL */
-        IsActiveEvent = (AV_Descr[index].Event_State != EVENT_STATE_NORMAL);
+        IsActiveEvent = (CurrentAV->Event_State != EVENT_STATE_NORMAL);
 
         /* Acked_Transitions property, which has at least one of the bits
            (TO-OFFNORMAL, TO-FAULT, TONORMAL) set to FALSE. */
         IsNotAckedTransitions =
-            (AV_Descr[index].Acked_Transitions[TRANSITION_TO_OFFNORMAL].
+            (CurrentAV->Acked_Transitions[TRANSITION_TO_OFFNORMAL].
             bIsAcked ==
-            false) | (AV_Descr[index].Acked_Transitions[TRANSITION_TO_FAULT].
+            false) | (CurrentAV->Acked_Transitions[TRANSITION_TO_FAULT].
             bIsAcked ==
-            false) | (AV_Descr[index].Acked_Transitions[TRANSITION_TO_NORMAL].
+            false) | (CurrentAV->Acked_Transitions[TRANSITION_TO_NORMAL].
             bIsAcked == false);
     } else
         return -1;      /* end of list  */
@@ -1005,40 +1095,40 @@ int Analog_Value_Event_Information(
         getevent_data->objectIdentifier.instance =
             Analog_Value_Index_To_Instance(index);
         /* Event State */
-        getevent_data->eventState = AV_Descr[index].Event_State;
+        getevent_data->eventState = CurrentAV->Event_State;
         /* Acknowledged Transitions */
         bitstring_init(&getevent_data->acknowledgedTransitions);
         bitstring_set_bit(&getevent_data->acknowledgedTransitions,
             TRANSITION_TO_OFFNORMAL,
-            AV_Descr[index].Acked_Transitions[TRANSITION_TO_OFFNORMAL].
+            CurrentAV->Acked_Transitions[TRANSITION_TO_OFFNORMAL].
             bIsAcked);
         bitstring_set_bit(&getevent_data->acknowledgedTransitions,
             TRANSITION_TO_FAULT,
-            AV_Descr[index].Acked_Transitions[TRANSITION_TO_FAULT].bIsAcked);
+            CurrentAV->Acked_Transitions[TRANSITION_TO_FAULT].bIsAcked);
         bitstring_set_bit(&getevent_data->acknowledgedTransitions,
             TRANSITION_TO_NORMAL,
-            AV_Descr[index].Acked_Transitions[TRANSITION_TO_NORMAL].bIsAcked);
+            CurrentAV->Acked_Transitions[TRANSITION_TO_NORMAL].bIsAcked);
         /* Event Time Stamps */
         for (i = 0; i < 3; i++) {
             getevent_data->eventTimeStamps[i].tag = TIME_STAMP_DATETIME;
             getevent_data->eventTimeStamps[i].value.dateTime =
-                AV_Descr[index].Event_Time_Stamps[i];
+                CurrentAV->Event_Time_Stamps[i];
         }
         /* Notify Type */
-        getevent_data->notifyType = AV_Descr[index].Notify_Type;
+        getevent_data->notifyType = CurrentAV->Notify_Type;
         /* Event Enable */
         bitstring_init(&getevent_data->eventEnable);
         bitstring_set_bit(&getevent_data->eventEnable, TRANSITION_TO_OFFNORMAL,
-            (AV_Descr[index].
+            (CurrentAV->
                 Event_Enable & EVENT_ENABLE_TO_OFFNORMAL) ? true : false);
         bitstring_set_bit(&getevent_data->eventEnable, TRANSITION_TO_FAULT,
-            (AV_Descr[index].
+            (CurrentAV->
                 Event_Enable & EVENT_ENABLE_TO_FAULT) ? true : false);
         bitstring_set_bit(&getevent_data->eventEnable, TRANSITION_TO_NORMAL,
-            (AV_Descr[index].
+            (CurrentAV->
                 Event_Enable & EVENT_ENABLE_TO_NORMAL) ? true : false);
         /* Event Priorities */
-        Notification_Class_Get_Priorities(AV_Descr[index].Notification_Class,
+        Notification_Class_Get_Priorities(CurrentAV->Notification_Class,
             getevent_data->eventPriorities);
 
         return 1;       /* active event */
@@ -1058,8 +1148,8 @@ int Analog_Value_Alarm_Ack(
         Analog_Value_Instance_To_Index(alarmack_data->eventObjectIdentifier.
         instance);
 
-    if (object_index < MAX_ANALOG_VALUES)
-        CurrentAV = &AV_Descr[object_index];
+    if (object_index < Object_Store_Count(AV_Store))
+        CurrentAV = Analog_Value_Descr(object_index);
     else {
         *error_code = ERROR_CODE_UNKNOWN_OBJECT;
         return -1;
@@ -1153,32 +1243,34 @@ int Analog_Value_Alarm_Summary(
     unsigned index,
     BACNET_GET_ALARM_SUMMARY_DATA * getalarm_data)
 {
+    ANALOG_VALUE_DESCR *CurrentAV;
 
     /* check index */
-    if (index < MAX_ANALOG_VALUES) {
+    if (index < Object_Store_Count(AV_Store)) {
+        CurrentAV = Analog_Value_Descr(index);
         /* Event_State is not equal to NORMAL  and
            Notify_Type property value is ALARM */
-        if ((AV_Descr[index].Event_State != EVENT_STATE_NORMAL) &&
-            (AV_Descr[index].Notify_Type == NOTIFY_ALARM)) {
+        if ((CurrentAV->Event_State != EVENT_STATE_NORMAL) &&
+            (CurrentAV->Notify_Type == NOTIFY_ALARM)) {
             /* Object Identifier */
             getalarm_data->objectIdentifier.type = OBJECT_ANALOG_VALUE;
             getalarm_data->objectIdentifier.instance =
                 Analog_Value_Index_To_Instance(index);
             /* Alarm State */
-            getalarm_data->alarmState = AV_Descr[index].Event_State;
+            getalarm_data->alarmState = CurrentAV->Event_State;
             /* Acknowledged Transitions */
             bitstring_init(&getalarm_data->acknowledgedTransitions);
             bitstring_set_bit(&getalarm_data->acknowledgedTransitions,
                 TRANSITION_TO_OFFNORMAL,
-                AV_Descr[index].Acked_Transitions[TRANSITION_TO_OFFNORMAL].
+                CurrentAV->Acked_Transitions[TRANSITION_TO_OFFNORMAL].
                 bIsAcked);
             bitstring_set_bit(&getalarm_data->acknowledgedTransitions,
                 TRANSITION_TO_FAULT,
-                AV_Descr[index].
+                CurrentAV->
                 Acked_Transitions[TRANSITION_TO_FAULT].bIsAcked);
             bitstring_set_bit(&getalarm_data->acknowledgedTransitions,
                 TRANSITION_TO_NORMAL,
-                AV_Descr[index].
+                CurrentAV->
                 Acked_Transitions[TRANSITION_TO_NORMAL].bIsAcked);
 
             return 1;   /* active alarm */
@@ -1209,6 +1301,18 @@ bool WPValidateArgType(
     return false;
 }
 
+void Device_Object_Created(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+}
+
+void Device_Object_Deleted(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+}
+
 void testAnalog_Value(
     Test * pTest)
 {
@@ -1235,6 +1339,18 @@ void testAnalog_Value(
     ct_test(pTest, decoded_type == rpdata.object_type);
     ct_test(pTest, decoded_instance == rpdata.object_instance);
 
+    /* objects created at run time */
+    ct_test(pTest, Analog_Value_Count() == MAX_ANALOG_VALUES);
+    ct_test(pTest, Analog_Value_Create(MAX_ANALOG_VALUES - 1) == false);
+    ct_test(pTest, Analog_Value_Create(4194302));
+    ct_test(pTest, Analog_Value_Present_Value_Set(4194302, 2.5f, 16));
+    ct_test(pTest, Analog_Value_Delete(1));
+    ct_test(pTest, !Analog_Value_Valid_Instance(1));
+    ct_test(pTest, Analog_Value_Present_Value(4194302) == 2.5f);
+    ct_test(pTest, Analog_Value_Count() == MAX_ANALOG_VALUES);
+    Analog_Value_Cleanup();
+    ct_test(pTest, Analog_Value_Count() == 0);
+
     return;
 }
 
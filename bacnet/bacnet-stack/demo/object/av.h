@@ -29,6 +29,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "bacdef.h"
+#include "objstore.h"
 #include "bacerror.h"
 #include "wp.h"
 #include "rp.h"
@@ -48,6 +49,7 @@ extern "C" {
         bool Out_Of_Service;
         uint16_t Units;
         float Present_Value;
+        char Object_Name[64];
 #if defined(INTRINSIC_REPORTING)
         uint32_t Time_Delay;
         uint32_t Notification_Class;
@@ -83,6 +85,12 @@ extern "C" {
     bool Analog_Value_Object_Name(
         uint32_t object_instance,
         BACNET_CHARACTER_STRING * object_name);
+    bool Analog_Value_Object_Name_View(
+        uint32_t object_instance,
+        BACNET_STRING_VIEW * view);
+    bool Analog_Value_Name_Set(
+        uint32_t object_instance,
+        char *new_name);
 
     int Analog_Value_Read_Property(
         BACNET_READ_PROPERTY_DATA * rpdata);
@@ -153,6 +161,8 @@ extern "C" {
         void);
     void Analog_Value_Init(
         void);
+    void Analog_Value_Store_Select(
+        OBJECT_STORE * store);
 
 #ifdef TEST
 #include "ctest.h"
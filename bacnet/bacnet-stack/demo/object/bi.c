@@ -28,6 +28,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "bacdef.h"
 #include "bacdcode.h"
 #include "bacenum.h"
@@ -36,21 +37,32 @@
 #include "wp.h"
 #include "cov.h"
 #include "config.h"     /* the custom stuff */
+#include "device.h"
+#include "objstore.h"
 #include "bi.h"
 #include "handlers.h"
 
+/* number of objects created by Binary_Input_Init() */
 #ifndef MAX_BINARY_INPUTS
 #define MAX_BINARY_INPUTS 5
 #endif
 
-/* stores the current value */
-static BACNET_BINARY_PV Present_Value[MAX_BINARY_INPUTS];
-/* out of service decouples physical input from Present_Value */
-static bool Out_Of_Service[MAX_BINARY_INPUTS];
-/* Change of Value flag */
-static bool Change_Of_Value[MAX_BINARY_INPUTS];
-/* Polarity of Input */
-static BACNET_POLARITY Polarity[MAX_BINARY_INPUTS];
+typedef struct binary_input_descr {
+    /* stores the current value */
+    BACNET_BINARY_PV Present_Value;
+    /* out of service decouples physical input from Present_Value */
+    bool Out_Of_Service;
+    /* Change of Value flag */
+    bool Change_Of_Value;
+    /* Polarity of Input */
+    BACNET_POLARITY Polarity;
+    /* set when the object is added, see Binary_Input_Name_Set() */
+    char Object_Name[64];
+} BINARY_INPUT_DESCR;
+
+static OBJECT_STORE BI_Default_Store;
+/* the objects being addressed, see Binary_Input_Store_Select() */
+static OBJECT_STORE *BI_Store = &BI_Default_Store;
 
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int Binary_Input_Properties_Required[] = {
@@ -92,67 +104,114 @@ void Binary_Input_Property_Lists(
     return;
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need validate that the */
-/* given instance exists */
-bool Binary_Input_Valid_Instance(
+static BINARY_INPUT_DESCR *Binary_Input_Descr(
+    unsigned index)
+{
+    return (BINARY_INPUT_DESCR *) Object_Store_Element(BI_Store, index);
+}
+
+/* add an object with the default property values */
+static bool Binary_Input_Add(
     uint32_t object_instance)
 {
-    if (object_instance < MAX_BINARY_INPUTS) {
-        return true;
+    BINARY_INPUT_DESCR *pObject;
+
+    pObject = Object_Store_Add(BI_Store, object_instance);
+    if (!pObject) {
+        return false;
     }
+    sprintf(pObject->Object_Name, "BINARY INPUT %lu",
+        (unsigned long) object_instance);
+    pObject->Present_Value = BINARY_INACTIVE;
+    pObject->Out_Of_Service = false;
+    pObject->Change_Of_Value = false;
+    pObject->Polarity = POLARITY_NORMAL;
+
+    return true;
+}
 
-    return false;
+/* create an object at run time, e.g. from a configuration file */
+bool Binary_Input_Create(
+    uint32_t object_instance)
+{
+    if ((object_instance >= BACNET_MAX_INSTANCE) ||
+        !Binary_Input_Add(object_instance)) {
+        return false;
+    }
+    Device_Object_Created(OBJECT_BINARY_INPUT, object_instance);
+
+    return true;
+}
+
+bool Binary_Input_Delete(
+    uint32_t object_instance)
+{
+    if (!Object_Store_Remove(BI_Store, object_instance)) {
+        return false;
+    }
+    Device_Object_Deleted(OBJECT_BINARY_INPUT, object_instance);
+
+    return true;
+}
+
+void Binary_Input_Cleanup(
+    void)
+{
+    Object_Store_Cleanup(BI_Store);
+}
+
+bool Binary_Input_Valid_Instance(
+    uint32_t object_instance)
+{
+    return (Object_Store_Find(BI_Store, object_instance) != NULL);
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then count how many you have */
 unsigned Binary_Input_Count(
     void)
 {
-    return MAX_BINARY_INPUTS;
+    return Object_Store_Count(BI_Store);
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the instance */
-/* that correlates to the correct index */
+/* the index is only good until the next object is deleted */
 uint32_t Binary_Input_Index_To_Instance(
     unsigned index)
 {
-    return index;
+    return Object_Store_Instance(BI_Store, index);
 }
 
 void Binary_Input_Init(
     void)
 {
-    static bool initialized = false;
     unsigned i;
 
-    if (!initialized) {
-        initialized = true;
-
-        /* initialize all the values */
-        for (i = 0; i < MAX_BINARY_INPUTS; i++) {
-            Present_Value[i] = BINARY_INACTIVE;
-        }
+    Object_Store_Cleanup(BI_Store);
+    Object_Store_Init(BI_Store, sizeof(BINARY_INPUT_DESCR));
+    for (i = 0; i < MAX_BINARY_INPUTS; i++) {
+        Binary_Input_Add(i);
     }
 
     return;
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the index */
-/* that correlates to the correct instance number */
-unsigned Binary_Input_Instance_To_Index(
-    uint32_t object_instance)
+/* Address the objects in another store, eg. those of one of the Devices
+   behind a gateway, or NULL for the objects of Binary_Input_Init().
+   A zeroed store is ready for use. */
+void Binary_Input_Store_Select(
+    OBJECT_STORE * store)
 {
-    unsigned index = MAX_BINARY_INPUTS;
-
-    if (object_instance < MAX_BINARY_INPUTS) {
-        index = object_instance;
+    if (store == NULL) {
+        store = &BI_Default_Store;
+    } else if (store->element_size == 0) {
+        Object_Store_Init(store, sizeof(BINARY_INPUT_DESCR));
     }
+    BI_Store = store;
+}
 
-    return index;
+/* returns Binary_Input_Count() if there is no such instance */
+unsigned Binary_Input_Instance_To_Index(
+    uint32_t object_instance)
+{
+    return Object_Store_Index(BI_Store, object_instance);
 }
 
 BACNET_BINARY_PV Binary_Input_Present_Value(
@@ -162,9 +221,9 @@ BACNET_BINARY_PV Binary_Input_Present_Value(
     unsigned index = 0;
 
     index = Binary_Input_Instance_To_Index(object_instance);
-    if (index < MAX_BINARY_INPUTS) {
-        value = Present_Value[index];
-        if (Polarity[index] != POLARITY_NORMAL) {
+    if (index < Object_Store_Count(BI_Store)) {
+        value = Binary_Input_Descr(index)->Present_Value;
+        if (Binary_Input_Descr(index)->Polarity != POLARITY_NORMAL) {
             if (value == BINARY_INACTIVE) {
                 value = BINARY_ACTIVE;
             } else {
@@ -183,8 +242,8 @@ bool Binary_Input_Out_Of_Service(
     unsigned index = 0;
 
     index = Binary_Input_Instance_To_Index(object_instance);
-    if (index < MAX_BINARY_INPUTS) {
-        value = Out_Of_Service[index];
+    if (index < Object_Store_Count(BI_Store)) {
+        value = Binary_Input_Descr(index)->Out_Of_Service;
     }
 
     return value;
@@ -197,8 +256,8 @@ bool Binary_Input_Change_Of_Value(
     unsigned index;
 
     index = Binary_Input_Instance_To_Index(object_instance);
-    if (index < MAX_BINARY_INPUTS) {
-        status = Change_Of_Value[index];
+    if (index < Object_Store_Count(BI_Store)) {
+        status = Binary_Input_Descr(index)->Change_Of_Value;
     }
 
     return status;
@@ -210,13 +269,23 @@ void Binary_Input_Change_Of_Value_Clear(
     unsigned index;
 
     index = Binary_Input_Instance_To_Index(object_instance);
-    if (index < MAX_BINARY_INPUTS) {
-        Change_Of_Value[index] = false;
+    if (index < Object_Store_Count(BI_Store)) {
+        Binary_Input_Descr(index)->Change_Of_Value = false;
     }
 
     return;
 }
 
+static void Binary_Input_Change_Of_Value_Set(
+    unsigned index)
+{
+    if (!Binary_Input_Descr(index)->Change_Of_Value) {
+        Binary_Input_Descr(index)->Change_Of_Value = true;
+        Device_COV_Changed(OBJECT_BINARY_INPUT,
+            Binary_Input_Index_To_Instance(index));
+    }
+}
+
 /* returns true if value has changed */
 bool Binary_Input_Encode_Value_List(
     uint32_t object_instance,
@@ -271,18 +340,18 @@ bool Binary_Input_Present_Value_Set(
     bool status = false;
 
     index = Binary_Input_Instance_To_Index(object_instance);
-    if (index < MAX_BINARY_INPUTS) {
-        if (Polarity[index] != POLARITY_NORMAL) {
+    if (index < Object_Store_Count(BI_Store)) {
+        if (Binary_Input_Descr(index)->Polarity != POLARITY_NORMAL) {
             if (value == BINARY_INACTIVE) {
                 value = BINARY_ACTIVE;
             } else {
                 value = BINARY_INACTIVE;
             }
         }
-        if (Present_Value[index] != value) {
-            Change_Of_Value[index] = true;
+        if (Binary_Input_Descr(index)->Present_Value != value) {
+            Binary_Input_Change_Of_Value_Set(index);
         }
-        Present_Value[index] = value;
+        Binary_Input_Descr(index)->Present_Value = value;
         status = true;
     }
 
@@ -296,11 +365,11 @@ static void Binary_Input_Out_Of_Service_Set(
     unsigned index = 0;
 
     index = Binary_Input_Instance_To_Index(object_instance);
-    if (index < MAX_BINARY_INPUTS) {
-        if (Out_Of_Service[index] != value) {
-            Change_Of_Value[index] = true;
+    if (index < Object_Store_Count(BI_Store)) {
+        if (Binary_Input_Descr(index)->Out_Of_Service != value) {
+            Binary_Input_Change_Of_Value_Set(index);
         }
-        Out_Of_Service[index] = value;
+        Binary_Input_Descr(index)->Out_Of_Service = value;
     }
 
     return;
@@ -310,20 +379,49 @@ bool Binary_Input_Object_Name(
     uint32_t object_instance,
     BACNET_CHARACTER_STRING * object_name)
 {
-    static char text_string[32] = "";   /* okay for single thread */
+    BINARY_INPUT_DESCR *pObject;
     bool status = false;
-    unsigned index = 0;
 
-    index = Binary_Input_Instance_To_Index(object_instance);
-    if (index < MAX_BINARY_INPUTS) {
-        sprintf(text_string, "BINARY INPUT %lu",
-            (unsigned long) object_instance);
-        status = characterstring_init_ansi(object_name, text_string);
+    pObject = Object_Store_Find(BI_Store, object_instance);
+    if (pObject) {
+        status = characterstring_init_ansi(object_name, pObject->Object_Name);
     }
 
     return status;
 }
 
+/* the name left in place, see BACNET_STRING_VIEW; false if not found */
+bool Binary_Input_Object_Name_View(
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view)
+{
+    BINARY_INPUT_DESCR *pObject;
+
+    pObject = Object_Store_Find(BI_Store, object_instance);
+    stringview_init_ansi(view, pObject ? pObject->Object_Name : NULL);
+
+    return (pObject != NULL);
+}
+
+/* note: the object name must be unique within this device */
+bool Binary_Input_Name_Set(
+    uint32_t object_instance,
+    char *new_name)
+{
+    BINARY_INPUT_DESCR *pObject;
+
+    pObject = Object_Store_Find(BI_Store, object_instance);
+    if (!pObject || !new_name ||
+        (strlen(new_name) >= sizeof(pObject->Object_Name))) {
+        return false;
+    }
+    strcpy(pObject->Object_Name, new_name);
+    /* a new name for the index, and a new Database_Revision */
+    Device_Object_Created(OBJECT_BINARY_INPUT, object_instance);
+
+    return true;
+}
+
 BACNET_POLARITY Binary_Input_Polarity(
     uint32_t object_instance)
 {
@@ -331,8 +429,8 @@ BACNET_POLARITY Binary_Input_Polarity(
     unsigned index = 0;
 
     index = Binary_Input_Instance_To_Index(object_instance);
-    if (index < MAX_BINARY_INPUTS) {
-        polarity = Polarity[index];
+    if (index < Object_Store_Count(BI_Store)) {
+        polarity = Binary_Input_Descr(index)->Polarity;
     }
 
     return polarity;
@@ -346,8 +444,8 @@ bool Binary_Input_Polarity_Set(
     unsigned index = 0;
 
     index = Binary_Input_Instance_To_Index(object_instance);
-    if (index < MAX_BINARY_INPUTS) {
-        Polarity[index] = polarity;
+    if (index < Object_Store_Count(BI_Store)) {
+        Binary_Input_Descr(index)->Polarity = polarity;
     }
 
     return status;
@@ -360,7 +458,7 @@ int Binary_Input_Read_Property(
 {
     int apdu_len = 0;   /* return value */
     BACNET_BIT_STRING bit_string;
-    BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     uint8_t *apdu = NULL;
 
     if ((rpdata == NULL) || (rpdata->application_data == NULL) ||
@@ -377,9 +475,10 @@ int Binary_Input_Read_Property(
         case PROP_OBJECT_NAME:
         case PROP_DESCRIPTION:
             /* note: object name must be unique in our device */
-            Binary_Input_Object_Name(rpdata->object_instance, &char_string);
+            Binary_Input_Object_Name_View(rpdata->object_instance, &name_view);
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
         case PROP_OBJECT_TYPE:
             apdu_len =
@@ -525,6 +624,27 @@ bool Binary_Input_Write_Property(
 #include <string.h>
 #include "ctest.h"
 
+void Device_Object_Created(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+}
+
+void Device_Object_Deleted(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+}
+
+static unsigned COV_Changed_Count;
+
+void Device_COV_Changed(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    COV_Changed_Count++;
+}
+
 bool WPValidateArgType(
     BACNET_APPLICATION_DATA_VALUE * pValue,
     uint8_t ucExpectedTag,
@@ -565,6 +685,28 @@ void testBinaryInput(
     ct_test(pTest, decoded_type == rpdata.object_type);
     ct_test(pTest, decoded_instance == rpdata.object_instance);
 
+    /* objects created at run time */
+    ct_test(pTest, Binary_Input_Count() == MAX_BINARY_INPUTS);
+    ct_test(pTest, Binary_Input_Create(1) == false);
+    ct_test(pTest, Binary_Input_Create(100000));
+    ct_test(pTest, Binary_Input_Count() == (MAX_BINARY_INPUTS + 1));
+    Binary_Input_Present_Value_Set(100000, BINARY_ACTIVE);
+    ct_test(pTest, Binary_Input_Present_Value(100000) == BINARY_ACTIVE);
+    ct_test(pTest, Binary_Input_Change_Of_Value(100000));
+    /* the device hears of a change once, until the flag is cleared */
+    ct_test(pTest, COV_Changed_Count == 1);
+    Binary_Input_Present_Value_Set(100000, BINARY_INACTIVE);
+    ct_test(pTest, COV_Changed_Count == 1);
+    Binary_Input_Change_Of_Value_Clear(100000);
+    Binary_Input_Present_Value_Set(100000, BINARY_ACTIVE);
+    ct_test(pTest, COV_Changed_Count == 2);
+    ct_test(pTest, Binary_Input_Delete(0));
+    ct_test(pTest, !Binary_Input_Valid_Instance(0));
+    ct_test(pTest, Binary_Input_Present_Value(100000) == BINARY_ACTIVE);
+    ct_test(pTest, Binary_Input_Instance_To_Index(0) == Binary_Input_Count());
+    Binary_Input_Cleanup();
+    ct_test(pTest, Binary_Input_Count() == 0);
+
     return;
 }
 
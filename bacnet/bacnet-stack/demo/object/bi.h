@@ -28,6 +28,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "bacdef.h"
+#include "objstore.h"
 #include "cov.h"
 #include "rp.h"
 #include "wp.h"
@@ -55,6 +56,9 @@ extern "C" {
     bool Binary_Input_Object_Name(
         uint32_t object_instance,
         BACNET_CHARACTER_STRING * object_name);
+    bool Binary_Input_Object_Name_View(
+        uint32_t object_instance,
+        BACNET_STRING_VIEW * view);
     bool Binary_Input_Name_Set(
         uint32_t object_instance,
         char *new_name);
@@ -111,6 +115,8 @@ extern "C" {
         void);
     void Binary_Input_Init(
         void);
+    void Binary_Input_Store_Select(
+        OBJECT_STORE * store);
 
 #ifdef TEST
 #include "ctest.h"
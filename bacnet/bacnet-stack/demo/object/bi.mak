@@ -8,11 +8,13 @@ DEFINES = -DBIG_ENDIAN=0 -DTEST -DTEST_BINARY_INPUT
 CFLAGS  = -Wall $(INCLUDES) $(DEFINES) -g
 
 SRCS = bi.c \
+	objstore.c \
 	$(SRC_DIR)/bacdcode.c \
 	$(SRC_DIR)/bacint.c \
 	$(SRC_DIR)/bacstr.c \
 	$(SRC_DIR)/bacreal.c \
 	$(SRC_DIR)/bacapp.c \
+	$(SRC_DIR)/bacdevobjpropref.c \
 	$(SRC_DIR)/bactext.c \
 	$(SRC_DIR)/indtext.c \
 	$(SRC_DIR)/datetime.c \
@@ -28,6 +28,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "bacdef.h"
 #include "bacdcode.h"
 #include "bacenum.h"
@@ -35,9 +36,12 @@
 #include "config.h"     /* the custom stuff */
 #include "rp.h"
 #include "wp.h"
+#include "device.h"
+#include "objstore.h"
 #include "bo.h"
 #include "handlers.h"
 
+/* number of objects created by Binary_Output_Init() */
 #ifndef MAX_BINARY_OUTPUTS
 #define MAX_BINARY_OUTPUTS 4
 #endif
@@ -45,12 +49,20 @@
 /* When all the priorities are level null, the present value returns */
 /* the Relinquish Default value */
 #define RELINQUISH_DEFAULT BINARY_INACTIVE
-/* Here is our Priority Array.*/
-static BACNET_BINARY_PV
-    Binary_Output_Level[MAX_BINARY_OUTPUTS][BACNET_MAX_PRIORITY];
-/* Writable out-of-service allows others to play with our Present Value */
-/* without changing the physical output */
-static bool Out_Of_Service[MAX_BINARY_OUTPUTS];
+
+typedef struct binary_output_descr {
+    /* Here is our Priority Array.*/
+    BACNET_BINARY_PV Priority_Array[BACNET_MAX_PRIORITY];
+    /* Writable out-of-service allows others to play with our Present Value */
+    /* without changing the physical output */
+    bool Out_Of_Service;
+    /* set when the object is added, see Binary_Output_Name_Set() */
+    char Object_Name[64];
+} BINARY_OUTPUT_DESCR;
+
+static OBJECT_STORE BO_Default_Store;
+/* the objects being addressed, see Binary_Output_Store_Select() */
+static OBJECT_STORE *BO_Store = &BO_Default_Store;
 
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int Binary_Output_Properties_Required[] = {
@@ -93,81 +105,124 @@ void Binary_Output_Property_Lists(
     return;
 }
 
-void Binary_Output_Init(
+/* add an object with the default property values */
+static bool Binary_Output_Add(
+    uint32_t object_instance)
+{
+    BINARY_OUTPUT_DESCR *pObject;
+    unsigned j;
+
+    pObject = Object_Store_Add(BO_Store, object_instance);
+    if (!pObject) {
+        return false;
+    }
+    sprintf(pObject->Object_Name, "BINARY OUTPUT %lu",
+        (unsigned long) object_instance);
+    /* initialize the priority array to NULL */
+    for (j = 0; j < BACNET_MAX_PRIORITY; j++) {
+        pObject->Priority_Array[j] = BINARY_NULL;
+    }
+    pObject->Out_Of_Service = false;
+
+    return true;
+}
+
+/* create an object at run time, e.g. from a configuration file */
+bool Binary_Output_Create(
+    uint32_t object_instance)
+{
+    if ((object_instance >= BACNET_MAX_INSTANCE) ||
+        !Binary_Output_Add(object_instance)) {
+        return false;
+    }
+    Device_Object_Created(OBJECT_BINARY_OUTPUT, object_instance);
+
+    return true;
+}
+
+bool Binary_Output_Delete(
+    uint32_t object_instance)
+{
+    if (!Object_Store_Remove(BO_Store, object_instance)) {
+        return false;
+    }
+    Device_Object_Deleted(OBJECT_BINARY_OUTPUT, object_instance);
+
+    return true;
+}
+
+void Binary_Output_Cleanup(
     void)
 {
-    unsigned i, j;
-    static bool initialized = false;
+    Object_Store_Cleanup(BO_Store);
+}
 
-    if (!initialized) {
-        initialized = true;
+void Binary_Output_Init(
+    void)
+{
+    unsigned i;
 
-        /* initialize all the analog output priority arrays to NULL */
-        for (i = 0; i < MAX_BINARY_OUTPUTS; i++) {
-            for (j = 0; j < BACNET_MAX_PRIORITY; j++) {
-                Binary_Output_Level[i][j] = BINARY_NULL;
-            }
-        }
+    Object_Store_Cleanup(BO_Store);
+    Object_Store_Init(BO_Store, sizeof(BINARY_OUTPUT_DESCR));
+    for (i = 0; i < MAX_BINARY_OUTPUTS; i++) {
+        Binary_Output_Add(i);
     }
 
     return;
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need validate that the */
-/* given instance exists */
+/* Address the objects in another store, eg. those of one of the Devices
+   behind a gateway, or NULL for the objects of Binary_Output_Init().
+   A zeroed store is ready for use. */
+void Binary_Output_Store_Select(
+    OBJECT_STORE * store)
+{
+    if (store == NULL) {
+        store = &BO_Default_Store;
+    } else if (store->element_size == 0) {
+        Object_Store_Init(store, sizeof(BINARY_OUTPUT_DESCR));
+    }
+    BO_Store = store;
+}
+
 bool Binary_Output_Valid_Instance(
     uint32_t object_instance)
 {
-    if (object_instance < MAX_BINARY_OUTPUTS)
-        return true;
-
-    return false;
+    return (Object_Store_Find(BO_Store, object_instance) != NULL);
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then count how many you have */
 unsigned Binary_Output_Count(
     void)
 {
-    return MAX_BINARY_OUTPUTS;
+    return Object_Store_Count(BO_Store);
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the instance */
-/* that correlates to the correct index */
+/* the index is only good until the next object is deleted */
 uint32_t Binary_Output_Index_To_Instance(
     unsigned index)
 {
-    return index;
+    return Object_Store_Instance(BO_Store, index);
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the index */
-/* that correlates to the correct instance number */
+/* returns Binary_Output_Count() if there is no such instance */
 unsigned Binary_Output_Instance_To_Index(
     uint32_t object_instance)
 {
-    unsigned index = MAX_BINARY_OUTPUTS;
-
-    if (object_instance < MAX_BINARY_OUTPUTS)
-        index = object_instance;
-
-    return index;
+    return Object_Store_Index(BO_Store, object_instance);
 }
 
 BACNET_BINARY_PV Binary_Output_Present_Value(
     uint32_t object_instance)
 {
     BACNET_BINARY_PV value = RELINQUISH_DEFAULT;
-    unsigned index = 0;
+    BINARY_OUTPUT_DESCR *pObject;
     unsigned i = 0;
 
-    index = Binary_Output_Instance_To_Index(object_instance);
-    if (index < MAX_BINARY_OUTPUTS) {
+    pObject = Object_Store_Find(BO_Store, object_instance);
+    if (pObject) {
         for (i = 0; i < BACNET_MAX_PRIORITY; i++) {
-            if (Binary_Output_Level[index][i] != BINARY_NULL) {
-                value = Binary_Output_Level[index][i];
+            if (pObject->Priority_Array[i] != BINARY_NULL) {
+                value = pObject->Priority_Array[i];
                 break;
             }
         }
@@ -180,11 +235,11 @@ bool Binary_Output_Out_Of_Service(
     uint32_t object_instance)
 {
     bool value = false;
-    unsigned index = 0;
+    BINARY_OUTPUT_DESCR *pObject;
 
-    index = Binary_Output_Instance_To_Index(object_instance);
-    if (index < MAX_BINARY_OUTPUTS) {
-        value = Out_Of_Service[index];
+    pObject = Object_Store_Find(BO_Store, object_instance);
+    if (pObject) {
+        value = pObject->Out_Of_Service;
     }
 
     return value;
@@ -195,18 +250,49 @@ bool Binary_Output_Object_Name(
     uint32_t object_instance,
     BACNET_CHARACTER_STRING * object_name)
 {
-    static char text_string[32] = "";   /* okay for single thread */
+    BINARY_OUTPUT_DESCR *pObject;
     bool status = false;
 
-    if (object_instance < MAX_BINARY_OUTPUTS) {
-        sprintf(text_string, "BINARY OUTPUT %lu",
-            (unsigned long) object_instance);
-        status = characterstring_init_ansi(object_name, text_string);
+    pObject = Object_Store_Find(BO_Store, object_instance);
+    if (pObject) {
+        status = characterstring_init_ansi(object_name, pObject->Object_Name);
     }
 
     return status;
 }
 
+/* the name left in place, see BACNET_STRING_VIEW; false if not found */
+bool Binary_Output_Object_Name_View(
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view)
+{
+    BINARY_OUTPUT_DESCR *pObject;
+
+    pObject = Object_Store_Find(BO_Store, object_instance);
+    stringview_init_ansi(view, pObject ? pObject->Object_Name : NULL);
+
+    return (pObject != NULL);
+}
+
+/* note: the object name must be unique within this device */
+bool Binary_Output_Name_Set(
+    uint32_t object_instance,
+    char *new_name)
+{
+    BINARY_OUTPUT_DESCR *pObject;
+
+    pObject = Object_Store_Find(BO_Store, object_instance);
+    if (!pObject || !new_name ||
+        (strlen(new_name) >= sizeof(pObject->Object_Name))) {
+        return false;
+    }
+    strcpy(pObject->Object_Name, new_name);
+    /* a new name for the index, and a new Database_Revision */
+    Device_Object_Created(OBJECT_BINARY_OUTPUT, object_instance);
+
+    return true;
+}
+
 /* return apdu len, or BACNET_STATUS_ERROR on error */
 int Binary_Output_Read_Property(
     BACNET_READ_PROPERTY_DATA * rpdata)
@@ -215,9 +301,10 @@ int Binary_Output_Read_Property(
     int apdu_len = 0;   /* return value */
     BACNET_BIT_STRING bit_string;
     BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     BACNET_BINARY_PV present_value = BINARY_INACTIVE;
     BACNET_POLARITY polarity = POLARITY_NORMAL;
-    unsigned object_index = 0;
+    BINARY_OUTPUT_DESCR *pObject;
     unsigned i = 0;
     bool state = false;
     uint8_t *apdu = NULL;
@@ -226,6 +313,12 @@ int Binary_Output_Read_Property(
         (rpdata->application_data_len == 0)) {
         return 0;
     }
+    pObject = Object_Store_Find(BO_Store, rpdata->object_instance);
+    if (!pObject) {
+        rpdata->error_class = ERROR_CLASS_OBJECT;
+        rpdata->error_code = ERROR_CODE_UNKNOWN_OBJECT;
+        return BACNET_STATUS_ERROR;
+    }
     apdu = rpdata->application_data;
     switch (rpdata->object_property) {
         case PROP_OBJECT_IDENTIFIER:
@@ -237,9 +330,10 @@ int Binary_Output_Read_Property(
                You could make Description writable and different */
         case PROP_OBJECT_NAME:
         case PROP_DESCRIPTION:
-            Binary_Output_Object_Name(rpdata->object_instance, &char_string);
+            Binary_Output_Object_Name_View(rpdata->object_instance, &name_view);
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
         case PROP_OBJECT_TYPE:
             apdu_len =
@@ -265,9 +359,7 @@ int Binary_Output_Read_Property(
                 encode_application_enumerated(&apdu[0], EVENT_STATE_NORMAL);
             break;
         case PROP_OUT_OF_SERVICE:
-            object_index =
-                Binary_Output_Instance_To_Index(rpdata->object_instance);
-            state = Out_Of_Service[object_index];
+            state = pObject->Out_Of_Service;
             apdu_len = encode_application_boolean(&apdu[0], state);
             break;
         case PROP_POLARITY:
@@ -281,14 +373,12 @@ int Binary_Output_Read_Property(
             /* if no index was specified, then try to encode the entire list */
             /* into one packet. */
             else if (rpdata->array_index == BACNET_ARRAY_ALL) {
-                object_index =
-                    Binary_Output_Instance_To_Index(rpdata->object_instance);
                 for (i = 0; i < BACNET_MAX_PRIORITY; i++) {
                     /* FIXME: check if we have room before adding it to APDU */
-                    if (Binary_Output_Level[object_index][i] == BINARY_NULL)
+                    if (pObject->Priority_Array[i] == BINARY_NULL)
                         len = encode_application_null(&apdu[apdu_len]);
                     else {
-                        present_value = Binary_Output_Level[object_index][i];
+                        present_value = pObject->Priority_Array[i];
                         len =
                             encode_application_enumerated(&apdu[apdu_len],
                             present_value);
@@ -304,15 +394,13 @@ int Binary_Output_Read_Property(
                     }
                 }
             } else {
-                object_index =
-                    Binary_Output_Instance_To_Index(rpdata->object_instance);
                 if (rpdata->array_index <= BACNET_MAX_PRIORITY) {
-                    if (Binary_Output_Level[object_index][rpdata->array_index -
-                            1] == BINARY_NULL)
+                    if (pObject->Priority_Array[rpdata->array_index - 1] ==
+                        BINARY_NULL)
                         apdu_len = encode_application_null(&apdu[apdu_len]);
                     else {
-                        present_value = Binary_Output_Level[object_index]
-                            [rpdata->array_index - 1];
+                        present_value =
+                            pObject->Priority_Array[rpdata->array_index - 1];
                         apdu_len =
                             encode_application_enumerated(&apdu[apdu_len],
                             present_value);
@@ -361,7 +449,7 @@ bool Binary_Output_Write_Property(
     BACNET_WRITE_PROPERTY_DATA * wp_data)
 {
     bool status = false;        /* return value */
-    unsigned int object_index = 0;
+    BINARY_OUTPUT_DESCR *pObject;
     unsigned int priority = 0;
     BACNET_BINARY_PV level = BINARY_NULL;
     int len = 0;
@@ -385,6 +473,12 @@ bool Binary_Output_Write_Property(
         wp_data->error_code = ERROR_CODE_PROPERTY_IS_NOT_AN_ARRAY;
         return false;
     }
+    pObject = Object_Store_Find(BO_Store, wp_data->object_instance);
+    if (!pObject) {
+        wp_data->error_class = ERROR_CLASS_OBJECT;
+        wp_data->error_code = ERROR_CODE_UNKNOWN_OBJECT;
+        return false;
+    }
     switch (wp_data->object_property) {
         case PROP_PRESENT_VALUE:
             if (value.tag == BACNET_APPLICATION_TAG_ENUMERATED) {
@@ -396,11 +490,8 @@ bool Binary_Output_Write_Property(
                     (priority != 6 /* reserved */ ) &&
                     (value.type.Enumerated <= MAX_BINARY_PV)) {
                     level = (BACNET_BINARY_PV) value.type.Enumerated;
-                    object_index =
-                        Binary_Output_Instance_To_Index
-                        (wp_data->object_instance);
                     priority--;
-                    Binary_Output_Level[object_index][priority] = level;
+                    pObject->Priority_Array[priority] = level;
                     /* Note: you could set the physical output here if we
                        are the highest priority.
                        However, if Out of Service is TRUE, then don't set the
@@ -423,13 +514,10 @@ bool Binary_Output_Write_Property(
                     &wp_data->error_class, &wp_data->error_code);
                 if (status) {
                     level = BINARY_NULL;
-                    object_index =
-                        Binary_Output_Instance_To_Index
-                        (wp_data->object_instance);
                     priority = wp_data->priority;
                     if (priority && (priority <= BACNET_MAX_PRIORITY)) {
                         priority--;
-                        Binary_Output_Level[object_index][priority] = level;
+                        pObject->Priority_Array[priority] = level;
                         /* Note: you could set the physical output here to the next
                            highest priority, or to the relinquish default if no
                            priorities are set.
@@ -449,10 +537,7 @@ bool Binary_Output_Write_Property(
                 WPValidateArgType(&value, BACNET_APPLICATION_TAG_BOOLEAN,
                 &wp_data->error_class, &wp_data->error_code);
             if (status) {
-                object_index =
-                    Binary_Output_Instance_To_Index(wp_data->object_instance);
-                Out_Of_Service[object_index] =
-                    value.type.Boolean;
+                pObject->Out_Of_Service = value.type.Boolean;
             }
             break;
         case PROP_OBJECT_IDENTIFIER:
@@ -484,6 +569,18 @@ bool Binary_Output_Write_Property(
 #include <string.h>
 #include "ctest.h"
 
+void Device_Object_Created(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+}
+
+void Device_Object_Deleted(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+}
+
 bool WPValidateArgType(
     BACNET_APPLICATION_DATA_VALUE * pValue,
     uint8_t ucExpectedTag,
@@ -524,6 +621,21 @@ void testBinaryOutput(
     ct_test(pTest, decoded_type == rpdata.object_type);
     ct_test(pTest, decoded_instance == rpdata.object_instance);
 
+    /* objects created at run time */
+    ct_test(pTest, Binary_Output_Count() == MAX_BINARY_OUTPUTS);
+    ct_test(pTest, Binary_Output_Create(1) == false);
+    ct_test(pTest, Binary_Output_Create(100000));
+    ct_test(pTest, Binary_Output_Count() == (MAX_BINARY_OUTPUTS + 1));
+    ct_test(pTest, Binary_Output_Present_Value(100000) == RELINQUISH_DEFAULT);
+    ct_test(pTest, Binary_Output_Delete(0));
+    ct_test(pTest, !Binary_Output_Valid_Instance(0));
+    ct_test(pTest, Binary_Output_Valid_Instance(100000));
+    rpdata.object_instance = 0;
+    ct_test(pTest,
+        Binary_Output_Read_Property(&rpdata) == BACNET_STATUS_ERROR);
+    Binary_Output_Cleanup();
+    ct_test(pTest, Binary_Output_Count() == 0);
+
     return;
 }
 
@@ -28,6 +28,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "bacdef.h"
+#include "objstore.h"
 #include "bacerror.h"
 #include "rp.h"
 #include "wp.h"
@@ -55,6 +56,9 @@ extern "C" {
     bool Binary_Output_Object_Name(
         uint32_t object_instance,
         BACNET_CHARACTER_STRING * object_name);
+    bool Binary_Output_Object_Name_View(
+        uint32_t object_instance,
+        BACNET_STRING_VIEW * view);
     bool Binary_Output_Name_Set(
         uint32_t object_instance,
         char *new_name);
@@ -112,6 +116,8 @@ extern "C" {
         void);
     void Binary_Output_Init(
         void);
+    void Binary_Output_Store_Select(
+        OBJECT_STORE * store);
 
 #ifdef TEST
 #include "ctest.h"
@@ -48,6 +48,10 @@
 /* Here is our Priority Array.*/
 static BACNET_BINARY_PV
     Binary_Value_Level[MAX_BINARY_VALUES][BACNET_MAX_PRIORITY];
+
+/* the names, set once by the Init */
+static char Binary_Value_Names[MAX_BINARY_VALUES][64];
+
 /* Writable out-of-service allows others to play with our Present Value */
 /* without changing the physical output */
 static bool Out_Of_Service[MAX_BINARY_VALUES];
@@ -101,6 +105,7 @@ void Binary_Value_Init(
 
         /* initialize all the analog output priority arrays to NULL */
         for (i = 0; i < MAX_BINARY_VALUES; i++) {
+            sprintf(Binary_Value_Names[i], "BINARY VALUE %u", i);
             for (j = 0; j < BACNET_MAX_PRIORITY; j++) {
                 Binary_Value_Level[i][j] = BINARY_NULL;
             }
@@ -178,18 +183,32 @@ bool Binary_Value_Object_Name(
     uint32_t object_instance,
     BACNET_CHARACTER_STRING * object_name)
 {
-    static char text_string[32] = "";   /* okay for single thread */
     bool status = false;
 
     if (object_instance < MAX_BINARY_VALUES) {
-        sprintf(text_string, "BINARY VALUE %lu",
-            (unsigned long) object_instance);
-        status = characterstring_init_ansi(object_name, text_string);
+        status =
+            characterstring_init_ansi(object_name,
+            Binary_Value_Names[object_instance]);
     }
 
     return status;
 }
 
+/* the name left in place, see BACNET_STRING_VIEW; false if not found */
+bool Binary_Value_Object_Name_View(
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view)
+{
+    const char *name = NULL;
+
+    if (object_instance < MAX_BINARY_VALUES) {
+        name = Binary_Value_Names[object_instance];
+    }
+    stringview_init_ansi(view, name);
+
+    return (name != NULL);
+}
+
 /* return apdu len, or BACNET_STATUS_ERROR on error */
 int Binary_Value_Read_Property(
     BACNET_READ_PROPERTY_DATA * rpdata)
@@ -197,7 +216,7 @@ int Binary_Value_Read_Property(
     int len = 0;
     int apdu_len = 0;   /* return value */
     BACNET_BIT_STRING bit_string;
-    BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     BACNET_BINARY_PV present_value = BINARY_INACTIVE;
     unsigned object_index = 0;
     unsigned i = 0;
@@ -219,9 +238,10 @@ int Binary_Value_Read_Property(
                You could make Description writable and different */
         case PROP_OBJECT_NAME:
         case PROP_DESCRIPTION:
-            Binary_Value_Object_Name(rpdata->object_instance, &char_string);
+            Binary_Value_Object_Name_View(rpdata->object_instance, &name_view);
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
         case PROP_OBJECT_TYPE:
             apdu_len =
@@ -52,6 +52,9 @@ extern "C" {
     bool Binary_Value_Object_Name(
         uint32_t object_instance,
         BACNET_CHARACTER_STRING * object_name);
+    bool Binary_Value_Object_Name_View(
+        uint32_t object_instance,
+        BACNET_STRING_VIEW * view);
     bool Binary_Value_Name_Set(
         uint32_t object_instance,
         char *new_name);
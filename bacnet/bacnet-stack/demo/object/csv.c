@@ -35,6 +35,7 @@
 #include "config.h"     /* the custom stuff */
 #include "rp.h"
 #include "wp.h"
+#include "device.h"
 #include "csv.h"
 #include "handlers.h"
 
@@ -283,6 +284,7 @@ bool CharacterString_Value_Name_Set(
                 Object_Name[index][i] = 0;
             }
         }
+        Device_Inc_Database_Revision();
     }
 
     return status;
@@ -447,6 +449,11 @@ bool CharacterString_Value_Write_Property(
 #include <string.h>
 #include "ctest.h"
 
+void Device_Inc_Database_Revision(
+    void)
+{
+}
+
 bool WPValidateArgType(
     BACNET_APPLICATION_DATA_VALUE * pValue,
     uint8_t ucExpectedTag,
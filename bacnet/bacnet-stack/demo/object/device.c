@@ -28,6 +28,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>     /* for memmove */
 #include <time.h>       /* for timezone, localtime */
 #include "bacdef.h"
@@ -106,7 +107,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        NULL /* Name View */ },
     {OBJECT_ANALOG_INPUT,
             Analog_Input_Init,
             Analog_Input_Count,
@@ -121,7 +123,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        Analog_Input_Intrinsic_Reporting},
+            Analog_Input_Intrinsic_Reporting,
+        Analog_Input_Object_Name_View},
     {OBJECT_ANALOG_OUTPUT,
             Analog_Output_Init,
             Analog_Output_Count,
@@ -136,7 +139,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        Analog_Output_Object_Name_View},
     {OBJECT_ANALOG_VALUE,
             Analog_Value_Init,
             Analog_Value_Count,
@@ -151,7 +155,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        Analog_Value_Intrinsic_Reporting},
+            Analog_Value_Intrinsic_Reporting,
+        Analog_Value_Object_Name_View},
     {OBJECT_BINARY_INPUT,
             Binary_Input_Init,
             Binary_Input_Count,
@@ -166,7 +171,8 @@ static object_functions_t My_Object_Table[] = {
             Binary_Input_Encode_Value_List,
             Binary_Input_Change_Of_Value,
             Binary_Input_Change_Of_Value_Clear,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        Binary_Input_Object_Name_View},
     {OBJECT_BINARY_OUTPUT,
             Binary_Output_Init,
             Binary_Output_Count,
@@ -181,7 +187,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        Binary_Output_Object_Name_View},
     {OBJECT_BINARY_VALUE,
             Binary_Value_Init,
             Binary_Value_Count,
@@ -196,7 +203,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        Binary_Value_Object_Name_View},
 #if 0
     {OBJECT_CHARACTERSTRING_VALUE,
             CharacterString_Value_Init,
@@ -212,7 +220,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        NULL /* Name View */ },
 #endif
 #if defined(INTRINSIC_REPORTING)
     {OBJECT_NOTIFICATION_CLASS,
@@ -229,7 +238,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        Notification_Class_Object_Name_View},
 #endif
     {OBJECT_LIFE_SAFETY_POINT,
             Life_Safety_Point_Init,
@@ -245,7 +255,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        Life_Safety_Point_Object_Name_View},
     {OBJECT_LOAD_CONTROL,
             Load_Control_Init,
             Load_Control_Count,
@@ -260,7 +271,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        Load_Control_Object_Name_View},
     {OBJECT_MULTI_STATE_INPUT,
             Multistate_Input_Init,
             Multistate_Input_Count,
@@ -275,7 +287,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        NULL /* Name View */ },
     {OBJECT_MULTI_STATE_OUTPUT,
             Multistate_Output_Init,
             Multistate_Output_Count,
@@ -290,7 +303,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        Multistate_Output_Object_Name_View},
     {OBJECT_MULTI_STATE_VALUE,
             Multistate_Value_Init,
             Multistate_Value_Count,
@@ -305,7 +319,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        NULL /* Name View */ },
     {OBJECT_TRENDLOG,
             Trend_Log_Init,
             Trend_Log_Count,
@@ -320,7 +335,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        Trend_Log_Object_Name_View},
 #if defined(BACFILE)
     {OBJECT_FILE,
             bacfile_init,
@@ -336,7 +352,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        NULL /* Name View */ },
 #endif
     {OBJECT_OCTETSTRING_VALUE,
             OctetString_Value_Init,
@@ -352,7 +369,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        OctetString_Value_Object_Name_View},
     {OBJECT_POSITIVE_INTEGER_VALUE,
             PositiveInteger_Value_Init,
             PositiveInteger_Value_Count,
@@ -367,7 +385,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        PositiveInteger_Value_Object_Name_View},
     {OBJECT_SCHEDULE,
             Schedule_Init,
             Schedule_Count,
@@ -382,7 +401,8 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ },
+            NULL /* Intrinsic Reporting */ ,
+        Schedule_Object_Name_View},
     {MAX_BACNET_OBJECT_TYPE,
             NULL /* Init */ ,
             NULL /* Count */ ,
@@ -397,9 +417,18 @@ static object_functions_t My_Object_Table[] = {
             NULL /* Value_Lists */ ,
             NULL /* COV */ ,
             NULL /* COV Clear */ ,
-        NULL /* Intrinsic Reporting */ }
+            NULL /* Intrinsic Reporting */ ,
+        NULL /* Name View */ }
 };
 
+/* Direct index from the standard object types to their helper functions.
+   Proprietary types are rare, and are still found by walking the table. */
+static struct object_functions *Object_Type_Index[OBJECT_PROPRIETARY_MIN];
+
+/* The property lists of each entry of the object table, with their counts
+   and property bits, set up by Device_Init() for RPM and membership. */
+static struct property_list_index_t *Object_Property_Index;
+
 /** Glue function to let the Device object, when called by a handler,
  * lookup which Object type needs to be invoked.
  * @ingroup ObjHelpers
@@ -412,6 +441,9 @@ static struct object_functions *Device_Objects_Find_Functions(
 {
     struct object_functions *pObject = NULL;
 
+    if (Object_Type < OBJECT_PROPRIETARY_MIN) {
+        return Object_Type_Index[Object_Type];
+    }
     pObject = Object_Table;
     while (pObject->Object_Type < MAX_BACNET_OBJECT_TYPE) {
         /* handle each object type */
@@ -469,6 +501,10 @@ void Device_Objects_Property_List(
      */
 
     pObject = Device_Objects_Find_Functions(object_type);
+    if ((pObject != NULL) && Object_Property_Index) {
+        *pPropertyList = Object_Property_Index[pObject - Object_Table].List;
+        return;
+    }
     if ((pObject != NULL) && (pObject->Object_RPM_List != NULL)) {
         pObject->Object_RPM_List(&pPropertyList->Required.pList,
             &pPropertyList->Optional.pList, &pPropertyList->Proprietary.pList);
@@ -490,6 +526,50 @@ void Device_Objects_Property_List(
     return;
 }
 
+/** Tells if a property is one of the Required, Optional, or All properties
+ * of an object type, without walking its lists.
+ * @ingroup ObjIntf
+ *
+ * @param object_type [in] The BACNET_OBJECT_TYPE of the object.
+ * @param special_property [in] PROP_ALL, PROP_REQUIRED, or PROP_OPTIONAL.
+ * @param object_property [in] The property looked for.
+ * @return True if the object type lists the property.
+ */
+bool Device_Objects_Property_List_Member(
+    BACNET_OBJECT_TYPE object_type,
+    BACNET_PROPERTY_ID special_property,
+    BACNET_PROPERTY_ID object_property)
+{
+    struct object_functions *pObject = NULL;
+    struct special_property_list_t PropertyList;
+
+    pObject = Device_Objects_Find_Functions(object_type);
+    if (pObject == NULL) {
+        return false;
+    }
+    if (Object_Property_Index) {
+        return property_list_index_member(&Object_Property_Index[pObject -
+                Object_Table], special_property, object_property);
+    }
+    Device_Objects_Property_List(object_type, &PropertyList);
+    if (special_property == PROP_REQUIRED) {
+        return property_list_member(PropertyList.Required.pList,
+            object_property);
+    } else if (special_property == PROP_OPTIONAL) {
+        return property_list_member(PropertyList.Optional.pList,
+            object_property);
+    } else if (special_property == PROP_ALL) {
+        return property_list_member(PropertyList.Required.pList,
+            object_property) ||
+            property_list_member(PropertyList.Optional.pList,
+            object_property) ||
+            property_list_member(PropertyList.Proprietary.pList,
+            object_property);
+    }
+
+    return false;
+}
+
 /** Commands a Device re-initialization, to a given state.
  * The request's password must match for the operation to succeed.
  * This implementation provides a framework, but doesn't
@@ -578,6 +658,10 @@ static const int Device_Properties_Optional[] = {
     PROP_DAYLIGHT_SAVINGS_STATUS,
     PROP_LOCATION,
     PROP_ACTIVE_COV_SUBSCRIPTIONS,
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+    PROP_MAX_SEGMENTS_ACCEPTED,
+    PROP_APDU_SEGMENT_TIMEOUT,
+#endif
     -1
 };
 
@@ -924,7 +1008,12 @@ uint8_t Device_Protocol_Revision(
 BACNET_SEGMENTATION Device_Segmentation_Supported(
     void)
 {
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+    /* the replies, the requests are still not taken in segments */
+    return SEGMENTATION_TRANSMIT;
+#else
     return SEGMENTATION_NONE;
+#endif
 }
 
 uint32_t Device_Database_Revision(
@@ -1034,6 +1123,354 @@ bool Device_Object_List_Identifier(
     return status;
 }
 
+/* Index of the objects in the Object_Table, hashed both on
+ * (type, instance) and on object name, so that a name is found without
+ * reading the name of every object.  Entries are linked by array
+ * position so the array can grow.  The Device object itself is not
+ * indexed, since a gateway swaps it per request (see Routing_Device_Init).
+ * The index is rebuilt whenever the Database_Revision has moved under
+ * it, so anything that renames an object must bump the revision.
+ */
+#define OBJECT_INDEX_NONE (-1)
+typedef struct object_index_entry {
+    uint32_t instance;
+    uint16_t type;
+    uint32_t name_hash;
+    int32_t id_next;    /* next in id bucket, or in the free list */
+    int32_t name_next;  /* next in name bucket */
+} OBJECT_INDEX_ENTRY;
+
+static OBJECT_INDEX_ENTRY *Object_Index;
+static unsigned Object_Index_Size;      /* entries allocated */
+static unsigned Object_Index_Count;     /* entries in use */
+static int32_t Object_Index_Free = OBJECT_INDEX_NONE;
+static int32_t *Object_Id_Buckets;
+static int32_t *Object_Name_Buckets;
+static unsigned Object_Index_Mask;      /* buckets - 1 */
+static bool Object_Index_Valid;
+static uint32_t Object_Index_Revision;
+
+static uint32_t Object_Id_Hash(
+    int object_type,
+    uint32_t object_instance)
+{
+    uint32_t hash = ((uint32_t) object_type << 22) ^ object_instance;
+
+    hash ^= hash >> 16;
+    hash *= 0x7feb352dUL;
+    hash ^= hash >> 15;
+
+    return hash;
+}
+
+static uint32_t Object_Name_Hash(
+    BACNET_STRING_VIEW * object_name)
+{
+    /* FNV-1a over the encoding and the octets of the name */
+    uint32_t hash = 2166136261UL;
+    size_t i;
+
+    hash = (hash ^ object_name->encoding) * 16777619UL;
+    for (i = 0; i < object_name->length; i++) {
+        hash = (hash ^ object_name->value[i]) * 16777619UL;
+    }
+
+    return hash;
+}
+
+/* the name of an object in place, or else in the given copy */
+static bool Object_Name_View(
+    struct object_functions *pObject,
+    uint32_t object_instance,
+    BACNET_CHARACTER_STRING * copy,
+    BACNET_STRING_VIEW * view)
+{
+    if (pObject->Object_Name_View) {
+        return pObject->Object_Name_View(object_instance, view);
+    }
+    if (!pObject->Object_Name ||
+        !pObject->Object_Name(object_instance, copy)) {
+        return false;
+    }
+    stringview_init(view, characterstring_encoding(copy),
+        (const uint8_t *) characterstring_value(copy),
+        characterstring_length(copy));
+
+    return true;
+}
+
+static void Object_Index_Clear(
+    void)
+{
+    free(Object_Index);
+    free(Object_Id_Buckets);
+    free(Object_Name_Buckets);
+    Object_Index = NULL;
+    Object_Id_Buckets = NULL;
+    Object_Name_Buckets = NULL;
+    Object_Index_Size = 0;
+    Object_Index_Count = 0;
+    Object_Index_Free = OBJECT_INDEX_NONE;
+    Object_Index_Mask = 0;
+    Object_Index_Valid = false;
+}
+
+/* (re)link every entry in use into buckets of the given count */
+static bool Object_Index_Rehash(
+    unsigned buckets)
+{
+    int32_t *id_buckets;
+    int32_t *name_buckets;
+    unsigned i;
+    uint32_t slot;
+
+    id_buckets = malloc(buckets * sizeof(int32_t));
+    name_buckets = malloc(buckets * sizeof(int32_t));
+    if (!id_buckets || !name_buckets) {
+        free(id_buckets);
+        free(name_buckets);
+        return false;
+    }
+    for (i = 0; i < buckets; i++) {
+        id_buckets[i] = OBJECT_INDEX_NONE;
+        name_buckets[i] = OBJECT_INDEX_NONE;
+    }
+    free(Object_Id_Buckets);
+    free(Object_Name_Buckets);
+    Object_Id_Buckets = id_buckets;
+    Object_Name_Buckets = name_buckets;
+    Object_Index_Mask = buckets - 1;
+    Object_Index_Free = OBJECT_INDEX_NONE;
+    for (i = Object_Index_Size; i-- > 0;) {
+        if (Object_Index[i].type >= MAX_BACNET_OBJECT_TYPE) {
+            Object_Index[i].id_next = Object_Index_Free;
+            Object_Index_Free = i;
+            continue;
+        }
+        slot =
+            Object_Id_Hash(Object_Index[i].type,
+            Object_Index[i].instance) & Object_Index_Mask;
+        Object_Index[i].id_next = Object_Id_Buckets[slot];
+        Object_Id_Buckets[slot] = i;
+        slot = Object_Index[i].name_hash & Object_Index_Mask;
+        Object_Index[i].name_next = Object_Name_Buckets[slot];
+        Object_Name_Buckets[slot] = i;
+    }
+
+    return true;
+}
+
+static bool Object_Index_Insert(
+    struct object_functions *pObject,
+    uint32_t object_instance)
+{
+    BACNET_CHARACTER_STRING object_name;
+    BACNET_STRING_VIEW name_view;
+    OBJECT_INDEX_ENTRY *entries;
+    unsigned size;
+    unsigned i;
+    int32_t index;
+    uint32_t slot;
+
+    if (!Object_Name_View(pObject, object_instance, &object_name, &name_view)) {
+        /* nameless objects can't be found by name anyway */
+        return true;
+    }
+    if (Object_Index_Free == OBJECT_INDEX_NONE) {
+        /* double the entries, and the buckets with them */
+        size = Object_Index_Size ? Object_Index_Size * 2 : 64;
+        entries = realloc(Object_Index, size * sizeof(OBJECT_INDEX_ENTRY));
+        if (!entries) {
+            return false;
+        }
+        for (i = Object_Index_Size; i < size; i++) {
+            entries[i].type = MAX_BACNET_OBJECT_TYPE;
+        }
+        Object_Index = entries;
+        Object_Index_Size = size;
+        if (!Object_Index_Rehash(size)) {
+            return false;
+        }
+    }
+    index = Object_Index_Free;
+    Object_Index_Free = Object_Index[index].id_next;
+    Object_Index[index].type = pObject->Object_Type;
+    Object_Index[index].instance = object_instance;
+    Object_Index[index].name_hash = Object_Name_Hash(&name_view);
+    slot =
+        Object_Id_Hash(pObject->Object_Type,
+        object_instance) & Object_Index_Mask;
+    Object_Index[index].id_next = Object_Id_Buckets[slot];
+    Object_Id_Buckets[slot] = index;
+    slot = Object_Index[index].name_hash & Object_Index_Mask;
+    Object_Index[index].name_next = Object_Name_Buckets[slot];
+    Object_Name_Buckets[slot] = index;
+    Object_Index_Count++;
+
+    return true;
+}
+
+static void Object_Index_Remove(
+    int object_type,
+    uint32_t object_instance)
+{
+    int32_t *link;
+    int32_t index;
+
+    if (!Object_Index_Mask) {
+        return;
+    }
+    link =
+        &Object_Id_Buckets[Object_Id_Hash(object_type,
+            object_instance) & Object_Index_Mask];
+    while (*link != OBJECT_INDEX_NONE) {
+        index = *link;
+        if ((Object_Index[index].type == object_type) &&
+            (Object_Index[index].instance == object_instance)) {
+            *link = Object_Index[index].id_next;
+            link =
+                &Object_Name_Buckets[Object_Index[index].name_hash &
+                Object_Index_Mask];
+            while (*link != index) {
+                link = &Object_Index[*link].name_next;
+            }
+            *link = Object_Index[index].name_next;
+            Object_Index[index].type = MAX_BACNET_OBJECT_TYPE;
+            Object_Index[index].id_next = Object_Index_Free;
+            Object_Index_Free = index;
+            Object_Index_Count--;
+            return;
+        }
+        link = &Object_Index[index].id_next;
+    }
+}
+
+/* make sure the index matches the objects; false if it can't be built */
+static bool Object_Index_Update(
+    void)
+{
+    struct object_functions *pObject = NULL;
+    unsigned count = 0;
+    unsigned index = 0;
+    unsigned i = 0;
+
+    if (Object_Index_Valid && (Object_Index_Revision == Database_Revision)) {
+        return true;
+    }
+    Object_Index_Clear();
+    pObject = Object_Table;
+    while (pObject->Object_Type < MAX_BACNET_OBJECT_TYPE) {
+        if ((pObject->Object_Type != OBJECT_DEVICE) && pObject->Object_Count
+            && pObject->Object_Index_To_Instance) {
+            count = pObject->Object_Count();
+            if (pObject->Object_Iterator) {
+                index = pObject->Object_Iterator(~(unsigned) 0);
+            } else {
+                index = 0;
+            }
+            for (i = 0; i < count; i++) {
+                if (!Object_Index_Insert(pObject,
+                        pObject->Object_Index_To_Instance(index))) {
+                    Object_Index_Clear();
+                    return false;
+                }
+                if (pObject->Object_Iterator) {
+                    index = pObject->Object_Iterator(index);
+                } else {
+                    index++;
+                }
+            }
+        }
+        pObject++;
+    }
+    Object_Index_Valid = true;
+    Object_Index_Revision = Database_Revision;
+
+    return true;
+}
+
+/** Tell the Device that an object has been added to its database.
+ * Call this once the object answers to its Object_Name function; it
+ * bumps the Database_Revision and adds the object to the name index.
+ * @param object_type [in] The BACNET_OBJECT_TYPE of the new Object.
+ * @param object_instance [in] The object instance number of the new Object.
+ */
+void Device_Object_Created(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    struct object_functions *pObject = NULL;
+    bool current = false;
+
+    current = Object_Index_Valid &&
+        (Object_Index_Revision == Database_Revision);
+    Database_Revision++;
+    pObject = Device_Objects_Find_Functions(object_type);
+    if (current && pObject && (object_type != OBJECT_DEVICE)) {
+        Object_Index_Remove(object_type, object_instance);
+        if (Object_Index_Insert(pObject, object_instance)) {
+            Object_Index_Revision = Database_Revision;
+        } else {
+            Object_Index_Clear();
+        }
+    }
+}
+
+/** Tell the Device that an object has been removed from its database.
+ * This bumps the Database_Revision and drops the object from the index.
+ * @param object_type [in] The BACNET_OBJECT_TYPE of the deleted Object.
+ * @param object_instance [in] The object instance of the deleted Object.
+ */
+void Device_Object_Deleted(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    bool current = false;
+
+    current = Object_Index_Valid &&
+        (Object_Index_Revision == Database_Revision);
+    Database_Revision++;
+    if (current) {
+        Object_Index_Remove(object_type, object_instance);
+        Object_Index_Revision = Database_Revision;
+    }
+}
+
+/** Tell the Device that the objects behind the Object_Table were swapped,
+ * eg. by a gateway addressing another of its routed Devices.
+ * The index is rebuilt from the new objects when it is next needed.
+ */
+void Device_Objects_Swapped(
+    void)
+{
+    Object_Index_Clear();
+}
+
+static bool Device_Object_Name_Match(
+    struct object_functions *pObject,
+    uint32_t instance,
+    BACNET_CHARACTER_STRING * object_name1,
+    int *object_type,
+    uint32_t * object_instance)
+{
+    BACNET_CHARACTER_STRING object_name2;
+    BACNET_STRING_VIEW name_view;
+
+    if ((pObject != NULL) &&
+        Object_Name_View(pObject, instance, &object_name2, &name_view) &&
+        characterstring_view_same(&name_view, object_name1)) {
+        if (object_type) {
+            *object_type = pObject->Object_Type;
+        }
+        if (object_instance) {
+            *object_instance = instance;
+        }
+        return true;
+    }
+
+    return false;
+}
+
 /** Determine if we have an object with the given object_name.
  * If the object_type and object_instance pointers are not null,
  * and the lookup succeeds, they will be given the resulting values.
@@ -1052,26 +1489,52 @@ bool Device_Valid_Object_Name(
     uint32_t instance;
     unsigned max_objects = 0, i = 0;
     bool check_id = false;
-    BACNET_CHARACTER_STRING object_name2;
+    uint32_t hash = 0;
+    int32_t index = 0;
+    BACNET_STRING_VIEW name_view;
     struct object_functions *pObject = NULL;
 
+    /* the Device object is kept out of the index */
+    pObject = Device_Objects_Find_Functions(OBJECT_DEVICE);
+    if (pObject && pObject->Object_Count && pObject->Object_Index_To_Instance) {
+        max_objects = pObject->Object_Count();
+        for (i = 0; i < max_objects; i++) {
+            if (Device_Object_Name_Match(pObject,
+                    pObject->Object_Index_To_Instance(i), object_name1,
+                    object_type, object_instance)) {
+                return true;
+            }
+        }
+    }
+    if (Object_Index_Update()) {
+        if (Object_Index_Count == 0) {
+            return false;
+        }
+        stringview_init(&name_view, characterstring_encoding(object_name1),
+            (const uint8_t *) characterstring_value(object_name1),
+            characterstring_length(object_name1));
+        hash = Object_Name_Hash(&name_view);
+        index = Object_Name_Buckets[hash & Object_Index_Mask];
+        while (index != OBJECT_INDEX_NONE) {
+            if ((Object_Index[index].name_hash == hash) &&
+                Device_Object_Name_Match(Device_Objects_Find_Functions
+                    (Object_Index[index].type), Object_Index[index].instance,
+                    object_name1, object_type, object_instance)) {
+                return true;
+            }
+            index = Object_Index[index].name_next;
+        }
+        return false;
+    }
+    /* no memory for the index: look at every object */
     max_objects = Device_Object_List_Count();
     for (i = 1; i <= max_objects; i++) {
         check_id = Device_Object_List_Identifier(i, &type, &instance);
-        if (check_id) {
-            pObject = Device_Objects_Find_Functions(type);
-            if ((pObject != NULL) && (pObject->Object_Name != NULL) &&
-                (pObject->Object_Name(instance, &object_name2) &&
-                    characterstring_same(object_name1, &object_name2))) {
-                found = true;
-                if (object_type) {
-                    *object_type = type;
-                }
-                if (object_instance) {
-                    *object_instance = instance;
-                }
-                break;
-            }
+        if (check_id && Device_Object_Name_Match
+            (Device_Objects_Find_Functions(type), instance, object_name1,
+                object_type, object_instance)) {
+            found = true;
+            break;
         }
     }
 
@@ -1391,6 +1854,16 @@ int Device_Read_Property_Local(
         case PROP_NUMBER_OF_APDU_RETRIES:
             apdu_len = encode_application_unsigned(&apdu[0], apdu_retries());
             break;
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+        case PROP_MAX_SEGMENTS_ACCEPTED:
+            apdu_len =
+                encode_application_unsigned(&apdu[0], MAX_SEGMENTS_ACCEPTED);
+            break;
+        case PROP_APDU_SEGMENT_TIMEOUT:
+            apdu_len =
+                encode_application_unsigned(&apdu[0], apdu_segment_timeout());
+            break;
+#endif
         case PROP_DEVICE_ADDRESS_BINDING:
             /* FIXME: the real max apdu remaining should be passed into function */
             apdu_len = address_list_encode(&apdu[0], MAX_APDU);
@@ -1525,6 +1998,16 @@ bool Device_Write_Property_Local(
                 apdu_timeout_set((uint16_t) value.type.Unsigned_Int);
             }
             break;
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+        case PROP_APDU_SEGMENT_TIMEOUT:
+            status =
+                WPValidateArgType(&value, BACNET_APPLICATION_TAG_UNSIGNED_INT,
+                &wp_data->error_class, &wp_data->error_code);
+            if (status) {
+                apdu_segment_timeout_set((uint16_t) value.type.Unsigned_Int);
+            }
+            break;
+#endif
         case PROP_VENDOR_IDENTIFIER:
             status =
                 WPValidateArgType(&value, BACNET_APPLICATION_TAG_UNSIGNED_INT,
@@ -1658,6 +2141,7 @@ bool Device_Write_Property_Local(
         case PROP_OBJECT_LIST:
         case PROP_MAX_APDU_LENGTH_ACCEPTED:
         case PROP_SEGMENTATION_SUPPORTED:
+        case PROP_MAX_SEGMENTS_ACCEPTED:
         case PROP_DEVICE_ADDRESS_BINDING:
         case PROP_DATABASE_REVISION:
         case PROP_ACTIVE_COV_SUBSCRIPTIONS:
@@ -1791,6 +2275,20 @@ void Device_COV_Clear(
     }
 }
 
+/** Tell the Device that the COV flag of an Object has just been set.
+ * The objects call this when their COV flag goes from clear to set, so
+ * that the COV task only visits the objects that changed.
+ * @ingroup ObjHelpers
+ * @param [in] The object type of the changed Object.
+ * @param [in] The object instance of the changed Object.
+ */
+void Device_COV_Changed(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    handler_cov_object_changed(object_type, object_instance);
+}
+
 #if defined(INTRINSIC_REPORTING)
 void Device_local_reporting(
     void)
@@ -1849,6 +2347,39 @@ bool Device_Value_List_Supported(
  *  Each Child Object must provide some implementation of each of these
  *  functions in order to properly support the default handlers.
  */
+/* Without memory for the index, the lists are counted on each use. */
+static void Device_Objects_Property_Index_Init(
+    unsigned count)
+{
+    struct object_functions *pObject = NULL;
+    const int *pRequired = NULL;
+    const int *pOptional = NULL;
+    const int *pProprietary = NULL;
+    unsigned i = 0;
+
+    free(Object_Property_Index);
+    Object_Property_Index = NULL;
+    if (count == 0) {
+        return;
+    }
+    Object_Property_Index =
+        malloc(count * sizeof(struct property_list_index_t));
+    if (Object_Property_Index == NULL) {
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        pObject = &Object_Table[i];
+        pRequired = NULL;
+        pOptional = NULL;
+        pProprietary = NULL;
+        if (pObject->Object_RPM_List) {
+            pObject->Object_RPM_List(&pRequired, &pOptional, &pProprietary);
+        }
+        property_list_index_init(&Object_Property_Index[i], pRequired,
+            pOptional, pProprietary);
+    }
+}
+
 void Device_Init(
     object_functions_t * object_table)
 {
@@ -1860,13 +2391,23 @@ void Device_Init(
     } else {
         Object_Table = &My_Object_Table[0];
     }
+    memset(Object_Type_Index, 0, sizeof(Object_Type_Index));
     pObject = Object_Table;
     while (pObject->Object_Type < MAX_BACNET_OBJECT_TYPE) {
+        if ((pObject->Object_Type < OBJECT_PROPRIETARY_MIN) &&
+            !Object_Type_Index[pObject->Object_Type]) {
+            Object_Type_Index[pObject->Object_Type] = pObject;
+        }
         if (pObject->Object_Init) {
             pObject->Object_Init();
         }
         pObject++;
     }
+    Device_Objects_Property_Index_Init(pObject - Object_Table);
+#if defined(BACNET_PROPERTY_LISTS) && BACNET_PROPERTY_LISTS
+    property_list_init();
+#endif
+    Object_Index_Clear();
 }
 
 bool DeviceGetRRInfo(
@@ -1991,6 +2532,14 @@ int handler_cov_encode_subscriptions(
     return 0;
 }
 
+void handler_cov_object_changed(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    object_type = object_type;
+    object_instance = object_instance;
+}
+
 void testDevice(
     Test * pTest)
 {
@@ -138,6 +138,17 @@ typedef void (
     *object_intrinsic_reporting_function) (
     uint32_t object_instance);
 
+/** Views the Object_Name where the object keeps it, without a copy.
+ * @ingroup ObjHelpers
+ * @param object_instance [in] The object instance number to be looked up.
+ * @param view [out] The name, good until the object is renamed or deleted.
+ * @return True if the object_instance is valid.
+ */
+typedef bool(
+    *object_name_view_function) (
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view);
+
 
 /** Defines the group of object helper functions for any supported Object.
  * @ingroup ObjHelpers
@@ -164,6 +175,8 @@ typedef struct object_functions {
     object_cov_function Object_COV;
     object_cov_clear_function Object_COV_Clear;
     object_intrinsic_reporting_function Object_Intrinsic_Reporting;
+    /* optional, else the names are looked up with copies of Object_Name */
+    object_name_view_function Object_Name_View;
 } object_functions_t;
 
 /* String Lengths - excluding any nul terminator */
@@ -245,6 +258,10 @@ extern "C" {
     void Device_Objects_Property_List(
         BACNET_OBJECT_TYPE object_type,
         struct special_property_list_t *pPropertyList);
+    bool Device_Objects_Property_List_Member(
+        BACNET_OBJECT_TYPE object_type,
+        BACNET_PROPERTY_ID special_property,
+        BACNET_PROPERTY_ID object_property);
     /* functions to support COV */
     bool Device_Encode_Value_List(
         BACNET_OBJECT_TYPE object_type,
@@ -258,6 +275,9 @@ extern "C" {
     void Device_COV_Clear(
         BACNET_OBJECT_TYPE object_type,
         uint32_t object_instance);
+    void Device_COV_Changed(
+        BACNET_OBJECT_TYPE object_type,
+        uint32_t object_instance);
 
     uint32_t Device_Object_Instance_Number(
         void);
@@ -345,6 +365,15 @@ extern "C" {
     void Device_Inc_Database_Revision(
         void);
 
+    void Device_Object_Created(
+        BACNET_OBJECT_TYPE object_type,
+        uint32_t object_instance);
+    void Device_Object_Deleted(
+        BACNET_OBJECT_TYPE object_type,
+        uint32_t object_instance);
+    void Device_Objects_Swapped(
+        void);
+
     bool Device_Valid_Object_Name(
         BACNET_CHARACTER_STRING * object_name,
         int *object_type,
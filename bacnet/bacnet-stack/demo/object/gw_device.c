@@ -27,6 +27,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>     /* for calloc */
 #include <string.h>     /* for memmove */
 #include <time.h>       /* for timezone, localtime */
 #include "bacdef.h"
@@ -106,10 +107,152 @@ uint16_t Num_Managed_Devices = 0;
  */
 uint16_t iCurrent_Device_Idx = 0;
 
+/** The objects of each routed Device.
+ * The gateway Device keeps the objects made by the usual *_Init() calls;
+ * the others start empty and are filled through the same *_Create() calls
+ * once they are addressed.
+ */
+typedef struct routed_device_objects {
+    OBJECT_STORE Analog_Inputs;
+    OBJECT_STORE Analog_Values;
+    OBJECT_STORE Binary_Inputs;
+    OBJECT_STORE Binary_Outputs;
+} ROUTED_DEVICE_OBJECTS;
+static ROUTED_DEVICE_OBJECTS Routed_Objects[MAX_NUM_DEVICES];
+/** The objects, selected by Routed_Device_Select(), of this entry */
+static uint16_t Routed_Objects_Idx = 0;
+
+/** Hash of the MAC addresses of the Devices, so that a message routed to
+ * one of thousands of Devices finds it without a search.
+ * Slots hold the index + 1 of a Device, or 0 when empty.
+ * The MAC addresses are filled in place through the pointers handed out by
+ * Get_Routed_Device_Object() and Get_Routed_Device_Address(), so those mark
+ * the hash as stale and it is rebuilt on the next lookup.
+ */
+static uint16_t *Routed_Address_Hash = NULL;
+static unsigned Routed_Address_Hash_Mask = 0;   /* slots - 1 */
+static bool Routed_Address_Hash_Valid = false;
+
 /* void Routing_Device_Init(uint32_t first_object_instance) is
  * found in device.c
  */
 
+/** Make the indicated entry the Device being managed, and its objects
+ * the ones seen through the Object_Table.
+ * @param idx [in] Index into Devices[] array; 0 is the gateway Device.
+ */
+static void Routed_Device_Select(
+    uint16_t idx)
+{
+    ROUTED_DEVICE_OBJECTS *pObjects = NULL;
+
+    iCurrent_Device_Idx = idx;
+    if (idx == Routed_Objects_Idx) {
+        return;
+    }
+    if (idx > 0) {
+        pObjects = &Routed_Objects[idx];
+    }
+    Analog_Input_Store_Select(pObjects ? &pObjects->Analog_Inputs : NULL);
+    Analog_Value_Store_Select(pObjects ? &pObjects->Analog_Values : NULL);
+    Binary_Input_Store_Select(pObjects ? &pObjects->Binary_Inputs : NULL);
+    Binary_Output_Store_Select(pObjects ? &pObjects->Binary_Outputs : NULL);
+    Routed_Objects_Idx = idx;
+    Device_Objects_Swapped();
+}
+
+static uint32_t Routed_Address_Hash_Key(
+    uint8_t address_len,
+    uint8_t * mac_adress)
+{
+    /* FNV-1a over the octets of the MAC */
+    uint32_t hash = 2166136261UL;
+    uint8_t i;
+
+    for (i = 0; i < address_len; i++) {
+        hash = (hash ^ mac_adress[i]) * 16777619UL;
+    }
+
+    return hash;
+}
+
+/* (re)build the hash from the MAC addresses of all the managed Devices */
+static bool Routed_Address_Hash_Update(
+    void)
+{
+    DEVICE_OBJECT_DATA *pDev = NULL;
+    unsigned slots = 8;
+    unsigned slot = 0;
+    uint16_t idx = 0;
+
+    if (Routed_Address_Hash_Valid) {
+        return true;
+    }
+    /* keep the hash at most half full */
+    while (slots < (2U * Num_Managed_Devices)) {
+        slots <<= 1;
+    }
+    if ((slots - 1) != Routed_Address_Hash_Mask) {
+        free(Routed_Address_Hash);
+        Routed_Address_Hash = calloc(slots, sizeof(uint16_t));
+        if (Routed_Address_Hash == NULL) {
+            Routed_Address_Hash_Mask = 0;
+            return false;
+        }
+        Routed_Address_Hash_Mask = slots - 1;
+    } else {
+        memset(Routed_Address_Hash, 0, slots * sizeof(uint16_t));
+    }
+    for (idx = 0; idx < Num_Managed_Devices; idx++) {
+        pDev = &Devices[idx];
+        slot =
+            Routed_Address_Hash_Key(pDev->bacDevAddr.mac_len,
+            pDev->bacDevAddr.mac) & Routed_Address_Hash_Mask;
+        while (Routed_Address_Hash[slot] != 0) {
+            slot = (slot + 1) & Routed_Address_Hash_Mask;
+        }
+        Routed_Address_Hash[slot] = idx + 1;
+    }
+    Routed_Address_Hash_Valid = true;
+
+    return true;
+}
+
+/** Find the routed Device (not the gateway) at the given MAC address.
+ * @return The index into Devices[], or -1 if no routed Device has it.
+ */
+static int Routed_Address_Find(
+    uint8_t address_len,
+    uint8_t * mac_adress)
+{
+    DEVICE_OBJECT_DATA *pDev = NULL;
+    unsigned slot = 0;
+    uint16_t idx = 0;
+
+    if (!Routed_Address_Hash_Update()) {
+        /* no memory for the hash, so search */
+        for (idx = 1; idx < Num_Managed_Devices; idx++) {
+            if (Routed_Device_Address_Lookup(idx, address_len, mac_adress))
+                return idx;
+        }
+        return -1;
+    }
+    slot =
+        Routed_Address_Hash_Key(address_len,
+        mac_adress) & Routed_Address_Hash_Mask;
+    while (Routed_Address_Hash[slot] != 0) {
+        idx = Routed_Address_Hash[slot] - 1;
+        pDev = &Devices[idx];
+        if ((idx > 0) && (pDev->bacDevAddr.mac_len == address_len) &&
+            (memcmp(pDev->bacDevAddr.mac, mac_adress, address_len) == 0)) {
+            return idx;
+        }
+        slot = (slot + 1) & Routed_Address_Hash_Mask;
+    }
+
+    return -1;
+}
+
 /** Add a Device to our table of Devices[].
  * The first entry must be the gateway device.
  * @param Object_Instance [in] Set the new Device to this instance number.
@@ -127,7 +270,8 @@ uint16_t Add_Routed_Device(
     if (i < MAX_NUM_DEVICES) {
         DEVICE_OBJECT_DATA *pDev = &Devices[i];
         Num_Managed_Devices++;
-        iCurrent_Device_Idx = i;
+        Routed_Address_Hash_Valid = false;
+        Routed_Device_Select(i);
         pDev->bacObj.mObject_Type = OBJECT_DEVICE;
         pDev->bacObj.Object_Instance_Number = Object_Instance;
         if (sObject_Name != NULL)
@@ -161,8 +305,10 @@ DEVICE_OBJECT_DATA *Get_Routed_Device_Object(
 {
     if (idx == -1)
         return &Devices[iCurrent_Device_Idx];
-    else if ((idx >= 0) && (idx < MAX_NUM_DEVICES)) {
-        iCurrent_Device_Idx = idx;
+    else if ((idx >= 0) && (idx < Num_Managed_Devices)) {
+        /* the caller may change the address */
+        Routed_Address_Hash_Valid = false;
+        Routed_Device_Select(idx);
         return &Devices[idx];
     } else
         return NULL;
@@ -182,8 +328,10 @@ BACNET_ADDRESS *Get_Routed_Device_Address(
 {
     if (idx == -1)
         return &Devices[iCurrent_Device_Idx].bacDevAddr;
-    else if ((idx >= 0) && (idx < MAX_NUM_DEVICES)) {
-        iCurrent_Device_Idx = idx;
+    else if ((idx >= 0) && (idx < Num_Managed_Devices)) {
+        /* the caller may change the address */
+        Routed_Address_Hash_Valid = false;
+        Routed_Device_Select(idx);
         return &Devices[idx].bacDevAddr;
     } else
         return NULL;
@@ -231,13 +379,14 @@ bool Routed_Device_Address_Lookup(
     uint8_t * mac_adress)
 {
     bool result = false;
-    DEVICE_OBJECT_DATA *pDev = &Devices[idx];
+    DEVICE_OBJECT_DATA *pDev = NULL;
     int i;
 
-    if ((idx >= 0) && (idx < MAX_NUM_DEVICES)) {
+    if ((idx >= 0) && (idx < Num_Managed_Devices)) {
+        pDev = &Devices[idx];
         if (address_len == 0) {
             /* Automatic match */
-            iCurrent_Device_Idx = idx;
+            Routed_Device_Select(idx);
             result = true;
         } else if (mac_adress != NULL) {
             for (i = 0; i < address_len; i++) {
@@ -245,7 +394,7 @@ bool Routed_Device_Address_Lookup(
                     break;
             }
             if (i == address_len) {     /* Success! */
-                iCurrent_Device_Idx = idx;
+                Routed_Device_Select(idx);
                 result = true;
             }
         }
@@ -292,7 +441,7 @@ bool Routed_Device_GetNext(
     /* First, see if the index is out of range.
      * Eg, last call to GetNext may have been the last successful one.
      */
-    if ((idx < 0) || (idx >= MAX_NUM_DEVICES))
+    if ((idx < 0) || (idx >= Num_Managed_Devices))
         idx = -1;
 
     /* Next, see if it's a BACnet broadcast.
@@ -313,25 +462,31 @@ bool Routed_Device_GetNext(
         /* Next step: no more matches: */
         idx = -1;
     }
-    /* Or if is our virtual DNET, check
-     * against each of our virtually routed Devices.
+    /* Or if is our virtual DNET, look up which of our virtually
+     * routed Devices has the MAC address.
      * If we get a match, have it handle the APDU.
      * For broadcasts, all Devices get a chance at it.
      */
     else if (dest->net == dnet) {
         if (idx == 0)   /* Step over this case (starting point) */
             idx = 1;
-        while (idx < MAX_NUM_DEVICES) {
-            bSuccess =
-                Routed_Device_Address_Lookup(idx++, dest->len, dest->adr);
-            if (bSuccess)
-                break;  /* We don't need to keep looking */
+        if (dest->len == 0) {
+            if (idx < Num_Managed_Devices)
+                bSuccess = Routed_Device_Address_Lookup(idx++, 0, NULL);
+        } else {
+            idx = Routed_Address_Find(dest->len, dest->adr);
+            if (idx > 0) {
+                Routed_Device_Select(idx);
+                bSuccess = true;
+            }
+            /* Only the one Device has the address */
+            idx = Num_Managed_Devices;
         }
     }
 
     if (!bSuccess)
         *cursor = -1;
-    else if (idx == MAX_NUM_DEVICES)    /* No more to GetNext */
+    else if (idx >= Num_Managed_Devices)        /* No more to GetNext */
         *cursor = -1;
     else
         *cursor = idx;
@@ -46,6 +46,9 @@
 #define MAX_LOAD_CONTROLS 4
 #endif
 
+/* the names, set once by the Init */
+static char Load_Control_Names[MAX_LOAD_CONTROLS][64];
+
 /*  indicates the current load shedding state of the object */
 static BACNET_SHED_STATE Present_Value[MAX_LOAD_CONTROLS];
 
@@ -189,6 +192,7 @@ void Load_Control_Init(
     unsigned i, j;
 
     for (i = 0; i < MAX_LOAD_CONTROLS; i++) {
+        sprintf(Load_Control_Names[i], "LOAD CONTROL %u", i);
         /* FIXME: load saved data? */
         Present_Value[i] = BACNET_SHED_INACTIVE;
         Requested_Shed_Level[i].type = BACNET_SHED_TYPE_LEVEL;
@@ -276,17 +280,32 @@ bool Load_Control_Object_Name(
     uint32_t object_instance,
     BACNET_CHARACTER_STRING * object_name)
 {
-    static char text_string[32] = "";   /* okay for single thread */
     bool status = false;
 
     if (object_instance < MAX_LOAD_CONTROLS) {
-        sprintf(text_string, "LOAD CONTROL %u", object_instance);
-        status = characterstring_init_ansi(object_name, text_string);
+        status =
+            characterstring_init_ansi(object_name,
+            Load_Control_Names[object_instance]);
     }
 
     return status;
 }
 
+/* the name left in place, see BACNET_STRING_VIEW; false if not found */
+bool Load_Control_Object_Name_View(
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view)
+{
+    const char *name = NULL;
+
+    if (object_instance < MAX_LOAD_CONTROLS) {
+        name = Load_Control_Names[object_instance];
+    }
+    stringview_init_ansi(view, name);
+
+    return (name != NULL);
+}
+
 static void Update_Current_Time(
     BACNET_DATE_TIME * bdatetime)
 {
@@ -688,6 +707,7 @@ int Load_Control_Read_Property(
     int apdu_len = 0;   /* return value */
     BACNET_BIT_STRING bit_string;
     BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     int enumeration = 0;
     unsigned object_index = 0;
     unsigned i = 0;
@@ -708,9 +728,10 @@ int Load_Control_Read_Property(
             break;
         case PROP_OBJECT_NAME:
         case PROP_DESCRIPTION:
-            Load_Control_Object_Name(rpdata->object_instance, &char_string);
+            Load_Control_Object_Name_View(rpdata->object_instance, &name_view);
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
         case PROP_OBJECT_TYPE:
             apdu_len =
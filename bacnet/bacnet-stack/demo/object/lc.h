@@ -55,6 +55,9 @@ extern "C" {
     bool Load_Control_Object_Name(
         uint32_t object_instance,
         BACNET_CHARACTER_STRING * object_name);
+    bool Load_Control_Object_Name_View(
+        uint32_t object_instance,
+        BACNET_STRING_VIEW * view);
 
     void Load_Control_Init(
         void);
@@ -63,6 +63,9 @@ typedef struct LightingCommand {
     uint16_t duration;  /* 1..65535 minutes until relinquish, 0=not used */
 } BACNET_LIGHTING_COMMAND;
 
+/* the names, set once by the Init */
+static char Lighting_Output_Names[MAX_LIGHTING_OUTPUTS][64];
+
 /* Here is our Priority Array.  They are supposed to be Real, but */
 /* we might not have that kind of memory, so we will use a single byte */
 /* and load a Real for returning the value when asked. */
@@ -179,6 +182,7 @@ void Lighting_Output_Init(
 
     /* initialize all the analog output priority arrays to NULL */
     for (i = 0; i < MAX_LIGHTING_OUTPUTS; i++) {
+        sprintf(Lighting_Output_Names[i], "LIGHTING OUTPUT %u", i);
         for (j = 0; j < BACNET_MAX_PRIORITY; j++) {
             Lighting_Output_Level[i][j] = LIGHTING_LEVEL_NULL;
         }
@@ -345,11 +349,8 @@ float Lighting_Output_Tracking_Value(
 char *Lighting_Output_Name(
     uint32_t object_instance)
 {
-    static char text_string[32] = "";   /* okay for single thread */
-
     if (object_instance < MAX_LIGHTING_OUTPUTS) {
-        sprintf(text_string, "LIGHTING OUTPUT %u", object_instance);
-        return text_string;
+        return Lighting_Output_Names[object_instance];
     }
 
     return NULL;
@@ -362,7 +363,7 @@ int Lighting_Output_Read_Property(
     int len = 0;
     int apdu_len = 0;   /* return value */
     BACNET_BIT_STRING bit_string;
-    BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     float real_value = (float) 1.414;
     unsigned object_index = 0;
     unsigned i = 0;
@@ -384,10 +385,11 @@ int Lighting_Output_Read_Property(
         case PROP_DESCRIPTION:
             /* object name must be unique in this device. */
             /* FIXME: description could be writable and different than object name */
-            characterstring_init_ansi(&char_string,
+            stringview_init_ansi(&name_view,
                 Lighting_Output_Name(rpdata->object_instance));
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
         case PROP_OBJECT_TYPE:
             apdu_len =
@@ -42,6 +42,9 @@
 #define MAX_LIFE_SAFETY_POINTS 7
 #endif
 
+/* the names, set once by the Init */
+static char Life_Safety_Point_Names[MAX_LIFE_SAFETY_POINTS][64];
+
 /* Here are our stored levels.*/
 static BACNET_LIFE_SAFETY_MODE Life_Safety_Point_Mode[MAX_LIFE_SAFETY_POINTS];
 static BACNET_LIFE_SAFETY_STATE
@@ -107,6 +110,7 @@ void Life_Safety_Point_Init(
 
         /* initialize all the analog output priority arrays to NULL */
         for (i = 0; i < MAX_LIFE_SAFETY_POINTS; i++) {
+            sprintf(Life_Safety_Point_Names[i], "LS POINT %u", i);
             Life_Safety_Point_Mode[i] = LIFE_SAFETY_MODE_DEFAULT;
             Life_Safety_Point_State[i] = LIFE_SAFETY_STATE_QUIET;
             Life_Safety_Point_Silenced_State[i] = SILENCED_STATE_UNSILENCED;
@@ -178,17 +182,32 @@ bool Life_Safety_Point_Object_Name(
     uint32_t object_instance,
     BACNET_CHARACTER_STRING * object_name)
 {
-    static char text_string[32] = "";   /* okay for single thread */
     bool status = false;
 
     if (object_instance < MAX_LIFE_SAFETY_POINTS) {
-        sprintf(text_string, "LS POINT %u", object_instance);
-        status = characterstring_init_ansi(object_name, text_string);
+        status =
+            characterstring_init_ansi(object_name,
+            Life_Safety_Point_Names[object_instance]);
     }
 
     return status;
 }
 
+/* the name left in place, see BACNET_STRING_VIEW; false if not found */
+bool Life_Safety_Point_Object_Name_View(
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view)
+{
+    const char *name = NULL;
+
+    if (object_instance < MAX_LIFE_SAFETY_POINTS) {
+        name = Life_Safety_Point_Names[object_instance];
+    }
+    stringview_init_ansi(view, name);
+
+    return (name != NULL);
+}
+
 /* return apdu len, or BACNET_STATUS_ERROR on error */
 int Life_Safety_Point_Read_Property(
     BACNET_READ_PROPERTY_DATA * rpdata)
@@ -196,7 +215,7 @@ int Life_Safety_Point_Read_Property(
     int len = 0;
     int apdu_len = 0;   /* return value */
     BACNET_BIT_STRING bit_string;
-    BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     BACNET_LIFE_SAFETY_STATE present_value = LIFE_SAFETY_STATE_QUIET;
     BACNET_LIFE_SAFETY_MODE mode = LIFE_SAFETY_MODE_DEFAULT;
     BACNET_SILENCED_STATE silenced_state = SILENCED_STATE_UNSILENCED;
@@ -219,10 +238,11 @@ int Life_Safety_Point_Read_Property(
             break;
         case PROP_OBJECT_NAME:
         case PROP_DESCRIPTION:
-            Life_Safety_Point_Object_Name(rpdata->object_instance,
-                &char_string);
+            Life_Safety_Point_Object_Name_View(rpdata->object_instance,
+                &name_view);
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
         case PROP_OBJECT_TYPE:
             apdu_len =
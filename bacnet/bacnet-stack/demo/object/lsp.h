@@ -51,6 +51,9 @@ extern "C" {
     bool Life_Safety_Point_Object_Name(
         uint32_t object_instance,
         BACNET_CHARACTER_STRING * object_name);
+    bool Life_Safety_Point_Object_Name_View(
+        uint32_t object_instance,
+        BACNET_STRING_VIEW * view);
     void Life_Safety_Point_Init(
         void);
 
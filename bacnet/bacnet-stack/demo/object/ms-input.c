@@ -340,6 +340,7 @@ bool Multistate_Input_Name_Set(
                 Object_Name[index][i] = 0;
             }
         }
+        Device_Inc_Database_Revision();
     }
 
     return status;
@@ -365,7 +366,9 @@ static bool Multistate_Input_Object_Name_Write(
                 status =
                     characterstring_ansi_copy(Object_Name[index],
                     sizeof(Object_Name[index]), char_string);
-                if (!status) {
+                if (status) {
+                    Device_Inc_Database_Revision();
+                } else {
                     *error_class = ERROR_CLASS_PROPERTY;
                     *error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
                 }
@@ -794,6 +797,11 @@ bool Device_Valid_Object_Name(
     return true;
 }
 
+void Device_Inc_Database_Revision(
+    void)
+{
+}
+
 bool WPValidateArgType(
     BACNET_APPLICATION_DATA_VALUE * pValue,
     uint8_t ucExpectedTag,
@@ -53,6 +53,10 @@
 /* Here is our Priority Array.*/
 static uint8_t
     Multistate_Output_Level[MAX_MULTISTATE_OUTPUTS][BACNET_MAX_PRIORITY];
+
+/* the names, set once by the Init */
+static char Multistate_Output_Names[MAX_MULTISTATE_OUTPUTS][64];
+
 /* Writable out-of-service allows others to play with our Present Value */
 /* without changing the physical output */
 static bool Multistate_Output_Out_Of_Service[MAX_MULTISTATE_OUTPUTS];
@@ -107,6 +111,7 @@ void Multistate_Output_Init(
 
         /* initialize all the analog output priority arrays to NULL */
         for (i = 0; i < MAX_MULTISTATE_OUTPUTS; i++) {
+            sprintf(Multistate_Output_Names[i], "MULTISTATE OUTPUT %u", i);
             for (j = 0; j < BACNET_MAX_PRIORITY; j++) {
                 Multistate_Output_Level[i][j] = MULTISTATE_NULL;
             }
@@ -184,17 +189,32 @@ bool Multistate_Output_Object_Name(
     uint32_t object_instance,
     BACNET_CHARACTER_STRING * object_name)
 {
-    static char text_string[32] = "";   /* okay for single thread */
     bool status = false;
 
     if (object_instance < MAX_MULTISTATE_OUTPUTS) {
-        sprintf(text_string, "MULTISTATE OUTPUT %u", object_instance);
-        status = characterstring_init_ansi(object_name, text_string);
+        status =
+            characterstring_init_ansi(object_name,
+            Multistate_Output_Names[object_instance]);
     }
 
     return status;
 }
 
+/* the name left in place, see BACNET_STRING_VIEW; false if not found */
+bool Multistate_Output_Object_Name_View(
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view)
+{
+    const char *name = NULL;
+
+    if (object_instance < MAX_MULTISTATE_OUTPUTS) {
+        name = Multistate_Output_Names[object_instance];
+    }
+    stringview_init_ansi(view, name);
+
+    return (name != NULL);
+}
+
 /* return apdu len, or BACNET_STATUS_ERROR on error */
 int Multistate_Output_Read_Property(
     BACNET_READ_PROPERTY_DATA * rpdata)
@@ -202,7 +222,7 @@ int Multistate_Output_Read_Property(
     int len = 0;
     int apdu_len = 0;   /* return value */
     BACNET_BIT_STRING bit_string;
-    BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     uint32_t present_value = 0;
     unsigned object_index = 0;
     unsigned i = 0;
@@ -224,10 +244,11 @@ int Multistate_Output_Read_Property(
                You could make Description writable and different */
         case PROP_OBJECT_NAME:
         case PROP_DESCRIPTION:
-            Multistate_Output_Object_Name(rpdata->object_instance,
-                &char_string);
+            Multistate_Output_Object_Name_View(rpdata->object_instance,
+                &name_view);
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
         case PROP_OBJECT_TYPE:
             apdu_len =
@@ -52,6 +52,9 @@ extern "C" {
     bool Multistate_Output_Object_Name(
         uint32_t object_instance,
         BACNET_CHARACTER_STRING * object_name);
+    bool Multistate_Output_Object_Name_View(
+        uint32_t object_instance,
+        BACNET_STRING_VIEW * view);
 
     void Multistate_Output_Init(
         void);
@@ -48,6 +48,9 @@
 
 
 #if defined(INTRINSIC_REPORTING)
+/* the names, set once by the Init */
+static char Notification_Class_Names[MAX_NOTIFICATION_CLASSES][64];
+
 static NOTIFICATION_CLASS_INFO NC_Info[MAX_NOTIFICATION_CLASSES];
 
 /* These three arrays are used by the ReadPropertyMultiple handler */
@@ -91,6 +94,8 @@ void Notification_Class_Init(
     uint8_t NotifyIdx = 0;
 
     for (NotifyIdx = 0; NotifyIdx < MAX_NOTIFICATION_CLASSES; NotifyIdx++) {
+        sprintf(Notification_Class_Names[NotifyIdx], "NOTIFICATION CLASS %u",
+            (unsigned) NotifyIdx);
         /* init with zeros */
         memset(&NC_Info[NotifyIdx], 0x00, sizeof(NOTIFICATION_CLASS_INFO));
         /* set the basic parameters */
@@ -154,26 +159,43 @@ bool Notification_Class_Object_Name(
     uint32_t object_instance,
     BACNET_CHARACTER_STRING * object_name)
 {
-    static char text_string[32] = "";   /* okay for single thread */
-    unsigned int index;
+    unsigned index = 0;
     bool status = false;
 
     index = Notification_Class_Instance_To_Index(object_instance);
     if (index < MAX_NOTIFICATION_CLASSES) {
-        sprintf(text_string, "NOTIFICATION CLASS %lu", (unsigned long) index);
-        status = characterstring_init_ansi(object_name, text_string);
+        status =
+            characterstring_init_ansi(object_name,
+            Notification_Class_Names[index]);
     }
 
     return status;
 }
 
+/* the name left in place, see BACNET_STRING_VIEW; false if not found */
+bool Notification_Class_Object_Name_View(
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view)
+{
+    unsigned index = 0;
+    const char *name = NULL;
+
+    index = Notification_Class_Instance_To_Index(object_instance);
+    if (index < MAX_NOTIFICATION_CLASSES) {
+        name = Notification_Class_Names[index];
+    }
+    stringview_init_ansi(view, name);
+
+    return (name != NULL);
+}
+
 
 
 int Notification_Class_Read_Property(
     BACNET_READ_PROPERTY_DATA * rpdata)
 {
     NOTIFICATION_CLASS_INFO *CurrentNotify;
-    BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     BACNET_OCTET_STRING octet_string;
     BACNET_BIT_STRING bit_string;
     uint8_t *apdu = NULL;
@@ -201,10 +223,11 @@ int Notification_Class_Read_Property(
 
         case PROP_OBJECT_NAME:
         case PROP_DESCRIPTION:
-            Notification_Class_Object_Name(rpdata->object_instance,
-                &char_string);
+            Notification_Class_Object_Name_View(rpdata->object_instance,
+                &name_view);
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
 
         case PROP_OBJECT_TYPE:
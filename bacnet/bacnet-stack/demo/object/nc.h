@@ -116,6 +116,9 @@ BACnetRecipient ::= CHOICE {
     bool Notification_Class_Object_Name(
         uint32_t object_instance,
         BACNET_CHARACTER_STRING * object_name);
+    bool Notification_Class_Object_Name_View(
+        uint32_t object_instance,
+        BACNET_STRING_VIEW * view);
 
     int Notification_Class_Read_Property(
         BACNET_READ_PROPERTY_DATA * rpdata);
@@ -0,0 +1,361 @@
+/**************************************************************************
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*********************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "objstore.h"
+
+/** @file objstore.c  Runtime store of the objects of one type */
+
+static unsigned Object_Store_Hash(
+    uint32_t object_instance)
+{
+    uint32_t hash = object_instance * 2654435761UL;
+
+    return hash ^ (hash >> 16);
+}
+
+/* slot holding the instance, or the empty slot where it would go */
+static unsigned Object_Store_Slot(
+    OBJECT_STORE * store,
+    uint32_t object_instance)
+{
+    unsigned slot = Object_Store_Hash(object_instance) & store->hash_mask;
+
+    while (store->hash[slot] &&
+        (store->instances[store->hash[slot] - 1] != object_instance)) {
+        slot = (slot + 1) & store->hash_mask;
+    }
+
+    return slot;
+}
+
+static bool Object_Store_Rehash(
+    OBJECT_STORE * store,
+    unsigned slots)
+{
+    uint32_t *hash;
+    unsigned i;
+
+    hash = calloc(slots, sizeof(uint32_t));
+    if (!hash) {
+        return false;
+    }
+    free(store->hash);
+    store->hash = hash;
+    store->hash_mask = slots - 1;
+    for (i = 0; i < store->count; i++) {
+        store->hash[Object_Store_Slot(store, store->instances[i])] = i + 1;
+    }
+
+    return true;
+}
+
+/* add one slab, keeping the hash at most half full */
+static bool Object_Store_Grow(
+    OBJECT_STORE * store)
+{
+    unsigned capacity = store->capacity + OBJECT_STORE_SLAB_SIZE;
+    unsigned slabs = capacity / OBJECT_STORE_SLAB_SIZE;
+    uint8_t **slab_list;
+    uint32_t *instances;
+    unsigned slots;
+
+    slab_list = realloc(store->slabs, slabs * sizeof(uint8_t *));
+    if (!slab_list) {
+        return false;
+    }
+    store->slabs = slab_list;
+    instances = realloc(store->instances, capacity * sizeof(uint32_t));
+    if (!instances) {
+        return false;
+    }
+    store->instances = instances;
+    slots = store->hash_mask + 1;
+    if (!store->hash || (slots < (capacity * 2))) {
+        for (slots = 1; slots < (capacity * 2); slots <<= 1) {
+            /* next power of two */
+        }
+        if (!Object_Store_Rehash(store, slots)) {
+            return false;
+        }
+    }
+    store->slabs[slabs - 1] =
+        malloc(OBJECT_STORE_SLAB_SIZE * store->element_size);
+    if (!store->slabs[slabs - 1]) {
+        return false;
+    }
+    store->capacity = capacity;
+
+    return true;
+}
+
+void Object_Store_Init(
+    OBJECT_STORE * store,
+    size_t element_size)
+{
+    memset(store, 0, sizeof(OBJECT_STORE));
+    store->element_size = element_size;
+}
+
+void Object_Store_Cleanup(
+    OBJECT_STORE * store)
+{
+    unsigned i;
+
+    for (i = 0; i < (store->capacity / OBJECT_STORE_SLAB_SIZE); i++) {
+        free(store->slabs[i]);
+    }
+    free(store->slabs);
+    free(store->instances);
+    free(store->hash);
+    Object_Store_Init(store, store->element_size);
+}
+
+/** Add an object to the store.
+ * @param store [in] The store of the object type.
+ * @param object_instance [in] Instance number of the new object.
+ * @return The zeroed descriptor of the new object, or NULL if the
+ *         instance is already in the store or there is no memory.
+ */
+void *Object_Store_Add(
+    OBJECT_STORE * store,
+    uint32_t object_instance)
+{
+    void *element;
+    unsigned slot;
+
+    if (store->count && Object_Store_Find(store, object_instance)) {
+        return NULL;
+    }
+    if ((store->count == store->capacity) && !Object_Store_Grow(store)) {
+        return NULL;
+    }
+    store->instances[store->count] = object_instance;
+    slot = Object_Store_Slot(store, object_instance);
+    store->hash[slot] = store->count + 1;
+    element = Object_Store_Element(store, store->count);
+    memset(element, 0, store->element_size);
+    store->count++;
+
+    return element;
+}
+
+/** Remove an object from the store.
+ * The last object of the store takes the index of the removed one.
+ * @param store [in] The store of the object type.
+ * @param object_instance [in] Instance number of the object.
+ * @return True if the object was in the store.
+ */
+bool Object_Store_Remove(
+    OBJECT_STORE * store,
+    uint32_t object_instance)
+{
+    unsigned slot;
+    unsigned next;
+    unsigned home;
+    unsigned index;
+    unsigned last;
+
+    if (store->count == 0) {
+        return false;
+    }
+    slot = Object_Store_Slot(store, object_instance);
+    if (!store->hash[slot]) {
+        return false;
+    }
+    index = store->hash[slot] - 1;
+    /* close the gap in the probe sequence */
+    store->hash[slot] = 0;
+    next = (slot + 1) & store->hash_mask;
+    while (store->hash[next]) {
+        home =
+            Object_Store_Hash(store->instances[store->hash[next] -
+                1]) & store->hash_mask;
+        if (((next - home) & store->hash_mask) >=
+            ((next - slot) & store->hash_mask)) {
+            store->hash[slot] = store->hash[next];
+            store->hash[next] = 0;
+            slot = next;
+        }
+        next = (next + 1) & store->hash_mask;
+    }
+    /* move the last object into the hole */
+    last = store->count - 1;
+    if (index != last) {
+        memcpy(Object_Store_Element(store, index), Object_Store_Element(store,
+                last), store->element_size);
+        store->instances[index] = store->instances[last];
+        store->hash[Object_Store_Slot(store, store->instances[index])] =
+            index + 1;
+    }
+    store->count--;
+
+    return true;
+}
+
+unsigned Object_Store_Count(
+    OBJECT_STORE * store)
+{
+    return store->count;
+}
+
+/** Find the index of an object.
+ * @return The index, or the count of objects if there is no such
+ *         instance, so that a check of index < count is enough.
+ */
+unsigned Object_Store_Index(
+    OBJECT_STORE * store,
+    uint32_t object_instance)
+{
+    unsigned slot;
+
+    if (store->count == 0) {
+        return 0;
+    }
+    slot = Object_Store_Slot(store, object_instance);
+    if (store->hash[slot]) {
+        return store->hash[slot] - 1;
+    }
+
+    return store->count;
+}
+
+uint32_t Object_Store_Instance(
+    OBJECT_STORE * store,
+    unsigned index)
+{
+    if (index < store->count) {
+        return store->instances[index];
+    }
+
+    return UINT32_MAX;
+}
+
+void *Object_Store_Element(
+    OBJECT_STORE * store,
+    unsigned index)
+{
+    return store->slabs[index >> OBJECT_STORE_SLAB_BITS] +
+        ((index & (OBJECT_STORE_SLAB_SIZE - 1)) * store->element_size);
+}
+
+void *Object_Store_Find(
+    OBJECT_STORE * store,
+    uint32_t object_instance)
+{
+    unsigned index = Object_Store_Index(store, object_instance);
+
+    if (index < store->count) {
+        return Object_Store_Element(store, index);
+    }
+
+    return NULL;
+}
+
+#ifdef TEST
+#include <assert.h>
+#include "ctest.h"
+
+typedef struct test_object {
+    uint32_t instance;
+    float value;
+} TEST_OBJECT;
+
+void testObjectStore(
+    Test * pTest)
+{
+    OBJECT_STORE store;
+    TEST_OBJECT *pObject;
+    const unsigned max_objects = 50000;
+    unsigned i;
+    uint32_t instance;
+
+    Object_Store_Init(&store, sizeof(TEST_OBJECT));
+    ct_test(pTest, Object_Store_Count(&store) == 0);
+    ct_test(pTest, Object_Store_Find(&store, 0) == NULL);
+    ct_test(pTest, Object_Store_Index(&store, 0) == 0);
+    ct_test(pTest, Object_Store_Remove(&store, 0) == false);
+    /* sparse instance numbers, as a gateway would have them */
+    for (i = 0; i < max_objects; i++) {
+        instance = i * 7919;
+        pObject = Object_Store_Add(&store, instance);
+        ct_test(pTest, pObject != NULL);
+        pObject->instance = instance;
+        pObject->value = (float) i;
+    }
+    ct_test(pTest, Object_Store_Count(&store) == max_objects);
+    ct_test(pTest, Object_Store_Add(&store, 7919) == NULL);
+    for (i = 0; i < max_objects; i++) {
+        instance = i * 7919;
+        pObject = Object_Store_Find(&store, instance);
+        ct_test(pTest, pObject && (pObject->instance == instance));
+        ct_test(pTest, Object_Store_Instance(&store, Object_Store_Index(&store,
+                    instance)) == instance);
+    }
+    ct_test(pTest, Object_Store_Find(&store, 1) == NULL);
+    ct_test(pTest, Object_Store_Index(&store, 1) == max_objects);
+    /* delete every other object, the rest stay reachable */
+    for (i = 0; i < max_objects; i += 2) {
+        ct_test(pTest, Object_Store_Remove(&store, i * 7919));
+    }
+    ct_test(pTest, Object_Store_Count(&store) == (max_objects / 2));
+    for (i = 0; i < max_objects; i++) {
+        pObject = Object_Store_Find(&store, i * 7919);
+        if (i & 1) {
+            ct_test(pTest, pObject && (pObject->instance == i * 7919));
+        } else {
+            ct_test(pTest, pObject == NULL);
+        }
+    }
+    for (i = 0; i < Object_Store_Count(&store); i++) {
+        pObject = Object_Store_Element(&store, i);
+        ct_test(pTest, pObject->instance == Object_Store_Instance(&store, i));
+    }
+    Object_Store_Cleanup(&store);
+    ct_test(pTest, Object_Store_Count(&store) == 0);
+    ct_test(pTest, Object_Store_Find(&store, 7919) == NULL);
+}
+
+#ifdef TEST_OBJECT_STORE
+int main(
+    void)
+{
+    Test *pTest;
+    bool rc;
+
+    pTest = ct_create("BACnet Object Store", NULL);
+    /* individual tests */
+    rc = ct_addTestFunction(pTest, testObjectStore);
+    assert(rc);
+
+    ct_setStream(pTest, stdout);
+    ct_run(pTest);
+    (void) ct_report(pTest);
+    ct_destroy(pTest);
+
+    return 0;
+}
+#endif /* TEST_OBJECT_STORE */
+#endif /* TEST */
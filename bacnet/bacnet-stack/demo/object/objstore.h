@@ -0,0 +1,94 @@
+/**************************************************************************
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*********************************************************************/
+#ifndef OBJSTORE_H
+#define OBJSTORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Objects are kept in slabs of 2^OBJECT_STORE_SLAB_BITS descriptors.
+   Slabs never move, so growing the store is cheap, and the descriptors
+   of a type are dense for sweeps such as COV detection. */
+#ifndef OBJECT_STORE_SLAB_BITS
+#define OBJECT_STORE_SLAB_BITS 8
+#endif
+#define OBJECT_STORE_SLAB_SIZE (1U << OBJECT_STORE_SLAB_BITS)
+
+/** Runtime store for the objects of one type.
+ * Index 0..count-1 is dense: deleting an object moves the last object
+ * into its place, so an index is only good until the next delete.
+ * Instance numbers are found through an open addressed hash.
+ */
+typedef struct object_store {
+    size_t element_size;
+    unsigned count;     /* objects in the store */
+    unsigned capacity;  /* descriptors in the allocated slabs */
+    uint8_t **slabs;
+    uint32_t *instances;        /* instance number of each index */
+    uint32_t *hash;     /* index + 1 of each slot, 0 if empty */
+    unsigned hash_mask; /* hash slots - 1 */
+} OBJECT_STORE;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    void Object_Store_Init(
+        OBJECT_STORE * store,
+        size_t element_size);
+    void Object_Store_Cleanup(
+        OBJECT_STORE * store);
+
+    void *Object_Store_Add(
+        OBJECT_STORE * store,
+        uint32_t object_instance);
+    bool Object_Store_Remove(
+        OBJECT_STORE * store,
+        uint32_t object_instance);
+
+    unsigned Object_Store_Count(
+        OBJECT_STORE * store);
+    unsigned Object_Store_Index(
+        OBJECT_STORE * store,
+        uint32_t object_instance);
+    uint32_t Object_Store_Instance(
+        OBJECT_STORE * store,
+        unsigned index);
+    void *Object_Store_Element(
+        OBJECT_STORE * store,
+        unsigned index);
+    void *Object_Store_Find(
+        OBJECT_STORE * store,
+        uint32_t object_instance);
+
+#ifdef TEST
+#include "ctest.h"
+    void testObjectStore(
+        Test * pTest);
+#endif
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif
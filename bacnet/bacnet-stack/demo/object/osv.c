@@ -47,6 +47,9 @@
 
 OCTETSTRING_VALUE_DESCR AV_Descr[MAX_OCTETSTRING_VALUES];
 
+/* the names, set once by the Init */
+static char OctetString_Value_Names[MAX_OCTETSTRING_VALUES][64];
+
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int OctetString_Value_Properties_Required[] = {
     PROP_OBJECT_IDENTIFIER,
@@ -87,6 +90,7 @@ void OctetString_Value_Init(void)
     unsigned i;
 
     for (i = 0; i < MAX_OCTETSTRING_VALUES; i++) {
+        sprintf(OctetString_Value_Names[i], "OCTETSTRING VALUE %u", i);
         memset(&AV_Descr[i], 0x00, sizeof(OCTETSTRING_VALUE_DESCR));
         octetstring_init(&AV_Descr[i].Present_Value, NULL, 0);
     }
@@ -170,27 +174,42 @@ BACNET_OCTET_STRING *OctetString_Value_Present_Value(uint32_t object_instance)
 }
 
 /* note: the object name must be unique within this device */
-bool OctetString_Value_Object_Name(uint32_t object_instance,
+bool OctetString_Value_Object_Name(
+    uint32_t object_instance,
     BACNET_CHARACTER_STRING * object_name)
 {
-    static char text_string[32] = "";   /* okay for single thread */
     bool status = false;
 
     if (object_instance < MAX_OCTETSTRING_VALUES) {
-        sprintf(text_string, "OCTETSTRING VALUE %lu",
-            (unsigned long) object_instance);
-        status = characterstring_init_ansi(object_name, text_string);
+        status =
+            characterstring_init_ansi(object_name,
+            OctetString_Value_Names[object_instance]);
     }
 
     return status;
 }
 
+/* the name left in place, see BACNET_STRING_VIEW; false if not found */
+bool OctetString_Value_Object_Name_View(
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view)
+{
+    const char *name = NULL;
+
+    if (object_instance < MAX_OCTETSTRING_VALUES) {
+        name = OctetString_Value_Names[object_instance];
+    }
+    stringview_init_ansi(view, name);
+
+    return (name != NULL);
+}
+
 /* return apdu len, or BACNET_STATUS_ERROR on error */
 int OctetString_Value_Read_Property(BACNET_READ_PROPERTY_DATA * rpdata)
 {
     int apdu_len = 0;   /* return value */
     BACNET_BIT_STRING bit_string;
-    BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     BACNET_OCTET_STRING *real_value = NULL;
     unsigned object_index = 0;
     bool state = false;
@@ -220,10 +239,11 @@ int OctetString_Value_Read_Property(BACNET_READ_PROPERTY_DATA * rpdata)
 
         case PROP_OBJECT_NAME:
         case PROP_DESCRIPTION:
-            OctetString_Value_Object_Name(rpdata->object_instance,
-                &char_string);
+            OctetString_Value_Object_Name_View(rpdata->object_instance,
+                &name_view);
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
 
         case PROP_OBJECT_TYPE:
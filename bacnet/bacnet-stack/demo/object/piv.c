@@ -47,6 +47,9 @@
 
 POSITIVEINTEGER_VALUE_DESCR PIV_Descr[MAX_POSITIVEINTEGER_VALUES];
 
+/* the names, set once by the Init */
+static char PositiveInteger_Value_Names[MAX_POSITIVEINTEGER_VALUES][64];
+
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int PositiveInteger_Value_Properties_Required[] = {
     PROP_OBJECT_IDENTIFIER,
@@ -85,6 +88,7 @@ void PositiveInteger_Value_Init(void)
     unsigned i;
 
     for (i = 0; i < MAX_POSITIVEINTEGER_VALUES; i++) {
+        sprintf(PositiveInteger_Value_Names[i], "POSITIVEINTEGER VALUE %u", i);
         memset(&PIV_Descr[i], 0x00, sizeof(POSITIVEINTEGER_VALUE_DESCR));
     }
 }
@@ -167,27 +171,42 @@ uint32_t PositiveInteger_Value_Present_Value(uint32_t object_instance)
 }
 
 /* note: the object name must be unique within this device */
-bool PositiveInteger_Value_Object_Name(uint32_t object_instance,
+bool PositiveInteger_Value_Object_Name(
+    uint32_t object_instance,
     BACNET_CHARACTER_STRING * object_name)
 {
-    static char text_string[32] = "";   /* okay for single thread */
     bool status = false;
 
     if (object_instance < MAX_POSITIVEINTEGER_VALUES) {
-        sprintf(text_string, "POSITIVEINTEGER VALUE %lu",
-            (unsigned long) object_instance);
-        status = characterstring_init_ansi(object_name, text_string);
+        status =
+            characterstring_init_ansi(object_name,
+            PositiveInteger_Value_Names[object_instance]);
     }
 
     return status;
 }
 
+/* the name left in place, see BACNET_STRING_VIEW; false if not found */
+bool PositiveInteger_Value_Object_Name_View(
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view)
+{
+    const char *name = NULL;
+
+    if (object_instance < MAX_POSITIVEINTEGER_VALUES) {
+        name = PositiveInteger_Value_Names[object_instance];
+    }
+    stringview_init_ansi(view, name);
+
+    return (name != NULL);
+}
+
 /* return apdu len, or BACNET_STATUS_ERROR on error */
 int PositiveInteger_Value_Read_Property(BACNET_READ_PROPERTY_DATA * rpdata)
 {
     int apdu_len = 0;   /* return value */
     BACNET_BIT_STRING bit_string;
-    BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     unsigned object_index = 0;
     bool state = false;
     uint8_t *apdu = NULL;
@@ -215,10 +234,11 @@ int PositiveInteger_Value_Read_Property(BACNET_READ_PROPERTY_DATA * rpdata)
             break;
 
         case PROP_OBJECT_NAME:
-            PositiveInteger_Value_Object_Name(rpdata->object_instance,
-                &char_string);
+            PositiveInteger_Value_Object_Name_View(rpdata->object_instance,
+                &name_view);
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
 
         case PROP_OBJECT_TYPE:
@@ -53,6 +53,8 @@ extern "C" {
 
     bool PositiveInteger_Value_Object_Name(uint32_t object_instance,
         BACNET_CHARACTER_STRING * object_name);
+    bool PositiveInteger_Value_Object_Name_View(uint32_t object_instance,
+        BACNET_STRING_VIEW * view);
 
     int PositiveInteger_Value_Read_Property(BACNET_READ_PROPERTY_DATA *
         rpdata);
@@ -25,6 +25,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include "bacdef.h"
 #include "bacdcode.h"
@@ -41,8 +42,21 @@
 #define MAX_SCHEDULES 4
 #endif
 
+#if (MAX_SCHEDULES >= 0xFFFF)
+#error "MAX_SCHEDULES must be less than 65535"
+#endif
+
 SCHEDULE_DESCR Schedule_Descr[MAX_SCHEDULES];
 
+/* the names, set once by the Init */
+static char Schedule_Names[MAX_SCHEDULES][64];
+
+/* The schedules are kept in a heap ordered by their next transition, so
+   the timer only recalculates those whose Present Value changes now. */
+static uint16_t Schedule_Heap[MAX_SCHEDULES];
+/* index + 1 of each schedule in the heap */
+static uint16_t Schedule_Heap_Position[MAX_SCHEDULES];
+
 static const int Schedule_Properties_Required[] = {
     PROP_OBJECT_IDENTIFIER,
     PROP_OBJECT_NAME,
@@ -83,12 +97,13 @@ void Schedule_Init(void)
 {
     unsigned i, j;
     for (i = 0; i < MAX_SCHEDULES; i++) {
+        sprintf(Schedule_Names[i], "SCHEDULE %u", i);
         /* whole year, change as neccessary */
-        Schedule_Descr[i].Start_Date.year = 0xFF;
+        Schedule_Descr[i].Start_Date.year = 1900 + 0xFF;  /* any year */
         Schedule_Descr[i].Start_Date.month = 1;
         Schedule_Descr[i].Start_Date.day = 1;
         Schedule_Descr[i].Start_Date.wday = 0xFF;
-        Schedule_Descr[i].End_Date.year = 0xFF;
+        Schedule_Descr[i].End_Date.year = 1900 + 0xFF;  /* any year */
         Schedule_Descr[i].End_Date.month = 12;
         Schedule_Descr[i].End_Date.day = 31;
         Schedule_Descr[i].End_Date.wday = 0xFF;
@@ -102,6 +117,10 @@ void Schedule_Init(void)
         Schedule_Descr[i].obj_prop_ref_cnt = 0; /* no references, add as needed */
         Schedule_Descr[i].Priority_For_Writing = 16;    /* lowest priority */
         Schedule_Descr[i].Out_Of_Service = false;
+        /* due at the first timer */
+        Schedule_Descr[i].Next_Transition = 0;
+        Schedule_Heap[i] = (uint16_t) i;
+        Schedule_Heap_Position[i] = (uint16_t) (i + 1);
     }
 }
 
@@ -134,22 +153,38 @@ unsigned Schedule_Instance_To_Index(uint32_t instance)
     return index;
 }
 
-bool Schedule_Object_Name(uint32_t object_instance,
+bool Schedule_Object_Name(
+    uint32_t object_instance,
     BACNET_CHARACTER_STRING * object_name)
 {
-    static char text_string[32] = "";   /* okay for single thread */
-    unsigned int index;
+    unsigned index = 0;
     bool status = false;
 
     index = Schedule_Instance_To_Index(object_instance);
     if (index < MAX_SCHEDULES) {
-        sprintf(text_string, "SCHEDULE %lu", (unsigned long) index);
-        status = characterstring_init_ansi(object_name, text_string);
+        status = characterstring_init_ansi(object_name, Schedule_Names[index]);
     }
 
     return status;
 }
 
+/* the name left in place, see BACNET_STRING_VIEW; false if not found */
+bool Schedule_Object_Name_View(
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view)
+{
+    unsigned index = 0;
+    const char *name = NULL;
+
+    index = Schedule_Instance_To_Index(object_instance);
+    if (index < MAX_SCHEDULES) {
+        name = Schedule_Names[index];
+    }
+    stringview_init_ansi(view, name);
+
+    return (name != NULL);
+}
+
 int Schedule_Read_Property(BACNET_READ_PROPERTY_DATA * rpdata)
 {
     int apdu_len = 0;
@@ -157,7 +192,7 @@ int Schedule_Read_Property(BACNET_READ_PROPERTY_DATA * rpdata)
     SCHEDULE_DESCR *CurrentSC;
     uint8_t *apdu = NULL;
     BACNET_BIT_STRING bit_string;
-    BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     int i;
 
     if ((rpdata == NULL) || (rpdata->application_data == NULL) ||
@@ -179,9 +214,10 @@ int Schedule_Read_Property(BACNET_READ_PROPERTY_DATA * rpdata)
                 rpdata->object_instance);
             break;
         case PROP_OBJECT_NAME:
-            Schedule_Object_Name(rpdata->object_instance, &char_string);
+            Schedule_Object_Name_View(rpdata->object_instance, &name_view);
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
         case PROP_OBJECT_TYPE:
             apdu_len =
@@ -323,30 +359,175 @@ bool Schedule_In_Effective_Period(SCHEDULE_DESCR * desc,
     return res;
 }
 
+/* The Present Value is that of the latest time value of the day at or
+   before the time, or the Schedule Default if there is none or it is NULL.
+   The time values may be in any order. */
 void Schedule_Recalculate_PV(SCHEDULE_DESCR * desc,
     BACNET_WEEKDAY wday,
     BACNET_TIME * time)
 {
+    BACNET_DAILY_SCHEDULE *daily = &desc->Weekly_Schedule[wday - 1];
+    BACNET_TIME_VALUE *latest = NULL;
     int i;
-    desc->Present_Value = NULL;
 
     /* for future development, here should be the loop for Exception Schedule */
 
-    for (i = 0;
-        i < desc->Weekly_Schedule[wday - 1].TV_Count &&
-        desc->Present_Value == NULL; i++) {
-        int diff = datetime_wildcard_compare_time(time,
-            &desc->Weekly_Schedule[wday - 1].Time_Values[i].Time);
-        if (diff >= 0 &&
-            desc->Weekly_Schedule[wday - 1].Time_Values[i].Value.tag !=
-            BACNET_APPLICATION_TAG_NULL) {
-            desc->Present_Value =
-                &desc->Weekly_Schedule[wday - 1].Time_Values[i].Value;
+    for (i = 0; i < daily->TV_Count; i++) {
+        if ((datetime_wildcard_compare_time(time,
+                    &daily->Time_Values[i].Time) >= 0) && ((latest == NULL) ||
+                (datetime_wildcard_compare_time(&latest->Time,
+                        &daily->Time_Values[i].Time) <= 0))) {
+            latest = &daily->Time_Values[i];
+        }
+    }
+
+    if (latest && (latest->Value.tag != BACNET_APPLICATION_TAG_NULL))
+        desc->Present_Value = &latest->Value;
+    else
+        desc->Present_Value = &desc->Schedule_Default;
+}
+
+/* seconds since midnight of the first time value of the day after the
+   time, or of the next midnight */
+static uint32_t Schedule_Next_Time(SCHEDULE_DESCR * desc,
+    BACNET_WEEKDAY wday,
+    BACNET_TIME * time)
+{
+    BACNET_DAILY_SCHEDULE *daily = &desc->Weekly_Schedule[wday - 1];
+    uint32_t next = 24UL * 60 * 60;
+    uint32_t seconds = 0;
+    int i;
+
+    for (i = 0; i < daily->TV_Count; i++) {
+        if (datetime_wildcard_compare_time(time,
+                &daily->Time_Values[i].Time) < 0) {
+            seconds =
+                datetime_seconds_since_midnight(&daily->Time_Values[i].Time);
+            if (seconds < next)
+                next = seconds;
         }
     }
 
-    if (desc->Present_Value == NULL)
+    return next;
+}
+
+static bool Schedule_Heap_Before(
+    unsigned a,
+    unsigned b)
+{
+    return Schedule_Descr[Schedule_Heap[a]].Next_Transition <
+        Schedule_Descr[Schedule_Heap[b]].Next_Transition;
+}
+
+static void Schedule_Heap_Swap(
+    unsigned a,
+    unsigned b)
+{
+    uint16_t index = Schedule_Heap[a];
+
+    Schedule_Heap[a] = Schedule_Heap[b];
+    Schedule_Heap[b] = index;
+    Schedule_Heap_Position[Schedule_Heap[a]] = (uint16_t) (a + 1);
+    Schedule_Heap_Position[Schedule_Heap[b]] = (uint16_t) (b + 1);
+}
+
+static void Schedule_Heap_Up(
+    unsigned pos)
+{
+    while ((pos > 0) && Schedule_Heap_Before(pos, (pos - 1) / 2)) {
+        Schedule_Heap_Swap(pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+static void Schedule_Heap_Down(
+    unsigned pos)
+{
+    unsigned child = 0;
+
+    for (;;) {
+        child = 2 * pos + 1;
+        if (child >= MAX_SCHEDULES)
+            break;
+        if (((child + 1) < MAX_SCHEDULES) &&
+            Schedule_Heap_Before(child + 1, child))
+            child++;
+        if (!Schedule_Heap_Before(child, pos))
+            break;
+        Schedule_Heap_Swap(pos, child);
+        pos = child;
+    }
+}
+
+/* Recalculates the Present Value of the schedule at the date and time,
+   and finds when it changes next. */
+static void Schedule_Update(SCHEDULE_DESCR * desc,
+    BACNET_DATE_TIME * bdatetime,
+    uint32_t now)
+{
+    uint32_t midnight = now - datetime_seconds_since_midnight(&bdatetime->time);
+
+    if (Schedule_In_Effective_Period(desc, &bdatetime->date)) {
+        Schedule_Recalculate_PV(desc, bdatetime->date.wday, &bdatetime->time);
+        desc->Next_Transition = midnight +
+            Schedule_Next_Time(desc, bdatetime->date.wday, &bdatetime->time);
+    } else {
         desc->Present_Value = &desc->Schedule_Default;
+        /* the period may begin tomorrow */
+        desc->Next_Transition = midnight + (24UL * 60 * 60);
+    }
+}
+
+/**
+ * Recalculates the Present Value of each schedule whose next transition
+ * has come, and gives it its new one.  The others are not looked at.
+ *
+ * @param bdatetime - the local date and time, with the day of the week
+ */
+void Schedule_Timer(BACNET_DATE_TIME * bdatetime)
+{
+    SCHEDULE_DESCR *desc = NULL;
+    uint32_t now = 0;
+
+    if ((bdatetime == NULL) || (bdatetime->date.wday < BACNET_WEEKDAY_MONDAY)
+        || (bdatetime->date.wday > BACNET_WEEKDAY_SUNDAY))
+        return;
+    now = datetime_seconds_since_unix_epoch(bdatetime);
+    while (MAX_SCHEDULES > 0) {
+        desc = &Schedule_Descr[Schedule_Heap[0]];
+        if (desc->Next_Transition > now)
+            break;
+        Schedule_Update(desc, bdatetime, now);
+        Schedule_Heap_Down(0);
+    }
+}
+
+/**
+ * @return the seconds since 1970, local time, of the next transition of
+ *  any schedule, so that the caller may sleep until then.
+ */
+uint32_t Schedule_Next_Transition(void)
+{
+    if (MAX_SCHEDULES == 0)
+        return UINT32_MAX;
+
+    return Schedule_Descr[Schedule_Heap[0]].Next_Transition;
+}
+
+/**
+ * Has the schedule recalculated at the next timer, after its weekly
+ * schedule, effective period or default were changed.
+ *
+ * @param object_instance - the instance of the schedule
+ */
+void Schedule_Changed(uint32_t object_instance)
+{
+    unsigned index = Schedule_Instance_To_Index(object_instance);
+
+    if (index < MAX_SCHEDULES) {
+        Schedule_Descr[index].Next_Transition = 0;
+        Schedule_Heap_Up(Schedule_Heap_Position[index] - 1u);
+    }
 }
 
 #ifdef TEST
@@ -383,6 +564,60 @@ void testSchedule(Test * pTest)
     return;
 }
 
+static void testScheduleTransitions(Test * pTest)
+{
+    SCHEDULE_DESCR *desc = &Schedule_Descr[1];
+    BACNET_DAILY_SCHEDULE *daily = NULL;
+    BACNET_DATE_TIME bdatetime;
+    uint32_t seconds = 0;
+    unsigned i = 0;
+
+    Schedule_Init();
+    /* Monday: on at 08:00 and off at 17:00, written out of order */
+    daily = &desc->Weekly_Schedule[BACNET_WEEKDAY_MONDAY - 1];
+    daily->TV_Count = 2;
+    datetime_set_time(&daily->Time_Values[0].Time, 17, 0, 0, 0);
+    daily->Time_Values[0].Value.tag = BACNET_APPLICATION_TAG_REAL;
+    daily->Time_Values[0].Value.type.Real = 15.0;
+    datetime_set_time(&daily->Time_Values[1].Time, 8, 0, 0, 0);
+    daily->Time_Values[1].Value.tag = BACNET_APPLICATION_TAG_REAL;
+    daily->Time_Values[1].Value.type.Real = 22.0;
+    Schedule_Changed(1);
+    /* Monday, January 6, 2020 */
+    datetime_set_values(&bdatetime, 2020, 1, 6, 7, 0, 0, 0);
+    Schedule_Timer(&bdatetime);
+    ct_test(pTest, desc->Present_Value == &desc->Schedule_Default);
+    seconds = datetime_seconds_since_unix_epoch(&bdatetime);
+    ct_test(pTest, desc->Next_Transition == seconds + 3600);
+    ct_test(pTest, Schedule_Next_Transition() == seconds + 3600);
+    /* the other schedules wait for midnight */
+    for (i = 0; i < MAX_SCHEDULES; i++) {
+        if (i != 1)
+            ct_test(pTest, Schedule_Descr[i].Next_Transition ==
+                seconds + (17UL * 3600));
+    }
+    /* nothing is done before the transition */
+    desc->Present_Value = NULL;
+    datetime_set_values(&bdatetime, 2020, 1, 6, 7, 59, 59, 0);
+    Schedule_Timer(&bdatetime);
+    ct_test(pTest, desc->Present_Value == NULL);
+    datetime_set_values(&bdatetime, 2020, 1, 6, 8, 0, 0, 0);
+    Schedule_Timer(&bdatetime);
+    ct_test(pTest, desc->Present_Value == &daily->Time_Values[1].Value);
+    datetime_set_values(&bdatetime, 2020, 1, 6, 18, 30, 0, 0);
+    Schedule_Timer(&bdatetime);
+    ct_test(pTest, desc->Present_Value == &daily->Time_Values[0].Value);
+    /* Tuesday has no time values */
+    datetime_set_values(&bdatetime, 2020, 1, 7, 0, 0, 1, 0);
+    Schedule_Timer(&bdatetime);
+    ct_test(pTest, desc->Present_Value == &desc->Schedule_Default);
+    /* a NULL relinquishes to the default */
+    daily->Time_Values[0].Value.tag = BACNET_APPLICATION_TAG_NULL;
+    datetime_set_time(&bdatetime.time, 18, 0, 0, 0);
+    Schedule_Recalculate_PV(desc, BACNET_WEEKDAY_MONDAY, &bdatetime.time);
+    ct_test(pTest, desc->Present_Value == &desc->Schedule_Default);
+}
+
 
 #ifdef TEST_SCHEDULE
 
@@ -395,6 +630,8 @@ int main(void)
     /* individual tests */
     rc = ct_addTestFunction(pTest, testSchedule);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testScheduleTransitions);
+    assert(rc);
 
     ct_setStream(pTest, stdout);
     ct_run(pTest);
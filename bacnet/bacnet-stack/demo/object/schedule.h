@@ -69,6 +69,8 @@ extern "C" {
         uint8_t obj_prop_ref_cnt;       /* actual number of obj_prop references */
         uint8_t Priority_For_Writing;   /* (1..16) */
         bool Out_Of_Service;
+        /* seconds since 1970, local time, when Present Value next changes */
+        uint32_t Next_Transition;
     } SCHEDULE_DESCR;
 
     void Schedule_Property_Lists(const int **pRequired,
@@ -83,6 +85,8 @@ extern "C" {
 
     bool Schedule_Object_Name(uint32_t object_instance,
         BACNET_CHARACTER_STRING * object_name);
+    bool Schedule_Object_Name_View(uint32_t object_instance,
+        BACNET_STRING_VIEW * view);
 
     int Schedule_Read_Property(BACNET_READ_PROPERTY_DATA * rpdata);
     bool Schedule_Write_Property(BACNET_WRITE_PROPERTY_DATA * wp_data);
@@ -95,6 +99,11 @@ extern "C" {
         BACNET_WEEKDAY wday,
         BACNET_TIME * time);
 
+    /* the Present Values are only recalculated at their transitions */
+    void Schedule_Timer(BACNET_DATE_TIME * bdatetime);
+    uint32_t Schedule_Next_Transition(void);
+    void Schedule_Changed(uint32_t object_instance);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
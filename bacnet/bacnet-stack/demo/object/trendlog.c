@@ -43,13 +43,56 @@
 #if defined(BACFILE)
 #include "bacfile.h"    /* object list dependency */
 #endif
+#if defined(TL_MMAP_STORAGE)
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 /* number of demo objects */
 #ifndef MAX_TREND_LOGS
 #define MAX_TREND_LOGS 8
 #endif
 
-TL_DATA_REC Logs[MAX_TREND_LOGS][TL_MAX_ENTRIES];
+/* the names, set once by the Init */
+static char Trend_Log_Names[MAX_TREND_LOGS][64];
+
+#if defined(TL_MMAP_STORAGE)
+/* Each log is a ring file: a header holding the buffer state followed by
+ * TL_MAX_ENTRIES fixed size records. The file is mapped shared, so an
+ * insert goes straight to the file and the log is found again at start up.
+ */
+#define TL_FILE_MAGIC 0x544C4F47UL      /* "TLOG" */
+#define TL_FILE_VERSION 1
+#define TL_FILE_HEADER_SIZE 64  /* keeps the records aligned */
+
+typedef struct tl_file_header {
+    uint32_t ulMagic;
+    uint16_t usVersion;
+    uint16_t usRecordSize;
+    uint32_t ulCapacity;
+    uint32_t ulRecordCount;
+    uint32_t ulTotalRecordCount;
+    uint32_t ulIndex;
+} TL_FILE_HEADER;
+
+static TL_FILE_HEADER *LogFile[MAX_TREND_LOGS];
+static TL_DATA_REC *Logs[MAX_TREND_LOGS];
+#define TL_Has_Storage(iLog) (Logs[(iLog)] != NULL)
+#else
+static TL_DATA_REC Logs[MAX_TREND_LOGS][TL_MAX_ENTRIES];
+#define TL_Has_Storage(iLog) true
+#endif
+
+/* number of made up entries put in a new log for testing */
+#if TL_MAX_ENTRIES < 1000
+#define TL_DEMO_ENTRIES TL_MAX_ENTRIES
+#else
+#define TL_DEMO_ENTRIES 1000
+#endif
 static TL_LOG_INFO LogInfo[MAX_TREND_LOGS];
 
 /* These three arrays are used by the ReadPropertyMultiple handler */
@@ -160,6 +203,158 @@ unsigned Trend_Log_Instance_To_Index(
     return index;
 }
 
+#if defined(TL_MMAP_STORAGE)
+/*
+ * Map the ring file of a log, creating it if it is missing or was written
+ * with a different layout. If no file can be used the log is kept in
+ * anonymous memory for this run. Returns true if an existing log was
+ * reopened, in which case the header holds its state.
+ */
+static bool TL_Storage_Open(
+    int iLog)
+{
+    char szName[256];
+    const char *pDir = NULL;
+    TL_FILE_HEADER *pHeader = NULL;
+    void *pMap = MAP_FAILED;
+    size_t size = 0;
+    struct stat st;
+    bool bReopened = false;
+    int fd = -1;
+
+    size = TL_FILE_HEADER_SIZE + (size_t) TL_MAX_ENTRIES * sizeof(TL_DATA_REC);
+    pDir = getenv("BACNET_TRENDLOG_PATH");
+    if (pDir == NULL)
+        pDir = TL_STORAGE_PATH;
+    snprintf(szName, sizeof(szName), "%s/trendlog-%lu.dat", pDir,
+        (unsigned long) Trend_Log_Index_To_Instance(iLog));
+    fd = open(szName, O_RDWR | O_CREAT, 0644);
+    if (fd >= 0) {
+        if ((fstat(fd, &st) == 0) && (st.st_size == (off_t) size)) {
+            bReopened = true;
+        } else if ((ftruncate(fd, 0) != 0) ||
+            (ftruncate(fd, (off_t) size) != 0)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0) {
+        pMap = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if (pMap == MAP_FAILED) {
+        bReopened = false;
+        pMap =
+            mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pMap == MAP_FAILED)
+            return false;
+    }
+    pHeader = (TL_FILE_HEADER *) pMap;
+    if (bReopened) {
+        bReopened = (pHeader->ulMagic == TL_FILE_MAGIC) &&
+            (pHeader->usVersion == TL_FILE_VERSION) &&
+            (pHeader->usRecordSize == sizeof(TL_DATA_REC)) &&
+            (pHeader->ulCapacity == TL_MAX_ENTRIES) &&
+            (pHeader->ulRecordCount <= TL_MAX_ENTRIES) &&
+            (pHeader->ulIndex < TL_MAX_ENTRIES);
+    }
+    if (!bReopened) {
+        memset(pHeader, 0, sizeof(TL_FILE_HEADER));
+        pHeader->ulMagic = TL_FILE_MAGIC;
+        pHeader->usVersion = TL_FILE_VERSION;
+        pHeader->usRecordSize = sizeof(TL_DATA_REC);
+        pHeader->ulCapacity = TL_MAX_ENTRIES;
+    }
+    LogFile[iLog] = pHeader;
+    Logs[iLog] = (TL_DATA_REC *) ((uint8_t *) pMap + TL_FILE_HEADER_SIZE);
+
+    return bReopened;
+}
+#endif
+
+/*
+ * Copy the buffer state of a log to its file header so that it is
+ * current should the device stop.
+ */
+static void TL_Storage_Sync(
+    int iLog)
+{
+#if defined(TL_MMAP_STORAGE)
+    if (LogFile[iLog] != NULL) {
+        LogFile[iLog]->ulRecordCount = LogInfo[iLog].ulRecordCount;
+        LogFile[iLog]->ulTotalRecordCount = LogInfo[iLog].ulTotalRecordCount;
+        LogFile[iLog]->ulIndex = (uint32_t) LogInfo[iLog].iIndex;
+    }
+#else
+    (void) iLog;
+#endif
+}
+
+/*
+ * Find a record by its position in the log, where entry 0 is the oldest.
+ */
+static TL_DATA_REC *TL_Record(
+    int iLog,
+    uint32_t ulEntry)
+{
+    if (LogInfo[iLog].ulRecordCount < TL_MAX_ENTRIES)
+        return &Logs[iLog][ulEntry];
+
+    return &Logs[iLog][(LogInfo[iLog].iIndex + ulEntry) % TL_MAX_ENTRIES];
+}
+
+/*
+ * Add a record at the insertion point of a log, overwriting the oldest
+ * record once the log is full.
+ */
+static void TL_Insert_Record(
+    int iLog,
+    TL_DATA_REC * pRecord)
+{
+    TL_LOG_INFO *CurrentLog = &LogInfo[iLog];
+
+    if (!TL_Has_Storage(iLog))
+        return;
+    Logs[iLog][CurrentLog->iIndex++] = *pRecord;
+    if (CurrentLog->iIndex >= TL_MAX_ENTRIES)
+        CurrentLog->iIndex = 0;
+
+    CurrentLog->ulTotalRecordCount++;
+
+    if (CurrentLog->ulRecordCount < TL_MAX_ENTRIES)
+        CurrentLog->ulRecordCount++;
+    TL_Storage_Sync(iLog);
+}
+
+/*
+ * Count the records, from the oldest on, that were logged before the
+ * reference time, or also at it if bInclusive is set. Records are added
+ * in time order, so this is a binary search of the ring rather than a
+ * scan, which matters once a log holds millions of entries.
+ */
+static uint32_t TL_Count_Before(
+    int iLog,
+    time_t tRefTime,
+    bool bInclusive)
+{
+    uint32_t ulLow = 0;
+    uint32_t ulHigh = LogInfo[iLog].ulRecordCount;
+    uint32_t ulMid = 0;
+    time_t tStamp = 0;
+
+    while (ulLow < ulHigh) {
+        ulMid = ulLow + ((ulHigh - ulLow) / 2);
+        tStamp = TL_Record(iLog, ulMid)->tTimeStamp;
+        if ((tStamp < tRefTime) || (bInclusive && (tStamp == tRefTime)))
+            ulLow = ulMid + 1;
+        else
+            ulHigh = ulMid;
+    }
+
+    return ulLow;
+}
+
 /*
  * Things to do when starting up the stack for Trend Logs.
  * Should be called whenever we reset the device or power it up
@@ -172,6 +367,7 @@ void Trend_Log_Init(
     int iEntry;
     struct tm TempTime;
     time_t tClock;
+    bool bReopened = false;
 
     if (!initialized) {
         initialized = true;
@@ -179,6 +375,7 @@ void Trend_Log_Init(
         /* initialize all the values */
 
         for (iLog = 0; iLog < MAX_TREND_LOGS; iLog++) {
+            sprintf(Trend_Log_Names[iLog], "Trend Log %u", (unsigned) iLog);
             /*
              * Do we need to do anything here?
              * Trend logs are usually assumed to survive over resets
@@ -190,8 +387,11 @@ void Trend_Log_Init(
              * entries into any active logs if the power down or reset
              * may have caused us to miss readings.
              */
+#if defined(TL_MMAP_STORAGE)
+            bReopened = TL_Storage_Open(iLog);
+#endif
 
-            /* We will just fill the logs with some entries for testing
+            /* We will just fill new logs with some entries for testing
              * purposes.
              */
             TempTime.tm_year = 109;
@@ -200,13 +400,15 @@ void Trend_Log_Init(
             TempTime.tm_hour = 0;
             TempTime.tm_min = 0;
             TempTime.tm_sec = 0;
+            TempTime.tm_isdst = -1;
             tClock = mktime(&TempTime);
 
-            for (iEntry = 0; iEntry < TL_MAX_ENTRIES; iEntry++) {
+            for (iEntry = 0; !bReopened && TL_Has_Storage(iLog) &&
+                (iEntry < TL_DEMO_ENTRIES); iEntry++) {
                 Logs[iLog][iEntry].tTimeStamp = tClock;
                 Logs[iLog][iEntry].ucRecType = TL_TYPE_REAL;
                 Logs[iLog][iEntry].Datum.fReal =
-                    (float) (iEntry + (iLog * TL_MAX_ENTRIES));
+                    (float) (iEntry + (iLog * TL_DEMO_ENTRIES));
                 /* Put status flags with every second log */
                 if ((iLog & 1) == 0)
                     Logs[iLog][iEntry].ucStatus = 128;
@@ -226,8 +428,21 @@ void Trend_Log_Init(
             LogInfo[iLog].ulIntervalOffset = 0;
             LogInfo[iLog].iIndex = 0;
             LogInfo[iLog].ulLogInterval = 900;
-            LogInfo[iLog].ulRecordCount = TL_MAX_ENTRIES;
-            LogInfo[iLog].ulTotalRecordCount = 10000;
+            LogInfo[iLog].ulRecordCount = iEntry;
+            LogInfo[iLog].ulTotalRecordCount = iEntry ? 10000 : 0;
+#if defined(TL_MMAP_STORAGE)
+            if (bReopened) {
+                LogInfo[iLog].iIndex = (int) LogFile[iLog]->ulIndex;
+                LogInfo[iLog].ulRecordCount = LogFile[iLog]->ulRecordCount;
+                LogInfo[iLog].ulTotalRecordCount =
+                    LogFile[iLog]->ulTotalRecordCount;
+                if (LogInfo[iLog].ulRecordCount > 0)
+                    LogInfo[iLog].tLastDataTime =
+                        TL_Record(iLog,
+                        LogInfo[iLog].ulRecordCount - 1)->tTimeStamp;
+            }
+#endif
+            TL_Storage_Sync(iLog);
 
             LogInfo[iLog].Source.deviceIndentifier.instance =
                 Device_Object_Instance_Number();
@@ -245,6 +460,9 @@ void Trend_Log_Init(
                 59, 99);
             LogInfo[iLog].tStopTime =
                 TL_BAC_Time_To_Local(&LogInfo[iLog].StopTime);
+            /* Readings were missed while we were down */
+            if (bReopened && TL_Is_Enabled(iLog))
+                TL_Insert_Status_Rec(iLog, LOG_STATUS_LOG_INTERRUPTED, true);
         }
     }
 
@@ -261,17 +479,32 @@ bool Trend_Log_Object_Name(
     uint32_t object_instance,
     BACNET_CHARACTER_STRING * object_name)
 {
-    static char text_string[32] = "";   /* okay for single thread */
     bool status = false;
 
     if (object_instance < MAX_TREND_LOGS) {
-        sprintf(text_string, "Trend Log %u", object_instance);
-        status = characterstring_init_ansi(object_name, text_string);
+        status =
+            characterstring_init_ansi(object_name,
+            Trend_Log_Names[object_instance]);
     }
 
     return status;
 }
 
+/* the name left in place, see BACNET_STRING_VIEW; false if not found */
+bool Trend_Log_Object_Name_View(
+    uint32_t object_instance,
+    BACNET_STRING_VIEW * view)
+{
+    const char *name = NULL;
+
+    if (object_instance < MAX_TREND_LOGS) {
+        name = Trend_Log_Names[object_instance];
+    }
+    stringview_init_ansi(view, name);
+
+    return (name != NULL);
+}
+
 
 /* return the length of the apdu encoded or BACNET_STATUS_ERROR for error or
    BACNET_STATUS_ABORT for abort message */
@@ -281,7 +514,7 @@ int Trend_Log_Read_Property(
     int apdu_len = 0;   /* return value */
     int len = 0;        /* apdu len intermediate value */
     BACNET_BIT_STRING bit_string;
-    BACNET_CHARACTER_STRING char_string;
+    BACNET_STRING_VIEW name_view;
     TL_LOG_INFO *CurrentLog;
     uint8_t *apdu = NULL;
 
@@ -300,9 +533,10 @@ int Trend_Log_Read_Property(
 
         case PROP_DESCRIPTION:
         case PROP_OBJECT_NAME:
-            Trend_Log_Object_Name(rpdata->object_instance, &char_string);
+            Trend_Log_Object_Name_View(rpdata->object_instance, &name_view);
             apdu_len =
-                encode_application_character_string(&apdu[0], &char_string);
+                encode_application_character_string_view(&apdu[0],
+                &name_view);
             break;
 
         case PROP_OBJECT_TYPE:
@@ -563,6 +797,7 @@ bool Trend_Log_Write_Property(
                     /* Time to clear down the log */
                     CurrentLog->ulRecordCount = 0;
                     CurrentLog->iIndex = 0;
+                    TL_Storage_Sync(log_index);
                     TL_Insert_Status_Rec(log_index, LOG_STATUS_BUFFER_PURGED,
                         true);
                 }
@@ -726,6 +961,7 @@ bool Trend_Log_Write_Property(
                 /* Clear buffer if property being logged is changed */
                 CurrentLog->ulRecordCount = 0;
                 CurrentLog->iIndex = 0;
+                TL_Storage_Sync(log_index);
                 TL_Insert_Status_Rec(log_index, LOG_STATUS_BUFFER_PURGED,
                     true);
             }
@@ -844,11 +1080,8 @@ void TL_Insert_Status_Rec(
     BACNET_LOG_STATUS eStatus,
     bool bState)
 {
-    TL_LOG_INFO *CurrentLog;
     TL_DATA_REC TempRec;
 
-    CurrentLog = &LogInfo[iLog];
-
     TempRec.tTimeStamp = time(NULL);
     TempRec.ucRecType = TL_TYPE_STATUS;
     TempRec.ucStatus = 0;
@@ -871,14 +1104,7 @@ void TL_Insert_Status_Rec(
             break;
     }
 
-    Logs[iLog][CurrentLog->iIndex++] = TempRec;
-    if (CurrentLog->iIndex >= TL_MAX_ENTRIES)
-        CurrentLog->iIndex = 0;
-
-    CurrentLog->ulTotalRecordCount++;
-
-    if (CurrentLog->ulRecordCount < TL_MAX_ENTRIES)
-        CurrentLog->ulRecordCount++;
+    TL_Insert_Record(iLog, &TempRec);
 }
 
 /*****************************************************************************
@@ -969,6 +1195,7 @@ time_t TL_BAC_Time_To_Local(
     LocalTime.tm_hour = SourceTime->time.hour;
     LocalTime.tm_min = SourceTime->time.min;
     LocalTime.tm_sec = SourceTime->time.sec;
+    LocalTime.tm_isdst = -1;    /* let mktime work out daylight saving */
 
     return (mktime(&LocalTime));
 }
@@ -981,24 +1208,28 @@ void TL_Local_Time_To_BAC(
     BACNET_DATE_TIME * DestTime,
     time_t SourceTime)
 {
+    /* The offset of the local time from UTC only changes on the quarter
+     * hour, so localtime() is asked once for each quarter hour and the
+     * rest of the entries of a ReadRange are converted by arithmetic */
+    static time_t Offset_Block = (time_t) - 1;
+    static int32_t Offset_Seconds = 0;
     struct tm *TempTime;
-
-    TempTime = localtime(&SourceTime);
-
-    DestTime->date.year = (uint16_t) (TempTime->tm_year + 1900);
-    DestTime->date.month = (uint8_t) (TempTime->tm_mon + 1);
-    DestTime->date.day = (uint8_t) TempTime->tm_mday;
-    /* BACnet is 1 to 7 = Monday to Sunday
-     * Windows is days from Sunday 0 - 6 so we
-     * have to adjust */
-    if (TempTime->tm_wday == 0)
-        DestTime->date.wday = 7;
-    else
-        DestTime->date.wday = (uint8_t) TempTime->tm_wday;
-    DestTime->time.hour = (uint8_t) TempTime->tm_hour;
-    DestTime->time.min = (uint8_t) TempTime->tm_min;
-    DestTime->time.sec = (uint8_t) TempTime->tm_sec;
-    DestTime->time.hundredths = 0;
+    time_t Block;
+
+    Block = SourceTime / 900;
+    if (Block != Offset_Block) {
+        TempTime = localtime(&SourceTime);
+        datetime_set_values(DestTime, (uint16_t) (TempTime->tm_year + 1900),
+            (uint8_t) (TempTime->tm_mon + 1), (uint8_t) TempTime->tm_mday,
+            (uint8_t) TempTime->tm_hour, (uint8_t) TempTime->tm_min,
+            (uint8_t) TempTime->tm_sec, 0);
+        Offset_Seconds =
+            (int32_t) (datetime_seconds_since_unix_epoch(DestTime) -
+            (uint32_t) SourceTime);
+        Offset_Block = Block;
+    }
+    datetime_seconds_since_unix_epoch_into_datetime((uint32_t) SourceTime +
+        (uint32_t) Offset_Seconds, DestTime);
 }
 
 /****************************************************************************
@@ -1069,7 +1300,7 @@ int TL_encode_by_position(
     uint32_t uiRemaining = 0;   /* Amount of unused space in packet */
 
     /* See how much space we have */
-    uiRemaining = MAX_APDU - pRequest->Overhead;
+    uiRemaining = RR_MAX_APDU(pRequest) - pRequest->Overhead;
     log_index = Trend_Log_Instance_To_Index(pRequest->object_instance);
     CurrentLog = &LogInfo[log_index];
     if (pRequest->RequestType == RR_READ_ALL) {
@@ -1179,7 +1410,7 @@ int TL_encode_by_sequence(
     bool bWrapLog = false;      /* Has log sequence range spanned the max for uint32_t? */
 
     /* See how much space we have */
-    uiRemaining = MAX_APDU - pRequest->Overhead;
+    uiRemaining = RR_MAX_APDU(pRequest) - pRequest->Overhead;
     log_index = Trend_Log_Instance_To_Index(pRequest->object_instance);
     CurrentLog = &LogInfo[log_index];
     /* Figure out the sequence number for the first record, last is ulTotalRecordCount */
@@ -1311,34 +1542,20 @@ int TL_encode_by_time(
     time_t tRefTime = 0;        /* The time from the request in local format */
 
     /* See how much space we have */
-    uiRemaining = MAX_APDU - pRequest->Overhead;
+    uiRemaining = RR_MAX_APDU(pRequest) - pRequest->Overhead;
     log_index = Trend_Log_Instance_To_Index(pRequest->object_instance);
     CurrentLog = &LogInfo[log_index];
 
     tRefTime = TL_BAC_Time_To_Local(&pRequest->Range.RefTime);
-    /* Find correct position for oldest entry in log */
-    if (CurrentLog->ulRecordCount < TL_MAX_ENTRIES)
-        uiIndex = 0;
-    else
-        uiIndex = CurrentLog->iIndex;
 
     if (pRequest->Count < 0) {
-        /* Start at end of log and look for record which has
-         * timestamp greater than or equal to the reference.
-         */
-        iCount = CurrentLog->ulRecordCount - 1;
-        /* Start out with the sequence number for the last record */
-        uiFirstSeq = CurrentLog->ulTotalRecordCount;
-        for (;;) {
-            if (Logs[pRequest->object_instance][(uiIndex +
-                        iCount) % TL_MAX_ENTRIES].tTimeStamp < tRefTime)
-                break;
-
-            uiFirstSeq--;
-            iCount--;
-            if (iCount < 0)
-                return (0);
-        }
+        /* Find the last record with a timestamp before the reference */
+        iCount = (int) TL_Count_Before(log_index, tRefTime, false) - 1;
+        if (iCount < 0)
+            return (0);
+        /* and work out its sequence number from that of the last record */
+        uiFirstSeq = CurrentLog->ulTotalRecordCount -
+            ((CurrentLog->ulRecordCount - 1) - iCount);
 
         /* We have an and point for our request,
          * now work backwards to find where we should start from
@@ -1360,23 +1577,16 @@ int TL_encode_by_time(
             iCount -= iTemp;
         }
     } else {
-        /* Start at beginning of log and look for 1st record which has
-         * timestamp greater than the reference time.
+        /* Find the 1st record which has a timestamp greater than the
+         * reference time.
          */
-        iCount = 0;
+        iCount = (int) TL_Count_Before(log_index, tRefTime, true);
+        if ((uint32_t) iCount == CurrentLog->ulRecordCount)
+            return (0);
         /* Figure out the sequence number for the first record, last is ulTotalRecordCount */
         uiFirstSeq =
-            CurrentLog->ulTotalRecordCount - (CurrentLog->ulRecordCount - 1);
-        for (;;) {
-            if (Logs[pRequest->object_instance][(uiIndex +
-                        iCount) % TL_MAX_ENTRIES].tTimeStamp > tRefTime)
-                break;
-
-            uiFirstSeq++;
-            iCount++;
-            if ((uint32_t) iCount == CurrentLog->ulRecordCount)
-                return (0);
-        }
+            CurrentLog->ulTotalRecordCount - (CurrentLog->ulRecordCount - 1) +
+            iCount;
     }
 
     /* We now have a starting point for the operation and a +ve count */
@@ -1433,14 +1643,8 @@ int TL_encode_entry(
     uint8_t ucCount = 0;
     BACNET_DATE_TIME TempTime;
 
-    /* Convert from BACnet 1 based to 0 based array index and then
-     * handle wrap around of the circular buffer */
-
-    if (LogInfo[iLog].ulRecordCount < TL_MAX_ENTRIES)
-        pSource = &Logs[iLog][(iEntry - 1) % TL_MAX_ENTRIES];
-    else
-        pSource =
-            &Logs[iLog][(LogInfo[iLog].iIndex + iEntry - 1) % TL_MAX_ENTRIES];
+    /* Convert from BACnet 1 based to 0 based entry */
+    pSource = TL_Record(iLog, (uint32_t) (iEntry - 1));
 
     iLen = 0;
     /* First stick the time stamp in with tag [0] */
@@ -1703,14 +1907,7 @@ void TL_fetch_property(
         TempRec.ucStatus = 128 | bitstring_octet(&TempBits, 0);
     }
 
-    Logs[iLog][CurrentLog->iIndex++] = TempRec;
-    if (CurrentLog->iIndex >= TL_MAX_ENTRIES)
-        CurrentLog->iIndex = 0;
-
-    CurrentLog->ulTotalRecordCount++;
-
-    if (CurrentLog->ulRecordCount < TL_MAX_ENTRIES)
-        CurrentLog->ulRecordCount++;
+    TL_Insert_Record(iLog, &TempRec);
 }
 
 /****************************************************************************
@@ -80,7 +80,20 @@ extern "C" {
 #define TL_T_START_WILD 1       /* Start time is wild carded */
 #define TL_T_STOP_WILD  2       /* Stop Time is wild carded */
 
+/* With TL_MMAP_STORAGE each log is kept in a memory mapped ring file, */
+/* so the buffer can be large and outlives a restart of the device. */
+#ifndef TL_MAX_ENTRIES
+#if defined(TL_MMAP_STORAGE)
+#define TL_MAX_ENTRIES 1048576  /* Entries per datalog */
+#else
 #define TL_MAX_ENTRIES 1000     /* Entries per datalog */
+#endif
+#endif
+
+/* Directory for the log files, BACNET_TRENDLOG_PATH overrides it */
+#ifndef TL_STORAGE_PATH
+#define TL_STORAGE_PATH "."
+#endif
 
 /* Structure containing config and status info for a Trend Log */
 
@@ -142,6 +155,9 @@ extern "C" {
     bool Trend_Log_Object_Name(
         uint32_t object_instance,
         BACNET_CHARACTER_STRING * object_name);
+    bool Trend_Log_Object_Name_View(
+        uint32_t object_instance,
+        BACNET_STRING_VIEW * view);
 
     int Trend_Log_Read_Property(
         BACNET_READ_PROPERTY_DATA * rpdata);
@@ -1514,6 +1514,33 @@ void Device_COV_Clear(
     }
 }
 
+/** Tell the Device that the COV flag of an Object has just been set.
+ * @ingroup ObjHelpers
+ * @param [in] The object type of the changed Object.
+ * @param [in] The object instance of the changed Object.
+ */
+void Device_COV_Changed(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    handler_cov_object_changed(object_type, object_instance);
+}
+
+/* the objects created and deleted at run time only change the revision */
+void Device_Object_Created(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    Device_Inc_Database_Revision();
+}
+
+void Device_Object_Deleted(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    Device_Inc_Database_Revision();
+}
+
 #if defined(INTRINSIC_REPORTING)
 void Device_local_reporting(
     void)
@@ -1730,6 +1757,14 @@ int handler_cov_encode_subscriptions(
     return 0;
 }
 
+void handler_cov_object_changed(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    object_type = object_type;
+    object_instance = object_instance;
+}
+
 void testDevice(
     Test * pTest)
 {
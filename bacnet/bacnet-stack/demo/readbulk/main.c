@@ -0,0 +1,1097 @@
+/*************************************************************************
+* Copyright (C) 2008 Steve Karg <skarg@users.sourceforge.net>
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*********************************************************************/
+
+/* command line tool that reads a list of properties of many devices in one
+   run, with ReadPropertyMultiple, and prints the values as JSON lines */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#define PRINT_ENABLED 1
+
+#include "bacdef.h"
+#include "config.h"
+#include "bactext.h"
+#include "bacerror.h"
+#include "bacapp.h"
+#include "iam.h"
+#include "tsm.h"
+#include "bactimer.h"
+#include "address.h"
+#include "npdu.h"
+#include "apdu.h"
+#include "device.h"
+#include "net.h"
+#include "datalink.h"
+#include "whois.h"
+#include "rp.h"
+/* some demo stuff needed */
+#include "rpm.h"
+#include "filename.h"
+#include "handlers.h"
+#include "client.h"
+#include "txbuf.h"
+#include "dlenv.h"
+
+/* the devices read at once, unless BACNET_BULK_DEVICES says otherwise */
+#define BULK_DEVICES_DEFAULT 32
+/* the requests in flight to one device, see BACNET_BULK_WINDOW */
+#define BULK_WINDOW_DEFAULT 1
+/* the properties in one ReadPropertyMultiple, see BACNET_BULK_BATCH */
+#define BULK_BATCH_DEFAULT 16
+/* one for each transaction the TSM has, and as many waiting to be sent
+   again after a reply that was too large */
+#define BULK_MAX_REQUESTS 512
+/* the most an object and a property with its array index add to a request */
+#define BULK_TARGET_LEN 18
+
+typedef struct bulk_target {
+    uint32_t device_id;
+    BACNET_OBJECT_TYPE object_type;
+    uint32_t object_instance;
+    BACNET_PROPERTY_ID object_property;
+    uint32_t array_index;
+    /* of the list, the targets of a device are read in its order */
+    unsigned order;
+} BULK_TARGET;
+
+typedef struct bulk_device {
+    uint32_t device_id;
+    /* its targets, in the sorted list */
+    BULK_TARGET *targets;
+    unsigned count;
+    /* the first target not requested yet */
+    unsigned next;
+    /* the properties in one request, halved when the reply is too large */
+    unsigned batch;
+    /* if it rejects ReadPropertyMultiple */
+    bool rp_only;
+    bool bound;
+    BACNET_ADDRESS dest;
+    unsigned max_apdu;
+    /* the Who-Is sent, and the clock of the last */
+    unsigned whois;
+    uint32_t whois_ms;
+    unsigned inflight;
+    /* the requests of it waiting to be sent again */
+    unsigned again;
+} BULK_DEVICE;
+
+typedef enum {
+    BULK_REQUEST_FREE,
+    BULK_REQUEST_INFLIGHT,
+    BULK_REQUEST_AGAIN
+} BULK_REQUEST_STATE;
+
+typedef struct bulk_request {
+    BULK_REQUEST_STATE state;
+    BULK_DEVICE *device;
+    /* its targets, of those of the device */
+    unsigned first;
+    unsigned count;
+    /* the most targets each request sending them again may have */
+    unsigned batch;
+    bool rpm;
+} BULK_REQUEST;
+
+/* buffer used for receive */
+static uint8_t Rx_Buf[MAX_MPDU] = { 0 };
+
+static BULK_TARGET *Bulk_Targets;
+static unsigned Bulk_Target_Count;
+static BULK_DEVICE *Bulk_Devices;
+static unsigned Bulk_Device_Count;
+static BULK_REQUEST Requests[BULK_MAX_REQUESTS];
+/* the devices being read */
+static BULK_DEVICE **Active;
+static unsigned Window = BULK_WINDOW_DEFAULT;
+static unsigned Batch = BULK_BATCH_DEFAULT;
+/* the milliseconds between two requests, of any device */
+static uint32_t Interval;
+static uint32_t Last_Send_ms;
+static bool Sent_Once;
+/* for the summary */
+static unsigned Request_Count;
+static unsigned Read_Count;
+static unsigned Failed_Count;
+
+static void print_json_string(
+    const char *str)
+{
+    fputc('"', stdout);
+    for (; *str; str++) {
+        if ((*str == '"') || (*str == '\\')) {
+            fputc('\\', stdout);
+            fputc(*str, stdout);
+        } else if ((unsigned char) *str < 0x20) {
+            fprintf(stdout, "\\u%04x", (unsigned) (unsigned char) *str);
+        } else {
+            fputc(*str, stdout);
+        }
+    }
+    fputc('"', stdout);
+}
+
+static void print_result_begin(
+    uint32_t device_id,
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance,
+    BACNET_PROPERTY_ID object_property,
+    uint32_t array_index)
+{
+    fprintf(stdout, "{\"device\":%lu,\"type\":%u,\"instance\":%lu,"
+        "\"property\":%u", (unsigned long) device_id, (unsigned) object_type,
+        (unsigned long) object_instance, (unsigned) object_property);
+    if (array_index != BACNET_ARRAY_ALL) {
+        fprintf(stdout, ",\"index\":%lu", (unsigned long) array_index);
+    }
+}
+
+/* the numbers and the booleans as they are, anything else as its text */
+static void print_json_value(
+    BACNET_OBJECT_PROPERTY_VALUE * object_value)
+{
+    char text[512];
+    char *end = NULL;
+    int len = 0;
+
+    if (object_value->value->tag == BACNET_APPLICATION_TAG_NULL) {
+        fprintf(stdout, "null");
+        return;
+    }
+    len = bacapp_snprintf_value(text, sizeof(text), object_value);
+    if (len < 0) {
+        text[0] = 0;
+    }
+    switch (object_value->value->tag) {
+        case BACNET_APPLICATION_TAG_BOOLEAN:
+            fprintf(stdout, "%s", (strcmp(text, "TRUE") == 0) ? "true" :
+                "false");
+            return;
+        case BACNET_APPLICATION_TAG_UNSIGNED_INT:
+        case BACNET_APPLICATION_TAG_SIGNED_INT:
+        case BACNET_APPLICATION_TAG_REAL:
+        case BACNET_APPLICATION_TAG_DOUBLE:
+            /* not nan or inf, which JSON has no numbers for */
+            if (text[0] && isdigit((unsigned char)
+                    text[(text[0] == '-') ? 1 : 0])) {
+                (void) strtod(text, &end);
+                if (*end == 0) {
+                    fprintf(stdout, "%s", text);
+                    return;
+                }
+            }
+            break;
+        case BACNET_APPLICATION_TAG_CHARACTER_STRING:
+            /* without the quotes it is printed in */
+            len = (int) strlen(text);
+            if ((len >= 2) && (text[0] == '"') && (text[len - 1] == '"')) {
+                text[len - 1] = 0;
+                print_json_string(&text[1]);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    print_json_string(text);
+}
+
+static void print_error(
+    const char *error)
+{
+    fprintf(stdout, ",\"error\":");
+    print_json_string(error);
+    fprintf(stdout, "}\n");
+    Failed_Count++;
+}
+
+static void print_access_error(
+    BACNET_ERROR_CLASS error_class,
+    BACNET_ERROR_CODE error_code)
+{
+    char text[128];
+
+    snprintf(text, sizeof(text), "%s: %s",
+        bactext_error_class_name((int) error_class),
+        bactext_error_code_name((int) error_code));
+    print_error(text);
+}
+
+/* an error for each of the targets, e.g. of a request that timed out */
+static void fail_targets(
+    BULK_DEVICE * device,
+    unsigned first,
+    unsigned count,
+    const char *error)
+{
+    BULK_TARGET *target = NULL;
+    unsigned i = 0;
+
+    for (i = first; i < first + count; i++) {
+        target = &device->targets[i];
+        print_result_begin(target->device_id, target->object_type,
+            target->object_instance, target->object_property,
+            target->array_index);
+        print_error(error);
+    }
+}
+
+static void print_rpm_ack(
+    uint32_t device_id,
+    BACNET_READ_ACCESS_DATA * rpm_data)
+{
+    BACNET_OBJECT_PROPERTY_VALUE object_value;
+    BACNET_PROPERTY_REFERENCE *property;
+    BACNET_APPLICATION_DATA_VALUE *value;
+    BACNET_APPLICATION_DATA_VIEW *view;
+    BACNET_APPLICATION_DATA_VALUE view_value;
+    bool array_value = false;
+
+    for (; rpm_data; rpm_data = rpm_data->next) {
+        object_value.object_type = rpm_data->object_type;
+        object_value.object_instance = rpm_data->object_instance;
+        for (property = rpm_data->listOfProperties; property;
+            property = property->next) {
+            print_result_begin(device_id, rpm_data->object_type,
+                rpm_data->object_instance, property->propertyIdentifier,
+                property->propertyArrayIndex);
+            value = property->value;
+            view = property->view;
+            if (!value && !view) {
+                print_access_error(property->error.error_class,
+                    property->error.error_code);
+                continue;
+            }
+            object_value.object_property = property->propertyIdentifier;
+            object_value.array_index = property->propertyArrayIndex;
+            array_value = (value && value->next) || (!value && view->next);
+            fprintf(stdout, ",\"value\":%s", array_value ? "[" : "");
+            while (value || view) {
+                if (value) {
+                    object_value.value = value;
+                    value = value->next;
+                } else {
+                    if (!bacapp_view_to_value(view, &view_value)) {
+                        view_value.tag = BACNET_APPLICATION_TAG_NULL;
+                    }
+                    object_value.value = &view_value;
+                    view = view->next;
+                }
+                print_json_value(&object_value);
+                if (value || view) {
+                    fputc(',', stdout);
+                }
+            }
+            fprintf(stdout, "%s}\n", array_value ? "]" : "");
+            Read_Count++;
+        }
+    }
+}
+
+static void print_rp_ack(
+    uint32_t device_id,
+    BACNET_READ_PROPERTY_DATA * data)
+{
+    BACNET_OBJECT_PROPERTY_VALUE object_value;
+    BACNET_APPLICATION_DATA_VALUE value;
+    uint8_t *application_data = data->application_data;
+    int application_data_len = data->application_data_len;
+    bool array_value = false;
+    int len = 0;
+
+    print_result_begin(device_id, data->object_type, data->object_instance,
+        data->object_property, data->array_index);
+    object_value.object_type = data->object_type;
+    object_value.object_instance = data->object_instance;
+    object_value.object_property = data->object_property;
+    object_value.array_index = data->array_index;
+    object_value.value = &value;
+    fprintf(stdout, ",\"value\":");
+    while (application_data_len > 0) {
+        len =
+            bacapp_decode_application_data(application_data,
+            (unsigned) application_data_len, &value);
+        if (len <= 0) {
+            break;
+        }
+        if (!array_value && (len < application_data_len)) {
+            array_value = true;
+            fputc('[', stdout);
+        }
+        print_json_value(&object_value);
+        application_data += len;
+        application_data_len -= len;
+        if (application_data_len > 0) {
+            fputc(',', stdout);
+        }
+    }
+    if (array_value) {
+        fputc(']', stdout);
+    } else if (len <= 0) {
+        fprintf(stdout, "null");
+    }
+    fprintf(stdout, "}\n");
+    Read_Count++;
+}
+
+static unsigned device_free_requests(
+    BULK_DEVICE * device)
+{
+    return (device->inflight < Window) ? Window - device->inflight : 0;
+}
+
+static bool device_done(
+    BULK_DEVICE * device)
+{
+    return (device->next >= device->count) && (device->inflight == 0) &&
+        (device->again == 0);
+}
+
+static BULK_REQUEST *request_alloc(
+    void)
+{
+    unsigned i = 0;
+
+    for (i = 0; i < BULK_MAX_REQUESTS; i++) {
+        if (Requests[i].state == BULK_REQUEST_FREE) {
+            return &Requests[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* the request is sent again, in requests of at most batch targets */
+static void request_again(
+    BULK_REQUEST * request,
+    unsigned batch)
+{
+    request->state = BULK_REQUEST_AGAIN;
+    request->batch = batch ? batch : 1;
+    request->device->again++;
+}
+
+static void bulk_completed(
+    BACNET_ADDRESS * src,
+    uint8_t invoke_id,
+    BACNET_CONFIRMED_REPLY * reply,
+    void *context)
+{
+    static BACNET_RPM_ARENA arena;
+    BULK_REQUEST *request = (BULK_REQUEST *) context;
+    BULK_DEVICE *device = request->device;
+    BACNET_READ_ACCESS_DATA *rpm_data = NULL;
+    BACNET_READ_PROPERTY_DATA rp_data;
+    bool too_large = false;
+    char text[128];
+    int len = 0;
+
+    (void) src;
+    (void) invoke_id;
+    device->inflight--;
+    if ((reply->pdu_type == PDU_TYPE_COMPLEX_ACK) && reply->service_request) {
+        if (request->rpm) {
+            if (arena.block_size == 0) {
+                rpm_arena_init(&arena, MAX_APDU * 2);
+            }
+            rpm_arena_reset(&arena);
+            rpm_data =
+                rpm_arena_alloc(&arena, sizeof(BACNET_READ_ACCESS_DATA));
+            if (rpm_data) {
+                len =
+                    rpm_ack_decode_service_request_compact
+                    (reply->service_request, reply->service_len, rpm_data,
+                    &arena);
+            }
+            if (len > 0) {
+                print_rpm_ack(device->device_id, rpm_data);
+            }
+        } else {
+            len =
+                rp_ack_decode_service_request(reply->service_request,
+                reply->service_len, &rp_data);
+            if (len > 0) {
+                print_rp_ack(device->device_id, &rp_data);
+            }
+        }
+        if (len <= 0) {
+            fail_targets(device, request->first, request->count,
+                "malformed ack");
+        }
+        request->state = BULK_REQUEST_FREE;
+        return;
+    }
+    if (reply->timeout) {
+        fail_targets(device, request->first, request->count, "timeout");
+        request->state = BULK_REQUEST_FREE;
+        return;
+    }
+    /* the reply doesn't fit, in segments or at all: smaller requests */
+    too_large = (reply->pdu_type == PDU_TYPE_ABORT) &&
+        ((reply->reason == ABORT_REASON_SEGMENTATION_NOT_SUPPORTED) ||
+        (reply->reason == ABORT_REASON_BUFFER_OVERFLOW));
+    if (too_large && (request->count > 1)) {
+        if (device->batch > request->count / 2) {
+            device->batch = request->count / 2;
+        }
+        request_again(request, device->batch);
+        return;
+    }
+    /* a device without ReadPropertyMultiple is read a property at a time */
+    if (request->rpm && (reply->pdu_type == PDU_TYPE_REJECT) &&
+        (reply->reason == REJECT_REASON_UNRECOGNIZED_SERVICE)) {
+        device->rp_only = true;
+        request_again(request, 1);
+        return;
+    }
+    /* an Error for the whole of it, e.g. of an unknown object: each of */
+    /* the targets is read on its own for the error of that one */
+    if ((reply->pdu_type == PDU_TYPE_ERROR) && (request->count > 1)) {
+        request_again(request, 1);
+        return;
+    }
+    if (reply->pdu_type == PDU_TYPE_ERROR) {
+        snprintf(text, sizeof(text), "%s: %s",
+            bactext_error_class_name((int) reply->error_class),
+            bactext_error_code_name((int) reply->error_code));
+    } else if (reply->pdu_type == PDU_TYPE_ABORT) {
+        snprintf(text, sizeof(text), "abort: %s",
+            bactext_abort_reason_name((int) reply->reason));
+    } else if (reply->pdu_type == PDU_TYPE_REJECT) {
+        snprintf(text, sizeof(text), "reject: %s",
+            bactext_reject_reason_name((int) reply->reason));
+    } else {
+        snprintf(text, sizeof(text), "unexpected reply");
+    }
+    fail_targets(device, request->first, request->count, text);
+    request->state = BULK_REQUEST_FREE;
+}
+
+/* sends a request for the targets from first, as many of the count as fit
+   in the APDU of the device, and returns the number of them; 0 if no
+   invoke ID or request is free */
+static unsigned bulk_send(
+    BULK_DEVICE * device,
+    unsigned first,
+    unsigned count)
+{
+    BACNET_ADDRESS my_address;
+    BACNET_NPDU_DATA npdu_data;
+    BACNET_READ_PROPERTY_DATA rp_data;
+    BULK_REQUEST *request = NULL;
+    BULK_TARGET *target = NULL;
+    BULK_TARGET *object = NULL;
+    uint8_t *pdu = &Handler_Transmit_Buffer[0];
+    unsigned limit = device->max_apdu;
+    unsigned packed = 0;
+    uint8_t invoke_id = 0;
+    int pdu_len = 0;
+
+    request = request_alloc();
+    if (!request) {
+        return 0;
+    }
+    invoke_id = tsm_next_free_invokeID_peer(&device->dest);
+    if (!invoke_id) {
+        return 0;
+    }
+    if ((limit == 0) || (limit > MAX_PDU)) {
+        limit = MAX_PDU;
+    }
+    datalink_get_my_address(&my_address);
+    npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_NORMAL);
+    pdu_len = npdu_encode_pdu(&pdu[0], &device->dest, &my_address,
+        &npdu_data);
+    if (device->rp_only) {
+        target = &device->targets[first];
+        rp_data.object_type = target->object_type;
+        rp_data.object_instance = target->object_instance;
+        rp_data.object_property = target->object_property;
+        rp_data.array_index = target->array_index;
+        pdu_len += rp_encode_apdu(&pdu[pdu_len], invoke_id, &rp_data);
+        packed = 1;
+    } else {
+        pdu_len += rpm_encode_apdu_init(&pdu[pdu_len], invoke_id);
+        /* the objects of the targets next to each other are merged */
+        for (packed = 0; packed < count; packed++) {
+            target = &device->targets[first + packed];
+            if (((unsigned) pdu_len + BULK_TARGET_LEN) >= limit) {
+                break;
+            }
+            if (!object || (object->object_type != target->object_type) ||
+                (object->object_instance != target->object_instance)) {
+                if (object) {
+                    pdu_len += rpm_encode_apdu_object_end(&pdu[pdu_len]);
+                }
+                object = target;
+                pdu_len +=
+                    rpm_encode_apdu_object_begin(&pdu[pdu_len],
+                    target->object_type, target->object_instance);
+            }
+            pdu_len +=
+                rpm_encode_apdu_object_property(&pdu[pdu_len],
+                target->object_property, target->array_index);
+        }
+        if (object) {
+            pdu_len += rpm_encode_apdu_object_end(&pdu[pdu_len]);
+        }
+    }
+    if ((packed == 0) || ((unsigned) pdu_len >= limit)) {
+        tsm_free_invoke_id_peer(&device->dest, invoke_id);
+        fail_targets(device, first, 1, "exceeds the maximum APDU");
+        return 1;
+    }
+    request->state = BULK_REQUEST_INFLIGHT;
+    request->device = device;
+    request->first = first;
+    request->count = packed;
+    request->rpm = !device->rp_only;
+    tsm_set_confirmed_unsegmented_transaction(invoke_id, &device->dest,
+        &npdu_data, &pdu[0], (uint16_t) pdu_len);
+    tsm_set_completion(&device->dest, invoke_id, bulk_completed, request);
+    device->inflight++;
+    Request_Count++;
+    if (datalink_send_pdu(&device->dest, &npdu_data, &pdu[0], pdu_len) <= 0) {
+        fprintf(stderr, "Failed to Send Request (%s)!\n", strerror(errno));
+    }
+
+    return packed;
+}
+
+/* one more request may be sent, of the pacing */
+static bool bulk_paced(
+    uint32_t now)
+{
+    return !Sent_Once || ((now - Last_Send_ms) >= Interval);
+}
+
+static void bulk_sent(
+    uint32_t now)
+{
+    Sent_Once = true;
+    Last_Send_ms = now;
+}
+
+/* binds the device, then sends the requests its window has room for;
+   true once every target of it has its result */
+static bool device_task(
+    BULK_DEVICE * device,
+    uint32_t now,
+    uint32_t whois_ms)
+{
+    BULK_REQUEST *request = NULL;
+    unsigned count = 0;
+    unsigned sent = 0;
+    unsigned i = 0;
+
+    if (!device->bound) {
+        device->bound =
+            address_bind_request(device->device_id, &device->max_apdu,
+            &device->dest);
+        if (device->bound) {
+            /* fallthrough to the requests */
+        } else if ((device->whois == 0) ||
+            ((now - device->whois_ms) >= whois_ms)) {
+            if (device->whois > apdu_retries()) {
+                fail_targets(device, device->next,
+                    device->count - device->next, "device not found");
+                device->next = device->count;
+                return true;
+            }
+            if (!bulk_paced(now)) {
+                return false;
+            }
+            Send_WhoIs(device->device_id, device->device_id);
+            device->whois++;
+            device->whois_ms = now;
+            bulk_sent(now);
+            return false;
+        } else {
+            return false;
+        }
+    }
+    while (device_free_requests(device) && bulk_paced(now)) {
+        request = NULL;
+        if (device->again) {
+            for (i = 0; i < BULK_MAX_REQUESTS; i++) {
+                if ((Requests[i].state == BULK_REQUEST_AGAIN) &&
+                    (Requests[i].device == device)) {
+                    request = &Requests[i];
+                    break;
+                }
+            }
+        }
+        if (request) {
+            count = request->count;
+            if (count > request->batch) {
+                count = request->batch;
+            }
+            sent = bulk_send(device, request->first, count);
+            request->first += sent;
+            request->count -= sent;
+            if (request->count == 0) {
+                request->state = BULK_REQUEST_FREE;
+                device->again--;
+            }
+        } else if (device->next < device->count) {
+            count = device->count - device->next;
+            if (count > device->batch) {
+                count = device->batch;
+            }
+            sent = bulk_send(device, device->next, count);
+            device->next += sent;
+        } else {
+            break;
+        }
+        if (sent == 0) {
+            break;
+        }
+        bulk_sent(now);
+    }
+
+    return device_done(device);
+}
+
+/* the TSM timeouts and retries, when the first one is due */
+static BACNET_TIMER TSM_Timer;
+
+static uint32_t tsm_timer(
+    uint32_t elapsed_milliseconds)
+{
+    tsm_timer_milliseconds((uint16_t) (elapsed_milliseconds >
+            60000 ? 60000 : elapsed_milliseconds));
+
+    return tsm_timer_remaining();
+}
+
+/* a number, or the name of an object type or a property */
+static bool parse_enum(
+    const char *token,
+    bool (*name_index) (const char *search_name,
+        unsigned *found_index),
+    unsigned *value)
+{
+    char *end = NULL;
+
+    if (isdigit((unsigned char) token[0])) {
+        *value = (unsigned) strtoul(token, &end, 0);
+        return (*end == 0) || (*end == '[');
+    }
+
+    return name_index(token, value);
+}
+
+static bool parse_target(
+    BULK_TARGET * target,
+    const char *device,
+    const char *type,
+    const char *instance,
+    const char *property,
+    const char *index)
+{
+    unsigned value = 0;
+    const char *bracket = NULL;
+
+    if (!device[0] || !type[0] || !instance[0] || !property[0]) {
+        return false;
+    }
+    target->device_id = strtoul(device, NULL, 0);
+    target->object_instance = strtoul(instance, NULL, 0);
+    if ((target->device_id >= BACNET_MAX_INSTANCE) ||
+        (target->object_instance > BACNET_MAX_INSTANCE)) {
+        return false;
+    }
+    if (!parse_enum(type, bactext_object_type_index, &value) ||
+        (value >= MAX_BACNET_OBJECT_TYPE)) {
+        return false;
+    }
+    target->object_type = (BACNET_OBJECT_TYPE) value;
+    if (!parse_enum(property, bactext_property_index, &value) ||
+        (value > MAX_BACNET_PROPERTY_ID)) {
+        return false;
+    }
+    target->object_property = (BACNET_PROPERTY_ID) value;
+    /* the index as a field of its own, or as in bacrpm, 87[3] */
+    target->array_index = BACNET_ARRAY_ALL;
+    bracket = strchr(property, '[');
+    if (index && index[0] && (strcmp(index, "-1") != 0)) {
+        target->array_index = strtoul(index, NULL, 0);
+    } else if (bracket) {
+        target->array_index = strtoul(bracket + 1, NULL, 0);
+    }
+
+    return true;
+}
+
+static bool add_target(
+    BULK_TARGET * target)
+{
+    static unsigned capacity;
+    BULK_TARGET *targets = NULL;
+
+    if (Bulk_Target_Count == capacity) {
+        capacity = capacity ? capacity * 2 : 256;
+        targets = realloc(Bulk_Targets, capacity * sizeof(BULK_TARGET));
+        if (!targets) {
+            return false;
+        }
+        Bulk_Targets = targets;
+    }
+    target->order = Bulk_Target_Count;
+    Bulk_Targets[Bulk_Target_Count++] = *target;
+
+    return true;
+}
+
+/* device,object-type,object-instance,property[,index] - the fields are
+   numbers or names, blank lines and lines of # are skipped */
+static bool parse_csv_line(
+    char *line,
+    unsigned line_number)
+{
+    BULK_TARGET target;
+    char *fields[5] = { "", "", "", "", "" };
+    char *token = NULL;
+    unsigned count = 0;
+
+    while (isspace((unsigned char) *line)) {
+        line++;
+    }
+    if ((*line == 0) || (*line == '#')) {
+        return true;
+    }
+    for (token = strtok(line, ", \t\r\n"); token && (count < 5);
+        token = strtok(NULL, ", \t\r\n")) {
+        fields[count++] = token;
+    }
+    if (!parse_target(&target, fields[0], fields[1], fields[2], fields[3],
+            fields[4])) {
+        fprintf(stderr, "line %u: expected device,object-type,"
+            "object-instance,property[,index]\n", line_number);
+        return false;
+    }
+
+    return add_target(&target);
+}
+
+/* the value of the key of a flat JSON object, a number or a string */
+static void json_field(
+    const char *object,
+    const char *key,
+    char *value,
+    size_t size)
+{
+    char name[32];
+    const char *p = NULL;
+    size_t len = 0;
+
+    value[0] = 0;
+    snprintf(name, sizeof(name), "\"%s\"", key);
+    p = strstr(object, name);
+    if (!p) {
+        return;
+    }
+    p += strlen(name);
+    while (isspace((unsigned char) *p) || (*p == ':')) {
+        p++;
+    }
+    if (*p == '"') {
+        p++;
+        while (p[len] && (p[len] != '"') && (len + 1 < size)) {
+            len++;
+        }
+    } else {
+        while (p[len] && !strchr(",} \t\r\n", p[len]) && (len + 1 < size)) {
+            len++;
+        }
+    }
+    memcpy(value, p, len);
+    value[len] = 0;
+}
+
+/* an array of objects, or one object on each line, e.g.
+   {"device":123,"type":"analog-input","instance":1,"property":85} */
+static bool parse_json(
+    char *text)
+{
+    BULK_TARGET target;
+    char device[32], type[64], instance[32], property[64], index[32];
+    char *object = NULL;
+    char *end = NULL;
+
+    for (object = strchr(text, '{'); object; object = strchr(end + 1, '{')) {
+        end = strchr(object, '}');
+        if (!end) {
+            fprintf(stderr, "unterminated object: %.40s\n", object);
+            return false;
+        }
+        *end = 0;
+        json_field(object, "device", device, sizeof(device));
+        json_field(object, "type", type, sizeof(type));
+        json_field(object, "instance", instance, sizeof(instance));
+        json_field(object, "property", property, sizeof(property));
+        json_field(object, "index", index, sizeof(index));
+        if (!parse_target(&target, device, type, instance, property, index)) {
+            fprintf(stderr, "expected device, type, instance and property: "
+                "%.60s}\n", object);
+            return false;
+        }
+        if (!add_target(&target)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool load_targets(
+    const char *path)
+{
+    FILE *pFile = NULL;
+    char *text = NULL;
+    char *line = NULL;
+    char *next = NULL;
+    size_t len = 0;
+    size_t size = 0;
+    size_t got = 0;
+    unsigned line_number = 0;
+    bool status = true;
+
+    pFile = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+    if (!pFile) {
+        fprintf(stderr, "Unable to open file \"%s\" (%s)!\n", path,
+            strerror(errno));
+        return false;
+    }
+    do {
+        if (len + 1 >= size) {
+            size = size ? size * 2 : 65536;
+            next = realloc(text, size);
+            if (!next) {
+                status = false;
+                break;
+            }
+            text = next;
+        }
+        got = fread(&text[len], 1, size - len - 1, pFile);
+        len += got;
+    } while (got > 0);
+    if (pFile != stdin) {
+        fclose(pFile);
+    }
+    if (!status) {
+        free(text);
+        return false;
+    }
+    text[len] = 0;
+    for (line = text; isspace((unsigned char) *line); line++) {
+    }
+    if ((*line == '[') || (*line == '{')) {
+        status = parse_json(line);
+    } else {
+        for (line = text; line && status; line = next) {
+            next = strchr(line, '\n');
+            if (next) {
+                *next++ = 0;
+            }
+            status = parse_csv_line(line, ++line_number);
+        }
+    }
+    free(text);
+
+    return status;
+}
+
+static int target_compare(
+    const void *a,
+    const void *b)
+{
+    const BULK_TARGET *ta = (const BULK_TARGET *) a;
+    const BULK_TARGET *tb = (const BULK_TARGET *) b;
+
+    if (ta->device_id != tb->device_id) {
+        return (ta->device_id < tb->device_id) ? -1 : 1;
+    }
+    return (ta->order < tb->order) ? -1 : (ta->order > tb->order);
+}
+
+/* the targets of each device together, in the order of the list */
+static bool group_targets(
+    void)
+{
+    unsigned i = 0;
+
+    qsort(Bulk_Targets, Bulk_Target_Count, sizeof(BULK_TARGET), target_compare);
+    Bulk_Devices = calloc(Bulk_Target_Count ? Bulk_Target_Count : 1, sizeof(BULK_DEVICE));
+    if (!Bulk_Devices) {
+        return false;
+    }
+    for (i = 0; i < Bulk_Target_Count; i++) {
+        if ((i == 0) || (Bulk_Targets[i].device_id != Bulk_Targets[i - 1].device_id)) {
+            Bulk_Devices[Bulk_Device_Count].device_id = Bulk_Targets[i].device_id;
+            Bulk_Devices[Bulk_Device_Count].targets = &Bulk_Targets[i];
+            Bulk_Devices[Bulk_Device_Count].batch = Batch;
+            Bulk_Device_Count++;
+        }
+        Bulk_Devices[Bulk_Device_Count - 1].count++;
+    }
+
+    return true;
+}
+
+static unsigned env_unsigned(
+    const char *name,
+    unsigned value)
+{
+    char *pEnv = getenv(name);
+
+    if (pEnv) {
+        value = (unsigned) strtol(pEnv, NULL, 0);
+    }
+
+    return value;
+}
+
+int main(
+    int argc,
+    char *argv[])
+{
+    BACNET_ADDRESS src = {
+        0
+    };  /* address where message came from */
+    uint16_t pdu_len = 0;
+    unsigned timeout = 100;     /* milliseconds */
+    unsigned concurrency = BULK_DEVICES_DEFAULT;
+    unsigned active = 0;
+    unsigned started = 0;
+    unsigned i = 0;
+    uint32_t current_ms = 0;
+    uint32_t start_ms = 0;
+    uint32_t whois_ms = 0;
+
+    if ((argc < 2) || (strcmp(argv[1], "--help") == 0)) {
+        printf("Usage: %s targets-file\r\n", filename_remove_path(argv[0]));
+        if (argc > 1) {
+            printf("targets-file:\r\n"
+                "The properties to read, - for stdin, as the lines\r\n"
+                "device-instance,object-type,object-instance,property[,index]\r\n"
+                "or as a JSON array of objects, or one object a line, of\r\n"
+                "{\"device\":123,\"type\":0,\"instance\":1,\"property\":85}\r\n"
+                "with an optional \"index\".  The types and properties are\r\n"
+                "numbers or names, e.g. analog-input and present-value.\r\n"
+                "Each device is bound once, its properties are read with\r\n"
+                "ReadPropertyMultiple, and each value is printed as a JSON\r\n"
+                "line with a value or an error.\r\n"
+                "\r\nBACNET_BULK_DEVICES - the devices read at once, "
+                "default %u\r\n"
+                "BACNET_BULK_WINDOW - the requests in flight to a device, "
+                "default %u\r\n"
+                "BACNET_BULK_BATCH - the properties in a request, "
+                "default %u\r\n"
+                "BACNET_BULK_INTERVAL - the milliseconds between two "
+                "requests, default 0\r\n", BULK_DEVICES_DEFAULT,
+                BULK_WINDOW_DEFAULT, BULK_BATCH_DEFAULT);
+        }
+        return 0;
+    }
+    concurrency = env_unsigned("BACNET_BULK_DEVICES", concurrency);
+    Window = env_unsigned("BACNET_BULK_WINDOW", Window);
+    Batch = env_unsigned("BACNET_BULK_BATCH", Batch);
+    Interval = env_unsigned("BACNET_BULK_INTERVAL", 0);
+    if (concurrency == 0)
+        concurrency = 1;
+    if (Window == 0)
+        Window = 1;
+    if (Batch == 0)
+        Batch = 1;
+    if (!load_targets(argv[1]) || !group_targets()) {
+        return 1;
+    }
+    Active = calloc(concurrency, sizeof(BULK_DEVICE *));
+    if (!Active) {
+        return 1;
+    }
+    /* setup my info */
+    Device_Set_Object_Instance_Number(BACNET_MAX_INSTANCE);
+    address_init();
+    Device_Init(NULL);
+    apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_WHO_IS, handler_who_is);
+    apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_I_AM, handler_i_am_bind);
+    apdu_set_unrecognized_service_handler_handler
+        (handler_unrecognized_service);
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_READ_PROPERTY,
+        handler_read_property);
+    /* the replies to the reads go to the completion of each request */
+    dlenv_init();
+    atexit(datalink_cleanup);
+    current_ms = bactimer_milliseconds();
+    start_ms = current_ms;
+    bactimer_register(&TSM_Timer, tsm_timer, current_ms, BACTIMER_IDLE);
+    whois_ms = apdu_timeout();
+    while ((active > 0) || (started < Bulk_Device_Count)) {
+        current_ms = bactimer_milliseconds();
+        /* the devices after those done, as many at once as allowed */
+        while ((active < concurrency) && (started < Bulk_Device_Count)) {
+            Active[active++] = &Bulk_Devices[started++];
+        }
+        for (i = 0; i < active;) {
+            if (device_task(Active[i], current_ms, whois_ms)) {
+                Active[i] = Active[--active];
+            } else {
+                i++;
+            }
+        }
+        fflush(stdout);
+        /* the requests just sent are timed, the bindings and the pacing */
+        /* are looked at again within 10ms */
+        bactimer_due(&TSM_Timer, current_ms, tsm_timer_remaining());
+        timeout = bactimer_next(current_ms);
+        if (timeout > 10) {
+            timeout = 10;
+        }
+        /* returns 0 bytes on timeout */
+        pdu_len = datalink_receive(&src, &Rx_Buf[0], MAX_MPDU, timeout);
+
+        /* process */
+        if (pdu_len) {
+            npdu_handler(&src, &Rx_Buf[0], pdu_len);
+        }
+        bactimer_run(bactimer_milliseconds());
+    }
+    fflush(stdout);
+    fprintf(stderr, "%u values of %u devices in %lu ms, %u requests, "
+        "%u failed\n", Read_Count, Bulk_Device_Count,
+        (unsigned long) (bactimer_milliseconds() - start_ms), Request_Count,
+        Failed_Count);
+    free(Active);
+    free(Bulk_Devices);
+    free(Bulk_Targets);
+
+    return Failed_Count ? 1 : 0;
+}
@@ -23,17 +23,19 @@
 *
 *********************************************************************/
 
-/* command line tool that sends a BACnet service, and displays the reply */
+/* command line tool that reads a file of a device with AtomicReadFile */
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>       /* for time */
 #include <errno.h>
 #include "bactext.h"
 #include "iam.h"
 #include "arf.h"
 #include "tsm.h"
+#include "bactimer.h"
 #include "address.h"
 #include "config.h"
 #include "bacdef.h"
@@ -49,6 +51,10 @@
 #include "client.h"
 #include "txbuf.h"
 #include "dlenv.h"
+#include "filexfer.h"
+
+/* the requests in flight, unless BACNET_FILE_WINDOW says otherwise */
+#define FILE_WINDOW_DEFAULT 8
 
 /* buffer used for receive */
 static uint8_t Rx_Buf[MAX_MPDU] = { 0 };
@@ -58,117 +64,9 @@ static uint32_t Target_File_Object_Instance = BACNET_MAX_INSTANCE;
 static uint32_t Target_Device_Object_Instance = BACNET_MAX_INSTANCE;
 static BACNET_ADDRESS Target_Address;
 static char *Local_File_Name = NULL;
-static int Target_File_Start_Position;
-static unsigned int Target_File_Requested_Octet_Count;
-static bool End_Of_File_Detected = false;
-static bool Error_Detected = false;
-static uint8_t Request_Invoke_ID = 0;
-
-static void Atomic_Read_File_Error_Handler(
-    BACNET_ADDRESS * src,
-    uint8_t invoke_id,
-    BACNET_ERROR_CLASS error_class,
-    BACNET_ERROR_CODE error_code)
-{
-    if (address_match(&Target_Address, src) &&
-        (invoke_id == Request_Invoke_ID)) {
-        printf("BACnet Error: %s: %s\n",
-            bactext_error_class_name((int) error_class),
-            bactext_error_code_name((int) error_code));
-        Error_Detected = true;
-    }
-}
-
-void MyAbortHandler(
-    BACNET_ADDRESS * src,
-    uint8_t invoke_id,
-    uint8_t abort_reason,
-    bool server)
-{
-    (void) server;
-    if (address_match(&Target_Address, src) &&
-        (invoke_id == Request_Invoke_ID)) {
-        printf("BACnet Abort: %s\n",
-            bactext_abort_reason_name((int) abort_reason));
-        Error_Detected = true;
-    }
-}
-
-void MyRejectHandler(
-    BACNET_ADDRESS * src,
-    uint8_t invoke_id,
-    uint8_t reject_reason)
-{
-    if (address_match(&Target_Address, src) &&
-        (invoke_id == Request_Invoke_ID)) {
-        printf("BACnet Reject: %s\n",
-            bactext_reject_reason_name((int) reject_reason));
-        Error_Detected = true;
-    }
-}
-
-static void AtomicReadFileAckHandler(
-    uint8_t * service_request,
-    uint16_t service_len,
-    BACNET_ADDRESS * src,
-    BACNET_CONFIRMED_SERVICE_ACK_DATA * service_data)
-{
-    int len = 0;
-    int result = 0;
-    BACNET_ATOMIC_READ_FILE_DATA data;
-    FILE *pFile = NULL; /* stream pointer */
-    size_t octets_written = 0;
-
-    if (address_match(&Target_Address, src) &&
-        (service_data->invoke_id == Request_Invoke_ID)) {
-        len = arf_ack_decode_service_request(service_request, service_len, &data);
-        if ((len > 0) && (data.access == FILE_STREAM_ACCESS)) {
-            if (data.type.stream.fileStartPosition == 0) {
-                pFile = fopen(Local_File_Name, "wb");
-            } else {
-                pFile = fopen(Local_File_Name, "rb+");
-            }
-            if (pFile) {
-                result = fseek(pFile, data.type.stream.fileStartPosition,
-                    SEEK_SET);
-                if (result == 0) {
-                    /* unit to write in bytes -
-                       in our case, an octet is one byte */
-                    octets_written = fwrite(
-                        octetstring_value(&data.fileData), 1,
-                        octetstring_length(&data.fileData), pFile);
-                    if (octets_written !=
-                        octetstring_length(&data.fileData)) {
-                        fprintf(stderr,
-                            "Unable to write data to file \"%s\".\n",
-                            Local_File_Name);
-                    } else if (octets_written == 0) {
-                        fprintf(stderr, "Received 0 byte octet string!.\n");
-                    } else {
-                        Target_File_Start_Position =
-                            data.type.stream.fileStartPosition +
-                            octets_written;
-                        printf("\r%d bytes", (int)Target_File_Start_Position);
-                    }
-                    fflush(pFile);
-                } else {
-                    fprintf(stderr, "Unable to seek to %d!\n",
-                        data.type.stream.fileStartPosition);
-                }
-                fclose(pFile);
-            }
-            if (data.endOfFile) {
-                End_Of_File_Detected = true;
-                printf("\n");
-            }
-        } else {
-            fprintf(stderr, "Decode error! %d bytes decoded.\n", len);
-        }
-    } else {
-        fprintf(stderr, "Address & Invoke ID mismatch! Invoke ID=%d\n",
-            Request_Invoke_ID);
-    }
-}
+/* of the I-Am of the device, none if it is bound without one */
+static int Target_Segmentation = SEGMENTATION_NONE;
+static BACNET_FILE_TRANSFER Transfer;
 
 static void LocalIAmHandler(
     uint8_t * service_request,
@@ -188,6 +86,8 @@ static void LocalIAmHandler(
         &segmentation, &vendor_id);
     if (len != -1) {
         address_add(device_id, max_apdu, src);
+        if (device_id == Target_Device_Object_Instance)
+            Target_Segmentation = segmentation;
     } else
         fprintf(stderr, "!\n");
 
@@ -210,14 +110,40 @@ static void Init_Service_Handlers(
     /* we must implement read property - it's required! */
     apdu_set_confirmed_handler(SERVICE_CONFIRMED_READ_PROPERTY,
         handler_read_property);
-    /* handle the data coming back from confirmed requests */
-    apdu_set_confirmed_ack_handler(SERVICE_CONFIRMED_ATOMIC_READ_FILE,
-        AtomicReadFileAckHandler);
-    /* handle any errors coming back */
-    apdu_set_error_handler(SERVICE_CONFIRMED_ATOMIC_READ_FILE,
-        Atomic_Read_File_Error_Handler);
-    apdu_set_abort_handler(MyAbortHandler);
-    apdu_set_reject_handler(MyRejectHandler);
+    /* the replies to the reads go to the completion of the transfer */
+}
+
+/* the retries and the timeouts of the reads, when the first is due */
+static BACNET_TIMER TSM_Timer;
+
+static uint32_t tsm_timer(
+    uint32_t elapsed_milliseconds)
+{
+    tsm_timer_milliseconds((uint16_t) (elapsed_milliseconds >
+            60000 ? 60000 : elapsed_milliseconds));
+
+    return tsm_timer_remaining();
+}
+
+static void print_failure(
+    BACNET_FILE_TRANSFER * transfer)
+{
+    if (transfer->timeout) {
+        fprintf(stderr, "\rError: TSM Timeout!\r\n");
+    } else if (transfer->pdu_type == PDU_TYPE_ERROR) {
+        printf("BACnet Error: %s: %s\n",
+            bactext_error_class_name((int) transfer->error_class),
+            bactext_error_code_name((int) transfer->error_code));
+    } else if (transfer->pdu_type == PDU_TYPE_ABORT) {
+        printf("BACnet Abort: %s\n",
+            bactext_abort_reason_name((int) transfer->reason));
+    } else if (transfer->pdu_type == PDU_TYPE_REJECT) {
+        printf("BACnet Reject: %s\n",
+            bactext_reject_reason_name((int) transfer->reason));
+    } else {
+        fprintf(stderr, "Unable to write data to file \"%s\".\n",
+            Local_File_Name);
+    }
 }
 
 int main(
@@ -230,18 +156,23 @@ int main(
     uint16_t pdu_len = 0;
     unsigned timeout = 100;     /* milliseconds */
     unsigned max_apdu = 0;
-    time_t elapsed_seconds = 0;
-    time_t last_seconds = 0;
-    time_t current_seconds = 0;
-    time_t timeout_seconds = 0;
-    uint8_t invoke_id = 0;
+    uint32_t elapsed_ms = 0;
+    uint32_t last_ms = 0;
+    uint32_t current_ms = 0;
+    uint32_t timeout_ms = 0;
+    uint32_t start_ms = 0;
+    uint32_t printed = 0;
+    unsigned window = FILE_WINDOW_DEFAULT;
     bool found = false;
-    uint16_t my_max_apdu = 0;
+    char *pEnv = NULL;
+    FILE *pFile = NULL;
 
     if (argc < 4) {
         /* FIXME: what about access method - record or stream? */
-        printf("%s device-instance file-instance local-name\r\n",
-            filename_remove_path(argv[0]));
+        printf("%s device-instance file-instance local-name\r\n"
+            "BACNET_FILE_WINDOW - the requests in flight at once, "
+            "default %u\r\n", filename_remove_path(argv[0]),
+            FILE_WINDOW_DEFAULT);
         return 0;
     }
     /* decode the command line parameters */
@@ -258,15 +189,29 @@ int main(
             Target_File_Object_Instance, BACNET_MAX_INSTANCE + 1);
         return 1;
     }
+    pEnv = getenv("BACNET_FILE_WINDOW");
+    if (pEnv) {
+        window = (unsigned) strtol(pEnv, NULL, 0);
+    }
+    pFile = fopen(Local_File_Name, "wb");
+    if (!pFile) {
+        fprintf(stderr, "Unable to open file \"%s\" (%s)!\n", Local_File_Name,
+            strerror(errno));
+        return 1;
+    }
     /* setup my info */
     Device_Set_Object_Instance_Number(BACNET_MAX_INSTANCE);
     address_init();
     Init_Service_Handlers();
     dlenv_init();
     atexit(datalink_cleanup);
+    file_transfer_init(&Transfer, Target_Device_Object_Instance,
+        Target_File_Object_Instance, pFile, false, window);
     /* configure the timeout values */
-    last_seconds = time(NULL);
-    timeout_seconds = (apdu_timeout() / 1000) * apdu_retries();
+    last_ms = bactimer_milliseconds();
+    start_ms = last_ms;
+    bactimer_register(&TSM_Timer, tsm_timer, last_ms, BACTIMER_IDLE);
+    timeout_ms = apdu_timeout() * apdu_retries();
     /* try to bind with the device */
     found =
         address_bind_request(Target_Device_Object_Instance, &max_apdu,
@@ -275,11 +220,7 @@ int main(
         Send_WhoIs(Target_Device_Object_Instance,
             Target_Device_Object_Instance);
     }
-    /* loop forever */
-    for (;;) {
-        /* increment timer - exit if timed out */
-        current_seconds = time(NULL);
-
+    while (!file_transfer_done(&Transfer)) {
         /* returns 0 bytes on timeout */
         pdu_len = datalink_receive(&src, &Rx_Buf[0], MAX_MPDU, timeout);
 
@@ -287,73 +228,54 @@ int main(
         if (pdu_len) {
             npdu_handler(&src, &Rx_Buf[0], pdu_len);
         }
-        /* at least one second has passed */
-        if (current_seconds != last_seconds) {
-            tsm_timer_milliseconds(((current_seconds - last_seconds) * 1000));
-        }
+        current_ms = bactimer_milliseconds();
+        bactimer_run(current_ms);
         /* wait until the device is bound, or timeout and quit */
         if (!found) {
             found =
                 address_bind_request(Target_Device_Object_Instance, &max_apdu,
                 &Target_Address);
+            elapsed_ms += current_ms - last_ms;
+            if (!found && (elapsed_ms > timeout_ms)) {
+                fprintf(stderr, "\rError: APDU Timeout!\r\n");
+                fclose(pFile);
+                return 1;
+            }
         }
         if (found) {
-            /* calculate the smaller of our APDU size or theirs
-               and remove the overhead of the APDU (about 16 octets max).
-               note: we could fail if there is a bottle neck (router)
-               and smaller MPDU in betweeen. */
-            if (max_apdu < MAX_APDU) {
-                my_max_apdu = max_apdu;
-            } else {
-                my_max_apdu = MAX_APDU;
+            /* the reads are larger when the device sends them in segments */
+            if (!Transfer.bound) {
+                Transfer.segmentation =
+                    (Target_Segmentation == SEGMENTATION_BOTH) ||
+                    (Target_Segmentation == SEGMENTATION_TRANSMIT);
             }
-            /* Typical sizes are 50, 128, 206, 480, 1024, and 1476 octets */
-            if (my_max_apdu <= 50) {
-                Target_File_Requested_Octet_Count = my_max_apdu - 20;
-            } else if (my_max_apdu <= 480) {
-                Target_File_Requested_Octet_Count = my_max_apdu - 32;
-            } else if (my_max_apdu <= 1476) {
-                Target_File_Requested_Octet_Count = my_max_apdu - 64;
-            } else {
-                Target_File_Requested_Octet_Count = my_max_apdu / 2;
-            }
-            /* has the previous invoke id expired or returned?
-               note: invoke ID = 0 is invalid, so it will be idle */
-            if ((invoke_id == 0) || tsm_invoke_id_free(invoke_id)) {
-                if (End_Of_File_Detected || Error_Detected) {
-                    break;
-                }
-                /* the ACK will increment the start position if OK */
-                /* we'll read the file in chunks
-                   less than max_apdu to keep unsegmented */
-                invoke_id =
-                    Send_Atomic_Read_File_Stream(Target_Device_Object_Instance,
-                    Target_File_Object_Instance, Target_File_Start_Position,
-                    Target_File_Requested_Octet_Count);
-                Request_Invoke_ID = invoke_id;
-            } else if (tsm_invoke_id_failed(invoke_id)) {
-                fprintf(stderr, "\rError: TSM Timeout!\r\n");
-                tsm_free_invoke_id(invoke_id);
-                /* try again or abort? */
-                Error_Detected = true;
-                break;
-            }
-        } else {
-            /* increment timer - exit if timed out */
-            elapsed_seconds += (current_seconds - last_seconds);
-            if (elapsed_seconds > timeout_seconds) {
-                fprintf(stderr, "\rError: APDU Timeout!\r\n");
-                Error_Detected = true;
-                break;
+            file_transfer_task(&Transfer);
+            if (Transfer.done != printed) {
+                printed = Transfer.done;
+                printf("\r%lu bytes", (unsigned long) printed);
+                fflush(stdout);
             }
         }
+        /* the reads just sent are timed, the binding is looked at */
+        /* again within 100ms */
+        bactimer_due(&TSM_Timer, current_ms, tsm_timer_remaining());
+        timeout = bactimer_next(current_ms);
+        if (timeout > 100) {
+            timeout = 100;
+        }
         /* keep track of time for next check */
-        last_seconds = current_seconds;
+        last_ms = current_ms;
     }
-
-    if (Error_Detected) {
+    printf("\n");
+    fclose(pFile);
+    if (Transfer.state == FILE_TRANSFER_FAILED) {
+        print_failure(&Transfer);
         return 1;
     }
+    fprintf(stderr, "%lu bytes in %lu ms, %lu requests, %lu sent again\n",
+        (unsigned long) Transfer.done,
+        (unsigned long) (bactimer_milliseconds() - start_ms),
+        (unsigned long) Transfer.requests, (unsigned long) Transfer.retries);
 
     return 0;
 }
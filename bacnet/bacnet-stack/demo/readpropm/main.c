@@ -112,8 +112,9 @@ void MyRejectHandler(
 
 /** Handler for a ReadPropertyMultiple ACK.
  * @ingroup DSRPM
- * For each read property, print out the ACK'd data,
- * and free the request data items from linked property list.
+ * For each read property, print out the ACK'd data.
+ * The data is decoded into compact views in an arena that is kept for
+ * the next ack.
  *
  * @param service_request [in] The contents of the service request.
  * @param service_len [in] The length of the service_request.
@@ -127,60 +128,28 @@ void My_Read_Property_Multiple_Ack_Handler(
     BACNET_ADDRESS * src,
     BACNET_CONFIRMED_SERVICE_ACK_DATA * service_data)
 {
+    static BACNET_RPM_ARENA arena;
     int len = 0;
     BACNET_READ_ACCESS_DATA *rpm_data;
-    BACNET_READ_ACCESS_DATA *old_rpm_data;
-    BACNET_PROPERTY_REFERENCE *rpm_property;
-    BACNET_PROPERTY_REFERENCE *old_rpm_property;
-    BACNET_APPLICATION_DATA_VALUE *value;
-    BACNET_APPLICATION_DATA_VALUE *old_value;
 
     if (address_match(&Target_Address, src) &&
         (service_data->invoke_id == Request_Invoke_ID)) {
-        rpm_data = calloc(1, sizeof(BACNET_READ_ACCESS_DATA));
+        if (arena.block_size == 0) {
+            rpm_arena_init(&arena, MAX_APDU * 2);
+        }
+        rpm_arena_reset(&arena);
+        rpm_data = rpm_arena_alloc(&arena, sizeof(BACNET_READ_ACCESS_DATA));
         if (rpm_data) {
             len =
-                rpm_ack_decode_service_request(service_request, service_len,
-                rpm_data);
+                rpm_ack_decode_service_request_compact(service_request,
+                service_len, rpm_data, &arena);
         }
         if (len > 0) {
-            while (rpm_data) {
+            for (; rpm_data; rpm_data = rpm_data->next) {
                 rpm_ack_print_data(rpm_data);
-                rpm_property = rpm_data->listOfProperties;
-                while (rpm_property) {
-                    value = rpm_property->value;
-                    while (value) {
-                        old_value = value;
-                        value = value->next;
-                        free(old_value);
-                    }
-                    old_rpm_property = rpm_property;
-                    rpm_property = rpm_property->next;
-                    free(old_rpm_property);
-                }
-                old_rpm_data = rpm_data;
-                rpm_data = rpm_data->next;
-                free(old_rpm_data);
             }
         } else {
-            fprintf(stderr, "RPM Ack Malformed! Freeing memory...\n");
-            while (rpm_data) {
-                rpm_property = rpm_data->listOfProperties;
-                while (rpm_property) {
-                    value = rpm_property->value;
-                    while (value) {
-                        old_value = value;
-                        value = value->next;
-                        free(old_value);
-                    }
-                    old_rpm_property = rpm_property;
-                    rpm_property = rpm_property->next;
-                    free(old_rpm_property);
-                }
-                old_rpm_data = rpm_data;
-                rpm_data = rpm_data->next;
-                free(old_rpm_data);
-            }
+            fprintf(stderr, "RPM Ack Malformed!\n");
         }
     }
 }
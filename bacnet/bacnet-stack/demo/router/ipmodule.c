@@ -337,23 +337,23 @@ int dl_ip_recv(
                     (void) decode_unsigned16(&data->buff[2], &buff_len);
                     /* subtract off the BVLC header */
                     buff_len -= 4;
-                    if (buff_len < data->max_buff) {
-                        /* allocate data message stucture */
-                        (*msg_data) = (MSG_DATA *) malloc(sizeof(MSG_DATA));
-                        (*msg_data)->pdu_len = buff_len;
-                        (*msg_data)->pdu =
-                            (uint8_t *) malloc((*msg_data)->pdu_len);
+                    if ((buff_len < data->max_buff) &&
+                        (buff_len <= MSG_PDU_SIZE) &&
+                        ((*msg_data) = alloc_data()) != NULL) {
                         /* fill up data message structure */
+                        (*msg_data)->pdu_len = buff_len;
                         memmove(&(*msg_data)->pdu[0], &data->buff[4],
                             (*msg_data)->pdu_len);
                         memmove(&(*msg_data)->src, src,
                             sizeof(BACNET_ADDRESS));
                     }
-                    /* ignore packets that are too large */
+                    /* ignore packets that are too large, or that
+                       arrive while every message slot is in use */
                     else {
                         buff_len = 0;
 
-                        PRINT(ERROR, "BIP: PDU too large. Discarded!.\n");
+                        PRINT(ERROR, "BIP: PDU too large or no free "
+                            "message slot. Discarded!.\n");
 
                     }
                 }
@@ -374,19 +374,18 @@ int dl_ip_recv(
                     (void) decode_unsigned16(&data->buff[2], &buff_len);
                     /* subtract off the BVLC header */
                     buff_len -= 10;
-                    if (buff_len < data->max_buff) {
-                        /* allocate data message stucture */
-                        (*msg_data) = (MSG_DATA *) malloc(sizeof(MSG_DATA));
-                        (*msg_data)->pdu_len = buff_len;
-                        (*msg_data)->pdu =
-                            (uint8_t *) malloc((*msg_data)->pdu_len);
+                    if ((buff_len < data->max_buff) &&
+                        (buff_len <= MSG_PDU_SIZE) &&
+                        ((*msg_data) = alloc_data()) != NULL) {
                         /* fill up data message structure */
+                        (*msg_data)->pdu_len = buff_len;
                         memmove(&(*msg_data)->pdu[0], &data->buff[4 + 6],
                             (*msg_data)->pdu_len);
                         memmove(&(*msg_data)->src, src,
                             sizeof(BACNET_ADDRESS));
                     } else {
-                        /* ignore packets that are too large */
+                        /* ignore packets that are too large, or that
+                           arrive while every message slot is in use */
                         buff_len = 0;
                     }
                 }
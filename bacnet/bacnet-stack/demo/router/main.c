@@ -104,10 +104,12 @@ int main(
     printf("I am router\n");
 
     ROUTER_PORT *port;
+    ROUTER_PORT *inbox = NULL;
     BACMSG msg_storage, *bacmsg = NULL;
     MSG_DATA *msg_data = NULL;
     uint8_t *buff = NULL;
     int16_t buff_len = 0;
+    int i;
 
     atexit(cleanup);
 
@@ -134,31 +136,40 @@ int main(
             }
         }
 
-        bacmsg = recv_from_msgbox(head->main_id, &msg_storage);
+        /* take the next message from the port mailboxes in turn */
+        bacmsg = NULL;
+        for (i = 0; (i < port_count) && !bacmsg; i++) {
+            inbox = (inbox && inbox->next) ? inbox->next : head;
+            bacmsg = recv_from_msgbox(inbox->main_id, &msg_storage);
+        }
         if (bacmsg) {
             switch (bacmsg->type) {
                 case DATA:
                     {
                         MSGBOX_ID msg_src = bacmsg->origin;
-
-                        /* allocate message structure */
-                        msg_data = malloc(sizeof(MSG_DATA));
-                        if (!msg_data) {
-                            PRINT(ERROR, "Error: Could not allocate memory\n");
-                            break;
-                        }
+                        bool network_msg = is_network_msg(bacmsg);
 
                         print_msg(bacmsg);
 
-                        if (is_network_msg(bacmsg)) {
+                        if (network_msg) {
+                            /* replies are built in a slot of their own */
+                            msg_data = alloc_data();
+                            if (!msg_data) {
+                                PRINT(ERROR, "Error: No free message slot\n");
+                                free_data(bacmsg->data);
+                                break;
+                            }
                             buff_len =
                                 process_network_message(bacmsg, msg_data,
                                 &buff);
+                            free_data(bacmsg->data);
                             if (buff_len == 0) {
-                                free_data(bacmsg->data);
+                                free_data(msg_data);
                                 break;
                             }
                         } else {
+                            /* forwarded in place, no copy of the APDU */
+                            msg_data = (MSG_DATA *) bacmsg->data;
                             buff_len = process_msg(bacmsg, msg_data, &buff);
                         }
 
@@ -175,29 +186,35 @@ int main(
                             msg_storage.type = DATA;
                             msg_storage.data = msg_data;
 
-                            print_msg(bacmsg);
+                            print_msg(&msg_storage);
 
-                            if (is_network_msg(bacmsg)) {
+                            if (network_msg) {
                                 msg_data->ref_count = 1;
-                                send_to_msgbox(msg_src, &msg_storage);
+                                if (!send_to_msgbox(msg_src, &msg_storage)) {
+                                    check_data(msg_data);
+                                }
                             } else if (msg_data->dest.net !=
                                 BACNET_BROADCAST_NETWORK) {
                                 msg_data->ref_count = 1;
                                 port =
                                     find_dnet(msg_data->dest.net,
                                     &msg_data->dest);
-                                send_to_msgbox(port->port_id, &msg_storage);
+                                if (!send_to_msgbox(port->port_id,
+                                        &msg_storage)) {
+                                    check_data(msg_data);
+                                }
                             } else {
+                                /* one reference per port; the ports
+                                   that don't get it give theirs back */
                                 port = head;
-                                msg_data->ref_count = port_count - 1;
+                                msg_data->ref_count = port_count;
                                 while (port != NULL) {
                                     if (port->port_id == msg_src ||
-                                        port->state == FINISHED) {
-                                        port = port->next;
-                                        continue;
+                                        port->state == FINISHED ||
+                                        !send_to_msgbox(port->port_id,
+                                            &msg_storage)) {
+                                        check_data(msg_data);
                                     }
-                                    send_to_msgbox(port->port_id,
-                                        &msg_storage);
                                     port = port->next;
                                 }
                             }
@@ -702,14 +719,15 @@ bool init_router(
     MSGBOX_ID msgboxid;
     ROUTER_PORT *port;
 
-    msgboxid = create_msgbox();
-    if (msgboxid == INVALID_MSGBOX_ID)
-        return false;
-
     port = head;
-    /* add main message box id to all ports */
+    /* each port gets its own message box to the main thread,
+       so that every box has a single producer */
     while (port != NULL) {
+        msgboxid = create_msgbox();
+        if (msgboxid == INVALID_MSGBOX_ID)
+            return false;
         port->main_id = msgboxid;
+        add_port_net(port);
         port = port->next;
     }
 
@@ -747,11 +765,10 @@ void cleanup(
     msg.type = SERVICE;
     msg.subtype = SHUTDOWN;
 
-    del_msgbox(head->main_id);  /* close routers message box */
-
     /* send shutdown message to all router ports */
     port = head;
     while (port != NULL) {
+        del_msgbox(port->main_id);      /* close routers message box */
         if (port->state == RUNNING)
             send_to_msgbox(port->port_id, &msg);
         port = port->next;
@@ -768,7 +785,6 @@ void cleanup(
         }
     }
 
-    pthread_mutex_destroy(&msg_lock);
 }
 
 void print_msg(
@@ -803,8 +819,6 @@ uint16_t process_msg(
     int apdu_len;
     int npdu_len;
 
-    memmove(data, msg->data, sizeof(MSG_DATA));
-
     apdu_offset = npdu_decode(data->pdu, &data->dest, &addr, &npdu_data);
     apdu_len = data->pdu_len - apdu_offset;
 
@@ -812,6 +826,11 @@ uint16_t process_msg(
     destport = find_dnet(data->dest.net, NULL);
     assert(srcport);
 
+    if (destport && !dnet_available(data->dest.net)) {
+        PRINT(INFO, "Message discarded: NET busy\n");
+        return -2;
+    }
+
     if (srcport && destport) {
         data->src.net = srcport->route_info.net;
 
@@ -829,20 +848,18 @@ uint16_t process_msg(
             npdu_len = npdu_encode_pdu(npdu, NULL, &data->src, &npdu_data);
         }
 
-        buff_len = npdu_len + data->pdu_len - apdu_offset;
+        buff_len = npdu_len + apdu_len;
 
-        *buff = (uint8_t *) malloc(buff_len);
-        memmove(*buff, npdu, npdu_len); /* copy newly formed NPDU */
-        memmove(*buff + npdu_len, &data->pdu[apdu_offset], apdu_len);   /* copy APDU */
+        /* the new NPDU goes right in front of the APDU; the slot
+           headroom leaves room for it to be longer than the old one */
+        *buff = &data->pdu[apdu_offset] - npdu_len;
+        memmove(*buff, npdu, npdu_len);
 
     } else {
         /* request net search */
         return -1;
     }
 
-    /* delete received message */
-    free_data((MSG_DATA *) msg->data);
-
     return buff_len;
 }
 
@@ -33,32 +33,80 @@
 #include <pthread.h>
 #include "msgqueue.h"
 
-pthread_mutex_t msg_lock = PTHREAD_MUTEX_INITIALIZER;
+#if (MSGBOX_SIZE & (MSGBOX_SIZE - 1))
+#error MSGBOX_SIZE must be a power of 2
+#endif
+
+/* single producer, single consumer ring of messages;
+   head is only written by the consumer, tail by the producer */
+typedef struct _msgbox {
+    unsigned head;
+    unsigned tail;
+    BACMSG msgs[MSGBOX_SIZE];
+} MSGBOX;
+
+typedef struct _msg_slot {
+    MSG_DATA data;
+    uint8_t buffer[MSG_HEADROOM + MSG_PDU_SIZE];
+    /* next free slot + 1, 0 at the end of the list */
+    unsigned next;
+} MSG_SLOT;
+
+static MSGBOX Msgboxes[MAX_MSGBOXES];
+static unsigned Msgbox_Count;
+
+static MSG_SLOT Slots[MSG_POOL_SIZE];
+/* lock free stack of free slots: the low half is the first free
+   slot + 1, the high half a tag that changes on every pop so that a
+   stale compare-and-swap can't succeed */
+static uint64_t Free_Slots;
+static pthread_once_t Slots_Once = PTHREAD_ONCE_INIT;
+
+static void init_slots(
+    void)
+{
+    unsigned i;
+
+    for (i = 0; i < MSG_POOL_SIZE; i++) {
+        Slots[i].next = (i + 1 < MSG_POOL_SIZE) ? (i + 2) : 0;
+    }
+    __atomic_store_n(&Free_Slots, (uint64_t) 1, __ATOMIC_RELEASE);
+}
 
 MSGBOX_ID create_msgbox(
     )
 {
-    MSGBOX_ID msgboxid;
+    unsigned id;
 
-    msgboxid = msgget(IPC_PRIVATE, 0666 | IPC_CREAT);
-    if (msgboxid == INVALID_MSGBOX_ID) {
+    pthread_once(&Slots_Once, init_slots);
+    id = __atomic_fetch_add(&Msgbox_Count, 1, __ATOMIC_RELAXED);
+    if (id >= MAX_MSGBOXES) {
         return INVALID_MSGBOX_ID;
     }
 
-    return msgboxid;
+    return (MSGBOX_ID) id;
 }
 
 bool send_to_msgbox(
     MSGBOX_ID dest,
     BACMSG * msg)
 {
+    MSGBOX *box;
+    unsigned head, tail;
 
-    int err;
-
-    err = msgsnd(dest, msg, sizeof(BACMSG), 0);
-    if (err) {
+    if ((dest < 0) || (dest >= MAX_MSGBOXES)) {
         return false;
     }
+    box = &Msgboxes[dest];
+    tail = box->tail;
+    head = __atomic_load_n(&box->head, __ATOMIC_ACQUIRE);
+    if ((tail - head) >= MSGBOX_SIZE) {
+        /* full */
+        return false;
+    }
+    box->msgs[tail & (MSGBOX_SIZE - 1)] = *msg;
+    __atomic_store_n(&box->tail, tail + 1, __ATOMIC_RELEASE);
+
     return true;
 }
 
@@ -66,49 +114,86 @@ BACMSG *recv_from_msgbox(
     MSGBOX_ID src,
     BACMSG * msg)
 {
+    MSGBOX *box;
+    unsigned head, tail;
 
-    int recv_bytes;
-
-    recv_bytes = msgrcv(src, msg, sizeof(BACMSG), 0, IPC_NOWAIT);
-    if (recv_bytes > 0) {
-        return msg;
-    } else {
+    if ((src < 0) || (src >= MAX_MSGBOXES)) {
+        return NULL;
+    }
+    box = &Msgboxes[src];
+    head = box->head;
+    tail = __atomic_load_n(&box->tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
         return NULL;
     }
+    *msg = box->msgs[head & (MSGBOX_SIZE - 1)];
+    __atomic_store_n(&box->head, head + 1, __ATOMIC_RELEASE);
+
+    return msg;
 }
 
 void del_msgbox(
     MSGBOX_ID msgboxid)
 {
+    /* the boxes are static and live as long as the router */
+    (void) msgboxid;
+}
 
-    if (msgboxid == INVALID_MSGBOX_ID)
-        return;
-    else
-        msgctl(msgboxid, IPC_RMID, NULL);
+MSG_DATA *alloc_data(
+    void)
+{
+    uint64_t old_head, new_head;
+    unsigned index;
+
+    pthread_once(&Slots_Once, init_slots);
+    old_head = __atomic_load_n(&Free_Slots, __ATOMIC_ACQUIRE);
+    do {
+        index = (unsigned) (old_head & 0xFFFFFFFF);
+        if (index == 0) {
+            return NULL;
+        }
+        new_head =
+            ((old_head + ((uint64_t) 1 << 32)) & ~(uint64_t) 0xFFFFFFFF) |
+            __atomic_load_n(&Slots[index - 1].next, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&Free_Slots, &old_head, new_head,
+            true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    memset(&Slots[index - 1].data, 0, sizeof(MSG_DATA));
+    Slots[index - 1].data.pdu = &Slots[index - 1].buffer[MSG_HEADROOM];
+    Slots[index - 1].data.ref_count = 1;
+
+    return &Slots[index - 1].data;
+}
+
+uint8_t *data_buffer(
+    MSG_DATA * data)
+{
+    return ((MSG_SLOT *) data)->buffer;
 }
 
 void free_data(
     MSG_DATA * data)
 {
+    uint64_t old_head, new_head;
+    unsigned index;
 
-    if (data->pdu) {
-        free(data->pdu);
-        data->pdu = NULL;
-    }
-    if (data) {
-        free(data);
-        data = NULL;
+    if (!data) {
+        return;
     }
+    index = (unsigned) ((MSG_SLOT *) data - Slots) + 1;
+    old_head = __atomic_load_n(&Free_Slots, __ATOMIC_ACQUIRE);
+    do {
+        __atomic_store_n(&Slots[index - 1].next,
+            (unsigned) (old_head & 0xFFFFFFFF), __ATOMIC_RELAXED);
+        new_head = (old_head & ~(uint64_t) 0xFFFFFFFF) | index;
+    } while (!__atomic_compare_exchange_n(&Free_Slots, &old_head, new_head,
+            true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
 }
 
 void check_data(
     MSG_DATA * data)
 {
-
-    /* lock and decrement messages reference count */
-    pthread_mutex_lock(&msg_lock);
-    if (--data->ref_count == 0) {
+    /* decrement messages reference count, last one out frees it */
+    if (__atomic_sub_fetch(&data->ref_count, 1, __ATOMIC_ACQ_REL) == 0) {
         free_data(data);
     }
-    pthread_mutex_unlock(&msg_lock);
 }
@@ -32,15 +32,31 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
 #include "bacdef.h"
 #include "npdu.h"
 
-extern pthread_mutex_t msg_lock;
-
 #define INVALID_MSGBOX_ID -1
 
+/* message boxes are single producer, single consumer rings:
+   the main thread writes the port boxes, each port writes its own
+   box to the main thread */
+#ifndef MAX_MSGBOXES
+#define MAX_MSGBOXES 32
+#endif
+/* must be a power of 2 */
+#ifndef MSGBOX_SIZE
+#define MSGBOX_SIZE 64
+#endif
+
+/* message data comes from a preallocated pool of slots; each slot has
+   room in front of the PDU so the router can grow the NPDU header in
+   place when it forwards a message */
+#ifndef MSG_POOL_SIZE
+#define MSG_POOL_SIZE 256
+#endif
+#define MSG_HEADROOM MAX_NPDU
+#define MSG_PDU_SIZE MAX_PDU
+
 typedef int MSGBOX_ID;
 
 typedef enum {
@@ -66,7 +82,7 @@ typedef struct _message {
 typedef struct _msg_data {
     BACNET_ADDRESS dest;
     BACNET_ADDRESS src;
-    uint8_t *pdu;
+    uint8_t *pdu;       /* points into the slot buffer */
     uint16_t pdu_len;
     uint8_t ref_count;
 } MSG_DATA;
@@ -87,7 +103,16 @@ BACMSG *recv_from_msgbox(
 void del_msgbox(
     MSGBOX_ID msgboxid);
 
-/* free message data structure */
+/* take message data from the pool, NULL if the pool is empty;
+   pdu points MSG_HEADROOM into the slot buffer, ref_count is 1 */
+MSG_DATA *alloc_data(
+    void);
+
+/* start of the slot buffer backing the message data */
+uint8_t *data_buffer(
+    MSG_DATA * data);
+
+/* return message data to the pool */
 void free_data(
     MSG_DATA * data);
 
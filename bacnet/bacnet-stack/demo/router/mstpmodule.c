@@ -48,6 +48,7 @@ void *dl_mstp_thread(
     ROUTER_PORT *port = (ROUTER_PORT *) pArgs;
     struct mstp_port_struct_t mstp_port = { (MSTP_RECEIVE_STATE) 0 };
     volatile SHARED_MSTP_DATA shared_port_data = { 0 };
+    BACNET_ADDRESS src = { 0 };
     uint16_t pdu_len;
     uint8_t shutdown = 0;
 
@@ -144,19 +145,21 @@ void *dl_mstp_thread(
                     break;
             }
         } else {
-            pdu_len = dlmstp_receive(&mstp_port, NULL, NULL, 0, 1000);
-
-            if (pdu_len > 0) {
-                msg_data = (MSG_DATA *) malloc(sizeof(MSG_DATA));
-                memmove(&(msg_data->src),
-                    (const void *) &(shared_port_data.Receive_Packet.address),
-                    sizeof(shared_port_data.Receive_Packet.address));
+            /* receive straight into a pool slot; with no slot
+               free the packet is dropped */
+            msg_data = alloc_data();
+            pdu_len =
+                dlmstp_receive(&mstp_port, &src,
+                msg_data ? msg_data->pdu : NULL, MSG_PDU_SIZE, 1000);
+
+            if (!msg_data) {
+                continue;
+            } else if (pdu_len == 0) {
+                free_data(msg_data);
+            } else {
+                memmove(&(msg_data->src), &src, sizeof(src));
                 msg_data->src.adr[0] = msg_data->src.mac[0];
                 msg_data->src.len = 1;
-                msg_data->pdu = (uint8_t *) malloc(pdu_len);
-                memmove(msg_data->pdu,
-                    (const void *) &(shared_port_data.Receive_Packet.pdu),
-                    pdu_len);
                 msg_data->pdu_len = pdu_len;
 
                 msg_storage.type = DATA;
@@ -96,7 +96,7 @@ uint16_t process_network_message(
                 int i;
                 for (i = 0; i < net_count; i++) {
                     decode_unsigned16(&data->pdu[apdu_offset + 2 * i], &net);   /* decode received NET values */
-                    add_dnet(&srcport->route_info, net, data->src);     /* and update routing table */
+                    add_dnet(srcport, net, data->src);     /* and update routing table */
                 }
                 break;
             }
@@ -131,7 +131,7 @@ uint16_t process_network_message(
                 while (net_count--) {
                     int i = 1;
                     decode_unsigned16(&data->pdu[apdu_offset + i], &net);       /* decode received NET values */
-                    add_dnet(&srcport->route_info, net, data->src);     /* and update routing table */
+                    add_dnet(srcport, net, data->src);     /* and update routing table */
                     if (data->pdu[apdu_offset + i + 3] > 0)     /* find next NET value */
                         i = data->pdu[apdu_offset + i + 3] + 4;
                     else
@@ -153,7 +153,7 @@ uint16_t process_network_message(
                 while (net_count--) {
                     int i = 1;
                     decode_unsigned16(&data->pdu[apdu_offset + i], &net);       /* decode received NET values */
-                    add_dnet(&srcport->route_info, net, data->src);     /* and update routing table */
+                    add_dnet(srcport, net, data->src);     /* and update routing table */
                     if (data->pdu[apdu_offset + i + 3] > 0)     /* find next NET value */
                         i = data->pdu[apdu_offset + i + 3] + 4;
                     else
@@ -162,10 +162,27 @@ uint16_t process_network_message(
             }
             break;
 
-        case NETWORK_MESSAGE_INVALID:
-        case NETWORK_MESSAGE_I_COULD_BE_ROUTER_TO_NETWORK:
         case NETWORK_MESSAGE_ROUTER_BUSY_TO_NETWORK:
         case NETWORK_MESSAGE_ROUTER_AVAILABLE_TO_NETWORK:
+            {
+                bool available =
+                    (npdu_data.network_message_type ==
+                    NETWORK_MESSAGE_ROUTER_AVAILABLE_TO_NETWORK);
+                int net_count = apdu_len / 2;
+                int i;
+                PRINT(INFO, "Recieved Router-%s-To-Network message\n",
+                    available ? "Available" : "Busy");
+                /* an empty list stands for all NETs of that router */
+                if (net_count == 0)
+                    set_dnet_state(srcport, 0, data->src, available);
+                for (i = 0; i < net_count; i++) {
+                    decode_unsigned16(&data->pdu[apdu_offset + 2 * i], &net);
+                    set_dnet_state(srcport, net, data->src, available);
+                }
+                break;
+            }
+        case NETWORK_MESSAGE_INVALID:
+        case NETWORK_MESSAGE_I_COULD_BE_ROUTER_TO_NETWORK:
         case NETWORK_MESSAGE_ESTABLISH_CONNECTION_TO_NETWORK:
         case NETWORK_MESSAGE_DISCONNECT_CONNECTION_TO_NETWORK:
             /* hell if I know what to do with these messages */
@@ -194,7 +211,8 @@ uint16_t create_network_message(
         data_expecting_reply = true;
     init_npdu(&npdu_data, network_message_type, data_expecting_reply);
 
-    *buff = (uint8_t *) malloc(128);    /* resolve different length */
+    /* built in the slot buffer, which has room for any of these */
+    *buff = data_buffer(data);
 
     /* manual destination setup for Init-RT-Table-Ack message */
     data->dest.net = BACNET_BROADCAST_NETWORK;
@@ -297,7 +315,11 @@ void send_network_message(
     int16_t buff_len;
 
     if (!data) {
-        data = (MSG_DATA *) malloc(sizeof(MSG_DATA));
+        data = alloc_data();
+        if (!data) {
+            PRINT(ERROR, "Error: No free message slot\n");
+            return;
+        }
         data->dest.net = BACNET_BROADCAST_NETWORK;
         data->dest.len = 0;
     }
@@ -311,13 +333,12 @@ void send_network_message(
     msg.type = DATA;
     msg.data = data;
 
+    /* one reference per port; the ports that don't get it give theirs back */
     data->ref_count = port_count;
     while (port != NULL) {
-        if (port->state == FINISHED) {
-            port = port->next;
-            continue;
+        if (port->state == FINISHED || !send_to_msgbox(port->port_id, &msg)) {
+            check_data(data);
         }
-        send_to_msgbox(port->port_id, &msg);
         port = port->next;
     }
 }
@@ -29,8 +29,62 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "portthread.h"
 
+/* routing table: every reachable NET, hashed on its number */
+static DNET *Route_Table[DNET_HASH_SIZE];
+
+static unsigned dnet_hash(
+    uint16_t net)
+{
+    /* Fibonacci hashing, site NETs are often numbered in sequence */
+    return (uint16_t) (net * 40503U) >> (16 - DNET_HASH_BITS);
+}
+
+static DNET *find_route(
+    uint16_t net)
+{
+    DNET *dnet = Route_Table[dnet_hash(net)];
+
+    while (dnet != NULL) {
+        if (dnet->net == net)
+            return dnet;
+        dnet = dnet->hash_next;
+    }
+
+    return NULL;
+}
+
+static void unlink_route(
+    DNET * node)
+{
+    DNET **dnet = &Route_Table[dnet_hash(node->net)];
+
+    while (*dnet != NULL) {
+        if (*dnet == node) {
+            *dnet = node->hash_next;
+            break;
+        }
+        dnet = &(*dnet)->hash_next;
+    }
+}
+
+static void unlink_port_dnet(
+    ROUTER_PORT * port,
+    DNET * node)
+{
+    DNET **dnet = &port->route_info.dnets;
+
+    while (*dnet != NULL) {
+        if (*dnet == node) {
+            *dnet = node->next;
+            break;
+        }
+        dnet = &(*dnet)->next;
+    }
+}
+
 ROUTER_PORT *find_snet(
     MSGBOX_ID id)
 {
@@ -51,71 +105,127 @@ ROUTER_PORT *find_dnet(
     BACNET_ADDRESS * addr)
 {
 
-    ROUTER_PORT *port = head;
     DNET *dnet;
 
     /* for broadcast messages no search is needed */
     if (net == BACNET_BROADCAST_NETWORK)
-        return port;
+        return head;
 
-    while (port != NULL) {
+    dnet = find_route(net);
+    if (dnet == NULL)
+        return NULL;
 
-        /* check if DNET is directly connected to the router */
-        if (net == port->route_info.net)
-            return port;
+    /* directly connected NETs have no next router to address */
+    if (addr && dnet != &dnet->port->route_info.local) {
+        memmove(&addr->len, &dnet->mac_len, 1);
+        memmove(&addr->adr[0], &dnet->mac[0], MAX_MAC_LEN);
+    }
 
-        /* else search router ports DNET list */
-        else if (port->route_info.dnets) {
-            dnet = port->route_info.dnets;
-            while (dnet != NULL) {
-                if (net == dnet->net) {
-                    if (addr) {
-                        memmove(&addr->len, &dnet->mac_len, 1);
-                        memmove(&addr->adr[0], &dnet->mac[0], MAX_MAC_LEN);
-                    }
-                    return port;
-                }
-                dnet = dnet->next;
-            }
-        }
-        port = port->next;
+    return dnet->port;
+}
+
+bool dnet_available(
+    uint16_t net)
+{
+
+    DNET *dnet = find_route(net);
+
+    if (dnet == NULL || dnet->state)
+        return true;
+
+    /* busy reports lapse unless the router renews them */
+    if (time(NULL) - dnet->busy_time >= DNET_BUSY_TIMEOUT) {
+        dnet->state = true;
+        return true;
     }
 
-    return NULL;
+    return false;
+}
+
+void add_port_net(
+    ROUTER_PORT * port)
+{
+
+    DNET *dnet = &port->route_info.local;
+    unsigned index = dnet_hash(port->route_info.net);
+
+    port->route_info.dnets = NULL;
+    dnet->mac_len = 0;
+    dnet->net = port->route_info.net;
+    dnet->state = true;
+    dnet->busy_time = 0;
+    dnet->port = port;
+    dnet->next = NULL;
+    dnet->hash_next = Route_Table[index];
+    Route_Table[index] = dnet;
 }
 
 void add_dnet(
-    RT_ENTRY * route_info,
+    ROUTER_PORT * port,
     uint16_t net,
     BACNET_ADDRESS addr)
 {
 
-    DNET *dnet = route_info->dnets;
-    DNET *tmp;
-
-    if (dnet == NULL) {
-        route_info->dnets = (DNET *) malloc(sizeof(DNET));
-        memmove(&route_info->dnets->mac_len, &addr.len, 1);
-        memmove(&route_info->dnets->mac[0], &addr.adr[0], MAX_MAC_LEN);
-        route_info->dnets->net = net;
-        route_info->dnets->state = true;
-        route_info->dnets->next = NULL;
+    DNET *dnet = find_route(net);
+    unsigned index;
+
+    if (dnet != NULL) {
+        /* directly connected NETs are never learned */
+        if (dnet == &dnet->port->route_info.local)
+            return;
+        /* the NET has moved to a router on another port */
+        if (dnet->port != port) {
+            unlink_port_dnet(dnet->port, dnet);
+            dnet->port = port;
+            dnet->next = port->route_info.dnets;
+            port->route_info.dnets = dnet;
+        }
     } else {
+        dnet = (DNET *) malloc(sizeof(DNET));
+        dnet->net = net;
+        dnet->port = port;
+        dnet->next = port->route_info.dnets;
+        port->route_info.dnets = dnet;
+        index = dnet_hash(net);
+        dnet->hash_next = Route_Table[index];
+        Route_Table[index] = dnet;
+    }
+
+    /* the latest I-Am-Router-To-Network names the router to use */
+    memmove(&dnet->mac_len, &addr.len, 1);
+    memmove(&dnet->mac[0], &addr.adr[0], MAX_MAC_LEN);
+    dnet->state = true;
+    dnet->busy_time = 0;
+}
+
+void set_dnet_state(
+    ROUTER_PORT * port,
+    uint16_t net,
+    BACNET_ADDRESS addr,
+    bool available)
+{
+
+    DNET *dnet;
 
-        while (dnet != NULL) {
-            if (dnet->net == net)       /* make sure NETs are not repeated */
-                return;
-            tmp = dnet;
-            dnet = dnet->next;
+    if (net != 0) {
+        dnet = find_route(net);
+        if (dnet != NULL && dnet->port == port &&
+            dnet != &port->route_info.local) {
+            dnet->state = available;
+            dnet->busy_time = time(NULL);
         }
+        return;
+    }
 
-        dnet = (DNET *) malloc(sizeof(DNET));
-        memmove(&dnet->mac_len, &addr.len, 1);
-        memmove(&dnet->mac[0], &addr.adr[0], MAX_MAC_LEN);
-        dnet->net = net;
-        dnet->state = true;
-        dnet->next = NULL;
-        tmp->next = dnet;
+    /* no NET list: every NET served by the reporting router */
+    dnet = port->route_info.dnets;
+    while (dnet != NULL) {
+        if (dnet->mac_len == addr.len &&
+            memcmp(&dnet->mac[0], &addr.adr[0], addr.len) == 0) {
+            dnet->state = available;
+            dnet->busy_time = time(NULL);
+        }
+        dnet = dnet->next;
     }
 }
 
@@ -126,6 +236,7 @@ void cleanup_dnets(
     DNET *dnet = dnets;
     while (dnet != NULL) {
         dnet = dnet->next;
+        unlink_route(dnets);
         free(dnets);
         dnets = dnet;
     }
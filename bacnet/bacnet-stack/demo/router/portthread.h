@@ -32,6 +32,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <time.h>
 #include "msgqueue.h"
 #include "bacdef.h"
 #include "npdu.h"
@@ -85,13 +86,23 @@ typedef union _port_params {
     } mstp_params;
 } PORT_PARAMS;
 
+/* routing table is hashed on DNET, 2^DNET_HASH_BITS buckets */
+#define DNET_HASH_BITS 8
+#define DNET_HASH_SIZE (1 << DNET_HASH_BITS)
+
+/* seconds a Router-Busy-To-Network holds unless lifted (6.6.3.6) */
+#define DNET_BUSY_TIMEOUT 30
+
 /* list node for reacheble networks */
 typedef struct _dnet {
     uint8_t mac[MAX_MAC_LEN];
     uint8_t mac_len;
     uint16_t net;
     bool state; /* enabled or disabled */
-    struct _dnet *next;
+    time_t busy_time;   /* when the router reported the NET busy */
+    struct _port *port; /* router port the NET is reached through */
+    struct _dnet *next; /* next NET of the same router port */
+    struct _dnet *hash_next;    /* next NET in the same hash bucket */
 } DNET;
 
 /* information for routing table */
@@ -100,6 +111,7 @@ typedef struct _routing_table_entry {
     uint8_t mac_len;
     uint16_t net;
     DNET *dnets;
+    DNET local; /* routing table node of the directly connected NET */
 } RT_ENTRY;
 
 typedef struct _port {
@@ -126,12 +138,27 @@ ROUTER_PORT *find_dnet(
     uint16_t net,
     BACNET_ADDRESS * addr);
 
+/* false while the router to NET has reported it busy */
+bool dnet_available(
+    uint16_t net);
+
+/* enter directly connected network of the router port */
+void add_port_net(
+    ROUTER_PORT * port);
+
 /* add reacheble network for specified router port */
 void add_dnet(
-    RT_ENTRY * route_info,
+    ROUTER_PORT * port,
     uint16_t net,
     BACNET_ADDRESS addr);
 
+/* mark NET (or with 0, every NET of the router at addr) busy or available */
+void set_dnet_state(
+    ROUTER_PORT * port,
+    uint16_t net,
+    BACNET_ADDRESS addr,
+    bool available);
+
 void cleanup_dnets(
     DNET * dnets);
 
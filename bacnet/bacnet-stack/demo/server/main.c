@@ -41,6 +41,7 @@
 #include "apdu.h"
 #include "iam.h"
 #include "tsm.h"
+#include "bactimer.h"
 #include "device.h"
 #include "bacfile.h"
 #include "datalink.h"
@@ -53,6 +54,7 @@
 /* include the device object */
 #include "device.h"
 #include "trendlog.h"
+#include "schedule.h"
 #if defined(INTRINSIC_REPORTING)
 #include "nc.h"
 #endif /* defined(INTRINSIC_REPORTING) */
@@ -71,6 +73,76 @@
 /** Buffer used for receiving */
 static uint8_t Rx_Buf[MAX_MPDU] = { 0 };
 
+/** The periodic maintenance, each run when it is due. */
+static BACNET_TIMER TSM_Timer;
+static BACNET_TIMER Seconds_Timer;
+static BACNET_TIMER Address_Timer;
+#if defined(INTRINSIC_REPORTING)
+static BACNET_TIMER Recipient_Timer;
+#endif
+
+/** The retries and the timeouts of the requests, when the first is due. */
+static uint32_t tsm_timer(
+    uint32_t elapsed_milliseconds)
+{
+    tsm_timer_milliseconds((uint16_t) (elapsed_milliseconds >
+            60000 ? 60000 : elapsed_milliseconds));
+
+    return tsm_timer_remaining();
+}
+
+/** The maintenance counted in seconds; the part of a second left over
+ *  is carried to the next run. */
+static uint32_t seconds_timer(
+    uint32_t elapsed_milliseconds)
+{
+    static uint32_t carry_milliseconds = 0;
+    uint32_t elapsed_seconds = 0;
+    BACNET_DATE_TIME local_time;
+
+    carry_milliseconds += elapsed_milliseconds;
+    elapsed_seconds = carry_milliseconds / 1000;
+    carry_milliseconds %= 1000;
+    if (elapsed_seconds) {
+        dcc_timer_seconds(elapsed_seconds);
+#if defined(BACDL_BIP) && BBMD_ENABLED
+        bvlc_maintenance_timer(elapsed_seconds);
+#endif
+        dlenv_maintenance_timer(elapsed_seconds);
+        Load_Control_State_Machine_Handler();
+        handler_cov_timer_seconds(elapsed_seconds);
+        trend_log_timer(elapsed_seconds);
+        Device_getCurrentDateTime(&local_time);
+        Schedule_Timer(&local_time);
+#if defined(INTRINSIC_REPORTING)
+        Device_local_reporting();
+#endif
+    }
+
+    return 1000 - carry_milliseconds;
+}
+
+/** The address cache entries expire by the minute. */
+static uint32_t address_timer(
+    uint32_t elapsed_milliseconds)
+{
+    address_cache_timer((uint16_t) (elapsed_milliseconds / 1000));
+
+    return 60000;
+}
+
+#if defined(INTRINSIC_REPORTING)
+/** Try to find the addresses of the recipients. */
+static uint32_t recipient_timer(
+    uint32_t elapsed_milliseconds)
+{
+    (void) elapsed_milliseconds;
+    Notification_Class_find_recipient();
+
+    return NC_RESCAN_RECIPIENTS_SECS * 1000;
+}
+#endif
+
 /** Initialize the handlers we will utilize.
  * @see Device_Init, apdu_set_unconfirmed_handler, apdu_set_confirmed_handler
  */
@@ -134,7 +206,7 @@ static void Init_Service_Handlers(
 /** Main function of server demo.
  *
  * @see Device_Set_Object_Instance_Number, dlenv_init, Send_I_Am,
- *      datalink_receive, npdu_handler,
+ *      datalink_receive, npdu_handler, bactimer_run,
  *      dcc_timer_seconds, bvlc_maintenance_timer,
  *      Load_Control_State_Machine_Handler, handler_cov_task,
  *      tsm_timer_milliseconds
@@ -152,12 +224,7 @@ int main(
     };  /* address where message came from */
     uint16_t pdu_len = 0;
     unsigned timeout = 1;       /* milliseconds */
-    time_t last_seconds = 0;
-    time_t current_seconds = 0;
-    uint32_t elapsed_seconds = 0;
-    uint32_t elapsed_milliseconds = 0;
-    uint32_t address_binding_tmr = 0;
-    uint32_t recipient_scan_tmr = 0;
+    uint32_t now = 0;
 
     /* allow the device ID to be set */
     if (argc > 1)
@@ -171,14 +238,20 @@ int main(
     Init_Service_Handlers();
     dlenv_init();
     atexit(datalink_cleanup);
-    /* configure the timeout values */
-    last_seconds = time(NULL);
+    /* configure the timers */
+    now = bactimer_milliseconds();
+    bactimer_register(&TSM_Timer, tsm_timer, now, BACTIMER_IDLE);
+    bactimer_register(&Seconds_Timer, seconds_timer, now, 1000);
+    bactimer_register(&Address_Timer, address_timer, now, 60000);
+#if defined(INTRINSIC_REPORTING)
+    bactimer_register(&Recipient_Timer, recipient_timer, now,
+        NC_RESCAN_RECIPIENTS_SECS * 1000);
+#endif
     /* broadcast an I-Am on startup */
     Send_I_Am(&Handler_Transmit_Buffer[0]);
     /* loop forever */
     for (;;) {
         /* input */
-        current_seconds = time(NULL);
 
         /* returns 0 bytes on timeout */
         pdu_len = datalink_receive(&src, &Rx_Buf[0], MAX_MPDU, timeout);
@@ -187,39 +260,14 @@ int main(
         if (pdu_len) {
             npdu_handler(&src, &Rx_Buf[0], pdu_len);
         }
-        /* at least one second has passed */
-        elapsed_seconds = (uint32_t) (current_seconds - last_seconds);
-        if (elapsed_seconds) {
-            last_seconds = current_seconds;
-            dcc_timer_seconds(elapsed_seconds);
-#if defined(BACDL_BIP) && BBMD_ENABLED
-            bvlc_maintenance_timer(elapsed_seconds);
-#endif
-            dlenv_maintenance_timer(elapsed_seconds);
-            Load_Control_State_Machine_Handler();
-            elapsed_milliseconds = elapsed_seconds * 1000;
-            handler_cov_timer_seconds(elapsed_seconds);
-            tsm_timer_milliseconds(elapsed_milliseconds);
-            trend_log_timer(elapsed_seconds);
-#if defined(INTRINSIC_REPORTING)
-            Device_local_reporting();
-#endif
-        }
+        now = bactimer_milliseconds();
+        bactimer_run(now);
         handler_cov_task();
-        /* scan cache address */
-        address_binding_tmr += elapsed_seconds;
-        if (address_binding_tmr >= 60) {
-            address_cache_timer(address_binding_tmr);
-            address_binding_tmr = 0;
-        }
-#if defined(INTRINSIC_REPORTING)
-        /* try to find addresses of recipients */
-        recipient_scan_tmr += elapsed_seconds;
-        if (recipient_scan_tmr >= NC_RESCAN_RECIPIENTS_SECS) {
-            Notification_Class_find_recipient();
-            recipient_scan_tmr = 0;
-        }
-#endif
+        /* the confirmed notifications just sent are timed */
+        bactimer_due(&TSM_Timer, now, tsm_timer_remaining());
+        /* wait for the next datagram, or until a timer is due; the */
+        /* seconds timer is due within a second */
+        timeout = bactimer_next(now);
         /* output */
 
         /* blink LEDs, Turn on or off outputs, etc */
@@ -23,11 +23,12 @@
 *
 *********************************************************************/
 
-/* command line tool that sends a BACnet service, and displays the reply */
+/* command line tool that writes a file of a device with AtomicWriteFile */
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>       /* for time */
 #include <errno.h>
 #include "bactext.h"
@@ -49,6 +50,10 @@
 #include "client.h"
 #include "txbuf.h"
 #include "dlenv.h"
+#include "filexfer.h"
+
+/* the requests in flight, unless BACNET_FILE_WINDOW says otherwise */
+#define FILE_WINDOW_DEFAULT 8
 
 /* buffer used for receive */
 static uint8_t Rx_Buf[MAX_MPDU] = { 0 };
@@ -60,52 +65,7 @@ static uint32_t Target_File_Requested_Octet_Count;
 static uint8_t Target_File_Requested_Octet_Pad_Byte;
 static BACNET_ADDRESS Target_Address;
 static char *Local_File_Name = NULL;
-static bool End_Of_File_Detected = false;
-static bool Error_Detected = false;
-static uint8_t Current_Invoke_ID = 0;
-
-static void Atomic_Write_File_Error_Handler(
-    BACNET_ADDRESS * src,
-    uint8_t invoke_id,
-    BACNET_ERROR_CLASS error_class,
-    BACNET_ERROR_CODE error_code)
-{
-    if (address_match(&Target_Address, src) &&
-        (invoke_id == Current_Invoke_ID)) {
-        printf("\r\nBACnet Error!\r\n");
-        printf("Error Class: %s\r\n", bactext_error_class_name(error_class));
-        printf("Error Code: %s\r\n", bactext_error_code_name(error_code));
-        Error_Detected = true;
-    }
-}
-
-void MyAbortHandler(
-    BACNET_ADDRESS * src,
-    uint8_t invoke_id,
-    uint8_t abort_reason,
-    bool server)
-{
-    (void) server;
-    if (address_match(&Target_Address, src) &&
-        (invoke_id == Current_Invoke_ID)) {
-        printf("BACnet Abort: %s\r\n",
-            bactext_abort_reason_name((int) abort_reason));
-        Error_Detected = true;
-    }
-}
-
-void MyRejectHandler(
-    BACNET_ADDRESS * src,
-    uint8_t invoke_id,
-    uint8_t reject_reason)
-{
-    if (address_match(&Target_Address, src) &&
-        (invoke_id == Current_Invoke_ID)) {
-        printf("BACnet Reject: %s\r\n",
-            bactext_reject_reason_name((int) reject_reason));
-        Error_Detected = true;
-    }
-}
+static BACNET_FILE_TRANSFER Transfer;
 
 static void LocalIAmHandler(
     uint8_t * service_request,
@@ -147,11 +107,68 @@ static void Init_Service_Handlers(
     /* we must implement read property - it's required! */
     apdu_set_confirmed_handler(SERVICE_CONFIRMED_READ_PROPERTY,
         handler_read_property);
-    /* handle any errors coming back */
-    apdu_set_error_handler(SERVICE_CONFIRMED_ATOMIC_WRITE_FILE,
-        Atomic_Write_File_Error_Handler);
-    apdu_set_abort_handler(MyAbortHandler);
-    apdu_set_reject_handler(MyRejectHandler);
+    /* the replies to the writes go to the completion of the transfer */
+}
+
+static uint32_t milliseconds(
+    void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint32_t) (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+/* a copy of the file, padded to a multiple of the octet count */
+static FILE *padded_file(
+    FILE * pFile,
+    unsigned octet_count,
+    uint8_t pad)
+{
+    FILE *pPadded = NULL;
+    uint8_t buffer[512];
+    size_t len = 0;
+    unsigned long size = 0;
+
+    pPadded = tmpfile();
+    if (!pPadded) {
+        return NULL;
+    }
+    while ((len = fread(buffer, 1, sizeof(buffer), pFile)) > 0) {
+        fwrite(buffer, 1, len, pPadded);
+        size += len;
+    }
+    while ((size == 0) || (size % octet_count)) {
+        fputc(pad, pPadded);
+        size++;
+    }
+    fclose(pFile);
+
+    return pPadded;
+}
+
+static void print_failure(
+    BACNET_FILE_TRANSFER * transfer)
+{
+    if (transfer->timeout) {
+        fprintf(stderr, "\rError: TSM Timeout!\r\n");
+    } else if (transfer->pdu_type == PDU_TYPE_ERROR) {
+        printf("\r\nBACnet Error!\r\n");
+        printf("Error Class: %s\r\n",
+            bactext_error_class_name(transfer->error_class));
+        printf("Error Code: %s\r\n",
+            bactext_error_code_name(transfer->error_code));
+    } else if (transfer->pdu_type == PDU_TYPE_ABORT) {
+        printf("BACnet Abort: %s\r\n",
+            bactext_abort_reason_name((int) transfer->reason));
+    } else if (transfer->pdu_type == PDU_TYPE_REJECT) {
+        printf("BACnet Reject: %s\r\n",
+            bactext_reject_reason_name((int) transfer->reason));
+    } else {
+        fprintf(stderr, "Unable to read data from file \"%s\".\n",
+            Local_File_Name);
+    }
 }
 
 int main(
@@ -164,25 +181,25 @@ int main(
     uint16_t pdu_len = 0;
     unsigned timeout = 100;     /* milliseconds */
     unsigned max_apdu = 0;
-    time_t elapsed_seconds = 0;
-    time_t last_seconds = 0;
-    time_t current_seconds = 0;
-    time_t timeout_seconds = 0;
-    int fileStartPosition = 0;
-    unsigned requestedOctetCount = 0;
-    uint8_t invoke_id = 0;
+    uint32_t elapsed_ms = 0;
+    uint32_t last_ms = 0;
+    uint32_t current_ms = 0;
+    uint32_t timeout_ms = 0;
+    uint32_t start_ms = 0;
+    uint32_t printed = 0;
+    unsigned window = FILE_WINDOW_DEFAULT;
     bool found = false;
-    uint16_t my_max_apdu = 0;
-    FILE *pFile = NULL;
-    static BACNET_OCTET_STRING fileData;
-    size_t len = 0;
     bool pad_byte = false;
+    char *pEnv = NULL;
+    FILE *pFile = NULL;
 
     if (argc < 4) {
         /* FIXME: what about access method - record or stream? */
         printf
-            ("%s device-instance file-instance local-name [octet count] [pad value]\r\n",
-            filename_remove_path(argv[0]));
+            ("%s device-instance file-instance local-name [octet count] [pad value]\r\n"
+            "BACNET_FILE_WINDOW - the requests in flight at once, "
+            "default %u\r\n", filename_remove_path(argv[0]),
+            FILE_WINDOW_DEFAULT);
         return 0;
     }
     /* decode the command line parameters */
@@ -206,15 +223,36 @@ int main(
         Target_File_Requested_Octet_Pad_Byte = strtol(argv[5], NULL, 0);
         pad_byte = true;
     }
+    pEnv = getenv("BACNET_FILE_WINDOW");
+    if (pEnv) {
+        window = (unsigned) strtol(pEnv, NULL, 0);
+    }
+    pFile = fopen(Local_File_Name, "rb");
+    if (pFile && pad_byte && Target_File_Requested_Octet_Count) {
+        /* every request is of the octet count, the last one padded */
+        pFile =
+            padded_file(pFile, Target_File_Requested_Octet_Count,
+            Target_File_Requested_Octet_Pad_Byte);
+    }
+    if (!pFile) {
+        fprintf(stderr, "Unable to open file \"%s\" (%s)!\n", Local_File_Name,
+            strerror(errno));
+        return 1;
+    }
     /* setup my info */
     Device_Set_Object_Instance_Number(BACNET_MAX_INSTANCE);
     address_init();
     Init_Service_Handlers();
     dlenv_init();
     atexit(datalink_cleanup);
+    file_transfer_init(&Transfer, Target_Device_Object_Instance,
+        Target_File_Object_Instance, pFile, true, window);
+    /* else it is worked out from the max APDU of the device */
+    Transfer.chunk_size = Target_File_Requested_Octet_Count;
     /* configure the timeout values */
-    last_seconds = time(NULL);
-    timeout_seconds = (apdu_timeout() / 1000) * apdu_retries();
+    last_ms = milliseconds();
+    start_ms = last_ms;
+    timeout_ms = apdu_timeout() * apdu_retries();
     /* try to bind with the device */
     found =
         address_bind_request(Target_Device_Object_Instance, &max_apdu,
@@ -223,11 +261,7 @@ int main(
         Send_WhoIs(Target_Device_Object_Instance,
             Target_Device_Object_Instance);
     }
-    /* loop forever */
-    for (;;) {
-        /* increment timer - exit if timed out */
-        current_seconds = time(NULL);
-
+    while (!file_transfer_done(&Transfer)) {
         /* returns 0 bytes on timeout */
         pdu_len = datalink_receive(&src, &Rx_Buf[0], MAX_MPDU, timeout);
 
@@ -235,100 +269,43 @@ int main(
         if (pdu_len) {
             npdu_handler(&src, &Rx_Buf[0], pdu_len);
         }
-        /* at least one second has passed */
-        if (current_seconds != last_seconds) {
-            tsm_timer_milliseconds(((current_seconds - last_seconds) * 1000));
+        current_ms = milliseconds();
+        if (current_ms != last_ms) {
+            tsm_timer_milliseconds((uint16_t) (current_ms - last_ms));
         }
         /* wait until the device is bound, or timeout and quit */
         if (!found) {
             found =
                 address_bind_request(Target_Device_Object_Instance, &max_apdu,
                 &Target_Address);
+            elapsed_ms += current_ms - last_ms;
+            if (!found && (elapsed_ms > timeout_ms)) {
+                fprintf(stderr, "\rError: APDU Timeout!\r\n");
+                fclose(pFile);
+                return 1;
+            }
         }
         if (found) {
-            if (Target_File_Requested_Octet_Count) {
-                requestedOctetCount = Target_File_Requested_Octet_Count;
-            } else {
-                /* calculate the smaller of our APDU size or theirs
-                   and remove the overhead of the APDU (varies depending on size).
-                   note: we could fail if there is a bottle neck (router)
-                   and smaller MPDU in betweeen. */
-                if (max_apdu < MAX_APDU) {
-                    my_max_apdu = max_apdu;
-                } else {
-                    my_max_apdu = MAX_APDU;
-                }
-                /* Typical sizes are 50, 128, 206, 480, 1024, and 1476 octets */
-                if (my_max_apdu <= 50) {
-                    requestedOctetCount = my_max_apdu - 19;
-                } else if (my_max_apdu <= 480) {
-                    requestedOctetCount = my_max_apdu - 32;
-                } else if (my_max_apdu <= 1476) {
-                    requestedOctetCount = my_max_apdu - 64;
-                } else {
-                    requestedOctetCount = my_max_apdu / 2;
-                }
-            }
-            /* has the previous invoke id expired or returned?
-               note: invoke ID = 0 is invalid, so it will be idle */
-            if ((invoke_id == 0) || tsm_invoke_id_free(invoke_id)) {
-                if (End_Of_File_Detected || Error_Detected) {
-                    printf("\r\n");
-                    break;
-                }
-                if (invoke_id != 0) {
-                    fileStartPosition += requestedOctetCount;
-                }
-                /* we'll read the file in chunks
-                   less than max_apdu to keep unsegmented */
-                pFile = fopen(Local_File_Name, "rb");
-                if (pFile) {
-                    (void) fseek(pFile, fileStartPosition, SEEK_SET);
-                    len =
-                        fread(octetstring_value(&fileData), 1,
-                        requestedOctetCount, pFile);
-                    if (len < requestedOctetCount) {
-                        End_Of_File_Detected = true;
-                        if (pad_byte) {
-                            memset(octetstring_value(&fileData) + len + 1,
-                                (int) Target_File_Requested_Octet_Pad_Byte,
-                                requestedOctetCount - len);
-                            len = requestedOctetCount;
-                        }
-                    }
-                    octetstring_truncate(&fileData, len);
-                    fclose(pFile);
-                } else {
-                    End_Of_File_Detected = true;
-                }
-                printf("\rSending %d bytes", (int)(fileStartPosition + len));
-                invoke_id =
-                    Send_Atomic_Write_File_Stream
-                    (Target_Device_Object_Instance,
-                    Target_File_Object_Instance, fileStartPosition, &fileData);
-                Current_Invoke_ID = invoke_id;
-            } else if (tsm_invoke_id_failed(invoke_id)) {
-                fprintf(stderr, "\rError: TSM Timeout!\r\n");
-                tsm_free_invoke_id(invoke_id);
-                Error_Detected = true;
-                /* try again or abort? */
-                break;
-            }
-        } else {
-            /* increment timer - exit if timed out */
-            elapsed_seconds += (current_seconds - last_seconds);
-            if (elapsed_seconds > timeout_seconds) {
-                fprintf(stderr, "\rError: APDU Timeout!\r\n");
-                Error_Detected = true;
-                break;
+            file_transfer_task(&Transfer);
+            if (Transfer.done != printed) {
+                printed = Transfer.done;
+                printf("\rSending %lu bytes", (unsigned long) printed);
+                fflush(stdout);
             }
         }
         /* keep track of time for next check */
-        last_seconds = current_seconds;
+        last_ms = current_ms;
     }
-
-    if (Error_Detected) {
+    printf("\r\n");
+    fclose(pFile);
+    if (Transfer.state == FILE_TRANSFER_FAILED) {
+        print_failure(&Transfer);
         return 1;
     }
+    fprintf(stderr, "%lu bytes in %lu ms, %lu requests, %lu sent again\n",
+        (unsigned long) Transfer.done,
+        (unsigned long) (milliseconds() - start_ms),
+        (unsigned long) Transfer.requests, (unsigned long) Transfer.retries);
+
     return 0;
 }
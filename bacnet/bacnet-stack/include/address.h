@@ -80,6 +80,9 @@ extern "C" {
         unsigned max_apdu,
         BACNET_ADDRESS * src);
 
+    bool address_bind_wanted(
+        uint32_t device_id);
+
     int address_list_encode(
         uint8_t * apdu,
         unsigned apdu_len);
@@ -96,6 +99,12 @@ extern "C" {
     void address_cache_timer(
         uint16_t uSeconds);
 
+    bool address_bindings_save(
+        const char *pFilename);
+
+    void address_bindings_load(
+        const char *pFilename);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
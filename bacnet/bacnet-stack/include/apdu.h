@@ -40,6 +40,15 @@ typedef struct _confirmed_service_data {
     uint8_t proposed_window_number;
 } BACNET_CONFIRMED_SERVICE_DATA;
 
+/* The first octet of a confirmed request, with segmented-response-accepted
+   when the TSM puts segmented replies back together. */
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+#define APDU_CONFIRMED_SERVICE_REQUEST \
+    (PDU_TYPE_CONFIRMED_SERVICE_REQUEST | 0x02)
+#else
+#define APDU_CONFIRMED_SERVICE_REQUEST PDU_TYPE_CONFIRMED_SERVICE_REQUEST
+#endif
+
 typedef struct _confirmed_service_ack_data {
     bool segmented_message;
     bool more_follows;
@@ -183,6 +192,10 @@ extern "C" {
         void);
     void apdu_retries_set(
         uint8_t value);
+    uint16_t apdu_segment_timeout(
+        void);
+    void apdu_segment_timeout_set(
+        uint16_t milliseconds);
 
     void apdu_handler(
         BACNET_ADDRESS * src,   /* source address */
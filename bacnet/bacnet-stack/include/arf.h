@@ -91,6 +91,16 @@ extern "C" {
         uint8_t * invoke_id,
         BACNET_ATOMIC_READ_FILE_DATA * data);
 
+/* decode the service request of a stream access ack, the file data is
+   not copied, it points into the apdu */
+    int arf_ack_decode_stream(
+        uint8_t * apdu,
+        unsigned apdu_len,
+        bool * endOfFile,
+        int32_t * fileStartPosition,
+        uint8_t ** fileData,
+        uint32_t * fileDataLen);
+
 #ifdef TEST
 #include "ctest.h"
 
@@ -86,6 +86,55 @@ typedef struct BACnet_Application_Data_Value {
     struct BACnet_Application_Data_Value *next;
 } BACNET_APPLICATION_DATA_VALUE;
 
+/* A decoded value that leaves its octet and character strings in the
+   buffer it was decoded from, for the paths that only read what they
+   decode.  Tens of octets, where a BACNET_APPLICATION_DATA_VALUE has room
+   for the longest string; it is good only as long as the buffer. */
+struct BACnet_Application_Data_View;
+typedef struct BACnet_Application_Data_View {
+    bool context_specific;      /* true if context specific data */
+    uint8_t context_tag;        /* only used for context specific data */
+    uint8_t tag;        /* application tag data type */
+    union {
+#if defined (BACAPP_BOOLEAN)
+        bool Boolean;
+#endif
+#if defined (BACAPP_UNSIGNED)
+        uint32_t Unsigned_Int;
+#endif
+#if defined (BACAPP_SIGNED)
+        int32_t Signed_Int;
+#endif
+#if defined (BACAPP_REAL)
+        float Real;
+#endif
+#if defined (BACAPP_DOUBLE)
+        double Double;
+#endif
+#if defined (BACAPP_OCTET_STRING) || defined (BACAPP_CHARACTER_STRING)
+        /* an Octet_String or a Character_String */
+        BACNET_STRING_VIEW String;
+#endif
+#if defined (BACAPP_BIT_STRING)
+        BACNET_BIT_STRING Bit_String;
+#endif
+#if defined (BACAPP_ENUMERATED)
+        uint32_t Enumerated;
+#endif
+#if defined (BACAPP_DATE)
+        BACNET_DATE Date;
+#endif
+#if defined (BACAPP_TIME)
+        BACNET_TIME Time;
+#endif
+#if defined (BACAPP_OBJECT_ID)
+        BACNET_OBJECT_ID Object_Id;
+#endif
+    } type;
+    /* simple linked list if needed */
+    struct BACnet_Application_Data_View *next;
+} BACNET_APPLICATION_DATA_VIEW;
+
 struct BACnet_Access_Error;
 typedef struct BACnet_Access_Error {
     BACNET_ERROR_CLASS error_class;
@@ -99,6 +148,8 @@ typedef struct BACnet_Property_Reference {
     /* either value or error, but not both.
        Use NULL value to indicate error */
     BACNET_APPLICATION_DATA_VALUE *value;
+    /* instead of value, from rpm_ack_decode_service_request_view() */
+    BACNET_APPLICATION_DATA_VIEW *view;
     BACNET_ACCESS_ERROR error;
     /* simple linked list */
     struct BACnet_Property_Reference *next;
@@ -141,6 +192,22 @@ extern "C" {
         unsigned max_apdu_len,
         BACNET_APPLICATION_DATA_VALUE * value);
 
+    /* The number of application tagged values at apdu, within max_apdu_len,
+       that are encoded like the first one: a NULL or BOOLEAN, or a REAL,
+       Unsigned, Signed or Enumerated of the same length, e.g. the elements
+       of a Priority_Array or a log of one point. 0 if the first isn't one. */
+    unsigned bacapp_application_run_count(
+        uint8_t * apdu,
+        unsigned max_apdu_len);
+
+    /* Decode the count values found by bacapp_application_run_count()
+       into the array, linked in order. The buffer is not checked again.
+       Returns the number of octets decoded. */
+    int bacapp_decode_application_run(
+        uint8_t * apdu,
+        unsigned count,
+        BACNET_APPLICATION_DATA_VALUE * values);
+
     bool bacapp_decode_application_data_safe(
         uint8_t * new_apdu,
         uint32_t new_apdu_len,
@@ -161,6 +228,27 @@ extern "C" {
         BACNET_APPLICATION_DATA_VALUE * value,
         BACNET_PROPERTY_ID property);
 
+    /* Decode like bacapp_decode_application_data() and
+       bacapp_decode_context_data(), leaving the strings in the apdu. */
+    int bacapp_decode_application_view(
+        uint8_t * apdu,
+        unsigned max_apdu_len,
+        BACNET_APPLICATION_DATA_VIEW * view);
+    int bacapp_decode_context_view(
+        uint8_t * apdu,
+        unsigned max_apdu_len,
+        BACNET_APPLICATION_DATA_VIEW * view,
+        BACNET_PROPERTY_ID property);
+    /* copy the view, strings and all, into a value; returns false if a
+       string exceeds the capacity of the value.  The next is not copied. */
+    bool bacapp_view_to_value(
+        BACNET_APPLICATION_DATA_VIEW * view,
+        BACNET_APPLICATION_DATA_VALUE * value);
+    /* a view of the value; its strings stay in the value */
+    void bacapp_value_to_view(
+        BACNET_APPLICATION_DATA_VALUE * value,
+        BACNET_APPLICATION_DATA_VIEW * view);
+
     int bacapp_encode_context_data_value(
         uint8_t * apdu,
         uint8_t context_tag_number,
@@ -233,6 +321,10 @@ extern "C" {
         Test * pTest);
     void testBACnetApplicationData(
         Test * pTest);
+    void testBACnetApplicationDataRun(
+        Test * pTest);
+    void testBACnetApplicationDataView(
+        Test * pTest);
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,89 @@
+/**************************************************************************
+*
+* Copyright (C) 2005 Steve Karg <skarg@users.sourceforge.net>
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*********************************************************************/
+#ifndef BACCTX_H
+#define BACCTX_H
+
+#include <stdbool.h>
+
+/** @file bacctx.h  A BACnet context owns the state of one stack instance
+ * (the transaction state machine and the address cache) and the lock
+ * that serializes access to it.  A thread enters a context before it
+ * calls into the stack, and leaves it afterwards; the stack then works on
+ * that context's state.  Without BACNET_CONTEXT_ENABLED, or when no context is
+ * entered, the stack uses its static default state as before.
+ */
+
+#if defined(BACNET_CONTEXT_ENABLED)
+#if defined(_MSC_VER)
+#define BACNET_THREAD_LOCAL __declspec(thread)
+#else
+#define BACNET_THREAD_LOCAL __thread
+#endif
+#else
+#define BACNET_THREAD_LOCAL
+#endif
+
+typedef struct bacnet_context BACNET_CONTEXT;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#if defined(BACNET_CONTEXT_ENABLED)
+    BACNET_CONTEXT *bacnet_context_create(
+        void);
+    void bacnet_context_destroy(
+        BACNET_CONTEXT * ctx);
+
+    /* lock the context and make it current for the calling thread; */
+    /* enter and leave calls nest */
+    void bacnet_context_enter(
+        BACNET_CONTEXT * ctx);
+    void bacnet_context_leave(
+        BACNET_CONTEXT * ctx);
+    BACNET_CONTEXT *bacnet_context_current(
+        void);
+
+    /* state of the current context, or NULL when none is entered */
+    void *bacnet_context_tsm_state(
+        void);
+    void *bacnet_context_address_state(
+        void);
+
+    /* provided by tsm.c and address.c */
+    void *tsm_state_create(
+        void);
+    void tsm_state_destroy(
+        void *state);
+    void *address_state_create(
+        void);
+    void address_state_destroy(
+        void *state);
+#endif
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif
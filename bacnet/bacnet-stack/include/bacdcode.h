@@ -219,6 +219,11 @@ extern "C" {
         uint8_t * apdu,
         uint8_t tag_number,
         BACNET_OCTET_STRING * octet_string);
+/* leaves the octets in the apdu, see BACNET_STRING_VIEW */
+    int decode_octet_string_view(
+        uint8_t * apdu,
+        uint32_t len_value,
+        BACNET_STRING_VIEW * view);
 
 
 /* from clause 20.2.9 Encoding of a Character String Value */
@@ -236,6 +241,9 @@ extern "C" {
     int encode_application_character_string(
         uint8_t * apdu,
         BACNET_CHARACTER_STRING * char_string);
+    int encode_application_character_string_view(
+        uint8_t * apdu,
+        BACNET_STRING_VIEW * view);
     int encode_context_character_string(
         uint8_t * apdu,
         uint8_t tag_number,
@@ -248,6 +256,11 @@ extern "C" {
         uint8_t * apdu,
         uint8_t tag_number,
         BACNET_CHARACTER_STRING * char_string);
+/* leaves the characters in the apdu, see BACNET_STRING_VIEW */
+    int decode_character_string_view(
+        uint8_t * apdu,
+        uint32_t len_value,
+        BACNET_STRING_VIEW * view);
 
 
 /* from clause 20.2.4 Encoding of an Unsigned Integer Value */
@@ -52,6 +52,15 @@ typedef struct BACnet_Octet_String {
     uint8_t value[MAX_OCTET_STRING_BYTES];
 } BACNET_OCTET_STRING;
 
+/* A character or octet string left in the buffer it was decoded from:
+   the length and a pointer instead of a copy.  It is not terminated,
+   and is good only as long as the buffer. */
+typedef struct BACnet_String_View {
+    size_t length;
+    uint8_t encoding;   /* of a character string */
+    const uint8_t *value;
+} BACNET_STRING_VIEW;
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -195,10 +204,33 @@ extern "C" {
         BACNET_OCTET_STRING * octet_string1,
         BACNET_OCTET_STRING * octet_string2);
 
+    void stringview_init(
+        BACNET_STRING_VIEW * view,
+        uint8_t encoding,
+        const uint8_t * value,
+        size_t length);
+/* views a nul terminated string kept elsewhere, e.g. an object name */
+    void stringview_init_ansi(
+        BACNET_STRING_VIEW * view,
+        const char *value);
+/* copy the viewed octets; returns false if they exceed capacity */
+    bool characterstring_init_view(
+        BACNET_CHARACTER_STRING * char_string,
+        BACNET_STRING_VIEW * view);
+    bool octetstring_init_view(
+        BACNET_OCTET_STRING * octet_string,
+        BACNET_STRING_VIEW * view);
+/* returns true if the same length, encoding and value, without a copy */
+    bool characterstring_view_same(
+        BACNET_STRING_VIEW * view,
+        BACNET_CHARACTER_STRING * char_string);
+
 #ifdef TEST
 #include "ctest.h"
     void testBACnetStrings(
         Test * pTest);
+    void testStringView(
+        Test * pTest);
 #endif
 
 #ifdef __cplusplus
@@ -128,6 +128,11 @@ extern "C" {
 
 	const char *bactext_lighting_transition(
 		unsigned index);
+
+/* build the lookup indexes of the text tables, they are built on the
+   first lookup otherwise, which is not thread safe */
+    void bactext_init(
+        void);
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,100 @@
+/**************************************************************************
+*
+* Copyright (C) 2005 Steve Karg <skarg@users.sourceforge.net>
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*********************************************************************/
+#ifndef BACTIMER_H
+#define BACTIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** @file bactimer.h  The periodic maintenance of the stack (the TSM
+ * retries, the address cache, the foreign device table, the COV
+ * lifetimes, ...) registered as timers with deadlines on one monotonic
+ * millisecond clock.  The application's loop runs the timers that are
+ * due with bactimer_run(), and waits in its receive, select or epoll for
+ * the milliseconds it returns, instead of driving every module on each
+ * pass.  The timers are the application's: they are run from one thread,
+ * inside its BACnet context when it has one.
+ */
+
+/* the timer waits until bactimer_due() wakes it */
+#define BACTIMER_IDLE UINT32_MAX
+
+/* runs the module, given the milliseconds since it last ran, and returns */
+/* the milliseconds until it is due again, or BACTIMER_IDLE */
+typedef uint32_t(
+    *bactimer_function) (
+    uint32_t elapsed_milliseconds);
+
+typedef struct bacnet_timer {
+    bactimer_function Function;
+    /* the clock when it last ran, or when it was woken from idle */
+    uint32_t Last;
+    uint32_t Due;
+    /* in the list of the timers waiting, by Due */
+    bool Waiting;
+    struct bacnet_timer *Next;
+} BACNET_TIMER;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    /* the monotonic clock of the host, it wraps around in 49 days */
+    uint32_t bactimer_milliseconds(
+        void);
+
+    /* the timer is first due after delay, BACTIMER_IDLE to wait */
+    void bactimer_register(
+        BACNET_TIMER * timer,
+        bactimer_function function,
+        uint32_t now,
+        uint32_t delay);
+    void bactimer_unregister(
+        BACNET_TIMER * timer);
+
+    /* the timer runs no later than now + delay, e.g. the TSM once a */
+    /* request is sent */
+    void bactimer_due(
+        BACNET_TIMER * timer,
+        uint32_t now,
+        uint32_t delay);
+
+    /* runs the timers that are due, each at most once, and returns the */
+    /* milliseconds until the next one, or BACTIMER_IDLE */
+    uint32_t bactimer_run(
+        uint32_t now);
+    uint32_t bactimer_next(
+        uint32_t now);
+
+#ifdef TEST
+#include "ctest.h"
+    void testBACnetTimer(
+        Test * pTest);
+#endif
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif
@@ -37,6 +37,21 @@
 
 #define BVLL_TYPE_BACNET_IP (0x81)
 
+/* datagrams per recvmmsg and per sendmmsg on Linux; define them as 1 for
+   one recvfrom or sendto per datagram */
+#if defined(__linux__)
+#ifndef BIP_RECEIVE_BATCH
+#define BIP_RECEIVE_BATCH 32
+#endif
+#ifndef BIP_SEND_BATCH
+#define BIP_SEND_BATCH 32
+#endif
+/* sockets sharing the port with SO_REUSEPORT, see bip_set_lanes */
+#ifndef BIP_MAX_LANES
+#define BIP_MAX_LANES 16
+#endif
+#endif
+
 extern bool BIP_Debug;
 
 #ifdef __cplusplus
@@ -65,6 +80,29 @@ extern "C" {
     void bip_get_my_address(
         BACNET_ADDRESS * my_address);
 
+    /* the lanes: sockets sharing the UDP port, each read by one thread. */
+    /* the replies and broadcasts of a device arrive at bip_lane_of(its */
+    /* address), and are returned only to the threads of that lane */
+    void bip_set_lanes(
+        unsigned lanes);
+    unsigned bip_get_lanes(
+        void);
+    unsigned bip_lane_count(
+        void);
+    /* the lane of the calling thread, for its sends and receives */
+    void bip_set_lane(
+        unsigned lane);
+    unsigned bip_lane(
+        void);
+    unsigned bip_lane_of(
+        BACNET_ADDRESS * dest);
+    /* for the port: the sockets of the lanes other than 0 */
+    bool bip_set_lane_socket(
+        unsigned lane,
+        int sock_fd);
+    int bip_lane_socket(
+        unsigned lane);
+
     /* function to send a packet out the BACnet/IP socket */
     /* returns zero on success, non-zero on failure */
     int bip_send_pdu(
@@ -73,6 +111,34 @@ extern "C" {
         uint8_t * pdu,  /* any data to be sent - may be null */
         unsigned pdu_len);      /* number of bytes of data */
 
+    /* sends a BVLL message, or holds it in the batch of this thread */
+    int bip_send_mpdu(
+        struct sockaddr_in *dest,
+        uint8_t * mtu,
+        uint16_t mtu_len);
+    /* sends the same BVLL message to each address */
+    unsigned bip_send_mpdu_list(
+        struct sockaddr_in *dests,
+        unsigned count,
+        uint8_t * mtu,
+        uint16_t mtu_len);
+    /* holds the sends of this thread until the matching end */
+    void bip_send_batch_begin(
+        void);
+    void bip_send_batch_end(
+        void);
+    /* SO_RCVBUF and SO_SNDBUF in bytes, 0 for the system default */
+    void bip_set_socket_buffers(
+        int receive_size,
+        int send_size);
+
+    /* receives a BVLL message, with its BVLC header */
+    int bip_receive_mpdu(
+        struct sockaddr_in *sin,
+        uint8_t * pdu,
+        uint16_t max_pdu,
+        unsigned timeout);
+
     /* receives a BACnet/IP packet */
     /* returns the number of octets in the PDU, or zero on failure */
     uint16_t bip_receive(
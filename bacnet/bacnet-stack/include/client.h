@@ -133,6 +133,19 @@ extern "C" {
         size_t max_pdu,
         uint32_t device_id,     /* destination device */
         BACNET_READ_ACCESS_DATA * read_access_data);
+    /* encode once, send to each; returns how many were sent */
+    unsigned Send_Read_Property_Multiple_Request_List(
+        uint32_t * device_ids,
+        unsigned count,
+        BACNET_READ_ACCESS_DATA * read_access_data,
+        uint8_t * invoke_ids);
+    unsigned Send_Confirmed_Request_List(
+        BACNET_ADDRESS * dests,
+        unsigned count,
+        unsigned max_apdu,
+        uint8_t * apdu,
+        unsigned apdu_len,
+        uint8_t * invoke_ids);
 
 /* returns the invoke ID for confirmed request, or 0 if failed */
     uint8_t Send_Write_Property_Request(
@@ -28,8 +28,133 @@
 /* Note: these defines can be defined in your makefile or project
    or here or not defined and defaults will be used */
 
+/* The embedded profile sizes the stack for a server on a part with tens
+   of KB of RAM, like the at91sam7s, stm32f10x and lwIP ports, instead of
+   for a PC.  Declare the objects of the device (MAX_ANALOG_INPUTS and the
+   like) and define BACNET_PROFILE_EMBEDDED; the tables below are then
+   sized from them, and only the server services are built.  The port can
+   still define any of the sizes itself. */
+#if defined(BACNET_PROFILE_EMBEDDED)
+#if defined(MAX_ANALOG_INPUTS)
+#define PROFILE_ANALOG_INPUTS MAX_ANALOG_INPUTS
+#else
+#define PROFILE_ANALOG_INPUTS 0
+#endif
+#if defined(MAX_ANALOG_OUTPUTS)
+#define PROFILE_ANALOG_OUTPUTS MAX_ANALOG_OUTPUTS
+#else
+#define PROFILE_ANALOG_OUTPUTS 0
+#endif
+#if defined(MAX_ANALOG_VALUES)
+#define PROFILE_ANALOG_VALUES MAX_ANALOG_VALUES
+#else
+#define PROFILE_ANALOG_VALUES 0
+#endif
+#if defined(MAX_BINARY_INPUTS)
+#define PROFILE_BINARY_INPUTS MAX_BINARY_INPUTS
+#else
+#define PROFILE_BINARY_INPUTS 0
+#endif
+#if defined(MAX_BINARY_OUTPUTS)
+#define PROFILE_BINARY_OUTPUTS MAX_BINARY_OUTPUTS
+#else
+#define PROFILE_BINARY_OUTPUTS 0
+#endif
+#if defined(MAX_BINARY_VALUES)
+#define PROFILE_BINARY_VALUES MAX_BINARY_VALUES
+#else
+#define PROFILE_BINARY_VALUES 0
+#endif
+/* the objects of the device, with the Device object */
+#define BACNET_PROFILE_OBJECTS (1 + PROFILE_ANALOG_INPUTS + \
+    PROFILE_ANALOG_OUTPUTS + PROFILE_ANALOG_VALUES + \
+    PROFILE_BINARY_INPUTS + PROFILE_BINARY_OUTPUTS + PROFILE_BINARY_VALUES)
+/* a server answers one request at a time, in one unsegmented APDU */
+#if !defined(MAX_APDU)
+#define MAX_APDU 480
+#endif
+#if !defined(MAX_TSM_TRANSACTIONS)
+#define MAX_TSM_TRANSACTIONS 0
+#endif
+#if !defined(MAX_SEGMENTS_ACCEPTED)
+#define MAX_SEGMENTS_ACCEPTED 1
+#endif
+/* the object names and descriptions are short */
+#if !defined(MAX_CHARACTER_STRING_BYTES)
+#define MAX_CHARACTER_STRING_BYTES 64
+#endif
+#if !defined(MAX_OCTET_STRING_BYTES)
+#define MAX_OCTET_STRING_BYTES 64
+#endif
+/* the tables are allocated once at their limit, and never grow */
+#if !defined(MAX_ADDRESS_CACHE)
+#define MAX_ADDRESS_CACHE 8
+#endif
+#if !defined(MAX_ADDRESS_CACHE_LIMIT)
+#define MAX_ADDRESS_CACHE_LIMIT MAX_ADDRESS_CACHE
+#endif
+/* two subscribers to each object, from up to four addresses */
+#if !defined(MAX_COV_SUBCRIPTIONS)
+#define MAX_COV_SUBCRIPTIONS (2 * BACNET_PROFILE_OBJECTS)
+#endif
+#if !defined(COV_SUBSCRIPTIONS_INITIAL)
+#define COV_SUBSCRIPTIONS_INITIAL MAX_COV_SUBCRIPTIONS
+#endif
+#if !defined(MAX_COV_ADDRESSES)
+#define MAX_COV_ADDRESSES 4
+#endif
+#if !defined(COV_ADDRESSES_INITIAL)
+#define COV_ADDRESSES_INITIAL MAX_COV_ADDRESSES
+#endif
+#if !defined(MAX_COV_NOTIFICATIONS_PER_TASK)
+#define MAX_COV_NOTIFICATIONS_PER_TASK 1
+#endif
+/* one MS/TP reply is queued, it leaves with the next token */
+#if !defined(MSTP_PDU_PACKET_COUNT)
+#define MSTP_PDU_PACKET_COUNT 1
+#endif
+#if !defined(BBMD_ENABLED)
+#define BBMD_ENABLED 0
+#endif
+/* the object types whose property lists ReadPropertyMultiple keeps */
+#if !defined(RPM_PROPERTY_LIST_CACHE_SIZE)
+#define RPM_PROPERTY_LIST_CACHE_SIZE 4
+#endif
+/* the datatypes of the properties of the objects above */
+#if !(defined(BACAPP_ALL) || \
+    defined(BACAPP_NULL) || \
+    defined(BACAPP_BOOLEAN) || \
+    defined(BACAPP_UNSIGNED) || \
+    defined(BACAPP_SIGNED) || \
+    defined(BACAPP_REAL) || \
+    defined(BACAPP_DOUBLE) || \
+    defined(BACAPP_OCTET_STRING) || \
+    defined(BACAPP_CHARACTER_STRING) || \
+    defined(BACAPP_BIT_STRING) || \
+    defined(BACAPP_ENUMERATED) || \
+    defined(BACAPP_DATE) || \
+    defined(BACAPP_TIME) || \
+    defined(BACAPP_OBJECT_ID) || \
+    defined(BACAPP_DEVICE_OBJECT_PROP_REF))
+#define BACAPP_NULL
+#define BACAPP_BOOLEAN
+#define BACAPP_UNSIGNED
+#define BACAPP_REAL
+#define BACAPP_CHARACTER_STRING
+#define BACAPP_BIT_STRING
+#define BACAPP_ENUMERATED
+#define BACAPP_DATE
+#define BACAPP_TIME
+#define BACAPP_OBJECT_ID
+#endif
+#endif
+
 /* declare a single physical layer using your compiler define.
    see datalink.h for possible defines. */
+#if defined(BACDL_MULTI) && !defined(BACDL_BIP)
+/* B/IP is one of the ports of the multiple datalinks */
+#define BACDL_BIP
+#endif
 #if !(defined(BACDL_ETHERNET) || defined(BACDL_ARCNET) || defined(BACDL_MSTP) || defined(BACDL_BIP) || defined(BACDL_TEST) || defined(BACDL_ALL))
 #define BACDL_BIP
 #endif
@@ -78,7 +203,10 @@
 #if !defined(MAX_APDU)
     /* #define MAX_APDU 50 */
     /* #define MAX_APDU 1476 */
-#if defined(BACDL_BIP)
+#if defined(BACDL_MULTI)
+/* the application is a node of every port, the MS/TP one too */
+#define MAX_APDU 480
+#elif defined(BACDL_BIP)
 #define MAX_APDU 1476
 /* #define MAX_APDU 128 enable this IP for testing readrange so you get the More Follows flag set */
 #elif defined (BACDL_ETHERNET)
@@ -96,14 +224,40 @@
 #if !defined(MAX_TSM_TRANSACTIONS)
 #define MAX_TSM_TRANSACTIONS 255
 #endif
+/* Replies to confirmed requests that do not fit in one APDU are sent, */
+/* and received, in up to this many segments of the peer's max APDU. */
+/* A reply received in segments is put back together before it is given */
+/* to the handler, so the product with MAX_APDU must fit in 16 bits. */
+/* Configure to 1 for no segmentation, which is all there is without */
+/* a TSM. */
+#if !defined(MAX_SEGMENTS_ACCEPTED)
+#if defined(BACDL_BIP) && (MAX_TSM_TRANSACTIONS)
+#define MAX_SEGMENTS_ACCEPTED 32
+#else
+#define MAX_SEGMENTS_ACCEPTED 1
+#endif
+#endif
+#if (MAX_SEGMENTS_ACCEPTED > 1) && !(MAX_TSM_TRANSACTIONS)
+#error "segmentation needs MAX_TSM_TRANSACTIONS"
+#endif
+/* the number of segments sent before waiting for a SegmentACK */
+#if !defined(MAX_SEGMENT_WINDOW_SIZE)
+#define MAX_SEGMENT_WINDOW_SIZE 16
+#endif
 /* The address cache is used for binding to BACnet devices */
 /* The number of entries corresponds to the number of */
 /* devices that might respond to an I-Am on the network. */
 /* If your device is a simple server and does not need to bind, */
 /* then you don't need to use this. */
+/* The cache starts with MAX_ADDRESS_CACHE entries and grows as more */
+/* devices are bound, up to MAX_ADDRESS_CACHE_LIMIT entries, before the */
+/* oldest entries are dropped to make room. */
 #if !defined(MAX_ADDRESS_CACHE)
 #define MAX_ADDRESS_CACHE 255
 #endif
+#if !defined(MAX_ADDRESS_CACHE_LIMIT)
+#define MAX_ADDRESS_CACHE_LIMIT 16384
+#endif
 
 /* some modules have debugging enabled using PRINT_ENABLED */
 #if !defined(PRINT_ENABLED)
@@ -180,7 +334,9 @@
 ** make use of the code space reductions.
 **/
 
-#ifdef TEST
+#if defined(BACNET_PROFILE_EMBEDDED)
+/* only what is defined by the port, a server by default */
+#elif defined(TEST)
 #define BACNET_SVC_I_HAVE_A    1
 #define BACNET_SVC_WP_A        1
 #define BACNET_SVC_RP_A        1
@@ -231,6 +387,10 @@
 #define BACNET_SVC_RD_A 0
 #endif
 
+#ifndef BACNET_SVC_TS_A /* Do we send TimeSynchronization requests? */
+#define BACNET_SVC_TS_A 0
+#endif
+
 #ifndef BACNET_SVC_SERVER       /* Are we a pure server type device? */
 #define BACNET_SVC_SERVER 1
 #endif
@@ -27,7 +27,25 @@
 #include "config.h"
 #include "bacdef.h"
 
-#if defined(BACDL_ETHERNET)
+#if defined(BACDL_MULTI)
+#include "bip.h"
+#include "bvlc.h"
+#include "dlport.h"
+
+/* big enough for the frames of every port */
+#undef MAX_HEADER
+#undef MAX_MPDU
+#define MAX_HEADER (6+6+2+1+1+1)
+#define MAX_MPDU (MAX_HEADER+MAX_PDU)
+
+#define datalink_init dlport_init
+#define datalink_send_pdu dlport_send_pdu
+#define datalink_receive dlport_receive
+#define datalink_cleanup dlport_cleanup
+#define datalink_get_broadcast_address dlport_get_broadcast_address
+#define datalink_get_my_address dlport_get_my_address
+
+#elif defined(BACDL_ETHERNET)
 #include "ethernet.h"
 
 #define datalink_init ethernet_init
@@ -131,6 +149,8 @@ extern "C" {
  * - BACDL_ARCNET   -- for Clause 8 ARCNET LAN
  * - BACDL_MSTP     -- for Clause 9 MASTER-SLAVE/TOKEN PASSING (MS/TP) LAN
  * - BACDL_BIP      -- for ANNEX J - BACnet/IP
+ * - BACDL_MULTI    -- B/IP, MS/TP and Ethernet ports at once, routed
+ *                     between their networks (see dlport.h).
  * - BACDL_ALL      -- Unspecified for the build, so the transport can be
  *                     chosen at runtime from among these choices.
  * - Clause 10 POINT-TO-POINT (PTP) and Clause 11 EIA/CEA-709.1 ("LonTalk") LAN
@@ -120,6 +120,11 @@ extern "C" {
         uint16_t year,
         uint8_t month,
         uint8_t day);
+    uint32_t datetime_seconds_since_unix_epoch(
+        BACNET_DATE_TIME * bdatetime);
+    void datetime_seconds_since_unix_epoch_into_datetime(
+        uint32_t seconds,
+        BACNET_DATE_TIME * bdatetime);
     uint32_t datetime_seconds_since_midnight(
         BACNET_TIME *btime);
     uint16_t datetime_minutes_since_midnight(
@@ -116,6 +116,20 @@ extern "C" {
     bool dlmstp_send_pdu_queue_empty(void);
     bool dlmstp_send_pdu_queue_full(void);
 
+    /* the node tunes the Max_Master and Max_Info_Frames it uses, within */
+    /* the values above, see Auto_Tune in mstp.h.  The Linux port only, */
+    /* also set by BACNET_MSTP_AUTO_TUNE */
+    void dlmstp_set_auto_tune(
+        bool auto_tune);
+    bool dlmstp_auto_tune(
+        void);
+
+    /* how late the MS/TP task woke up after its timeouts, the Linux
+       port only, see BACNET_MSTP_PRIORITY */
+    void dlmstp_wakeup_jitter(
+        uint32_t * max_us,
+        uint32_t * mean_us);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,100 @@
+/**************************************************************************
+*
+* Copyright (C) 2005 Steve Karg <skarg@users.sourceforge.net>
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*********************************************************************/
+#ifndef DLPORT_H
+#define DLPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "bacdef.h"
+#include "npdu.h"
+
+/** @file dlport.h  Several datalinks driven at once by one process.
+ * Each port is one datalink with its own function table and BACnet
+ * network number.  The ports route between their networks, and the local
+ * application is a node on every one of them: a message for it arrives
+ * with the network of its port, and a reply goes out of that port.
+ */
+
+/* the ports of the process, one per datalink type */
+#define DLPORT_MAX_PORTS 4
+/* the networks learned behind the routers of the ports */
+#define DLPORT_MAX_ROUTES 64
+/* how long the receive waits on the sockets before it polls the
+   datalinks without one (MS/TP) again, in milliseconds */
+#define DLPORT_POLL_MS 5
+
+/* The functions of one datalink. */
+typedef struct dlport_funcs {
+    const char *name;
+    bool(*init) (char *ifname);
+    int (*send_pdu) (BACNET_ADDRESS * dest, BACNET_NPDU_DATA * npdu_data,
+        uint8_t * pdu, unsigned pdu_len);
+    uint16_t(*receive) (BACNET_ADDRESS * src, uint8_t * pdu,
+        uint16_t max_pdu, unsigned timeout);
+    void (*cleanup) (void);
+    void (*get_broadcast_address) (BACNET_ADDRESS * dest);
+    void (*get_my_address) (BACNET_ADDRESS * my_address);
+    /* the descriptor to wait on, or NULL if the datalink must be polled */
+    int (*socket) (void);
+} DLPORT_FUNCS;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    const DLPORT_FUNCS *dlport_funcs(
+        const char *name);
+    bool dlport_add(
+        const DLPORT_FUNCS * funcs,
+        char *ifname,
+        uint16_t net);
+    unsigned dlport_count(
+        void);
+    uint16_t dlport_network(
+        unsigned port);
+
+    bool dlport_init(
+        char *spec);
+    int dlport_send_pdu(
+        BACNET_ADDRESS * dest,
+        BACNET_NPDU_DATA * npdu_data,
+        uint8_t * pdu,
+        unsigned pdu_len);
+    uint16_t dlport_receive(
+        BACNET_ADDRESS * src,
+        uint8_t * pdu,
+        uint16_t max_pdu,
+        unsigned timeout);
+    void dlport_cleanup(
+        void);
+    void dlport_get_broadcast_address(
+        BACNET_ADDRESS * dest);
+    void dlport_get_my_address(
+        BACNET_ADDRESS * my_address);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif
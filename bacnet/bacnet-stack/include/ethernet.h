@@ -34,12 +34,26 @@
 #define MAX_HEADER (6+6+2+1+1+1)
 #define MAX_MPDU (MAX_HEADER+MAX_PDU)
 
+/* the blocks of the PACKET_RX_RING the 802.2 frames are received into on
+   Linux, and the size of each; define the blocks as 0 to read one frame
+   per system call */
+#if defined(__linux__)
+#ifndef ETHERNET_RX_RING_BLOCKS
+#define ETHERNET_RX_RING_BLOCKS 8
+#endif
+#ifndef ETHERNET_RX_RING_BLOCK_SIZE
+#define ETHERNET_RX_RING_BLOCK_SIZE (1 << 16)
+#endif
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
     bool ethernet_valid(
         void);
+    int ethernet_socket(
+        void);
     void ethernet_cleanup(
         void);
     bool ethernet_init(
@@ -64,6 +64,19 @@ extern "C" {
         uint8_t * data_bytes,
         unsigned count);
 
+    volatile uint8_t *FIFO_Peek_Span(
+        FIFO_BUFFER const *b,
+        unsigned *length);
+    unsigned FIFO_Pull_Commit(
+        FIFO_BUFFER * b,
+        unsigned count);
+    volatile uint8_t *FIFO_Put_Span(
+        FIFO_BUFFER const *b,
+        unsigned *length);
+    unsigned FIFO_Put_Commit(
+        FIFO_BUFFER * b,
+        unsigned count);
+
     void FIFO_Flush(
         FIFO_BUFFER * b);
 
@@ -77,6 +90,8 @@ extern "C" {
 #include "ctest.h"
     void testFIFOBuffer(
         Test * pTest);
+    void testFIFOSpan(
+        Test * pTest);
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,142 @@
+/**************************************************************************
+*
+* Copyright (C) 2006 Steve Karg <skarg@users.sourceforge.net>
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*********************************************************************/
+#ifndef FILEXFER_H
+#define FILEXFER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "bacdef.h"
+#include "bacenum.h"
+
+/** @file filexfer.h  Reading or writing a whole File object with stream
+ * access, with a window of AtomicReadFile or AtomicWriteFile requests in
+ * flight at consecutive offsets.  Each request has its own completion
+ * (see tsm_set_completion) and an invoke id unique for the device, the
+ * acks are written to, or read from, the local file at their offset in
+ * whatever order they come, and a chunk that fails is sent again alone.
+ * A read asks for as much as the device sends in segments, if it says it
+ * can, and the stack puts segmented replies back together.
+ *
+ * The application owns the datalink: it binds the device, calls
+ * file_transfer_init(), gives the received PDUs to npdu_handler(), and
+ * calls tsm_timer_milliseconds() and file_transfer_task() as time goes
+ * by, until file_transfer_done().
+ */
+
+/* the requests in flight at once for one transfer */
+#ifndef MAX_FILE_TRANSFER_WINDOW
+#define MAX_FILE_TRANSFER_WINDOW 32
+#endif
+/* a chunk is sent again this many times after the TSM gave up on it */
+#ifndef FILE_TRANSFER_RETRIES
+#define FILE_TRANSFER_RETRIES 3
+#endif
+
+typedef enum {
+    FILE_TRANSFER_RUNNING,
+    FILE_TRANSFER_DONE,
+    FILE_TRANSFER_FAILED
+} BACNET_FILE_TRANSFER_STATE;
+
+struct BACnet_File_Transfer;
+
+/* a range of the file, read or written with one or more requests */
+typedef struct BACnet_File_Transfer_Chunk {
+    struct BACnet_File_Transfer *transfer;
+    bool busy;
+    /* its request is in flight, else it waits to be sent */
+    bool inflight;
+    int32_t offset;
+    uint32_t length;
+    /* the octets of the request in flight */
+    uint32_t requested;
+    uint8_t retries;
+} BACNET_FILE_TRANSFER_CHUNK;
+
+typedef struct BACnet_File_Transfer {
+    uint32_t device_id;
+    uint32_t file_instance;
+    /* AtomicWriteFile from the local file, else AtomicReadFile into it */
+    bool write;
+    FILE *file;
+    /* the requests in flight at once, 1..MAX_FILE_TRANSFER_WINDOW */
+    unsigned window;
+    /* the device sends segmented replies, see the segmentation of its
+       I-Am; the reads are then larger than one APDU */
+    bool segmentation;
+    BACNET_FILE_TRANSFER_STATE state;
+    /* the octets of a request; if 0, it is worked out from the max APDU
+       of the device when it is bound */
+    uint32_t chunk_size;
+    /* the next offset not given to a chunk yet */
+    int32_t next;
+    /* of the local file on a write; on a read, -1 until the end of the
+       file is acked */
+    int32_t size;
+    /* the octets acked */
+    uint32_t done;
+    /* the requests sent, and sent again */
+    uint32_t requests;
+    uint32_t retries;
+    /* why it failed */
+    uint8_t pdu_type;
+    BACNET_ERROR_CLASS error_class;
+    BACNET_ERROR_CODE error_code;
+    uint8_t reason;
+    bool timeout;
+    /* internal */
+    bool bound;
+    BACNET_ADDRESS dest;
+    unsigned max_apdu;
+    BACNET_FILE_TRANSFER_CHUNK chunks[MAX_FILE_TRANSFER_WINDOW];
+} BACNET_FILE_TRANSFER;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    void file_transfer_init(
+        BACNET_FILE_TRANSFER * transfer,
+        uint32_t device_id,
+        uint32_t file_instance,
+        FILE * file,
+        bool write,
+        unsigned window);
+    /* sends the requests that the window allows, once the device is bound */
+    void file_transfer_task(
+        BACNET_FILE_TRANSFER * transfer);
+    bool file_transfer_done(
+        BACNET_FILE_TRANSFER * transfer);
+    /* the octets of a request to a device of the max APDU */
+    uint32_t file_transfer_chunk_size(
+        unsigned max_apdu,
+        bool segmentation,
+        bool write);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif
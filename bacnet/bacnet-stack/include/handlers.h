@@ -222,6 +222,22 @@ extern "C" {
         uint8_t * apdu,
         int apdu_len,
         BACNET_READ_ACCESS_DATA * read_access_data);
+    /* The same, with the nodes allocated from the arena. */
+    int rpm_ack_decode_service_request_arena(
+        uint8_t * apdu,
+        int apdu_len,
+        BACNET_READ_ACCESS_DATA * read_access_data,
+        BACNET_RPM_ARENA * arena);
+    int rpm_ack_decode_service_request_view(
+        uint8_t * apdu,
+        int apdu_len,
+        BACNET_READ_ACCESS_DATA * read_access_data,
+        BACNET_RPM_ARENA * arena);
+    int rpm_ack_decode_service_request_compact(
+        uint8_t * apdu,
+        int apdu_len,
+        BACNET_READ_ACCESS_DATA * read_access_data,
+        BACNET_RPM_ARENA * arena);
     /* print the RP Ack data to stdout */
     void rp_ack_print_data(
         BACNET_READ_PROPERTY_DATA * data);
@@ -243,6 +259,13 @@ extern "C" {
     int handler_cov_encode_subscriptions(
         uint8_t * apdu,
         int max_apdu);
+    void handler_cov_object_changed(
+        BACNET_OBJECT_TYPE object_type,
+        uint32_t object_instance);
+    void handler_cov_batch_begin(
+        void);
+    void handler_cov_batch_end(
+        void);
 
     void handler_ucov_notification(
         uint8_t * service_request,
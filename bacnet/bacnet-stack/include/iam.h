@@ -48,6 +48,11 @@ extern "C" {
         int *pSegmentation,
         uint16_t * pVendor_id);
 
+    bool iam_decode_device_id(
+        uint8_t * apdu,
+        uint16_t apdu_len,
+        uint32_t * pDevice_id);
+
 #ifdef TEST
 #include "ctest.h"
     int iam_decode_apdu(
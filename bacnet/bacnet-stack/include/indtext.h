@@ -34,6 +34,18 @@ typedef struct {
     const char *pString;        /* text pair - use NULL to end the list */
 } INDTEXT_DATA;
 
+/* hash index of a list, for the lookups in O(1) instead of a scan.
+   it's built on the first lookup, or by indtext_hash_build, which must
+   be done before the index is shared between threads */
+typedef struct {
+    INDTEXT_DATA *data_list;
+    unsigned size;      /* slots of each table, a power of 2, 0 until built */
+    INDTEXT_DATA **by_string;   /* by the case insensitive text */
+    INDTEXT_DATA **by_index;
+} INDTEXT_HASH;
+
+#define INDTEXT_HASH_INIT(list) { list, 0, NULL, NULL }
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -89,6 +101,32 @@ extern "C" {
     unsigned indtext_count(
         INDTEXT_DATA * data_list);
 
+/* The same lookups through the hash index of the list. The first entry
+   of the list wins for a duplicate text or index, as with the scans.
+   If the index can't be allocated, they fall back to the scans. */
+    bool indtext_hash_build(
+        INDTEXT_HASH * hash);
+    void indtext_hash_free(
+        INDTEXT_HASH * hash);
+    bool indtext_hash_by_istring(
+        INDTEXT_HASH * hash,
+        const char *search_name,
+        unsigned *found_index);
+    unsigned indtext_hash_by_istring_default(
+        INDTEXT_HASH * hash,
+        const char *search_name,
+        unsigned default_index);
+    const char *indtext_hash_by_index_default(
+        INDTEXT_HASH * hash,
+        unsigned index,
+        const char *default_name);
+    const char *indtext_hash_by_index_split_default(
+        INDTEXT_HASH * hash,
+        unsigned index,
+        unsigned split_index,
+        const char *before_split_default_name,
+        const char *default_name);
+
 
 #if !defined(__BORLANDC__) && !defined(_MSC_VER)
     int stricmp(
@@ -100,6 +138,8 @@ extern "C" {
 #include "ctest.h"
     void testIndexText(
         Test * pTest);
+    void testIndexTextHash(
+        Test * pTest);
 #endif
 
 #ifdef __cplusplus
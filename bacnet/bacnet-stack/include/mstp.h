@@ -154,6 +154,25 @@ struct mstp_port_struct_t {
     /* its value shall be 127. */
     uint8_t Nmax_master;
 
+    /* With Auto_Tune, Nmax_master and Nmax_info_frames are tuned by the */
+    /* node, Max_Master and Max_Info_Frames keep the values of the Device */
+    /* object.  Nmax_master follows the highest master heard on the link, */
+    /* so that the highest master doesn't poll the empty addresses above */
+    /* it, with a cycle up to Max_Master every MSTP_SWEEP_CYCLES cycles. */
+    /* Nmax_info_frames goes up by one, to MSTP_AUTO_MAX_INFO_FRAMES, each */
+    /* time the node sent all the frames it was allowed with a token, and */
+    /* back down to Max_Info_Frames while it has less to send. */
+    /* MSTP_Init copies Nmax_master and Nmax_info_frames, and clears it. */
+    bool Auto_Tune;
+    uint8_t Max_Master;
+    uint8_t Max_Info_Frames;
+    /* the highest master heard since the last cycle up to Max_Master */
+    uint8_t Highest_Master;
+    /* the cycles left until the next one up to Max_Master */
+    uint16_t Sweep_Count;
+    /* the frames sent with the token */
+    uint8_t Token_Frames;
+
     /* An array of octets, used to store octets for transmitting */
     /* OutputBuffer is indexed from 0 to OutputBufferSize-1. */
     /* The maximum size of a frame is 501 octets. */
@@ -187,6 +206,9 @@ extern "C" {
     /* returns true if line is active */
     bool MSTP_Line_Active(
         volatile struct mstp_port_struct_t *mstp_port);
+    /* returns milliseconds the state machines may sleep, 0 if busy */
+    uint16_t MSTP_Wait_Time(
+        volatile struct mstp_port_struct_t *mstp_port);
 
     uint16_t MSTP_Create_Frame(
         uint8_t * buffer,       /* where frame is loaded */
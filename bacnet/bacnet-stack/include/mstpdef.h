@@ -123,6 +123,20 @@ typedef enum {
 #define DEFAULT_MAX_MASTER 127
 #define DEFAULT_MAC_ADDRESS 127
 
+/* With Auto_Tune, the maintenance cycles of the tuned Max_Master between */
+/* two cycles up to the Max_Master of the Device object, that find the */
+/* masters added above the highest one.  A cycle of the highest master */
+/* lasts Npoll tokens once there is no address left to poll, and a cycle */
+/* up to Max_Master polls every address in the gap, one each Npoll tokens. */
+#ifndef MSTP_SWEEP_CYCLES
+#define MSTP_SWEEP_CYCLES 256
+#endif
+
+/* With Auto_Tune, the highest Max_Info_Frames the node raises to */
+#ifndef MSTP_AUTO_MAX_INFO_FRAMES
+#define MSTP_AUTO_MAX_INFO_FRAMES 8
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
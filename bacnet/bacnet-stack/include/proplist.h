@@ -43,12 +43,43 @@ struct special_property_list_t {
     struct property_list_t Proprietary;
 };
 
+/* a bit for each of the properties 0..511 that ASHRAE reserves */
+#define PROPERTY_LIST_BITS 512
+
+/* the lists of an object type with their counts, and which of the
+   standard properties they hold, worked out once rather than by walking
+   the lists on each request.  The proprietary properties are past the
+   bits and are looked up in their list. */
+struct property_list_index_t {
+    struct special_property_list_t List;
+    uint8_t Required[PROPERTY_LIST_BITS / 8];
+    uint8_t Optional[PROPERTY_LIST_BITS / 8];
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
     unsigned property_list_count(
         const int *pList);
+    bool property_list_member(
+        const int *pList,
+        int object_property);
+    void property_list_index_init(
+        struct property_list_index_t *pIndex,
+        const int *pListRequired,
+        const int *pListOptional,
+        const int *pListProprietary);
+    bool property_list_index_member(
+        const struct property_list_index_t *pIndex,
+        BACNET_PROPERTY_ID special_property,
+        BACNET_PROPERTY_ID object_property);
+    void property_list_init(
+        void);
+    bool property_list_special_member(
+        BACNET_OBJECT_TYPE object_type,
+        BACNET_PROPERTY_ID special_property,
+        BACNET_PROPERTY_ID object_property);
     const int * property_list_optional(
         BACNET_OBJECT_TYPE object_type);
     const int * property_list_required(
@@ -42,6 +42,7 @@ extern "C" {
         BACNET_BIT_STRING ResultFlags;  /**<  FIRST_ITEM, LAST_ITEM, MORE_ITEMS. */
         int RequestType;/**< Index, sequence or time based request. */
         int Overhead;    /**< How much space the baggage takes in the response. */
+        int MaxAPDU;     /**< Space for the whole response, 0 for MAX_APDU. */
         uint32_t ItemCount;
         uint32_t FirstSequence;
         union { /**< Pick the appropriate data type. */
@@ -54,6 +55,10 @@ extern "C" {
         BACNET_ERROR_CODE error_code;
     } BACNET_READ_RANGE_DATA;
 
+/** The space the items and the baggage may take in the response. */
+#define RR_MAX_APDU(pRequest) \
+    (((pRequest)->MaxAPDU > 0) ? (pRequest)->MaxAPDU : MAX_APDU)
+
 /** Defines to indicate which type of read range request it is.
    Not really a bit map but we do it like this to allow quick
    checking of request against capabilities for the property */
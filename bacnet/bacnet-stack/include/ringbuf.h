@@ -64,6 +64,14 @@ extern "C" {
         RING_BUFFER * b);
     bool Ringbuf_Data_Put(
         RING_BUFFER * b, volatile uint8_t *data_element);
+    unsigned Ringbuf_Pop_Many(
+        RING_BUFFER * b,
+        uint8_t * data_elements,
+        unsigned count);
+    unsigned Ringbuf_Put_Many(
+        RING_BUFFER * b,
+        uint8_t * data_elements,
+        unsigned count);
     /* Note: element_count must be a power of two */
     void Ringbuf_Init(
         RING_BUFFER * b,        /* ring buffer structure */
@@ -53,6 +53,20 @@ typedef struct BACnet_Read_Access_Data {
     struct BACnet_Read_Access_Data *next;
 } BACNET_READ_ACCESS_DATA;
 
+/* A bump allocator for the nodes decoded from one RPM Ack.
+   The nodes are carved from blocks, and all released at once. */
+struct BACnet_RPM_Arena_Block;
+typedef struct BACnet_RPM_Arena_Block {
+    struct BACnet_RPM_Arena_Block *next;
+    size_t size;
+    size_t used;
+} BACNET_RPM_ARENA_BLOCK;
+
+typedef struct BACnet_RPM_Arena {
+    BACNET_RPM_ARENA_BLOCK *blocks;     /* the newest first */
+    size_t block_size;  /* minimum size of a new block */
+} BACNET_RPM_ARENA;
+
 /** Fetches the lists of properties (array of BACNET_PROPERTY_ID's) for this
  *  object type, grouped by Required, Optional, and Proprietary.
  * A function template; @see device.c for assignment to object types.
@@ -166,6 +180,20 @@ extern "C" {
         unsigned apdu_len,
         BACNET_PROPERTY_ID * object_property,
         uint32_t * array_index);
+
+/* arena for the decoded nodes, see BACNET_RPM_ARENA */
+    void rpm_arena_init(
+        BACNET_RPM_ARENA * arena,
+        size_t block_size);
+/* zeroed memory, valid until the next reset. NULL if out of memory */
+    void *rpm_arena_alloc(
+        BACNET_RPM_ARENA * arena,
+        size_t size);
+/* release everything at once, keeping one block large enough for it all */
+    void rpm_arena_reset(
+        BACNET_RPM_ARENA * arena);
+    void rpm_arena_destroy(
+        BACNET_RPM_ARENA * arena);
 #ifdef TEST
 #include "ctest.h"
     int rpm_decode_apdu(
@@ -186,6 +214,8 @@ extern "C" {
         Test * pTest);
     void testReadPropertyMultipleAck(
         Test * pTest);
+    void testReadPropertyMultipleArena(
+        Test * pTest);
 #endif
 
 #ifdef __cplusplus
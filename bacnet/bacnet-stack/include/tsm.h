@@ -28,12 +28,46 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "bacdef.h"
+#include "apdu.h"
 #include "npdu.h"
+#include "bacenum.h"
+#include "bactimer.h"
+
+/* the reply to a confirmed request, or its failure, as given to the */
+/* completion function of the transaction */
+typedef struct BACnet_Confirmed_Reply {
+    /* PDU_TYPE_SIMPLE_ACK, COMPLEX_ACK, ERROR, REJECT or ABORT */
+    uint8_t pdu_type;
+    /* true if there was no reply, after the retries; nothing else is set */
+    bool timeout;
+    uint8_t service_choice;
+    /* the service data of a ComplexACK, all its segments */
+    uint8_t *service_request;
+    uint16_t service_len;
+    BACNET_CONFIRMED_SERVICE_ACK_DATA *ack_data;
+    /* of an Error */
+    BACNET_ERROR_CLASS error_class;
+    BACNET_ERROR_CODE error_code;
+    /* of a Reject or an Abort */
+    uint8_t reason;
+} BACNET_CONFIRMED_REPLY;
+
+/* called once with the reply to the request, in place of the handlers */
+/* set with apdu_set_*_handler(); the invoke ID is free once it returns */
+typedef void (
+    *tsm_completion_function) (
+    BACNET_ADDRESS * src,
+    uint8_t invoke_id,
+    BACNET_CONFIRMED_REPLY * reply,
+    void *context);
 
 /* note: TSM functionality is optional - only needed if we are
    doing client requests */
 #if (!MAX_TSM_TRANSACTIONS)
 #define tsm_free_invoke_id(x) (void)x;
+#define tsm_free_invoke_id_peer(s,x) (void)s; (void)x;
+#define tsm_complete(s,x,r) false
+#define tsm_reply_received(s,x) ((void)s, (void)x)
 #else
 typedef enum {
     TSM_STATE_IDLE,
@@ -54,12 +88,12 @@ typedef struct BACnet_TSM_Data {
     /* used to control APDU retries and the acceptance of server replies */
     /*bool SentAllSegments;  */
     /* stores the sequence number of the last segment received in order */
-    /*uint8_t LastSequenceNumber; */
+    uint8_t LastSequenceNumber;
     /* stores the sequence number of the first segment of */
     /* a sequence of segments that fill a window */
-    /*uint8_t InitialSequenceNumber; */
+    uint8_t InitialSequenceNumber;
     /* stores the current window size */
-    /*uint8_t ActualWindowSize; */
+    uint8_t ActualWindowSize;
     /* stores the window size proposed by the segment sender */
     /*uint8_t ProposedWindowSize;  */
     /*  used to perform timeout on PDU segments */
@@ -67,8 +101,14 @@ typedef struct BACnet_TSM_Data {
     /* used to perform timeout on Confirmed Requests */
     /* in milliseconds */
     uint16_t RequestTimer;
+    /* when RequestTimer expires, on the clock of tsm_timer_milliseconds */
+    uint32_t Deadline;
+    /* when the request was first sent, for the round trip of its reply */
+    uint32_t SentAt;
     /* unique id */
     uint8_t InvokeID;
+    /* true if the id is only unique for dest, see tsm_next_free_invokeID_peer */
+    bool PeerInvokeID;
     /* state that the TSM is in */
     BACNET_TSM_STATE state;
     /* the address we sent it to */
@@ -78,6 +118,17 @@ typedef struct BACnet_TSM_Data {
     /* copy of the APDU, should we need to send it again */
     uint8_t apdu[MAX_PDU];
     unsigned apdu_len;
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+    /* the service data of the segments of the reply received so far, */
+    /* allocated with the first segment */
+    uint8_t *segments;
+    unsigned segments_len;
+    /* a SegmentACK asked for the segments after LastSequenceNumber */
+    bool SegmentNak;
+#endif
+    /* see tsm_set_completion, NULL for the global handlers */
+    tsm_completion_function Completion;
+    void *CompletionContext;
 } BACNET_TSM_DATA;
 
 #ifdef __cplusplus
@@ -90,6 +141,10 @@ extern "C" {
         void);
     void tsm_timer_milliseconds(
         uint16_t milliseconds);
+/* the milliseconds of the TSM clock until a transaction is due, for */
+/* its timer; BACTIMER_IDLE while none is */
+    uint32_t tsm_timer_remaining(
+        void);
 /* free the invoke ID when the reply comes back */
     void tsm_free_invoke_id(
         uint8_t invokeID);
@@ -98,6 +153,13 @@ extern "C" {
         void);
     void tsm_invokeID_set(
         uint8_t invokeID);
+/* an invoke ID only unique for the device, for clients with more
+   requests in flight than one 8-bit invoke ID space holds */
+    uint8_t tsm_next_free_invokeID_peer(
+        BACNET_ADDRESS * dest);
+    void tsm_free_invoke_id_peer(
+        BACNET_ADDRESS * src,
+        uint8_t invokeID);
 /* returns the same invoke ID that was given */
     void tsm_set_confirmed_unsegmented_transaction(
         uint8_t invokeID,
@@ -117,6 +179,69 @@ extern "C" {
         uint8_t invokeID);
     bool tsm_invoke_id_failed(
         uint8_t invokeID);
+    bool tsm_invoke_id_free_peer(
+        BACNET_ADDRESS * dest,
+        uint8_t invokeID);
+    bool tsm_invoke_id_failed_peer(
+        BACNET_ADDRESS * dest,
+        uint8_t invokeID);
+/* the reply to the request of the transaction goes to the function, */
+/* with the context, instead of the global handlers; so does a timeout */
+    bool tsm_set_completion(
+        BACNET_ADDRESS * dest,
+        uint8_t invokeID,
+        tsm_completion_function completion,
+        void *context);
+/* gives the reply to the completion function of the transaction and */
+/* frees the invoke ID; false, and nothing is done, if it has none */
+    bool tsm_complete(
+        BACNET_ADDRESS * src,
+        uint8_t invokeID,
+        BACNET_CONFIRMED_REPLY * reply);
+/* a reply to the request came, before it is handled: the round trip is */
+/* measured for the adaptive timeout */
+    void tsm_reply_received(
+        BACNET_ADDRESS * src,
+        uint8_t invokeID);
+/* the timeout of the requests to each device is learned from the round */
+/* trips of its replies, and doubled on every retry; off by default, */
+/* when every request waits apdu_timeout() */
+    void tsm_adaptive_timeout_set(
+        bool enable);
+/* the timeout of the next request to the device, in milliseconds */
+    uint16_t tsm_peer_timeout(
+        BACNET_ADDRESS * dest);
+
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+/* segmented replies, as the server: the largest APDU a reply may have */
+/* and, when it does not fit in one, sending it in segments */
+    unsigned tsm_segmented_response_limit(
+        BACNET_CONFIRMED_SERVICE_DATA * service_data);
+    bool tsm_segmented_response(
+        BACNET_ADDRESS * dest,
+        BACNET_NPDU_DATA * npdu_data,
+        BACNET_CONFIRMED_SERVICE_DATA * service_data,
+        uint8_t * apdu,
+        unsigned apdu_len);
+    void tsm_segmented_response_abort(
+        BACNET_ADDRESS * src,
+        uint8_t invokeID);
+/* as the client: puts the segments of a ComplexACK back together, */
+/* true with the whole service data once the last one is received */
+    bool tsm_segmented_confirmation(
+        BACNET_ADDRESS * src,
+        BACNET_CONFIRMED_SERVICE_ACK_DATA * service_ack_data,
+        uint8_t ** service_request,
+        uint16_t * service_request_len);
+/* a SegmentACK, for either of them */
+    void tsm_segment_ack_received(
+        BACNET_ADDRESS * src,
+        uint8_t invokeID,
+        uint8_t sequence_number,
+        uint8_t actual_window_size,
+        bool negative,
+        bool server);
+#endif
 
 #ifdef __cplusplus
 }
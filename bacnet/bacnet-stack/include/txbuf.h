@@ -29,7 +29,21 @@
 #include <stdint.h>
 #include "config.h"
 #include "datalink.h"
+#include "bacctx.h"
 
-extern uint8_t Handler_Transmit_Buffer[MAX_PDU];
+/* With the embedded profile and no segmentation, the ReadPropertyMultiple
+   handler encodes its reply in this buffer, with the headroom it needs,
+   instead of in one of its own.  Nothing else uses the buffer while it
+   does, as the ports run the handlers on one thread. */
+#if defined(BACNET_PROFILE_EMBEDDED) && (MAX_SEGMENTS_ACCEPTED == 1)
+#define HANDLER_TRANSMIT_BUFFER_SHARED 1
+#define HANDLER_TRANSMIT_BUFFER_SIZE (MAX_NPDU + MAX_APDU + MAX_APDU)
+#else
+#define HANDLER_TRANSMIT_BUFFER_SIZE MAX_PDU
+#endif
+
+/* one per thread, when threads run their own BACnet contexts */
+extern BACNET_THREAD_LOCAL uint8_t
+    Handler_Transmit_Buffer[HANDLER_TRANSMIT_BUFFER_SIZE];
 
 #endif
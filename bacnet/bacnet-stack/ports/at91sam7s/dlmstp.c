@@ -417,6 +417,11 @@ static void MSTP_Receive_Frame_FSM(
     /* Used as an index by the Receive State Machine,
        up to a maximum value of the MPDU */
     static uint16_t Index = 0;
+#if RS485_DMA_RECEIVE
+    /* the received data octets that follow each other */
+    uint8_t *data = NULL;
+    uint16_t count = 0;
+#endif
 
     switch (Receive_State) {
         case MSTP_RECEIVE_STATE_IDLE:
@@ -595,6 +600,21 @@ static void MSTP_Receive_Frame_FSM(
                 MSTP_Flag.ReceivedInvalidFrame = true;
                 /* wait for the start of the next frame. */
                 Receive_State = MSTP_RECEIVE_STATE_IDLE;
+#if RS485_DMA_RECEIVE
+            } else if ((Index < DataLength) &&
+                (count = RS485_DataBlock(&data))) {
+                /* DataOctets: all of them that the DMA has received */
+                if (count > (DataLength - Index)) {
+                    count = DataLength - Index;
+                }
+                DataCRC = CRC_Calc_Data_Block(data, count, DataCRC);
+                if (Receive_State == MSTP_RECEIVE_STATE_DATA) {
+                    memcpy(&InputBuffer[Index], data, count);
+                }
+                Index += count;
+                RS485_DataBlock_Release(count);
+                INCREMENT_AND_LIMIT_UINT8(EventCount);
+#endif
             } else if (RS485_DataAvailable(&DataRegister)) {
                 Timer_Silence_Reset();
                 INCREMENT_AND_LIMIT_UINT8(EventCount);
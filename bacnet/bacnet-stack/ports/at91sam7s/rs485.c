@@ -33,6 +33,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "timer.h"
+#include "rs485.h"
 
 /* This file has been customized for use with UART0
    on the AT91SAM7S-EK */
@@ -42,6 +43,15 @@
 static volatile AT91S_USART *RS485_Interface = AT91C_BASE_US0;
 /* baud rate */
 static int RS485_Baud = 38400;
+#if RS485_DMA_RECEIVE
+/* The PDC receives into one half of the ring while the other half waits
+   as its next buffer.  The ring holds more than the largest frame. */
+#define RS485_RING_SIZE 1024
+#define RS485_RING_HALF (RS485_RING_SIZE / 2)
+static uint8_t Receive_Ring[RS485_RING_SIZE];
+/* the next byte of the ring to hand to the FSM */
+static uint16_t Receive_Tail;
+#endif
 
 /* The minimum time after the end of the stop bit of the final octet of a */
 /* received frame before a node may enable its EIA-485 driver: 40 bit times. */
@@ -99,6 +109,17 @@ void RS485_Initialize(
     /* baud rate */
     RS485_Interface->US_BRGR = MCK / 16 / RS485_Baud;
 
+#if RS485_DMA_RECEIVE
+    /* the PDC fills the first half, then moves on to the second */
+    RS485_Interface->US_PTCR = AT91C_PDC_RXTDIS;
+    RS485_Interface->US_RPR = (unsigned int) &Receive_Ring[0];
+    RS485_Interface->US_RCR = RS485_RING_HALF;
+    RS485_Interface->US_RNPR = (unsigned int) &Receive_Ring[RS485_RING_HALF];
+    RS485_Interface->US_RNCR = RS485_RING_HALF;
+    Receive_Tail = 0;
+    RS485_Interface->US_PTCR = AT91C_PDC_RXTEN;
+#endif
+
     RS485_Interface->US_CR = AT91C_US_RXEN |    /* Receiver Enable     */
         AT91C_US_TXEN;  /* Transmitter Enable  */
 
@@ -240,6 +261,105 @@ bool RS485_ReceiveError(
     return ReceiveError;
 }
 
+#if RS485_DMA_RECEIVE
+/****************************************************************************
+* DESCRIPTION: The place in the ring where the PDC stores the next byte
+* RETURN:      index into the ring
+* ALGORITHM:   When the PDC has used up its next buffer, it is working in
+*              the other half, so the half it finished becomes the next.
+* NOTES:       Called often enough that the PDC never finishes both halves
+*              in between, which is a frame or more at any baud rate.
+*****************************************************************************/
+static uint16_t RS485_Ring_Head(
+    void)
+{
+    /* the next counter first: once it is zero, the pointer is already in
+       the other half */
+    bool swapped = (RS485_Interface->US_RNCR == 0);
+    uint8_t *pointer = (uint8_t *) RS485_Interface->US_RPR;
+
+    if (swapped) {
+        if (pointer >= &Receive_Ring[RS485_RING_HALF]) {
+            RS485_Interface->US_RNPR = (unsigned int) &Receive_Ring[0];
+        } else {
+            RS485_Interface->US_RNPR =
+                (unsigned int) &Receive_Ring[RS485_RING_HALF];
+        }
+        RS485_Interface->US_RNCR = RS485_RING_HALF;
+    }
+
+    return (uint16_t) ((pointer - &Receive_Ring[0]) % RS485_RING_SIZE);
+}
+
+/****************************************************************************
+* DESCRIPTION: Return true if data is available
+* RETURN:      true if data is available, with the data in the parameter set
+* ALGORITHM:   none
+* NOTES:       none
+*****************************************************************************/
+bool RS485_DataAvailable(
+    uint8_t * DataRegister)
+{
+    bool DataAvailable = false;
+    /* LED on send */
+    volatile AT91PS_PIO pPIO = AT91C_BASE_PIOA;
+
+    if (Receive_Tail != RS485_Ring_Head()) {
+        if (DataRegister) {
+            *DataRegister = Receive_Ring[Receive_Tail];
+            Receive_Tail = (Receive_Tail + 1) % RS485_RING_SIZE;
+        }
+        DataAvailable = true;
+        /* LED ON */
+        pPIO->PIO_CODR = LED2;
+    }
+
+    return DataAvailable;
+}
+
+/****************************************************************************
+* DESCRIPTION: The received bytes that follow each other in the ring
+* RETURN:      number of bytes, with their address in the parameter
+* ALGORITHM:   none
+* NOTES:       the bytes stay in the ring until RS485_DataBlock_Release()
+*****************************************************************************/
+uint16_t RS485_DataBlock(
+    uint8_t ** data)
+{
+    uint16_t head = RS485_Ring_Head();
+    uint16_t count = 0;
+
+    if (head >= Receive_Tail) {
+        count = head - Receive_Tail;
+    } else {
+        /* up to the end of the ring, the rest comes next time */
+        count = RS485_RING_SIZE - Receive_Tail;
+    }
+    *data = &Receive_Ring[Receive_Tail];
+
+    return count;
+}
+
+/****************************************************************************
+* DESCRIPTION: Give bytes returned by RS485_DataBlock() back to the ring
+* RETURN:      none
+* ALGORITHM:   none
+* NOTES:       restarts the silence timer, as receiving a byte does
+*****************************************************************************/
+void RS485_DataBlock_Release(
+    uint16_t count)
+{
+    /* LED on send */
+    volatile AT91PS_PIO pPIO = AT91C_BASE_PIOA;
+
+    if (count) {
+        Receive_Tail = (Receive_Tail + count) % RS485_RING_SIZE;
+        Timer_Silence_Reset();
+        /* LED ON */
+        pPIO->PIO_CODR = LED2;
+    }
+}
+#else
 /****************************************************************************
 * DESCRIPTION: Return true if data is available
 * RETURN:      true if data is available, with the data in the parameter set
@@ -265,6 +385,7 @@ bool RS485_DataAvailable(
 
     return DataAvailable;
 }
+#endif
 
 #ifdef TEST_RS485
 int main(
@@ -27,6 +27,14 @@
 #define RS485_H
 
 #include <stdint.h>
+#include <stdbool.h>
+
+/* The PDC writes the received bytes into a ring by itself, so none are
+   lost while the main loop is busy, and the frame FSM takes the data in
+   blocks. */
+#ifndef RS485_DMA_RECEIVE
+#define RS485_DMA_RECEIVE 1
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -46,6 +54,12 @@ extern "C" {
         void);
     bool RS485_DataAvailable(
         uint8_t * data);
+#if RS485_DMA_RECEIVE
+    uint16_t RS485_DataBlock(
+        uint8_t ** data);
+    void RS485_DataBlock_Release(
+        uint16_t count);
+#endif
 
     void RS485_Turnaround_Delay(
         void);
@@ -37,6 +37,7 @@
 #include "bacdcode.h"
 #include "bip.h"
 #include "net.h"
+#include <linux/filter.h>
 
 /** @file linux/bip-init.c  Initializes BACnet/IP interface (Linux). */
 
@@ -139,6 +140,103 @@ void bip_set_interface(
     }
 }
 
+/* Opens a UDP socket bound to the BACnet/IP port, for sending and
+ * receiving broadcasts, which shares the port with the other lanes when
+ * reuseport.  Returns the socket, or -1 if a socket function fails. */
+static int bip_open_socket(
+    bool reuseport)
+{
+    int status = 0;     /* return from socket lib calls */
+    struct sockaddr_in sin;
+    int sockopt = 1;
+    int sock_fd = -1;
+
+    sock_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock_fd < 0)
+        return -1;
+    /* Allow us to use the same socket for sending and receiving */
+    /* This makes sure that the src port is correct when sending */
+    status =
+        setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &sockopt,
+        sizeof(sockopt));
+    /* allow us to send a broadcast */
+    if (status >= 0) {
+        status =
+            setsockopt(sock_fd, SOL_SOCKET, SO_BROADCAST, &sockopt,
+            sizeof(sockopt));
+    }
+#if defined(SO_REUSEPORT)
+    if ((status >= 0) && reuseport) {
+        status =
+            setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &sockopt,
+            sizeof(sockopt));
+    }
+#else
+    (void) reuseport;
+#endif
+    /* bind the socket to the local port number and IP address */
+    if (status >= 0) {
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(INADDR_ANY);
+        sin.sin_port = bip_get_port();
+        memset(&(sin.sin_zero), '\0', sizeof(sin.sin_zero));
+        status =
+            bind(sock_fd, (const struct sockaddr *) &sin,
+            sizeof(struct sockaddr));
+    }
+    if (status < 0) {
+        close(sock_fd);
+        return -1;
+    }
+
+    return sock_fd;
+}
+
+/* Hands each datagram to the socket of the lane of its source address,
+ * as bip_lane_of() tells: the IPv4 source address, in host order, modulo
+ * the lanes.  The sockets of a SO_REUSEPORT group are numbered in the
+ * order they are bound, the order of the lanes.  Without it the kernel
+ * would spread the datagrams by a hash the threads can't tell. */
+static bool bip_steer_lanes(
+    int sock_fd,
+    unsigned lanes)
+{
+#if defined(SO_ATTACH_REUSEPORT_CBPF)
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, 0),
+        BPF_STMT(BPF_RET | BPF_A, 0)
+    };
+    struct sock_fprog prog;
+
+    code[1].k = lanes;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+
+    return (setsockopt(sock_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+            sizeof(prog)) == 0);
+#else
+    (void) sock_fd;
+    (void) lanes;
+    return false;
+#endif
+}
+
+/* Closes the lanes from the last one down to lane first. */
+static void bip_close_lanes(
+    unsigned first)
+{
+    unsigned lane = bip_lane_count();
+
+    while (lane > first) {
+        lane--;
+        if (bip_lane_socket(lane) >= 0) {
+            close(bip_lane_socket(lane));
+        }
+        bip_set_lane_socket(lane, -1);
+    }
+}
+
 /** Initialize the BACnet/IP services at the given interface.
  * @ingroup DLBIP
  * -# Gets the local IP address and local broadcast address from the system,
@@ -148,6 +246,9 @@ void bip_set_interface(
  * -# Configures the socket so it can send broadcasts
  * -# Binds the socket to the local IP address at the specified port for
  *    BACnet/IP (by default, 0xBAC0 = 47808).
+ * -# With bip_set_lanes, opens the other lanes' sockets on the same port,
+ *    and steers the datagrams to the lanes by their source address.  If
+ *    that fails, the one socket is used.
  *
  * @note For Linux, ifname is eth0, ath0, arc0, and others.
  *
@@ -159,9 +260,8 @@ void bip_set_interface(
 bool bip_init(
     char *ifname)
 {
-    int status = 0;     /* return from socket lib calls */
-    struct sockaddr_in sin;
-    int sockopt = 0;
+    unsigned lanes = bip_get_lanes();
+    unsigned lane = 0;
     int sock_fd = -1;
 
     if (ifname)
@@ -169,41 +269,27 @@ bool bip_init(
     else
         bip_set_interface("eth0");
     /* assumes that the driver has already been initialized */
-    sock_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sock_fd = bip_open_socket(lanes > 1);
     bip_set_socket(sock_fd);
     if (sock_fd < 0)
         return false;
-    /* Allow us to use the same socket for sending and receiving */
-    /* This makes sure that the src port is correct when sending */
-    sockopt = 1;
-    status =
-        setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &sockopt,
-        sizeof(sockopt));
-    if (status < 0) {
-        close(sock_fd);
-        bip_set_socket(-1);
-        return status;
+    for (lane = 1; lane < lanes; lane++) {
+        sock_fd = bip_open_socket(true);
+        if (sock_fd < 0) {
+            break;
+        }
+        if (!bip_set_lane_socket(lane, sock_fd)) {
+            close(sock_fd);
+            break;
+        }
     }
-    /* allow us to send a broadcast */
-    status =
-        setsockopt(sock_fd, SOL_SOCKET, SO_BROADCAST, &sockopt,
-        sizeof(sockopt));
-    if (status < 0) {
-        close(sock_fd);
-        bip_set_socket(-1);
-        return false;
-    }
-    /* bind the socket to the local port number and IP address */
-    sin.sin_family = AF_INET;
-    sin.sin_addr.s_addr = htonl(INADDR_ANY);
-    sin.sin_port = bip_get_port();
-    memset(&(sin.sin_zero), '\0', sizeof(sin.sin_zero));
-    status =
-        bind(sock_fd, (const struct sockaddr *) &sin, sizeof(struct sockaddr));
-    if (status < 0) {
-        close(sock_fd);
-        bip_set_socket(-1);
-        return false;
+    if ((lanes > 1) && ((lane < lanes) ||
+            !bip_steer_lanes(bip_lane_socket(0), lanes))) {
+        if (BIP_Debug) {
+            fprintf(stderr, "BIP: %u lanes not available, using one "
+                "socket\n", lanes);
+        }
+        bip_close_lanes(1);
     }
 
     return true;
@@ -217,8 +303,9 @@ void bip_cleanup(
 {
     int sock_fd = 0;
 
+    bip_close_lanes(1);
     if (bip_valid()) {
-        sock_fd = bip_socket();
+        sock_fd = bip_lane_socket(0);
         close(sock_fd);
     }
     bip_set_socket(-1);
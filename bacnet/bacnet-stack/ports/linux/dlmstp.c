@@ -23,6 +23,8 @@
 * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 *
 *********************************************************************/
+/* for the CPU affinity of the MS/TP thread */
+#define _GNU_SOURCE
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
@@ -30,6 +32,8 @@
 #include <string.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sched.h>
 #include "bacdef.h"
 #include "bacaddr.h"
 #include "mstp.h"
@@ -66,10 +70,22 @@ static pthread_cond_t Received_Frame_Flag;
 static pthread_mutex_t Received_Frame_Mutex;
 static pthread_cond_t Master_Done_Flag;
 static pthread_mutex_t Master_Done_Mutex;
+/* mechanism to wait for a reply to be queued */
+static pthread_cond_t PDU_Queue_Flag;
+static pthread_mutex_t PDU_Queue_Mutex;
+static unsigned PDU_Queue_Puts;
+static unsigned PDU_Queue_Seen;
+
+/* how late the FSM task woke up after its timeout, in microseconds */
+static uint32_t Wakeup_Jitter_Max;
+static uint64_t Wakeup_Jitter_Sum;
+static uint32_t Wakeup_Jitter_Count;
 
 /*RT_TASK Receive_Task, Fsm_Task;*/
 /* local MS/TP port data - shared with RS-485 */
 static volatile struct mstp_port_struct_t MSTP_Port;
+/* kept for MSTP_Init, which clears it in the port */
+static bool Auto_Tune;
 /* buffers needed by mstp port struct */
 static uint8_t TxBuffer[MAX_MPDU];
 static uint8_t RxBuffer[MAX_MPDU];
@@ -86,16 +102,6 @@ struct mstp_pdu_packet {
 #endif
 static struct mstp_pdu_packet PDU_Buffer[MSTP_PDU_PACKET_COUNT];
 static RING_BUFFER PDU_Queue;
-/* The minimum time without a DataAvailable or ReceiveError event */
-/* that a node must wait for a station to begin replying to a */
-/* confirmed request: 255 milliseconds. (Implementations may use */
-/* larger values for this timeout, not to exceed 300 milliseconds.) */
-static uint16_t Treply_timeout = 300;
-/* The minimum time without a DataAvailable or ReceiveError event that a */
-/* node must wait for a remote node to begin using a token or replying to */
-/* a Poll For Master frame: 20 milliseconds. (Implementations may use */
-/* larger values for this timeout, not to exceed 100 milliseconds.) */
-static uint8_t Tusage_timeout = 100;
 /* Timer that indicates line silence - and functions */
 
 static struct timeval start;
@@ -139,9 +145,11 @@ void dlmstp_cleanup(
     pthread_cond_destroy(&Received_Frame_Flag);
     pthread_cond_destroy(&Receive_Packet_Flag);
     pthread_cond_destroy(&Master_Done_Flag);
+    pthread_cond_destroy(&PDU_Queue_Flag);
     pthread_mutex_destroy(&Received_Frame_Mutex);
     pthread_mutex_destroy(&Receive_Packet_Mutex);
     pthread_mutex_destroy(&Master_Done_Mutex);
+    pthread_mutex_destroy(&PDU_Queue_Mutex);
 }
 
 /* returns number of bytes sent on success, zero on failure */
@@ -170,12 +178,32 @@ int dlmstp_send_pdu(
         }
         if (Ringbuf_Data_Put(&PDU_Queue, (uint8_t *)pkt)) {
             bytes_sent = pdu_len;
+            /* wake the master task if it is holding a request */
+            pthread_mutex_lock(&PDU_Queue_Mutex);
+            PDU_Queue_Puts++;
+            pthread_cond_signal(&PDU_Queue_Flag);
+            pthread_mutex_unlock(&PDU_Queue_Mutex);
         }
     }
 
     return bytes_sent;
 }
 
+/* sleep until a PDU is queued or the timeout expires */
+static void dlmstp_wait_for_reply(
+    unsigned timeout)
+{
+    struct timespec abstime;
+
+    pthread_mutex_lock(&PDU_Queue_Mutex);
+    if (PDU_Queue_Seen == PDU_Queue_Puts) {
+        get_abstime(&abstime, timeout);
+        pthread_cond_timedwait(&PDU_Queue_Flag, &PDU_Queue_Mutex, &abstime);
+    }
+    PDU_Queue_Seen = PDU_Queue_Puts;
+    pthread_mutex_unlock(&PDU_Queue_Mutex);
+}
+
 uint16_t dlmstp_receive(
     BACNET_ADDRESS * src,       /* source address */
     uint8_t * pdu,      /* PDU data */
@@ -212,40 +240,75 @@ uint16_t dlmstp_receive(
     return pdu_len;
 }
 
+static uint64_t monotonic_us(
+    void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* the time between the timeout of the wait and the task running again */
+static void wakeup_jitter_record(
+    uint64_t started,
+    uint16_t wait)
+{
+    uint64_t late = monotonic_us() - started;
+
+    if (late < (uint64_t) wait * 1000) {
+        return;
+    }
+    late -= (uint64_t) wait * 1000;
+    if (late > Wakeup_Jitter_Max) {
+        Wakeup_Jitter_Max = (uint32_t) late;
+    }
+    Wakeup_Jitter_Sum += late;
+    Wakeup_Jitter_Count++;
+}
+
+void dlmstp_wakeup_jitter(
+    uint32_t * max_us,
+    uint32_t * mean_us)
+{
+    uint32_t count = Wakeup_Jitter_Count;
+
+    if (max_us) {
+        *max_us = Wakeup_Jitter_Max;
+    }
+    if (mean_us) {
+        *mean_us = count ? (uint32_t) (Wakeup_Jitter_Sum / count) : 0;
+    }
+}
+
 static void *dlmstp_master_fsm_task(
     void *pArg)
 {
-    uint32_t silence = 0;
+    uint16_t wait = 0;
     bool run_master = false;
+    uint64_t started = 0;
 
     (void) pArg;
     for (;;) {
+        /* sleep until an octet arrives or the next MS/TP timer is due */
+        wait = MSTP_Wait_Time(&MSTP_Port);
         if (MSTP_Port.ReceivedValidFrame == false &&
             MSTP_Port.ReceivedInvalidFrame == false) {
-            RS485_Check_UART_Data(&MSTP_Port);
+            started = monotonic_us();
+            RS485_Wait_UART_Data(&MSTP_Port, wait);
+            if (wait && (MSTP_Port.DataAvailable == false)) {
+                /* no octet, the wait timed out */
+                wakeup_jitter_record(started, wait);
+            }
             MSTP_Receive_Frame_FSM(&MSTP_Port);
+        } else if (wait) {
+            /* holding a request until the reply is queued */
+            dlmstp_wait_for_reply(wait);
         }
         if (MSTP_Port.ReceivedValidFrame || MSTP_Port.ReceivedInvalidFrame) {
             run_master = true;
         } else {
-            silence = MSTP_Port.SilenceTimer(NULL);
-            switch (MSTP_Port.master_state) {
-                case MSTP_MASTER_STATE_IDLE:
-                    if (silence >= Tno_token)
-                        run_master = true;
-                    break;
-                case MSTP_MASTER_STATE_WAIT_FOR_REPLY:
-                    if (silence >= Treply_timeout)
-                        run_master = true;
-                    break;
-                case MSTP_MASTER_STATE_POLL_FOR_MASTER:
-                    if (silence >= Tusage_timeout)
-                        run_master = true;
-                    break;
-                default:
-                    run_master = true;
-                    break;
-            }
+            run_master = (MSTP_Wait_Time(&MSTP_Port) == 0);
         }
         if (run_master) {
             if (MSTP_Port.This_Station <= 127) {
@@ -577,6 +640,7 @@ void dlmstp_set_max_info_frames(
 {
     if (max_info_frames >= 1) {
         MSTP_Port.Nmax_info_frames = max_info_frames;
+        MSTP_Port.Max_Info_Frames = max_info_frames;
         /* FIXME: implement your data storage */
         /* I2C_Write_Byte(
            EEPROM_DEVICE_ADDRESS,
@@ -590,7 +654,7 @@ void dlmstp_set_max_info_frames(
 uint8_t dlmstp_max_info_frames(
     void)
 {
-    return MSTP_Port.Nmax_info_frames;
+    return MSTP_Port.Max_Info_Frames;
 }
 
 /* This parameter represents the value of the Max_Master property of the */
@@ -604,6 +668,7 @@ void dlmstp_set_max_master(
     if (max_master <= 127) {
         if (MSTP_Port.This_Station <= max_master) {
             MSTP_Port.Nmax_master = max_master;
+            MSTP_Port.Max_Master = max_master;
             /* FIXME: implement your data storage */
             /* I2C_Write_Byte(
                EEPROM_DEVICE_ADDRESS,
@@ -618,7 +683,27 @@ void dlmstp_set_max_master(
 uint8_t dlmstp_max_master(
     void)
 {
-    return MSTP_Port.Nmax_master;
+    return MSTP_Port.Max_Master;
+}
+
+/* the node tunes its Max_Master and Max_Info_Frames to the masters */
+/* on the link and the frames it has to send, within the values above. */
+/* BACNET_MSTP_AUTO_TUNE=1 turns it on at dlmstp_init. */
+void dlmstp_set_auto_tune(
+    bool auto_tune)
+{
+    Auto_Tune = auto_tune;
+    MSTP_Port.Auto_Tune = auto_tune;
+    if (!auto_tune) {
+        MSTP_Port.Nmax_master = MSTP_Port.Max_Master;
+        MSTP_Port.Nmax_info_frames = MSTP_Port.Max_Info_Frames;
+    }
+}
+
+bool dlmstp_auto_tune(
+    void)
+{
+    return Auto_Tune;
 }
 
 /* RS485 Baud Rate 9600, 19200, 38400, 57600, 115200 */
@@ -668,11 +753,84 @@ void dlmstp_get_broadcast_address(
     return;
 }
 
+/* BACNET_MSTP_PRIORITY runs the FSM task under SCHED_FIFO at that
+   priority, with the memory of the process locked, so that TLS or JSON
+   work of the application doesn't break the token passing timing.
+   BACNET_MSTP_CPUS is the mask of the CPUs the task runs on, e.g. 0x4 */
+static void dlmstp_realtime_init(
+    pthread_attr_t * attr)
+{
+    char *pEnv = NULL;
+    struct sched_param param;
+
+    pEnv = getenv("BACNET_MSTP_PRIORITY");
+    if (pEnv) {
+        param.sched_priority = strtol(pEnv, NULL, 0);
+        pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+        pthread_attr_setschedparam(attr, &param);
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            fprintf(stderr, "MS/TP: cannot lock the memory.\n");
+        }
+    }
+    pEnv = getenv("BACNET_MSTP_CPUS");
+    if (pEnv) {
+        unsigned long mask = strtoul(pEnv, NULL, 0);
+        cpu_set_t cpus;
+        unsigned i = 0;
+
+        CPU_ZERO(&cpus);
+        for (i = 0; i < sizeof(mask) * 8; i++) {
+            if (mask & (1UL << i)) {
+                CPU_SET(i, &cpus);
+            }
+        }
+        pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+    }
+}
+
+/* BACNET_MSTP_RS485 has the kernel switch the transceiver with RTS: 1
+   for RTS high while sending, 2 for RTS low.  BACNET_MSTP_RTS_DELAY is
+   the milliseconds RTS is set before a frame and held after it, as
+   "before[,after]".  BACNET_MSTP_LOW_LATENCY=0 leaves the driver's
+   latency timer on. */
+static void dlmstp_line_init(
+    void)
+{
+    char *pEnv = NULL;
+    char *pNext = NULL;
+    unsigned long before = 0;
+    unsigned long after = 0;
+    long mode = RS485_LINE_ADAPTER;
+
+    pEnv = getenv("BACNET_MSTP_RS485");
+    if (pEnv) {
+        mode = strtol(pEnv, NULL, 0);
+    }
+    pEnv = getenv("BACNET_MSTP_RTS_DELAY");
+    if (pEnv) {
+        before = strtoul(pEnv, &pNext, 0);
+        if (*pNext == ',') {
+            after = strtoul(pNext + 1, NULL, 0);
+        }
+    }
+    if ((mode == RS485_LINE_RTS_HIGH) || (mode == RS485_LINE_RTS_LOW)) {
+        RS485_Set_Line_Mode((RS485_LINE_MODE) mode, (unsigned) before,
+            (unsigned) after);
+    }
+    pEnv = getenv("BACNET_MSTP_LOW_LATENCY");
+    if (pEnv) {
+        RS485_Set_Low_Latency(strtol(pEnv, NULL, 0) != 0);
+    }
+}
+
 bool dlmstp_init(
     char *ifname)
 {
-    unsigned long hThread = 0;
+    pthread_t hThread;
+    pthread_attr_t attr;
     int rv = 0;
+    char *pEnv = NULL;
 
     /* initialize PDU queue */
     Ringbuf_Init(&PDU_Queue, (uint8_t *) & PDU_Buffer,
@@ -693,6 +851,19 @@ bool dlmstp_init(
             "MS/TP Interface: %s\n cannot allocate PThread Mutex.\n", ifname);
         exit(1);
     }
+    rv = pthread_cond_init(&PDU_Queue_Flag, NULL);
+    if (rv != 0) {
+        fprintf(stderr,
+            "MS/TP Interface: %s\n cannot allocate PThread Condition.\n",
+            ifname);
+        exit(1);
+    }
+    rv = pthread_mutex_init(&PDU_Queue_Mutex, NULL);
+    if (rv != 0) {
+        fprintf(stderr,
+            "MS/TP Interface: %s\n cannot allocate PThread Mutex.\n", ifname);
+        exit(1);
+    }
     /* initialize hardware */
     if (ifname) {
         RS485_Set_Interface(ifname);
@@ -700,6 +871,7 @@ bool dlmstp_init(
         fprintf(stderr, "MS/TP Interface: %s\n", ifname);
 #endif
     }
+    dlmstp_line_init();
     RS485_Initialize();
     MSTP_Port.InputBuffer = &RxBuffer[0];
     MSTP_Port.InputBufferSize = sizeof(RxBuffer);
@@ -709,17 +881,33 @@ bool dlmstp_init(
     MSTP_Port.SilenceTimer = Timer_Silence;
     MSTP_Port.SilenceTimerReset = Timer_Silence_Reset;
     MSTP_Init(&MSTP_Port);
+    pEnv = getenv("BACNET_MSTP_AUTO_TUNE");
+    if (pEnv) {
+        Auto_Tune = (strtol(pEnv, NULL, 0) != 0);
+    }
+    MSTP_Port.Auto_Tune = Auto_Tune;
 #if PRINT_ENABLED
     fprintf(stderr, "MS/TP MAC: %02X\n", MSTP_Port.This_Station);
     fprintf(stderr, "MS/TP Max_Master: %02X\n", MSTP_Port.Nmax_master);
     fprintf(stderr, "MS/TP Max_Info_Frames: %u\n", MSTP_Port.Nmax_info_frames);
+    if (Auto_Tune) {
+        fprintf(stderr, "MS/TP Max_Master and Max_Info_Frames auto tuned\n");
+    }
 #endif
     /* start the threads */
     /*    rv = pthread_create(&hThread, NULL, dlmstp_receive_fsm_task, NULL); */
     /*    if (rv != 0) {
        fprintf(stderr, "Failed to start recive FSM task\n");
        } */
-    rv = pthread_create(&hThread, NULL, dlmstp_master_fsm_task, NULL);
+    pthread_attr_init(&attr);
+    dlmstp_realtime_init(&attr);
+    rv = pthread_create(&hThread, &attr, dlmstp_master_fsm_task, NULL);
+    if (rv == EPERM) {
+        fprintf(stderr, "MS/TP: no permission for SCHED_FIFO.\n");
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        rv = pthread_create(&hThread, &attr, dlmstp_master_fsm_task, NULL);
+    }
+    pthread_attr_destroy(&attr);
     if (rv != 0) {
         fprintf(stderr, "Failed to start Master Node FSM task\n");
     }
@@ -96,8 +96,8 @@ void get_abstime(
     struct timeval now, offset, result;
 
     gettimeofday(&now, NULL);
-    offset.tv_sec = 0;
-    offset.tv_usec = milliseconds * 1000;
+    offset.tv_sec = milliseconds / 1000;
+    offset.tv_usec = (milliseconds % 1000) * 1000;
     timeradd(&now, &offset, &result);
     abstime->tv_sec = result.tv_sec;
     abstime->tv_nsec = result.tv_usec * 1000;
@@ -118,6 +118,8 @@ void dlmstp_cleanup(
     }
 
     /* restore the old port settings */
+    RS485_Restore_Line(poSharedData->RS485_Handle,
+        &poSharedData->RS485_oldrs485);
     tcsetattr(poSharedData->RS485_Handle, TCSANOW,
         &poSharedData->RS485_oldtio);
     close(poSharedData->RS485_Handle);
@@ -125,9 +127,11 @@ void dlmstp_cleanup(
     pthread_cond_destroy(&poSharedData->Received_Frame_Flag);
     pthread_cond_destroy(&poSharedData->Receive_Packet_Flag);
     pthread_cond_destroy(&poSharedData->Master_Done_Flag);
+    pthread_cond_destroy(&poSharedData->PDU_Queue_Flag);
     pthread_mutex_destroy(&poSharedData->Received_Frame_Mutex);
     pthread_mutex_destroy(&poSharedData->Receive_Packet_Mutex);
     pthread_mutex_destroy(&poSharedData->Master_Done_Mutex);
+    pthread_mutex_destroy(&poSharedData->PDU_Queue_Mutex);
 }
 
 /* returns number of bytes sent on success, zero on failure */
@@ -162,12 +166,65 @@ int dlmstp_send_pdu(
         pkt->destination_mac = dest->mac[0];
         if (Ringbuf_Data_Put(&poSharedData->PDU_Queue, (uint8_t *)pkt)) {
             bytes_sent = pdu_len;
+            /* wake the master task if it is holding a request */
+            pthread_mutex_lock(&poSharedData->PDU_Queue_Mutex);
+            poSharedData->PDU_Queue_Puts++;
+            pthread_cond_signal(&poSharedData->PDU_Queue_Flag);
+            pthread_mutex_unlock(&poSharedData->PDU_Queue_Mutex);
         }
     }
 
     return bytes_sent;
 }
 
+/* sleep until a PDU is queued or the timeout expires */
+static void dlmstp_wait_for_reply(
+    SHARED_MSTP_DATA * poSharedData,
+    unsigned timeout)
+{
+    struct timespec abstime;
+
+    pthread_mutex_lock(&poSharedData->PDU_Queue_Mutex);
+    if (poSharedData->PDU_Queue_Seen == poSharedData->PDU_Queue_Puts) {
+        get_abstime(&abstime, timeout);
+        pthread_cond_timedwait(&poSharedData->PDU_Queue_Flag,
+            &poSharedData->PDU_Queue_Mutex, &abstime);
+    }
+    poSharedData->PDU_Queue_Seen = poSharedData->PDU_Queue_Puts;
+    pthread_mutex_unlock(&poSharedData->PDU_Queue_Mutex);
+}
+
+/* moves the received packet out to the caller;
+   called with the Receive_Packet_Mutex held */
+static uint16_t dlmstp_take_packet(
+    SHARED_MSTP_DATA * poSharedData,
+    BACNET_ADDRESS * src,       /* source address */
+    uint8_t * pdu,      /* PDU data */
+    uint16_t max_pdu)
+{       /* amount of space available in the PDU  */
+    uint16_t pdu_len = 0;
+
+    if (poSharedData->Receive_Packet.ready) {
+        if (poSharedData->Receive_Packet.pdu_len) {
+            poSharedData->MSTP_Packets++;
+            if (src) {
+                memmove(src, &poSharedData->Receive_Packet.address,
+                    sizeof(poSharedData->Receive_Packet.address));
+            }
+            pdu_len = poSharedData->Receive_Packet.pdu_len;
+            if (pdu) {
+                if (pdu_len > max_pdu) {
+                    pdu_len = max_pdu;
+                }
+                memmove(pdu, &poSharedData->Receive_Packet.pdu, pdu_len);
+            }
+        }
+        poSharedData->Receive_Packet.ready = false;
+    }
+
+    return pdu_len;
+}
+
 uint16_t dlmstp_receive(
     void *poPort,
     BACNET_ADDRESS * src,       /* source address */
@@ -177,7 +234,6 @@ uint16_t dlmstp_receive(
 {       /* milliseconds to wait for a packet */
     uint16_t pdu_len = 0;
     struct timespec abstime;
-    int rv = 0;
     SHARED_MSTP_DATA *poSharedData;
     struct mstp_port_struct_t *mstp_port =
         (struct mstp_port_struct_t *) poPort;
@@ -188,31 +244,146 @@ uint16_t dlmstp_receive(
     if (!poSharedData) {
         return 0;
     }
-    (void) max_pdu;
     /* see if there is a packet available, and a place
        to put the reply (if necessary) and process it */
+    pthread_mutex_lock(&poSharedData->Receive_Packet_Mutex);
+    if (!poSharedData->Receive_Packet.ready) {
+        get_abstime(&abstime, timeout);
+        pthread_cond_timedwait(&poSharedData->Receive_Packet_Flag,
+            &poSharedData->Receive_Packet_Mutex, &abstime);
+    }
+    pdu_len = dlmstp_take_packet(poSharedData, src, pdu, max_pdu);
+    pthread_mutex_unlock(&poSharedData->Receive_Packet_Mutex);
+
+    return pdu_len;
+}
+
+bool dlmstp_group_init(
+    DLMSTP_PORT_GROUP * group)
+{
+    if (!group) {
+        return false;
+    }
+    memset(group, 0, sizeof(DLMSTP_PORT_GROUP));
+    if (pthread_mutex_init(&group->Mutex, NULL) != 0) {
+        return false;
+    }
+    if (pthread_cond_init(&group->Flag, NULL) != 0) {
+        pthread_mutex_destroy(&group->Mutex);
+        return false;
+    }
+
+    return true;
+}
+
+void dlmstp_group_cleanup(
+    DLMSTP_PORT_GROUP * group)
+{
+    unsigned i;
+    SHARED_MSTP_DATA *poSharedData;
+
+    if (!group) {
+        return;
+    }
+    for (i = 0; i < group->Count; i++) {
+        poSharedData = (SHARED_MSTP_DATA *) group->Ports[i]->UserData;
+        if (poSharedData) {
+            poSharedData->Group = NULL;
+        }
+    }
+    group->Count = 0;
+    pthread_cond_destroy(&group->Flag);
+    pthread_mutex_destroy(&group->Mutex);
+}
+
+bool dlmstp_group_add(
+    DLMSTP_PORT_GROUP * group,
+    void *poPort)
+{
+    SHARED_MSTP_DATA *poSharedData;
+    struct mstp_port_struct_t *mstp_port =
+        (struct mstp_port_struct_t *) poPort;
+
+    if (!group || !mstp_port || (group->Count >= DLMSTP_MAX_PORTS)) {
+        return false;
+    }
+    poSharedData = (SHARED_MSTP_DATA *) mstp_port->UserData;
+    if (!poSharedData) {
+        return false;
+    }
+    poSharedData->Group = group;
+    group->Ports[group->Count] = mstp_port;
+    group->Count++;
+
+    return true;
+}
+
+uint16_t dlmstp_group_receive(
+    DLMSTP_PORT_GROUP * group,
+    unsigned *index,
+    BACNET_ADDRESS * src,       /* source address */
+    uint8_t * pdu,      /* PDU data */
+    uint16_t max_pdu,   /* amount of space available in the PDU  */
+    unsigned timeout)
+{       /* milliseconds to wait for a packet */
+    uint16_t pdu_len = 0;
+    struct timespec abstime;
+    SHARED_MSTP_DATA *poSharedData;
+    unsigned events;
+    unsigned port;
+    unsigned i;
+    int rv = 0;
+
+    if (!group || (group->Count == 0)) {
+        return 0;
+    }
     get_abstime(&abstime, timeout);
-    rv = pthread_cond_timedwait(&poSharedData->Receive_Packet_Flag,
-        &poSharedData->Receive_Packet_Mutex, &abstime);
-    if (rv == 0) {
-        if (poSharedData->Receive_Packet.ready) {
-            if (poSharedData->Receive_Packet.pdu_len) {
-                poSharedData->MSTP_Packets++;
-                if (src) {
-                    memmove(src, &poSharedData->Receive_Packet.address,
-                        sizeof(poSharedData->Receive_Packet.address));
-                }
-                if (pdu) {
-                    memmove(pdu, &poSharedData->Receive_Packet.pdu,
-                        sizeof(poSharedData->Receive_Packet.pdu));
+    for (;;) {
+        pthread_mutex_lock(&group->Mutex);
+        events = group->Events;
+        pthread_mutex_unlock(&group->Mutex);
+        for (i = 0; i < group->Count; i++) {
+            port = (group->Next + i) % group->Count;
+            poSharedData = (SHARED_MSTP_DATA *) group->Ports[port]->UserData;
+            pthread_mutex_lock(&poSharedData->Receive_Packet_Mutex);
+            if (poSharedData->Receive_Packet.ready) {
+                pdu_len = dlmstp_take_packet(poSharedData, src, pdu, max_pdu);
+                pthread_mutex_unlock(&poSharedData->Receive_Packet_Mutex);
+                group->Next = (port + 1) % group->Count;
+                if (index) {
+                    *index = port;
                 }
-                pdu_len = poSharedData->Receive_Packet.pdu_len;
+                return pdu_len;
             }
-            poSharedData->Receive_Packet.ready = false;
+            pthread_mutex_unlock(&poSharedData->Receive_Packet_Mutex);
+        }
+        if (rv != 0) {
+            /* timed out, and nothing came in since */
+            break;
+        }
+        pthread_mutex_lock(&group->Mutex);
+        if (events == group->Events) {
+            rv = pthread_cond_timedwait(&group->Flag, &group->Mutex,
+                &abstime);
         }
+        pthread_mutex_unlock(&group->Mutex);
     }
 
-    return pdu_len;
+    return 0;
+}
+
+int dlmstp_group_send_pdu(
+    DLMSTP_PORT_GROUP * group,
+    unsigned index,
+    BACNET_ADDRESS * dest,      /* destination address */
+    uint8_t * pdu,      /* any data to be sent - may be null */
+    unsigned pdu_len)
+{       /* number of bytes of data */
+    if (!group || (index >= group->Count)) {
+        return 0;
+    }
+
+    return dlmstp_send_pdu(group->Ports[index], dest, pdu, pdu_len);
 }
 
 void *dlmstp_receive_fsm_task(
@@ -236,7 +407,7 @@ void *dlmstp_receive_fsm_task(
         if ((mstp_port->ReceivedValidFrame == false) &&
             (mstp_port->ReceivedInvalidFrame == false)) {
             do {
-                RS485_Check_UART_Data(mstp_port);
+                RS485_Wait_UART_Data(mstp_port, MSTP_Wait_Time(mstp_port));
                 MSTP_Receive_Frame_FSM((volatile struct mstp_port_struct_t *)
                     pArg);
                 received_frame = mstp_port->ReceivedValidFrame ||
@@ -255,7 +426,7 @@ void *dlmstp_receive_fsm_task(
 void *dlmstp_master_fsm_task(
     void *pArg)
 {
-    uint32_t silence = 0;
+    uint16_t wait = 0;
     bool run_master = false;
     SHARED_MSTP_DATA *poSharedData;
     struct mstp_port_struct_t *mstp_port = (struct mstp_port_struct_t *) pArg;
@@ -270,32 +441,20 @@ void *dlmstp_master_fsm_task(
     }
 
     for (;;) {
+        /* sleep until an octet arrives or the next MS/TP timer is due */
+        wait = MSTP_Wait_Time(mstp_port);
         if (mstp_port->ReceivedValidFrame == false &&
             mstp_port->ReceivedInvalidFrame == false) {
-            RS485_Check_UART_Data(mstp_port);
+            RS485_Wait_UART_Data(mstp_port, wait);
             MSTP_Receive_Frame_FSM(mstp_port);
+        } else if (wait) {
+            /* holding a request until the reply is queued */
+            dlmstp_wait_for_reply(poSharedData, wait);
         }
         if (mstp_port->ReceivedValidFrame || mstp_port->ReceivedInvalidFrame) {
             run_master = true;
         } else {
-            silence = mstp_port->SilenceTimer(NULL);
-            switch (mstp_port->master_state) {
-                case MSTP_MASTER_STATE_IDLE:
-                    if (silence >= Tno_token)
-                        run_master = true;
-                    break;
-                case MSTP_MASTER_STATE_WAIT_FOR_REPLY:
-                    if (silence >= poSharedData->Treply_timeout)
-                        run_master = true;
-                    break;
-                case MSTP_MASTER_STATE_POLL_FOR_MASTER:
-                    if (silence >= poSharedData->Tusage_timeout)
-                        run_master = true;
-                    break;
-                default:
-                    run_master = true;
-                    break;
-            }
+            run_master = (MSTP_Wait_Time(mstp_port) == 0);
         }
         if (run_master) {
             if (mstp_port->This_Station <= DEFAULT_MAX_MASTER) {
@@ -347,6 +506,7 @@ uint16_t MSTP_Put_Receive(
         return 0;
     }
 
+    pthread_mutex_lock(&poSharedData->Receive_Packet_Mutex);
     if (!poSharedData->Receive_Packet.ready) {
         /* bounds check - maybe this should send an abort? */
         pdu_len = mstp_port->DataLength;
@@ -356,10 +516,17 @@ uint16_t MSTP_Put_Receive(
             (void *) &mstp_port->InputBuffer[0], pdu_len);
         dlmstp_fill_bacnet_address(&poSharedData->Receive_Packet.address,
             mstp_port->SourceAddress);
-        poSharedData->Receive_Packet.pdu_len = mstp_port->DataLength;
+        poSharedData->Receive_Packet.pdu_len = pdu_len;
         poSharedData->Receive_Packet.ready = true;
         pthread_cond_signal(&poSharedData->Receive_Packet_Flag);
+        if (poSharedData->Group) {
+            pthread_mutex_lock(&poSharedData->Group->Mutex);
+            poSharedData->Group->Events++;
+            pthread_cond_broadcast(&poSharedData->Group->Flag);
+            pthread_mutex_unlock(&poSharedData->Group->Mutex);
+        }
     }
+    pthread_mutex_unlock(&poSharedData->Receive_Packet_Mutex);
 
     return pdu_len;
 }
@@ -909,6 +1076,21 @@ bool dlmstp_init(
             "MS/TP Interface: %s\n cannot allocate PThread Mutex.\n", ifname);
         exit(1);
     }
+    poSharedData->PDU_Queue_Puts = 0;
+    poSharedData->PDU_Queue_Seen = 0;
+    rv = pthread_cond_init(&poSharedData->PDU_Queue_Flag, NULL);
+    if (rv != 0) {
+        fprintf(stderr,
+            "MS/TP Interface: %s\n cannot allocate PThread Condition.\n",
+            ifname);
+        exit(1);
+    }
+    rv = pthread_mutex_init(&poSharedData->PDU_Queue_Mutex, NULL);
+    if (rv != 0) {
+        fprintf(stderr,
+            "MS/TP Interface: %s\n cannot allocate PThread Mutex.\n", ifname);
+        exit(1);
+    }
 
     struct termios newtio;
     printf("RS485: Initializing %s", poSharedData->RS485_Port_Name);
@@ -949,8 +1131,15 @@ bool dlmstp_init(
     newtio.c_oflag = 0;
     /* no processing */
     newtio.c_lflag = 0;
+    /* read() returns what is there; poll() does the waiting because
+       VTIME counts in 100ms and the MS/TP timers need milliseconds */
+    newtio.c_cc[VMIN] = 0;
+    newtio.c_cc[VTIME] = 0;
     /* activate the settings for the port after flushing I/O */
     tcsetattr(poSharedData->RS485_Handle, TCSAFLUSH, &newtio);
+    /* the kernel switches the transceiver, the bytes are passed on at once */
+    RS485_Configure_Line(poSharedData->RS485_Handle,
+        &poSharedData->RS485_oldrs485);
     /* flush any data waiting */
     usleep(200000);
     tcflush(poSharedData->RS485_Handle, TCIOFLUSH);
@@ -34,6 +34,7 @@
 #include "bacdef.h"
 #include "npdu.h"
 #include <termios.h>
+#include <linux/serial.h>
 #include "fifo.h"
 #include "ringbuf.h"
 /* defines specific to MS/TP */
@@ -62,6 +63,24 @@ struct mstp_pdu_packet {
     uint8_t buffer[MAX_MPDU];
 };
 
+/* number of MS/TP ports one upper layer can service through a group */
+#ifndef DLMSTP_MAX_PORTS
+#define DLMSTP_MAX_PORTS 8
+#endif
+
+/* several ports serviced by one upper layer: each port keeps its own
+   master FSM thread, and the group lets one thread wait on all of them */
+typedef struct dlmstp_port_group {
+    pthread_mutex_t Mutex;
+    pthread_cond_t Flag;
+    /* bumped each time any port in the group receives a packet */
+    unsigned Events;
+    /* next port to look at, so a busy trunk can't starve the others */
+    unsigned Next;
+    unsigned Count;
+    struct mstp_port_struct_t *Ports[DLMSTP_MAX_PORTS];
+} DLMSTP_PORT_GROUP;
+
 typedef struct shared_mstp_data {
     /* Number of MS/TP Packets Rx/Tx */
     uint16_t MSTP_Packets;
@@ -84,6 +103,11 @@ typedef struct shared_mstp_data {
     pthread_mutex_t Received_Frame_Mutex;
     pthread_cond_t Master_Done_Flag;
     pthread_mutex_t Master_Done_Mutex;
+    /* mechanism to wait for a reply to be queued */
+    pthread_cond_t PDU_Queue_Flag;
+    pthread_mutex_t PDU_Queue_Mutex;
+    unsigned PDU_Queue_Puts;
+    unsigned PDU_Queue_Seen;
     /* buffers needed by mstp port struct */
     uint8_t TxBuffer[MAX_MPDU];
     uint8_t RxBuffer[MAX_MPDU];
@@ -110,6 +134,8 @@ typedef struct shared_mstp_data {
     char *RS485_Port_Name;
     /* serial I/O settings */
     struct termios RS485_oldtio;
+    /* the RS-485 settings, see RS485_Configure_Line */
+    struct serial_rs485 RS485_oldrs485;
     /* some terminal I/O have RS-485 specific functionality */
     tcflag_t RS485MOD;
     /* Ring buffer for incoming bytes, in order to speed up the receiving. */
@@ -122,6 +148,8 @@ typedef struct shared_mstp_data {
 
     struct mstp_pdu_packet PDU_Buffer[MSTP_PDU_PACKET_COUNT];
 
+    /* group to notify when a packet is received, if any */
+    DLMSTP_PORT_GROUP *Group;
 } SHARED_MSTP_DATA;
 
 #ifdef __cplusplus
@@ -202,6 +230,31 @@ extern "C" {
     bool dlmstp_sole_master(
         void);
 
+    bool dlmstp_group_init(
+        DLMSTP_PORT_GROUP * group);
+    void dlmstp_group_cleanup(
+        DLMSTP_PORT_GROUP * group);
+    /* returns false if the group is full */
+    bool dlmstp_group_add(
+        DLMSTP_PORT_GROUP * group,
+        void *poPort);
+    /* waits for a packet from any port in the group; returns the number
+       of octets in the PDU, or zero on timeout, and the port index */
+    uint16_t dlmstp_group_receive(
+        DLMSTP_PORT_GROUP * group,
+        unsigned *index,
+        BACNET_ADDRESS * src,   /* source address */
+        uint8_t * pdu,  /* PDU data */
+        uint16_t max_pdu,       /* amount of space available in the PDU  */
+        unsigned timeout);      /* milliseconds to wait for a packet */
+    /* returns number of bytes sent on success, zero on failure */
+    int dlmstp_group_send_pdu(
+        DLMSTP_PORT_GROUP * group,
+        unsigned index,
+        BACNET_ADDRESS * dest,  /* destination address */
+        uint8_t * pdu,  /* any data to be sent - may be null */
+        unsigned pdu_len);      /* number of bytes of data */
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -52,7 +52,43 @@ uint8_t Ethernet_Empty_MAC[MAX_MAC_LEN] = { 0, 0, 0, 0, 0, 0 };
 uint8_t Ethernet_MAC_Address[MAX_MAC_LEN] = { 0 };
 
 static int eth802_sockfd = -1;  /* 802.2 file handle */
+
+/* With ETHERNET_RX_RING_BLOCKS (see ethernet.h), the frames are received
+   on a PF_PACKET socket into a TPACKET_V3 ring shared with the kernel,
+   which hands it a block of frames at a time.  ethernet_receive takes
+   them from the ring without a system call, and a filter on the socket
+   keeps the frames that are not BACnet out of the ring. */
+#if defined(ETHERNET_RX_RING_BLOCKS) && (ETHERNET_RX_RING_BLOCKS > 0)
+#define ETHERNET_RX_RING 1
+#include <poll.h>
+#include <sys/mman.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+
+/* a block goes to us once it is full, or once its first frame has
+   waited this many milliseconds */
+#define ETHERNET_RX_RING_TIMEOUT 2
+/* the room of a frame in a block */
+#define ETHERNET_RX_FRAME_SIZE 2048
+
+static struct sockaddr_ll eth_addr;     /* used for binding 802.2 */
+static uint8_t *Rx_Ring = NULL;
+/* the block being read, and the frames of it not read yet */
+static unsigned Rx_Block_Index = 0;
+static struct tpacket_block_desc *Rx_Block = NULL;
+static struct tpacket3_hdr *Rx_Frame = NULL;
+static unsigned Rx_Frames_Left = 0;
+
+/* the DSAP and SSAP of BACnet, 0x82 0x82, after the MAC header */
+static struct sock_filter BACnet_Filter[] = {
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 14),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x8282, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, 0xFFFF),
+    BPF_STMT(BPF_RET | BPF_K, 0)
+};
+#else
 static struct sockaddr eth_addr = { 0 };        /* used for binding 802.2 */
+#endif
 
 bool ethernet_valid(
     void)
@@ -60,9 +96,26 @@ bool ethernet_valid(
     return (eth802_sockfd >= 0);
 }
 
+/* the 802.2 socket, to wait on with others */
+int ethernet_socket(
+    void)
+{
+    return eth802_sockfd;
+}
+
 void ethernet_cleanup(
     void)
 {
+#if defined(ETHERNET_RX_RING)
+    if (Rx_Ring) {
+        munmap(Rx_Ring,
+            (size_t) ETHERNET_RX_RING_BLOCKS * ETHERNET_RX_RING_BLOCK_SIZE);
+        Rx_Ring = NULL;
+    }
+    Rx_Block = NULL;
+    Rx_Block_Index = 0;
+    Rx_Frames_Left = 0;
+#endif
     if (ethernet_valid())
         close(eth802_sockfd);
     eth802_sockfd = -1;
@@ -91,6 +144,83 @@ int setNonblocking(
 }
 #endif
 
+#if defined(ETHERNET_RX_RING)
+/* opens a PF_PACKET socket for 802.2 BACnet frames, with a receive ring */
+static int ethernet_bind(
+    struct sockaddr_ll *eth_addr,
+    char *interface_name)
+{
+    struct sock_fprog filter;
+    struct tpacket_req3 req;
+    int version = TPACKET_V3;
+    int sock_fd = -1;   /* return value */
+
+    fprintf(stderr, "ethernet: opening \"%s\"\n", interface_name);
+    if (getuid() != 0) {
+        fprintf(stderr,
+            "ethernet: Unable to open an 802.2 socket.  "
+            "Try running with root priveleges.\n");
+        return sock_fd;
+    }
+    if ((sock_fd = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_802_2))) < 0) {
+        fprintf(stderr, "ethernet: Error opening socket: %s\n",
+            strerror(errno));
+        exit(-1);
+    }
+    filter.len = sizeof(BACnet_Filter) / sizeof(BACnet_Filter[0]);
+    filter.filter = BACnet_Filter;
+    if (setsockopt(sock_fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter,
+            sizeof(filter)) < 0) {
+        fprintf(stderr, "ethernet: Unable to filter BACnet frames: %s\n",
+            strerror(errno));
+    }
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = ETHERNET_RX_RING_BLOCK_SIZE;
+    req.tp_block_nr = ETHERNET_RX_RING_BLOCKS;
+    req.tp_frame_size = ETHERNET_RX_FRAME_SIZE;
+    req.tp_frame_nr =
+        (ETHERNET_RX_RING_BLOCK_SIZE / ETHERNET_RX_FRAME_SIZE) *
+        ETHERNET_RX_RING_BLOCKS;
+    req.tp_retire_blk_tov = ETHERNET_RX_RING_TIMEOUT;
+    if ((setsockopt(sock_fd, SOL_PACKET, PACKET_VERSION, &version,
+                sizeof(version)) == 0) &&
+        (setsockopt(sock_fd, SOL_PACKET, PACKET_RX_RING, &req,
+                sizeof(req)) == 0)) {
+        Rx_Ring =
+            mmap(NULL,
+            (size_t) ETHERNET_RX_RING_BLOCKS * ETHERNET_RX_RING_BLOCK_SIZE,
+            PROT_READ | PROT_WRITE, MAP_SHARED, sock_fd, 0);
+        if (Rx_Ring == MAP_FAILED) {
+            Rx_Ring = NULL;
+            /* give the frames back to the socket */
+            memset(&req, 0, sizeof(req));
+            setsockopt(sock_fd, SOL_PACKET, PACKET_RX_RING, &req,
+                sizeof(req));
+        }
+    }
+    if (!Rx_Ring) {
+        fprintf(stderr, "ethernet: Unable to map a receive ring: %s; "
+            "reading one frame at a time\n", strerror(errno));
+    }
+    memset(eth_addr, 0, sizeof(*eth_addr));
+    eth_addr->sll_family = AF_PACKET;
+    eth_addr->sll_protocol = htons(ETH_P_802_2);
+    eth_addr->sll_ifindex = (int) if_nametoindex(interface_name);
+    fprintf(stderr, "ethernet: binding \"%s\"\n", interface_name);
+    if ((eth_addr->sll_ifindex == 0) ||
+        (bind(sock_fd, (struct sockaddr *) eth_addr,
+                sizeof(*eth_addr)) != 0)) {
+        fprintf(stderr, "ethernet: Unable to bind 802.2 socket : %s\n",
+            strerror(errno));
+        close(sock_fd);
+        exit(-1);
+    }
+
+    atexit(ethernet_cleanup);
+
+    return sock_fd;
+}
+#else
 /* opens an 802.2 socket to receive and send packets */
 static int ethernet_bind(
     struct sockaddr *eth_addr,
@@ -167,6 +297,7 @@ static int ethernet_bind(
 
     return sock_fd;
 }
+#endif
 
 /* function to find the local ethernet MAC address */
 static int get_local_hwaddr(
@@ -205,6 +336,15 @@ bool ethernet_init(
     return ethernet_valid();
 }
 
+/* sends a whole frame out of the 802.2 socket */
+static int ethernet_sendto(
+    uint8_t * mtu,
+    int mtu_len)
+{
+    return sendto(eth802_sockfd, mtu, mtu_len, 0,
+        (struct sockaddr *) &eth_addr, sizeof(eth_addr));
+}
+
 int ethernet_send(
     uint8_t * mtu,
     int mtu_len)
@@ -212,9 +352,7 @@ int ethernet_send(
     int bytes = 0;
 
     /* Send the packet */
-    bytes =
-        sendto(eth802_sockfd, &mtu, mtu_len, 0, (struct sockaddr *) &eth_addr,
-        sizeof(struct sockaddr));
+    bytes = ethernet_sendto(mtu, mtu_len);
     /* did it get sent? */
     if (bytes < 0)
         fprintf(stderr, "ethernet: Error sending packet: %s\n",
@@ -284,9 +422,7 @@ int ethernet_send_pdu(
     encode_unsigned16(&mtu[12], 3 + pdu_len);
 
     /* Send the packet */
-    bytes =
-        sendto(eth802_sockfd, &mtu, mtu_len, 0, (struct sockaddr *) &eth_addr,
-        sizeof(struct sockaddr));
+    bytes = ethernet_sendto(mtu, mtu_len);
     /* did it get sent? */
     if (bytes < 0)
         fprintf(stderr, "ethernet: Error sending packet: %s\n",
@@ -295,6 +431,99 @@ int ethernet_send_pdu(
     return bytes;
 }
 
+/* takes the PDU out of a received 802.2 frame */
+/* returns the number of octets in the PDU, or zero if it isn't for us */
+static uint16_t ethernet_frame_pdu(
+    BACNET_ADDRESS * src,
+    uint8_t * pdu,
+    uint16_t max_pdu,
+    uint8_t * buf,
+    unsigned buf_len)
+{
+    uint16_t pdu_len = 0;       /* return value */
+
+    if (buf_len < 17)
+        return 0;
+
+    /* the signature of an 802.2 BACnet packet */
+    if ((buf[14] != 0x82) && (buf[15] != 0x82)) {
+        /*fprintf(stderr,"ethernet: Non-BACnet packet\n"); */
+        return 0;
+    }
+    /* copy the source address */
+    src->mac_len = 6;
+    memmove(src->mac, &buf[6], 6);
+
+    /* check destination address for when */
+    /* the Ethernet card is in promiscious mode */
+    if ((memcmp(&buf[0], Ethernet_MAC_Address, 6) != 0)
+        && (memcmp(&buf[0], Ethernet_Broadcast, 6) != 0)) {
+        /*fprintf(stderr, "ethernet: This packet isn't for us\n"); */
+        return 0;
+    }
+
+    (void) decode_unsigned16(&buf[12], &pdu_len);
+    pdu_len -= 3 /* DSAP, SSAP, LLC Control */ ;
+    /* copy the buffer into the PDU */
+    if ((pdu_len < max_pdu) && ((17 + (unsigned) pdu_len) <= buf_len))
+        memmove(&pdu[0], &buf[17], pdu_len);
+    /* ignore packets that are too large */
+    else
+        pdu_len = 0;
+
+    return pdu_len;
+}
+
+#if defined(ETHERNET_RX_RING)
+/* The next frame of the ring, waiting up to timeout milliseconds for the
+   kernel to hand over a block.  A block goes back to the kernel when the
+   frame after its last one is asked for. */
+static struct tpacket3_hdr *ethernet_ring_frame(
+    unsigned timeout)
+{
+    struct tpacket_block_desc *block = NULL;
+    struct pollfd pfd;
+
+    if (Rx_Frames_Left > 0) {
+        Rx_Frame =
+            (struct tpacket3_hdr *) ((uint8_t *) Rx_Frame +
+            Rx_Frame->tp_next_offset);
+        Rx_Frames_Left--;
+        return Rx_Frame;
+    }
+    if (Rx_Block) {
+        __sync_synchronize();
+        Rx_Block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        Rx_Block = NULL;
+        Rx_Block_Index = (Rx_Block_Index + 1) % ETHERNET_RX_RING_BLOCKS;
+    }
+    block =
+        (struct tpacket_block_desc *) (Rx_Ring +
+        (size_t) Rx_Block_Index * ETHERNET_RX_RING_BLOCK_SIZE);
+    if (!(block->hdr.bh1.block_status & TP_STATUS_USER)) {
+        if (timeout == 0)
+            return NULL;
+        pfd.fd = eth802_sockfd;
+        pfd.events = POLLIN | POLLERR;
+        pfd.revents = 0;
+        poll(&pfd, 1, (int) timeout);
+        if (!(block->hdr.bh1.block_status & TP_STATUS_USER))
+            return NULL;
+    }
+    __sync_synchronize();
+    Rx_Block = block;
+    Rx_Frames_Left = block->hdr.bh1.num_pkts;
+    if (Rx_Frames_Left == 0)
+        return NULL;
+    Rx_Frame =
+        (struct tpacket3_hdr *) ((uint8_t *) block +
+        block->hdr.bh1.offset_to_first_pkt);
+    Rx_Frames_Left--;
+
+    return Rx_Frame;
+}
+#endif
+
 /* receives an 802.2 framed packet */
 /* returns the number of octets in the PDU, or zero on failure */
 uint16_t ethernet_receive(
@@ -305,14 +534,25 @@ uint16_t ethernet_receive(
 {       /* number of milliseconds to wait for a packet */
     int received_bytes;
     uint8_t buf[MAX_MPDU] = { 0 };      /* data */
-    uint16_t pdu_len = 0;       /* return value */
     fd_set read_fds;
     int max;
     struct timeval select_timeout;
+#if defined(ETHERNET_RX_RING)
+    struct tpacket3_hdr *frame = NULL;
+#endif
 
     /* Make sure the socket is open */
     if (eth802_sockfd <= 0)
         return 0;
+#if defined(ETHERNET_RX_RING)
+    if (Rx_Ring) {
+        frame = ethernet_ring_frame(timeout);
+        if (!frame)
+            return 0;
+        return ethernet_frame_pdu(src, pdu, max_pdu,
+            (uint8_t *) frame + frame->tp_mac, frame->tp_snaplen);
+    }
+#endif
 
     /* we could just use a non-blocking socket, but that consumes all
        the CPU time.  We can use a timeout; it is only supported as
@@ -348,34 +588,8 @@ uint16_t ethernet_receive(
     if (received_bytes == 0)
         return 0;
 
-    /* the signature of an 802.2 BACnet packet */
-    if ((buf[14] != 0x82) && (buf[15] != 0x82)) {
-        /*fprintf(stderr,"ethernet: Non-BACnet packet\n"); */
-        return 0;
-    }
-    /* copy the source address */
-    src->mac_len = 6;
-    memmove(src->mac, &buf[6], 6);
-
-    /* check destination address for when */
-    /* the Ethernet card is in promiscious mode */
-    if ((memcmp(&buf[0], Ethernet_MAC_Address, 6) != 0)
-        && (memcmp(&buf[0], Ethernet_Broadcast, 6) != 0)) {
-        /*fprintf(stderr, "ethernet: This packet isn't for us\n"); */
-        return 0;
-    }
-
-    (void) decode_unsigned16(&buf[12], &pdu_len);
-    pdu_len -= 3 /* DSAP, SSAP, LLC Control */ ;
-    /* copy the buffer into the PDU */
-    if (pdu_len < max_pdu)
-        memmove(&pdu[0], &buf[17], pdu_len);
-    /* ignore packets that are too large */
-    else
-        pdu_len = 0;
-
-
-    return pdu_len;
+    return ethernet_frame_pdu(src, pdu, max_pdu, buf,
+        (unsigned) received_bytes);
 }
 
 void ethernet_set_my_address(
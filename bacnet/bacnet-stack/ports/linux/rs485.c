@@ -63,7 +63,7 @@
 #include "rs485.h"
 #include "fifo.h"
 
-#include <sys/select.h>
+#include <poll.h>
 #include <sys/time.h>
 
 #include "dlmstp_linux.h"
@@ -93,6 +93,14 @@ static struct termios RS485_oldtio;
 static struct serial_struct RS485_oldserial;
 /* indicator of special baud rate */
 static bool RS485_SpecBaud = false;
+/* who switches the transceiver, and the RTS delays in milliseconds */
+static RS485_LINE_MODE RS485_Line_Mode = RS485_LINE_ADAPTER;
+static unsigned RS485_RTS_Delay_Before = 0;
+static unsigned RS485_RTS_Delay_After = 0;
+/* the driver passes on the received bytes at once */
+static bool RS485_Low_Latency = true;
+/* the RS-485 settings of the port before RS485_Initialize */
+static struct serial_rs485 RS485_oldrs485;
 
 /* Ring buffer for incoming bytes, in order to speed up the receiving. */
 static FIFO_BUFFER Rx_FIFO;
@@ -452,85 +460,171 @@ void RS485_Send_Frame(
 }
 
 /****************************************************************************
-* DESCRIPTION: Get a byte of receive data
+* DESCRIPTION: Get a byte of receive data, sleeping until data arrives
+*              or the timeout expires when there is nothing to hand over
 * RETURN:      none
-* ALGORITHM:   none
-* NOTES:       none
+* ALGORITHM:   poll() the port with the millisecond timeout
+* NOTES:       the port is set up with VMIN=0 and VTIME=0 so that read()
+*              never blocks and poll() provides the timing
 *****************************************************************************/
-void RS485_Check_UART_Data(
-    volatile struct mstp_port_struct_t *mstp_port)
+void RS485_Wait_UART_Data(
+    volatile struct mstp_port_struct_t *mstp_port,
+    unsigned timeout)
 {
-    fd_set input;
-    struct timeval waiter;
+    struct pollfd input;
     uint8_t buf[2048];
+    int handle;
+    FIFO_BUFFER *fifo;
     int n;
 
     SHARED_MSTP_DATA *poSharedData = (SHARED_MSTP_DATA *) mstp_port->UserData;
     if (!poSharedData) {
-        if (mstp_port->ReceiveError == true) {
-            /* do nothing but wait for state machine to clear the error */
-            /* burning time, so wait a longer time */
-            waiter.tv_sec = 0;
-            waiter.tv_usec = 5000;
-        } else if (mstp_port->DataAvailable == false) {
-            /* wait for state machine to read from the DataRegister */
-            if (FIFO_Count(&Rx_FIFO) > 0) {
-                /* data is available */
-                mstp_port->DataRegister = FIFO_Get(&Rx_FIFO);
-                mstp_port->DataAvailable = true;
-                /* FIFO is giving data - don't wait very long */
-                waiter.tv_sec = 0;
-                waiter.tv_usec = 10;
-            } else {
-                /* FIFO is empty - wait a longer time */
-                waiter.tv_sec = 0;
-                waiter.tv_usec = 5000;
-            }
+        handle = RS485_Handle;
+        fifo = &Rx_FIFO;
+    } else {
+        handle = poSharedData->RS485_Handle;
+        fifo = &poSharedData->Rx_FIFO;
+    }
+    if (mstp_port->ReceiveError || mstp_port->DataAvailable) {
+        /* the state machine has something to do before the next byte */
+        timeout = 0;
+    } else if (FIFO_Count(fifo) > 0) {
+        /* data is available */
+        mstp_port->DataRegister = FIFO_Get(fifo);
+        mstp_port->DataAvailable = true;
+        /* FIFO is giving data - don't wait */
+        timeout = 0;
+    }
+    /* grab bytes and stuff them into the FIFO every time */
+    input.fd = handle;
+    input.events = POLLIN;
+    input.revents = 0;
+    n = poll(&input, 1, (int) timeout);
+    if (n <= 0) {
+        return;
+    }
+    if (input.revents & POLLIN) {
+        n = read(handle, buf, sizeof(buf));
+        if (n > 0) {
+            FIFO_Add(fifo, &buf[0], n);
         }
-        /* grab bytes and stuff them into the FIFO every time */
-        FD_ZERO(&input);
-        FD_SET(RS485_Handle, &input);
-        n = select(RS485_Handle + 1, &input, NULL, NULL, &waiter);
-        if (n < 0) {
-            return;
+        if ((mstp_port->ReceiveError == false) &&
+            (mstp_port->DataAvailable == false) && (FIFO_Count(fifo) > 0)) {
+            /* hand over the byte that woke us up */
+            mstp_port->DataRegister = FIFO_Get(fifo);
+            mstp_port->DataAvailable = true;
         }
-        if (FD_ISSET(RS485_Handle, &input)) {
-            n = read(RS485_Handle, buf, sizeof(buf));
-            FIFO_Add(&Rx_FIFO, &buf[0], n);
+    }
+}
+
+/****************************************************************************
+* DESCRIPTION: Get a byte of receive data
+* RETURN:      none
+* ALGORITHM:   none
+* NOTES:       none
+*****************************************************************************/
+void RS485_Check_UART_Data(
+    volatile struct mstp_port_struct_t *mstp_port)
+{
+    /* FIFO is empty - wait a longer time */
+    RS485_Wait_UART_Data(mstp_port, 5);
+}
+
+/****************************************************************************
+* DESCRIPTION: Configures who switches the transceiver of the ports opened
+*              next between sending and receiving
+* RETURN:      none
+* ALGORITHM:   none
+* NOTES:       with RS485_LINE_RTS_HIGH or RS485_LINE_RTS_LOW the kernel
+*              drives RTS while the frame is on the wire and releases the
+*              line as soon as the last bit is out, instead of an adapter
+*              that senses the data and holds the line for a byte time or
+*              more.  The delays are for transceivers that need RTS set
+*              before the first bit or held after the last one.
+*****************************************************************************/
+void RS485_Set_Line_Mode(
+    RS485_LINE_MODE mode,
+    unsigned delay_before_ms,
+    unsigned delay_after_ms)
+{
+    RS485_Line_Mode = mode;
+    RS485_RTS_Delay_Before = delay_before_ms;
+    RS485_RTS_Delay_After = delay_after_ms;
+}
+
+/****************************************************************************
+* DESCRIPTION: Configures ASYNC_LOW_LATENCY on the ports opened next
+* RETURN:      none
+* ALGORITHM:   none
+* NOTES:       without it, a USB adapter holds the bytes it received for
+*              its latency timer (16ms on FTDI), which is most of the
+*              MS/TP usage timeout.  It is on by default.
+*****************************************************************************/
+void RS485_Set_Low_Latency(
+    bool enable)
+{
+    RS485_Low_Latency = enable;
+}
+
+/****************************************************************************
+* DESCRIPTION: Applies the line settings to an open port
+* RETURN:      none
+* ALGORITHM:   TIOCSRS485 for the line mode, TIOCSSERIAL for the latency
+* NOTES:       a driver without the RS-485 mode leaves the switching to the
+*              adapter, as before
+*****************************************************************************/
+void RS485_Configure_Line(
+    int handle,
+    struct serial_rs485 *saved)
+{
+    struct serial_rs485 rs485;
+    struct serial_struct serial;
+
+    memset(saved, 0, sizeof(*saved));
+    if (RS485_Line_Mode != RS485_LINE_ADAPTER) {
+        if (ioctl(handle, TIOCGRS485, saved) < 0) {
+            memset(saved, 0, sizeof(*saved));
         }
-    } else {
-        if (mstp_port->ReceiveError == true) {
-            /* do nothing but wait for state machine to clear the error */
-            /* burning time, so wait a longer time */
-            waiter.tv_sec = 0;
-            waiter.tv_usec = 5000;
-        } else if (mstp_port->DataAvailable == false) {
-            /* wait for state machine to read from the DataRegister */
-            if (FIFO_Count(&poSharedData->Rx_FIFO) > 0) {
-                /* data is available */
-                mstp_port->DataRegister = FIFO_Get(&poSharedData->Rx_FIFO);
-                mstp_port->DataAvailable = true;
-                /* FIFO is giving data - don't wait very long */
-                waiter.tv_sec = 0;
-                waiter.tv_usec = 10;
-            } else {
-                /* FIFO is empty - wait a longer time */
-                waiter.tv_sec = 0;
-                waiter.tv_usec = 5000;
-            }
+        rs485 = *saved;
+        rs485.flags |= SER_RS485_ENABLED;
+        /* the transceiver receives at the other level, and not its echo */
+        rs485.flags &=
+            ~(SER_RS485_RTS_ON_SEND | SER_RS485_RTS_AFTER_SEND |
+            SER_RS485_RX_DURING_TX);
+        if (RS485_Line_Mode == RS485_LINE_RTS_HIGH) {
+            rs485.flags |= SER_RS485_RTS_ON_SEND;
+        } else {
+            rs485.flags |= SER_RS485_RTS_AFTER_SEND;
         }
-        /* grab bytes and stuff them into the FIFO every time */
-        FD_ZERO(&input);
-        FD_SET(poSharedData->RS485_Handle, &input);
-        n = select(poSharedData->RS485_Handle + 1, &input, NULL, NULL,
-            &waiter);
-        if (n < 0) {
-            return;
+        rs485.delay_rts_before_send = RS485_RTS_Delay_Before;
+        rs485.delay_rts_after_send = RS485_RTS_Delay_After;
+        if (ioctl(handle, TIOCSRS485, &rs485) < 0) {
+            fprintf(stderr, "RS485: no RS-485 mode in the driver (%s), "
+                "the adapter switches the line\n", strerror(errno));
         }
-        if (FD_ISSET(poSharedData->RS485_Handle, &input)) {
-            n = read(poSharedData->RS485_Handle, buf, sizeof(buf));
-            FIFO_Add(&poSharedData->Rx_FIFO, &buf[0], n);
+    }
+    if (ioctl(handle, TIOCGSERIAL, &serial) == 0) {
+        if (RS485_Low_Latency) {
+            serial.flags |= ASYNC_LOW_LATENCY;
+        } else {
+            serial.flags &= ~ASYNC_LOW_LATENCY;
         }
+        (void) ioctl(handle, TIOCSSERIAL, &serial);
+    }
+}
+
+/****************************************************************************
+* DESCRIPTION: Restores the RS-485 settings saved by RS485_Configure_Line
+* RETURN:      none
+* ALGORITHM:   none
+* NOTES:       none
+*****************************************************************************/
+void RS485_Restore_Line(
+    int handle,
+    struct serial_rs485 *saved)
+{
+    if (RS485_Line_Mode != RS485_LINE_ADAPTER) {
+        (void) ioctl(handle, TIOCSRS485, saved);
     }
 }
 
@@ -538,6 +632,7 @@ void RS485_Cleanup(
     void)
 {
     /* restore the old port settings */
+    RS485_Restore_Line(RS485_Handle, &RS485_oldrs485);
     tcsetattr(RS485_Handle, TCSANOW, &RS485_oldtio);
     ioctl(RS485_Handle, TIOCSSERIAL, &RS485_oldserial);
     close(RS485_Handle);
@@ -591,6 +686,10 @@ void RS485_Initialize(
     newtio.c_oflag = 0;
     /* no processing */
     newtio.c_lflag = 0;
+    /* read() returns what is there; poll() does the waiting because
+       VTIME counts in 100ms and the MS/TP timers need milliseconds */
+    newtio.c_cc[VMIN] = 0;
+    newtio.c_cc[VTIME] = 0;
     /* activate the settings for the port after flushing I/O */
     tcsetattr(RS485_Handle, TCSAFLUSH, &newtio);
     if (RS485_SpecBaud) {
@@ -613,6 +712,8 @@ void RS485_Initialize(
         /* if all goes well, set new divisor */
         ioctl(RS485_Handle, TIOCSSERIAL, &newserial);
     }
+    /* the kernel switches the transceiver, the bytes are passed on at once */
+    RS485_Configure_Line(RS485_Handle, &RS485_oldrs485);
     printf(" at Baud Rate %u", RS485_Get_Baud_Rate());
     /* destructor */
     atexit(RS485_Cleanup);
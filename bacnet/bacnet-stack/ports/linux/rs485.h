@@ -37,8 +37,20 @@
 #define RS485_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <linux/serial.h>       /* for struct serial_rs485 */
 #include "mstp.h"
 
+/* who switches the transceiver between sending and receiving */
+typedef enum {
+    /* the adapter itself, e.g. by sensing the data */
+    RS485_LINE_ADAPTER = 0,
+    /* the kernel (TIOCSRS485), with RTS high while sending */
+    RS485_LINE_RTS_HIGH,
+    /* the kernel, with RTS low while sending */
+    RS485_LINE_RTS_LOW
+} RS485_LINE_MODE;
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -58,6 +70,9 @@ extern "C" {
 
     void RS485_Check_UART_Data(
         volatile struct mstp_port_struct_t *mstp_port); /* port specific data */
+    void RS485_Wait_UART_Data(
+        volatile struct mstp_port_struct_t *mstp_port,  /* port specific data */
+        unsigned timeout);      /* milliseconds to wait for data */
     uint32_t RS485_Get_Port_Baud_Rate(
         volatile struct mstp_port_struct_t *mstp_port);
     uint32_t RS485_Get_Baud_Rate(
@@ -65,6 +80,22 @@ extern "C" {
     bool RS485_Set_Baud_Rate(
         uint32_t baud);
 
+    /* the line settings of the ports opened next; the delays are the */
+    /* milliseconds RTS is set before a frame and held after it */
+    void RS485_Set_Line_Mode(
+        RS485_LINE_MODE mode,
+        unsigned delay_before_ms,
+        unsigned delay_after_ms);
+    void RS485_Set_Low_Latency(
+        bool enable);
+    /* applies them to an open port, saving the RS-485 settings it had */
+    void RS485_Configure_Line(
+        int handle,
+        struct serial_rs485 *saved);
+    void RS485_Restore_Line(
+        int handle,
+        struct serial_rs485 *saved);
+
     void RS485_Cleanup(
         void);
     void RS485_Print_Ports(
@@ -69,6 +69,7 @@ SRCS = main.c \
        ..\..\demo\object\bv.c \
        ..\..\demo\object\lsp.c \
        ..\..\demo\object\mso.c \
+       ..\..\demo\object\objstore.c \
        ..\..\datalink.c \
        ..\..\tsm.c \
        ..\..\address.c \
@@ -34,9 +34,17 @@
 #include "led.h"
 #include "rs485.h"
 
+#if RS485_DMA_RECEIVE
+/* DMA1 channel 6 writes the bytes of USART2 around this ring, which
+   holds more than the largest frame */
+static uint8_t Receive_Ring[512];
+/* the next byte of the ring to hand to the FSM */
+static uint16_t Receive_Tail;
+#else
 /* buffer for storing received bytes - size must be power of two */
 static uint8_t Receive_Buffer_Data[512];
 static FIFO_BUFFER Receive_Buffer;
+#endif
 /* amount of silence on the wire */
 static struct etimer Silence_Timer;
 /* baud rate */
@@ -112,7 +120,99 @@ bool rs485_receive_error(
     return false;
 }
 
-                                                                                                                                                                                                                     /*********************************************************************//**
+#if RS485_DMA_RECEIVE
+/*********************************************************************//**
+ * @brief        USARTx interrupt handler sub-routine
+ * @param[in]    None
+ * @return         None
+ * @note         Only the idle line interrupts: the line has been quiet
+ *               for a character since the last byte the DMA stored, so
+ *               the silence starts now, even if the FSM is busy.
+ **********************************************************************/
+void USART2_IRQHandler(
+    void)
+{
+    if (USART_GetITStatus(USART2, USART_IT_IDLE) != RESET) {
+        /* reading the status then the data register clears the flag */
+        (void) USART_ReceiveData(USART2);
+        timer_elapsed_start(&Silence_Timer);
+    }
+}
+
+/*************************************************************************
+* DESCRIPTION: The place in the ring where the DMA stores the next byte
+* RETURN:      index into the ring
+* NOTES:       the counter counts down, and reloads in circular mode
+**************************************************************************/
+static uint16_t rs485_receive_head(
+    void)
+{
+    return (uint16_t) ((sizeof(Receive_Ring) -
+            DMA_GetCurrDataCounter(DMA1_Channel6)) % sizeof(Receive_Ring));
+}
+
+/*************************************************************************
+* DESCRIPTION: Return true if a byte is available
+* RETURN:      true if a byte is available, with the byte in the parameter
+* NOTES:       none
+**************************************************************************/
+bool rs485_byte_available(
+    uint8_t * data_register)
+{
+    bool data_available = false;        /* return value */
+
+    if (Receive_Tail != rs485_receive_head()) {
+        if (data_register) {
+            *data_register = Receive_Ring[Receive_Tail];
+            Receive_Tail = (Receive_Tail + 1) % sizeof(Receive_Ring);
+        }
+        timer_elapsed_start(&Silence_Timer);
+        data_available = true;
+        led_rx_on_interval(10);
+    }
+
+    return data_available;
+}
+
+/*************************************************************************
+* DESCRIPTION: The received bytes that follow each other in the ring
+* RETURN:      number of bytes, with their address in the parameter
+* NOTES:       the bytes stay in the ring until rs485_bytes_release()
+**************************************************************************/
+uint16_t rs485_bytes_available(
+    uint8_t ** data)
+{
+    uint16_t head = rs485_receive_head();
+    uint16_t count = 0;
+
+    if (head >= Receive_Tail) {
+        count = head - Receive_Tail;
+    } else {
+        /* up to the end of the ring, the rest comes next time */
+        count = sizeof(Receive_Ring) - Receive_Tail;
+    }
+    *data = &Receive_Ring[Receive_Tail];
+
+    return count;
+}
+
+/*************************************************************************
+* DESCRIPTION: Give bytes returned by rs485_bytes_available() back to the
+*              ring
+* RETURN:      nothing
+* NOTES:       none
+**************************************************************************/
+void rs485_bytes_release(
+    uint16_t count)
+{
+    if (count) {
+        Receive_Tail = (Receive_Tail + count) % sizeof(Receive_Ring);
+        timer_elapsed_start(&Silence_Timer);
+        led_rx_on_interval(10);
+    }
+}
+#else
+/*********************************************************************//**
  * @brief        USARTx interrupt handler sub-routine
  * @param[in]    None
  * @return         None
@@ -151,6 +251,7 @@ bool rs485_byte_available(
 
     return data_available;
 }
+#endif
 
 /*************************************************************************
 * DESCRIPTION: Sends a byte of data
@@ -306,6 +407,9 @@ void rs485_init(
 {
     GPIO_InitTypeDef GPIO_InitStructure;
     NVIC_InitTypeDef NVIC_InitStructure;
+#if RS485_DMA_RECEIVE
+    DMA_InitTypeDef DMA_InitStructure;
+#endif
 
     GPIO_StructInit(&GPIO_InitStructure);
     /* Configure USARTx Rx as input floating */
@@ -339,14 +443,41 @@ void rs485_init(
     NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
     NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
     NVIC_Init(&NVIC_InitStructure);
+#if RS485_DMA_RECEIVE
+    /* USART2 Rx requests go to DMA1 channel 6, which fills the ring
+       over and over */
+    RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+    DMA_DeInit(DMA1_Channel6);
+    DMA_StructInit(&DMA_InitStructure);
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t) & USART2->DR;
+    DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t) & Receive_Ring[0];
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+    DMA_InitStructure.DMA_BufferSize = sizeof(Receive_Ring);
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+    DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+    DMA_Init(DMA1_Channel6, &DMA_InitStructure);
+    DMA_Cmd(DMA1_Channel6, ENABLE);
+    USART_DMACmd(USART2, USART_DMAReq_Rx, ENABLE);
+    Receive_Tail = 0;
+    /* interrupt only when the line goes idle after a frame */
+    USART_ITConfig(USART2, USART_IT_IDLE, ENABLE);
+#else
     /* enable the USART to generate interrupts */
     USART_ITConfig(USART2, USART_IT_RXNE, ENABLE);
+#endif
 
     rs485_baud_rate_set(Baud_Rate);
 
     USART_Cmd(USART2, ENABLE);
 
+#if !RS485_DMA_RECEIVE
     FIFO_Init(&Receive_Buffer, &Receive_Buffer_Data[0],
         (unsigned) sizeof(Receive_Buffer_Data));
+#endif
     timer_elapsed_start(&Silence_Timer);
 }
@@ -30,6 +30,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/* The DMA writes the received bytes into a ring by itself, instead of an
+   interrupt for each byte, and the frame FSM takes the data in blocks. */
+#ifndef RS485_DMA_RECEIVE
+#define RS485_DMA_RECEIVE 1
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -40,6 +46,12 @@ extern "C" {
         bool enable);
     bool rs485_byte_available(
         uint8_t * data_register);
+#if RS485_DMA_RECEIVE
+    uint16_t rs485_bytes_available(
+        uint8_t ** data);
+    void rs485_bytes_release(
+        uint16_t count);
+#endif
     bool rs485_receive_error(
         void);
     void rs485_bytes_send(
@@ -36,12 +36,14 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "config.h"
 #include "bacaddr.h"
 #include "address.h"
 #include "bacdef.h"
 #include "bacdcode.h"
 #include "readrange.h"
+#include "bacctx.h"
 
 /** @file address.c  Handle address binding */
 
@@ -49,13 +51,85 @@
 /* occurs in BACnet.  A device id is bound to a MAC address. */
 /* The normal method is using Who-Is, and using the data from I-Am */
 
-static struct Address_Cache_Entry {
+/* The entries holding a slot are packed at the front of the cache, and */
+/* are indexed by device id in an open addressing hash table, so that the */
+/* lookups do not scan the cache. The cache grows from MAX_ADDRESS_CACHE */
+/* entries up to MAX_ADDRESS_CACHE_LIMIT entries. */
+/* An entry expires at an absolute time of the cache clock, and the */
+/* entries that expire are kept in a min-heap by that time, so that the */
+/* timer only looks at the entries that are due. */
+
+struct Address_Cache_Entry {
     uint8_t Flags;
     uint32_t device_id;
     unsigned max_apdu;
     BACNET_ADDRESS address;
-    uint32_t TimeToLive;
-} Address_Cache[MAX_ADDRESS_CACHE];
+    /* the cache clock it expires after, BAC_ADDR_FOREVER for a static */
+    uint32_t Expires;
+    /* its position in the expiry heap + 1, 0 if it doesn't expire */
+    unsigned Expiry_Slot;
+};
+
+/* The state of the cache, one per BACnet context (see bacctx.h). */
+struct address_state {
+    struct Address_Cache_Entry *Cache;
+    unsigned Cache_Size;        /* Number of entries allocated */
+    unsigned Cache_Count;       /* Number of entries holding a slot */
+    /* Entry index + 1 for each device id, 0 for an empty slot. The table */
+    /* is a power of two, and at most half full. */
+    uint32_t *Hash;
+    unsigned Hash_Size;
+    /* Entry indexes of the entries that expire, by Expires. */
+    uint32_t *Expiry;
+    unsigned Expiry_Count;
+    /* The seconds counted by address_cache_timer(). */
+    uint32_t Clock;
+};
+
+static struct address_state Address_Default_State;
+
+#if defined(BACNET_CONTEXT_ENABLED)
+void *address_state_create(
+    void)
+{
+    return calloc(1, sizeof(struct address_state));
+}
+
+void address_state_destroy(
+    void *state)
+{
+    struct address_state *pState = (struct address_state *) state;
+
+    if (pState) {
+        free(pState->Cache);
+        free(pState->Hash);
+        free(pState->Expiry);
+        free(pState);
+    }
+}
+
+static struct address_state *address_state(
+    void)
+{
+    struct address_state *pState = bacnet_context_address_state();
+
+    return pState ? pState : &Address_Default_State;
+}
+
+#define ADDRESS_STATE (address_state())
+#else
+#define ADDRESS_STATE (&Address_Default_State)
+#endif
+
+/* the state of the current context */
+#define Address_Cache (ADDRESS_STATE->Cache)
+#define Address_Cache_Size (ADDRESS_STATE->Cache_Size)
+#define Address_Cache_Count (ADDRESS_STATE->Cache_Count)
+#define Address_Hash (ADDRESS_STATE->Hash)
+#define Address_Hash_Size (ADDRESS_STATE->Hash_Size)
+#define Address_Expiry (ADDRESS_STATE->Expiry)
+#define Address_Expiry_Count (ADDRESS_STATE->Expiry_Count)
+#define Address_Clock (ADDRESS_STATE->Clock)
 
 /* State flags for cache entries */
 
@@ -63,7 +137,6 @@ static struct Address_Cache_Entry {
 #define BAC_ADDR_BIND_REQ  2    /* Bind request outstanding for entry */
 #define BAC_ADDR_STATIC    4    /* Static address mapping - does not expire */
 #define BAC_ADDR_SHORT_TTL 8    /* Oppertunistaclly added address with short TTL */
-#define BAC_ADDR_RESERVED  128  /* Freed up but held for caller to fill */
 
 #define BAC_ADDR_SECS_1HOUR 3600        /* 60x60 */
 #define BAC_ADDR_SECS_1DAY  86400       /* 60x60x24 */
@@ -72,6 +145,9 @@ static struct Address_Cache_Entry {
 #define BAC_ADDR_SHORT_TIME BAC_ADDR_SECS_1HOUR
 #define BAC_ADDR_FOREVER    0xFFFFFFFF  /* Permenant entry */
 
+#define ADDRESS_IS_BOUND(e) \
+    (((e)->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ)) == BAC_ADDR_IN_USE)
+
 bool address_match(
     BACNET_ADDRESS * dest,
     BACNET_ADDRESS * src)
@@ -108,106 +184,369 @@ bool address_match(
     return true;
 }
 
+static unsigned address_hash_home(
+    uint32_t device_id)
+{
+    uint32_t h = device_id;
+
+    h ^= h >> 16;
+    h *= 0x45D9F3BUL;
+    h ^= h >> 16;
+
+    return (unsigned) (h & (Address_Hash_Size - 1));
+}
+
+/* returns the hash slot of the device, or Address_Hash_Size if not found */
+static unsigned address_hash_slot(
+    uint32_t device_id)
+{
+    unsigned slot;
+
+    if (Address_Hash_Size == 0)
+        return Address_Hash_Size;
+    slot = address_hash_home(device_id);
+    while (Address_Hash[slot] != 0) {
+        if (Address_Cache[Address_Hash[slot] - 1].device_id == device_id)
+            return slot;
+        slot = (slot + 1) & (Address_Hash_Size - 1);
+    }
+
+    return Address_Hash_Size;
+}
+
+static void address_hash_insert(
+    uint32_t device_id,
+    unsigned index)
+{
+    unsigned slot = address_hash_home(device_id);
+
+    while (Address_Hash[slot] != 0)
+        slot = (slot + 1) & (Address_Hash_Size - 1);
+    Address_Hash[slot] = index + 1;
+}
+
+/* Linear probing without tombstones: the entries after the removed one */
+/* are shifted back when their home slot allows it. */
+static void address_hash_remove(
+    uint32_t device_id)
+{
+    unsigned mask = Address_Hash_Size - 1;
+    unsigned hole;
+    unsigned slot;
+    unsigned home;
+
+    hole = address_hash_slot(device_id);
+    if (hole >= Address_Hash_Size)
+        return;
+    Address_Hash[hole] = 0;
+    slot = hole;
+    for (;;) {
+        slot = (slot + 1) & mask;
+        if (Address_Hash[slot] == 0)
+            break;
+        home =
+            address_hash_home(Address_Cache[Address_Hash[slot] -
+                1].device_id);
+        /* leave it if its home is cyclically in (hole, slot] */
+        if ((hole <= slot) ? ((home > hole) && (home <= slot))
+            : ((home > hole) || (home <= slot)))
+            continue;
+        Address_Hash[hole] = Address_Hash[slot];
+        Address_Hash[slot] = 0;
+        hole = slot;
+    }
+}
+
+static void address_hash_rebuild(
+    void)
+{
+    unsigned index;
+
+    memset(Address_Hash, 0, Address_Hash_Size * sizeof(Address_Hash[0]));
+    for (index = 0; index < Address_Cache_Count; index++) {
+        address_hash_insert(Address_Cache[index].device_id, index);
+    }
+}
+
+static struct Address_Cache_Entry *address_find(
+    uint32_t device_id)
+{
+    unsigned slot = address_hash_slot(device_id);
+
+    if (slot >= Address_Hash_Size)
+        return NULL;
+
+    return &Address_Cache[Address_Hash[slot] - 1];
+}
+
+/* put the entry at a position of the expiry heap */
+static void address_expiry_set(
+    unsigned pos,
+    unsigned index)
+{
+    Address_Expiry[pos] = index;
+    Address_Cache[index].Expiry_Slot = pos + 1;
+}
+
+static void address_expiry_up(
+    unsigned pos)
+{
+    unsigned index = Address_Expiry[pos];
+    uint32_t expires = Address_Cache[index].Expires;
+    unsigned parent;
+
+    while (pos > 0) {
+        parent = (pos - 1) / 2;
+        if (Address_Cache[Address_Expiry[parent]].Expires <= expires)
+            break;
+        address_expiry_set(pos, Address_Expiry[parent]);
+        pos = parent;
+    }
+    address_expiry_set(pos, index);
+}
+
+static void address_expiry_down(
+    unsigned pos)
+{
+    unsigned index = Address_Expiry[pos];
+    uint32_t expires = Address_Cache[index].Expires;
+    unsigned child;
+
+    for (;;) {
+        child = 2 * pos + 1;
+        if (child >= Address_Expiry_Count)
+            break;
+        if ((child + 1 < Address_Expiry_Count) &&
+            (Address_Cache[Address_Expiry[child + 1]].Expires <
+                Address_Cache[Address_Expiry[child]].Expires))
+            child++;
+        if (Address_Cache[Address_Expiry[child]].Expires >= expires)
+            break;
+        address_expiry_set(pos, Address_Expiry[child]);
+        pos = child;
+    }
+    address_expiry_set(pos, index);
+}
+
+static void address_expiry_remove(
+    struct Address_Cache_Entry *pMatch)
+{
+    unsigned pos;
+    unsigned moved;
+
+    if (pMatch->Expiry_Slot == 0)
+        return;
+    pos = pMatch->Expiry_Slot - 1;
+    pMatch->Expiry_Slot = 0;
+    Address_Expiry_Count--;
+    if (pos < Address_Expiry_Count) {
+        moved = Address_Expiry[Address_Expiry_Count];
+        address_expiry_set(pos, moved);
+        address_expiry_up(pos);
+        address_expiry_down(Address_Cache[moved].Expiry_Slot - 1);
+    }
+}
+
+/* set the time to live of the entry, in seconds from now; a static */
+/* entry never expires */
+static void address_entry_ttl(
+    struct Address_Cache_Entry *pMatch,
+    uint32_t ttl)
+{
+    unsigned index = (unsigned) (pMatch - Address_Cache);
+
+    if ((pMatch->Flags & BAC_ADDR_STATIC) != 0) {
+        address_expiry_remove(pMatch);
+        pMatch->Expires = BAC_ADDR_FOREVER;
+        return;
+    }
+    if (ttl >= BAC_ADDR_FOREVER - Address_Clock)
+        pMatch->Expires = BAC_ADDR_FOREVER - 1;
+    else
+        pMatch->Expires = Address_Clock + ttl;
+    if (pMatch->Expiry_Slot == 0) {
+        address_expiry_set(Address_Expiry_Count++, index);
+        address_expiry_up(pMatch->Expiry_Slot - 1);
+    } else {
+        address_expiry_up(pMatch->Expiry_Slot - 1);
+        address_expiry_down(pMatch->Expiry_Slot - 1);
+    }
+}
+
+/* double the cache, returns false at the limit or out of memory */
+static bool address_cache_grow(
+    void)
+{
+    struct Address_Cache_Entry *pCache;
+    uint32_t *pHash;
+    uint32_t *pExpiry;
+    unsigned size;
+    unsigned hash_size;
+
+    size = Address_Cache_Size ? Address_Cache_Size * 2 : MAX_ADDRESS_CACHE;
+    if (size > MAX_ADDRESS_CACHE_LIMIT)
+        size = MAX_ADDRESS_CACHE_LIMIT;
+    if ((size <= Address_Cache_Size) || (size == 0))
+        return false;
+    hash_size = 1;
+    while (hash_size < size * 2)
+        hash_size <<= 1;
+    pHash = calloc(hash_size, sizeof(pHash[0]));
+    if (pHash == NULL)
+        return false;
+    pCache = realloc(Address_Cache, size * sizeof(pCache[0]));
+    if (pCache == NULL) {
+        free(pHash);
+        return false;
+    }
+    Address_Cache = pCache;
+    pExpiry = realloc(Address_Expiry, size * sizeof(pExpiry[0]));
+    if (pExpiry == NULL) {
+        free(pHash);
+        return false;
+    }
+    Address_Expiry = pExpiry;
+    Address_Cache_Size = size;
+    free(Address_Hash);
+    Address_Hash = pHash;
+    Address_Hash_Size = hash_size;
+    address_hash_rebuild();
+
+    return true;
+}
+
+/* release the slot of the entry, the last entry is moved into it */
+static void address_entry_free(
+    struct Address_Cache_Entry *pMatch)
+{
+    unsigned index = (unsigned) (pMatch - Address_Cache);
+    unsigned last = Address_Cache_Count - 1;
+
+    address_hash_remove(pMatch->device_id);
+    address_expiry_remove(pMatch);
+    if (index != last) {
+        *pMatch = Address_Cache[last];
+        Address_Hash[address_hash_slot(pMatch->device_id)] = index + 1;
+        if (pMatch->Expiry_Slot)
+            Address_Expiry[pMatch->Expiry_Slot - 1] = index;
+    }
+    Address_Cache[last].Flags = 0;
+    Address_Cache_Count--;
+}
+
 void address_remove_device(
     uint32_t device_id)
 {
     struct Address_Cache_Entry *pMatch;
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if (((pMatch->Flags & BAC_ADDR_IN_USE) != 0) &&
-            (pMatch->device_id == device_id)) {
-            pMatch->Flags = 0;
-            break;
-        }
-        pMatch++;
+    pMatch = address_find(device_id);
+    if (pMatch != NULL) {
+        address_entry_free(pMatch);
     }
 
     return;
 }
 
 /*****************************************************************************
- * Search the cache for the entry nearest expiry and delete it. Mark the     *
- * entry as reserved with a 1 hour TTL and return a pointer to the reserved  *
- * entry. Will not delete a static entry and returns NULL pointer if no      *
- * entry available to free up. Does not check for free entries as it is      *
- * assumed we are calling this due to the lack of those.                     *
+ * Search the cache for the entry nearest expiry and delete it. Will not     *
+ * delete a static entry and returns false if no entry available to free up. *
+ * Does not check for free entries as it is assumed we are calling this due  *
+ * to the lack of those.                                                     *
  *****************************************************************************/
 
 
-static struct Address_Cache_Entry *address_remove_oldest(
+static bool address_remove_oldest(
     void)
 {
     struct Address_Cache_Entry *pMatch;
     struct Address_Cache_Entry *pCandidate;
     uint32_t ulTime;
+    unsigned index;
 
     pCandidate = NULL;
     ulTime = BAC_ADDR_FOREVER - 1;      /* Longest possible non static time to live */
 
     /* First pass - try only in use and bound entries */
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
+    for (index = 0; index < Address_Cache_Count; index++) {
+        pMatch = &Address_Cache[index];
         if ((pMatch->
                 Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ |
                     BAC_ADDR_STATIC)) == BAC_ADDR_IN_USE) {
-            if (pMatch->TimeToLive <= ulTime) { /* Shorter lived entry found */
-                ulTime = pMatch->TimeToLive;
+            if (pMatch->Expires <= ulTime) {    /* Shorter lived entry found */
+                ulTime = pMatch->Expires;
                 pCandidate = pMatch;
             }
         }
-        pMatch++;
     }
 
-    if (pCandidate != NULL) {   /* Found something to free up */
-        pCandidate->Flags = BAC_ADDR_RESERVED;
-        pCandidate->TimeToLive = BAC_ADDR_SHORT_TIME;   /* only reserve it for a short while */
-        return (pCandidate);
-    }
-
-    /* Second pass - try in use and un bound as last resort */
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if ((pMatch->
-                Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ |
-                    BAC_ADDR_STATIC)) ==
-            ((uint8_t) (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ))) {
-            if (pMatch->TimeToLive <= ulTime) { /* Shorter lived entry found */
-                ulTime = pMatch->TimeToLive;
-                pCandidate = pMatch;
+    if (pCandidate == NULL) {
+        /* Second pass - try in use and un bound as last resort */
+        for (index = 0; index < Address_Cache_Count; index++) {
+            pMatch = &Address_Cache[index];
+            if ((pMatch->
+                    Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ |
+                        BAC_ADDR_STATIC)) ==
+                ((uint8_t) (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ))) {
+                if (pMatch->Expires <= ulTime) {        /* Shorter lived entry found */
+                    ulTime = pMatch->Expires;
+                    pCandidate = pMatch;
+                }
             }
         }
-        pMatch++;
     }
 
-    if (pCandidate != NULL) {   /* Found something to free up */
-        pCandidate->Flags = BAC_ADDR_RESERVED;
-        pCandidate->TimeToLive = BAC_ADDR_SHORT_TIME;   /* only reserve it for a short while */
+    if (pCandidate == NULL)
+        return false;
+    address_entry_free(pCandidate);
+
+    return true;
+}
+
+/* take a free slot for the device, growing the cache or dropping the */
+/* oldest entry if there is none. Returns NULL if the cache is full of */
+/* static entries or out of memory. */
+static struct Address_Cache_Entry *address_entry_new(
+    uint32_t device_id)
+{
+    struct Address_Cache_Entry *pMatch;
+
+    if ((Address_Cache_Count >= Address_Cache_Size) && !address_cache_grow()) {
+        if (!address_remove_oldest())
+            return NULL;
     }
+    pMatch = &Address_Cache[Address_Cache_Count];
+    memset(pMatch, 0, sizeof(*pMatch));
+    pMatch->device_id = device_id;
+    address_hash_insert(device_id, Address_Cache_Count);
+    Address_Cache_Count++;
 
-    return (pCandidate);
+    return pMatch;
 }
 
 
 /* File format:
-DeviceID MAC SNET SADR MAX-APDU
+DeviceID MAC SNET SADR MAX-APDU [TTL]
 4194303 05 0 0 50
 55555 C0:A8:00:18:BA:C0 26001 19 50
 note: useful for MS/TP Slave static binding
-*/
+The optional TTL is written for the learned bindings, see
+address_bindings_save(). */
 static const char *Address_Cache_Filename = "address_cache";
 
-static void address_file_init(
-    const char *pFilename)
+static void address_file_read(
+    const char *pFilename,
+    bool learned)
 {
     FILE *pFile = NULL; /* stream pointer */
     char line[256] = { "" };    /* holds line from file */
     long device_id = 0;
     unsigned snet = 0;
     unsigned max_apdu = 0;
+    unsigned long ttl = 0;
     unsigned mac[MAX_MAC_LEN] = { 0 };
     int count = 0;
+    int fields = 0;
     char mac_string[80] = { "" }, sadr_string[80] = {
     ""};
     BACNET_ADDRESS src = { 0 };
@@ -218,9 +557,10 @@ static void address_file_init(
         while (fgets(line, (int) sizeof(line), pFile) != NULL) {
             /* ignore comments */
             if (line[0] != ';') {
-                if (sscanf(line, "%7ld %79s %5u %79s %4u", &device_id,
-                        &mac_string[0], &snet, &sadr_string[0],
-                        &max_apdu) == 5) {
+                fields =
+                    sscanf(line, "%7ld %79s %5u %79s %4u %10lu", &device_id,
+                    &mac_string[0], &snet, &sadr_string[0], &max_apdu, &ttl);
+                if (fields >= 5) {
                     count =
                         sscanf(mac_string, "%2x:%2x:%2x:%2x:%2x:%2x", &mac[0],
                         &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]);
@@ -244,8 +584,17 @@ static void address_file_init(
                             src.adr[index] = 0;
                         }
                     }
-                    address_add((uint32_t) device_id, max_apdu, &src);
-                    address_set_device_TTL((uint32_t) device_id, 0, true);      /* Mark as static entry */
+                    if (!learned) {
+                        address_add((uint32_t) device_id, max_apdu, &src);
+                        address_set_device_TTL((uint32_t) device_id, 0, true);  /* Mark as static entry */
+                    } else if (address_find((uint32_t) device_id) == NULL) {
+                        /* Never override a static or a live binding */
+                        if ((fields < 6) || (ttl == 0))
+                            ttl = BAC_ADDR_LONG_TIME;
+                        address_add((uint32_t) device_id, max_apdu, &src);
+                        address_set_device_TTL((uint32_t) device_id,
+                            (uint32_t) ttl, false);
+                    }
                 }
             }
         }
@@ -255,6 +604,95 @@ static void address_file_init(
     return;
 }
 
+static void address_file_init(
+    const char *pFilename)
+{
+    address_file_read(pFilename, false);
+}
+
+static void address_file_write_entry(
+    FILE * pFile,
+    uint32_t device_id,
+    BACNET_ADDRESS * dest,
+    unsigned max_apdu)
+{
+    unsigned i;
+
+    fprintf(pFile, "%lu ", (long unsigned int) device_id);
+    for (i = 0; i < dest->mac_len; i++) {
+        fprintf(pFile, "%02x", dest->mac[i]);
+        if ((i + 1) < dest->mac_len) {
+            fprintf(pFile, ":");
+        }
+    }
+    fprintf(pFile, " %hu ", dest->net);
+    if (dest->net && dest->len) {
+        for (i = 0; i < dest->len; i++) {
+            fprintf(pFile, "%02x", dest->adr[i]);
+            if ((i + 1) < dest->len) {
+                fprintf(pFile, ":");
+            }
+        }
+    } else {
+        fprintf(pFile, "0");
+    }
+    fprintf(pFile, " %u", max_apdu);
+}
+
+/****************************************************************************
+ * Save the learned (bound and not static) entries, so that a restart can   *
+ * reload them with address_bindings_load() instead of binding the devices  *
+ * again. The file is written aside and renamed over the old one, so that a *
+ * crash leaves either the old or the new bindings. Returns false if the    *
+ * file could not be written.                                               *
+ ****************************************************************************/
+
+bool address_bindings_save(
+    const char *pFilename)
+{
+    FILE *pFile = NULL;
+    char tmp_name[256] = { "" };
+    struct Address_Cache_Entry *pMatch;
+    unsigned index;
+    bool status = true;
+
+    if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp",
+            pFilename) >= (int) sizeof(tmp_name))
+        return false;
+    pFile = fopen(tmp_name, "w");
+    if (pFile == NULL)
+        return false;
+    fprintf(pFile, "; DeviceID MAC SNET SADR MAX-APDU TTL\n");
+    for (index = 0; index < Address_Cache_Count; index++) {
+        pMatch = &Address_Cache[index];
+        if (ADDRESS_IS_BOUND(pMatch) &&
+            ((pMatch->Flags & BAC_ADDR_STATIC) == 0)) {
+            address_file_write_entry(pFile, pMatch->device_id,
+                &pMatch->address, pMatch->max_apdu);
+            fprintf(pFile, " %lu\n",
+                (unsigned long) (pMatch->Expires - Address_Clock));
+        }
+    }
+    if (ferror(pFile))
+        status = false;
+    if (fclose(pFile) != 0)
+        status = false;
+    if (status && (rename(tmp_name, pFilename) != 0))
+        status = false;
+    if (!status)
+        remove(tmp_name);
+
+    return status;
+}
+
+/* Reload the bindings saved by address_bindings_save(). Devices already */
+/* in the cache keep their entry. */
+void address_bindings_load(
+    const char *pFilename)
+{
+    address_file_read(pFilename, true);
+}
+
 
 /****************************************************************************
  * Clear down the cache and make sure the full complement of entries are    *
@@ -264,44 +702,41 @@ static void address_file_init(
 void address_init(
     void)
 {
-    struct Address_Cache_Entry *pMatch;
-
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        pMatch->Flags = 0;
-        pMatch++;
-    }
+    Address_Cache_Count = 0;
+    Address_Expiry_Count = 0;
+    if (Address_Cache_Size == 0)
+        (void) address_cache_grow();
+    else
+        address_hash_rebuild();
     address_file_init(Address_Cache_Filename);
 
     return;
 }
 
 /****************************************************************************
- * Clear down the cache of any non bound, expired  or reserved entries.     *
- * Leave static and unexpired bound entries alone. For use where the cache  *
- * is held in persistant memory which can survive a reset or power cycle.   *
- * This reduces the network traffic on restarts as the cache will have much *
- * of its entries intact.                                                   *
+ * Clear down the cache of any non bound or expired entries. Leave static   *
+ * and unexpired bound entries alone. For use where the cache is held in    *
+ * persistant memory which can survive a reset or power cycle. This reduces *
+ * the network traffic on restarts as the cache will have much of its       *
+ * entries intact.                                                          *
  ****************************************************************************/
 
 void address_init_partial(
     void)
 {
     struct Address_Cache_Entry *pMatch;
+    unsigned index = 0;
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if ((pMatch->Flags & BAC_ADDR_IN_USE) != 0) {   /* It's in use so let's check further */
-            if (((pMatch->Flags & BAC_ADDR_BIND_REQ) != 0) ||
-                (pMatch->TimeToLive == 0))
-                pMatch->Flags = 0;
-        }
-
-        if ((pMatch->Flags & BAC_ADDR_RESERVED) != 0) { /* Reserved entries should be cleared */
-            pMatch->Flags = 0;
+    while (index < Address_Cache_Count) {
+        pMatch = &Address_Cache[index];
+        if (((pMatch->Flags & BAC_ADDR_IN_USE) == 0) ||
+            ((pMatch->Flags & BAC_ADDR_BIND_REQ) != 0) ||
+            (pMatch->Expires <= Address_Clock)) {
+            /* the last entry is moved here, look at it again */
+            address_entry_free(pMatch);
+        } else {
+            index++;
         }
-
-        pMatch++;
     }
     address_file_init(Address_Cache_Filename);
 
@@ -323,24 +758,19 @@ void address_set_device_TTL(
 {
     struct Address_Cache_Entry *pMatch;
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if (((pMatch->Flags & BAC_ADDR_IN_USE) != 0) &&
-            (pMatch->device_id == device_id)) {
-            if ((pMatch->Flags & BAC_ADDR_BIND_REQ) == 0) {     /* If bound then we have either static or normaal */
-                if (StaticFlag) {
-                    pMatch->Flags |= BAC_ADDR_STATIC;
-                    pMatch->TimeToLive = BAC_ADDR_FOREVER;
-                } else {
-                    pMatch->Flags &= ~BAC_ADDR_STATIC;
-                    pMatch->TimeToLive = TimeOut;
-                }
+    pMatch = address_find(device_id);
+    if (pMatch != NULL) {
+        if ((pMatch->Flags & BAC_ADDR_BIND_REQ) == 0) { /* If bound then we have either static or normaal */
+            if (StaticFlag) {
+                pMatch->Flags |= BAC_ADDR_STATIC;
+                address_entry_ttl(pMatch, BAC_ADDR_FOREVER);
             } else {
-                pMatch->TimeToLive = TimeOut;   /* For unbound we can only set the time to live */
+                pMatch->Flags &= ~BAC_ADDR_STATIC;
+                address_entry_ttl(pMatch, TimeOut);
             }
-            break;      /* Exit now if found at all - bound or unbound */
+        } else {
+            address_entry_ttl(pMatch, TimeOut); /* For unbound we can only set the time to live */
         }
-        pMatch++;
     }
 }
 
@@ -353,23 +783,25 @@ bool address_get_by_device(
     struct Address_Cache_Entry *pMatch;
     bool found = false; /* return value */
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if (((pMatch->Flags & BAC_ADDR_IN_USE) != 0) &&
-            (pMatch->device_id == device_id)) {
-            if ((pMatch->Flags & BAC_ADDR_BIND_REQ) == 0) {     /* If bound then fetch data */
-                *src = pMatch->address;
-                *max_apdu = pMatch->max_apdu;
-                found = true;   /* Prove we found it */
-            }
-            break;      /* Exit now if found at all - bound or unbound */
-        }
-        pMatch++;
+    pMatch = address_find(device_id);
+    if ((pMatch != NULL) && ((pMatch->Flags & BAC_ADDR_BIND_REQ) == 0)) {
+        /* If bound then fetch data */
+        *src = pMatch->address;
+        *max_apdu = pMatch->max_apdu;
+        found = true;   /* Prove we found it */
     }
 
     return found;
 }
 
+/* returns true if the device is cached, bound or with a bind request,
+   so that an I-Am of it is worth decoding */
+bool address_bind_wanted(
+    uint32_t device_id)
+{
+    return (address_find(device_id) != NULL);
+}
+
 /* find a device id from a given MAC address */
 
 bool address_get_device_id(
@@ -378,10 +810,11 @@ bool address_get_device_id(
 {
     struct Address_Cache_Entry *pMatch;
     bool found = false; /* return value */
+    unsigned index;
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ)) == BAC_ADDR_IN_USE) {       /* If bound */
+    for (index = 0; index < Address_Cache_Count; index++) {
+        pMatch = &Address_Cache[index];
+        if (ADDRESS_IS_BOUND(pMatch)) {
             if (bacnet_address_same(&pMatch->address, src)) {
                 if (device_id) {
                     *device_id = pMatch->device_id;
@@ -390,7 +823,6 @@ bool address_get_device_id(
                 break;
             }
         }
-        pMatch++;
     }
 
     return found;
@@ -401,7 +833,6 @@ void address_add(
     unsigned max_apdu,
     BACNET_ADDRESS * src)
 {
-    bool found = false; /* return value */
     struct Address_Cache_Entry *pMatch;
 
     /* Note: Previously this function would ignore bind request
@@ -411,58 +842,33 @@ void address_add(
        bind request if it exists */
 
     /* existing device or bind request outstanding - update address */
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if (((pMatch->Flags & BAC_ADDR_IN_USE) != 0) &&
-            (pMatch->device_id == device_id)) {
-            pMatch->address = *src;
-            pMatch->max_apdu = max_apdu;
-
-            /* Pick the right time to live */
-
-            if ((pMatch->Flags & BAC_ADDR_BIND_REQ) != 0)       /* Bind requested so long time */
-                pMatch->TimeToLive = BAC_ADDR_LONG_TIME;
-            else if ((pMatch->Flags & BAC_ADDR_STATIC) != 0)    /* Static already so make sure it never expires */
-                pMatch->TimeToLive = BAC_ADDR_FOREVER;
-            else if ((pMatch->Flags & BAC_ADDR_SHORT_TTL) != 0) /* Opportunistic entry so leave on short fuse */
-                pMatch->TimeToLive = BAC_ADDR_SHORT_TIME;
-            else
-                pMatch->TimeToLive = BAC_ADDR_LONG_TIME;        /* Renewing existing entry */
-
-            pMatch->Flags &= ~BAC_ADDR_BIND_REQ;        /* Clear bind request flag just in case */
-            found = true;
-            break;
-        }
-        pMatch++;
+    pMatch = address_find(device_id);
+    if (pMatch != NULL) {
+        pMatch->address = *src;
+        pMatch->max_apdu = max_apdu;
+
+        /* Pick the right time to live */
+
+        if ((pMatch->Flags & BAC_ADDR_BIND_REQ) != 0)   /* Bind requested so long time */
+            address_entry_ttl(pMatch, BAC_ADDR_LONG_TIME);
+        else if ((pMatch->Flags & BAC_ADDR_STATIC) != 0)        /* Static already so make sure it never expires */
+            address_entry_ttl(pMatch, BAC_ADDR_FOREVER);
+        else if ((pMatch->Flags & BAC_ADDR_SHORT_TTL) != 0)     /* Opportunistic entry so leave on short fuse */
+            address_entry_ttl(pMatch, BAC_ADDR_SHORT_TIME);
+        else
+            address_entry_ttl(pMatch, BAC_ADDR_LONG_TIME);      /* Renewing existing entry */
+
+        pMatch->Flags &= ~BAC_ADDR_BIND_REQ;    /* Clear bind request flag just in case */
+        return;
     }
 
     /* new device - add to cache if there is room */
-    if (!found) {
-        pMatch = Address_Cache;
-        while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-            if ((pMatch->Flags & BAC_ADDR_IN_USE) == 0) {
-                pMatch->Flags = BAC_ADDR_IN_USE;
-                pMatch->device_id = device_id;
-                pMatch->max_apdu = max_apdu;
-                pMatch->address = *src;
-                pMatch->TimeToLive = BAC_ADDR_SHORT_TIME;       /* Opportunistic entry so leave on short fuse */
-                found = true;
-                break;
-            }
-            pMatch++;
-        }
-    }
-
-    /* See if we can squeeze it in */
-    if (!found) {
-        pMatch = address_remove_oldest();
-        if (pMatch != NULL) {
-            pMatch->Flags = BAC_ADDR_IN_USE;
-            pMatch->device_id = device_id;
-            pMatch->max_apdu = max_apdu;
-            pMatch->address = *src;
-            pMatch->TimeToLive = BAC_ADDR_SHORT_TIME;   /* Opportunistic entry so leave on short fuse */
-        }
+    pMatch = address_entry_new(device_id);
+    if (pMatch != NULL) {
+        pMatch->Flags = BAC_ADDR_IN_USE;
+        pMatch->max_apdu = max_apdu;
+        pMatch->address = *src;
+        address_entry_ttl(pMatch, BAC_ADDR_SHORT_TIME); /* Opportunistic entry so leave on short fuse */
     }
     return;
 }
@@ -478,46 +884,28 @@ bool address_bind_request(
     struct Address_Cache_Entry *pMatch;
 
     /* existing device - update address info if currently bound */
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if (((pMatch->Flags & BAC_ADDR_IN_USE) != 0) &&
-            (pMatch->device_id == device_id)) {
-            if ((pMatch->Flags & BAC_ADDR_BIND_REQ) == 0) {     /* Already bound */
-                found = true;
-                *src = pMatch->address;
-                *max_apdu = pMatch->max_apdu;
-                if ((pMatch->Flags & BAC_ADDR_SHORT_TTL) != 0) {        /* Was picked up opportunistacilly */
-                    pMatch->Flags &= ~BAC_ADDR_SHORT_TTL;       /* Convert to normal entry  */
-                    pMatch->TimeToLive = BAC_ADDR_LONG_TIME;    /* And give it a decent time to live */
-                }
+    pMatch = address_find(device_id);
+    if (pMatch != NULL) {
+        if ((pMatch->Flags & BAC_ADDR_BIND_REQ) == 0) { /* Already bound */
+            found = true;
+            *src = pMatch->address;
+            *max_apdu = pMatch->max_apdu;
+            if ((pMatch->Flags & BAC_ADDR_SHORT_TTL) != 0) {    /* Was picked up opportunistacilly */
+                pMatch->Flags &= ~BAC_ADDR_SHORT_TTL;   /* Convert to normal entry  */
+                address_entry_ttl(pMatch, BAC_ADDR_LONG_TIME);  /* And give it a decent time to live */
             }
-            return (found);     /* True if bound, false if bind request outstanding */
-        }
-        pMatch++;
-    }
-
-    /* Not there already so look for a free entry to put it in */
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_RESERVED)) == 0) {
-            /* In use and awaiting binding */
-            pMatch->Flags = (uint8_t) (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ);
-            pMatch->device_id = device_id;
-            /* No point in leaving bind requests in for long haul */
-            pMatch->TimeToLive = BAC_ADDR_SHORT_TIME;
-            /* now would be a good time to do a Who-Is request */
-            return (false);
         }
-        pMatch++;
+        return (found); /* True if bound, false if bind request outstanding */
     }
 
-    /* No free entries, See if we can squeeze it in by dropping an existing one */
-    pMatch = address_remove_oldest();
+    /* Not there already so take a free entry, or drop an existing one */
+    pMatch = address_entry_new(device_id);
     if (pMatch != NULL) {
+        /* In use and awaiting binding */
         pMatch->Flags = (uint8_t) (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ);
-        pMatch->device_id = device_id;
         /* No point in leaving bind requests in for long haul */
-        pMatch->TimeToLive = BAC_ADDR_SHORT_TIME;
+        address_entry_ttl(pMatch, BAC_ADDR_SHORT_TIME);
+        /* now would be a good time to do a Who-Is request */
     }
     return (false);
 }
@@ -531,22 +919,17 @@ void address_add_binding(
     struct Address_Cache_Entry *pMatch;
 
     /* existing device or bind request - update address */
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if (((pMatch->Flags & BAC_ADDR_IN_USE) != 0) &&
-            (pMatch->device_id == device_id)) {
-            pMatch->address = *src;
-            pMatch->max_apdu = max_apdu;
-            /* Clear bind request flag in case it was set */
-            pMatch->Flags &= ~BAC_ADDR_BIND_REQ;
-            /* Only update TTL if not static */
-            if ((pMatch->Flags & BAC_ADDR_STATIC) == 0) {
-                /* and set it on a long fuse */
-                pMatch->TimeToLive = BAC_ADDR_LONG_TIME;
-            }
-            break;
+    pMatch = address_find(device_id);
+    if (pMatch != NULL) {
+        pMatch->address = *src;
+        pMatch->max_apdu = max_apdu;
+        /* Clear bind request flag in case it was set */
+        pMatch->Flags &= ~BAC_ADDR_BIND_REQ;
+        /* Only update TTL if not static */
+        if ((pMatch->Flags & BAC_ADDR_STATIC) == 0) {
+            /* and set it on a long fuse */
+            address_entry_ttl(pMatch, BAC_ADDR_LONG_TIME);
         }
-        pMatch++;
     }
     return;
 }
@@ -560,10 +943,9 @@ bool address_get_by_index(
     struct Address_Cache_Entry *pMatch;
     bool found = false; /* return value */
 
-    if (index < MAX_ADDRESS_CACHE) {
+    if (index < Address_Cache_Count) {
         pMatch = &Address_Cache[index];
-        if ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ)) ==
-            BAC_ADDR_IN_USE) {
+        if (ADDRESS_IS_BOUND(pMatch)) {
             *src = pMatch->address;
             *device_id = pMatch->device_id;
             *max_apdu = pMatch->max_apdu;
@@ -577,17 +959,13 @@ bool address_get_by_index(
 unsigned address_count(
     void)
 {
-    struct Address_Cache_Entry *pMatch;
     unsigned count = 0; /* return value */
+    unsigned index;
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
+    for (index = 0; index < Address_Cache_Count; index++) {
         /* Only count bound entries */
-        if ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ)) ==
-            BAC_ADDR_IN_USE)
+        if (ADDRESS_IS_BOUND(&Address_Cache[index]))
             count++;
-
-        pMatch++;
     }
 
     return count;
@@ -605,16 +983,16 @@ int address_list_encode(
     int iLen = 0;
     struct Address_Cache_Entry *pMatch;
     BACNET_OCTET_STRING MAC_Address;
+    unsigned index;
 
     /* FIXME: I really shouild check the length remaining here but it is
        fairly pointless until we have the true length remaining in
        the packet to work with as at the moment it is just MAX_APDU */
     apdu_len = apdu_len;
     /* look for matching address */
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ)) ==
-            BAC_ADDR_IN_USE) {
+    for (index = 0; index < Address_Cache_Count; index++) {
+        pMatch = &Address_Cache[index];
+        if (ADDRESS_IS_BOUND(pMatch)) {
             iLen +=
                 encode_application_object_id(&apdu[iLen], OBJECT_DEVICE,
                 pMatch->device_id);
@@ -635,7 +1013,6 @@ int address_list_encode(
                     encode_application_octet_string(&apdu[iLen], &MAC_Address);
             }
         }
-        pMatch++;
     }
 
     return (iLen);
@@ -674,6 +1051,7 @@ int rr_address_list_encode(
     int32_t iTemp = 0;
     struct Address_Cache_Entry *pMatch = NULL;
     BACNET_OCTET_STRING MAC_Address;
+    unsigned index = 0;         /* Position in the cache */
     uint32_t uiTotal = 0;       /* Number of bound entries in the cache */
     uint32_t uiIndex = 0;       /* Current entry number */
     uint32_t uiFirst = 0;       /* Entry number we started encoding from */
@@ -687,7 +1065,7 @@ int rr_address_list_encode(
     bitstring_set_bit(&pRequest->ResultFlags, RESULT_FLAG_LAST_ITEM, false);
     bitstring_set_bit(&pRequest->ResultFlags, RESULT_FLAG_MORE_ITEMS, false);
     /* See how much space we have */
-    uiRemaining = (uint32_t) (MAX_APDU - pRequest->Overhead);
+    uiRemaining = (uint32_t) (RR_MAX_APDU(pRequest) - pRequest->Overhead);
 
     pRequest->ItemCount = 0;    /* Start out with nothing */
     uiTotal = address_count();  /* What do we have to work with here ? */
@@ -738,22 +1116,24 @@ int rr_address_list_encode(
     if (uiTarget > uiTotal)     /* Capped at end of list if necessary */
         uiTarget = uiTotal;
 
-    pMatch = Address_Cache;
-    uiIndex = 1;
-    while ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ)) != BAC_ADDR_IN_USE)  /* Find first bound entry */
-        pMatch++;
-
-    /* Seek to start position */
-    while (uiIndex != pRequest->Range.RefIndex) {
-        if ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ)) == BAC_ADDR_IN_USE) {       /* Only count bound entries */
-            pMatch++;
+    /* Seek to start position, only bound entries are counted */
+    uiIndex = 0;
+    while (index < Address_Cache_Count) {
+        if (ADDRESS_IS_BOUND(&Address_Cache[index])) {
             uiIndex++;
-        } else
-            pMatch++;
+            if (uiIndex == pRequest->Range.RefIndex)
+                break;
+        }
+        index++;
     }
 
     uiFirst = uiIndex;  /* Record where we started from */
-    while (uiIndex <= uiTarget) {
+    while ((uiIndex <= uiTarget) && (index < Address_Cache_Count)) {
+        pMatch = &Address_Cache[index];
+        if (!ADDRESS_IS_BOUND(pMatch)) {        /* Skip to next bound entry */
+            index++;
+            continue;
+        }
         if (uiRemaining < ACACHE_MAX_ENC) {
             /*
              * Can't fit any more in! We just set the result flag to say there
@@ -792,11 +1172,8 @@ int rr_address_list_encode(
 
         uiLast = uiIndex;       /* Record the last entry encoded */
         uiIndex++;      /* and get ready for next one */
-        pMatch++;
+        index++;
         pRequest->ItemCount++;  /* Chalk up another one for the response count */
-
-        while ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ)) != BAC_ADDR_IN_USE)      /* Find next bound entry */
-            pMatch++;
     }
 
     /* Set remaining result flags if necessary */
@@ -822,17 +1199,13 @@ void address_cache_timer(
 {       /* Approximate number of seconds since last call to this function */
     struct Address_Cache_Entry *pMatch;
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if (((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_RESERVED)) != 0)
-            && ((pMatch->Flags & BAC_ADDR_STATIC) == 0)) {      /* Check all entries holding a slot except statics */
-            if (pMatch->TimeToLive >= uSeconds)
-                pMatch->TimeToLive -= uSeconds;
-            else
-                pMatch->Flags = 0;
-        }
-
-        pMatch++;
+    Address_Clock += uSeconds;
+    /* only the entries that are due, soonest first */
+    while (Address_Expiry_Count > 0) {
+        pMatch = &Address_Cache[Address_Expiry[0]];
+        if (pMatch->Expires >= Address_Clock)
+            break;
+        address_entry_free(pMatch);
     }
 }
 
@@ -860,37 +1233,36 @@ static void set_address(
     }
 }
 
+/* the file holds at most six MAC bytes, as a B/IP address behind a router */
+static void set_bip_address(
+    unsigned index,
+    BACNET_ADDRESS * dest)
+{
+    unsigned i;
+
+    memset(dest, 0, sizeof(*dest));
+    for (i = 0; i < 6; i++) {
+        dest->mac[i] = index;
+    }
+    dest->mac_len = 6;
+    dest->net = 7;
+    dest->len = 1;
+    dest->adr[0] = index;
+}
+
 static void set_file_address(
     const char *pFilename,
     uint32_t device_id,
     BACNET_ADDRESS * dest,
     uint16_t max_apdu)
 {
-    unsigned i;
     FILE *pFile = NULL;
 
     pFile = fopen(pFilename, "w");
 
     if (pFile) {
-        fprintf(pFile, "%lu ", (long unsigned int) device_id);
-        for (i = 0; i < dest->mac_len; i++) {
-            fprintf(pFile, "%02x", dest->mac[i]);
-            if ((i + 1) < dest->mac_len) {
-                fprintf(pFile, ":");
-            }
-        }
-        fprintf(pFile, " %hu ", dest->net);
-        if (dest->net) {
-            for (i = 0; i < dest->len; i++) {
-                fprintf(pFile, "%02x", dest->adr[i]);
-                if ((i + 1) < dest->len) {
-                    fprintf(pFile, ":");
-                }
-            }
-        } else {
-            fprintf(pFile, "0");
-        }
-        fprintf(pFile, " %hu\n", max_apdu);
+        address_file_write_entry(pFile, device_id, dest, max_apdu);
+        fprintf(pFile, "\n");
         fclose(pFile);
     }
 }
@@ -991,6 +1363,137 @@ void testAddress(
     }
 }
 
+void testAddressGrowth(
+    Test * pTest)
+{
+    unsigned i;
+    BACNET_ADDRESS src;
+    uint32_t device_id = 0;
+    unsigned max_apdu = 480;
+    BACNET_ADDRESS test_address;
+    unsigned test_max_apdu = 0;
+
+    remove(Address_Cache_Filename);
+    address_init();
+    /* the cache grows past its initial size up to the limit */
+    for (i = 0; i < MAX_ADDRESS_CACHE_LIMIT; i++) {
+        set_address(i, &src);
+        address_add(i * 3, max_apdu, &src);
+    }
+    ct_test(pTest, address_count() == MAX_ADDRESS_CACHE_LIMIT);
+    for (i = 0; i < MAX_ADDRESS_CACHE_LIMIT; i++) {
+        ct_test(pTest, address_get_by_device(i * 3, &test_max_apdu,
+                &test_address));
+        ct_test(pTest, !address_get_by_device(i * 3 + 1, &test_max_apdu,
+                &test_address));
+    }
+    /* remove every other device, the rest stay reachable */
+    for (i = 0; i < MAX_ADDRESS_CACHE_LIMIT; i += 2) {
+        address_remove_device(i * 3);
+    }
+    ct_test(pTest, address_count() == MAX_ADDRESS_CACHE_LIMIT / 2);
+    for (i = 0; i < MAX_ADDRESS_CACHE_LIMIT; i++) {
+        ct_test(pTest, address_get_by_device(i * 3, &test_max_apdu,
+                &test_address) == ((i % 2) == 1));
+    }
+    /* at the limit an old entry makes room for the new one */
+    for (i = 0; i < MAX_ADDRESS_CACHE_LIMIT; i += 2) {
+        set_address(i, &src);
+        address_add(i * 3, max_apdu, &src);
+    }
+    device_id = MAX_ADDRESS_CACHE_LIMIT * 3;
+    ct_test(pTest, !address_bind_request(device_id, &test_max_apdu,
+            &test_address));
+    ct_test(pTest, address_count() == MAX_ADDRESS_CACHE_LIMIT - 1);
+    address_add_binding(device_id, max_apdu, &src);
+    ct_test(pTest, address_get_by_device(device_id, &test_max_apdu,
+            &test_address));
+    ct_test(pTest, address_count() == MAX_ADDRESS_CACHE_LIMIT);
+    address_init();
+    ct_test(pTest, address_count() == 0);
+}
+
+void testAddressBindings(
+    Test * pTest)
+{
+    const char *pFilename = "address_bindings";
+    unsigned i;
+    BACNET_ADDRESS src;
+    unsigned max_apdu = 480;
+    BACNET_ADDRESS test_address;
+    unsigned test_max_apdu = 0;
+
+    remove(Address_Cache_Filename);
+    address_init();
+    for (i = 1; i <= 10; i++) {
+        set_bip_address(i, &src);
+        if (!address_bind_request(i, &test_max_apdu, &test_address)) {
+            address_add_binding(i, max_apdu, &src);
+        }
+    }
+    /* a static entry is not saved, and a pending bind request neither */
+    address_set_device_TTL(1, 0, true);
+    ct_test(pTest, !address_bind_request(100, &test_max_apdu,
+            &test_address));
+    ct_test(pTest, address_bind_wanted(100));
+    ct_test(pTest, address_bind_wanted(10));
+    ct_test(pTest, !address_bind_wanted(11));
+    ct_test(pTest, address_bindings_save(pFilename));
+
+    address_init();
+    address_bindings_load(pFilename);
+    ct_test(pTest, address_count() == 9);
+    ct_test(pTest, !address_get_by_device(1, &test_max_apdu, &test_address));
+    ct_test(pTest, !address_get_by_device(100, &test_max_apdu,
+            &test_address));
+    for (i = 2; i <= 10; i++) {
+        set_bip_address(i, &src);
+        ct_test(pTest, address_bind_request(i, &test_max_apdu,
+                &test_address));
+        ct_test(pTest, test_max_apdu == max_apdu);
+        ct_test(pTest, bacnet_address_same(&test_address, &src));
+    }
+    remove(pFilename);
+}
+
+void testAddressExpiry(
+    Test * pTest)
+{
+    unsigned i;
+    BACNET_ADDRESS src;
+    unsigned max_apdu = 480;
+    BACNET_ADDRESS test_address;
+    unsigned test_max_apdu = 0;
+
+    remove(Address_Cache_Filename);
+    address_init();
+    for (i = 1; i <= 100; i++) {
+        set_address(i, &src);
+        address_add(i, max_apdu, &src);
+        address_set_device_TTL(i, (101 - i) * 10, false);
+    }
+    set_address(1000, &src);
+    address_add(1000, max_apdu, &src);
+    address_set_device_TTL(1000, 0, true);
+    /* the entries shorter lived than the elapsed time go */
+    address_cache_timer(155);
+    ct_test(pTest, address_count() == 101 - 15);
+    for (i = 1; i <= 100; i++) {
+        ct_test(pTest, address_get_by_device(i, &test_max_apdu,
+                &test_address) == (i < 86));
+    }
+    /* a renewed entry lives on, a static one forever */
+    address_set_device_TTL(50, 1000, false);
+    address_cache_timer(1000);
+    ct_test(pTest, address_count() == 2);
+    ct_test(pTest, address_get_by_device(50, &test_max_apdu, &test_address));
+    address_cache_timer(1);
+    ct_test(pTest, address_count() == 1);
+    ct_test(pTest, address_get_by_device(1000, &test_max_apdu,
+            &test_address));
+    address_init();
+}
+
 #ifdef TEST_ADDRESS
 int main(
     void)
@@ -1004,6 +1507,12 @@ int main(
     assert(rc);
     rc = ct_addTestFunction(pTest, testAddressFile);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testAddressGrowth);
+    assert(rc);
+    rc = ct_addTestFunction(pTest, testAddressBindings);
+    assert(rc);
+    rc = ct_addTestFunction(pTest, testAddressExpiry);
+    assert(rc);
 
 
     ct_setStream(pTest, stdout);
@@ -56,6 +56,8 @@ extern int Routed_Device_Service_Approval(
 static uint16_t Timeout_Milliseconds = 3000;
 /* Number of APDU Retries */
 static uint8_t Number_Of_Retries = 3;
+/* APDU Segment Timeout in Milliseconds */
+static uint16_t Segment_Timeout_Milliseconds = 2000;
 
 /* a simple table for crossing the services supported */
 static BACNET_SERVICES_SUPPORTED
@@ -374,6 +376,18 @@ void apdu_retries_set(
     Number_Of_Retries = value;
 }
 
+uint16_t apdu_segment_timeout(
+    void)
+{
+    return Segment_Timeout_Milliseconds;
+}
+
+void apdu_segment_timeout_set(
+    uint16_t milliseconds)
+{
+    Segment_Timeout_Milliseconds = milliseconds;
+}
+
 
 /* When network communications are completely disabled,
    only DeviceCommunicationControl and ReinitializeDevice APDUs
@@ -457,6 +471,7 @@ void apdu_handler(
     uint32_t error_class = 0;
     uint8_t reason = 0;
     bool server = false;
+    BACNET_CONFIRMED_REPLY reply = { 0 };
 
     if (apdu) {
         /* PDU Type */
@@ -501,6 +516,12 @@ void apdu_handler(
             case PDU_TYPE_SIMPLE_ACK:
                 invoke_id = apdu[1];
                 service_choice = apdu[2];
+                tsm_reply_received(src, invoke_id);
+                /* the completion of the request, before the handlers */
+                reply.pdu_type = PDU_TYPE_SIMPLE_ACK;
+                reply.service_choice = service_choice;
+                if (tsm_complete(src, invoke_id, &reply))
+                    break;
                 switch (service_choice) {
                     case SERVICE_CONFIRMED_ACKNOWLEDGE_ALARM:
                     case SERVICE_CONFIRMED_COV_NOTIFICATION:
@@ -527,7 +548,7 @@ void apdu_handler(
                                 Confirmed_ACK_Function[service_choice]) (src,
                                 invoke_id);
                         }
-                        tsm_free_invoke_id(invoke_id);
+                        tsm_free_invoke_id_peer(src, invoke_id);
                         break;
                     default:
                         break;
@@ -547,6 +568,23 @@ void apdu_handler(
                 service_choice = apdu[len++];
                 service_request = &apdu[len];
                 service_request_len = apdu_len - (uint16_t) len;
+                /* the first segment, the others come after the round trip */
+                tsm_reply_received(src, invoke_id);
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+                if (service_ack_data.segmented_message &&
+                    !tsm_segmented_confirmation(src, &service_ack_data,
+                        &service_request, &service_request_len)) {
+                    /* more segments to come */
+                    break;
+                }
+#endif
+                reply.pdu_type = PDU_TYPE_COMPLEX_ACK;
+                reply.service_choice = service_choice;
+                reply.service_request = service_request;
+                reply.service_len = service_request_len;
+                reply.ack_data = &service_ack_data;
+                if (tsm_complete(src, invoke_id, &reply))
+                    break;
                 switch (service_choice) {
                     case SERVICE_CONFIRMED_GET_ALARM_SUMMARY:
                     case SERVICE_CONFIRMED_GET_ENROLLMENT_SUMMARY:
@@ -571,28 +609,35 @@ void apdu_handler(
                                 (service_request, service_request_len, src,
                                 &service_ack_data);
                         }
-                        tsm_free_invoke_id(invoke_id);
+                        tsm_free_invoke_id_peer(src, invoke_id);
                         break;
                     default:
                         break;
                 }
                 break;
             case PDU_TYPE_SEGMENT_ACK:
-                /* FIXME: what about a denial of service attack here?
-                   we could check src to see if that matched the tsm */
-                tsm_free_invoke_id(invoke_id);
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+                /* only the transaction with src is affected */
+                if (apdu_len >= 4) {
+                    tsm_segment_ack_received(src, apdu[1], apdu[2], apdu[3],
+                        (apdu[0] & BIT1) ? true : false,
+                        (apdu[0] & BIT0) ? true : false);
+                }
+#endif
                 break;
             case PDU_TYPE_ERROR:
                 invoke_id = apdu[1];
                 service_choice = apdu[2];
                 len = 3;
+                tsm_reply_received(src, invoke_id);
 
-                /* FIXME: Currently special case for C_P_T but there are others which may
-                   need consideration such as ChangeList-Error, CreateObject-Error,
-                   WritePropertyMultiple-Error and VTClose_Error but they may be left as
+                /* FIXME: Currently special case for C_P_T and WPM but there are others
+                   which may need consideration such as ChangeList-Error,
+                   CreateObject-Error and VTClose_Error but they may be left as
                    is for now until support for these services is added */
 
-                if (service_choice == SERVICE_CONFIRMED_PRIVATE_TRANSFER) {     /* skip over opening tag 0 */
+                if ((service_choice == SERVICE_CONFIRMED_PRIVATE_TRANSFER) ||
+                    (service_choice == SERVICE_CONFIRMED_WRITE_PROP_MULTIPLE)) {        /* skip over opening tag 0 */
                     if (decode_is_opening_tag_number(&apdu[len], 0)) {
                         len++;  /* a tag number of 0 is not extended so only one octet */
                     }
@@ -608,33 +653,60 @@ void apdu_handler(
                 /* FIXME: we could validate that the tag is enumerated... */
                 len += decode_enumerated(&apdu[len], len_value, &error_code);
 
-                if (service_choice == SERVICE_CONFIRMED_PRIVATE_TRANSFER) {     /* skip over closing tag 0 */
+                if ((service_choice == SERVICE_CONFIRMED_PRIVATE_TRANSFER) ||
+                    (service_choice == SERVICE_CONFIRMED_WRITE_PROP_MULTIPLE)) {        /* skip over closing tag 0 */
                     if (decode_is_closing_tag_number(&apdu[len], 0)) {
                         len++;  /* a tag number of 0 is not extended so only one octet */
                     }
                 }
+                reply.pdu_type = PDU_TYPE_ERROR;
+                reply.service_choice = service_choice;
+                reply.error_class = (BACNET_ERROR_CLASS) error_class;
+                reply.error_code = (BACNET_ERROR_CODE) error_code;
+                if (tsm_complete(src, invoke_id, &reply))
+                    break;
                 if (service_choice < MAX_BACNET_CONFIRMED_SERVICE) {
                     if (Error_Function[service_choice])
                         Error_Function[service_choice] (src, invoke_id,
                             (BACNET_ERROR_CLASS) error_class,
                             (BACNET_ERROR_CODE) error_code);
                 }
-                tsm_free_invoke_id(invoke_id);
+                tsm_free_invoke_id_peer(src, invoke_id);
                 break;
             case PDU_TYPE_REJECT:
                 invoke_id = apdu[1];
                 reason = apdu[2];
+                tsm_reply_received(src, invoke_id);
+                reply.pdu_type = PDU_TYPE_REJECT;
+                reply.reason = reason;
+                if (tsm_complete(src, invoke_id, &reply))
+                    break;
                 if (Reject_Function)
                     Reject_Function(src, invoke_id, reason);
-                tsm_free_invoke_id(invoke_id);
+                tsm_free_invoke_id_peer(src, invoke_id);
                 break;
             case PDU_TYPE_ABORT:
                 server = apdu[0] & 0x01;
                 invoke_id = apdu[1];
                 reason = apdu[2];
+                /* from the server, of a request of ours */
+                if (server) {
+                    tsm_reply_received(src, invoke_id);
+                }
+                reply.pdu_type = PDU_TYPE_ABORT;
+                reply.reason = reason;
+                if (server && tsm_complete(src, invoke_id, &reply))
+                    break;
                 if (Abort_Function)
                     Abort_Function(src, invoke_id, reason, server);
-                tsm_free_invoke_id(invoke_id);
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+                if (!server) {
+                    /* the client gave up on our segmented reply */
+                    tsm_segmented_response_abort(src, invoke_id);
+                    break;
+                }
+#endif
+                tsm_free_invoke_id_peer(src, invoke_id);
                 break;
             default:
                 break;
@@ -35,6 +35,7 @@
 #include "bacenum.h"
 #include "bacdcode.h"
 #include "bacdef.h"
+#include "apdu.h"
 #include "arf.h"
 
 /** @file arf.c  Atomic Read File */
@@ -48,8 +49,8 @@ int arf_encode_apdu(
     int apdu_len = 0;   /* total length of the apdu, return value */
 
     if (apdu) {
-        apdu[0] = PDU_TYPE_CONFIRMED_SERVICE_REQUEST;
-        apdu[1] = encode_max_segs_max_apdu(0, MAX_APDU);
+        apdu[0] = APDU_CONFIRMED_SERVICE_REQUEST;
+        apdu[1] = encode_max_segs_max_apdu(MAX_SEGMENTS_ACCEPTED, MAX_APDU);
         apdu[2] = invoke_id;
         apdu[3] = SERVICE_CONFIRMED_ATOMIC_READ_FILE;   /* service choice */
         apdu_len = 4;
@@ -181,7 +182,7 @@ int arf_decode_apdu(
     if (!apdu)
         return -1;
     /* optional checking - most likely was already done prior to this call */
-    if (apdu[0] != PDU_TYPE_CONFIRMED_SERVICE_REQUEST)
+    if ((apdu[0] & 0xF0) != PDU_TYPE_CONFIRMED_SERVICE_REQUEST)
         return -1;
     /*  apdu[1] = encode_max_segs_max_apdu(0, MAX_APDU); */
     *invoke_id = apdu[2];       /* invoke id - filled in by net layer */
@@ -350,6 +351,67 @@ int arf_ack_decode_service_request(
     return len;
 }
 
+/* decode the service request of a stream access ack only, without copying
+   the file data, which may be more than an octet string holds when the ack
+   came in segments. fileData points into the apdu. */
+int arf_ack_decode_stream(
+    uint8_t * apdu,
+    unsigned apdu_len,
+    bool * endOfFile,
+    int32_t * fileStartPosition,
+    uint8_t ** fileData,
+    uint32_t * fileDataLen)
+{
+    int len = 0;
+    int tag_len = 0;
+    uint8_t tag_number = 0;
+    uint32_t len_value_type = 0;
+
+    if (!apdu || (apdu_len < 1))
+        return -1;
+    tag_len =
+        decode_tag_number_and_value_safe(&apdu[0], apdu_len, &tag_number,
+        &len_value_type);
+    if ((tag_len <= 0) || (tag_number != BACNET_APPLICATION_TAG_BOOLEAN))
+        return -1;
+    *endOfFile = decode_boolean(len_value_type);
+    len = tag_len;
+    if (((unsigned) len >= apdu_len) ||
+        !decode_is_opening_tag_number(&apdu[len], 0))
+        return -1;
+    /* a tag number is not extended so only one octet */
+    len++;
+    /* fileStartPosition */
+    tag_len =
+        decode_tag_number_and_value_safe(&apdu[len], apdu_len - len,
+        &tag_number, &len_value_type);
+    if ((tag_len <= 0) || (tag_number != BACNET_APPLICATION_TAG_SIGNED_INT) ||
+        ((unsigned) (len + tag_len) + len_value_type > apdu_len))
+        return -1;
+    len += tag_len;
+    len += decode_signed(&apdu[len], len_value_type, fileStartPosition);
+    /* fileData */
+    if ((unsigned) len >= apdu_len)
+        return -1;
+    tag_len =
+        decode_tag_number_and_value_safe(&apdu[len], apdu_len - len,
+        &tag_number, &len_value_type);
+    if ((tag_len <= 0) || (tag_number != BACNET_APPLICATION_TAG_OCTET_STRING))
+        return -1;
+    len += tag_len;
+    /* the closing tag follows the data */
+    if ((unsigned) len + len_value_type >= apdu_len)
+        return -1;
+    *fileData = &apdu[len];
+    *fileDataLen = len_value_type;
+    len += (int) len_value_type;
+    if (!decode_is_closing_tag_number(&apdu[len], 0))
+        return -1;
+    len++;
+
+    return len;
+}
+
 int arf_ack_decode_apdu(
     uint8_t * apdu,
     unsigned apdu_len,
@@ -423,6 +485,53 @@ void testAtomicReadFileAckAccess(
             octetstring_length(&test_data.fileData)) == 0);
 }
 
+void testAtomicReadFileAckStream(
+    Test * pTest)
+{
+    BACNET_ATOMIC_READ_FILE_DATA data = { 0 };
+    uint8_t apdu[480] = { 0 };
+    uint8_t test_octet_string[32] = "Joshua-Mary-Anna-Christopher";
+    bool endOfFile = false;
+    int32_t fileStartPosition = 0;
+    uint8_t *fileData = NULL;
+    uint32_t fileDataLen = 0;
+    int apdu_len = 0;
+    int len = 0;
+    int i = 0;
+
+    data.endOfFile = true;
+    data.access = FILE_STREAM_ACCESS;
+    data.type.stream.fileStartPosition = 70000;
+    octetstring_init(&data.fileData, test_octet_string,
+        sizeof(test_octet_string));
+    apdu_len = arf_ack_encode_apdu(&apdu[0], 1, &data);
+    ct_test(pTest, apdu_len > 3);
+    /* the service request follows the invoke id and the service choice */
+    len =
+        arf_ack_decode_stream(&apdu[3], apdu_len - 3, &endOfFile,
+        &fileStartPosition, &fileData, &fileDataLen);
+    ct_test(pTest, len == (apdu_len - 3));
+    ct_test(pTest, endOfFile == true);
+    ct_test(pTest, fileStartPosition == 70000);
+    ct_test(pTest, fileDataLen == sizeof(test_octet_string));
+    ct_test(pTest, fileData == &apdu[apdu_len - 1 - sizeof(test_octet_string)]);
+    ct_test(pTest, memcmp(fileData, test_octet_string, fileDataLen) == 0);
+    /* cut short anywhere, it is not decoded */
+    for (i = 0; i < (apdu_len - 3); i++) {
+        len =
+            arf_ack_decode_stream(&apdu[3], i, &endOfFile,
+            &fileStartPosition, &fileData, &fileDataLen);
+        ct_test(pTest, len == -1);
+    }
+    /* nor is the record access */
+    data.access = FILE_RECORD_ACCESS;
+    apdu_len = arf_ack_encode_apdu(&apdu[0], 1, &data);
+    len =
+        arf_ack_decode_stream(&apdu[3], apdu_len - 3, &endOfFile,
+        &fileStartPosition, &fileData, &fileDataLen);
+    ct_test(pTest, len == -1);
+}
+
 void testAtomicReadFileAck(
     Test * pTest)
 {
@@ -520,6 +629,8 @@ int main(
     assert(rc);
     rc = ct_addTestFunction(pTest, testAtomicReadFileAck);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testAtomicReadFileAckStream);
+    assert(rc);
 
     ct_setStream(pTest, stdout);
     ct_run(pTest);
@@ -281,6 +281,166 @@ int bacapp_decode_data(
     return len;
 }
 
+/* The size of the application tagged value starting with this octet, if
+   its tag and length fit in the octet and it's a NULL, BOOLEAN, Unsigned,
+   Signed, REAL or Enumerated, else 0. These are most of the values of the
+   acks, and the same octet means the same tag and length. */
+static inline unsigned bacapp_fixed_size(
+    uint8_t octet)
+{
+    uint8_t len_value_type = octet & 0x07;
+
+    if (IS_CONTEXT_SPECIFIC(octet)) {
+        return 0;
+    }
+    switch (octet >> 4) {
+#if defined (BACAPP_NULL)
+        case BACNET_APPLICATION_TAG_NULL:
+            return (octet == 0) ? 1 : 0;
+#endif
+#if defined (BACAPP_BOOLEAN)
+        case BACNET_APPLICATION_TAG_BOOLEAN:
+            return (len_value_type <= 1) ? 1 : 0;
+#endif
+#if defined (BACAPP_UNSIGNED)
+        case BACNET_APPLICATION_TAG_UNSIGNED_INT:
+#endif
+#if defined (BACAPP_SIGNED)
+        case BACNET_APPLICATION_TAG_SIGNED_INT:
+#endif
+#if defined (BACAPP_ENUMERATED)
+        case BACNET_APPLICATION_TAG_ENUMERATED:
+#endif
+#if defined (BACAPP_UNSIGNED) || defined (BACAPP_SIGNED) || \
+    defined (BACAPP_ENUMERATED)
+            return (len_value_type && (len_value_type <= 4)) ?
+                1 + len_value_type : 0;
+#endif
+#if defined (BACAPP_REAL)
+        case BACNET_APPLICATION_TAG_REAL:
+            return (len_value_type == 4) ? 5 : 0;
+#endif
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+/* Decode the value of bacapp_fixed_size() octets at apdu, which are known
+   to be in the buffer, without the checks of the general decoders. */
+static inline void bacapp_decode_fixed(
+    uint8_t * apdu,
+    BACNET_APPLICATION_DATA_VALUE * value)
+{
+    uint8_t tag_number = apdu[0] >> 4;
+    uint8_t len_value_type = apdu[0] & 0x07;
+    uint32_t octets = 0;
+
+    /* the octets are read before anything is stored into the value, a
+       BOOLEAN has none */
+    switch ((tag_number == BACNET_APPLICATION_TAG_BOOLEAN) ? 0 :
+        len_value_type) {
+        case 4:
+            octets = ((uint32_t) apdu[1] << 24) | ((uint32_t) apdu[2] << 16) |
+                ((uint32_t) apdu[3] << 8) | apdu[4];
+            break;
+        case 3:
+            octets = ((uint32_t) apdu[1] << 16) | ((uint32_t) apdu[2] << 8) |
+                apdu[3];
+            break;
+        case 2:
+            octets = ((uint32_t) apdu[1] << 8) | apdu[2];
+            break;
+        case 1:
+            octets = apdu[1];
+            break;
+        default:
+            break;
+    }
+    value->tag = tag_number;
+    value->context_specific = false;
+    switch (tag_number) {
+#if defined (BACAPP_BOOLEAN)
+        case BACNET_APPLICATION_TAG_BOOLEAN:
+            /* the value is the length of the tag */
+            value->type.Boolean = (len_value_type == 1);
+            break;
+#endif
+#if defined (BACAPP_UNSIGNED)
+        case BACNET_APPLICATION_TAG_UNSIGNED_INT:
+            value->type.Unsigned_Int = octets;
+            break;
+#endif
+#if defined (BACAPP_SIGNED)
+        case BACNET_APPLICATION_TAG_SIGNED_INT:
+            /* sign extend the octets */
+            if ((len_value_type < 4) && (apdu[1] & 0x80)) {
+                octets |= 0xFFFFFFFFU << (len_value_type * 8);
+            }
+            value->type.Signed_Int = (int32_t) octets;
+            break;
+#endif
+#if defined (BACAPP_REAL)
+        case BACNET_APPLICATION_TAG_REAL:
+            /* NOTE: assumes the compiler stores float as IEEE-754 float */
+            memcpy(&value->type.Real, &octets, sizeof(float));
+            break;
+#endif
+#if defined (BACAPP_ENUMERATED)
+        case BACNET_APPLICATION_TAG_ENUMERATED:
+            value->type.Enumerated = octets;
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+unsigned bacapp_application_run_count(
+    uint8_t * apdu,
+    unsigned max_apdu_len)
+{
+    unsigned size = 0;
+    unsigned count = 0;
+    unsigned len = 0;
+
+    if (!apdu || !max_apdu_len) {
+        return 0;
+    }
+    size = bacapp_fixed_size(apdu[0]);
+    if (!size) {
+        return 0;
+    }
+    while ((len + size <= max_apdu_len) && (apdu[len] == apdu[0])) {
+        count++;
+        len += size;
+    }
+
+    return count;
+}
+
+int bacapp_decode_application_run(
+    uint8_t * apdu,
+    unsigned count,
+    BACNET_APPLICATION_DATA_VALUE * values)
+{
+    unsigned size = bacapp_fixed_size(apdu[0]);
+    unsigned i = 0;
+    int len = 0;
+
+    for (i = 0; i < count; i++) {
+        bacapp_decode_fixed(&apdu[len], &values[i]);
+        values[i].next = &values[i + 1];
+        len += size;
+    }
+    if (count) {
+        values[count - 1].next = NULL;
+    }
+
+    return len;
+}
+
 int bacapp_decode_application_data(
     uint8_t * apdu,
     unsigned max_apdu_len,
@@ -291,15 +451,25 @@ int bacapp_decode_application_data(
     int decode_len = 0;
     uint8_t tag_number = 0;
     uint32_t len_value_type = 0;
-
-    /* FIXME: use max_apdu_len! */
-    max_apdu_len = max_apdu_len;
-    if (apdu && value && !IS_CONTEXT_SPECIFIC(*apdu)) {
+    unsigned size = 0;
+
+    if (apdu && value && max_apdu_len && !IS_CONTEXT_SPECIFIC(*apdu)) {
+        /* the common values of a fixed size are checked and decoded
+           at once */
+        size = bacapp_fixed_size(apdu[0]);
+        if (size && (size <= max_apdu_len)) {
+            bacapp_decode_fixed(apdu, value);
+            value->next = NULL;
+            return (int) size;
+        }
         value->context_specific = false;
+        /* the tag and the data are checked against the buffer here,
+           so that the decoders of the data don't have to */
         tag_len =
-            decode_tag_number_and_value(&apdu[0], &tag_number,
-            &len_value_type);
-        if (tag_len) {
+            decode_tag_number_and_value_safe(&apdu[0], max_apdu_len,
+            &tag_number, &len_value_type);
+        if (tag_len && ((tag_number == BACNET_APPLICATION_TAG_BOOLEAN) ||
+                (len_value_type <= max_apdu_len - tag_len))) {
             len += tag_len;
             value->tag = tag_number;
             decode_len =
@@ -310,6 +480,9 @@ int bacapp_decode_application_data(
             } else {
                 len = BACNET_STATUS_ERROR;
             }
+        } else {
+            value->tag = MAX_BACNET_APPLICATION_TAG;
+            len = BACNET_STATUS_ERROR;
         }
         value->next = NULL;
     }
@@ -787,6 +960,370 @@ int bacapp_decode_context_data_len(
     return apdu_len;
 }
 
+/* bacapp_decode_data() for a view: the strings are left in the apdu */
+static int bacapp_decode_data_view(
+    uint8_t * apdu,
+    uint8_t tag_data_type,
+    uint32_t len_value_type,
+    BACNET_APPLICATION_DATA_VIEW * view)
+{
+    int len = 0;
+
+    switch (tag_data_type) {
+#if defined (BACAPP_NULL)
+        case BACNET_APPLICATION_TAG_NULL:
+            /* nothing else to do */
+            break;
+#endif
+#if defined (BACAPP_BOOLEAN)
+        case BACNET_APPLICATION_TAG_BOOLEAN:
+            view->type.Boolean = decode_boolean(len_value_type);
+            break;
+#endif
+#if defined (BACAPP_UNSIGNED)
+        case BACNET_APPLICATION_TAG_UNSIGNED_INT:
+            len =
+                decode_unsigned(&apdu[0], len_value_type,
+                &view->type.Unsigned_Int);
+            break;
+#endif
+#if defined (BACAPP_SIGNED)
+        case BACNET_APPLICATION_TAG_SIGNED_INT:
+            len =
+                decode_signed(&apdu[0], len_value_type,
+                &view->type.Signed_Int);
+            break;
+#endif
+#if defined (BACAPP_REAL)
+        case BACNET_APPLICATION_TAG_REAL:
+            len =
+                decode_real_safe(&apdu[0], len_value_type,
+                &view->type.Real);
+            break;
+#endif
+#if defined (BACAPP_DOUBLE)
+        case BACNET_APPLICATION_TAG_DOUBLE:
+            len =
+                decode_double_safe(&apdu[0], len_value_type,
+                &view->type.Double);
+            break;
+#endif
+#if defined (BACAPP_OCTET_STRING)
+        case BACNET_APPLICATION_TAG_OCTET_STRING:
+            len =
+                decode_octet_string_view(&apdu[0], len_value_type,
+                &view->type.String);
+            break;
+#endif
+#if defined (BACAPP_CHARACTER_STRING)
+        case BACNET_APPLICATION_TAG_CHARACTER_STRING:
+            len =
+                decode_character_string_view(&apdu[0], len_value_type,
+                &view->type.String);
+            break;
+#endif
+#if defined (BACAPP_BIT_STRING)
+        case BACNET_APPLICATION_TAG_BIT_STRING:
+            len =
+                decode_bitstring(&apdu[0], len_value_type,
+                &view->type.Bit_String);
+            break;
+#endif
+#if defined (BACAPP_ENUMERATED)
+        case BACNET_APPLICATION_TAG_ENUMERATED:
+            len =
+                decode_enumerated(&apdu[0], len_value_type,
+                &view->type.Enumerated);
+            break;
+#endif
+#if defined (BACAPP_DATE)
+        case BACNET_APPLICATION_TAG_DATE:
+            len =
+                decode_date_safe(&apdu[0], len_value_type, &view->type.Date);
+            break;
+#endif
+#if defined (BACAPP_TIME)
+        case BACNET_APPLICATION_TAG_TIME:
+            len =
+                decode_bacnet_time_safe(&apdu[0], len_value_type,
+                &view->type.Time);
+            break;
+#endif
+#if defined (BACAPP_OBJECT_ID)
+        case BACNET_APPLICATION_TAG_OBJECT_ID:
+            {
+                uint16_t object_type = 0;
+                uint32_t instance = 0;
+                len =
+                    decode_object_id_safe(&apdu[0], len_value_type,
+                    &object_type, &instance);
+                view->type.Object_Id.type = object_type;
+                view->type.Object_Id.instance = instance;
+            }
+            break;
+#endif
+        default:
+            break;
+    }
+    if ((len == 0) && (tag_data_type != BACNET_APPLICATION_TAG_NULL) &&
+        (tag_data_type != BACNET_APPLICATION_TAG_BOOLEAN) &&
+        (tag_data_type != BACNET_APPLICATION_TAG_OCTET_STRING)) {
+        /* indicate that we were not able to decode the value */
+        view->tag = MAX_BACNET_APPLICATION_TAG;
+    }
+
+    return len;
+}
+
+int bacapp_decode_application_view(
+    uint8_t * apdu,
+    unsigned max_apdu_len,
+    BACNET_APPLICATION_DATA_VIEW * view)
+{
+    int len = 0;
+    int tag_len = 0;
+    int decode_len = 0;
+    uint8_t tag_number = 0;
+    uint32_t len_value_type = 0;
+
+    if (apdu && view && max_apdu_len && !IS_CONTEXT_SPECIFIC(*apdu)) {
+        view->context_specific = false;
+        view->next = NULL;
+        /* the tag and the data are checked against the buffer here,
+           so that the decoders of the data don't have to */
+        tag_len =
+            decode_tag_number_and_value_safe(&apdu[0], max_apdu_len,
+            &tag_number, &len_value_type);
+        if (tag_len && ((tag_number == BACNET_APPLICATION_TAG_BOOLEAN) ||
+                (len_value_type <= max_apdu_len - tag_len))) {
+            len += tag_len;
+            view->tag = tag_number;
+            decode_len =
+                bacapp_decode_data_view(&apdu[len], tag_number,
+                len_value_type, view);
+            if (view->tag != MAX_BACNET_APPLICATION_TAG) {
+                len += decode_len;
+            } else {
+                len = BACNET_STATUS_ERROR;
+            }
+        } else {
+            view->tag = MAX_BACNET_APPLICATION_TAG;
+            len = BACNET_STATUS_ERROR;
+        }
+    }
+
+    return len;
+}
+
+int bacapp_decode_context_view(
+    uint8_t * apdu,
+    unsigned max_apdu_len,
+    BACNET_APPLICATION_DATA_VIEW * view,
+    BACNET_PROPERTY_ID property)
+{
+    int apdu_len = 0;
+    int tag_len = 0;
+    uint8_t tag_number = 0;
+    uint32_t len_value_type = 0;
+
+    if (apdu && view && max_apdu_len && IS_CONTEXT_SPECIFIC(*apdu)) {
+        view->context_specific = true;
+        view->next = NULL;
+        tag_len =
+            decode_tag_number_and_value_safe(&apdu[0], max_apdu_len,
+            &tag_number, &len_value_type);
+        apdu_len = tag_len;
+        /* Empty construct : (closing tag) => returns NULL value */
+        if (tag_len && !decode_is_closing_tag_number(&apdu[0], tag_number)) {
+            view->context_tag = tag_number;
+            view->tag = bacapp_context_tag_type(property, tag_number);
+            if (len_value_type > (max_apdu_len - tag_len)) {
+                apdu_len = BACNET_STATUS_ERROR;
+            } else if (view->tag < MAX_BACNET_APPLICATION_TAG) {
+                apdu_len +=
+                    bacapp_decode_data_view(&apdu[apdu_len], view->tag,
+                    len_value_type, view);
+            } else if (len_value_type) {
+                /* Unknown value : non null size (elementary type) */
+                apdu_len += len_value_type;
+            } else {
+                apdu_len = BACNET_STATUS_ERROR;
+            }
+        } else if (tag_len == 1)        /* and is a Closing tag */
+            apdu_len = 0;       /* Don't advance over that closing tag. */
+    }
+
+    return apdu_len;
+}
+
+bool bacapp_view_to_value(
+    BACNET_APPLICATION_DATA_VIEW * view,
+    BACNET_APPLICATION_DATA_VALUE * value)
+{
+    bool status = true; /* return value */
+
+    if (!view || !value) {
+        return false;
+    }
+    value->context_specific = view->context_specific;
+    value->context_tag = view->context_tag;
+    value->tag = view->tag;
+    value->next = NULL;
+    switch (view->tag) {
+#if defined (BACAPP_BOOLEAN)
+        case BACNET_APPLICATION_TAG_BOOLEAN:
+            value->type.Boolean = view->type.Boolean;
+            break;
+#endif
+#if defined (BACAPP_UNSIGNED)
+        case BACNET_APPLICATION_TAG_UNSIGNED_INT:
+            value->type.Unsigned_Int = view->type.Unsigned_Int;
+            break;
+#endif
+#if defined (BACAPP_SIGNED)
+        case BACNET_APPLICATION_TAG_SIGNED_INT:
+            value->type.Signed_Int = view->type.Signed_Int;
+            break;
+#endif
+#if defined (BACAPP_REAL)
+        case BACNET_APPLICATION_TAG_REAL:
+            value->type.Real = view->type.Real;
+            break;
+#endif
+#if defined (BACAPP_DOUBLE)
+        case BACNET_APPLICATION_TAG_DOUBLE:
+            value->type.Double = view->type.Double;
+            break;
+#endif
+#if defined (BACAPP_OCTET_STRING)
+        case BACNET_APPLICATION_TAG_OCTET_STRING:
+            status =
+                octetstring_init_view(&value->type.Octet_String,
+                &view->type.String);
+            break;
+#endif
+#if defined (BACAPP_CHARACTER_STRING)
+        case BACNET_APPLICATION_TAG_CHARACTER_STRING:
+            status =
+                characterstring_init_view(&value->type.Character_String,
+                &view->type.String);
+            break;
+#endif
+#if defined (BACAPP_BIT_STRING)
+        case BACNET_APPLICATION_TAG_BIT_STRING:
+            value->type.Bit_String = view->type.Bit_String;
+            break;
+#endif
+#if defined (BACAPP_ENUMERATED)
+        case BACNET_APPLICATION_TAG_ENUMERATED:
+            value->type.Enumerated = view->type.Enumerated;
+            break;
+#endif
+#if defined (BACAPP_DATE)
+        case BACNET_APPLICATION_TAG_DATE:
+            value->type.Date = view->type.Date;
+            break;
+#endif
+#if defined (BACAPP_TIME)
+        case BACNET_APPLICATION_TAG_TIME:
+            value->type.Time = view->type.Time;
+            break;
+#endif
+#if defined (BACAPP_OBJECT_ID)
+        case BACNET_APPLICATION_TAG_OBJECT_ID:
+            value->type.Object_Id = view->type.Object_Id;
+            break;
+#endif
+        default:
+            break;
+    }
+
+    return status;
+}
+
+void bacapp_value_to_view(
+    BACNET_APPLICATION_DATA_VALUE * value,
+    BACNET_APPLICATION_DATA_VIEW * view)
+{
+    if (!view || !value) {
+        return;
+    }
+    memset(view, 0, sizeof(BACNET_APPLICATION_DATA_VIEW));
+    view->context_specific = value->context_specific;
+    view->context_tag = value->context_tag;
+    view->tag = value->tag;
+    switch (value->tag) {
+#if defined (BACAPP_BOOLEAN)
+        case BACNET_APPLICATION_TAG_BOOLEAN:
+            view->type.Boolean = value->type.Boolean;
+            break;
+#endif
+#if defined (BACAPP_UNSIGNED)
+        case BACNET_APPLICATION_TAG_UNSIGNED_INT:
+            view->type.Unsigned_Int = value->type.Unsigned_Int;
+            break;
+#endif
+#if defined (BACAPP_SIGNED)
+        case BACNET_APPLICATION_TAG_SIGNED_INT:
+            view->type.Signed_Int = value->type.Signed_Int;
+            break;
+#endif
+#if defined (BACAPP_REAL)
+        case BACNET_APPLICATION_TAG_REAL:
+            view->type.Real = value->type.Real;
+            break;
+#endif
+#if defined (BACAPP_DOUBLE)
+        case BACNET_APPLICATION_TAG_DOUBLE:
+            view->type.Double = value->type.Double;
+            break;
+#endif
+#if defined (BACAPP_OCTET_STRING)
+        case BACNET_APPLICATION_TAG_OCTET_STRING:
+            stringview_init(&view->type.String, 0,
+                octetstring_value(&value->type.Octet_String),
+                octetstring_length(&value->type.Octet_String));
+            break;
+#endif
+#if defined (BACAPP_CHARACTER_STRING)
+        case BACNET_APPLICATION_TAG_CHARACTER_STRING:
+            stringview_init(&view->type.String,
+                characterstring_encoding(&value->type.Character_String),
+                (uint8_t *) characterstring_value(&value->type.
+                    Character_String),
+                characterstring_length(&value->type.Character_String));
+            break;
+#endif
+#if defined (BACAPP_BIT_STRING)
+        case BACNET_APPLICATION_TAG_BIT_STRING:
+            view->type.Bit_String = value->type.Bit_String;
+            break;
+#endif
+#if defined (BACAPP_ENUMERATED)
+        case BACNET_APPLICATION_TAG_ENUMERATED:
+            view->type.Enumerated = value->type.Enumerated;
+            break;
+#endif
+#if defined (BACAPP_DATE)
+        case BACNET_APPLICATION_TAG_DATE:
+            view->type.Date = value->type.Date;
+            break;
+#endif
+#if defined (BACAPP_TIME)
+        case BACNET_APPLICATION_TAG_TIME:
+            view->type.Time = value->type.Time;
+            break;
+#endif
+#if defined (BACAPP_OBJECT_ID)
+        case BACNET_APPLICATION_TAG_OBJECT_ID:
+            view->type.Object_Id = value->type.Object_Id;
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
 int bacapp_encode_data(
     uint8_t * apdu,
     BACNET_APPLICATION_DATA_VALUE * value)
@@ -2137,6 +2674,178 @@ void testBACnetApplicationData(
 }
 
 
+/* the runs of fixed size values decode the same as one value at a time */
+void testBACnetApplicationDataRun(
+    Test * pTest)
+{
+    uint8_t apdu[480] = { 0 };
+    BACNET_APPLICATION_DATA_VALUE values[BACNET_MAX_PRIORITY];
+    BACNET_APPLICATION_DATA_VALUE value;
+    int apdu_len = 0;
+    int len = 0;
+    unsigned count = 0;
+    unsigned i = 0;
+
+    /* a priority array of REALs, then an Unsigned */
+    for (i = 0; i < BACNET_MAX_PRIORITY; i++) {
+        apdu_len += encode_application_real(&apdu[apdu_len], i * 1.5f - 3);
+    }
+    apdu_len += encode_application_unsigned(&apdu[apdu_len], 42);
+    count = bacapp_application_run_count(apdu, apdu_len);
+    ct_test(pTest, count == BACNET_MAX_PRIORITY);
+    len = bacapp_decode_application_run(apdu, count, values);
+    ct_test(pTest, len == BACNET_MAX_PRIORITY * 5);
+    for (i = 0; i < BACNET_MAX_PRIORITY; i++) {
+        ct_test(pTest, values[i].tag == BACNET_APPLICATION_TAG_REAL);
+        ct_test(pTest, values[i].type.Real == i * 1.5f - 3);
+        ct_test(pTest, values[i].next ==
+            ((i + 1 < BACNET_MAX_PRIORITY) ? &values[i + 1] : NULL));
+    }
+    len = bacapp_decode_application_data(&apdu[len], apdu_len - len, &value);
+    ct_test(pTest, len == 2);
+    ct_test(pTest, value.tag == BACNET_APPLICATION_TAG_UNSIGNED_INT);
+    ct_test(pTest, value.type.Unsigned_Int == 42);
+    /* only the whole values in the buffer */
+    ct_test(pTest, bacapp_application_run_count(apdu, 12) == 2);
+    ct_test(pTest, bacapp_application_run_count(apdu, 4) == 0);
+
+    /* Unsigneds of another length end the run */
+    apdu_len = 0;
+    apdu_len += encode_application_unsigned(&apdu[apdu_len], 1000);
+    apdu_len += encode_application_unsigned(&apdu[apdu_len], 65535);
+    apdu_len += encode_application_unsigned(&apdu[apdu_len], 70000);
+    ct_test(pTest, bacapp_application_run_count(apdu, apdu_len) == 2);
+    len = bacapp_decode_application_run(apdu, 2, values);
+    ct_test(pTest, len == 6);
+    ct_test(pTest, values[0].type.Unsigned_Int == 1000);
+    ct_test(pTest, values[1].type.Unsigned_Int == 65535);
+    ct_test(pTest, bacapp_application_run_count(&apdu[len],
+            apdu_len - len) == 1);
+
+    /* NULLs, Signeds and Enumerateds */
+    apdu_len = 0;
+    apdu_len += encode_application_null(&apdu[apdu_len]);
+    apdu_len += encode_application_null(&apdu[apdu_len]);
+    apdu_len += encode_application_signed(&apdu[apdu_len], -300);
+    apdu_len += encode_application_enumerated(&apdu[apdu_len], 7);
+    ct_test(pTest, bacapp_application_run_count(apdu, apdu_len) == 2);
+    len = bacapp_decode_application_run(apdu, 2, values);
+    ct_test(pTest, len == 2);
+    ct_test(pTest, values[1].tag == BACNET_APPLICATION_TAG_NULL);
+    len += bacapp_decode_application_data(&apdu[len], apdu_len - len, &value);
+    ct_test(pTest, value.tag == BACNET_APPLICATION_TAG_SIGNED_INT);
+    ct_test(pTest, value.type.Signed_Int == -300);
+    len += bacapp_decode_application_data(&apdu[len], apdu_len - len, &value);
+    ct_test(pTest, value.tag == BACNET_APPLICATION_TAG_ENUMERATED);
+    ct_test(pTest, value.type.Enumerated == 7);
+    ct_test(pTest, len == apdu_len);
+
+    /* the values past the end of the buffer are refused */
+    apdu_len = encode_application_real(&apdu[0], 1.0f);
+    len = bacapp_decode_application_data(&apdu[0], apdu_len - 1, &value);
+    ct_test(pTest, len == BACNET_STATUS_ERROR);
+    apdu_len = encode_application_double(&apdu[0], 1.0);
+    len = bacapp_decode_application_data(&apdu[0], apdu_len - 1, &value);
+    ct_test(pTest, len == BACNET_STATUS_ERROR);
+    len = bacapp_decode_application_data(&apdu[0], apdu_len, &value);
+    ct_test(pTest, len == apdu_len);
+    ct_test(pTest, value.tag == BACNET_APPLICATION_TAG_DOUBLE);
+    /* the boolean is all in the tag */
+    apdu_len = encode_application_boolean(&apdu[0], true);
+    apdu_len += encode_application_boolean(&apdu[apdu_len], false);
+    len = bacapp_decode_application_data(&apdu[0], 1, &value);
+    ct_test(pTest, len == 1);
+    ct_test(pTest, value.type.Boolean == true);
+    len = bacapp_decode_application_data(&apdu[1], 1, &value);
+    ct_test(pTest, len == 1);
+    ct_test(pTest, value.type.Boolean == false);
+    ct_test(pTest, bacapp_application_run_count(apdu, apdu_len) == 1);
+    /* and the context tags are not application values */
+    apdu_len = encode_context_unsigned(&apdu[0], 2, 1000);
+    ct_test(pTest, bacapp_application_run_count(apdu, apdu_len) == 0);
+}
+
+void testBACnetApplicationDataView(
+    Test * pTest)
+{
+    uint8_t apdu[480] = { 0 };
+    BACNET_APPLICATION_DATA_VALUE values[6];
+    BACNET_APPLICATION_DATA_VALUE value;
+    BACNET_APPLICATION_DATA_VIEW view;
+    int apdu_len = 0;
+    int len = 0;
+    unsigned i = 0;
+
+    /* the view is much smaller than the value */
+    ct_test(pTest, sizeof(view) < 64);
+    memset(values, 0, sizeof(values));
+    values[0].tag = BACNET_APPLICATION_TAG_REAL;
+    values[0].type.Real = 12.5f;
+    values[1].tag = BACNET_APPLICATION_TAG_CHARACTER_STRING;
+    characterstring_init_ansi(&values[1].type.Character_String,
+        "Outside Air Temperature");
+    values[2].tag = BACNET_APPLICATION_TAG_OCTET_STRING;
+    octetstring_init(&values[2].type.Octet_String, apdu, 0);
+    values[3].tag = BACNET_APPLICATION_TAG_ENUMERATED;
+    values[3].type.Enumerated = 62;
+    values[4].tag = BACNET_APPLICATION_TAG_OBJECT_ID;
+    values[4].type.Object_Id.type = OBJECT_ANALOG_INPUT;
+    values[4].type.Object_Id.instance = 4194302;
+    values[5].tag = BACNET_APPLICATION_TAG_DATE;
+    datetime_set_date(&values[5].type.Date, 2017, 6, 30);
+    for (i = 0; i < 6; i++) {
+        apdu_len +=
+            bacapp_encode_application_data(&apdu[apdu_len], &values[i]);
+    }
+    for (i = 0, len = 0; i < 6; i++) {
+        int view_len =
+            bacapp_decode_application_view(&apdu[len], apdu_len - len, &view);
+        ct_test(pTest, view_len > 0);
+        ct_test(pTest, view.tag == values[i].tag);
+        ct_test(pTest, view.next == NULL);
+        ct_test(pTest, bacapp_view_to_value(&view, &value));
+        ct_test(pTest, bacapp_same_value(&value, &values[i]));
+        if (i == 1) {
+            /* the characters are where they were decoded from */
+            ct_test(pTest, view.type.String.value > &apdu[len]);
+            ct_test(pTest, view.type.String.value < &apdu[len + view_len]);
+            ct_test(pTest, characterstring_view_same(&view.type.String,
+                    &values[i].type.Character_String));
+        }
+        len += view_len;
+    }
+    ct_test(pTest, len == apdu_len);
+    /* and back to a view, with the strings in the value */
+    bacapp_value_to_view(&values[1], &view);
+    ct_test(pTest, view.type.String.value ==
+        (uint8_t *) characterstring_value(&values[1].type.Character_String));
+    ct_test(pTest, view.type.String.length == 23);
+    bacapp_value_to_view(&values[0], &view);
+    ct_test(pTest, view.type.Real == 12.5f);
+
+    /* a string cut off by the end of the buffer is refused */
+    apdu_len = bacapp_encode_application_data(&apdu[0], &values[1]);
+    len = bacapp_decode_application_view(&apdu[0], apdu_len - 1, &view);
+    ct_test(pTest, len == BACNET_STATUS_ERROR);
+    /* context tags take the type of the property */
+    apdu_len = encode_context_real(&apdu[0], 2, 3.5f);
+    len =
+        bacapp_decode_context_view(&apdu[0], apdu_len, &view,
+        PROP_REQUESTED_SHED_LEVEL);
+    ct_test(pTest, len == apdu_len);
+    ct_test(pTest, view.context_specific);
+    ct_test(pTest, view.context_tag == 2);
+    ct_test(pTest, view.tag == BACNET_APPLICATION_TAG_REAL);
+    ct_test(pTest, view.type.Real == 3.5f);
+    len =
+        bacapp_decode_context_view(&apdu[0], apdu_len - 1, &view,
+        PROP_REQUESTED_SHED_LEVEL);
+    ct_test(pTest, len == BACNET_STATUS_ERROR);
+    /* an application tag isn't context data, and the other way round */
+    ct_test(pTest, bacapp_decode_application_view(&apdu[0], apdu_len,
+            &view) == 0);
+}
+
 #ifdef TEST_BACNET_APPLICATION_DATA
 int main(
     void)
@@ -2152,6 +2861,10 @@ int main(
     assert(rc);
     rc = ct_addTestFunction(pTest, testBACnetApplicationData_Safe);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testBACnetApplicationDataRun);
+    assert(rc);
+    rc = ct_addTestFunction(pTest, testBACnetApplicationDataView);
+    assert(rc);
 
     ct_setStream(pTest, stdout);
     ct_run(pTest);
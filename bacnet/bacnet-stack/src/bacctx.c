@@ -0,0 +1,157 @@
+/*####COPYRIGHTBEGIN####
+ -------------------------------------------
+ Copyright (C) 2005 Steve Karg
+ Corrections by Ferran Arumi, 2007, Barcelona, Spain
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to:
+ The Free Software Foundation, Inc.
+ 59 Temple Place - Suite 330
+ Boston, MA  02111-1307, USA.
+
+ As a special exception, if other files instantiate templates or
+ use macros or inline functions from this file, or you compile
+ this file and link it with other works to produce a work based
+ on this file, this file does not by itself cause the resulting
+ work to be covered by the GNU General Public License. However
+ the source code for this file must still be made available in
+ accordance with section (3) of the GNU General Public License.
+
+ This exception does not invalidate any other reasons why a work
+ based on this file might be covered by the GNU General Public
+ License.
+ -------------------------------------------
+####COPYRIGHTEND####*/
+#include <stdbool.h>
+#include <stdlib.h>
+#include "bacctx.h"
+
+/** @file bacctx.c  BACnet context: per-instance stack state */
+
+#if defined(BACNET_CONTEXT_ENABLED)
+#if defined(_WIN32)
+#include <windows.h>
+typedef CRITICAL_SECTION CONTEXT_LOCK;
+#define context_lock_init(l) (InitializeCriticalSection(l), true)
+#define context_lock_destroy(l) DeleteCriticalSection(l)
+#define context_lock(l) EnterCriticalSection(l)
+#define context_unlock(l) LeaveCriticalSection(l)
+#else
+#include <pthread.h>
+typedef pthread_mutex_t CONTEXT_LOCK;
+static bool context_lock_init(
+    pthread_mutex_t * l)
+{
+    pthread_mutexattr_t attr;
+    bool status = false;
+
+    if (pthread_mutexattr_init(&attr) == 0) {
+        /* a handler may call back into the stack while holding it */
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        status = (pthread_mutex_init(l, &attr) == 0);
+        pthread_mutexattr_destroy(&attr);
+    }
+
+    return status;
+}
+
+#define context_lock_destroy(l) pthread_mutex_destroy(l)
+#define context_lock(l) pthread_mutex_lock(l)
+#define context_unlock(l) pthread_mutex_unlock(l)
+#endif
+
+struct bacnet_context {
+    CONTEXT_LOCK Lock;
+    void *TSM_State;
+    void *Address_State;
+    /* owning thread bookkeeping, only touched under Lock */
+    unsigned Depth;
+    BACNET_CONTEXT *Previous;
+};
+
+static BACNET_THREAD_LOCAL BACNET_CONTEXT *Current_Context = NULL;
+
+BACNET_CONTEXT *bacnet_context_create(
+    void)
+{
+    BACNET_CONTEXT *ctx = calloc(1, sizeof(BACNET_CONTEXT));
+
+    if (!ctx) {
+        return NULL;
+    }
+    ctx->TSM_State = tsm_state_create();
+    ctx->Address_State = address_state_create();
+    if (!ctx->TSM_State || !ctx->Address_State ||
+        !context_lock_init(&ctx->Lock)) {
+        tsm_state_destroy(ctx->TSM_State);
+        address_state_destroy(ctx->Address_State);
+        free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+void bacnet_context_destroy(
+    BACNET_CONTEXT * ctx)
+{
+    if (ctx) {
+        tsm_state_destroy(ctx->TSM_State);
+        address_state_destroy(ctx->Address_State);
+        context_lock_destroy(&ctx->Lock);
+        free(ctx);
+    }
+}
+
+void bacnet_context_enter(
+    BACNET_CONTEXT * ctx)
+{
+    if (ctx) {
+        context_lock(&ctx->Lock);
+        if (ctx->Depth++ == 0) {
+            ctx->Previous = Current_Context;
+        }
+        Current_Context = ctx;
+    }
+}
+
+void bacnet_context_leave(
+    BACNET_CONTEXT * ctx)
+{
+    if (ctx && ctx->Depth) {
+        if (--ctx->Depth == 0) {
+            Current_Context = ctx->Previous;
+            ctx->Previous = NULL;
+        }
+        context_unlock(&ctx->Lock);
+    }
+}
+
+BACNET_CONTEXT *bacnet_context_current(
+    void)
+{
+    return Current_Context;
+}
+
+void *bacnet_context_tsm_state(
+    void)
+{
+    return Current_Context ? Current_Context->TSM_State : NULL;
+}
+
+void *bacnet_context_address_state(
+    void)
+{
+    return Current_Context ? Current_Context->Address_State : NULL;
+}
+#endif
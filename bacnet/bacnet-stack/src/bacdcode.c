@@ -959,6 +959,16 @@ int decode_octet_string(
     return len;
 }
 
+int decode_octet_string_view(
+    uint8_t * apdu,
+    uint32_t len_value,
+    BACNET_STRING_VIEW * view)
+{
+    stringview_init(view, 0, &apdu[0], len_value);
+
+    return (int) len_value;
+}
+
 int decode_context_octet_string(
     uint8_t * apdu,
     uint8_t tag_number,
@@ -1044,6 +1054,33 @@ int encode_application_character_string(
     return len;
 }
 
+/* encodes the characters where they are kept, see BACNET_STRING_VIEW */
+int encode_application_character_string_view(
+    uint8_t * apdu,
+    BACNET_STRING_VIEW * view)
+{
+    int len = 0;
+    int string_len = 0;
+
+    if (!view) {
+        return 0;
+    }
+    string_len = (int) view->length + 1 /* for encoding */ ;
+    len =
+        encode_tag(&apdu[0], BACNET_APPLICATION_TAG_CHARACTER_STRING, false,
+        (uint32_t) string_len);
+    if ((len + string_len) < MAX_APDU) {
+        len +=
+            (int) encode_bacnet_character_string_safe(&apdu[len],
+            (uint32_t) string_len, view->encoding, (char *) view->value,
+            (uint32_t) view->length);
+    } else {
+        len = 0;
+    }
+
+    return len;
+}
+
 int encode_context_character_string(
     uint8_t * apdu,
     uint8_t tag_number,
@@ -1085,6 +1122,22 @@ int decode_character_string(
     return len;
 }
 
+int decode_character_string_view(
+    uint8_t * apdu,
+    uint32_t len_value,
+    BACNET_STRING_VIEW * view)
+{
+    int len = 0;        /* return value */
+
+    /* the encoding octet comes first */
+    if (len_value > 0) {
+        stringview_init(view, apdu[0], &apdu[1], len_value - 1);
+        len = (int) len_value;
+    }
+
+    return len;
+}
+
 int decode_context_character_string(
     uint8_t * apdu,
     uint8_t tag_number,
@@ -2233,6 +2286,7 @@ void testBACDCodeCharacterString(
     uint8_t encoded_array[MAX_APDU] = { 0 };
     BACNET_CHARACTER_STRING char_string;
     BACNET_CHARACTER_STRING test_char_string;
+    BACNET_STRING_VIEW view;
     char test_value[MAX_APDU] = { "" };
     int i;      /* for loop counter */
     int apdu_len;
@@ -2280,6 +2334,11 @@ void testBACDCodeCharacterString(
         }
         ct_test(pTest, diff == 0);
     }
+    /* the same octets from a view of the characters */
+    stringview_init_ansi(&view, test_value);
+    len = encode_application_character_string_view(&array[0], &view);
+    ct_test(pTest, len == apdu_len);
+    ct_test(pTest, memcmp(&array[0], &encoded_array[0], len) == 0);
 
     return;
 }
@@ -287,7 +287,6 @@ bool characterstring_init(
     size_t length)
 {
     bool status = false;        /* return value */
-    size_t i;   /* counter */
 
     if (char_string) {
         char_string->length = 0;
@@ -295,20 +294,14 @@ bool characterstring_init(
         /* save a byte at the end for NULL -
            note: assumes printable characters */
         if (length <= CHARACTER_STRING_CAPACITY) {
-            if (value) {
-                for (i = 0; i < MAX_CHARACTER_STRING_BYTES; i++) {
-                    if (i < length) {
-                        char_string->value[char_string->length] = value[i];
-                        char_string->length++;
-                    } else {
-                        char_string->value[i] = 0;
-                    }
-                }
-            } else {
-                for (i = 0; i < MAX_CHARACTER_STRING_BYTES; i++) {
-                    char_string->value[i] = 0;
-                }
+            if (!value) {
+                length = 0;
             }
+            /* the value may be in this string already */
+            memmove(char_string->value, value ? value : "", length);
+            memset(&char_string->value[length], 0,
+                MAX_CHARACTER_STRING_BYTES - length);
+            char_string->length = length;
             status = true;
         }
     }
@@ -694,23 +687,17 @@ bool octetstring_init(
     size_t length)
 {
     bool status = false;        /* return value */
-    size_t i;   /* counter */
 
     if (octet_string && (length <= MAX_OCTET_STRING_BYTES)) {
         octet_string->length = 0;
         if (value) {
-            for (i = 0; i < MAX_OCTET_STRING_BYTES; i++) {
-                if (i < length) {
-                    octet_string->value[i] = value[i];
-                } else {
-                    octet_string->value[i] = 0;
-                }
-            }
+            /* the value may be in this string already */
+            memmove(octet_string->value, value, length);
+            memset(&octet_string->value[length], 0,
+                MAX_OCTET_STRING_BYTES - length);
             octet_string->length = length;
         } else {
-            for (i = 0; i < MAX_OCTET_STRING_BYTES; i++) {
-                octet_string->value[i] = 0;
-            }
+            memset(octet_string->value, 0, MAX_OCTET_STRING_BYTES);
         }
         status = true;
     }
@@ -902,6 +889,67 @@ bool octetstring_value_same(
 }
 #endif
 
+void stringview_init(
+    BACNET_STRING_VIEW * view,
+    uint8_t encoding,
+    const uint8_t * value,
+    size_t length)
+{
+    if (view) {
+        view->length = value ? length : 0;
+        view->encoding = encoding;
+        view->value = value;
+    }
+}
+
+void stringview_init_ansi(
+    BACNET_STRING_VIEW * view,
+    const char *value)
+{
+    stringview_init(view, CHARACTER_ANSI_X34, (const uint8_t *) value,
+        value ? strlen(value) : 0);
+}
+
+bool characterstring_init_view(
+    BACNET_CHARACTER_STRING * char_string,
+    BACNET_STRING_VIEW * view)
+{
+    if (!view) {
+        return false;
+    }
+
+    return characterstring_init(char_string, view->encoding,
+        (const char *) view->value, view->length);
+}
+
+bool octetstring_init_view(
+    BACNET_OCTET_STRING * octet_string,
+    BACNET_STRING_VIEW * view)
+{
+    if (!view) {
+        return false;
+    }
+
+    return octetstring_init(octet_string, (uint8_t *) view->value,
+        view->length);
+}
+
+bool characterstring_view_same(
+    BACNET_STRING_VIEW * view,
+    BACNET_CHARACTER_STRING * char_string)
+{
+    if (!view || !char_string) {
+        return false;
+    }
+    if ((view->length != char_string->length) ||
+        (view->encoding != char_string->encoding)) {
+        return false;
+    }
+
+    return (view->length == 0) ||
+        (memcmp(view->value, char_string->value, view->length) == 0);
+}
+
 #ifdef TEST
 #include <assert.h>
 #include <string.h>
@@ -1095,6 +1143,53 @@ void testOctetString(
     }
 }
 
+void testStringView(
+    Test * pTest)
+{
+    BACNET_STRING_VIEW view;
+    BACNET_CHARACTER_STRING bacnet_string;
+    BACNET_OCTET_STRING octet_string;
+    /* the encoding and the octets, as they are in an APDU */
+    uint8_t apdu[] = { CHARACTER_ANSI_X34, 'B', 'A', 'C', 'n', 'e', 't' };
+    bool status = false;
+
+    stringview_init(&view, apdu[0], &apdu[1], sizeof(apdu) - 1);
+    ct_test(pTest, view.length == 6);
+    ct_test(pTest, view.value == &apdu[1]);
+    status = characterstring_init_view(&bacnet_string, &view);
+    ct_test(pTest, status == true);
+    ct_test(pTest, characterstring_length(&bacnet_string) == 6);
+    ct_test(pTest, strcmp(characterstring_value(&bacnet_string),
+            "BACnet") == 0);
+    ct_test(pTest, characterstring_view_same(&view, &bacnet_string));
+    /* the view follows the buffer, the copy does not */
+    apdu[1] = 'b';
+    ct_test(pTest, !characterstring_view_same(&view, &bacnet_string));
+    characterstring_init(&bacnet_string, CHARACTER_MS_DBCS, "bACnet", 6);
+    ct_test(pTest, !characterstring_view_same(&view, &bacnet_string));
+    status = octetstring_init_view(&octet_string, &view);
+    ct_test(pTest, status == true);
+    ct_test(pTest, octetstring_length(&octet_string) == 6);
+    ct_test(pTest, memcmp(octetstring_value(&octet_string), &apdu[1],
+            6) == 0);
+    /* an empty view */
+    stringview_init(&view, CHARACTER_UTF8, NULL, 10);
+    ct_test(pTest, view.length == 0);
+    status = characterstring_init_view(&bacnet_string, &view);
+    ct_test(pTest, status == true);
+    ct_test(pTest, characterstring_length(&bacnet_string) == 0);
+    ct_test(pTest, characterstring_view_same(&view, &bacnet_string));
+    ct_test(pTest, characterstring_init_view(&bacnet_string, NULL) == false);
+    /* a name kept by its object */
+    stringview_init_ansi(&view, "ANALOG INPUT 1");
+    ct_test(pTest, view.length == 14);
+    ct_test(pTest, view.encoding == CHARACTER_ANSI_X34);
+    characterstring_init_ansi(&bacnet_string, "ANALOG INPUT 1");
+    ct_test(pTest, characterstring_view_same(&view, &bacnet_string));
+    stringview_init_ansi(&view, NULL);
+    ct_test(pTest, view.length == 0);
+}
+
 #ifdef TEST_BACSTR
 int main(
     void)
@@ -1110,6 +1205,8 @@ int main(
     assert(rc);
     rc = ct_addTestFunction(pTest, testOctetString);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testStringView);
+    assert(rc);
     /* configure output */
     ct_setStream(pTest, stdout);
     ct_run(pTest);
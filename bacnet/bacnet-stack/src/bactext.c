@@ -78,10 +78,14 @@ INDTEXT_DATA bacnet_confirmed_service_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_confirmed_service_names_hash =
+    INDTEXT_HASH_INIT(bacnet_confirmed_service_names);
+
 const char *bactext_confirmed_service_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_confirmed_service_names, index,
+    return indtext_hash_by_index_default(&bacnet_confirmed_service_names_hash,
+        index,
         ASHRAE_Reserved_String);
 }
 
@@ -113,10 +117,14 @@ INDTEXT_DATA bacnet_unconfirmed_service_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_unconfirmed_service_names_hash =
+    INDTEXT_HASH_INIT(bacnet_unconfirmed_service_names);
+
 const char *bactext_unconfirmed_service_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_unconfirmed_service_names, index,
+    return indtext_hash_by_index_default(&bacnet_unconfirmed_service_names_hash,
+        index,
         ASHRAE_Reserved_String);
 }
 
@@ -156,10 +164,14 @@ INDTEXT_DATA bacnet_application_tag_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_application_tag_names_hash =
+    INDTEXT_HASH_INIT(bacnet_application_tag_names);
+
 const char *bactext_application_tag_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_application_tag_names, index,
+    return indtext_hash_by_index_default(&bacnet_application_tag_names_hash,
+        index,
         ASHRAE_Reserved_String);
 }
 
@@ -167,7 +179,8 @@ bool bactext_application_tag_index(
     const char *search_name,
     unsigned *found_index)
 {
-    return indtext_by_istring(bacnet_application_tag_names, search_name,
+    return indtext_hash_by_istring(&bacnet_application_tag_names_hash,
+        search_name,
         found_index);
 }
 
@@ -288,10 +301,14 @@ INDTEXT_DATA bacnet_object_type_names[] = {
        the procedures and constraints described in Clause 23. */
 };
 
+static INDTEXT_HASH bacnet_object_type_names_hash =
+    INDTEXT_HASH_INIT(bacnet_object_type_names);
+
 const char *bactext_object_type_name(
     unsigned index)
 {
-    return indtext_by_index_split_default(bacnet_object_type_names, index, 128,
+    return indtext_hash_by_index_split_default(&bacnet_object_type_names_hash,
+        index, 128,
         ASHRAE_Reserved_String, Vendor_Proprietary_String);
 }
 
@@ -299,7 +316,7 @@ bool bactext_object_type_index(
     const char *search_name,
     unsigned *found_index)
 {
-    return indtext_by_istring(bacnet_object_type_names, search_name,
+    return indtext_hash_by_istring(&bacnet_object_type_names_hash, search_name,
         found_index);
 }
 
@@ -1040,24 +1057,30 @@ INDTEXT_DATA bacnet_property_names[] = {
        procedures and constraints described in Clause 23. */
 };
 
+static INDTEXT_HASH bacnet_property_names_hash =
+    INDTEXT_HASH_INIT(bacnet_property_names);
+
 const char *bactext_property_name(
     unsigned index)
 {
-    return indtext_by_index_split_default(bacnet_property_names, index, 512,
+    return indtext_hash_by_index_split_default(&bacnet_property_names_hash,
+        index, 512,
         ASHRAE_Reserved_String, Vendor_Proprietary_String);
 }
 
 unsigned bactext_property_id(
     const char *name)
 {
-    return indtext_by_istring_default(bacnet_property_names, name, 0);
+    return indtext_hash_by_istring_default(&bacnet_property_names_hash,
+        name, 0);
 }
 
 bool bactext_property_index(
     const char *search_name,
     unsigned *found_index)
 {
-    return indtext_by_istring(bacnet_property_names, search_name, found_index);
+    return indtext_hash_by_istring(&bacnet_property_names_hash,
+        search_name, found_index);
 }
 
 INDTEXT_DATA bacnet_engineering_unit_names[] = {
@@ -1454,10 +1477,14 @@ INDTEXT_DATA bacnet_engineering_unit_names[] = {
    the procedures and constraints described in Clause 23. */
 };
 
+static INDTEXT_HASH bacnet_engineering_unit_names_hash =
+    INDTEXT_HASH_INIT(bacnet_engineering_unit_names);
+
 const char *bactext_engineering_unit_name(
     unsigned index)
 {
-    return indtext_by_index_split_default(bacnet_engineering_unit_names, index,
+    return indtext_hash_by_index_split_default(&bacnet_engineering_unit_names_hash,
+        index,
         256, ASHRAE_Reserved_String, Vendor_Proprietary_String);
 }
 
@@ -1465,7 +1492,8 @@ bool bactext_engineering_unit_index(
     const char *search_name,
     unsigned *found_index)
 {
-    return indtext_by_istring(bacnet_engineering_unit_names, search_name,
+    return indtext_hash_by_istring(&bacnet_engineering_unit_names_hash,
+        search_name,
         found_index);
 }
 
@@ -1494,10 +1522,14 @@ INDTEXT_DATA bacnet_reject_reason_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_reject_reason_names_hash =
+    INDTEXT_HASH_INIT(bacnet_reject_reason_names);
+
 const char *bactext_reject_reason_name(
     unsigned index)
 {
-    return indtext_by_index_split_default(bacnet_reject_reason_names, index,
+    return indtext_hash_by_index_split_default(&bacnet_reject_reason_names_hash,
+        index,
         FIRST_PROPRIETARY_REJECT_REASON, ASHRAE_Reserved_String,
         Vendor_Proprietary_String);
 }
@@ -1517,10 +1549,14 @@ INDTEXT_DATA bacnet_abort_reason_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_abort_reason_names_hash =
+    INDTEXT_HASH_INIT(bacnet_abort_reason_names);
+
 const char *bactext_abort_reason_name(
     unsigned index)
 {
-    return indtext_by_index_split_default(bacnet_abort_reason_names, index,
+    return indtext_hash_by_index_split_default(&bacnet_abort_reason_names_hash,
+        index,
         FIRST_PROPRIETARY_ABORT_REASON, ASHRAE_Reserved_String,
         Vendor_Proprietary_String);
 }
@@ -1543,10 +1579,14 @@ INDTEXT_DATA bacnet_error_class_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_error_class_names_hash =
+    INDTEXT_HASH_INIT(bacnet_error_class_names);
+
 const char *bactext_error_class_name(
     unsigned index)
 {
-    return indtext_by_index_split_default(bacnet_error_class_names, index,
+    return indtext_hash_by_index_split_default(&bacnet_error_class_names_hash,
+        index,
         FIRST_PROPRIETARY_ERROR_CLASS, ASHRAE_Reserved_String,
         Vendor_Proprietary_String);
 }
@@ -1795,10 +1835,14 @@ INDTEXT_DATA bacnet_error_code_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_error_code_names_hash =
+    INDTEXT_HASH_INIT(bacnet_error_code_names);
+
 const char *bactext_error_code_name(
     unsigned index)
 {
-    return indtext_by_index_split_default(bacnet_error_code_names, index,
+    return indtext_hash_by_index_split_default(&bacnet_error_code_names_hash,
+        index,
         FIRST_PROPRIETARY_ERROR_CLASS, ASHRAE_Reserved_String,
         Vendor_Proprietary_String);
 }
@@ -1837,10 +1881,13 @@ INDTEXT_DATA bacnet_month_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_month_names_hash =
+    INDTEXT_HASH_INIT(bacnet_month_names);
+
 const char *bactext_month_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_month_names, index,
+    return indtext_hash_by_index_default(&bacnet_month_names_hash, index,
         ASHRAE_Reserved_String);
 }
 
@@ -1862,10 +1909,14 @@ INDTEXT_DATA bacnet_week_of_month_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_week_of_month_names_hash =
+    INDTEXT_HASH_INIT(bacnet_week_of_month_names);
+
 const char *bactext_week_of_month_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_week_of_month_names, index,
+    return indtext_hash_by_index_default(&bacnet_week_of_month_names_hash,
+        index,
         ASHRAE_Reserved_String);
 }
 
@@ -1890,10 +1941,13 @@ INDTEXT_DATA bacnet_day_of_week_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_day_of_week_names_hash =
+    INDTEXT_HASH_INIT(bacnet_day_of_week_names);
+
 const char *bactext_day_of_week_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_day_of_week_names, index,
+    return indtext_hash_by_index_default(&bacnet_day_of_week_names_hash, index,
         ASHRAE_Reserved_String);
 }
 
@@ -1916,10 +1970,13 @@ INDTEXT_DATA bacnet_days_of_week_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_days_of_week_names_hash =
+    INDTEXT_HASH_INIT(bacnet_days_of_week_names);
+
 const char *bactext_days_of_week_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_days_of_week_names, index,
+    return indtext_hash_by_index_default(&bacnet_days_of_week_names_hash, index,
         ASHRAE_Reserved_String);
 }
 
@@ -1927,7 +1984,7 @@ bool bactext_days_of_week_index(
     const char *search_name,
     unsigned *found_index)
 {
-    return indtext_by_istring(bacnet_days_of_week_names, search_name,
+    return indtext_hash_by_istring(&bacnet_days_of_week_names_hash, search_name,
         found_index);
 }
 
@@ -1941,10 +1998,14 @@ INDTEXT_DATA bacnet_event_transition_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_event_transition_names_hash =
+    INDTEXT_HASH_INIT(bacnet_event_transition_names);
+
 const char *bactext_event_transition_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_event_transition_names, index,
+    return indtext_hash_by_index_default(&bacnet_event_transition_names_hash,
+        index,
         ASHRAE_Reserved_String);
 }
 
@@ -1952,7 +2013,8 @@ bool bactext_event_transition_index(
     const char *search_name,
     unsigned *found_index)
 {
-    return indtext_by_istring(bacnet_event_transition_names, search_name,
+    return indtext_hash_by_istring(&bacnet_event_transition_names_hash,
+        search_name,
         found_index);
 }
 
@@ -1970,10 +2032,13 @@ INDTEXT_DATA bacnet_event_state_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_event_state_names_hash =
+    INDTEXT_HASH_INIT(bacnet_event_state_names);
+
 const char *bactext_event_state_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_event_state_names, index,
+    return indtext_hash_by_index_default(&bacnet_event_state_names_hash, index,
         ASHRAE_Reserved_String);
 }
 
@@ -1985,10 +2050,14 @@ INDTEXT_DATA bacnet_binary_present_value_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_binary_present_value_names_hash =
+    INDTEXT_HASH_INIT(bacnet_binary_present_value_names);
+
 const char *bactext_binary_present_value_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_binary_present_value_names, index,
+    return indtext_hash_by_index_default(&bacnet_binary_present_value_names_hash,
+        index,
         ASHRAE_Reserved_String);
 }
 
@@ -1996,7 +2065,8 @@ bool bactext_binary_present_value_index(
     const char *search_name,
     unsigned *found_index)
 {
-    return indtext_by_istring(bacnet_binary_present_value_names, search_name,
+    return indtext_hash_by_istring(&bacnet_binary_present_value_names_hash,
+        search_name,
         found_index);
 }
 
@@ -2008,10 +2078,14 @@ INDTEXT_DATA bacnet_binary_polarity_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_binary_polarity_names_hash =
+    INDTEXT_HASH_INIT(bacnet_binary_polarity_names);
+
 const char *bactext_binary_polarity_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_binary_polarity_names, index,
+    return indtext_hash_by_index_default(&bacnet_binary_polarity_names_hash,
+        index,
         ASHRAE_Reserved_String);
 }
 
@@ -2048,10 +2122,13 @@ INDTEXT_DATA bacnet_reliability_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_reliability_names_hash =
+    INDTEXT_HASH_INIT(bacnet_reliability_names);
+
 const char *bactext_reliability_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_reliability_names, index,
+    return indtext_hash_by_index_default(&bacnet_reliability_names_hash, index,
         ASHRAE_Reserved_String);
 }
 
@@ -2071,10 +2148,14 @@ INDTEXT_DATA bacnet_device_status_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_device_status_names_hash =
+    INDTEXT_HASH_INIT(bacnet_device_status_names);
+
 const char *bactext_device_status_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_device_status_names, index,
+    return indtext_hash_by_index_default(&bacnet_device_status_names_hash,
+        index,
         ASHRAE_Reserved_String);
 }
 
@@ -2090,10 +2171,13 @@ INDTEXT_DATA bacnet_segmentation_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_segmentation_names_hash =
+    INDTEXT_HASH_INIT(bacnet_segmentation_names);
+
 const char *bactext_segmentation_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_segmentation_names, index,
+    return indtext_hash_by_index_default(&bacnet_segmentation_names_hash, index,
         ASHRAE_Reserved_String);
 }
 
@@ -2101,7 +2185,7 @@ bool bactext_segmentation_index(
     const char *search_name,
     unsigned *found_index)
 {
-    return indtext_by_istring(bacnet_segmentation_names, search_name,
+    return indtext_hash_by_istring(&bacnet_segmentation_names_hash, search_name,
         found_index);
 }
 
@@ -2133,10 +2217,13 @@ INDTEXT_DATA bacnet_node_type_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH bacnet_node_type_names_hash =
+    INDTEXT_HASH_INIT(bacnet_node_type_names);
+
 const char *bactext_node_type_name(
     unsigned index)
 {
-    return indtext_by_index_default(bacnet_node_type_names, index,
+    return indtext_hash_by_index_default(&bacnet_node_type_names_hash, index,
         ASHRAE_Reserved_String);
 }
 
@@ -2165,11 +2252,15 @@ INDTEXT_DATA network_layer_msg_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH network_layer_msg_names_hash =
+    INDTEXT_HASH_INIT(network_layer_msg_names);
+
 const char *bactext_network_layer_msg_name(
     unsigned index)
 {
     if (index <= 0x7F)
-        return indtext_by_index_default(network_layer_msg_names, index,
+        return indtext_hash_by_index_default(&network_layer_msg_names_hash,
+            index,
             ASHRAE_Reserved_String);
     else if (index < NETWORK_MESSAGE_INVALID)
         return Vendor_Proprietary_String;
@@ -2229,11 +2320,15 @@ INDTEXT_DATA life_safety_state_names[] = {
     {0, NULL}
 };
 
+static INDTEXT_HASH life_safety_state_names_hash =
+    INDTEXT_HASH_INIT(life_safety_state_names);
+
 const char *bactext_life_safety_state_name(
         unsigned index)
 {
 	if (index < MAX_LIFE_SAFETY_STATE)
-        return indtext_by_index_default(life_safety_state_names, index,
+        return indtext_hash_by_index_default(&life_safety_state_names_hash,
+            index,
             ASHRAE_Reserved_String);
     else
         return "Invalid Safety State Message";
@@ -2253,11 +2348,14 @@ INDTEXT_DATA lighting_in_progress[] = {
 		{ 0, NULL }
 };
 
+static INDTEXT_HASH lighting_in_progress_hash =
+    INDTEXT_HASH_INIT(lighting_in_progress);
+
 const char *bactext_lighting_in_progress(
 	unsigned index)
 {
 	if (index < MAX_BACNET_LIGHTING_IN_PROGRESS)
-		return indtext_by_index_default(lighting_in_progress, index,
+		return indtext_hash_by_index_default(&lighting_in_progress_hash, index,
 		ASHRAE_Reserved_String);
 	else
 		return "Invalid Lighting In Progress Message";
@@ -2273,11 +2371,14 @@ INDTEXT_DATA lighting_transition[] = {
 		{ 0, NULL }
 };
 
+static INDTEXT_HASH lighting_transition_hash =
+    INDTEXT_HASH_INIT(lighting_transition);
+
 const char *bactext_lighting_transition(
 	unsigned index)
 {
 	if (index < MAX_BACNET_LIGHTING_TRANSITION)
-		return indtext_by_index_default(lighting_transition, index,
+		return indtext_hash_by_index_default(&lighting_transition_hash, index,
 		ASHRAE_Reserved_String);
 	else
 		return "Invalid Lighting Transition Message";
@@ -2313,10 +2414,43 @@ const char *bactext_lighting_operation_name(
     unsigned index)
 {
     if (index < BACNET_LIGHTS_PROPRIETARY_FIRST)
-        return indtext_by_index_default(network_layer_msg_names, index,
+        return indtext_hash_by_index_default(&network_layer_msg_names_hash,
+            index,
             ASHRAE_Reserved_String);
     else if (index <= BACNET_LIGHTS_PROPRIETARY_LAST)
         return Vendor_Proprietary_String;
     else
         return "Invalid BACnetLightingOperation";
 }
+
+/* build the hash indexes of all the tables, before the threads use them */
+void bactext_init(
+    void)
+{
+    indtext_hash_build(&bacnet_confirmed_service_names_hash);
+    indtext_hash_build(&bacnet_unconfirmed_service_names_hash);
+    indtext_hash_build(&bacnet_application_tag_names_hash);
+    indtext_hash_build(&bacnet_object_type_names_hash);
+    indtext_hash_build(&bacnet_property_names_hash);
+    indtext_hash_build(&bacnet_engineering_unit_names_hash);
+    indtext_hash_build(&bacnet_reject_reason_names_hash);
+    indtext_hash_build(&bacnet_abort_reason_names_hash);
+    indtext_hash_build(&bacnet_error_class_names_hash);
+    indtext_hash_build(&bacnet_error_code_names_hash);
+    indtext_hash_build(&bacnet_month_names_hash);
+    indtext_hash_build(&bacnet_week_of_month_names_hash);
+    indtext_hash_build(&bacnet_day_of_week_names_hash);
+    indtext_hash_build(&bacnet_days_of_week_names_hash);
+    indtext_hash_build(&bacnet_event_transition_names_hash);
+    indtext_hash_build(&bacnet_event_state_names_hash);
+    indtext_hash_build(&bacnet_binary_present_value_names_hash);
+    indtext_hash_build(&bacnet_binary_polarity_names_hash);
+    indtext_hash_build(&bacnet_reliability_names_hash);
+    indtext_hash_build(&bacnet_device_status_names_hash);
+    indtext_hash_build(&bacnet_segmentation_names_hash);
+    indtext_hash_build(&bacnet_node_type_names_hash);
+    indtext_hash_build(&network_layer_msg_names_hash);
+    indtext_hash_build(&life_safety_state_names_hash);
+    indtext_hash_build(&lighting_in_progress_hash);
+    indtext_hash_build(&lighting_transition_hash);
+}
@@ -0,0 +1,315 @@
+/*####COPYRIGHTBEGIN####
+ -------------------------------------------
+ Copyright (C) 2005 Steve Karg
+ Corrections by Ferran Arumi, 2007, Barcelona, Spain
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to:
+ The Free Software Foundation, Inc.
+ 59 Temple Place - Suite 330
+ Boston, MA  02111-1307, USA.
+
+ As a special exception, if other files instantiate templates or
+ use macros or inline functions from this file, or you compile
+ this file and link it with other works to produce a work based
+ on this file, this file does not by itself cause the resulting
+ work to be covered by the GNU General Public License. However
+ the source code for this file must still be made available in
+ accordance with section (3) of the GNU General Public License.
+
+ This exception does not invalidate any other reasons why a work
+ based on this file might be covered by the GNU General Public
+ License.
+ -------------------------------------------
+####COPYRIGHTEND####*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "bactimer.h"
+
+/** @file bactimer.c  Timer service for the periodic maintenance */
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/* the timers waiting, the earliest first */
+static BACNET_TIMER *Timer_List;
+
+uint32_t bactimer_milliseconds(
+    void)
+{
+#if defined(_WIN32)
+    return (uint32_t) GetTickCount();
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint32_t) now.tv_sec * 1000 + (uint32_t) (now.tv_nsec / 1000000);
+#endif
+}
+
+/* the clock wraps around, the deadlines are compared by their distance */
+static bool bactimer_before(
+    uint32_t a,
+    uint32_t b)
+{
+    return (int32_t) (a - b) < 0;
+}
+
+static void bactimer_insert(
+    BACNET_TIMER * timer)
+{
+    BACNET_TIMER **next = &Timer_List;
+
+    while (*next && !bactimer_before(timer->Due, (*next)->Due)) {
+        next = &(*next)->Next;
+    }
+    timer->Next = *next;
+    *next = timer;
+    timer->Waiting = true;
+}
+
+static void bactimer_remove(
+    BACNET_TIMER * timer)
+{
+    BACNET_TIMER **next = &Timer_List;
+
+    while (*next && (*next != timer)) {
+        next = &(*next)->Next;
+    }
+    if (*next) {
+        *next = timer->Next;
+    }
+    timer->Next = NULL;
+    timer->Waiting = false;
+}
+
+void bactimer_register(
+    BACNET_TIMER * timer,
+    bactimer_function function,
+    uint32_t now,
+    uint32_t delay)
+{
+    if (!timer || !function) {
+        return;
+    }
+    if (timer->Function && timer->Waiting) {
+        bactimer_remove(timer);
+    }
+    timer->Function = function;
+    timer->Last = now;
+    timer->Waiting = false;
+    timer->Next = NULL;
+    if (delay != BACTIMER_IDLE) {
+        timer->Due = now + delay;
+        bactimer_insert(timer);
+    }
+}
+
+void bactimer_unregister(
+    BACNET_TIMER * timer)
+{
+    if (!timer || !timer->Function) {
+        return;
+    }
+    if (timer->Waiting) {
+        bactimer_remove(timer);
+    }
+    timer->Function = NULL;
+}
+
+void bactimer_due(
+    BACNET_TIMER * timer,
+    uint32_t now,
+    uint32_t delay)
+{
+    if (!timer || !timer->Function || (delay == BACTIMER_IDLE)) {
+        return;
+    }
+    if (timer->Waiting) {
+        if (!bactimer_before(now + delay, timer->Due)) {
+            return;
+        }
+        bactimer_remove(timer);
+    } else {
+        /* nothing was due while it was idle, its clock starts again */
+        timer->Last = now;
+    }
+    timer->Due = now + delay;
+    bactimer_insert(timer);
+}
+
+uint32_t bactimer_next(
+    uint32_t now)
+{
+    if (!Timer_List) {
+        return BACTIMER_IDLE;
+    }
+    if (!bactimer_before(now, Timer_List->Due)) {
+        return 0;
+    }
+
+    return Timer_List->Due - now;
+}
+
+uint32_t bactimer_run(
+    uint32_t now)
+{
+    BACNET_TIMER *due = NULL;
+    BACNET_TIMER *timer = NULL;
+    uint32_t delay = 0;
+
+    /* the timers due are taken off first, so that one due again at */
+    /* once waits for the next run */
+    while (Timer_List && !bactimer_before(now, Timer_List->Due)) {
+        timer = Timer_List;
+        Timer_List = timer->Next;
+        timer->Waiting = false;
+        timer->Next = due;
+        due = timer;
+    }
+    while (due) {
+        timer = due;
+        due = timer->Next;
+        timer->Next = NULL;
+        if (!timer->Function) {
+            continue;
+        }
+        delay = timer->Function(now - timer->Last);
+        timer->Last = now;
+        /* it may have been woken, or unregistered, by its own function */
+        if (timer->Function && (delay != BACTIMER_IDLE)) {
+            if (timer->Waiting) {
+                if (!bactimer_before(now + delay, timer->Due)) {
+                    continue;
+                }
+                bactimer_remove(timer);
+            }
+            timer->Due = now + delay;
+            bactimer_insert(timer);
+        }
+    }
+
+    return bactimer_next(now);
+}
+
+#ifdef TEST
+#include <assert.h>
+#include "ctest.h"
+
+static unsigned Fast_Runs;
+static uint32_t Fast_Elapsed;
+static unsigned Slow_Runs;
+static unsigned Once_Runs;
+
+static uint32_t fast_timer(
+    uint32_t elapsed_milliseconds)
+{
+    Fast_Runs++;
+    Fast_Elapsed = elapsed_milliseconds;
+
+    return 10;
+}
+
+static uint32_t slow_timer(
+    uint32_t elapsed_milliseconds)
+{
+    (void) elapsed_milliseconds;
+    Slow_Runs++;
+
+    return 1000;
+}
+
+static uint32_t once_timer(
+    uint32_t elapsed_milliseconds)
+{
+    (void) elapsed_milliseconds;
+    Once_Runs++;
+
+    return BACTIMER_IDLE;
+}
+
+void testBACnetTimer(
+    Test * pTest)
+{
+    BACNET_TIMER fast = { 0 };
+    BACNET_TIMER slow = { 0 };
+    BACNET_TIMER once = { 0 };
+    /* the clock wraps around during the test */
+    uint32_t now = UINT32_MAX - 500;
+
+    ct_test(pTest, bactimer_next(now) == BACTIMER_IDLE);
+    bactimer_register(&slow, slow_timer, now, 1000);
+    bactimer_register(&fast, fast_timer, now, 10);
+    bactimer_register(&once, once_timer, now, BACTIMER_IDLE);
+    ct_test(pTest, bactimer_next(now) == 10);
+    /* nothing is run before it is due */
+    ct_test(pTest, bactimer_run(now + 9) == 1);
+    ct_test(pTest, Fast_Runs == 0);
+    ct_test(pTest, bactimer_run(now + 12) == 10);
+    ct_test(pTest, Fast_Runs == 1);
+    ct_test(pTest, Fast_Elapsed == 12);
+    ct_test(pTest, Slow_Runs == 0);
+    /* a late run: each timer due runs once, given the time it missed */
+    ct_test(pTest, bactimer_run(now + 1500) == 10);
+    ct_test(pTest, Fast_Runs == 2);
+    ct_test(pTest, Fast_Elapsed == 1488);
+    ct_test(pTest, Slow_Runs == 1);
+    ct_test(pTest, bactimer_next(now + 1500) == 10);
+    /* an idle timer is woken, and its elapsed time counts from then */
+    bactimer_due(&once, now + 1502, 5);
+    ct_test(pTest, bactimer_next(now + 1502) == 5);
+    bactimer_run(now + 1507);
+    ct_test(pTest, Once_Runs == 1);
+    ct_test(pTest, !once.Waiting);
+    /* a later deadline does not delay it, an earlier one brings it in */
+    bactimer_due(&slow, now + 1507, 5000);
+    ct_test(pTest, slow.Due == (now + 2500));
+    bactimer_due(&slow, now + 1507, 3);
+    ct_test(pTest, slow.Due == (now + 1510));
+    bactimer_run(now + 1510);
+    ct_test(pTest, Slow_Runs == 2);
+    ct_test(pTest, Fast_Runs == 3);
+    bactimer_unregister(&fast);
+    bactimer_unregister(&slow);
+    bactimer_unregister(&once);
+    ct_test(pTest, bactimer_next(now + 1510) == BACTIMER_IDLE);
+    bactimer_due(&fast, now + 1510, 1);
+    ct_test(pTest, bactimer_next(now + 1510) == BACTIMER_IDLE);
+}
+
+#ifdef TEST_BACTIMER
+int main(
+    void)
+{
+    Test *pTest;
+    bool rc;
+
+    pTest = ct_create("BACnet Timer", NULL);
+    /* individual tests */
+    rc = ct_addTestFunction(pTest, testBACnetTimer);
+    assert(rc);
+
+    ct_setStream(pTest, stdout);
+    ct_run(pTest);
+    (void) ct_report(pTest);
+    ct_destroy(pTest);
+
+    return 0;
+}
+#endif /* TEST_BACTIMER */
+#endif /* TEST */
@@ -31,13 +31,18 @@
  License.
  -------------------------------------------
 ####COPYRIGHTEND####*/
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     /* for recvmmsg */
+#endif
 
 #include <stdint.h>     /* for standard integer types uint8_t etc. */
 #include <stdbool.h>    /* for the standard bool type. */
+#include <stdlib.h>
 #include "bacdcode.h"
 #include "bacint.h"
 #include "bip.h"
 #include "bvlc.h"
+#include "bacctx.h"
 #include "net.h"        /* custom per port */
 #if PRINT_ENABLED
 #include <stdio.h>      /* for standard i/o, like printing */
@@ -45,7 +50,6 @@
 
 /** @file bip.c  Configuration and Operations for BACnet/IP */
 
-static int BIP_Socket = -1;
 /* port to use - stored in network byte order */
 static uint16_t BIP_Port = 0;   /* this will force initialization in demos */
 /* IP Address - stored in network byte order */
@@ -53,6 +57,257 @@ static struct in_addr BIP_Address;
 /* Broadcast Address - stored in network byte order */
 static struct in_addr BIP_Broadcast_Address;
 
+/* With BIP_RECEIVE_BATCH (see bip.h), bip_receive waits with epoll and
+   reads the socket with recvmmsg into a queue that the following calls
+   return from without a system call. A burst of I-Am or ack datagrams
+   is then drained before the socket buffer overflows. */
+#if defined(BIP_RECEIVE_BATCH) && (BIP_RECEIVE_BATCH > 1)
+#define BIP_BATCHED_RECEIVE 1
+#include <sys/epoll.h>
+
+struct bip_datagram {
+    struct sockaddr_in sin;
+    int len;
+    uint8_t buf[MAX_MPDU];
+};
+#endif
+
+/* A lane is one socket of the port and the datagrams received from it.
+   With BIP_MAX_LANES (see bip.h) the port is shared by several sockets,
+   each read by its own thread; lane 0 is the socket of bip_set_socket. */
+struct bip_lane {
+    int socket;
+    /* the epoll instance watching the socket, or -1 to use select */
+    int epoll;
+#if defined(BIP_BATCHED_RECEIVE)
+    struct bip_datagram rx_queue[BIP_RECEIVE_BATCH];
+    /* the queued datagrams are [rx_next, rx_count) */
+    unsigned rx_next;
+    unsigned rx_count;
+#endif
+};
+
+#ifndef BIP_MAX_LANES
+#define BIP_MAX_LANES 1
+#endif
+
+static struct bip_lane BIP_Lane_Zero = { -1, -1 };
+/* the other lanes are allocated when they get a socket */
+static struct bip_lane *BIP_Lanes[BIP_MAX_LANES] = { &BIP_Lane_Zero };
+/* the lanes [0, BIP_Lane_Count) are in use */
+static unsigned BIP_Lane_Count = 1;
+/* the lanes bip_init opens */
+static unsigned BIP_Lanes_Wanted = 1;
+/* the lane of the calling thread */
+static BACNET_THREAD_LOCAL unsigned BIP_Lane = 0;
+
+/* With BIP_SEND_BATCH, the datagrams held by bip_send_batch_begin, and
+   the lists of bip_send_mpdu_list, go out with sendmmsg. */
+#if defined(BIP_SEND_BATCH) && (BIP_SEND_BATCH > 1)
+#define BIP_BATCHED_SEND 1
+
+struct bip_send_queue {
+    unsigned count;
+    struct sockaddr_in sin[BIP_SEND_BATCH];
+    uint16_t len[BIP_SEND_BATCH];
+    uint8_t buf[BIP_SEND_BATCH][MAX_MPDU];
+};
+
+/* each thread batches its own sends, the queue is allocated on first use */
+static BACNET_THREAD_LOCAL struct bip_send_queue *BIP_Tx_Queue = NULL;
+static BACNET_THREAD_LOCAL unsigned BIP_Tx_Batching = 0;
+#endif
+
+/* SO_RCVBUF and SO_SNDBUF of the socket, 0 for the system default */
+static int BIP_Receive_Buffer_Size = 0;
+static int BIP_Send_Buffer_Size = 0;
+
+static void bip_set_socket_buffer_sizes(
+    int sock_fd)
+{
+    if (sock_fd < 0) {
+        return;
+    }
+    if (BIP_Receive_Buffer_Size > 0) {
+        (void) setsockopt(sock_fd, SOL_SOCKET, SO_RCVBUF,
+            (char *) &BIP_Receive_Buffer_Size, sizeof(int));
+    }
+    if (BIP_Send_Buffer_Size > 0) {
+        (void) setsockopt(sock_fd, SOL_SOCKET, SO_SNDBUF,
+            (char *) &BIP_Send_Buffer_Size, sizeof(int));
+    }
+}
+
+/* The lane of the calling thread, lane 0 if its lane is not open. */
+static struct bip_lane *bip_current_lane(
+    void)
+{
+    return BIP_Lanes[(BIP_Lane < BIP_Lane_Count) ? BIP_Lane : 0];
+}
+
+/* The socket of the calling thread's lane. */
+static int bip_current_socket(
+    void)
+{
+    return bip_current_lane()->socket;
+}
+
+/* The lane that the datagrams of a source address arrive at, the same
+ * choice as the steering of the sockets in the port. */
+static unsigned bip_lane_of_address(
+    uint32_t net_address)
+{
+    return (BIP_Lane_Count > 1) ? (ntohl(net_address) % BIP_Lane_Count) : 0;
+}
+
+/** Setter for the socket of a lane; the sockets of a port that shares
+ * its UDP port between several lanes.  The lanes are opened from 0 up,
+ * and closed (with -1) from the last one down.
+ *
+ * @param lane [in] The lane, below BIP_MAX_LANES.
+ * @param sock_fd [in] Handle for the lane's socket, or -1.
+ * @return True if the lane was set.
+ */
+bool bip_set_lane_socket(
+    unsigned lane,
+    int sock_fd)
+{
+    struct bip_lane *l = NULL;
+#if defined(BIP_BATCHED_RECEIVE)
+    struct epoll_event event;
+#endif
+
+    if ((lane >= BIP_MAX_LANES) || (lane > BIP_Lane_Count)) {
+        return false;
+    }
+    if (!BIP_Lanes[lane]) {
+        BIP_Lanes[lane] = calloc(1, sizeof(struct bip_lane));
+        if (!BIP_Lanes[lane]) {
+            return false;
+        }
+        BIP_Lanes[lane]->socket = -1;
+        BIP_Lanes[lane]->epoll = -1;
+    }
+    l = BIP_Lanes[lane];
+#if defined(BIP_BATCHED_RECEIVE)
+    if (l->epoll >= 0) {
+        close(l->epoll);
+        l->epoll = -1;
+    }
+    /* the queued datagrams came from the old socket */
+    l->rx_next = 0;
+    l->rx_count = 0;
+    if (sock_fd >= 0) {
+        l->epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (l->epoll >= 0) {
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.fd = sock_fd;
+            if (epoll_ctl(l->epoll, EPOLL_CTL_ADD, sock_fd, &event) < 0) {
+                close(l->epoll);
+                l->epoll = -1;
+            }
+        }
+    }
+#endif
+#if defined(BIP_BATCHED_SEND)
+    /* the held datagrams were for the old socket */
+    if (BIP_Tx_Queue) {
+        BIP_Tx_Queue->count = 0;
+    }
+#endif
+    bip_set_socket_buffer_sizes(sock_fd);
+    l->socket = sock_fd;
+    if ((sock_fd >= 0) && (lane == BIP_Lane_Count)) {
+        BIP_Lane_Count++;
+    } else if ((sock_fd < 0) && (lane > 0) && (lane == BIP_Lane_Count - 1)) {
+        BIP_Lane_Count--;
+    }
+
+    return true;
+}
+
+/** Getter for the socket of a lane.
+ *
+ * @param lane [in] The lane.
+ * @return The handle to the lane's socket, or -1 if it is not open.
+ */
+int bip_lane_socket(
+    unsigned lane)
+{
+    return (lane < BIP_Lane_Count) ? BIP_Lanes[lane]->socket : -1;
+}
+
+/** Set the number of lanes (sockets sharing the UDP port) that bip_init
+ * opens, where the port supports it.  Each lane is read by its own
+ * thread; see bip_set_lane.
+ *
+ * @param lanes [in] The number of lanes, 1 for the single socket.
+ */
+void bip_set_lanes(
+    unsigned lanes)
+{
+    if (lanes < 1) {
+        lanes = 1;
+    } else if (lanes > BIP_MAX_LANES) {
+        lanes = BIP_MAX_LANES;
+    }
+    BIP_Lanes_Wanted = lanes;
+}
+
+/* returns the number of lanes bip_init opens */
+unsigned bip_get_lanes(
+    void)
+{
+    return BIP_Lanes_Wanted;
+}
+
+/* returns the number of lanes open */
+unsigned bip_lane_count(
+    void)
+{
+    return BIP_Lane_Count;
+}
+
+/** Make a lane the calling thread's: its sends go out of the lane's
+ * socket, and its receives read the lane.  A thread that does not set a
+ * lane uses lane 0.
+ *
+ * @param lane [in] The lane of the thread.
+ */
+void bip_set_lane(
+    unsigned lane)
+{
+    BIP_Lane = lane;
+}
+
+/* returns the lane of the calling thread */
+unsigned bip_lane(
+    void)
+{
+    return (BIP_Lane < BIP_Lane_Count) ? BIP_Lane : 0;
+}
+
+/** The lane that receives the datagrams of a device: its replies and its
+ * broadcasts.  The thread that sends a device its confirmed requests
+ * from this lane receives their acks, in its own context.
+ *
+ * @param dest [in] The B/IP address of the device, or of its router.
+ * @return The lane, 0 for a broadcast address.
+ */
+unsigned bip_lane_of(
+    BACNET_ADDRESS * dest)
+{
+    uint32_t net_address = 0;
+
+    if (!dest || (dest->mac_len != 6)) {
+        return 0;
+    }
+    memcpy(&net_address, &dest->mac[0], 4);
+
+    return bip_lane_of_address(net_address);
+}
+
 /** Setter for the BACnet/IP socket handle.
  *
  * @param sock_fd [in] Handle for the BACnet/IP socket.
@@ -60,23 +315,23 @@ static struct in_addr BIP_Broadcast_Address;
 void bip_set_socket(
     int sock_fd)
 {
-    BIP_Socket = sock_fd;
+    (void) bip_set_lane_socket(0, sock_fd);
 }
 
 /** Getter for the BACnet/IP socket handle.
  *
- * @return The handle to the BACnet/IP socket.
+ * @return The handle to the BACnet/IP socket of the calling thread's lane.
  */
 int bip_socket(
     void)
 {
-    return BIP_Socket;
+    return bip_current_socket();
 }
 
 bool bip_valid(
     void)
 {
-    return (BIP_Socket != -1);
+    return (BIP_Lanes[0]->socket != -1);
 }
 
 void bip_set_addr(
@@ -135,6 +390,210 @@ static int bip_decode_bip_address(
     return len;
 }
 
+/** Set the sizes of the socket buffers, applied to the socket now and
+ * whenever bip_set_socket is given a new one.  A larger receive buffer
+ * holds the burst of I-Am replies of a large site.
+ *
+ * @param receive_size [in] SO_RCVBUF in bytes, or 0 for the system default.
+ * @param send_size [in] SO_SNDBUF in bytes, or 0 for the system default.
+ */
+void bip_set_socket_buffers(
+    int receive_size,
+    int send_size)
+{
+    unsigned lane = 0;
+
+    BIP_Receive_Buffer_Size = receive_size;
+    BIP_Send_Buffer_Size = send_size;
+    for (lane = 0; lane < BIP_Lane_Count; lane++) {
+        bip_set_socket_buffer_sizes(BIP_Lanes[lane]->socket);
+    }
+}
+
+#if defined(BIP_BATCHED_SEND)
+/* Send the messages with sendmmsg, skipping a destination that fails
+ * like a failed sendto would be.
+ * @return The number of datagrams sent. */
+static unsigned bip_sendmmsg(
+    struct mmsghdr *msgs,
+    unsigned count)
+{
+    int sock_fd = bip_current_socket();
+    unsigned done = 0;
+    unsigned sent = 0;
+    int rv = 0;
+
+    while (done < count) {
+        rv = sendmmsg(sock_fd, &msgs[done], count - done, 0);
+        if (rv > 0) {
+            done += (unsigned) rv;
+            sent += (unsigned) rv;
+        } else {
+            done++;
+        }
+    }
+
+    return sent;
+}
+
+/* Send the datagrams held by bip_send_batch_begin on this thread. */
+static void bip_send_queue_flush(
+    void)
+{
+    struct bip_send_queue *queue = BIP_Tx_Queue;
+    struct mmsghdr msgs[BIP_SEND_BATCH];
+    struct iovec iovecs[BIP_SEND_BATCH];
+    unsigned i = 0;
+
+    if (!queue || (queue->count == 0)) {
+        return;
+    }
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < queue->count; i++) {
+        iovecs[i].iov_base = queue->buf[i];
+        iovecs[i].iov_len = queue->len[i];
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &queue->sin[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(queue->sin[i]);
+    }
+    if (bip_current_socket() >= 0) {
+        (void) bip_sendmmsg(msgs, queue->count);
+    }
+    queue->count = 0;
+}
+#endif
+
+/** Hold the datagrams sent by this thread until bip_send_batch_end, and
+ * send them with as few system calls as the platform allows.  The calls
+ * nest; a full batch is sent right away.  The senders see a held
+ * datagram as sent.
+ */
+void bip_send_batch_begin(
+    void)
+{
+#if defined(BIP_BATCHED_SEND)
+    if (!BIP_Tx_Queue) {
+        BIP_Tx_Queue = calloc(1, sizeof(struct bip_send_queue));
+    }
+    /* without a queue, the datagrams are simply sent one by one */
+    if (BIP_Tx_Queue) {
+        BIP_Tx_Batching++;
+    }
+#endif
+}
+
+/** Send the datagrams held since the matching bip_send_batch_begin. */
+void bip_send_batch_end(
+    void)
+{
+#if defined(BIP_BATCHED_SEND)
+    if (BIP_Tx_Batching && (--BIP_Tx_Batching == 0)) {
+        bip_send_queue_flush();
+    }
+#endif
+}
+
+/** Send one BVLL message (the mpdu, with its BVLC header) to a B/IP address.
+ *
+ * @param dest [in] The address and port, in network byte order.
+ * @param mtu [in] The bytes to send.
+ * @param mtu_len [in] The number of bytes to send.
+ * @return The number of bytes sent (or held in a batch), or -1 and errno
+ *  on failure.
+ */
+int bip_send_mpdu(
+    struct sockaddr_in *dest,
+    uint8_t * mtu,
+    uint16_t mtu_len)
+{
+    struct sockaddr_in bip_dest = { 0 };
+    int sock_fd = bip_current_socket();
+#if defined(BIP_BATCHED_SEND)
+    struct bip_send_queue *queue = BIP_Tx_Queue;
+#endif
+
+    /* assumes that the driver has already been initialized */
+    if (sock_fd < 0) {
+        return 0;
+    }
+    bip_dest.sin_family = AF_INET;
+    bip_dest.sin_addr.s_addr = dest->sin_addr.s_addr;
+    bip_dest.sin_port = dest->sin_port;
+    memset(&(bip_dest.sin_zero), '\0', 8);
+#if defined(BIP_BATCHED_SEND)
+    if (BIP_Tx_Batching && queue && (mtu_len <= MAX_MPDU)) {
+        queue->sin[queue->count] = bip_dest;
+        queue->len[queue->count] = mtu_len;
+        memcpy(queue->buf[queue->count], mtu, mtu_len);
+        queue->count++;
+        if (queue->count == BIP_SEND_BATCH) {
+            bip_send_queue_flush();
+        }
+        return mtu_len;
+    }
+#endif
+
+    return sendto(sock_fd, (char *) mtu, mtu_len, 0,
+        (struct sockaddr *) &bip_dest, sizeof(struct sockaddr));
+}
+
+/** Send the same BVLL message to each of a list of B/IP addresses, like
+ * the BBMD when it forwards a broadcast to its peers and foreign devices.
+ *
+ * @param dests [in] The addresses and ports, in network byte order.
+ * @param count [in] The number of addresses.
+ * @param mtu [in] The bytes to send.
+ * @param mtu_len [in] The number of bytes to send.
+ * @return The number of datagrams sent.
+ */
+unsigned bip_send_mpdu_list(
+    struct sockaddr_in *dests,
+    unsigned count,
+    uint8_t * mtu,
+    uint16_t mtu_len)
+{
+    unsigned sent = 0;
+    unsigned i = 0;
+#if defined(BIP_BATCHED_SEND)
+    struct mmsghdr msgs[BIP_SEND_BATCH];
+    struct sockaddr_in sin[BIP_SEND_BATCH];
+    struct iovec iov;
+    unsigned n = 0;
+
+    if (bip_current_socket() < 0) {
+        return 0;
+    }
+    if (!BIP_Tx_Batching) {
+        /* the messages share the one buffer */
+        iov.iov_base = mtu;
+        iov.iov_len = mtu_len;
+        memset(msgs, 0, sizeof(msgs));
+        memset(sin, 0, sizeof(sin));
+        while (i < count) {
+            for (n = 0; (n < BIP_SEND_BATCH) && (i < count); n++, i++) {
+                sin[n].sin_family = AF_INET;
+                sin[n].sin_addr.s_addr = dests[i].sin_addr.s_addr;
+                sin[n].sin_port = dests[i].sin_port;
+                msgs[n].msg_hdr.msg_iov = &iov;
+                msgs[n].msg_hdr.msg_iovlen = 1;
+                msgs[n].msg_hdr.msg_name = &sin[n];
+                msgs[n].msg_hdr.msg_namelen = sizeof(sin[n]);
+            }
+            sent += bip_sendmmsg(msgs, n);
+        }
+        return sent;
+    }
+#endif
+    for (i = 0; i < count; i++) {
+        if (bip_send_mpdu(&dests[i], mtu, mtu_len) > 0) {
+            sent++;
+        }
+    }
+
+    return sent;
+}
+
 /** Function to send a packet out the BACnet/IP socket (Annex J).
  * @ingroup DLBIP
  *
@@ -160,8 +619,8 @@ int bip_send_pdu(
 
     (void) npdu_data;
     /* assumes that the driver has already been initialized */
-    if (BIP_Socket < 0) {
-        return BIP_Socket;
+    if (bip_current_socket() < 0) {
+        return -1;
     }
 
     mtu[0] = BVLL_TYPE_BACNET_IP;
@@ -198,13 +657,149 @@ int bip_send_pdu(
     mtu_len += pdu_len;
 
     /* Send the packet */
-    bytes_sent =
-        sendto(BIP_Socket, (char *) mtu, mtu_len, 0,
-        (struct sockaddr *) &bip_dest, sizeof(struct sockaddr));
+    bytes_sent = bip_send_mpdu(&bip_dest, mtu, (uint16_t) mtu_len);
 
     return bytes_sent;
 }
 
+/* Wait for the socket to become readable, for up to timeout milliseconds.
+ * @return true if there is a datagram to read. */
+static bool bip_wait(
+    struct bip_lane *lane,
+    unsigned timeout)
+{
+    fd_set read_fds;
+    struct timeval select_timeout;
+
+#if defined(BIP_BATCHED_RECEIVE)
+    struct epoll_event event;
+
+    if (lane->epoll >= 0) {
+        return (epoll_wait(lane->epoll, &event, 1, (int) timeout) > 0);
+    }
+#endif
+    /* we could just use a non-blocking socket, but that consumes all
+       the CPU time.  We can use a timeout; it is only supported as
+       a select. */
+    if (timeout >= 1000) {
+        select_timeout.tv_sec = timeout / 1000;
+        select_timeout.tv_usec =
+            1000 * (timeout - select_timeout.tv_sec * 1000);
+    } else {
+        select_timeout.tv_sec = 0;
+        select_timeout.tv_usec = 1000 * timeout;
+    }
+    FD_ZERO(&read_fds);
+    FD_SET(lane->socket, &read_fds);
+
+    return (select(lane->socket + 1, &read_fds, NULL, NULL,
+            &select_timeout) > 0);
+}
+
+#if defined(BIP_BATCHED_RECEIVE)
+/* Read the datagrams waiting on the lane's socket into its queue, in
+ * one call.
+ * @return The number of datagrams queued. */
+static unsigned bip_receive_batch(
+    struct bip_lane *lane)
+{
+    struct mmsghdr msgs[BIP_RECEIVE_BATCH];
+    struct iovec iovecs[BIP_RECEIVE_BATCH];
+    struct bip_datagram *queue = lane->rx_queue;
+    unsigned i = 0;
+    int count = 0;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < BIP_RECEIVE_BATCH; i++) {
+        iovecs[i].iov_base = queue[i].buf;
+        iovecs[i].iov_len = sizeof(queue[i].buf);
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &queue[i].sin;
+        msgs[i].msg_hdr.msg_namelen = sizeof(queue[i].sin);
+    }
+    count = recvmmsg(lane->socket, msgs, BIP_RECEIVE_BATCH, MSG_DONTWAIT, NULL);
+    if (count <= 0) {
+        count = 0;
+    }
+    for (i = 0; i < (unsigned) count; i++) {
+        queue[i].len = msgs[i].msg_len;
+    }
+    lane->rx_next = 0;
+    lane->rx_count = (unsigned) count;
+
+    return lane->rx_count;
+}
+#endif
+
+/* Receive one datagram of the lane, from its queue or its socket. */
+static int bip_lane_receive(
+    struct bip_lane *lane,
+    struct sockaddr_in *sin,
+    uint8_t * pdu,
+    uint16_t max_pdu,
+    unsigned timeout)
+{
+#if defined(BIP_BATCHED_RECEIVE)
+    struct bip_datagram *datagram = NULL;
+    int len = 0;
+
+    if (lane->rx_next >= lane->rx_count) {
+        if (!bip_wait(lane, timeout) || (bip_receive_batch(lane) == 0)) {
+            return 0;
+        }
+    }
+    datagram = &lane->rx_queue[lane->rx_next++];
+    *sin = datagram->sin;
+    len = datagram->len;
+    if (len > max_pdu) {
+        len = max_pdu;
+    }
+    memcpy(pdu, datagram->buf, (size_t) len);
+
+    return len;
+#else
+    socklen_t sin_len = sizeof(*sin);
+
+    /* see if there is a packet for us */
+    if (!bip_wait(lane, timeout)) {
+        return 0;
+    }
+
+    return recvfrom(lane->socket, (char *) &pdu[0], max_pdu, 0,
+        (struct sockaddr *) sin, &sin_len);
+#endif
+}
+
+/** Receive one BVLL message (with its BVLC header) into pdu[], from the
+ * queue of a batched receive or from the socket of the calling thread's
+ * lane.  Every lane receives the broadcasts; only the lane of the sender
+ * returns them, like its unicasts.
+ *
+ * @param sin [out] The address of the sender, in network byte order.
+ * @param pdu [out] The buffer of the message.
+ * @param max_pdu [in] The size of the buffer.
+ * @param timeout [in] The number of milliseconds to wait for a message.
+ * @return The number of octets received, or zero if none arrived.
+ */
+int bip_receive_mpdu(
+    struct sockaddr_in *sin,
+    uint8_t * pdu,
+    uint16_t max_pdu,
+    unsigned timeout)
+{
+    unsigned lane = bip_lane();
+    int len = 0;
+
+    do {
+        len = bip_lane_receive(BIP_Lanes[lane], sin, pdu, max_pdu, timeout);
+        /* the ones of the other lanes are skipped without waiting again */
+        timeout = 0;
+    } while ((len > 0) && (bip_lane_of_address(sin->sin_addr.s_addr) != lane));
+
+    return len;
+}
+
 /** Implementation of the receive() function for BACnet/IP; receives one
  * packet, verifies its BVLC header, and removes the BVLC header from
  * the PDU data before returning.
@@ -224,39 +819,15 @@ uint16_t bip_receive(
 {
     int received_bytes = 0;
     uint16_t pdu_len = 0;       /* return value */
-    fd_set read_fds;
-    int max = 0;
-    struct timeval select_timeout;
     struct sockaddr_in sin = { 0 };
-    socklen_t sin_len = sizeof(sin);
     uint16_t i = 0;
     int function = 0;
 
     /* Make sure the socket is open */
-    if (BIP_Socket < 0)
+    if (bip_current_socket() < 0)
         return 0;
 
-    /* we could just use a non-blocking socket, but that consumes all
-       the CPU time.  We can use a timeout; it is only supported as
-       a select. */
-    if (timeout >= 1000) {
-        select_timeout.tv_sec = timeout / 1000;
-        select_timeout.tv_usec =
-            1000 * (timeout - select_timeout.tv_sec * 1000);
-    } else {
-        select_timeout.tv_sec = 0;
-        select_timeout.tv_usec = 1000 * timeout;
-    }
-    FD_ZERO(&read_fds);
-    FD_SET(BIP_Socket, &read_fds);
-    max = BIP_Socket;
-    /* see if there is a packet for us */
-    if (select(max + 1, &read_fds, NULL, NULL, &select_timeout) > 0)
-        received_bytes =
-            recvfrom(BIP_Socket, (char *) &pdu[0], max_pdu, 0,
-            (struct sockaddr *) &sin, &sin_len);
-    else
-        return 0;
+    received_bytes = bip_receive_mpdu(&sin, pdu, max_pdu, timeout);
 
     /* See if there is a problem */
     if (received_bytes < 0) {
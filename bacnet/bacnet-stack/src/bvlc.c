@@ -89,22 +89,160 @@ entry if no re-registration occurs. This value will be initialized
 to the 2-octet Time-to-Live value supplied at the time of
 registration.*/
 typedef struct {
-    bool valid;
     /* BACnet/IP address */
     struct in_addr dest_address;
     /* BACnet/IP port number - not always 47808=BAC0h */
     uint16_t dest_port;
     /* seconds for valid entry lifetime */
     uint16_t time_to_live;
-    /* our counter */
-    time_t seconds_remaining;   /* includes 30 second grace period */
+    /* the second of FD_Clock when the entry is purged, */
+    /* includes the 30 second grace period */
+    uint32_t expires;
+    /* the entries of the same timer wheel slot, index + 1, 0 ends */
+    uint16_t wheel_next;
+    uint16_t wheel_prev;
 } FD_TABLE_ENTRY;
 
+/* the capacity of the FDT */
 #ifndef MAX_FD_ENTRIES
 #define MAX_FD_ENTRIES 128
 #endif
+#if (MAX_FD_ENTRIES >= 0xFFFF)
+#error MAX_FD_ENTRIES does not fit the uint16_t table indexes
+#endif
+/* the registered entries are [0, FD_Count), in no particular order */
 static FD_TABLE_ENTRY FD_Table[MAX_FD_ENTRIES];
+static unsigned FD_Count = 0;
+
+/* Entry index + 1 for each B/IP address, 0 for an empty slot. A power */
+/* of two at least twice the capacity, so it is at most half full. */
+#define FD_HASH_SIZE \
+    ((MAX_FD_ENTRIES <= 8) ? 16 : (MAX_FD_ENTRIES <= 32) ? 64 : \
+    (MAX_FD_ENTRIES <= 128) ? 256 : (MAX_FD_ENTRIES <= 512) ? 1024 : \
+    (MAX_FD_ENTRIES <= 2048) ? 4096 : (MAX_FD_ENTRIES <= 8192) ? 16384 : \
+    65536)
+static uint16_t FD_Hash[FD_HASH_SIZE];
+
+/* The entries expire from a timer wheel of one second slots: an entry is */
+/* in slot (expires % FD_WHEEL_SLOTS), and each second only the entries */
+/* of one slot are looked at. Entries due after more than a turn of the */
+/* wheel stay in their slot for another turn. */
+#define FD_WHEEL_SLOTS 256
+static uint16_t FD_Wheel[FD_WHEEL_SLOTS];
+/* seconds counted by bvlc_maintenance_timer */
+static uint32_t FD_Clock = 0;
+
+static unsigned fdt_hash_home(
+    struct in_addr address,
+    uint16_t port)
+{
+    uint32_t key = address.s_addr ^ ((uint32_t) port * 0x9E3779B1UL);
+
+    key ^= key >> 16;
+    key *= 0x85EBCA6BUL;
+    key ^= key >> 13;
+
+    return key & (FD_HASH_SIZE - 1);
+}
+
+/* the hash slot of the address, and if it is not there, the empty */
+/* slot where it would go */
+static unsigned fdt_hash_slot(
+    struct in_addr address,
+    uint16_t port)
+{
+    unsigned slot = fdt_hash_home(address, port);
+    FD_TABLE_ENTRY *entry = NULL;
+
+    while (FD_Hash[slot]) {
+        entry = &FD_Table[FD_Hash[slot] - 1];
+        if ((entry->dest_address.s_addr == address.s_addr) &&
+            (entry->dest_port == port)) {
+            break;
+        }
+        slot = (slot + 1) & (FD_HASH_SIZE - 1);
+    }
 
+    return slot;
+}
+
+/* empty a hash slot, moving up the entries that probed past it */
+static void fdt_hash_remove(
+    unsigned slot)
+{
+    unsigned next = slot;
+    unsigned home = 0;
+    FD_TABLE_ENTRY *entry = NULL;
+
+    FD_Hash[slot] = 0;
+    for (;;) {
+        next = (next + 1) & (FD_HASH_SIZE - 1);
+        if (FD_Hash[next] == 0) {
+            break;
+        }
+        entry = &FD_Table[FD_Hash[next] - 1];
+        home = fdt_hash_home(entry->dest_address, entry->dest_port);
+        /* can the entry move back to the empty slot? */
+        if (((next - home) & (FD_HASH_SIZE - 1)) >=
+            ((next - slot) & (FD_HASH_SIZE - 1))) {
+            FD_Hash[slot] = FD_Hash[next];
+            FD_Hash[next] = 0;
+            slot = next;
+        }
+    }
+}
+
+static void fdt_wheel_insert(
+    unsigned index)
+{
+    FD_TABLE_ENTRY *entry = &FD_Table[index];
+    unsigned slot = entry->expires % FD_WHEEL_SLOTS;
+
+    entry->wheel_prev = 0;
+    entry->wheel_next = FD_Wheel[slot];
+    if (FD_Wheel[slot]) {
+        FD_Table[FD_Wheel[slot] - 1].wheel_prev = (uint16_t) (index + 1);
+    }
+    FD_Wheel[slot] = (uint16_t) (index + 1);
+}
+
+static void fdt_wheel_remove(
+    unsigned index)
+{
+    FD_TABLE_ENTRY *entry = &FD_Table[index];
+
+    if (entry->wheel_prev) {
+        FD_Table[entry->wheel_prev - 1].wheel_next = entry->wheel_next;
+    } else {
+        FD_Wheel[entry->expires % FD_WHEEL_SLOTS] = entry->wheel_next;
+    }
+    if (entry->wheel_next) {
+        FD_Table[entry->wheel_next - 1].wheel_prev = entry->wheel_prev;
+    }
+    entry->wheel_next = 0;
+    entry->wheel_prev = 0;
+}
+
+/* Remove an entry from the FDT. The last entry moves into its place. */
+static void fdt_entry_remove(
+    unsigned index)
+{
+    unsigned last = FD_Count - 1;
+    FD_TABLE_ENTRY *entry = &FD_Table[index];
+
+    fdt_wheel_remove(index);
+    fdt_hash_remove(fdt_hash_slot(entry->dest_address, entry->dest_port));
+    if (index != last) {
+        entry = &FD_Table[last];
+        fdt_wheel_remove(last);
+        FD_Hash[fdt_hash_slot(entry->dest_address, entry->dest_port)] =
+            (uint16_t) (index + 1);
+        FD_Table[index] = *entry;
+        fdt_wheel_insert(index);
+    }
+    memset(&FD_Table[last], 0, sizeof(FD_Table[last]));
+    FD_Count = last;
+}
 
 /** A timer function that is called about once a second.
  *
@@ -113,24 +251,52 @@ static FD_TABLE_ENTRY FD_Table[MAX_FD_ENTRIES];
 void bvlc_maintenance_timer(
     time_t seconds)
 {
-    unsigned i = 0;
+    uint32_t target = 0;
+    unsigned slot = 0;
+    unsigned index = 0;
 
-    for (i = 0; i < MAX_FD_ENTRIES; i++) {
-        if (FD_Table[i].valid) {
-            if (FD_Table[i].seconds_remaining) {
-                if (FD_Table[i].seconds_remaining < seconds) {
-                    FD_Table[i].seconds_remaining = 0;
-                } else {
-                    FD_Table[i].seconds_remaining -= seconds;
-                }
-                if (FD_Table[i].seconds_remaining == 0) {
-                    FD_Table[i].valid = false;
-                }
+    if (seconds <= 0) {
+        return;
+    }
+    /* after a full turn, every slot has been looked at */
+    if (seconds > FD_WHEEL_SLOTS) {
+        FD_Clock += (uint32_t) (seconds - FD_WHEEL_SLOTS);
+        seconds = FD_WHEEL_SLOTS;
+    }
+    target = FD_Clock + (uint32_t) seconds;
+    while (FD_Clock != target) {
+        FD_Clock++;
+        slot = FD_Clock % FD_WHEEL_SLOTS;
+        index = FD_Wheel[slot];
+        while (index) {
+            if ((int32_t) (FD_Table[index - 1].expires - FD_Clock) <= 0) {
+                /* the removal moves the last entry, which may relink */
+                /* this slot, so look at it again from its start */
+                fdt_entry_remove(index - 1);
+                index = FD_Wheel[slot];
+            } else {
+                index = FD_Table[index - 1].wheel_next;
             }
         }
     }
 }
 
+/* the seconds before the entry is purged */
+static uint16_t fdt_seconds_remaining(
+    FD_TABLE_ENTRY * entry)
+{
+    int32_t remaining = (int32_t) (entry->expires - FD_Clock);
+
+    if (remaining <= 0) {
+        return 0;
+    }
+    if (remaining > 0xFFFF) {
+        return 0xFFFF;
+    }
+
+    return (uint16_t) remaining;
+}
+
 /** Copy the source internet address to the BACnet address
  *
  * FIXME: IPv6?
@@ -526,30 +692,24 @@ static int bvlc_encode_read_fdt_ack(
     unsigned i;
     uint16_t seconds_remaining = 0;
 
-    for (i = 0; i < MAX_FD_ENTRIES; i++) {
-        if (FD_Table[i].valid) {
-            count++;
-        }
-    }
+    count = FD_Count;
     len = bvlc_encode_read_fdt_ack_init(&pdu[0], count);
     pdu_len += len;
-    for (i = 0; i < MAX_FD_ENTRIES; i++) {
-        if (FD_Table[i].valid) {
-            /* too much to send */
-            if ((pdu_len + 10) > max_pdu) {
-                pdu_len = 0;
-                break;
-            }
-            len =
-                bvlc_encode_bip_address(&pdu[pdu_len],
-                &FD_Table[i].dest_address, FD_Table[i].dest_port);
-            pdu_len += len;
-            len = encode_unsigned16(&pdu[pdu_len], FD_Table[i].time_to_live);
-            pdu_len += len;
-            seconds_remaining = (uint16_t) FD_Table[i].seconds_remaining;
-            len = encode_unsigned16(&pdu[pdu_len], seconds_remaining);
-            pdu_len += len;
+    for (i = 0; i < FD_Count; i++) {
+        /* too much to send */
+        if ((pdu_len + 10) > max_pdu) {
+            pdu_len = 0;
+            break;
         }
+        len =
+            bvlc_encode_bip_address(&pdu[pdu_len],
+            &FD_Table[i].dest_address, FD_Table[i].dest_port);
+        pdu_len += len;
+        len = encode_unsigned16(&pdu[pdu_len], FD_Table[i].time_to_live);
+        pdu_len += len;
+        seconds_remaining = fdt_seconds_remaining(&FD_Table[i]);
+        len = encode_unsigned16(&pdu[pdu_len], seconds_remaining);
+        pdu_len += len;
     }
 
     return pdu_len;
@@ -715,41 +875,33 @@ static bool bvlc_register_foreign_device(
     struct sockaddr_in *sin,
     uint16_t time_to_live)
 {
-    unsigned i = 0;
-    bool status = false;
+    unsigned slot = 0;
+    unsigned index = 0;
+    FD_TABLE_ENTRY *entry = NULL;
 
     /* am I here already?  If so, update my time to live... */
-    for (i = 0; i < MAX_FD_ENTRIES; i++) {
-        if (FD_Table[i].valid) {
-            if ((FD_Table[i].dest_address.s_addr == sin->sin_addr.s_addr) &&
-                (FD_Table[i].dest_port == sin->sin_port)) {
-                status = true;
-                FD_Table[i].time_to_live = time_to_live;
-                /*  Upon receipt of a BVLL Register-Foreign-Device message,
-                   a BBMD shall start a timer with a value equal to the
-                   Time-to-Live parameter supplied plus a fixed grace
-                   period of 30 seconds. */
-                FD_Table[i].seconds_remaining = time_to_live + 30;
-                break;
-            }
-        }
-    }
-    if (!status) {
-        for (i = 0; i < MAX_FD_ENTRIES; i++) {
-            if (!FD_Table[i].valid) {
-                FD_Table[i].dest_address.s_addr = sin->sin_addr.s_addr;
-                FD_Table[i].dest_port = sin->sin_port;
-                FD_Table[i].time_to_live = time_to_live;
-                FD_Table[i].seconds_remaining = time_to_live + 30;
-                FD_Table[i].valid = true;
-                status = true;
-                break;
-            }
-        }
+    slot = fdt_hash_slot(sin->sin_addr, sin->sin_port);
+    if (FD_Hash[slot]) {
+        index = FD_Hash[slot] - 1;
+        fdt_wheel_remove(index);
+    } else if (FD_Count < MAX_FD_ENTRIES) {
+        index = FD_Count++;
+        FD_Hash[slot] = (uint16_t) (index + 1);
+        FD_Table[index].dest_address.s_addr = sin->sin_addr.s_addr;
+        FD_Table[index].dest_port = sin->sin_port;
+    } else {
+        return false;
     }
+    entry = &FD_Table[index];
+    entry->time_to_live = time_to_live;
+    /*  Upon receipt of a BVLL Register-Foreign-Device message,
+       a BBMD shall start a timer with a value equal to the
+       Time-to-Live parameter supplied plus a fixed grace
+       period of 30 seconds. */
+    entry->expires = FD_Clock + (uint32_t) time_to_live + 30;
+    fdt_wheel_insert(index);
 
-
-    return status;
+    return true;
 }
 
 /** Delete a Foreign Device from the Foreign Device Table
@@ -762,22 +914,16 @@ static bool bvlc_delete_foreign_device(
     uint8_t * pdu)
 {
     struct sockaddr_in sin = { 0 };     /* the ip address */
-    bool status = false;        /* return value */
-    unsigned i = 0;
+    unsigned slot = 0;
 
     bvlc_decode_bip_address(pdu, &sin.sin_addr, &sin.sin_port);
-    for (i = 0; i < MAX_FD_ENTRIES; i++) {
-        if (FD_Table[i].valid) {
-            if ((FD_Table[i].dest_address.s_addr == sin.sin_addr.s_addr) &&
-                (FD_Table[i].dest_port == sin.sin_port)) {
-                FD_Table[i].valid = false;
-                FD_Table[i].seconds_remaining = 0;
-                status = true;
-                break;
-            }
-        }
+    slot = fdt_hash_slot(sin.sin_addr, sin.sin_port);
+    if (FD_Hash[slot] == 0) {
+        return false;
     }
-    return status;
+    fdt_entry_remove(FD_Hash[slot] - 1);
+
+    return true;
 }
 #endif
 
@@ -798,20 +944,8 @@ int bvlc_send_mpdu(
     uint8_t * mtu,
     uint16_t mtu_len)
 {
-    struct sockaddr_in bvlc_dest = { 0 };
-
-    /* assumes that the driver has already been initialized */
-    if (bip_socket() < 0) {
-        return 0;
-    }
-    /* load destination IP address */
-    bvlc_dest.sin_family = AF_INET;
-    bvlc_dest.sin_addr.s_addr = dest->sin_addr.s_addr;
-    bvlc_dest.sin_port = dest->sin_port;
-    memset(&(bvlc_dest.sin_zero), '\0', 8);
     /* Send the packet */
-    return sendto(bip_socket(), (char *) mtu, mtu_len, 0,
-        (struct sockaddr *) &bvlc_dest, sizeof(struct sockaddr));
+    return bip_send_mpdu(dest, mtu, mtu_len);
 }
 
 #if defined(BBMD_ENABLED) && BBMD_ENABLED
@@ -832,6 +966,8 @@ static void bvlc_bdt_forward_npdu(
     uint16_t mtu_len = 0;
     unsigned i = 0;     /* loop counter */
     struct sockaddr_in bip_dest = { 0 };
+    struct sockaddr_in dests[MAX_BBMD_ENTRIES];
+    unsigned count = 0;
 
     /* If we are forwarding an original broadcast message and the NAT
      * handling is enabled, change the source address to NAT routers
@@ -882,11 +1018,13 @@ static void bvlc_bdt_forward_npdu(
                 (bip_dest.sin_port == bip_get_port())) {
                 continue;
             }
-            bvlc_send_mpdu(&bip_dest, mtu, mtu_len);
+            dests[count++] = bip_dest;
             debug_printf("BVLC: BDT Sent Forwarded-NPDU to %s:%04X\n",
                 inet_ntoa(bip_dest.sin_addr), ntohs(bip_dest.sin_port));
         }
     }
+    /* one system call for the whole table, where the port allows it */
+    (void) bip_send_mpdu_list(dests, count, mtu, mtu_len);
 
     return;
 }
@@ -932,6 +1070,8 @@ static void bvlc_fdt_forward_npdu(
     uint16_t mtu_len = 0;
     unsigned i = 0;     /* loop counter */
     struct sockaddr_in bip_dest = { 0 };
+    struct sockaddr_in dests[MAX_FD_ENTRIES];
+    unsigned count = 0;
 
     /* If we are forwarding an original broadcast message and the NAT
      * handling is enabled, change the source address to NAT routers
@@ -952,34 +1092,33 @@ static void bvlc_fdt_forward_npdu(
     }
 
     /* loop through the FDT and send one to each entry */
-    for (i = 0; i < MAX_FD_ENTRIES; i++) {
-        if (FD_Table[i].valid && FD_Table[i].seconds_remaining) {
-            bip_dest.sin_addr.s_addr = FD_Table[i].dest_address.s_addr;
-            bip_dest.sin_port = FD_Table[i].dest_port;
-            /* don't send to my ip address and same port */
-            if ((bip_dest.sin_addr.s_addr == bip_get_addr()) &&
-                (bip_dest.sin_port == bip_get_port())) {
-                continue;
-            }
-            /* don't send to src ip address and same port */
-            if ((bip_dest.sin_addr.s_addr == sin->sin_addr.s_addr) &&
-                (bip_dest.sin_port == sin->sin_port)) {
-                continue;
-            }
-            /* NAT router port forwards BACnet packets from global IP to us.
-             * Packets sent to that global IP by us would end up back, creating
-             * a loop.
-             */
-            if (BVLC_NAT_Handling &&
-                (bip_dest.sin_addr.s_addr == BVLC_Global_Address.s_addr) &&
-                (bip_dest.sin_port == bip_get_port())) {
-                continue;
-            }
-            bvlc_send_mpdu(&bip_dest, mtu, mtu_len);
-            debug_printf("BVLC: FDT Sent Forwarded-NPDU to %s:%04X\n",
-                inet_ntoa(bip_dest.sin_addr), ntohs(bip_dest.sin_port));
+    for (i = 0; i < FD_Count; i++) {
+        bip_dest.sin_addr.s_addr = FD_Table[i].dest_address.s_addr;
+        bip_dest.sin_port = FD_Table[i].dest_port;
+        /* don't send to my ip address and same port */
+        if ((bip_dest.sin_addr.s_addr == bip_get_addr()) &&
+            (bip_dest.sin_port == bip_get_port())) {
+            continue;
+        }
+        /* don't send to src ip address and same port */
+        if ((bip_dest.sin_addr.s_addr == sin->sin_addr.s_addr) &&
+            (bip_dest.sin_port == sin->sin_port)) {
+            continue;
+        }
+        /* NAT router port forwards BACnet packets from global IP to us.
+         * Packets sent to that global IP by us would end up back, creating
+         * a loop.
+         */
+        if (BVLC_NAT_Handling &&
+            (bip_dest.sin_addr.s_addr == BVLC_Global_Address.s_addr) &&
+            (bip_dest.sin_port == bip_get_port())) {
+            continue;
         }
+        dests[count++] = bip_dest;
+        debug_printf("BVLC: FDT Sent Forwarded-NPDU to %s:%04X\n",
+            inet_ntoa(bip_dest.sin_addr), ntohs(bip_dest.sin_port));
     }
+    (void) bip_send_mpdu_list(dests, count, mtu, mtu_len);
 
     return;
 }
@@ -1101,13 +1240,9 @@ uint16_t bvlc_receive(
     unsigned timeout)
 {
     uint16_t npdu_len = 0;      /* return value */
-    fd_set read_fds;
-    int max = 0;
-    struct timeval select_timeout;
     struct sockaddr_in sin = { 0 };
     struct sockaddr_in original_sin = { 0 };
     struct sockaddr_in dest = { 0 };
-    socklen_t sin_len = sizeof(sin);
     int received_bytes = 0;
     uint16_t result_code = 0;
     uint16_t i = 0;
@@ -1119,28 +1254,7 @@ uint16_t bvlc_receive(
         return 0;
     }
 
-    /* we could just use a non-blocking socket, but that consumes all
-       the CPU time.  We can use a timeout; it is only supported as
-       a select. */
-    if (timeout >= 1000) {
-        select_timeout.tv_sec = timeout / 1000;
-        select_timeout.tv_usec =
-            1000 * (timeout - select_timeout.tv_sec * 1000);
-    } else {
-        select_timeout.tv_sec = 0;
-        select_timeout.tv_usec = 1000 * timeout;
-    }
-    FD_ZERO(&read_fds);
-    FD_SET(bip_socket(), &read_fds);
-    max = bip_socket();
-    /* see if there is a packet for us */
-    if (select(max + 1, &read_fds, NULL, NULL, &select_timeout) > 0) {
-        received_bytes =
-            recvfrom(bip_socket(), (char *) &npdu[0], max_npdu, 0,
-            (struct sockaddr *) &sin, &sin_len);
-    } else {
-        return 0;
-    }
+    received_bytes = bip_receive_mpdu(&sin, npdu, max_npdu, timeout);
     /* See if there is a problem */
     if (received_bytes < 0) {
         return 0;
@@ -1799,6 +1913,139 @@ void testInternetAddress(
     ct_test(pTest, sin.sin_addr.s_addr == test_sin.sin_addr.s_addr);
 }
 
+/* the batched sends and receives over a loopback socket */
+void testBIPBatch(
+    Test * pTest)
+{
+    struct sockaddr_in sin = { 0 };
+    struct sockaddr_in from = { 0 };
+    struct sockaddr_in dests[40];
+    socklen_t sin_len = sizeof(sin);
+    uint8_t mtu[8] = { BVLL_TYPE_BACNET_IP, BVLC_ORIGINAL_UNICAST_NPDU,
+        0, 8, 1, 0, 0x10, 0x08
+    };
+    uint8_t buf[MAX_MPDU] = { 0 };
+    unsigned i = 0;
+    unsigned count = 0;
+    int sock_fd = -1;
+
+    sock_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    ct_test(pTest, sock_fd >= 0);
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = 0;
+    ct_test(pTest, bind(sock_fd, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+    ct_test(pTest, getsockname(sock_fd, (struct sockaddr *) &sin,
+            &sin_len) == 0);
+    bip_set_socket_buffers(256 * 1024, 0);
+    bip_set_socket(sock_fd);
+    /* one list send reaches every destination */
+    for (i = 0; i < 40; i++) {
+        dests[i] = sin;
+    }
+    ct_test(pTest, bip_send_mpdu_list(dests, 40, mtu, sizeof(mtu)) == 40);
+    for (count = 0; bip_receive_mpdu(&from, buf, sizeof(buf), 100) > 0;
+        count++) {
+        ct_test(pTest, memcmp(buf, mtu, sizeof(mtu)) == 0);
+        ct_test(pTest, from.sin_port == sin.sin_port);
+    }
+    ct_test(pTest, count == 40);
+    /* the batch is held until its end */
+    bip_send_batch_begin();
+    for (i = 0; i < 5; i++) {
+        mtu[7] = (uint8_t) i;
+        ct_test(pTest, bip_send_mpdu(&sin, mtu, sizeof(mtu)) == sizeof(mtu));
+    }
+#if defined(BIP_SEND_BATCH) && (BIP_SEND_BATCH > 1)
+    ct_test(pTest, bip_receive_mpdu(&from, buf, sizeof(buf), 10) == 0);
+#endif
+    bip_send_batch_end();
+    for (i = 0; i < 5; i++) {
+        ct_test(pTest, bip_receive_mpdu(&from, buf, sizeof(buf),
+                100) == sizeof(mtu));
+        ct_test(pTest, buf[7] == i);
+    }
+    bip_set_socket(-1);
+    close(sock_fd);
+}
+
+#if defined(BBMD_ENABLED) && BBMD_ENABLED
+static void set_fd_address(
+    unsigned i,
+    struct sockaddr_in *sin)
+{
+    memset(sin, 0, sizeof(*sin));
+    sin->sin_addr.s_addr = htonl(0x0A000000UL + (i >> 2));
+    sin->sin_port = htons((uint16_t) (0xBAC0 + (i & 3)));
+}
+
+static bool fdt_has(
+    struct sockaddr_in *sin)
+{
+    return FD_Hash[fdt_hash_slot(sin->sin_addr, sin->sin_port)] != 0;
+}
+
+void testFDT(
+    Test * pTest)
+{
+    struct sockaddr_in sin = { 0 };
+    uint8_t pdu[6] = { 0 };
+    uint32_t expires[MAX_FD_ENTRIES];
+    bool deleted[MAX_FD_ENTRIES];
+    unsigned i = 0;
+    unsigned count = 0;
+    unsigned second = 0;
+
+    /* fill the table, with lifetimes longer than a turn of the wheel */
+    for (i = 0; i < MAX_FD_ENTRIES; i++) {
+        set_fd_address(i, &sin);
+        ct_test(pTest, bvlc_register_foreign_device(&sin,
+                (uint16_t) (1 + (i * 7) % 600)));
+        expires[i] = 1 + (i * 7) % 600 + 30;
+        deleted[i] = false;
+    }
+    ct_test(pTest, FD_Count == MAX_FD_ENTRIES);
+    set_fd_address(MAX_FD_ENTRIES, &sin);
+    ct_test(pTest, !bvlc_register_foreign_device(&sin, 60));
+    /* registering again renews the entry */
+    set_fd_address(5, &sin);
+    ct_test(pTest, bvlc_register_foreign_device(&sin, 700));
+    expires[5] = 730;
+    ct_test(pTest, FD_Count == MAX_FD_ENTRIES);
+    /* deletes */
+    for (i = 0; i < MAX_FD_ENTRIES; i += 3) {
+        set_fd_address(i, &sin);
+        bvlc_encode_bip_address(pdu, &sin.sin_addr, sin.sin_port);
+        ct_test(pTest, bvlc_delete_foreign_device(pdu));
+        ct_test(pTest, !bvlc_delete_foreign_device(pdu));
+        deleted[i] = true;
+    }
+    /* the entries expire on their second */
+    for (second = 1; second <= 731; second++) {
+        bvlc_maintenance_timer(1);
+        count = 0;
+        for (i = 0; i < MAX_FD_ENTRIES; i++) {
+            set_fd_address(i, &sin);
+            if (!deleted[i] && (second < expires[i])) {
+                count++;
+                ct_test(pTest, fdt_has(&sin));
+            } else {
+                ct_test(pTest, !fdt_has(&sin));
+            }
+        }
+        ct_test(pTest, FD_Count == count);
+    }
+    ct_test(pTest, FD_Count == 0);
+    /* a long pause purges everything at once */
+    set_fd_address(1, &sin);
+    ct_test(pTest, bvlc_register_foreign_device(&sin, 1000));
+    bvlc_maintenance_timer(1029);
+    ct_test(pTest, FD_Count == 1);
+    bvlc_maintenance_timer(100000);
+    ct_test(pTest, FD_Count == 0);
+}
+#endif
+
 #ifdef TEST_BVLC
 int main(
     void)
@@ -1812,6 +2059,12 @@ int main(
     assert(rc);
     rc = ct_addTestFunction(pTest, testInternetAddress);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testBIPBatch);
+    assert(rc);
+#if defined(BBMD_ENABLED) && BBMD_ENABLED
+    rc = ct_addTestFunction(pTest, testFDT);
+    assert(rc);
+#endif
     /* configure output */
     ct_setStream(pTest, stdout);
     ct_run(pTest);
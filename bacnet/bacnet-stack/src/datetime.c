@@ -114,19 +114,35 @@ bool datetime_date_is_valid(
     return status;
 }
 
+/* The dates are counted in years that start on March 1, so that the leap
+   day is the last day of the year: the days before a month are then
+   (153 * month + 2) / 5 with March as month 0, and a year of years is
+   365 days plus the leap days of the Gregorian rules.  Computing a date
+   this way is the same few operations for any year. */
+/* the days from March 1 of the year 0 to January 1, 1900 */
+#define DAYS_TO_EPOCH 693901UL
+/* the days in 400 years, which repeat */
+#define DAYS_PER_ERA 146097UL
+/* the days from January 1, 1900 to January 1, 1970 */
+#define DAYS_TO_UNIX_EPOCH 25567UL
+#define SECONDS_PER_DAY 86400UL
+
 static uint32_t day_of_year(
     uint16_t year,
     uint8_t month,
     uint8_t day)
 {
+    /* the days before each month, in a year which is not a leap year */
+    static const uint16_t month_days_before[13] = { 0,
+        0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334
+    };
     uint32_t days = 0;  /* return value */
-    uint8_t months = 0; /* loop counter for months */
 
     if (datetime_ymd_is_valid(year, month, day)) {
-        for (months = 1; months < month; months++) {
-            days += datetime_month_days(year, months);
+        days = month_days_before[month] + day;
+        if ((month > 2) && datetime_is_leap_year(year)) {
+            days++;
         }
-        days += day;
     }
 
     return (days);
@@ -188,17 +204,22 @@ static uint32_t days_since_epoch(
     uint8_t day)
 {
     uint32_t days = 0;  /* return value */
-    uint16_t years = 0; /* loop counter for years */
+    uint32_t years = 0; /* years since March 1 of the year 0 */
+    uint32_t months = 0;        /* months since March 1 */
 
     if (datetime_ymd_is_valid(year, month, day)) {
-        for (years = 1900; years < year; years++) {
-            days += 365;
-            if (datetime_is_leap_year(years))
-                days++;
+        /* January and February are the end of the previous year */
+        if (month <= 2) {
+            years = year - 1U;
+            months = month + 9U;
+        } else {
+            years = year;
+            months = month - 3U;
         }
-        days += day_of_year(year, month, day);
-        /* 'days since' is one less */
-        days -= 1;
+        days =
+            (365 * years) + (years / 4) - (years / 100) + (years / 400) +
+            ((153 * months) + 2) / 5 + (day - 1);
+        days -= DAYS_TO_EPOCH;
     }
 
     return (days);
@@ -222,26 +243,37 @@ static void days_since_epoch_into_ymd(
     uint8_t * pMonth,
     uint8_t * pDay)
 {
-    uint16_t year = 1900;
-    uint8_t month = 1;
-    uint8_t day = 1;
+    uint32_t era = 0;   /* 400 year periods since March 1 of the year 0 */
+    uint32_t year_of_era = 0;
+    uint32_t day_of_era = 0;
+    uint32_t day_of_march_year = 0;
+    uint32_t months = 0;        /* months since March 1 */
+    uint16_t year = 0;
+    uint8_t month = 0;
+    uint8_t day = 0;
 
-    while (days >= 365) {
-        if ((datetime_is_leap_year(year)) && (days == 365))
-            break;
-        days -= 365;
-        if (datetime_is_leap_year(year))
-            --days;
-        year++;
+    days += DAYS_TO_EPOCH;
+    era = days / DAYS_PER_ERA;
+    day_of_era = days - (era * DAYS_PER_ERA);
+    /* the leap days of the era so far, taken out, give the year */
+    year_of_era =
+        (day_of_era - (day_of_era / 1460) + (day_of_era / 36524) -
+        (day_of_era / (DAYS_PER_ERA - 1))) / 365;
+    day_of_march_year =
+        day_of_era - ((365 * year_of_era) + (year_of_era / 4) -
+        (year_of_era / 100));
+    months = ((5 * day_of_march_year) + 2) / 153;
+    day = (uint8_t) (day_of_march_year - (((153 * months) + 2) / 5) + 1);
+    if (months < 10) {
+        month = (uint8_t) (months + 3);
+    } else {
+        month = (uint8_t) (months - 9);
     }
-
-    while (days >= (uint32_t) datetime_month_days(year, month)) {
-        days -= datetime_month_days(year, month);
-        month++;
+    year = (uint16_t) (year_of_era + (era * 400));
+    if (month <= 2) {
+        year++;
     }
 
-    day = (uint8_t) (day + days);
-
     if (pYear)
         *pYear = year;
     if (pMonth)
@@ -622,6 +654,65 @@ uint16_t datetime_minutes_since_midnight(
     return minutes;
 }
 
+/** Calculates the seconds from January 1, 1970 to a date and time,
+ * the count of a POSIX time_t.  The time zone is that of the date and time.
+ *
+ * @param bdatetime [in] the date and time, from 1970 to early 2106
+ *
+ * @return seconds since 1970, or 0 for dates before 1970 or invalid dates
+ */
+uint32_t datetime_seconds_since_unix_epoch(
+    BACNET_DATE_TIME * bdatetime)
+{
+    uint32_t days = 0;
+    uint32_t seconds = 0;
+
+    if (bdatetime &&
+        datetime_ymd_is_valid(bdatetime->date.year, bdatetime->date.month,
+            bdatetime->date.day)) {
+        days =
+            days_since_epoch(bdatetime->date.year, bdatetime->date.month,
+            bdatetime->date.day);
+        if (days >= DAYS_TO_UNIX_EPOCH) {
+            seconds =
+                ((days - DAYS_TO_UNIX_EPOCH) * SECONDS_PER_DAY) +
+                seconds_since_midnight(bdatetime->time.hour,
+                bdatetime->time.min, bdatetime->time.sec);
+        }
+    }
+
+    return seconds;
+}
+
+/** Sets a date and time from the seconds since January 1, 1970
+ *
+ * @param seconds [in] seconds since 1970, as from a POSIX time_t
+ * @param bdatetime [out] the date and time, with the hundredths 0
+ */
+void datetime_seconds_since_unix_epoch_into_datetime(
+    uint32_t seconds,
+    BACNET_DATE_TIME * bdatetime)
+{
+    uint16_t year = 0;
+    uint8_t month = 0;
+    uint8_t day = 0;
+    uint32_t days = 0;
+
+    if (bdatetime) {
+        days = (seconds / SECONDS_PER_DAY) + DAYS_TO_UNIX_EPOCH;
+        days_since_epoch_into_ymd(days, &year, &month, &day);
+        bdatetime->date.year = year;
+        bdatetime->date.month = month;
+        bdatetime->date.day = day;
+        /* Jan 1, 1900 is a Monday */
+        bdatetime->date.wday = (uint8_t) ((days % 7) + 1);
+        seconds_since_midnight_into_hms(seconds % SECONDS_PER_DAY,
+            &bdatetime->time.hour, &bdatetime->time.min,
+            &bdatetime->time.sec);
+        bdatetime->time.hundredths = 0;
+    }
+}
+
 /** Utility to add or subtract minutes to a BACnet DateTime structure
  *
  * @param bdatetime [in] the starting date and time
@@ -1172,6 +1263,7 @@ static void testDateEpoch(
     uint16_t year = 0, test_year = 0;
     uint8_t month = 0, test_month = 0;
     uint8_t day = 0, test_day = 0;
+    uint32_t expected_days = 0;
 
     days = days_since_epoch(1900, 1, 1);
     ct_test(pTest, days == 0);
@@ -1185,6 +1277,9 @@ static void testDateEpoch(
         for (month = 1; month <= 12; month++) {
             for (day = 1; day <= datetime_month_days(year, month); day++) {
                 days = days_since_epoch(year, month, day);
+                /* each day is the one after the day before */
+                ct_test(pTest, days == expected_days);
+                expected_days++;
                 days_since_epoch_into_ymd(days,
                     &test_year, &test_month, &test_day);
                 ct_test(pTest, year == test_year);
@@ -1193,6 +1288,53 @@ static void testDateEpoch(
             }
         }
     }
+    /* some well known days */
+    ct_test(pTest, days_since_epoch(1970, 1, 1) == 25567);
+    ct_test(pTest, days_since_epoch(2000, 3, 1) == 36584);
+    ct_test(pTest, days_since_epoch(2154, 12, 31) == 93136);
+}
+
+static void testDateTimeUnixEpoch(
+    Test * pTest)
+{
+    BACNET_DATE_TIME bdatetime;
+    BACNET_DATE_TIME test_bdatetime;
+    uint32_t seconds = 0;
+    uint32_t test_seconds = 0;
+
+    datetime_set_values(&bdatetime, 1970, 1, 1, 0, 0, 0, 0);
+    ct_test(pTest, datetime_seconds_since_unix_epoch(&bdatetime) == 0);
+    /* 2000-02-29 12:34:56 UTC */
+    datetime_set_values(&bdatetime, 2000, 2, 29, 12, 34, 56, 0);
+    seconds = datetime_seconds_since_unix_epoch(&bdatetime);
+    ct_test(pTest, seconds == 951827696UL);
+    datetime_seconds_since_unix_epoch_into_datetime(seconds,
+        &test_bdatetime);
+    ct_test(pTest, datetime_compare(&bdatetime, &test_bdatetime) == 0);
+    ct_test(pTest, test_bdatetime.date.wday == bdatetime.date.wday);
+    /* the last second that fits */
+    datetime_seconds_since_unix_epoch_into_datetime(0xFFFFFFFFUL,
+        &test_bdatetime);
+    ct_test(pTest, test_bdatetime.date.year == 2106);
+    ct_test(pTest, test_bdatetime.date.month == 2);
+    ct_test(pTest, test_bdatetime.date.day == 7);
+    ct_test(pTest, test_bdatetime.time.hour == 6);
+    ct_test(pTest, test_bdatetime.time.min == 28);
+    ct_test(pTest, test_bdatetime.time.sec == 15);
+    /* every day and some seconds of each */
+    for (seconds = 0; seconds < 0xFFFF0000UL; seconds += 86399UL) {
+        datetime_seconds_since_unix_epoch_into_datetime(seconds,
+            &test_bdatetime);
+        test_seconds = datetime_seconds_since_unix_epoch(&test_bdatetime);
+        ct_test(pTest, seconds == test_seconds);
+        if (seconds != test_seconds) {
+            break;
+        }
+    }
+    /* before 1970 */
+    datetime_set_values(&bdatetime, 1969, 12, 31, 23, 59, 59, 0);
+    ct_test(pTest, datetime_seconds_since_unix_epoch(&bdatetime) == 0);
+    ct_test(pTest, datetime_seconds_since_unix_epoch(NULL) == 0);
 }
 
 static void testBACnetDayOfWeek(
@@ -1276,6 +1418,8 @@ void testDateTime(
     assert(rc);
     rc = ct_addTestFunction(pTest, testDateEpoch);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testDateTimeUnixEpoch);
+    assert(rc);
     rc = ct_addTestFunction(pTest, testBACnetDateTimeSeconds);
     assert(rc);
     rc = ct_addTestFunction(pTest, testBACnetDateTimeAdd);
@@ -0,0 +1,701 @@
+/**************************************************************************
+*
+* Copyright (C) 2005 Steve Karg <skarg@users.sourceforge.net>
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*********************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+
+/** @file dlport.c  Several datalinks driven at once, with the routing
+ * between their networks */
+
+#if defined(BACDL_MULTI)
+#include <poll.h>
+#include <time.h>
+#include "bacdef.h"
+#include "bacdcode.h"
+#include "bacint.h"
+#include "npdu.h"
+/* each datalink sizes its own frames; the process uses the largest */
+#include "dlmstp.h"
+#undef MAX_HEADER
+#undef MAX_MPDU
+#include "ethernet.h"
+#undef MAX_HEADER
+#undef MAX_MPDU
+#include "datalink.h"
+#include "dlport.h"
+
+/* the longest interface name of a port */
+#define DLPORT_IFNAME_LEN 64
+
+static const DLPORT_FUNCS Datalinks[] = {
+    {"bip", bip_init,
+#if defined(BBMD_ENABLED) && BBMD_ENABLED
+            bvlc_send_pdu, bvlc_receive,
+#else
+            bip_send_pdu, bip_receive,
+#endif
+            bip_cleanup, bip_get_broadcast_address, bip_get_my_address,
+        bip_socket},
+    {"mstp", dlmstp_init, dlmstp_send_pdu, dlmstp_receive, dlmstp_cleanup,
+        dlmstp_get_broadcast_address, dlmstp_get_my_address, NULL},
+    {"ethernet", ethernet_init, ethernet_send_pdu, ethernet_receive,
+            ethernet_cleanup, ethernet_get_broadcast_address,
+        ethernet_get_my_address, ethernet_socket}
+};
+
+struct dlport {
+    const DLPORT_FUNCS *funcs;
+    char ifname[DLPORT_IFNAME_LEN];
+    /* the network of the port; zero is only allowed for the first */
+    uint16_t net;
+};
+
+/* a network behind a router on one of the ports */
+struct dlport_route {
+    uint16_t net;
+    unsigned port;
+    BACNET_ADDRESS router;
+};
+
+/* the first port is the default one: the local network of the process */
+static struct dlport Ports[DLPORT_MAX_PORTS];
+static unsigned Port_Count;
+/* the port the receive reads first, so each gets its turn */
+static unsigned Next_Port;
+static struct dlport_route Routes[DLPORT_MAX_ROUTES];
+static unsigned Route_Count;
+
+/** Find the functions of a datalink by name.
+ * @param name [in] "bip", "mstp" or "ethernet".
+ * @return The functions, or NULL if the datalink is unknown.
+ */
+const DLPORT_FUNCS *dlport_funcs(
+    const char *name)
+{
+    unsigned i = 0;
+
+    for (i = 0; i < sizeof(Datalinks) / sizeof(Datalinks[0]); i++) {
+        if (strcmp(Datalinks[i].name, name) == 0) {
+            return &Datalinks[i];
+        }
+    }
+
+    return NULL;
+}
+
+/** Add a port; the ports are initialized by dlport_init().
+ * @param funcs [in] The functions of its datalink.
+ * @param ifname [in] The interface of the datalink, or NULL for its default.
+ * @param net [in] The network number of the port.
+ * @return True if the port was added.
+ */
+bool dlport_add(
+    const DLPORT_FUNCS * funcs,
+    char *ifname,
+    uint16_t net)
+{
+    struct dlport *port = NULL;
+    unsigned i = 0;
+
+    if (!funcs || (Port_Count >= DLPORT_MAX_PORTS) ||
+        (net == BACNET_BROADCAST_NETWORK) || ((Port_Count > 0) &&
+            (net == 0))) {
+        return false;
+    }
+    for (i = 0; i < Port_Count; i++) {
+        /* the drivers are single instance */
+        if ((Ports[i].funcs == funcs) || (net && (Ports[i].net == net))) {
+            return false;
+        }
+    }
+    port = &Ports[Port_Count];
+    port->funcs = funcs;
+    port->ifname[0] = 0;
+    if (ifname) {
+        strncpy(port->ifname, ifname, sizeof(port->ifname) - 1);
+        port->ifname[sizeof(port->ifname) - 1] = 0;
+    }
+    port->net = net;
+    Port_Count++;
+
+    return true;
+}
+
+unsigned dlport_count(
+    void)
+{
+    return Port_Count;
+}
+
+uint16_t dlport_network(
+    unsigned port)
+{
+    return (port < Port_Count) ? Ports[port].net : 0;
+}
+
+/* Find the port of a network, and the router it is reached through;
+   the router is NULL for the network of the port itself. */
+static int dlport_route_port(
+    uint16_t net,
+    BACNET_ADDRESS ** router)
+{
+    unsigned i = 0;
+
+    *router = NULL;
+    for (i = 0; i < Port_Count; i++) {
+        if (Ports[i].net == net) {
+            return (int) i;
+        }
+    }
+    for (i = 0; i < Route_Count; i++) {
+        if (Routes[i].net == net) {
+            *router = &Routes[i].router;
+            return (int) Routes[i].port;
+        }
+    }
+
+    return -1;
+}
+
+/* Remember that a network is reached through a router of a port. */
+static void dlport_learn(
+    uint16_t net,
+    unsigned port,
+    BACNET_ADDRESS * router)
+{
+    struct dlport_route *route = NULL;
+    unsigned i = 0;
+
+    if ((net == 0) || (net == BACNET_BROADCAST_NETWORK)) {
+        return;
+    }
+    for (i = 0; i < Port_Count; i++) {
+        if (Ports[i].net == net) {
+            return;
+        }
+    }
+    for (i = 0; i < Route_Count; i++) {
+        if (Routes[i].net == net) {
+            route = &Routes[i];
+            break;
+        }
+    }
+    if (!route) {
+        if (Route_Count >= DLPORT_MAX_ROUTES) {
+            return;
+        }
+        route = &Routes[Route_Count];
+    }
+    memset(&route->router, 0, sizeof(route->router));
+    route->router.mac_len = router->mac_len;
+    memcpy(route->router.mac, router->mac, router->mac_len);
+    route->port = port;
+    route->net = net;
+    if (route == &Routes[Route_Count]) {
+        /* readers see the entry only once it is complete */
+        Route_Count++;
+    }
+}
+
+/* The networks reached through the ports other than the given one, or
+   only the given network if it is one of them. */
+static unsigned dlport_networks_behind(
+    unsigned port,
+    uint16_t net,
+    uint16_t * nets)
+{
+    unsigned count = 0;
+    unsigned i = 0;
+
+    for (i = 0; i < Port_Count; i++) {
+        if ((i != port) && Ports[i].net && (!net || (Ports[i].net == net))) {
+            nets[count++] = Ports[i].net;
+        }
+    }
+    for (i = 0; i < Route_Count; i++) {
+        if ((Routes[i].port != port) && (!net || (Routes[i].net == net))) {
+            nets[count++] = Routes[i].net;
+        }
+    }
+
+    return count;
+}
+
+/* Broadcast an I-Am-Router-To-Network on a port. */
+static void dlport_send_i_am_router(
+    unsigned port,
+    uint16_t * nets,
+    unsigned count)
+{
+    uint8_t buf[MAX_MPDU];
+    BACNET_ADDRESS dest;
+    BACNET_NPDU_DATA npdu_data;
+    int len = 0;
+    unsigned i = 0;
+
+    npdu_encode_npdu_data(&npdu_data, false, MESSAGE_PRIORITY_NORMAL);
+    npdu_data.network_layer_message = true;
+    npdu_data.network_message_type = NETWORK_MESSAGE_I_AM_ROUTER_TO_NETWORK;
+    len = npdu_encode_pdu(buf, NULL, NULL, &npdu_data);
+    for (i = 0; (i < count) && (len + 2 <= (int) sizeof(buf)); i++) {
+        len += encode_unsigned16(&buf[len], nets[i]);
+    }
+    Ports[port].funcs->get_broadcast_address(&dest);
+    Ports[port].funcs->send_pdu(&dest, &npdu_data, buf, (unsigned) len);
+}
+
+/* Answer the Who-Is-Router-To-Network of a port, and learn the networks
+   of the I-Am-Router-To-Network. */
+static void dlport_network_message(
+    unsigned port,
+    BACNET_ADDRESS * src,
+    BACNET_NPDU_DATA * npdu_data,
+    uint8_t * data,
+    int data_len)
+{
+    uint16_t nets[DLPORT_MAX_PORTS + DLPORT_MAX_ROUTES];
+    uint16_t net = 0;
+    unsigned count = 0;
+    int i = 0;
+
+    switch (npdu_data->network_message_type) {
+        case NETWORK_MESSAGE_WHO_IS_ROUTER_TO_NETWORK:
+            if (data_len >= 2) {
+                decode_unsigned16(data, &net);
+            }
+            count = dlport_networks_behind(port, net, nets);
+            if (count) {
+                dlport_send_i_am_router(port, nets, count);
+            }
+            break;
+        case NETWORK_MESSAGE_I_AM_ROUTER_TO_NETWORK:
+            for (i = 0; i + 2 <= data_len; i += 2) {
+                decode_unsigned16(&data[i], &net);
+                dlport_learn(net, port, src);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* Send an NPDU out of a port, with the given network header in front of
+   the APDU (or network message) of the original. */
+static int dlport_send_npdu(
+    unsigned port,
+    BACNET_ADDRESS * link,
+    BACNET_ADDRESS * dest,
+    BACNET_ADDRESS * src,
+    BACNET_NPDU_DATA * npdu_data,
+    uint8_t * apdu,
+    unsigned apdu_len)
+{
+    uint8_t buf[MAX_MPDU];
+    int len = 0;
+
+    len = npdu_encode_pdu(buf, dest, src, npdu_data);
+    if ((len <= 0) || (len + apdu_len > sizeof(buf))) {
+        return -1;
+    }
+    memcpy(&buf[len], apdu, apdu_len);
+
+    return Ports[port].funcs->send_pdu(link, npdu_data, buf,
+        (unsigned) len + apdu_len);
+}
+
+/* Route a message that arrived on one port out of another. */
+static void dlport_forward(
+    unsigned from,
+    BACNET_ADDRESS * from_mac,
+    unsigned to,
+    BACNET_ADDRESS * npdu_dest,
+    BACNET_ADDRESS * npdu_src,
+    BACNET_NPDU_DATA * npdu_data,
+    uint8_t * apdu,
+    unsigned apdu_len)
+{
+    BACNET_ADDRESS dest = *npdu_dest;
+    BACNET_ADDRESS src = *npdu_src;
+    BACNET_NPDU_DATA data = *npdu_data;
+    BACNET_ADDRESS link;
+    BACNET_ADDRESS *router = NULL;
+
+    if (src.net == 0) {
+        if (Ports[from].net == 0) {
+            /* the reply could not find its way back */
+            return;
+        }
+        src.net = Ports[from].net;
+        src.len = from_mac->mac_len;
+        memcpy(src.adr, from_mac->mac, from_mac->mac_len);
+    }
+    memset(&link, 0, sizeof(link));
+    if (dest.net == Ports[to].net) {
+        /* the last hop: a local message of that network */
+        if (dest.len == 0) {
+            Ports[to].funcs->get_broadcast_address(&link);
+        } else {
+            link.mac_len = dest.len;
+            memcpy(link.mac, dest.adr, dest.len);
+        }
+        dest.net = 0;
+        dest.len = 0;
+    } else {
+        if (data.hop_count <= 1) {
+            return;
+        }
+        data.hop_count--;
+        if ((dest.net != BACNET_BROADCAST_NETWORK) &&
+            (dlport_route_port(dest.net, &router) == (int) to) && router) {
+            link = *router;
+        } else {
+            Ports[to].funcs->get_broadcast_address(&link);
+        }
+    }
+    dlport_send_npdu(to, &link, &dest, &src, &data, apdu, apdu_len);
+}
+
+/* Route a message received on a port, and make what is left for the
+   application look like it came from the network of the port.
+   Returns the length of the message to deliver, or zero. */
+static uint16_t dlport_accept(
+    unsigned port,
+    BACNET_ADDRESS * src,
+    uint8_t * pdu,
+    uint16_t pdu_len,
+    uint16_t max_pdu)
+{
+    uint8_t header[MAX_NPDU];
+    BACNET_ADDRESS dest;
+    BACNET_ADDRESS npdu_src;
+    BACNET_ADDRESS my_address;
+    BACNET_ADDRESS *router = NULL;
+    BACNET_NPDU_DATA npdu_data;
+    unsigned apdu_len = 0;
+    bool deliver = true;
+    int offset = 0;
+    int len = 0;
+    int to = 0;
+    unsigned i = 0;
+
+    if ((pdu_len < 2) || (pdu[0] != BACNET_PROTOCOL_VERSION)) {
+        return 0;
+    }
+    memset(&npdu_src, 0, sizeof(npdu_src));
+    offset = npdu_decode(pdu, &dest, &npdu_src, &npdu_data);
+    if ((offset <= 0) || (offset > pdu_len)) {
+        return 0;
+    }
+    apdu_len = pdu_len - (unsigned) offset;
+    if (npdu_src.net) {
+        dlport_learn(npdu_src.net, port, src);
+    }
+    if (npdu_data.network_layer_message && ((dest.net == 0) ||
+            (dest.net == BACNET_BROADCAST_NETWORK))) {
+        dlport_network_message(port, src, &npdu_data, &pdu[offset],
+            (int) apdu_len);
+    }
+    if (dest.net == BACNET_BROADCAST_NETWORK) {
+        for (i = 0; i < Port_Count; i++) {
+            if (i != port) {
+                dlport_forward(port, src, i, &dest, &npdu_src, &npdu_data,
+                    &pdu[offset], apdu_len);
+            }
+        }
+    } else if (dest.net && (dest.net != Ports[port].net)) {
+        to = dlport_route_port(dest.net, &router);
+        if ((to < 0) || (to == (int) port)) {
+            return 0;
+        }
+        deliver = false;
+        if (Ports[to].net == dest.net) {
+            Ports[to].funcs->get_my_address(&my_address);
+            if (dest.len && (dest.len == my_address.mac_len) &&
+                (memcmp(dest.adr, my_address.mac, dest.len) == 0)) {
+                /* addressed to the application on that network */
+                deliver = true;
+            } else {
+                dlport_forward(port, src, (unsigned) to, &dest, &npdu_src,
+                    &npdu_data, &pdu[offset], apdu_len);
+                /* a broadcast on that network reaches us too */
+                deliver = (dest.len == 0);
+            }
+        } else {
+            dlport_forward(port, src, (unsigned) to, &dest, &npdu_src,
+                &npdu_data, &pdu[offset], apdu_len);
+        }
+    }
+    if (!deliver || npdu_data.network_layer_message) {
+        return 0;
+    }
+    if ((port == 0 || npdu_src.net) && ((dest.net == 0) ||
+            (dest.net == BACNET_BROADCAST_NETWORK))) {
+        return pdu_len;
+    }
+    /* the application only takes local and global messages, and binds
+       the sender to the network of its port */
+    if (dest.net != BACNET_BROADCAST_NETWORK) {
+        dest.net = 0;
+        dest.len = 0;
+    }
+    if ((port > 0) && (npdu_src.net == 0)) {
+        npdu_src.net = Ports[port].net;
+        npdu_src.len = src->mac_len;
+        memcpy(npdu_src.adr, src->mac, src->mac_len);
+    }
+    len = npdu_encode_pdu(header, &dest, &npdu_src, &npdu_data);
+    if ((len <= 0) || (len + apdu_len > max_pdu)) {
+        return 0;
+    }
+    memmove(&pdu[len], &pdu[offset], apdu_len);
+    memcpy(pdu, header, (size_t) len);
+
+    return (uint16_t) (len + apdu_len);
+}
+
+/** Initialize the ports.
+ * @param spec [in] The ports, as comma separated type[:ifname[:net]],
+ *  for example "bip,mstp:/dev/ttyUSB0:2001,ethernet:eth1:3001".
+ *  The first port is the local network of the process; the others need
+ *  their network numbers.  NULL is a single B/IP port.
+ * @return True if every port was initialized.
+ */
+bool dlport_init(
+    char *spec)
+{
+    char buf[256];
+    char *entry = NULL;
+    char *next = NULL;
+    char *ifname = NULL;
+    char *net = NULL;
+    uint16_t nets[DLPORT_MAX_PORTS];
+    unsigned count = 0;
+    unsigned i = 0;
+
+    if (Port_Count == 0) {
+        strncpy(buf, spec ? spec : "bip", sizeof(buf) - 1);
+        buf[sizeof(buf) - 1] = 0;
+        for (entry = buf; entry; entry = next) {
+            next = strchr(entry, ',');
+            if (next) {
+                *next++ = 0;
+            }
+            ifname = strchr(entry, ':');
+            net = NULL;
+            if (ifname) {
+                *ifname++ = 0;
+                net = strrchr(ifname, ':');
+                if (net) {
+                    *net++ = 0;
+                }
+            }
+            if (!dlport_add(dlport_funcs(entry), ifname,
+                    net ? (uint16_t) strtoul(net, NULL, 0) : 0)) {
+                Port_Count = 0;
+                return false;
+            }
+        }
+    }
+    for (i = 0; i < Port_Count; i++) {
+        if (!Ports[i].funcs->init(Ports[i].ifname[0] ? Ports[i].ifname :
+                NULL)) {
+            while (i > 0) {
+                Ports[--i].funcs->cleanup();
+            }
+            return false;
+        }
+    }
+    if (Port_Count > 1) {
+        for (i = 0; i < Port_Count; i++) {
+            count = dlport_networks_behind(i, 0, nets);
+            if (count) {
+                dlport_send_i_am_router(i, nets, count);
+            }
+        }
+    }
+
+    return true;
+}
+
+/** Send a PDU: local and global messages go out of the first port, and
+ * to another network out of the port that reaches it.
+ * @see datalink_send_pdu
+ */
+int dlport_send_pdu(
+    BACNET_ADDRESS * dest,
+    BACNET_NPDU_DATA * npdu_data,
+    uint8_t * pdu,
+    unsigned pdu_len)
+{
+    BACNET_ADDRESS npdu_dest;
+    BACNET_ADDRESS npdu_src;
+    BACNET_ADDRESS link;
+    BACNET_ADDRESS *router = NULL;
+    BACNET_NPDU_DATA data;
+    int offset = 0;
+    int bytes = -1;
+    int sent = 0;
+    int port = 0;
+    unsigned i = 0;
+
+    if (Port_Count == 0) {
+        return -1;
+    }
+    if ((Port_Count == 1) || (dest->net == 0)) {
+        return Ports[0].funcs->send_pdu(dest, npdu_data, pdu, pdu_len);
+    }
+    if (dest->net == BACNET_BROADCAST_NETWORK) {
+        for (i = 0; i < Port_Count; i++) {
+            sent = Ports[i].funcs->send_pdu(dest, npdu_data, pdu, pdu_len);
+            if (sent > bytes) {
+                bytes = sent;
+            }
+        }
+        return bytes;
+    }
+    port = dlport_route_port(dest->net, &router);
+    if (port < 0) {
+        /* a router of the local network may know it */
+        return Ports[0].funcs->send_pdu(dest, npdu_data, pdu, pdu_len);
+    }
+    if (router) {
+        return Ports[port].funcs->send_pdu(router, npdu_data, pdu, pdu_len);
+    }
+    /* the network of a port: the application is local to it */
+    memset(&npdu_src, 0, sizeof(npdu_src));
+    offset = npdu_decode(pdu, &npdu_dest, &npdu_src, &data);
+    if ((offset <= 0) || ((unsigned) offset > pdu_len)) {
+        return -1;
+    }
+    memset(&link, 0, sizeof(link));
+    if (dest->len == 0) {
+        Ports[port].funcs->get_broadcast_address(&link);
+    } else {
+        link.mac_len = dest->len;
+        memcpy(link.mac, dest->adr, dest->len);
+    }
+
+    return dlport_send_npdu((unsigned) port, &link, NULL, &npdu_src, &data,
+        &pdu[offset], pdu_len - (unsigned) offset);
+}
+
+static uint32_t dlport_milliseconds(
+    void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint32_t) (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+/** Receive the next message for the application from any of the ports,
+ * routing the messages for the other networks on the way.
+ * @see datalink_receive
+ */
+uint16_t dlport_receive(
+    BACNET_ADDRESS * src,
+    uint8_t * pdu,
+    uint16_t max_pdu,
+    unsigned timeout)
+{
+    struct pollfd fds[DLPORT_MAX_PORTS];
+    uint32_t start = 0;
+    uint32_t elapsed = 0;
+    uint16_t pdu_len = 0;
+    bool polled = false;
+    unsigned nfds = 0;
+    unsigned wait = 0;
+    unsigned port = 0;
+    unsigned i = 0;
+
+    if (Port_Count == 0) {
+        return 0;
+    }
+    if (Port_Count == 1) {
+        return Ports[0].funcs->receive(src, pdu, max_pdu, timeout);
+    }
+    for (i = 0; i < Port_Count; i++) {
+        if (Ports[i].funcs->socket) {
+            fds[nfds].fd = Ports[i].funcs->socket();
+            fds[nfds].events = POLLIN;
+            nfds++;
+        } else {
+            polled = true;
+        }
+    }
+    start = dlport_milliseconds();
+    for (;;) {
+        /* the queued and polled messages first, then wait for more */
+        for (i = 0; i < Port_Count; i++) {
+            port = (Next_Port + i) % Port_Count;
+            pdu_len = Ports[port].funcs->receive(src, pdu, max_pdu, 0);
+            if (pdu_len) {
+                Next_Port = (port + 1) % Port_Count;
+                pdu_len = dlport_accept(port, src, pdu, pdu_len, max_pdu);
+                if (pdu_len) {
+                    return pdu_len;
+                }
+            }
+        }
+        elapsed = dlport_milliseconds() - start;
+        if (elapsed >= timeout) {
+            return 0;
+        }
+        wait = timeout - elapsed;
+        if (polled && (wait > DLPORT_POLL_MS)) {
+            wait = DLPORT_POLL_MS;
+        }
+        poll(fds, nfds, (int) wait);
+    }
+}
+
+void dlport_cleanup(
+    void)
+{
+    while (Port_Count > 0) {
+        Ports[--Port_Count].funcs->cleanup();
+    }
+    Route_Count = 0;
+}
+
+void dlport_get_broadcast_address(
+    BACNET_ADDRESS * dest)
+{
+    if (Port_Count) {
+        Ports[0].funcs->get_broadcast_address(dest);
+    }
+}
+
+void dlport_get_my_address(
+    BACNET_ADDRESS * my_address)
+{
+    if (Port_Count) {
+        Ports[0].funcs->get_my_address(my_address);
+    }
+}
+#endif
@@ -41,7 +41,7 @@
 * This library only uses a byte sized chunk for a data element.
 * It uses a data store whose size is a power of 2 (8, 16, 32, 64, ...)
 * and doesn't waste any data bytes.  It has very low overhead, and
-* utilizes modulo for indexing the data in the data store.
+* masks the free running head and tail to index the data in the data store.
 *
 * To use this library, first declare a data store, sized for a power of 2:
 * {@code
@@ -88,12 +88,32 @@
 * checking the queue for data using FIFO_Empty(), and then pulling data from
 * the queue using FIFO_Get().
 *
+* A DMA engine or a parser can also work on the data store in place:
+* {@code
+* volatile uint8_t *span;
+* unsigned length = 0;
+*
+* span = FIFO_Put_Span(&queue, &length);
+* length = receive_into(span, length);
+* (void) FIFO_Put_Commit(&queue, length);
+* span = FIFO_Peek_Span(&queue, &length);
+* length = parse(span, length);
+* (void) FIFO_Pull_Commit(&queue, length);
+* }
+* A span stops at the end of the data store, so the rest of the data, or
+* of the free space, is in the next span.
+*
 */
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include "fifo.h"
 
+/* buffer_len is a power of two, so this is the free running index modulo
+   buffer_len */
+#define FIFO_INDEX(b, i) ((i) & ((b)->buffer_len - 1))
+
 /**
 * Returns the number of bytes in the FIFO
 *
@@ -171,7 +191,7 @@ uint8_t FIFO_Peek(
     unsigned index;
 
     if (b) {
-        index = b->tail % b->buffer_len;
+        index = FIFO_INDEX(b, b->tail);
         return (b->buffer[index]);
     }
 
@@ -195,7 +215,7 @@ uint8_t FIFO_Get(
     unsigned index;
 
     if (!FIFO_Empty(b)) {
-        index = b->tail % b->buffer_len;
+        index = FIFO_INDEX(b, b->tail);
         data_byte = b->buffer[index];
         b->tail++;
     }
@@ -219,30 +239,29 @@ unsigned FIFO_Pull(
     unsigned length)
 {
     unsigned count;
-    uint8_t data_byte;
     unsigned index;
+    unsigned span;
 
     count = FIFO_Count(b);
     if (count > length) {
         /* adjust to limit the number of bytes pulled */
         count = length;
     }
-    if (length > count) {
-        /* adjust the return value */
-        length = count;
-    }
-    while (count) {
-        index = b->tail % b->buffer_len;
-        data_byte = b->buffer[index];
-        b->tail++;
+    if (count) {
         if (buffer) {
-            *buffer = data_byte;
-            buffer++;
+            /* up to the end of the data store, then from its start */
+            index = FIFO_INDEX(b, b->tail);
+            span = b->buffer_len - index;
+            if (span > count) {
+                span = count;
+            }
+            memcpy(buffer, (uint8_t *) & b->buffer[index], span);
+            memcpy(&buffer[span], (uint8_t *) & b->buffer[0], count - span);
         }
-        count--;
+        b->tail += count;
     }
 
-    return length;
+    return count;
 }
 
 /**
@@ -263,7 +282,7 @@ bool FIFO_Put(
     if (b) {
         /* limit the buffer to prevent overwriting */
         if (!FIFO_Full(b)) {
-            index = b->head % b->buffer_len;
+            index = FIFO_INDEX(b, b->head);
             b->buffer[index] = data_byte;
             b->head++;
             status = true;
@@ -289,22 +308,146 @@ bool FIFO_Add(
 {
     bool status = false;        /* return value */
     unsigned index;
+    unsigned span;
 
     /* limit the buffer to prevent overwriting */
     if (FIFO_Available(b, count) && buffer) {
-        while (count) {
-            index = b->head % b->buffer_len;
-            b->buffer[index] = *buffer;
-            b->head++;
-            buffer++;
-            count--;
+        /* up to the end of the data store, then from its start */
+        index = FIFO_INDEX(b, b->head);
+        span = b->buffer_len - index;
+        if (span > count) {
+            span = count;
         }
+        memcpy((uint8_t *) & b->buffer[index], buffer, span);
+        memcpy((uint8_t *) & b->buffer[0], &buffer[span], count - span);
+        /* then let the consumer see it */
+        b->head += count;
         status = true;
     }
 
     return status;
 }
 
+/**
+* Gets the data at the front of the FIFO that is contiguous in the data
+* store, without removing it.
+*
+* @param b - pointer to FIFO_BUFFER structure
+* @param length [out] - number of bytes in the span
+*
+* @return pointer to the first byte, or NULL if the FIFO is empty
+*/
+volatile uint8_t *FIFO_Peek_Span(
+    FIFO_BUFFER const *b,
+    unsigned *length)
+{
+    volatile uint8_t *span = NULL;
+    unsigned count;
+    unsigned index;
+
+    count = FIFO_Count(b);
+    if (count) {
+        index = FIFO_INDEX(b, b->tail);
+        if (count > (b->buffer_len - index)) {
+            count = b->buffer_len - index;
+        }
+        span = &b->buffer[index];
+    }
+    if (length) {
+        *length = count;
+    }
+
+    return span;
+}
+
+/**
+* Removes bytes from the front of the FIFO, such as those of a span from
+* FIFO_Peek_Span() that have been used in place.
+*
+* @param b - pointer to FIFO_BUFFER structure
+* @param count [in] - number of bytes to remove
+*
+* @return the number of bytes actually removed
+*/
+unsigned FIFO_Pull_Commit(
+    FIFO_BUFFER * b,
+    unsigned count)
+{
+    unsigned available;
+
+    available = FIFO_Count(b);
+    if (count > available) {
+        count = available;
+    }
+    if (count) {
+        b->tail += count;
+    }
+
+    return count;
+}
+
+/**
+* Gets the free space at the end of the FIFO that is contiguous in the
+* data store, so that data can be written there in place.
+*
+* @param b - pointer to FIFO_BUFFER structure
+* @param length [out] - number of bytes in the span
+*
+* @return pointer to the first free byte, or NULL if the FIFO is full
+*/
+volatile uint8_t *FIFO_Put_Span(
+    FIFO_BUFFER const *b,
+    unsigned *length)
+{
+    volatile uint8_t *span = NULL;
+    unsigned count = 0;
+    unsigned index;
+
+    if (b) {
+        count = b->buffer_len - FIFO_Count(b);
+        if (count) {
+            index = FIFO_INDEX(b, b->head);
+            if (count > (b->buffer_len - index)) {
+                count = b->buffer_len - index;
+            }
+            span = &b->buffer[index];
+        }
+    }
+    if (length) {
+        *length = count;
+    }
+
+    return span;
+}
+
+/**
+* Adds the bytes written in place into a span from FIFO_Put_Span()
+* to the end of the FIFO.
+*
+* @param b - pointer to FIFO_BUFFER structure
+* @param count [in] - number of bytes written into the span
+*
+* @return the number of bytes actually added
+*/
+unsigned FIFO_Put_Commit(
+    FIFO_BUFFER * b,
+    unsigned count)
+{
+    unsigned available = 0;
+
+    if (b) {
+        available = b->buffer_len - FIFO_Count(b);
+        if (count > available) {
+            count = available;
+        }
+        b->head += count;
+    } else {
+        count = 0;
+    }
+
+    return count;
+}
+
 /**
 * Flushes any data in the FIFO buffer
 *
@@ -472,6 +615,91 @@ void testFIFOBuffer(
     return;
 }
 
+/**
+* Unit Test for the bulk and in place operations across the end of the
+* data store
+*
+* @param pTest - test tracking pointer
+*/
+void testFIFOSpan(
+    Test * pTest)
+{
+    FIFO_BUFFER test_buffer = { 0 };
+    volatile uint8_t data_store[64] = { 0 };
+    uint8_t add_data[40] = { 0 };
+    uint8_t test_data[40] = { 0 };
+    volatile uint8_t *span = NULL;
+    unsigned length = 0;
+    unsigned offset = 0;
+    unsigned index = 0;
+    unsigned count = 0;
+    bool status = false;
+
+    for (index = 0; index < sizeof(add_data); index++) {
+        add_data[index] = (uint8_t) (index + 1);
+    }
+    FIFO_Init(&test_buffer, data_store, sizeof(data_store));
+    /* every place the data can start, so some of the copies wrap */
+    for (offset = 0; offset < sizeof(data_store); offset++) {
+        status = FIFO_Add(&test_buffer, add_data, sizeof(add_data));
+        ct_test(pTest, status == true);
+        ct_test(pTest, FIFO_Count(&test_buffer) == sizeof(add_data));
+        memset(test_data, 0, sizeof(test_data));
+        count = FIFO_Pull(&test_buffer, test_data, sizeof(test_data));
+        ct_test(pTest, count == sizeof(test_data));
+        ct_test(pTest, memcmp(test_data, add_data, sizeof(add_data)) == 0);
+        ct_test(pTest, FIFO_Empty(&test_buffer));
+        /* written in place, in as many spans as it takes */
+        count = 0;
+        while (count < sizeof(add_data)) {
+            span = FIFO_Put_Span(&test_buffer, &length);
+            ct_test(pTest, span != NULL);
+            ct_test(pTest, length > 0);
+            if (length > (sizeof(add_data) - count)) {
+                length = sizeof(add_data) - count;
+            }
+            for (index = 0; index < length; index++) {
+                span[index] = add_data[count + index];
+            }
+            ct_test(pTest, FIFO_Put_Commit(&test_buffer, length) == length);
+            count += length;
+        }
+        /* read in place */
+        count = 0;
+        while (!FIFO_Empty(&test_buffer)) {
+            span = FIFO_Peek_Span(&test_buffer, &length);
+            ct_test(pTest, span != NULL);
+            for (index = 0; index < length; index++) {
+                ct_test(pTest, span[index] == add_data[count + index]);
+            }
+            ct_test(pTest, FIFO_Pull_Commit(&test_buffer, length) == length);
+            count += length;
+        }
+        ct_test(pTest, count == sizeof(add_data));
+        /* move the start by one */
+        (void) FIFO_Put(&test_buffer, 0);
+        (void) FIFO_Get(&test_buffer);
+    }
+    /* the spans stop at the limits */
+    span = FIFO_Peek_Span(&test_buffer, &length);
+    ct_test(pTest, span == NULL);
+    ct_test(pTest, length == 0);
+    ct_test(pTest, FIFO_Pull_Commit(&test_buffer, 1) == 0);
+    while (FIFO_Put(&test_buffer, 1)) {
+        /* fill it */
+    }
+    span = FIFO_Put_Span(&test_buffer, &length);
+    ct_test(pTest, span == NULL);
+    ct_test(pTest, length == 0);
+    ct_test(pTest, FIFO_Put_Commit(&test_buffer, 1) == 0);
+    status = FIFO_Add(&test_buffer, add_data, 1);
+    ct_test(pTest, status == false);
+    /* more than there is */
+    count = FIFO_Pull(&test_buffer, NULL, sizeof(data_store) * 2);
+    ct_test(pTest, count == sizeof(data_store));
+    ct_test(pTest, FIFO_Empty(&test_buffer));
+}
+
 #ifdef TEST_FIFO_BUFFER
 /**
 * Main program entry for Unit Test
@@ -489,6 +717,8 @@ int main(
     /* individual tests */
     rc = ct_addTestFunction(pTest, testFIFOBuffer);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testFIFOSpan);
+    assert(rc);
 
     ct_setStream(pTest, stdout);
     ct_run(pTest);
@@ -139,6 +139,28 @@ int iam_decode_service_request(
     return apdu_len;
 }
 
+/** Peek at the device instance of an I-Am, without decoding the rest.
+ * @param apdu [in] The service request of the I-Am.
+ * @param apdu_len [in] The length of the service request.
+ * @param pDevice_id [out] The device instance.
+ * @return True if the I-Am starts with a Device object identifier.
+ */
+bool iam_decode_device_id(
+    uint8_t * apdu,
+    uint16_t apdu_len,
+    uint32_t * pDevice_id)
+{
+    uint16_t object_type = 0;
+
+    /* an object identifier is always application tag 12 of 4 octets */
+    if ((apdu_len < 5) ||
+        (apdu[0] != ((BACNET_APPLICATION_TAG_OBJECT_ID << 4) | 4)))
+        return false;
+    (void) decode_object_id(&apdu[1], &object_type, pDevice_id);
+
+    return (object_type == OBJECT_DEVICE);
+}
+
 #ifdef TEST
 #include <assert.h>
 #include <string.h>
@@ -196,6 +218,15 @@ void testIAm(
     ct_test(pTest, test_vendor_id == vendor_id);
     ct_test(pTest, test_max_apdu == max_apdu);
     ct_test(pTest, test_segmentation == segmentation);
+
+    test_device_id = 0;
+    ct_test(pTest, iam_decode_device_id(&apdu[2], (uint16_t) (len - 2),
+            &test_device_id));
+    ct_test(pTest, test_device_id == device_id);
+    ct_test(pTest, !iam_decode_device_id(&apdu[2], 4, &test_device_id));
+    apdu[3] ^= 0x80;
+    ct_test(pTest, !iam_decode_device_id(&apdu[2], (uint16_t) (len - 2),
+            &test_device_id));
 }
 
 #ifdef TEST_IAM
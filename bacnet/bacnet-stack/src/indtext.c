@@ -32,7 +32,9 @@
  -------------------------------------------
 ####COPYRIGHTEND####*/
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include "indtext.h"
 
 /** @file indtext.c  Maps text strings and indices of type INDTEXT_DATA */
@@ -191,6 +193,169 @@ unsigned indtext_count(
     return count;
 }
 
+/* FNV-1a of the lower case text */
+static unsigned indtext_hash_string(
+    const char *text)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*text) {
+        hash ^= (unsigned char) tolower((unsigned char) *text);
+        hash *= 16777619u;
+        text++;
+    }
+
+    return (unsigned) hash;
+}
+
+static unsigned indtext_hash_index(
+    unsigned index)
+{
+    uint32_t hash = (uint32_t) index * 2654435761u;
+
+    return (unsigned) (hash ^ (hash >> 16));
+}
+
+bool indtext_hash_build(
+    INDTEXT_HASH * hash)
+{
+    INDTEXT_DATA *data = NULL;
+    unsigned size = 1;
+    unsigned slot = 0;
+    unsigned count = 0;
+
+    if (!hash) {
+        return false;
+    }
+    if (hash->size) {
+        return true;
+    }
+    count = indtext_count(hash->data_list);
+    /* at most half full */
+    while (size < count * 2) {
+        size *= 2;
+    }
+    hash->by_string = calloc(size, sizeof(INDTEXT_DATA *));
+    hash->by_index = calloc(size, sizeof(INDTEXT_DATA *));
+    if (!hash->by_string || !hash->by_index) {
+        indtext_hash_free(hash);
+        return false;
+    }
+    for (data = hash->data_list; data && data->pString; data++) {
+        slot = indtext_hash_string(data->pString) & (size - 1);
+        while (hash->by_string[slot] &&
+            stricmp(hash->by_string[slot]->pString, data->pString) != 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        if (!hash->by_string[slot]) {
+            hash->by_string[slot] = data;
+        }
+        slot = indtext_hash_index(data->index) & (size - 1);
+        while (hash->by_index[slot] &&
+            hash->by_index[slot]->index != data->index) {
+            slot = (slot + 1) & (size - 1);
+        }
+        if (!hash->by_index[slot]) {
+            hash->by_index[slot] = data;
+        }
+    }
+    hash->size = size;
+
+    return true;
+}
+
+void indtext_hash_free(
+    INDTEXT_HASH * hash)
+{
+    if (hash) {
+        free(hash->by_string);
+        free(hash->by_index);
+        hash->by_string = NULL;
+        hash->by_index = NULL;
+        hash->size = 0;
+    }
+}
+
+bool indtext_hash_by_istring(
+    INDTEXT_HASH * hash,
+    const char *search_name,
+    unsigned *found_index)
+{
+    INDTEXT_DATA *data = NULL;
+    unsigned slot = 0;
+
+    if (!hash || !search_name) {
+        return false;
+    }
+    if (!indtext_hash_build(hash)) {
+        return indtext_by_istring(hash->data_list, search_name, found_index);
+    }
+    slot = indtext_hash_string(search_name) & (hash->size - 1);
+    while ((data = hash->by_string[slot]) != NULL) {
+        if (stricmp(data->pString, search_name) == 0) {
+            if (found_index) {
+                *found_index = data->index;
+            }
+            return true;
+        }
+        slot = (slot + 1) & (hash->size - 1);
+    }
+
+    return false;
+}
+
+unsigned indtext_hash_by_istring_default(
+    INDTEXT_HASH * hash,
+    const char *search_name,
+    unsigned default_index)
+{
+    unsigned index = 0;
+
+    if (!indtext_hash_by_istring(hash, search_name, &index))
+        index = default_index;
+
+    return index;
+}
+
+const char *indtext_hash_by_index_default(
+    INDTEXT_HASH * hash,
+    unsigned index,
+    const char *default_name)
+{
+    INDTEXT_DATA *data = NULL;
+    unsigned slot = 0;
+
+    if (!hash) {
+        return default_name;
+    }
+    if (!indtext_hash_build(hash)) {
+        return indtext_by_index_default(hash->data_list, index, default_name);
+    }
+    slot = indtext_hash_index(index) & (hash->size - 1);
+    while ((data = hash->by_index[slot]) != NULL) {
+        if (data->index == index) {
+            return data->pString;
+        }
+        slot = (slot + 1) & (hash->size - 1);
+    }
+
+    return default_name;
+}
+
+const char *indtext_hash_by_index_split_default(
+    INDTEXT_HASH * hash,
+    unsigned index,
+    unsigned split_index,
+    const char *before_split_default_name,
+    const char *default_name)
+{
+    if (index < split_index)
+        return indtext_hash_by_index_default(hash, index,
+            before_split_default_name);
+    else
+        return indtext_hash_by_index_default(hash, index, default_name);
+}
+
 #ifdef TEST
 #include <assert.h>
 #include "ctest.h"
@@ -238,6 +403,60 @@ void testIndexText(
     ct_test(pTest, index == indtext_by_istring_default(data_list, "ANNA",
             index));
 }
+
+static INDTEXT_DATA duplicate_list[] = {
+    {1, "one"},
+    {2, "two"},
+    {1, "uno"},
+    {3, "TWO"},
+    {0, NULL}
+};
+
+void testIndexTextHash(
+    Test * pTest)
+{
+    INDTEXT_HASH hash = INDTEXT_HASH_INIT(data_list);
+    INDTEXT_HASH duplicates = INDTEXT_HASH_INIT(duplicate_list);
+    INDTEXT_HASH empty = INDTEXT_HASH_INIT(NULL);
+    unsigned i; /*counter */
+    unsigned index = 0;
+    bool valid;
+
+    /* the same answers as the scans */
+    for (i = 0; i < 10; i++) {
+        ct_test(pTest, indtext_hash_by_index_default(&hash, i, NULL) ==
+            indtext_by_index(data_list, i));
+    }
+    for (i = 0; data_list[i].pString; i++) {
+        valid = indtext_hash_by_istring(&hash, data_list[i].pString, &index);
+        ct_test(pTest, valid == true);
+        ct_test(pTest, index == data_list[i].index);
+    }
+    ct_test(pTest, hash.size >= 2 * indtext_count(data_list));
+    ct_test(pTest, indtext_hash_by_istring(&hash, "JOSHUA", &index) == true);
+    ct_test(pTest, index == 1);
+    ct_test(pTest, indtext_hash_by_istring(&hash, "Harry", NULL) == false);
+    ct_test(pTest, indtext_hash_by_istring(&hash, NULL, NULL) == false);
+    ct_test(pTest, indtext_hash_by_istring_default(&hash, "Harry", 99) == 99);
+    ct_test(pTest, strcmp(indtext_hash_by_index_split_default(&hash, 7, 8,
+                "before", "after"), "before") == 0);
+    ct_test(pTest, strcmp(indtext_hash_by_index_split_default(&hash, 9, 8,
+                "before", "after"), "after") == 0);
+    /* the first entry wins */
+    ct_test(pTest, strcmp(indtext_hash_by_index_default(&duplicates, 1,
+                NULL), "one") == 0);
+    ct_test(pTest, indtext_hash_by_istring(&duplicates, "two", &index));
+    ct_test(pTest, index == 2);
+    ct_test(pTest, indtext_hash_by_istring(&duplicates, "uno", &index));
+    ct_test(pTest, index == 1);
+    /* an empty list */
+    ct_test(pTest, indtext_hash_by_istring(&empty, "one", NULL) == false);
+    ct_test(pTest, indtext_hash_by_index_default(&empty, 1, NULL) == NULL);
+    indtext_hash_free(&hash);
+    ct_test(pTest, hash.size == 0);
+    indtext_hash_free(&duplicates);
+    indtext_hash_free(&empty);
+}
 #endif
 
 #ifdef TEST_INDEX_TEXT
@@ -252,6 +471,8 @@ int main(
     /* individual tests */
     rc = ct_addTestFunction(pTest, testIndexText);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testIndexTextHash);
+    assert(rc);
 
     ct_setStream(pTest, stdout);
     ct_run(pTest);
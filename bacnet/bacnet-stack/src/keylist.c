@@ -41,6 +41,7 @@
 /* static data */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "keylist.h"    /* check for valid prototypes */
 
@@ -73,39 +74,34 @@ static struct Keylist *KeylistCreate(
 /* check to see if the array is big enough for an addition */
 /* or is too big when we are deleting and we can shrink */
 /* returns TRUE if success, FALSE if failed */
+/* The array doubles when it is full, so adding n nodes moves them O(n) */
+/* times in all, and halves when only a quarter is used, so adding and */
+/* deleting around one size does not resize it each time. */
 static int CheckArraySize(
     OS_Keylist list)
 {
     int new_size = 0;   /* set it up so that no size change is the default */
     const int chunk = 8;        /* minimum number of nodes to allocate memory for */
     struct Keylist_Node **new_array;    /* new array of nodes, if needed */
-    int i;      /* counter */
     if (!list)
         return FALSE;
 
     /* indicates the need for more memory allocation */
     if (list->count == list->size)
-        new_size = list->size + chunk;
+        new_size = list->size ? (list->size * 2) : chunk;
 
     /* allow for shrinking memory */
-    else if ((list->size > chunk) && (list->count < (list->size - chunk)))
-        new_size = list->size - chunk;
+    else if ((list->size > chunk) && (list->count < (list->size / 4)))
+        new_size = list->size / 2;
     if (new_size) {
 
-        /* Allocate more room for node pointer array */
-        new_array = calloc((size_t) new_size, sizeof(new_array));
+        /* Resize the node pointer array, keeping the nodes */
+        new_array =
+            realloc(list->array, (size_t) new_size * sizeof(*new_array));
 
         /* See if we got the memory we wanted */
         if (!new_array)
-            return FALSE;
-
-        /* copy the nodes from the old array to the new array */
-        if (list->array) {
-            for (i = 0; i < list->count; i++) {
-                new_array[i] = list->array[i];
-            }
-            free(list->array);
-        }
+            return (new_size < list->size) ? TRUE : FALSE;
         list->array = new_array;
         list->size = new_size;
     }
@@ -180,11 +176,20 @@ int Keylist_Data_Add(
 {
     struct Keylist_Node *node;  /* holds the new node */
     int index = -1;     /* return value */
-    int i;      /* counts through the array */
 
     if (list && CheckArraySize(list)) {
+        /* create the node first, so a failure leaves the list as it was */
+        node = NodeCreate();
+        if (!node) {
+            index = -1;
+        }
+        /* keys that come in order, such as instances from a scan, go on
+           the end without a search */
+        else if (list->count && (key > list->array[list->count - 1]->key)) {
+            index = list->count;
+        }
         /* figure out where to put the new node */
-        if (list->count) {
+        else if (list->count) {
             (void) FindIndex(list, key, &index);
             /* Add to the beginning of the list */
             if (index < 0)
@@ -195,17 +200,15 @@ int Keylist_Data_Add(
                 index = list->count;
 
             /* Move all the items up to make room for the new one */
-            for (i = list->count; i > index; i--) {
-                list->array[i] = list->array[i - 1];
-            }
+            memmove(&list->array[index + 1], &list->array[index],
+                (size_t) (list->count - index) * sizeof(list->array[0]));
         }
 
         else {
             index = 0;
         }
 
-        /* create and add the node */
-        node = NodeCreate();
+        /* add the node */
         if (node) {
             list->count++;
             node->key = key;
@@ -243,11 +246,8 @@ void *Keylist_Data_Delete_By_Index(
         }
         /* Move all the nodes down one */
         else {
-            int i;      /* counter */
-            int count = list->count - 1;
-            for (i = index; i < count; i++) {
-                list->array[i] = list->array[i + 1];
-            }
+            memmove(&list->array[index], &list->array[index + 1],
+                (size_t) (list->count - 1 - index) * sizeof(list->array[0]));
         }
         list->count--;
         if (node)
@@ -698,6 +698,46 @@ static void testKeyListLarge(
     return;
 }
 
+/* test keys added out of order, and the array growing and shrinking */
+static void testKeyListUnsorted(
+    Test * pTest)
+{
+    int data1 = 42;
+    OS_Keylist list;
+    KEY key;
+    int index;
+    const int num_keys = 1000;
+
+    list = Keylist_Create();
+    if (!list)
+        return;
+
+    /* every key once, in a scrambled order */
+    for (index = 0; index < num_keys; index++) {
+        key = (KEY) ((index * 7919) % num_keys);
+        (void) Keylist_Data_Add(list, key, &data1);
+        ct_test(pTest, list->size >= list->count);
+    }
+    ct_test(pTest, Keylist_Count(list) == num_keys);
+    for (index = 0; index < num_keys; index++) {
+        ct_test(pTest, Keylist_Key(list, index) == (KEY) index);
+        ct_test(pTest, Keylist_Index(list, (KEY) index) == index);
+    }
+    /* the array grew by doubling */
+    ct_test(pTest, list->size == 1024);
+    /* delete all but the last few, and the array follows */
+    while (Keylist_Count(list) > 3) {
+        ct_test(pTest, Keylist_Data_Delete_By_Index(list, 0) == &data1);
+        ct_test(pTest, list->count >= (list->size / 4));
+    }
+    ct_test(pTest, list->size <= 16);
+    ct_test(pTest, Keylist_Key(list, 0) == (KEY) (num_keys - 3));
+    ct_test(pTest, Keylist_Key(list, 2) == (KEY) (num_keys - 1));
+    Keylist_Delete(list);
+
+    return;
+}
+
 /* test access of a lot of entries */
 void testKeyList(
     Test * pTest)
@@ -715,6 +755,8 @@ void testKeyList(
     assert(rc);
     rc = ct_addTestFunction(pTest, testKeyListLarge);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testKeyListUnsorted);
+    assert(rc);
 }
 
 #ifdef TEST_KEYLIST
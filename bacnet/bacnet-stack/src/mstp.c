@@ -174,6 +174,69 @@ bool MSTP_Line_Active(
     return (mstp_port->EventCount > Nmin_octets);
 }
 
+/* milliseconds left until the silence timer passes the timeout */
+static uint32_t MSTP_Time_Remaining(
+    uint32_t silence,
+    uint32_t timeout)
+{
+    return (silence < timeout) ? (timeout - silence) : 0;
+}
+
+/* returns the milliseconds the node state machines can sleep before one
+   of their timers expires, assuming no octet arrives in the meantime.
+   Zero means the node state machine has work to do now. */
+uint16_t MSTP_Wait_Time(
+    volatile struct mstp_port_struct_t *mstp_port)
+{
+    uint32_t silence = 0;
+    uint32_t wait = 0;
+    uint32_t frame_wait = 0;
+
+    silence = mstp_port->SilenceTimer((void *) mstp_port);
+    if (mstp_port->ReceivedValidFrame || mstp_port->ReceivedInvalidFrame) {
+        /* a frame held while the higher layers prepare the reply */
+        if (mstp_port->ReceivedValidFrame &&
+            (mstp_port->master_state ==
+                MSTP_MASTER_STATE_ANSWER_DATA_REQUEST)) {
+            wait = MSTP_Time_Remaining(silence, Treply_delay + 1);
+        }
+        return (uint16_t) wait;
+    }
+    if (mstp_port->This_Station > DEFAULT_MAX_MASTER) {
+        /* slave nodes only act on received frames */
+        wait = Tno_token;
+    } else {
+        switch (mstp_port->master_state) {
+            case MSTP_MASTER_STATE_IDLE:
+                wait = MSTP_Time_Remaining(silence, Tno_token);
+                break;
+            case MSTP_MASTER_STATE_WAIT_FOR_REPLY:
+                wait = MSTP_Time_Remaining(silence, Treply_timeout);
+                break;
+            case MSTP_MASTER_STATE_POLL_FOR_MASTER:
+            case MSTP_MASTER_STATE_PASS_TOKEN:
+                wait = MSTP_Time_Remaining(silence, Tusage_timeout + 1);
+                break;
+            case MSTP_MASTER_STATE_NO_TOKEN:
+                wait =
+                    MSTP_Time_Remaining(silence,
+                    Tno_token + (Tslot * mstp_port->This_Station));
+                break;
+            default:
+                break;
+        }
+    }
+    if (mstp_port->receive_state != MSTP_RECEIVE_STATE_IDLE) {
+        /* a partial frame is dropped after Tframe_abort */
+        frame_wait = MSTP_Time_Remaining(silence, Tframe_abort + 1);
+        if (frame_wait < wait) {
+            wait = frame_wait;
+        }
+    }
+
+    return (uint16_t) wait;
+}
+
 void MSTP_Fill_BACnet_Address(
     BACNET_ADDRESS * src,
     uint8_t mstp_address)
@@ -233,13 +296,13 @@ uint16_t MSTP_Create_Frame(
     index = 8;
     while (data_len && data && (index < buffer_len)) {
         buffer[index] = *data;
-        crc16 = CRC_Calc_Data(buffer[index], crc16);
         data++;
         index++;
         data_len--;
     }
     /* append the data CRC if necessary */
     if (index > 8) {
+        crc16 = CRC_Calc_Data_Block(&buffer[8], index - 8, crc16);
         if ((index + 2) <= buffer_len) {
             crc16 = ~crc16;
             buffer[index] = crc16 & 0xFF;       /* LSB first */
@@ -269,7 +332,104 @@ void MSTP_Create_And_Send_Frame(
         data_len);
 
     RS485_Send_Frame(mstp_port, (uint8_t *) & mstp_port->OutputBuffer[0], len);
-    /* FIXME: be sure to reset SilenceTimer() after each octet is sent! */
+    /* FIXME: be sure to reset SilenceTimer(NULL) after each octet is sent! */
+}
+
+/* With Auto_Tune, a valid frame raises the highest master heard: the */
+/* token passes between masters, and only masters poll or reply to a */
+/* poll.  The tuned Nmax_master covers it right away, so that the token */
+/* still goes to a successor above it. */
+static void MSTP_Note_Master(
+    volatile struct mstp_port_struct_t *mstp_port)
+{
+    uint8_t master = 0;
+
+    if (!mstp_port->Auto_Tune) {
+        return;
+    }
+    switch (mstp_port->FrameType) {
+        case FRAME_TYPE_TOKEN:
+            master = mstp_port->SourceAddress;
+            if ((mstp_port->DestinationAddress > master) &&
+                (mstp_port->DestinationAddress <= 127)) {
+                master = mstp_port->DestinationAddress;
+            }
+            break;
+        case FRAME_TYPE_POLL_FOR_MASTER:
+        case FRAME_TYPE_REPLY_TO_POLL_FOR_MASTER:
+            master = mstp_port->SourceAddress;
+            break;
+        default:
+            return;
+    }
+    if ((master > 127) || (master <= mstp_port->Highest_Master)) {
+        return;
+    }
+    mstp_port->Highest_Master = master;
+    if (master > mstp_port->Nmax_master) {
+        if (master < mstp_port->Max_Master) {
+            mstp_port->Nmax_master = master;
+        } else {
+            mstp_port->Nmax_master = mstp_port->Max_Master;
+        }
+    }
+}
+
+/* With Auto_Tune, at the end of a maintenance cycle: the next cycle polls */
+/* up to the highest master known, or to Max_Master once in a while. */
+/* It never goes below TS or NS, the token passing is as with a */
+/* Max_Master of that value. */
+static void MSTP_Tune_Max_Master(
+    volatile struct mstp_port_struct_t *mstp_port)
+{
+    uint8_t max_master = 0;
+
+    if (!mstp_port->Auto_Tune) {
+        return;
+    }
+    if (mstp_port->Sweep_Count > 0) {
+        mstp_port->Sweep_Count--;
+        if (mstp_port->Sweep_Count == 0) {
+            /* the masters gone are forgotten, the sweep hears the others */
+            mstp_port->Nmax_master = mstp_port->Max_Master;
+            mstp_port->Highest_Master = mstp_port->This_Station;
+            return;
+        }
+    } else {
+        mstp_port->Sweep_Count = MSTP_SWEEP_CYCLES;
+    }
+    max_master = mstp_port->Highest_Master;
+    if (mstp_port->This_Station > max_master) {
+        max_master = mstp_port->This_Station;
+    }
+    if ((mstp_port->Next_Station > max_master) &&
+        (mstp_port->Next_Station <= 127)) {
+        max_master = mstp_port->Next_Station;
+    }
+    if (max_master > mstp_port->Max_Master) {
+        max_master = mstp_port->Max_Master;
+    }
+    mstp_port->Nmax_master = max_master;
+}
+
+/* With Auto_Tune, when the token is received: one more frame if the */
+/* node used all of them with the last token, one less if it used */
+/* less than half of them. */
+static void MSTP_Tune_Info_Frames(
+    volatile struct mstp_port_struct_t *mstp_port)
+{
+    if (!mstp_port->Auto_Tune) {
+        return;
+    }
+    if (mstp_port->Token_Frames >= mstp_port->Nmax_info_frames) {
+        if (mstp_port->Nmax_info_frames < MSTP_AUTO_MAX_INFO_FRAMES) {
+            mstp_port->Nmax_info_frames++;
+        }
+    } else if (((mstp_port->Token_Frames * 2) < mstp_port->Nmax_info_frames)
+        && (mstp_port->Nmax_info_frames > mstp_port->Max_Info_Frames)) {
+        mstp_port->Nmax_info_frames--;
+    }
+    mstp_port->Token_Frames = 0;
 }
 
 void MSTP_Receive_Frame_FSM(
@@ -433,6 +593,7 @@ void MSTP_Receive_Frame_FSM(
                             printf_receive_data("%s",
                                 mstptext_frame_type((unsigned)
                                     mstp_port->FrameType));
+                            MSTP_Note_Master(mstp_port);
                             if ((mstp_port->DestinationAddress ==
                                     mstp_port->This_Station)
                                 || (mstp_port->DestinationAddress ==
@@ -518,23 +679,32 @@ void MSTP_Receive_Frame_FSM(
                 printf_receive_data("%02X ", mstp_port->DataRegister);
                 if (mstp_port->Index < mstp_port->DataLength) {
                     /* DataOctet */
-                    mstp_port->DataCRC =
-                        CRC_Calc_Data(mstp_port->DataRegister,
-                        mstp_port->DataCRC);
+                    if (mstp_port->receive_state ==
+                        MSTP_RECEIVE_STATE_SKIP_DATA) {
+                        /* skipped data may not fit the buffer */
+                        mstp_port->DataCRC =
+                            CRC_Calc_Data(mstp_port->DataRegister,
+                            mstp_port->DataCRC);
+                    }
                     if (mstp_port->Index < mstp_port->InputBufferSize) {
                         mstp_port->InputBuffer[mstp_port->Index] =
                             mstp_port->DataRegister;
                     }
                     mstp_port->Index++;
-                    mstp_port->receive_state = MSTP_RECEIVE_STATE_DATA;
                 } else if (mstp_port->Index == mstp_port->DataLength) {
                     /* CRC1 */
+                    if (mstp_port->receive_state == MSTP_RECEIVE_STATE_DATA) {
+                        /* the whole data portion is in the buffer,
+                           so check it in one block */
+                        mstp_port->DataCRC =
+                            CRC_Calc_Data_Block(&mstp_port->InputBuffer[0],
+                            mstp_port->DataLength, mstp_port->DataCRC);
+                    }
                     mstp_port->DataCRC =
                         CRC_Calc_Data(mstp_port->DataRegister,
                         mstp_port->DataCRC);
                     mstp_port->DataCRCActualMSB = mstp_port->DataRegister;
                     mstp_port->Index++;
-                    mstp_port->receive_state = MSTP_RECEIVE_STATE_DATA;
                 } else if (mstp_port->Index == (mstp_port->DataLength + 1)) {
                     /* CRC2 */
                     mstp_port->DataCRC =
@@ -546,6 +716,7 @@ void MSTP_Receive_Frame_FSM(
                     /* STATE DATA CRC - no need for new state */
                     /* indicate the complete reception of a valid frame */
                     if (mstp_port->DataCRC == 0xF0B8) {
+                        MSTP_Note_Master(mstp_port);
                         if (mstp_port->receive_state ==
                             MSTP_RECEIVE_STATE_DATA) {
                             /* ForUs */
@@ -583,7 +754,7 @@ void MSTP_Receive_Frame_FSM(
 
 /* returns true if we need to transition immediately */
 bool MSTP_Master_Node_FSM(
-    volatile struct mstp_port_struct_t * mstp_port)
+    volatile struct mstp_port_struct_t *mstp_port)
 {
     unsigned length = 0;
     uint8_t next_poll_station = 0;
@@ -651,6 +822,7 @@ bool MSTP_Master_Node_FSM(
                                 break;
                             }
                             mstp_port->ReceivedValidFrame = false;
+                            MSTP_Tune_Info_Frames(mstp_port);
                             mstp_port->FrameCount = 0;
                             mstp_port->SoleMaster = false;
                             mstp_port->master_state =
@@ -717,6 +889,7 @@ bool MSTP_Master_Node_FSM(
                     (uint8_t *) & mstp_port->OutputBuffer[0],
                     (uint16_t) length);
                 mstp_port->FrameCount++;
+                INCREMENT_AND_LIMIT_UINT8(mstp_port->Token_Frames);
                 switch (frame_type) {
                     case FRAME_TYPE_BACNET_DATA_EXPECTING_REPLY:
                         if (destination == MSTP_BROADCAST_ADDRESS) {
@@ -833,6 +1006,7 @@ bool MSTP_Master_Node_FSM(
                     /* SoleMaster */
                     /* there are no other known master nodes to */
                     /* which the token may be sent (true master-slave operation).  */
+                    MSTP_Tune_Info_Frames(mstp_port);
                     mstp_port->FrameCount = 0;
                     mstp_port->TokenCount++;
                     mstp_port->master_state = MSTP_MASTER_STATE_USE_TOKEN;
@@ -855,7 +1029,10 @@ bool MSTP_Master_Node_FSM(
             } else if (next_poll_station == mstp_port->Next_Station) {
                 if (mstp_port->SoleMaster == true) {
                     /* SoleMasterRestartMaintenancePFM */
-                    mstp_port->Poll_Station = next_next_station;
+                    MSTP_Tune_Max_Master(mstp_port);
+                    mstp_port->Poll_Station =
+                        (mstp_port->Next_Station +
+                        1) % (mstp_port->Nmax_master + 1);
                     MSTP_Create_And_Send_Frame(mstp_port,
                         FRAME_TYPE_POLL_FOR_MASTER, mstp_port->Poll_Station,
                         mstp_port->This_Station, NULL, 0);
@@ -870,6 +1047,7 @@ bool MSTP_Master_Node_FSM(
                         MSTP_MASTER_STATE_POLL_FOR_MASTER;
                 } else {
                     /* ResetMaintenancePFM */
+                    MSTP_Tune_Max_Master(mstp_port);
                     mstp_port->Poll_Station = mstp_port->This_Station;
                     /* transmit a Token frame to NS */
                     MSTP_Create_And_Send_Frame(mstp_port, FRAME_TYPE_TOKEN,
@@ -934,7 +1112,7 @@ bool MSTP_Master_Node_FSM(
             }
             break;
         case MSTP_MASTER_STATE_NO_TOKEN:
-            /* The NO_TOKEN state is entered if mstp_port->SilenceTimer() becomes greater  */
+            /* The NO_TOKEN state is entered if mstp_port->SilenceTimer(NULL) becomes greater  */
             /* than Tno_token, indicating that there has been no network activity */
             /* for that period of time. The timeout is continued to determine  */
             /* whether or not this node may create a token. */
@@ -1160,6 +1338,11 @@ void MSTP_Slave_Node_FSM(
                            this is a local matter), then no reply is possible. */
                         /* clear our flag we were holding for comparison */
                         mstp_port->ReceivedValidFrame = false;
+                    } else {
+                        /* still holding the frame - lets MSTP_Wait_Time
+                           know we are waiting on the higher layers */
+                        mstp_port->master_state =
+                            MSTP_MASTER_STATE_ANSWER_DATA_REQUEST;
                     }
                 } else {
                     mstp_port->ReceivedValidFrame = false;
@@ -1229,6 +1412,12 @@ void MSTP_Init(
         mstp_port->SoleMaster = false;
         mstp_port->SourceAddress = 0;
         mstp_port->TokenCount = 0;
+        mstp_port->Auto_Tune = false;
+        mstp_port->Max_Master = mstp_port->Nmax_master;
+        mstp_port->Max_Info_Frames = mstp_port->Nmax_info_frames;
+        mstp_port->Highest_Master = mstp_port->This_Station;
+        mstp_port->Sweep_Count = 0;
+        mstp_port->Token_Frames = 0;
     }
 }
 
@@ -1236,6 +1425,7 @@ void MSTP_Init(
 #include <assert.h>
 #include <string.h>
 #include "ringbuf.h"
+#include "dlmstp.h"
 #include "ctest.h"
 
 static uint8_t RxBuffer[MAX_MPDU];
@@ -1252,7 +1442,8 @@ void RS485_Send_Frame(
 }
 
 #define RING_BUFFER_DATA_SIZE 1
-#define RING_BUFFER_SIZE MAX_MPDU
+/* a power of two, at least MAX_MPDU */
+#define RING_BUFFER_SIZE 2048
 static RING_BUFFER Test_Buffer;
 static uint8_t Test_Buffer_Data[RING_BUFFER_DATA_SIZE * RING_BUFFER_SIZE];
 static void Load_Input_Buffer(
@@ -1317,15 +1508,17 @@ uint16_t MSTP_Get_Reply(
 }
 
 uint16_t SilenceTime = 0;
-static uint16_t Timer_Silence(
-    void)
+static uint32_t Timer_Silence(
+    void *pArg)
 {
+    (void) pArg;
     return SilenceTime;
 }
 
 static void Timer_Silence_Reset(
-    void)
+    void *pArg)
 {
+    (void) pArg;
     SilenceTime = 0;
 }
 
@@ -1363,7 +1556,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.EventCount == EventCount);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.ReceiveError == false);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_IDLE);
     /* check for bad packet header */
@@ -1372,7 +1565,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_IDLE);
     /* check for good packet header, but timeout */
@@ -1381,7 +1574,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_PREAMBLE);
     /* force the timeout */
@@ -1394,7 +1587,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_PREAMBLE);
     /* force the error */
@@ -1402,7 +1595,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.ReceiveError == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_IDLE);
     /* check for good packet header preamble1, but bad preamble2 */
@@ -1411,7 +1604,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_PREAMBLE);
     MSTP_Receive_Frame_FSM(&mstp_port);
@@ -1426,7 +1619,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_PREAMBLE);
     /* repeated preamble1 */
@@ -1435,7 +1628,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_PREAMBLE);
     /* bad data */
@@ -1444,7 +1637,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.ReceiveError == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_IDLE);
     /* check for good packet header preamble, but timeout in packet */
@@ -1453,7 +1646,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_PREAMBLE);
     MSTP_Receive_Frame_FSM(&mstp_port);
@@ -1463,7 +1656,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.Index == 0);
     ct_test(pTest, mstp_port.HeaderCRC == 0xFF);
@@ -1479,7 +1672,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_PREAMBLE);
     MSTP_Receive_Frame_FSM(&mstp_port);
@@ -1489,7 +1682,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.Index == 0);
     ct_test(pTest, mstp_port.HeaderCRC == 0xFF);
@@ -1499,7 +1692,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.ReceiveError == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_IDLE);
     /* check for good packet header preamble */
@@ -1508,7 +1701,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_PREAMBLE);
     MSTP_Receive_Frame_FSM(&mstp_port);
@@ -1518,7 +1711,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.Index == 0);
     ct_test(pTest, mstp_port.HeaderCRC == 0xFF);
@@ -1537,7 +1730,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.Index == 1);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_HEADER);
@@ -1549,7 +1742,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.Index == 2);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_HEADER);
@@ -1561,7 +1754,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.Index == 3);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_HEADER);
@@ -1573,7 +1766,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.Index == 4);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_HEADER);
@@ -1585,7 +1778,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.Index == 5);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_HEADER);
@@ -1597,7 +1790,7 @@ void testReceiveNodeFSM(
     INCREMENT_AND_LIMIT_UINT8(EventCount);
     MSTP_Receive_Frame_FSM(&mstp_port);
     ct_test(pTest, mstp_port.DataAvailable == false);
-    ct_test(pTest, mstp_port.SilenceTimer() == 0);
+    ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
     ct_test(pTest, mstp_port.EventCount == EventCount);
     ct_test(pTest, mstp_port.Index == 5);
     ct_test(pTest, mstp_port.receive_state == MSTP_RECEIVE_STATE_IDLE);
@@ -1618,7 +1811,7 @@ void testReceiveNodeFSM(
         INCREMENT_AND_LIMIT_UINT8(EventCount);
         MSTP_Receive_Frame_FSM(&mstp_port);
         ct_test(pTest, mstp_port.DataAvailable == false);
-        ct_test(pTest, mstp_port.SilenceTimer() == 0);
+        ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
         ct_test(pTest, mstp_port.EventCount == EventCount);
     }
     ct_test(pTest, mstp_port.ReceivedInvalidFrame == true);
@@ -1638,7 +1831,7 @@ void testReceiveNodeFSM(
         INCREMENT_AND_LIMIT_UINT8(EventCount);
         MSTP_Receive_Frame_FSM(&mstp_port);
         ct_test(pTest, mstp_port.DataAvailable == false);
-        ct_test(pTest, mstp_port.SilenceTimer() == 0);
+        ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
         ct_test(pTest, mstp_port.EventCount == EventCount);
     }
     ct_test(pTest, mstp_port.ReceivedInvalidFrame == false);
@@ -1660,7 +1853,7 @@ void testReceiveNodeFSM(
         INCREMENT_AND_LIMIT_UINT8(EventCount);
         MSTP_Receive_Frame_FSM(&mstp_port);
         ct_test(pTest, mstp_port.DataAvailable == false);
-        ct_test(pTest, mstp_port.SilenceTimer() == 0);
+        ct_test(pTest, mstp_port.SilenceTimer(NULL) == 0);
         ct_test(pTest, mstp_port.EventCount == EventCount);
     }
     ct_test(pTest, mstp_port.ReceivedInvalidFrame == true);
@@ -1707,6 +1900,132 @@ void testMasterNodeFSM(
     /* FIXME: write a unit test for the Master Node State Machine */
 }
 
+void testWaitTime(
+    Test * pTest)
+{
+    volatile struct mstp_port_struct_t MSTP_Port;       /* port data */
+    MSTP_Port.InputBuffer = &RxBuffer[0];
+    MSTP_Port.InputBufferSize = sizeof(RxBuffer);
+    MSTP_Port.OutputBuffer = &TxBuffer[0];
+    MSTP_Port.OutputBufferSize = sizeof(TxBuffer);
+    MSTP_Port.This_Station = 0x05;
+    MSTP_Port.Nmax_info_frames = 1;
+    MSTP_Port.Nmax_master = 127;
+    MSTP_Port.SilenceTimer = Timer_Silence;
+    MSTP_Port.SilenceTimerReset = Timer_Silence_Reset;
+    MSTP_Init(&MSTP_Port);
+    /* INITIALIZE has work to do right away */
+    ct_test(pTest, MSTP_Wait_Time(&MSTP_Port) == 0);
+    /* IDLE sleeps until Tno_token */
+    MSTP_Port.master_state = MSTP_MASTER_STATE_IDLE;
+    SilenceTime = 100;
+    ct_test(pTest, MSTP_Wait_Time(&MSTP_Port) == (Tno_token - 100));
+    SilenceTime = Tno_token;
+    ct_test(pTest, MSTP_Wait_Time(&MSTP_Port) == 0);
+    /* a partial frame shortens the sleep to Tframe_abort */
+    SilenceTime = 10;
+    MSTP_Port.receive_state = MSTP_RECEIVE_STATE_HEADER;
+    ct_test(pTest, MSTP_Wait_Time(&MSTP_Port) == (Tframe_abort + 1 - 10));
+    MSTP_Port.receive_state = MSTP_RECEIVE_STATE_IDLE;
+    /* WAIT_FOR_REPLY sleeps until Treply_timeout */
+    MSTP_Port.master_state = MSTP_MASTER_STATE_WAIT_FOR_REPLY;
+    ct_test(pTest, MSTP_Wait_Time(&MSTP_Port) == (Treply_timeout - 10));
+    /* NO_TOKEN waits for the slot of this station */
+    MSTP_Port.master_state = MSTP_MASTER_STATE_NO_TOKEN;
+    SilenceTime = Tno_token;
+    ct_test(pTest, MSTP_Wait_Time(&MSTP_Port) == (Tslot * 0x05));
+    /* a received frame is handled right away... */
+    MSTP_Port.master_state = MSTP_MASTER_STATE_IDLE;
+    MSTP_Port.ReceivedValidFrame = true;
+    SilenceTime = 0;
+    ct_test(pTest, MSTP_Wait_Time(&MSTP_Port) == 0);
+    /* ...unless it is held for the reply */
+    MSTP_Port.master_state = MSTP_MASTER_STATE_ANSWER_DATA_REQUEST;
+    SilenceTime = 50;
+    ct_test(pTest, MSTP_Wait_Time(&MSTP_Port) == (Treply_delay + 1 - 50));
+    SilenceTime = Treply_delay + 1;
+    ct_test(pTest, MSTP_Wait_Time(&MSTP_Port) == 0);
+}
+
+void testAutoTune(
+    Test * pTest)
+{
+    volatile struct mstp_port_struct_t MSTP_Port;       /* port data */
+    unsigned i = 0;
+
+    MSTP_Port.InputBuffer = &RxBuffer[0];
+    MSTP_Port.InputBufferSize = sizeof(RxBuffer);
+    MSTP_Port.OutputBuffer = &TxBuffer[0];
+    MSTP_Port.OutputBufferSize = sizeof(TxBuffer);
+    MSTP_Port.This_Station = 0x10;
+    MSTP_Port.Nmax_info_frames = 1;
+    MSTP_Port.Nmax_master = 127;
+    MSTP_Port.SilenceTimer = Timer_Silence;
+    MSTP_Port.SilenceTimerReset = Timer_Silence_Reset;
+    MSTP_Init(&MSTP_Port);
+    ct_test(pTest, MSTP_Port.Auto_Tune == false);
+    ct_test(pTest, MSTP_Port.Max_Master == 127);
+    /* nothing is tuned unless asked for */
+    MSTP_Tune_Max_Master(&MSTP_Port);
+    ct_test(pTest, MSTP_Port.Nmax_master == 127);
+    MSTP_Port.Auto_Tune = true;
+    /* the token passes from 0x02 to 0x08, and on to this node */
+    MSTP_Port.FrameType = FRAME_TYPE_TOKEN;
+    MSTP_Port.SourceAddress = 0x02;
+    MSTP_Port.DestinationAddress = 0x08;
+    MSTP_Note_Master(&MSTP_Port);
+    MSTP_Port.Next_Station = 0x02;
+    /* the first cycle polled up to Max_Master, the next ones stop at TS */
+    MSTP_Tune_Max_Master(&MSTP_Port);
+    ct_test(pTest, MSTP_Port.Nmax_master == 0x10);
+    ct_test(pTest, MSTP_Port.Sweep_Count == MSTP_SWEEP_CYCLES);
+    /* a master is heard above it */
+    MSTP_Port.FrameType = FRAME_TYPE_REPLY_TO_POLL_FOR_MASTER;
+    MSTP_Port.SourceAddress = 0x20;
+    MSTP_Port.DestinationAddress = 0x10;
+    MSTP_Note_Master(&MSTP_Port);
+    ct_test(pTest, MSTP_Port.Nmax_master == 0x20);
+    /* a slave is not */
+    MSTP_Port.FrameType = FRAME_TYPE_BACNET_DATA_NOT_EXPECTING_REPLY;
+    MSTP_Port.SourceAddress = 0x40;
+    MSTP_Note_Master(&MSTP_Port);
+    ct_test(pTest, MSTP_Port.Nmax_master == 0x20);
+    /* every MSTP_SWEEP_CYCLES, a cycle up to Max_Master */
+    for (i = 1; i < MSTP_SWEEP_CYCLES; i++) {
+        MSTP_Tune_Max_Master(&MSTP_Port);
+        ct_test(pTest, MSTP_Port.Nmax_master == 0x20);
+    }
+    MSTP_Tune_Max_Master(&MSTP_Port);
+    ct_test(pTest, MSTP_Port.Nmax_master == 127);
+    /* 0x20 is gone, no frame of it during the sweep */
+    MSTP_Tune_Max_Master(&MSTP_Port);
+    ct_test(pTest, MSTP_Port.Nmax_master == 0x10);
+    /* never below Max_Master */
+    MSTP_Port.Max_Master = 0x18;
+    MSTP_Port.FrameType = FRAME_TYPE_POLL_FOR_MASTER;
+    MSTP_Port.SourceAddress = 0x30;
+    MSTP_Note_Master(&MSTP_Port);
+    ct_test(pTest, MSTP_Port.Nmax_master == 0x18);
+    /* frames: more while all of them are used, back down when idle */
+    MSTP_Port.Token_Frames = 1;
+    MSTP_Tune_Info_Frames(&MSTP_Port);
+    ct_test(pTest, MSTP_Port.Nmax_info_frames == 2);
+    ct_test(pTest, MSTP_Port.Token_Frames == 0);
+    for (i = 0; i < 2 * MSTP_AUTO_MAX_INFO_FRAMES; i++) {
+        MSTP_Port.Token_Frames = MSTP_Port.Nmax_info_frames;
+        MSTP_Tune_Info_Frames(&MSTP_Port);
+    }
+    ct_test(pTest, MSTP_Port.Nmax_info_frames == MSTP_AUTO_MAX_INFO_FRAMES);
+    /* half of them keeps the value */
+    MSTP_Port.Token_Frames = MSTP_AUTO_MAX_INFO_FRAMES / 2;
+    MSTP_Tune_Info_Frames(&MSTP_Port);
+    ct_test(pTest, MSTP_Port.Nmax_info_frames == MSTP_AUTO_MAX_INFO_FRAMES);
+    for (i = 0; i < 2 * MSTP_AUTO_MAX_INFO_FRAMES; i++) {
+        MSTP_Tune_Info_Frames(&MSTP_Port);
+    }
+    ct_test(pTest, MSTP_Port.Nmax_info_frames == MSTP_Port.Max_Info_Frames);
+}
+
 #endif
 
 #ifdef TEST_MSTP
@@ -1721,6 +2040,10 @@ int main(
     assert(rc);
     rc = ct_addTestFunction(pTest, testMasterNodeFSM);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testWaitTime);
+    assert(rc);
+    rc = ct_addTestFunction(pTest, testAutoTune);
+    assert(rc);
     ct_setStream(pTest, stdout);
     ct_run(pTest);
     (void) ct_report(pTest);
@@ -451,6 +451,7 @@ int npdu_decode(
 #include <assert.h>
 #include <string.h>
 #include "ctest.h"
+#include "tsm.h"
 
 void testNPDU2(
     Test * pTest)
@@ -581,6 +582,74 @@ void tsm_free_invoke_id(
     (void) invokeID;
 }
 
+void tsm_free_invoke_id_peer(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID)
+{
+    (void) src;
+    (void) invokeID;
+}
+
+void tsm_reply_received(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID)
+{
+    (void) src;
+    (void) invokeID;
+}
+
+bool tsm_complete(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID,
+    BACNET_CONFIRMED_REPLY * reply)
+{
+    (void) src;
+    (void) invokeID;
+    (void) reply;
+
+    return false;
+}
+
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+bool tsm_segmented_confirmation(
+    BACNET_ADDRESS * src,
+    BACNET_CONFIRMED_SERVICE_ACK_DATA * service_ack_data,
+    uint8_t ** service_request,
+    uint16_t * service_request_len)
+{
+    (void) src;
+    (void) service_ack_data;
+    (void) service_request;
+    (void) service_request_len;
+
+    return false;
+}
+
+void tsm_segmented_response_abort(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID)
+{
+    (void) src;
+    (void) invokeID;
+}
+
+void tsm_segment_ack_received(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID,
+    uint8_t sequence_number,
+    uint8_t actual_window_size,
+    bool negative,
+    bool server)
+{
+    (void) src;
+    (void) invokeID;
+    (void) sequence_number;
+    (void) actual_window_size;
+    (void) negative;
+    (void) server;
+}
+#endif
+
 void iam_handler(
     uint8_t * service_request,
     uint16_t service_len,
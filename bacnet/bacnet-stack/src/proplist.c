@@ -32,6 +32,7 @@
  -------------------------------------------
 ####COPYRIGHTEND####*/
 #include <stdint.h>
+#include <string.h>
 #include "bacenum.h"
 #include "bacdef.h"
 #include "bacdcode.h"
@@ -1030,6 +1031,45 @@ const int * property_list_required(
     return pList;
 }
 
+/* the object types up to the last one in bacenum.h; the others that have
+   no lists of their own get the default lists */
+#define PROPERTY_LIST_OBJECT_TYPES (OBJECT_LIGHTING_OUTPUT + 1)
+
+static struct property_list_index_t
+    Property_List_Index[PROPERTY_LIST_OBJECT_TYPES];
+static bool Property_List_Index_Valid;
+
+/**
+ * Works out the counts and the property bits of the lists of each of the
+ * standard object types.  It is done on the first use otherwise, so call
+ * it at startup when the lists are used from more than one thread.
+ */
+void property_list_init(
+    void)
+{
+    unsigned i = 0;
+
+    for (i = 0; i < PROPERTY_LIST_OBJECT_TYPES; i++) {
+        property_list_index_init(&Property_List_Index[i],
+            property_list_required((BACNET_OBJECT_TYPE) i),
+            property_list_optional((BACNET_OBJECT_TYPE) i), NULL);
+    }
+    Property_List_Index_Valid = true;
+}
+
+static const struct property_list_index_t *property_list_index(
+    BACNET_OBJECT_TYPE object_type)
+{
+    if ((unsigned) object_type >= PROPERTY_LIST_OBJECT_TYPES) {
+        return NULL;
+    }
+    if (!Property_List_Index_Valid) {
+        property_list_init();
+    }
+
+    return &Property_List_Index[object_type];
+}
+
 /**
  * Function that returns the list of Required or Optional properties
  * of known standard objects.
@@ -1043,9 +1083,16 @@ void property_list_special(
     BACNET_OBJECT_TYPE object_type,
     struct special_property_list_t *pPropertyList)
 {
+    const struct property_list_index_t *pIndex = NULL;
+
     if (pPropertyList == NULL) {
         return;
     }
+    pIndex = property_list_index(object_type);
+    if (pIndex) {
+        *pPropertyList = pIndex->List;
+        return;
+    }
     pPropertyList->Required.pList = property_list_required(object_type);
     pPropertyList->Optional.pList = property_list_optional(object_type);
     pPropertyList->Proprietary.pList = NULL;
@@ -1125,6 +1172,45 @@ unsigned property_list_special_count(
 
     return count;
 }
+
+/**
+ * Function that tells if a property is in the Required or Optional list, or
+ * either of them, of a known standard object, without walking the lists.
+ *
+ * @param object_type - enumerated BACNET_OBJECT_TYPE
+ * @param special_property - PROP_ALL, PROP_REQUIRED or PROP_OPTIONAL
+ * @param object_property - the property looked for
+ *
+ * @return true if the property is in the list
+ */
+bool property_list_special_member(
+    BACNET_OBJECT_TYPE object_type,
+    BACNET_PROPERTY_ID special_property,
+    BACNET_PROPERTY_ID object_property)
+{
+    const struct property_list_index_t *pIndex = NULL;
+    bool status = false;
+
+    pIndex = property_list_index(object_type);
+    if (pIndex) {
+        return property_list_index_member(pIndex, special_property,
+            object_property);
+    }
+    if ((special_property == PROP_ALL) ||
+        (special_property == PROP_REQUIRED)) {
+        status =
+            property_list_member(property_list_required(object_type),
+            object_property);
+    }
+    if (!status && ((special_property == PROP_ALL) ||
+            (special_property == PROP_OPTIONAL))) {
+        status =
+            property_list_member(property_list_optional(object_type),
+            object_property);
+    }
+
+    return status;
+}
 #endif
 
 /**
@@ -1148,6 +1234,120 @@ unsigned property_list_count(
     return property_count;
 }
 
+/**
+ * Function that tells if a property is in a list of BACnet object properties
+ *
+ * @param pList - array of type 'int' that is a list of BACnet object
+ * properties, terminated by a '-1' value.
+ * @param object_property - the property looked for
+ *
+ * @return true if the property is in the list
+ */
+bool property_list_member(
+    const int *pList,
+    int object_property)
+{
+    if (pList) {
+        while (*pList != -1) {
+            if (*pList == object_property) {
+                return true;
+            }
+            pList++;
+        }
+    }
+
+    return false;
+}
+
+static void property_list_bits(
+    uint8_t * bits,
+    const int *pList)
+{
+    if (pList) {
+        while (*pList != -1) {
+            if ((*pList >= 0) && (*pList < PROPERTY_LIST_BITS)) {
+                bits[*pList / 8] |= (uint8_t) (1 << (*pList % 8));
+            }
+            pList++;
+        }
+    }
+}
+
+/**
+ * Function that counts the lists of an object type, and sets the bits of
+ * the standard properties in them, for property_list_index_member().
+ * The lists are referenced, not copied.
+ *
+ * @param pIndex - the index to set up
+ * @param pListRequired - '-1' terminated list of the required properties
+ * @param pListOptional - '-1' terminated list of the optional properties
+ * @param pListProprietary - '-1' terminated list of the proprietary
+ * properties, or NULL
+ */
+void property_list_index_init(
+    struct property_list_index_t *pIndex,
+    const int *pListRequired,
+    const int *pListOptional,
+    const int *pListProprietary)
+{
+    if (pIndex == NULL) {
+        return;
+    }
+    memset(pIndex, 0, sizeof(*pIndex));
+    pIndex->List.Required.pList = pListRequired;
+    pIndex->List.Required.count = property_list_count(pListRequired);
+    pIndex->List.Optional.pList = pListOptional;
+    pIndex->List.Optional.count = property_list_count(pListOptional);
+    pIndex->List.Proprietary.pList = pListProprietary;
+    pIndex->List.Proprietary.count = property_list_count(pListProprietary);
+    property_list_bits(pIndex->Required, pListRequired);
+    property_list_bits(pIndex->Optional, pListOptional);
+}
+
+/**
+ * Function that tells if a property is in the lists of an index.  A
+ * standard property is looked up in the bits, a proprietary one in the
+ * lists.
+ *
+ * @param pIndex - the index set up by property_list_index_init()
+ * @param special_property - PROP_ALL, PROP_REQUIRED or PROP_OPTIONAL
+ * @param object_property - the property looked for
+ *
+ * @return true if the property is in the list
+ */
+bool property_list_index_member(
+    const struct property_list_index_t *pIndex,
+    BACNET_PROPERTY_ID special_property,
+    BACNET_PROPERTY_ID object_property)
+{
+    unsigned property = (unsigned) object_property;
+    bool required = false;
+    bool optional = false;
+
+    if (pIndex == NULL) {
+        return false;
+    }
+    if (property < PROPERTY_LIST_BITS) {
+        required = (pIndex->Required[property / 8] & (1 << (property % 8)));
+        optional = (pIndex->Optional[property / 8] & (1 << (property % 8)));
+    } else {
+        required =
+            property_list_member(pIndex->List.Required.pList, property);
+        optional =
+            property_list_member(pIndex->List.Optional.pList, property);
+    }
+    if (special_property == PROP_ALL) {
+        return required || optional ||
+            property_list_member(pIndex->List.Proprietary.pList, property);
+    } else if (special_property == PROP_REQUIRED) {
+        return required;
+    } else if (special_property == PROP_OPTIONAL) {
+        return optional;
+    }
+
+    return false;
+}
+
 /**
  * ReadProperty handler for this property.  For the given ReadProperty
  * data, the application_data is loaded or the error flags are set.
@@ -1350,6 +1550,55 @@ void testPropList(
     }
 }
 
+void testPropListMember(
+    Test * pTest)
+{
+    unsigned i = 0, j = 0;
+    bool required = false, optional = false;
+    const int Proprietary[] = { 512, 4194303, -1 };
+    struct property_list_index_t Index;
+
+    property_list_init();
+    for (i = 0; i < OBJECT_PROPRIETARY_MIN; i++) {
+        for (j = 0; j < PROPERTY_LIST_BITS; j++) {
+            required =
+                property_list_member(property_list_required((BACNET_OBJECT_TYPE)
+                    i), j);
+            optional =
+                property_list_member(property_list_optional((BACNET_OBJECT_TYPE)
+                    i), j);
+            ct_test(pTest, property_list_special_member((BACNET_OBJECT_TYPE) i,
+                    PROP_REQUIRED, (BACNET_PROPERTY_ID) j) == required);
+            ct_test(pTest, property_list_special_member((BACNET_OBJECT_TYPE) i,
+                    PROP_OPTIONAL, (BACNET_PROPERTY_ID) j) == optional);
+            ct_test(pTest, property_list_special_member((BACNET_OBJECT_TYPE) i,
+                    PROP_ALL, (BACNET_PROPERTY_ID) j) == (required ||
+                    optional));
+        }
+        ct_test(pTest, !property_list_special_member((BACNET_OBJECT_TYPE) i,
+                PROP_ALL, PROP_PROPERTY_LIST));
+    }
+    property_list_index_init(&Index,
+        property_list_required(OBJECT_ANALOG_INPUT),
+        property_list_optional(OBJECT_ANALOG_INPUT), Proprietary);
+    ct_test(pTest, Index.List.Proprietary.count == 2);
+    ct_test(pTest, property_list_index_member(&Index, PROP_ALL,
+            PROP_PRESENT_VALUE));
+    ct_test(pTest, property_list_index_member(&Index, PROP_REQUIRED,
+            PROP_PRESENT_VALUE));
+    ct_test(pTest, !property_list_index_member(&Index, PROP_OPTIONAL,
+            PROP_PRESENT_VALUE));
+    ct_test(pTest, property_list_index_member(&Index, PROP_ALL,
+            (BACNET_PROPERTY_ID) 512));
+    ct_test(pTest, property_list_index_member(&Index, PROP_ALL,
+            MAX_BACNET_PROPERTY_ID));
+    ct_test(pTest, !property_list_index_member(&Index, PROP_REQUIRED,
+            (BACNET_PROPERTY_ID) 512));
+    ct_test(pTest, !property_list_index_member(&Index, PROP_ALL,
+            (BACNET_PROPERTY_ID) 513));
+    ct_test(pTest, !property_list_member(NULL, PROP_PRESENT_VALUE));
+}
+
 #ifdef TEST_PROPLIST
 int main(
     void)
@@ -1361,6 +1610,8 @@ int main(
     /* individual tests */
     rc = ct_addTestFunction(pTest, testPropList);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testPropListMember);
+    assert(rc);
 
     ct_setStream(pTest, stdout);
     ct_run(pTest);
@@ -39,8 +39,14 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include "ringbuf.h"
 
+/* element_count is a power of two, so this is the element of the free
+   running index */
+#define RINGBUF_ELEMENT(b, i) \
+    (&(b)->buffer[((i) & ((b)->element_count - 1)) * (b)->element_size])
+
 /****************************************************************************
 * DESCRIPTION: Returns the number of elements in the ring buffer
 * RETURN:      Number of elements in the ring buffer
@@ -97,8 +103,7 @@ volatile uint8_t *Ringbuf_Peek(
     volatile uint8_t *data_element = NULL;      /* return value */
 
     if (!Ringbuf_Empty(b)) {
-        data_element = b->buffer;
-        data_element += ((b->tail % b->element_count) * b->element_size);
+        data_element = RINGBUF_ELEMENT(b, b->tail);
     }
 
     return data_element;
@@ -116,15 +121,11 @@ bool Ringbuf_Pop(
 {
     bool status = false;        /* return value */
     volatile uint8_t *ring_data = NULL; /* used to help point ring data */
-    unsigned i; /* loop counter */
 
     if (!Ringbuf_Empty(b)) {
-        ring_data = b->buffer;
-        ring_data += ((b->tail % b->element_count) * b->element_size);
         if (data_element) {
-            for (i = 0; i < b->element_size; i++) {
-                data_element[i] = ring_data[i];
-            }
+            ring_data = RINGBUF_ELEMENT(b, b->tail);
+            memcpy(data_element, (uint8_t *) ring_data, b->element_size);
         }
         b->tail++;
         status = true;
@@ -145,16 +146,12 @@ bool Ringbuf_Put(
 {       /* one element to add to the ring */
     bool status = false;        /* return value */
     volatile uint8_t *ring_data = NULL; /* used to help point ring data */
-    unsigned i; /* loop counter */
 
     if (b && data_element) {
         /* limit the amount of elements that we accept */
         if (!Ringbuf_Full(b)) {
-            ring_data = b->buffer;
-            ring_data += ((b->head % b->element_count) * b->element_size);
-            for (i = 0; i < b->element_size; i++) {
-                ring_data[i] = data_element[i];
-            }
+            ring_data = RINGBUF_ELEMENT(b, b->head);
+            memcpy((uint8_t *) ring_data, data_element, b->element_size);
             b->head++;
             status = true;
         }
@@ -177,18 +174,14 @@ bool Ringbuf_Put_Front(
 {       /* one element to add to the front of the ring */
     bool status = false;        /* return value */
     volatile uint8_t *ring_data = NULL; /* used to help point ring data */
-    unsigned i = 0;     /* loop counter */
 
     if (b && data_element) {
         /* limit the amount of elements that we accept */
         if (!Ringbuf_Full(b)) {
             b->tail--;
-            ring_data = b->buffer;
-            ring_data += ((b->tail % b->element_count) * b->element_size);
+            ring_data = RINGBUF_ELEMENT(b, b->tail);
             /* copy the data to the ring data element */
-            for (i = 0; i < b->element_size; i++) {
-                ring_data[i] = data_element[i];
-            }
+            memcpy((uint8_t *) ring_data, data_element, b->element_size);
             status = true;
         }
     }
@@ -210,8 +203,7 @@ volatile uint8_t *Ringbuf_Data_Peek(RING_BUFFER * b)
     if (b) {
         /* limit the amount of elements that we accept */
         if (!Ringbuf_Full(b)) {
-            ring_data = b->buffer;
-            ring_data += ((b->head % b->element_count) * b->element_size);
+            ring_data = RINGBUF_ELEMENT(b, b->head);
         }
     }
 
@@ -234,8 +226,7 @@ bool Ringbuf_Data_Put(RING_BUFFER * b, volatile uint8_t *data_element)
     if (b) {
         /* limit the amount of elements that we accept */
         if (!Ringbuf_Full(b)) {
-            ring_data = b->buffer;
-            ring_data += ((b->head % b->element_count) * b->element_size);
+            ring_data = RINGBUF_ELEMENT(b, b->head);
             if (ring_data == data_element) {
                 /* same chunk of memory - okay to signal the head */
                 b->head++;
@@ -247,6 +238,84 @@ bool Ringbuf_Data_Put(RING_BUFFER * b, volatile uint8_t *data_element)
     return status;
 }
 
+/****************************************************************************
+* DESCRIPTION: Copies up to count elements from the front of the list, and
+*              removes them
+* RETURN:      number of elements copied
+* ALGORITHM:   at most two copies: up to the end of the data block, then
+*              from its start
+* NOTES:       data_elements may be NULL to only remove them
+*****************************************************************************/
+unsigned Ringbuf_Pop_Many(
+    RING_BUFFER * b,
+    uint8_t * data_elements,
+    unsigned count)
+{
+    unsigned available;
+    unsigned index;
+    unsigned span;
+
+    available = Ringbuf_Count(b);
+    if (count > available) {
+        count = available;
+    }
+    if (count) {
+        if (data_elements) {
+            index = b->tail & (b->element_count - 1);
+            span = b->element_count - index;
+            if (span > count) {
+                span = count;
+            }
+            memcpy(data_elements, (uint8_t *) RINGBUF_ELEMENT(b, b->tail),
+                span * b->element_size);
+            memcpy(&data_elements[span * b->element_size],
+                (uint8_t *) & b->buffer[0], (count - span) * b->element_size);
+        }
+        b->tail += count;
+    }
+
+    return count;
+}
+
+/****************************************************************************
+* DESCRIPTION: Adds up to count elements of data to the end of the ring
+*              buffer
+* RETURN:      number of elements added, which stops when the ring is full
+* ALGORITHM:   at most two copies: up to the end of the data block, then
+*              from its start
+* NOTES:       none
+*****************************************************************************/
+unsigned Ringbuf_Put_Many(
+    RING_BUFFER * b,
+    uint8_t * data_elements,
+    unsigned count)
+{
+    unsigned available = 0;
+    unsigned index;
+    unsigned span;
+
+    if (b && data_elements) {
+        available = b->element_count - Ringbuf_Count(b);
+    }
+    if (count > available) {
+        count = available;
+    }
+    if (count) {
+        index = b->head & (b->element_count - 1);
+        span = b->element_count - index;
+        if (span > count) {
+            span = count;
+        }
+        memcpy((uint8_t *) RINGBUF_ELEMENT(b, b->head), data_elements,
+            span * b->element_size);
+        memcpy((uint8_t *) & b->buffer[0], &data_elements[span *
+                b->element_size], (count - span) * b->element_size);
+        b->head += count;
+    }
+
+    return count;
+}
+
 /****************************************************************************
 * DESCRIPTION: Configures the ring buffer
 * RETURN:      none
@@ -396,6 +465,61 @@ static void testRingBuf(
     return;
 }
 
+/* test the copies of many elements, from every start in the ring */
+static void testRingBufMany(
+    Test * pTest,
+    uint8_t * data_store,
+    unsigned element_size,
+    unsigned element_count)
+{
+    RING_BUFFER test_buffer;
+    uint8_t data_elements[16 * 32] = { 0 };
+    uint8_t test_elements[16 * 32] = { 0 };
+    unsigned many = element_count - 3;
+    unsigned offset;
+    unsigned index;
+    unsigned count;
+
+    for (index = 0; index < sizeof(data_elements); index++) {
+        data_elements[index] = (uint8_t) (index * 7);
+    }
+    Ringbuf_Init(&test_buffer, data_store, element_size, element_count);
+    for (offset = 0; offset < element_count; offset++) {
+        count = Ringbuf_Put_Many(&test_buffer, data_elements, many);
+        ct_test(pTest, count == many);
+        ct_test(pTest, Ringbuf_Count(&test_buffer) == many);
+        /* one at a time, the same as the bulk copy */
+        for (index = 0; index < many; index++) {
+            ct_test(pTest, memcmp((uint8_t *) Ringbuf_Peek(&test_buffer),
+                    &data_elements[index * element_size],
+                    element_size) == 0);
+            (void) Ringbuf_Pop(&test_buffer, NULL);
+        }
+        ct_test(pTest, Ringbuf_Empty(&test_buffer));
+        (void) Ringbuf_Put_Many(&test_buffer, data_elements, many);
+        memset(test_elements, 0, sizeof(test_elements));
+        count = Ringbuf_Pop_Many(&test_buffer, test_elements, many + 1);
+        ct_test(pTest, count == many);
+        ct_test(pTest, memcmp(test_elements, data_elements,
+                many * element_size) == 0);
+        ct_test(pTest, Ringbuf_Empty(&test_buffer));
+        /* move the start by one */
+        (void) Ringbuf_Put(&test_buffer, data_elements);
+        (void) Ringbuf_Pop(&test_buffer, NULL);
+    }
+    /* only what fits */
+    count = Ringbuf_Put_Many(&test_buffer, data_elements, element_count + 1);
+    ct_test(pTest, count == element_count);
+    ct_test(pTest, Ringbuf_Full(&test_buffer));
+    count = Ringbuf_Put_Many(&test_buffer, data_elements, 1);
+    ct_test(pTest, count == 0);
+    count = Ringbuf_Pop_Many(&test_buffer, NULL, element_count);
+    ct_test(pTest, count == element_count);
+    ct_test(pTest, Ringbuf_Empty(&test_buffer));
+    count = Ringbuf_Pop_Many(&test_buffer, test_elements, 1);
+    ct_test(pTest, count == 0);
+}
+
 void testRingBufSize16(
     Test * pTest)
 {
@@ -404,6 +528,8 @@ void testRingBufSize16(
 
     testRingBuf(pTest, data_store, data_element, sizeof(data_element),
         sizeof(data_store) / sizeof(data_element));
+    testRingBufMany(pTest, data_store, sizeof(data_element),
+        sizeof(data_store) / sizeof(data_element));
 }
 
 void testRingBufSize32(
@@ -414,6 +540,8 @@ void testRingBufSize32(
 
     testRingBuf(pTest, data_store, data_element, sizeof(data_element),
         sizeof(data_store) / sizeof(data_element));
+    testRingBufMany(pTest, data_store, sizeof(data_element),
+        sizeof(data_store) / sizeof(data_element));
 }
 
 
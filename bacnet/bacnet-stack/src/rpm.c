@@ -32,16 +32,112 @@
  -------------------------------------------
 ####COPYRIGHTEND####*/
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include "bacenum.h"
 #include "bacerror.h"
 #include "bacdcode.h"
 #include "bacdef.h"
 #include "bacapp.h"
 #include "memcopy.h"
+#include "apdu.h"
 #include "rpm.h"
 
 /** @file rpm.c  Encode/Decode Read Property Multiple and RPM ACKs  */
 
+/* the blocks and the allocations are aligned for any value type */
+#define RPM_ARENA_ALIGN 16
+#define RPM_ARENA_ROUND(n) (((n) + RPM_ARENA_ALIGN - 1) & ~((size_t) RPM_ARENA_ALIGN - 1))
+#define RPM_ARENA_HEADER RPM_ARENA_ROUND(sizeof(BACNET_RPM_ARENA_BLOCK))
+
+void rpm_arena_init(
+    BACNET_RPM_ARENA * arena,
+    size_t block_size)
+{
+    if (arena) {
+        arena->blocks = NULL;
+        arena->block_size = block_size;
+    }
+}
+
+void *rpm_arena_alloc(
+    BACNET_RPM_ARENA * arena,
+    size_t size)
+{
+    BACNET_RPM_ARENA_BLOCK *block = NULL;
+    uint8_t *memory = NULL;
+
+    if (!arena) {
+        return NULL;
+    }
+    size = RPM_ARENA_ROUND(size);
+    block = arena->blocks;
+    if (!block || (block->size - block->used) < size) {
+        size_t block_size = arena->block_size;
+        if (block_size < size) {
+            block_size = size;
+        }
+        block = malloc(RPM_ARENA_HEADER + block_size);
+        if (!block) {
+            return NULL;
+        }
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    memory = (uint8_t *) block + RPM_ARENA_HEADER + block->used;
+    block->used += size;
+    memset(memory, 0, size);
+
+    return memory;
+}
+
+void rpm_arena_reset(
+    BACNET_RPM_ARENA * arena)
+{
+    BACNET_RPM_ARENA_BLOCK *block = NULL;
+    size_t total = 0;
+
+    if (!arena || !arena->blocks) {
+        return;
+    }
+    if (!arena->blocks->next) {
+        arena->blocks->used = 0;
+        return;
+    }
+    /* it took several blocks: next time one block holds it all */
+    for (block = arena->blocks; block; block = block->next) {
+        total += block->size;
+    }
+    rpm_arena_destroy(arena);
+    if (arena->block_size < total) {
+        arena->block_size = total;
+    }
+    block = malloc(RPM_ARENA_HEADER + arena->block_size);
+    if (block) {
+        block->size = arena->block_size;
+        block->used = 0;
+        block->next = NULL;
+        arena->blocks = block;
+    }
+}
+
+void rpm_arena_destroy(
+    BACNET_RPM_ARENA * arena)
+{
+    BACNET_RPM_ARENA_BLOCK *block = NULL;
+
+    if (!arena) {
+        return;
+    }
+    while (arena->blocks) {
+        block = arena->blocks;
+        arena->blocks = block->next;
+        free(block);
+    }
+}
+
 #if BACNET_SVC_RPM_A
 /* encode the initial portion of the service */
 int rpm_encode_apdu_init(
@@ -51,8 +147,8 @@ int rpm_encode_apdu_init(
     int apdu_len = 0;   /* total length of the apdu, return value */
 
     if (apdu) {
-        apdu[0] = PDU_TYPE_CONFIRMED_SERVICE_REQUEST;
-        apdu[1] = encode_max_segs_max_apdu(0, MAX_APDU);
+        apdu[0] = APDU_CONFIRMED_SERVICE_REQUEST;
+        apdu[1] = encode_max_segs_max_apdu(MAX_SEGMENTS_ACCEPTED, MAX_APDU);
         apdu[2] = invoke_id;
         apdu[3] = SERVICE_CONFIRMED_READ_PROP_MULTIPLE; /* service choice */
         apdu_len = 4;
@@ -565,7 +661,7 @@ int rpm_decode_apdu(
     if (!apdu)
         return -1;
     /* optional checking - most likely was already done prior to this call */
-    if (apdu[0] != PDU_TYPE_CONFIRMED_SERVICE_REQUEST)
+    if ((apdu[0] & 0xF0) != PDU_TYPE_CONFIRMED_SERVICE_REQUEST)
         return -1;
     /*  apdu[1] = encode_max_segs_max_apdu(0, MAX_APDU); */
     *invoke_id = apdu[2];       /* invoke id - filled in by net layer */
@@ -942,6 +1038,53 @@ void testReadPropertyMultipleAck(
     ct_test(pTest, len == service_request_len);
 }
 
+void testReadPropertyMultipleArena(
+    Test * pTest)
+{
+    BACNET_RPM_ARENA arena;
+    uint8_t *first = NULL;
+    uint8_t *second = NULL;
+    uint8_t *large = NULL;
+    unsigned i = 0;
+
+    rpm_arena_init(&arena, 256);
+    ct_test(pTest, arena.blocks == NULL);
+    first = rpm_arena_alloc(&arena, 3);
+    ct_test(pTest, first != NULL);
+    ct_test(pTest, ((uintptr_t) first % RPM_ARENA_ALIGN) == 0);
+    first[0] = 0xAA;
+    first[2] = 0xBB;
+    second = rpm_arena_alloc(&arena, 10);
+    ct_test(pTest, second == first + RPM_ARENA_ALIGN);
+    ct_test(pTest, arena.blocks->next == NULL);
+    for (i = 0; i < 10; i++) {
+        ct_test(pTest, second[i] == 0);
+    }
+    /* larger than a block */
+    large = rpm_arena_alloc(&arena, 1024);
+    ct_test(pTest, large != NULL);
+    ct_test(pTest, arena.blocks->next != NULL);
+    ct_test(pTest, arena.blocks->size == 1024);
+    /* the reset merges the blocks into one */
+    rpm_arena_reset(&arena);
+    ct_test(pTest, arena.blocks != NULL);
+    ct_test(pTest, arena.blocks->next == NULL);
+    ct_test(pTest, arena.blocks->used == 0);
+    ct_test(pTest, arena.blocks->size == 1280);
+    first = rpm_arena_alloc(&arena, 3);
+    ct_test(pTest, first[0] == 0);
+    ct_test(pTest, first[2] == 0);
+    large = rpm_arena_alloc(&arena, 1024);
+    ct_test(pTest, arena.blocks->next == NULL);
+    /* a single block is reused as is */
+    rpm_arena_reset(&arena);
+    ct_test(pTest, arena.blocks->next == NULL);
+    ct_test(pTest, arena.blocks->used == 0);
+    rpm_arena_destroy(&arena);
+    ct_test(pTest, arena.blocks == NULL);
+    ct_test(pTest, rpm_arena_alloc(NULL, 8) == NULL);
+}
+
 #ifdef TEST_READ_PROPERTY_MULTIPLE
 int main(
     void)
@@ -955,6 +1098,8 @@ int main(
     assert(rc);
     rc = ct_addTestFunction(pTest, testReadPropertyMultipleAck);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testReadPropertyMultipleArena);
+    assert(rc);
 
     ct_setStream(pTest, stdout);
     ct_run(pTest);
@@ -35,6 +35,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include "bits.h"
 #include "apdu.h"
 #include "bacdef.h"
@@ -46,6 +48,8 @@
 #include "handlers.h"
 #include "address.h"
 #include "bacaddr.h"
+#include "bacctx.h"
+#include "abort.h"
 
 /** @file tsm.c  BACnet Transaction State Machine operations  */
 
@@ -55,80 +59,540 @@
 /* If we are only a server and only initiate broadcasts, */
 /* then we don't need a TSM layer. */
 
-/* FIXME: not coded for segmentation */
+/* Segmentation is only coded for the replies: a ComplexACK too big for */
+/* one APDU is sent in windows of segments by the server, see */
+/* tsm_segmented_response(), and put back together by the client, see */
+/* tsm_segmented_confirmation(). */
 
-/* declare space for the TSM transactions, and set it up in the init. */
-/* table rules: an Invoke ID = 0 is an unused spot in the table */
-static BACNET_TSM_DATA TSM_List[MAX_TSM_TRANSACTIONS];
+/* The unused spots are kept in a free list, so a transaction is taken */
+/* without a scan. An invoke ID is either global, from */
+/* tsm_next_free_invokeID(), and then it is not in use for any device so */
+/* it is found by the ID alone, or it is only unique for its device, from */
+/* tsm_next_free_invokeID_peer(), and found by the device address and the */
+/* ID. The transactions awaiting a confirmation are kept in a heap ordered */
+/* by their deadline, so the timer only looks at the expired ones. */
 
-/* invoke ID for incrementing between subsequent calls. */
-static uint8_t Current_Invoke_ID = 1;
+#if (MAX_TSM_TRANSACTIONS >= 0xFFFF)
+#error "MAX_TSM_TRANSACTIONS must be less than 65535"
+#endif
 
-/* returns MAX_TSM_TRANSACTIONS if not found */
-static uint8_t tsm_find_invokeID_index(
-    uint8_t invokeID)
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+#if ((MAX_SEGMENTS_ACCEPTED * MAX_APDU) > 0xFFFF)
+#error "MAX_SEGMENTS_ACCEPTED segments of MAX_APDU must fit in 16 bits"
+#endif
+#if (MAX_SEGMENTS_ACCEPTED > 255)
+#error "MAX_SEGMENTS_ACCEPTED must be less than 256"
+#endif
+#if ((MAX_SEGMENT_WINDOW_SIZE < 1) || (MAX_SEGMENT_WINDOW_SIZE > 127))
+#error "MAX_SEGMENT_WINDOW_SIZE must be from 1 to 127"
+#endif
+/* the replies that can be sent in segments at the same time */
+#if !defined(MAX_TSM_SEGMENTED_RESPONSES)
+#define MAX_TSM_SEGMENTED_RESPONSES 4
+#endif
+/* the header of a segmented ComplexACK, and of an unsegmented one */
+#define TSM_SEGMENT_HEADER_LEN 5
+#define TSM_COMPLEX_ACK_HEADER_LEN 3
+
+/* 5.4.5 A reply being sent in segments. The sequence number of a segment */
+/* is its index, as there are less than 256 of them. */
+struct tsm_segmented_response {
+    bool Active;
+    /* the client, and the invoke ID of its request */
+    BACNET_ADDRESS dest;
+    uint8_t InvokeID;
+    BACNET_NPDU_DATA npdu_data;
+    uint8_t ServiceChoice;
+    /* copy of the service data of the reply, cut in segment_size pieces */
+    uint8_t *service_data;
+    unsigned service_data_len;
+    unsigned segment_size;
+    unsigned segment_count;
+    /* the first segment of the window not acknowledged yet */
+    uint8_t InitialSequenceNumber;
+    uint8_t ActualWindowSize;
+    uint8_t SegmentRetryCount;
+    /* when the SegmentACK is due, on the clock of tsm_timer_milliseconds */
+    uint32_t Deadline;
+};
+#endif
+
+/* the devices whose round trips are kept for the adaptive timeout, by */
+/* the hash of their address; one taking the spot of another starts over */
+#if !defined(MAX_TSM_PEERS)
+#define MAX_TSM_PEERS 64
+#endif
+/* the bounds of the adaptive timeout, in milliseconds */
+#if !defined(TSM_MIN_TIMEOUT)
+#define TSM_MIN_TIMEOUT 100
+#endif
+#define TSM_MAX_TIMEOUT 60000
+
+/* The round trips of a device, as TCP estimates its RTO (RFC 6298): */
+/* the smoothed round trip and its mean deviation are kept scaled by 8 */
+/* and by 4, so that the gains of 1/8 and 1/4 are shifts. */
+struct tsm_peer {
+    bool Valid;
+    BACNET_ADDRESS dest;
+    int32_t SRTT8;
+    int32_t RTTVAR4;
+    uint16_t Timeout;
+};
+
+#define TSM_NO_INDEX 0xFFFF
+/* at most half full for the linear probing */
+#define TSM_HASH_SIZE (2 * MAX_TSM_TRANSACTIONS + 1)
+
+/* The state of the TSM, one per BACnet context (see bacctx.h). All zero */
+/* is the initial state. */
+struct tsm_state {
+    /* invoke IDs (1..255) used by a transaction */
+    unsigned ID_Used;
+    /* invoke ID for incrementing between subsequent calls, 0 is 1. */
+    uint8_t Current_Invoke_ID;
+    bool Initialized;
+    /* declare space for the TSM transactions, and set it up in the init. */
+    /* table rules: an Invoke ID = 0 is an unused spot in the table */
+    BACNET_TSM_DATA List[MAX_TSM_TRANSACTIONS];
+    /* next unused spot, and the head of the list */
+    uint16_t Free_Next[MAX_TSM_TRANSACTIONS];
+    uint16_t Free_Head;
+    unsigned Free_Count;
+    /* index + 1 of the transaction of each global invoke ID, 0 if none */
+    uint16_t Global[256];
+    /* transactions using each invoke ID, whatever the device */
+    uint16_t ID_Users[256];
+    /* index + 1 of the per device transactions, by address and invoke ID */
+    uint16_t Hash[TSM_HASH_SIZE];
+    /* transaction indexes by deadline, and index + 1 of each in the heap */
+    uint16_t Heap[MAX_TSM_TRANSACTIONS];
+    uint16_t Heap_Position[MAX_TSM_TRANSACTIONS];
+    unsigned Heap_Count;
+    /* milliseconds counted by tsm_timer_milliseconds, wraps around */
+    uint32_t Clock;
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+    struct tsm_segmented_response Segmented[MAX_TSM_SEGMENTED_RESPONSES];
+#endif
+    /* see tsm_adaptive_timeout_set() */
+    bool Adaptive;
+    struct tsm_peer Peers[MAX_TSM_PEERS];
+};
+
+static struct tsm_state TSM_Default_State;
+
+#if defined(BACNET_CONTEXT_ENABLED)
+void *tsm_state_create(
+    void)
 {
-    unsigned i = 0;     /* counter */
-    uint8_t index = MAX_TSM_TRANSACTIONS;       /* return value */
+    return calloc(1, sizeof(struct tsm_state));
+}
 
-    for (i = 0; i < MAX_TSM_TRANSACTIONS; i++) {
-        if (TSM_List[i].InvokeID == invokeID) {
-            index = (uint8_t) i;
-            break;
+void tsm_state_destroy(
+    void *state)
+{
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+    struct tsm_state *pState = (struct tsm_state *) state;
+    unsigned i = 0;
+
+    if (pState) {
+        for (i = 0; i < MAX_TSM_TRANSACTIONS; i++) {
+            free(pState->List[i].segments);
+        }
+        for (i = 0; i < MAX_TSM_SEGMENTED_RESPONSES; i++) {
+            free(pState->Segmented[i].service_data);
         }
     }
+#endif
+    free(state);
+}
 
-    return index;
+static struct tsm_state *tsm_state(
+    void)
+{
+    struct tsm_state *state = bacnet_context_tsm_state();
+
+    return state ? state : &TSM_Default_State;
 }
 
-static uint8_t tsm_find_first_free_index(
+#define TSM_STATE (tsm_state())
+#else
+#define TSM_STATE (&TSM_Default_State)
+#endif
+
+/* the state of the current context */
+#define TSM_List (TSM_STATE->List)
+#define TSM_Free_Next (TSM_STATE->Free_Next)
+#define TSM_Free_Head (TSM_STATE->Free_Head)
+#define TSM_Free_Count (TSM_STATE->Free_Count)
+#define TSM_Initialized (TSM_STATE->Initialized)
+#define TSM_Global (TSM_STATE->Global)
+#define TSM_ID_Users (TSM_STATE->ID_Users)
+#define TSM_ID_Used (TSM_STATE->ID_Used)
+#define TSM_Hash (TSM_STATE->Hash)
+#define TSM_Heap (TSM_STATE->Heap)
+#define TSM_Heap_Position (TSM_STATE->Heap_Position)
+#define TSM_Heap_Count (TSM_STATE->Heap_Count)
+#define TSM_Clock (TSM_STATE->Clock)
+#define TSM_Segmented (TSM_STATE->Segmented)
+#define TSM_Adaptive (TSM_STATE->Adaptive)
+#define TSM_Peers (TSM_STATE->Peers)
+#define Current_Invoke_ID (TSM_STATE->Current_Invoke_ID)
+
+static void tsm_init(
     void)
 {
-    unsigned i = 0;     /* counter */
-    uint8_t index = MAX_TSM_TRANSACTIONS;       /* return value */
+    unsigned i = 0;
 
     for (i = 0; i < MAX_TSM_TRANSACTIONS; i++) {
-        if (TSM_List[i].InvokeID == 0) {
-            index = (uint8_t) i;
-            break;
+        TSM_Free_Next[i] = (uint16_t) ((i + 1) < MAX_TSM_TRANSACTIONS ? (i +
+                1) : TSM_NO_INDEX);
+    }
+    TSM_Free_Head = 0;
+    TSM_Free_Count = MAX_TSM_TRANSACTIONS;
+    TSM_Initialized = true;
+}
+
+static void tsm_next_invoke_id(
+    void)
+{
+    Current_Invoke_ID++;
+    /* skip zero - we treat that internally as invalid or no free */
+    if (Current_Invoke_ID == 0) {
+        Current_Invoke_ID = 1;
+    }
+}
+
+/* the fields compared by bacnet_address_same() */
+static unsigned tsm_hash_home(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID)
+{
+    uint32_t h = 2166136261UL;
+    unsigned i = 0;
+
+    h = (h ^ invokeID) * 16777619UL;
+    h = (h ^ (dest->net & 0xFF)) * 16777619UL;
+    h = (h ^ (dest->net >> 8)) * 16777619UL;
+    for (i = 0; (i < dest->len) && (i < MAX_MAC_LEN); i++) {
+        h = (h ^ dest->adr[i]) * 16777619UL;
+    }
+    if (dest->net == 0) {
+        for (i = 0; (i < dest->mac_len) && (i < MAX_MAC_LEN); i++) {
+            h = (h ^ dest->mac[i]) * 16777619UL;
         }
     }
 
-    return index;
+    return (unsigned) (h % TSM_HASH_SIZE);
 }
 
-bool tsm_transaction_available(
-    void)
+/* returns the hash slot, or TSM_HASH_SIZE if not found */
+static unsigned tsm_hash_slot(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID)
 {
-    bool status = false;        /* return value */
-    unsigned i = 0;     /* counter */
+    unsigned slot = tsm_hash_home(dest, invokeID);
+    BACNET_TSM_DATA *plist = NULL;
 
-    for (i = 0; i < MAX_TSM_TRANSACTIONS; i++) {
-        if (TSM_List[i].InvokeID == 0) {
-            /* one is available! */
-            status = true;
+    while (TSM_Hash[slot] != 0) {
+        plist = &TSM_List[TSM_Hash[slot] - 1];
+        if ((plist->InvokeID == invokeID) &&
+            bacnet_address_same(&plist->dest, dest))
+            return slot;
+        slot = (slot + 1) % TSM_HASH_SIZE;
+    }
+
+    return TSM_HASH_SIZE;
+}
+
+static void tsm_hash_insert(
+    unsigned index)
+{
+    unsigned slot = tsm_hash_home(&TSM_List[index].dest,
+        TSM_List[index].InvokeID);
+
+    while (TSM_Hash[slot] != 0)
+        slot = (slot + 1) % TSM_HASH_SIZE;
+    TSM_Hash[slot] = (uint16_t) (index + 1);
+}
+
+/* Linear probing without tombstones: the entries after the removed one */
+/* are shifted back when their home slot allows it. */
+static void tsm_hash_remove(
+    unsigned index)
+{
+    unsigned hole = 0;
+    unsigned slot = 0;
+    unsigned home = 0;
+    BACNET_TSM_DATA *plist = NULL;
+
+    hole = tsm_hash_slot(&TSM_List[index].dest, TSM_List[index].InvokeID);
+    if (hole >= TSM_HASH_SIZE)
+        return;
+    TSM_Hash[hole] = 0;
+    slot = hole;
+    for (;;) {
+        slot = (slot + 1) % TSM_HASH_SIZE;
+        if (TSM_Hash[slot] == 0)
             break;
-        }
+        plist = &TSM_List[TSM_Hash[slot] - 1];
+        home = tsm_hash_home(&plist->dest, plist->InvokeID);
+        /* leave it if its home is cyclically in (hole, slot] */
+        if ((hole <= slot) ? ((home > hole) && (home <= slot))
+            : ((home > hole) || (home <= slot)))
+            continue;
+        TSM_Hash[hole] = TSM_Hash[slot];
+        TSM_Hash[slot] = 0;
+        hole = slot;
     }
+}
 
-    return status;
+/* the round trips of the device, NULL if none are known */
+static struct tsm_peer *tsm_peer_find(
+    BACNET_ADDRESS * dest)
+{
+    struct tsm_peer *peer = &TSM_Peers[tsm_hash_home(dest, 0) % MAX_TSM_PEERS];
+
+    if (peer->Valid && bacnet_address_same(&peer->dest, dest))
+        return peer;
+
+    return NULL;
 }
 
-uint8_t tsm_transaction_idle_count(
-    void)
+/* the timeout of a new request to the device */
+static uint16_t tsm_request_timeout(
+    BACNET_ADDRESS * dest)
 {
-    uint8_t count = 0;  /* return value */
-    unsigned i = 0;     /* counter */
+    struct tsm_peer *peer = NULL;
 
-    for (i = 0; i < MAX_TSM_TRANSACTIONS; i++) {
-        if ((TSM_List[i].InvokeID == 0) &&
-            (TSM_List[i].state == TSM_STATE_IDLE)) {
-            /* one is available! */
-            count++;
-        }
+    if (TSM_Adaptive) {
+        peer = tsm_peer_find(dest);
+        if (peer)
+            return peer->Timeout;
+    }
+
+    return apdu_timeout();
+}
+
+/* a round trip of the device, of a request sent only once (Karn) */
+static void tsm_peer_sample(
+    BACNET_ADDRESS * dest,
+    uint32_t rtt)
+{
+    struct tsm_peer *peer = &TSM_Peers[tsm_hash_home(dest, 0) % MAX_TSM_PEERS];
+    int32_t r = (int32_t) (rtt > TSM_MAX_TIMEOUT ? TSM_MAX_TIMEOUT : rtt);
+    int32_t delta = 0;
+    int32_t rto = 0;
+
+    if (!peer->Valid || !bacnet_address_same(&peer->dest, dest)) {
+        peer->Valid = true;
+        bacnet_address_copy(&peer->dest, dest);
+        peer->SRTT8 = r * 8;
+        peer->RTTVAR4 = r * 2;
+    } else {
+        delta = r - peer->SRTT8 / 8;
+        peer->SRTT8 += delta;
+        if (delta < 0)
+            delta = -delta;
+        peer->RTTVAR4 += delta - peer->RTTVAR4 / 4;
     }
+    rto = peer->SRTT8 / 8 + peer->RTTVAR4;
+    if (rto < TSM_MIN_TIMEOUT)
+        rto = TSM_MIN_TIMEOUT;
+    else if (rto > TSM_MAX_TIMEOUT)
+        rto = TSM_MAX_TIMEOUT;
+    peer->Timeout = (uint16_t) rto;
+}
+
+/* the timeout of the next try of the transaction, doubled; the device */
+/* keeps it until a reply tells its round trip again */
+static uint16_t tsm_backoff(
+    unsigned index)
+{
+    struct tsm_peer *peer = NULL;
+    uint32_t timeout = 2u * TSM_List[index].RequestTimer;
 
-    return count;
+    if (!TSM_Adaptive)
+        return apdu_timeout();
+    if (timeout > TSM_MAX_TIMEOUT)
+        timeout = TSM_MAX_TIMEOUT;
+    peer = tsm_peer_find(&TSM_List[index].dest);
+    if (peer && (peer->Timeout < timeout))
+        peer->Timeout = (uint16_t) timeout;
+
+    return (uint16_t) timeout;
+}
+
+/* the deadlines wrap around with the clock */
+static bool tsm_heap_before(
+    unsigned a,
+    unsigned b)
+{
+    return (int32_t) (TSM_List[TSM_Heap[a]].Deadline -
+        TSM_List[TSM_Heap[b]].Deadline) < 0;
+}
+
+static void tsm_heap_swap(
+    unsigned a,
+    unsigned b)
+{
+    uint16_t index = TSM_Heap[a];
+
+    TSM_Heap[a] = TSM_Heap[b];
+    TSM_Heap[b] = index;
+    TSM_Heap_Position[TSM_Heap[a]] = (uint16_t) (a + 1);
+    TSM_Heap_Position[TSM_Heap[b]] = (uint16_t) (b + 1);
+}
+
+static void tsm_heap_up(
+    unsigned pos)
+{
+    while ((pos > 0) && tsm_heap_before(pos, (pos - 1) / 2)) {
+        tsm_heap_swap(pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+static void tsm_heap_down(
+    unsigned pos)
+{
+    unsigned child = 0;
+
+    for (;;) {
+        child = 2 * pos + 1;
+        if (child >= TSM_Heap_Count)
+            break;
+        if (((child + 1) < TSM_Heap_Count) && tsm_heap_before(child + 1,
+                child))
+            child++;
+        if (!tsm_heap_before(child, pos))
+            break;
+        tsm_heap_swap(pos, child);
+        pos = child;
+    }
+}
+
+static void tsm_heap_remove(
+    unsigned index)
+{
+    unsigned pos = 0;
+
+    if (TSM_Heap_Position[index] == 0)
+        return;
+    pos = TSM_Heap_Position[index] - 1u;
+    TSM_Heap_Position[index] = 0;
+    TSM_Heap_Count--;
+    if (pos != TSM_Heap_Count) {
+        TSM_Heap[pos] = TSM_Heap[TSM_Heap_Count];
+        TSM_Heap_Position[TSM_Heap[pos]] = (uint16_t) (pos + 1);
+        tsm_heap_up(pos);
+        tsm_heap_down(pos);
+    }
+}
+
+/* (re)start the timer of the transaction */
+static void tsm_heap_schedule(
+    unsigned index)
+{
+    tsm_heap_remove(index);
+    TSM_List[index].Deadline = TSM_Clock + TSM_List[index].RequestTimer;
+    TSM_Heap[TSM_Heap_Count] = (uint16_t) index;
+    TSM_Heap_Position[index] = (uint16_t) (TSM_Heap_Count + 1);
+    TSM_Heap_Count++;
+    tsm_heap_up(TSM_Heap_Count - 1);
+}
+
+/* returns MAX_TSM_TRANSACTIONS if not found */
+static unsigned tsm_find_invokeID_index(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID)
+{
+    unsigned slot = 0;
+
+    if (invokeID == 0)
+        return MAX_TSM_TRANSACTIONS;
+    if (TSM_Global[invokeID] != 0)
+        return TSM_Global[invokeID] - 1u;
+    if (dest != NULL) {
+        slot = tsm_hash_slot(dest, invokeID);
+        if (slot < TSM_HASH_SIZE)
+            return TSM_Hash[slot] - 1u;
+    }
+
+    return MAX_TSM_TRANSACTIONS;
+}
+
+/* take an unused spot for the invoke ID, returns MAX_TSM_TRANSACTIONS */
+/* if there is none */
+static unsigned tsm_take_index(
+    uint8_t invokeID)
+{
+    unsigned index = 0;
+
+    if (!TSM_Initialized)
+        tsm_init();
+    if (TSM_Free_Head == TSM_NO_INDEX)
+        return MAX_TSM_TRANSACTIONS;
+    index = TSM_Free_Head;
+    TSM_Free_Head = TSM_Free_Next[index];
+    TSM_Free_Count--;
+    if (TSM_ID_Users[invokeID] == 0)
+        TSM_ID_Used++;
+    TSM_ID_Users[invokeID]++;
+    TSM_List[index].InvokeID = invokeID;
+    TSM_List[index].PeerInvokeID = false;
+    TSM_List[index].state = TSM_STATE_IDLE;
+    TSM_List[index].RetryCount = 0;
+    TSM_List[index].RequestTimer = apdu_timeout();
+    TSM_List[index].Completion = NULL;
+    TSM_List[index].CompletionContext = NULL;
+
+    return index;
+}
+
+static void tsm_release_index(
+    unsigned index)
+{
+    uint8_t invokeID = TSM_List[index].InvokeID;
+
+    tsm_heap_remove(index);
+    if (TSM_List[index].PeerInvokeID)
+        tsm_hash_remove(index);
+    else
+        TSM_Global[invokeID] = 0;
+    TSM_ID_Users[invokeID]--;
+    if (TSM_ID_Users[invokeID] == 0)
+        TSM_ID_Used--;
+    TSM_List[index].state = TSM_STATE_IDLE;
+    TSM_List[index].InvokeID = 0;
+    TSM_List[index].PeerInvokeID = false;
+    TSM_List[index].Completion = NULL;
+    TSM_List[index].CompletionContext = NULL;
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+    free(TSM_List[index].segments);
+    TSM_List[index].segments = NULL;
+    TSM_List[index].segments_len = 0;
+#endif
+    TSM_Free_Next[index] = TSM_Free_Head;
+    TSM_Free_Head = (uint16_t) index;
+    TSM_Free_Count++;
+}
+
+bool tsm_transaction_available(
+    void)
+{
+    if (!TSM_Initialized)
+        tsm_init();
+
+    return (TSM_Free_Count > 0);
+}
+
+uint8_t tsm_transaction_idle_count(
+    void)
+{
+    if (!TSM_Initialized)
+        tsm_init();
+
+    return (uint8_t) (TSM_Free_Count > 255 ? 255 : TSM_Free_Count);
 }
 
 /* sets the invokeID */
@@ -148,45 +612,87 @@ void tsm_invokeID_set(
 uint8_t tsm_next_free_invokeID(
     void)
 {
-    uint8_t index = 0;
+    unsigned index = 0;
     uint8_t invokeID = 0;
-    bool found = false;
 
     /* is there even space available? */
-    if (tsm_transaction_available()) {
-        while (!found) {
-            index = tsm_find_invokeID_index(Current_Invoke_ID);
-            if (index == MAX_TSM_TRANSACTIONS) {
-                /* Not found, so this invokeID is not used */
-                found = true;
-                /* set this id into the table */
-                index = tsm_find_first_free_index();
-                if (index != MAX_TSM_TRANSACTIONS) {
-                    TSM_List[index].InvokeID = invokeID = Current_Invoke_ID;
-                    TSM_List[index].state = TSM_STATE_IDLE;
-                    TSM_List[index].RequestTimer = apdu_timeout();
-                    /* update for the next call or check */
-                    Current_Invoke_ID++;
-                    /* skip zero - we treat that internally as invalid or no free */
-                    if (Current_Invoke_ID == 0) {
-                        Current_Invoke_ID = 1;
-                    }
-                }
-            } else {
-                /* found! This invokeID is already used */
-                /* try next one */
-                Current_Invoke_ID++;
-                /* skip zero - we treat that internally as invalid or no free */
-                if (Current_Invoke_ID == 0) {
-                    Current_Invoke_ID = 1;
-                }
-            }
+    if (tsm_transaction_available() && (TSM_ID_Used < 255)) {
+        if (Current_Invoke_ID == 0) {
+            Current_Invoke_ID = 1;
+        }
+        /* an ID not in use for any device */
+        while (TSM_ID_Users[Current_Invoke_ID] != 0) {
+            tsm_next_invoke_id();
         }
+        invokeID = Current_Invoke_ID;
+        index = tsm_take_index(invokeID);
+        TSM_Global[invokeID] = (uint16_t) (index + 1);
+        /* update for the next call or check */
+        tsm_next_invoke_id();
     }
 
     return invokeID;
 }
 
+/* gets the next invokeID not in use for the device, and reserves a spot */
+/* in the table. The ID must then be given with the address of the device */
+/* to the _peer functions. Returns 0 if none are available */
+uint8_t tsm_next_free_invokeID_peer(
+    BACNET_ADDRESS * dest)
+{
+    unsigned index = 0;
+    uint8_t invokeID = 0;
+    unsigned tries = 0;
+
+    if ((dest == NULL) || !tsm_transaction_available()) {
+        return 0;
+    }
+    if (Current_Invoke_ID == 0) {
+        Current_Invoke_ID = 1;
+    }
+    for (tries = 0; tries < 255; tries++) {
+        invokeID = Current_Invoke_ID;
+        tsm_next_invoke_id();
+        if ((TSM_Global[invokeID] == 0) &&
+            (tsm_hash_slot(dest, invokeID) >= TSM_HASH_SIZE)) {
+            index = tsm_take_index(invokeID);
+            TSM_List[index].PeerInvokeID = true;
+            bacnet_address_copy(&TSM_List[index].dest, dest);
+            tsm_hash_insert(index);
+            return invokeID;
+        }
+    }
+
+    return 0;
+}
+
+static void tsm_set_transaction(
+    unsigned index,
+    BACNET_ADDRESS * dest,
+    BACNET_NPDU_DATA * ndpu_data,
+    uint8_t * apdu,
+    uint16_t apdu_len)
+{
+    uint16_t j = 0;
+
+    /* SendConfirmedUnsegmented */
+    TSM_List[index].state = TSM_STATE_AWAIT_CONFIRMATION;
+    TSM_List[index].RetryCount = 0;
+    /* start the timer */
+    TSM_List[index].RequestTimer = tsm_request_timeout(dest);
+    TSM_List[index].SentAt = TSM_Clock;
+    tsm_heap_schedule(index);
+    /* copy the data */
+    for (j = 0; j < apdu_len; j++) {
+        TSM_List[index].apdu[j] = apdu[j];
+    }
+    TSM_List[index].apdu_len = apdu_len;
+    npdu_copy_data(&TSM_List[index].npdu_data, ndpu_data);
+    /* the per device IDs are indexed by the address already given */
+    if (!TSM_List[index].PeerInvokeID)
+        bacnet_address_copy(&TSM_List[index].dest, dest);
+}
+
 void tsm_set_confirmed_unsegmented_transaction(
     uint8_t invokeID,
     BACNET_ADDRESS * dest,
@@ -194,24 +700,12 @@ void tsm_set_confirmed_unsegmented_transaction(
     uint8_t * apdu,
     uint16_t apdu_len)
 {
-    uint16_t j = 0;
-    uint8_t index;
+    unsigned index;
 
     if (invokeID) {
-        index = tsm_find_invokeID_index(invokeID);
+        index = tsm_find_invokeID_index(dest, invokeID);
         if (index < MAX_TSM_TRANSACTIONS) {
-            /* SendConfirmedUnsegmented */
-            TSM_List[index].state = TSM_STATE_AWAIT_CONFIRMATION;
-            TSM_List[index].RetryCount = 0;
-            /* start the timer */
-            TSM_List[index].RequestTimer = apdu_timeout();
-            /* copy the data */
-            for (j = 0; j < apdu_len; j++) {
-                TSM_List[index].apdu[j] = apdu[j];
-            }
-            TSM_List[index].apdu_len = apdu_len;
-            npdu_copy_data(&TSM_List[index].npdu_data, ndpu_data);
-            bacnet_address_copy(&TSM_List[index].dest, dest);
+            tsm_set_transaction(index, dest, ndpu_data, apdu, apdu_len);
         }
     }
 
@@ -228,11 +722,11 @@ bool tsm_get_transaction_pdu(
     uint16_t * apdu_len)
 {
     uint16_t j = 0;
-    uint8_t index;
+    unsigned index;
     bool found = false;
 
     if (invokeID) {
-        index = tsm_find_invokeID_index(invokeID);
+        index = tsm_find_invokeID_index(NULL, invokeID);
         /* how much checking is needed?  state?  dest match? just invokeID? */
         if (index < MAX_TSM_TRANSACTIONS) {
             /* FIXME: we may want to free the transaction so it doesn't timeout */
@@ -251,50 +745,224 @@ bool tsm_get_transaction_pdu(
     return found;
 }
 
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+static void tsm_segmented_response_timer(
+    void);
+#endif
+
+/* frees the transaction and tells its completion that it failed; freed */
+/* before, so that the completion may send the request again */
+static void tsm_completion_failed(
+    unsigned index,
+    BACNET_CONFIRMED_REPLY * reply)
+{
+    BACNET_ADDRESS dest;
+    tsm_completion_function completion = TSM_List[index].Completion;
+    void *context = TSM_List[index].CompletionContext;
+    uint8_t invokeID = TSM_List[index].InvokeID;
+
+    bacnet_address_copy(&dest, &TSM_List[index].dest);
+    tsm_release_index(index);
+    completion(&dest, invokeID, reply, context);
+}
+
 /* called once a millisecond or slower */
 void tsm_timer_milliseconds(
     uint16_t milliseconds)
 {
-    unsigned i = 0;     /* counter */
+    unsigned i = 0;     /* index of the transaction */
+    BACNET_CONFIRMED_REPLY reply;
 
-    for (i = 0; i < MAX_TSM_TRANSACTIONS; i++) {
-        if (TSM_List[i].state == TSM_STATE_AWAIT_CONFIRMATION) {
-            if (TSM_List[i].RequestTimer > milliseconds)
-                TSM_List[i].RequestTimer -= milliseconds;
-            else
-                TSM_List[i].RequestTimer = 0;
-            /* AWAIT_CONFIRMATION */
-            if (TSM_List[i].RequestTimer == 0) {
-                if (TSM_List[i].RetryCount < apdu_retries()) {
-                    TSM_List[i].RequestTimer = apdu_timeout();
-                    TSM_List[i].RetryCount++;
-                    datalink_send_pdu(&TSM_List[i].dest,
-                        &TSM_List[i].npdu_data, &TSM_List[i].apdu[0],
-                        TSM_List[i].apdu_len);
-                } else {
-                    /* note: the invoke id has not been cleared yet
-                       and this indicates a failed message:
-                       IDLE and a valid invoke id */
-                    TSM_List[i].state = TSM_STATE_IDLE;
-                }
-            }
+    TSM_Clock += milliseconds;
+    /* only the expired ones, the earliest first */
+    while ((TSM_Heap_Count > 0) &&
+        ((int32_t) (TSM_List[TSM_Heap[0]].Deadline - TSM_Clock) <= 0)) {
+        i = TSM_Heap[0];
+        tsm_heap_remove(i);
+        /* AWAIT_CONFIRMATION, while SEGMENTED_CONFIRMATION just fails */
+        if ((TSM_List[i].state == TSM_STATE_AWAIT_CONFIRMATION) &&
+            (TSM_List[i].RetryCount < apdu_retries())) {
+            TSM_List[i].RequestTimer = tsm_backoff(i);
+            TSM_List[i].RetryCount++;
+            tsm_heap_schedule(i);
+            datalink_send_pdu(&TSM_List[i].dest, &TSM_List[i].npdu_data,
+                &TSM_List[i].apdu[0], TSM_List[i].apdu_len);
+        } else if (TSM_List[i].Completion) {
+            memset(&reply, 0, sizeof(reply));
+            reply.timeout = true;
+            tsm_completion_failed(i, &reply);
+        } else {
+            /* note: the invoke id has not been cleared yet
+               and this indicates a failed message:
+               IDLE and a valid invoke id */
+            TSM_List[i].RequestTimer = 0;
+            TSM_List[i].state = TSM_STATE_IDLE;
+        }
+    }
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+    tsm_segmented_response_timer();
+#endif
+}
+
+uint32_t tsm_timer_remaining(
+    void)
+{
+    uint32_t remaining = BACTIMER_IDLE;
+    int32_t left = 0;
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+    unsigned i = 0;
+#endif
+
+    if (TSM_Heap_Count > 0) {
+        left = (int32_t) (TSM_List[TSM_Heap[0]].Deadline - TSM_Clock);
+        remaining = (left > 0) ? (uint32_t) left : 0;
+    }
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+    for (i = 0; i < MAX_TSM_SEGMENTED_RESPONSES; i++) {
+        if (!TSM_Segmented[i].Active) {
+            continue;
+        }
+        left = (int32_t) (TSM_Segmented[i].Deadline - TSM_Clock);
+        if (left <= 0) {
+            remaining = 0;
+        } else if ((uint32_t) left < remaining) {
+            remaining = (uint32_t) left;
         }
     }
+#endif
+
+    return remaining;
 }
 
 /* frees the invokeID and sets its state to IDLE */
 void tsm_free_invoke_id(
     uint8_t invokeID)
 {
-    uint8_t index;
+    unsigned index;
+
+    index = tsm_find_invokeID_index(NULL, invokeID);
+    if (index < MAX_TSM_TRANSACTIONS) {
+        tsm_release_index(index);
+    }
+}
+
+/* frees the invokeID of the device, global or per device */
+void tsm_free_invoke_id_peer(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID)
+{
+    unsigned index;
 
-    index = tsm_find_invokeID_index(invokeID);
+    index = tsm_find_invokeID_index(src, invokeID);
     if (index < MAX_TSM_TRANSACTIONS) {
-        TSM_List[index].state = TSM_STATE_IDLE;
-        TSM_List[index].InvokeID = 0;
+        tsm_release_index(index);
     }
 }
 
+/** Set the function the reply to the request of the transaction is given
+ *  to, by tsm_complete(), or its timeout, by tsm_timer_milliseconds().
+ * @param dest [in] The device of a per device invoke ID, or NULL.
+ * @param invokeID [in] The invokeID of the request.
+ * @param completion [in] The function, NULL for the global handlers.
+ * @param context [in] Given to the function as is.
+ * @return True if the transaction is found.
+ */
+bool tsm_set_completion(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID,
+    tsm_completion_function completion,
+    void *context)
+{
+    unsigned index;
+
+    index = tsm_find_invokeID_index(dest, invokeID);
+    if (index >= MAX_TSM_TRANSACTIONS) {
+        return false;
+    }
+    TSM_List[index].Completion = completion;
+    TSM_List[index].CompletionContext = context;
+
+    return true;
+}
+
+/** Give a reply to the completion function of its transaction, and free
+ *  the invoke ID once it returns.
+ * @param src [in] The device the reply came from.
+ * @param invokeID [in] The invokeID of the reply.
+ * @param reply [in] The reply.
+ * @return True if the transaction has a completion function, False if it
+ *         has none or is not found, in which case nothing is done.
+ */
+bool tsm_complete(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID,
+    BACNET_CONFIRMED_REPLY * reply)
+{
+    unsigned index;
+    tsm_completion_function completion = NULL;
+    void *context = NULL;
+
+    index = tsm_find_invokeID_index(src, invokeID);
+    if ((index >= MAX_TSM_TRANSACTIONS) || !TSM_List[index].Completion) {
+        return false;
+    }
+    /* once: a duplicate of the reply goes to the global handlers */
+    completion = TSM_List[index].Completion;
+    context = TSM_List[index].CompletionContext;
+    TSM_List[index].Completion = NULL;
+    TSM_List[index].CompletionContext = NULL;
+    /* the segments of the reply are kept until it returns */
+    completion(src, invokeID, reply, context);
+    tsm_free_invoke_id_peer(src, invokeID);
+
+    return true;
+}
+
+/** Measure the round trip of the request of a reply, for the adaptive
+ *  timeout of its device. Only the replies to requests sent once are
+ *  measured, the reply to a retry may be to any of the tries.
+ * @param src [in] The device the reply came from.
+ * @param invokeID [in] The invokeID of the reply.
+ */
+void tsm_reply_received(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID)
+{
+    unsigned index;
+
+    if (!TSM_Adaptive) {
+        return;
+    }
+    index = tsm_find_invokeID_index(src, invokeID);
+    if ((index < MAX_TSM_TRANSACTIONS) &&
+        (TSM_List[index].state == TSM_STATE_AWAIT_CONFIRMATION) &&
+        (TSM_List[index].RetryCount == 0) &&
+        bacnet_address_same(&TSM_List[index].dest, src)) {
+        tsm_peer_sample(src, TSM_Clock - TSM_List[index].SentAt);
+    }
+}
+
+/** Learn the timeout of the requests to each device from the round trips
+ *  of its replies, and double it on every retry, instead of waiting
+ *  apdu_timeout() for every try. For the current context.
+ * @param enable [in] True to turn it on, off by default.
+ */
+void tsm_adaptive_timeout_set(
+    bool enable)
+{
+    TSM_Adaptive = enable;
+}
+
+/** The timeout of the next request to the device.
+ * @param dest [in] The device.
+ * @return In milliseconds, apdu_timeout() until a round trip is known.
+ */
+uint16_t tsm_peer_timeout(
+    BACNET_ADDRESS * dest)
+{
+    return tsm_request_timeout(dest);
+}
+
 /** Check if the invoke ID has been made free by the Transaction State Machine.
  * @param invokeID [in] The invokeID to be checked, normally of last message sent.
  * @return True if it is free (done with), False if still pending in the TSM.
@@ -302,14 +970,19 @@ void tsm_free_invoke_id(
 bool tsm_invoke_id_free(
     uint8_t invokeID)
 {
-    bool status = true;
-    uint8_t index;
-
-    index = tsm_find_invokeID_index(invokeID);
-    if (index < MAX_TSM_TRANSACTIONS)
-        status = false;
+    return tsm_invoke_id_free_peer(NULL, invokeID);
+}
 
-    return status;
+/** Check if the invoke ID of the device has been made free.
+ * @param dest [in] The device of a per device invoke ID, or NULL.
+ * @param invokeID [in] The invokeID to be checked.
+ * @return True if it is free (done with), False if still pending in the TSM.
+ */
+bool tsm_invoke_id_free_peer(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID)
+{
+    return (tsm_find_invokeID_index(dest, invokeID) >= MAX_TSM_TRANSACTIONS);
 }
 
 /** See if we failed get a confirmation for the message associated
@@ -320,11 +993,24 @@ bool tsm_invoke_id_free(
  */
 bool tsm_invoke_id_failed(
     uint8_t invokeID)
+{
+    return tsm_invoke_id_failed_peer(NULL, invokeID);
+}
+
+/** See if the message with the invoke ID of the device failed.
+ * @param dest [in] The device of a per device invoke ID, or NULL.
+ * @param invokeID [in] The invokeID to be checked.
+ * @return True if already failed, False if done or segmented or still waiting
+ *         for a confirmation.
+ */
+bool tsm_invoke_id_failed_peer(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID)
 {
     bool status = false;
-    uint8_t index;
+    unsigned index;
 
-    index = tsm_find_invokeID_index(invokeID);
+    index = tsm_find_invokeID_index(dest, invokeID);
     if (index < MAX_TSM_TRANSACTIONS) {
         /* a valid invoke ID and the state is IDLE is a
            message that failed to confirm */
@@ -335,6 +1021,443 @@ bool tsm_invoke_id_failed(
     return status;
 }
 
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+static void tsm_send_apdu(
+    BACNET_ADDRESS * dest,
+    uint8_t * apdu,
+    unsigned apdu_len)
+{
+    uint8_t pdu[MAX_NPDU + 8];
+    BACNET_NPDU_DATA npdu_data;
+    BACNET_ADDRESS my_address;
+    int pdu_len = 0;
+
+    datalink_get_my_address(&my_address);
+    npdu_encode_npdu_data(&npdu_data, false, MESSAGE_PRIORITY_NORMAL);
+    pdu_len = npdu_encode_pdu(&pdu[0], dest, &my_address, &npdu_data);
+    memcpy(&pdu[pdu_len], apdu, apdu_len);
+    pdu_len += (int) apdu_len;
+    datalink_send_pdu(dest, &npdu_data, &pdu[0], (unsigned) pdu_len);
+}
+
+static void tsm_send_segment_ack(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID,
+    uint8_t sequence_number,
+    uint8_t actual_window_size,
+    bool negative,
+    bool server)
+{
+    uint8_t apdu[4];
+
+    apdu[0] = PDU_TYPE_SEGMENT_ACK;
+    if (negative)
+        apdu[0] |= BIT1;
+    if (server)
+        apdu[0] |= BIT0;
+    apdu[1] = invokeID;
+    apdu[2] = sequence_number;
+    apdu[3] = actual_window_size;
+    tsm_send_apdu(dest, &apdu[0], sizeof(apdu));
+}
+
+static void tsm_send_abort(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID,
+    uint8_t reason,
+    bool server)
+{
+    uint8_t apdu[3];
+    int apdu_len = 0;
+
+    apdu_len = abort_encode_apdu(&apdu[0], invokeID, reason, server);
+    tsm_send_apdu(dest, &apdu[0], (unsigned) apdu_len);
+}
+
+/* the segmented reply to the request, or NULL */
+static struct tsm_segmented_response *tsm_segmented_response_find(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID)
+{
+    unsigned i = 0;
+
+    for (i = 0; i < MAX_TSM_SEGMENTED_RESPONSES; i++) {
+        if (TSM_Segmented[i].Active && (TSM_Segmented[i].InvokeID == invokeID)
+            && bacnet_address_same(&TSM_Segmented[i].dest, dest)) {
+            return &TSM_Segmented[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void tsm_segmented_response_release(
+    struct tsm_segmented_response *pSegmented)
+{
+    free(pSegmented->service_data);
+    pSegmented->service_data = NULL;
+    pSegmented->Active = false;
+}
+
+static void tsm_send_segment(
+    struct tsm_segmented_response *pSegmented,
+    unsigned sequence_number)
+{
+    uint8_t pdu[MAX_PDU];
+    BACNET_ADDRESS my_address;
+    unsigned offset = sequence_number * pSegmented->segment_size;
+    unsigned len = pSegmented->segment_size;
+    int pdu_len = 0;
+
+    if ((offset + len) > pSegmented->service_data_len) {
+        len = pSegmented->service_data_len - offset;
+    }
+    datalink_get_my_address(&my_address);
+    pdu_len =
+        npdu_encode_pdu(&pdu[0], &pSegmented->dest, &my_address,
+        &pSegmented->npdu_data);
+    pdu[pdu_len] = PDU_TYPE_COMPLEX_ACK | BIT3;
+    if ((sequence_number + 1) < pSegmented->segment_count) {
+        /* more-follows */
+        pdu[pdu_len] |= BIT2;
+    }
+    pdu[pdu_len + 1] = pSegmented->InvokeID;
+    pdu[pdu_len + 2] = (uint8_t) sequence_number;
+    pdu[pdu_len + 3] = MAX_SEGMENT_WINDOW_SIZE;
+    pdu[pdu_len + 4] = pSegmented->ServiceChoice;
+    pdu_len += TSM_SEGMENT_HEADER_LEN;
+    memcpy(&pdu[pdu_len], &pSegmented->service_data[offset], len);
+    pdu_len += (int) len;
+    datalink_send_pdu(&pSegmented->dest, &pSegmented->npdu_data, &pdu[0],
+        (unsigned) pdu_len);
+}
+
+/* sends the segments of the window, and waits for their SegmentACK */
+static void tsm_send_segment_window(
+    struct tsm_segmented_response *pSegmented)
+{
+    unsigned sequence_number = pSegmented->InitialSequenceNumber;
+    unsigned i = 0;
+
+    for (i = 0; (i < pSegmented->ActualWindowSize) &&
+        (sequence_number < pSegmented->segment_count); i++) {
+        tsm_send_segment(pSegmented, sequence_number);
+        sequence_number++;
+    }
+    pSegmented->Deadline = TSM_Clock + apdu_segment_timeout();
+}
+
+static void tsm_segmented_response_timer(
+    void)
+{
+    struct tsm_segmented_response *pSegmented = NULL;
+    unsigned i = 0;
+
+    for (i = 0; i < MAX_TSM_SEGMENTED_RESPONSES; i++) {
+        pSegmented = &TSM_Segmented[i];
+        if (!pSegmented->Active ||
+            ((int32_t) (pSegmented->Deadline - TSM_Clock) > 0)) {
+            continue;
+        }
+        if (pSegmented->SegmentRetryCount < apdu_retries()) {
+            pSegmented->SegmentRetryCount++;
+            tsm_send_segment_window(pSegmented);
+        } else {
+            /* the client is gone */
+            tsm_segmented_response_release(pSegmented);
+        }
+    }
+}
+
+/** The largest ComplexACK APDU the client of the request accepts,
+ * in segments when it accepts them, else in one APDU.
+ * @param service_data [in] The header of the request.
+ * @return The length of the APDU, counting the unsegmented header.
+ */
+unsigned tsm_segmented_response_limit(
+    BACNET_CONFIRMED_SERVICE_DATA * service_data)
+{
+    unsigned max_apdu = MAX_APDU;
+    unsigned max_segs = MAX_SEGMENTS_ACCEPTED;
+
+    if ((service_data->max_resp > 0) &&
+        ((unsigned) service_data->max_resp < max_apdu)) {
+        max_apdu = (unsigned) service_data->max_resp;
+    }
+    /* zero is unspecified */
+    if ((service_data->max_segs > 0) &&
+        ((unsigned) service_data->max_segs < max_segs)) {
+        max_segs = (unsigned) service_data->max_segs;
+    }
+    if (!service_data->segmented_response_accepted || (max_segs < 2)) {
+        return max_apdu;
+    }
+
+    return TSM_COMPLEX_ACK_HEADER_LEN + max_segs * (max_apdu -
+        TSM_SEGMENT_HEADER_LEN);
+}
+
+/** Sends a ComplexACK too big for one APDU in segments, per 5.4.5.
+ * The first segment is sent now, the others as the client asks for
+ * them with its SegmentACKs.
+ * @param dest [in] The client.
+ * @param npdu_data [in] The network layer info for the segments.
+ * @param service_data [in] The header of the request.
+ * @param apdu [in] The whole unsegmented ComplexACK, which is copied.
+ * @param apdu_len [in] Its length, up to tsm_segmented_response_limit().
+ * @return True if it is being sent, false if it is too big, or there
+ *         are too many replies being sent already.
+ */
+bool tsm_segmented_response(
+    BACNET_ADDRESS * dest,
+    BACNET_NPDU_DATA * npdu_data,
+    BACNET_CONFIRMED_SERVICE_DATA * service_data,
+    uint8_t * apdu,
+    unsigned apdu_len)
+{
+    struct tsm_segmented_response *pSegmented = NULL;
+    unsigned segment_size = MAX_APDU;
+    unsigned i = 0;
+
+    if ((apdu_len <= TSM_COMPLEX_ACK_HEADER_LEN) ||
+        (apdu_len > tsm_segmented_response_limit(service_data))) {
+        return false;
+    }
+    /* a retry of the request starts the reply over */
+    pSegmented = tsm_segmented_response_find(dest, service_data->invoke_id);
+    if (pSegmented) {
+        tsm_segmented_response_release(pSegmented);
+    } else {
+        for (i = 0; i < MAX_TSM_SEGMENTED_RESPONSES; i++) {
+            if (!TSM_Segmented[i].Active) {
+                pSegmented = &TSM_Segmented[i];
+                break;
+            }
+        }
+        if (!pSegmented) {
+            return false;
+        }
+    }
+    pSegmented->service_data_len = apdu_len - TSM_COMPLEX_ACK_HEADER_LEN;
+    pSegmented->service_data = malloc(pSegmented->service_data_len);
+    if (!pSegmented->service_data) {
+        return false;
+    }
+    memcpy(pSegmented->service_data, &apdu[TSM_COMPLEX_ACK_HEADER_LEN],
+        pSegmented->service_data_len);
+    if ((unsigned) service_data->max_resp < segment_size) {
+        segment_size = (unsigned) service_data->max_resp;
+    }
+    pSegmented->segment_size = segment_size - TSM_SEGMENT_HEADER_LEN;
+    pSegmented->segment_count =
+        (pSegmented->service_data_len + pSegmented->segment_size -
+        1) / pSegmented->segment_size;
+    bacnet_address_copy(&pSegmented->dest, dest);
+    npdu_copy_data(&pSegmented->npdu_data, npdu_data);
+    pSegmented->InvokeID = service_data->invoke_id;
+    pSegmented->ServiceChoice = apdu[2];
+    pSegmented->InitialSequenceNumber = 0;
+    /* only the first segment, until the client says its window */
+    pSegmented->ActualWindowSize = 1;
+    pSegmented->SegmentRetryCount = 0;
+    pSegmented->Active = true;
+    tsm_send_segment_window(pSegmented);
+
+    return true;
+}
+
+/** Stops sending the reply to a request the client aborted.
+ * @param src [in] The client.
+ * @param invokeID [in] The invoke ID of its request.
+ */
+void tsm_segmented_response_abort(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID)
+{
+    struct tsm_segmented_response *pSegmented = NULL;
+
+    pSegmented = tsm_segmented_response_find(src, invokeID);
+    if (pSegmented) {
+        tsm_segmented_response_release(pSegmented);
+    }
+}
+
+/** Handles a SegmentACK received from the peer.
+ * @param src [in] The peer.
+ * @param invokeID [in] The invoke ID of the transaction.
+ * @param sequence_number [in] The last segment received in order.
+ * @param actual_window_size [in] The window the peer accepts.
+ * @param negative [in] True if a segment was lost.
+ * @param server [in] True if sent by a server, about a segmented request.
+ */
+void tsm_segment_ack_received(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID,
+    uint8_t sequence_number,
+    uint8_t actual_window_size,
+    bool negative,
+    bool server)
+{
+    struct tsm_segmented_response *pSegmented = NULL;
+    uint8_t acked = 0;
+
+    /* our requests are never segmented */
+    if (server) {
+        return;
+    }
+    pSegmented = tsm_segmented_response_find(src, invokeID);
+    if (!pSegmented) {
+        return;
+    }
+    /* the segments of the window it got, 0 if none */
+    acked =
+        (uint8_t) (sequence_number + 1 - pSegmented->InitialSequenceNumber);
+    if ((acked > pSegmented->ActualWindowSize) || ((acked == 0) &&
+            !negative)) {
+        /* a duplicate */
+        pSegmented->Deadline = TSM_Clock + apdu_segment_timeout();
+        return;
+    }
+    if ((pSegmented->InitialSequenceNumber + acked) >=
+        pSegmented->segment_count) {
+        /* the client has it all */
+        tsm_segmented_response_release(pSegmented);
+        return;
+    }
+    pSegmented->InitialSequenceNumber += acked;
+    if (actual_window_size < 1) {
+        actual_window_size = 1;
+    } else if (actual_window_size > MAX_SEGMENT_WINDOW_SIZE) {
+        actual_window_size = MAX_SEGMENT_WINDOW_SIZE;
+    }
+    pSegmented->ActualWindowSize = actual_window_size;
+    pSegmented->SegmentRetryCount = 0;
+    tsm_send_segment_window(pSegmented);
+}
+
+/* the reply will not come: send an Abort and fail the transaction */
+static void tsm_segmented_confirmation_abort(
+    unsigned index,
+    uint8_t reason)
+{
+    BACNET_CONFIRMED_REPLY reply;
+
+    tsm_send_abort(&TSM_List[index].dest, TSM_List[index].InvokeID, reason,
+        false);
+    tsm_heap_remove(index);
+    TSM_List[index].RequestTimer = 0;
+    TSM_List[index].state = TSM_STATE_IDLE;
+    if (TSM_List[index].Completion) {
+        memset(&reply, 0, sizeof(reply));
+        reply.pdu_type = PDU_TYPE_ABORT;
+        reply.reason = reason;
+        tsm_completion_failed(index, &reply);
+    }
+}
+
+/** Puts the segments of a ComplexACK back together, per 5.4.4, and
+ * sends the SegmentACKs.
+ * @param src [in] The server.
+ * @param service_ack_data [in] The header of the segment.
+ * @param service_request [in,out] The service data of the segment, and
+ *        when it was the last one, of the whole reply.
+ * @param service_request_len [in,out] Their length.
+ * @return True when the whole reply has been received, and can be given
+ *         to the handler before the invoke ID is freed.
+ */
+bool tsm_segmented_confirmation(
+    BACNET_ADDRESS * src,
+    BACNET_CONFIRMED_SERVICE_ACK_DATA * service_ack_data,
+    uint8_t ** service_request,
+    uint16_t * service_request_len)
+{
+    BACNET_TSM_DATA *plist = NULL;
+    unsigned index = 0;
+    uint8_t sequence_number = service_ack_data->sequence_number;
+    uint8_t window = service_ack_data->proposed_window_number;
+
+    index = tsm_find_invokeID_index(src, service_ack_data->invoke_id);
+    if (index >= MAX_TSM_TRANSACTIONS) {
+        return false;
+    }
+    plist = &TSM_List[index];
+    if (plist->state == TSM_STATE_AWAIT_CONFIRMATION) {
+        if (sequence_number != 0) {
+            tsm_segmented_confirmation_abort(index,
+                ABORT_REASON_INVALID_APDU_IN_THIS_STATE);
+            return false;
+        }
+        if (!plist->segments) {
+            plist->segments = malloc(MAX_SEGMENTS_ACCEPTED * MAX_APDU);
+        }
+        if (!plist->segments) {
+            tsm_segmented_confirmation_abort(index,
+                ABORT_REASON_BUFFER_OVERFLOW);
+            return false;
+        }
+        plist->segments_len = 0;
+        if (window < 1) {
+            window = 1;
+        } else if (window > MAX_SEGMENT_WINDOW_SIZE) {
+            window = MAX_SEGMENT_WINDOW_SIZE;
+        }
+        plist->ActualWindowSize = window;
+        plist->InitialSequenceNumber = 0;
+        plist->SegmentNak = false;
+        plist->state = TSM_STATE_SEGMENTED_CONFIRMATION;
+    } else if (plist->state == TSM_STATE_SEGMENTED_CONFIRMATION) {
+        if (sequence_number != (uint8_t) (plist->LastSequenceNumber + 1)) {
+            /* one was lost: ask once for the ones after the last in
+               order, the rest of the window is dropped as it comes */
+            if (!plist->SegmentNak &&
+                ((uint8_t) (sequence_number - plist->LastSequenceNumber) <=
+                    plist->ActualWindowSize)) {
+                tsm_send_segment_ack(src, plist->InvokeID,
+                    plist->LastSequenceNumber, plist->ActualWindowSize, true,
+                    false);
+                plist->InitialSequenceNumber = plist->LastSequenceNumber;
+                plist->SegmentNak = true;
+            }
+            return false;
+        }
+        plist->SegmentNak = false;
+    } else {
+        return false;
+    }
+    if ((plist->segments_len + *service_request_len) >
+        (MAX_SEGMENTS_ACCEPTED * MAX_APDU)) {
+        tsm_segmented_confirmation_abort(index, ABORT_REASON_BUFFER_OVERFLOW);
+        return false;
+    }
+    memcpy(&plist->segments[plist->segments_len], *service_request,
+        *service_request_len);
+    plist->segments_len += *service_request_len;
+    plist->LastSequenceNumber = sequence_number;
+    if (!service_ack_data->more_follows) {
+        tsm_send_segment_ack(src, plist->InvokeID, sequence_number,
+            plist->ActualWindowSize, false, false);
+        tsm_heap_remove(index);
+        *service_request = plist->segments;
+        *service_request_len = (uint16_t) plist->segments_len;
+        return true;
+    }
+    if ((sequence_number == 0) ||
+        (sequence_number ==
+            (uint8_t) (plist->InitialSequenceNumber +
+                plist->ActualWindowSize))) {
+        /* the window is full, or the first segment tells our window */
+        tsm_send_segment_ack(src, plist->InvokeID, sequence_number,
+            plist->ActualWindowSize, false, false);
+        plist->InitialSequenceNumber = sequence_number;
+    }
+    /* the server may wait for a SegmentACK of up to a segment timeout */
+    plist->RequestTimer = (uint16_t) ((apdu_segment_timeout() < 0x4000) ?
+        (4 * apdu_segment_timeout()) : 0xFFFF);
+    tsm_heap_schedule(index);
+
+    return false;
+}
+#endif
 
 #ifdef TEST
 #include <assert.h>
@@ -344,6 +1467,12 @@ bool tsm_invoke_id_failed(
 /* flag to send an I-Am */
 bool I_Am_Request = true;
 
+static unsigned Sent_Count = 0;
+/* the PDUs sent, to be read back by the tests */
+#define SENT_QUEUE_SIZE 64
+static uint8_t Sent_PDU[SENT_QUEUE_SIZE][MAX_PDU];
+static unsigned Sent_PDU_Len[SENT_QUEUE_SIZE];
+
 /* dummy function stubs */
 int datalink_send_pdu(
     BACNET_ADDRESS * dest,
@@ -353,12 +1482,21 @@ int datalink_send_pdu(
 {
     (void) dest;
     (void) npdu_data;
-    (void) pdu;
-    (void) pdu_len;
+    if (pdu_len <= MAX_PDU) {
+        memcpy(Sent_PDU[Sent_Count % SENT_QUEUE_SIZE], pdu, pdu_len);
+        Sent_PDU_Len[Sent_Count % SENT_QUEUE_SIZE] = pdu_len;
+    }
+    Sent_Count++;
 
     return 0;
 }
 
+void datalink_get_my_address(
+    BACNET_ADDRESS * my_address)
+{
+    memset(my_address, 0, sizeof(*my_address));
+}
+
 /* dummy function stubs */
 void datalink_get_broadcast_address(
     BACNET_ADDRESS * dest)
@@ -366,11 +1504,486 @@ void datalink_get_broadcast_address(
     (void) dest;
 }
 
+static void set_peer(
+    unsigned index,
+    BACNET_ADDRESS * dest)
+{
+    memset(dest, 0, sizeof(*dest));
+    dest->mac_len = 6;
+    dest->mac[0] = 192;
+    dest->mac[1] = 168;
+    dest->mac[2] = (uint8_t) (index >> 8);
+    dest->mac[3] = (uint8_t) index;
+    dest->mac[4] = 0xBA;
+    dest->mac[5] = 0xC0;
+}
+
 void testTSM(
     Test * pTest)
 {
-    /* FIXME: add some unit testing... */
-    return;
+    uint8_t ids[256] = { 0 };
+    bool used[256] = { false };
+    BACNET_ADDRESS dest;
+    BACNET_NPDU_DATA npdu_data = { 0 };
+    uint8_t apdu[4] = { 0, 5, 1, 12 };
+    unsigned i = 0;
+    unsigned count = 0;
+    unsigned retries = 0;
+
+    set_peer(1, &dest);
+    /* the global IDs are all different, and run out at 255 */
+    for (i = 0; i < 255; i++) {
+        ids[i] = tsm_next_free_invokeID();
+        ct_test(pTest, ids[i] != 0);
+        ct_test(pTest, !used[ids[i]]);
+        used[ids[i]] = true;
+        ct_test(pTest, !tsm_invoke_id_free(ids[i]));
+    }
+    if (MAX_TSM_TRANSACTIONS == 255) {
+        ct_test(pTest, !tsm_transaction_available());
+    }
+    ct_test(pTest, tsm_next_free_invokeID() == 0);
+    tsm_free_invoke_id(ids[7]);
+    ct_test(pTest, tsm_invoke_id_free(ids[7]));
+    ct_test(pTest, tsm_next_free_invokeID() == ids[7]);
+    for (i = 0; i < 255; i++) {
+        tsm_free_invoke_id(ids[i]);
+    }
+    ct_test(pTest, tsm_transaction_available());
+    count = tsm_transaction_idle_count();
+    ct_test(pTest, count == (MAX_TSM_TRANSACTIONS > 255 ? 255 :
+            MAX_TSM_TRANSACTIONS));
+
+    /* the timer retries, then the transaction fails */
+    ct_test(pTest, tsm_timer_remaining() == BACTIMER_IDLE);
+    ids[0] = tsm_next_free_invokeID();
+    ids[1] = tsm_next_free_invokeID();
+    tsm_set_confirmed_unsegmented_transaction(ids[0], &dest, &npdu_data,
+        apdu, sizeof(apdu));
+    tsm_set_confirmed_unsegmented_transaction(ids[1], &dest, &npdu_data,
+        apdu, sizeof(apdu));
+    ct_test(pTest, tsm_timer_remaining() == apdu_timeout());
+    Sent_Count = 0;
+    tsm_timer_milliseconds(apdu_timeout() - 1);
+    ct_test(pTest, Sent_Count == 0);
+    ct_test(pTest, tsm_timer_remaining() == 1);
+    ct_test(pTest, !tsm_invoke_id_failed(ids[0]));
+    /* the reply of the second one comes in time */
+    tsm_free_invoke_id_peer(&dest, ids[1]);
+    ct_test(pTest, tsm_invoke_id_free(ids[1]));
+    for (retries = 0; retries < apdu_retries(); retries++) {
+        tsm_timer_milliseconds(1);
+        ct_test(pTest, Sent_Count == (retries + 1));
+        ct_test(pTest, !tsm_invoke_id_failed(ids[0]));
+        tsm_timer_milliseconds(apdu_timeout() - 1);
+    }
+    tsm_timer_milliseconds(1);
+    ct_test(pTest, Sent_Count == apdu_retries());
+    ct_test(pTest, tsm_invoke_id_failed(ids[0]));
+    ct_test(pTest, !tsm_invoke_id_free(ids[0]));
+    tsm_free_invoke_id(ids[0]);
+    ct_test(pTest, tsm_invoke_id_free(ids[0]));
+    ct_test(pTest, !tsm_invoke_id_failed(ids[0]));
+}
+
+void testTSMPeer(
+    Test * pTest)
+{
+    BACNET_ADDRESS dest[3];
+    BACNET_NPDU_DATA npdu_data = { 0 };
+    uint8_t apdu[4] = { 0, 5, 1, 12 };
+    uint8_t ids[3][256];
+    uint8_t global_id = 0;
+    unsigned i = 0;
+    unsigned peer = 0;
+    unsigned per_peer = (MAX_TSM_TRANSACTIONS - 1) / 3;
+
+    if (per_peer > 200)
+        per_peer = 200;
+    for (peer = 0; peer < 3; peer++) {
+        set_peer(peer + 10, &dest[peer]);
+    }
+    /* a global ID is not used by the peers */
+    global_id = tsm_next_free_invokeID();
+    ct_test(pTest, global_id != 0);
+    /* each device has its own invoke ID space */
+    for (i = 0; i < per_peer; i++) {
+        for (peer = 0; peer < 3; peer++) {
+            ids[peer][i] = tsm_next_free_invokeID_peer(&dest[peer]);
+            ct_test(pTest, ids[peer][i] != 0);
+            ct_test(pTest, ids[peer][i] != global_id);
+            tsm_set_confirmed_unsegmented_transaction(ids[peer][i],
+                &dest[peer], &npdu_data, apdu, sizeof(apdu));
+        }
+    }
+    for (peer = 0; peer < 3; peer++) {
+        for (i = 0; i < per_peer; i++) {
+            ct_test(pTest, !tsm_invoke_id_free_peer(&dest[peer],
+                    ids[peer][i]));
+            ct_test(pTest, !tsm_invoke_id_failed_peer(&dest[peer],
+                    ids[peer][i]));
+        }
+    }
+    /* the replies only free the ID of their device */
+    for (i = 0; i < per_peer; i++) {
+        tsm_free_invoke_id_peer(&dest[0], ids[0][i]);
+        ct_test(pTest, tsm_invoke_id_free_peer(&dest[0], ids[0][i]));
+    }
+    for (i = 0; i < per_peer; i++) {
+        ct_test(pTest, !tsm_invoke_id_free_peer(&dest[1], ids[1][i]));
+        tsm_free_invoke_id_peer(&dest[1], ids[1][i]);
+        tsm_free_invoke_id_peer(&dest[2], ids[2][i]);
+    }
+    tsm_free_invoke_id(global_id);
+    ct_test(pTest, tsm_transaction_idle_count() ==
+        (MAX_TSM_TRANSACTIONS > 255 ? 255 : MAX_TSM_TRANSACTIONS));
+}
+
+/* what the completion of testTSMCompletion was given */
+static unsigned Completed_Count = 0;
+static uint8_t Completed_ID = 0;
+static bool Completed_Timeout = false;
+static uint8_t Completed_Type = 0;
+static void *Completed_Context = NULL;
+static bool Completed_Free = false;
+
+static void completion_handler(
+    BACNET_ADDRESS * src,
+    uint8_t invoke_id,
+    BACNET_CONFIRMED_REPLY * reply,
+    void *context)
+{
+    Completed_Count++;
+    Completed_ID = invoke_id;
+    Completed_Timeout = reply->timeout;
+    Completed_Type = reply->pdu_type;
+    Completed_Context = context;
+    Completed_Free = tsm_invoke_id_free_peer(src, invoke_id);
+}
+
+void testTSMCompletion(
+    Test * pTest)
+{
+    BACNET_ADDRESS dest;
+    BACNET_NPDU_DATA npdu_data = { 0 };
+    BACNET_CONFIRMED_REPLY reply = { 0 };
+    uint8_t apdu[4] = { 0, 5, 1, 12 };
+    uint8_t idle = tsm_transaction_idle_count();
+    uint8_t id = 0;
+    int token = 0;
+    unsigned retries = 0;
+
+    set_peer(20, &dest);
+    /* the reply goes to the completion, once */
+    id = tsm_next_free_invokeID_peer(&dest);
+    tsm_set_confirmed_unsegmented_transaction(id, &dest, &npdu_data, apdu,
+        sizeof(apdu));
+    ct_test(pTest, tsm_set_completion(&dest, id, completion_handler, &token));
+    reply.pdu_type = PDU_TYPE_COMPLEX_ACK;
+    ct_test(pTest, tsm_complete(&dest, id, &reply));
+    ct_test(pTest, Completed_Count == 1);
+    ct_test(pTest, Completed_ID == id);
+    ct_test(pTest, !Completed_Timeout);
+    ct_test(pTest, Completed_Type == PDU_TYPE_COMPLEX_ACK);
+    ct_test(pTest, Completed_Context == &token);
+    ct_test(pTest, !Completed_Free);
+    ct_test(pTest, tsm_invoke_id_free_peer(&dest, id));
+    ct_test(pTest, !tsm_complete(&dest, id, &reply));
+    ct_test(pTest, Completed_Count == 1);
+    /* without one, the reply is left to the global handlers */
+    id = tsm_next_free_invokeID_peer(&dest);
+    tsm_set_confirmed_unsegmented_transaction(id, &dest, &npdu_data, apdu,
+        sizeof(apdu));
+    ct_test(pTest, !tsm_complete(&dest, id, &reply));
+    ct_test(pTest, !tsm_invoke_id_free_peer(&dest, id));
+    tsm_free_invoke_id_peer(&dest, id);
+    ct_test(pTest, !tsm_set_completion(&dest, id, completion_handler, NULL));
+    /* and so is the timeout, with the invoke ID already free */
+    id = tsm_next_free_invokeID_peer(&dest);
+    tsm_set_confirmed_unsegmented_transaction(id, &dest, &npdu_data, apdu,
+        sizeof(apdu));
+    tsm_set_completion(&dest, id, completion_handler, &token);
+    for (retries = 0; retries <= apdu_retries(); retries++) {
+        ct_test(pTest, Completed_Count == 1);
+        tsm_timer_milliseconds(apdu_timeout());
+    }
+    ct_test(pTest, Completed_Count == 2);
+    ct_test(pTest, Completed_ID == id);
+    ct_test(pTest, Completed_Timeout);
+    ct_test(pTest, Completed_Context == &token);
+    ct_test(pTest, Completed_Free);
+    ct_test(pTest, !tsm_invoke_id_failed_peer(&dest, id));
+    ct_test(pTest, tsm_transaction_idle_count() == idle);
+}
+
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+/* the APDU of a PDU sent, and its length */
+static uint8_t *sent_apdu(
+    unsigned index,
+    unsigned *apdu_len)
+{
+    BACNET_NPDU_DATA npdu_data;
+    uint8_t *pdu = Sent_PDU[index % SENT_QUEUE_SIZE];
+    int npdu_len = npdu_decode(pdu, NULL, NULL, &npdu_data);
+
+    *apdu_len = Sent_PDU_Len[index % SENT_QUEUE_SIZE] - (unsigned) npdu_len;
+    return &pdu[npdu_len];
+}
+
+/* Sends a reply in segments and gives each PDU sent to the other side, */
+/* the server and the client are both this TSM. Drops the segment with */
+/* the sequence number lost the first time it is sent. Returns true when */
+/* the client has the whole reply, which it copies to reply. */
+static bool loop_segments(
+    BACNET_ADDRESS * peer,
+    unsigned first,
+    int lost,
+    uint8_t * reply,
+    unsigned *reply_len)
+{
+    BACNET_CONFIRMED_SERVICE_ACK_DATA ack;
+    uint8_t *apdu = NULL;
+    uint8_t *service_request = NULL;
+    uint16_t service_request_len = 0;
+    unsigned apdu_len = 0;
+    unsigned next = first;
+    bool done = false;
+
+    while (next < Sent_Count) {
+        apdu = sent_apdu(next++, &apdu_len);
+        if ((apdu[0] & 0xF0) == PDU_TYPE_SEGMENT_ACK) {
+            tsm_segment_ack_received(peer, apdu[1], apdu[2], apdu[3],
+                (apdu[0] & BIT1) ? true : false,
+                (apdu[0] & BIT0) ? true : false);
+        } else if ((apdu[0] & 0xF0) == PDU_TYPE_COMPLEX_ACK) {
+            if ((int) apdu[2] == lost) {
+                lost = -1;
+                continue;
+            }
+            ack.segmented_message = (apdu[0] & BIT3) ? true : false;
+            ack.more_follows = (apdu[0] & BIT2) ? true : false;
+            ack.invoke_id = apdu[1];
+            ack.sequence_number = apdu[2];
+            ack.proposed_window_number = apdu[3];
+            service_request = &apdu[5];
+            service_request_len = (uint16_t) (apdu_len - 5);
+            if (tsm_segmented_confirmation(peer, &ack, &service_request,
+                    &service_request_len)) {
+                memcpy(reply, service_request, service_request_len);
+                *reply_len = service_request_len;
+                done = true;
+            }
+        }
+    }
+
+    return done;
+}
+
+void testTSMSegmentation(
+    Test * pTest)
+{
+    static uint8_t apdu[3000];
+    static uint8_t reply[MAX_SEGMENTS_ACCEPTED * MAX_APDU];
+    BACNET_CONFIRMED_SERVICE_DATA service_data = { 0 };
+    BACNET_NPDU_DATA npdu_data = { 0 };
+    BACNET_ADDRESS peer;
+    unsigned reply_len = 0;
+    unsigned first = 0;
+    unsigned i = 0;
+    unsigned count = 0;
+    uint8_t id = 0;
+
+    set_peer(42, &peer);
+    apdu[0] = PDU_TYPE_COMPLEX_ACK;
+    apdu[2] = SERVICE_CONFIRMED_READ_PROP_MULTIPLE;
+    for (i = 3; i < sizeof(apdu); i++) {
+        apdu[i] = (uint8_t) (i * 7);
+    }
+    service_data.max_resp = 206;
+    service_data.max_segs = 16;
+    /* the client has to accept segments */
+    ct_test(pTest, tsm_segmented_response_limit(&service_data) == 206);
+    ct_test(pTest, !tsm_segmented_response(&peer, &npdu_data,
+            &service_data, apdu, sizeof(apdu)));
+    service_data.segmented_response_accepted = true;
+    ct_test(pTest,
+        tsm_segmented_response_limit(&service_data) == (3 + 16 * 201));
+    service_data.max_segs = 8;
+    ct_test(pTest, !tsm_segmented_response(&peer, &npdu_data,
+            &service_data, apdu, sizeof(apdu)));
+    service_data.max_segs = 0;
+
+    /* the whole reply gets across, in 15 segments of 201 octets */
+    for (count = 0; count < 2; count++) {
+        id = tsm_next_free_invokeID_peer(&peer);
+        tsm_set_confirmed_unsegmented_transaction(id, &peer, &npdu_data,
+            apdu, 4);
+        service_data.invoke_id = id;
+        first = Sent_Count;
+        ct_test(pTest, tsm_segmented_response(&peer, &npdu_data,
+                &service_data, apdu, sizeof(apdu)));
+        /* only the first segment, until the window is known */
+        ct_test(pTest, Sent_Count == (first + 1));
+        reply_len = 0;
+        /* the second time a segment is lost, and sent again */
+        ct_test(pTest, loop_segments(&peer, first, count ? 7 : -1, reply,
+                &reply_len));
+        ct_test(pTest, reply_len == (sizeof(apdu) - 3));
+        ct_test(pTest, memcmp(reply, &apdu[3], sizeof(apdu) - 3) == 0);
+        tsm_free_invoke_id_peer(&peer, id);
+    }
+    /* the server is done, nothing more is sent */
+    first = Sent_Count;
+    for (i = 0; i <= apdu_retries(); i++) {
+        tsm_timer_milliseconds(apdu_segment_timeout());
+    }
+    ct_test(pTest, Sent_Count == first);
+
+    /* without SegmentACKs the window is sent again, then given up */
+    service_data.invoke_id = 99;
+    first = Sent_Count;
+    ct_test(pTest, tsm_segmented_response(&peer, &npdu_data, &service_data,
+            apdu, sizeof(apdu)));
+    for (i = 0; i <= apdu_retries(); i++) {
+        tsm_timer_milliseconds(apdu_segment_timeout());
+    }
+    ct_test(pTest, Sent_Count == (first + 1 + apdu_retries()));
+    /* an abort from the client stops it early */
+    ct_test(pTest, tsm_segmented_response(&peer, &npdu_data, &service_data,
+            apdu, sizeof(apdu)));
+    tsm_segmented_response_abort(&peer, 99);
+    first = Sent_Count;
+    tsm_timer_milliseconds(apdu_segment_timeout());
+    ct_test(pTest, Sent_Count == first);
+}
+#endif
+
+#if defined(BACNET_CONTEXT_ENABLED)
+#if defined(TEST_TSM)
+/* the address cache is not part of this test */
+void *address_state_create(
+    void)
+{
+    static int state;
+
+    return &state;
+}
+
+void address_state_destroy(
+    void *state)
+{
+    (void) state;
+}
+#endif
+
+void testTSMContext(
+    Test * pTest)
+{
+    BACNET_CONTEXT *ctx[2];
+    BACNET_ADDRESS dest;
+    BACNET_NPDU_DATA npdu_data = { 0 };
+    uint8_t apdu[4] = { 0, 5, 1, 12 };
+    uint8_t id[2];
+    uint8_t default_id = 0;
+    unsigned default_idle = 0;
+    unsigned idle = MAX_TSM_TRANSACTIONS > 255 ? 255 : MAX_TSM_TRANSACTIONS;
+    unsigned i = 0;
+
+    set_peer(1, &dest);
+    default_id = tsm_next_free_invokeID();
+    ct_test(pTest, default_id != 0);
+    default_idle = tsm_transaction_idle_count();
+    for (i = 0; i < 2; i++) {
+        ctx[i] = bacnet_context_create();
+        ct_test(pTest, ctx[i] != NULL);
+    }
+    /* each context has its own transactions and invoke IDs */
+    for (i = 0; i < 2; i++) {
+        bacnet_context_enter(ctx[i]);
+        ct_test(pTest, bacnet_context_current() == ctx[i]);
+        ct_test(pTest, tsm_transaction_idle_count() == idle);
+        ct_test(pTest, tsm_invoke_id_free(default_id));
+        id[i] = tsm_next_free_invokeID();
+        ct_test(pTest, id[i] == 1);
+        tsm_set_confirmed_unsegmented_transaction(id[i], &dest, &npdu_data,
+            apdu, sizeof(apdu));
+        bacnet_context_leave(ctx[i]);
+    }
+    ct_test(pTest, bacnet_context_current() == NULL);
+    ct_test(pTest, !tsm_invoke_id_free(default_id));
+    ct_test(pTest, tsm_transaction_idle_count() == default_idle);
+    /* the timer only runs the transactions of the entered context */
+    bacnet_context_enter(ctx[0]);
+    /* enter and leave nest */
+    bacnet_context_enter(ctx[0]);
+    bacnet_context_leave(ctx[0]);
+    ct_test(pTest, bacnet_context_current() == ctx[0]);
+    for (i = 0; i <= apdu_retries(); i++) {
+        tsm_timer_milliseconds(apdu_timeout());
+    }
+    ct_test(pTest, tsm_invoke_id_failed(id[0]));
+    bacnet_context_leave(ctx[0]);
+    bacnet_context_enter(ctx[1]);
+    ct_test(pTest, !tsm_invoke_id_failed(id[1]));
+    ct_test(pTest, !tsm_invoke_id_free(id[1]));
+    tsm_free_invoke_id(id[1]);
+    ct_test(pTest, tsm_transaction_idle_count() == idle);
+    bacnet_context_leave(ctx[1]);
+    for (i = 0; i < 2; i++) {
+        bacnet_context_destroy(ctx[i]);
+    }
+    tsm_free_invoke_id(default_id);
+    ct_test(pTest, tsm_transaction_idle_count() == idle);
+}
+#endif
+
+void testTSMAdaptive(
+    Test * pTest)
+{
+    BACNET_ADDRESS dest;
+    BACNET_NPDU_DATA npdu_data = { 0 };
+    uint8_t apdu[4] = { 0, 5, 1, 12 };
+    uint8_t id = 0;
+
+    set_peer(7, &dest);
+    tsm_adaptive_timeout_set(true);
+    ct_test(pTest, tsm_peer_timeout(&dest) == apdu_timeout());
+    /* a fast device gets the least timeout */
+    id = tsm_next_free_invokeID_peer(&dest);
+    tsm_set_confirmed_unsegmented_transaction(id, &dest, &npdu_data, apdu,
+        sizeof(apdu));
+    tsm_timer_milliseconds(20);
+    tsm_reply_received(&dest, id);
+    tsm_free_invoke_id_peer(&dest, id);
+    ct_test(pTest, tsm_peer_timeout(&dest) == TSM_MIN_TIMEOUT);
+    /* srtt 28 = 20 + (90 - 20) / 8, rttvar 100 / 4 */
+    id = tsm_next_free_invokeID_peer(&dest);
+    tsm_set_confirmed_unsegmented_transaction(id, &dest, &npdu_data, apdu,
+        sizeof(apdu));
+    tsm_timer_milliseconds(90);
+    tsm_reply_received(&dest, id);
+    tsm_free_invoke_id_peer(&dest, id);
+    ct_test(pTest, tsm_peer_timeout(&dest) == 128);
+    /* the retries back off, and the device keeps the timeout */
+    id = tsm_next_free_invokeID_peer(&dest);
+    tsm_set_confirmed_unsegmented_transaction(id, &dest, &npdu_data, apdu,
+        sizeof(apdu));
+    Sent_Count = 0;
+    tsm_timer_milliseconds(127);
+    ct_test(pTest, Sent_Count == 0);
+    tsm_timer_milliseconds(1);
+    ct_test(pTest, Sent_Count == 1);
+    ct_test(pTest, tsm_peer_timeout(&dest) == 256);
+    tsm_timer_milliseconds(255);
+    ct_test(pTest, Sent_Count == 1);
+    tsm_timer_milliseconds(1);
+    ct_test(pTest, Sent_Count == 2);
+    /* the reply to a retry is not measured */
+    tsm_reply_received(&dest, id);
+    tsm_free_invoke_id_peer(&dest, id);
+    ct_test(pTest, tsm_peer_timeout(&dest) == 512);
+    tsm_adaptive_timeout_set(false);
+    ct_test(pTest, tsm_peer_timeout(&dest) == apdu_timeout());
 }
 
 #ifdef TEST_TSM
@@ -384,6 +1997,20 @@ int main(
     /* individual tests */
     rc = ct_addTestFunction(pTest, testTSM);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testTSMPeer);
+    assert(rc);
+    rc = ct_addTestFunction(pTest, testTSMCompletion);
+    assert(rc);
+    rc = ct_addTestFunction(pTest, testTSMAdaptive);
+    assert(rc);
+#if (MAX_SEGMENTS_ACCEPTED > 1)
+    rc = ct_addTestFunction(pTest, testTSMSegmentation);
+    assert(rc);
+#endif
+#if defined(BACNET_CONTEXT_ENABLED)
+    rc = ct_addTestFunction(pTest, testTSMContext);
+    assert(rc);
+#endif
 
     ct_setStream(pTest, stdout);
     ct_run(pTest);
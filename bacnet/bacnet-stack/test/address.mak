@@ -2,7 +2,7 @@
 CC      = gcc
 SRC_DIR = ../src
 INCLUDES = -I../include -I.
-DEFINES = -DBIG_ENDIAN=0 -DTEST -DTEST_ADDRESS
+DEFINES = -DBIG_ENDIAN=0 -DTEST -DTEST_ADDRESS -DMAX_ADDRESS_CACHE_LIMIT=1024
 
 CFLAGS  = -Wall $(INCLUDES) $(DEFINES) -g
 
@@ -13,6 +13,7 @@ SRCS = $(SRC_DIR)/address.c \
 	$(SRC_DIR)/bacstr.c \
 	$(SRC_DIR)/bacreal.c \
 	$(SRC_DIR)/bacapp.c \
+	$(SRC_DIR)/bacdevobjpropref.c \
 	$(SRC_DIR)/datetime.c \
 	$(SRC_DIR)/bactext.c \
 	$(SRC_DIR)/indtext.c \
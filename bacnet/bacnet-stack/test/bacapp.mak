@@ -13,6 +13,7 @@ SRCS = $(SRC_DIR)/bacdcode.c \
 	$(SRC_DIR)/bacstr.c \
 	$(SRC_DIR)/bacreal.c \
 	$(SRC_DIR)/bacapp.c \
+	$(SRC_DIR)/bacdevobjpropref.c \
 	$(SRC_DIR)/datetime.c \
 	$(SRC_DIR)/bactext.c \
 	$(SRC_DIR)/indtext.c \
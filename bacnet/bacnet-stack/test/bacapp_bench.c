@@ -0,0 +1,260 @@
+/*####COPYRIGHTBEGIN####
+ -------------------------------------------
+ Copyright (C) 2017 Steve Karg
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to:
+ The Free Software Foundation, Inc.
+ 59 Temple Place - Suite 330
+ Boston, MA  02111-1307, USA.
+
+ As a special exception, if other files instantiate templates or
+ use macros or inline functions from this file, or you compile
+ this file and link it with other works to produce a work based
+ on this file, this file does not by itself cause the resulting
+ work to be covered by the GNU General Public License. However
+ the source code for this file must still be made available in
+ accordance with section (3) of the GNU General Public License.
+
+ This exception does not invalidate any other reasons why a work
+ based on this file might be covered by the GNU General Public
+ License.
+ -------------------------------------------
+####COPYRIGHTEND####*/
+
+/* Throughput of the decoding of the application tagged values of an ack:
+   one tag at a time as before, with the fixed size fast path of
+   bacapp_decode_application_data(), and as runs of the same encoding.
+   Usage: bacapp_bench [rounds] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bacdef.h"
+#include "bacdcode.h"
+#include "bacapp.h"
+
+/* the values of a full ack of a 1476 octet APDU */
+#define BENCH_VALUES 280
+
+static double elapsed_ms(
+    struct timespec *start,
+    struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 +
+        (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/* how the values were decoded before the fast path */
+static int decode_tag_by_tag(
+    uint8_t * apdu,
+    BACNET_APPLICATION_DATA_VALUE * value)
+{
+    uint8_t tag_number = 0;
+    uint32_t len_value_type = 0;
+    int len = 0;
+
+    len = decode_tag_number_and_value(apdu, &tag_number, &len_value_type);
+    value->tag = tag_number;
+    value->context_specific = false;
+    len += bacapp_decode_data(&apdu[len], tag_number, len_value_type, value);
+    value->next = NULL;
+
+    return len;
+}
+
+/* the values of the benchmark are the same */
+static bool same_value(
+    BACNET_APPLICATION_DATA_VALUE * a,
+    BACNET_APPLICATION_DATA_VALUE * b)
+{
+    if (a->tag != b->tag || a->context_specific != b->context_specific) {
+        return false;
+    }
+    switch (a->tag) {
+        case BACNET_APPLICATION_TAG_NULL:
+            return true;
+        case BACNET_APPLICATION_TAG_BOOLEAN:
+            return a->type.Boolean == b->type.Boolean;
+        case BACNET_APPLICATION_TAG_UNSIGNED_INT:
+            return a->type.Unsigned_Int == b->type.Unsigned_Int;
+        case BACNET_APPLICATION_TAG_REAL:
+            return a->type.Real == b->type.Real;
+        case BACNET_APPLICATION_TAG_ENUMERATED:
+            return a->type.Enumerated == b->type.Enumerated;
+        default:
+            return false;
+    }
+}
+
+static int decode_one_by_one(
+    uint8_t * apdu,
+    int apdu_len,
+    BACNET_APPLICATION_DATA_VALUE * values)
+{
+    int len = 0;
+    int i = 0;
+
+    while (len < apdu_len) {
+        len +=
+            bacapp_decode_application_data(&apdu[len], apdu_len - len,
+            &values[i++]);
+    }
+
+    return i;
+}
+
+static int decode_runs(
+    uint8_t * apdu,
+    int apdu_len,
+    BACNET_APPLICATION_DATA_VALUE * values)
+{
+    int len = 0;
+    int first = 0;
+    int i = 0;
+    unsigned run = 0;
+
+    while (len < apdu_len) {
+        first = len;
+        len +=
+            bacapp_decode_application_data(&apdu[len], apdu_len - len,
+            &values[i++]);
+        /* the rest of the array encoded like the first element */
+        if ((len < apdu_len) && (apdu[len] == apdu[first])) {
+            run = bacapp_application_run_count(&apdu[len], apdu_len - len);
+            len += bacapp_decode_application_run(&apdu[len], run, &values[i]);
+            i += run;
+        }
+    }
+
+    return i;
+}
+
+static int decode_old(
+    uint8_t * apdu,
+    int apdu_len,
+    BACNET_APPLICATION_DATA_VALUE * values)
+{
+    int len = 0;
+    int i = 0;
+
+    while (len < apdu_len) {
+        len += decode_tag_by_tag(&apdu[len], &values[i++]);
+    }
+
+    return i;
+}
+
+static void run_bench(
+    const char *name,
+    uint8_t * apdu,
+    int apdu_len,
+    int count,
+    long rounds)
+{
+    static BACNET_APPLICATION_DATA_VALUE expected[BENCH_VALUES];
+    static BACNET_APPLICATION_DATA_VALUE values[BENCH_VALUES];
+    int (*decoders[3]) (uint8_t *, int, BACNET_APPLICATION_DATA_VALUE *) = {
+    decode_old, decode_one_by_one, decode_runs};
+    const char *labels[3] = { "tag by tag", "fast path", "runs" };
+    struct timespec t0, t1;
+    double ms = 0;
+    long r = 0;
+    int d = 0;
+    int i = 0;
+
+    decode_old(apdu, apdu_len, expected);
+    for (d = 0; d < 3; d++) {
+        memset(values, 0, sizeof(values));
+        if (decoders[d] (apdu, apdu_len, values) != count) {
+            printf("ERROR: %s %s decoded the wrong number of values\n", name,
+                labels[d]);
+            exit(1);
+        }
+        for (i = 0; i < count; i++) {
+            if (!same_value(&expected[i], &values[i])) {
+                printf("ERROR: %s %s value %d differs\n", name, labels[d], i);
+                exit(1);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (r = 0; r < rounds; r++) {
+            decoders[d] (apdu, apdu_len, values);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ms = elapsed_ms(&t0, &t1);
+        printf("%-22s %-10s %6.1f Mvalues/s, %5.2f ns/value\n", name,
+            labels[d], count * (double) rounds / ms / 1000.0,
+            ms * 1000000.0 / ((double) count * rounds));
+    }
+}
+
+int main(
+    int argc,
+    char *argv[])
+{
+    static uint8_t apdu[MAX_APDU * 4];
+    long rounds = argc > 1 ? atol(argv[1]) : 20000;
+    int apdu_len = 0;
+    int i = 0;
+
+    /* present values of a log, all REALs */
+    for (i = 0; i < BENCH_VALUES; i++) {
+        apdu_len += encode_application_real(&apdu[apdu_len], 20.0f + i / 8.0f);
+    }
+    run_bench("REAL array", apdu, apdu_len, BENCH_VALUES, rounds);
+
+    /* counters of one size */
+    apdu_len = 0;
+    for (i = 0; i < BENCH_VALUES; i++) {
+        apdu_len += encode_application_unsigned(&apdu[apdu_len], 1000 + i);
+    }
+    run_bench("Unsigned array", apdu, apdu_len, BENCH_VALUES, rounds);
+
+    /* priority arrays, mostly NULL */
+    apdu_len = 0;
+    for (i = 0; i < BENCH_VALUES; i++) {
+        if ((i % 16) == 7 || (i % 16) == 15) {
+            apdu_len += encode_application_real(&apdu[apdu_len], 21.5f);
+        } else {
+            apdu_len += encode_application_null(&apdu[apdu_len]);
+        }
+    }
+    run_bench("priority arrays", apdu, apdu_len, BENCH_VALUES, rounds);
+
+    /* the mix of a ReadPropertyMultiple of several objects */
+    apdu_len = 0;
+    for (i = 0; i < BENCH_VALUES; i++) {
+        switch (i % 4) {
+            case 0:
+                apdu_len +=
+                    encode_application_real(&apdu[apdu_len], i * 0.5f);
+                break;
+            case 1:
+                apdu_len +=
+                    encode_application_enumerated(&apdu[apdu_len], i % 3);
+                break;
+            case 2:
+                apdu_len +=
+                    encode_application_boolean(&apdu[apdu_len], i & 1);
+                break;
+            default:
+                apdu_len += encode_application_unsigned(&apdu[apdu_len], i);
+                break;
+        }
+    }
+    run_bench("mixed", apdu, apdu_len, BENCH_VALUES, rounds);
+
+    return 0;
+}
@@ -0,0 +1,34 @@
+#Makefile to build the decoding benchmark
+CC      = gcc
+
+SRC_DIR = ../src
+INCLUDES = -I../include -I.
+DEFINES = -DBIG_ENDIAN=0 -DBACAPP_ALL -DPRINT_ENABLED=1
+
+CFLAGS  = -Wall -O2 $(INCLUDES) $(DEFINES)
+
+SRCS = $(SRC_DIR)/bacdcode.c \
+	$(SRC_DIR)/bacint.c \
+	$(SRC_DIR)/bacstr.c \
+	$(SRC_DIR)/bacreal.c \
+	$(SRC_DIR)/bacapp.c \
+	$(SRC_DIR)/bacdevobjpropref.c \
+	$(SRC_DIR)/datetime.c \
+	$(SRC_DIR)/bactext.c \
+	$(SRC_DIR)/indtext.c \
+	bacapp_bench.c
+
+OBJS = ${SRCS:.c=.o}
+
+TARGET = bacapp_bench
+
+all: ${TARGET}
+
+${TARGET}: ${OBJS}
+	${CC} -o $@ ${OBJS}
+
+.c.o:
+	${CC} -c ${CFLAGS} $*.c -o $@
+
+clean:
+	rm -rf ${OBJS} ${TARGET}
@@ -2,7 +2,8 @@
 CC      = gcc
 SRC_DIR = ../src
 INCLUDES = -I../include -I. -I../ports/linux
-DEFINES = -DBACDL_BIP -DBIG_ENDIAN=0 -DTEST -DTEST_BVLC
+DEFINES = -DBACDL_BIP -DBIG_ENDIAN=0 -DTEST -DTEST_BVLC \
+	-DBBMD_ENABLED=1 -DMAX_FD_ENTRIES=300
 
 CFLAGS  = -Wall $(INCLUDES) $(DEFINES) -g
 
@@ -11,6 +12,8 @@ SRCS = $(SRC_DIR)/bacdcode.c \
 	$(SRC_DIR)/bacstr.c \
 	$(SRC_DIR)/bacreal.c \
 	$(SRC_DIR)/bvlc.c \
+	$(SRC_DIR)/bip.c \
+	$(SRC_DIR)/debug.c \
 	ctest.c
 
 OBJS = ${SRCS:.c=.o}
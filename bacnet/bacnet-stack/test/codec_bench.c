@@ -0,0 +1,665 @@
+/*####COPYRIGHTBEGIN####
+ -------------------------------------------
+ Copyright (C) 2017 Steve Karg
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to:
+ The Free Software Foundation, Inc.
+ 59 Temple Place - Suite 330
+ Boston, MA  02111-1307, USA.
+
+ As a special exception, if other files instantiate templates or
+ use macros or inline functions from this file, or you compile
+ this file and link it with other works to produce a work based
+ on this file, this file does not by itself cause the resulting
+ work to be covered by the GNU General Public License. However
+ the source code for this file must still be made available in
+ accordance with section (3) of the GNU General Public License.
+
+ This exception does not invalidate any other reasons why a work
+ based on this file might be covered by the GNU General Public
+ License.
+ -------------------------------------------
+####COPYRIGHTEND####*/
+
+/* The cost of the encoding and the decoding of representative APDUs, in
+   ns and heap allocations per operation: ReadPropertyMultiple requests and
+   acks of 1 to 200 properties, COV notifications, ReadRange responses of
+   trend log records and I-Am.  The results can be written as JSON, and
+   compared against a baseline written before, which fails the run if a
+   case got slower than the tolerance or allocates more.
+   Usage: codec_bench [--json file] [--baseline file] [--tolerance percent] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bacdef.h"
+#include "bacdcode.h"
+#include "bacapp.h"
+#include "bacstr.h"
+#include "rpm.h"
+#include "cov.h"
+#include "readrange.h"
+#include "iam.h"
+#include "handlers.h"
+
+/* the room for an ack of 200 properties, larger than any MAX_APDU,
+   a real one would be segmented */
+#define BENCH_APDU_SIZE 8192
+/* every run of a case takes at least this long, and the fastest of
+   the runs is reported, the others were disturbed by something else */
+#define BENCH_MIN_NS 50000000.0
+#define BENCH_RUNS 5
+#define BENCH_MAX_CASES 64
+#define BENCH_NAME_LEN 64
+/* properties of an object in the requests */
+#define BENCH_OBJECT_PROPERTIES 10
+#define BENCH_COV_VALUES 2
+#define BENCH_TREND_RECORDS 50
+
+typedef struct bench_result {
+    char name[BENCH_NAME_LEN];
+    double ns_per_op;
+    double allocs_per_op;
+} BENCH_RESULT;
+
+static BENCH_RESULT Results[BENCH_MAX_CASES];
+static int Result_Count;
+
+/* the heap allocations, counted by wrapping the allocator of glibc */
+static unsigned long Allocations;
+#if defined(__GLIBC__)
+extern void *__libc_malloc(
+    size_t size);
+extern void *__libc_calloc(
+    size_t count,
+    size_t size);
+extern void *__libc_realloc(
+    void *ptr,
+    size_t size);
+
+void *malloc(
+    size_t size)
+{
+    Allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(
+    size_t count,
+    size_t size)
+{
+    Allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(
+    void *ptr,
+    size_t size)
+{
+    Allocations++;
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+static uint8_t Apdu[BENCH_APDU_SIZE];
+static int Apdu_Len;
+static uint8_t Work[BENCH_APDU_SIZE];
+/* the operations write here, so that they are not optimized away */
+static volatile int Sink;
+
+static const BACNET_PROPERTY_ID Properties[BENCH_OBJECT_PROPERTIES] = {
+    PROP_PRESENT_VALUE, PROP_STATUS_FLAGS, PROP_OBJECT_NAME, PROP_UNITS,
+    PROP_DESCRIPTION, PROP_RELIABILITY, PROP_OUT_OF_SERVICE,
+    PROP_EVENT_STATE, PROP_COV_INCREMENT, PROP_PRIORITY_ARRAY
+};
+
+static double now_ns(
+    void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000.0 + ts.tv_nsec;
+}
+
+/* time op(n) until it took BENCH_MIN_NS, doubling the rounds, then
+   time as many rounds BENCH_RUNS times */
+static void run_case(
+    const char *name,
+    unsigned n,
+    void (*op) (unsigned))
+{
+    BENCH_RESULT *result = &Results[Result_Count];
+    unsigned long rounds = 64;
+    unsigned long r = 0;
+    unsigned long allocations = 0;
+    double start = 0;
+    double ns = 0;
+    double best = 0;
+    int run = 0;
+
+    for (;;) {
+        allocations = Allocations;
+        start = now_ns();
+        for (r = 0; r < rounds; r++) {
+            op(n);
+        }
+        ns = now_ns() - start;
+        if (ns >= BENCH_MIN_NS) {
+            break;
+        }
+        rounds *= 2;
+    }
+    best = ns;
+    for (run = 1; run < BENCH_RUNS; run++) {
+        start = now_ns();
+        for (r = 0; r < rounds; r++) {
+            op(n);
+        }
+        ns = now_ns() - start;
+        if (ns < best) {
+            best = ns;
+        }
+    }
+    if (Result_Count < BENCH_MAX_CASES) {
+        if (n) {
+            snprintf(result->name, BENCH_NAME_LEN, "%s/%u", name, n);
+        } else {
+            snprintf(result->name, BENCH_NAME_LEN, "%s", name);
+        }
+        result->ns_per_op = best / rounds;
+        result->allocs_per_op = (double) (Allocations - allocations) / rounds;
+        printf("%-28s %10.1f ns/op %8.2f allocs/op\n", result->name,
+            result->ns_per_op, result->allocs_per_op);
+        Result_Count++;
+    }
+}
+
+/* a request for n properties of objects of BENCH_OBJECT_PROPERTIES each */
+static int encode_rpm_request(
+    uint8_t * apdu,
+    unsigned n)
+{
+    int len = 0;
+    unsigned i = 0;
+
+    len = rpm_encode_apdu_init(apdu, 1);
+    for (i = 0; i < n; i++) {
+        if ((i % BENCH_OBJECT_PROPERTIES) == 0) {
+            if (i) {
+                len += rpm_encode_apdu_object_end(&apdu[len]);
+            }
+            len +=
+                rpm_encode_apdu_object_begin(&apdu[len], OBJECT_ANALOG_INPUT,
+                i / BENCH_OBJECT_PROPERTIES);
+        }
+        len +=
+            rpm_encode_apdu_object_property(&apdu[len],
+            Properties[i % BENCH_OBJECT_PROPERTIES], BACNET_ARRAY_ALL);
+    }
+    len += rpm_encode_apdu_object_end(&apdu[len]);
+
+    return len;
+}
+
+static void op_rpm_request_encode(
+    unsigned n)
+{
+    Sink = encode_rpm_request(Work, n);
+}
+
+static void op_rpm_request_decode(
+    unsigned n)
+{
+    BACNET_RPM_DATA data;
+    int len = 4;        /* the header of the confirmed request */
+    int properties = 0;
+
+    (void) n;
+    while (len < Apdu_Len) {
+        len += rpm_decode_object_id(&Apdu[len], Apdu_Len - len, &data);
+        while (!rpm_decode_object_end(&Apdu[len], Apdu_Len - len)) {
+            len +=
+                rpm_decode_object_property(&Apdu[len], Apdu_Len - len, &data);
+            properties++;
+        }
+        len++;
+    }
+    Sink = properties;
+}
+
+/* an ack of n properties, every value a REAL */
+static int encode_rpm_ack(
+    uint8_t * apdu,
+    unsigned n)
+{
+    BACNET_RPM_DATA data;
+    uint8_t value[8];
+    int value_len = 0;
+    int len = 0;
+    unsigned i = 0;
+
+    len = rpm_ack_encode_apdu_init(apdu, 1);
+    for (i = 0; i < n; i++) {
+        if ((i % BENCH_OBJECT_PROPERTIES) == 0) {
+            if (i) {
+                len += rpm_ack_encode_apdu_object_end(&apdu[len]);
+            }
+            data.object_type = OBJECT_ANALOG_INPUT;
+            data.object_instance = i / BENCH_OBJECT_PROPERTIES;
+            len += rpm_ack_encode_apdu_object_begin(&apdu[len], &data);
+        }
+        len +=
+            rpm_ack_encode_apdu_object_property(&apdu[len],
+            Properties[i % BENCH_OBJECT_PROPERTIES], BACNET_ARRAY_ALL);
+        value_len = encode_application_real(value, 20.0f + i / 8.0f);
+        len +=
+            rpm_ack_encode_apdu_object_property_value(&apdu[len], value,
+            value_len);
+    }
+    len += rpm_ack_encode_apdu_object_end(&apdu[len]);
+
+    return len;
+}
+
+static void op_rpm_ack_encode(
+    unsigned n)
+{
+    Sink = encode_rpm_ack(Work, n);
+}
+
+/* the nodes of rpm_ack_decode_service_request(), but the first object */
+static void free_read_access_data(
+    BACNET_READ_ACCESS_DATA * rpm_data)
+{
+    BACNET_READ_ACCESS_DATA *next_object = NULL;
+    BACNET_PROPERTY_REFERENCE *property = NULL;
+    BACNET_PROPERTY_REFERENCE *next_property = NULL;
+    BACNET_APPLICATION_DATA_VALUE *value = NULL;
+    BACNET_APPLICATION_DATA_VALUE *next_value = NULL;
+    bool first = true;
+
+    while (rpm_data) {
+        for (property = rpm_data->listOfProperties; property;
+            property = next_property) {
+            for (value = property->value; value; value = next_value) {
+                next_value = value->next;
+                free(value);
+            }
+            next_property = property->next;
+            free(property);
+        }
+        next_object = rpm_data->next;
+        if (!first) {
+            free(rpm_data);
+        }
+        first = false;
+        rpm_data = next_object;
+    }
+}
+
+/* the ack is decoded into calloc'd nodes, as before the arena */
+static void op_rpm_ack_decode_heap(
+    unsigned n)
+{
+    BACNET_READ_ACCESS_DATA rpm_data;
+
+    (void) n;
+    memset(&rpm_data, 0, sizeof(rpm_data));
+    Sink = rpm_ack_decode_service_request(&Apdu[3], Apdu_Len - 3, &rpm_data);
+    free_read_access_data(&rpm_data);
+}
+
+static BACNET_RPM_ARENA Arena;
+
+static void op_rpm_ack_decode_arena(
+    unsigned n)
+{
+    BACNET_READ_ACCESS_DATA *rpm_data = NULL;
+
+    (void) n;
+    rpm_arena_reset(&Arena);
+    rpm_data = rpm_arena_alloc(&Arena, sizeof(BACNET_READ_ACCESS_DATA));
+    Sink =
+        rpm_ack_decode_service_request_arena(&Apdu[3], Apdu_Len - 3, rpm_data,
+        &Arena);
+}
+
+static void op_rpm_ack_decode_compact(
+    unsigned n)
+{
+    BACNET_READ_ACCESS_DATA *rpm_data = NULL;
+
+    (void) n;
+    rpm_arena_reset(&Arena);
+    rpm_data = rpm_arena_alloc(&Arena, sizeof(BACNET_READ_ACCESS_DATA));
+    Sink =
+        rpm_ack_decode_service_request_compact(&Apdu[3], Apdu_Len - 3,
+        rpm_data, &Arena);
+}
+
+/* the present value and the status flags of an analog input */
+static BACNET_PROPERTY_VALUE Cov_Values[BENCH_COV_VALUES];
+static BACNET_COV_DATA Cov_Data;
+
+static void init_cov_data(
+    void)
+{
+    Cov_Data.subscriberProcessIdentifier = 1;
+    Cov_Data.initiatingDeviceIdentifier = 260001;
+    Cov_Data.monitoredObjectIdentifier.type = OBJECT_ANALOG_INPUT;
+    Cov_Data.monitoredObjectIdentifier.instance = 7;
+    Cov_Data.timeRemaining = 300;
+    cov_data_value_list_link(&Cov_Data, &Cov_Values[0], BENCH_COV_VALUES);
+    Cov_Values[0].propertyIdentifier = PROP_PRESENT_VALUE;
+    Cov_Values[0].propertyArrayIndex = BACNET_ARRAY_ALL;
+    Cov_Values[0].value.tag = BACNET_APPLICATION_TAG_REAL;
+    Cov_Values[0].value.type.Real = 21.5f;
+    Cov_Values[1].propertyIdentifier = PROP_STATUS_FLAGS;
+    Cov_Values[1].propertyArrayIndex = BACNET_ARRAY_ALL;
+    Cov_Values[1].value.tag = BACNET_APPLICATION_TAG_BIT_STRING;
+    bitstring_init(&Cov_Values[1].value.type.Bit_String);
+    bitstring_set_bit(&Cov_Values[1].value.type.Bit_String,
+        STATUS_FLAG_IN_ALARM, false);
+    bitstring_set_bit(&Cov_Values[1].value.type.Bit_String,
+        STATUS_FLAG_FAULT, false);
+    bitstring_set_bit(&Cov_Values[1].value.type.Bit_String,
+        STATUS_FLAG_OVERRIDDEN, false);
+    bitstring_set_bit(&Cov_Values[1].value.type.Bit_String,
+        STATUS_FLAG_OUT_OF_SERVICE, false);
+}
+
+static void op_cov_encode(
+    unsigned n)
+{
+    (void) n;
+    Sink = ucov_notify_encode_apdu(Work, &Cov_Data);
+}
+
+static void op_cov_decode(
+    unsigned n)
+{
+    BACNET_PROPERTY_VALUE values[BENCH_COV_VALUES];
+    BACNET_COV_DATA data;
+
+    (void) n;
+    cov_data_value_list_link(&data, &values[0], BENCH_COV_VALUES);
+    /* after the header of the unconfirmed request */
+    Sink =
+        cov_notify_decode_service_request(&Apdu[2], Apdu_Len - 2, &data);
+}
+
+/* the records of a trend log of REALs, as a ReadRange ack carries them:
+   timestamp [0], logDatum [1] real-value [2], statusFlags [2] */
+static int encode_trend_records(
+    uint8_t * apdu,
+    unsigned n)
+{
+    BACNET_DATE date = { 2017, 1, 1, 7 };
+    BACNET_TIME time = { 8, 0, 0, 0 };
+    BACNET_BIT_STRING flags;
+    int len = 0;
+    unsigned i = 0;
+
+    bitstring_init(&flags);
+    bitstring_set_bit(&flags, STATUS_FLAG_OUT_OF_SERVICE, false);
+    for (i = 0; i < n; i++) {
+        time.min = i % 60;
+        len += encode_opening_tag(&apdu[len], 0);
+        len += encode_application_date(&apdu[len], &date);
+        len += encode_application_time(&apdu[len], &time);
+        len += encode_closing_tag(&apdu[len], 0);
+        len += encode_opening_tag(&apdu[len], 1);
+        len += encode_context_real(&apdu[len], 2, 20.0f + i / 8.0f);
+        len += encode_closing_tag(&apdu[len], 1);
+        len += encode_context_bitstring(&apdu[len], 2, &flags);
+    }
+
+    return len;
+}
+
+static uint8_t Trend_Data[BENCH_APDU_SIZE];
+
+static void init_rr_data(
+    BACNET_READ_RANGE_DATA * rrdata,
+    unsigned n)
+{
+    memset(rrdata, 0, sizeof(*rrdata));
+    rrdata->object_type = OBJECT_TRENDLOG;
+    rrdata->object_instance = 1;
+    rrdata->object_property = PROP_LOG_BUFFER;
+    rrdata->array_index = BACNET_ARRAY_ALL;
+    rrdata->RequestType = RR_BY_POSITION;
+    rrdata->ItemCount = n;
+    rrdata->FirstSequence = 1;
+    bitstring_init(&rrdata->ResultFlags);
+    bitstring_set_bit(&rrdata->ResultFlags, RESULT_FLAG_FIRST_ITEM, true);
+    bitstring_set_bit(&rrdata->ResultFlags, RESULT_FLAG_LAST_ITEM, true);
+    bitstring_set_bit(&rrdata->ResultFlags, RESULT_FLAG_MORE_ITEMS, false);
+}
+
+static void op_readrange_ack_encode(
+    unsigned n)
+{
+    BACNET_READ_RANGE_DATA rrdata;
+
+    init_rr_data(&rrdata, n);
+    rrdata.application_data_len = encode_trend_records(Trend_Data, n);
+    rrdata.application_data = Trend_Data;
+    Sink = rr_ack_encode_apdu(Work, 1, &rrdata);
+}
+
+/* the ack, and every value of its records */
+static void op_readrange_ack_decode(
+    unsigned n)
+{
+    BACNET_READ_RANGE_DATA rrdata;
+    BACNET_APPLICATION_DATA_VALUE value;
+    BACNET_BIT_STRING flags;
+    uint8_t tag_number = 0;
+    uint32_t len_value = 0;
+    uint8_t *apdu = NULL;
+    float real = 0;
+    int len = 0;
+    int records = 0;
+
+    (void) n;
+    memset(&rrdata, 0, sizeof(rrdata));
+    if (rr_ack_decode_service_request(&Apdu[3], Apdu_Len - 3, &rrdata) <= 0) {
+        return;
+    }
+    apdu = rrdata.application_data;
+    while (len < rrdata.application_data_len) {
+        len++;  /* opening tag 0 */
+        len +=
+            bacapp_decode_application_data(&apdu[len],
+            rrdata.application_data_len - len, &value);
+        len +=
+            bacapp_decode_application_data(&apdu[len],
+            rrdata.application_data_len - len, &value);
+        len += 2;       /* closing tag 0, opening tag 1 */
+        len +=
+            decode_tag_number_and_value(&apdu[len], &tag_number, &len_value);
+        len += decode_real(&apdu[len], &real);
+        len++;  /* closing tag 1 */
+        len +=
+            decode_tag_number_and_value(&apdu[len], &tag_number, &len_value);
+        len += decode_bitstring(&apdu[len], len_value, &flags);
+        records++;
+    }
+    Sink = records;
+}
+
+static void op_iam_encode(
+    unsigned n)
+{
+    (void) n;
+    Sink = iam_encode_apdu(Work, 260001, MAX_APDU, SEGMENTATION_NONE, 260);
+}
+
+static void op_iam_decode(
+    unsigned n)
+{
+    uint32_t device_id = 0;
+    unsigned max_apdu = 0;
+    int segmentation = 0;
+    uint16_t vendor_id = 0;
+
+    (void) n;
+    Sink =
+        iam_decode_service_request(&Apdu[2], &device_id, &max_apdu,
+        &segmentation, &vendor_id);
+}
+
+static void write_json(
+    const char *filename)
+{
+    FILE *file = fopen(filename, "w");
+    int i = 0;
+
+    if (!file) {
+        printf("ERROR: cannot write %s\n", filename);
+        exit(1);
+    }
+    fprintf(file, "{\n  \"benchmark\": \"codec_bench\",\n  \"cases\": [\n");
+    for (i = 0; i < Result_Count; i++) {
+        fprintf(file,
+            "    {\"name\": \"%s\", \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f}%s\n",
+            Results[i].name, Results[i].ns_per_op, Results[i].allocs_per_op,
+            (i + 1 < Result_Count) ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+}
+
+/* compare the results with the cases of the baseline written by
+   write_json(), return the number of regressions */
+static int compare_baseline(
+    const char *filename,
+    double tolerance)
+{
+    FILE *file = fopen(filename, "r");
+    char line[256];
+    char name[BENCH_NAME_LEN];
+    double ns = 0;
+    double allocs = 0;
+    int regressions = 0;
+    int i = 0;
+
+    if (!file) {
+        printf("ERROR: cannot read the baseline %s\n", filename);
+        exit(1);
+    }
+    printf("\n%-28s %10s %10s %8s\n", "compared to baseline", "ns/op",
+        "baseline", "change");
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line,
+                " {\"name\": \"%63[^\"]\", \"ns_per_op\": %lf, \"allocs_per_op\": %lf}",
+                name, &ns, &allocs) != 3) {
+            continue;
+        }
+        for (i = 0; i < Result_Count; i++) {
+            if (strcmp(Results[i].name, name) != 0) {
+                continue;
+            }
+            printf("%-28s %10.1f %10.1f %+7.1f%%", name, Results[i].ns_per_op,
+                ns, (Results[i].ns_per_op - ns) * 100.0 / ns);
+            if (Results[i].ns_per_op > ns * (1.0 + tolerance / 100.0)) {
+                printf("  SLOWER");
+                regressions++;
+            }
+            if (Results[i].allocs_per_op > allocs) {
+                printf("  MORE ALLOCS (%.2f, was %.2f)",
+                    Results[i].allocs_per_op, allocs);
+                regressions++;
+            }
+            printf("\n");
+        }
+    }
+    fclose(file);
+
+    return regressions;
+}
+
+int main(
+    int argc,
+    char *argv[])
+{
+    static const unsigned sizes[] = { 1, 10, 50, 200 };
+    const char *json = NULL;
+    const char *baseline = NULL;
+    double tolerance = 25.0;
+    BACNET_READ_RANGE_DATA rrdata;
+    unsigned n = 0;
+    int i = 0;
+    int regressions = 0;
+
+    for (i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--json") == 0) && (i + 1 < argc)) {
+            json = argv[++i];
+        } else if ((strcmp(argv[i], "--baseline") == 0) && (i + 1 < argc)) {
+            baseline = argv[++i];
+        } else if ((strcmp(argv[i], "--tolerance") == 0) && (i + 1 < argc)) {
+            tolerance = atof(argv[++i]);
+        } else {
+            printf("usage: %s [--json file] [--baseline file] "
+                "[--tolerance percent]\n", argv[0]);
+            return 1;
+        }
+    }
+    rpm_arena_init(&Arena, BENCH_APDU_SIZE * 2);
+    for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++) {
+        n = sizes[i];
+        Apdu_Len = encode_rpm_request(Apdu, n);
+        run_case("rpm_request_encode", n, op_rpm_request_encode);
+        run_case("rpm_request_decode", n, op_rpm_request_decode);
+        Apdu_Len = encode_rpm_ack(Apdu, n);
+        run_case("rpm_ack_encode", n, op_rpm_ack_encode);
+        run_case("rpm_ack_decode_heap", n, op_rpm_ack_decode_heap);
+        run_case("rpm_ack_decode_arena", n, op_rpm_ack_decode_arena);
+        run_case("rpm_ack_decode_compact", n, op_rpm_ack_decode_compact);
+    }
+    init_cov_data();
+    Apdu_Len = ucov_notify_encode_apdu(Apdu, &Cov_Data);
+    run_case("cov_notify_encode", 0, op_cov_encode);
+    run_case("cov_notify_decode", 0, op_cov_decode);
+    init_rr_data(&rrdata, BENCH_TREND_RECORDS);
+    rrdata.application_data_len =
+        encode_trend_records(Trend_Data, BENCH_TREND_RECORDS);
+    rrdata.application_data = Trend_Data;
+    Apdu_Len = rr_ack_encode_apdu(Apdu, 1, &rrdata);
+    run_case("readrange_ack_encode", BENCH_TREND_RECORDS,
+        op_readrange_ack_encode);
+    run_case("readrange_ack_decode", BENCH_TREND_RECORDS,
+        op_readrange_ack_decode);
+    Apdu_Len = iam_encode_apdu(Apdu, 260001, MAX_APDU, SEGMENTATION_NONE, 260);
+    run_case("iam_encode", 0, op_iam_encode);
+    run_case("iam_decode", 0, op_iam_decode);
+    rpm_arena_destroy(&Arena);
+
+    if (json) {
+        write_json(json);
+    }
+    if (baseline) {
+        regressions = compare_baseline(baseline, tolerance);
+        if (regressions) {
+            printf("%d regression(s) beyond %.0f%%\n", regressions,
+                tolerance);
+            return 1;
+        }
+    }
+
+    return 0;
+}
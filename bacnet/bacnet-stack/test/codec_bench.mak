@@ -0,0 +1,43 @@
+#Makefile to build the encoding and decoding benchmark
+CC      = gcc
+
+SRC_DIR = ../src
+HANDLER_DIR = ../demo/handler
+INCLUDES = -I../include -I. -I../ports/linux -I../demo/object
+DEFINES = -DBIG_ENDIAN=0 -DBACAPP_ALL -DPRINT_ENABLED=1 -DBACDL_BIP
+
+# the handler of the RPM ack is linked for its decoders only
+CFLAGS  = -Wall -O2 -ffunction-sections $(INCLUDES) $(DEFINES)
+LFLAGS  = -Wl,--gc-sections
+
+SRCS = $(SRC_DIR)/bacdcode.c \
+	$(SRC_DIR)/bacint.c \
+	$(SRC_DIR)/bacstr.c \
+	$(SRC_DIR)/bacreal.c \
+	$(SRC_DIR)/bacapp.c \
+	$(SRC_DIR)/bacdevobjpropref.c \
+	$(SRC_DIR)/datetime.c \
+	$(SRC_DIR)/bactext.c \
+	$(SRC_DIR)/indtext.c \
+	$(SRC_DIR)/rpm.c \
+	$(SRC_DIR)/cov.c \
+	$(SRC_DIR)/readrange.c \
+	$(SRC_DIR)/iam.c \
+	$(SRC_DIR)/memcopy.c \
+	$(HANDLER_DIR)/h_rpm_a.c \
+	codec_bench.c
+
+OBJS = ${SRCS:.c=.o}
+
+TARGET = codec_bench
+
+all: ${TARGET}
+
+${TARGET}: ${OBJS}
+	${CC} -o $@ ${OBJS} ${LFLAGS}
+
+.c.o:
+	${CC} -c ${CFLAGS} $*.c -o $@
+
+clean:
+	rm -rf ${OBJS} ${TARGET}
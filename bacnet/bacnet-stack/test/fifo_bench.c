@@ -0,0 +1,163 @@
+/*####COPYRIGHTBEGIN####
+ -------------------------------------------
+ Copyright (C) 2017 Steve Karg
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to:
+ The Free Software Foundation, Inc.
+ 59 Temple Place - Suite 330
+ Boston, MA  02111-1307, USA.
+
+ As a special exception, if other files instantiate templates or
+ use macros or inline functions from this file, or you compile
+ this file and link it with other works to produce a work based
+ on this file, this file does not by itself cause the resulting
+ work to be covered by the GNU General Public License. However
+ the source code for this file must still be made available in
+ accordance with section (3) of the GNU General Public License.
+
+ This exception does not invalidate any other reasons why a work
+ based on this file might be covered by the GNU General Public
+ License.
+ -------------------------------------------
+####COPYRIGHTEND####*/
+
+
+/* Throughput of the FIFO under an MS/TP receiver: a frame at a time, byte
+   by byte as the interrupt handlers do, with the byte loops FIFO_Add() and
+   FIFO_Pull() used to have, with their two memcpy now, and in place with
+   the spans.
+   Usage: fifo_bench [rounds] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fifo.h"
+
+/* the data store of the Linux RS-485 driver, and the largest frame */
+static volatile uint8_t Data_Store[4096];
+#define BENCH_FRAME 509
+
+static double elapsed_ms(
+    struct timespec *start,
+    struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 +
+        (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static void frame_by_byte(
+    FIFO_BUFFER * b,
+    uint8_t * frame,
+    uint8_t * copy)
+{
+    unsigned i;
+
+    for (i = 0; i < BENCH_FRAME; i++) {
+        (void) FIFO_Put(b, frame[i]);
+    }
+    for (i = 0; i < BENCH_FRAME; i++) {
+        copy[i] = FIFO_Get(b);
+    }
+}
+
+/* how FIFO_Add() and FIFO_Pull() copied before */
+static void frame_by_loop(
+    FIFO_BUFFER * b,
+    uint8_t * frame,
+    uint8_t * copy)
+{
+    unsigned i;
+
+    if (FIFO_Available(b, BENCH_FRAME)) {
+        for (i = 0; i < BENCH_FRAME; i++) {
+            b->buffer[b->head % b->buffer_len] = frame[i];
+            b->head++;
+        }
+    }
+    for (i = 0; (i < BENCH_FRAME) && !FIFO_Empty(b); i++) {
+        copy[i] = b->buffer[b->tail % b->buffer_len];
+        b->tail++;
+    }
+}
+
+static void frame_by_copy(
+    FIFO_BUFFER * b,
+    uint8_t * frame,
+    uint8_t * copy)
+{
+    (void) FIFO_Add(b, frame, BENCH_FRAME);
+    (void) FIFO_Pull(b, copy, BENCH_FRAME);
+}
+
+/* the reader works on the data store, as the MS/TP FSM can */
+static void frame_by_span(
+    FIFO_BUFFER * b,
+    uint8_t * frame,
+    uint8_t * copy)
+{
+    volatile uint8_t *span;
+    unsigned length = 0;
+    unsigned count = 0;
+
+    (void) FIFO_Add(b, frame, BENCH_FRAME);
+    while ((span = FIFO_Peek_Span(b, &length)) != NULL) {
+        memcpy(&copy[count], (uint8_t *) span, length);
+        count += FIFO_Pull_Commit(b, length);
+    }
+}
+
+int main(
+    int argc,
+    char *argv[])
+{
+    void (*copies[4]) (FIFO_BUFFER *, uint8_t *, uint8_t *) = {
+    frame_by_byte, frame_by_loop, frame_by_copy, frame_by_span};
+    const char *labels[4] = { "Put/Get", "byte loops", "Add/Pull", "spans" };
+    static uint8_t frame[BENCH_FRAME];
+    static uint8_t copy[BENCH_FRAME];
+    long rounds = argc > 1 ? atol(argv[1]) : 200000;
+    FIFO_BUFFER fifo;
+    struct timespec t0, t1;
+    double ms = 0;
+    long r = 0;
+    int c = 0;
+    unsigned i = 0;
+
+    for (i = 0; i < BENCH_FRAME; i++) {
+        frame[i] = (uint8_t) (i * 31);
+    }
+    for (c = 0; c < 4; c++) {
+        FIFO_Init(&fifo, Data_Store, sizeof(Data_Store));
+        /* start near the end, so the frames wrap now and then */
+        fifo.head = fifo.tail = sizeof(Data_Store) - 100;
+        memset(copy, 0, sizeof(copy));
+        copies[c] (&fifo, frame, copy);
+        if (memcmp(copy, frame, sizeof(frame)) != 0) {
+            printf("ERROR: %s copied the frame wrong\n", labels[c]);
+            exit(1);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (r = 0; r < rounds; r++) {
+            copies[c] (&fifo, frame, copy);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ms = elapsed_ms(&t0, &t1);
+        printf("%-10s %8.1f MB/s, %7.1f ns/frame\n", labels[c],
+            BENCH_FRAME * (double) rounds / ms / 1000.0,
+            ms * 1000000.0 / rounds);
+    }
+
+    return 0;
+}
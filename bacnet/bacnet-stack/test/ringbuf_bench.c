@@ -0,0 +1,163 @@
+/*####COPYRIGHTBEGIN####
+ -------------------------------------------
+ Copyright (C) 2017 Steve Karg
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to:
+ The Free Software Foundation, Inc.
+ 59 Temple Place - Suite 330
+ Boston, MA  02111-1307, USA.
+
+ As a special exception, if other files instantiate templates or
+ use macros or inline functions from this file, or you compile
+ this file and link it with other works to produce a work based
+ on this file, this file does not by itself cause the resulting
+ work to be covered by the GNU General Public License. However
+ the source code for this file must still be made available in
+ accordance with section (3) of the GNU General Public License.
+
+ This exception does not invalidate any other reasons why a work
+ based on this file might be covered by the GNU General Public
+ License.
+ -------------------------------------------
+####COPYRIGHTEND####*/
+
+
+/* Throughput of the ring buffer with the packets of an MS/TP PDU queue:
+   with the volatile byte loops Ringbuf_Put() and Ringbuf_Pop() used to
+   have, with memcpy now, and with Ringbuf_Put_Many() and
+   Ringbuf_Pop_Many().
+   Usage: ringbuf_bench [rounds] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ringbuf.h"
+
+/* a PDU queue entry: the address and the PDU */
+#define BENCH_ELEMENT_SIZE 512
+#define BENCH_ELEMENT_COUNT 8
+static uint8_t Data_Store[BENCH_ELEMENT_SIZE * BENCH_ELEMENT_COUNT];
+
+static double elapsed_ms(
+    struct timespec *start,
+    struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 +
+        (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/* how Ringbuf_Put() and Ringbuf_Pop() copied before */
+static void queue_by_loop(
+    RING_BUFFER * b,
+    uint8_t * packets,
+    uint8_t * copy,
+    unsigned count)
+{
+    volatile uint8_t *ring_data;
+    unsigned n;
+    unsigned i;
+
+    for (n = 0; n < count; n++) {
+        if (!Ringbuf_Full(b)) {
+            ring_data = b->buffer;
+            ring_data += ((b->head % b->element_count) * b->element_size);
+            for (i = 0; i < b->element_size; i++) {
+                ring_data[i] = packets[n * b->element_size + i];
+            }
+            b->head++;
+        }
+    }
+    for (n = 0; n < count; n++) {
+        if (!Ringbuf_Empty(b)) {
+            ring_data = b->buffer;
+            ring_data += ((b->tail % b->element_count) * b->element_size);
+            for (i = 0; i < b->element_size; i++) {
+                copy[n * b->element_size + i] = ring_data[i];
+            }
+            b->tail++;
+        }
+    }
+}
+
+static void queue_by_element(
+    RING_BUFFER * b,
+    uint8_t * packets,
+    uint8_t * copy,
+    unsigned count)
+{
+    unsigned n;
+
+    for (n = 0; n < count; n++) {
+        (void) Ringbuf_Put(b, &packets[n * b->element_size]);
+    }
+    for (n = 0; n < count; n++) {
+        (void) Ringbuf_Pop(b, &copy[n * b->element_size]);
+    }
+}
+
+static void queue_by_many(
+    RING_BUFFER * b,
+    uint8_t * packets,
+    uint8_t * copy,
+    unsigned count)
+{
+    (void) Ringbuf_Put_Many(b, packets, count);
+    (void) Ringbuf_Pop_Many(b, copy, count);
+}
+
+int main(
+    int argc,
+    char *argv[])
+{
+    void (*queues[3]) (RING_BUFFER *, uint8_t *, uint8_t *, unsigned) = {
+    queue_by_loop, queue_by_element, queue_by_many};
+    const char *labels[3] = { "byte loops", "Put/Pop", "Put/Pop Many" };
+    static uint8_t packets[sizeof(Data_Store)];
+    static uint8_t copy[sizeof(Data_Store)];
+    /* the packets queued at once, which wrap around the ring */
+    unsigned count = BENCH_ELEMENT_COUNT - 3;
+    long rounds = argc > 1 ? atol(argv[1]) : 200000;
+    RING_BUFFER ring;
+    struct timespec t0, t1;
+    double ms = 0;
+    long r = 0;
+    int q = 0;
+    unsigned i = 0;
+
+    for (i = 0; i < sizeof(packets); i++) {
+        packets[i] = (uint8_t) (i * 31);
+    }
+    for (q = 0; q < 3; q++) {
+        Ringbuf_Init(&ring, Data_Store, BENCH_ELEMENT_SIZE,
+            BENCH_ELEMENT_COUNT);
+        memset(copy, 0, sizeof(copy));
+        queues[q] (&ring, packets, copy, count);
+        if (memcmp(copy, packets, count * BENCH_ELEMENT_SIZE) != 0) {
+            printf("ERROR: %s copied the packets wrong\n", labels[q]);
+            exit(1);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (r = 0; r < rounds; r++) {
+            queues[q] (&ring, packets, copy, count);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ms = elapsed_ms(&t0, &t1);
+        printf("%-12s %8.1f MB/s, %7.1f ns/packet\n", labels[q],
+            count * BENCH_ELEMENT_SIZE * (double) rounds / ms / 1000.0,
+            ms * 1000000.0 / ((double) rounds * count));
+    }
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+#Makefile to build the ringbuf throughput benchmark
+CC      = gcc
+
+SRC_DIR = ../src
+INCLUDES = -I../include -I.
+DEFINES = -DBIG_ENDIAN=0
+
+CFLAGS  = -Wall -O2 $(INCLUDES) $(DEFINES)
+
+SRCS = $(SRC_DIR)/ringbuf.c \
+	ringbuf_bench.c
+
+OBJS = ${SRCS:.c=.o}
+
+TARGET = ringbuf_bench
+
+all: ${TARGET}
+
+${TARGET}: ${OBJS}
+	${CC} -o $@ ${OBJS}
+
+.c.o:
+	${CC} -c ${CFLAGS} $*.c -o $@
+
+clean:
+	rm -rf ${OBJS} ${TARGET}
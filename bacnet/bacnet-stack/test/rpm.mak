@@ -17,6 +17,7 @@ SRCS = $(SRC_DIR)/bacdcode.c \
 	$(SRC_DIR)/datetime.c \
 	$(SRC_DIR)/memcopy.c \
 	$(SRC_DIR)/rpm.c \
+	$(SRC_DIR)/bacdevobjpropref.c \
 	ctest.c
 
 TARGET = rpm
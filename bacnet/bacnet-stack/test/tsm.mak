@@ -0,0 +1,42 @@
+#Makefile to build test case
+CC      = gcc
+SRC_DIR = ../src
+INCLUDES = -I../include -I. -I../ports/linux
+DEFINES = -DBACDL_BIP -DBIG_ENDIAN=0 -DTEST -DTEST_TSM -DMAX_TSM_TRANSACTIONS=600 \
+	-DBACNET_CONTEXT_ENABLED
+
+CFLAGS  = -Wall $(INCLUDES) $(DEFINES) -g
+
+SRCS = $(SRC_DIR)/tsm.c \
+	$(SRC_DIR)/bacctx.c \
+	$(SRC_DIR)/apdu.c \
+	$(SRC_DIR)/abort.c \
+	$(SRC_DIR)/dcc.c \
+	$(SRC_DIR)/npdu.c \
+	$(SRC_DIR)/bacaddr.c \
+	$(SRC_DIR)/bacdcode.c \
+	$(SRC_DIR)/bacint.c \
+	$(SRC_DIR)/bacstr.c \
+	$(SRC_DIR)/bacreal.c \
+	ctest.c
+
+TARGET = tsm
+
+all: ${TARGET}
+ 
+OBJS = ${SRCS:.c=.o}
+
+${TARGET}: ${OBJS}
+	${CC} -pthread -o $@ ${OBJS} 
+
+.c.o:
+	${CC} -c ${CFLAGS} $*.c -o $@
+	
+depend:
+	rm -f .depend
+	${CC} -MM ${CFLAGS} *.c >> .depend
+	
+clean:
+	rm -rf core ${TARGET} $(OBJS)
+
+include: .depend
@@ -0,0 +1,244 @@
+#include "ackpool.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+// an ack copied out of the datagram
+typedef struct {
+    PullPolicy* policy;
+    uint16_t len;
+    uint8_t apdu[];
+} AckJob;
+
+// a single producer, single consumer ring. head is only written by the
+// producer and tail by the consumer, each on a cache line of its own
+typedef struct {
+    unsigned head __attribute__((aligned(64)));
+    unsigned tail __attribute__((aligned(64)));
+    AckJob* slots[ACK_QUEUE_LEN] __attribute__((aligned(64)));
+} AckRing;
+
+typedef struct {
+    AckRing jobs;	// from the receiver to the worker
+    AckRing done;	// from the worker back to the receiver
+    BACNET_RPM_ARENA arena;
+    pthread_t thread;
+    int wakeFd;	// the worker sleeps on it while its ring is empty
+    int stop;
+    // the receiver's own: the acks queued and not reaped yet, at most
+    // ACK_QUEUE_LEN so that neither ring gets full, and whether the worker
+    // is to be told at the next kick
+    int queued;
+    int kick;
+} AckWorker;
+
+static AckWorker* g_workers = NULL;
+static int g_worker_num = 0;
+static RpmAckHandler g_handler = NULL;
+static RpmAckDone g_done = NULL;
+static EventLoop* g_done_loop = NULL;
+
+static int ring_push(AckRing* r, AckJob* job) {
+    unsigned head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= ACK_QUEUE_LEN) {
+        return -1;
+    }
+    r->slots[head % ACK_QUEUE_LEN] = job;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static AckJob* ring_pop(AckRing* r) {
+    unsigned tail = r->tail;
+    if (tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    AckJob* job = r->slots[tail % ACK_QUEUE_LEN];
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return job;
+}
+
+static void* ack_worker_func(void* arg) {
+    AckWorker* w = (AckWorker*) arg;
+    while (1) {
+        int handled = 0;
+        AckJob* job = NULL;
+        while ((job = ring_pop(&w->jobs)) != NULL) {
+            g_handler(job->policy, job->apdu, job->len, &w->arena);
+            // the done ring has room for every ack queued
+            ring_push(&w->done, job);
+            handled++;
+        }
+        // the receiver reaps them once the ring ran dry, not after each ack
+        if (handled > 0) {
+            evloop_wakeup(g_done_loop);
+        }
+        if (__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        // the kicks since the ring was last looked at are merged into one
+        uint64_t kicks = 0;
+        if (read(w->wakeFd, &kicks, sizeof(kicks)) < 0) {
+            usleep(1000);
+        }
+    }
+    return NULL;
+}
+
+static void wake_worker(AckWorker* w) {
+    uint64_t one = 1;
+    if (write(w->wakeFd, &one, sizeof(one)) < 0) {
+        // the counter is full, the worker is awake anyway
+    }
+    w->kick = 0;
+}
+
+int ack_pool_start(int workers, RpmAckHandler handler, RpmAckDone done, EventLoop* loop) {
+    if (workers <= 0 || g_workers != NULL) {
+        return 0;
+    }
+    // the rings are aligned to the cache lines
+    void* mem = NULL;
+    if (posix_memalign(&mem, 64, workers * sizeof(AckWorker)) != 0) {
+        printf("ERROR:out of memory for the ack workers, the acks are handled by the receiver\n");
+        return -1;
+    }
+    g_workers = (AckWorker*) mem;
+    memset(g_workers, 0, workers * sizeof(AckWorker));
+    g_handler = handler;
+    g_done = done;
+    g_done_loop = loop;
+    int i = 0;
+    for (i = 0; i < workers; i++) {
+        AckWorker* w = &g_workers[i];
+        w->wakeFd = eventfd(0, EFD_CLOEXEC);
+        if (w->wakeFd < 0) {
+            break;
+        }
+        rpm_arena_init(&w->arena, ACK_ARENA_BLOCK);
+        if (pthread_create(&w->thread, NULL, ack_worker_func, w) != 0) {
+            rpm_arena_destroy(&w->arena);
+            close(w->wakeFd);
+            break;
+        }
+    }
+    g_worker_num = i;
+    if (g_worker_num == 0) {
+        free(g_workers);
+        g_workers = NULL;
+        printf("failed to start the ack workers, the acks are handled by the receiver\n");
+        return -1;
+    }
+    if (g_worker_num < workers) {
+        printf("only %d of the %d ack workers are started\n", g_worker_num, workers);
+    }
+    return 0;
+}
+
+int ack_pool_size() {
+    return g_worker_num;
+}
+
+// the worker of the policy, by the address of the policy
+static AckWorker* worker_of(PullPolicy* policy) {
+    return &g_workers[((uintptr_t) policy >> 4) % g_worker_num];
+}
+
+int ack_pool_submit(PullPolicy* policy, uint8_t* apdu, uint16_t len) {
+    if (g_worker_num == 0) {
+        return -1;
+    }
+    AckWorker* w = worker_of(policy);
+    if (w->queued >= ACK_QUEUE_LEN) {
+        ack_pool_reap();
+    }
+    // the policy has no acks queued: handled here, it's still in order
+    if (w->queued >= ACK_QUEUE_LEN && policy->rtAcksQueued == 0) {
+        return -1;
+    }
+    AckJob* job = (AckJob*) malloc(sizeof(AckJob) + len);
+    if (job == NULL) {
+        // the acks of the policy queued already go first
+        ack_pool_drain(policy);
+        return -1;
+    }
+    job->policy = policy;
+    job->len = len;
+    memcpy(job->apdu, apdu, len);
+    while (w->queued >= ACK_QUEUE_LEN) {
+        wake_worker(w);
+        usleep(ACK_WAIT_US);
+        ack_pool_reap();
+    }
+    ring_push(&w->jobs, job);
+    w->queued++;
+    w->kick = 1;
+    policy->rtAcksQueued++;
+    return 0;
+}
+
+void ack_pool_kick() {
+    int i = 0;
+    for (i = 0; i < g_worker_num; i++) {
+        if (g_workers[i].kick) {
+            wake_worker(&g_workers[i]);
+        }
+    }
+}
+
+void ack_pool_reap() {
+    int i = 0;
+    for (i = 0; i < g_worker_num; i++) {
+        AckWorker* w = &g_workers[i];
+        AckJob* job = NULL;
+        while ((job = ring_pop(&w->done)) != NULL) {
+            w->queued--;
+            job->policy->rtAcksQueued--;
+            g_done(job->policy);
+            free(job);
+        }
+    }
+}
+
+void ack_pool_drain(PullPolicy* policy) {
+    if (g_worker_num == 0 || (policy != NULL && policy->rtAcksQueued == 0)) {
+        return;
+    }
+    ack_pool_kick();
+    while (1) {
+        ack_pool_reap();
+        int left = 0;
+        int i = 0;
+        for (i = 0; i < g_worker_num; i++) {
+            left += g_workers[i].queued;
+        }
+        if (policy != NULL ? policy->rtAcksQueued == 0 : left == 0) {
+            return;
+        }
+        usleep(ACK_WAIT_US);
+    }
+}
+
+void ack_pool_stop() {
+    if (g_worker_num == 0) {
+        return;
+    }
+    ack_pool_drain(NULL);
+    int i = 0;
+    for (i = 0; i < g_worker_num; i++) {
+        AckWorker* w = &g_workers[i];
+        __atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+        wake_worker(w);
+        pthread_join(w->thread, NULL);
+        rpm_arena_destroy(&w->arena);
+        close(w->wakeFd);
+    }
+    free(g_workers);
+    g_workers = NULL;
+    g_worker_num = 0;
+}
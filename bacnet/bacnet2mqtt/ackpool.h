@@ -0,0 +1,49 @@
+#ifndef INF_BCE_IOT_BAC2MQTT_ACKPOOL_H
+#define INF_BCE_IOT_BAC2MQTT_ACKPOOL_H
+
+#include "data.h"
+#include "rpm.h"
+
+// the acks of ReadPropertyMultiple are decoded, formatted and published by a
+// few threads of their own, so that the receiver only copies them out of the
+// datagram. each worker has a lock-free ring of the acks from the receiver and
+// one of the acks done back to it, and an arena to decode into. the acks of a
+// policy always go to the same worker in the order they came, its runtime
+// state (the cursor, the history, the windows, the last values) is then only
+// touched by one thread at a time. all but the handler are called by the
+// receiver thread
+
+// decode the ack and publish its values, on a worker
+typedef void (*RpmAckHandler)(PullPolicy* policy, uint8_t* apdu, uint16_t len,
+	BACNET_RPM_ARENA* arena);
+
+// called on the receiver once an ack of the policy is done
+typedef void (*RpmAckDone)(PullPolicy* policy);
+
+// start the workers, the receiver loop is woken up as they finish acks. return
+// 0 on success, also for 0 workers, -1 if none could be started
+int ack_pool_start(int workers, RpmAckHandler handler, RpmAckDone done, EventLoop* loop);
+
+// the workers started, 0 if the acks are handled by the receiver
+int ack_pool_size();
+
+// queue a copy of the ack to the worker of the policy, the worker is told at
+// the next ack_pool_kick. return 0 if queued, -1 if the ack is to be handled
+// by the caller: no workers, out of memory, or the queue is full and none of
+// the acks of the policy are queued. while some are, it waits for room
+int ack_pool_submit(PullPolicy* policy, uint8_t* apdu, uint16_t len);
+
+// wake the workers the acks were queued to since the last kick
+void ack_pool_kick();
+
+// call done for the acks the workers finished
+void ack_pool_reap();
+
+// wait until the queued acks of the policy are done, e.g. before it's
+// touched by the receiver. NULL for all of them
+void ack_pool_drain(PullPolicy* policy);
+
+// drain and join the workers
+void ack_pool_stop();
+
+#endif
@@ -26,7 +26,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>       /* for time */
+#include <math.h>
+#include <arpa/inet.h>
 
 #define PRINT_ENABLED 1
 
@@ -38,141 +41,1206 @@
 #include "apdu.h"
 #include "device.h"
 #include "datalink.h"
+#include "bip.h"
+#include "bvlc.h"
 #include "whois.h"
 /* some demo stuff needed */
 #include "handlers.h"
 #include "client.h"
 #include "dlenv.h"
+#include "tsm.h"
+#include "bactimer.h"
+#include "txbuf.h"
+#include "dcc.h"
+#include "rp.h"
+#include "rpm.h"
+#include "wpm.h"
+#include "readrange.h"
+#include "datetime.h"
+#include "trendlog.h"
+#include "event.h"
+#include "alarm_ack.h"
+#include "abort.h"
+#include "reject.h"
 #include "baclib.h"
+#include "ackpool.h"
 #include "jsonutil.h"
 #include "mqttutil.h"
 #include "common.h"
 
 static GlobalVar* g_vars = NULL;
-static char LOG_BUFF[BUFF_LEN] = {0};
+
+// the confirmed requests in flight. each slot is the context of the
+// completion of its transaction (see tsm_set_completion), the tsm of the
+// stack matches the reply to it by the invoke id and the address of the
+// device, does the retries, and calls request_completed once with the ack,
+// error, abort or reject, or the timeout. the slots are only used inside the
+// g_bac_ctx context
+typedef struct {
+    PullPolicy* policy;	// NULL if the slot is free, or for a control message
+    ControlMsg* control;	// the message of a WritePropertyMultiple, NULL otherwise
+    int alarmAck;	// 1 for an AcknowledgeAlarm, which has no policy nor message
+    BacTarget* target;
+    uint32_t device;
+    int props;	// properties read by the request
+    uint8_t service;	// the confirmed service of the request
+    uint8_t invokeId;
+} InflightRequest;
+
+static InflightRequest g_inflight[MAX_INFLIGHT_REQUESTS];
+static int g_inflight_count = 0;
+static int g_inflight_free[MAX_INFLIGHT_REQUESTS];	// the released slots
+static int g_inflight_free_num = 0;
+static int g_inflight_used = 0;	// the slots [0, used) were taken once
+// the most tsm_transaction_idle_count reports
+#define MAX_IDLE_COUNT (MAX_TSM_TRANSACTIONS < 255 ? MAX_TSM_TRANSACTIONS : 255)
+// the policies subscribed to cov, by the subscriber process id modulo
+// MAX_COV_POLICIES. the ids keep growing across the reloads, so that the
+// notifications of the subscriptions of a replaced policy match nothing
+static PullPolicy* g_cov_policies[MAX_COV_POLICIES];
+static uint32_t g_cov_last_process_id = 0;
+// the bindings of the target devices, by the instance
+static BacTarget* g_targets[TARGET_BUCKETS];
+static unsigned g_bind_pass = 0;
+// the unbound targets due for a Who-Is, collected by a bind pass
+static BacTarget** g_whois_due = NULL;
+static int g_whois_due_cap = 0;
+// the decoded values of one ack, reset by each handler. the handlers only run
+// in the event loop of the worker, the ack workers have arenas of their own
+static BACNET_RPM_ARENA g_ack_arena;
+// the learned device addresses, reloaded at the start
+static const char* const ADDRESS_CACHE = "addressCache-bacnet.txt";
+// the loop the datalink is registered in, NULL until started
+static EventLoop* g_receiver_loop = NULL;
+static uint8_t g_rx_buf[MAX_MPDU];
+// the maintenance of the stack, each run when it's due, see bactimer.h
+static BACNET_TIMER g_tsm_timer;
+static BACNET_TIMER g_bvlc_timer;
+static BACNET_TIMER g_save_timer;
+
+static BacTarget* find_target(uint32_t instance);
+static int continue_log_read(PullPolicy* pPolicy, int found);
+static void request_completed(BACNET_ADDRESS* src, uint8_t invoke_id,
+    BACNET_CONFIRMED_REPLY* reply, void* context);
+static InflightRequest* new_inflight(BacTarget* target, uint32_t device, BACNET_ADDRESS* dest,
+    uint8_t invokeId, int props, uint8_t service);
+
+static void release_inflight(InflightRequest* req) {
+    if (req->policy == NULL && req->control == NULL && ! req->alarmAck) {
+        return;
+    }
+    if (req->policy != NULL && req->policy->rtReqPending > 0) {
+        req->policy->rtReqPending--;
+    }
+    if (req->target != NULL && req->target->inflight > 0) {
+        req->target->inflight--;
+    }
+    req->policy = NULL;
+    req->control = NULL;
+    req->alarmAck = 0;
+    g_inflight_free[g_inflight_free_num++] = (int) (req - g_inflight);
+    g_inflight_count--;
+}
+
+// the device answered, its window grows by one once a window of replies came back
+static void device_replied(BacTarget* target) {
+    if (target == NULL) {
+        return;
+    }
+    if (++target->replies >= target->window && target->window < g_vars->g_mqtt_info.deviceWindow) {
+        target->window++;
+        target->replies = 0;
+    }
+}
+
+// the device timed out or ran out of resources: halve its window, once per
+// backoff so that the requests of the same burst failing don't collapse it
+static void device_congested(BacTarget* target) {
+    if (target == NULL) {
+        return;
+    }
+    long long now = monotonic_ms();
+    if (now < target->backoffUntil) {
+        return;
+    }
+    target->window = target->window > 1 ? target->window / 2 : 1;
+    target->replies = 0;
+    target->backoffUntil = now + DEVICE_BACKOFF_MS;
+    logger_debug("device %u is congested, window %d", target->instance, target->window);
+}
+
+// the target of the policy, NULL if out of memory
+static BacTarget* policy_target(PullPolicy* pPolicy) {
+    if (pPolicy->rtTarget == NULL) {
+        pPolicy->rtTarget = find_target(pPolicy->targetInstanceNumber);
+    }
+    return pPolicy->rtTarget;
+}
+
+// 1 if the device can take the requests now. a run larger than the window
+// goes once the device has nothing else in flight
+static int device_window_open(BacTarget* target, int requests) {
+    if (target == NULL) {
+        return 0;
+    }
+    if (target->window == 0) {
+        target->window = g_vars->g_mqtt_info.deviceWindow;
+    }
+    if (target->backoffUntil > 0 && monotonic_ms() < target->backoffUntil) {
+        return 0;
+    }
+    return target->inflight == 0 || target->inflight + requests <= target->window;
+}
+
+// fall back to polling, the subscription is tried again after COV_RETRY_MS
+static void cov_subscription_failed(PullPolicy* policy) {
+    if (policy->rtCovState != COV_FAILED) {
+        printf("cov subscription to device %u failed, polling it instead\n",
+            policy->targetInstanceNumber);
+    }
+    policy->rtCovState = COV_FAILED;
+    policy->rtCovRenewAt = monotonic_ms() + COV_RETRY_MS;
+}
+
+static void request_failed(InflightRequest* req, PullPolicy* policy) {
+    if (policy != NULL && req->service == SERVICE_CONFIRMED_SUBSCRIBE_COV_PROPERTY) {
+        cov_subscription_failed(policy);
+    }
+}
+
+// an error, abort or reject reply
+static void reply_failed(InflightRequest* req, PullPolicy* policy) {
+    if (req->target != NULL) {
+        req->target->failures++;
+    }
+    request_failed(req, policy);
+}
+
+// the ack of the control message goes out once all its writes are done
+static void finish_control_msg(ControlMsg* msg) {
+    printf("control message %s done\n", msg->id != NULL ? msg->id : "");
+    sendAck(controlAck2json(msg), g_vars);
+    release_control_msg(msg);
+}
+
+// the write i of the message is done, error is NULL if it's ok. return the
+// writes of the message not done yet
+static int control_write_done(ControlMsg* msg, int i, const char* error) {
+    ControlWrite* w = &msg->writes[i];
+    w->done = 1;
+    w->ok = error == NULL;
+    w->error = error;
+    w->latencyMs = monotonic_ms() - msg->receivedMs;
+    return --msg->remaining;
+}
+
+// the WritePropertyMultiple to the device is done. the message is freed
+// after its last write
+static void control_writes_done(ControlMsg* msg, uint32_t device, uint8_t invokeId,
+    const char* error) {
+    int i = 0;
+    for (i = 0; i < msg->num; i++) {
+        ControlWrite* w = &msg->writes[i];
+        if (w->issued && ! w->done && w->device == device && w->invokeId == invokeId) {
+            control_write_done(msg, i, error);
+        }
+    }
+    if (msg->remaining == 0) {
+        finish_control_msg(msg);
+    }
+}
+
+// the tsm gave up on the request after the retries
+static void request_timed_out(InflightRequest* req) {
+    logger_debug("request %d to device %u timed out", req->invokeId, req->device);
+    counter_add(&g_vars->g_poll_errors, 1);
+    if (req->target != NULL) {
+        req->target->timeouts++;
+    }
+    device_congested(req->target);
+    request_failed(req, req->policy);
+    if (req->control != NULL) {
+        control_writes_done(req->control, req->device, req->invokeId, "timeout");
+    }
+}
+
+int bac_inflight_requests() {
+    return g_inflight_count;
+}
+
+void retire_policy(PullPolicy* pPolicy) {
+    uint32_t processId = pPolicy->rtCovProcessId;
+    if (processId != 0 && g_cov_policies[processId % MAX_COV_POLICIES] == pPolicy) {
+        g_cov_policies[processId % MAX_COV_POLICIES] = NULL;
+    }
+    release_policy_history(pPolicy);
+    release_policy_aggregates(pPolicy);
+    release_request_templates(pPolicy);
+    // the acks still in flight are published as is, but the records of the
+    // logs are read again by the new policy, from the cursors it took over
+    pPolicy->historyMs = 0;
+    pPolicy->aggregateHopMs = 0;
+    pPolicy->rtRetired = 1;
+    // its points go to the properties of the new policies
+    int i = 0;
+    for (i = 0; i < pPolicy->propNum; i++) {
+        pPolicy->properties[i].rtSharedPoint = -1;
+        pPolicy->properties[i].rtShadowPoint = -1;
+    }
+}
 
 void set_global_vars(GlobalVar* pVars) {
     g_vars = pVars;
 }
 
 static void MyErrorHandler(
-    BACNET_ADDRESS * src,
-    uint8_t invoke_id,
+    InflightRequest* req,
     BACNET_ERROR_CLASS error_class,
     BACNET_ERROR_CODE error_code)
 {
     log_debug("MyErrorHandler");
+    counter_add(&g_vars->g_poll_errors, 1);
+    device_replied(req->target);
+    reply_failed(req, req->policy);
     printf("BACnet Error: %s: %s\r\n",
             bactext_error_class_name((int) error_class),
             bactext_error_code_name((int) error_code));
+    if (req->control != NULL) {
+        control_writes_done(req->control, req->device, req->invokeId,
+            bactext_error_code_name((int) error_code));
+    }
 }
 
-void MyAbortHandler(
-    BACNET_ADDRESS * src,
-    uint8_t invoke_id,
-    uint8_t abort_reason,
-    bool server)
+static void MyAbortHandler(
+    InflightRequest* req,
+    uint8_t abort_reason)
 {
-    (void) server;
     log_debug("MyAbortHandler");
+    counter_add(&g_vars->g_poll_errors, 1);
+    PullPolicy* policy = req->policy;
     printf("BACnet Abort: %s\r\n",
             bactext_abort_reason_name((int) abort_reason));
+    reply_failed(req, policy);
+    // the ack doesn't fit the apdu of the device, and segmentation is not
+    // supported here, split the properties into smaller requests
+    if (abort_reason == ABORT_REASON_SEGMENTATION_NOT_SUPPORTED
+        || abort_reason == ABORT_REASON_BUFFER_OVERFLOW) {
+        device_replied(req->target);
+        if (policy != NULL && req->service == SERVICE_CONFIRMED_READ_PROP_MULTIPLE && req->props > 1) {
+            policy->rtMaxProps = req->props / 2;
+            printf("reading at most %d properties per request from device %u\n",
+                policy->rtMaxProps, policy->targetInstanceNumber);
+        }
+    } else {
+        // e.g. out of resources, too many requests at once for the device
+        device_congested(req->target);
+    }
+    if (req->control != NULL) {
+        control_writes_done(req->control, req->device, req->invokeId,
+            bactext_abort_reason_name((int) abort_reason));
+    }
  }
 
-void MyRejectHandler(
-    BACNET_ADDRESS * src,
-    uint8_t invoke_id,
+static void MyRejectHandler(
+    InflightRequest* req,
     uint8_t reject_reason)
 {
     log_debug("MyRejectHandler");
+    counter_add(&g_vars->g_poll_errors, 1);
+    PullPolicy* policy = req->policy;
+    device_replied(req->target);
     printf("BACnet Reject: %s\r\n",
             bactext_reject_reason_name((int) reject_reason));
+    reply_failed(req, policy);
+    if (req->control != NULL) {
+        control_writes_done(req->control, req->device, req->invokeId,
+            bactext_reject_reason_name((int) reject_reason));
+    }
+    if (policy != NULL && req->service == SERVICE_CONFIRMED_READ_PROP_MULTIPLE
+        && reject_reason == REJECT_REASON_UNRECOGNIZED_SERVICE) {
+        printf("device %u doesn't support ReadPropertyMultiple, using ReadProperty\n",
+            policy->targetInstanceNumber);
+        policy->rtUseReadProperty = 1;
+    }
+}
+
+// the pages of data messages are published as they are written
+static void publish_data(char* msg, void* arg) {
+    (void) arg;
+    log_debug("received some BACNet data, going to publish it");
+    sendData(msg, g_vars);
+}
+
+static char* put_u16(char* p, unsigned v) {
+    *p++ = (char) (v >> 8);
+    *p++ = (char) v;
+    return p;
+}
+
+static char* put_u32(char* p, uint32_t v) {
+    p = put_u16(p, v >> 16);
+    return put_u16(p, v & 0xffff);
+}
+
+// publish the blocks of the policy as one binary message and start them over:
+//   0xBC, version 1, kind 2 (bacnet), the instance of this device(4), the
+//   target instance(4), the number of points(2), and for each point
+//   objectType(2), objectInstance(4), propertyId(4), arrayIndex(4) and the
+//   packed block, sample count(2), length(2) and the samples. big endian
+void publish_history(PullPolicy* policy) {
+    if (policy->rtHistory == NULL) {
+        return;
+    }
+    int i = 0;
+    int points = 0;
+    int len = 13;
+    for (i = 0; i < policy->propNum; i++) {
+        if (policy->rtHistory[i].count > 0) {
+            points++;
+            len += 14 + 4 + tsblock_bytes(&policy->rtHistory[i]);
+        }
+    }
+    if (points == 0) {
+        return;
+    }
+    char* msg = (char*) malloc(len);
+    if (msg != NULL) {
+        char* p = msg;
+        *p++ = (char) 0xBC;
+        *p++ = 1;
+        *p++ = 2;
+        p = put_u32(p, g_vars->g_config.device.instanceNumber);
+        p = put_u32(p, policy->targetInstanceNumber);
+        p = put_u16(p, points);
+        for (i = 0; i < policy->propNum; i++) {
+            BacProperty* pProp = &policy->properties[i];
+            TsBlock* b = &policy->rtHistory[i];
+            if (b->count == 0) {
+                continue;
+            }
+            p = put_u16(p, pProp->objectType);
+            p = put_u32(p, pProp->objectInstance);
+            p = put_u32(p, pProp->property);
+            p = put_u32(p, pProp->index);
+            p += tsblock_pack(b, p, len - (p - msg));
+        }
+        log_debug("publishing the history blocks of a policy");
+        sendDataLen(msg, len, g_vars);
+    } else {
+        printf("ERROR:out of memory, the history of device %u is dropped\n",
+            policy->targetInstanceNumber);
+    }
+    for (i = 0; i < policy->propNum; i++) {
+        tsblock_reset(&policy->rtHistory[i]);
+    }
+}
+
+// the number of a single value, return 0 if it's not a number
+static int value_number(BACNET_APPLICATION_DATA_VIEW* value, double* number) {
+    if (value == NULL || value->next != NULL) {
+        return 0;
+    }
+    switch (value->tag) {
+    case BACNET_APPLICATION_TAG_BOOLEAN:
+        *number = value->type.Boolean;
+        break;
+    case BACNET_APPLICATION_TAG_UNSIGNED_INT:
+        *number = value->type.Unsigned_Int;
+        break;
+    case BACNET_APPLICATION_TAG_SIGNED_INT:
+        *number = value->type.Signed_Int;
+        break;
+    case BACNET_APPLICATION_TAG_REAL:
+        *number = value->type.Real;
+        break;
+    #if defined (BACAPP_DOUBLE)
+    case BACNET_APPLICATION_TAG_DOUBLE:
+        *number = value->type.Double;
+        break;
+    #endif
+    case BACNET_APPLICATION_TAG_ENUMERATED:
+        *number = value->type.Enumerated;
+        break;
+    default:
+        return 0;
+    }
+    return 1;
+}
+
+// the id of the first value of the property, as write_data_value has it
+static void shared_point_name(BacProperty* pProp, char* name, int len) {
+    uint32_t valueIndex = (pProp->index == BACNET_ARRAY_ALL ? 0 : pProp->index) + 1;
+    snprintf(name, len, "%s%u", pProp->idPrefix, valueIndex);
+}
+
+void layout_shared_points(Bac2mqttConfig* pconfig) {
+    layout_shadow_points(pconfig);
+    if (! g_vars->g_shared_points_started) {
+        return;
+    }
+    ShmPoints* t = &g_vars->g_shared_points;
+    shmp_begin_layout(t);
+    int full = 0;
+    PullPolicy* policy = NULL;
+    for (policy = pconfig->policyHeader.next; policy != NULL; policy = policy->next) {
+        int i = 0;
+        for (i = 0; i < policy->propNum; i++) {
+            BacProperty* pProp = &policy->properties[i];
+            pProp->rtSharedPoint = -1;
+            if (pProp->idPrefix == NULL || full) {
+                continue;
+            }
+            char name[SHMP_NAME_LEN];
+            shared_point_name(pProp, name, sizeof(name));
+            pProp->rtSharedPoint = shmp_add(t, name);
+            full = pProp->rtSharedPoint < 0;
+        }
+    }
+    shmp_end_layout(t);
+    if (full) {
+        printf("ERROR:the shared memory table is full, some of the properties are left out\n");
+    }
+}
+
+void layout_shadow_points(Bac2mqttConfig* pconfig) {
+    ShadowMirror* m = g_vars->g_shadow_mirror;
+    if (m == NULL) {
+        return;
+    }
+    shadow_mirror_begin_layout(m);
+    PullPolicy* policy = NULL;
+    for (policy = pconfig->policyHeader.next; policy != NULL; policy = policy->next) {
+        int i = 0;
+        for (i = 0; i < policy->propNum; i++) {
+            BacProperty* pProp = &policy->properties[i];
+            pProp->rtShadowPoint = -1;
+            if (pProp->idPrefix == NULL) {
+                continue;
+            }
+            char name[SHMP_NAME_LEN];
+            shared_point_name(pProp, name, sizeof(name));
+            if (shadow_mirror_has(m, name)) {
+                pProp->rtShadowPoint = shadow_mirror_add(m, name);
+            }
+        }
+    }
+    shadow_mirror_end_layout(m);
+}
+
+// write the number of the property found into its point in the shared memory
+// table and in the shadow mirror
+static void share_value(PullPolicy* policy, int found, BACNET_APPLICATION_DATA_VIEW* value) {
+    double number = 0;
+    if (found < 0 || (policy->properties[found].rtSharedPoint < 0
+        && policy->properties[found].rtShadowPoint < 0) || ! value_number(value, &number)) {
+        return;
+    }
+    if (policy->properties[found].rtSharedPoint >= 0) {
+        shmp_write(&g_vars->g_shared_points, policy->properties[found].rtSharedPoint, number,
+            realtime_ms());
+    }
+    shadow_mirror_write(g_vars->g_shadow_mirror, policy->properties[found].rtShadowPoint, number);
+}
+
+// the index of the property of the policy the value is of, -1 if none. from
+// the property after the last one, that's where the next value of an ack
+// usually is
+static int find_policy_property(PullPolicy* policy, BACNET_OBJECT_TYPE objectType,
+    uint32_t objectInstance, BACNET_PROPERTY_ID propertyId, uint32_t arrayIndex, int anyIndex) {
+    int n = 0;
+    for (n = 0; n < policy->propNum; n++) {
+        int i = (policy->rtPropCursor + n) % policy->propNum;
+        BacProperty* pProp = &policy->properties[i];
+        if (pProp->objectType == objectType && pProp->objectInstance == objectInstance
+            && pProp->property == propertyId && (anyIndex || pProp->index == arrayIndex)) {
+            policy->rtPropCursor = (i + 1) % policy->propNum;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// the property of the policy found, or the identity of a value which is not
+// of one, in other. its names are then looked up as it's written
+static BacProperty* value_property(PullPolicy* policy, int found, BacProperty* other,
+    BACNET_OBJECT_TYPE objectType, uint32_t objectInstance, BACNET_PROPERTY_ID propertyId) {
+    if (found >= 0) {
+        return &policy->properties[found];
+    }
+    memset(other, 0, sizeof(BacProperty));
+    other->objectType = objectType;
+    other->objectInstance = objectInstance;
+    other->property = propertyId;
+    return other;
+}
+
+// with onChange, a polled number is only published once it moved more than
+// the deadband of its property since it was last published, or it has been
+// silent for maxSilence. the states, e.g. booleans, on any change. found is
+// the index of the property, from find_policy_property. return 1 if the value
+// is dropped
+static int value_unchanged(PullPolicy* policy, int found,
+    BACNET_APPLICATION_DATA_VIEW* value) {
+    double number = 0;
+    if (! policy->onChange || ! value_number(value, &number)) {
+        return 0;
+    }
+    if (found < 0) {
+        return 0;
+    }
+    BacProperty* pProp = &policy->properties[found];
+    double deadband = pProp->deadband;
+    if (value->tag == BACNET_APPLICATION_TAG_BOOLEAN || value->tag == BACNET_APPLICATION_TAG_ENUMERATED) {
+        deadband = 0;
+    }
+    long long now = monotonic_ms();
+    if (pProp->rtLastValid && fabs(number - pProp->rtLastValue) <= deadband
+        && (policy->maxSilence <= 0 || now - pProp->rtLastPublish < policy->maxSilence)) {
+        counter_add(&g_vars->g_values_unchanged, 1);
+        return 1;
+    }
+    pProp->rtLastValid = 1;
+    pProp->rtLastValue = number;
+    pProp->rtLastPublish = now;
+    return 0;
+}
+
+// append a sample to the block of the property found, the blocks of the
+// policy are allocated with the first one. a full block publishes them all
+// first. return 0 on success, -1 if out of memory
+static int history_append(PullPolicy* policy, int found, long long ts, double number) {
+    if (policy->rtHistory == NULL) {
+        TsBlock* blocks = (TsBlock*) calloc(policy->propNum, sizeof(TsBlock));
+        int i = 0;
+        for (i = 0; blocks != NULL && i < policy->propNum; i++) {
+            if (tsblock_init(&blocks[i], HISTORY_BLOCK_BYTES) != 0) {
+                break;
+            }
+        }
+        if (blocks == NULL || i < policy->propNum) {
+            while (blocks != NULL && --i >= 0) {
+                tsblock_destroy(&blocks[i]);
+            }
+            free(blocks);
+            return -1;
+        }
+        policy->rtHistory = blocks;
+    }
+    TsBlock* b = &policy->rtHistory[found];
+    if (tsblock_full(b)) {
+        publish_history(policy);
+    }
+    int empty = 1;
+    int i = 0;
+    for (i = 0; i < policy->propNum && empty; i++) {
+        empty = policy->rtHistory[i].count == 0;
+    }
+    if (empty) {
+        policy->rtHistoryStart = monotonic_ms();
+    }
+    // the clock of a device may go back, e.g. at the end of the summer time
+    if (b->count > 0 && ts < b->lastTs) {
+        ts = b->lastTs;
+    }
+    tsblock_append(b, ts, number);
+    return 0;
+}
+
+// the single numbers go into the blocks of the properties, found is the
+// index of the property. return 1 if the value is kept there, 0 if it's to be
+// published as json
+static int record_history(PullPolicy* policy, int found,
+    BACNET_APPLICATION_DATA_VIEW* value) {
+    double number = 0;
+    if (policy->historyMs <= 0 || policy->propNum == 0 || ! value_number(value, &number)) {
+        return 0;
+    }
+    if (found < 0) {
+        return 0;
+    }
+    if (history_append(policy, found, realtime_ms(), number) != 0) {
+        printf("ERROR:out of memory for the history of device %u, publishing the values\n",
+            policy->targetInstanceNumber);
+        policy->historyMs = 0;
+        return 0;
+    }
+    if (monotonic_ms() - policy->rtHistoryStart >= policy->historyMs) {
+        publish_history(policy);
+    }
+    return 1;
+}
+
+void flush_policy_history(Bac2mqttConfig* pconfig) {
+    PullPolicy* policy = NULL;
+    for (policy = pconfig->policyHeader.next; policy != NULL; policy = policy->next) {
+        publish_history(policy);
+    }
+}
+
+void release_policy_history(PullPolicy* pPolicy) {
+    int i = 0;
+    if (pPolicy->rtHistory == NULL) {
+        return;
+    }
+    for (i = 0; i < pPolicy->propNum; i++) {
+        tsblock_destroy(&pPolicy->rtHistory[i]);
+    }
+    free(pPolicy->rtHistory);
+    pPolicy->rtHistory = NULL;
+}
+
+void release_policy_aggregates(PullPolicy* pPolicy) {
+    int i = 0;
+    if (pPolicy->rtAggregates == NULL) {
+        return;
+    }
+    for (i = 0; i < pPolicy->propNum; i++) {
+        agg_destroy(&pPolicy->rtAggregates[i]);
+    }
+    free(pPolicy->rtAggregates);
+    pPolicy->rtAggregates = NULL;
+}
+
+// publish the summaries of the windows of the properties that have numbers
+static void publish_aggregates(PullPolicy* policy) {
+    DataWriter dw;
+    AggStats stats;
+    int i = 0;
+    data_writer_init(&dw, &g_vars->g_config.device, publish_data, NULL);
+    for (i = 0; i < policy->propNum; i++) {
+        agg_summary(&policy->rtAggregates[i], &stats);
+        if (stats.count > 0) {
+            data_writer_add_summary(&dw, policy->targetInstanceNumber, &policy->properties[i],
+                policy->aggregateHopMs * policy->aggregatePanes, &stats);
+        }
+    }
+    data_writer_flush(&dw);
+}
+
+// the single numbers go into the windows of the properties, found is the
+// index of the property. the summaries go out with the first number after
+// each hop. return 1 if the number is kept there, 0 if it's to be published
+// as json, e.g. out of the alarm limits of its property or just back in
+static int aggregate_value(PullPolicy* policy, int found,
+    BACNET_APPLICATION_DATA_VIEW* value) {
+    double number = 0;
+    int i = 0;
+    if (policy->aggregateHopMs <= 0 || found < 0 || ! value_number(value, &number)) {
+        return 0;
+    }
+    long long now = monotonic_ms();
+    if (policy->rtAggregates == NULL) {
+        AggWindow* windows = (AggWindow*) calloc(policy->propNum, sizeof(AggWindow));
+        for (i = 0; windows != NULL && i < policy->propNum; i++) {
+            if (agg_init(&windows[i], policy->aggregatePanes) != 0) {
+                break;
+            }
+        }
+        if (windows == NULL || i < policy->propNum) {
+            while (windows != NULL && --i >= 0) {
+                agg_destroy(&windows[i]);
+            }
+            free(windows);
+            printf("ERROR:out of memory for the windows of device %u, publishing the values\n",
+                policy->targetInstanceNumber);
+            policy->aggregateHopMs = 0;
+            return 0;
+        }
+        policy->rtAggregates = windows;
+        policy->rtAggregateStart = now;
+    }
+    long long hops = (now - policy->rtAggregateStart) / policy->aggregateHopMs;
+    if (hops > 0) {
+        publish_aggregates(policy);
+        policy->rtAggregateStart += hops * policy->aggregateHopMs;
+        // the hops without numbers, e.g. while the device is down, are empty
+        for (i = 0; i < policy->propNum; i++) {
+            long long slid = 0;
+            for (slid = 0; slid < hops && slid < policy->aggregatePanes; slid++) {
+                agg_slide(&policy->rtAggregates[i]);
+            }
+        }
+    }
+    BacProperty* pProp = &policy->properties[found];
+    agg_add(&policy->rtAggregates[found], number);
+    int alarm = number < pProp->alarmLow || number > pProp->alarmHigh;
+    int publish = alarm || pProp->rtAlarm;
+    pProp->rtAlarm = alarm;
+    return ! publish;
 }
 
-/** Handler for a ReadProperty ACK.
+/** Handler for a ReadProperty ACK, of the devices without ReadPropertyMultiple.
  * @ingroup DSRP
- * Doesn't actually do anything, except, for debugging, to
- * print out the ACK data of a matching request.
  *
+ * @param req [in] The request of the ack.
  * @param service_request [in] The contents of the service request.
  * @param service_len [in] The length of the service_request.
- * @param src [in] BACNET_ADDRESS of the source of the message
- * @param service_data [in] The BACNET_CONFIRMED_SERVICE_DATA information
- *                          decoded from the APDU header of this message.
-//  */
-void My_Read_Property_Ack_Handler(
+ */
+static void My_Read_Property_Ack_Handler(
+    InflightRequest * req,
+    uint8_t * service_request,
+    uint16_t service_len)
+{
+    int len = 0;
+    BACNET_READ_PROPERTY_DATA data;
+
+    log_debug("My_Read_Property_Ack_Handler");
+    rpm_arena_reset(&g_ack_arena);
+    PullPolicy* pPolicy = req->policy;
+    if (pPolicy == NULL) {
+        return;
+    }
+    // the acks of ReadPropertyMultiple before the device refused it
+    ack_pool_drain(pPolicy);
+    len = rp_ack_decode_service_request(service_request, service_len, &data);
+    if (len <= 0) {
+        fprintf(stderr, "RP Ack Malformed!\n");
+        return;
+    }
+    // the values of the property, one after another. the strings stay in
+    // the ack
+    BACNET_APPLICATION_DATA_VIEW* values = NULL;
+    BACNET_APPLICATION_DATA_VIEW** tail = &values;
+    uint8_t* apdu = data.application_data;
+    int apdu_len = data.application_data_len;
+    while (apdu_len > 0) {
+        BACNET_APPLICATION_DATA_VIEW* value = rpm_arena_alloc(&g_ack_arena,
+            sizeof(BACNET_APPLICATION_DATA_VIEW));
+        int value_len = 0;
+        if (value != NULL) {
+            value_len = bacapp_decode_application_view(apdu, (unsigned) apdu_len, value);
+        }
+        if (value_len <= 0) {
+            break;
+        }
+        *tail = value;
+        tail = &value->next;
+        apdu += value_len;
+        apdu_len -= value_len;
+    }
+    int found = find_policy_property(pPolicy, data.object_type, data.object_instance,
+        data.object_property, data.array_index, 0);
+    share_value(pPolicy, found, values);
+    if (record_history(pPolicy, found, values) || aggregate_value(pPolicy, found, values)
+        || value_unchanged(pPolicy, found, values)) {
+        return;
+    }
+    BacProperty other;
+    DataWriter dw;
+    data_writer_init(&dw, &g_vars->g_config.device, publish_data, NULL);
+    data_writer_add(&dw, pPolicy->targetInstanceNumber,
+        value_property(pPolicy, found, &other, data.object_type, data.object_instance,
+        data.object_property), data.array_index, values);
+    data_writer_flush(&dw);
+}
+
+// decode the ack of ReadPropertyMultiple into the arena and publish its
+// values. called by the receiver, or by the ack worker of the policy
+static void handle_rpm_ack(
+    PullPolicy * pPolicy,
+    uint8_t * service_request,
+    uint16_t service_len,
+    BACNET_RPM_ARENA * arena)
+{
+    int len = 0;
+    BACNET_READ_ACCESS_DATA *rpm_data;
+    BACNET_PROPERTY_REFERENCE *rpm_property;
+
+    rpm_arena_reset(arena);
+    rpm_data = rpm_arena_alloc(arena, sizeof(BACNET_READ_ACCESS_DATA));
+    if (rpm_data) {
+        len =
+            rpm_ack_decode_service_request_view(service_request, service_len,
+            rpm_data, arena);
+    }
+    if (len <= 0) {
+        fprintf(stderr, "RPM Ack Malformed!\n");
+        return;
+    }
+    DataWriter dw;
+    data_writer_init(&dw, &g_vars->g_config.device, publish_data, NULL);
+    for (; rpm_data; rpm_data = rpm_data->next) {
+        for (rpm_property = rpm_data->listOfProperties; rpm_property; 
+            rpm_property = rpm_property->next) {
+            // the property the names of the value come from, once for all
+            int found = find_policy_property(pPolicy, rpm_data->object_type,
+                rpm_data->object_instance, rpm_property->propertyIdentifier,
+                rpm_property->propertyArrayIndex, 0);
+            share_value(pPolicy, found, rpm_property->view);
+            if (record_history(pPolicy, found, rpm_property->view)
+                || aggregate_value(pPolicy, found, rpm_property->view)
+                || value_unchanged(pPolicy, found, rpm_property->view)) {
+                continue;
+            }
+            BacProperty other;
+            data_writer_add(&dw, pPolicy->targetInstanceNumber,
+                value_property(pPolicy, found, &other, rpm_data->object_type,
+                rpm_data->object_instance, rpm_property->propertyIdentifier),
+                rpm_property->propertyArrayIndex, rpm_property->view);
+        }
+    }
+    data_writer_flush(&dw);
+}
+
+// an ack handled by an ack worker, the policy is no longer held by it
+static void rpm_ack_done(PullPolicy* pPolicy) {
+    if (pPolicy->rtReqPending > 0) {
+        pPolicy->rtReqPending--;
+    }
+}
+
+/** Handler for a ReadPropertyMultiple ACK.
+ * @ingroup DSRPM
+ * The ack is decoded into views in the arena, so that its nodes are released
+ * at once by the next ack instead of one by one, and its strings aren't
+ * copied. With ackWorkers, a copy of the ack is queued to the worker of the
+ * policy instead, the policy counts as in flight until it's done; the cov
+ * policies, whose notifications the receiver handles, are not queued.
+ *
+ * @param req [in] The request of the ack.
+ * @param service_request [in] The contents of the service request.
+ * @param service_len [in] The length of the service_request.
+ */
+static void My_Read_Property_Multiple_Ack_Handler(
+    InflightRequest * req,
+    uint8_t * service_request,
+    uint16_t service_len)
+{
+    PullPolicy* pPolicy = req->policy;
+    if (pPolicy == NULL) {
+        return;
+    }
+    if (! pPolicy->covMode
+        && ack_pool_submit(pPolicy, service_request, service_len) == 0) {
+        pPolicy->rtReqPending++;
+        return;
+    }
+    handle_rpm_ack(pPolicy, service_request, service_len, &g_ack_arena);
+}
+
+// the length of the element at apdu, of a constructed one up to its closing
+// tag. -1 if it runs past apdu_len
+static int element_len(uint8_t* apdu, int apdu_len) {
+    int depth = 0;
+    int len = 0;
+    do {
+        uint8_t tag = 0;
+        uint32_t lvt = 0;
+        if (len >= apdu_len) {
+            return -1;
+        }
+        uint8_t first = apdu[len];
+        len += decode_tag_number_and_value(&apdu[len], &tag, &lvt);
+        if (IS_CONTEXT_SPECIFIC(first) && IS_OPENING_TAG(first)) {
+            depth++;
+        } else if (IS_CONTEXT_SPECIFIC(first) && IS_CLOSING_TAG(first)) {
+            depth--;
+        } else if (IS_CONTEXT_SPECIFIC(first) || tag != BACNET_APPLICATION_TAG_BOOLEAN) {
+            len += lvt;
+        }
+    } while (depth > 0);
+    return depth == 0 && len <= apdu_len ? len : -1;
+}
+
+// one BACnetLogRecord of the buffer of a trend log: the timestamp [0], the
+// datum [1] and the optional status flags [2]. isNumber is set if the datum
+// is a boolean, real, enumerated, unsigned or signed, the status, failure and
+// time change records are skipped. return its length, -1 if it's malformed
+static int decode_log_record(uint8_t* apdu, int apdu_len, BACNET_DATE_TIME* stamp,
+    int* isNumber, double* number) {
+    uint8_t tag = 0;
+    uint32_t lvt = 0;
+    *isNumber = 0;
+    // the date and the time take 10 octets
+    if (apdu_len < 15) {
+        return -1;
+    }
+    int len = bacapp_decode_context_datetime(apdu, 0, stamp);
+    if (len <= 0 || len + 2 > apdu_len || ! decode_is_opening_tag_number(&apdu[len], 1)) {
+        return -1;
+    }
+    len++;
+    uint8_t first = apdu[len];
+    int datum_len = element_len(&apdu[len], apdu_len - len);
+    if (datum_len < 0 || ! IS_CONTEXT_SPECIFIC(first)) {
+        return -1;
+    }
+    uint8_t* value = &apdu[len + decode_tag_number_and_value(&apdu[len], &tag, &lvt)];
+    if (! IS_OPENING_TAG(first)) {
+        float real = 0;
+        uint32_t unsigned_value = 0;
+        int32_t signed_value = 0;
+        *isNumber = 1;
+        if (tag == TL_TYPE_BOOL && lvt == 1) {
+            *number = value[0] ? 1 : 0;
+        } else if (tag == TL_TYPE_REAL && lvt == 4) {
+            decode_real(value, &real);
+            *number = real;
+        } else if ((tag == TL_TYPE_ENUM || tag == TL_TYPE_UNSIGN) && lvt <= 4) {
+            decode_unsigned(value, lvt, &unsigned_value);
+            *number = unsigned_value;
+        } else if (tag == TL_TYPE_SIGN && lvt <= 4) {
+            decode_signed(value, lvt, &signed_value);
+            *number = signed_value;
+        } else {
+            *isNumber = 0;
+        }
+    }
+    len += datum_len;
+    if (len >= apdu_len || ! decode_is_closing_tag_number(&apdu[len], 1)) {
+        return -1;
+    }
+    len++;
+    if (len < apdu_len && decode_is_context_tag(&apdu[len], 2)) {
+        int flags_len = element_len(&apdu[len], apdu_len - len);
+        if (flags_len < 0) {
+            return -1;
+        }
+        len += flags_len;
+    }
+    return len;
+}
+
+/** Handler for a ReadRange ACK of the buffer of a trend log.
+ * The numbers of the records go into the history block of the log with the
+ * timestamps of the records, the cursor of the log moves past them, and the
+ * rest of the new records is read at once if they didn't fit the ack. The
+ * blocks are published once the reads of the run are done, or every
+ * historyMs if it's set.
+ *
+ * @param req [in] The request of the ack.
+ * @param service_request [in] The contents of the service request.
+ * @param service_len [in] The length of the service_request.
+ */
+static void My_Read_Range_Ack_Handler(
+    InflightRequest * req,
+    uint8_t * service_request,
+    uint16_t service_len)
+{
+    BACNET_READ_RANGE_DATA data;
+
+    log_debug("My_Read_Range_Ack_Handler");
+    PullPolicy* pPolicy = req->policy;
+    if (pPolicy == NULL || pPolicy->rtRetired) {
+        return;
+    }
+    memset(&data, 0, sizeof(data));
+    if (rr_ack_decode_service_request(service_request, service_len, &data) <= 0) {
+        fprintf(stderr, "RR Ack Malformed!\n");
+        return;
+    }
+    int found = find_policy_property(pPolicy, data.object_type, data.object_instance,
+        data.object_property, data.array_index, 1);
+    if (found < 0) {
+        return;
+    }
+    BacProperty* pProp = &pPolicy->properties[found];
+    // the records are stamped in the local time of the device, taken to be
+    // the one of the gateway
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    long long offset = local.tm_gmtoff;
+    uint8_t* apdu = data.application_data;
+    int apdu_len = (int) data.application_data_len;
+    uint32_t kept = 0;
+    while (kept < data.ItemCount && apdu_len > 0) {
+        BACNET_DATE_TIME stamp;
+        int isNumber = 0;
+        double number = 0;
+        int len = decode_log_record(apdu, apdu_len, &stamp, &isNumber, &number);
+        if (len <= 0) {
+            fprintf(stderr, "log record %lu of trend log %u of device %u is malformed\n",
+                (unsigned long) (data.FirstSequence + kept), pProp->objectInstance,
+                pPolicy->targetInstanceNumber);
+            kept = data.ItemCount;
+            break;
+        }
+        long long ts = ((long long) datetime_seconds_since_unix_epoch(&stamp) - offset) * 1000
+            + stamp.time.hundredths * 10;
+        if (isNumber && history_append(pPolicy, found, ts, number) != 0) {
+            printf("ERROR:out of memory for the history of device %u, the log is read again later\n",
+                pPolicy->targetInstanceNumber);
+            break;
+        }
+        kept++;
+        apdu += len;
+        apdu_len -= len;
+    }
+    // the first sequence number comes with the records
+    if (kept > 0) {
+        pProp->rtLogNext = (data.FirstSequence != 0 ? data.FirstSequence : pProp->rtLogNext) + kept;
+    }
+    if (kept == data.ItemCount && data.ItemCount > 0
+        && bitstring_bit(&data.ResultFlags, RESULT_FLAG_MORE_ITEMS)
+        && continue_log_read(pPolicy, found) == 0) {
+        return;
+    }
+    if (pPolicy->rtReqPending == 0 && (pPolicy->historyMs <= 0
+        || monotonic_ms() - pPolicy->rtHistoryStart >= pPolicy->historyMs)) {
+        publish_history(pPolicy);
+    }
+}
+
+/** Handler for the SimpleACK of a SubscribeCOVProperty, the subscription
+ * is active once all the properties of the policy are acked.
+ *
+ * @param req [in] The request of the ack.
+ */
+static void My_Subscribe_COV_Ack_Handler(
+    InflightRequest * req)
+{
+    log_debug("My_Subscribe_COV_Ack_Handler");
+    PullPolicy* policy = req->policy;
+    if (policy != NULL && policy->rtReqPending == 0 && policy->rtCovState == COV_SUBSCRIBING) {
+        policy->rtCovState = COV_ACTIVE;
+    }
+}
+
+/** Handler for an Unconfirmed COV Notification, the changed values of the
+ * subscribed properties are published as they arrive.
+ *
+ * @param service_request [in] The contents of the service request.
+ * @param service_len [in] The length of the service_request.
+ * @param src [in] BACNET_ADDRESS of the source of the message
+ */
+static void My_COV_Notification_Handler(
     uint8_t * service_request,
     uint16_t service_len,
-    BACNET_ADDRESS * src,
-    BACNET_CONFIRMED_SERVICE_ACK_DATA * service_data)
+    BACNET_ADDRESS * src)
 {
-    int len = 0;
-    BACNET_READ_PROPERTY_DATA data;
+    BACNET_COV_DATA cov_data;
+    BACNET_PROPERTY_VALUE property_value[MAX_COV_VALUES];
+    BACNET_PROPERTY_VALUE *pProperty_value = NULL;
+    int i = 0;
 
-    log_debug("My_Read_Property_Ack_Handler");
-    len = rp_ack_decode_service_request(service_request, service_len, &data);
-    if (len > 0) {
-        rp_ack_print_data(&data);
+    (void) src;
+    log_debug("My_COV_Notification_Handler");
+    memset(property_value, 0, sizeof(property_value));
+    for (i = 0; i < MAX_COV_VALUES; i++) {
+        property_value[i].next = i + 1 < MAX_COV_VALUES ? &property_value[i + 1] : NULL;
     }
-}
+    cov_data.listOfValues = &property_value[0];
+    if (cov_notify_decode_service_request(service_request, service_len, &cov_data) <= 0) {
+        fprintf(stderr, "COV Notification Malformed!\n");
+        return;
+    }
+    // ignore the subscriptions we don't know, e.g. of the policies before a reload
+    uint32_t processId = cov_data.subscriberProcessIdentifier;
+    PullPolicy* pPolicy = g_cov_policies[processId % MAX_COV_POLICIES];
+    if (pPolicy == NULL || pPolicy->rtCovProcessId != processId
+        || pPolicy->targetInstanceNumber != cov_data.initiatingDeviceIdentifier) {
+        return;
+    }
+    counter_add(&g_vars->g_cov_notifications, 1);
 
-PullPolicy* findPullPolicy(BACNET_ADDRESS * srcAddr, uint8_t invokeId) {
-    PullPolicy* pPolicy = g_vars->g_config.policyHeader.next;
-    while (pPolicy) {
-        if (pPolicy->rtAddressBund == 1
-            && address_match(&pPolicy->rtTargetAddress, srcAddr)
-            && pPolicy->rtReqInvokeId == invokeId) {
-            return pPolicy;
+    // only the configured properties, the notification also carries the status flags
+    DataWriter dw;
+    data_writer_init(&dw, &g_vars->g_config.device, publish_data, NULL);
+    for (pProperty_value = cov_data.listOfValues; pProperty_value; pProperty_value = pProperty_value->next) {
+        for (i = 0; i < pPolicy->propNum; i++) {
+            BacProperty* pProp = &pPolicy->properties[i];
+            if (pProp->objectType == cov_data.monitoredObjectIdentifier.type
+                && pProp->objectInstance == cov_data.monitoredObjectIdentifier.instance
+                && pProp->property == pProperty_value->propertyIdentifier) {
+                BACNET_APPLICATION_DATA_VIEW view;
+                bacapp_value_to_view(&pProperty_value->value, &view);
+                share_value(pPolicy, i, &view);
+                if (record_history(pPolicy, i, &view) || aggregate_value(pPolicy, i, &view)) {
+                    break;
+                }
+                data_writer_add(&dw, pPolicy->targetInstanceNumber, pProp,
+                    pProperty_value->propertyArrayIndex, &view);
+                break;
+            }
         }
-        pPolicy = pPolicy->next;
     }
+    data_writer_flush(&dw);
+}
+
+// acknowledge the alarm for the operator, to the address it came from. the
+// reply only counts for the window of the device, a failure is logged
+static void issue_alarm_ack(BACNET_EVENT_NOTIFICATION_DATA* data, BACNET_ADDRESS* src) {
+    BACNET_ALARM_ACK_DATA ack;
+    BACNET_NPDU_DATA npdu_data;
+    BACNET_ADDRESS my_address;
+    BACNET_ADDRESS dest = *src;
+    uint32_t device = data->initiatingObjectIdentifier.instance;
+
+    uint8_t invoke_id = tsm_next_free_invokeID_peer(&dest);
+    if (invoke_id == 0) {
+        logger_debug("no invoke id to acknowledge the alarm of device %u", device);
+        return;
+    }
+    ack.ackProcessIdentifier = data->processIdentifier;
+    ack.eventObjectIdentifier = data->eventObjectIdentifier;
+    ack.eventStateAcked = data->toState;
+    ack.eventTimeStamp = data->timeStamp;
+    characterstring_init_ansi(&ack.ackSource, "bdBacnetGateway");
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    ack.ackTimeStamp.tag = TIME_STAMP_DATETIME;
+    datetime_set_values(&ack.ackTimeStamp.value.dateTime, (uint16_t) (local.tm_year + 1900),
+        (uint8_t) (local.tm_mon + 1), (uint8_t) local.tm_mday, (uint8_t) local.tm_hour,
+        (uint8_t) local.tm_min, (uint8_t) local.tm_sec, 0);
 
-    return NULL;
+    datalink_get_my_address(&my_address);
+    npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_URGENT);
+    int pdu_len = npdu_encode_pdu(&Handler_Transmit_Buffer[0], &dest, &my_address, &npdu_data);
+    pdu_len += alarm_ack_encode_apdu(&Handler_Transmit_Buffer[pdu_len], invoke_id, &ack);
+    tsm_set_confirmed_unsegmented_transaction(invoke_id, &dest,
+        &npdu_data, &Handler_Transmit_Buffer[0], (uint16_t) pdu_len);
+    if (datalink_send_pdu(&dest, &npdu_data, &Handler_Transmit_Buffer[0], pdu_len) <= 0) {
+        fprintf(stderr, "Failed to Send AcknowledgeAlarm Request!\n");
+    }
+    InflightRequest* req = new_inflight(find_target(device), device, &dest, invoke_id, 0,
+        SERVICE_CONFIRMED_ACKNOWLEDGE_ALARM);
+    if (req != NULL) {
+        req->alarmAck = 1;
+    }
+    counter_add(&g_vars->g_alarm_acks, 1);
 }
 
-void release_output_data(BacValueOutput* phead) {
-    while (phead) {
-        free(phead->value);
-        free(phead->id);
-        BacValueOutput* to_free = phead;
-        phead = phead->next;
-        free(to_free);
+// the alarms and events don't go through the data path: no paging, history
+// or aggregation, they are published on the urgent queue of the mqtt client
+// as soon as they are decoded
+static void publish_event_notification(BACNET_EVENT_NOTIFICATION_DATA* data,
+    BACNET_ADDRESS* src) {
+    counter_add(&g_vars->g_event_notifications, 1);
+    sendAlarm(eventNotification2json(data, &g_vars->g_config.device), g_vars);
+    if (data->ackRequired && data->notifyType != NOTIFY_ACK_NOTIFICATION
+        && g_vars->g_mqtt_info.alarmAutoAck) {
+        issue_alarm_ack(data, src);
     }
 }
 
-const char* value_tag_to_text(uint8_t tag) {
-    const char* ret = "Unknown";
-    switch(tag) {
-    case BACNET_APPLICATION_TAG_NULL:
-        ret = "Null";
-        break;
-    case BACNET_APPLICATION_TAG_BOOLEAN:
-        ret = "Boolean";
-        break;
-    case BACNET_APPLICATION_TAG_UNSIGNED_INT:
-        ret = "Uint";
-        break;
-    case BACNET_APPLICATION_TAG_SIGNED_INT:
-        ret = "Int";
-        break;
-    case BACNET_APPLICATION_TAG_REAL:
-        ret = "Double";
-        break;
-    #if defined (BACAPP_DOUBLE)
-    case BACNET_APPLICATION_TAG_DOUBLE:
-        ret = "Double";
-        break;
-    #endif
-        default:
-        ret = "Unknown";
+/** Handler for an Unconfirmed Event Notification of an alarm or event.
+ *
+ * @param service_request [in] The contents of the service request.
+ * @param service_len [in] The length of the service_request.
+ * @param src [in] BACNET_ADDRESS of the source of the message
+ */
+static void My_Unconfirmed_Event_Notification_Handler(
+    uint8_t * service_request,
+    uint16_t service_len,
+    BACNET_ADDRESS * src)
+{
+    BACNET_EVENT_NOTIFICATION_DATA data;
+    BACNET_CHARACTER_STRING message;
+
+    log_debug("My_Unconfirmed_Event_Notification_Handler");
+    memset(&data, 0, sizeof(data));
+    data.messageText = &message;
+    if (event_notify_decode_service_request(service_request, service_len, &data) <= 0) {
+        fprintf(stderr, "Event Notification Malformed!\n");
+        return;
     }
-    return ret;
+    publish_event_notification(&data, src);
 }
 
-/** Handler for a ReadPropertyMultiple ACK.
- * @ingroup DSRPM
- * For each read property, print out the ACK'd data,
- * and free the request data items from linked property list.
+/** Handler for a Confirmed Event Notification, the Simple Ack goes out before
+ * the alarm is published so that the device doesn't retry meanwhile.
  *
  * @param service_request [in] The contents of the service request.
  * @param service_len [in] The length of the service_request.
@@ -180,134 +1248,104 @@ const char* value_tag_to_text(uint8_t tag) {
  * @param service_data [in] The BACNET_CONFIRMED_SERVICE_DATA information
  *                          decoded from the APDU header of this message.
  */
-void My_Read_Property_Multiple_Ack_Handler(
+static void My_Confirmed_Event_Notification_Handler(
     uint8_t * service_request,
     uint16_t service_len,
     BACNET_ADDRESS * src,
-    BACNET_CONFIRMED_SERVICE_ACK_DATA * service_data)
+    BACNET_CONFIRMED_SERVICE_DATA * service_data)
 {
+    BACNET_EVENT_NOTIFICATION_DATA data;
+    BACNET_CHARACTER_STRING message;
+    BACNET_NPDU_DATA npdu_data;
+    BACNET_ADDRESS my_address;
+    int decoded = 0;
     int len = 0;
-    BACNET_READ_ACCESS_DATA *rpm_data;
-    BACNET_READ_ACCESS_DATA *old_rpm_data;
-    BACNET_PROPERTY_REFERENCE *rpm_property;
-    BACNET_PROPERTY_REFERENCE *old_rpm_property;
-    BACNET_APPLICATION_DATA_VALUE *value;
-    BACNET_APPLICATION_DATA_VALUE *old_value;
-    BACNET_OBJECT_PROPERTY_VALUE object_value;
-
-    BacValueOutput* result = NULL;
-    PullPolicy* pPolicy = findPullPolicy(src, service_data->invoke_id);
-    if (pPolicy != NULL) {
-        rpm_data = calloc(1, sizeof(BACNET_READ_ACCESS_DATA));
-        if (rpm_data) {
-            len =
-                rpm_ack_decode_service_request(service_request, service_len,
-                rpm_data);
-        }
-        if (len > 0) {
-            while (rpm_data) {
-                object_value.object_type = rpm_data->object_type;
-                object_value.object_instance = rpm_data->object_instance;
-
-                //rpm_ack_print_data(rpm_data);
-                BACNET_PROPERTY_REFERENCE *listOfProperties = rpm_data->listOfProperties;
-                while (listOfProperties) {
-                    BACNET_APPLICATION_DATA_VALUE *value = listOfProperties->value;
-                    uint32_t valueIndex = listOfProperties->propertyArrayIndex;
-                    if (listOfProperties->propertyArrayIndex == BACNET_ARRAY_ALL) {
-                        valueIndex = 0;
-                    }
-                    while (value) {
-                        valueIndex++;
-                        BacValueOutput* outval = calloc(1, sizeof(BacValueOutput));
-                        outval->instanceNumber = pPolicy->targetInstanceNumber;
-                        outval->next = NULL;
-                        outval->objectType = bactext_object_type_name(rpm_data->object_type);
-                        outval->objectInstance = (int) rpm_data->object_instance;
-                        outval->propertyId = bactext_property_name(listOfProperties->propertyIdentifier);
-                        outval->index = valueIndex;
-                        outval->type = value_tag_to_text(value->tag);
-
-                        int buff_len = 256;
-                        char buff[256];
-                        {
-                            object_value.object_property = listOfProperties->propertyIdentifier;
-                            object_value.array_index = listOfProperties->propertyArrayIndex;
-                            object_value.value = value;
-                        }
-
-                        int actLen = bacapp_snprintf_value(buff, buff_len, &object_value);
-                        outval->value = (char*) malloc(actLen + 1);
-                        mystrncpy(outval->value, buff, actLen);
-
-                        int idLen = sprintf(buff, "inst_%d_%s_%d_%s_%d", outval->instanceNumber, outval->objectType, 
-                            outval->objectInstance, outval->propertyId, valueIndex);
-
-                        outval->id = (char*) malloc(idLen + 1);
-                        mystrncpy(outval->id, buff, idLen + 1);
-
-                        outval->next = result;
-                        result = outval;
-
-                        value = value->next;
-                    }
-
-                    listOfProperties = listOfProperties->next;
-                }
 
-                
-                //bacapp_snprintf_value
-                rpm_property = rpm_data->listOfProperties;
-                while (rpm_property) {
-                    value = rpm_property->value;
-                    while (value) {
-                        old_value = value;
-                        value = value->next;
-                        free(old_value);
-                    }
-                    old_rpm_property = rpm_property;
-                    rpm_property = rpm_property->next;
-                    free(old_rpm_property);
-                }
-                old_rpm_data = rpm_data;
-                rpm_data = rpm_data->next;
-                free(old_rpm_data);
-            }
-        } else {
-            fprintf(stderr, "RPM Ack Malformed! Freeing memory...\n");
-            while (rpm_data) {
-                rpm_property = rpm_data->listOfProperties;
-                while (rpm_property) {
-                    value = rpm_property->value;
-                    while (value) {
-                        old_value = value;
-                        value = value->next;
-                        free(old_value);
-                    }
-                    old_rpm_property = rpm_property;
-                    rpm_property = rpm_property->next;
-                    free(old_rpm_property);
-                }
-                old_rpm_data = rpm_data;
-                rpm_data = rpm_data->next;
-                free(old_rpm_data);
-            }
-        }
+    log_debug("My_Confirmed_Event_Notification_Handler");
+    memset(&data, 0, sizeof(data));
+    data.messageText = &message;
+    datalink_get_my_address(&my_address);
+    npdu_encode_npdu_data(&npdu_data, false, MESSAGE_PRIORITY_NORMAL);
+    int pdu_len = npdu_encode_pdu(&Handler_Transmit_Buffer[0], src, &my_address, &npdu_data);
+    if (service_data->segmented_message) {
+        len = abort_encode_apdu(&Handler_Transmit_Buffer[pdu_len], service_data->invoke_id,
+            ABORT_REASON_SEGMENTATION_NOT_SUPPORTED, true);
+    } else if (event_notify_decode_service_request(service_request, service_len, &data) <= 0) {
+        fprintf(stderr, "Event Notification Malformed!\n");
+        len = reject_encode_apdu(&Handler_Transmit_Buffer[pdu_len], service_data->invoke_id,
+            REJECT_REASON_MISSING_REQUIRED_PARAMETER);
+    } else {
+        decoded = 1;
+        len = encode_simple_ack(&Handler_Transmit_Buffer[pdu_len], service_data->invoke_id,
+            SERVICE_CONFIRMED_EVENT_NOTIFICATION);
+    }
+    pdu_len += len;
+    if (datalink_send_pdu(src, &npdu_data, &Handler_Transmit_Buffer[0], pdu_len) <= 0) {
+        fprintf(stderr, "Failed to Send Event Notification Reply!\n");
+    }
+    if (decoded) {
+        publish_event_notification(&data, src);
+    }
+}
+
+// all the writes of the WritePropertyMultiple succeeded
+static void My_Write_Property_Multiple_Ack_Handler(
+    InflightRequest * req)
+{
+    log_debug("My_Write_Property_Multiple_Ack_Handler");
+    if (req->control != NULL) {
+        control_writes_done(req->control, req->device, req->invokeId, NULL);
     }
+}
 
-    if (result != NULL) {
-        log_debug("received some BACNet data, going to publish it");
+// the completion of every request in flight, see tsm_set_completion. the
+// slot is released first, the reply may issue the next requests
+static void request_completed(
+    BACNET_ADDRESS * src,
+    uint8_t invoke_id,
+    BACNET_CONFIRMED_REPLY * reply,
+    void *context)
+{
+    InflightRequest req = *(InflightRequest*) context;
 
-        BacValueOutput* nextPage = NULL;
-        BacValueOutput* head = result;
-        while (head != NULL) {
-            // convert data into json and send to mqtt
-            char* msg = bacData2Json(head, &g_vars->g_config.device, &nextPage);
-            sendData(msg, g_vars);
-            head = nextPage;
-        }
-        // release the data allocated in result
-        release_output_data(result);
+    (void) src;
+    (void) invoke_id;
+    release_inflight((InflightRequest*) context);
+    if (reply->timeout) {
+        request_timed_out(&req);
+        return;
+    }
+    switch (reply->pdu_type) {
+        case PDU_TYPE_SIMPLE_ACK:
+        case PDU_TYPE_COMPLEX_ACK:
+            device_replied(req.target);
+            if (reply->service_choice != req.service) {
+                // not an ack of the request, the device is confused
+                reply_failed(&req, req.policy);
+            } else if (req.service == SERVICE_CONFIRMED_READ_PROPERTY) {
+                My_Read_Property_Ack_Handler(&req, reply->service_request, reply->service_len);
+            } else if (req.service == SERVICE_CONFIRMED_READ_PROP_MULTIPLE) {
+                My_Read_Property_Multiple_Ack_Handler(&req, reply->service_request,
+                    reply->service_len);
+            } else if (req.service == SERVICE_CONFIRMED_READ_RANGE) {
+                My_Read_Range_Ack_Handler(&req, reply->service_request, reply->service_len);
+            } else if (req.service == SERVICE_CONFIRMED_SUBSCRIBE_COV_PROPERTY) {
+                My_Subscribe_COV_Ack_Handler(&req);
+            } else if (req.service == SERVICE_CONFIRMED_WRITE_PROP_MULTIPLE) {
+                My_Write_Property_Multiple_Ack_Handler(&req);
+            }
+            break;
+        case PDU_TYPE_ERROR:
+            MyErrorHandler(&req, reply->error_class, reply->error_code);
+            break;
+        case PDU_TYPE_ABORT:
+            MyAbortHandler(&req, reply->reason);
+            break;
+        case PDU_TYPE_REJECT:
+            MyRejectHandler(&req, reply->reason);
+            break;
+        default:
+            break;
     }
 }
 
@@ -326,131 +1364,902 @@ static void Init_Service_Handlers(void)
     /* we must implement read property - it's required! */
     apdu_set_confirmed_handler(SERVICE_CONFIRMED_READ_PROPERTY,
         handler_read_property);
-    /* handle the data coming back from confirmed requests */
-    apdu_set_confirmed_ack_handler(SERVICE_CONFIRMED_READ_PROPERTY,
-        My_Read_Property_Ack_Handler);
+    /* the replies to our requests go to request_completed, by the tsm */
 
-    apdu_set_confirmed_ack_handler(SERVICE_CONFIRMED_READ_PROP_MULTIPLE,
-        My_Read_Property_Multiple_Ack_Handler);
-
-    /* handle any errors coming back */
-    apdu_set_error_handler(SERVICE_CONFIRMED_READ_PROPERTY, MyErrorHandler);
-    apdu_set_abort_handler(MyAbortHandler);
-    apdu_set_reject_handler(MyRejectHandler);
+    /* the notifications of the cov subscriptions */
+    apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_COV_NOTIFICATION,
+        My_COV_Notification_Handler);
+    /* the alarms and events the devices send to us */
+    apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_EVENT_NOTIFICATION,
+        My_Unconfirmed_Event_Notification_Handler);
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_EVENT_NOTIFICATION,
+        My_Confirmed_Event_Notification_Handler);
 }
 
-int start_local_bacnet_device(Bac2mqttConfig* pconfig) {
-    Device_Set_Object_Instance_Number(pconfig->device.instanceNumber);
+int start_bacnet_datalink() {
+    // the address cache and the handlers' sends belong to the context,
+    // the datalink (one socket) to the process
+    bacnet_context_enter(g_vars->g_bac_ctx);
     address_init();
+    // the devices bound before the restart need no Who-Is
+    address_bindings_load(ADDRESS_CACHE);
     Init_Service_Handlers();
+    // each device's timeout is learned from its replies, a slow MS/TP
+    // controller behind a router gets more than a fast b/ip one
+    tsm_adaptive_timeout_set(true);
+    rpm_arena_init(&g_ack_arena, ACK_ARENA_BLOCK);
     dlenv_init();
     atexit(datalink_cleanup);
+    bacnet_context_leave(g_vars->g_bac_ctx);
+
+    return 0;
+}
+
+// the datagrams received before stay in the socket until the receiver starts,
+// nobody is told of a wrong instance number meanwhile
+int start_local_bacnet_device(Bac2mqttConfig* pconfig) {
+    bacnet_context_enter(g_vars->g_bac_ctx);
+    Device_Set_Object_Instance_Number(pconfig->device.instanceNumber);
+    bacnet_context_leave(g_vars->g_bac_ctx);
 
     return 0;
 }
 
-void receive_and_handle() {
-    uint8_t Rx_Buf1[MAX_MPDU] = { 0 };
-    BACNET_ADDRESS src = {
-        0
-    };  /* address where message came from */
+static void save_address_cache() {
+    if (! address_bindings_save(ADDRESS_CACHE)) {
+        logger_debug("failed to save the device addresses to %s", ADDRESS_CACHE);
+    }
+}
+
+// the socket is readable: the datagrams read in a batch are all handled, the
+// loop isn't told about the ones already out of the socket
+static void on_datalink_readable(int fd, void* arg) {
+    BACNET_ADDRESS src;  /* address where message came from */
     uint16_t pdu_len = 0;
-    unsigned timeout = 100;     /* milliseconds */
 
-    /* returns 0 bytes on timeout */
-    pdu_len = datalink_receive(&src, &Rx_Buf1[0], MAX_MPDU, timeout);
-    /* process */
-    if (pdu_len) {
-        snprintf(LOG_BUFF, BUFF_LEN, "datalink_receive returned %d bytes", pdu_len);
-        log_debug(LOG_BUFF);
-        npdu_handler(&src, &Rx_Buf1[0], pdu_len);
+    bacnet_context_enter(g_vars->g_bac_ctx);
+    // the timers expire what was due before the replies
+    bactimer_run((uint32_t) monotonic_ms());
+    ack_pool_reap();
+    do {
+        memset(&src, 0, sizeof(src));
+        /* returns 0 bytes once there is nothing left */
+        pdu_len = datalink_receive(&src, &g_rx_buf[0], MAX_MPDU, 0);
+        if (pdu_len) {
+            npdu_handler(&src, &g_rx_buf[0], pdu_len);
+        }
+    } while (pdu_len);
+    // the acks of the batch queued to the workers go at once
+    ack_pool_kick();
+    bacnet_context_leave(g_vars->g_bac_ctx);
+}
+
+// the retries and the timeouts of the transactions, at the first deadline.
+// while there are none it's idle, a request sent after a long idle isn't
+// timed out by the time that passed before
+static uint32_t tsm_timer(uint32_t elapsed) {
+    tsm_timer_milliseconds((uint16_t) (elapsed > 60000 ? 60000 : elapsed));
+    return tsm_timer_remaining();
+}
+
+// the foreign devices registered with us expire by the second. they have a
+// grace of 30s past their time to live, looking every 10s is soon enough and
+// leaves the worker asleep while idle
+static uint32_t bvlc_timer(uint32_t elapsed) {
+    static uint32_t carry = 0;
+    carry += elapsed;
+    bvlc_maintenance_timer(carry / 1000);
+    carry %= 1000;
+    return BVLC_TIMER_MS;
+}
+
+static uint32_t save_timer(uint32_t elapsed) {
+    save_address_cache();
+    return ADDRESS_SAVE_MS;
+}
+
+int start_bac_receiver(EventLoop* loop) {
+    if (g_receiver_loop != NULL) {
+        return 0;
+    }
+    uint32_t now = (uint32_t) monotonic_ms();
+    bacnet_context_enter(g_vars->g_bac_ctx);
+    bactimer_register(&g_tsm_timer, tsm_timer, now, BACTIMER_IDLE);
+    bactimer_register(&g_bvlc_timer, bvlc_timer, now, BVLC_TIMER_MS);
+    bactimer_register(&g_save_timer, save_timer, now, ADDRESS_SAVE_MS);
+    bacnet_context_leave(g_vars->g_bac_ctx);
+    if (evloop_add(loop, bip_socket(), on_datalink_readable, NULL) != 0) {
+        printf("failed to start the bacnet receiver\n");
+        return -1;
+    }
+    g_receiver_loop = loop;
+    ack_pool_start(g_vars->g_mqtt_info.ackWorkers, handle_rpm_ack, rpm_ack_done, loop);
+    return 0;
+}
+
+long long bac_receiver_timers() {
+    if (g_receiver_loop == NULL) {
+        return 0;
+    }
+    long long now = monotonic_ms();
+    bacnet_context_enter(g_vars->g_bac_ctx);
+    // the requests just sent are timed from now
+    bactimer_due(&g_tsm_timer, (uint32_t) now, tsm_timer_remaining());
+    uint32_t next = bactimer_run((uint32_t) now);
+    bacnet_context_leave(g_vars->g_bac_ctx);
+    return next == BACTIMER_IDLE ? 0 : now + next;
+}
+
+void stop_bac_receiver() {
+    if (g_receiver_loop != NULL) {
+        evloop_remove(g_receiver_loop, bip_socket());
+        g_receiver_loop = NULL;
+        ack_pool_stop();
+        bacnet_context_enter(g_vars->g_bac_ctx);
+        bactimer_unregister(&g_tsm_timer);
+        bactimer_unregister(&g_bvlc_timer);
+        bactimer_unregister(&g_save_timer);
+        save_address_cache();
+        bacnet_context_leave(g_vars->g_bac_ctx);
+        rpm_arena_destroy(&g_ack_arena);
     }
 }
 
-int bind_bac_device_address(Bac2mqttConfig* pconfig) {
-    unsigned max_apdu = 0;
+// the binding of the device, created unbound the first time it's asked for.
+// NULL if out of memory
+static BacTarget* find_target(uint32_t instance) {
+    BacTarget** bucket = &g_targets[instance % TARGET_BUCKETS];
+    BacTarget* target = *bucket;
+    while (target != NULL && target->instance != instance) {
+        target = target->next;
+    }
+    if (target == NULL) {
+        target = (BacTarget*) calloc(1, sizeof(BacTarget));
+        if (target == NULL) {
+            return NULL;
+        }
+        target->instance = instance;
+        target->next = *bucket;
+        *bucket = target;
+    }
+    return target;
+}
+
+void bac_device_metrics(MetricsText* t) {
+    static const char* const names[] = {"bacnet_device_timeouts_total",
+        "bacnet_device_failures_total", "bacnet_device_inflight", "bacnet_device_window",
+        "bacnet_device_timeout_ms"};
+    static const char* const types[] = {"counter", "counter", "gauge", "gauge", "gauge"};
+    char labels[64];
+    int m = 0;
+    int i = 0;
+    bacnet_context_enter(g_vars->g_bac_ctx);
+    for (m = 0; m < 5; m++) {
+        mt_type(t, names[m], types[m]);
+        for (i = 0; i < TARGET_BUCKETS; i++) {
+            BacTarget* target = NULL;
+            for (target = g_targets[i]; target != NULL; target = target->next) {
+                double values[] = {(double) target->timeouts, (double) target->failures,
+                    target->inflight, target->window,
+                    target->bound ? tsm_peer_timeout(&target->address) : apdu_timeout()};
+                snprintf(labels, sizeof(labels), "device=\"%u\"", target->instance);
+                mt_value(t, names[m], labels, values[m]);
+            }
+        }
+    }
+    bacnet_context_leave(g_vars->g_bac_ctx);
+}
+
+void release_bac_targets() {
+    int i = 0;
+    for (i = 0; i < TARGET_BUCKETS; i++) {
+        while (g_targets[i] != NULL) {
+            BacTarget* tmp = g_targets[i];
+            g_targets[i] = tmp->next;
+            free(tmp);
+        }
+    }
+    free(g_whois_due);
+    g_whois_due = NULL;
+    g_whois_due_cap = 0;
+}
+
+// ip[:port] into the b/ip address of a device, return 0 if it's not valid
+static int parse_bip_address(const char* text, BACNET_ADDRESS* addr) {
+    char host[MAX_LEN];
+    struct in_addr ip;
+    uint16_t port = bip_get_port();
+    snprintf(host, MAX_LEN, "%s", text);
+    char* colon = strchr(host, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        port = htons((uint16_t) atoi(colon + 1));
+    }
+    if (inet_aton(host, &ip) == 0) {
+        return 0;
+    }
+    memset(addr, 0, sizeof(BACNET_ADDRESS));
+    memcpy(&addr->mac[0], &ip.s_addr, 4);
+    memcpy(&addr->mac[4], &port, 2);
+    addr->mac_len = 6;
+    return 1;
+}
+
+static int compare_target_instance(const void* a, const void* b) {
+    uint32_t x = (*(BacTarget* const*) a)->instance;
+    uint32_t y = (*(BacTarget* const*) b)->instance;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// the next Who-Is of the target waits twice as long, up to WHOIS_MAX_MS
+static void whois_sent(BacTarget* target, long long now) {
+    target->whoIsBackoffMs = target->whoIsBackoffMs == 0 ? WHOIS_MIN_MS
+        : (target->whoIsBackoffMs >= WHOIS_MAX_MS / 2 ? WHOIS_MAX_MS : target->whoIsBackoffMs * 2);
+    target->whoIsAt = now + target->whoIsBackoffMs;
+}
+
+static int add_whois_due(BacTarget* target, int num) {
+    if (num == g_whois_due_cap) {
+        int cap = g_whois_due_cap == 0 ? 64 : g_whois_due_cap * 2;
+        BacTarget** due = (BacTarget**) realloc(g_whois_due, cap * sizeof(BacTarget*));
+        if (due == NULL) {
+            return num;
+        }
+        g_whois_due = due;
+        g_whois_due_cap = cap;
+    }
+    g_whois_due[num] = target;
+    return num + 1;
+}
 
+long long bind_bac_device_address(Bac2mqttConfig* pconfig) {
     if (pconfig == NULL) {
         return -1;
     }
 
+    long long now = monotonic_ms();
+    int num = 0;
+    int sent = 0;
+    bacnet_context_enter(g_vars->g_bac_ctx);
+    g_bind_pass++;
     PullPolicy* pNext = pconfig->policyHeader.next;
     while (pNext != NULL) {
-        if (! pNext->rtAddressBund) {
-            pNext->rtAddressBund =
-            address_bind_request(pNext->targetInstanceNumber, &max_apdu,
-            &pNext->rtTargetAddress);
-            
-            if (! pNext->rtAddressBund) {
-                log_debug("sending WhoIs request");
-                Send_WhoIs(pNext->targetInstanceNumber, pNext->targetInstanceNumber);
+        if (pNext->rtTarget == NULL) {
+            pNext->rtTarget = find_target(pNext->targetInstanceNumber);
+            if (pNext->rtTarget != NULL && pNext->whoIsAddress != NULL
+                && ! parse_bip_address(pNext->whoIsAddress, &pNext->rtTarget->whoIsAddress)) {
+                printf("WARN:whoIsAddress %s of device %u is not ip[:port]\n",
+                    pNext->whoIsAddress, pNext->targetInstanceNumber);
             }
         }
+        BacTarget* target = pNext->rtTarget;
         pNext = pNext->next;
+        if (target == NULL || target->bound || target->whoIsPass == g_bind_pass) {
+            continue;
+        }
+        target->whoIsPass = g_bind_pass;
+        target->bound = address_bind_request(target->instance, &target->maxApdu,
+            &target->address);
+        if (! target->bound && target->whoIsAt <= now) {
+            num = add_whois_due(target, num);
+        }
     }
 
-    receive_and_handle();
-    return 0;
+    // the Who-Is of the devices due go out together, the configured ones
+    // directly
+    bip_send_batch_begin();
+    int due = num;
+    int kept = 0;
+    int i = 0;
+    for (i = 0; i < num; i++) {
+        BacTarget* target = g_whois_due[i];
+        if (target->whoIsAddress.mac_len == 0) {
+            g_whois_due[kept++] = target;
+        } else if (sent < WHOIS_MAX_PER_PASS) {
+            Send_WhoIs_Remote(&target->whoIsAddress, target->instance, target->instance);
+            whois_sent(target, now);
+            sent++;
+        }
+    }
+    // the others as a few ranged broadcasts, the nearby instances in one
+    num = kept;
+    qsort(g_whois_due, num, sizeof(BacTarget*), compare_target_instance);
+    i = 0;
+    while (i < num && sent < WHOIS_MAX_PER_PASS) {
+        int last = i;
+        while (last + 1 < num
+            && g_whois_due[last + 1]->instance - g_whois_due[last]->instance <= WHOIS_RANGE_GAP) {
+            last++;
+        }
+        logger_debug("sending WhoIs request %u..%u",
+            g_whois_due[i]->instance, g_whois_due[last]->instance);
+        Send_WhoIs(g_whois_due[i]->instance, g_whois_due[last]->instance);
+        sent++;
+        for (; i <= last; i++) {
+            whois_sent(g_whois_due[i], now);
+        }
+    }
+    bip_send_batch_end();
+    // the Who-Is left over by this pass go out with the next one
+    long long next = sent < due ? now + WHOIS_PASS_MS : 0;
+    for (pNext = pconfig->policyHeader.next; pNext != NULL; pNext = pNext->next) {
+        BacTarget* target = pNext->rtTarget;
+        if (target != NULL && ! target->bound && target->whoIsAt > now
+            && (next == 0 || target->whoIsAt < next)) {
+            next = target->whoIsAt;
+        }
+    }
+    bacnet_context_leave(g_vars->g_bac_ctx);
+    return next;
 }
 
-void cleanup_read_access_data(BACNET_READ_ACCESS_DATA* header)
-{
-    BACNET_READ_ACCESS_DATA *rpm_object;
-    BACNET_READ_ACCESS_DATA *old_rpm_object;
-    BACNET_PROPERTY_REFERENCE *rpm_property;
-    BACNET_PROPERTY_REFERENCE *old_rpm_property;
+static int same_bac_object(BacProperty* a, BacProperty* b) {
+    return a->objectType == b->objectType && a->objectInstance == b->objectInstance;
+}
+
+// the properties [start, return) of the next request. the properties are
+// sorted by object, the properties of the same object share one access spec.
+// the size of the ack is estimated to fit the max apdu of the device, and
+// the request takes at most rtMaxProps, which shrinks when the device aborts
+static int next_chunk(PullPolicy* pPolicy, int start, unsigned maxApdu) {
+    int budget = (int) maxApdu - RPM_ACK_HEADER;
+    int size = 0;
+    int i = start;
+    while (i < pPolicy->propNum && (pPolicy->rtMaxProps == 0 || i - start < pPolicy->rtMaxProps)) {
+        BacProperty* prop = &pPolicy->properties[i];
+        int cost = RPM_PROPERTY_ESTIMATE;
+        if (i == start || ! same_bac_object(&pPolicy->properties[i - 1], prop)) {
+            cost += RPM_OBJECT_ESTIMATE;
+        }
+        if (i > start && size + cost > budget) {
+            break;
+        }
+        size += cost;
+        i++;
+    }
+    return i;
+}
+
+// encode the ReadPropertyMultiple of the properties [start, end), with invoke id 0
+static int encode_read_property_multiple(PullPolicy* pPolicy, int start, int end,
+    uint8_t* apdu, int size) {
+    int len = rpm_encode_apdu_init(apdu, 0);
+    int i = start;
+    for (; i < end; i++) {
+        BacProperty* pProp = &pPolicy->properties[i];
+        // the object id, the tags and one property are at most 16 bytes
+        if (len + 16 > size) {
+            return -1;
+        }
+        if (i == start || ! same_bac_object(&pPolicy->properties[i - 1], pProp)) {
+            if (i > start) {
+                len += rpm_encode_apdu_object_end(&apdu[len]);
+            }
+            len += rpm_encode_apdu_object_begin(&apdu[len], pProp->objectType, pProp->objectInstance);
+        }
+        len += rpm_encode_apdu_object_property(&apdu[len], pProp->property, pProp->index);
+    }
+    len += rpm_encode_apdu_object_end(&apdu[len]);
+    return len;
+}
+
+void release_request_templates(PullPolicy* pPolicy) {
+    int i = 0;
+    for (i = 0; i < pPolicy->rtTemplateNum; i++) {
+        free(pPolicy->rtTemplates[i].apdu);
+    }
+    free(pPolicy->rtTemplates);
+    pPolicy->rtTemplates = NULL;
+    pPolicy->rtTemplateNum = 0;
+}
+
+// encode the requests of the policy once, they only change with the max apdu
+// of the device, or when the device aborts or rejects them. the invoke id is
+// patched in before each send
+static int build_request_templates(PullPolicy* pPolicy, unsigned maxApdu) {
+    release_request_templates(pPolicy);
+    int count = 0;
+    int start = 0;
+    for (start = 0; start < pPolicy->propNum; count++) {
+        start = pPolicy->rtUseReadProperty ? start + 1 : next_chunk(pPolicy, start, maxApdu);
+    }
+    RequestTemplate* templates = calloc(count, sizeof(RequestTemplate));
+    if (templates == NULL) {
+        return -1;
+    }
+    pPolicy->rtTemplates = templates;
 
-    rpm_object = header;
-    old_rpm_object = rpm_object;
-    while (rpm_object) {
-        rpm_property = rpm_object->listOfProperties;
-        while (rpm_property) {
-            old_rpm_property = rpm_property;
-            rpm_property = rpm_property->next;
-            free(old_rpm_property);
+    uint8_t apdu[MAX_APDU];
+    for (start = 0; start < pPolicy->propNum; ) {
+        int end = start + 1;
+        int len = 0;
+        RequestTemplate* t = &templates[pPolicy->rtTemplateNum];
+        if (pPolicy->rtUseReadProperty) {
+            BacProperty* pProp = &pPolicy->properties[start];
+            BACNET_READ_PROPERTY_DATA data;
+            memset(&data, 0, sizeof(data));
+            data.object_type = pProp->objectType;
+            data.object_instance = pProp->objectInstance;
+            data.object_property = pProp->property;
+            data.array_index = pProp->index;
+            len = rp_encode_apdu(apdu, 0, &data);
+            t->service = SERVICE_CONFIRMED_READ_PROPERTY;
+        } else {
+            end = next_chunk(pPolicy, start, maxApdu);
+            len = encode_read_property_multiple(pPolicy, start, end, apdu, sizeof(apdu));
+            t->service = SERVICE_CONFIRMED_READ_PROP_MULTIPLE;
+        }
+        t->apdu = len > 0 ? malloc(len) : NULL;
+        if (t->apdu == NULL) {
+            release_request_templates(pPolicy);
+            return -1;
         }
-        old_rpm_object = rpm_object;
-        rpm_object = rpm_object->next;
-        free(old_rpm_object);
+        memcpy(t->apdu, apdu, len);
+        t->len = len;
+        t->props = end - start;
+        pPolicy->rtTemplateNum++;
+        start = end;
+    }
+    pPolicy->rtTemplateMaxApdu = maxApdu;
+    pPolicy->rtTemplateMaxProps = pPolicy->rtMaxProps;
+    pPolicy->rtTemplateReadProperty = pPolicy->rtUseReadProperty;
+    return 0;
+}
+
+// like Send_Read_Property_Multiple_Request, from the pre-encoded apdu.
+// return the invoke id
+static uint8_t send_request_template(RequestTemplate* t, BACNET_ADDRESS* dest, unsigned maxApdu) {
+    uint8_t invoke_id = 0;
+    Send_Confirmed_Request_List(dest, 1, maxApdu, t->apdu, (unsigned) t->len, &invoke_id);
+    return invoke_id;
+}
+
+// a slot for the request, NULL if none is left
+static InflightRequest* new_inflight(BacTarget* target, uint32_t device, BACNET_ADDRESS* dest,
+    uint8_t invokeId, int props, uint8_t service) {
+    int slot = 0;
+    if (g_inflight_free_num > 0) {
+        slot = g_inflight_free[--g_inflight_free_num];
+    } else if (g_inflight_used < MAX_INFLIGHT_REQUESTS) {
+        slot = g_inflight_used++;
+    } else {
+        // can't happen, the tsm has no more transactions than the slots
+        tsm_free_invoke_id_peer(dest, invokeId);
+        return NULL;
     }
+    InflightRequest* req = &g_inflight[slot];
+    req->policy = NULL;
+    req->control = NULL;
+    req->alarmAck = 0;
+    req->target = target;
+    if (req->target != NULL) {
+        req->target->inflight++;
+    }
+    req->device = device;
+    req->props = props;
+    req->service = service;
+    req->invokeId = invokeId;
+    g_inflight_count++;
+    // the request was sent in the same context, its reply can't be handled yet
+    tsm_set_completion(dest, invokeId, request_completed, req);
+    return req;
+}
+
+static void add_inflight(PullPolicy* pPolicy, BACNET_ADDRESS* dest, uint8_t invokeId, int props, uint8_t service) {
+    InflightRequest* req = new_inflight(policy_target(pPolicy), pPolicy->targetInstanceNumber,
+        dest, invokeId, props, service);
+    if (req == NULL) {
+        return;
+    }
+    req->policy = pPolicy;
+    pPolicy->rtReqInvokeId = invokeId;
+    pPolicy->rtReqPending++;
 }
 
 int issue_read_property_multiple(PullPolicy* pPolicy) {
-    // combine the multiple property request into a read_property_multiple
+    // combine the properties into as few read_property_multiple as the max
+    // apdu of the device allows, or read them one by one if it has no rpm
     if (pPolicy == NULL) {
         return -1;
     }
+    if (pPolicy->propNum <= 0) {
+        return 0;
+    }
 
-    if (pPolicy->propNum > 0) {
-        BACNET_READ_ACCESS_DATA* header = NULL;
-        int i = 0;
-        for (; i < pPolicy->propNum; i++) {
-            BacProperty* pProp = pPolicy->properties[i];
-            BACNET_READ_ACCESS_DATA* rpm_object = calloc(1, sizeof(BACNET_READ_ACCESS_DATA));
-            rpm_object->object_type = pProp->objectType;
-            rpm_object->object_instance = pProp->objectInstance;
-
-            BACNET_PROPERTY_REFERENCE* rpm_property = calloc(1, sizeof(BACNET_PROPERTY_REFERENCE));
-            rpm_property->next = NULL;
-            rpm_property->propertyArrayIndex = BACNET_ARRAY_ALL;    // default read all
-            // we just put one property here, for simplicity
-            rpm_property->propertyIdentifier = pProp->property;
-            if (pProp->index >= 0) {
-                rpm_property->propertyArrayIndex = pProp->index;
-            }
-            rpm_object->listOfProperties = rpm_property;
+    bacnet_context_enter(g_vars->g_bac_ctx);
+    unsigned maxApdu = 0;
+    BACNET_ADDRESS dest;
+    if (! address_get_by_device(pPolicy->targetInstanceNumber, &maxApdu, &dest)) {
+        bacnet_context_leave(g_vars->g_bac_ctx);
+        return -1;
+    }
+    if (pPolicy->rtTemplates == NULL || pPolicy->rtTemplateMaxApdu != maxApdu
+        || pPolicy->rtTemplateMaxProps != pPolicy->rtMaxProps
+        || pPolicy->rtTemplateReadProperty != pPolicy->rtUseReadProperty) {
+        if (build_request_templates(pPolicy, maxApdu) != 0) {
+            bacnet_context_leave(g_vars->g_bac_ctx);
+            return -1;
+        }
+    }
+    // the requests of a run are issued all together
+    int requests = pPolicy->rtTemplateNum;
+    int idle = tsm_transaction_idle_count();
+    if (! device_window_open(policy_target(pPolicy), requests)
+        || idle < (requests < MAX_IDLE_COUNT ? requests : MAX_IDLE_COUNT)) {
+        bacnet_context_leave(g_vars->g_bac_ctx);
+        return 1;
+    }
 
-            rpm_object->next = header;
-            header = rpm_object;
+    int rc = 0;
+    int i = 0;
+    for (i = 0; i < requests; i++) {
+        RequestTemplate* t = &pPolicy->rtTemplates[i];
+        uint8_t invokeId = send_request_template(t, &dest, maxApdu);
+        if (invokeId == 0) {
+            rc = -1;
+            break;
         }
-        uint8_t buffer[MAX_PDU] = {0};
-        log_debug("Send_Read_Property_Multiple_Request");
-        pPolicy->rtReqInvokeId = Send_Read_Property_Multiple_Request(&buffer[0],
-                    sizeof(buffer), pPolicy->targetInstanceNumber,
-                    header);
-        
-        cleanup_read_access_data(header);
+        add_inflight(pPolicy, &dest, invokeId, t->props, t->service);
+    }
+    bacnet_context_leave(g_vars->g_bac_ctx);
+
+    return rc;
+}
+
+// send one SubscribeCOVProperty, like Send_COV_Subscribe of the stack which
+// only has the object variant. return the invoke id
+static uint8_t send_cov_subscribe_property(BACNET_ADDRESS* pDest, unsigned max_apdu,
+    BACNET_SUBSCRIBE_COV_DATA* cov_data) {
+    BACNET_ADDRESS dest = *pDest;
+    BACNET_ADDRESS my_address;
+    BACNET_NPDU_DATA npdu_data;
+    uint8_t invoke_id = 0;
+
+    invoke_id = tsm_next_free_invokeID_peer(&dest);
+    if (invoke_id == 0) {
+        return 0;
+    }
+    datalink_get_my_address(&my_address);
+    npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_NORMAL);
+    int pdu_len = npdu_encode_pdu(&Handler_Transmit_Buffer[0], &dest, &my_address, &npdu_data);
+    pdu_len += cov_subscribe_property_encode_apdu(&Handler_Transmit_Buffer[pdu_len],
+        invoke_id, cov_data);
+    if ((unsigned) pdu_len >= max_apdu) {
+        tsm_free_invoke_id_peer(&dest, invoke_id);
+        return 0;
+    }
+    tsm_set_confirmed_unsegmented_transaction(invoke_id, &dest,
+        &npdu_data, &Handler_Transmit_Buffer[0], (uint16_t) pdu_len);
+    if (datalink_send_pdu(&dest, &npdu_data, &Handler_Transmit_Buffer[0], pdu_len) <= 0) {
+        fprintf(stderr, "Failed to Send SubscribeCOVProperty Request!\n");
+    }
+    return invoke_id;
+}
+
+// send one ReadRange of the records of the log from its cursor on, by
+// sequence number, as many as the max apdu of the device should fit. like
+// Send_ReadRange_Request of the stack, with the invoke ids of the device.
+// return the invoke id
+static uint8_t send_read_range(BACNET_ADDRESS* pDest, unsigned max_apdu, BacProperty* pProp) {
+    BACNET_ADDRESS dest = *pDest;
+    BACNET_ADDRESS my_address;
+    BACNET_NPDU_DATA npdu_data;
+    BACNET_READ_RANGE_DATA rr_data;
+    uint8_t invoke_id = 0;
+
+    memset(&rr_data, 0, sizeof(rr_data));
+    rr_data.object_type = pProp->objectType;
+    rr_data.object_instance = pProp->objectInstance;
+    rr_data.object_property = pProp->property;
+    rr_data.array_index = pProp->index;
+    rr_data.RequestType = RR_BY_SEQUENCE;
+    rr_data.Range.RefSeqNum = pProp->rtLogNext;
+    int count = ((int) max_apdu - RR_ACK_HEADER) / LOG_RECORD_ESTIMATE;
+    rr_data.Count = count > 1 ? count : 1;
+    invoke_id = tsm_next_free_invokeID_peer(&dest);
+    if (invoke_id == 0) {
+        return 0;
+    }
+    datalink_get_my_address(&my_address);
+    npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_NORMAL);
+    int pdu_len = npdu_encode_pdu(&Handler_Transmit_Buffer[0], &dest, &my_address, &npdu_data);
+    pdu_len += rr_encode_apdu(&Handler_Transmit_Buffer[pdu_len], invoke_id, &rr_data);
+    if ((unsigned) pdu_len >= max_apdu) {
+        tsm_free_invoke_id_peer(&dest, invoke_id);
+        return 0;
     }
+    tsm_set_confirmed_unsegmented_transaction(invoke_id, &dest,
+        &npdu_data, &Handler_Transmit_Buffer[0], (uint16_t) pdu_len);
+    if (datalink_send_pdu(&dest, &npdu_data, &Handler_Transmit_Buffer[0], pdu_len) <= 0) {
+        fprintf(stderr, "Failed to Send ReadRange Request!\n");
+    }
+    return invoke_id;
+}
 
+// the rest of the new records of the log found, from the ack of the last read
+// of it. return 0 if it's sent, the next run reads them otherwise
+static int continue_log_read(PullPolicy* pPolicy, int found) {
+    unsigned maxApdu = 0;
+    BACNET_ADDRESS dest;
+    if (! address_get_by_device(pPolicy->targetInstanceNumber, &maxApdu, &dest)
+        || ! device_window_open(policy_target(pPolicy), 1) || tsm_transaction_idle_count() == 0) {
+        return -1;
+    }
+    uint8_t invokeId = send_read_range(&dest, maxApdu, &pPolicy->properties[found]);
+    if (invokeId == 0) {
+        return -1;
+    }
+    add_inflight(pPolicy, &dest, invokeId, 1, SERVICE_CONFIRMED_READ_RANGE);
     return 0;
 }
+
+int issue_read_range(PullPolicy* pPolicy) {
+    // one ReadRange per log, each goes on by itself until it read all the
+    // new records
+    if (pPolicy == NULL) {
+        return -1;
+    }
+    if (pPolicy->propNum <= 0) {
+        return 0;
+    }
+
+    bacnet_context_enter(g_vars->g_bac_ctx);
+    unsigned maxApdu = 0;
+    BACNET_ADDRESS dest;
+    if (! address_get_by_device(pPolicy->targetInstanceNumber, &maxApdu, &dest)) {
+        bacnet_context_leave(g_vars->g_bac_ctx);
+        return -1;
+    }
+    int requests = pPolicy->propNum < MAX_IDLE_COUNT ? pPolicy->propNum : MAX_IDLE_COUNT;
+    if (! device_window_open(policy_target(pPolicy), pPolicy->propNum)
+        || tsm_transaction_idle_count() < requests) {
+        bacnet_context_leave(g_vars->g_bac_ctx);
+        return 1;
+    }
+
+    int rc = 0;
+    int i = 0;
+    for (i = 0; i < pPolicy->propNum; i++) {
+        uint8_t invokeId = send_read_range(&dest, maxApdu, &pPolicy->properties[i]);
+        if (invokeId == 0) {
+            rc = -1;
+            break;
+        }
+        add_inflight(pPolicy, &dest, invokeId, 1, SERVICE_CONFIRMED_READ_RANGE);
+    }
+    bacnet_context_leave(g_vars->g_bac_ctx);
+
+    return rc;
+}
+
+// send the WritePropertyMultiple of the n writes idx of the message, writes
+// of the same object in a row share one write access spec. return the invoke
+// id, 0 if there's none free, -1 if it doesn't fit the max apdu of the device
+static int send_write_property_multiple(BACNET_ADDRESS* pDest, unsigned max_apdu,
+    ControlMsg* msg, int* idx, int n) {
+    BACNET_WRITE_ACCESS_DATA objects[MAX_CONTROL_WRITES];
+    BACNET_PROPERTY_VALUE values[MAX_CONTROL_WRITES];
+    BACNET_ADDRESS dest = *pDest;
+    BACNET_ADDRESS my_address;
+    BACNET_NPDU_DATA npdu_data;
+    int objectNum = 0;
+    int i = 0;
+
+    for (i = 0; i < n; i++) {
+        ControlWrite* w = &msg->writes[idx[i]];
+        BACNET_PROPERTY_VALUE* v = &values[i];
+        v->propertyIdentifier = w->property;
+        v->propertyArrayIndex = w->index;
+        v->value = w->value;
+        v->value.next = NULL;
+        v->priority = w->priority == 0 ? BACNET_NO_PRIORITY : w->priority;
+        v->next = NULL;
+        BACNET_WRITE_ACCESS_DATA* last = objectNum > 0 ? &objects[objectNum - 1] : NULL;
+        if (last != NULL && last->object_type == w->objectType
+            && last->object_instance == w->objectInstance) {
+            values[i - 1].next = v;
+            continue;
+        }
+        if (last != NULL) {
+            last->next = &objects[objectNum];
+        }
+        objects[objectNum].object_type = w->objectType;
+        objects[objectNum].object_instance = w->objectInstance;
+        objects[objectNum].listOfProperties = v;
+        objects[objectNum].next = NULL;
+        objectNum++;
+    }
+
+    uint8_t invoke_id = tsm_next_free_invokeID_peer(&dest);
+    if (invoke_id == 0) {
+        return 0;
+    }
+    datalink_get_my_address(&my_address);
+    npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_NORMAL);
+    int pdu_len = npdu_encode_pdu(&Handler_Transmit_Buffer[0], &dest, &my_address, &npdu_data);
+    pdu_len += wpm_encode_apdu(&Handler_Transmit_Buffer[pdu_len], max_apdu, invoke_id, objects);
+    if ((unsigned) pdu_len >= max_apdu) {
+        tsm_free_invoke_id_peer(&dest, invoke_id);
+        return -1;
+    }
+    tsm_set_confirmed_unsegmented_transaction(invoke_id, &dest,
+        &npdu_data, &Handler_Transmit_Buffer[0], (uint16_t) pdu_len);
+    if (datalink_send_pdu(&dest, &npdu_data, &Handler_Transmit_Buffer[0], pdu_len) <= 0) {
+        fprintf(stderr, "Failed to Send WritePropertyMultiple Request!\n");
+    }
+    return invoke_id;
+}
+
+int issue_control_writes(ControlMsg* msg) {
+    int idx[MAX_CONTROL_WRITES];
+    int blocked = 0;
+    int i = 0;
+
+    bacnet_context_enter(g_vars->g_bac_ctx);
+    while (! blocked) {
+        // the device of the first write not sent yet
+        int first = 0;
+        while (first < msg->num && (msg->writes[first].issued || msg->writes[first].done)) {
+            first++;
+        }
+        if (first == msg->num) {
+            break;
+        }
+        uint32_t device = msg->writes[first].device;
+        unsigned maxApdu = 0;
+        BACNET_ADDRESS dest;
+        if (! address_get_by_device(device, &maxApdu, &dest)) {
+            for (i = first; i < msg->num; i++) {
+                ControlWrite* w = &msg->writes[i];
+                if (w->device == device && ! w->issued && ! w->done) {
+                    control_write_done(msg, i, "device not bound");
+                }
+            }
+            continue;
+        }
+        // the writes of the device in the order of the message, as many as
+        // the max apdu surely fits
+        int limit = ((int) maxApdu - RPM_ACK_HEADER) / WPM_WRITE_ESTIMATE;
+        int n = 0;
+        for (i = first; i < msg->num && n < (limit > 1 ? limit : 1); i++) {
+            ControlWrite* w = &msg->writes[i];
+            if (w->device == device && ! w->issued && ! w->done) {
+                idx[n++] = i;
+            }
+        }
+        // the estimate doesn't hold for long strings
+        int invokeId = 0;
+        while ((invokeId = send_write_property_multiple(&dest, maxApdu, msg, idx, n)) < 0 && n > 1) {
+            n /= 2;
+        }
+        if (invokeId == 0) {
+            // no transaction is free, the rest goes in the next loop of the worker
+            blocked = 1;
+        } else if (invokeId < 0) {
+            control_write_done(msg, idx[0], "too large for the device");
+        } else {
+            for (i = 0; i < n; i++) {
+                msg->writes[idx[i]].issued = 1;
+                msg->writes[idx[i]].invokeId = (uint8_t) invokeId;
+            }
+            InflightRequest* req = new_inflight(find_target(device), device, &dest,
+                (uint8_t) invokeId, n, SERVICE_CONFIRMED_WRITE_PROP_MULTIPLE);
+            if (req != NULL) {
+                req->control = msg;
+            } else {
+                for (i = 0; i < n; i++) {
+                    control_write_done(msg, idx[i], "no transaction");
+                }
+            }
+        }
+    }
+    // freed with its ack if all the writes are done already
+    if (msg->remaining == 0) {
+        finish_control_msg(msg);
+        blocked = 0;
+    }
+    bacnet_context_leave(g_vars->g_bac_ctx);
+    return blocked;
+}
+
+int issue_cov_subscriptions(PullPolicy* pPolicy) {
+    // subscribe each property of the policy, unconfirmed notifications
+    if (pPolicy == NULL) {
+        return -1;
+    }
+    if (pPolicy->propNum <= 0) {
+        return 0;
+    }
+
+    bacnet_context_enter(g_vars->g_bac_ctx);
+    int tries = 0;
+    while (pPolicy->rtCovProcessId == 0 && tries++ < MAX_COV_POLICIES) {
+        uint32_t processId = ++g_cov_last_process_id;
+        if (processId != 0 && g_cov_policies[processId % MAX_COV_POLICIES] == NULL) {
+            pPolicy->rtCovProcessId = processId;
+            g_cov_policies[processId % MAX_COV_POLICIES] = pPolicy;
+        }
+    }
+    if (pPolicy->rtCovProcessId == 0) {
+        bacnet_context_leave(g_vars->g_bac_ctx);
+        return -1;
+    }
+    unsigned maxApdu = 0;
+    BACNET_ADDRESS dest;
+    if (! address_get_by_device(pPolicy->targetInstanceNumber, &maxApdu, &dest)) {
+        bacnet_context_leave(g_vars->g_bac_ctx);
+        return -1;
+    }
+    int requests = pPolicy->propNum < MAX_IDLE_COUNT ? pPolicy->propNum : MAX_IDLE_COUNT;
+    if (! device_window_open(policy_target(pPolicy), pPolicy->propNum)
+        || tsm_transaction_idle_count() < requests) {
+        bacnet_context_leave(g_vars->g_bac_ctx);
+        return 1;
+    }
+
+    int rc = 0;
+    int i = 0;
+    for (i = 0; i < pPolicy->propNum; i++) {
+        BacProperty* pProp = &pPolicy->properties[i];
+        BACNET_SUBSCRIBE_COV_DATA cov_data;
+        memset(&cov_data, 0, sizeof(cov_data));
+        cov_data.subscriberProcessIdentifier = pPolicy->rtCovProcessId;
+        cov_data.monitoredObjectIdentifier.type = pProp->objectType;
+        cov_data.monitoredObjectIdentifier.instance = pProp->objectInstance;
+        cov_data.cancellationRequest = false;
+        cov_data.issueConfirmedNotifications = false;
+        cov_data.lifetime = (uint32_t) pPolicy->covLifetime;
+        cov_data.monitoredProperty.propertyIdentifier = pProp->property;
+        cov_data.monitoredProperty.propertyArrayIndex = pProp->index;
+        cov_data.covIncrementPresent = false;
+        uint8_t invokeId = send_cov_subscribe_property(&dest, maxApdu, &cov_data);
+        if (invokeId == 0) {
+            rc = -1;
+            break;
+        }
+        add_inflight(pPolicy, &dest, invokeId, 1, SERVICE_CONFIRMED_SUBSCRIBE_COV_PROPERTY);
+    }
+    if (rc == 0 && pPolicy->rtCovState != COV_ACTIVE) {
+        pPolicy->rtCovState = COV_SUBSCRIBING;
+    }
+    bacnet_context_leave(g_vars->g_bac_ctx);
+
+    return rc;
+}
+
+// append "text" to the dictionary, if there is room
+static int dict_append(char* buf, int cap, int len, const char* text) {
+	int n = snprintf(buf + len, cap - len, "\"%s\"", text);
+	return (n > 0 && len + n < cap) ? len + n : len;
+}
+
+int build_zlib_dictionary(char* buf, int cap) {
+	// zlib matches the end of the dictionary best, so the rare strings go
+	// first, the skeleton of a message goes last
+	const char* reserved = "Reserved";
+	const char* vendor = "Vendor";
+	int len = 0;
+	unsigned i = 0;
+	for (i = 0; i < 512; i++) {
+		const char* name = bactext_property_name(i);
+		if (strncmp(name, reserved, strlen(reserved)) != 0 && strncmp(name, vendor, strlen(vendor)) != 0) {
+			len = dict_append(buf, cap, len, name);
+		}
+	}
+	for (i = 0; i < OBJECT_PROPRIETARY_MIN; i++) {
+		const char* name = bactext_object_type_name(i);
+		if (strncmp(name, reserved, strlen(reserved)) != 0 && strncmp(name, vendor, strlen(vendor)) != 0) {
+			len = dict_append(buf, cap, len, name);
+		}
+	}
+	const char* skeleton = "{\"bdBacVer\":1,\"device\":{\"instanceNumber\":,\"ip\":\"\","
+		"\"broadcastIp\":\"\"},\"ts\":,\"data\":[{\"id\":\"_\",\"instance\":,"
+		"\"objType\":\"analog-input\",\"objInstance\":,\"propertyId\":\"present-value\","
+		"\"index\":4294967295,\"type\":\"Uint\",\"type\":\"Boolean\",\"type\":\"Double\",\"value\":\"";
+	int n = strlen(skeleton);
+	if (len + n < cap) {
+		memcpy(buf + len, skeleton, n);
+		len += n;
+	}
+	return len;
+}
@@ -4,25 +4,99 @@
 
 #include "data.h"
 
+// open the datalink and install the handlers. it needs no config, so it's
+// brought up while the mqtt client connects
+int start_bacnet_datalink();
+
+// take the instance number of the config, once the first one is loaded
 int start_local_bacnet_device(Bac2mqttConfig* pconfig);
 
-int bind_bac_device_address(Bac2mqttConfig* pconfig);
+// look up the binding of the target devices of the policies, and send a
+// Who-Is for the devices still unknown. the bindings are kept across the
+// reloads, so that the devices already bound are not discovered again.
+// return the monotonic time(ms) the next Who-Is is due, 0 if none is
+long long bind_bac_device_address(Bac2mqttConfig* pconfig);
+
+// the requests to each target device: timeouts, failed replies, in flight
+// and the learned window, for the metrics endpoint
+void bac_device_metrics(MetricsText* t);
+
+// free the bindings of the target devices, once the receiver is stopped
+void release_bac_targets();
 
 // pass the global variables pointer into this lib
 void set_global_vars(GlobalVar* pVars);
 
+// issue the read property multiple request of the policy without waiting for
+// the ack. return 0 if it's sent, 1 if the window of the device is full (try
+// again later), -1 if it can't be sent
 int issue_read_property_multiple(PullPolicy* pPolicy);
 
-typedef struct BacValueOutput_t {
-	char* id;
-	uint32_t instanceNumber;	// TODO: need to find the instance number and upload to cloud
-	const char* objectType;
-	int objectInstance;
-	const char* propertyId;
-	uint32_t index;
-	const char* type;
-	char* value;
-	struct BacValueOutput_t* next;
-} BacValueOutput;
+// read the records of the trend logs of the policy added since the last
+// run, by ReadRange from the cursor of each log, and keep them in the history
+// blocks. same return as issue_read_property_multiple
+int issue_read_range(PullPolicy* pPolicy);
+
+// free the encoded requests of the policy
+void release_request_templates(PullPolicy* pPolicy);
+
+// publish the history blocks of the policies that have samples, before the
+// policies are reloaded or the gateway exits
+void flush_policy_history(Bac2mqttConfig* pconfig);
+
+// the same, of one policy
+void publish_history(PullPolicy* policy);
+
+// free the history blocks of the policy
+void release_policy_history(PullPolicy* pPolicy);
+
+// free the aggregation windows of the policy, the summaries of the windows
+// cut short are dropped
+void release_policy_aggregates(PullPolicy* pPolicy);
+
+// subscribe the properties of the policy to cov, the changes are published as
+// they are notified. same return as issue_read_property_multiple, a refused
+// subscription is reported later by setting rtCovState to COV_FAILED
+int issue_cov_subscriptions(PullPolicy* pPolicy);
+
+// send the writes of the control message, one WritePropertyMultiple per
+// device (or more if they don't fit its max apdu). the writes go ahead of the
+// windows of the devices. return 1 if some of them must wait for a free
+// transaction, call it again later then; 0 once all are sent, the message is
+// freed after its ack is published
+int issue_control_writes(ControlMsg* msg);
+
+// the datalink is registered in the event loop of the worker, its acks are
+// dispatched as they arrive, so that many requests are in flight at once.
+// return 0 on success, -1 if the socket can't be added to the loop
+int start_bac_receiver(EventLoop* loop);
+
+// run the timers of the stack that are due, the transactions and the upkeep
+// of the datalink, in the loop between the events. return the monotonic
+// time(ms) the next one is due, 0 if none is
+long long bac_receiver_timers();
+
+void stop_bac_receiver();
+
+// confirmed requests in flight
+int bac_inflight_requests();
+
+// the policy is replaced by a reload: its cov notifications are ignored from
+// now on, while the acks of its requests in flight are still published. it can
+// be freed once its rtReqPending is 0. called inside the g_bac_ctx context
+void retire_policy(PullPolicy* pPolicy);
+
+// lay out the properties of the policies in the shared memory table, every
+// property is the point of its single value, named after the id of the value,
+// e.g. inst_117_analog-input_0_present-value_1. called inside the g_bac_ctx context
+void layout_shared_points(Bac2mqttConfig* pconfig);
+
+// lay out the properties mirrored into the device shadow, named as in the
+// shared memory table, see shadow_mirror.h. called by layout_shared_points
+void layout_shadow_points(Bac2mqttConfig* pconfig);
+
+// build the preset zlib dictionary of the data messages into buf, from the
+// text tables of the bacnet stack, return the length
+int build_zlib_dictionary(char* buf, int cap);
 
 #endif
\ No newline at end of file
@@ -1,18 +1,25 @@
 
 #include <string.h>
 #include <stdlib.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
 
 #include "common.h"
 #include "jsonutil.h"
 #include "mqttutil.h"
 #include "baclib.h"
+#include "ackpool.h"
+#include "bactext.h"
+#include "bip.h"
 
 
 const char* const CONFIG_FILE = "gwconfig-bacnet.txt";
 const char* const POLICY_CACHE = "policyCache-bacnet.txt";
+// the deltas received on top of POLICY_CACHE, one json per line
+const char* const POLICY_JOURNAL = "policyCache-bacnet.delta";
 
 GlobalVar g_vars;
-char g_buff[BUFF_LEN];
 int g_stop_worker = 0;
 
 void load_mqtt_config(const char* file, MqttInfo* pInfo) {
@@ -28,23 +35,219 @@ void load_mqtt_config(const char* file, MqttInfo* pInfo) {
     }
 
 	json2MqttInfo(content, pInfo);
+	free(content);
 
 }
 
+void freeCharPointer(char** pstr) {
+	if (pstr && *pstr) {
+		free(*pstr);
+		*pstr = NULL;
+	}
+}
+
+void free_pull_policy(PullPolicy* pPolicy) {
+	// the id prefixes of the properties are in their block
+	free(pPolicy->properties);
+	pPolicy->propNum = 0;
+	freeCharPointer(&pPolicy->whoIsAddress);
+	freeCharPointer(&pPolicy->id);
+	release_request_templates(pPolicy);
+	release_policy_history(pPolicy);
+	release_policy_aggregates(pPolicy);
+	free(pPolicy);
+}
+
+// free a parsed config that was not swapped in, NULL is ignored
+void release_config(Bac2mqttConfig* pconfig) {
+	if (pconfig == NULL) {
+		return;
+	}
+	PullPolicy* pPolicy = pconfig->policyHeader.next;
+	while (pPolicy) {
+		PullPolicy* tmp = pPolicy;
+		pPolicy = pPolicy->next;
+		free_pull_policy(tmp);
+	}
+	freeCharPointer(&pconfig->device.ip);
+	freeCharPointer(&pconfig->device.broadcastIp);
+	free(pconfig);
+}
+
+static void free_policy_list(PullPolicy* pPolicy) {
+	while (pPolicy) {
+		PullPolicy* tmp = pPolicy;
+		pPolicy = pPolicy->next;
+		free_pull_policy(tmp);
+	}
+}
+
+// free a delta config, NULL is ignored
+void release_delta(BacConfigDelta* delta) {
+	if (delta == NULL) {
+		return;
+	}
+	free_policy_list(delta->addHeader.next);
+	free_policy_list(delta->updateHeader.next);
+	int i = 0;
+	for (i = 0; delta->removeIds != NULL && i < delta->removeNum; i++) {
+		free(delta->removeIds[i]);
+	}
+	free(delta->removeIds);
+	free(delta);
+}
+
+// free the configs in the queue from staged on
+static void release_staged_configs(StagedConfig* staged) {
+	while (staged != NULL) {
+		StagedConfig* next = staged->next;
+		release_config(staged->full);
+		release_delta(staged->delta);
+		free(staged);
+		staged = next;
+	}
+}
+
+// apply the deltas of the journal to the json of the policy cache, in order.
+// return -1 if one doesn't fit, the rest of them are skipped
+static int merge_policy_journal(cJSON* config) {
+	char* content = NULL;
+	long len = read_file_as_string(POLICY_JOURNAL, &content);
+	g_vars.g_journal_num = 0;
+	if (len <= 0) {
+		return 0;
+	}
+	content[len] = 0;
+	int rc = 0;
+	char* line = content;
+	char* end = NULL;
+	while (rc == 0 && (end = strchr(line, '\n')) != NULL) {
+		*end = 0;
+		cJSON* delta = cJSON_Parse(line);
+		line = end + 1;
+		g_vars.g_journal_num++;
+		// a delta received again is skipped
+		cJSON* version = cJSON_GetObjectItem(config, "version");
+		if (! is_delta_config(delta) || ! cJSON_IsNumber(version)
+			|| json_double(delta, "version") > version->valuedouble) {
+			rc = merge_config_delta(config, delta);
+		}
+		cJSON_Delete(delta);
+	}
+	free(content);
+	return rc;
+}
+
+// write the cache with the deltas of the journal merged, and empty the journal
+static void compact_policy_cache() {
+	char* content = NULL;
+	long len = read_file_as_string(POLICY_CACHE, &content);
+	if (len <= 0) {
+		return;
+	}
+	content[len] = 0;
+	cJSON* config = cJSON_Parse(content);
+	free(content);
+	if (config == NULL) {
+		return;
+	}
+	merge_policy_journal(config);
+	char* text = cJSON_PrintUnformatted(config);
+	cJSON_Delete(config);
+	if (text != NULL && write_file_atomic(POLICY_CACHE, text, strlen(text)) == 0) {
+		remove(POLICY_JOURNAL);
+		g_vars.g_journal_num = 0;
+	} else {
+		printf("ERROR: failed to write the policy cache %s\n", POLICY_CACHE);
+	}
+	free(text);
+}
+
+// append the delta to the journal, for the next start. the journal is merged
+// into the cache once it's long
+static void journal_policy_delta(cJSON* delta) {
+	char* line = cJSON_PrintUnformatted(delta);
+	FILE* fp = fopen(POLICY_JOURNAL, "a");
+	int ok = fp != NULL && line != NULL && fprintf(fp, "%s\n", line) > 0 && fflush(fp) == 0;
+#ifndef WIN32
+	ok = ok && fsync(fileno(fp)) == 0;
+#endif
+	if (fp != NULL) {
+		ok = fclose(fp) == 0 && ok;
+	}
+	free(line);
+	if (! ok) {
+		printf("ERROR: failed to append to the policy journal %s\n", POLICY_JOURNAL);
+	}
+	g_vars.g_journal_num++;
+	if (! ok || g_vars.g_journal_num >= MAX_POLICY_JOURNAL) {
+		compact_policy_cache();
+	}
+}
+
 void connection_lost(void* context, char* cause)
 {
-    printf("\nConnection lost, caused by %s, will reconnect later\n", cause);
-    pthread_mutex_lock(&(g_vars.g_gateway_mutex));
-    g_vars.g_gateway_connected = 0;
-    pthread_mutex_unlock(&(g_vars.g_gateway_mutex));
+    printf("\nConnection lost, caused by %s, reconnecting\n", cause);
+}
+
+// the writes of the message are queued for the worker, which sends them
+// before it polls
+int handle_control_msg(char* topicName, MQTTAsync_message* message)
+{
+    char* buf = (char*) malloc(message->payloadlen + 1);
+    if (buf == NULL)
+    {
+        return 0;
+    }
+    memcpy(buf, message->payload, message->payloadlen);
+    buf[message->payloadlen] = 0;
+    MQTTAsync_freeMessage(&message);
+    MQTTAsync_free(topicName);
+
+    ControlMsg* msg = json2ControlMsg(buf);
+    free(buf);
+    if (msg == NULL)
+    {
+        return 1;
+    }
+    printf("received control message %s with %d writes\n", msg->id != NULL ? msg->id : "", msg->num);
+    pthread_mutex_lock(&g_vars.g_control_lock);
+    if (g_vars.g_control_tail == NULL)
+    {
+        g_vars.g_control_head = msg;
+    }
+    else
+    {
+        g_vars.g_control_tail->next = msg;
+    }
+    g_vars.g_control_tail = msg;
+    pthread_mutex_unlock(&g_vars.g_control_lock);
+    evloop_wakeup(&g_vars.g_loop);
+    return 1;
 }
 
-void delivered(void* context, MQTTClient_deliveryToken dt)
+// the control messages in the order they came, a message waiting for free
+// transactions holds the ones after it
+void issue_control_messages()
 {
-    printf("Message with token value %d delivery confirmed\n", dt);
+    pthread_mutex_lock(&g_vars.g_control_lock);
+    while (g_vars.g_control_head != NULL)
+    {
+        ControlMsg* msg = g_vars.g_control_head;
+        if (issue_control_writes(msg) != 0)
+        {
+            break;
+        }
+        g_vars.g_control_head = msg->next;
+        if (g_vars.g_control_head == NULL)
+        {
+            g_vars.g_control_tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&g_vars.g_control_lock);
 }
 
-int msg_arrived(void* context, char* topicName, int topicLen, MQTTClient_message* message)
+int msg_arrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
 {
     // sometime we receive strange message with topic name like "\300\005@\267"
     // let's filter those message that with topic other than expected
@@ -54,18 +257,14 @@ int msg_arrived(void* context, char* topicName, int topicLen, MQTTClient_message
     }
     if (strcmp(g_vars.g_mqtt_info.configTopic, topicName) != 0)
     {
-    	if (strcmp(g_vars.g_mqtt_info.controlTopic, topicName) == 0) {
-    		printf("WARN:got message from control topic:%s, but control is not implemented\n", topicName);
-    		return 1;
+    	if (g_vars.g_mqtt_info.controlTopic != NULL
+    		&& strcmp(g_vars.g_mqtt_info.controlTopic, topicName) == 0) {
+    		return handle_control_msg(topicName, message);
     	} else {
-	    	char buff[BUFF_LEN];
-	        snprintf(buff, BUFF_LEN, 
-	                "received unrelevant message in command topic, skipping it. topic=%s, payload=", 
-	                topicName);
-	        log_debug(buff);
+	        logger_debug("received unrelevant message in command topic, skipping it. topic=%s", topicName);
 	    
-	        MQTTClient_freeMessage(&message);
-	        MQTTClient_free(topicName);
+	        MQTTAsync_freeMessage(&message);
+	        MQTTAsync_free(topicName);
 
 	        return 1;
     	}
@@ -83,79 +282,428 @@ int msg_arrived(void* context, char* topicName, int topicLen, MQTTClient_message
         buf[i] = payloadptr[i];
     }
 
-    MQTTClient_freeMessage(&message);
-    MQTTClient_free(topicName);
+    MQTTAsync_freeMessage(&message);
+    MQTTAsync_free(topicName);
 
-    if (isStringValidJson(buf) == 0)
+    // parsed once here, so that the worker only applies it
+    cJSON* root = cJSON_Parse(buf);
+    StagedConfig* staged = (StagedConfig*) calloc(1, sizeof(StagedConfig));
+    int rc = root == NULL || staged == NULL ? -1 : 0;
+    if (rc == 0 && is_delta_config(root)) {
+        staged->delta = (BacConfigDelta*) malloc(sizeof(BacConfigDelta));
+        rc = staged->delta == NULL ? -1 : cjson2BacConfigDelta(root, staged->delta);
+    } else if (rc == 0) {
+        staged->full = (Bac2mqttConfig*) malloc(sizeof(Bac2mqttConfig));
+        if (staged->full != NULL) {
+            memset(staged->full, 0, sizeof(Bac2mqttConfig));
+        }
+        rc = staged->full == NULL ? -1 : cjson2Bac2mqttConfig(root, staged->full);
+    }
+    if (rc != 0)
     {
-        free(buf);
         printf("received invalid json config:%s\n", buf);
+        release_staged_configs(staged);
+        cJSON_Delete(root);
+        free(buf);
         return 1;
     }
+    printf("received following config:\n%s\n", buf);
 
+    // the configs not applied yet are of no use once a full config comes
+    int full = staged->full != NULL;
+    StagedConfig* dropped = NULL;
     pthread_mutex_lock(&(g_vars.g_policy_update_lock));
-    FILE* fp = fopen(POLICY_CACHE, "w");
-    if (! fp)
-    {
-        free(buf);
-        snprintf(g_buff, BUFF_LEN, "failed to open %s for write", POLICY_CACHE);
-        log_debug(g_buff);
-        pthread_mutex_unlock(&(g_vars.g_policy_update_lock));
-        return 0;
+    if (full) {
+        dropped = g_vars.g_staged_head;
+        g_vars.g_staged_head = NULL;
+        g_vars.g_staged_tail = NULL;
     }
-    fprintf(fp, "%s", buf);
-    fclose(fp);
-    printf("received following config:\n%s\n", buf);
-    free(buf);
-
+    if (g_vars.g_staged_tail != NULL) {
+        g_vars.g_staged_tail->next = staged;
+    } else {
+        g_vars.g_staged_head = staged;
+    }
+    g_vars.g_staged_tail = staged;
     g_vars.g_policy_updated = 1;
     pthread_mutex_unlock(&(g_vars.g_policy_update_lock));
+    evloop_wakeup(&g_vars.g_loop);
+    release_staged_configs(dropped);
+
+    // cached for the next start while the worker applies it, a full config as
+    // received and a delta in the journal. the mqtt callbacks come one by one,
+    // so the files hold the configs in the order received
+    if (full) {
+        if (write_file_atomic(POLICY_CACHE, buf, buflen - 1) == 0) {
+            remove(POLICY_JOURNAL);
+            g_vars.g_journal_num = 0;
+        } else {
+            printf("ERROR: failed to write the policy cache %s\n", POLICY_CACHE);
+        }
+    } else {
+        journal_policy_delta(root);
+    }
+    cJSON_Delete(root);
+    free(buf);
     return 1;
 }
 
-void load_pull_policy(const char* file, Bac2mqttConfig* pconfig) {
-	printf("start to load data sampling policy from file:%s\n", file);
+void schedule_policy(PullPolicy* policy)
+{
+    // (re)schedule the policy, ordered by the nextRun asc
+    // so that the top of the schedule is always the next policy need to execute
+    // note, this function could be involked in a different thread, make sure 
+    // add lock before modifying the schedule
 
-    // anyway we will clear the flag that need reload policy
-    pthread_mutex_lock(&(g_vars.g_policy_update_lock));
+    if (policy == NULL)
+    {
+        return;
+    }
 
-    g_vars.g_policy_updated = 0;
+    // we already have the lock here.
+    if (sched_push(&g_vars.g_config.schedule, policy->nextRun, policy) != 0)
+    {
+        printf("out of memory while scheduling policy of device %u\n", policy->targetInstanceNumber);
+    }
+}
+
+// called with g_policy_lock held
+void schedule_all_policies(Bac2mqttConfig* pconfig)
+{
+    sched_clear(&pconfig->schedule);
+    PullPolicy* policy = pconfig->policyHeader.next;
+    while (policy != NULL) {
+        schedule_policy(policy);
+        policy = policy->next;
+    }
+}
+
+// free the retired policies whose requests are all done.
+// called with g_policy_lock held, inside the g_bac_ctx context
+void reclaim_retired_policies(Bac2mqttConfig* pconfig) {
+	PullPolicy* prev = &pconfig->retiredHeader;
+	while (prev->next != NULL) {
+		PullPolicy* pPolicy = prev->next;
+		if (pPolicy->rtReqPending > 0) {
+			prev = pPolicy;
+			continue;
+		}
+		prev->next = pPolicy->next;
+		free_pull_policy(pPolicy);
+	}
+}
+
+// the new trend log policies go on from the records the old ones read, the
+// logs are matched by the target device and the object
+static void keep_trendlog_cursors(PullPolicy* old_list, PullPolicy* new_list) {
+    PullPolicy* to = NULL;
+    PullPolicy* from = NULL;
+    int i = 0;
+    int j = 0;
+    for (to = new_list; to != NULL; to = to->next) {
+        if (! to->trendLogMode) {
+            continue;
+        }
+        for (from = old_list; from != NULL; from = from->next) {
+            if (! from->trendLogMode || from->targetInstanceNumber != to->targetInstanceNumber) {
+                continue;
+            }
+            for (i = 0; i < to->propNum; i++) {
+                BacProperty* pProp = &to->properties[i];
+                for (j = 0; j < from->propNum; j++) {
+                    BacProperty* old = &from->properties[j];
+                    if (old->objectType == pProp->objectType
+                        && old->objectInstance == pProp->objectInstance
+                        && old->property == pProp->property) {
+                        pProp->rtLogNext = old->rtLogNext;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// replace the policies by the ones of next, which is freed. the requests of
+// the old policies in flight are still matched to them, their acks are
+// published, and the old policies are freed once they are all done
+void swap_pull_policy(Bac2mqttConfig* pconfig, Bac2mqttConfig* next) {
+    pthread_mutex_lock(&g_vars.g_policy_lock);
+    // the receiver may be handling the acks of the old policies
+    bacnet_context_enter(g_vars.g_bac_ctx);
+    flush_policy_history(pconfig);
+    keep_trendlog_cursors(pconfig->policyHeader.next, next->policyHeader.next);
+    PullPolicy* pPolicy = pconfig->policyHeader.next;
+    while (pPolicy != NULL) {
+        PullPolicy* tmp = pPolicy;
+        pPolicy = pPolicy->next;
+        retire_policy(tmp);
+        tmp->next = pconfig->retiredHeader.next;
+        pconfig->retiredHeader.next = tmp;
+    }
+    pconfig->policyHeader.next = next->policyHeader.next;
+    next->policyHeader.next = NULL;
+    pconfig->bdBacVer = next->bdBacVer;
+    pconfig->version = next->version;
+    // only taken by the local device once it's started
+    pconfig->device.instanceNumber = next->device.instanceNumber;
+    freeCharPointer(&pconfig->device.ip);
+    freeCharPointer(&pconfig->device.broadcastIp);
+    pconfig->device.ip = next->device.ip;
+    pconfig->device.broadcastIp = next->device.broadcastIp;
+    next->device.ip = NULL;
+    next->device.broadcastIp = NULL;
+    reclaim_retired_policies(pconfig);
+    layout_shared_points(pconfig);
+    bacnet_context_leave(g_vars.g_bac_ctx);
+    schedule_all_policies(pconfig);
+    pconfig->rtConfLoaded = 1;
+    pthread_mutex_unlock(&g_vars.g_policy_lock);
+    release_config(next);
+}
+
+// the policy of the id in the list, NULL if none
+static PullPolicy* find_policy(PullPolicy* list, const char* id) {
+    for (; list != NULL; list = list->next) {
+        if (list->id != NULL && strcmp(list->id, id) == 0) {
+            return list;
+        }
+    }
+    return NULL;
+}
 
-    char* content = NULL;
+// take the policy of the id out of the config, it's retired
+static void retire_policy_of(Bac2mqttConfig* pconfig, const char* id) {
+    PullPolicy* prev = &pconfig->policyHeader;
+    while (prev->next != NULL && (prev->next->id == NULL || strcmp(prev->next->id, id) != 0)) {
+        prev = prev->next;
+    }
+    PullPolicy* old = prev->next;
+    if (old == NULL) {
+        return;
+    }
+    prev->next = old->next;
+    publish_history(old);
+    sched_remove(&pconfig->schedule, old);
+    retire_policy(old);
+    old->next = pconfig->retiredHeader.next;
+    pconfig->retiredHeader.next = old;
+}
 
-    long filesize = read_file_as_string(file, &content);
+// the added ones must be new, the updated and removed ones there
+static int delta_fits(Bac2mqttConfig* pconfig, BacConfigDelta* delta) {
+    PullPolicy* policy = NULL;
+    int i = 0;
+    for (policy = delta->addHeader.next; policy != NULL; policy = policy->next) {
+        if (find_policy(pconfig->policyHeader.next, policy->id) != NULL) {
+            return 0;
+        }
+    }
+    for (policy = delta->updateHeader.next; policy != NULL; policy = policy->next) {
+        if (find_policy(pconfig->policyHeader.next, policy->id) == NULL) {
+            return 0;
+        }
+    }
+    for (i = 0; i < delta->removeNum; i++) {
+        if (find_policy(pconfig->policyHeader.next, delta->removeIds[i]) == NULL) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// ask the cloud for a full config on the ackTopic, the policies are out of sync
+static void request_full_config() {
+    if (! g_vars.g_mqtt_client_created) {
+        return;
+    }
+    g_vars.g_resync_needed = 0;
+    if (g_vars.g_mqtt_info.ackTopic == NULL) {
+        printf("no ackTopic to ask for a full config, waiting for one\n");
+        return;
+    }
+    char* ack = (char*) malloc(MAX_LEN);
+    if (ack != NULL) {
+        snprintf(ack, MAX_LEN, "{\"configVersion\":%lld,\"resync\":true}", g_vars.g_config.version);
+    }
+    sendAck(ack, &g_vars);
+}
+
+// apply the policies added, updated and removed by the delta in place, the
+// rest of the policies are not touched. a delta that doesn't fit the version
+// or the policies makes the gateway ask for a full config
+static void apply_config_delta(Bac2mqttConfig* pconfig, BacConfigDelta* delta) {
+    if (pconfig->version >= 0 && delta->version <= pconfig->version) {
+        printf("the delta config %lld is already applied, skipping it\n", delta->version);
+        return;
+    }
+    pthread_mutex_lock(&g_vars.g_policy_lock);
+    int fits = pconfig->version >= 0 && delta->baseVersion == pconfig->version
+        && delta_fits(pconfig, delta);
+    if (! fits) {
+        printf("the delta config %lld of version %lld doesn't fit the policies of version %lld, "
+            "asking for a full config\n", delta->version, delta->baseVersion, pconfig->version);
+        pconfig->version = -1;
+        pthread_mutex_unlock(&g_vars.g_policy_lock);
+        g_vars.g_resync_needed = 1;
+        return;
+    }
+    // the receiver may be handling the acks of the old policies
+    bacnet_context_enter(g_vars.g_bac_ctx);
+    keep_trendlog_cursors(pconfig->policyHeader.next, delta->addHeader.next);
+    keep_trendlog_cursors(pconfig->policyHeader.next, delta->updateHeader.next);
+    PullPolicy* policy = NULL;
+    int i = 0;
+    for (policy = delta->updateHeader.next; policy != NULL; policy = policy->next) {
+        retire_policy_of(pconfig, policy->id);
+    }
+    for (i = 0; i < delta->removeNum; i++) {
+        retire_policy_of(pconfig, delta->removeIds[i]);
+    }
+    PullPolicy* lists[2] = {delta->addHeader.next, delta->updateHeader.next};
+    delta->addHeader.next = NULL;
+    delta->updateHeader.next = NULL;
+    for (i = 0; i < 2; i++) {
+        while (lists[i] != NULL) {
+            policy = lists[i];
+            lists[i] = policy->next;
+            policy->next = pconfig->policyHeader.next;
+            pconfig->policyHeader.next = policy;
+            schedule_policy(policy);
+        }
+    }
+    reclaim_retired_policies(pconfig);
+    layout_shared_points(pconfig);
+    bacnet_context_leave(g_vars.g_bac_ctx);
+    pconfig->version = delta->version;
+    pthread_mutex_unlock(&g_vars.g_policy_lock);
+    printf("the delta config %lld is applied\n", delta->version);
+}
+
+// apply the configs parsed by the mqtt thread in order, if any
+void apply_staged_policy(Bac2mqttConfig* pconfig) {
+    pthread_mutex_lock(&(g_vars.g_policy_update_lock));
+    g_vars.g_policy_updated = 0;
+    StagedConfig* staged = g_vars.g_staged_head;
+    g_vars.g_staged_head = NULL;
+    g_vars.g_staged_tail = NULL;
     pthread_mutex_unlock(&(g_vars.g_policy_update_lock));
 
-    if (filesize <= 0)
+    StagedConfig* next = NULL;
+    for (; staged != NULL; staged = next) {
+        next = staged->next;
+        if (staged->full != NULL) {
+            printf("start to apply the data sampling policy received\n");
+            swap_pull_policy(pconfig, staged->full);
+            staged->full = NULL;
+            g_vars.g_resync_needed = 0;
+        } else {
+            apply_config_delta(pconfig, staged->delta);
+        }
+        staged->next = NULL;
+        release_staged_configs(staged);
+    }
+}
+
+// apply the deltas of the journal to the policies loaded from the cache, in
+// order, as if they were received again. stop at the first one that doesn't
+// fit, the gateway asks for a full config then
+static void replay_policy_journal(Bac2mqttConfig* pconfig) {
+	char* content = NULL;
+	long len = read_file_as_string(POLICY_JOURNAL, &content);
+	g_vars.g_journal_num = 0;
+	if (len <= 0) {
+		return;
+	}
+	content[len] = 0;
+	char* line = content;
+	char* end = NULL;
+	while (pconfig->version >= 0 && (end = strchr(line, '\n')) != NULL) {
+		*end = 0;
+		cJSON* root = cJSON_Parse(line);
+		line = end + 1;
+		g_vars.g_journal_num++;
+		BacConfigDelta* delta = (BacConfigDelta*) malloc(sizeof(BacConfigDelta));
+		int rc = delta == NULL ? -1 : cjson2BacConfigDelta(root, delta);
+		cJSON_Delete(root);
+		if (rc != 0) {
+			printf("a delta of %s is invalid, asking for a full config\n", POLICY_JOURNAL);
+			pconfig->version = -1;
+			g_vars.g_resync_needed = 1;
+		} else {
+			// a delta received again is skipped
+			apply_config_delta(pconfig, delta);
+		}
+		release_delta(delta);
+	}
+	free(content);
+}
+
+void load_pull_policy(const char* file, Bac2mqttConfig* pconfig) {
+	printf("start to load data sampling policy from file:%s\n", file);
+
+    // the configs staged are left alone, they are newer than the cache
+    FILE* fp = fopen(file, "rb");
+    if (fp == NULL)
     {
         printf("failed to open policy cache file %s, skipping policy cache loading\n",
                  file);
         
         return;
     }
-    if (content == NULL)
-    {
-        return;
-    }
 
-    int rc = json2Bac2mqttConfig(content, pconfig);
-    if (rc == 0) {
-    	pconfig->rtConfLoaded = 1;
+    // parsed without any lock, the sampling goes on meanwhile. the policies
+    // are built as the file is read, so a large cache is never held in memory
+    // as a whole, neither its text nor its tree
+    Bac2mqttConfig* next = (Bac2mqttConfig*) malloc(sizeof(Bac2mqttConfig));
+    if (next != NULL) {
+        memset(next, 0, sizeof(Bac2mqttConfig));
+    }
+    int rc = next == NULL ? -1 : file2Bac2mqttConfig(fp, next);
+    fclose(fp);
+    if (rc != 0) {
+        printf("the config string in %s is not a valid json object\n", file);
+        release_config(next);
+        return;
     }
+    swap_pull_policy(pconfig, next);
+    // the deltas journaled since the cache was written
+    replay_policy_journal(pconfig);
 }
 
 void init_global_vars(GlobalVar* vars) {
 
-	vars->g_gateway_connected = 0;
+	vars->g_mqtt_client_created = 0;
 	pthread_mutex_init(&(vars->g_mqtt_client_mutex), NULL);// = PTHREAD_MUTEX_INITIALIZER;
 
 	pthread_mutex_init(&(vars->g_policy_lock), NULL);// = PTHREAD_MUTEX_INITIALIZER;
+	vars->g_bac_ctx = bacnet_context_create();
+	if (vars->g_bac_ctx == NULL) {
+		printf("failed to create the bacnet context\n");
+		exit(1);
+	}
+	// the mqtt callbacks wake it up from the start
+	if (evloop_init(&(vars->g_loop)) != 0) {
+		printf("failed to create the event loop of the worker\n");
+		exit(1);
+	}
 	g_vars.g_policy_updated = 0;
-	pthread_mutex_init(&(vars->g_policy_update_lock), NULL);// = PTHREAD_MUTEX_INITIALIZER;
+	g_vars.g_staged_head = NULL;
+	g_vars.g_staged_tail = NULL;
+	g_vars.g_journal_num = 0;
+	g_vars.g_resync_needed = 0;
+	pthread_mutex_init(&(vars->g_policy_update_lock), NULL);
+	vars->g_control_head = NULL;
+	vars->g_control_tail = NULL;
+	pthread_mutex_init(&(vars->g_control_lock), NULL);// = PTHREAD_MUTEX_INITIALIZER;
+	vars->g_shared_points_started = 0;
+	vars->g_shadow_mirror = NULL;
 
 	vars->g_config.rtConfLoaded = 0;	// config not loaded yet
 	vars->g_config.rtDeviceStarted = 0;	// this bacnet device not started yet
+	vars->g_config.version = 0;
 	vars->g_config.policyHeader.next = NULL;
+	vars->g_config.retiredHeader.next = NULL;
+	sched_init(&vars->g_config.schedule, 0);
 
 	set_global_vars(&g_vars);
 }
@@ -175,62 +723,117 @@ void wait_user_input()
         }
     } while(ch!='Q' && ch != 'q'); 
     g_stop_worker = 1;
+    evloop_wakeup(&g_vars.g_loop);
     printf("exiting...\n");
 }
 
-void insert_slave_policy(PullPolicy* policy)
+void execute_policy(PullPolicy* policy)
 {
-    // insert a new slave policy into the list, ordered by the nextRun asc
-    // so that the head of the list is always the next slave need to execute
-    // note, this function could be involked in a different thread, make sure 
-    // add lock before modifying the list
-
-    if (policy == NULL)
-    {
-        return;
+	if (policy == NULL) {
+		return;
+	}
+    long long now = monotonic_ms();
+    // 1 issue the property read request, the ack is handled by the receiver.
+    // if the last request of the policy is still in flight, the device is
+    // slower than the interval, the run is skipped instead of piling up
+    // a cov policy is only polled while its subscription failed, the run
+    // renews the subscription at the half of its lifetime. a trend log
+    // policy reads the records logged since its last run
+    if (policy->rtReqPending) {
+        counter_add(&g_vars.g_poll_overruns, 1);
+    } else if (policy->trendLogMode) {
+        if (issue_read_range(policy) == 1) {
+            // the window of the device is full, try again shortly
+            if (sched_push(&g_vars.g_config.schedule, now + ISSUE_RETRY_MS, policy) != 0) {
+                printf("out of memory while scheduling policy of device %u\n", 
+                    policy->targetInstanceNumber);
+            }
+            return;
+        }
+        counter_add(&g_vars.g_polls, 1);
+    } else if (policy->covMode && now >= policy->rtCovRenewAt) {
+        int rc = issue_cov_subscriptions(policy);
+        if (rc == 1) {
+            if (sched_push(&g_vars.g_config.schedule, now + ISSUE_RETRY_MS, policy) != 0) {
+                printf("out of memory while scheduling policy of device %u\n", 
+                    policy->targetInstanceNumber);
+            }
+            return;
+        } else if (rc == 0) {
+            policy->rtCovRenewAt = now + policy->covLifetime * 1000LL / 2;
+        } else {
+            policy->rtCovState = COV_FAILED;
+            policy->rtCovRenewAt = now + COV_RETRY_MS;
+        }
+    } else if (! policy->covMode || policy->rtCovState == COV_FAILED) {
+        if (issue_read_property_multiple(policy) == 1) {
+            // the window of the device is full, try again shortly
+            if (sched_push(&g_vars.g_config.schedule, now + ISSUE_RETRY_MS, policy) != 0) {
+                printf("out of memory while scheduling policy of device %u\n", 
+                    policy->targetInstanceNumber);
+            }
+            return;
+        }
+        hist_record(&g_vars.g_lateness, (now - policy->nextRun) * 1000);
+        counter_add(&g_vars.g_polls, 1);
     }
 
-    // we already have the lock here.
-    PullPolicy* itr = &g_vars.g_config.policyHeader;
-    while (itr->next != NULL && itr->next->nextRun < policy->nextRun)
-    {
-        itr = itr->next;
+    // 2 recaculate the next run time, against the absolute deadline so that
+    // the latency does not accumulate. if we are more than one interval
+    // late, skip the missed runs instead of bursting
+    policy->nextRun += policy->interval;
+    if (policy->nextRun <= now) {
+        policy->nextRun += ((now - policy->nextRun) / policy->interval + 1) * policy->interval;
     }
-    policy->next = itr->next;
-    itr->next = policy;
-}
 
+    // 3 re-schedule, in order of nextRun
+    schedule_policy(policy);
+}
 
-void execute_policy(PullPolicy* policy)
+// the monotonic time(ms) the worker is due next: the first policy, the
+// earliest of due, or the retry of the mqtt client. 0 if there is nothing
+long long next_wakeup(long long due)
 {
-	if (policy == NULL) {
-		return;
-	}
-    // 1 recaculate the next run time
-    policy->nextRun = policy->interval + time(NULL);
-
-    // 2 re-insert into the list, in order of nextRun
-    insert_slave_policy(policy);
+    long long deadline = 0;
+    pthread_mutex_lock(&g_vars.g_policy_lock);
+    if (sched_peek(&g_vars.g_config.schedule, &deadline) == NULL) {
+        deadline = 0;
+    }
+    pthread_mutex_unlock(&g_vars.g_policy_lock);
 
-    // 3 issue the property read request
-    issue_read_property_multiple(policy);
+    if (due > 0 && (deadline == 0 || due < deadline)) {
+        deadline = due;
+    }
+    if (! g_vars.g_mqtt_client_created) {
+        long long retry = monotonic_ms() + MAX_IDLE_WAIT_MS;
+        if (deadline == 0 || retry < deadline) {
+            deadline = retry;
+        }
+    }
+    return deadline;
 }
 
-//TODO: fire up a few more workers, and precess in parallel, to speed up.
+// one worker issues the requests and handles their acks, many of them are in
+// flight at once. it sleeps in its event loop until the datalink is readable,
+// it's woken up, or the timer at next_wakeup fires, see start_bac_receiver
 void* worker_func(void* arg)
 {
     while (g_stop_worker != 1)
     {
+        long long due = 0;
+        long long whoIsAt = 0;
         // load slave policy if it's updated
         if (g_vars.g_policy_updated)
         {
-            load_pull_policy(POLICY_CACHE, &(g_vars.g_config));
+            // the ack workers are done with the policies before they change
+            ack_pool_drain(NULL);
+            apply_staged_policy(&(g_vars.g_config));
         }
         
-        if (g_vars.g_gateway_connected == 0)
-        {
-            log_debug("going to connect the mqtt client");
-            start_mqtt_client(&g_vars, connection_lost, msg_arrived, delivered);
+        // no-op while connected, the client reconnects by itself once connected
+        start_mqtt_client(&g_vars, connection_lost, msg_arrived);
+        if (g_vars.g_resync_needed) {
+            request_full_config();
         }
 
         // iterate from the beginning of the policy list
@@ -238,35 +841,51 @@ void* worker_func(void* arg)
         // calculate the new next run, and insert into the list
         if (g_vars.g_config.rtConfLoaded) {
         	if (g_vars.g_config.rtDeviceStarted == 0) {
+        		// the datalink is up already, the devices are bound below
         		start_local_bacnet_device(&g_vars.g_config);
         		g_vars.g_config.rtDeviceStarted = 1;
+        		start_bac_receiver(&g_vars.g_loop);
         	}
         	//printf("rtDeviceStarted=%d\n", g_vars.g_config.rtDeviceStarted);
         	if (g_vars.g_config.rtDeviceStarted == 1) {
-        		bind_bac_device_address(&g_vars.g_config);
+        		whoIsAt = bind_bac_device_address(&g_vars.g_config);
         	}
         	if (g_vars.g_config.rtDeviceStarted == 1) {
-		        time_t now = time(NULL);
+		        long long now = monotonic_ms();
 		        // we have something to do, acquire the lock here
 		        Bac2mqttConfig* theConfig = &g_vars.g_config;
+		        // the writes from the cloud go ahead of the polls
+		        issue_control_messages();
+		        // the policies of the acks the workers finished run again
+		        ack_pool_reap();
 		        pthread_mutex_lock(&g_vars.g_policy_lock);
-		        if (theConfig->policyHeader.next != NULL && theConfig->policyHeader.next->nextRun <= now)
-		        {    
-		            while (theConfig->policyHeader.next != NULL && theConfig->policyHeader.next->nextRun <= now)
-		            {
-		                // detach from the list
-		                PullPolicy* policy = theConfig->policyHeader.next;
-		                theConfig->policyHeader.next = theConfig->policyHeader.next->next;
-		                execute_policy(policy);
-		            }
+		        if (theConfig->retiredHeader.next != NULL) {
+		            bacnet_context_enter(g_vars.g_bac_ctx);
+		            reclaim_retired_policies(theConfig);
+		            bacnet_context_leave(g_vars.g_bac_ctx);
+		        }
+		        long long deadline = 0;
+		        // the requests of the due policies leave in a few sendmmsg
+		        bip_send_batch_begin();
+		        while (sched_peek(&theConfig->schedule, &deadline) != NULL && deadline <= now)
+		        {
+		            PullPolicy* policy = (PullPolicy*) sched_pop(&theConfig->schedule);
+		            execute_policy(policy);
 		        }
+		        bip_send_batch_end();
 		        pthread_mutex_unlock(&g_vars.g_policy_lock);   
+		        // after the sends, the requests just sent are in flight
+		        due = bac_receiver_timers();
 	    	}
         } 
 
-        sleep_ms(300);
+        if (whoIsAt > 0 && (due == 0 || whoIsAt < due)) {
+            due = whoIsAt;
+        }
+        evloop_set_deadline(&g_vars.g_loop, next_wakeup(due));
+        evloop_run_once(&g_vars.g_loop, -1);
     }
-    log_debug("exiting worker thread...\n");
+    log_debug("exiting worker thread...");
     return NULL;
 }
 
@@ -277,29 +896,112 @@ void start_worker()
     pthread_create(&g_worker_thread, NULL, worker_func, NULL);
 }
 
+// the metrics of the gateway in the prometheus text format, on every scrape
+void render_metrics(MetricsText* t, void* arg) {
+	mt_type(t, "bacnet_polls_total", "counter");
+	mt_value(t, "bacnet_polls_total", NULL, counter_get(&g_vars.g_polls));
+	mt_type(t, "bacnet_poll_errors_total", "counter");
+	mt_value(t, "bacnet_poll_errors_total", NULL, counter_get(&g_vars.g_poll_errors));
+	mt_type(t, "bacnet_poll_overruns_total", "counter");
+	mt_value(t, "bacnet_poll_overruns_total", NULL, counter_get(&g_vars.g_poll_overruns));
+	mt_type(t, "bacnet_cov_notifications_total", "counter");
+	mt_value(t, "bacnet_cov_notifications_total", NULL, counter_get(&g_vars.g_cov_notifications));
+	mt_type(t, "bacnet_event_notifications_total", "counter");
+	mt_value(t, "bacnet_event_notifications_total", NULL, counter_get(&g_vars.g_event_notifications));
+	mt_type(t, "bacnet_alarm_acks_total", "counter");
+	mt_value(t, "bacnet_alarm_acks_total", NULL, counter_get(&g_vars.g_alarm_acks));
+	mt_type(t, "bacnet_values_unchanged_total", "counter");
+	mt_value(t, "bacnet_values_unchanged_total", NULL, counter_get(&g_vars.g_values_unchanged));
+	mt_type(t, "bacnet_requests_inflight", "gauge");
+	mt_value(t, "bacnet_requests_inflight", NULL, bac_inflight_requests());
+	bac_device_metrics(t);
+	mt_type(t, "bacnet_poll_lateness_seconds", "histogram");
+	mt_histogram(t, "bacnet_poll_lateness_seconds", NULL, &g_vars.g_lateness);
+	mt_type(t, "bacnet_publish_latency_seconds", "histogram");
+	mt_histogram(t, "bacnet_publish_latency_seconds", NULL, &g_vars.g_publish_latency);
+	AmqttHealth health;
+	memset(&health, 0, sizeof(health));
+	if (g_vars.g_mqtt_client_created) {
+		amqtt_health(&g_vars.g_mqtt_client, &health);
+	}
+	mt_type(t, "bacnet_mqtt_pending", "gauge");
+	mt_value(t, "bacnet_mqtt_pending", NULL, health.pending);
+	mt_type(t, "bacnet_mqtt_sent_total", "counter");
+	mt_value(t, "bacnet_mqtt_sent_total", NULL, health.sent);
+	mt_type(t, "bacnet_mqtt_dropped_total", "counter");
+	mt_value(t, "bacnet_mqtt_dropped_total", NULL, health.dropped);
+	mt_type(t, "bacnet_mqtt_send_failures_total", "counter");
+	mt_value(t, "bacnet_mqtt_send_failures_total", NULL, health.failed);
+	mt_type(t, "bacnet_mqtt_spooled_total", "counter");
+	mt_value(t, "bacnet_mqtt_spooled_total", NULL, health.spooled);
+	mt_type(t, "bacnet_mqtt_spool_replaying", "gauge");
+	mt_value(t, "bacnet_mqtt_spool_replaying", NULL, health.spooling);
+	mt_type(t, "bacnet_mqtt_throttled_total", "counter");
+	mt_value(t, "bacnet_mqtt_throttled_total", NULL, health.throttled);
+}
+
+void start_metrics_endpoint() {
+	char* listen = g_vars.g_mqtt_info.metricsListen;
+	if (listen == NULL || strlen(listen) == 0) {
+		return;
+	}
+	char host[MAX_LEN];
+	snprintf(host, MAX_LEN, "%s", listen);
+	char* colon = strrchr(host, ':');
+	if (colon == NULL) {
+		printf("metricsListen should be ip:port, got %s\n", listen);
+		return;
+	}
+	*colon = '\0';
+	if (metrics_http_start(host, atoi(colon + 1), render_metrics, NULL) == 0) {
+		printf("serving the metrics on http://%s/metrics\n", listen);
+	}
+}
+
+// the shared memory table takes the policies as they are loaded
+void start_shared_points() {
+	char* name = g_vars.g_mqtt_info.sharedMemory;
+	if (name == NULL || strlen(name) == 0) {
+		return;
+	}
+	if (shmp_create(&g_vars.g_shared_points, name, g_vars.g_mqtt_info.sharedPoints) != 0) {
+		printf("ERROR:failed to create the shared memory table %s\n", name);
+		return;
+	}
+	g_vars.g_shared_points_started = 1;
+	printf("writing the latest values to the shared memory table %s\n", name);
+}
+
 void init_and_start() {
+	logger_start(stdout);
 	init_global_vars(&g_vars);
+	// the config is parsed by the mqtt thread too
+	bactext_init();
 
 	load_mqtt_config(CONFIG_FILE, &(g_vars.g_mqtt_info));
 
-	start_mqtt_client(&g_vars, connection_lost, msg_arrived, delivered);
-
-	// lets sleep 1 second, in case any config sent with retain=true
-	sleep_ms(500);
+	start_metrics_endpoint();
+	start_shared_points();
+	if (g_vars.g_mqtt_info.shadow != NULL) {
+		g_vars.g_shadow_mirror = shadow_mirror_start(g_vars.g_mqtt_info.shadow);
+	}
 
+	// the cached config is sampled at once. it's loaded before the connect, so
+	// a config retained by the broker is staged after it and replaces it as
+	// soon as it's received, the worker is woken up for it
 	load_pull_policy(POLICY_CACHE, &(g_vars.g_config));
 
+	// non-blocking, the datalink comes up during the handshake
+	start_mqtt_client(&g_vars, connection_lost, msg_arrived);
+	start_bacnet_datalink();
+
 	start_worker();
 	//worker_func(NULL);
 }
 
-void freeCharPointer(char** pstr) {
-	if (pstr && *pstr) {
-		free(*pstr);
-		*pstr = NULL;
-	}
-}
 void cleanup_data() {
+	// the samples still in the blocks go out before the connection is closed
+	flush_policy_history(&g_vars.g_config);
 	// close the mqtt connection
 	mqtt_cleanup(&g_vars);
 
@@ -310,23 +1012,48 @@ void cleanup_data() {
 	freeCharPointer(&g_vars.g_mqtt_info.controlTopic);
 	freeCharPointer(&g_vars.g_mqtt_info.user);
 	freeCharPointer(&g_vars.g_mqtt_info.password);
+	freeCharPointer(&g_vars.g_mqtt_info.spoolDir);
+	freeCharPointer(&g_vars.g_mqtt_info.metricsListen);
+	freeCharPointer(&g_vars.g_mqtt_info.ackTopic);
+	freeCharPointer(&g_vars.g_mqtt_info.alarmTopic);
+	freeCharPointer(&g_vars.g_mqtt_info.sharedMemory);
+	if (g_vars.g_shared_points_started) {
+		shmp_destroy(&g_vars.g_shared_points);
+		g_vars.g_shared_points_started = 0;
+	}
+	shadow_mirror_stop(g_vars.g_shadow_mirror);
+	g_vars.g_shadow_mirror = NULL;
+	cJSON_Delete(g_vars.g_mqtt_info.shadow);
+	g_vars.g_mqtt_info.shadow = NULL;
 	
-	// clean up pull policies
+	// clean up pull policies, the retired ones too as the receiver is stopped
 	PullPolicy* pPolicy = g_vars.g_config.policyHeader.next;
-	int i = 0;
 	while (pPolicy) {
-		for (i = 0; i < pPolicy->propNum; i++) {
-			if (pPolicy->properties[i] != NULL) {
-				free(pPolicy->properties[i]);
-				pPolicy->properties[i] = NULL;
-			}
-		}
-		pPolicy->propNum = 0;
 		PullPolicy* tmp = pPolicy;
 		pPolicy = pPolicy->next;
-		free(tmp);
+		free_pull_policy(tmp);
 	}
 	g_vars.g_config.policyHeader.next = NULL;
+	pPolicy = g_vars.g_config.retiredHeader.next;
+	while (pPolicy) {
+		PullPolicy* tmp = pPolicy;
+		pPolicy = pPolicy->next;
+		free_pull_policy(tmp);
+	}
+	g_vars.g_config.retiredHeader.next = NULL;
+	release_staged_configs(g_vars.g_staged_head);
+	g_vars.g_staged_head = NULL;
+	g_vars.g_staged_tail = NULL;
+	// the messages not sent yet, the ones in flight go with the process
+	while (g_vars.g_control_head != NULL) {
+		ControlMsg* msg = g_vars.g_control_head;
+		g_vars.g_control_head = msg->next;
+		release_control_msg(msg);
+	}
+	g_vars.g_control_tail = NULL;
+	sched_destroy(&g_vars.g_config.schedule);
+
+	release_bac_targets();
 
 	// clean up bacnet device info
 	freeCharPointer(&g_vars.g_config.device.ip);
@@ -336,6 +1063,10 @@ void cleanup_data() {
 void clean_and_exit()
 {
     pthread_join(g_worker_thread, NULL);
+    stop_bac_receiver();
+    evloop_destroy(&g_vars.g_loop);
+    metrics_http_stop();
     cleanup_data();
+    logger_stop();
 }
 
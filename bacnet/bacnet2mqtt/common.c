@@ -11,6 +11,9 @@
 #else
 #include <unistd.h> // for usleep
 #endif
+#ifndef WIN32
+#include <unistd.h> // for fsync
+#endif
 
 void sleep_ms(int milliseconds) // cross-platform sleep function
 {
@@ -26,6 +29,20 @@ void sleep_ms(int milliseconds) // cross-platform sleep function
 #endif
 }
 
+long long monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long long realtime_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 // common function section
 long read_file_as_string(char const* path, char** buf)
 {
@@ -41,20 +58,24 @@ long read_file_as_string(char const* path, char** buf)
     }
 
     rc = fseek(fp, 0L, SEEK_END);
-    if(0 != rc)
+    if(0 != rc || 0 > (off_end = ftell(fp)))
     {
+        fclose(fp);
         return -1L;
     }
-
-    if(0 > (off_end = ftell(fp)))
+    fsz = (size_t)off_end;
+    if(0 == fsz)
     {
-        return -1L;
+        // nothing is allocated for an empty file
+        fclose(fp);
+        *buf = NULL;
+        return 0L;
     }
-    fsz = (size_t)off_end;
 
     *buf = malloc(fsz + 1);
     if(NULL == *buf)
     {
+        fclose(fp);
         return -1L;
     }
 
@@ -62,40 +83,63 @@ long read_file_as_string(char const* path, char** buf)
 
     if(fsz != fread(*buf, 1, fsz, fp))
     {
+        fclose(fp);
         free(*buf);
+        *buf = NULL;
         return -1L;
     }
 
     if(EOF == fclose(fp))
     {
         free(*buf);
+        *buf = NULL;
         return -1L;
     }
 
     return (long)fsz;
 }
 
-int g_debug = 0;
+// write a temporary file next to path and rename it over path, so that a
+// reader never sees a half written file. return 0 on success
+int write_file_atomic(const char* path, const char* content, long len)
+{
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* fp = fopen(tmp, "wb");
+    if (fp == NULL)
+    {
+        return -1;
+    }
+    int ok = len == 0 || fwrite(content, len, 1, fp) == 1;
+    ok = ok && fflush(fp) == 0;
+#ifndef WIN32
+    ok = ok && fsync(fileno(fp)) == 0;
+#endif
+    if (fclose(fp) != 0 || !ok || rename(tmp, path) != 0)
+    {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
 void toggle_debug()
 {
-    g_debug = g_debug == 0 ? 1 : 0;
-    if (g_debug == 1)
+    if (logger_enabled(LOGGER_DEBUG))
     {
-        printf("debug info is on\n");
+        logger_set_level(LOGGER_INFO);
+        printf("debug info is off\n");
     }
     else
     {
-        printf("debug info is off\n");
+        logger_set_level(LOGGER_DEBUG);
+        printf("debug info is on\n");
     }
 }
 
 void log_debug(char* msg)
 {
-    if (g_debug == 1)
-    {
-        time_t now = time(NULL);
-        printf("%s %s\n", ctime(&now), msg);
-    } 
+    logger_debug("%s", msg);
 }
 
 void mystrncpy(char* desc, const char* src, int len)
@@ -111,4 +155,9 @@ int json_int(cJSON* root, char* item)
 char* json_string(cJSON* root, char* item)
 {
     return cJSON_GetObjectItem(root, item)->valuestring;
+}
+
+double json_double(cJSON* root, char* item)
+{
+    return cJSON_GetObjectItem(root, item)->valuedouble;
 }
\ No newline at end of file
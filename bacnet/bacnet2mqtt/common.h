@@ -2,13 +2,22 @@
 #define INF_BCE_IOT_BAC2MQTT_COMMON_H
 
 #include "data.h"
+#include "logger.h"
 #include <cjson/cJSON.h>
 
 // common function section
+// read the whole file into a malloc'ed *buf, return its size, -1 on error.
+// nothing is allocated if it's empty or on error
 long read_file_as_string(char const* path, char** buf);
 
+// replace the file by a rename, a reader sees the old or the new content.
+// return 0 on success
+int write_file_atomic(const char* path, const char* content, long len);
+
 void toggle_debug();
 
+// the message is queued for the writer of the log, see logger.h. prefer
+// logger_debug() for formatted lines, it's only formatted if debug is on
 void log_debug(char* msg);
 
 void mystrncpy(char* desc, const char* src, int len);
@@ -17,6 +26,14 @@ int json_int(cJSON* root, char* item);
 
 char* json_string(cJSON* root, char* item);
 
+double json_double(cJSON* root, char* item);
+
 void sleep_ms(int ms);
 
+// milliseconds from a monotonic clock, not affected by wall clock changes
+long long monotonic_ms();
+
+// milliseconds since the epoch
+long long realtime_ms();
+
 #endif
\ No newline at end of file
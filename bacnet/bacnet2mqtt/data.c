@@ -1,16 +1,59 @@
 #include "data.h"
 
+#include <math.h>
+
 PullPolicy* newPullPolicy() {
 	PullPolicy* ret = (PullPolicy*) malloc(sizeof(PullPolicy));
-	ret->rtAddressBund = 0;
+	ret->rtTarget = NULL;
 	ret->rtReqInvokeId = 0;
+	ret->rtReqPending = 0;
+	ret->rtAcksQueued = 0;
+	ret->rtMaxProps = 0;
+	ret->rtUseReadProperty = 0;
+	ret->rtCovState = COV_IDLE;
+	ret->rtCovRenewAt = 0;
+	ret->rtCovProcessId = 0;
+	ret->rtTemplates = NULL;
+	ret->rtTemplateNum = 0;
+	ret->rtTemplateMaxApdu = 0;
+	ret->rtTemplateMaxProps = 0;
+	ret->rtTemplateReadProperty = 0;
+	ret->rtHistory = NULL;
+	ret->rtHistoryStart = 0;
+	ret->rtAggregates = NULL;
+	ret->rtAggregateStart = 0;
+	ret->rtPropCursor = 0;
+	ret->rtRetired = 0;
+	ret->covMode = 0;
+	ret->covLifetime = DEFAULT_COV_LIFETIME;
+	ret->trendLogMode = 0;
+	ret->historyMs = 0;
+	ret->aggregateHopMs = 0;
+	ret->aggregatePanes = 1;
+	ret->whoIsAddress = NULL;
+	ret->id = NULL;
+	ret->onChange = 0;
+	ret->maxSilence = 0;
 	ret->next = NULL;
 	ret->propNum = 0;
+	ret->properties = NULL;
 	return ret;
 }
 
-BacProperty* newBacProperty() {
-	BacProperty* ret = (BacProperty*) malloc(sizeof(BacProperty));
+void initBacProperty(BacProperty* ret) {
 	ret->index = -1;
-	return ret;
+	ret->deadband = 0;
+	ret->idPrefix = NULL;
+	ret->idPrefixLen = 0;
+	ret->objTypeName = NULL;
+	ret->propertyName = NULL;
+	ret->rtLastValid = 0;
+	ret->rtLastValue = 0;
+	ret->rtLastPublish = 0;
+	ret->rtLogNext = 1;
+	ret->rtSharedPoint = -1;
+	ret->rtShadowPoint = -1;
+	ret->alarmLow = -INFINITY;
+	ret->alarmHigh = INFINITY;
+	ret->rtAlarm = 0;
 }
\ No newline at end of file
@@ -4,17 +4,68 @@
 #include <stdint.h>
 #include <time.h>
 #include <pthread.h>
-#include <MQTTClient.h>
 #include <stdlib.h>
 
 #include "bacenum.h"
 #include "bacdef.h"
+#include "bacapp.h"
+#include "bacctx.h"
+#include "scheduler.h"
+#include "async_mqtt.h"
+#include "metrics.h"
+#include "tsblock.h"
+#include "shm_points.h"
+#include "shadow_mirror.h"
+#include "aggregate.h"
+#include "evloop.h"
 
 // constants
 enum {
 	MAX_LEN = 256,
 	BUFF_LEN = 2048,
-	MAX_PROPERTY_PER_MQTT_MSG = 50
+	MAX_DATA_MSG_BYTES = 16384,	// a data message is paged at this size
+	MIN_INTERVAL_MS = 10,
+	MAX_IDLE_WAIT_MS = 300,	// how often the worker retries to create the mqtt client
+	MAX_POLICY_JOURNAL = 64,	// the deltas journaled before the policy cache is rewritten
+	DEFAULT_SPOOL_MAX_MB = 64,
+	DEFAULT_DEVICE_WINDOW = 4,	// confirmed requests in flight to one device
+	MAX_INFLIGHT_REQUESTS = MAX_TSM_TRANSACTIONS,	// every transaction of the tsm may be in flight
+	BVLC_TIMER_MS = 10000,	// how often the foreign devices registered with us are expired
+	ISSUE_RETRY_MS = 5,	// how soon a policy is retried while the window of its device is full
+	RPM_ACK_HEADER = 4,	// estimated size of the ack header of a ReadPropertyMultiple
+	RPM_OBJECT_ESTIMATE = 7,	// estimated size of an object id with its opening/closing tags
+	RPM_PROPERTY_ESTIMATE = 20,	// estimated size of a property id with its value
+	WPM_WRITE_ESTIMATE = 32,	// the most a write of a number takes in a WritePropertyMultiple
+	RR_ACK_HEADER = 24,	// estimated size of the ack header of a ReadRange, with the first sequence number
+	LOG_RECORD_ESTIMATE = 24,	// estimated size of a log record of a number with its status flags
+	DEFAULT_COV_LIFETIME = 300,	// seconds of a cov subscription, renewed at the half of it
+	COV_RETRY_MS = 60000,	// how soon a failed cov subscription is tried again
+	MAX_COV_POLICIES = 1024,	// policies subscribed to cov, by the subscriber process id
+	MAX_COV_VALUES = 8,	// values of one cov notification
+	ACK_ARENA_BLOCK = 65536,	// first block of the arena the acks are decoded into
+	MAX_ACK_WORKERS = 16,	// threads the acks of ReadPropertyMultiple may be handled by
+	ACK_QUEUE_LEN = 256,	// acks queued to one of them, a power of 2
+	ACK_WAIT_US = 200,	// how often the receiver looks again while it waits for them
+	HISTORY_BLOCK_BYTES = 4096,	// the time series block of a property, uploaded once full
+	ADDRESS_SAVE_MS = 300000,	// how often the learned device addresses are saved
+	TARGET_BUCKETS = 1024,	// buckets of the table of the device bindings
+	WHOIS_MIN_MS = 1000,	// the first retry of the Who-Is of a device, doubled on each retry
+	WHOIS_MAX_MS = 300000,	// the longest between two Who-Is of a device
+	WHOIS_RANGE_GAP = 16,	// unbound instances this close share a ranged Who-Is
+	WHOIS_MAX_PER_PASS = 8,	// Who-Is sent by one bind pass, the others wait for the next
+	WHOIS_PASS_MS = 300,	// how soon the next bind pass sends the Who-Is left over
+	DEVICE_BACKOFF_MS = 500,	// a device that timed out or aborted gets no request for this long
+	MAX_CONTROL_WRITES = 100,	// writes of one control message
+	CONTROL_KEY_LEN = 32,	// the key of a write in the control message
+	DEFAULT_SHARED_POINTS = 10000	// the points of the shared memory table, see shm_points.h
+};
+
+// the cov subscription of a policy
+enum {
+	COV_IDLE = 0,	// not subscribed yet
+	COV_SUBSCRIBING,	// the subscriptions are sent, not all acked yet
+	COV_ACTIVE,	// the changes are notified, the policy is not polled
+	COV_FAILED	// the device refused or didn't answer, the policy is polled
 };
 
 typedef struct
@@ -25,6 +76,23 @@ typedef struct
     char* controlTopic;	// topic to receive control cmd from cloud, null means disable controlling
     char* user;
     char* password;
+    char* spoolDir;	// optional, where the data is spooled while the broker is unreachable
+    int spoolMaxMB;
+    int compress;	// 1 if the data is compressed by zlib
+    int pubQos;	// qos of the published data, 0 or 1
+    int mqttVersion;	// 5 for mqtt 5, 4 for the default 3.1.1
+    int mqttMaxPacketSize;	// with mqtt 5, the largest packet from the broker, 0 if not limited
+    int mqttRateLimit;	// the publishes a second the broker allows, 0 if not limited
+    int mqttRateBurst;	// sent at once within the rate limit, 0 for a tenth of it
+    char* metricsListen;	// optional, ip:port to serve the prometheus metrics
+    int deviceWindow;	// max confirmed requests in flight to one device, the window starts there
+    int ackWorkers;	// threads handling the acks of ReadPropertyMultiple, 0 for the receiver itself
+    char* ackTopic;	// optional, where the results of the control messages are published
+    char* sharedMemory;	// optional, the shared memory table of the latest values
+    int sharedPoints;	// the points the table has room for
+    cJSON* shadow;	// optional, the points mirrored into a device shadow, see shadow_mirror.h
+    char* alarmTopic;	// optional, where the event notifications go, the dataTopic if NULL
+    int alarmAutoAck;	// 1 if the alarms asking for it are acknowledged by the gateway
 } MqttInfo;
 
 
@@ -35,29 +103,117 @@ typedef struct
 	uint32_t objectInstance;
 	BACNET_PROPERTY_ID property;
 	uint32_t index;	// -1: no index; 0: array size; BACNET_ARRAY_ALL: all elements
+	double deadband;	// with onChange, the change of a number to publish it
+	// the constant parts of the json of its values, resolved at the config load,
+	// the id is inst_<device>_<objType>_<objInstance>_<propertyId>_ and the index
+	char* idPrefix;
+	int idPrefixLen;
+	const char* objTypeName;
+	const char* propertyName;
+	// the number last published, runtime only
+	int rtLastValid;
+	double rtLastValue;
+	long long rtLastPublish;	// monotonic time(ms)
+	// with trendLogMode, the sequence number of the next record of the log,
+	// kept across the reloads, runtime only
+	uint32_t rtLogNext;
+	// the point of its single value in the shared memory table, -1 if none, runtime only
+	int rtSharedPoint;
+	// its point in the shadow mirror, -1 if not mirrored, runtime only
+	int rtShadowPoint;
+	// with aggregateSec, the numbers out of these are published as they are,
+	// -inf and inf if not set
+	double alarmLow;
+	double alarmHigh;
+	int rtAlarm;	// the last number was out of them, runtime only
 } BacProperty;
 
-BacProperty* newBacProperty() ;
+void initBacProperty(BacProperty* property);
+
+// the encoded apdu of one request of a policy, only the invoke id changes
+typedef struct
+{
+	uint8_t* apdu;
+	int len;
+	int props;	// properties read by the request
+	uint8_t service;	// SERVICE_CONFIRMED_READ_PROP_MULTIPLE or SERVICE_CONFIRMED_READ_PROPERTY
+} RequestTemplate;
+
+// the binding of a target device, shared by the policies of the device and
+// kept across the reloads. only used inside the g_bac_ctx context
+typedef struct BacTarget_t
+{
+	uint32_t instance;
+	BACNET_ADDRESS address;
+	unsigned maxApdu;
+	int bound;
+	// the device is asked for directly there instead of by a broadcast,
+	// e.g. behind a bbmd. mac_len is 0 if not configured
+	BACNET_ADDRESS whoIsAddress;
+	long long whoIsAt;	// monotonic time(ms) the next Who-Is may be sent
+	int whoIsBackoffMs;	// 0 before the first Who-Is
+	unsigned whoIsPass;	// the bind pass that last looked at it
+	// the confirmed requests to the device, the window is learned: one more
+	// once a window of replies came back, halved on a timeout or an abort
+	int inflight;
+	int window;	// 0 until the first request, then 1 to deviceWindow
+	int replies;	// since the window grew
+	long long backoffUntil;	// monotonic time(ms), no request before it
+	unsigned long long timeouts;	// requests the tsm gave up on after its retries
+	unsigned long long failures;	// error, abort or reject replies
+	struct BacTarget_t* next;	// in the bucket of the instance
+} BacTarget;
 
 // data sampling polic
 typedef struct PullPolicy_t
 {
 	///////////////////////////////
 	// bacnet runtime properties
-	BACNET_ADDRESS rtTargetAddress;
-	int rtAddressBund;
+	BacTarget* rtTarget;	// the binding of targetInstanceNumber, NULL until looked up
 	uint8_t rtReqInvokeId;
+	int rtReqPending;	// requests of this policy in flight, and acks queued to the ack workers
+	int rtAcksQueued;	// acks queued to the ack workers, only used by the receiver
+	int rtMaxProps;	// max properties of one request, 0: as many as the max apdu fits
+	int rtUseReadProperty;	// 1 if the device doesn't support ReadPropertyMultiple
+	int rtCovState;	// COV_IDLE, COV_SUBSCRIBING, COV_ACTIVE or COV_FAILED
+	long long rtCovRenewAt;	// monotonic time(ms) to subscribe again
+	uint32_t rtCovProcessId;	// the subscriber process id, 0 if not subscribed
+	// the requests of a run, built for the max apdu and the split below
+	RequestTemplate* rtTemplates;
+	int rtTemplateNum;
+	unsigned rtTemplateMaxApdu;
+	int rtTemplateMaxProps;
+	int rtTemplateReadProperty;
+	// the time series blocks of the properties, by the index of properties
+	TsBlock* rtHistory;
+	long long rtHistoryStart;	// monotonic time(ms) of the first sample of the blocks
+	// the windows of the numbers of the properties, by the index of properties
+	AggWindow* rtAggregates;
+	long long rtAggregateStart;	// monotonic time(ms) the current hop started
+	int rtPropCursor;	// after the property of the last value matched, the acks follow the order
+	int rtRetired;	// replaced by a reload, the records of its logs in flight are dropped
 	///////////////////////////////
 
 
+	char* id;	// optional, how a delta config refers to it, default NULL
 	uint32_t targetInstanceNumber;
-	int interval;
-	time_t nextRun;	// ts that this policy is schedule to run
+	int interval;	// in milliseconds
+	int covMode;	// 1 to subscribe to the changes instead of polling
+	int covLifetime;	// seconds of the subscription
+	int trendLogMode;	// 1 to read the new records of the trend logs of properties instead of polling
+	long long nextRun;	// monotonic time(ms) that this policy is schedule to run
+	int historyMs;	// > 0 to keep the numbers in blocks, uploaded this often
+	int aggregateHopMs;	// > 0 to publish the numbers as summaries this often
+	int aggregatePanes;	// the window is this many hops, 1 for tumbling windows
+	char* whoIsAddress;	// optional ip[:port] the Who-Is of the target is sent to, default NULL
+	int onChange;	// 1 to publish the polled numbers only when they change
+	int maxSilence;	// with onChange, publish anyway after this long(ms), 0 never
 
 	int propNum; // number of BacProperty in properites fields
 
-	// actaully an array of pointer to BacProperty, eg BacProperty* properties[]
-	BacProperty ** properties;	
+	// the properties inline, sorted by object, in one block with their id
+	// prefixes behind them, so it's freed at once
+	BacProperty* properties;
 
 	struct PullPolicy_t* next;
 } PullPolicy;
@@ -80,29 +236,121 @@ typedef struct
 	int rtDeviceStarted;
 
 	int bdBacVer;
+	long long version;	// the deltas apply on top of it, -1 once out of sync
 	BacDevice device;
 	
 	PullPolicy policyHeader;
+	Scheduler schedule;	// the policies ordered by nextRun, runtime only
+	// the policies replaced by a reload with requests still in flight, freed
+	// once their acks are handled or timed out, runtime only
+	PullPolicy retiredHeader;
 } Bac2mqttConfig;
 
+// a delta config, the pull policies of baseVersion are changed into the ones
+// of version. the policies are told apart by their id
+typedef struct
+{
+	long long version;
+	long long baseVersion;
+	PullPolicy addHeader;	// the new policies
+	PullPolicy updateHeader;	// in place of the ones of the same id
+	char** removeIds;
+	int removeNum;
+} BacConfigDelta;
+
+// a config received, parsed by the mqtt thread and applied by the worker.
+// one of full and delta
+typedef struct StagedConfig_t
+{
+	Bac2mqttConfig* full;
+	BacConfigDelta* delta;
+	struct StagedConfig_t* next;
+} StagedConfig;
+
+
+// a write of a control message
+typedef struct
+{
+	char key[CONTROL_KEY_LEN];	// of the write in the message, e.g. request1
+	uint32_t device;
+	BACNET_OBJECT_TYPE objectType;
+	uint32_t objectInstance;
+	BACNET_PROPERTY_ID property;
+	uint32_t index;	// BACNET_ARRAY_ALL if not an element of an array
+	uint8_t priority;	// 1 to 16, 0 if not given
+	BACNET_APPLICATION_DATA_VALUE value;
+	// runtime, inside the g_bac_ctx context
+	int issued;	// its WritePropertyMultiple is sent
+	uint8_t invokeId;	// of the WritePropertyMultiple
+	int done;
+	int ok;
+	const char* error;	// why it failed, NULL if ok
+	long long latencyMs;
+} ControlWrite;
+
+// a control message from the cloud. the writes to the same device go in as
+// few WritePropertyMultiple as its max apdu allows, the result of every write
+// is published to the ackTopic once all of them are done
+typedef struct ControlMsg_t
+{
+	char* id;	// optional, echoed in the ack
+	ControlWrite* writes;
+	int num;
+	int remaining;	// writes not done yet
+	long long receivedMs;	// monotonic
+	struct ControlMsg_t* next;	// in the queue of the worker
+} ControlMsg;
 
 typedef struct
 {
 	// mqtt info
 	MqttInfo g_mqtt_info;
 
-	MQTTClient g_mqtt_client;
+	AsyncMqtt g_mqtt_client;	// reconnects by itself once created
+	int g_mqtt_client_created;
 	pthread_mutex_t g_mqtt_client_mutex;
 
-	int g_gateway_connected;
-	pthread_mutex_t g_gateway_mutex;
-
 	// bacnet data sampling config
 	Bac2mqttConfig g_config;
 	pthread_mutex_t g_policy_lock;
+	// the bacnet stack state (tsm, address cache) of the gateway. the worker
+	// and the metrics endpoint enter it around every use of the stack, which
+	// also serializes them. lock order: g_policy_lock, then g_bac_ctx
+	BACNET_CONTEXT* g_bac_ctx;
+	// the reactor of the worker: the datalink, and the wake-ups for the
+	// config, the control messages and the exit
+	EventLoop g_loop;
 
 	int g_policy_updated;
+	// the configs received and not applied yet, in order. a full config drops
+	// the ones before it. guarded by g_policy_update_lock
+	StagedConfig* g_staged_head;
+	StagedConfig* g_staged_tail;
 	pthread_mutex_t g_policy_update_lock;
+	int g_journal_num;	// the deltas journaled on top of the cache, by the mqtt thread
+	int g_resync_needed;	// a full config is to be asked for on the ackTopic
+
+	// the control messages received, written by the worker before it polls
+	ControlMsg* g_control_head;
+	ControlMsg* g_control_tail;
+	pthread_mutex_t g_control_lock;
+
+	// runtime metrics, updated without locks
+	Histogram g_lateness;	// how late the policies are issued, in us
+	Histogram g_publish_latency;	// from queued to acked by the broker, in us
+	unsigned long long g_polls;
+	unsigned long long g_poll_errors;	// error, abort or reject replies, or timed out
+	unsigned long long g_poll_overruns;	// skipped as the last request was still in flight
+	unsigned long long g_cov_notifications;
+	unsigned long long g_event_notifications;	// the alarms and events received
+	unsigned long long g_alarm_acks;	// AcknowledgeAlarm sent
+	unsigned long long g_values_unchanged;	// polled numbers not published, see onChange
+
+	// the latest values for the local processes, written inside the g_bac_ctx context
+	ShmPoints g_shared_points;
+	int g_shared_points_started;
+	// the points mirrored into a device shadow, NULL if none
+	ShadowMirror* g_shadow_mirror;
 } GlobalVar;
 
 #endif
\ No newline at end of file
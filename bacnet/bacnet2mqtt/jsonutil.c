@@ -4,9 +4,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "bacutil.h"
+#include "bactext.h"
+#include "datetime.h"
 #include "common.h"
+#include "json_writer.h"
+#include "json_reader.h"
+#include "numfmt.h"
 
 void copyStrValueFromJson(char** dest, cJSON* json, char* key, int maxLen) {
 	*dest = NULL;
@@ -54,89 +60,480 @@ void json2MqttInfo(const char* str, MqttInfo* info) {
     }
     copyStrValueFromJson(&info->user, root, "user", MAX_LEN);
     copyStrValueFromJson(&info->password, root, "password", MAX_LEN);
+    // the spool is optional, the data is kept in memory only without it
+    info->spoolDir = NULL;
+    info->spoolMaxMB = DEFAULT_SPOOL_MAX_MB;
+    if (cJSON_HasObjectItem(root, "spoolDir")) {
+    	copyStrValueFromJson(&info->spoolDir, root, "spoolDir", MAX_LEN);
+    }
+    if (cJSON_HasObjectItem(root, "spoolMaxMB")) {
+    	info->spoolMaxMB = json_int(root, "spoolMaxMB");
+    }
+    // only "zlib" is supported
+    info->compress = cJSON_HasObjectItem(root, "compress") 
+    	&& strcmp(json_string(root, "compress"), "zlib") == 0;
+    // with qos 1 and the spool, the data in flight survives a restart too
+    info->pubQos = cJSON_HasObjectItem(root, "pubQos") && json_int(root, "pubQos") > 0 ? 1 : 0;
+    // 5 gets the topic aliases of mqtt 5, if the paho library supports it
+    info->mqttVersion = cJSON_HasObjectItem(root, "mqttVersion") 
+    	&& json_int(root, "mqttVersion") == 5 ? 5 : 4;
+    info->mqttMaxPacketSize = 0;
+    if (cJSON_HasObjectItem(root, "mqttMaxPacketSize")) {
+    	info->mqttMaxPacketSize = json_int(root, "mqttMaxPacketSize");
+    }
+    // the message rate quota of the broker, a burst of data waits in the queue
+    info->mqttRateLimit = 0;
+    info->mqttRateBurst = 0;
+    if (cJSON_HasObjectItem(root, "mqttRateLimit")) {
+    	info->mqttRateLimit = json_int(root, "mqttRateLimit");
+    }
+    if (cJSON_HasObjectItem(root, "mqttRateBurst")) {
+    	info->mqttRateBurst = json_int(root, "mqttRateBurst");
+    }
+    info->deviceWindow = DEFAULT_DEVICE_WINDOW;
+    if (cJSON_HasObjectItem(root, "deviceWindow")) {
+    	info->deviceWindow = json_int(root, "deviceWindow");
+    }
+    if (info->deviceWindow < 1) {
+    	info->deviceWindow = 1;
+    }
+    // the acks of ReadPropertyMultiple are decoded and published by the
+    // receiver itself unless there are ackWorkers
+    info->ackWorkers = 0;
+    if (cJSON_HasObjectItem(root, "ackWorkers")) {
+    	info->ackWorkers = json_int(root, "ackWorkers");
+    }
+    if (info->ackWorkers < 0) {
+    	info->ackWorkers = 0;
+    } else if (info->ackWorkers > MAX_ACK_WORKERS) {
+    	info->ackWorkers = MAX_ACK_WORKERS;
+    }
+    info->metricsListen = NULL;
+    if (cJSON_HasObjectItem(root, "metricsListen")) {
+    	copyStrValueFromJson(&info->metricsListen, root, "metricsListen", MAX_LEN);
+    }
+    // the results of the control messages are published there
+    info->ackTopic = NULL;
+    if (cJSON_HasObjectItem(root, "ackTopic")) {
+    	copyStrValueFromJson(&info->ackTopic, root, "ackTopic", MAX_LEN);
+    }
+    // the latest values are written to a shared memory table, like
+    // {"name": "/bdBacnetGateway", "points": 10000}, see shm_points.h
+    info->sharedMemory = NULL;
+    info->sharedPoints = DEFAULT_SHARED_POINTS;
+    if (cJSON_IsObject(cJSON_GetObjectItem(root, "sharedMemory"))) {
+    	cJSON* shared = cJSON_GetObjectItem(root, "sharedMemory");
+    	copyStrValueFromJson(&info->sharedMemory, shared, "name", MAX_LEN);
+    	if (cJSON_HasObjectItem(shared, "points")) {
+    		info->sharedPoints = json_int(shared, "points");
+    	}
+    }
+    // the points mirrored into the reported properties of a device shadow, see
+    // shadow_mirror.h. kept as it is until the mirror starts
+    info->shadow = NULL;
+    if (cJSON_IsObject(cJSON_GetObjectItem(root, "shadow"))) {
+    	info->shadow = cJSON_Duplicate(cJSON_GetObjectItem(root, "shadow"), 1);
+    }
+    // the event notifications skip the batching of the data, see sendAlarm
+    info->alarmTopic = NULL;
+    if (cJSON_HasObjectItem(root, "alarmTopic")) {
+    	copyStrValueFromJson(&info->alarmTopic, root, "alarmTopic", MAX_LEN);
+    }
+    info->alarmAutoAck = cJSON_IsTrue(cJSON_GetObjectItem(root, "alarmAutoAck"));
 
 
     cJSON_Delete(root);
 }
 
-int json2Bac2mqttConfig(const char* str, Bac2mqttConfig* config) {
-	if (str == NULL) {
-		return -1;
-	}
+// order the properties by object
+static int compare_bac_object(const void* a, const void* b) {
+    const BacProperty* pa = (const BacProperty*) a;
+    const BacProperty* pb = (const BacProperty*) b;
+    if (pa->objectType != pb->objectType) {
+        return pa->objectType < pb->objectType ? -1 : 1;
+    }
+    if (pa->objectInstance != pb->objectInstance) {
+        return pa->objectInstance < pb->objectInstance ? -1 : 1;
+    }
+    return 0;
+}
 
-	cJSON* root = cJSON_Parse(str);
-    if (root == NULL)
-    {
-        printf("the config string is not a valid json object, content=%s\n", str);
-        return -1;
+// move the id prefixes of the properties behind them, into their block, so
+// that a policy runs through one block and is freed with one free. without the
+// memory the prefixes are dropped, the ids are then written in full
+static void pack_policy_properties(PullPolicy* policy) {
+    size_t size = policy->propNum * sizeof(BacProperty);
+    size_t texts = 0;
+    int i = 0;
+    for (i = 0; i < policy->propNum; i++) {
+        if (policy->properties[i].idPrefix != NULL) {
+            texts += policy->properties[i].idPrefixLen + 1;
+        }
     }
+    BacProperty* block = (BacProperty*) realloc(policy->properties, size + texts + 1);
+    if (block != NULL) {
+        policy->properties = block;
+    }
+    char* text = (char*) policy->properties + size;
+    for (i = 0; i < policy->propNum; i++) {
+        BacProperty* property = &policy->properties[i];
+        if (property->idPrefix != NULL && block != NULL) {
+            memcpy(text, property->idPrefix, property->idPrefixLen + 1);
+            free(property->idPrefix);
+            property->idPrefix = text;
+            text += property->idPrefixLen + 1;
+        } else if (property->idPrefix != NULL) {
+            free(property->idPrefix);
+            property->idPrefix = NULL;
+            property->idPrefixLen = 0;
+        }
+    }
+}
 
-    config->bdBacVer = json_int(root, "bdBacVer");
+// spread the first runs of the policies of the same interval evenly over it,
+// or they would all be due in the same tick after every load, and forever
+static void stagger_policies(PullPolicy* list, long long now) {
+    PullPolicy* policy = NULL;
+    for (policy = list; policy != NULL; policy = policy->next) {
+        int k = 0;
+        int n = 0;
+        PullPolicy* other = NULL;
+        for (other = list; other != NULL; other = other->next) {
+            if (other->interval == policy->interval) {
+                if (other == policy) {
+                    k = n;
+                }
+                n++;
+            }
+        }
+        policy->nextRun = sched_phase(now, policy->interval, (unsigned int) policy->interval, k, n);
+    }
+}
 
-    // device
-    cJSON* device = cJSON_GetObjectItem(root, "device");
-    config->device.instanceNumber = (uint32_t) json_int(device, "instanceNumber");
-    config->device.ip = NULL;
+// a pull policy of the config, its first run is not set yet
+static PullPolicy* json2PullPolicy(cJSON* policyNode) {
+    PullPolicy* policy = newPullPolicy(); // (PullPolicy*) malloc(sizeof(PullPolicy));
+    // id is optional, a delta config updates and removes the policy by it
+    if (cJSON_IsString(cJSON_GetObjectItem(policyNode, "id"))) {
+    	copyStrValueFromJson(&policy->id, policyNode, "id", MAX_LEN);
+    }
+    policy->targetInstanceNumber = (uint32_t) json_int(policyNode, "targetInstanceNumber");
+    // interval is in seconds, intervalMs (optional) allows sub-second polling
+    policy->interval = json_int(policyNode, "interval") * 1000;
+    if (cJSON_HasObjectItem(policyNode, "intervalMs")) {
+    	policy->interval = json_int(policyNode, "intervalMs");
+    }
+    if (policy->interval < MIN_INTERVAL_MS) {
+    	policy->interval = MIN_INTERVAL_MS;
+    }
+    cJSON* mode = cJSON_GetObjectItem(policyNode, "mode");
+    policy->covMode = cJSON_IsString(mode) && strcmp(mode->valuestring, "cov") == 0;
+    // the properties are trend logs, their buffers are read by sequence number
+    policy->trendLogMode = cJSON_IsString(mode) && strcmp(mode->valuestring, "trendlog") == 0;
+    if (cJSON_HasObjectItem(policyNode, "covLifetime")) {
+    	policy->covLifetime = json_int(policyNode, "covLifetime");
+    }
+    if (policy->covLifetime <= 0) {
+    	policy->covLifetime = DEFAULT_COV_LIFETIME;
+    }
+    // the numbers are kept locally and uploaded in blocks every historySec
+    if (cJSON_HasObjectItem(policyNode, "historySec")) {
+    	policy->historyMs = json_int(policyNode, "historySec") * 1000;
+    }
+    if (policy->historyMs < 0) {
+    	policy->historyMs = 0;
+    }
+    // the numbers are published as their min, max, avg and last over windows
+    // of aggregateSec, sliding by aggregateHopSec or tumbling without it
+    if (cJSON_HasObjectItem(policyNode, "aggregateSec")) {
+    	int windowMs = json_int(policyNode, "aggregateSec") * 1000;
+    	policy->aggregateHopMs = windowMs;
+    	if (cJSON_HasObjectItem(policyNode, "aggregateHopSec")) {
+    		policy->aggregateHopMs = json_int(policyNode, "aggregateHopSec") * 1000;
+    	}
+    	if (windowMs <= 0 || policy->aggregateHopMs <= 0 || policy->aggregateHopMs > windowMs) {
+    		policy->aggregateHopMs = windowMs > 0 ? windowMs : 0;
+    	} else {
+    		policy->aggregatePanes = windowMs / policy->aggregateHopMs;
+    	}
+    	if (policy->aggregatePanes > AGG_MAX_PANES) {
+    		policy->aggregatePanes = AGG_MAX_PANES;
+    	}
+    }
+    // the device is discovered by a Who-Is sent there, e.g. behind a bbmd
+    if (cJSON_HasObjectItem(policyNode, "whoIsAddress")) {
+    	copyStrValueFromJson(&policy->whoIsAddress, policyNode, "whoIsAddress", MAX_LEN);
+    }
+    // report by exception is optional, enabled by onChange, deadband or the
+    // covIncrement of a property
+    double deadband = 0;
+    cJSON* onChange = cJSON_GetObjectItem(policyNode, "onChange");
+    policy->onChange = cJSON_IsTrue(onChange);
+    if (cJSON_HasObjectItem(policyNode, "deadband")) {
+    	deadband = json_double(policyNode, "deadband");
+    	policy->onChange = 1;
+    }
+    if (cJSON_HasObjectItem(policyNode, "maxSilence")) {
+    	policy->maxSilence = json_int(policyNode, "maxSilence") * 1000;
+    }
+
+    cJSON* propertyArray = cJSON_GetObjectItem(policyNode, "properties");
+    policy->propNum = cJSON_GetArraySize(propertyArray);
+    policy->properties = (BacProperty*) malloc(policy->propNum * sizeof(BacProperty) + 1);
+    // init them 
+    int j = 0;
+    for (j = 0; j < policy->propNum; j++) {
+    	cJSON* propNode = cJSON_GetArrayItem(propertyArray, j);
+    	BacProperty* property = &policy->properties[j];
+    	initBacProperty(property);
+    	property->objectType = str2BacObjectType(json_string(propNode, "objectType"));
+    	property->objectInstance = (uint32_t) json_int(propNode, "objectInstance");
+    	if (policy->trendLogMode && ! cJSON_HasObjectItem(propNode, "property")) {
+    		property->property = PROP_LOG_BUFFER;
+    	} else {
+    		property->property = str2PropertyId(json_string(propNode, "property"));
+    	}
+
+    	if (cJSON_HasObjectItem(propNode, "index")) {
+    		property->index = (uint32_t) json_int(propNode, "index");
+    	}
+    	property->deadband = deadband;
+    	if (cJSON_HasObjectItem(propNode, "covIncrement")) {
+    		property->deadband = json_double(propNode, "covIncrement");
+    		policy->onChange = 1;
+    	}
+    	if (cJSON_HasObjectItem(propNode, "alarmLow")) {
+    		property->alarmLow = json_double(propNode, "alarmLow");
+    	}
+    	if (cJSON_HasObjectItem(propNode, "alarmHigh")) {
+    		property->alarmHigh = json_double(propNode, "alarmHigh");
+    	}
+
+    	resolve_property_names(property, policy->targetInstanceNumber);
+    }
+    // the properties of the same object go into one access spec of the request
+    qsort(policy->properties, policy->propNum, sizeof(BacProperty), compare_bac_object);
+    pack_policy_properties(policy);
+
+    return policy;
+}
+
+// the device of a config, the strings are allocated
+static void json2BacDevice(cJSON* device, BacDevice* out) {
+    out->instanceNumber = (uint32_t) json_int(device, "instanceNumber");
+    out->ip = NULL;
     if (cJSON_HasObjectItem(device, "ip"))
     {
     	cJSON* ip = cJSON_GetObjectItem(device, "ip");
     	if (ip != NULL && !cJSON_IsNull(ip)) {
     		char* ipStr = ip->valuestring;
-    		config->device.ip = (char*) malloc(sizeof(char) * strlen(ipStr) + 1);
-    		mystrncpy(config->device.ip, ipStr, MAX_LEN);
+    		out->ip = (char*) malloc(sizeof(char) * strlen(ipStr) + 1);
+    		mystrncpy(out->ip, ipStr, MAX_LEN);
     	}
     }
 
-    config->device.broadcastIp = NULL;
+    out->broadcastIp = NULL;
     if (cJSON_HasObjectItem(device, "broadcastIp"))
     {
     	cJSON* brdcastip = cJSON_GetObjectItem(device, "broadcastIp");
     	if (brdcastip != NULL && !cJSON_IsNull(brdcastip)) {
     		char* brdcastipStr = brdcastip->valuestring;
-    		config->device.broadcastIp = (char*) malloc(sizeof(char) * strlen(brdcastipStr) + 1);
-    		mystrncpy(config->device.broadcastIp, brdcastipStr, MAX_LEN);
+    		out->broadcastIp = (char*) malloc(sizeof(char) * strlen(brdcastipStr) + 1);
+    		mystrncpy(out->broadcastIp, brdcastipStr, MAX_LEN);
     	}
     }
+}
+
+int json2Bac2mqttConfig(const char* str, Bac2mqttConfig* config) {
+	if (str == NULL) {
+		return -1;
+	}
+
+	cJSON* root = cJSON_Parse(str);
+    if (root == NULL)
+    {
+        printf("the config string is not a valid json object, content=%s\n", str);
+        return -1;
+    }
+    int rc = cjson2Bac2mqttConfig(root, config);
+    cJSON_Delete(root);
+
+    return rc;
+}
+
+int cjson2Bac2mqttConfig(cJSON* root, Bac2mqttConfig* config) {
+    config->bdBacVer = json_int(root, "bdBacVer");
+    // version is optional, the deltas apply on top of it
+    config->version = 0;
+    if (cJSON_IsNumber(cJSON_GetObjectItem(root, "version"))) {
+    	config->version = (long long) json_double(root, "version");
+    }
+
+    // device
+    json2BacDevice(cJSON_GetObjectItem(root, "device"), &config->device);
 
     // pullPolices
     cJSON* pullPolices = cJSON_GetObjectItem(root, "pullPolices");
     int pullPolicyNum = cJSON_GetArraySize(pullPolices);
     config->policyHeader.next = NULL;
-    time_t now = time(NULL);
+    long long now = monotonic_ms();
     int i = 0;
     for (i = 0; i < pullPolicyNum; i++) {
     	cJSON* policyNode = cJSON_GetArrayItem(pullPolices, i);
-    	PullPolicy* policy = newPullPolicy(); // (PullPolicy*) malloc(sizeof(PullPolicy));
-    	policy->targetInstanceNumber = (uint32_t) json_int(policyNode, "targetInstanceNumber");
-    	policy->interval = json_int(policyNode, "interval");
-    	policy->nextRun = policy->interval + now;
-
-    	cJSON* propertyArray = cJSON_GetObjectItem(policyNode, "properties");
-    	policy->propNum = cJSON_GetArraySize(propertyArray);
-    	policy->properties = (BacProperty**) malloc(policy->propNum * sizeof(BacProperty*));
-    	// init them 
-    	int j = 0;
-    	for (j = 0; j < policy->propNum; j++) {
-    		cJSON* propNode = cJSON_GetArrayItem(propertyArray, j);
-    		BacProperty* property = newBacProperty(); 
-    		property->objectType = str2BacObjectType(json_string(propNode, "objectType"));
-    		property->objectInstance = (uint32_t) json_int(propNode, "objectInstance");
-    		property->property = str2PropertyId(json_string(propNode, "property"));
+    	PullPolicy* policy = json2PullPolicy(policyNode);
+    	policy->next = config->policyHeader.next;
+    	config->policyHeader.next = policy;
+    }
+    stagger_policies(config->policyHeader.next, now);
 
-    		if (cJSON_HasObjectItem(propNode, "index")) {
-    			property->index = (uint32_t) json_int(propNode, "index");
-    		}
+    return 0;
+}
 
-    		policy->properties[j] = property;
+// the members of a config file but its pull policies
+static int configFileMember(void* ctx, const char* key, cJSON* value) {
+    Bac2mqttConfig* config = (Bac2mqttConfig*) ctx;
+    if (strcmp(key, "bdBacVer") == 0 && cJSON_IsNumber(value)) {
+    	config->bdBacVer = value->valueint;
+    } else if (strcmp(key, "version") == 0 && cJSON_IsNumber(value)) {
+    	config->version = (long long) value->valuedouble;
+    } else if (strcmp(key, "device") == 0 && cJSON_IsObject(value)) {
+    	free(config->device.ip);
+    	free(config->device.broadcastIp);
+    	json2BacDevice(value, &config->device);
+    }
+    return 0;
+}
+
+static int configFilePolicy(void* ctx, cJSON* policyNode) {
+    Bac2mqttConfig* config = (Bac2mqttConfig*) ctx;
+    PullPolicy* policy = json2PullPolicy(policyNode);
+    policy->next = config->policyHeader.next;
+    config->policyHeader.next = policy;
+    return 0;
+}
 
+int file2Bac2mqttConfig(FILE* fp, Bac2mqttConfig* config) {
+    config->bdBacVer = 0;
+    config->version = 0;
+    config->device.instanceNumber = 0;
+    config->device.ip = NULL;
+    config->device.broadcastIp = NULL;
+    config->policyHeader.next = NULL;
+    long long now = monotonic_ms();
+    // the policies are optional, as in cjson2Bac2mqttConfig
+    if (jr_read(fp, "pullPolices", configFileMember, configFilePolicy, config) == JR_ERROR) {
+    	return -1;
+    }
+    stagger_policies(config->policyHeader.next, now);
+    return 0;
+}
+
+// the policies of the items of a delta, all of them need an id
+static int json2DeltaPolicies(cJSON* items, PullPolicy* header) {
+    header->next = NULL;
+    int num = cJSON_GetArraySize(items);
+    int i = 0;
+    for (i = 0; i < num; i++) {
+    	cJSON* policyNode = cJSON_GetArrayItem(items, i);
+    	if (! cJSON_IsString(cJSON_GetObjectItem(policyNode, "id"))) {
+    		printf("ERROR:a pull policy of the delta config has no id\n");
+    		return -1;
     	}
+    	PullPolicy* policy = json2PullPolicy(policyNode);
+    	policy->next = header->next;
+    	header->next = policy;
+    }
+    return 0;
+}
 
-    	policy->next = config->policyHeader.next;
-    	config->policyHeader.next = policy;
+int is_delta_config(cJSON* root) {
+	return cJSON_IsObject(root) && cJSON_IsNumber(cJSON_GetObjectItem(root, "version"))
+		&& cJSON_IsNumber(cJSON_GetObjectItem(root, "baseVersion"));
+}
+
+int cjson2BacConfigDelta(cJSON* root, BacConfigDelta* delta) {
+    memset(delta, 0, sizeof(BacConfigDelta));
+    if (! is_delta_config(root)) {
+    	return -1;
+    }
+    delta->version = (long long) json_double(root, "version");
+    delta->baseVersion = (long long) json_double(root, "baseVersion");
+    if (json2DeltaPolicies(cJSON_GetObjectItem(root, "add"), &delta->addHeader) != 0
+    	|| json2DeltaPolicies(cJSON_GetObjectItem(root, "update"), &delta->updateHeader) != 0) {
+    	return -1;
+    }
+    cJSON* removes = cJSON_GetObjectItem(root, "remove");
+    int num = cJSON_GetArraySize(removes);
+    delta->removeIds = (char**) calloc(num + 1, sizeof(char*));
+    if (delta->removeIds == NULL) {
+    	return -1;
+    }
+    int i = 0;
+    for (i = 0; i < num; i++) {
+    	cJSON* item = cJSON_GetArrayItem(removes, i);
+    	if (! cJSON_IsString(cJSON_GetObjectItem(item, "id"))) {
+    		printf("ERROR:a removed pull policy of the delta config has no id\n");
+    		return -1;
+    	}
+    	copyStrValueFromJson(&delta->removeIds[i], item, "id", MAX_LEN);
+    	delta->removeNum++;
     }
+    long long now = monotonic_ms();
+    stagger_policies(delta->addHeader.next, now);
+    stagger_policies(delta->updateHeader.next, now);
+    return 0;
+}
 
-    cJSON_Delete(root);
+// the index of the pull policy of the id in the policies of the config, -1 if none
+static int find_policy_node(cJSON* policies, cJSON* id) {
+    int num = cJSON_GetArraySize(policies);
+    int i = 0;
+    for (i = 0; cJSON_IsString(id) && i < num; i++) {
+    	cJSON* other = cJSON_GetObjectItem(cJSON_GetArrayItem(policies, i), "id");
+    	if (cJSON_IsString(other) && strcmp(other->valuestring, id->valuestring) == 0) {
+    		return i;
+    	}
+    }
+    return -1;
+}
 
+int merge_config_delta(cJSON* config, cJSON* delta) {
+    cJSON* policies = cJSON_GetObjectItem(config, "pullPolices");
+    cJSON* version = cJSON_GetObjectItem(config, "version");
+    long long base = cJSON_IsNumber(version) ? (long long) version->valuedouble : 0;
+    if (! cJSON_IsArray(policies) || ! is_delta_config(delta)
+    	|| (long long) json_double(delta, "baseVersion") != base) {
+    	return -1;
+    }
+    const char* names[3] = {"add", "update", "remove"};
+    int k = 0;
+    int i = 0;
+    // the added policies must be new, the updated and removed ones there
+    for (k = 0; k < 3; k++) {
+    	cJSON* items = cJSON_GetObjectItem(delta, names[k]);
+    	for (i = 0; i < cJSON_GetArraySize(items); i++) {
+    		cJSON* id = cJSON_GetObjectItem(cJSON_GetArrayItem(items, i), "id");
+    		if (! cJSON_IsString(id) || (find_policy_node(policies, id) < 0) != (k == 0)) {
+    			return -1;
+    		}
+    	}
+    }
+    for (k = 0; k < 3; k++) {
+    	cJSON* items = cJSON_GetObjectItem(delta, names[k]);
+    	for (i = 0; i < cJSON_GetArraySize(items); i++) {
+    		cJSON* item = cJSON_GetArrayItem(items, i);
+    		int at = find_policy_node(policies, cJSON_GetObjectItem(item, "id"));
+    		if (k == 0) {
+    			cJSON_AddItemToArray(policies, cJSON_Duplicate(item, 1));
+    		} else if (k == 1) {
+    			cJSON_ReplaceItemInArray(policies, at, cJSON_Duplicate(item, 1));
+    		} else {
+    			cJSON_DeleteItemFromArray(policies, at);
+    		}
+    	}
+    }
+    cJSON_DeleteItemFromObject(config, "version");
+    cJSON_AddNumberToObject(config, "version", json_double(delta, "version"));
     return 0;
 }
 
@@ -152,8 +549,269 @@ int isStringValidJson(const char* str) {
 }
 
 
-char* bacData2Json(BacValueOutput* bacDataList, BacDevice* thisDevice, BacValueOutput** nextPage) {
-	// convert data into format like:
+// the value of a write, the type is guessed from the json unless given.
+// return 0 if it's not supported
+static int json2WriteValue(cJSON* node, BACNET_APPLICATION_DATA_VALUE* value) {
+	cJSON* v = cJSON_GetObjectItem(node, "value");
+	cJSON* t = cJSON_GetObjectItem(node, "type");
+	const char* type = cJSON_IsString(t) ? t->valuestring
+		: (cJSON_IsBool(v) ? "boolean" : (cJSON_IsNull(v) ? "null" : "real"));
+	memset(value, 0, sizeof(BACNET_APPLICATION_DATA_VALUE));
+	if (v == NULL) {
+		return 0;
+	}
+	if (strcasecmp(type, "null") == 0) {
+		// relinquishes the priority
+		value->tag = BACNET_APPLICATION_TAG_NULL;
+		return 1;
+	}
+	if (strcasecmp(type, "boolean") == 0) {
+		if (! cJSON_IsBool(v) && ! cJSON_IsNumber(v)) {
+			return 0;
+		}
+		value->tag = BACNET_APPLICATION_TAG_BOOLEAN;
+		value->type.Boolean = cJSON_IsTrue(v) || (cJSON_IsNumber(v) && v->valuedouble != 0);
+		return 1;
+	}
+	if (! cJSON_IsNumber(v)) {
+		return 0;
+	}
+	if (strcasecmp(type, "real") == 0) {
+		value->tag = BACNET_APPLICATION_TAG_REAL;
+		value->type.Real = (float) v->valuedouble;
+	} else if (strcasecmp(type, "unsigned") == 0 && v->valuedouble >= 0) {
+		value->tag = BACNET_APPLICATION_TAG_UNSIGNED_INT;
+		value->type.Unsigned_Int = (uint32_t) v->valuedouble;
+	} else if (strcasecmp(type, "signed") == 0) {
+		value->tag = BACNET_APPLICATION_TAG_SIGNED_INT;
+		value->type.Signed_Int = (int32_t) v->valuedouble;
+	} else if (strcasecmp(type, "enumerated") == 0 && v->valuedouble >= 0) {
+		value->tag = BACNET_APPLICATION_TAG_ENUMERATED;
+		value->type.Enumerated = (uint32_t) v->valuedouble;
+	#if defined (BACAPP_DOUBLE)
+	} else if (strcasecmp(type, "double") == 0) {
+		value->tag = BACNET_APPLICATION_TAG_DOUBLE;
+		value->type.Double = v->valuedouble;
+	#endif
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+ControlMsg* json2ControlMsg(const char* str) {
+	cJSON* root = cJSON_Parse(str);
+	if (root == NULL) {
+		printf("received invalid json control message:%s\n", str);
+		return NULL;
+	}
+	ControlMsg* msg = (ControlMsg*) calloc(1, sizeof(ControlMsg));
+	if (msg == NULL) {
+		cJSON_Delete(root);
+		return NULL;
+	}
+	msg->writes = (ControlWrite*) calloc(MAX_CONTROL_WRITES, sizeof(ControlWrite));
+	if (msg->writes == NULL) {
+		free(msg);
+		cJSON_Delete(root);
+		return NULL;
+	}
+	cJSON* node = NULL;
+	for (node = root->child; node != NULL; node = node->next) {
+		if (strcmp(node->string, "id") == 0 && cJSON_IsString(node)) {
+			msg->id = strdup(node->valuestring);
+			continue;
+		}
+		if (! cJSON_IsObject(node)) {
+			continue;
+		}
+		if (msg->num == MAX_CONTROL_WRITES) {
+			printf("WARN:a control message writes at most %d properties, the rest is ignored\n",
+				MAX_CONTROL_WRITES);
+			break;
+		}
+		cJSON* device = cJSON_GetObjectItem(node, "targetInstanceNumber");
+		cJSON* objectType = cJSON_GetObjectItem(node, "objectType");
+		cJSON* objectInstance = cJSON_GetObjectItem(node, "objectInstance");
+		cJSON* property = cJSON_GetObjectItem(node, "property");
+		if (! cJSON_IsNumber(device) || ! cJSON_IsString(objectType)
+			|| ! cJSON_IsNumber(objectInstance) || ! cJSON_IsString(property)) {
+			printf("WARN:write %s should have targetInstanceNumber, objectType, objectInstance"
+				" and property, skipping it\n", node->string);
+			continue;
+		}
+		ControlWrite* w = &msg->writes[msg->num];
+		mystrncpy(w->key, node->string, CONTROL_KEY_LEN);
+		w->device = (uint32_t) device->valuedouble;
+		w->objectType = str2BacObjectType(objectType->valuestring);
+		w->objectInstance = (uint32_t) objectInstance->valuedouble;
+		w->property = str2PropertyId(property->valuestring);
+		w->index = BACNET_ARRAY_ALL;
+		if (cJSON_HasObjectItem(node, "index")) {
+			w->index = (uint32_t) json_int(node, "index");
+		}
+		if (cJSON_HasObjectItem(node, "priority")) {
+			int priority = json_int(node, "priority");
+			w->priority = (uint8_t) (priority >= 1 && priority <= 16 ? priority : 0);
+		}
+		if (w->objectType == MAX_BACNET_OBJECT_TYPE || w->property == MAX_BACNET_PROPERTY_ID
+			|| ! json2WriteValue(node, &w->value)) {
+			printf("WARN:write %s has an unsupported object type, property or value, skipping it\n",
+				node->string);
+			continue;
+		}
+		msg->num++;
+	}
+	cJSON_Delete(root);
+	msg->remaining = msg->num;
+	msg->receivedMs = monotonic_ms();
+	return msg;
+}
+
+void release_control_msg(ControlMsg* msg) {
+	if (msg == NULL) {
+		return;
+	}
+	free(msg->id);
+	free(msg->writes);
+	free(msg);
+}
+
+char* controlAck2json(ControlMsg* msg) {
+	cJSON* root = cJSON_CreateObject();
+	if (msg->id != NULL) {
+		cJSON_AddStringToObject(root, "id", msg->id);
+	}
+	cJSON* results = cJSON_CreateObject();
+	int i = 0;
+	for (i = 0; i < msg->num; i++) {
+		ControlWrite* w = &msg->writes[i];
+		cJSON* result = cJSON_CreateObject();
+		cJSON_AddBoolToObject(result, "ok", w->ok);
+		cJSON_AddNumberToObject(result, "latencyMs", (double) w->latencyMs);
+		if (w->error != NULL) {
+			cJSON_AddStringToObject(result, "error", w->error);
+		}
+		cJSON_AddItemToObject(results, w->key, result);
+	}
+	cJSON_AddItemToObject(root, "results", results);
+	char* text = cJSON_PrintUnformatted(root);
+	cJSON_Delete(root);
+	return text;
+}
+
+static const char* notify_type_to_text(BACNET_NOTIFY_TYPE type) {
+	switch (type) {
+	case NOTIFY_ALARM:
+		return "alarm";
+	case NOTIFY_EVENT:
+		return "event";
+	case NOTIFY_ACK_NOTIFICATION:
+		return "ackNotification";
+	default:
+		return "unknown";
+	}
+}
+
+char* eventNotification2json(BACNET_EVENT_NOTIFICATION_DATA* data, BacDevice* thisDevice) {
+	cJSON* root = cJSON_CreateObject();
+	cJSON_AddNumberToObject(root, "bdBacVer", 1);
+	cJSON* device = cJSON_CreateObject();
+	cJSON_AddNumberToObject(device, "instanceNumber", thisDevice->instanceNumber);
+	cJSON_AddStringToObject(device, "ip", thisDevice->ip);
+	cJSON_AddStringToObject(device, "broadcastIp", thisDevice->broadcastIp);
+	cJSON_AddItemToObject(root, "device", device);
+	cJSON_AddNumberToObject(root, "ts", (double) time(NULL));
+	cJSON* event = cJSON_CreateObject();
+	cJSON_AddNumberToObject(event, "instance", data->initiatingObjectIdentifier.instance);
+	cJSON_AddStringToObject(event, "objType",
+		bactext_object_type_name(data->eventObjectIdentifier.type));
+	cJSON_AddNumberToObject(event, "objInstance", data->eventObjectIdentifier.instance);
+	cJSON_AddStringToObject(event, "notifyType", notify_type_to_text(data->notifyType));
+	cJSON_AddNumberToObject(event, "eventType", data->eventType);
+	cJSON_AddStringToObject(event, "fromState", bactext_event_state_name(data->fromState));
+	cJSON_AddStringToObject(event, "toState", bactext_event_state_name(data->toState));
+	cJSON_AddNumberToObject(event, "priority", data->priority);
+	cJSON_AddNumberToObject(event, "notificationClass", data->notificationClass);
+	cJSON_AddBoolToObject(event, "ackRequired", data->ackRequired);
+	// the time stamp of the device, in its local time like the trend logs
+	if (data->timeStamp.tag == TIME_STAMP_DATETIME) {
+		cJSON_AddNumberToObject(event, "eventTs",
+			datetime_seconds_since_unix_epoch(&data->timeStamp.value.dateTime));
+	} else if (data->timeStamp.tag == TIME_STAMP_SEQUENCE) {
+		cJSON_AddNumberToObject(event, "eventSeq", data->timeStamp.value.sequenceNum);
+	}
+	if (data->messageText != NULL && characterstring_length(data->messageText) > 0) {
+		char text[MAX_CHARACTER_STRING_BYTES + 1];
+		if (characterstring_ansi_copy(text, sizeof(text), data->messageText)) {
+			cJSON_AddStringToObject(event, "message", text);
+		}
+	}
+	cJSON_AddItemToObject(root, "event", event);
+	char* text = cJSON_PrintUnformatted(root);
+	cJSON_Delete(root);
+	return text;
+}
+
+static const char* value_tag_to_text(uint8_t tag) {
+    const char* ret = "Unknown";
+    switch(tag) {
+    case BACNET_APPLICATION_TAG_NULL:
+        ret = "Null";
+        break;
+    case BACNET_APPLICATION_TAG_BOOLEAN:
+        ret = "Boolean";
+        break;
+    case BACNET_APPLICATION_TAG_UNSIGNED_INT:
+        ret = "Uint";
+        break;
+    case BACNET_APPLICATION_TAG_SIGNED_INT:
+        ret = "Int";
+        break;
+    case BACNET_APPLICATION_TAG_REAL:
+        ret = "Double";
+        break;
+    #if defined (BACAPP_DOUBLE)
+    case BACNET_APPLICATION_TAG_DOUBLE:
+        ret = "Double";
+        break;
+    #endif
+        default:
+        ret = "Unknown";
+    }
+    return ret;
+}
+
+void resolve_property_names(BacProperty* property, uint32_t instanceNumber) {
+	char text[BUFF_LEN];
+	property->objTypeName = bactext_object_type_name(property->objectType);
+	property->propertyName = bactext_property_name(property->property);
+	int len = snprintf(text, sizeof(text), "inst_%u_%s_%u_%s_", instanceNumber,
+		property->objTypeName, property->objectInstance, property->propertyName);
+	free(property->idPrefix);
+	property->idPrefix = NULL;
+	property->idPrefixLen = 0;
+	// with room for the index
+	if (len > 0 && len + NUMFMT_INT_SIZE <= (int) sizeof(text)) {
+		property->idPrefix = (char*) malloc(len + 1);
+	}
+	if (property->idPrefix != NULL) {
+		memcpy(property->idPrefix, text, len + 1);
+		property->idPrefixLen = len;
+	}
+}
+
+void data_writer_init(DataWriter* dw, BacDevice* thisDevice, 
+	void (*publish)(char* msg, void* arg), void* arg) {
+	jw_init(&dw->w, NULL, 0);
+	dw->open = 0;
+	dw->count = 0;
+	dw->thisDevice = thisDevice;
+	dw->publish = publish;
+	dw->arg = arg;
+}
+
+// a page is like:
 // {
 //     "bdBacVer": 1,
 //     "device": {
@@ -164,62 +822,193 @@ char* bacData2Json(BacValueOutput* bacDataList, BacDevice* thisDevice, BacValueO
 //     "ts": 1493021816,
 //     "data": [
 //         {
-//             "id": "_117_ANALOG_INPUT_0_PRESENT_VALUE_0",
+//             "id": "inst_117_analog-input_0_present-value_1",
 //             "instance": 117,
-//             "objType": "ANALOG_INPUT",
+//             "objType": "analog-input",
 //             "objInstance": 0,
-//             "propertyId": "PRESENT_VALUE",
-//             "index": -1,
+//             "propertyId": "present-value",
+//             "index": 1,
 //             "type": "Double",
 //             "value": 12.3
 //         }
 //     ]
 // }
+static void begin_data_page(DataWriter* dw) {
+	// the buffer goes with the page, a new one is sized for a full page
+	int cap = MAX_DATA_MSG_BYTES + 1;
+	char* buf = (char*) malloc(cap);
+	jw_init(&dw->w, buf, buf != NULL ? cap : 0);
+	JsonWriter* w = &dw->w;
+	jw_begin_object(w, NULL);
+	jw_int(w, "bdBacVer", 1);
+	jw_begin_object(w, "device");
+	jw_int(w, "instanceNumber", dw->thisDevice->instanceNumber);
+	jw_string(w, "ip", dw->thisDevice->ip);
+	jw_string(w, "broadcastIp", dw->thisDevice->broadcastIp);
+	jw_end_object(w);
+	jw_int(w, "ts", time(NULL));
+	jw_begin_array(w, "data");
+	dw->open = 1;
+	dw->count = 0;
+}
 
-    *nextPage = NULL;  // default no next page
+static void end_data_page(DataWriter* dw) {
+	jw_end_array(&dw->w);
+	jw_end_object(&dw->w);
+	if (jw_ok(&dw->w)) {
+		dw->publish(dw->w.buf, dw->arg);
+	} else {
+		printf("ERROR:failed to convert the bacnet data into json\n");
+		free(dw->w.buf);
+	}
+	jw_init(&dw->w, NULL, 0);
+	dw->open = 0;
+	dw->count = 0;
+}
 
-	cJSON* root = cJSON_CreateObject(); 
-	cJSON_AddNumberToObject(root, "bdBacVer", 1);
-    cJSON* device = NULL;
-    cJSON_AddItemToObject(root, "device", device = cJSON_CreateObject());
-    cJSON_AddNumberToObject(device, "instanceNumber", thisDevice->instanceNumber);
-    if (thisDevice->ip) {
-        cJSON_AddStringToObject(device, "ip", thisDevice->ip);
-    } else {
-        cJSON_AddItemToObject(device, "ip", cJSON_CreateNull());
-    }
-    if (thisDevice->broadcastIp) {
-        cJSON_AddStringToObject(device, "broadcastIp", thisDevice->broadcastIp);
-    } else {
-        cJSON_AddItemToObject(device, "broadcastIp", cJSON_CreateNull());
-    }
-
-    cJSON_AddNumberToObject(root, "ts", time(NULL));
-
-    cJSON* data = NULL;
-    cJSON_AddItemToObject(root, "data", data = cJSON_CreateArray());
-    int cnt = 0;
-    while (bacDataList != NULL && cnt++ < MAX_PROPERTY_PER_MQTT_MSG) {
-    	cJSON* elem = cJSON_CreateObject();
-    	cJSON_AddStringToObject(elem, "id", bacDataList->id);
-    	cJSON_AddNumberToObject(elem, "instance", bacDataList->instanceNumber);
-    	cJSON_AddStringToObject(elem, "objType", bacDataList->objectType);
-    	cJSON_AddNumberToObject(elem, "objInstance", bacDataList->objectInstance);
-    	cJSON_AddStringToObject(elem, "propertyId", bacDataList->propertyId);
-    	cJSON_AddNumberToObject(elem, "index", bacDataList->index);
-    	cJSON_AddStringToObject(elem, "type", bacDataList->type);
-    	cJSON_AddStringToObject(elem, "value", bacDataList->value);
-
-    	cJSON_AddItemToArray(data, elem);
-
-    	bacDataList = bacDataList->next;
-    }
-    if (bacDataList != NULL && cnt >= MAX_PROPERTY_PER_MQTT_MSG) {
-        *nextPage = bacDataList;
-    }
-    
-    char* text = cJSON_Print(root);
-    cJSON_Delete(root);
+// the names of the value in the object the caller opened
+static void write_value_names(JsonWriter* w, uint32_t instanceNumber, 
+	const BacProperty* property, BACNET_OBJECT_PROPERTY_VALUE* object_value,
+	uint32_t valueIndex) {
+	char text[BUFF_LEN];
+	const char* objectType = property->objTypeName;
+	const char* propertyId = property->propertyName;
+
+	if (property->idPrefix != NULL) {
+		memcpy(text, property->idPrefix, property->idPrefixLen);
+		numfmt_u64(text + property->idPrefixLen, valueIndex);
+	} else {
+		objectType = bactext_object_type_name(object_value->object_type);
+		propertyId = bactext_property_name(object_value->object_property);
+		snprintf(text, sizeof(text), "inst_%u_%s_%u_%s_%u", instanceNumber, objectType, 
+			object_value->object_instance, propertyId, valueIndex);
+	}
+	jw_string(w, "id", text);
+	jw_int(w, "instance", instanceNumber);
+	jw_string(w, "objType", objectType);
+	jw_int(w, "objInstance", object_value->object_instance);
+	jw_string(w, "propertyId", propertyId);
+	jw_int(w, "index", valueIndex);
+}
+
+static void write_data_value(JsonWriter* w, uint32_t instanceNumber, 
+	const BacProperty* property, BACNET_OBJECT_PROPERTY_VALUE* object_value,
+	BACNET_APPLICATION_DATA_VIEW* value, uint32_t valueIndex) {
+	char text[BUFF_LEN];
+	BACNET_APPLICATION_DATA_VALUE copy;
+
+	jw_begin_object(w, NULL);
+	write_value_names(w, instanceNumber, property, object_value, valueIndex);
+	jw_string(w, "type", value_tag_to_text(value->tag));
+	// the numbers are native json numbers, the rest as the stack prints them
+	switch (value->tag) {
+	case BACNET_APPLICATION_TAG_NULL:
+		jw_null(w, "value");
+		break;
+	case BACNET_APPLICATION_TAG_BOOLEAN:
+		jw_bool(w, "value", value->type.Boolean);
+		break;
+	case BACNET_APPLICATION_TAG_UNSIGNED_INT:
+		jw_int(w, "value", value->type.Unsigned_Int);
+		break;
+	case BACNET_APPLICATION_TAG_SIGNED_INT:
+		jw_int(w, "value", value->type.Signed_Int);
+		break;
+	case BACNET_APPLICATION_TAG_REAL:
+		jw_float(w, "value", value->type.Real);
+		break;
+	#if defined (BACAPP_DOUBLE)
+	case BACNET_APPLICATION_TAG_DOUBLE:
+		jw_double(w, "value", value->type.Double);
+		break;
+	#endif
+	default:
+		// only the values printed by the stack are copied out of the ack
+		if (! bacapp_view_to_value(value, &copy)) {
+			jw_null(w, "value");
+			break;
+		}
+		object_value->value = &copy;
+		bacapp_snprintf_value(text, sizeof(text), object_value);
+		jw_string(w, "value", text);
+	}
+	jw_end_object(w);
+}
 
-    return text;
-}
\ No newline at end of file
+void data_writer_add(DataWriter* dw, uint32_t instanceNumber, const BacProperty* property,
+	uint32_t arrayIndex, BACNET_APPLICATION_DATA_VIEW* value) {
+	BACNET_OBJECT_PROPERTY_VALUE object_value;
+	object_value.object_type = property->objectType;
+	object_value.object_instance = property->objectInstance;
+	object_value.object_property = property->property;
+	object_value.array_index = arrayIndex;
+
+	uint32_t valueIndex = arrayIndex;
+	if (arrayIndex == BACNET_ARRAY_ALL) {
+		valueIndex = 0;
+	}
+	for (; value != NULL; value = value->next) {
+		valueIndex++;
+		if (!dw->open) {
+			begin_data_page(dw);
+		}
+		JwMark mark = jw_mark(&dw->w);
+		write_data_value(&dw->w, instanceNumber, property, &object_value, value, valueIndex);
+		// with the closing ]} of the page. a value too large for any page
+		// still goes alone
+		if (dw->w.len + 2 > MAX_DATA_MSG_BYTES && dw->count > 0) {
+			jw_rewind(&dw->w, mark);
+			end_data_page(dw);
+			begin_data_page(dw);
+			write_data_value(&dw->w, instanceNumber, property, &object_value, value, valueIndex);
+		}
+		dw->count++;
+	}
+}
+
+// a summary is like the value, with "type": "Summary" and "windowMs", "count",
+// "min", "max", "avg" and "last" instead of the value
+static void write_data_summary(JsonWriter* w, uint32_t instanceNumber, 
+	const BacProperty* property, BACNET_OBJECT_PROPERTY_VALUE* object_value,
+	uint32_t valueIndex, int windowMs, const AggStats* stats) {
+	jw_begin_object(w, NULL);
+	write_value_names(w, instanceNumber, property, object_value, valueIndex);
+	jw_string(w, "type", "Summary");
+	jw_int(w, "windowMs", windowMs);
+	jw_int(w, "count", stats->count);
+	jw_double(w, "min", stats->min);
+	jw_double(w, "max", stats->max);
+	jw_double(w, "avg", stats->sum / stats->count);
+	jw_double(w, "last", stats->last);
+	jw_end_object(w);
+}
+
+void data_writer_add_summary(DataWriter* dw, uint32_t instanceNumber, const BacProperty* property,
+	int windowMs, const AggStats* stats) {
+	BACNET_OBJECT_PROPERTY_VALUE object_value;
+	object_value.object_type = property->objectType;
+	object_value.object_instance = property->objectInstance;
+	object_value.object_property = property->property;
+	object_value.array_index = property->index;
+	// the index of its single value, as data_writer_add numbers it
+	uint32_t valueIndex = (property->index == BACNET_ARRAY_ALL ? 0 : property->index) + 1;
+
+	if (!dw->open) {
+		begin_data_page(dw);
+	}
+	JwMark mark = jw_mark(&dw->w);
+	write_data_summary(&dw->w, instanceNumber, property, &object_value, valueIndex, windowMs, stats);
+	if (dw->w.len + 2 > MAX_DATA_MSG_BYTES && dw->count > 0) {
+		jw_rewind(&dw->w, mark);
+		end_data_page(dw);
+		begin_data_page(dw);
+		write_data_summary(&dw->w, instanceNumber, property, &object_value, valueIndex, windowMs, stats);
+	}
+	dw->count++;
+}
+
+void data_writer_flush(DataWriter* dw) {
+	if (dw->open) {
+		end_data_page(dw);
+	}
+}
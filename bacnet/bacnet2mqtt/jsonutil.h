@@ -3,13 +3,81 @@
 
 #include "data.h"
 #include "baclib.h"
+#include "bacapp.h"
+#include "event.h"
+#include "json_writer.h"
+#include <cjson/cJSON.h>
+#include <stdio.h>
 
 void json2MqttInfo(const char* str, MqttInfo* info);
 
 // return 0, success; failed otherwise
 int json2Bac2mqttConfig(const char* str, Bac2mqttConfig* config);
 
+// the same, of the json parsed
+int cjson2Bac2mqttConfig(cJSON* root, Bac2mqttConfig* config);
+
+// the same, of the json read from fp, e.g. the policy cache. the pull policies
+// are built as the file is read, one json policy at a time, see json_reader.h.
+// the policies parsed are in config even if it failed
+int file2Bac2mqttConfig(FILE* fp, Bac2mqttConfig* config);
+
+// a delta config changes the pull policies of baseVersion into the ones of
+// version: {"version": n, "baseVersion": m, "add": [...], "update": [...],
+// "remove": [{"id": ...}]}, the policies are told apart by their id
+int is_delta_config(cJSON* root);
+
+// return 0 on success, the policies parsed are in delta even if it failed
+int cjson2BacConfigDelta(cJSON* root, BacConfigDelta* delta);
+
+// apply the delta to the json of a full config, e.g. the policy cache.
+// return -1 if it doesn't fit the config, which is not changed then
+int merge_config_delta(cJSON* config, cJSON* delta);
+
 int isStringValidJson(const char* str);
 
-char* bacData2Json(BacValueOutput* data, BacDevice* thisDevice, BacValueOutput** nextPage);
+// the writes of a control message, NULL if it's not a json object. the writes
+// that can't be understood are skipped
+ControlMsg* json2ControlMsg(const char* str);
+
+void release_control_msg(ControlMsg* msg);
+
+// the results of the writes, for the ackTopic. the caller frees it
+char* controlAck2json(ControlMsg* msg);
+
+// an alarm or event notification of a device, for the alarmTopic. the caller frees it
+char* eventNotification2json(BACNET_EVENT_NOTIFICATION_DATA* data, BacDevice* thisDevice);
+
+// the data messages are written straight from the decoded values. a page is
+// handed to publish once the next value would make it exceed MAX_DATA_MSG_BYTES,
+// publish takes the ownership of msg
+typedef struct
+{
+	JsonWriter w;
+	int open;	// 1 while a page is being written
+	int count;	// values in the page
+	BacDevice* thisDevice;
+	void (*publish)(char* msg, void* arg);
+	void* arg;
+} DataWriter;
+
+void data_writer_init(DataWriter* dw, BacDevice* thisDevice, 
+	void (*publish)(char* msg, void* arg), void* arg);
+
+// look up the names of the json of the values of the property once, instead of
+// for every value. without them, e.g. when out of memory, they are looked up
+// as the values are written. must be called before the properties of the
+// policy are packed into their block
+void resolve_property_names(BacProperty* property, uint32_t instanceNumber);
+
+// append the values of one property, a list of values for an array
+void data_writer_add(DataWriter* dw, uint32_t instanceNumber, const BacProperty* property,
+	uint32_t arrayIndex, BACNET_APPLICATION_DATA_VIEW* value);
+
+// append the summary of the single numbers of the property over a window
+void data_writer_add_summary(DataWriter* dw, uint32_t instanceNumber, const BacProperty* property,
+	int windowMs, const AggStats* stats);
+
+// publish the last page, if any
+void data_writer_flush(DataWriter* dw);
 #endif
\ No newline at end of file
@@ -5,190 +5,137 @@
 #include <stdlib.h>
 
 #include "common.h"
+#include "baclib.h"
 
-// cache at most 2048 messages, ring buffer
-enum {MSG_BUF_SIZE = 2048};
-char* g_dataToSend[MSG_BUF_SIZE];
-int g_buffHead = 0;
-int g_buffSize = 0;
+// cache at most 2048 messages in memory while the connection is down, the
+// rest goes to the spool if it's configured
+enum {MSG_BUF_SIZE = 2048, MAX_INFLIGHT = 10, ZLIB_DICT_LEN = 16384};
 const char* const PEM_FILE = "root_cert.pem";
-MQTTClient_SSLOptions g_sslopts = MQTTClient_SSLOptions_initializer;
 
-char LOG_BUFF[BUFF_LEN] = {0};
+void start_mqtt_client(GlobalVar* vars, 
+	connection_lost_fun connection_lost, 
+	msg_arrived_fun msg_arrived) {
+	pthread_mutex_lock(&(vars->g_mqtt_client_mutex));
+	if (! vars->g_mqtt_client_created) {
+		printf("connecting gateway to cloud...\n");
+		printf("endpoint:%s\n", vars->g_mqtt_info.endpoint);
+		printf("user:%s\n", vars->g_mqtt_info.user);
+		printf("sub config from topic:%s\n", vars->g_mqtt_info.configTopic);
+		printf("pub data to topic:%s\n", vars->g_mqtt_info.dataTopic);
+
+		char seed[MAX_LEN * 2];
+		snprintf(seed, sizeof(seed), "%s %s", vars->g_mqtt_info.endpoint, vars->g_mqtt_info.configTopic);
+		char clientid[MAX_LEN];
+		amqtt_clientid(clientid, MAX_LEN, "bacnetGW", seed);
+		if (amqtt_create(&(vars->g_mqtt_client), vars->g_mqtt_info.endpoint, clientid,
+				vars->g_mqtt_info.user, vars->g_mqtt_info.password, PEM_FILE,
+				MSG_BUF_SIZE, MAX_INFLIGHT, vars->g_mqtt_info.pubQos) != 0) {
+			printf("Failed to create the mqtt client\n");
+			pthread_mutex_unlock(&(vars->g_mqtt_client_mutex));
+			return;
+		}
+		amqtt_set_latency_histogram(&(vars->g_mqtt_client), &(vars->g_publish_latency));
+		amqtt_set_rate_limit(&(vars->g_mqtt_client), vars->g_mqtt_info.mqttRateLimit,
+				vars->g_mqtt_info.mqttRateBurst);
 
+		if (vars->g_mqtt_info.mqttVersion == 5 
+			&& amqtt_enable_mqtt5(&(vars->g_mqtt_client), vars->g_mqtt_info.mqttMaxPacketSize) != 0) {
+			printf("mqtt 5 is not supported by the paho library, using mqtt 3.1.1\n");
+		}
 
-int isBufferFull() {
-	return g_buffSize >= MSG_BUF_SIZE;
-}
+		if (vars->g_mqtt_info.spoolDir != NULL && strlen(vars->g_mqtt_info.spoolDir) > 0) {
+			long long maxBytes = (long long)vars->g_mqtt_info.spoolMaxMB * 1024 * 1024;
+			if (amqtt_enable_spool(&(vars->g_mqtt_client), vars->g_mqtt_info.spoolDir, maxBytes) != 0) {
+				printf("failed to enable the spool %s\n", vars->g_mqtt_info.spoolDir);
+			}
+		}
 
-int isBufferEmpty() {
-	return g_buffSize <= 0;
-}
+		if (vars->g_mqtt_info.compress) {
+			char dict[ZLIB_DICT_LEN];
+			int dictLen = build_zlib_dictionary(dict, ZLIB_DICT_LEN);
+			if (amqtt_enable_compression(&(vars->g_mqtt_client), dict, dictLen) != 0) {
+				printf("failed to enable the compression\n");
+			}
+		}
 
-int putBuffData(char* data) {
-	// if full, them overwrite the oldest one
-	int idx = (g_buffSize + g_buffHead) % MSG_BUF_SIZE;
-	if (isBufferFull()) {
-		free(g_dataToSend[idx]);
-		g_dataToSend[idx] = data;
-		g_buffHead = (g_buffHead + 1) % MSG_BUF_SIZE;
-		g_buffSize = MSG_BUF_SIZE;
-		return 0;
-	} else {
-		g_dataToSend[idx] = data;
-		g_buffSize++;
-		return 1;
+		char* topics[2];
+		int count = 0;
+		topics[count++] = vars->g_mqtt_info.configTopic;
+		if (vars->g_mqtt_info.controlTopic != NULL && strlen(vars->g_mqtt_info.controlTopic) > 0) {
+			topics[count++] = vars->g_mqtt_info.controlTopic;
+		}
+		amqtt_set_subscriptions(&(vars->g_mqtt_client), topics, count, NULL, 
+			connection_lost, msg_arrived);
+		vars->g_mqtt_client_created = 1;
 	}
-}
+	pthread_mutex_unlock(&(vars->g_mqtt_client_mutex));
 
-char* getBuffData() {
-	if (isBufferEmpty()) {
-		return NULL;
-	} else {
-		char* ret = g_dataToSend[g_buffHead];
-		g_buffHead = (g_buffHead + 1) % MSG_BUF_SIZE;
-		g_buffSize--;
-		return ret;
-	}
+	// non-blocking, and backed off if the broker keeps refusing us
+	amqtt_connect(&(vars->g_mqtt_client));
 }
 
-void set_ssl_option(MQTTClient_connectOptions* conn_opts, char* host)
-{
-    char* ssl = "ssl://";
-    char* ssl_upper = "SSL://";
-    if (strncmp(ssl, host, strlen(ssl)) == 0
-        || strncmp(ssl_upper, host, strlen(ssl_upper)) == 0)
-    {
-        g_sslopts.trustStore = PEM_FILE;
-        g_sslopts.enableServerCertAuth = 1;
-        conn_opts->ssl = &g_sslopts;
-    }
+int sendData(char* data, GlobalVar* vars) {
+	if (data == NULL) {
+		return -1;
+	}
+	return sendDataLen(data, strlen(data), vars);
 }
 
+int sendDataLen(char* data, int len, GlobalVar* vars) {
+	// send data to the dataTopic. the message is queued, and sent in the
+	// background by the mqtt client, it's kept while the client is not connected
+	if (data == NULL) {
+		return -1;
+	}
 
-void start_mqtt_client(GlobalVar* vars, 
-	connection_lost_fun connection_lost, 
-	msg_arrived_fun msg_arrived,
-	delivered_fun delivered) {
-	printf("connecting gateway to cloud...\n");
-	printf("endpoint:%s\n", vars->g_mqtt_info.endpoint);
-	printf("user:%s\n", vars->g_mqtt_info.user);
-	printf("sub config from topic:%s\n", vars->g_mqtt_info.configTopic);
-	printf("pub data to topic:%s\n", vars->g_mqtt_info.dataTopic);
-
-	pthread_mutex_lock(&(vars->g_mqtt_client_mutex));
-    MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
-
-    char clientid[MAX_LEN];
-    snprintf(clientid, MAX_LEN, "bacnetGW%lld", (long long)time(NULL));
-    MQTTClient_create(&(vars->g_mqtt_client), vars->g_mqtt_info.endpoint, clientid,
-        MQTTCLIENT_PERSISTENCE_NONE, NULL);
-
-    conn_opts.keepAliveInterval = 50;
-    conn_opts.cleansession = 1;
-    conn_opts.username = vars->g_mqtt_info.user;
-    conn_opts.password = vars->g_mqtt_info.password;
-    set_ssl_option(&conn_opts, vars->g_mqtt_info.endpoint);
-
-    MQTTClient_setCallbacks(vars->g_mqtt_client, NULL, connection_lost, msg_arrived, delivered);
-
-    int rc = 0;
-    if ((rc = MQTTClient_connect(vars->g_mqtt_client, &conn_opts)) != MQTTCLIENT_SUCCESS)
-    {
-        printf("Failed to connect, return code %d\n", rc);
-        pthread_mutex_unlock(&(vars->g_mqtt_client_mutex));
-
-        return;
-    }
-    if (vars->g_mqtt_info.controlTopic != NULL && strlen(vars->g_mqtt_info.controlTopic) > 0) {
-    	char* topics[2];
-    	topics[0] = vars->g_mqtt_info.configTopic;
-    	topics[1] = vars->g_mqtt_info.controlTopic;
-    	int qoss[2];
-    	qoss[0] = 0;
-    	qoss[1] = 0;
-    	MQTTClient_subscribeMany(vars->g_mqtt_client, 2, topics, qoss);
-    } else {
-    	MQTTClient_subscribe(vars->g_mqtt_client, vars->g_mqtt_info.configTopic, 0);
+	int rc = -1;
+	if (vars != NULL && vars->g_mqtt_client_created) {
+		rc = amqtt_publish(&(vars->g_mqtt_client), vars->g_mqtt_info.dataTopic, 
+			data, len, 0);
 	}
-    vars->g_gateway_connected = 1;
-    pthread_mutex_unlock(&(vars->g_mqtt_client_mutex));
+	if (rc != 0) {
+		log_debug("mqtt client is not created, dropping the data");
+	}
+	free(data);
 
-    printf("gateway started!\n");
+	return rc;
 }
 
-// return -1 if failed, 0 otherwise
-int sendAMessage(char*data, MQTTClient client, char* topic) {
-	MQTTClient_message pubmsg = MQTTClient_message_initializer;
-	MQTTClient_deliveryToken delivery_token;
-	pubmsg.payload = data;
-	pubmsg.payloadlen = strlen(data);
-	pubmsg.qos = 0;
-	pubmsg.retained = 0;
-
-	int rc = MQTTClient_publishMessage(client, topic, &pubmsg, &delivery_token);
-	if (rc == MQTTCLIENT_SUCCESS) {
-		MQTTClient_waitForCompletion(client, delivery_token, 1000L);
-		return 0;
-	} else {
-		return -1; // failed to send
+int sendAck(char* data, GlobalVar* vars) {
+	if (data == NULL) {
+		return -1;
 	}
-}
+	int rc = -1;
+	if (vars != NULL && vars->g_mqtt_info.ackTopic != NULL && vars->g_mqtt_client_created) {
+		rc = amqtt_publish(&(vars->g_mqtt_client), vars->g_mqtt_info.ackTopic,
+			data, strlen(data), 0);
+	}
+	free(data);
 
-int sendData(char* data, GlobalVar* vars) {
-	// send data to the dataTopic
+	return rc;
+}
 
-	// if mqtt client is not in a good state, then cache the data for later send
+int sendAlarm(char* data, GlobalVar* vars) {
 	if (data == NULL) {
 		return -1;
 	}
-
-	if (vars == NULL || !MQTTClient_isConnected(vars->g_mqtt_client)) {
-		putBuffData(data);
-		log_debug("mqtt client is not connected, caching the data");
-		return 0;
+	int rc = -1;
+	if (vars != NULL && vars->g_mqtt_client_created) {
+		const char* topic = vars->g_mqtt_info.alarmTopic != NULL
+			? vars->g_mqtt_info.alarmTopic : vars->g_mqtt_info.dataTopic;
+		rc = amqtt_publish_urgent(&(vars->g_mqtt_client), topic, data, strlen(data), 0);
 	}
-
-	// send the data
-	int rc = sendAMessage(data, vars->g_mqtt_client, vars->g_mqtt_info.dataTopic);
-	if (rc == 0) {
-		free(data);
-
-		// send the buffered data if any
-		char* buffData = NULL;
-		int cnt = 0;
-		while (rc == 0 && ! isBufferEmpty()) {
-			buffData = getBuffData();
-			rc = sendAMessage(buffData, vars->g_mqtt_client, vars->g_mqtt_info.dataTopic);
-			if (rc == 0) {
-				cnt++;
-				free(buffData);
-				buffData = NULL;
-			} else {
-				// send mqtt message failed
-				putBuffData(buffData);
-				break;
-			}
-		}
-		if (cnt > 0) {
-			snprintf(LOG_BUFF, BUFF_LEN, "sent %d message from cache", cnt);
-			log_debug(LOG_BUFF);
-		}
-
-	} else {
-		// cache the data, and mark the mqtt client need reconnect
-		snprintf(LOG_BUFF, BUFF_LEN, 
-			"failed to send a mqtt message, return code=%d. Caching it for later sending", rc);
-		log_debug(LOG_BUFF);
-		putBuffData(data);
-		pthread_mutex_lock(& vars->g_gateway_mutex);
-		vars->g_gateway_connected = 0;
-		pthread_mutex_unlock(& vars->g_gateway_mutex);
+	if (rc != 0) {
+		log_debug("mqtt client is not created, dropping the alarm");
 	}
+	free(data);
 
-	return 0;
+	return rc;
 }
 
 void mqtt_cleanup(GlobalVar* vars) {
-	MQTTClient_disconnect(vars->g_mqtt_client, 500);
-}
\ No newline at end of file
+	if (vars->g_mqtt_client_created) {
+		amqtt_destroy(&(vars->g_mqtt_client), 500);
+		vars->g_mqtt_client_created = 0;
+	}
+}
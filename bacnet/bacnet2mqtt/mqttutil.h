@@ -3,24 +3,32 @@
 #ifndef INF_BCE_IOT_BAC2MQTT_MQTTUTIL_H
 #define INF_BCE_IOT_BAC2MQTT_MQTTUTIL_H
 
-#include <MQTTClient.h>
+#include <MQTTAsync.h>
 
 #include "data.h"
 
 typedef void (*connection_lost_fun)(void*, char*);
 
-typedef void (*delivered_fun)(void*, MQTTClient_deliveryToken);
-
-typedef int (*msg_arrived_fun)(void*, char*, int, MQTTClient_message*);
+typedef int (*msg_arrived_fun)(void*, char*, int, MQTTAsync_message*);
 
 
 void start_mqtt_client(GlobalVar* vars, 
 	connection_lost_fun connection_lost, 
-	msg_arrived_fun msg_arrived,
-	delivered_fun delivered);
+	msg_arrived_fun msg_arrived);
 
 int sendData(char* data, GlobalVar* vars);
 
+// send len bytes of binary data, which is freed like by sendData
+int sendDataLen(char* data, int len, GlobalVar* vars);
+
+// send the results of a control message to the ackTopic, if configured.
+// data is freed like by sendData
+int sendAck(char* data, GlobalVar* vars);
+
+// send an event notification to the alarmTopic, or to the dataTopic if not
+// configured, ahead of the data queued. data is freed like by sendData
+int sendAlarm(char* data, GlobalVar* vars);
+
 void mqtt_cleanup(GlobalVar* vars);
 
 #endif
\ No newline at end of file
@@ -29,9 +29,10 @@ sudo apt-get --yes --force-yes install autoconf
 echo "3, install libtool"
 sudo apt-get --yes --force-yes install libtool
 
-# 4 install make
-sudo "4. install make"
+# 4 install make and zlib
+sudo "4. install make and zlib"
 sudo apt-get --yes --force-yes install make
+sudo apt-get --yes --force-yes install zlib1g-dev
 
 #5, make a temp dir
 echo "5, make a temp dir"
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "aggregate.h"
+
+#include <stdlib.h>
+
+int agg_init(AggWindow* w, int panes)
+{
+    if (panes < 1)
+    {
+        panes = 1;
+    }
+    if (panes > AGG_MAX_PANES)
+    {
+        panes = AGG_MAX_PANES;
+    }
+    w->panes = (AggStats*) calloc(panes, sizeof(AggStats));
+    w->paneNum = w->panes != NULL ? panes : 0;
+    w->current = 0;
+    return w->panes != NULL ? 0 : -1;
+}
+
+void agg_add(AggWindow* w, double value)
+{
+    AggStats* p = &w->panes[w->current];
+    if (p->count == 0)
+    {
+        p->min = value;
+        p->max = value;
+        p->sum = 0;
+    }
+    else if (value < p->min)
+    {
+        p->min = value;
+    }
+    else if (value > p->max)
+    {
+        p->max = value;
+    }
+    p->sum += value;
+    p->last = value;
+    p->count++;
+}
+
+void agg_summary(const AggWindow* w, AggStats* out)
+{
+    out->count = 0;
+    int i = 0;
+    // from the oldest pane to the one being filled, so the last one wins
+    for (i = 1; i <= w->paneNum; i++)
+    {
+        const AggStats* p = &w->panes[(w->current + i) % w->paneNum];
+        if (p->count == 0)
+        {
+            continue;
+        }
+        if (out->count == 0)
+        {
+            *out = *p;
+            continue;
+        }
+        if (p->min < out->min)
+        {
+            out->min = p->min;
+        }
+        if (p->max > out->max)
+        {
+            out->max = p->max;
+        }
+        out->sum += p->sum;
+        out->last = p->last;
+        out->count += p->count;
+    }
+}
+
+void agg_slide(AggWindow* w)
+{
+    w->current = (w->current + 1) % w->paneNum;
+    w->panes[w->current].count = 0;
+}
+
+void agg_destroy(AggWindow* w)
+{
+    free(w->panes);
+    w->panes = NULL;
+    w->paneNum = 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_AGGREGATE_H
+#define INF_BCE_IOT_EDGE_SDK_AGGREGATE_H
+
+// the statistics of the samples of one point over a window, kept at the
+// edge so that a point polled every second uploads a summary a minute. a
+// window of windowMs sliding by hopMs is kept as windowMs / hopMs panes of
+// hopMs, a ring of the statistics of each: a sample updates the pane being
+// filled, O(1), and a summary merges the panes once a hop. with one pane the
+// windows are tumbling
+
+enum
+{
+    AGG_MAX_PANES = 1024
+};
+
+typedef struct
+{
+    int count;                      // samples, the rest is undefined while 0
+    double min;
+    double max;
+    double sum;
+    double last;
+} AggStats;
+
+typedef struct
+{
+    AggStats* panes;
+    int paneNum;
+    int current;                    // the pane being filled
+} AggWindow;
+
+// panes is 1 to AGG_MAX_PANES. return 0 on success, -1 if out of memory
+int agg_init(AggWindow* w, int panes);
+
+void agg_add(AggWindow* w, double value);
+
+// the statistics of the samples in the window, the last is the one of the
+// latest pane with samples. count is 0 if there are none
+void agg_summary(const AggWindow* w, AggStats* out);
+
+// the pane being filled is done, the oldest one is dropped to make room for
+// the next. with one pane, the window starts over
+void agg_slide(AggWindow* w);
+
+void agg_destroy(AggWindow* w);
+
+#endif
@@ -0,0 +1,1047 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_mqtt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum {SEND_RETRY_MS = 100, SPOOL_REPLAY_BATCH = 64, SPOOL_SEGMENT_BYTES = 4 * 1024 * 1024,
+    SEND_BATCH = 16};
+
+// the context of one message in flight
+typedef struct
+{
+    AsyncMqtt* m;
+    AmqttMsg msg;
+    int urgent;                     // taken from the urgent queue
+} AmqttSend;
+
+static void free_msg(AmqttMsg* msg)
+{
+    free(msg->topic);
+    free(msg->payload);
+    msg->topic = NULL;
+    msg->payload = NULL;
+}
+
+static void on_send_success(void* context, MQTTAsync_successData* response);
+
+static void on_send_failure(void* context, MQTTAsync_failureData* response);
+
+static long long now_us();
+
+// put the message back to the front of the queue, drop it if there is no room
+static void requeue(AsyncMqtt* m, AmqttMsg* msg)
+{
+    if (m->size >= m->capacity)
+    {
+        m->dropped++;
+        free_msg(msg);
+        return;
+    }
+    m->head = (m->head + m->capacity - 1) % m->capacity;
+    m->queue[m->head] = *msg;
+    m->size++;
+}
+
+// requeue the message of the send to the front of the queue it was taken from.
+// an urgent one goes to the other queue if the urgent one is full meanwhile
+static void requeue_send(AsyncMqtt* m, AmqttSend* send)
+{
+    if (send->urgent && m->urgentSize < AMQTT_URGENT_CAPACITY)
+    {
+        m->urgentHead = (m->urgentHead + AMQTT_URGENT_CAPACITY - 1) % AMQTT_URGENT_CAPACITY;
+        m->urgent[m->urgentHead] = send->msg;
+        m->urgentSize++;
+        return;
+    }
+    requeue(m, &send->msg);
+}
+
+static void on_send_success(void* context, MQTTAsync_successData* response)
+{
+    AmqttSend* send = (AmqttSend*) context;
+    AsyncMqtt* m = send->m;
+    if (m->latency != NULL)
+    {
+        hist_record(m->latency, now_us() - send->msg.queuedUs);
+    }
+    if (send->msg.traceId != 0)
+    {
+        trace_span("publish", send->msg.traceId, send->msg.queuedUs * 1000, trace_now_ns());
+    }
+    pthread_mutex_lock(&m->lock);
+    m->inflight--;
+    m->sent++;
+    pthread_cond_broadcast(&m->wakeup);
+    pthread_mutex_unlock(&m->lock);
+    free_msg(&send->msg);
+    free(send);
+}
+
+static void on_send_failure(void* context, MQTTAsync_failureData* response)
+{
+    AmqttSend* send = (AmqttSend*) context;
+    AsyncMqtt* m = send->m;
+    pthread_mutex_lock(&m->lock);
+    m->inflight--;
+    m->failed++;
+    // most likely the connection is lost, it's resent after reconnecting
+    requeue_send(m, send);
+    pthread_cond_broadcast(&m->wakeup);
+    pthread_mutex_unlock(&m->lock);
+    free(send);
+}
+
+// the aliases are only known to the connection they are assigned on
+static void reset_topic_aliases(AsyncMqtt* m)
+{
+    int i = 0;
+    for (i = 0; i < m->aliasCount; i++)
+    {
+        free(m->aliasTopics[i]);
+        m->aliasTopics[i] = NULL;
+    }
+    m->aliasCount = 0;
+}
+
+static void on_connected(void* context, char* cause)
+{
+    AsyncMqtt* m = (AsyncMqtt*) context;
+    pthread_mutex_lock(&m->lock);
+    m->connected = 1;
+    m->connecting = 0;
+    m->connectFailures = 0;
+    m->downSince = 0;
+    reset_topic_aliases(m);
+    pthread_cond_broadcast(&m->wakeup);
+    pthread_mutex_unlock(&m->lock);
+    // the subscriptions are only set before connecting, no need to lock
+    if (m->subCount > 0)
+    {
+        MQTTAsync_subscribeMany(m->client, m->subCount, m->subTopics, m->subQos, NULL);
+    }
+}
+
+static long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// wait on the wakeup condition for ms at most, must be called with the lock held
+static void wait_ms(AsyncMqtt* m, int ms)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&m->wakeup, &m->lock, &ts);
+}
+
+// the token bucket of the rate limit: ratePerSec tokens a second, rateBurst
+// at most, a publish takes one. return how many of count may go now, they
+// are taken. must be called with the lock held
+static int take_tokens(AsyncMqtt* m, int count)
+{
+    if (m->ratePerSec <= 0)
+    {
+        return count;
+    }
+    long long now = now_us();
+    m->tokens += (double)(now - m->tokensUs) * m->ratePerSec / 1000000;
+    m->tokensUs = now;
+    if (m->tokens > m->rateBurst)
+    {
+        m->tokens = m->rateBurst;
+    }
+    if (count > (int)m->tokens)
+    {
+        count = (int)m->tokens;
+    }
+    m->tokens -= count;
+    return count;
+}
+
+// move a batch of the spooled messages to the queue, the spooling ends once the
+// spool is drained. must be called with the lock held, it's released meanwhile
+static void refill_from_spool(AsyncMqtt* m)
+{
+    AmqttMsg batch[SPOOL_REPLAY_BATCH];
+    int room = m->capacity - m->size;
+    if (room > SPOOL_REPLAY_BATCH)
+    {
+        room = SPOOL_REPLAY_BATCH;
+    }
+    pthread_mutex_unlock(&m->lock);
+    int count = 0;
+    while (count < room && spool_pop(m->spool, &batch[count].topic, &batch[count].payload, 
+        &batch[count].len, &batch[count].retained))
+    {
+        count++;
+    }
+    pthread_mutex_lock(&m->lock);
+
+    long long now = now_us();
+    int i = 0;
+    for (i = 0; i < count; i++)
+    {
+        batch[i].queuedUs = now;
+        batch[i].traceId = 0;
+        // the failed sends may have taken the room meanwhile
+        if (m->size >= m->capacity)
+        {
+            free_msg(&m->queue[m->head]);
+            m->head = (m->head + 1) % m->capacity;
+            m->size--;
+            m->dropped++;
+        }
+        m->queue[(m->head + m->size) % m->capacity] = batch[i];
+        m->size++;
+    }
+    if (count < room && m->spoolWriters == 0 && spool_count(m->spool) == 0)
+    {
+        m->spooling = 0;
+    }
+    else if (count == 0)
+    {
+        // a message is being appended, it's signaled when done
+        wait_ms(m, SEND_RETRY_MS);
+    }
+}
+
+#ifdef MQTTVERSION_5
+// the alias of the topic on this connection, 0 if it has none. *known is set
+// if the broker knows it already, the topic is left out then. only the qos 0
+// messages are aliased, the qos 1 ones may be resent on the next connection
+// where the alias means nothing. a reconnect between this and the send may
+// still let an unknown alias through, the broker drops the connection then
+// and the aliases start over
+static int topic_alias(AsyncMqtt* m, const char* topic, int* known)
+{
+    *known = 0;
+    if (!m->mqtt5 || m->qos != 0)
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&m->lock);
+    int alias = 0;
+    int i = 0;
+    for (i = 0; i < m->aliasCount && alias == 0; i++)
+    {
+        if (strcmp(m->aliasTopics[i], topic) == 0)
+        {
+            alias = i + 1;
+            *known = 1;
+        }
+    }
+    if (alias == 0 && m->aliasCount < m->aliasMax && m->aliasCount < AMQTT_MAX_TOPIC_ALIASES)
+    {
+        m->aliasTopics[m->aliasCount] = strdup(topic);
+        if (m->aliasTopics[m->aliasCount] != NULL)
+        {
+            alias = ++m->aliasCount;
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+    return alias;
+}
+#endif
+
+// hand a message to the client, the lock is not held. return 0 if it's sent,
+// the send is not freed then
+static int send_msg(AsyncMqtt* m, AmqttSend* send)
+{
+    MQTTAsync_message pubmsg = MQTTAsync_message_initializer;
+    pubmsg.payload = send->msg.payload;
+    pubmsg.payloadlen = send->msg.len;
+    pubmsg.qos = m->qos;
+    pubmsg.retained = send->msg.retained;
+
+    MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+    opts.onSuccess = on_send_success;
+    opts.onFailure = on_send_failure;
+    opts.context = send;
+    const char* topic = send->msg.topic;
+#ifdef MQTTVERSION_5
+    // the fixed header, the topic and the packet id of the publish, and its
+    // properties are well below 64 bytes
+    if (m->serverMaxPacket > 0 && send->msg.len + (int)strlen(topic) + 64 > m->serverMaxPacket)
+    {
+        // the broker would drop the connection, with everything in flight
+        pthread_mutex_lock(&m->lock);
+        m->inflight--;
+        m->dropped++;
+        pthread_cond_broadcast(&m->wakeup);
+        pthread_mutex_unlock(&m->lock);
+        free_msg(&send->msg);
+        free(send);
+        return 0;
+    }
+    int known = 0;
+    int alias = topic_alias(m, topic, &known);
+    if (alias > 0)
+    {
+        MQTTProperty property;
+        property.identifier = MQTTPROPERTY_CODE_TOPIC_ALIAS;
+        property.value.integer2 = alias;
+        MQTTProperties_add(&pubmsg.properties, &property);
+        topic = known ? "" : topic;
+    }
+    int rc = MQTTAsync_sendMessage(m->client, topic, &pubmsg, &opts);
+    MQTTProperties_free(&pubmsg.properties);
+    return rc == MQTTASYNC_SUCCESS ? 0 : -1;
+#else
+    return MQTTAsync_sendMessage(m->client, topic, &pubmsg, &opts) == MQTTASYNC_SUCCESS ? 0 : -1;
+#endif
+}
+
+// the publisher thread is the only one handing the queued messages to the
+// client, the lock is not held meanwhile. so the threads publishing only wait
+// for the queue, never for the client or the network. the messages are taken
+// in batches of up to the free in-flight window, one lock for the batch.
+// the urgent queue is emptied first, into the extra slots if the window is full
+static void* publisher_func(void* arg)
+{
+    AsyncMqtt* m = (AsyncMqtt*) arg;
+    AmqttSend* batch[SEND_BATCH];
+    pthread_mutex_lock(&m->lock);
+    while (!m->stopping)
+    {
+        int urgent = m->urgentSize > 0 && m->inflight < m->maxInflight + AMQTT_URGENT_INFLIGHT;
+        if (m->connected && !urgent && m->spooling && m->size <= m->capacity / 2)
+        {
+            refill_from_spool(m);
+            continue;
+        }
+        if (!m->connected || (!urgent && (m->size == 0 || m->inflight >= m->maxInflight)))
+        {
+            pthread_cond_wait(&m->wakeup, &m->lock);
+            continue;
+        }
+        int count = m->maxInflight - m->inflight;
+        int size = m->size;
+        if (urgent)
+        {
+            count += AMQTT_URGENT_INFLIGHT;
+            size = m->urgentSize;
+        }
+        if (count > size)
+        {
+            count = size;
+        }
+        if (count > SEND_BATCH)
+        {
+            count = SEND_BATCH;
+        }
+        int allowed = take_tokens(m, count);
+        if (allowed == 0)
+        {
+            // until the next token, the queue takes the burst meanwhile
+            m->throttled++;
+            wait_ms(m, (int)((1 - m->tokens) * 1000 / m->ratePerSec) + 1);
+            continue;
+        }
+        count = allowed;
+        int i = 0;
+        for (i = 0; i < count; i++)
+        {
+            batch[i] = (AmqttSend*) malloc(sizeof(AmqttSend));
+            if (batch[i] == NULL)
+            {
+                break;
+            }
+            // only this thread takes from the head, the others append to the tail
+            batch[i]->m = m;
+            batch[i]->urgent = urgent;
+            if (urgent)
+            {
+                batch[i]->msg = m->urgent[m->urgentHead];
+                m->urgentHead = (m->urgentHead + 1) % AMQTT_URGENT_CAPACITY;
+                m->urgentSize--;
+            }
+            else
+            {
+                batch[i]->msg = m->queue[m->head];
+                m->head = (m->head + 1) % m->capacity;
+                m->size--;
+            }
+            m->inflight++;
+        }
+        // the tokens of the sends not made are given back
+        m->tokens += count - i;
+        if (i == 0)
+        {
+            wait_ms(m, SEND_RETRY_MS);
+            continue;
+        }
+        count = i;
+        pthread_mutex_unlock(&m->lock);
+
+        for (i = 0; i < count && send_msg(m, batch[i]) == 0; i++)
+        {
+        }
+
+        pthread_mutex_lock(&m->lock);
+        if (i < count)
+        {
+            // keep the unsent ones at the front of the queue in their order,
+            // and retry a bit later
+            int j = 0;
+            for (j = count - 1; j >= i; j--)
+            {
+                m->inflight--;
+                requeue_send(m, batch[j]);
+                free(batch[j]);
+            }
+            m->tokens += count - i;
+            wait_ms(m, SEND_RETRY_MS);
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+    return NULL;
+}
+
+static void on_connect_failure(void* context, MQTTAsync_failureData* response)
+{
+    AsyncMqtt* m = (AsyncMqtt*) context;
+    pthread_mutex_lock(&m->lock);
+    m->connecting = 0;
+    // the automatic reconnect only covers a lost connection, back off the
+    // retries of the first connect here, 1s to 60s, randomized in
+    // [backoff/2, backoff]
+    long long backoff = 1000;
+    int i = 0;
+    for (i = 0; i < m->connectFailures && backoff < 60000; i++)
+    {
+        backoff *= 2;
+    }
+    if (backoff > 60000)
+    {
+        backoff = 60000;
+    }
+    m->connectFailures++;
+    m->nextConnect = now_ms() + backoff / 2 + rand_r(&m->seed) % (backoff / 2 + 1);
+    pthread_mutex_unlock(&m->lock);
+    printf("failed to connect mqtt, rc=%d\n", response != NULL ? response->code : 0);
+}
+
+#ifdef MQTTVERSION_5
+// the limits of the broker come with its connack, on every (re)connect
+static void on_connect_success5(void* context, MQTTAsync_successData5* response)
+{
+    AsyncMqtt* m = (AsyncMqtt*) context;
+    long long aliasMax = MQTTProperties_getNumericValue(&response->properties, 
+        MQTTPROPERTY_CODE_TOPIC_ALIAS_MAXIMUM);
+    long long maxPacket = MQTTProperties_getNumericValue(&response->properties, 
+        MQTTPROPERTY_CODE_MAXIMUM_PACKET_SIZE);
+    pthread_mutex_lock(&m->lock);
+    // not given means no aliases, and no limit of the packet size
+    m->aliasMax = aliasMax > 0 ? (int)aliasMax : 0;
+    m->serverMaxPacket = maxPacket > 0 ? (int)maxPacket : 0;
+    pthread_mutex_unlock(&m->lock);
+}
+
+static void on_connect_failure5(void* context, MQTTAsync_failureData5* response)
+{
+    MQTTAsync_failureData failure;
+    memset(&failure, 0, sizeof(failure));
+    failure.code = response != NULL ? response->code : 0;
+    on_connect_failure(context, &failure);
+}
+#endif
+
+// the user callbacks are called from the ones of the client, so that
+// the connection state is tracked as well
+static void on_connection_lost(void* context, char* cause)
+{
+    AsyncMqtt* m = (AsyncMqtt*) context;
+    pthread_mutex_lock(&m->lock);
+    if (m->connected)
+    {
+        m->disconnects++;
+        m->downSince = now_ms();
+    }
+    m->connected = 0;
+    pthread_mutex_unlock(&m->lock);
+    if (m->userConnectionLost != NULL)
+    {
+        m->userConnectionLost(m->userContext, cause);
+    }
+}
+
+static int on_message_arrived(void* context, char* topicName, int topicLen, 
+    MQTTAsync_message* message)
+{
+    AsyncMqtt* m = (AsyncMqtt*) context;
+    if (m->userMessageArrived != NULL)
+    {
+        return m->userMessageArrived(m->userContext, topicName, topicLen, message);
+    }
+    MQTTAsync_freeMessage(&message);
+    MQTTAsync_free(topicName);
+    return 1;
+}
+
+// create the paho client for the version and the persistence chosen so far,
+// replacing the one there, which is not connected yet. the old one goes first,
+// it may have the journal open. return 0 on success, -1 otherwise
+static int create_client(AsyncMqtt* m)
+{
+    if (m->client != NULL)
+    {
+        MQTTAsync_destroy(&m->client);
+    }
+    int type = MQTTCLIENT_PERSISTENCE_NONE;
+    void* context = NULL;
+    if (m->persistDir[0] != 0)
+    {
+        mpersist_init(&m->persistence, m->persistDir);
+        type = MQTTCLIENT_PERSISTENCE_USER;
+        context = &m->persistence;
+    }
+    MQTTAsync_createOptions create_opts = MQTTAsync_createOptions_initializer;
+#ifdef MQTTVERSION_5
+    if (m->mqtt5)
+    {
+        create_opts.MQTTVersion = MQTTVERSION_5;
+    }
+#endif
+    if (MQTTAsync_createWithOptions(&m->client, m->endpoint, m->clientid, type, context, 
+        &create_opts) != MQTTASYNC_SUCCESS)
+    {
+        m->client = NULL;
+        return -1;
+    }
+    MQTTAsync_setCallbacks(m->client, m, on_connection_lost, on_message_arrived, NULL);
+    MQTTAsync_setConnected(m->client, m, on_connected);
+    return 0;
+}
+
+int amqtt_create(AsyncMqtt* m, const char* endpoint, const char* clientid, 
+    const char* user, const char* password, const char* trustStore, 
+    int capacity, int maxInflight, int qos)
+{
+    memset(m, 0, sizeof(AsyncMqtt));
+    if (capacity < 1)
+    {
+        capacity = 1;
+    }
+    if (maxInflight < 1)
+    {
+        maxInflight = 1;
+    }
+    m->queue = (AmqttMsg*) calloc(capacity, sizeof(AmqttMsg));
+    m->urgent = (AmqttMsg*) calloc(AMQTT_URGENT_CAPACITY, sizeof(AmqttMsg));
+    if (m->queue == NULL || m->urgent == NULL)
+    {
+        free(m->queue);
+        free(m->urgent);
+        m->queue = NULL;
+        m->urgent = NULL;
+        return -1;
+    }
+    m->capacity = capacity;
+    m->maxInflight = maxInflight;
+    m->qos = qos;
+    snprintf(m->endpoint, sizeof(m->endpoint), "%s", endpoint);
+    snprintf(m->clientid, sizeof(m->clientid), "%s", clientid);
+    m->downSince = now_ms();
+    m->seed = (unsigned int)m->downSince;
+    const char* c = clientid;
+    for (; c != NULL && *c != 0; c++)
+    {
+        m->seed = m->seed * 33 + (unsigned char)*c;
+    }
+    snprintf(m->user, sizeof(m->user), "%s", user != NULL ? user : "");
+    snprintf(m->password, sizeof(m->password), "%s", password != NULL ? password : "");
+    if (trustStore != NULL && (strncmp(endpoint, "ssl://", 6) == 0 
+        || strncmp(endpoint, "SSL://", 6) == 0))
+    {
+        snprintf(m->trustStore, sizeof(m->trustStore), "%s", trustStore);
+    }
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m->wakeup, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (create_client(m) == 0)
+    {
+        if (pthread_create(&m->publisher, NULL, publisher_func, m) == 0)
+        {
+            return 0;
+        }
+        MQTTAsync_destroy(&m->client);
+    }
+    free(m->queue);
+    free(m->urgent);
+    m->queue = NULL;
+    m->urgent = NULL;
+    pthread_cond_destroy(&m->wakeup);
+    pthread_mutex_destroy(&m->lock);
+    return -1;
+}
+
+void amqtt_clientid(char* buf, int len, const char* prefix, const char* seed)
+{
+    // fnv-1a
+    unsigned int h = 2166136261u;
+    const char* c = seed;
+    for (; c != NULL && *c != 0; c++)
+    {
+        h = (h ^ (unsigned char)*c) * 16777619u;
+    }
+    snprintf(buf, len, "%s%08x", prefix, h);
+}
+
+int amqtt_enable_spool(AsyncMqtt* m, const char* dir, long long maxBytes)
+{
+    Spool* spool = (Spool*) malloc(sizeof(Spool));
+    if (spool == NULL || spool_open(spool, dir, maxBytes, SPOOL_SEGMENT_BYTES) != 0)
+    {
+        free(spool);
+        return -1;
+    }
+    pthread_mutex_lock(&m->lock);
+    m->spool = spool;
+    // the messages left by the previous run are replayed first
+    m->spooling = spool_count(spool) > 0;
+    pthread_mutex_unlock(&m->lock);
+    if (m->qos > 0)
+    {
+        snprintf(m->persistDir, sizeof(m->persistDir), "%s", dir);
+        if (create_client(m) != 0)
+        {
+            printf("failed to keep the mqtt messages in flight in %s\n", dir);
+            m->persistDir[0] = 0;
+            return create_client(m);
+        }
+    }
+    return 0;
+}
+
+int amqtt_enable_mqtt5(AsyncMqtt* m, int maxPacketSize)
+{
+#ifdef MQTTVERSION_5
+    // the version is chosen when the client is created, it's not connected
+    // yet so it's simply created again
+    m->mqtt5 = 1;
+    m->maxPacketSize = maxPacketSize > 0 ? maxPacketSize : 0;
+    if (create_client(m) != 0)
+    {
+        m->mqtt5 = 0;
+        create_client(m);
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int amqtt_enable_compression(AsyncMqtt* m, const char* dict, int dictLen)
+{
+    Compressor* compressor = (Compressor*) malloc(sizeof(Compressor));
+    if (compressor == NULL || compressor_init(compressor, dict, dictLen) != 0)
+    {
+        free(compressor);
+        return -1;
+    }
+    m->compressor = compressor;
+    return 0;
+}
+
+void amqtt_set_latency_histogram(AsyncMqtt* m, Histogram* h)
+{
+    m->latency = h;
+}
+
+void amqtt_set_rate_limit(AsyncMqtt* m, int perSecond, int burst)
+{
+    pthread_mutex_lock(&m->lock);
+    m->ratePerSec = perSecond > 0 ? perSecond : 0;
+    m->rateBurst = burst > 0 ? burst : perSecond / 10;
+    if (m->rateBurst < 1)
+    {
+        m->rateBurst = 1;
+    }
+    m->tokens = m->rateBurst;
+    m->tokensUs = now_us();
+    pthread_cond_broadcast(&m->wakeup);
+    pthread_mutex_unlock(&m->lock);
+}
+
+void amqtt_set_subscriptions(AsyncMqtt* m, char** topics, int count, 
+    void* context, MQTTAsync_connectionLost* cl, MQTTAsync_messageArrived* ma)
+{
+    pthread_mutex_lock(&m->lock);
+    int i = 0;
+    m->subTopics = (char**) calloc(count, sizeof(char*));
+    m->subQos = (int*) calloc(count, sizeof(int));
+    for (i = 0; i < count; i++)
+    {
+        m->subTopics[i] = strdup(topics[i]);
+        m->subQos[i] = 0;
+    }
+    m->subCount = count;
+    m->userContext = context;
+    m->userConnectionLost = cl;
+    m->userMessageArrived = ma;
+    pthread_mutex_unlock(&m->lock);
+}
+
+int amqtt_set_will(AsyncMqtt* m, const char* topic, const char* payload, int retained)
+{
+    char* t = strdup(topic);
+    char* p = strdup(payload);
+    if (t == NULL || p == NULL)
+    {
+        free(t);
+        free(p);
+        return -1;
+    }
+    free(m->willTopic);
+    free(m->willPayload);
+    m->willTopic = t;
+    m->willPayload = p;
+    m->willRetained = retained;
+    return 0;
+}
+
+int amqtt_connect(AsyncMqtt* m)
+{
+    pthread_mutex_lock(&m->lock);
+    if (m->connected || m->connecting)
+    {
+        pthread_mutex_unlock(&m->lock);
+        return 0;
+    }
+    if (now_ms() < m->nextConnect)
+    {
+        pthread_mutex_unlock(&m->lock);
+        return -1;
+    }
+    // the client is called without the lock, so that publishing is not held up
+    m->connecting = 1;
+    pthread_mutex_unlock(&m->lock);
+
+    MQTTAsync_connectOptions conn_opts = MQTTAsync_connectOptions_initializer;
+#ifdef MQTTVERSION_5
+    MQTTProperties props = MQTTProperties_initializer;
+#endif
+    MQTTAsync_SSLOptions ssl_opts = MQTTAsync_SSLOptions_initializer;
+    MQTTAsync_willOptions will_opts = MQTTAsync_willOptions_initializer;
+    conn_opts.keepAliveInterval = 50;
+    // keep the session, the messages of qos 1 sent while the client was away
+    // are delivered once it's back. the subscriptions are renewed anyway
+    conn_opts.cleansession = 0;
+    conn_opts.username = m->user;
+    conn_opts.password = m->password;
+    conn_opts.automaticReconnect = 1;
+    conn_opts.minRetryInterval = 1;
+    conn_opts.maxRetryInterval = 60;
+    conn_opts.onFailure = on_connect_failure;
+    conn_opts.context = m;
+#ifdef MQTTVERSION_5
+    if (m->mqtt5)
+    {
+        // the session is kept by cleanstart=0 and its expiry instead
+        conn_opts.MQTTVersion = MQTTVERSION_5;
+        conn_opts.cleansession = 0;
+        conn_opts.cleanstart = 0;
+        conn_opts.onFailure = NULL;
+        conn_opts.onSuccess5 = on_connect_success5;
+        conn_opts.onFailure5 = on_connect_failure5;
+        MQTTProperty property;
+        property.identifier = MQTTPROPERTY_CODE_SESSION_EXPIRY_INTERVAL;
+        property.value.integer4 = AMQTT_SESSION_EXPIRY;
+        MQTTProperties_add(&props, &property);
+        if (m->maxPacketSize > 0)
+        {
+            property.identifier = MQTTPROPERTY_CODE_MAXIMUM_PACKET_SIZE;
+            property.value.integer4 = m->maxPacketSize;
+            MQTTProperties_add(&props, &property);
+        }
+        conn_opts.connectProperties = &props;
+    }
+#endif
+    if (m->willTopic != NULL)
+    {
+        will_opts.topicName = m->willTopic;
+        will_opts.message = m->willPayload;
+        will_opts.retained = m->willRetained;
+        will_opts.qos = 1;
+        conn_opts.will = &will_opts;
+    }
+    if (strlen(m->trustStore) > 0)
+    {
+        ssl_opts.trustStore = m->trustStore;
+        ssl_opts.enableServerCertAuth = 1;
+        ssl_opts.enabledCipherSuites = AMQTT_TLS_CIPHERS;
+        conn_opts.ssl = &ssl_opts;
+    }
+    int rc = MQTTAsync_connect(m->client, &conn_opts);
+#ifdef MQTTVERSION_5
+    MQTTProperties_free(&props);
+#endif
+    if (rc != MQTTASYNC_SUCCESS)
+    {
+        pthread_mutex_lock(&m->lock);
+        m->connecting = 0;
+        pthread_mutex_unlock(&m->lock);
+    }
+    return rc == MQTTASYNC_SUCCESS ? 0 : -1;
+}
+
+int amqtt_is_connected(AsyncMqtt* m)
+{
+    pthread_mutex_lock(&m->lock);
+    int connected = m->connected;
+    pthread_mutex_unlock(&m->lock);
+    return connected;
+}
+
+int amqtt_publish(AsyncMqtt* m, const char* topic, const char* payload, int len, int retained)
+{
+    return amqtt_publish_traced(m, topic, payload, len, retained, 0);
+}
+
+// the copy of a message to queue, compressed if enabled. return 0 on success
+static int copy_msg(AsyncMqtt* m, AmqttMsg* msg, const char* topic, const char* payload, 
+    int len, int retained, unsigned long long traceId)
+{
+    // compressed into the copy, there is no extra buffer
+    int cap = m->compressor != NULL ? compressor_bound(m->compressor, len) : len;
+    msg->topic = strdup(topic);
+    msg->payload = (char*) malloc(cap > 0 ? cap : 1);
+    msg->len = len;
+    msg->retained = retained;
+    msg->queuedUs = now_us();
+    msg->traceId = traceId;
+    if (msg->topic == NULL || msg->payload == NULL)
+    {
+        free_msg(msg);
+        return -1;
+    }
+    if (m->compressor != NULL)
+    {
+        msg->len = compressor_run(m->compressor, payload, len, msg->payload, cap);
+        if (msg->len < 0)
+        {
+            free_msg(msg);
+            return -1;
+        }
+    }
+    else
+    {
+        memcpy(msg->payload, payload, len);
+    }
+    return 0;
+}
+
+// queue the copy of a message, the lock is held and released
+static int queue_msg(AsyncMqtt* m, AmqttMsg msg)
+{
+    // once the queue overflows, everything goes to the spool while the
+    // connection is down. once it's up the new messages are queued again and
+    // the spool is replayed alongside them, so that the live data is not held
+    // up behind the backlog. the order of the spooled ones is kept
+    if (m->spool != NULL && (m->size >= m->capacity || (m->spooling && !m->connected)))
+    {
+        m->spooling = 1;
+        m->spoolWriters++;
+        pthread_mutex_unlock(&m->lock);
+        int rc = spool_append(m->spool, msg.topic, msg.payload, msg.len, msg.retained);
+        free_msg(&msg);
+        pthread_mutex_lock(&m->lock);
+        m->spoolWriters--;
+        if (rc == 0)
+        {
+            m->spooled++;
+        }
+        else
+        {
+            m->dropped++;
+        }
+        pthread_cond_broadcast(&m->wakeup);
+        pthread_mutex_unlock(&m->lock);
+        return rc;
+    }
+    if (m->size >= m->capacity)
+    {
+        // drop the oldest, the newest data is more valuable
+        free_msg(&m->queue[m->head]);
+        m->head = (m->head + 1) % m->capacity;
+        m->size--;
+        m->dropped++;
+    }
+    m->queue[(m->head + m->size) % m->capacity] = msg;
+    m->size++;
+    pthread_cond_broadcast(&m->wakeup);
+    pthread_mutex_unlock(&m->lock);
+    return 0;
+}
+
+int amqtt_publish_traced(AsyncMqtt* m, const char* topic, const char* payload, int len, 
+    int retained, unsigned long long traceId)
+{
+    AmqttMsg msg;
+    if (copy_msg(m, &msg, topic, payload, len, retained, traceId) != 0)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&m->lock);
+    return queue_msg(m, msg);
+}
+
+int amqtt_publish_urgent(AsyncMqtt* m, const char* topic, const char* payload, int len,
+    int retained)
+{
+    AmqttMsg msg;
+    if (copy_msg(m, &msg, topic, payload, len, retained, 0) != 0)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&m->lock);
+    if (m->urgentSize >= AMQTT_URGENT_CAPACITY)
+    {
+        // a storm of them, the rest waits its turn, or is spooled
+        return queue_msg(m, msg);
+    }
+    m->urgent[(m->urgentHead + m->urgentSize) % AMQTT_URGENT_CAPACITY] = msg;
+    m->urgentSize++;
+    pthread_cond_broadcast(&m->wakeup);
+    pthread_mutex_unlock(&m->lock);
+    return 0;
+}
+
+int amqtt_pending(AsyncMqtt* m)
+{
+    pthread_mutex_lock(&m->lock);
+    int pending = m->size + m->urgentSize + m->inflight;
+    pthread_mutex_unlock(&m->lock);
+    return pending;
+}
+
+void amqtt_health(AsyncMqtt* m, AmqttHealth* health)
+{
+    pthread_mutex_lock(&m->lock);
+    health->connected = m->connected;
+    health->downMs = m->connected ? 0 : now_ms() - m->downSince;
+    health->disconnects = m->disconnects;
+    health->connectFailures = m->connectFailures;
+    health->pending = m->size + m->urgentSize + m->inflight;
+    health->dropped = m->dropped;
+    health->sent = m->sent;
+    health->failed = m->failed;
+    health->spooled = m->spooled;
+    health->spooling = m->spooling;
+    health->throttled = m->throttled;
+    pthread_mutex_unlock(&m->lock);
+}
+
+void amqtt_destroy(AsyncMqtt* m, int timeout_ms)
+{
+    if (m->queue == NULL)
+    {
+        return;
+    }
+    // give the queued messages a chance while still connected
+    long long deadline = now_ms() + timeout_ms;
+    pthread_mutex_lock(&m->lock);
+    while (m->connected && m->size + m->urgentSize + m->inflight > 0 && now_ms() < deadline)
+    {
+        wait_ms(m, (int)(deadline - now_ms()));
+    }
+    m->stopping = 1;
+    pthread_cond_broadcast(&m->wakeup);
+    pthread_mutex_unlock(&m->lock);
+    pthread_join(m->publisher, NULL);
+
+    MQTTAsync_disconnectOptions opts = MQTTAsync_disconnectOptions_initializer;
+    opts.timeout = timeout_ms;
+    MQTTAsync_disconnect(m->client, &opts);
+    MQTTAsync_destroy(&m->client);
+
+    int i = 0;
+    for (i = 0; i < m->urgentSize; i++)
+    {
+        AmqttMsg* msg = &m->urgent[(m->urgentHead + i) % AMQTT_URGENT_CAPACITY];
+        if (m->spool != NULL)
+        {
+            spool_append(m->spool, msg->topic, msg->payload, msg->len, msg->retained);
+        }
+        free_msg(msg);
+    }
+    for (i = 0; i < m->size; i++)
+    {
+        AmqttMsg* msg = &m->queue[(m->head + i) % m->capacity];
+        // not lost over a restart, though they are replayed after the spooled ones
+        if (m->spool != NULL)
+        {
+            spool_append(m->spool, msg->topic, msg->payload, msg->len, msg->retained);
+        }
+        free_msg(msg);
+    }
+    if (m->compressor != NULL)
+    {
+        compressor_destroy(m->compressor);
+        free(m->compressor);
+        m->compressor = NULL;
+    }
+    if (m->spool != NULL)
+    {
+        spool_close(m->spool);
+        free(m->spool);
+        m->spool = NULL;
+    }
+    free(m->queue);
+    free(m->urgent);
+    m->queue = NULL;
+    m->urgent = NULL;
+    for (i = 0; i < m->subCount; i++)
+    {
+        free(m->subTopics[i]);
+    }
+    free(m->subTopics);
+    free(m->subQos);
+    free(m->willTopic);
+    free(m->willPayload);
+    reset_topic_aliases(m);
+    pthread_cond_destroy(&m->wakeup);
+    pthread_mutex_destroy(&m->lock);
+}
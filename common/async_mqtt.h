@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_ASYNC_MQTT_H
+#define INF_BCE_IOT_EDGE_SDK_ASYNC_MQTT_H
+
+#include <pthread.h>
+#include <MQTTAsync.h>
+
+#include "compress.h"
+#include "metrics.h"
+#include "mqtt_persist.h"
+#include "spool.h"
+#include "trace.h"
+
+// an mqtt connection on top of MQTTAsync, shared by the modbus and the bacnet 
+// gateways. publishing never waits on the network: the message is copied into
+// a bounded outbound queue, and handed to the client in batches by a publisher
+// thread of its own once there is room in the in-flight window.
+// the connection is re-established automatically, the subscriptions are renewed
+// on every (re)connect. the retries of the first connect are backed off with
+// jitter, so that the clients of a failed broker don't retry in lockstep.
+// the broker session is kept (cleansession=0) and the client id should be
+// stable, see amqtt_clientid. a blip is resumed by the same MQTTAsync handle,
+// which reuses the tls session of the last connection, no full handshake.
+// all the functions are thread safe.
+
+// the tls 1.2 ciphers offered on ssl:// endpoints, ECDHE with AEAD only.
+// chacha20 goes first as it's faster than aes on the arm cpus without aes
+// instructions. the tls 1.3 suites are not restricted by this list
+#define AMQTT_TLS_CIPHERS "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:" \
+    "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:" \
+    "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384"
+
+// with mqtt 5, the topics published to get an alias each, up to the limit of
+// the broker. the session is kept for AMQTT_SESSION_EXPIRY seconds offline
+enum {AMQTT_MAX_TOPIC_ALIASES = 8, AMQTT_SESSION_EXPIRY = 86400};
+
+// the urgent messages, e.g. the alarms, have a short queue of their own which
+// the publisher empties first, and AMQTT_URGENT_INFLIGHT slots in flight beyond
+// the window, so that they are neither queued behind the data nor wait for
+// its acks
+enum {AMQTT_URGENT_CAPACITY = 256, AMQTT_URGENT_INFLIGHT = 8};
+
+typedef struct
+{
+    char* topic;
+    char* payload;
+    int len;
+    int retained;
+    long long queuedUs;             // monotonic time(us) it's queued, for the latency
+    unsigned long long traceId;     // the sample traced, 0 if not, see trace.h
+} AmqttMsg;
+
+// the health of a client, see amqtt_health
+typedef struct
+{
+    int connected;
+    long long downMs;               // how long it has been disconnected, 0 if connected
+    int disconnects;
+    int connectFailures;
+    int pending;                    // queued or in flight
+    long long dropped;              // the oldest dropped from a full queue, or failed to spool
+    long long sent;                 // acknowledged by the broker
+    long long failed;               // sends failed, they are queued again
+    long long spooled;              // written to the spool
+    int spooling;                   // the spool is being replayed
+    long long throttled;            // the publisher waited for the rate limit
+} AmqttHealth;
+
+typedef struct
+{
+    MQTTAsync client;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;          // queue, in-flight window or connection changed
+    pthread_t publisher;
+    int stopping;
+    AmqttMsg* queue;                // ring buffer of the messages waiting to be sent
+    int capacity;
+    int head;
+    int size;
+    AmqttMsg* urgent;               // ring buffer of the urgent messages, sent first
+    int urgentHead;
+    int urgentSize;
+    int inflight;                   // sent, but not yet acknowledged
+    int maxInflight;
+    int ratePerSec;                 // the publishes a second the broker allows, 0 if not limited
+    int rateBurst;                  // the most sent at once after a quiet while
+    double tokens;                  // the publishes allowed right now, see take_tokens
+    long long tokensUs;             // monotonic time(us) the tokens were counted
+    long long throttled;
+    int qos;
+    int connected;
+    int connecting;
+    int connectFailures;            // consecutive failures of the first connect
+    long long nextConnect;          // monotonic time(ms) to retry the first connect
+    unsigned int seed;              // for the jitter of the connect backoff
+    long long downSince;            // monotonic time(ms) the connection went down, 0 if up
+    int disconnects;                // connections lost since created
+    int subCount;
+    char** subTopics;               // subscribed on every (re)connect
+    int* subQos;
+    void* userContext;              // passed to the user callbacks
+    MQTTAsync_connectionLost* userConnectionLost;
+    MQTTAsync_messageArrived* userMessageArrived;
+    char user[512];
+    char password[512];
+    char trustStore[256];           // empty if not ssl
+    char* willTopic;                // NULL if there is no will
+    char* willPayload;
+    int willRetained;
+    Compressor* compressor;         // NULL unless the payloads are compressed
+    Spool* spool;                   // NULL unless spooling to disk is enabled
+    char persistDir[256];           // where the qos 1 messages in flight are kept, empty if not
+    MQTTClient_persistence persistence;
+    int spooling;                   // the spool is not drained yet
+    int spoolWriters;               // appending to the spool right now
+    long long sent;                 // statistics
+    long long dropped;              // dropped as the queue was full
+    long long failed;
+    long long spooled;
+    Histogram* latency;             // NULL, or where the publish latencies are recorded
+    char endpoint[256];
+    char clientid[256];
+    int mqtt5;                      // 1 once amqtt_enable_mqtt5 succeeded
+    int maxPacketSize;              // offered to the broker, 0 if not limited
+    int serverMaxPacket;            // the limit of the broker from its connack, 0 if none
+    int aliasMax;                   // the topic aliases the broker accepts
+    int aliasCount;                 // assigned on this connection
+    char* aliasTopics[AMQTT_MAX_TOPIC_ALIASES];     // the alias of a topic is its index + 1
+} AsyncMqtt;
+
+// create the client, it's not connected yet. trustStore is used for ssl:// endpoints.
+// capacity is the max messages queued, maxInflight the max messages sent but not
+// acknowledged. return 0 on success, -1 otherwise
+int amqtt_create(AsyncMqtt* m, const char* endpoint, const char* clientid, 
+    const char* user, const char* password, const char* trustStore, 
+    int capacity, int maxInflight, int qos);
+
+// write a client id to buf, prefix followed by the hash of seed, e.g. of the
+// endpoint and the topic. the same seed gives the same id across restarts,
+// so that the broker resumes the session instead of starting a new one
+void amqtt_clientid(char* buf, int len, const char* prefix, const char* seed);
+
+// spool the messages to dir when the queue overflows, e.g. while the broker is
+// unreachable, and replay them once there is room again. at most maxBytes of
+// disk is used. with qos 1, the messages handed to the client and not yet
+// acknowledged are kept in dir too, see mqtt_persist.h, and resent after a
+// restart. call it before connecting. return 0 on success, -1 otherwise
+int amqtt_enable_spool(AsyncMqtt* m, const char* dir, long long maxBytes);
+
+// speak mqtt 5 instead of 3.1.1: the topics published with qos 0 are sent as
+// topic aliases after the first message of each connection, and the messages
+// larger than the maximum packet size of the broker are dropped instead of
+// failing the connection. maxPacketSize, if > 0, is the largest packet the
+// broker may send to the client. call it before connecting. return 0 on
+// success, -1 if the paho library is built without mqtt 5 support
+int amqtt_enable_mqtt5(AsyncMqtt* m, int maxPacketSize);
+
+// compress every payload published from now on, see compress.h. dict is the
+// optional preset dictionary. call it before publishing. return 0 on success
+int amqtt_enable_compression(AsyncMqtt* m, const char* dict, int dictLen);
+
+// record the latency of every message acknowledged from now on into h, in us,
+// from queued in memory to acknowledged by the broker. the messages replayed
+// from the spool count from the replay. call it before publishing
+void amqtt_set_latency_histogram(AsyncMqtt* m, Histogram* h);
+
+// shape the publishes to perSecond a second at most, e.g. the message rate
+// quota of the broker on a connection, with a token bucket. up to burst go
+// at once after a quiet while, a tenth of perSecond if burst is 0. the
+// messages beyond the rate wait in the queue instead of failing at the
+// broker. the urgent ones go first but count too. 0 removes the limit
+void amqtt_set_rate_limit(AsyncMqtt* m, int perSecond, int burst);
+
+// set the callbacks of the client, and the topics to subscribe on connect
+void amqtt_set_subscriptions(AsyncMqtt* m, char** topics, int count, 
+    void* context, MQTTAsync_connectionLost* cl, MQTTAsync_messageArrived* ma);
+
+// the message the broker publishes for the client once its connection is lost
+// without a disconnect. call it before connecting. return 0 on success
+int amqtt_set_will(AsyncMqtt* m, const char* topic, const char* payload, int retained);
+
+// start connecting unless it's connected or connecting, return immediately.
+// the failed attempts are backed off, it's fine to call this periodically.
+// return 0 if the connection is started or already established, -1 otherwise
+int amqtt_connect(AsyncMqtt* m);
+
+int amqtt_is_connected(AsyncMqtt* m);
+
+// queue a copy of the message, the oldest message is dropped if the queue is full.
+// return 0 if queued, -1 otherwise
+int amqtt_publish(AsyncMqtt* m, const char* topic, const char* payload, int len, int retained);
+
+// amqtt_publish a message of the sample traceId, the time from queued to
+// acknowledged is recorded as its "publish" span. the spooled ones are not traced
+int amqtt_publish_traced(AsyncMqtt* m, const char* topic, const char* payload, int len, 
+    int retained, unsigned long long traceId);
+
+// amqtt_publish on the urgent queue, the message goes out before all the queued
+// ones, even if the in-flight window is full. once the urgent queue is full it's
+// queued as any other message
+int amqtt_publish_urgent(AsyncMqtt* m, const char* topic, const char* payload, int len,
+    int retained);
+
+// the number of messages not yet acknowledged, queued or in flight
+int amqtt_pending(AsyncMqtt* m);
+
+// a snapshot of the connection state and the statistics of the client.
+// every client reconnects on its own, concurrently with the others, this is
+// only for monitoring
+void amqtt_health(AsyncMqtt* m, AmqttHealth* health);
+
+// wait up to timeout_ms for the queued messages to be sent, stop the publisher
+// thread, disconnect, and free everything. the messages still queued are
+// saved to the spool if it's enabled
+void amqtt_destroy(AsyncMqtt* m, int timeout_ms);
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "compress.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int compressor_init(Compressor* c, const char* dict, int dictLen)
+{
+    memset(c, 0, sizeof(Compressor));
+    if (deflateInit(&c->zs, Z_BEST_COMPRESSION) != Z_OK)
+    {
+        return -1;
+    }
+    if (dict != NULL && dictLen > 0)
+    {
+        c->dict = (char*) malloc(dictLen);
+        if (c->dict == NULL)
+        {
+            deflateEnd(&c->zs);
+            return -1;
+        }
+        memcpy(c->dict, dict, dictLen);
+        c->dictLen = dictLen;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    return 0;
+}
+
+int compressor_bound(Compressor* c, int len)
+{
+    pthread_mutex_lock(&c->lock);
+    int bound = 2 + (int) deflateBound(&c->zs, len);
+    pthread_mutex_unlock(&c->lock);
+    return bound;
+}
+
+int compressor_run(Compressor* c, const char* payload, int len, char* dest, int destCap)
+{
+    if (destCap < 2)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&c->lock);
+    // much cheaper than a new stream for every payload
+    deflateReset(&c->zs);
+    if (c->dict != NULL)
+    {
+        deflateSetDictionary(&c->zs, (const Bytef*) c->dict, c->dictLen);
+    }
+    dest[0] = (char) COMPRESS_MARKER;
+    dest[1] = COMPRESS_ZLIB;
+    c->zs.next_in = (Bytef*) payload;
+    c->zs.avail_in = len;
+    c->zs.next_out = (Bytef*) dest + 2;
+    c->zs.avail_out = destCap - 2;
+    int rc = -1;
+    if (deflate(&c->zs, Z_FINISH) == Z_STREAM_END)
+    {
+        rc = 2 + (int) c->zs.total_out;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return rc;
+}
+
+void compressor_destroy(Compressor* c)
+{
+    deflateEnd(&c->zs);
+    free(c->dict);
+    c->dict = NULL;
+    pthread_mutex_destroy(&c->lock);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_COMPRESS_H
+#define INF_BCE_IOT_EDGE_SDK_COMPRESS_H
+
+#include <pthread.h>
+#include <zlib.h>
+
+// compresses the mqtt payloads with zlib. a compressed payload is
+//   0xBE, the algorithm (1 for zlib), the zlib stream
+// which tells it from json ('{') and the binary frames (0xBD). if a preset
+// dictionary is used, the zlib header holds its adler32 as the dictionary id,
+// the receiver needs the same dictionary to inflate it.
+
+enum
+{
+    COMPRESS_MARKER = 0xbe,
+    COMPRESS_ZLIB = 1
+};
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    z_stream zs;                    // reset for every payload, not re-initialized
+    char* dict;
+    int dictLen;
+} Compressor;
+
+// dict could be NULL, it's copied. return 0 on success, -1 otherwise
+int compressor_init(Compressor* c, const char* dict, int dictLen);
+
+// the max size of len bytes compressed
+int compressor_bound(Compressor* c, int len);
+
+// compress the payload into dest, return the size compressed, -1 on failure
+int compressor_run(Compressor* c, const char* payload, int len, char* dest, int destCap);
+
+void compressor_destroy(Compressor* c);
+
+#endif
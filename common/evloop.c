@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "evloop.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+static int watch_fd(EventLoop* loop, int fd)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int evloop_init(EventLoop* loop)
+{
+    memset(loop, 0, sizeof(EventLoop));
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    loop->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop->epfd < 0 || loop->wakeFd < 0 || loop->timerFd < 0
+        || watch_fd(loop, loop->wakeFd) != 0 || watch_fd(loop, loop->timerFd) != 0)
+    {
+        evloop_destroy(loop);
+        return -1;
+    }
+    return 0;
+}
+
+int evloop_add(EventLoop* loop, int fd, EvHandler handler, void* arg)
+{
+    if (loop->watchNum >= EVLOOP_MAX_FDS || watch_fd(loop, fd) != 0)
+    {
+        return -1;
+    }
+    EvWatch* w = &loop->watches[loop->watchNum++];
+    w->fd = fd;
+    w->handler = handler;
+    w->arg = arg;
+    return 0;
+}
+
+void evloop_remove(EventLoop* loop, int fd)
+{
+    int i = 0;
+    for (i = 0; i < loop->watchNum; i++)
+    {
+        if (loop->watches[i].fd == fd)
+        {
+            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+            loop->watches[i] = loop->watches[--loop->watchNum];
+            return;
+        }
+    }
+}
+
+void evloop_wakeup(EventLoop* loop)
+{
+    uint64_t one = 1;
+    // it only fails once the counter is full, it's woken up already then
+    ssize_t rc = write(loop->wakeFd, &one, sizeof(one));
+    (void) rc;
+}
+
+void evloop_set_deadline(EventLoop* loop, long long deadline)
+{
+    if (deadline == loop->deadline)
+    {
+        return;
+    }
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (deadline > 0)
+    {
+        spec.it_value.tv_sec = deadline / 1000;
+        spec.it_value.tv_nsec = (deadline % 1000) * 1000000;
+    }
+    // a zero it_value disarms, the time 0 has always passed
+    if (deadline > 0 && spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+    {
+        spec.it_value.tv_nsec = 1;
+    }
+    if (timerfd_settime(loop->timerFd, TFD_TIMER_ABSTIME, &spec, NULL) == 0)
+    {
+        loop->deadline = deadline;
+    }
+}
+
+int evloop_run_once(EventLoop* loop, int timeout_ms)
+{
+    struct epoll_event events[EVLOOP_MAX_EVENTS];
+    int n = epoll_wait(loop->epfd, events, EVLOOP_MAX_EVENTS, timeout_ms);
+    if (n < 0)
+    {
+        return errno == EINTR ? 0 : -1;
+    }
+    int result = 0;
+    uint64_t count = 0;
+    int i = 0;
+    for (i = 0; i < n; i++)
+    {
+        int fd = events[i].data.fd;
+        if (fd == loop->wakeFd)
+        {
+            if (read(loop->wakeFd, &count, sizeof(count)) == sizeof(count))
+            {
+                result |= EVLOOP_WOKEN;
+            }
+        }
+        else if (fd == loop->timerFd)
+        {
+            // the timer is one shot, it's disarmed once read
+            if (read(loop->timerFd, &count, sizeof(count)) == sizeof(count))
+            {
+                result |= EVLOOP_TIMER;
+                loop->deadline = 0;
+            }
+        }
+        else
+        {
+            // a handler may remove the fds, the ones gone are skipped
+            int j = 0;
+            for (j = 0; j < loop->watchNum && loop->watches[j].fd != fd; j++)
+            {
+            }
+            if (j < loop->watchNum)
+            {
+                loop->watches[j].handler(fd, loop->watches[j].arg);
+            }
+        }
+    }
+    return result;
+}
+
+void evloop_destroy(EventLoop* loop)
+{
+    if (loop->timerFd >= 0)
+    {
+        close(loop->timerFd);
+    }
+    if (loop->wakeFd >= 0)
+    {
+        close(loop->wakeFd);
+    }
+    if (loop->epfd >= 0)
+    {
+        close(loop->epfd);
+    }
+    loop->epfd = -1;
+    loop->wakeFd = -1;
+    loop->timerFd = -1;
+    loop->watchNum = 0;
+    loop->deadline = 0;
+}
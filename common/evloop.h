@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_EVLOOP_H
+#define INF_BCE_IOT_EDGE_SDK_EVLOOP_H
+
+// the reactor of a thread, on epoll: the fds added are dispatched to their
+// handlers once readable, and the thread sleeps until one is, until another
+// thread calls evloop_wakeup(an eventfd), or until the deadline(a timerfd).
+// nothing wakes it up periodically, an idle loop takes no cpu. only the
+// thread running the loop adds, removes and sets the deadline
+
+enum
+{
+    EVLOOP_MAX_FDS = 16,
+    EVLOOP_MAX_EVENTS = 16          // the events dispatched by one evloop_run_once
+};
+
+// what evloop_run_once returned for
+enum
+{
+    EVLOOP_WOKEN = 1,               // evloop_wakeup was called
+    EVLOOP_TIMER = 2                // the deadline has passed
+};
+
+typedef void (*EvHandler)(int fd, void* arg);
+
+typedef struct
+{
+    int fd;
+    EvHandler handler;
+    void* arg;
+} EvWatch;
+
+typedef struct
+{
+    int epfd;
+    int wakeFd;
+    int timerFd;
+    long long deadline;             // monotonic time(ms) the timer is armed for, 0 if not armed
+    EvWatch watches[EVLOOP_MAX_FDS];
+    int watchNum;
+} EventLoop;
+
+// return 0 on success, -1 if the fds can't be created
+int evloop_init(EventLoop* loop);
+
+// the handler is called by evloop_run_once while fd is readable, it should
+// read all there is. return 0 on success, -1 if full or fd can't be watched
+int evloop_add(EventLoop* loop, int fd, EvHandler handler, void* arg);
+
+void evloop_remove(EventLoop* loop, int fd);
+
+// evloop_run_once returns EVLOOP_WOKEN soon after, called by any thread and
+// by the signal handlers. the wake-ups before it runs are merged into one
+void evloop_wakeup(EventLoop* loop);
+
+// evloop_run_once returns EVLOOP_TIMER once the monotonic time(ms) deadline
+// has passed, 0 disarms it. a deadline passed already fires at once
+void evloop_set_deadline(EventLoop* loop, long long deadline);
+
+// wait for the events at most timeout_ms, -1 for no limit but the deadline,
+// and dispatch the fds ready. return the EVLOOP_WOKEN and EVLOOP_TIMER bits,
+// 0 if only fds or nothing happened, -1 on error
+int evloop_run_once(EventLoop* loop, int timeout_ms);
+
+void evloop_destroy(EventLoop* loop);
+
+#endif
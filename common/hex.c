@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hex.h"
+
+#include <string.h>
+
+static const char BASE64_CHARS[65] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// the 2 hex chars of every byte
+static const char HEX_PAIRS[513] =
+    "000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"
+    "202122232425262728292A2B2C2D2E2F303132333435363738393A3B3C3D3E3F"
+    "404142434445464748494A4B4C4D4E4F505152535455565758595A5B5C5D5E5F"
+    "606162636465666768696A6B6C6D6E6F707172737475767778797A7B7C7D7E7F"
+    "808182838485868788898A8B8C8D8E8F909192939495969798999A9B9C9D9E9F"
+    "A0A1A2A3A4A5A6A7A8A9AAABACADAEAFB0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+    "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECFD0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+    "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEFF0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+// the value of every hex char, -1 for the others
+static const signed char HEX_VALUES[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+void hex_encode(char* dest, const uint8_t* src, int len)
+{
+    int i = 0;
+    for (i = 0; i < len; i++)
+    {
+        memcpy(dest + 2 * i, HEX_PAIRS + 2 * src[i], 2);
+    }
+    dest[2 * len] = '\0';
+}
+
+void hex_encode_u16(char* dest, const uint16_t* src, int len)
+{
+    int i = 0;
+    for (i = 0; i < len; i++)
+    {
+        memcpy(dest + 4 * i, HEX_PAIRS + 2 * (src[i] >> 8), 2);
+        memcpy(dest + 4 * i + 2, HEX_PAIRS + 2 * (src[i] & 0xff), 2);
+    }
+    dest[4 * len] = '\0';
+}
+
+int hex_decode(uint8_t* dest, int cap, const char* src, int len)
+{
+    const unsigned char* s = (const unsigned char*) src;
+    int n = len / 2;
+    if (n > cap)
+    {
+        return -1;
+    }
+    // the invalid chars are or-ed into bad instead of branching on every char
+    int bad = 0;
+    int i = 0;
+    for (i = 0; i < n; i++)
+    {
+        int high = HEX_VALUES[s[2 * i]];
+        int low = HEX_VALUES[s[2 * i + 1]];
+        bad |= high | low;
+        dest[i] = (uint8_t)((high << 4) | (low & 0xf));
+    }
+    return bad < 0 ? -1 : n;
+}
+
+int hex_decode_u16(uint16_t* dest, int cap, const char* src, int len)
+{
+    const unsigned char* s = (const unsigned char*) src;
+    int n = len / 4;
+    if (n > cap)
+    {
+        return -1;
+    }
+    int bad = 0;
+    int i = 0;
+    for (i = 0; i < n; i++)
+    {
+        int a = HEX_VALUES[s[4 * i]];
+        int b = HEX_VALUES[s[4 * i + 1]];
+        int c = HEX_VALUES[s[4 * i + 2]];
+        int d = HEX_VALUES[s[4 * i + 3]];
+        bad |= a | b | c | d;
+        dest[i] = (uint16_t)(((a & 0xf) << 12) | ((b & 0xf) << 8) | ((c & 0xf) << 4) | (d & 0xf));
+    }
+    return bad < 0 ? -1 : n;
+}
+
+int pack_bits(uint8_t* dest, const uint8_t* bits, int nb)
+{
+    int bytes = (nb + 7) / 8;
+    int i = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // the bit 0 of the k-th byte ends up in the bit 56 + k of the product,
+    // the partial products never overlap there
+    for (; i < nb / 8; i++)
+    {
+        uint64_t x = 0;
+        memcpy(&x, bits + 8 * i, 8);
+        // any non zero byte is a 1
+        x |= x >> 4;
+        x |= x >> 2;
+        x |= x >> 1;
+        x &= 0x0101010101010101ULL;
+        dest[i] = (uint8_t)((x * 0x0102040810204080ULL) >> 56);
+    }
+#endif
+    for (; i < bytes; i++)
+    {
+        uint8_t b = 0;
+        int k = 0;
+        for (k = 0; k < 8 && 8 * i + k < nb; k++)
+        {
+            b |= (uint8_t)((bits[8 * i + k] != 0) << k);
+        }
+        dest[i] = b;
+    }
+    return bytes;
+}
+
+void base64_encode(char* dest, const uint8_t* src, int len)
+{
+    int i = 0;
+    char* p = dest;
+    for (i = 0; i + 2 < len; i += 3)
+    {
+        uint32_t v = ((uint32_t)src[i] << 16) | ((uint32_t)src[i + 1] << 8) | src[i + 2];
+        p[0] = BASE64_CHARS[v >> 18];
+        p[1] = BASE64_CHARS[(v >> 12) & 0x3f];
+        p[2] = BASE64_CHARS[(v >> 6) & 0x3f];
+        p[3] = BASE64_CHARS[v & 0x3f];
+        p += 4;
+    }
+    if (i < len)
+    {
+        uint32_t v = (uint32_t)src[i] << 16;
+        if (i + 1 < len)
+        {
+            v |= (uint32_t)src[i + 1] << 8;
+        }
+        p[0] = BASE64_CHARS[v >> 18];
+        p[1] = BASE64_CHARS[(v >> 12) & 0x3f];
+        p[2] = i + 1 < len ? BASE64_CHARS[(v >> 6) & 0x3f] : '=';
+        p[3] = '=';
+        p += 4;
+    }
+    *p = '\0';
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_HEX_H
+#define INF_BCE_IOT_EDGE_SDK_HEX_H
+
+#include <stdint.h>
+
+// table driven hex codec of the register payloads, shared by the gateways.
+// the output is upper case, both cases are accepted on input.
+// every byte takes one lookup to encode and two to decode, without branches
+// on the data, see hex_bench.c for the numbers
+
+// encode len bytes into dest, which must hold 2 * len + 1 chars
+void hex_encode(char* dest, const uint8_t* src, int len);
+
+// encode len 16 bit words, the high byte first, into dest, which must hold
+// 4 * len + 1 chars
+void hex_encode_u16(char* dest, const uint16_t* src, int len);
+
+// decode the first len / 2 bytes of the hex src (of len chars), a trailing odd char
+// is ignored. return the number of bytes decoded, -1 if any char is not hex
+// or there are more than cap bytes
+int hex_decode(uint8_t* dest, int cap, const char* src, int len);
+
+// decode the first len / 4 words of src, like hex_decode
+int hex_decode_u16(uint16_t* dest, int cap, const char* src, int len);
+
+// pack nb bits, stored one per byte(0 or not) as libmodbus reads them, into a
+// bitset of (nb + 7) / 8 bytes in dest, in the order of the modbus frames: the
+// first bit is the lowest bit of the first byte. 8 bits are packed at once by
+// a multiply. return the number of bytes
+int pack_bits(uint8_t* dest, const uint8_t* bits, int nb);
+
+// the bytes are encoded as standard base64 with padding
+#define BASE64_LEN(len) (((len) + 2) / 3 * 4)
+
+// encode len bytes into dest, which must hold BASE64_LEN(len) + 1 chars
+void base64_encode(char* dest, const uint8_t* src, int len);
+
+#endif
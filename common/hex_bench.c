@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark of the hex codec of the register payloads against the char by
+// char conversion it replaced: encode and decode a buffer of random registers
+// many times, and check that both give the same results. the bit packing of
+// 2000 coils is measured against packing bit by bit the same way.
+//
+// usage: ./hex_bench [registers] [rounds]
+
+#include "hex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double elapsed_ms(struct timespec* start, struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+// the previous conversion, one nibble at a time
+static void ref_char2hex(char c, char* hex1, char* hex2)
+{
+    char high = (c & 0XF0) >> 4;
+    char low = c & 0X0F;
+    *hex1 = high < 10 ? high + '0' : high - 10 + 'A';
+    *hex2 = low < 10 ? low + '0' : low - 10 + 'A';
+}
+
+static char ref_char2dec(char data)
+{
+    if (data >= '0' && data <= '9')
+    {
+        return data - '0';
+    } 
+    else if (data >= 'a' && data <= 'f')
+    {
+        return data - 'a' + 0xa;
+    }
+    else if (data >= 'A' && data <= 'F')
+    {
+        return data - 'A' + 0xa;
+    }
+    return 0;
+}
+
+static void ref_encode_u16(char* dest, uint16_t* src, int len)
+{
+    int i = 0; 
+    for (; i < len; i++)
+    {
+        char high = (src[i] & 0XFF00) >> 8;
+        char low = src[i] & 0XFF;
+        ref_char2hex(high, &dest[i << 2], &dest[(i << 2) +1]);
+        ref_char2hex(low, &dest[(i << 2) + 2], &dest[(i << 2) +3]);
+    }
+    dest[len << 2] = '\0';
+}
+
+static int ref_decode_u16(uint16_t* dest, const char* src)
+{
+    int len = strlen(src);
+    int i = 0 ;
+    int cnt = 0;
+    for (i = 0; i < len / 4; i++)
+    {
+        uint16_t data = 0;
+        data |= ref_char2dec(src[4 * i]) << 12;
+        data |= ref_char2dec(src[4 * i + 1]) << 8;
+        data |= ref_char2dec(src[4 * i + 2]) << 4;
+        data |= ref_char2dec(src[4 * i + 3]);
+        dest[cnt++] = data;
+    }
+    return cnt;
+}
+
+static int ref_pack_bits(uint8_t* dest, const uint8_t* bits, int nb)
+{
+    int i = 0;
+    memset(dest, 0, (nb + 7) / 8);
+    for (i = 0; i < nb; i++)
+    {
+        if (bits[i])
+        {
+            dest[i / 8] |= (uint8_t)(1 << (i % 8));
+        }
+    }
+    return (nb + 7) / 8;
+}
+
+// check and time the bit packing, return the number of errors
+static int bench_pack_bits(int rounds)
+{
+    enum { COILS = 2000 };
+    uint8_t bits[COILS];
+    uint8_t packed[COILS / 8 + 1];
+    uint8_t ref[COILS / 8 + 1];
+    int errors = 0;
+    int i = 0;
+    for (i = 0; i < COILS; i++)
+    {
+        // any non zero byte is a set bit
+        bits[i] = rand() % 3 == 0 ? (uint8_t)rand() : 0;
+    }
+    int nb = 0;
+    for (nb = 1; nb <= COILS; nb += nb < 64 ? 1 : 97)
+    {
+        memset(packed, 0xa5, sizeof(packed));
+        if (pack_bits(packed, bits, nb) != ref_pack_bits(ref, bits, nb) 
+            || memcmp(packed, ref, (nb + 7) / 8) != 0)
+        {
+            printf("ERROR: the packed bits of %d coils differ\n", nb);
+            errors++;
+        }
+    }
+    const char* plain[] = {"", "f", "fo", "foo", "foob", "fooba", "foobar"};
+    const char* base64[] = {"", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy"};
+    char text[16];
+    for (i = 0; i < 7; i++)
+    {
+        base64_encode(text, (const uint8_t*)plain[i], strlen(plain[i]));
+        if (strcmp(text, base64[i]) != 0)
+        {
+            printf("ERROR: base64 of \"%s\" is %s\n", plain[i], text);
+            errors++;
+        }
+    }
+
+    struct timespec start;
+    struct timespec end;
+    long long sum = 0;
+    int r = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++)
+    {
+        bits[r % COILS] ^= 1;
+        sum += ref_pack_bits(ref, bits, COILS) + ref[r % (COILS / 8)];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double by_bit = elapsed_ms(&start, &end);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++)
+    {
+        bits[r % COILS] ^= 1;
+        sum += pack_bits(packed, bits, COILS) + packed[r % (COILS / 8)];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double by_word = elapsed_ms(&start, &end);
+    double per = 1000000.0 / rounds;
+    printf("pack %d coils x %d: bit by bit %.3f ms (%.2f ns/read), "
+        "8 at once %.3f ms (%.2f ns/read), checksum %lld\n", COILS, rounds, 
+        by_bit, by_bit * per, by_word, by_word * per, sum);
+    return errors;
+}
+
+int main(int argc, char* argv[])
+{
+    int num = argc > 1 ? atoi(argv[1]) : 125;
+    int rounds = argc > 2 ? atoi(argv[2]) : 200000;
+    if (num <= 0 || rounds <= 0)
+    {
+        printf("usage: %s [registers] [rounds]\n", argv[0]);
+        return 1;
+    }
+    uint16_t* regs = (uint16_t*) malloc(num * sizeof(uint16_t));
+    uint16_t* back = (uint16_t*) malloc(num * sizeof(uint16_t));
+    char* hex = (char*) malloc(num * 4 + 1);
+    char* ref = (char*) malloc(num * 4 + 1);
+    if (regs == NULL || back == NULL || hex == NULL || ref == NULL)
+    {
+        printf("out of memory\n");
+        return 1;
+    }
+    srand(20170601);
+    int i = 0;
+    for (i = 0; i < num; i++)
+    {
+        regs[i] = (uint16_t)rand();
+    }
+
+    // the results must be the same as before
+    int errors = 0;
+    hex_encode_u16(hex, regs, num);
+    ref_encode_u16(ref, regs, num);
+    if (strcmp(hex, ref) != 0)
+    {
+        printf("ERROR: the encoded hex differs\n");
+        errors++;
+    }
+    if (hex_decode_u16(back, num, hex, num * 4) != num || memcmp(back, regs, num * 2) != 0)
+    {
+        printf("ERROR: the decoded registers differ\n");
+        errors++;
+    }
+    if (hex_decode_u16(back, num, "00fg", 4) != -1 || hex_decode_u16(back, 0, "00ff", 4) != -1)
+    {
+        printf("ERROR: the invalid input is not rejected\n");
+        errors++;
+    }
+
+    struct timespec start;
+    struct timespec end;
+    double ms[4];
+    int r = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++)
+    {
+        regs[r % num] ^= (uint16_t)r;
+        ref_encode_u16(ref, regs, num);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms[0] = elapsed_ms(&start, &end);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++)
+    {
+        regs[r % num] ^= (uint16_t)r;
+        hex_encode_u16(hex, regs, num);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms[1] = elapsed_ms(&start, &end);
+    long long sum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++)
+    {
+        sum += ref_decode_u16(back, ref) + back[r % num];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms[2] = elapsed_ms(&start, &end);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++)
+    {
+        sum += hex_decode_u16(back, num, hex, num * 4) + back[r % num];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms[3] = elapsed_ms(&start, &end);
+
+    double per = 1000000.0 / ((double)rounds * num);
+    printf("encode %d registers x %d: char by char %.3f ms (%.2f ns/register), "
+        "table %.3f ms (%.2f ns/register)\n", num, rounds, ms[0], ms[0] * per, ms[1], ms[1] * per);
+    printf("decode %d registers x %d: char by char %.3f ms (%.2f ns/register), "
+        "table %.3f ms (%.2f ns/register)\n", num, rounds, ms[2], ms[2] * per, ms[3], ms[3] * per);
+    printf("checksum %lld\n", sum);
+    errors += bench_pack_bits(rounds / 10 > 0 ? rounds / 10 : 1);
+
+    free(regs);
+    free(back);
+    free(hex);
+    free(ref);
+    return errors > 0 ? 1 : 0;
+}
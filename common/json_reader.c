@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "json_reader.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    FILE* fp;
+    char buf[JR_BUF_LEN];
+    int pos;
+    int len;
+    long start;                     // the file offset of buf[0]
+    char* text;                     // the value copied, nul terminated
+    int textLen;
+    int textCap;
+} JsonReader;
+
+// the char at the position, -1 at the end of the file
+static int peek(JsonReader* r)
+{
+    if (r->pos == r->len)
+    {
+        r->start += r->len;
+        r->pos = 0;
+        r->len = fread(r->buf, 1, JR_BUF_LEN, r->fp);
+        if (r->len <= 0)
+        {
+            r->len = 0;
+            return -1;
+        }
+    }
+    return (unsigned char) r->buf[r->pos];
+}
+
+static int take(JsonReader* r)
+{
+    int c = peek(r);
+    if (c >= 0)
+    {
+        r->pos++;
+    }
+    return c;
+}
+
+static int is_space(int c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int skip_space(JsonReader* r)
+{
+    int c = peek(r);
+    while (is_space(c))
+    {
+        r->pos++;
+        c = peek(r);
+    }
+    return c;
+}
+
+static int keep(JsonReader* r, int c)
+{
+    if (r->textLen + 2 > r->textCap)
+    {
+        if (r->textLen + 2 > JR_MAX_VALUE_LEN)
+        {
+            return -1;
+        }
+        int cap = r->textCap > 0 ? r->textCap * 2 : 256;
+        char* text = (char*) realloc(r->text, cap);
+        if (text == NULL)
+        {
+            return -1;
+        }
+        r->text = text;
+        r->textCap = cap;
+    }
+    r->text[r->textLen++] = (char) c;
+    r->text[r->textLen] = 0;
+    return 0;
+}
+
+// copy the text of the value at the position into r->text, or only skip it.
+// only the nesting is followed here, the text copied is checked by cJSON.
+// return 0 on success
+static int scan_value(JsonReader* r, int copy)
+{
+    int depth = 0;
+    int quoted = 0;
+    int escaped = 0;
+    int n = 0;
+    r->textLen = 0;
+    skip_space(r);
+    for (;;)
+    {
+        int c = peek(r);
+        if (quoted)
+        {
+            if (c < 0)
+            {
+                return -1;
+            }
+            if (escaped)
+            {
+                escaped = 0;
+            }
+            else if (c == '\\')
+            {
+                escaped = 1;
+            }
+            else if (c == '"')
+            {
+                quoted = 0;
+            }
+        }
+        else if (c < 0 || (depth == 0 && (c == ',' || c == ']' || c == '}' || is_space(c))))
+        {
+            // the end of a number, true, false or null
+            break;
+        }
+        else if (c == '"')
+        {
+            quoted = 1;
+        }
+        else if (c == '{' || c == '[')
+        {
+            depth++;
+        }
+        else if (c == '}' || c == ']')
+        {
+            depth--;
+        }
+        r->pos++;
+        n++;
+        if (copy && keep(r, c) != 0)
+        {
+            return -1;
+        }
+        if (depth == 0 && !quoted && (c == '"' || c == '}' || c == ']'))
+        {
+            break;
+        }
+    }
+    return n > 0 ? 0 : -1;
+}
+
+static cJSON* parse_text(JsonReader* r)
+{
+    return cJSON_ParseWithOpts(r->text, NULL, 1);
+}
+
+// the elements of the array at the position
+static int read_elements(JsonReader* r, jr_element_fn on_element, void* ctx)
+{
+    int num = 0;
+    take(r);
+    if (skip_space(r) == ']')
+    {
+        take(r);
+        return 0;
+    }
+    for (;;)
+    {
+        cJSON* element = scan_value(r, 1) == 0 ? parse_text(r) : NULL;
+        if (element == NULL)
+        {
+            return JR_ERROR;
+        }
+        int rc = on_element(ctx, element);
+        cJSON_Delete(element);
+        if (rc != 0)
+        {
+            return JR_ERROR;
+        }
+        num++;
+        int c = skip_space(r);
+        take(r);
+        if (c == ']')
+        {
+            return num;
+        }
+        if (c != ',')
+        {
+            return JR_ERROR;
+        }
+    }
+}
+
+// the members of the object at the position, but the array, whose offset is
+// in array_at, -1 if it's not there. return 0 on success
+static int read_members(JsonReader* r, const char* array_key, jr_member_fn on_member,
+    void* ctx, long* array_at)
+{
+    *array_at = -1;
+    take(r);
+    if (skip_space(r) == '}')
+    {
+        take(r);
+        return 0;
+    }
+    for (;;)
+    {
+        cJSON* key = scan_value(r, 1) == 0 ? parse_text(r) : NULL;
+        if (!cJSON_IsString(key) || skip_space(r) != ':')
+        {
+            cJSON_Delete(key);
+            return JR_ERROR;
+        }
+        take(r);
+        int rc = 0;
+        if (skip_space(r) == '[' && *array_at < 0 && strcmp(key->valuestring, array_key) == 0)
+        {
+            *array_at = r->start + r->pos;
+            rc = scan_value(r, 0);
+        }
+        else if (on_member == NULL)
+        {
+            rc = scan_value(r, 0);
+        }
+        else
+        {
+            cJSON* value = scan_value(r, 1) == 0 ? parse_text(r) : NULL;
+            rc = value == NULL ? -1 : on_member(ctx, key->valuestring, value);
+            cJSON_Delete(value);
+        }
+        cJSON_Delete(key);
+        if (rc != 0)
+        {
+            return JR_ERROR;
+        }
+        int c = skip_space(r);
+        take(r);
+        if (c == '}')
+        {
+            return 0;
+        }
+        if (c != ',')
+        {
+            return JR_ERROR;
+        }
+    }
+}
+
+int jr_read(FILE* fp, const char* array_key, jr_member_fn on_member,
+    jr_element_fn on_element, void* ctx)
+{
+    // the buffer is kept off the stack of the caller
+    JsonReader* r = (JsonReader*) calloc(1, sizeof(JsonReader));
+    if (r == NULL)
+    {
+        return JR_ERROR;
+    }
+    r->fp = fp;
+    r->start = ftell(fp);
+    int num = JR_ERROR;
+    int c = r->start < 0 ? -1 : skip_space(r);
+    if (c == '[')
+    {
+        num = read_elements(r, on_element, ctx);
+    }
+    else if (c == '{')
+    {
+        long array_at = -1;
+        if (read_members(r, array_key, on_member, ctx, &array_at) == 0)
+        {
+            num = skip_space(r) >= 0 ? JR_ERROR : JR_NO_ARRAY;
+        }
+        if (num == JR_NO_ARRAY && array_at >= 0)
+        {
+            num = JR_ERROR;
+            if (fseek(fp, array_at, SEEK_SET) == 0)
+            {
+                r->start = array_at;
+                r->pos = 0;
+                r->len = 0;
+                num = read_elements(r, on_element, ctx);
+            }
+            // the rest of the object is read already
+            c = -1;
+        }
+    }
+    if (c == '[' && num >= 0 && skip_space(r) >= 0)
+    {
+        num = JR_ERROR;
+    }
+    free(r->text);
+    free(r);
+    return num;
+}
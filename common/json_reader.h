@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_JSON_READER_H
+#define INF_BCE_IOT_EDGE_SDK_JSON_READER_H
+
+#include <stdio.h>
+#include <cjson/cJSON.h>
+
+// reads a large json file, e.g. a policy cache, through a small buffer and
+// without the tree of the whole text. the top level is an object with a big
+// array under one key, or that array itself. the other members of the object
+// and the elements of the array are handed over one at a time, each parsed by
+// cJSON on its own and deleted once the callback returns, so the memory is
+// that of the largest of them rather than of the file.
+// the members are all handed over before the first element, wherever the
+// array is in the object, e.g. the templates are there before the policies
+// using them: the array is skipped, and read again once the object is done,
+// hence the file must be seekable.
+
+enum
+{
+    JR_BUF_LEN = 16384,                 // read from the file at a time
+    JR_MAX_VALUE_LEN = 16 * 1024 * 1024 // of a member or an element, larger is invalid
+};
+
+enum
+{
+    JR_ERROR = -1,                      // not valid json, or a callback failed
+    JR_NO_ARRAY = -2                    // an object without the array under the key
+};
+
+// return 0 to go on, anything else stops the reading with JR_ERROR
+typedef int (*jr_member_fn)(void* ctx, const char* key, cJSON* value);
+
+typedef int (*jr_element_fn)(void* ctx, cJSON* element);
+
+// read the json from the current position of fp to its end. on_member may be
+// NULL to skip the members. return the number of the elements, JR_ERROR or
+// JR_NO_ARRAY. the callbacks may have been called for a file found invalid
+// later, the caller drops what it built from them then
+int jr_read(FILE* fp, const char* array_key, jr_member_fn on_member,
+    jr_element_fn on_element, void* ctx);
+
+#endif
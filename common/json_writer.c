@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "json_writer.h"
+#include "numfmt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// make room for n more bytes and the terminating 0
+static int reserve(JsonWriter* w, int n)
+{
+    if (w->error)
+    {
+        return 0;
+    }
+    if (w->len + n + 1 <= w->cap)
+    {
+        return 1;
+    }
+    int cap = w->cap > 0 ? w->cap : 256;
+    while (cap < w->len + n + 1)
+    {
+        cap *= 2;
+    }
+    char* buf = (char*) realloc(w->buf, cap);
+    if (buf == NULL)
+    {
+        w->error = 1;
+        return 0;
+    }
+    w->buf = buf;
+    w->cap = cap;
+    return 1;
+}
+
+static void append(JsonWriter* w, const char* text, int n)
+{
+    if (reserve(w, n))
+    {
+        memcpy(w->buf + w->len, text, n);
+        w->len += n;
+        w->buf[w->len] = 0;
+    }
+}
+
+static void append_quoted(JsonWriter* w, const char* text)
+{
+    // the worst case is every char escaped as \u00XX
+    int n = strlen(text);
+    if (!reserve(w, n * 6 + 2))
+    {
+        return;
+    }
+    char* p = w->buf + w->len;
+    *p++ = '"';
+    for (; *text != 0; text++)
+    {
+        unsigned char c = (unsigned char) *text;
+        if (c == '"' || c == '\\')
+        {
+            *p++ = '\\';
+            *p++ = c;
+        }
+        else if (c == '\n')
+        {
+            *p++ = '\\';
+            *p++ = 'n';
+        }
+        else if (c == '\r')
+        {
+            *p++ = '\\';
+            *p++ = 'r';
+        }
+        else if (c == '\t')
+        {
+            *p++ = '\\';
+            *p++ = 't';
+        }
+        else if (c < 0x20)
+        {
+            p += sprintf(p, "\\u%04x", c);
+        }
+        else
+        {
+            *p++ = c;
+        }
+    }
+    *p++ = '"';
+    *p = 0;
+    w->len = p - w->buf;
+}
+
+// the comma and the key before a value
+static void prefix(JsonWriter* w, const char* key)
+{
+    if (w->count[w->depth]++ > 0)
+    {
+        append(w, ",", 1);
+    }
+    if (key != NULL)
+    {
+        append_quoted(w, key);
+        append(w, ":", 1);
+    }
+}
+
+void jw_init(JsonWriter* w, char* buf, int cap)
+{
+    w->buf = buf;
+    w->cap = buf != NULL ? cap : 0;
+    jw_reset(w);
+}
+
+void jw_reset(JsonWriter* w)
+{
+    w->len = 0;
+    w->depth = 0;
+    w->count[0] = 0;
+    w->error = 0;
+    if (w->buf != NULL && w->cap > 0)
+    {
+        w->buf[0] = 0;
+    }
+}
+
+static void begin(JsonWriter* w, const char* key, const char* open)
+{
+    prefix(w, key);
+    append(w, open, 1);
+    if (w->depth + 1 >= JW_MAX_DEPTH)
+    {
+        w->error = 1;
+        return;
+    }
+    w->depth++;
+    w->count[w->depth] = 0;
+}
+
+static void end(JsonWriter* w, const char* close)
+{
+    append(w, close, 1);
+    if (w->depth > 0)
+    {
+        w->depth--;
+    }
+}
+
+void jw_begin_object(JsonWriter* w, const char* key)
+{
+    begin(w, key, "{");
+}
+
+void jw_end_object(JsonWriter* w)
+{
+    end(w, "}");
+}
+
+void jw_begin_array(JsonWriter* w, const char* key)
+{
+    begin(w, key, "[");
+}
+
+void jw_end_array(JsonWriter* w)
+{
+    end(w, "]");
+}
+
+void jw_string(JsonWriter* w, const char* key, const char* value)
+{
+    if (value == NULL)
+    {
+        jw_null(w, key);
+        return;
+    }
+    prefix(w, key);
+    append_quoted(w, value);
+}
+
+void jw_int(JsonWriter* w, const char* key, long long value)
+{
+    char text[NUMFMT_INT_SIZE];
+    prefix(w, key);
+    append(w, text, numfmt_i64(text, value));
+}
+
+void jw_double(JsonWriter* w, const char* key, double value)
+{
+    char text[NUMFMT_DOUBLE_SIZE];
+    prefix(w, key);
+    // json has no nan or infinity
+    if (value != value || value > 1.7976931348623157e308 || value < -1.7976931348623157e308)
+    {
+        append(w, "null", 4);
+        return;
+    }
+    append(w, text, numfmt_double(text, value));
+}
+
+void jw_float(JsonWriter* w, const char* key, float value)
+{
+    char text[NUMFMT_DOUBLE_SIZE];
+    prefix(w, key);
+    if (value != value || value > 3.4028235e38f || value < -3.4028235e38f)
+    {
+        append(w, "null", 4);
+        return;
+    }
+    append(w, text, numfmt_float(text, value));
+}
+
+void jw_bool(JsonWriter* w, const char* key, int value)
+{
+    prefix(w, key);
+    if (value)
+    {
+        append(w, "true", 4);
+    }
+    else
+    {
+        append(w, "false", 5);
+    }
+}
+
+void jw_null(JsonWriter* w, const char* key)
+{
+    prefix(w, key);
+    append(w, "null", 4);
+}
+
+JwMark jw_mark(JsonWriter* w)
+{
+    JwMark mark;
+    mark.len = w->len;
+    mark.depth = w->depth;
+    mark.count = w->count[w->depth];
+    return mark;
+}
+
+void jw_rewind(JsonWriter* w, JwMark mark)
+{
+    w->len = mark.len;
+    w->depth = mark.depth;
+    w->count[w->depth] = mark.count;
+    if (w->buf != NULL && w->cap > 0)
+    {
+        w->buf[w->len] = 0;
+    }
+}
+
+int jw_take_fragment(JsonWriter* w, JwMark mark, JwFragment* fragment)
+{
+    fragment->len = w->len - mark.len;
+    fragment->opened = w->depth - mark.depth;
+    fragment->count = w->count[w->depth];
+    fragment->text = w->error || fragment->opened < 0 ? NULL : (char*) malloc(fragment->len + 1);
+    if (fragment->text == NULL)
+    {
+        return -1;
+    }
+    memcpy(fragment->text, w->buf + mark.len, fragment->len);
+    fragment->text[fragment->len] = 0;
+    return 0;
+}
+
+void jw_fragment(JsonWriter* w, const JwFragment* fragment)
+{
+    // the fragment starts with a value, the comma before it is up to the writer
+    prefix(w, NULL);
+    append(w, fragment->text, fragment->len);
+    int i = 0;
+    for (i = 0; i < fragment->opened; i++)
+    {
+        if (w->depth + 1 >= JW_MAX_DEPTH)
+        {
+            w->error = 1;
+            return;
+        }
+        w->depth++;
+        w->count[w->depth] = i + 1 < fragment->opened ? 1 : fragment->count;
+    }
+}
+
+void jw_free_fragment(JwFragment* fragment)
+{
+    free(fragment->text);
+    fragment->text = NULL;
+    fragment->len = 0;
+}
+
+int jw_ok(JsonWriter* w)
+{
+    return !w->error && w->depth == 0;
+}
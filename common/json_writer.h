@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_JSON_WRITER_H
+#define INF_BCE_IOT_EDGE_SDK_JSON_WRITER_H
+
+// writes compact json text straight into a buffer, without building a tree.
+// the buffer grows as needed, and could be reused for the next message.
+// the key is NULL for the values in an array, and for the top level value.
+// a failed allocation is remembered, check jw_ok once done, the text is
+// never truncated silently.
+
+enum {JW_MAX_DEPTH = 16};
+
+typedef struct
+{
+    char* buf;
+    int len;
+    int cap;
+    int depth;
+    int count[JW_MAX_DEPTH];        // values written at every level, for the commas
+    int error;
+} JsonWriter;
+
+// start writing into buf of cap bytes, it's realloc'ed when too small, so it
+// must be allocated by malloc, or be NULL. take the buffer back from w->buf
+void jw_init(JsonWriter* w, char* buf, int cap);
+
+// forget the text written, keep the buffer
+void jw_reset(JsonWriter* w);
+
+void jw_begin_object(JsonWriter* w, const char* key);
+
+void jw_end_object(JsonWriter* w);
+
+void jw_begin_array(JsonWriter* w, const char* key);
+
+void jw_end_array(JsonWriter* w);
+
+// a NULL value is written as null
+void jw_string(JsonWriter* w, const char* key, const char* value);
+
+void jw_int(JsonWriter* w, const char* key, long long value);
+
+void jw_double(JsonWriter* w, const char* key, double value);
+
+// the digits of the float, 0.1f is written 0.1 rather than 0.10000000149011612
+void jw_float(JsonWriter* w, const char* key, float value);
+
+void jw_bool(JsonWriter* w, const char* key, int value);
+
+void jw_null(JsonWriter* w, const char* key);
+
+// where the writer is, to take back what is written after it, e.g. the value
+// which made a message too large. only at the same level as the mark
+typedef struct
+{
+    int len;
+    int depth;
+    int count;
+} JwMark;
+
+JwMark jw_mark(JsonWriter* w);
+
+void jw_rewind(JsonWriter* w, JwMark mark);
+
+// text rendered once and written again as it is, e.g. the members of a message
+// which never change. it's written at a level as if its values were, and the
+// objects and arrays it leaves open stay open
+typedef struct
+{
+    char* text;                     // NULL if none
+    int len;
+    int opened;                     // the levels left open at its end
+    int count;                      // the values written at the innermost of them
+} JwFragment;
+
+// take what is written after the mark as a fragment, the mark must be where
+// nothing is written at its level yet. return 0 on success, -1 if out of memory
+int jw_take_fragment(JsonWriter* w, JwMark mark, JwFragment* fragment);
+
+void jw_fragment(JsonWriter* w, const JwFragment* fragment);
+
+void jw_free_fragment(JwFragment* fragment);
+
+// 1 if the text is complete, 0 if an allocation failed or the nesting is too deep
+int jw_ok(JsonWriter* w);
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "logger.h"
+#include "timefmt.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {WRITE_BATCH = 64};
+
+typedef struct
+{
+    long long ts;                   // realtime(ms)
+    int level;
+    char text[LOGGER_LINE_BYTES];
+} LogLine;
+
+int g_logger_level = LOGGER_INFO;
+
+static const char* const LEVEL_NAMES[] = {"ERROR", "WARN", "INFO", "DEBUG"};
+
+static __thread char t_line[LOGGER_LINE_BYTES];
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_t g_writer;
+static int g_running = 0;
+static int g_stopping = 0;
+static FILE* g_out = NULL;
+static LogLine* g_queue = NULL;     // ring buffer of LOGGER_QUEUE_LINES lines
+static int g_head = 0;
+static int g_size = 0;
+
+// the rate limit, a window of one second
+static int g_rate = LOGGER_DEFAULT_RATE;
+static long long g_rate_window = 0;
+static int g_rate_count = 0;
+static unsigned long long g_dropped = 0;
+
+
+static void print_line(FILE* out, long long ts, int level, const char* text)
+{
+    char stamp[TIMEFMT_SIZE];
+    timefmt_format(stamp, ts, TIMEFMT_LOG);
+    fprintf(out, "%s %s %s\n", stamp, LEVEL_NAMES[level], text);
+}
+
+// 1 if the line is within the rate limit. a race at the turn of the window
+// lets a few lines more through, which is fine
+static int take_rate(long long ts)
+{
+    int rate = __atomic_load_n(&g_rate, __ATOMIC_RELAXED);
+    if (rate <= 0)
+    {
+        return 1;
+    }
+    long long window = ts / 1000;
+    long long current = __atomic_load_n(&g_rate_window, __ATOMIC_RELAXED);
+    if (current != window && __atomic_compare_exchange_n(&g_rate_window, &current, window, 0,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&g_rate_count, 0, __ATOMIC_RELAXED);
+    }
+    return __atomic_fetch_add(&g_rate_count, 1, __ATOMIC_RELAXED) < rate;
+}
+
+static void* writer_func(void* arg)
+{
+    static LogLine batch[WRITE_BATCH];
+    unsigned long long reported = logger_dropped();
+    pthread_mutex_lock(&g_lock);
+    while (1)
+    {
+        while (g_size == 0 && !g_stopping)
+        {
+            pthread_cond_wait(&g_wakeup, &g_lock);
+        }
+        if (g_size == 0)
+        {
+            break;
+        }
+        int count = g_size < WRITE_BATCH ? g_size : WRITE_BATCH;
+        int i = 0;
+        for (i = 0; i < count; i++)
+        {
+            batch[i] = g_queue[(g_head + i) % LOGGER_QUEUE_LINES];
+        }
+        g_head = (g_head + count) % LOGGER_QUEUE_LINES;
+        g_size -= count;
+        pthread_mutex_unlock(&g_lock);
+
+        for (i = 0; i < count; i++)
+        {
+            print_line(g_out, batch[i].ts, batch[i].level, batch[i].text);
+        }
+        unsigned long long dropped = logger_dropped();
+        if (dropped != reported)
+        {
+            fprintf(g_out, "%llu log lines dropped\n", dropped - reported);
+            reported = dropped;
+        }
+        fflush(g_out);
+        pthread_mutex_lock(&g_lock);
+    }
+    pthread_mutex_unlock(&g_lock);
+    return NULL;
+}
+
+void logger_set_level(int level)
+{
+    __atomic_store_n(&g_logger_level, level, __ATOMIC_RELAXED);
+}
+
+void logger_set_rate(int linesPerSec)
+{
+    __atomic_store_n(&g_rate, linesPerSec, __ATOMIC_RELAXED);
+}
+
+int logger_start(FILE* out)
+{
+    pthread_mutex_lock(&g_lock);
+    if (g_running)
+    {
+        pthread_mutex_unlock(&g_lock);
+        return 0;
+    }
+    g_queue = (LogLine*) malloc(LOGGER_QUEUE_LINES * sizeof(LogLine));
+    if (g_queue == NULL)
+    {
+        pthread_mutex_unlock(&g_lock);
+        return -1;
+    }
+    g_out = out;
+    g_head = 0;
+    g_size = 0;
+    g_stopping = 0;
+    if (pthread_create(&g_writer, NULL, writer_func, NULL) != 0)
+    {
+        free(g_queue);
+        g_queue = NULL;
+        pthread_mutex_unlock(&g_lock);
+        return -1;
+    }
+    g_running = 1;
+    pthread_mutex_unlock(&g_lock);
+    return 0;
+}
+
+void logger_stop()
+{
+    pthread_mutex_lock(&g_lock);
+    if (!g_running)
+    {
+        pthread_mutex_unlock(&g_lock);
+        return;
+    }
+    g_stopping = 1;
+    pthread_cond_signal(&g_wakeup);
+    pthread_mutex_unlock(&g_lock);
+    pthread_join(g_writer, NULL);
+
+    pthread_mutex_lock(&g_lock);
+    g_running = 0;
+    free(g_queue);
+    g_queue = NULL;
+    pthread_mutex_unlock(&g_lock);
+}
+
+void logger_write(int level, const char* fmt, ...)
+{
+    if (!logger_enabled(level))
+    {
+        return;
+    }
+    if (level < LOGGER_ERROR)
+    {
+        level = LOGGER_ERROR;
+    }
+    else if (level > LOGGER_DEBUG)
+    {
+        level = LOGGER_DEBUG;
+    }
+    long long ts = timefmt_now_ms();
+    if (!take_rate(ts))
+    {
+        __atomic_fetch_add(&g_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(t_line, sizeof(t_line), fmt, args);
+    va_end(args);
+    if (len < 0)
+    {
+        return;
+    }
+    if (len >= (int)sizeof(t_line))
+    {
+        len = sizeof(t_line) - 1;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    if (!g_running)
+    {
+        print_line(stdout, ts, level, t_line);
+        pthread_mutex_unlock(&g_lock);
+        return;
+    }
+    if (g_size >= LOGGER_QUEUE_LINES)
+    {
+        pthread_mutex_unlock(&g_lock);
+        __atomic_fetch_add(&g_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    LogLine* line = &g_queue[(g_head + g_size) % LOGGER_QUEUE_LINES];
+    line->ts = ts;
+    line->level = level;
+    memcpy(line->text, t_line, len + 1);
+    if (g_size++ == 0)
+    {
+        pthread_cond_signal(&g_wakeup);
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+unsigned long long logger_dropped()
+{
+    return __atomic_load_n(&g_dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef INF_BCE_IOT_EDGE_SDK_LOGGER_H
+#define INF_BCE_IOT_EDGE_SDK_LOGGER_H
+
+#include <stdio.h>
+
+// the log of the gateways. a line is formatted into a buffer of the calling
+// thread, copied into a bounded queue and written out by a thread of its own,
+// so the threads logging never wait for the console. the level is checked
+// before anything is formatted, and the lines beyond the rate limit, or the
+// ones that find the queue full, are dropped and counted, the writer reports
+// how many. before logger_start and after logger_stop the lines are written
+// by the caller
+
+enum
+{
+    LOGGER_ERROR = 0,
+    LOGGER_WARN,
+    LOGGER_INFO,
+    LOGGER_DEBUG,
+    LOGGER_LINE_BYTES = 256,        // longer lines are truncated
+    LOGGER_QUEUE_LINES = 4096,
+    LOGGER_DEFAULT_RATE = 1000      // lines per second
+};
+
+extern int g_logger_level;
+
+// 1 if the lines of the level are written, cheap enough for the hot paths
+static inline int logger_enabled(int level)
+{
+    return level <= __atomic_load_n(&g_logger_level, __ATOMIC_RELAXED);
+}
+
+// log a line at the level, the arguments are not evaluated if it's disabled
+#define logger_log(level, ...) \
+    do { if (logger_enabled(level)) logger_write(level, __VA_ARGS__); } while (0)
+
+#define logger_debug(...) logger_log(LOGGER_DEBUG, __VA_ARGS__)
+
+// the lines up to level are written, LOGGER_INFO by default
+void logger_set_level(int level);
+
+// at most linesPerSec lines are written a second, 0 for no limit
+void logger_set_rate(int linesPerSec);
+
+// start the writer thread, the lines go to out. return 0 on success
+int logger_start(FILE* out);
+
+// write the lines still queued and stop the writer thread
+void logger_stop();
+
+// format and queue a line, prefer logger_log which checks the level first
+void logger_write(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// lines dropped so far, by the rate limit or a full queue
+unsigned long long logger_dropped();
+
+#endif
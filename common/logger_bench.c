@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// benchmark of the log: the cost of a line to the threads logging, with the
+// level off, queued for the writer thread, and beyond the rate limit, next to
+// the synchronous ctime() and printf of the old log_debug. the lines go to
+// /dev/null, so this is the cost of the caller, not of the console.
+//
+// usage: ./logger_bench [threads] [linesPerThread]
+
+#include "logger.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int g_lines = 0;
+static FILE* g_null = NULL;
+static pthread_mutex_t g_sync_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double elapsed_ms(struct timespec* start, struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+// what log_debug did: format into a shared buffer, then ctime and printf
+static void* sync_func(void* arg)
+{
+    static char buff[256];
+    int i = 0;
+    for (i = 0; i < g_lines; i++)
+    {
+        pthread_mutex_lock(&g_sync_lock);
+        snprintf(buff, sizeof(buff), "request %d to device %u timed out", i & 0xff, 1000u + i);
+        time_t now = time(NULL);
+        fprintf(g_null, "%s %s\n", ctime(&now), buff);
+        pthread_mutex_unlock(&g_sync_lock);
+    }
+    return NULL;
+}
+
+static void* logger_func(void* arg)
+{
+    int i = 0;
+    for (i = 0; i < g_lines; i++)
+    {
+        logger_debug("request %d to device %u timed out", i & 0xff, 1000u + i);
+    }
+    return NULL;
+}
+
+static void run(const char* name, int threads, void* (*func)(void*))
+{
+    pthread_t* ids = (pthread_t*) malloc(threads * sizeof(pthread_t));
+    struct timespec t0;
+    struct timespec t1;
+    unsigned long long dropped = logger_dropped();
+    int i = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < threads; i++)
+    {
+        pthread_create(&ids[i], NULL, func, NULL);
+    }
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(ids[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ms = elapsed_ms(&t0, &t1);
+    long long total = (long long)threads * g_lines;
+    printf("%-24s %8.1f ns/line for the caller, %llu of %lld dropped\n", name,
+        ms * 1000000 / total, logger_dropped() - dropped, total);
+    free(ids);
+}
+
+int main(int argc, char* argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    g_lines = argc > 2 ? atoi(argv[2]) : 200000;
+    if (threads <= 0 || g_lines <= 0)
+    {
+        printf("usage: %s [threads] [linesPerThread]\n", argv[0]);
+        return 1;
+    }
+    g_null = fopen("/dev/null", "w");
+    if (g_null == NULL || logger_start(g_null) != 0)
+    {
+        printf("ERROR: failed to start the log\n");
+        return 1;
+    }
+    run("ctime + printf", threads, sync_func);
+    logger_set_level(LOGGER_INFO);
+    run("level off", threads, logger_func);
+    logger_set_level(LOGGER_DEBUG);
+    logger_set_rate(0);
+    run("queued, no rate limit", threads, logger_func);
+    logger_set_rate(LOGGER_DEFAULT_RATE);
+    // a second of its own, the runs before took the window of this one
+    struct timespec second = {1, 0};
+    nanosleep(&second, NULL);
+    run("queued, rate limited", threads, logger_func);
+    logger_stop();
+
+    // the lines are all written in order once the writer is stopped
+    FILE* out = tmpfile();
+    int errors = 0;
+    logger_set_rate(0);
+    logger_start(out);
+    int i = 0;
+    for (i = 0; i < 1000; i++)
+    {
+        logger_debug("line %d", i);
+    }
+    logger_stop();
+    rewind(out);
+    char line[LOGGER_LINE_BYTES + 64];
+    int expected = 0;
+    while (fgets(line, sizeof(line), out) != NULL)
+    {
+        char* text = strstr(line, "DEBUG line ");
+        if (text == NULL || atoi(text + 11) != expected)
+        {
+            errors++;
+        }
+        expected++;
+    }
+    if (expected != 1000)
+    {
+        printf("ERROR: %d of 1000 lines written\n", expected);
+        errors++;
+    }
+    fclose(out);
+    fclose(g_null);
+    return errors > 0 ? 1 : 0;
+}
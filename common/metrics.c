@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+enum {HIST_EXPORT_MIN_BIT = 4, HIST_EXPORT_MAX_BIT = 36, MT_INIT_CAP = 4096};
+
+static int bucket_of(long long value)
+{
+    if (value < HIST_SUB_BUCKETS)
+    {
+        return value < 0 ? 0 : (int)value;
+    }
+    int e = 63 - __builtin_clzll((unsigned long long)value);
+    int index = (e - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS 
+        + (int)(value >> (e - HIST_SUB_BITS)) - HIST_SUB_BUCKETS;
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+// the largest value falling into the bucket
+static long long bucket_upper(int index)
+{
+    if (index < HIST_SUB_BUCKETS)
+    {
+        return index;
+    }
+    int e = index / HIST_SUB_BUCKETS + HIST_SUB_BITS - 1;
+    int sub = index % HIST_SUB_BUCKETS;
+    return ((long long)(HIST_SUB_BUCKETS + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+void hist_record(Histogram* h, long long value)
+{
+    if (value < 0)
+    {
+        value = 0;
+    }
+    __atomic_fetch_add(&h->counts[bucket_of(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, (unsigned long long)value, __ATOMIC_RELAXED);
+    long long max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (value > max 
+        && !__atomic_compare_exchange_n(&h->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+long long hist_percentile(const Histogram* h, double p)
+{
+    unsigned long long count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    if (count == 0)
+    {
+        return 0;
+    }
+    unsigned long long rank = (unsigned long long)(count * p / 100.0 + 0.5);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    unsigned long long seen = 0;
+    int i = 0;
+    for (i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+        if (seen >= rank)
+        {
+            long long upper = bucket_upper(i);
+            long long max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+            // the last bucket takes all the larger values
+            return upper < max && i < HIST_BUCKETS - 1 ? upper : max;
+        }
+    }
+    return __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+}
+
+double hist_mean(const Histogram* h)
+{
+    unsigned long long count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    if (count == 0)
+    {
+        return 0;
+    }
+    return (double)__atomic_load_n(&h->sum, __ATOMIC_RELAXED) / count;
+}
+
+void mt_init(MetricsText* t)
+{
+    t->buf = NULL;
+    t->len = 0;
+    t->cap = 0;
+    t->error = 0;
+}
+
+void mt_free(MetricsText* t)
+{
+    free(t->buf);
+    mt_init(t);
+}
+
+void mt_printf(MetricsText* t, const char* fmt, ...)
+{
+    while (!t->error)
+    {
+        int room = t->cap - t->len;
+        va_list args;
+        va_start(args, fmt);
+        int n = room > 0 ? vsnprintf(t->buf + t->len, room, fmt, args) : -2;
+        va_end(args);
+        if (n >= 0 && n < room)
+        {
+            t->len += n;
+            return;
+        }
+        int cap = t->cap == 0 ? MT_INIT_CAP : t->cap * 2;
+        while (n >= 0 && cap - t->len <= n)
+        {
+            cap *= 2;
+        }
+        char* grown = (char*) realloc(t->buf, cap);
+        if (grown == NULL)
+        {
+            t->error = 1;
+            return;
+        }
+        t->buf = grown;
+        t->cap = cap;
+    }
+}
+
+void mt_type(MetricsText* t, const char* name, const char* type)
+{
+    mt_printf(t, "# TYPE %s %s\n", name, type);
+}
+
+void mt_value(MetricsText* t, const char* name, const char* labels, double value)
+{
+    if (labels != NULL && labels[0] != 0)
+    {
+        mt_printf(t, "%s{%s} %.15g\n", name, labels, value);
+    }
+    else
+    {
+        mt_printf(t, "%s %.15g\n", name, value);
+    }
+}
+
+void mt_histogram(MetricsText* t, const char* name, const char* labels, const Histogram* h)
+{
+    const char* sep = labels != NULL && labels[0] != 0 ? "," : "";
+    labels = labels != NULL ? labels : "";
+    unsigned long long seen = 0;
+    int i = 0;
+    int bit = 0;
+    for (bit = HIST_EXPORT_MIN_BIT; bit <= HIST_EXPORT_MAX_BIT; bit++)
+    {
+        // every bucket below 2^bit holds values below 2^bit
+        long long le = 1LL << bit;
+        while (i < HIST_BUCKETS && bucket_upper(i) < le)
+        {
+            seen += __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+            i++;
+        }
+        mt_printf(t, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, sep, le / 1e6, seen);
+    }
+    unsigned long long count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    mt_printf(t, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, count);
+    char metric[256];
+    snprintf(metric, sizeof(metric), "%s_sum", name);
+    mt_value(t, metric, labels, __atomic_load_n(&h->sum, __ATOMIC_RELAXED) / 1e6);
+    snprintf(metric, sizeof(metric), "%s_count", name);
+    mt_value(t, metric, labels, count);
+}
+
+static int g_metrics_server = -1;
+static int g_metrics_stop = 0;
+static pthread_t g_metrics_thread;
+static MetricsRender* g_metrics_render = NULL;
+static void* g_metrics_arg = NULL;
+
+static void write_all(int fd, const char* buf, int len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+// answer one scrape, the request is read up to the end of the headers and ignored
+static void serve_metrics(int client)
+{
+    struct timeval tv = {1, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    char req[4096];
+    int len = 0;
+    while (len < (int)sizeof(req) - 1)
+    {
+        ssize_t n = recv(client, req + len, sizeof(req) - 1 - len, 0);
+        if (n <= 0)
+        {
+            break;
+        }
+        len += n;
+        req[len] = 0;
+        if (strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL)
+        {
+            break;
+        }
+    }
+
+    MetricsText t;
+    mt_init(&t);
+    g_metrics_render(&t, g_metrics_arg);
+    char header[256];
+    int header_len = 0;
+    if (t.error)
+    {
+        header_len = snprintf(header, sizeof(header), 
+            "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n");
+        write_all(client, header, header_len);
+    }
+    else
+    {
+        header_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\n\r\n", t.len);
+        write_all(client, header, header_len);
+        write_all(client, t.buf, t.len);
+    }
+    mt_free(&t);
+}
+
+static void* metrics_func(void* arg)
+{
+    while (!g_metrics_stop)
+    {
+        struct pollfd pfd = {g_metrics_server, POLLIN, 0};
+        if (poll(&pfd, 1, 1000) <= 0)
+        {
+            continue;
+        }
+        int client = accept(g_metrics_server, NULL, NULL);
+        if (client < 0)
+        {
+            continue;
+        }
+        serve_metrics(client);
+        close(client);
+    }
+    return NULL;
+}
+
+int metrics_http_start(const char* host, int port, MetricsRender* render, void* arg)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+    {
+        printf("invalid metrics address %s\n", host);
+        return -1;
+    }
+    int s = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0)
+    {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 8) != 0)
+    {
+        printf("failed to listen on %s:%d for the metrics: %s\n", host, port, strerror(errno));
+        close(s);
+        return -1;
+    }
+    g_metrics_server = s;
+    g_metrics_render = render;
+    g_metrics_arg = arg;
+    g_metrics_stop = 0;
+    if (pthread_create(&g_metrics_thread, NULL, metrics_func, NULL) != 0)
+    {
+        close(s);
+        g_metrics_server = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void metrics_http_stop()
+{
+    if (g_metrics_server < 0)
+    {
+        return;
+    }
+    g_metrics_stop = 1;
+    pthread_join(g_metrics_thread, NULL);
+    close(g_metrics_server);
+    g_metrics_server = -1;
+}
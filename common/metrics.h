@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_METRICS_H
+#define INF_BCE_IOT_EDGE_SDK_METRICS_H
+
+// counters and latency histograms of the gateways, shared by the modbus and the
+// bacnet gateway. they are updated with atomic adds by any thread, without
+// locks, and read while being updated, so a snapshot may be off by the updates
+// in progress, which is fine for monitoring.
+// the histograms are log-linear like HdrHistogram: every power of 2 is split
+// into HIST_SUB_BUCKETS buckets, the values are kept within 12.5%, from 1 to
+// about 2^40 (us, i.e. 12 days). the values are in the unit of the caller,
+// the gateways record microseconds
+
+enum
+{
+    HIST_SUB_BITS = 3,
+    HIST_SUB_BUCKETS = 1 << HIST_SUB_BITS,
+    HIST_BUCKETS = HIST_SUB_BUCKETS * 38,
+};
+
+typedef struct
+{
+    unsigned long long counts[HIST_BUCKETS];
+    unsigned long long count;
+    unsigned long long sum;
+    long long max;
+} Histogram;
+
+// add n to the counter
+static inline void counter_add(unsigned long long* counter, long long n)
+{
+    __atomic_fetch_add(counter, (unsigned long long)n, __ATOMIC_RELAXED);
+}
+
+static inline unsigned long long counter_get(const unsigned long long* counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// record one value, the negative ones count as 0
+void hist_record(Histogram* h, long long value);
+
+// the value at percentile p(0 to 100), the upper bound of its bucket, 0 if empty
+long long hist_percentile(const Histogram* h, double p);
+
+double hist_mean(const Histogram* h);
+
+// a growable text buffer for the prometheus text format
+typedef struct
+{
+    char* buf;
+    int len;
+    int cap;
+    int error;                      // an allocation failed, the text is incomplete
+} MetricsText;
+
+void mt_init(MetricsText* t);
+
+void mt_free(MetricsText* t);
+
+void mt_printf(MetricsText* t, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// write the "# TYPE" line of a metric, once before its samples
+void mt_type(MetricsText* t, const char* name, const char* type);
+
+// write a sample of a counter or gauge, labels is like `bus="a",slaveid="1"`,
+// or NULL
+void mt_value(MetricsText* t, const char* name, const char* labels, double value);
+
+// write a histogram of microseconds as a prometheus histogram in seconds,
+// with the buckets at the powers of 2, plus _sum and _count
+void mt_histogram(MetricsText* t, const char* name, const char* labels, const Histogram* h);
+
+// render the metrics on every scrape, into t
+typedef void MetricsRender(MetricsText* t, void* arg);
+
+// serve the metrics over http on host:port in a thread of its own, for a
+// prometheus scrape. any path is answered. return 0 on success, -1 otherwise
+int metrics_http_start(const char* host, int port, MetricsRender* render, void* arg);
+
+void metrics_http_stop();
+
+#endif
@@ -0,0 +1,490 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mqtt_persist.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+enum
+{
+    JOURNAL_MAGIC = 0x5453504d,     // "MPST"
+    OP_PUT = 1,
+    OP_REMOVE = 2
+};
+
+// the header of a journal record, followed by the key and the data
+typedef struct
+{
+    uint32_t magic;
+    uint32_t crc;                   // of the rest of the header, the key and the data
+    uint32_t dataLen;
+    uint16_t keyLen;
+    uint16_t op;
+} JournalRecord;
+
+typedef struct
+{
+    char* key;
+    char* data;
+    int len;
+} PersistEntry;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    char path[512];
+    int fd;
+    PersistEntry* entries;
+    int count;
+    int cap;
+    long long journalBytes;
+    long long liveBytes;            // the journal bytes of the entries still there
+    long long lastSync;             // monotonic time(ms) of the last flush
+    int dirty;                      // appended since the last flush
+    int failed;                     // a write failed, it's reported once
+} Persist;
+
+static long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long long record_bytes(int keyLen, int dataLen)
+{
+    return (long long)sizeof(JournalRecord) + keyLen + dataLen;
+}
+
+static int find_entry(Persist* p, const char* key)
+{
+    int i = 0;
+    for (i = 0; i < p->count; i++)
+    {
+        if (strcmp(p->entries[i].key, key) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void remove_entry(Persist* p, int i)
+{
+    p->liveBytes -= record_bytes(strlen(p->entries[i].key), p->entries[i].len);
+    free(p->entries[i].key);
+    free(p->entries[i].data);
+    p->entries[i] = p->entries[--p->count];
+}
+
+// the entry takes data, return 0 on success, -1 if out of memory
+static int set_entry(Persist* p, const char* key, char* data, int len)
+{
+    int i = find_entry(p, key);
+    if (i >= 0)
+    {
+        remove_entry(p, i);
+    }
+    if (p->count == p->cap)
+    {
+        int cap = p->cap > 0 ? p->cap * 2 : 16;
+        PersistEntry* entries = (PersistEntry*) realloc(p->entries, cap * sizeof(PersistEntry));
+        if (entries == NULL)
+        {
+            return -1;
+        }
+        p->entries = entries;
+        p->cap = cap;
+    }
+    char* copy = strdup(key);
+    if (copy == NULL)
+    {
+        return -1;
+    }
+    p->entries[p->count].key = copy;
+    p->entries[p->count].data = data;
+    p->entries[p->count].len = len;
+    p->count++;
+    p->liveBytes += record_bytes(strlen(key), len);
+    return 0;
+}
+
+static int write_all(int fd, const char* buf, long long len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_record(int fd, int op, const char* key, const char* data, int len)
+{
+    int keyLen = strlen(key);
+    long long size = record_bytes(keyLen, len);
+    char* buf = (char*) malloc(size);
+    if (buf == NULL)
+    {
+        return -1;
+    }
+    JournalRecord rec;
+    rec.magic = JOURNAL_MAGIC;
+    rec.dataLen = len;
+    rec.keyLen = keyLen;
+    rec.op = op;
+    memcpy(buf, &rec, sizeof(rec));
+    memcpy(buf + sizeof(rec), key, keyLen);
+    if (len > 0)
+    {
+        memcpy(buf + sizeof(rec) + keyLen, data, len);
+    }
+    // the crc covers everything but the magic and the crc itself
+    rec.crc = crc32(0, (const Bytef*)buf + 8, size - 8);
+    memcpy(buf + 4, &rec.crc, sizeof(rec.crc));
+    int rc = write_all(fd, buf, size);
+    free(buf);
+    return rc;
+}
+
+// a failed write only costs the durability, the messages still go out from memory
+static void append_record(Persist* p, int op, const char* key, const char* data, int len)
+{
+    if (p->fd < 0 || write_record(p->fd, op, key, data, len) != 0)
+    {
+        if (!p->failed)
+        {
+            printf("failed to write the mqtt journal %s\n", p->path);
+        }
+        p->failed = 1;
+        return;
+    }
+    p->journalBytes += record_bytes(strlen(key), len);
+    p->dirty = 1;
+    long long now = now_ms();
+    if (now - p->lastSync >= MPERSIST_SYNC_MS)
+    {
+        fdatasync(p->fd);
+        p->lastSync = now;
+        p->dirty = 0;
+    }
+}
+
+// rewrite the journal with the entries still there, once the removed ones
+// take most of it
+static void compact(Persist* p)
+{
+    if (p->fd < 0 || p->journalBytes < MPERSIST_COMPACT_BYTES || p->journalBytes < 2 * p->liveBytes)
+    {
+        return;
+    }
+    char tmp[520];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", p->path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int rc = fd < 0 ? -1 : 0;
+    int i = 0;
+    for (i = 0; rc == 0 && i < p->count; i++)
+    {
+        rc = write_record(fd, OP_PUT, p->entries[i].key, p->entries[i].data, p->entries[i].len);
+    }
+    if (rc == 0 && fsync(fd) == 0 && rename(tmp, p->path) == 0)
+    {
+        close(p->fd);
+        p->fd = open(p->path, O_WRONLY | O_APPEND);
+        p->journalBytes = p->liveBytes;
+        p->lastSync = now_ms();
+        p->dirty = 0;
+    }
+    else
+    {
+        unlink(tmp);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+// apply the records of the journal, and cut it at the first one torn by a crash
+static void replay(Persist* p, int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        return;
+    }
+    char* buf = (char*) malloc(st.st_size);
+    if (buf == NULL || pread(fd, buf, st.st_size, 0) != st.st_size)
+    {
+        free(buf);
+        return;
+    }
+    long long off = 0;
+    while (off + (long long)sizeof(JournalRecord) <= st.st_size)
+    {
+        JournalRecord rec;
+        memcpy(&rec, buf + off, sizeof(rec));
+        long long size = record_bytes(rec.keyLen, rec.dataLen);
+        if (rec.magic != JOURNAL_MAGIC || off + size > st.st_size
+            || crc32(0, (const Bytef*)buf + off + 8, size - 8) != rec.crc)
+        {
+            break;
+        }
+        char* key = strndup(buf + off + sizeof(rec), rec.keyLen);
+        if (key == NULL)
+        {
+            break;
+        }
+        int i = find_entry(p, key);
+        if (rec.op == OP_REMOVE && i >= 0)
+        {
+            remove_entry(p, i);
+        }
+        else if (rec.op == OP_PUT)
+        {
+            char* data = (char*) malloc(rec.dataLen > 0 ? rec.dataLen : 1);
+            if (data == NULL || set_entry(p, key, data, rec.dataLen) != 0)
+            {
+                free(data);
+                free(key);
+                break;
+            }
+            memcpy(data, buf + off + sizeof(rec) + rec.keyLen, rec.dataLen);
+        }
+        free(key);
+        off += size;
+    }
+    free(buf);
+    if (off < st.st_size)
+    {
+        printf("dropped the torn tail of the mqtt journal %s at %lld\n", p->path, off);
+        if (ftruncate(fd, off) != 0)
+        {
+            printf("failed to truncate the mqtt journal %s\n", p->path);
+        }
+    }
+    p->journalBytes = off;
+}
+
+static int persist_open(void** handle, const char* clientID, const char* serverURI, void* context)
+{
+    const char* dir = (const char*) context;
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    {
+        printf("failed to create the mqtt journal directory %s\n", dir);
+        return MQTTCLIENT_PERSISTENCE_ERROR;
+    }
+    Persist* p = (Persist*) calloc(1, sizeof(Persist));
+    if (p == NULL)
+    {
+        return MQTTCLIENT_PERSISTENCE_ERROR;
+    }
+    snprintf(p->path, sizeof(p->path), "%s/inflight.log", dir);
+    p->fd = open(p->path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (p->fd < 0)
+    {
+        printf("failed to open the mqtt journal %s\n", p->path);
+        free(p);
+        return MQTTCLIENT_PERSISTENCE_ERROR;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    replay(p, p->fd);
+    p->lastSync = now_ms();
+    *handle = p;
+    return 0;
+}
+
+static int persist_close(void* handle)
+{
+    Persist* p = (Persist*) handle;
+    if (p->fd >= 0)
+    {
+        if (p->dirty)
+        {
+            fdatasync(p->fd);
+        }
+        close(p->fd);
+    }
+    while (p->count > 0)
+    {
+        remove_entry(p, p->count - 1);
+    }
+    free(p->entries);
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+    return 0;
+}
+
+static int persist_put(void* handle, char* key, int bufcount, char* buffers[], int buflens[])
+{
+    Persist* p = (Persist*) handle;
+    int len = 0;
+    int i = 0;
+    for (i = 0; i < bufcount; i++)
+    {
+        len += buflens[i];
+    }
+    char* data = (char*) malloc(len > 0 ? len : 1);
+    if (data == NULL)
+    {
+        return MQTTCLIENT_PERSISTENCE_ERROR;
+    }
+    char* dest = data;
+    for (i = 0; i < bufcount; i++)
+    {
+        memcpy(dest, buffers[i], buflens[i]);
+        dest += buflens[i];
+    }
+    pthread_mutex_lock(&p->lock);
+    int rc = set_entry(p, key, data, len);
+    if (rc == 0)
+    {
+        append_record(p, OP_PUT, key, data, len);
+    }
+    pthread_mutex_unlock(&p->lock);
+    if (rc != 0)
+    {
+        free(data);
+        return MQTTCLIENT_PERSISTENCE_ERROR;
+    }
+    return 0;
+}
+
+static int persist_get(void* handle, char* key, char** buffer, int* buflen)
+{
+    Persist* p = (Persist*) handle;
+    int rc = MQTTCLIENT_PERSISTENCE_ERROR;
+    pthread_mutex_lock(&p->lock);
+    int i = find_entry(p, key);
+    if (i >= 0)
+    {
+        // freed by paho
+        *buffer = (char*) malloc(p->entries[i].len > 0 ? p->entries[i].len : 1);
+        if (*buffer != NULL)
+        {
+            memcpy(*buffer, p->entries[i].data, p->entries[i].len);
+            *buflen = p->entries[i].len;
+            rc = 0;
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return rc;
+}
+
+static int persist_remove(void* handle, char* key)
+{
+    Persist* p = (Persist*) handle;
+    pthread_mutex_lock(&p->lock);
+    int i = find_entry(p, key);
+    if (i >= 0)
+    {
+        remove_entry(p, i);
+        append_record(p, OP_REMOVE, key, NULL, 0);
+        compact(p);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+static int persist_keys(void* handle, char*** keys, int* nkeys)
+{
+    Persist* p = (Persist*) handle;
+    int rc = 0;
+    pthread_mutex_lock(&p->lock);
+    *keys = NULL;
+    *nkeys = 0;
+    if (p->count > 0)
+    {
+        // freed by paho, the array and every key
+        *keys = (char**) malloc(p->count * sizeof(char*));
+        int i = 0;
+        for (i = 0; *keys != NULL && i < p->count; i++)
+        {
+            (*keys)[i] = strdup(p->entries[i].key);
+            if ((*keys)[i] == NULL)
+            {
+                break;
+            }
+        }
+        *nkeys = i;
+        if (*keys == NULL || i < p->count)
+        {
+            rc = MQTTCLIENT_PERSISTENCE_ERROR;
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return rc;
+}
+
+static int persist_clear(void* handle)
+{
+    Persist* p = (Persist*) handle;
+    pthread_mutex_lock(&p->lock);
+    while (p->count > 0)
+    {
+        remove_entry(p, p->count - 1);
+    }
+    if (p->fd >= 0 && ftruncate(p->fd, 0) == 0)
+    {
+        p->journalBytes = 0;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+static int persist_containskey(void* handle, char* key)
+{
+    Persist* p = (Persist*) handle;
+    pthread_mutex_lock(&p->lock);
+    int found = find_entry(p, key) >= 0;
+    pthread_mutex_unlock(&p->lock);
+    return found ? 0 : MQTTCLIENT_PERSISTENCE_ERROR;
+}
+
+void mpersist_init(MQTTClient_persistence* p, const char* dir)
+{
+    p->context = (void*) dir;
+    p->popen = persist_open;
+    p->pclose = persist_close;
+    p->pput = persist_put;
+    p->pget = persist_get;
+    p->premove = persist_remove;
+    p->pkeys = persist_keys;
+    p->pclear = persist_clear;
+    p->pcontainskey = persist_containskey;
+}
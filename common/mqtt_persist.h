@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_MQTT_PERSIST_H
+#define INF_BCE_IOT_EDGE_SDK_MQTT_PERSIST_H
+
+#include <MQTTClientPersistence.h>
+
+// a persistence of the paho client for the qos 1 messages in flight. paho
+// stores every message twice, as a command until it's sent and as a packet
+// until it's acknowledged, which with its default file persistence is a file
+// created and deleted per message. here the entries are kept in memory, and
+// every change is appended to one journal file, so a message costs a few
+// appends to the page cache. the journal is flushed to disk at most every
+// MPERSIST_SYNC_MS, and compacted once it's mostly removed entries. on open,
+// the journal left by the previous run is replayed, up to a record torn by a
+// crash, and paho resends what was in flight.
+
+enum {MPERSIST_SYNC_MS = 1000, MPERSIST_COMPACT_BYTES = 1024 * 1024};
+
+// fill p for MQTTCLIENT_PERSISTENCE_USER, the journal is dir/inflight.log.
+// dir must live as long as the clients using p
+void mpersist_init(MQTTClient_persistence* p, const char* dir);
+
+#endif
@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "numfmt.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// the 2 digits of every number below 100
+static const char DIGIT_PAIRS[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+int numfmt_u64(char* dest, unsigned long long value)
+{
+    // written backwards, 2 digits a division
+    char text[NUMFMT_INT_SIZE];
+    char* p = text + sizeof(text);
+    while (value >= 100)
+    {
+        unsigned pair = (unsigned) (value % 100);
+        value /= 100;
+        p -= 2;
+        memcpy(p, DIGIT_PAIRS + 2 * pair, 2);
+    }
+    if (value >= 10)
+    {
+        p -= 2;
+        memcpy(p, DIGIT_PAIRS + 2 * value, 2);
+    }
+    else
+    {
+        *--p = (char) ('0' + value);
+    }
+    int n = (int) (text + sizeof(text) - p);
+    memcpy(dest, p, n);
+    dest[n] = '\0';
+    return n;
+}
+
+int numfmt_i64(char* dest, long long value)
+{
+    if (value < 0)
+    {
+        // the magnitude of the smallest value only fits unsigned
+        *dest = '-';
+        return numfmt_u64(dest + 1, 0ULL - (unsigned long long) value) + 1;
+    }
+    return numfmt_u64(dest, (unsigned long long) value);
+}
+
+// a floating point number f * 2^e, with 64 bits of significand
+typedef struct
+{
+    uint64_t f;
+    int e;
+} DiyFp;
+
+// 10^k for k = -348, -340, ..., 340, rounded to 64 bits
+static const uint64_t CACHED_POWERS_F[87] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+
+static const int16_t CACHED_POWERS_E[87] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static const uint32_t POW10[10] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+// the upper 64 bits of the 128 bit product, rounded
+static DiyFp diy_mul(DiyFp x, DiyFp y)
+{
+    const uint64_t m32 = 0xFFFFFFFFULL;
+    uint64_t a = x.f >> 32;
+    uint64_t b = x.f & m32;
+    uint64_t c = y.f >> 32;
+    uint64_t d = y.f & m32;
+    uint64_t ac = a * c;
+    uint64_t bc = b * c;
+    uint64_t ad = a * d;
+    uint64_t bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32) + (1ULL << 31);
+    DiyFp r;
+    r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+static DiyFp diy_normalize(DiyFp x)
+{
+#if defined(__GNUC__)
+    int shift = __builtin_clzll(x.f);
+    x.f <<= shift;
+    x.e -= shift;
+#else
+    while (!(x.f & (1ULL << 63)))
+    {
+        x.f <<= 1;
+        x.e--;
+    }
+#endif
+    return x;
+}
+
+// the cached power c of 10 for which c * 2^e is in the range of the digit
+// generation, its decimal exponent is -*k
+static DiyFp cached_power(int e, int* k)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int i = (int) dk;
+    if (dk - i > 0.0)
+    {
+        i++;
+    }
+    unsigned index = (unsigned) ((i >> 3) + 1);
+    DiyFp c;
+    c.f = CACHED_POWERS_F[index];
+    c.e = CACHED_POWERS_E[index];
+    *k = -(-348 + (int) (index << 3));
+    return c;
+}
+
+static int count_digits(uint32_t n)
+{
+    int count = 1;
+    while (count < 10 && n >= POW10[count])
+    {
+        count++;
+    }
+    return count;
+}
+
+// move the last digit down, towards the value, while it is still within the
+// neighbours
+static void grisu_round(char* digits, int len, uint64_t delta, uint64_t rest,
+    uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+        (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        digits[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+// the digits of mp, until the rest is within delta of it
+static int digit_gen(DiyFp w, DiyFp mp, uint64_t delta, char* digits, int* k)
+{
+    DiyFp one;
+    one.f = 1ULL << -mp.e;
+    one.e = mp.e;
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t) (mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = count_digits(p1);
+    int len = 0;
+    while (kappa > 0)
+    {
+        uint32_t d = p1 / POW10[kappa - 1];
+        p1 %= POW10[kappa - 1];
+        if (d || len)
+        {
+            digits[len++] = (char) ('0' + d);
+        }
+        kappa--;
+        uint64_t rest = ((uint64_t) p1 << -one.e) + p2;
+        if (rest <= delta)
+        {
+            *k += kappa;
+            grisu_round(digits, len, delta, rest, (uint64_t) POW10[kappa] << -one.e, wp_w);
+            return len;
+        }
+    }
+    for (;;)
+    {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char) (p2 >> -one.e);
+        if (d || len)
+        {
+            digits[len++] = (char) ('0' + d);
+        }
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta)
+        {
+            *k += kappa;
+            grisu_round(digits, len, delta, p2, one.f, wp_w * (-kappa < 10 ? POW10[-kappa] : 0));
+            return len;
+        }
+    }
+}
+
+// the shortest digits of f * 2^e, whose neighbours in its format are half a
+// step away, or a quarter on the lower side at a power of 2. the value is
+// about digits * 10^*k
+static int grisu2(uint64_t f, int e, int lower_closer, char* digits, int* k)
+{
+    DiyFp v;
+    DiyFp plus;
+    DiyFp minus;
+    v.f = f;
+    v.e = e;
+    plus.f = (f << 1) + 1;
+    plus.e = e - 1;
+    plus = diy_normalize(plus);
+    if (lower_closer)
+    {
+        minus.f = (f << 2) - 1;
+        minus.e = e - 2;
+    }
+    else
+    {
+        minus.f = (f << 1) - 1;
+        minus.e = e - 1;
+    }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+    DiyFp c = cached_power(plus.e, k);
+    DiyFp w = diy_mul(diy_normalize(v), c);
+    DiyFp wp = diy_mul(plus, c);
+    DiyFp wm = diy_mul(minus, c);
+    wm.f++;
+    wp.f--;
+    return digit_gen(w, wp, wp.f - wm.f, digits, k);
+}
+
+// digits * 10^k as javascript writes it
+static int format_digits(char* dest, const char* digits, int len, int k)
+{
+    // the decimal point is after this many digits
+    int point = len + k;
+    char* p = dest;
+    if (k >= 0 && point <= 21)
+    {
+        memcpy(p, digits, len);
+        p += len;
+        memset(p, '0', k);
+        p += k;
+    }
+    else if (point > 0 && point <= 21)
+    {
+        memcpy(p, digits, point);
+        p += point;
+        *p++ = '.';
+        memcpy(p, digits + point, len - point);
+        p += len - point;
+    }
+    else if (point > -6 && point <= 0)
+    {
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', -point);
+        p += -point;
+        memcpy(p, digits, len);
+        p += len;
+    }
+    else
+    {
+        *p++ = digits[0];
+        if (len > 1)
+        {
+            *p++ = '.';
+            memcpy(p, digits + 1, len - 1);
+            p += len - 1;
+        }
+        *p++ = 'e';
+        *p++ = point - 1 < 0 ? '-' : '+';
+        p += numfmt_u64(p, (unsigned long long) (point - 1 < 0 ? 1 - point : point - 1));
+    }
+    *p = '\0';
+    return (int) (p - dest);
+}
+
+// the sign, then the text of zero or of the values which are not numbers
+static int format_special(char* dest, int negative, const char* text)
+{
+    int n = 0;
+    if (negative)
+    {
+        dest[n++] = '-';
+    }
+    int len = (int) strlen(text);
+    memcpy(dest + n, text, len + 1);
+    return n + len;
+}
+
+int numfmt_double(char* dest, double value)
+{
+    uint64_t bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    int negative = (int) (bits >> 63);
+    int biased = (int) ((bits >> 52) & 0x7FF);
+    uint64_t fraction = bits & ((1ULL << 52) - 1);
+    if (biased == 0x7FF)
+    {
+        return fraction != 0 ? format_special(dest, 0, "nan") : format_special(dest, negative, "inf");
+    }
+    if (biased == 0 && fraction == 0)
+    {
+        return format_special(dest, negative, "0");
+    }
+    uint64_t f = fraction;
+    int e = 1 - 1075;
+    if (biased != 0)
+    {
+        f |= 1ULL << 52;
+        e = biased - 1075;
+    }
+    char digits[20];
+    int k = 0;
+    int len = grisu2(f, e, biased > 1 && fraction == 0, digits, &k);
+    int n = format_special(dest, negative, "");
+    return n + format_digits(dest + n, digits, len, k);
+}
+
+int numfmt_float(char* dest, float value)
+{
+    uint32_t bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    int negative = (int) (bits >> 31);
+    int biased = (int) ((bits >> 23) & 0xFF);
+    uint32_t fraction = bits & ((1UL << 23) - 1);
+    if (biased == 0xFF)
+    {
+        return fraction != 0 ? format_special(dest, 0, "nan") : format_special(dest, negative, "inf");
+    }
+    if (biased == 0 && fraction == 0)
+    {
+        return format_special(dest, negative, "0");
+    }
+    uint64_t f = fraction;
+    int e = 1 - 150;
+    if (biased != 0)
+    {
+        f |= 1ULL << 23;
+        e = biased - 150;
+    }
+    char digits[20];
+    int k = 0;
+    int len = grisu2(f, e, biased > 1 && fraction == 0, digits, &k);
+    int n = format_special(dest, negative, "");
+    return n + format_digits(dest + n, digits, len, k);
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef INF_BCE_IOT_EDGE_SDK_NUMFMT_H
+#define INF_BCE_IOT_EDGE_SDK_NUMFMT_H
+
+// number to text conversions of the published values, without printf.
+// every function writes a terminating 0 and returns the chars written before it.
+//
+// the floating point values are written with few enough digits to read back as
+// the same value, as javascript's Number.toString does: 21, 0.1, 1.5e-7, 1e+21.
+// the digits are those of grisu2, which are the shortest for all but about one
+// double and two floats in a thousand, see numfmt_bench.c for the numbers
+
+// the room needed for any double or float, with the terminating 0
+enum {NUMFMT_DOUBLE_SIZE = 32};
+
+// the room needed for any 64 bit integer, with the sign and the terminating 0
+enum {NUMFMT_INT_SIZE = 21};
+
+int numfmt_u64(char* dest, unsigned long long value);
+
+int numfmt_i64(char* dest, long long value);
+
+// nan, inf and -inf are written as such, they are not numbers in json
+int numfmt_double(char* dest, double value);
+
+// the digits of the float, e.g. 0.1f is 0.1, not 0.10000000149011612
+int numfmt_float(char* dest, float value);
+
+#endif
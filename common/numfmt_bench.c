@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// checks and benchmark of the number to text conversions of the published
+// values against printf: the text of random doubles, floats and integers must
+// read back as the same value, in at most 17 or 9 digits, and the values for
+// which printf finds fewer digits are counted. grisu2 misses a few, mostly those
+// halfway between two doubles, which printf reads back by rounding to even.
+// then the time of both on sensor like values.
+//
+// usage: ./numfmt_bench [values] [rounds]
+
+#include "numfmt.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double elapsed_ms(struct timespec* start, struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static uint64_t random_bits(void)
+{
+    uint64_t bits = 0;
+    int i = 0;
+    for (i = 0; i < 4; i++)
+    {
+        bits = (bits << 16) ^ (uint64_t) (rand() & 0xFFFF);
+    }
+    return bits;
+}
+
+// the previous conversion of the json writer
+static int ref_double(char* text, double value)
+{
+    int n = snprintf(text, NUMFMT_DOUBLE_SIZE, "%.15g", value);
+    if (strtod(text, NULL) != value)
+    {
+        n = snprintf(text, NUMFMT_DOUBLE_SIZE, "%.17g", value);
+    }
+    return n;
+}
+
+// and of the floats of the bacnet gateway, before the writer had its turn
+static int ref_float(char* text, float f)
+{
+    snprintf(text, NUMFMT_DOUBLE_SIZE, "%.7g", f);
+    if ((float) strtod(text, NULL) != f)
+    {
+        snprintf(text, NUMFMT_DOUBLE_SIZE, "%.9g", f);
+    }
+    return ref_double(text, strtod(text, NULL));
+}
+
+// the significant digits of the text
+static int count_digits(const char* text)
+{
+    int count = 0;
+    int zeros = 0;
+    for (; *text != '\0' && *text != 'e'; text++)
+    {
+        if (*text == '0')
+        {
+            // leading zeros do not count, trailing ones neither
+            if (count > 0)
+            {
+                zeros++;
+            }
+        }
+        else if (*text >= '1' && *text <= '9')
+        {
+            count += zeros + 1;
+            zeros = 0;
+        }
+    }
+    return count;
+}
+
+// the fewest digits printf needs for the value to read back
+static int shortest_digits(double value, int is_float)
+{
+    char text[64];
+    int precision = 0;
+    for (precision = 0; precision < 17; precision++)
+    {
+        snprintf(text, sizeof(text), "%.*e", precision, value);
+        if (is_float ? strtof(text, NULL) == (float) value : strtod(text, NULL) == value)
+        {
+            break;
+        }
+    }
+    return precision + 1;
+}
+
+static int check_double(double value, int* longer)
+{
+    char text[NUMFMT_DOUBLE_SIZE];
+    int n = numfmt_double(text, value);
+    double back = strtod(text, NULL);
+    if (n != (int) strlen(text) || memcmp(&back, &value, sizeof(value)) != 0)
+    {
+        printf("ERROR: %.17g is written %s\n", value, text);
+        return 1;
+    }
+    int digits = count_digits(text);
+    int shortest = shortest_digits(value, 0);
+    if (digits > 17)
+    {
+        printf("ERROR: %.17g is written %s, %d digits\n", value, text, digits);
+        return 1;
+    }
+    *longer += digits > shortest;
+    return 0;
+}
+
+static int check_float(float value, int* longer)
+{
+    char text[NUMFMT_DOUBLE_SIZE];
+    int n = numfmt_float(text, value);
+    float back = strtof(text, NULL);
+    if (n != (int) strlen(text) || memcmp(&back, &value, sizeof(value)) != 0)
+    {
+        printf("ERROR: %.9g is written %s\n", value, text);
+        return 1;
+    }
+    int digits = count_digits(text);
+    int shortest = shortest_digits(value, 1);
+    if (digits > 9)
+    {
+        printf("ERROR: %.9g is written %s, %d digits\n", value, text, digits);
+        return 1;
+    }
+    *longer += digits > shortest;
+    return 0;
+}
+
+static int check_int(long long value)
+{
+    char text[NUMFMT_INT_SIZE];
+    char ref[32];
+    int n = numfmt_i64(text, value);
+    snprintf(ref, sizeof(ref), "%lld", value);
+    if (n != (int) strlen(ref) || strcmp(text, ref) != 0)
+    {
+        printf("ERROR: %s is written %s\n", ref, text);
+        return 1;
+    }
+    unsigned long long u = (unsigned long long) value;
+    n = numfmt_u64(text, u);
+    snprintf(ref, sizeof(ref), "%llu", u);
+    if (n != (int) strlen(ref) || strcmp(text, ref) != 0)
+    {
+        printf("ERROR: %s is written %s\n", ref, text);
+        return 1;
+    }
+    return 0;
+}
+
+static int check_text(const char* text, const char* expected)
+{
+    if (strcmp(text, expected) != 0)
+    {
+        printf("ERROR: %s is written %s\n", expected, text);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    int num = argc > 1 ? atoi(argv[1]) : 1000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 2000;
+    if (num <= 0 || rounds <= 0)
+    {
+        printf("usage: %s [values] [rounds]\n", argv[0]);
+        return 1;
+    }
+    double* doubles = (double*) malloc(num * sizeof(double));
+    float* floats = (float*) malloc(num * sizeof(float));
+    long long* ints = (long long*) malloc(num * sizeof(long long));
+    if (doubles == NULL || floats == NULL || ints == NULL)
+    {
+        printf("out of memory\n");
+        return 1;
+    }
+    srand(20170601);
+
+    // the text of the usual values, and of the edges
+    int errors = 0;
+    char text[NUMFMT_DOUBLE_SIZE];
+    numfmt_double(text, 0.1);
+    errors += check_text(text, "0.1");
+    numfmt_double(text, 21.0);
+    errors += check_text(text, "21");
+    numfmt_double(text, -1.5e-7);
+    errors += check_text(text, "-1.5e-7");
+    numfmt_double(text, 0.000001);
+    errors += check_text(text, "0.000001");
+    numfmt_double(text, 1e21);
+    errors += check_text(text, "1e+21");
+    numfmt_double(text, 123456789012345680000.0);
+    errors += check_text(text, "123456789012345680000");
+    numfmt_double(text, 5e-324);
+    errors += check_text(text, "5e-324");
+    numfmt_double(text, 1.7976931348623157e308);
+    errors += check_text(text, "1.7976931348623157e+308");
+    numfmt_double(text, -0.0);
+    errors += check_text(text, "-0");
+    numfmt_float(text, 0.1f);
+    errors += check_text(text, "0.1");
+    numfmt_float(text, 3.4028235e38f);
+    errors += check_text(text, "3.4028235e+38");
+    numfmt_float(text, 1e-45f);
+    errors += check_text(text, "1e-45");
+    errors += check_int(0) + check_int(9) + check_int(10) + check_int(-99) + check_int(100);
+    errors += check_int(LLONG_MAX) + check_int(LLONG_MIN);
+
+    // any bits, but those which are not numbers
+    int longer_doubles = 0;
+    int longer_floats = 0;
+    int checks = num * 100;
+    int i = 0;
+    for (i = 0; i < checks && errors < 10; i++)
+    {
+        uint64_t bits = random_bits();
+        double d = 0;
+        uint32_t bits32 = (uint32_t) bits;
+        float f = 0;
+        memcpy(&d, &bits, sizeof(d));
+        memcpy(&f, &bits32, sizeof(f));
+        if (d == d && d - d == 0)
+        {
+            errors += check_double(d, &longer_doubles);
+        }
+        if (f == f && f - f == 0)
+        {
+            errors += check_float(f, &longer_floats);
+        }
+        errors += check_int((long long) bits >> (i % 64));
+    }
+    printf("%d random doubles and floats read back, %d and %d of them (%.3f%%, %.3f%%) "
+        "longer than the shortest\n", checks, longer_doubles, longer_floats,
+        100.0 * longer_doubles / checks, 100.0 * longer_floats / checks);
+
+    // sensor like values, with at most 2 decimals, and counters
+    for (i = 0; i < num; i++)
+    {
+        doubles[i] = (rand() % 2000000 - 1000000) / 100.0;
+        floats[i] = (float) doubles[i];
+        ints[i] = rand() % 100000;
+    }
+    struct timespec start;
+    struct timespec end;
+    double ms[6];
+    long long sum = 0;
+    int r = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < num; i++)
+        {
+            sum += ref_double(text, doubles[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms[0] = elapsed_ms(&start, &end);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < num; i++)
+        {
+            sum += numfmt_double(text, doubles[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms[1] = elapsed_ms(&start, &end);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < num; i++)
+        {
+            sum += ref_float(text, floats[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms[2] = elapsed_ms(&start, &end);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < num; i++)
+        {
+            sum += numfmt_float(text, floats[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms[3] = elapsed_ms(&start, &end);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < num; i++)
+        {
+            sum += snprintf(text, sizeof(text), "%lld", ints[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms[4] = elapsed_ms(&start, &end);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < num; i++)
+        {
+            sum += numfmt_i64(text, ints[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms[5] = elapsed_ms(&start, &end);
+
+    double per = 1000000.0 / ((double) rounds * num);
+    printf("double %d values x %d: printf %.3f ms (%.1f ns/value), grisu2 %.3f ms (%.1f ns/value)\n",
+        num, rounds, ms[0], ms[0] * per, ms[1], ms[1] * per);
+    printf("float %d values x %d: printf %.3f ms (%.1f ns/value), grisu2 %.3f ms (%.1f ns/value)\n",
+        num, rounds, ms[2], ms[2] * per, ms[3], ms[3] * per);
+    printf("integer %d values x %d: printf %.3f ms (%.1f ns/value), pairs %.3f ms (%.1f ns/value)\n",
+        num, rounds, ms[4], ms[4] * per, ms[5], ms[5] * per);
+    printf("checksum %lld\n", sum);
+
+    free(doubles);
+    free(floats);
+    free(ints);
+    return errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// for the cpu sets
+#define _GNU_SOURCE
+
+#include "realtime.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+int rt_parse_cpus(const char* text, RtCpus* cpus)
+{
+    RtCpus set = 0;
+    const char* p = text;
+    while (*p != 0)
+    {
+        char* end = NULL;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p)
+        {
+            return -1;
+        }
+        p = end;
+        if (*p == '-')
+        {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p)
+            {
+                return -1;
+            }
+            p = end;
+        }
+        if (first < 0 || last < first || last >= RT_MAX_CPUS)
+        {
+            return -1;
+        }
+        for (; first <= last; first++)
+        {
+            set |= 1ULL << first;
+        }
+        if (*p == ',')
+        {
+            p++;
+        }
+        else if (*p != 0)
+        {
+            return -1;
+        }
+    }
+    if (set == 0)
+    {
+        return -1;
+    }
+    *cpus = set;
+    return 0;
+}
+
+int rt_apply(int priority, RtCpus cpus)
+{
+    int rc = 0;
+    if (cpus != 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        int i = 0;
+        for (i = 0; i < RT_MAX_CPUS; i++)
+        {
+            if (cpus & (1ULL << i))
+            {
+                CPU_SET(i, &set);
+            }
+        }
+        rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (rc != 0)
+        {
+            return rc;
+        }
+    }
+    if (priority > 0)
+    {
+        struct sched_param param;
+        param.sched_priority = priority > RT_MAX_PRIORITY ? RT_MAX_PRIORITY : priority;
+        rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    }
+    return rc;
+}
+
+int rt_lock_memory()
+{
+    return mlockall(MCL_CURRENT | MCL_FUTURE) == 0 ? 0 : errno;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_REALTIME_H
+#define INF_BCE_IOT_EDGE_SDK_REALTIME_H
+
+// the threads timing a bus, the modbus rtu frames or the ms/tp token, can be
+// run under SCHED_FIFO on cpus of their own, so that tls, json and the logger
+// don't delay them. the others are kept off those cpus. the calls fail without
+// CAP_SYS_NICE (or an RLIMIT_RTPRIO) and CAP_IPC_LOCK (or an RLIMIT_MEMLOCK),
+// the gateways then go on with the normal scheduler
+
+// a set of cpus, a bit per cpu below RT_MAX_CPUS
+typedef unsigned long long RtCpus;
+
+enum {RT_MAX_CPUS = 64, RT_MAX_PRIORITY = 99};
+
+// parse a cpu list like "2,3" or "0-1,4" into cpus. return 0, -1 if malformed
+int rt_parse_cpus(const char* text, RtCpus* cpus);
+
+// run the calling thread under SCHED_FIFO at priority(1 to RT_MAX_PRIORITY)
+// if it's not 0, and only on cpus if it's not 0. the threads it creates later
+// inherit both. return 0, or the errno of the step that failed
+int rt_apply(int priority, RtCpus cpus);
+
+// keep every page of the process in memory, the current and the future ones,
+// so that a realtime thread never waits for a page fault. return 0 or errno
+int rt_lock_memory();
+
+#endif
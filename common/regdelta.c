@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "regdelta.h"
+
+#include <string.h>
+
+int regdelta_diff(uint8_t* map, uint16_t* words, const uint16_t* ref, const uint16_t* cur, int n)
+{
+    int count = 0;
+    int i = 0;
+    // 8 registers are two 64 bit words, an unchanged block is skipped without
+    // looking at its registers one by one
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t a0 = 0;
+        uint64_t a1 = 0;
+        uint64_t b0 = 0;
+        uint64_t b1 = 0;
+        memcpy(&a0, ref + i, 8);
+        memcpy(&a1, ref + i + 4, 8);
+        memcpy(&b0, cur + i, 8);
+        memcpy(&b1, cur + i + 4, 8);
+        uint8_t bits = 0;
+        if (((a0 ^ b0) | (a1 ^ b1)) != 0)
+        {
+            int k = 0;
+            for (k = 0; k < 8; k++)
+            {
+                if (ref[i + k] != cur[i + k])
+                {
+                    bits |= (uint8_t)(1 << k);
+                    words[count++] = cur[i + k];
+                }
+            }
+        }
+        map[i / 8] = bits;
+    }
+    if (i < n)
+    {
+        uint8_t bits = 0;
+        int k = 0;
+        for (k = 0; i + k < n; k++)
+        {
+            if (ref[i + k] != cur[i + k])
+            {
+                bits |= (uint8_t)(1 << k);
+                words[count++] = cur[i + k];
+            }
+        }
+        map[i / 8] = bits;
+    }
+    return count;
+}
+
+int regdelta_apply(uint16_t* image, int n, const uint8_t* map, const uint16_t* words, int count)
+{
+    int taken = 0;
+    int i = 0;
+    for (i = 0; i < n; i++)
+    {
+        if (map[i / 8] & (1 << (i % 8)))
+        {
+            if (taken == count)
+            {
+                return -1;
+            }
+            image[i] = words[taken++];
+        }
+    }
+    return taken;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_REGDELTA_H
+#define INF_BCE_IOT_EDGE_SDK_REGDELTA_H
+
+#include <stdint.h>
+
+// the registers of a sample as a delta against the last image published: a
+// bitmap of the registers that changed, in the order of pack_bits (register i
+// is the bit i % 8 of the byte i / 8), and the changed words one after the
+// other. the registers are compared 4 at a time as 64 bit words, the blocks
+// of 8 that didn't change cost two xors, see regdelta_bench.c for the numbers
+
+// the bytes of the bitmap of n registers
+#define REGDELTA_MAP_BYTES(n) (((n) + 7) / 8)
+
+// compare the n registers of cur against ref. set the bitmap in map, which
+// must hold REGDELTA_MAP_BYTES(n) bytes, copy the changed registers into
+// words, which must hold n. return the number of registers changed
+int regdelta_diff(uint8_t* map, uint16_t* words, const uint16_t* ref, const uint16_t* cur, int n);
+
+// the other way, on the receiving side: write the changed words into the n
+// registers of image as the bitmap tells. return the number of words taken,
+// -1 if the bitmap needs more than count
+int regdelta_apply(uint16_t* image, int n, const uint8_t* map, const uint16_t* words, int count);
+
+#endif
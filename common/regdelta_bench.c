@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark of the register delta against comparing the registers one by one:
+// the delta of a sample where a few registers changed is computed many times,
+// and applied back onto the reference to check that it gives the sample.
+//
+// usage: ./regdelta_bench [registers] [changed] [rounds]
+
+#include "regdelta.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double elapsed_ms(struct timespec* start, struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static int ref_diff(uint8_t* map, uint16_t* words, const uint16_t* ref, const uint16_t* cur, int n)
+{
+    int count = 0;
+    int i = 0;
+    memset(map, 0, REGDELTA_MAP_BYTES(n));
+    for (i = 0; i < n; i++)
+    {
+        if (ref[i] != cur[i])
+        {
+            map[i / 8] |= (uint8_t)(1 << (i % 8));
+            words[count++] = cur[i];
+        }
+    }
+    return count;
+}
+
+int main(int argc, char* argv[])
+{
+    int num = argc > 1 ? atoi(argv[1]) : 125;
+    int changed = argc > 2 ? atoi(argv[2]) : 3;
+    int rounds = argc > 3 ? atoi(argv[3]) : 1000000;
+    if (num <= 0 || changed < 0 || changed > num || rounds <= 0)
+    {
+        printf("usage: %s [registers] [changed] [rounds]\n", argv[0]);
+        return 1;
+    }
+    uint16_t* ref = (uint16_t*) malloc(num * sizeof(uint16_t));
+    uint16_t* cur = (uint16_t*) malloc(num * sizeof(uint16_t));
+    uint16_t* image = (uint16_t*) malloc(num * sizeof(uint16_t));
+    uint16_t* words = (uint16_t*) malloc(num * sizeof(uint16_t));
+    uint16_t* refWords = (uint16_t*) malloc(num * sizeof(uint16_t));
+    uint8_t* map = (uint8_t*) malloc(REGDELTA_MAP_BYTES(num));
+    uint8_t* refMap = (uint8_t*) malloc(REGDELTA_MAP_BYTES(num));
+    if (ref == NULL || cur == NULL || image == NULL || words == NULL || refWords == NULL
+        || map == NULL || refMap == NULL)
+    {
+        printf("out of memory\n");
+        return 1;
+    }
+    srand(20170601);
+    int i = 0;
+    for (i = 0; i < num; i++)
+    {
+        ref[i] = (uint16_t)rand();
+    }
+
+    // every length up to num, with a few registers changed anywhere
+    int errors = 0;
+    int n = 0;
+    for (n = 1; n <= num; n++)
+    {
+        memcpy(cur, ref, n * sizeof(uint16_t));
+        for (i = 0; i < 3; i++)
+        {
+            cur[rand() % n] ^= (uint16_t)(1 + rand() % 0xffff);
+        }
+        int count = regdelta_diff(map, words, ref, cur, n);
+        int refCount = ref_diff(refMap, refWords, ref, cur, n);
+        memcpy(image, ref, n * sizeof(uint16_t));
+        if (count != refCount || memcmp(map, refMap, REGDELTA_MAP_BYTES(n)) != 0
+            || memcmp(words, refWords, count * sizeof(uint16_t)) != 0
+            || regdelta_apply(image, n, map, words, count) != count
+            || memcmp(image, cur, n * sizeof(uint16_t)) != 0)
+        {
+            printf("ERROR: the delta of %d registers differs\n", n);
+            errors++;
+        }
+    }
+
+    memcpy(cur, ref, num * sizeof(uint16_t));
+    for (i = 0; i < changed; i++)
+    {
+        cur[i * num / changed] ^= 1;
+    }
+    struct timespec start;
+    struct timespec end;
+    long long sum = 0;
+    int r = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++)
+    {
+        sum += ref_diff(refMap, refWords, ref, cur, num) + refMap[r % REGDELTA_MAP_BYTES(num)];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double by_reg = elapsed_ms(&start, &end);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++)
+    {
+        sum += regdelta_diff(map, words, ref, cur, num) + map[r % REGDELTA_MAP_BYTES(num)];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double by_word = elapsed_ms(&start, &end);
+    double per = 1000000.0 / rounds;
+    printf("delta of %d registers, %d changed, x %d: one by one %.3f ms (%.2f ns/sample), "
+        "by blocks %.3f ms (%.2f ns/sample), checksum %lld\n", num, changed, rounds,
+        by_reg, by_reg * per, by_word, by_word * per, sum);
+    printf("full sample %d bytes, delta %d bytes\n", 2 * num,
+        REGDELTA_MAP_BYTES(num) + 2 * changed);
+
+    free(ref);
+    free(cur);
+    free(image);
+    free(words);
+    free(refWords);
+    free(map);
+    free(refMap);
+    if (errors > 0)
+    {
+        printf("%d errors\n", errors);
+        return 1;
+    }
+    return 0;
+}
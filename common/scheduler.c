@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scheduler.h"
+
+#include <stdlib.h>
+
+enum
+{
+    SCHED_DEFAULT_CAPACITY = 64
+};
+
+int sched_init(Scheduler* sched, int capacity)
+{
+    if (capacity <= 0)
+    {
+        capacity = SCHED_DEFAULT_CAPACITY;
+    }
+    sched->size = 0;
+    sched->entries = (SchedEntry*) malloc(capacity * sizeof(SchedEntry));
+    if (sched->entries == NULL)
+    {
+        sched->capacity = 0;
+        return -1;
+    }
+    sched->capacity = capacity;
+    return 0;
+}
+
+void sched_destroy(Scheduler* sched)
+{
+    if (sched->entries != NULL)
+    {
+        free(sched->entries);
+        sched->entries = NULL;
+    }
+    sched->size = 0;
+    sched->capacity = 0;
+}
+
+void sched_clear(Scheduler* sched)
+{
+    sched->size = 0;
+}
+
+int sched_size(const Scheduler* sched)
+{
+    return sched->size;
+}
+
+static void sift_up(SchedEntry* entries, int pos)
+{
+    SchedEntry entry = entries[pos];
+    while (pos > 0)
+    {
+        int parent = (pos - 1) >> 1;
+        if (entries[parent].deadline <= entry.deadline)
+        {
+            break;
+        }
+        entries[pos] = entries[parent];
+        pos = parent;
+    }
+    entries[pos] = entry;
+}
+
+static void sift_down(SchedEntry* entries, int size, int pos)
+{
+    SchedEntry entry = entries[pos];
+    int child = (pos << 1) + 1;
+    while (child < size)
+    {
+        if (child + 1 < size && entries[child + 1].deadline < entries[child].deadline)
+        {
+            child++;
+        }
+        if (entry.deadline <= entries[child].deadline)
+        {
+            break;
+        }
+        entries[pos] = entries[child];
+        pos = child;
+        child = (pos << 1) + 1;
+    }
+    entries[pos] = entry;
+}
+
+int sched_push(Scheduler* sched, long long deadline, void* data)
+{
+    if (sched->size >= sched->capacity)
+    {
+        int capacity = sched->capacity > 0 ? sched->capacity * 2 : SCHED_DEFAULT_CAPACITY;
+        SchedEntry* entries = (SchedEntry*) realloc(sched->entries, capacity * sizeof(SchedEntry));
+        if (entries == NULL)
+        {
+            return -1;
+        }
+        sched->entries = entries;
+        sched->capacity = capacity;
+    }
+
+    sched->entries[sched->size].deadline = deadline;
+    sched->entries[sched->size].data = data;
+    sift_up(sched->entries, sched->size);
+    sched->size++;
+    return 0;
+}
+
+void* sched_peek(const Scheduler* sched, long long* deadline)
+{
+    if (sched->size <= 0)
+    {
+        return NULL;
+    }
+    if (deadline != NULL)
+    {
+        *deadline = sched->entries[0].deadline;
+    }
+    return sched->entries[0].data;
+}
+
+void* sched_pop(Scheduler* sched)
+{
+    if (sched->size <= 0)
+    {
+        return NULL;
+    }
+    void* data = sched->entries[0].data;
+    sched->size--;
+    if (sched->size > 0)
+    {
+        sched->entries[0] = sched->entries[sched->size];
+        sift_down(sched->entries, sched->size, 0);
+    }
+    return data;
+}
+
+int sched_remove(Scheduler* sched, void* data)
+{
+    // compact the entries that are kept, then rebuild the heap in O(n)
+    int kept = 0;
+    int i = 0;
+    for (i = 0; i < sched->size; i++)
+    {
+        if (sched->entries[i].data != data)
+        {
+            sched->entries[kept++] = sched->entries[i];
+        }
+    }
+    int removed = sched->size - kept;
+    sched->size = kept;
+    if (removed > 0)
+    {
+        for (i = (kept >> 1) - 1; i >= 0; i--)
+        {
+            sift_down(sched->entries, kept, i);
+        }
+    }
+    return removed;
+}
+
+long long sched_phase(long long now, int interval, unsigned int group, int k, int n)
+{
+    if (interval <= 0 || n <= 0)
+    {
+        return now;
+    }
+    // a multiplicative hash, so that the offsets of close groups are far apart
+    long long base = (long long)((group * 2654435761u) % (unsigned int)interval);
+    long long phase = (base + (long long)k * interval / n) % interval;
+    long long at = now % interval;
+    if (at < 0)
+    {
+        at += interval;
+    }
+    return now + (phase - at + interval) % interval;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_SCHEDULER_H
+#define INF_BCE_IOT_EDGE_SDK_SCHEDULER_H
+
+// a binary min-heap of deadlines, shared by the modbus and the bacnet gateways.
+// push and pop are O(log n), peeking the next due entry is O(1).
+// the scheduler is not thread safe, callers must hold their own lock.
+
+typedef struct
+{
+    long long deadline;    // when the entry is due, the unit is up to the caller
+    void* data;            // the scheduled object, e.g. a polling policy
+} SchedEntry;
+
+typedef struct
+{
+    SchedEntry* entries;
+    int size;
+    int capacity;
+} Scheduler;
+
+// return 0 on success, -1 if out of memory
+int sched_init(Scheduler* sched, int capacity);
+
+void sched_destroy(Scheduler* sched);
+
+// remove all the entries, the scheduled data is not touched
+void sched_clear(Scheduler* sched);
+
+int sched_size(const Scheduler* sched);
+
+// return 0 on success, -1 if out of memory
+int sched_push(Scheduler* sched, long long deadline, void* data);
+
+// return the data with the earliest deadline without removing it, NULL if empty.
+// the deadline is stored into *deadline if it's not NULL
+void* sched_peek(const Scheduler* sched, long long* deadline);
+
+// remove and return the data with the earliest deadline, NULL if empty
+void* sched_pop(Scheduler* sched);
+
+// remove every entry of data, return the number of entries removed
+int sched_remove(Scheduler* sched, void* data);
+
+// the first deadline, not before now, of the k-th of n entries repeating every
+// interval. the n entries are spread evenly over the interval, from an offset
+// hashed from group, so that the entries of other groups (other intervals, other
+// buses) don't line up with them either. the phase is taken from the clock and
+// not from now, so it's the same whenever the entries are loaded.
+// k is 0 to n - 1, interval and now are in the same unit
+long long sched_phase(long long now, int interval, unsigned int group, int k, int n);
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark of the policy scheduler: schedule a large number of synthetic
+// policies with random intervals, then keep executing the due ones and
+// rescheduling them, like the gateway workers do.
+//
+// usage: ./scheduler_bench [policy_num] [executions]
+
+#include "scheduler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct
+{
+    int id;
+    int interval;
+    long long nextRun;
+} SyntheticPolicy;
+
+static double elapsed_ms(struct timespec* start, struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+int main(int argc, char* argv[])
+{
+    int num = argc > 1 ? atoi(argv[1]) : 100000;
+    int executions = argc > 2 ? atoi(argv[2]) : 1000000;
+    if (num <= 0 || executions <= 0)
+    {
+        printf("usage: %s [policy_num] [executions]\n", argv[0]);
+        return 1;
+    }
+
+    SyntheticPolicy* policies = (SyntheticPolicy*) malloc(num * sizeof(SyntheticPolicy));
+    if (policies == NULL)
+    {
+        printf("out of memory\n");
+        return 1;
+    }
+    Scheduler sched;
+    sched_init(&sched, 0);
+    srand(20170601);
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int i = 0;
+    for (i = 0; i < num; i++)
+    {
+        policies[i].id = i;
+        policies[i].interval = 1 + rand() % 60;
+        policies[i].nextRun = rand() % 60;
+        sched_push(&sched, policies[i].nextRun, &policies[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("scheduled %d policies in %.3f ms\n", num, elapsed_ms(&start, &end));
+
+    // execute the due policies in order, and reschedule them
+    long long last = -1;
+    int out_of_order = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < executions; i++)
+    {
+        long long deadline = 0;
+        SyntheticPolicy* policy = (SyntheticPolicy*) sched_peek(&sched, &deadline);
+        sched_pop(&sched);
+        if (deadline < last)
+        {
+            out_of_order++;
+        }
+        last = deadline;
+        policy->nextRun = deadline + policy->interval;
+        sched_push(&sched, policy->nextRun, policy);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = elapsed_ms(&start, &end);
+    printf("executed and rescheduled %d policies in %.3f ms, %.1f ns per reschedule\n",
+            executions, ms, ms * 1000000.0 / executions);
+    if (out_of_order > 0)
+    {
+        printf("ERROR: %d policies executed out of order\n", out_of_order);
+    }
+
+    // the peak of the polls due in one tick(ms) when all the policies are
+    // loaded at once, every one counted in the first interval after its start.
+    // without the phases they all start one interval after the load
+    int errors = out_of_order;
+    int interval = 1000;
+    int* due = (int*) calloc(2 * interval, sizeof(int));
+    int peak = 0;
+    long long now = 123456789;
+    for (i = 0; due != NULL && i < num; i++)
+    {
+        long long first = sched_phase(now, interval, (unsigned int)interval, i, num);
+        if (first < now || first >= now + interval)
+        {
+            errors++;
+        }
+        else if (++due[first - now] > peak)
+        {
+            peak = due[first - now];
+        }
+    }
+    // the phase of a group doesn't depend on when it's loaded
+    if (sched_phase(now, interval, 7, 3, 10) % interval != sched_phase(now + 4321, interval, 7, 3, 10) % interval)
+    {
+        errors++;
+    }
+    printf("%d policies of the same interval loaded at once: %d due in the busiest tick, "
+            "%d without the phases, %d on average\n", num, peak, num, (num + interval - 1) / interval);
+    if (errors > out_of_order)
+    {
+        printf("ERROR: %d phases out of the interval\n", errors - out_of_order);
+    }
+    free(due);
+
+    sched_destroy(&sched);
+    free(policies);
+    return errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shadow_mirror.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <device_management.h>
+
+// a property of the shadow and the point it mirrors
+typedef struct
+{
+    char* point;
+    char* name;
+    double value;                   // the last polled
+    double reported;                // the last put in an update
+    int polled;
+    int isReported;
+} MirrorProperty;
+
+struct ShadowMirror
+{
+    DeviceManagementClient client;
+    MirrorProperty* props;          // sorted by the point
+    int propNum;
+    int intervalMs;
+    double deadband;
+    // the property of every point laid out, -1 if it's not mirrored
+    int* points;
+    int pointNum;
+    // being laid out
+    int* next;
+    int nextNum;
+    int nextCap;
+    // every property goes in the next update, the last one failed
+    int resend;
+    int stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static int compare_props(const void* a, const void* b)
+{
+    return strcmp(((const MirrorProperty*) a)->point, ((const MirrorProperty*) b)->point);
+}
+
+static int find_prop(ShadowMirror* m, const char* name)
+{
+    MirrorProperty key;
+    key.point = (char*) name;
+    MirrorProperty* found = (MirrorProperty*) bsearch(&key, m->props, m->propNum,
+        sizeof(MirrorProperty), compare_props);
+    return found != NULL ? (int) (found - m->props) : -1;
+}
+
+static const char* conf_string(const cJSON* conf, const char* key)
+{
+    cJSON* item = cJSON_GetObjectItem(conf, key);
+    return cJSON_IsString(item) ? item->valuestring : NULL;
+}
+
+// an update failed, the shadow may lack any of the properties
+static void on_update_ack(ShadowAction action, ShadowAckStatus status, ShadowActionAck* ack,
+    void* context)
+{
+    ShadowMirror* m = (ShadowMirror*) context;
+    if (status == SHADOW_ACK_ACCEPTED)
+    {
+        return;
+    }
+    printf("the shadow update is %s, every property is reported again\n",
+        status == SHADOW_ACK_REJECTED ? "rejected" : "timed out");
+    pthread_mutex_lock(&m->lock);
+    m->resend = 1;
+    pthread_mutex_unlock(&m->lock);
+}
+
+// one update of the properties that moved by more than the deadband
+static void report_changes(ShadowMirror* m)
+{
+    cJSON* reported = cJSON_CreateObject();
+    int count = 0;
+    int i = 0;
+    pthread_mutex_lock(&m->lock);
+    int resend = m->resend;
+    m->resend = 0;
+    for (i = 0; i < m->propNum; i++)
+    {
+        MirrorProperty* p = &m->props[i];
+        if (!p->polled)
+        {
+            continue;
+        }
+        if (resend || !p->isReported || fabs(p->value - p->reported) > m->deadband)
+        {
+            cJSON_AddNumberToObject(reported, p->name, p->value);
+            p->reported = p->value;
+            p->isReported = 1;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    // the ack may be told before it returns, the lock is not held
+    if (count > 0 && device_management_shadow_update(m->client, on_update_ack, m,
+        SHADOW_MIRROR_TIMEOUT_S, reported, NULL) != SUCCESS)
+    {
+        pthread_mutex_lock(&m->lock);
+        m->resend = 1;
+        pthread_mutex_unlock(&m->lock);
+    }
+    cJSON_Delete(reported);
+}
+
+static void* mirror_func(void* arg)
+{
+    ShadowMirror* m = (ShadowMirror*) arg;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    pthread_mutex_lock(&m->lock);
+    while (!m->stop)
+    {
+        // against absolute deadlines, the updates don't drift
+        deadline.tv_sec += m->intervalMs / 1000;
+        deadline.tv_nsec += (long) (m->intervalMs % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (!m->stop && pthread_cond_timedwait(&m->cond, &m->lock, &deadline) == 0)
+        {
+        }
+        pthread_mutex_unlock(&m->lock);
+        report_changes(m);
+        pthread_mutex_lock(&m->lock);
+    }
+    pthread_mutex_unlock(&m->lock);
+    return NULL;
+}
+
+static void free_mirror(ShadowMirror* m)
+{
+    int i = 0;
+    for (i = 0; i < m->propNum; i++)
+    {
+        free(m->props[i].point);
+        free(m->props[i].name);
+    }
+    free(m->props);
+    free(m->points);
+    free(m->next);
+    free(m);
+}
+
+ShadowMirror* shadow_mirror_start(const cJSON* conf)
+{
+    const char* endpoint = conf_string(conf, "endpoint");
+    const char* user = conf_string(conf, "user");
+    const char* password = conf_string(conf, "password");
+    const char* deviceName = conf_string(conf, "deviceName");
+    cJSON* points = cJSON_GetObjectItem(conf, "points");
+    if (endpoint == NULL || user == NULL || password == NULL || deviceName == NULL
+        || !cJSON_IsObject(points) || points->child == NULL)
+    {
+        printf("the shadow needs the endpoint, user, password, deviceName and points\n");
+        return NULL;
+    }
+    ShadowMirror* m = (ShadowMirror*) calloc(1, sizeof(ShadowMirror));
+    int num = cJSON_GetArraySize(points);
+    if (m == NULL || (m->props = (MirrorProperty*) calloc(num, sizeof(MirrorProperty))) == NULL)
+    {
+        printf("out of memory for the shadow mirror\n");
+        free(m);
+        return NULL;
+    }
+    cJSON* item = NULL;
+    for (item = points->child; item != NULL; item = item->next)
+    {
+        if (!cJSON_IsString(item))
+        {
+            printf("the property of the point %s is not a string, it's not mirrored\n", item->string);
+            continue;
+        }
+        m->props[m->propNum].point = strdup(item->string);
+        m->props[m->propNum].name = strdup(item->valuestring);
+        m->propNum++;
+    }
+    qsort(m->props, m->propNum, sizeof(MirrorProperty), compare_props);
+    m->intervalMs = SHADOW_MIRROR_INTERVAL_MS;
+    if (cJSON_IsNumber(cJSON_GetObjectItem(conf, "intervalMs")))
+    {
+        m->intervalMs = cJSON_GetObjectItem(conf, "intervalMs")->valueint;
+    }
+    if (m->intervalMs < SHADOW_MIRROR_MIN_INTERVAL_MS)
+    {
+        m->intervalMs = SHADOW_MIRROR_MIN_INTERVAL_MS;
+    }
+    if (cJSON_IsNumber(cJSON_GetObjectItem(conf, "deadband")))
+    {
+        m->deadband = cJSON_GetObjectItem(conf, "deadband")->valuedouble;
+    }
+
+    device_management_init();
+    if (device_management_create(&m->client, endpoint, deviceName, user, password, NULL,
+        conf_string(conf, "trustStore")) != SUCCESS)
+    {
+        printf("failed to create the shadow client of %s\n", deviceName);
+        device_management_fini();
+        free_mirror(m);
+        return NULL;
+    }
+    // what's reported while offline is merged into one update, a property at most once
+    device_management_shadow_set_offline_queue(m->client, m->propNum);
+    device_management_connect_async(m->client, NULL, NULL);
+
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&m->thread, NULL, mirror_func, m) != 0)
+    {
+        printf("failed to start the shadow mirror\n");
+        device_management_destroy(m->client);
+        device_management_fini();
+        pthread_cond_destroy(&m->cond);
+        pthread_mutex_destroy(&m->lock);
+        free_mirror(m);
+        return NULL;
+    }
+    printf("mirroring %d points into the shadow of %s every %dms\n", m->propNum, deviceName,
+        m->intervalMs);
+    return m;
+}
+
+void shadow_mirror_stop(ShadowMirror* m)
+{
+    if (m == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&m->lock);
+    m->stop = 1;
+    pthread_cond_signal(&m->cond);
+    pthread_mutex_unlock(&m->lock);
+    pthread_join(m->thread, NULL);
+    device_management_destroy(m->client);
+    device_management_fini();
+    pthread_cond_destroy(&m->cond);
+    pthread_mutex_destroy(&m->lock);
+    free_mirror(m);
+}
+
+void shadow_mirror_begin_layout(ShadowMirror* m)
+{
+    if (m != NULL)
+    {
+        m->nextNum = 0;
+    }
+}
+
+int shadow_mirror_has(ShadowMirror* m, const char* name)
+{
+    return m != NULL && find_prop(m, name) >= 0;
+}
+
+int shadow_mirror_add(ShadowMirror* m, const char* name)
+{
+    if (m == NULL)
+    {
+        return -1;
+    }
+    if (m->nextNum == m->nextCap)
+    {
+        int cap = m->nextCap > 0 ? m->nextCap * 2 : 64;
+        int* next = (int*) realloc(m->next, cap * sizeof(int));
+        if (next == NULL)
+        {
+            return -1;
+        }
+        m->next = next;
+        m->nextCap = cap;
+    }
+    m->next[m->nextNum] = find_prop(m, name);
+    return m->nextNum++;
+}
+
+void shadow_mirror_end_layout(ShadowMirror* m)
+{
+    if (m == NULL)
+    {
+        return;
+    }
+    int* points = m->nextNum > 0 ? (int*) malloc(m->nextNum * sizeof(int)) : NULL;
+    if (points != NULL)
+    {
+        memcpy(points, m->next, m->nextNum * sizeof(int));
+    }
+    pthread_mutex_lock(&m->lock);
+    free(m->points);
+    m->points = points;
+    m->pointNum = points != NULL ? m->nextNum : 0;
+    pthread_mutex_unlock(&m->lock);
+}
+
+void shadow_mirror_write(ShadowMirror* m, int point, double value)
+{
+    if (m == NULL || point < 0 || !isfinite(value))
+    {
+        return;
+    }
+    pthread_mutex_lock(&m->lock);
+    if (point < m->pointNum && m->points[point] >= 0)
+    {
+        MirrorProperty* p = &m->props[m->points[point]];
+        p->value = value;
+        p->polled = 1;
+    }
+    pthread_mutex_unlock(&m->lock);
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_SHADOW_MIRROR_H
+#define INF_BCE_IOT_EDGE_SDK_SHADOW_MIRROR_H
+
+#include <stdio.h>
+#include <cjson/cJSON.h>
+
+// the selected points of a gateway mirrored into the reported properties of a
+// device shadow through the device-management library, so that the cloud
+// apps read the current state of a point instead of rebuilding it from the
+// telemetry. the points are named as in the shared memory table, see
+// shm_points.h, and each one selected names the property it's reported as.
+// a polled value is only kept; every intervalMs the properties that moved by
+// more than the deadband since they were last reported go in one update,
+// whatever the polling rate. while the shadow is offline the updates are
+// merged property by property, see device_management_shadow_set_offline_queue,
+// and after a rejected or timed out update every property is reported again.
+// it's enabled by the gateway config, and only built with SHADOW=yes, e.g.
+//     "shadow": {"endpoint": "ssl://host:1884", "user": "...", "password": "...",
+//         "deviceName": "gateway1", "trustStore": "./root_cert.pem",
+//         "intervalMs": 1000, "deadband": 0.01,
+//         "points": {"192.168.1.10:502/1/temperature": "temperature"}}
+
+enum {
+    SHADOW_MIRROR_INTERVAL_MS = 1000,
+    SHADOW_MIRROR_MIN_INTERVAL_MS = 100,
+    SHADOW_MIRROR_TIMEOUT_S = 10
+};
+
+typedef struct ShadowMirror ShadowMirror;
+
+#ifdef SHADOW_MIRROR
+
+// connect to the shadow and report in a thread of its own. return NULL if the
+// config is bad, the connection is retried until it succeeds
+ShadowMirror* shadow_mirror_start(const cJSON* conf);
+
+// report what changed since the last update and disconnect
+void shadow_mirror_stop(ShadowMirror* m);
+
+// lay the points out again, e.g. as the policies are reloaded. they are added
+// one after the other, the properties keep their values
+void shadow_mirror_begin_layout(ShadowMirror* m);
+
+// 1 if the point named name is mirrored
+int shadow_mirror_has(ShadowMirror* m, const char* name);
+
+// the next point, mirrored or not. return its index, -1 if out of memory
+int shadow_mirror_add(ShadowMirror* m, const char* name);
+
+void shadow_mirror_end_layout(ShadowMirror* m);
+
+// the value just polled of a point, of any thread
+void shadow_mirror_write(ShadowMirror* m, int point, double value);
+
+#else
+
+static inline ShadowMirror* shadow_mirror_start(const cJSON* conf)
+{
+    printf("the gateway is built without the shadow mirror, rebuild with SHADOW=yes\n");
+    return NULL;
+}
+
+static inline void shadow_mirror_stop(ShadowMirror* m)
+{
+}
+
+static inline void shadow_mirror_begin_layout(ShadowMirror* m)
+{
+}
+
+static inline int shadow_mirror_has(ShadowMirror* m, const char* name)
+{
+    return 0;
+}
+
+static inline int shadow_mirror_add(ShadowMirror* m, const char* name)
+{
+    return -1;
+}
+
+static inline void shadow_mirror_end_layout(ShadowMirror* m)
+{
+}
+
+static inline void shadow_mirror_write(ShadowMirror* m, int point, double value)
+{
+}
+
+#endif
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "shm_points.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static size_t table_size(uint32_t capacity)
+{
+    return sizeof(ShmpHeader) + (size_t)capacity * sizeof(ShmpPoint);
+}
+
+static void map_table(ShmPoints* t, void* base, size_t size)
+{
+    t->header = (ShmpHeader*) base;
+    t->points = (ShmpPoint*) ((char*) base + sizeof(ShmpHeader));
+    t->size = size;
+}
+
+int shmp_create(ShmPoints* t, const char* name, int capacity)
+{
+    memset(t, 0, sizeof(ShmPoints));
+    if (capacity <= 0 || strlen(name) >= SHMP_NAME_LEN)
+    {
+        return -1;
+    }
+    // a new table, the readers of an old one keep their mapping of it
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    size_t size = table_size((uint32_t) capacity);
+    void* base = MAP_FAILED;
+    if (ftruncate(fd, (off_t) size) == 0)
+    {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return -1;
+    }
+    map_table(t, base, size);
+    t->writer = 1;
+    strcpy(t->name, name);
+    t->header->version = SHMP_VERSION;
+    t->header->capacity = (uint32_t) capacity;
+    t->header->count = 0;
+    t->header->layout = 0;
+    // the readers check the magic first
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(t->header->magic, "BDPT", 4);
+    return 0;
+}
+
+void shmp_begin_layout(ShmPoints* t)
+{
+    __atomic_store_n(&t->header->layout, t->header->layout + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    t->header->count = 0;
+}
+
+int shmp_add(ShmPoints* t, const char* name)
+{
+    uint32_t index = t->header->count;
+    if (index >= t->header->capacity)
+    {
+        return -1;
+    }
+    ShmpPoint* p = &t->points[index];
+    if (strncmp(p->name, name, SHMP_NAME_LEN - 1) != 0)
+    {
+        snprintf(p->name, SHMP_NAME_LEN, "%s", name);
+        __atomic_store_n(&p->value, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&p->updatedMs, 0, __ATOMIC_RELAXED);
+    }
+    t->header->count = index + 1;
+    return (int) index;
+}
+
+void shmp_end_layout(ShmPoints* t)
+{
+    __atomic_store_n(&t->header->layout, t->header->layout + 1, __ATOMIC_RELEASE);
+}
+
+void shmp_write(ShmPoints* t, int index, double value, long long updated_ms)
+{
+    ShmpPoint* p = &t->points[index];
+    uint64_t bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t seq = p->seq;
+    __atomic_store_n(&p->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&p->value, bits, __ATOMIC_RELAXED);
+    __atomic_store_n(&p->updatedMs, (int64_t) updated_ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&p->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void shmp_destroy(ShmPoints* t)
+{
+    if (t->header == NULL)
+    {
+        return;
+    }
+    munmap(t->header, t->size);
+    if (t->writer)
+    {
+        shm_unlink(t->name);
+    }
+    memset(t, 0, sizeof(ShmPoints));
+}
+
+int shmp_open(ShmPoints* t, const char* name)
+{
+    memset(t, 0, sizeof(ShmPoints));
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct stat st;
+    void* base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(ShmpHeader))
+    {
+        base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        return -1;
+    }
+    map_table(t, base, (size_t) st.st_size);
+    int valid = memcmp(t->header->magic, "BDPT", 4) == 0;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (!valid || t->header->version != SHMP_VERSION || table_size(t->header->capacity) > t->size)
+    {
+        shmp_close(t);
+        return -1;
+    }
+    return 0;
+}
+
+int shmp_find(ShmPoints* t, const char* name)
+{
+    while (1)
+    {
+        uint32_t layout = __atomic_load_n(&t->header->layout, __ATOMIC_ACQUIRE);
+        if (layout & 1)
+        {
+            // the names are being laid out, which takes a few microseconds
+            sched_yield();
+            continue;
+        }
+        int found = -1;
+        uint32_t count = t->header->count;
+        uint32_t i = 0;
+        for (i = 0; i < count && i < t->header->capacity && found < 0; i++)
+        {
+            if (strncmp(t->points[i].name, name, SHMP_NAME_LEN) == 0)
+            {
+                found = (int) i;
+            }
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&t->header->layout, __ATOMIC_RELAXED) == layout)
+        {
+            t->layout = layout;
+            return found;
+        }
+    }
+}
+
+int shmp_read(ShmPoints* t, int index, double* value, long long* updated_ms)
+{
+    if (index < 0 || (uint32_t) index >= t->header->capacity)
+    {
+        return -1;
+    }
+    ShmpPoint* p = &t->points[index];
+    uint64_t bits = 0;
+    int64_t ms = 0;
+    while (1)
+    {
+        uint32_t seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            continue;
+        }
+        bits = __atomic_load_n(&p->value, __ATOMIC_RELAXED);
+        ms = __atomic_load_n(&p->updatedMs, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&p->seq, __ATOMIC_RELAXED) == seq)
+        {
+            break;
+        }
+    }
+    if (__atomic_load_n(&t->header->layout, __ATOMIC_RELAXED) != t->layout)
+    {
+        return -1;
+    }
+    memcpy(value, &bits, sizeof(bits));
+    *updated_ms = ms;
+    return ms == 0 ? 1 : 0;
+}
+
+void shmp_close(ShmPoints* t)
+{
+    if (t->header != NULL)
+    {
+        munmap(t->header, t->size);
+    }
+    memset(t, 0, sizeof(ShmPoints));
+}
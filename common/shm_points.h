@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef INF_BCE_IOT_EDGE_SDK_SHM_POINTS_H
+#define INF_BCE_IOT_EDGE_SDK_SHM_POINTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the latest value of every point of a gateway, in a POSIX shared memory
+// table, so that the local processes read them without a socket or a parse.
+// the gateway writes, any number of processes read:
+//     ShmPoints t;
+//     shmp_open(&t, "/bdModbusGateway");
+//     int i = shmp_find(&t, "192.168.1.10:502/1/temperature");
+//     double value; long long at;
+//     if (shmp_read(&t, i, &value, &at) < 0) ... find it again
+// every point is guarded by a seqlock, a read never waits for the writer and
+// never sees half a write. the names are laid out again when the gateway
+// reloads its policies, the readers then find the points again. the points
+// kept at the same place keep their values. see shm_points_bench.c
+
+enum {
+    SHMP_NAME_LEN = 104,
+    SHMP_VERSION = 1
+};
+
+// the layout shared with the readers, the fields change only with SHMP_VERSION
+typedef struct
+{
+    char magic[4];                  // "BDPT"
+    uint32_t version;
+    uint32_t capacity;              // the points the table has room for
+    uint32_t layout;                // seqlock of the names, odd while they're laid out
+    uint32_t count;                 // the points laid out
+    uint32_t reserved[3];
+} ShmpHeader;
+
+typedef struct
+{
+    uint32_t seq;                   // seqlock of the value, odd while it's written
+    uint32_t reserved;
+    uint64_t value;                 // the bits of a double
+    int64_t updatedMs;              // realtime(ms) of the value, 0 until it's written
+    char name[SHMP_NAME_LEN];
+} ShmpPoint;                        // two cache lines
+
+typedef struct
+{
+    ShmpHeader* header;
+    ShmpPoint* points;
+    size_t size;
+    uint32_t layout;                // of the reader, the layout the points are found in
+    int writer;
+    char name[SHMP_NAME_LEN];       // of the writer, unlinked by shmp_destroy
+} ShmPoints;
+
+// the writer side, a point is written by one thread at a time
+
+// create the table name, e.g. "/bdModbusGateway", with room for capacity
+// points. a table left by a crash is replaced. return 0 on success
+int shmp_create(ShmPoints* t, const char* name, int capacity);
+
+// lay out the names again, shmp_add every point between the two
+void shmp_begin_layout(ShmPoints* t);
+
+// return the index of the new point, -1 if the table is full
+int shmp_add(ShmPoints* t, const char* name);
+
+void shmp_end_layout(ShmPoints* t);
+
+void shmp_write(ShmPoints* t, int index, double value, long long updated_ms);
+
+// unmap and remove the table
+void shmp_destroy(ShmPoints* t);
+
+// the reader side
+
+// map the table read only. return 0 on success
+int shmp_open(ShmPoints* t, const char* name);
+
+// the index of the point, -1 if there's none
+int shmp_find(ShmPoints* t, const char* name);
+
+// the value of the point found. return 0 on success, 1 if it's not written
+// yet, -1 if the points are laid out again since they were found
+int shmp_read(ShmPoints* t, int index, double* value, long long* updated_ms);
+
+void shmp_close(ShmPoints* t);
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// benchmark of the shared memory point table: the readers read the points
+// round and round while a writer thread updates them as fast as it can, so
+// that the seqlocks are contended far more than by any gateway. every value
+// is written with its own number as the time, a torn read would show them
+// apart.
+//
+// usage: ./shm_points_bench [readers] [points] [readsPerReader]
+
+#include "shm_points.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char* const TABLE = "/shm_points_bench";
+static int g_points = 0;
+static int g_reads = 0;
+static volatile int g_stop = 0;
+static long long g_read_ns = 0;     // of all the readers, the finds left out
+static ShmPoints g_writer;
+
+static double elapsed_ms(struct timespec* start, struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static void* writer_func(void* arg)
+{
+    long long n = 1;
+    while (!g_stop)
+    {
+        shmp_write(&g_writer, (int)(n % g_points), (double) n, n);
+        n++;
+    }
+    return NULL;
+}
+
+// return the torn reads
+static void* reader_func(void* arg)
+{
+    ShmPoints t;
+    size_t torn = 0;
+    if (shmp_open(&t, TABLE) != 0)
+    {
+        return (void*)(size_t)g_reads;
+    }
+    int* indexes = (int*) malloc(g_points * sizeof(int));
+    char name[SHMP_NAME_LEN];
+    int i = 0;
+    for (i = 0; i < g_points; i++)
+    {
+        snprintf(name, sizeof(name), "bench/%d", i);
+        indexes[i] = shmp_find(&t, name);
+    }
+    struct timespec t0;
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < g_reads; i++)
+    {
+        double value = 0;
+        long long at = 0;
+        if (shmp_read(&t, indexes[i % g_points], &value, &at) == 0 && value != (double) at)
+        {
+            torn++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    __atomic_fetch_add(&g_read_ns, (long long)(elapsed_ms(&t0, &t1) * 1000000), __ATOMIC_RELAXED);
+    free(indexes);
+    shmp_close(&t);
+    return (void*)torn;
+}
+
+// the readers at once, return their torn reads
+static size_t run(const char* name, int readers)
+{
+    pthread_t* ids = (pthread_t*) malloc(readers * sizeof(pthread_t));
+    int i = 0;
+    g_read_ns = 0;
+    for (i = 0; i < readers; i++)
+    {
+        pthread_create(&ids[i], NULL, reader_func, NULL);
+    }
+    size_t torn = 0;
+    for (i = 0; i < readers; i++)
+    {
+        void* rc = NULL;
+        pthread_join(ids[i], &rc);
+        torn += (size_t) rc;
+    }
+    double ns = (double) g_read_ns / readers / g_reads;
+    printf("%-10s %d readers, %d points: %6.1f ns/read, %4.0f reads/us per reader\n",
+        name, readers, g_points, ns, 1000 / ns);
+    free(ids);
+    return torn;
+}
+
+int main(int argc, char* argv[])
+{
+    int readers = argc > 1 ? atoi(argv[1]) : 4;
+    g_points = argc > 2 ? atoi(argv[2]) : 10000;
+    g_reads = argc > 3 ? atoi(argv[3]) : 10000000;
+    if (readers <= 0 || g_points <= 0 || g_reads <= 0)
+    {
+        printf("usage: %s [readers] [points] [readsPerReader]\n", argv[0]);
+        return 1;
+    }
+    if (shmp_create(&g_writer, TABLE, g_points) != 0)
+    {
+        printf("ERROR: failed to create the table %s\n", TABLE);
+        return 1;
+    }
+    char name[SHMP_NAME_LEN];
+    int i = 0;
+    shmp_begin_layout(&g_writer);
+    for (i = 0; i < g_points; i++)
+    {
+        snprintf(name, sizeof(name), "bench/%d", i);
+        shmp_add(&g_writer, name);
+    }
+    shmp_end_layout(&g_writer);
+
+    run("no writer", readers);
+    pthread_t writer;
+    pthread_create(&writer, NULL, writer_func, NULL);
+    size_t torn = run("a writer", readers);
+    g_stop = 1;
+    pthread_join(writer, NULL);
+    printf("%zu torn reads\n", torn);
+    shmp_destroy(&g_writer);
+    return torn > 0;
+}
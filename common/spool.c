@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "spool.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum
+{
+    RECORD_LIVE = 0x4c4f4f50,       // "POOL", not consumed yet
+    RECORD_DONE = 0x454e4f44,       // "DONE", consumed
+    MIN_SEGMENT_BYTES = 4096
+};
+
+// the header of a record, followed by the topic and the payload, padded to 4 bytes
+typedef struct
+{
+    uint32_t magic;
+    uint32_t crc;                   // of the rest of the header, the topic and the payload
+    uint32_t payloadLen;
+    uint16_t topicLen;
+    uint16_t retained;
+} SpoolRecord;
+
+static uint32_t g_crc_table[256];
+static pthread_once_t g_crc_once = PTHREAD_ONCE_INIT;
+
+static void init_crc_table()
+{
+    uint32_t i = 0;
+    for (i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        int k = 0;
+        for (k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        g_crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32(const char* data, int len)
+{
+    uint32_t c = 0xffffffff;
+    int i = 0;
+    for (i = 0; i < len; i++)
+    {
+        c = g_crc_table[(c ^ (uint8_t)data[i]) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffff;
+}
+
+static int record_size(int topicLen, int payloadLen)
+{
+    return (sizeof(SpoolRecord) + topicLen + payloadLen + 3) & ~3;
+}
+
+static void segment_path(Spool* s, unsigned int seg, char* path, int len)
+{
+    snprintf(path, len, "%s/%08u.seg", s->dir, seg);
+}
+
+// map the segment file, it's created if create is set
+static char* map_segment(Spool* s, unsigned int seg, int create)
+{
+    char path[512];
+    segment_path(s, seg, path, sizeof(path));
+    int fd = open(path, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (st.st_size < s->segmentBytes && ftruncate(fd, s->segmentBytes) != 0))
+    {
+        close(fd);
+        return NULL;
+    }
+    char* map = (char*) mmap(NULL, s->segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+static void unmap_segment(Spool* s, char* map)
+{
+    if (map != NULL)
+    {
+        munmap(map, s->segmentBytes);
+    }
+}
+
+// return the size of the valid record at off, 0 if there is none. 
+// done is set if it's consumed already
+static int record_at(Spool* s, char* map, int off, int* done)
+{
+    SpoolRecord rec;
+    if (off + (int) sizeof(SpoolRecord) > s->segmentBytes)
+    {
+        return 0;
+    }
+    memcpy(&rec, map + off, sizeof(SpoolRecord));
+    if (rec.magic != RECORD_LIVE && rec.magic != RECORD_DONE)
+    {
+        return 0;
+    }
+    if (rec.payloadLen > (uint32_t) s->segmentBytes)
+    {
+        return 0;
+    }
+    int size = record_size(rec.topicLen, rec.payloadLen);
+    if (off + size > s->segmentBytes)
+    {
+        return 0;
+    }
+    // the crc covers everything but the magic and the crc itself
+    int covered = sizeof(SpoolRecord) - 8 + rec.topicLen + rec.payloadLen;
+    if (crc32(map + off + 8, covered) != rec.crc)
+    {
+        return 0;
+    }
+    *done = rec.magic == RECORD_DONE;
+    return size;
+}
+
+// scan the records of a segment from off, return the offset after the last valid one
+static int scan_segment(Spool* s, char* map, int off, int* live, int* firstLive)
+{
+    int done = 0;
+    int size = 0;
+    *live = 0;
+    *firstLive = -1;
+    while ((size = record_at(s, map, off, &done)) > 0)
+    {
+        if (!done)
+        {
+            if (*firstLive < 0)
+            {
+                *firstLive = off;
+            }
+            (*live)++;
+        }
+        off += size;
+    }
+    return off;
+}
+
+// delete the head segment, and move to the next one. must be called with the lock held
+static void advance_head(Spool* s)
+{
+    char path[512];
+    unmap_segment(s, s->headMap);
+    s->headMap = NULL;
+    segment_path(s, s->headSeg, path, sizeof(path));
+    unlink(path);
+    while (s->headMap == NULL && s->headSeg < s->tailSeg)
+    {
+        s->headSeg++;
+        s->headMap = map_segment(s, s->headSeg, 0);
+    }
+    s->headOff = 0;
+}
+
+static int compare_uint(const void* a, const void* b)
+{
+    unsigned int x = *(const unsigned int*) a;
+    unsigned int y = *(const unsigned int*) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// list the segment ids in the directory in ascending order, return the count
+static int list_segments(Spool* s, unsigned int** segs)
+{
+    *segs = NULL;
+    DIR* dir = opendir(s->dir);
+    if (dir == NULL)
+    {
+        return 0;
+    }
+    int count = 0;
+    int capacity = 0;
+    struct dirent* ent = NULL;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        unsigned int seg = 0;
+        char ext[8] = {0};
+        if (sscanf(ent->d_name, "%u.%3s", &seg, ext) != 2 || strcmp(ext, "seg") != 0)
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            unsigned int* tmp = (unsigned int*) realloc(*segs, capacity * sizeof(unsigned int));
+            if (tmp == NULL)
+            {
+                break;
+            }
+            *segs = tmp;
+        }
+        (*segs)[count++] = seg;
+    }
+    closedir(dir);
+    qsort(*segs, count, sizeof(unsigned int), compare_uint);
+    return count;
+}
+
+int spool_open(Spool* s, const char* dir, long long maxBytes, int segmentBytes)
+{
+    pthread_once(&g_crc_once, init_crc_table);
+    memset(s, 0, sizeof(Spool));
+    snprintf(s->dir, sizeof(s->dir), "%s", dir);
+    if (mkdir(s->dir, 0755) != 0 && errno != EEXIST)
+    {
+        printf("failed to create the spool directory %s\n", s->dir);
+        return -1;
+    }
+    s->segmentBytes = segmentBytes < MIN_SEGMENT_BYTES ? MIN_SEGMENT_BYTES : (segmentBytes & ~3);
+    s->maxSegments = (int) (maxBytes / s->segmentBytes);
+    if (s->maxSegments < 2)
+    {
+        s->maxSegments = 2;
+    }
+
+    // the head is the first segment with records not consumed, the ones
+    // before it are deleted. the tail is the last segment
+    unsigned int* segs = NULL;
+    int count = list_segments(s, &segs);
+    int i = 0;
+    for (i = 0; i < count; i++)
+    {
+        int last = i == count - 1;
+        char* map = map_segment(s, segs[i], 0);
+        if (map == NULL)
+        {
+            continue;
+        }
+        int live = 0;
+        int firstLive = -1;
+        int end = scan_segment(s, map, 0, &live, &firstLive);
+        s->count += live;
+        if (s->headMap == NULL && (live > 0 || last))
+        {
+            s->headSeg = segs[i];
+            s->headMap = map;
+            s->headOff = live > 0 ? firstLive : end;
+        }
+        else if (s->headMap == NULL)
+        {
+            char path[512];
+            segment_path(s, segs[i], path, sizeof(path));
+            unmap_segment(s, map);
+            unlink(path);
+            continue;
+        }
+        else
+        {
+            unmap_segment(s, map);
+        }
+        if (last)
+        {
+            s->tailSeg = segs[i];
+            s->tailOff = end;
+            s->tailMap = map_segment(s, segs[i], 0);
+        }
+    }
+    free(segs);
+
+    if (s->headMap == NULL)
+    {
+        s->headSeg = 1;
+        s->tailSeg = 1;
+        s->headMap = map_segment(s, 1, 1);
+        s->tailMap = map_segment(s, 1, 1);
+    }
+    if (s->headMap == NULL || s->tailMap == NULL)
+    {
+        printf("failed to map the spool segments in %s\n", s->dir);
+        unmap_segment(s, s->headMap);
+        unmap_segment(s, s->tailMap);
+        return -1;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    if (s->count > 0)
+    {
+        printf("%lld messages recovered from the spool %s\n", s->count, s->dir);
+    }
+    return 0;
+}
+
+int spool_append(Spool* s, const char* topic, const char* payload, int len, int retained)
+{
+    int topicLen = strlen(topic);
+    int size = record_size(topicLen, len);
+    if (size > s->segmentBytes || topicLen > 0xffff)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&s->lock);
+    if (s->tailOff + size > s->segmentBytes)
+    {
+        // the size cap is reached, drop the oldest segment
+        if ((int) (s->tailSeg - s->headSeg + 1) >= s->maxSegments)
+        {
+            int live = 0;
+            int firstLive = -1;
+            scan_segment(s, s->headMap, s->headOff, &live, &firstLive);
+            s->count -= live;
+            s->dropped += live;
+            advance_head(s);
+        }
+        msync(s->tailMap, s->segmentBytes, MS_ASYNC);
+        unmap_segment(s, s->tailMap);
+        s->tailSeg++;
+        s->tailOff = 0;
+        s->tailMap = map_segment(s, s->tailSeg, 1);
+        if (s->tailMap == NULL)
+        {
+            pthread_mutex_unlock(&s->lock);
+            printf("failed to create the spool segment %u in %s\n", s->tailSeg, s->dir);
+            return -1;
+        }
+        if (s->headMap == NULL)
+        {
+            s->headSeg = s->tailSeg;
+            s->headMap = map_segment(s, s->headSeg, 0);
+        }
+    }
+
+    char* dest = s->tailMap + s->tailOff;
+    SpoolRecord rec;
+    rec.magic = 0;
+    rec.payloadLen = len;
+    rec.topicLen = topicLen;
+    rec.retained = retained ? 1 : 0;
+    memcpy(dest, &rec, sizeof(SpoolRecord));
+    memcpy(dest + sizeof(SpoolRecord), topic, topicLen);
+    memcpy(dest + sizeof(SpoolRecord) + topicLen, payload, len);
+    rec.crc = crc32(dest + 8, sizeof(SpoolRecord) - 8 + topicLen + len);
+    // the magic goes last, the record is not valid until it's complete
+    rec.magic = RECORD_LIVE;
+    memcpy(dest, &rec, 8);
+    s->tailOff += size;
+    s->count++;
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+int spool_pop(Spool* s, char** topic, char** payload, int* len, int* retained)
+{
+    pthread_mutex_lock(&s->lock);
+    while (s->headMap != NULL)
+    {
+        if (s->headSeg == s->tailSeg && s->headOff >= s->tailOff)
+        {
+            break;
+        }
+        int done = 0;
+        int size = record_at(s, s->headMap, s->headOff, &done);
+        if (size == 0)
+        {
+            // the end of the segment
+            if (s->headSeg >= s->tailSeg)
+            {
+                break;
+            }
+            advance_head(s);
+            continue;
+        }
+        if (done)
+        {
+            s->headOff += size;
+            continue;
+        }
+
+        SpoolRecord rec;
+        char* src = s->headMap + s->headOff;
+        memcpy(&rec, src, sizeof(SpoolRecord));
+        *topic = (char*) malloc(rec.topicLen + 1);
+        *payload = (char*) malloc(rec.payloadLen > 0 ? rec.payloadLen : 1);
+        if (*topic == NULL || *payload == NULL)
+        {
+            free(*topic);
+            free(*payload);
+            break;
+        }
+        memcpy(*topic, src + sizeof(SpoolRecord), rec.topicLen);
+        (*topic)[rec.topicLen] = 0;
+        memcpy(*payload, src + sizeof(SpoolRecord) + rec.topicLen, rec.payloadLen);
+        *len = rec.payloadLen;
+        *retained = rec.retained;
+
+        rec.magic = RECORD_DONE;
+        memcpy(src, &rec.magic, sizeof(rec.magic));
+        s->headOff += size;
+        s->count--;
+        pthread_mutex_unlock(&s->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+long long spool_count(Spool* s)
+{
+    pthread_mutex_lock(&s->lock);
+    long long count = s->count;
+    pthread_mutex_unlock(&s->lock);
+    return count;
+}
+
+void spool_close(Spool* s)
+{
+    pthread_mutex_lock(&s->lock);
+    if (s->tailMap != NULL)
+    {
+        msync(s->tailMap, s->segmentBytes, MS_SYNC);
+    }
+    if (s->headMap != NULL)
+    {
+        msync(s->headMap, s->segmentBytes, MS_SYNC);
+    }
+    unmap_segment(s, s->headMap);
+    unmap_segment(s, s->tailMap);
+    s->headMap = NULL;
+    s->tailMap = NULL;
+    pthread_mutex_unlock(&s->lock);
+    pthread_mutex_destroy(&s->lock);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_SPOOL_H
+#define INF_BCE_IOT_EDGE_SDK_SPOOL_H
+
+#include <pthread.h>
+
+// a persistent fifo of mqtt messages, kept in a directory as a sequence of
+// fixed size segment files (00000001.seg, 00000002.seg, ...). records are
+// appended to the last segment through mmap, and protected by a crc, so a
+// record torn by a crash is detected and dropped on the next open. a record
+// is marked as consumed in place once it's taken, a segment is deleted once
+// all its records are consumed. if the size cap is reached, the oldest
+// segment is dropped. all the functions are thread safe.
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    char dir[256];
+    int segmentBytes;
+    int maxSegments;
+    unsigned int headSeg;           // the segment to read from
+    char* headMap;
+    int headOff;
+    unsigned int tailSeg;           // the segment to append to
+    char* tailMap;
+    int tailOff;
+    long long count;                // records not yet consumed
+    long long dropped;              // dropped as the size cap was reached
+} Spool;
+
+// open the spool in dir, create it if missing, and recover the records left
+// by the previous run. maxBytes is the cap of the disk space used.
+// return 0 on success, -1 otherwise
+int spool_open(Spool* s, const char* dir, long long maxBytes, int segmentBytes);
+
+// append a record, return 0 on success, -1 otherwise
+int spool_append(Spool* s, const char* topic, const char* payload, int len, int retained);
+
+// take the oldest record, topic and payload are allocated and owned by the caller.
+// return 1 if a record is taken, 0 if the spool is empty
+int spool_pop(Spool* s, char** topic, char** payload, int* len, int* retained);
+
+long long spool_count(Spool* s);
+
+void spool_close(Spool* s);
+
+#endif
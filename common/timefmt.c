@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "timefmt.h"
+
+#include <string.h>
+#include <time.h>
+
+typedef struct
+{
+    int valid;
+    long long sec;                  // the second of the text
+    int prefixLen;
+    char prefix[TIMEFMT_SIZE];      // the text up to the seconds
+    int zoneLen;
+    char zone[8];                   // the text after the milliseconds
+} SecondText;
+
+static __thread SecondText t_seconds[TIMEFMT_FORMATS];
+
+static void format_second(SecondText* st, long long sec, TimeFormat format)
+{
+    struct tm tm;
+    time_t t = (time_t)sec;
+    localtime_r(&t, &tm);
+    st->prefixLen = (int)strftime(st->prefix, sizeof(st->prefix),
+        format == TIMEFMT_ISO8601_MS ? "%Y-%m-%dT%H:%M:%S" : "%Y-%m-%d %H:%M:%S", &tm);
+    st->zoneLen = 0;
+    if (format != TIMEFMT_LOG)
+    {
+        long offset = tm.tm_gmtoff / 60;
+        char* z = st->zone;
+        *z++ = offset < 0 ? '-' : '+';
+        offset = offset < 0 ? -offset : offset;
+        *z++ = (char)('0' + offset / 600 % 10);
+        *z++ = (char)('0' + offset / 60 % 10);
+        // +0800 as %z writes it, +08:00 in iso 8601
+        if (format == TIMEFMT_ISO8601_MS)
+        {
+            *z++ = ':';
+        }
+        *z++ = (char)('0' + offset % 60 / 10);
+        *z++ = (char)('0' + offset % 10);
+        st->zoneLen = (int)(z - st->zone);
+    }
+    st->sec = sec;
+    st->valid = 1;
+}
+
+int timefmt_format(char* dest, long long epoch_ms, TimeFormat format)
+{
+    long long sec = epoch_ms / 1000;
+    int ms = (int)(epoch_ms % 1000);
+    if (ms < 0)
+    {
+        sec--;
+        ms += 1000;
+    }
+    SecondText* st = &t_seconds[format];
+    if (!st->valid || st->sec != sec)
+    {
+        format_second(st, sec, format);
+    }
+    char* p = dest;
+    memcpy(p, st->prefix, st->prefixLen);
+    p += st->prefixLen;
+    if (format != TIMEFMT_LOCAL)
+    {
+        *p++ = '.';
+        *p++ = (char)('0' + ms / 100);
+        *p++ = (char)('0' + ms / 10 % 10);
+        *p++ = (char)('0' + ms % 10);
+    }
+    memcpy(p, st->zone, st->zoneLen);
+    p += st->zoneLen;
+    *p = 0;
+    return (int)(p - dest);
+}
+
+long long timefmt_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
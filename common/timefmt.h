@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef INF_BCE_IOT_EDGE_SDK_TIMEFMT_H
+#define INF_BCE_IOT_EDGE_SDK_TIMEFMT_H
+
+// the local time of the published samples and of the log lines.
+// every thread keeps the text of the last second it formatted, within the same
+// second only the milliseconds are written again, localtime_r and strftime run
+// once a second. see timefmt_bench.c for the numbers
+
+typedef enum
+{
+    TIMEFMT_LOCAL = 0,              // 2017-01-01 08:00:00+0800, the seconds only
+    TIMEFMT_LOG,                    // 2017-01-01 08:00:00.123, no zone
+    TIMEFMT_ISO8601_MS,             // 2017-01-01T08:00:00.123+08:00
+    TIMEFMT_FORMATS
+} TimeFormat;
+
+// the room needed for any of the formats, with the terminating 0
+enum {TIMEFMT_SIZE = 40};
+
+// write the time epoch_ms, in ms since epoch, in the format into dest of at
+// least TIMEFMT_SIZE chars. return the chars written before the terminating 0
+int timefmt_format(char* dest, long long epoch_ms, TimeFormat format);
+
+// the realtime clock in ms since epoch
+long long timefmt_now_ms();
+
+#endif
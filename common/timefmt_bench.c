@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// benchmark of the timestamps: the localtime_r and strftime of every sample
+// next to timefmt_format, by threads formatting a timestamp a ms apart, so that
+// the cached text of a second serves 1000 of them. the text of every format is
+// also checked against strftime and the digits of the milliseconds.
+//
+// usage: ./timefmt_bench [threads] [timestampsPerThread]
+
+#include "timefmt.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int g_count = 0;
+static long long g_start_ms = 0;
+
+static double elapsed_ms(struct timespec* start, struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+// what every sample did
+static void* strftime_func(void* arg)
+{
+    char text[TIMEFMT_SIZE];
+    unsigned sum = 0;
+    int i = 0;
+    for (i = 0; i < g_count; i++)
+    {
+        struct tm info;
+        time_t at = (time_t)((g_start_ms + i) / 1000);
+        localtime_r(&at, &info);
+        sum += strftime(text, sizeof(text), "%Y-%m-%d %X%z", &info);
+    }
+    return (void*)(size_t)sum;
+}
+
+static void* timefmt_func(void* arg)
+{
+    char text[TIMEFMT_SIZE];
+    unsigned sum = 0;
+    int i = 0;
+    for (i = 0; i < g_count; i++)
+    {
+        sum += timefmt_format(text, g_start_ms + i, TIMEFMT_ISO8601_MS);
+    }
+    return (void*)(size_t)sum;
+}
+
+static void run(const char* name, int threads, void* (*func)(void*))
+{
+    pthread_t* ids = (pthread_t*) malloc(threads * sizeof(pthread_t));
+    struct timespec t0;
+    struct timespec t1;
+    int i = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < threads; i++)
+    {
+        pthread_create(&ids[i], NULL, func, NULL);
+    }
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(ids[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ms = elapsed_ms(&t0, &t1);
+    printf("%-24s %8.1f ns/timestamp\n", name, ms * 1000000 / ((double)threads * g_count));
+    free(ids);
+}
+
+// the text of every format at epoch_ms against strftime. return 1 if it's wrong
+static int check(long long epoch_ms)
+{
+    struct tm info;
+    time_t at = (time_t)(epoch_ms / 1000);
+    localtime_r(&at, &info);
+    char zone[8];
+    strftime(zone, sizeof(zone), "%z", &info);
+    char expected[TIMEFMT_SIZE * 2];
+    char text[TIMEFMT_SIZE];
+    int errors = 0;
+
+    strftime(expected, sizeof(expected), "%Y-%m-%d %X%z", &info);
+    timefmt_format(text, epoch_ms, TIMEFMT_LOCAL);
+    errors += strcmp(text, expected) != 0;
+
+    strftime(expected, sizeof(expected), "%Y-%m-%d %H:%M:%S", &info);
+    sprintf(expected + strlen(expected), ".%03d", (int)(epoch_ms % 1000));
+    timefmt_format(text, epoch_ms, TIMEFMT_LOG);
+    errors += strcmp(text, expected) != 0;
+
+    strftime(expected, sizeof(expected), "%Y-%m-%dT%H:%M:%S", &info);
+    sprintf(expected + strlen(expected), ".%03d%.3s:%s", (int)(epoch_ms % 1000), zone, zone + 3);
+    timefmt_format(text, epoch_ms, TIMEFMT_ISO8601_MS);
+    errors += strcmp(text, expected) != 0;
+    if (errors > 0)
+    {
+        printf("ERROR: %lld is %s, %s expected\n", epoch_ms, text, expected);
+    }
+    return errors > 0;
+}
+
+int main(int argc, char* argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    g_count = argc > 2 ? atoi(argv[2]) : 1000000;
+    if (threads <= 0 || g_count <= 0)
+    {
+        printf("usage: %s [threads] [timestampsPerThread]\n", argv[0]);
+        return 1;
+    }
+    g_start_ms = timefmt_now_ms();
+    run("localtime_r + strftime", threads, strftime_func);
+    run("timefmt_format", threads, timefmt_func);
+
+    int errors = 0;
+    long long i = 0;
+    for (i = 0; i < 10000; i += 7)
+    {
+        errors += check(g_start_ms + i);
+    }
+    // the seconds going back and forth, and a year of them
+    for (i = 0; i < 365LL * 86400 * 1000; i += 86399999)
+    {
+        errors += check(g_start_ms - i);
+        errors += check(g_start_ms + i);
+    }
+    printf("%d wrong timestamps\n", errors);
+    return errors > 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "json_writer.h"
+
+typedef struct
+{
+    const char* name;
+    unsigned long long id;
+    long long startNs;
+    long long durNs;
+} TraceSpan;
+
+// written by its thread only, next is published after the span is written
+typedef struct
+{
+    unsigned long long next;        // spans ever recorded, the slot is next % TRACE_RING_EVENTS
+    char name[TRACE_NAME_LEN];
+    TraceSpan spans[TRACE_RING_EVENTS];
+} TraceRing;
+
+int g_trace_enabled = 0;
+
+static unsigned long long g_trace_ids = 0;
+static TraceRing* g_trace_rings[TRACE_MAX_THREADS];
+static int g_trace_ring_num = 0;
+static pthread_mutex_t g_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread TraceRing* t_ring = NULL;
+static __thread char t_name[TRACE_NAME_LEN];
+
+void trace_set_enabled(int enabled)
+{
+    __atomic_store_n(&g_trace_enabled, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+unsigned long long trace_next_id()
+{
+    return __atomic_add_fetch(&g_trace_ids, 1, __ATOMIC_RELAXED);
+}
+
+long long trace_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// the ring of the calling thread, created on its first span. NULL if there are
+// too many threads, or out of memory
+static TraceRing* thread_ring()
+{
+    if (t_ring != NULL)
+    {
+        return t_ring;
+    }
+    pthread_mutex_lock(&g_trace_lock);
+    if (g_trace_ring_num < TRACE_MAX_THREADS)
+    {
+        t_ring = (TraceRing*) calloc(1, sizeof(TraceRing));
+        if (t_ring != NULL)
+        {
+            if (t_name[0] != 0)
+            {
+                strcpy(t_ring->name, t_name);
+            }
+            else
+            {
+                snprintf(t_ring->name, TRACE_NAME_LEN, "thread %d", g_trace_ring_num);
+            }
+            g_trace_rings[g_trace_ring_num++] = t_ring;
+        }
+    }
+    pthread_mutex_unlock(&g_trace_lock);
+    return t_ring;
+}
+
+void trace_span(const char* name, unsigned long long id, long long startNs, long long endNs)
+{
+    if (!trace_enabled())
+    {
+        return;
+    }
+    TraceRing* ring = thread_ring();
+    if (ring == NULL)
+    {
+        return;
+    }
+    TraceSpan* span = &ring->spans[ring->next % TRACE_RING_EVENTS];
+    span->name = name;
+    span->id = id;
+    span->startNs = startNs;
+    span->durNs = endNs > startNs ? endNs - startNs : 0;
+    __atomic_store_n(&ring->next, ring->next + 1, __ATOMIC_RELEASE);
+}
+
+void trace_name_thread(const char* name)
+{
+    snprintf(t_name, TRACE_NAME_LEN, "%s", name);
+    if (t_ring != NULL)
+    {
+        pthread_mutex_lock(&g_trace_lock);
+        strcpy(t_ring->name, t_name);
+        pthread_mutex_unlock(&g_trace_lock);
+    }
+}
+
+// a new part with the names of the threads, as metadata events
+static void begin_part(JsonWriter* w)
+{
+    jw_reset(w);
+    jw_begin_object(w, NULL);
+    jw_string(w, "displayTimeUnit", "ns");
+    jw_begin_array(w, "traceEvents");
+    int i = 0;
+    for (i = 0; i < g_trace_ring_num; i++)
+    {
+        jw_begin_object(w, NULL);
+        jw_string(w, "name", "thread_name");
+        jw_string(w, "ph", "M");
+        jw_int(w, "pid", 1);
+        jw_int(w, "tid", i + 1);
+        jw_begin_object(w, "args");
+        jw_string(w, "name", g_trace_rings[i]->name);
+        jw_end_object(w);
+        jw_end_object(w);
+    }
+}
+
+static int end_part(JsonWriter* w, TraceEmit* emit, int part, void* arg)
+{
+    jw_end_array(w);
+    jw_end_object(w);
+    if (!jw_ok(w))
+    {
+        return -1;
+    }
+    emit(w->buf, w->len, part, arg);
+    return 0;
+}
+
+int trace_dump(int maxBytes, TraceEmit* emit, void* arg)
+{
+    JsonWriter w;
+    jw_init(&w, NULL, 0);
+    int parts = 0;
+    int spans = 0;
+    int rc = 0;
+    pthread_mutex_lock(&g_trace_lock);
+    begin_part(&w);
+    int i = 0;
+    for (i = 0; i < g_trace_ring_num && rc == 0; i++)
+    {
+        TraceRing* ring = g_trace_rings[i];
+        unsigned long long next = __atomic_load_n(&ring->next, __ATOMIC_ACQUIRE);
+        unsigned long long k = next > TRACE_RING_EVENTS ? next - TRACE_RING_EVENTS : 0;
+        for (; k < next && rc == 0; k++)
+        {
+            const TraceSpan* span = &ring->spans[k % TRACE_RING_EVENTS];
+            JwMark mark = jw_mark(&w);
+            jw_begin_object(&w, NULL);
+            jw_string(&w, "name", span->name);
+            jw_string(&w, "ph", "X");
+            jw_int(&w, "pid", 1);
+            jw_int(&w, "tid", i + 1);
+            jw_double(&w, "ts", span->startNs / 1000.0);
+            jw_double(&w, "dur", span->durNs / 1000.0);
+            jw_begin_object(&w, "args");
+            jw_int(&w, "id", (long long)span->id);
+            jw_end_object(&w);
+            jw_end_object(&w);
+            // the span goes into the next part once this one is full
+            if (w.len > maxBytes && spans > 0)
+            {
+                jw_rewind(&w, mark);
+                rc = end_part(&w, emit, parts++, arg);
+                begin_part(&w);
+                spans = 0;
+                k--;
+                continue;
+            }
+            spans++;
+        }
+    }
+    if (rc == 0 && (spans > 0 || parts == 0))
+    {
+        rc = end_part(&w, emit, parts++, arg);
+    }
+    pthread_mutex_unlock(&g_trace_lock);
+    free(w.buf);
+    return rc == 0 ? parts : -1;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_TRACE_H
+#define INF_BCE_IOT_EDGE_SDK_TRACE_H
+
+// optional tracing of the samples, from the poll being due to the broker
+// acknowledging the message. every sample traced gets an id, and the stages it
+// goes through are recorded as spans with nanosecond timestamps of the
+// monotonic clock into a ring of the thread recording them, without locks.
+// a ring keeps the last TRACE_RING_EVENTS spans of its thread. the rings are
+// dumped in the chrome trace event format, which chrome://tracing and
+// ui.perfetto.dev open. the dump reads the rings while they are written, the
+// spans being overwritten meanwhile may come out mixed, like the metrics
+// it is off by default, the checks cost a load when off
+
+enum {TRACE_RING_EVENTS = 8192, TRACE_MAX_THREADS = 64, TRACE_NAME_LEN = 32};
+
+extern int g_trace_enabled;
+
+static inline int trace_enabled()
+{
+    return __atomic_load_n(&g_trace_enabled, __ATOMIC_RELAXED);
+}
+
+// start or stop recording, the spans recorded are kept
+void trace_set_enabled(int enabled);
+
+// a new id for a sample, never 0
+unsigned long long trace_next_id();
+
+// the monotonic clock in ns, the clock of the spans
+long long trace_now_ns();
+
+// record a span of the sample id, from startNs to endNs, in the ring of the
+// calling thread. name must be a string literal, it's kept as the pointer.
+// dropped if tracing is off, or there are TRACE_MAX_THREADS rings already
+void trace_span(const char* name, unsigned long long id, long long startNs, long long endNs);
+
+// the name of the calling thread in the dump, e.g. "worker 0"
+void trace_name_thread(const char* name);
+
+// called with every part of a dump, the text is only valid during the call
+typedef void TraceEmit(const char* text, int len, int part, void* arg);
+
+// the spans of all the rings in parts of about maxBytes of text, so that a
+// part fits in a message. every part is a trace of its own like
+// {"displayTimeUnit": "ns", "traceEvents": [...]}, with the ts in us and the
+// sample id of every span in its args. return the parts emitted, -1 if out of memory
+int trace_dump(int maxBytes, TraceEmit* emit, void* arg);
+
+#endif
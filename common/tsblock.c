@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tsblock.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// the most bits a sample after the first one takes, '1111' + 64 bits of
+// timestamp and '11' + 5 + 6 + 64 bits of value
+#define MAX_SAMPLE_BITS (68 + 77)
+
+static unsigned long long double_bits(double value)
+{
+    unsigned long long bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double bits_double(unsigned long long bits)
+{
+    double value = 0;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// append the low n bits of v, n is 1 to 64
+static void put_bits(TsBlock* b, unsigned long long v, int n)
+{
+    while (n > 0)
+    {
+        int used = b->bits & 7;
+        int room = 8 - used;
+        int take = n < room ? n : room;
+        unsigned int chunk = (unsigned int)(v >> (n - take)) & ((1u << take) - 1);
+        unsigned char* p = b->buf + (b->bits >> 3);
+        if (used == 0)
+        {
+            *p = 0;
+        }
+        *p |= (unsigned char)(chunk << (room - take));
+        b->bits += take;
+        n -= take;
+    }
+}
+
+int tsblock_init(TsBlock* b, int cap)
+{
+    memset(b, 0, sizeof(TsBlock));
+    if (cap > TSBLOCK_MAX_BYTES)
+    {
+        cap = TSBLOCK_MAX_BYTES;
+    }
+    b->buf = (unsigned char*) malloc(cap);
+    if (b->buf == NULL)
+    {
+        return -1;
+    }
+    b->cap = cap;
+    tsblock_reset(b);
+    return 0;
+}
+
+void tsblock_reset(TsBlock* b)
+{
+    b->bits = 0;
+    b->count = 0;
+    b->firstTs = 0;
+    b->lastTs = 0;
+    b->lastDelta = 0;
+    b->lastValue = 0;
+    b->leading = -1;
+    b->trailing = 0;
+}
+
+static void put_timestamp(TsBlock* b, long long ts)
+{
+    long long delta = ts - b->lastTs;
+    long long dod = delta - b->lastDelta;
+    if (dod == 0)
+    {
+        put_bits(b, 0, 1);
+    }
+    else if (dod >= -63 && dod <= 64)
+    {
+        put_bits(b, 2, 2);
+        put_bits(b, (unsigned long long)(dod + 63), 7);
+    }
+    else if (dod >= -255 && dod <= 256)
+    {
+        put_bits(b, 6, 3);
+        put_bits(b, (unsigned long long)(dod + 255), 9);
+    }
+    else if (dod >= -2047 && dod <= 2048)
+    {
+        put_bits(b, 14, 4);
+        put_bits(b, (unsigned long long)(dod + 2047), 12);
+    }
+    else
+    {
+        put_bits(b, 15, 4);
+        put_bits(b, (unsigned long long)dod, 64);
+    }
+    b->lastDelta = delta;
+    b->lastTs = ts;
+}
+
+static void put_value(TsBlock* b, unsigned long long bits)
+{
+    unsigned long long x = bits ^ b->lastValue;
+    b->lastValue = bits;
+    if (x == 0)
+    {
+        put_bits(b, 0, 1);
+        return;
+    }
+    int leading = __builtin_clzll(x);
+    int trailing = __builtin_ctzll(x);
+    if (leading > 31)
+    {
+        leading = 31;
+    }
+    if (b->leading >= 0 && leading >= b->leading && trailing >= b->trailing)
+    {
+        // within the window of the last xor
+        put_bits(b, 2, 2);
+        put_bits(b, x >> b->trailing, 64 - b->leading - b->trailing);
+        return;
+    }
+    int meaningful = 64 - leading - trailing;
+    put_bits(b, 3, 2);
+    put_bits(b, (unsigned long long)leading, 5);
+    put_bits(b, (unsigned long long)(meaningful - 1), 6);
+    put_bits(b, x >> trailing, meaningful);
+    b->leading = leading;
+    b->trailing = trailing;
+}
+
+int tsblock_full(const TsBlock* b)
+{
+    return b->count >= TSBLOCK_MAX_SAMPLES || b->bits + MAX_SAMPLE_BITS > b->cap * 8;
+}
+
+int tsblock_append(TsBlock* b, long long ts, double value)
+{
+    if (tsblock_full(b))
+    {
+        return -1;
+    }
+    if (b->count == 0)
+    {
+        b->firstTs = ts;
+        b->lastTs = ts;
+        b->lastValue = double_bits(value);
+        put_bits(b, (unsigned long long)ts, 64);
+        put_bits(b, b->lastValue, 64);
+    }
+    else
+    {
+        put_timestamp(b, ts);
+        put_value(b, double_bits(value));
+    }
+    b->count++;
+    return 0;
+}
+
+int tsblock_bytes(const TsBlock* b)
+{
+    return (b->bits + 7) / 8;
+}
+
+int tsblock_pack(const TsBlock* b, char* dest, int cap)
+{
+    int len = tsblock_bytes(b);
+    if (4 + len > cap)
+    {
+        return 0;
+    }
+    dest[0] = (char)(b->count >> 8);
+    dest[1] = (char)(b->count & 0xff);
+    dest[2] = (char)(len >> 8);
+    dest[3] = (char)(len & 0xff);
+    memcpy(dest + 4, b->buf, len);
+    return 4 + len;
+}
+
+void tsblock_destroy(TsBlock* b)
+{
+    free(b->buf);
+    b->buf = NULL;
+    b->cap = 0;
+}
+
+void tsblock_reader_init(TsBlockReader* r, const unsigned char* buf, int len, int count)
+{
+    memset(r, 0, sizeof(TsBlockReader));
+    r->buf = buf;
+    r->bits = len * 8;
+    r->count = count;
+    r->leading = -1;
+}
+
+// read n bits, 1 to 64, into v. return -1 past the end of the block
+static int get_bits(TsBlockReader* r, int n, unsigned long long* v)
+{
+    if (r->pos + n > r->bits)
+    {
+        return -1;
+    }
+    unsigned long long result = 0;
+    while (n > 0)
+    {
+        int used = r->pos & 7;
+        int room = 8 - used;
+        int take = n < room ? n : room;
+        unsigned int byte = r->buf[r->pos >> 3];
+        unsigned int chunk = (byte >> (room - take)) & ((1u << take) - 1);
+        result = (result << take) | chunk;
+        r->pos += take;
+        n -= take;
+    }
+    *v = result;
+    return 0;
+}
+
+static int get_timestamp(TsBlockReader* r)
+{
+    // the number of leading 1 bits of the control, up to 4
+    static const int widths[] = {0, 7, 9, 12, 64};
+    static const long long bias[] = {0, 63, 255, 2047, 0};
+    unsigned long long bit = 0;
+    int ones = 0;
+    while (ones < 4)
+    {
+        if (get_bits(r, 1, &bit) != 0)
+        {
+            return -1;
+        }
+        if (bit == 0)
+        {
+            break;
+        }
+        ones++;
+    }
+    long long dod = 0;
+    if (ones > 0)
+    {
+        unsigned long long v = 0;
+        if (get_bits(r, widths[ones], &v) != 0)
+        {
+            return -1;
+        }
+        dod = (long long)v - bias[ones];
+    }
+    r->delta += dod;
+    r->ts += r->delta;
+    return 0;
+}
+
+static int get_value(TsBlockReader* r)
+{
+    unsigned long long bit = 0;
+    unsigned long long x = 0;
+    if (get_bits(r, 1, &bit) != 0)
+    {
+        return -1;
+    }
+    if (bit == 0)
+    {
+        return 0;
+    }
+    if (get_bits(r, 1, &bit) != 0)
+    {
+        return -1;
+    }
+    if (bit == 1)
+    {
+        unsigned long long leading = 0;
+        unsigned long long meaningful = 0;
+        if (get_bits(r, 5, &leading) != 0 || get_bits(r, 6, &meaningful) != 0)
+        {
+            return -1;
+        }
+        meaningful++;
+        if (leading + meaningful > 64)
+        {
+            return -1;
+        }
+        r->leading = (int)leading;
+        r->trailing = 64 - (int)leading - (int)meaningful;
+    }
+    else if (r->leading < 0)
+    {
+        return -1;
+    }
+    if (get_bits(r, 64 - r->leading - r->trailing, &x) != 0)
+    {
+        return -1;
+    }
+    r->value ^= x << r->trailing;
+    return 0;
+}
+
+int tsblock_next(TsBlockReader* r, long long* ts, double* value)
+{
+    if (r->index >= r->count)
+    {
+        return 0;
+    }
+    if (r->index == 0)
+    {
+        unsigned long long first = 0;
+        if (get_bits(r, 64, &first) != 0 || get_bits(r, 64, &r->value) != 0)
+        {
+            return -1;
+        }
+        r->ts = (long long)first;
+        r->delta = 0;
+    }
+    else if (get_timestamp(r) != 0 || get_value(r) != 0)
+    {
+        return -1;
+    }
+    r->index++;
+    *ts = r->ts;
+    *value = bits_double(r->value);
+    return 1;
+}
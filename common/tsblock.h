@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_EDGE_SDK_TSBLOCK_H
+#define INF_BCE_IOT_EDGE_SDK_TSBLOCK_H
+
+// the samples of one point, kept at the edge and uploaded as a block, the
+// way the gorilla paper of facebook compresses a time series. the block is a
+// bit stream, the most significant bit of every byte first:
+//   the first sample: timestamp in ms since epoch(64), value as a double(64)
+//   the timestamps after it, as the delta of the delta to the last one:
+//     '0' if it's 0, '10' + 7 bits if in [-63, 64], '110' + 9 bits if in
+//     [-255, 256], '1110' + 12 bits if in [-2047, 2048], '1111' + 64 bits
+//     otherwise. the delta before the second sample is taken as 0
+//   the values after it, as the xor with the last one:
+//     '0' if it's 0, '10' + the meaningful bits if they fit in the window of
+//     the last xor, '11' + leading zeros(5) + meaningful bits - 1(6) + the
+//     meaningful bits otherwise
+// a regular sampling with a slowly changing value takes a few bits a sample,
+// instead of the tens of bytes of a json sample. see tsblock_bench.c
+
+enum
+{
+    TSBLOCK_MAX_BYTES = 65535,      // the length of a packed block is 2 bytes
+    TSBLOCK_MAX_SAMPLES = 65535
+};
+
+typedef struct
+{
+    unsigned char* buf;
+    int cap;                        // bytes of buf
+    int bits;                       // bits written
+    int count;                      // samples in the block
+    long long firstTs;
+    long long lastTs;
+    long long lastDelta;
+    unsigned long long lastValue;   // the bits of the last value
+    int leading;                    // the window of the last xor, -1 before the first one
+    int trailing;
+} TsBlock;
+
+// cap is the max bytes of the block, at most TSBLOCK_MAX_BYTES.
+// return 0 on success, -1 if out of memory
+int tsblock_init(TsBlock* b, int cap);
+
+// drop the samples, the buffer is kept
+void tsblock_reset(TsBlock* b);
+
+// append a sample, the timestamps are in ms and not decreasing. return 0 on
+// success, -1 if the block is full, in which case the sample is not added
+int tsblock_append(TsBlock* b, long long ts, double value);
+
+// 1 if the next sample might not fit in the block
+int tsblock_full(const TsBlock* b);
+
+// bytes of the samples in the block
+int tsblock_bytes(const TsBlock* b);
+
+// pack the block into dest as sample count(2), block length(2) and the
+// block, big endian. return the bytes packed, 0 if dest is too small
+int tsblock_pack(const TsBlock* b, char* dest, int cap);
+
+void tsblock_destroy(TsBlock* b);
+
+// reads the samples back out of a block
+typedef struct
+{
+    const unsigned char* buf;
+    int bits;                       // bits of buf
+    int pos;                        // the next bit to read
+    int count;                      // samples in the block
+    int index;                      // samples read
+    long long ts;
+    long long delta;
+    unsigned long long value;
+    int leading;
+    int trailing;
+} TsBlockReader;
+
+void tsblock_reader_init(TsBlockReader* r, const unsigned char* buf, int len, int count);
+
+// return 1 if a sample is read, 0 once all the samples are read, -1 if the
+// block is truncated or malformed
+int tsblock_next(TsBlockReader* r, long long* ts, double* value);
+
+#endif
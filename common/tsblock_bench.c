@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark of the time series blocks: compress a few typical series of
+// polled values, check that they read back the same, and compare the bytes
+// of a sample with the json sample it replaces.
+//
+// usage: ./tsblock_bench [samples] [intervalMs]
+
+#include "tsblock.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double elapsed_ms(struct timespec* start, struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+// a sample of a decoded value as it's published without the blocks
+static int json_sample_bytes(long long ts, double value)
+{
+    char buf[128];
+    return snprintf(buf, sizeof(buf), "{\"values\":{\"temperature\":%.15g},"
+        "\"timestamp\":\"%lld\"}", value, ts);
+}
+
+enum
+{
+    SERIES_CONSTANT = 0,            // e.g. a set point
+    SERIES_SCALED,                  // a register times 0.1, drifting slowly
+    SERIES_NOISE,                   // a float32 field of a noisy sensor
+    SERIES_NUM
+};
+
+static const char* g_names[SERIES_NUM] = {"constant", "scaled register", "noisy float32"};
+
+static double series_value(int kind, int i)
+{
+    switch (kind)
+    {
+    case SERIES_CONSTANT:
+        return 50;
+    case SERIES_SCALED:
+        return (2300 + (int)(40 * sin(i / 500.0)) + (rand() % 3 - 1)) * 0.1;
+    default:
+        return (float)(23.0 + (rand() % 10000) / 10000.0);
+    }
+}
+
+// compress samples of the series in blocks of TSBLOCK_MAX_BYTES, and read
+// every block back. return the number of mismatches
+static int run_series(int kind, int num, int interval)
+{
+    long long* ts = (long long*) malloc(num * sizeof(long long));
+    double* values = (double*) malloc(num * sizeof(double));
+    TsBlock b;
+    if (ts == NULL || values == NULL || tsblock_init(&b, TSBLOCK_MAX_BYTES) != 0)
+    {
+        printf("out of memory\n");
+        exit(1);
+    }
+    long long now = 1496275200000LL;
+    long long json = 0;
+    int i = 0;
+    for (i = 0; i < num; i++)
+    {
+        // the polls are a few ms late now and then
+        now += interval + (rand() % 7 == 0 ? rand() % 5 : 0);
+        ts[i] = now;
+        values[i] = series_value(kind, i);
+        json += json_sample_bytes(ts[i], values[i]);
+    }
+
+    int errors = 0;
+    long long bytes = 0;
+    int blocks = 0;
+    int start = 0;
+    struct timespec t0;
+    struct timespec t1;
+    double encode_ms = 0;
+    double decode_ms = 0;
+    while (start < num)
+    {
+        tsblock_reset(&b);
+        int end = start;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        while (end < num && tsblock_append(&b, ts[end], values[end]) == 0)
+        {
+            end++;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        encode_ms += elapsed_ms(&t0, &t1);
+        bytes += 4 + tsblock_bytes(&b);
+        blocks++;
+
+        TsBlockReader r;
+        long long t = 0;
+        double v = 0;
+        int j = start;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        tsblock_reader_init(&r, b.buf, tsblock_bytes(&b), b.count);
+        while (tsblock_next(&r, &t, &v) == 1)
+        {
+            if (j >= end || t != ts[j] || memcmp(&v, &values[j], sizeof(double)) != 0)
+            {
+                errors++;
+            }
+            j++;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        decode_ms += elapsed_ms(&t0, &t1);
+        if (j != end)
+        {
+            errors++;
+        }
+        start = end;
+    }
+    if (errors > 0)
+    {
+        printf("ERROR: %d samples of the %s series differ\n", errors, g_names[kind]);
+    }
+    printf("%-16s %d samples in %d blocks: %.2f bytes/sample, json %.1f bytes/sample "
+        "(%.1fx), raw 16 bytes/sample (%.1fx), encode %.1f ns/sample, decode %.1f ns/sample\n",
+        g_names[kind], num, blocks, (double)bytes / num, (double)json / num,
+        (double)json / bytes, 16.0 * num / bytes, encode_ms * 1000000 / num,
+        decode_ms * 1000000 / num);
+    tsblock_destroy(&b);
+    free(ts);
+    free(values);
+    return errors;
+}
+
+int main(int argc, char* argv[])
+{
+    int num = argc > 1 ? atoi(argv[1]) : 1000000;
+    int interval = argc > 2 ? atoi(argv[2]) : 1000;
+    if (num <= 0 || interval <= 0)
+    {
+        printf("usage: %s [samples] [intervalMs]\n", argv[0]);
+        return 1;
+    }
+    srand(20170601);
+    int errors = 0;
+    int kind = 0;
+    for (kind = 0; kind < SERIES_NUM; kind++)
+    {
+        errors += run_series(kind, num, interval);
+    }
+
+    // the corner cases of the timestamps and the values
+    TsBlock b;
+    tsblock_init(&b, 256);
+    long long ts[] = {0, 1, 1, 100000, 100000, 3, 9000000000000LL};
+    double values[] = {0.0, -0.0, 1e308, -1e-308, NAN, INFINITY, 42};
+    int n = sizeof(ts) / sizeof(ts[0]);
+    int i = 0;
+    for (i = 0; i < n; i++)
+    {
+        if (tsblock_append(&b, ts[i], values[i]) != 0)
+        {
+            printf("ERROR: sample %d is not appended\n", i);
+            errors++;
+        }
+    }
+    TsBlockReader r;
+    long long t = 0;
+    double v = 0;
+    tsblock_reader_init(&r, b.buf, tsblock_bytes(&b), b.count);
+    for (i = 0; tsblock_next(&r, &t, &v) == 1; i++)
+    {
+        if (t != ts[i] || memcmp(&v, &values[i], sizeof(double)) != 0)
+        {
+            printf("ERROR: corner case %d differs\n", i);
+            errors++;
+        }
+    }
+    if (i != n)
+    {
+        printf("ERROR: %d of %d corner cases read back\n", i, n);
+        errors++;
+    }
+    // a truncated block must be refused, not read past its end
+    tsblock_reader_init(&r, b.buf, tsblock_bytes(&b) / 2, b.count);
+    while ((i = tsblock_next(&r, &t, &v)) == 1)
+    {
+    }
+    if (i != -1)
+    {
+        printf("ERROR: the truncated block is not refused\n");
+        errors++;
+    }
+    // and a full block refuses the sample instead of overflowing
+    tsblock_reset(&b);
+    for (i = 0; tsblock_append(&b, i * 1000LL, (double)rand()) == 0; i++)
+    {
+    }
+    if (tsblock_bytes(&b) > b.cap)
+    {
+        printf("ERROR: the block overflowed\n");
+        errors++;
+    }
+    tsblock_destroy(&b);
+    return errors > 0 ? 1 : 0;
+}
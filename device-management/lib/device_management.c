@@ -25,6 +25,7 @@
 #include "device_management.h"
 #include "device_management_conf.h"
 #include "device_management_util.h"
+#include "device_management_json.h"
 
 #define _GNU_SOURCE
 #define __USE_GNU
@@ -37,11 +38,45 @@
 #include <pthread.h>
 #include <zconf.h>
 #include <stdio.h>
+#include <time.h>
+#include <ctype.h>
 
 #define SUB_TOPIC_COUNT 7
 
+/*
+ * The subscribed topics come in groups, subscribed only once something uses them. The topics of a group follow each
+ * other in TopicContract.subTopics, the bit of a group in a topic mask is 1 << group.
+ */
+typedef enum {
+    TOPIC_GROUP_UPDATE = 0, /* update/accepted, update/rejected */
+    TOPIC_GROUP_GET, /* get/accepted, get/rejected */
+    TOPIC_GROUP_DELETE, /* delete/accepted, delete/rejected */
+    TOPIC_GROUP_DELTA, /* delta */
+    TOPIC_GROUP_COUNT
+} TopicGroup;
+
+#define TOPIC_GROUP_BIT(group) ((uint8_t) (1u << (group)))
+
+static const int TOPIC_GROUP_FIRST[TOPIC_GROUP_COUNT + 1] = {0, 2, 4, 6, SUB_TOPIC_COUNT};
+
 #define MAX_UUID_LENGTH (36 + 1) /* According to RFC4122 it has 32 hex digits + 4 dashes. */
 
+/*
+ * The variant bits of the request id of a fire and forget update, see device_management_shadow_report. They are the
+ * ones RFC4122 reserves for the future, so uuid_generate never gives them to a tracked request.
+ */
+#define FIRE_AND_FORGET_VARIANT 0xE0
+
+/* Slots of the request id index, kept at most half full so that the probes stay short. */
+#define IN_FLIGHT_INDEX_SIZE (2 * MAX_IN_FLIGHT_MESSAGE)
+
+#define IN_FLIGHT_NONE (-1)
+
+/* Slots of the property handler index by key. */
+#define PROPERTY_INDEX_SIZE (2 * MAX_SHADOW_PROPERTY_HANDLER)
+
+#define PROPERTY_NONE (-1)
+
 #define URI_SSL "ssl://"
 
 static const char *LO4C_CATEGORY_NAME = "device-management";
@@ -81,37 +116,136 @@ typedef struct {
 typedef struct {
     char *key; // key 可以为NULL，表示匹配根。
     ShadowPropertyDeltaCallback cb; // 收到更新之后，会调用这个回调。
+    int next; // 同一个 key 的下一个 handler，没有则为 PROPERTY_NONE。
 } ShadowPropertyDeltaHandler;
 
-/* Manages shadow property handlers. It's a add-only collection. */
+/*
+ * Manages shadow property handlers. It's a add-only collection. keys maps a key to its first handler by open
+ * addressing with linear probing, the handlers of the same key are chained in the order they were registered, and
+ * root chains the handlers of the whole shadow.
+ */
 typedef struct {
     ShadowPropertyDeltaHandler vault[MAX_SHADOW_PROPERTY_HANDLER];
     int index;
+    int keys[PROPERTY_INDEX_SIZE];
+    int root;
     /* This data is accessed from MQTT client's callback. */
     pthread_mutex_t mutex;
 } PropertyHandlerTable;
 
 typedef struct {
-    char requestId[MAX_UUID_LENGTH];
+    uuid_t requestId;
     ShadowAction action;
     ShadowActionCallback callback;
     void *callbackContext;
-    time_t timestamp;
-    uint8_t timeout;
+    int64_t deadline; /* In milliseconds of CLOCK_MONOTONIC. */
+    int heapIndex; /* The position in the deadline heap. */
     bool free;
+    int nextFree; /* The next free slot of the vault when this one is free. */
 } InFlightMessage;
 
+/*
+ * The vault holds the messages, its free slots are chained from freeHead. index maps the request id to the slot of
+ * the vault by open addressing with linear probing, IN_FLIGHT_NONE marks the empty entries. Both adding and matching
+ * a message take constant time whatever the number of messages in flight. heap is a binary min-heap of the slots
+ * in flight ordered by deadline, so the next message to time out is always heap[0].
+ */
 typedef struct {
     InFlightMessage vault[MAX_IN_FLIGHT_MESSAGE];
+    int index[IN_FLIGHT_INDEX_SIZE];
+    int freeHead;
+    int heap[MAX_IN_FLIGHT_MESSAGE];
+    int heapSize;
     /* This data is also accessed from MQTT client's callback. */
     pthread_mutex_t mutex;
 } InFlightMessageList;
 
+/* The callers whose reported fragments went into one update, told of its ack all together. */
+typedef struct {
+    int count;
+    ShadowActionCallback callbacks[MAX_COALESCED_UPDATE];
+    void *contexts[MAX_COALESCED_UPDATE];
+} CoalescedUpdateBatch;
+
+/*
+ * The update being coalesced, sent by the keeper once the linger window since its first fragment is over, or by the
+ * caller that fills the batch. reported is NULL when nothing is pending.
+ */
+typedef struct {
+    uint32_t lingerMs; /* 0 sends every update at once. */
+    cJSON *reported;
+    CoalescedUpdateBatch *batch;
+    uint8_t timeout; /* The shortest of the callers. */
+    int64_t deadline;
+    pthread_mutex_t mutex;
+} CoalescedUpdate;
+
+/*
+ * The reported fragments of the updates made while disconnected, merged member by member and sent as one update once
+ * connected again. reported is NULL when nothing is queued, properties counts its members.
+ */
+typedef struct {
+    uint32_t maxProperties; /* 0 turns the queue off. */
+    cJSON *reported;
+    uint32_t properties;
+    CoalescedUpdateBatch *batch;
+    uint8_t timeout; /* The shortest of the callers. */
+    pthread_mutex_t mutex;
+} OfflineQueue;
+
+/*
+ * The local copy of the shadow, see device_management_shadow_set_cache. reported holds what was accepted or is in
+ * flight, version is the profileVersion of the last ack, -1 if unknown. The GET of the resync in flight, if any, is
+ * resyncId, its ack is merged into the copy instead of replacing it.
+ */
+typedef struct {
+    bool enabled;
+    cJSON *reported;
+    cJSON *desired;
+    int version;
+    bool resyncing;
+    uuid_t resyncId;
+    pthread_mutex_t mutex;
+} ShadowCache;
+
+/* A growable set of clients. */
+typedef struct {
+    struct device_management_client_t **members;
+    int count;
+    int capacity;
+    pthread_mutex_t mutex;
+} ClientGroup;
+
 typedef struct device_management_client_t {
     MQTTAsync mqttClient;
+    /* The client whose MQTT connection this one shares, NULL if mqttClient is its own. */
+    struct device_management_client_t *owner;
+    /* The clients sharing the MQTT connection of this one, which routes their messages by the topic. */
+    ClientGroup shared;
     int errorCode;
     char *errorMessage;
+    /* The topics needed once connected are subscribed. */
     volatile bool hasSubscribed;
+    /*
+     * Topic masks, guarded by mutex. wantedTopics is what the client has used so far, subscribedTopics what the broker
+     * session has, or is being asked for in pendingTopics. The session outlives the connection, so a reconnect that
+     * finds it only subscribes what was added meanwhile.
+     */
+    uint8_t wantedTopics;
+    uint8_t subscribedTopics;
+    uint8_t pendingTopics;
+    /* The broker kept the session of the last connect, only meaningful for the owner of the connection. */
+    volatile bool sessionPresent;
+    /* Told once connected and subscribed, or once the connect is given up. Guarded by mutex like the rest. */
+    DeviceManagementConnectCallback connectCallback;
+    void *connectContext;
+    /* A connect of this MQTT client is under way. */
+    bool connecting;
+    /* Retry a failed connect instead of giving up, until the first one succeeds. After that paho reconnects. */
+    bool connectRetry;
+    /* When to retry the connect, 0 if not scheduled. The delay doubles from one failure to the next. */
+    int64_t reconnectAt;
+    uint32_t reconnectDelayMs;
     char *username;
     char *password;
     char *deviceName;
@@ -119,18 +253,61 @@ typedef struct device_management_client_t {
     TopicContract *topicContract;
     PropertyHandlerTable properties;
     InFlightMessageList messages;
+    CoalescedUpdate update;
+    OfflineQueue offline;
+    ShadowCache cache;
+    /* Index the acks instead of parsing them into cJSON. */
+    volatile bool lazyParse;
+    /* The QoS of the requests sent, the fire and forget updates always go at 0. */
+    volatile int qos;
+    /* The index of the message being received, used by the MQTT receive thread of the connection only. */
+    ShadowDocument document;
+    /* Reused to print the messages sent, guarded by mutex. */
+    char *sendBuffer;
+    int sendBufferSize;
     pthread_mutex_t mutex;
 } device_management_client_t;
 
+static ClientGroup allClients;
+
+/* A delta received, waiting for its handlers. */
+typedef struct DeltaEvent {
+    struct device_management_client_t *client;
+    cJSON *payload;
+    struct DeltaEvent *next;
+} DeltaEvent;
+
+/*
+ * The deltas are handed from the MQTT receive thread to a dispatch thread, so that slow handlers hold up neither
+ * the receive thread nor the acks behind them. dispatching is the client whose delta is being handled.
+ */
 typedef struct {
-    device_management_client_t *members[MAX_CLIENT];
+    DeltaEvent *head;
+    DeltaEvent *tail;
+    struct device_management_client_t *dispatching;
+    bool stop;
+    pthread_t thread;
     pthread_mutex_t mutex;
-} ClientGroup;
+    pthread_cond_t cond;
+} DeltaQueue;
 
-static ClientGroup allClients;
+static DeltaQueue deltas = {NULL, NULL, NULL, false, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
 
 static pthread_t inFlightMessageKeeper;
 
+/*
+ * The keeper sleeps until the earliest deadline of all clients. Adding a message that is due before it kicks the
+ * keeper awake to sleep again for the shorter time. Never lock the clients or their messages while holding
+ * keeperMutex.
+ */
+static pthread_mutex_t keeperMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_cond_t keeperCond;
+
+static bool keeperKicked = false;
+
+static bool keeperStop = false;
+
 static TopicContract *topic_contract_create(const char *deviceName);
 
 static void topic_contract_destroy(TopicContract *topics);
@@ -139,12 +316,84 @@ static bool client_group_add(ClientGroup *group, device_management_client_t *cli
 
 static bool client_group_remove(ClientGroup *group, device_management_client_t *client);
 
-static void client_group_iterate(ClientGroup *clients, void (*fp)(device_management_client_t *c));
+static void client_group_init(ClientGroup *group);
+
+static void client_group_destroy(ClientGroup *group);
+
+static void device_management_client_init(device_management_client_t *c, const char *deviceName);
+
+static DmReturnCode device_management_start_connect(device_management_client_t *c,
+                                                    DeviceManagementConnectCallback callback, void *context,
+                                                    bool retry);
+
+static DmReturnCode device_management_mqtt_connect(device_management_client_t *c);
+
+static void device_management_connect_done(device_management_client_t *c, DmReturnCode rc);
+
+static void device_management_on_ready(device_management_client_t *c);
+
+static int64_t device_management_reconnect_house_keep(device_management_client_t *c, int64_t now);
+
+static void device_management_subscribe(device_management_client_t *c, uint8_t groups);
+
+static void device_management_want_topics(device_management_client_t *c, uint8_t groups);
+
+static void device_management_resubscribe(device_management_client_t *c, bool sessionPresent);
 
-static void in_flight_message_house_keep(device_management_client_t *c);
+static void device_management_unsubscribe(device_management_client_t *c);
+
+static void device_management_forget_pending_topics(device_management_client_t *c);
+
+static device_management_client_t *device_management_route(device_management_client_t *owner, const char *topicName);
+
+static void in_flight_message_list_init(InFlightMessageList *table);
+
+static int in_flight_message_find(InFlightMessageList *table, const uuid_t requestId);
+
+static void in_flight_message_remove(InFlightMessageList *table, int position);
+
+static int64_t in_flight_message_house_keep(device_management_client_t *c);
 
 static void *in_flight_message_house_keep_proc(void *ignore);
 
+static void in_flight_message_kick_keeper();
+
+static DmReturnCode coalesced_update_add(device_management_client_t *c, ShadowActionCallback callback, void *context,
+                                         uint8_t timeout, cJSON *reported);
+
+static int64_t coalesced_update_house_keep(device_management_client_t *c, int64_t now);
+
+static void coalesced_update_ack(ShadowAction action, ShadowAckStatus status, ShadowActionAck *ack, void *context);
+
+static void coalesced_update_send(device_management_client_t *c, cJSON *reported, CoalescedUpdateBatch *batch,
+                                  uint8_t timeout);
+
+static cJSON *coalesced_update_take(device_management_client_t *c, CoalescedUpdateBatch **batch, uint8_t *timeout);
+
+static bool offline_queue_add(device_management_client_t *c, const cJSON *reported,
+                              const CoalescedUpdateBatch *callers, uint8_t timeout, bool older);
+
+static bool offline_queue_pending(device_management_client_t *c);
+
+static void offline_queue_flush(device_management_client_t *c);
+
+static void json_merge(cJSON *target, const cJSON *patch);
+
+static void json_merge_under(cJSON *target, const cJSON *patch);
+
+static cJSON *shadow_cache_changes(device_management_client_t *c, const cJSON *reported);
+
+static void shadow_cache_unchanged(device_management_client_t *c, ShadowActionCallback callback, void *context);
+
+static void shadow_cache_forget(device_management_client_t *c);
+
+static void shadow_cache_ack(device_management_client_t *c, const uuid_t requestId, ShadowAction action,
+                             ShadowAckStatus status, cJSON *payload, ShadowDocument *document);
+
+static void shadow_cache_delta(device_management_client_t *c, cJSON *payload);
+
+static int64_t monotonic_ms();
+
 static const char *message_get_request_id(const cJSON *payload);
 
 static bool device_management_is_connected(DeviceManagementClient client);
@@ -152,19 +401,36 @@ static bool device_management_is_connected(DeviceManagementClient client);
 static bool device_management_is_connected2(device_management_client_t *c);
 
 static DmReturnCode device_management_shadow_send_json(device_management_client_t *c, const char *topic,
-                                                       const char *requestId, cJSON *payload);
+                                                       const char *requestId, cJSON *payload, int qos);
+
+static DmReturnCode device_management_shadow_send_text(device_management_client_t *c, const char *topic,
+                                                       const char *requestId, const char *document, int qos);
+
+static DmReturnCode device_management_shadow_send_as(device_management_client_t *c, const uuid_t uuid,
+                                                     ShadowAction action, cJSON *payload, const char *document,
+                                                     ShadowActionCallback callback, void *context, uint32_t timeoutMs);
 
 static DmReturnCode device_management_shadow_send(DeviceManagementClient client, ShadowAction action, cJSON *payload,
-                                                  ShadowActionCallback callback,
-                                                  void *context, uint8_t timeout);
+                                                  const char *document, ShadowActionCallback callback,
+                                                  void *context, uint32_t timeoutMs);
 
 static int
 device_management_shadow_handle_response(device_management_client_t *c, const char *requestId, ShadowAction action,
                                          ShadowAckStatus status,
-                                         cJSON *payload);
+                                         cJSON *payload, ShadowDocument *document);
 
 static DmReturnCode device_management_delta_arrived(device_management_client_t *c, cJSON *payload);
 
+static void device_management_delta_dispatch(device_management_client_t *c, cJSON *payload);
+
+static void *delta_queue_proc(void *ignore);
+
+static void delta_queue_forget(device_management_client_t *c);
+
+static void property_handler_table_init(PropertyHandlerTable *table);
+
+static int property_handler_find(PropertyHandlerTable *table, const char *key);
+
 MQTTAsync_failureData UNKNOWN_FAILURE = {0, 0, "Unknown MQTT failure"};
 
 static void device_management_set_error(device_management_client_t *client, MQTTAsync_failureData *failureData);
@@ -215,8 +481,19 @@ DmReturnCode device_management_init() {
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
     pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-    pthread_mutex_init(&(allClients.mutex), NULL);
+    client_group_init(&allClients);
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&keeperCond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+    keeperStop = false;
     pthread_create(&inFlightMessageKeeper, NULL, in_flight_message_house_keep_proc, NULL);
+    /* Named so that their CPU time can be told apart, see test/benchmark.cpp. */
+    pthread_setname_np(inFlightMessageKeeper, "dm-keeper");
+    deltas.stop = false;
+    pthread_create(&(deltas.thread), NULL, delta_queue_proc, NULL);
+    pthread_setname_np(deltas.thread, "dm-delta");
     pthread_mutexattr_destroy(&attr);
     inited = true;
     return SUCCESS;
@@ -229,8 +506,17 @@ DmReturnCode device_management_fini() {
     }
     inited = false;
     // Destroy
-    pthread_cancel(inFlightMessageKeeper);
+    pthread_mutex_lock(&keeperMutex);
+    keeperStop = true;
+    pthread_cond_signal(&keeperCond);
+    pthread_mutex_unlock(&keeperMutex);
     pthread_join(inFlightMessageKeeper, NULL);
+    pthread_cond_destroy(&keeperCond);
+    pthread_mutex_lock(&(deltas.mutex));
+    deltas.stop = true;
+    pthread_cond_broadcast(&(deltas.cond));
+    pthread_mutex_unlock(&(deltas.mutex));
+    pthread_join(deltas.thread, NULL);
 
     log4c_category_log(category, LOG4C_PRIORITY_INFO, "cleaned up.");
 
@@ -244,7 +530,6 @@ DmReturnCode device_management_fini() {
 DmReturnCode device_management_create(DeviceManagementClient *client, const char *broker, const char *deviceName,
                                       const char *username, const char *password, const char *clientId, const char *trustStore) {
     int rc;
-    int i;
 
     if (client == NULL || broker == NULL || deviceName == NULL || username == NULL || password == NULL) {
         return NULL_POINTER;
@@ -273,45 +558,229 @@ DmReturnCode device_management_create(DeviceManagementClient *client, const char
     MQTTAsync_setConnected(c->mqttClient, c, mqtt_on_connected);
 
     /* Set up device_management_client_t. */
-    c->errorMessage = NULL;
     c->username = strdup(username);
     c->password = strdup(password);
-    c->deviceName = strdup(deviceName);
     c->trustStore = trustStore == NULL ? NULL : strdup(trustStore);
+    device_management_client_init(c, deviceName);
+    *client = c;
+
+    log4c_category_log(category, LOG4C_PRIORITY_INFO, "created. broker=%s, deviceName=%s.",
+                       broker, deviceName);
+    return SUCCESS;
+}
+
+DmReturnCode device_management_create_shared(DeviceManagementClient *client, DeviceManagementClient connection,
+                                             const char *deviceName) {
+    device_management_client_t *owner = connection;
+
+    if (client == NULL || connection == NULL || deviceName == NULL) {
+        return NULL_POINTER;
+    }
+
+    if (owner->owner != NULL) {
+        owner = owner->owner;
+    }
+
+    device_management_client_t *c = malloc(sizeof(device_management_client_t));
+    check_malloc_result(c);
+
+    c->mqttClient = owner->mqttClient;
+    c->username = NULL;
+    c->password = NULL;
+    c->trustStore = NULL;
+    device_management_client_init(c, deviceName);
+    c->owner = owner;
+    client_group_add(&(owner->shared), c);
+    *client = c;
+
+    /* It has nothing to subscribe yet. Otherwise it is set along with the owner once connected. */
+    if (MQTTAsync_isConnected(c->mqttClient)) {
+        device_management_resubscribe(c, false);
+    }
+
+    log4c_category_log(category, LOG4C_PRIORITY_INFO, "created. deviceName=%s, sharing the connection of %s.",
+                       deviceName, owner->deviceName);
+    return SUCCESS;
+}
+
+/* Set up what the clients with their own connection and the shared ones have in common. */
+void device_management_client_init(device_management_client_t *c, const char *deviceName) {
+    c->owner = NULL;
+    c->errorMessage = NULL;
+    c->deviceName = strdup(deviceName);
     c->topicContract = topic_contract_create(deviceName);
     c->hasSubscribed = false;
+    c->wantedTopics = 0;
+    c->subscribedTopics = 0;
+    c->pendingTopics = 0;
+    c->sessionPresent = false;
+    c->connectCallback = NULL;
+    c->connectContext = NULL;
+    c->connecting = false;
+    c->connectRetry = false;
+    c->reconnectAt = 0;
+    c->reconnectDelayMs = RECONNECT_MIN_INTERVAL * 1000;
+    c->sendBuffer = NULL;
+    c->sendBufferSize = 0;
+    c->lazyParse = false;
+    c->qos = QOS;
+    shadow_document_init(&(c->document));
 
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
     pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
 
-    c->properties.index = 0;
+    property_handler_table_init(&(c->properties));
     pthread_mutex_init(&(c->properties.mutex), &attr);
-    for (i = 0; i < MAX_IN_FLIGHT_MESSAGE; ++i) {
-        c->messages.vault[i].free = true;
-    }
+    in_flight_message_list_init(&(c->messages));
 
     pthread_mutex_init(&(c->messages.mutex), &attr);
+    c->update.lingerMs = 0;
+    c->update.reported = NULL;
+    c->update.batch = NULL;
+    pthread_mutex_init(&(c->update.mutex), &attr);
+    c->offline.maxProperties = 0;
+    c->offline.reported = NULL;
+    c->offline.properties = 0;
+    c->offline.batch = NULL;
+    pthread_mutex_init(&(c->offline.mutex), &attr);
+    c->cache.enabled = false;
+    c->cache.reported = NULL;
+    c->cache.desired = NULL;
+    c->cache.version = -1;
+    c->cache.resyncing = false;
+    pthread_mutex_init(&(c->cache.mutex), &attr);
     pthread_mutex_init(&(c->mutex), &attr);
     pthread_mutexattr_destroy(&attr);
+    client_group_init(&(c->shared));
     client_group_add(&allClients, c);
-    *client = c;
+}
 
-    log4c_category_log(category, LOG4C_PRIORITY_INFO, "created. broker=%s, deviceName=%s.",
-                       broker, deviceName);
-    return SUCCESS;
+/* Lets device_management_connect wait for its connect callback. */
+typedef struct {
+    bool done;
+    DmReturnCode rc;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} ConnectWaiter;
+
+static void device_management_connect_wake(DeviceManagementClient client, DmReturnCode rc, void *context) {
+    ConnectWaiter *waiter = context;
+    pthread_mutex_lock(&(waiter->mutex));
+    waiter->rc = rc;
+    waiter->done = true;
+    pthread_cond_signal(&(waiter->cond));
+    pthread_mutex_unlock(&(waiter->mutex));
 }
 
 DmReturnCode device_management_connect(DeviceManagementClient client) {
-    int rc;
+    DmReturnCode rc;
     device_management_client_t *c = client;
+    ConnectWaiter waiter = {false, SUCCESS, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+    if (c == NULL) {
+        return NULL_POINTER;
+    }
+
+    /* A single try, the caller learns of its failure. */
+    rc = device_management_start_connect(c, device_management_connect_wake, &waiter, false);
+    if (rc != SUCCESS) {
+        return rc;
+    }
+
+    pthread_mutex_lock(&(waiter.mutex));
+    while (!waiter.done) {
+        pthread_cond_wait(&(waiter.cond), &(waiter.mutex));
+    }
+    pthread_mutex_unlock(&(waiter.mutex));
+    pthread_mutex_destroy(&(waiter.mutex));
+    pthread_cond_destroy(&(waiter.cond));
+
+    if (waiter.rc != SUCCESS) {
+        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "MQTT connect failed. code=%d, message=%s.", c->errorCode,
+                           c->errorMessage != NULL ? c->errorMessage : "unknown");
+    }
+    return waiter.rc;
+}
+
+DmReturnCode device_management_connect_async(DeviceManagementClient client, DeviceManagementConnectCallback callback,
+                                             void *context) {
+    if (client == NULL) {
+        return NULL_POINTER;
+    }
+
+    return device_management_start_connect(client, callback, context, true);
+}
+
+/*
+ * Connect the client, or its owner if it shares a connection, and tell callback once its topics are subscribed. The
+ * callback is called at most once, and not at all if this doesn't return SUCCESS.
+ */
+DmReturnCode device_management_start_connect(device_management_client_t *c, DeviceManagementConnectCallback callback,
+                                             void *context, bool retry) {
+    DmReturnCode rc = SUCCESS;
+
+    pthread_mutex_lock(&(c->mutex));
+    if (callback != NULL && c->connectCallback != NULL) {
+        pthread_mutex_unlock(&(c->mutex));
+        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "already being connected. deviceName=%s.", c->deviceName);
+        return FAILURE;
+    }
+    if (device_management_is_connected2(c)) {
+        pthread_mutex_unlock(&(c->mutex));
+        log4c_category_log(category, LOG4C_PRIORITY_INFO, "already connected.");
+        if (callback != NULL) {
+            callback(c, SUCCESS, context);
+        }
+        return SUCCESS;
+    }
+    c->connectCallback = callback;
+    c->connectContext = context;
+    pthread_mutex_unlock(&(c->mutex));
+
+    if (c->owner != NULL) {
+        /* Connecting the owner subscribes the topics of this one too. */
+        rc = device_management_start_connect(c->owner, NULL, NULL, retry);
+    } else {
+        pthread_mutex_lock(&(c->mutex));
+        /* Otherwise the connect under way, or the subscribing after it, tells the callback. */
+        if (!c->connecting && !MQTTAsync_isConnected(c->mqttClient)) {
+            c->connectRetry = retry;
+            c->reconnectAt = 0;
+            c->reconnectDelayMs = RECONNECT_MIN_INTERVAL * 1000;
+            c->connecting = true;
+            rc = device_management_mqtt_connect(c);
+            if (rc != SUCCESS) {
+                c->connecting = false;
+            }
+        } else if (retry) {
+            c->connectRetry = true;
+        }
+        pthread_mutex_unlock(&(c->mutex));
+    }
+
+    if (rc != SUCCESS) {
+        pthread_mutex_lock(&(c->mutex));
+        c->connectCallback = NULL;
+        c->connectContext = NULL;
+        pthread_mutex_unlock(&(c->mutex));
+    }
+    return rc;
+}
+
+/* Start connecting, the outcome arrives in mqtt_on_connect_success/failure. */
+DmReturnCode device_management_mqtt_connect(device_management_client_t *c) {
+    int rc;
 
     MQTTAsync_connectOptions connectOptions = MQTTAsync_connectOptions_initializer;
     connectOptions.keepAliveInterval = KEEP_ALIVE;
-    connectOptions.cleansession = 1;
+    /* Keep the subscriptions in the broker session across reconnects. */
+    connectOptions.cleansession = 0;
     connectOptions.username = c->username;
     connectOptions.password = c->password;
     connectOptions.automaticReconnect = true;
+    connectOptions.minRetryInterval = RECONNECT_MIN_INTERVAL;
+    connectOptions.maxRetryInterval = RECONNECT_MAX_INTERVAL;
     connectOptions.onSuccess = mqtt_on_connect_success;
     connectOptions.onFailure = mqtt_on_connect_failure;
     connectOptions.context = c;
@@ -321,38 +790,58 @@ DmReturnCode device_management_connect(DeviceManagementClient client) {
     if (c->trustStore != NULL) {
         sslOptions.trustStore = c->trustStore;
         sslOptions.enableServerCertAuth = false;
+        sslOptions.enabledCipherSuites = TLS_CIPHERS;
         connectOptions.ssl = &sslOptions;
     }
 
-    if (MQTTAsync_isConnected(c->mqttClient)) {
-        log4c_category_log(category, LOG4C_PRIORITY_INFO, "already connected.");
-        return SUCCESS;
-    }
-
-    log4c_category_log(category, LOG4C_PRIORITY_INFO, "connecting to server.");
+    log4c_category_log(category, LOG4C_PRIORITY_INFO, "connecting to server. deviceName=%s.", c->deviceName);
     rc = MQTTAsync_connect(c->mqttClient, &connectOptions);
     if (rc != MQTTASYNC_SUCCESS) {
         log4c_category_log(category, LOG4C_PRIORITY_ERROR, "failed to start connecting. MQTT rc=%d.", rc);
         return FAILURE;
     }
+    return SUCCESS;
+}
+
+/* Tell the pending connect callback of the client, if any. */
+void device_management_connect_done(device_management_client_t *c, DmReturnCode rc) {
+    DeviceManagementConnectCallback callback;
+    void *context;
+
+    pthread_mutex_lock(&(c->mutex));
+    callback = c->connectCallback;
+    context = c->connectContext;
+    c->connectCallback = NULL;
+    c->connectContext = NULL;
+    pthread_mutex_unlock(&(c->mutex));
 
-    while (!MQTTAsync_isConnected(c->mqttClient) && c->errorMessage == NULL) {
-        sleep(1);
+    if (callback != NULL) {
+        callback(c, rc, context);
     }
+}
 
-    if (MQTTAsync_isConnected(c->mqttClient)) {
-        // Wait sub complete.
-        while (!device_management_is_connected2(c) && c->errorMessage == NULL) {
-            sleep(1);
+/* Retry the failed connect of the client when it's due. Return when to look again, INT64_MAX if there's no retry. */
+int64_t device_management_reconnect_house_keep(device_management_client_t *c, int64_t now) {
+    int64_t next = INT64_MAX;
+
+    pthread_mutex_lock(&(c->mutex));
+    if (c->reconnectAt != 0 && c->reconnectAt > now) {
+        next = c->reconnectAt;
+    } else if (c->reconnectAt != 0) {
+        c->reconnectAt = 0;
+        if (!c->connecting && !MQTTAsync_isConnected(c->mqttClient)) {
+            log4c_category_log(category, LOG4C_PRIORITY_INFO, "retrying to connect. deviceName=%s.", c->deviceName);
+            c->connecting = true;
+            if (device_management_mqtt_connect(c) != SUCCESS) {
+                c->connecting = false;
+                c->reconnectAt = now + c->reconnectDelayMs;
+                next = c->reconnectAt;
+            }
         }
-        return SUCCESS;
-    } else if (c->errorMessage != NULL) {
-        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "MQTT connect failed. code=%d, message=%s.", c->errorCode,
-                           c->errorMessage);
-        return FAILURE;
     }
+    pthread_mutex_unlock(&(c->mutex));
 
-    return SUCCESS;
+    return next;
 }
 
 DmReturnCode
@@ -361,6 +850,8 @@ device_management_shadow_update(DeviceManagementClient client, ShadowActionCallb
     DmReturnCode rc;
 
     cJSON *payload;
+    cJSON *changes = NULL;
+    cJSON *sent = reported;
 
     if (reported == NULL && desired == NULL) {
         return NULL_POINTER;
@@ -369,20 +860,84 @@ device_management_shadow_update(DeviceManagementClient client, ShadowActionCallb
         return BAD_ARGUMENT;
     }
 
+    /* With the cache on, only what the shadow doesn't have yet goes. */
+    if (reported != NULL) {
+        changes = shadow_cache_changes(client, reported);
+    }
+    if (changes != NULL) {
+        sent = changes->child != NULL ? changes : NULL;
+        if (sent == NULL && desired == NULL) {
+            cJSON_Delete(changes);
+            shadow_cache_unchanged(client, callback, context);
+            return SUCCESS;
+        }
+    }
+
+    /* Queued behind what is still waiting for the connection, so that the last value wins. */
+    if (desired == NULL && cJSON_IsObject(sent) && client->offline.maxProperties > 0 &&
+        (!device_management_is_connected2(client) || offline_queue_pending(client))) {
+        CoalescedUpdateBatch caller;
+        CoalescedUpdateBatch *lingering = NULL;
+        cJSON *older;
+        uint8_t olderTimeout = 0;
+        bool queued;
+
+        caller.count = 1;
+        caller.callbacks[0] = callback;
+        caller.contexts[0] = context;
+        /* What still lingers in the coalescer is older, it goes into the queue first. */
+        pthread_mutex_lock(&(client->update.mutex));
+        older = coalesced_update_take(client, &lingering, &olderTimeout);
+        if (older != NULL && offline_queue_add(client, older, lingering, olderTimeout, true)) {
+            cJSON_Delete(older);
+            free(lingering);
+            older = NULL;
+        }
+        queued = offline_queue_add(client, sent, &caller, timeout, false);
+        pthread_mutex_unlock(&(client->update.mutex));
+        /* It didn't fit in the queue, it goes on its own ahead of the newer fragments. */
+        if (older != NULL) {
+            coalesced_update_send(client, older, lingering, olderTimeout);
+        }
+        if (queued) {
+            cJSON_Delete(changes);
+            /* The connection may have come up meanwhile, with nobody left to flush the queue. */
+            if (device_management_is_connected2(client)) {
+                offline_queue_flush(client);
+            }
+            return SUCCESS;
+        }
+    }
+
+    if (client->update.lingerMs > 0 && desired == NULL && cJSON_IsObject(sent)) {
+        rc = coalesced_update_add(client, callback, context, timeout, sent);
+        if (rc != SUCCESS && changes != NULL) {
+            shadow_cache_forget(client);
+        }
+        cJSON_Delete(changes);
+        return rc;
+    }
+
     payload = cJSON_CreateObject();
 
-    if (reported != NULL) {
-        cJSON_AddItemToObject(payload, REPORTED, reported);
+    if (sent != NULL) {
+        cJSON_AddItemToObject(payload, REPORTED, sent);
     }
     if (desired != NULL) {
         cJSON_AddItemToObject(payload, DESIRED, desired);
     }
 
-    rc = device_management_shadow_send(client, SHADOW_UPDATE, payload, callback, context, timeout);
+    rc = device_management_shadow_send(client, SHADOW_UPDATE, payload, NULL, callback, context, timeout * 1000);
 
-    cJSON_DetachItemViaPointer(payload, reported);
+    cJSON_DetachItemViaPointer(payload, sent);
     cJSON_DetachItemViaPointer(payload, desired);
     cJSON_Delete(payload);
+    cJSON_Delete(changes);
+
+    /* The changes were counted into the copy, it no longer tells what the shadow has. */
+    if (rc != SUCCESS && changes != NULL) {
+        shadow_cache_forget(client);
+    }
 
     if (rc != SUCCESS) {
         log4c_category_log(category, LOG4C_PRIORITY_ERROR, "device_management_shadow_update rc=%d", rc);
@@ -390,60 +945,272 @@ device_management_shadow_update(DeviceManagementClient client, ShadowActionCallb
     return rc;
 }
 
-DmReturnCode device_management_shadow_get(DeviceManagementClient client, ShadowActionCallback callback, void *context,
-                                          uint8_t timeout) {
+DmReturnCode device_management_shadow_update_raw(DeviceManagementClient client, ShadowActionCallback callback,
+                                                 void *context, uint8_t timeout, const char *document) {
     DmReturnCode rc;
-    cJSON *payload = cJSON_CreateObject();
+    const char *p;
 
-    rc = device_management_shadow_send(client, SHADOW_GET, payload, callback, context, timeout);
+    if (client == NULL || document == NULL) {
+        return NULL_POINTER;
+    }
+    for (p = document; isspace((unsigned char) *p); ++p) {
+    }
+    if (*p != '{') {
+        return BAD_ARGUMENT;
+    }
 
-    cJSON_Delete(payload);
+    /* The document isn't looked into, whatever it changes is unknown to the copy. */
+    shadow_cache_forget(client);
+    rc = device_management_shadow_send(client, SHADOW_UPDATE, NULL, document, callback, context, timeout * 1000);
 
     if (rc != SUCCESS) {
-        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "device_management_shadow_get rc=%d", rc);
+        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "device_management_shadow_update_raw rc=%d", rc);
     }
     return rc;
 }
 
-DmReturnCode
-device_management_shadow_delete(DeviceManagementClient client, ShadowActionCallback callback, void *context,
-                                uint8_t timeout) {
-    DmReturnCode rc;
-    cJSON *payload = cJSON_CreateObject();
-
-    rc = device_management_shadow_send(client, SHADOW_DELETE, payload, callback, context, timeout);
-
-    cJSON_Delete(payload);
-
-    if (rc != SUCCESS) {
-        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "device_management_shadow_delete rc=%d", rc);
+DmReturnCode device_management_set_lazy_parse(DeviceManagementClient client, bool lazy) {
+    if (client == NULL) {
+        return NULL_POINTER;
     }
-    return rc;
-}
 
-DmReturnCode device_management_shadow_register_delta(DeviceManagementClient client, const char *key,
-                                                     ShadowPropertyDeltaCallback cb) {
-    DmReturnCode rc = SUCCESS;
+    client->lazyParse = lazy;
+    return SUCCESS;
+}
 
-    if (client == NULL || cb == NULL) {
-        exit_null_pointer();
+DmReturnCode device_management_set_qos(DeviceManagementClient client, int qos) {
+    if (client == NULL) {
+        return NULL_POINTER;
     }
-
-    if (!device_management_is_connected(client)) {
-        return NOT_CONNECTED;
+    if (qos != 0 && qos != 1) {
+        return BAD_ARGUMENT;
+    }
+
+    /* What is already sent keeps its QoS, the subscriptions always use QOS. */
+    client->qos = qos;
+    return SUCCESS;
+}
+
+DmReturnCode device_management_shadow_report(DeviceManagementClient client, cJSON *reported) {
+    DmReturnCode rc;
+    uuid_t uuid;
+    char requestId[MAX_UUID_LENGTH];
+    cJSON *payload;
+
+    if (client == NULL || reported == NULL) {
+        return NULL_POINTER;
+    }
+    if (!cJSON_IsObject(reported)) {
+        return BAD_ARGUMENT;
     }
 
     device_management_client_t *c = client;
 
-    pthread_mutex_lock(&(c->properties.mutex));
-    if (c->properties.index >= MAX_SHADOW_PROPERTY_HANDLER) {
+    /* Loss is expected on this lane, it's not worth a warning per update. */
+    if (!device_management_is_connected2(c)) {
+        return NOT_CONNECTED;
+    }
+
+    /* Nobody hears whether it got there, so the copy can't tell what the shadow has any more. */
+    shadow_cache_forget(c);
+
+    /* No in flight message, and the ack, if the update topics are subscribed at all, is told apart by the id. */
+    uuid_generate(uuid);
+    uuid[8] = (uuid[8] & 0x1F) | FIRE_AND_FORGET_VARIANT;
+    uuid_unparse(uuid, requestId);
+
+    payload = cJSON_CreateObject();
+    cJSON_AddItemToObject(payload, REPORTED, reported);
+    rc = device_management_shadow_send_json(c, c->topicContract->update, requestId, payload, 0);
+    cJSON_DetachItemViaPointer(payload, reported);
+    cJSON_Delete(payload);
+
+    return rc;
+}
+
+DmReturnCode device_management_shadow_set_update_linger(DeviceManagementClient client, uint32_t lingerMs) {
+    if (client == NULL) {
+        return NULL_POINTER;
+    }
+
+    device_management_client_t *c = client;
+
+    /* What is pending still goes at its deadline. */
+    pthread_mutex_lock(&(c->update.mutex));
+    c->update.lingerMs = lingerMs;
+    pthread_mutex_unlock(&(c->update.mutex));
+
+    return SUCCESS;
+}
+
+DmReturnCode device_management_shadow_set_offline_queue(DeviceManagementClient client, uint32_t maxProperties) {
+    if (client == NULL) {
+        return NULL_POINTER;
+    }
+
+    device_management_client_t *c = client;
+
+    /* What is queued still goes once connected. */
+    pthread_mutex_lock(&(c->offline.mutex));
+    c->offline.maxProperties = maxProperties;
+    pthread_mutex_unlock(&(c->offline.mutex));
+
+    return SUCCESS;
+}
+
+DmReturnCode device_management_shadow_set_cache(DeviceManagementClient client, bool enable) {
+    if (client == NULL) {
+        return NULL_POINTER;
+    }
+
+    device_management_client_t *c = client;
+
+    pthread_mutex_lock(&(c->cache.mutex));
+    if (c->cache.enabled != enable) {
+        c->cache.enabled = enable;
+        shadow_cache_forget(c);
+        if (!enable) {
+            cJSON_Delete(c->cache.reported);
+            cJSON_Delete(c->cache.desired);
+            c->cache.reported = NULL;
+            c->cache.desired = NULL;
+        }
+    }
+    pthread_mutex_unlock(&(c->cache.mutex));
+
+    return SUCCESS;
+}
+
+cJSON *device_management_shadow_cached(DeviceManagementClient client, int *profileVersion) {
+    cJSON *copy = NULL;
+
+    if (client == NULL) {
+        return NULL;
+    }
+
+    device_management_client_t *c = client;
+
+    pthread_mutex_lock(&(c->cache.mutex));
+    if (c->cache.enabled) {
+        copy = cJSON_CreateObject();
+        cJSON_AddItemToObject(copy, REPORTED, cJSON_Duplicate(c->cache.reported, 1));
+        cJSON_AddItemToObject(copy, DESIRED, cJSON_Duplicate(c->cache.desired, 1));
+    }
+    if (profileVersion != NULL) {
+        *profileVersion = c->cache.version;
+    }
+    pthread_mutex_unlock(&(c->cache.mutex));
+
+    return copy;
+}
+
+DmReturnCode device_management_shadow_resync(DeviceManagementClient client, ShadowActionCallback callback,
+                                             void *context, uint8_t timeout) {
+    DmReturnCode rc;
+    uuid_t uuid;
+    char document[64];
+
+    if (client == NULL) {
+        return NULL_POINTER;
+    }
+
+    device_management_client_t *c = client;
+
+    /* The id is known before the GET goes, its ack may come before the send returns. */
+    uuid_generate(uuid);
+    pthread_mutex_lock(&(c->cache.mutex));
+    if (c->cache.enabled && c->cache.version >= 0) {
+        snprintf(document, sizeof(document), "{\"profileVersion\":%d}", c->cache.version);
+        c->cache.resyncing = true;
+        uuid_copy(c->cache.resyncId, uuid);
+    } else {
+        strcpy(document, "{}");
+    }
+    pthread_mutex_unlock(&(c->cache.mutex));
+
+    rc = device_management_shadow_send_as(c, uuid, SHADOW_GET, NULL, document, callback, context, timeout * 1000);
+
+    if (rc != SUCCESS) {
+        pthread_mutex_lock(&(c->cache.mutex));
+        if (c->cache.resyncing && uuid_compare(c->cache.resyncId, uuid) == 0) {
+            c->cache.resyncing = false;
+        }
+        pthread_mutex_unlock(&(c->cache.mutex));
+        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "device_management_shadow_resync rc=%d", rc);
+    }
+    return rc;
+}
+
+DmReturnCode device_management_shadow_get(DeviceManagementClient client, ShadowActionCallback callback, void *context,
+                                          uint8_t timeout) {
+    DmReturnCode rc;
+
+    rc = device_management_shadow_send(client, SHADOW_GET, NULL, "{}", callback, context, timeout * 1000);
+
+    if (rc != SUCCESS) {
+        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "device_management_shadow_get rc=%d", rc);
+    }
+    return rc;
+}
+
+DmReturnCode
+device_management_shadow_delete(DeviceManagementClient client, ShadowActionCallback callback, void *context,
+                                uint8_t timeout) {
+    DmReturnCode rc;
+
+    rc = device_management_shadow_send(client, SHADOW_DELETE, NULL, "{}", callback, context, timeout * 1000);
+
+    if (rc != SUCCESS) {
+        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "device_management_shadow_delete rc=%d", rc);
+    }
+    return rc;
+}
+
+DmReturnCode device_management_shadow_register_delta(DeviceManagementClient client, const char *key,
+                                                     ShadowPropertyDeltaCallback cb) {
+    DmReturnCode rc = SUCCESS;
+    int *chain;
+    int position;
+
+    if (client == NULL || cb == NULL) {
+        exit_null_pointer();
+    }
+
+    if (!device_management_is_connected(client)) {
+        return NOT_CONNECTED;
+    }
+
+    device_management_client_t *c = client;
+    PropertyHandlerTable *table = &(c->properties);
+
+    pthread_mutex_lock(&(table->mutex));
+    if (table->index >= MAX_SHADOW_PROPERTY_HANDLER) {
         rc = TOO_MANY_SHADOW_PROPERTY_HANDLER;
     } else {
-        c->properties.vault[c->properties.index].key = key == NULL ? NULL : strdup(key);
-        c->properties.vault[c->properties.index].cb = cb;
-        c->properties.index++;
+        if (key == NULL) {
+            chain = &(table->root);
+        } else {
+            position = property_handler_find(table, key);
+            if (table->keys[position] == PROPERTY_NONE) {
+                table->keys[position] = table->index;
+            }
+            chain = &(table->keys[position]);
+        }
+        /* Append it to the handlers of the key. */
+        while (*chain != PROPERTY_NONE && *chain != table->index) {
+            chain = &(table->vault[*chain].next);
+        }
+        *chain = table->index;
+        table->vault[table->index].key = key == NULL ? NULL : strdup(key);
+        table->vault[table->index].cb = cb;
+        table->vault[table->index].next = PROPERTY_NONE;
+        table->index++;
+    }
+    pthread_mutex_unlock(&(table->mutex));
+
+    if (rc == SUCCESS) {
+        device_management_want_topics(c, TOPIC_GROUP_BIT(TOPIC_GROUP_DELTA));
     }
-    pthread_mutex_unlock(&(c->properties.mutex));
 
     if (rc != SUCCESS) {
         log4c_category_log(category, LOG4C_PRIORITY_ERROR, "device_management_shadow_register_delta rc=%d", rc);
@@ -456,7 +1223,21 @@ DmReturnCode device_management_destroy(DeviceManagementClient client) {
     device_management_client_t *c = client;
     if (c == NULL) {
         log4c_category_log(category, LOG4C_PRIORITY_ERROR, "bad client.");
+    } else if (c->shared.count > 0) {
+        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "%d clients still share the connection of %s.",
+                           c->shared.count, c->deviceName);
+        return FAILURE;
     } else {
+        /* No more messages are routed to it, and then no more deltas are queued for it. */
+        if (c->owner != NULL) {
+            client_group_remove(&(c->owner->shared), c);
+            device_management_unsubscribe(c);
+        } else {
+            MQTTAsync_disconnect(c->mqttClient, NULL);
+            MQTTAsync_destroy(&(c->mqttClient));
+        }
+        delta_queue_forget(c);
+
         pthread_mutex_lock(&(c->properties.mutex));
         for (i = 0; i < c->properties.index; ++i) {
             safe_free(&(c->properties.vault[i].key));
@@ -465,13 +1246,31 @@ DmReturnCode device_management_destroy(DeviceManagementClient client) {
         pthread_mutex_unlock(&(c->properties.mutex));
 
         client_group_remove(&allClients, c);
+        if (c->update.reported != NULL) {
+            log4c_category_log(category, LOG4C_PRIORITY_WARN, "dropped the coalesced update of %d callers.",
+                               c->update.batch->count);
+            cJSON_Delete(c->update.reported);
+            free(c->update.batch);
+        }
+        pthread_mutex_destroy(&(c->update.mutex));
+        if (c->offline.reported != NULL) {
+            log4c_category_log(category, LOG4C_PRIORITY_WARN, "dropped the offline update of %d callers.",
+                               c->offline.batch->count);
+            cJSON_Delete(c->offline.reported);
+            free(c->offline.batch);
+        }
+        pthread_mutex_destroy(&(c->offline.mutex));
+        cJSON_Delete(c->cache.reported);
+        cJSON_Delete(c->cache.desired);
+        pthread_mutex_destroy(&(c->cache.mutex));
         safe_free(&(c->username));
         safe_free(&(c->password));
         safe_free(&(c->deviceName));
         safe_free(&(c->trustStore));
         safe_free(&(c->errorMessage));
-        MQTTAsync_disconnect(c->mqttClient, NULL);
-        MQTTAsync_destroy(&(c->mqttClient));
+        safe_free(&(c->sendBuffer));
+        shadow_document_destroy(&(c->document));
+        client_group_destroy(&(c->shared));
         topic_contract_destroy(c->topicContract);
         pthread_mutex_destroy(&(c->mutex));
         free(client);
@@ -527,25 +1326,46 @@ void topic_contract_destroy(TopicContract *topics) {
     }
 }
 
-void client_group_iterate(ClientGroup *clients, void (*fp)(device_management_client_t *c)) {
-    int i;
-    pthread_mutex_lock(&(clients->mutex));
-    for (i = 0; i < MAX_CLIENT; ++i) {
-        if (clients->members[i] != NULL) {
-            fp(clients->members[i]);
-        }
-    }
-    pthread_mutex_unlock(&(clients->mutex));
+void client_group_init(ClientGroup *group) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    group->members = NULL;
+    group->count = 0;
+    group->capacity = 0;
+    pthread_mutex_init(&(group->mutex), &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void client_group_destroy(ClientGroup *group) {
+    free(group->members);
+    group->members = NULL;
+    group->count = 0;
+    group->capacity = 0;
+    pthread_mutex_destroy(&(group->mutex));
 }
 
 bool client_group_add(ClientGroup *group, device_management_client_t *client) {
+    pthread_mutex_lock(&(group->mutex));
+    if (group->count == group->capacity) {
+        group->capacity = group->capacity == 0 ? 8 : group->capacity * 2;
+        group->members = realloc(group->members, group->capacity * sizeof(device_management_client_t *));
+        check_malloc_result(group->members);
+    }
+    group->members[group->count++] = client;
+    pthread_mutex_unlock(&(group->mutex));
+
+    return true;
+}
+
+bool client_group_remove(ClientGroup *group, device_management_client_t *client) {
     int i;
     bool rc = false;
 
     pthread_mutex_lock(&(group->mutex));
-    for (i = 0; i < MAX_CLIENT; ++i) {
-        if (group->members[i] == NULL) {
-            group->members[i] = client;
+    for (i = 0; i < group->count; ++i) {
+        if (group->members[i] == client) {
+            group->members[i] = group->members[--group->count];
             rc = true;
             break;
         }
@@ -555,53 +1375,641 @@ bool client_group_add(ClientGroup *group, device_management_client_t *client) {
     return rc;
 }
 
-bool client_group_remove(ClientGroup *group, device_management_client_t *client) {
+static uint32_t in_flight_message_hash(const uuid_t requestId) {
+    /* The request ids are random UUIDs, folding their bytes is enough. */
+    uint32_t h = 2166136261u;
     int i;
-    bool rc = false;
+    for (i = 0; i < sizeof(uuid_t); ++i) {
+        h = (h ^ requestId[i]) * 16777619u;
+    }
+    return h % IN_FLIGHT_INDEX_SIZE;
+}
 
-    pthread_mutex_lock(&(group->mutex));
-    for (i = 0; i < MAX_CLIENT; ++i) {
-        if (group->members[i] == client) {
-            group->members[i] = NULL;
-            rc = true;
+void in_flight_message_list_init(InFlightMessageList *table) {
+    int i;
+    for (i = 0; i < MAX_IN_FLIGHT_MESSAGE; ++i) {
+        table->vault[i].free = true;
+        table->vault[i].nextFree = i + 1 < MAX_IN_FLIGHT_MESSAGE ? i + 1 : IN_FLIGHT_NONE;
+    }
+    for (i = 0; i < IN_FLIGHT_INDEX_SIZE; ++i) {
+        table->index[i] = IN_FLIGHT_NONE;
+    }
+    table->freeHead = 0;
+    table->heapSize = 0;
+}
+
+static void in_flight_message_heap_set(InFlightMessageList *table, int position, int slot) {
+    table->heap[position] = slot;
+    table->vault[slot].heapIndex = position;
+}
+
+static void in_flight_message_heap_up(InFlightMessageList *table, int position) {
+    int slot = table->heap[position];
+    int parent;
+    while (position > 0) {
+        parent = (position - 1) / 2;
+        if (table->vault[table->heap[parent]].deadline <= table->vault[slot].deadline) {
+            break;
+        }
+        in_flight_message_heap_set(table, position, table->heap[parent]);
+        position = parent;
+    }
+    in_flight_message_heap_set(table, position, slot);
+}
+
+static void in_flight_message_heap_down(InFlightMessageList *table, int position) {
+    int slot = table->heap[position];
+    int child;
+    while ((child = 2 * position + 1) < table->heapSize) {
+        if (child + 1 < table->heapSize &&
+            table->vault[table->heap[child + 1]].deadline < table->vault[table->heap[child]].deadline) {
+            child++;
+        }
+        if (table->vault[slot].deadline <= table->vault[table->heap[child]].deadline) {
             break;
         }
+        in_flight_message_heap_set(table, position, table->heap[child]);
+        position = child;
+    }
+    in_flight_message_heap_set(table, position, slot);
+}
+
+/* Return the position in the index of the message with the request id, IN_FLIGHT_NONE if there's none. */
+int in_flight_message_find(InFlightMessageList *table, const uuid_t requestId) {
+    int position = in_flight_message_hash(requestId);
+    while (table->index[position] != IN_FLIGHT_NONE) {
+        if (uuid_compare(table->vault[table->index[position]].requestId, requestId) == 0) {
+            return position;
+        }
+        position = (position + 1) % IN_FLIGHT_INDEX_SIZE;
+    }
+    return IN_FLIGHT_NONE;
+}
+
+/*
+ * Free the message at the position of the index. The entries probed past it are shifted back instead of leaving a
+ * tombstone, so that no lookup ever crosses more entries than the messages in flight.
+ */
+void in_flight_message_remove(InFlightMessageList *table, int position) {
+    int slot = table->index[position];
+    int hole = position;
+    int next = position;
+    int home;
+
+    while (1) {
+        next = (next + 1) % IN_FLIGHT_INDEX_SIZE;
+        if (table->index[next] == IN_FLIGHT_NONE) {
+            break;
+        }
+        home = in_flight_message_hash(table->vault[table->index[next]].requestId);
+        /* The entry can fill the hole unless its home lies cyclically in (hole, next]. */
+        if (hole <= next ? (home <= hole || home > next) : (home <= hole && home > next)) {
+            table->index[hole] = table->index[next];
+            hole = next;
+        }
+    }
+    table->index[hole] = IN_FLIGHT_NONE;
+
+    /* Fill its place in the heap with the last one. */
+    hole = table->vault[slot].heapIndex;
+    table->heapSize--;
+    if (hole < table->heapSize) {
+        in_flight_message_heap_set(table, hole, table->heap[table->heapSize]);
+        in_flight_message_heap_up(table, hole);
+        in_flight_message_heap_down(table, table->vault[table->heap[hole]].heapIndex);
+    }
+
+    table->vault[slot].free = true;
+    table->vault[slot].nextFree = table->freeHead;
+    table->freeHead = slot;
+}
+
+int64_t monotonic_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * Send the coalesced update and time out the messages that are due. Return the next deadline, INT64_MAX if there's
+ * nothing pending or in flight.
+ */
+int64_t in_flight_message_house_keep(device_management_client_t *c) {
+    InFlightMessageList *table = &(c->messages);
+    InFlightMessage *m;
+    ShadowAction action;
+    ShadowActionCallback callback;
+    void *context;
+    char requestId[MAX_UUID_LENGTH];
+    int64_t now = monotonic_ms();
+    int64_t next = coalesced_update_house_keep(c, now);
+    int64_t reconnectAt = device_management_reconnect_house_keep(c, now);
+
+    if (reconnectAt < next) {
+        next = reconnectAt;
+    }
+
+    pthread_mutex_lock(&(table->mutex));
+    while (table->heapSize > 0) {
+        m = &(table->vault[table->heap[0]]);
+        if (m->deadline > now) {
+            if (m->deadline < next) {
+                next = m->deadline;
+            }
+            break;
+        }
+        uuid_unparse(m->requestId, requestId);
+        action = m->action;
+        callback = m->callback;
+        context = m->callbackContext;
+        /* Free the slot first, the callback may send again. */
+        in_flight_message_remove(table, in_flight_message_find(table, m->requestId));
+        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "%s timed out. requestId=%s.",
+                           shadowActionStrings[action], requestId);
+        if (action == SHADOW_UPDATE) {
+            shadow_cache_forget(c);
+        }
+        if (callback != NULL) {
+            callback(action, SHADOW_ACK_TIMEOUT, NULL, context);
+        }
+    }
+    pthread_mutex_unlock(&(table->mutex));
+
+    return next;
+}
+
+void *in_flight_message_house_keep_proc(void *ignore) {
+    int i;
+    int64_t next;
+    int64_t deadline;
+    struct timespec until;
+
+    pthread_mutex_lock(&keeperMutex);
+    while (!keeperStop) {
+        keeperKicked = false;
+        pthread_mutex_unlock(&keeperMutex);
+
+        next = INT64_MAX;
+        pthread_mutex_lock(&(allClients.mutex));
+        for (i = 0; i < allClients.count; ++i) {
+            deadline = in_flight_message_house_keep(allClients.members[i]);
+            if (deadline < next) {
+                next = deadline;
+            }
+        }
+        pthread_mutex_unlock(&(allClients.mutex));
+
+        pthread_mutex_lock(&keeperMutex);
+        /* A message added meanwhile may be due before next, look again instead of sleeping. */
+        if (!keeperKicked && !keeperStop) {
+            if (next == INT64_MAX) {
+                pthread_cond_wait(&keeperCond, &keeperMutex);
+            } else {
+                until.tv_sec = next / 1000;
+                until.tv_nsec = (next % 1000) * 1000000;
+                pthread_cond_timedwait(&keeperCond, &keeperMutex, &until);
+            }
+        }
+    }
+    pthread_mutex_unlock(&keeperMutex);
+
+    return NULL;
+}
+
+void in_flight_message_kick_keeper() {
+    pthread_mutex_lock(&keeperMutex);
+    keeperKicked = true;
+    pthread_cond_signal(&keeperCond);
+    pthread_mutex_unlock(&keeperMutex);
+}
+
+/*
+ * Send the coalesced reported fragments as one update. If disconnected they wait in the offline queue, if it has room,
+ * else the batch is told of the failure. They are older than anything queued meanwhile, which keeps its values.
+ */
+static void coalesced_update_send(device_management_client_t *c, cJSON *reported, CoalescedUpdateBatch *batch,
+                                  uint8_t timeout) {
+    DmReturnCode rc;
+    cJSON *payload = cJSON_CreateObject();
+
+    cJSON_AddItemToObject(payload, REPORTED, reported);
+    rc = device_management_shadow_send(c, SHADOW_UPDATE, payload, NULL, coalesced_update_ack, batch, timeout * 1000);
+    if (rc == NOT_CONNECTED && offline_queue_add(c, reported, batch, timeout, true)) {
+        log4c_category_log(category, LOG4C_PRIORITY_INFO, "queued the update of %d callers until connected.",
+                           batch->count);
+        free(batch);
+        rc = SUCCESS;
+    }
+    cJSON_Delete(payload);
+
+    if (rc != SUCCESS) {
+        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "failed to send the update of %d callers. rc=%d",
+                           batch->count, rc);
+        shadow_cache_forget(c);
+        coalesced_update_ack(SHADOW_UPDATE, SHADOW_ACK_TIMEOUT, NULL, batch);
+    }
+}
+
+DmReturnCode coalesced_update_add(device_management_client_t *c, ShadowActionCallback callback, void *context,
+                                  uint8_t timeout, cJSON *reported) {
+    cJSON *full = NULL;
+    CoalescedUpdateBatch *batch;
+    bool first = false;
+
+    if (!device_management_is_connected2(c)) {
+        log4c_category_log(category, LOG4C_PRIORITY_WARN, "can't send message to server when client is not connected.");
+        return NOT_CONNECTED;
+    }
+
+    pthread_mutex_lock(&(c->update.mutex));
+    if (c->update.reported == NULL) {
+        c->update.reported = cJSON_CreateObject();
+        c->update.batch = malloc(sizeof(CoalescedUpdateBatch));
+        check_malloc_result(c->update.batch);
+        c->update.batch->count = 0;
+        c->update.timeout = timeout;
+        c->update.deadline = monotonic_ms() + c->update.lingerMs;
+        first = true;
+    }
+    json_merge(c->update.reported, reported);
+    batch = c->update.batch;
+    batch->callbacks[batch->count] = callback;
+    batch->contexts[batch->count] = context;
+    batch->count++;
+    if (timeout < c->update.timeout) {
+        c->update.timeout = timeout;
+    }
+    if (batch->count >= MAX_COALESCED_UPDATE) {
+        full = c->update.reported;
+        timeout = c->update.timeout;
+        c->update.reported = NULL;
+        c->update.batch = NULL;
+    }
+    pthread_mutex_unlock(&(c->update.mutex));
+
+    if (full != NULL) {
+        coalesced_update_send(c, full, batch, timeout);
+    } else if (first) {
+        in_flight_message_kick_keeper();
+    }
+
+    return SUCCESS;
+}
+
+/* Send the coalesced update if its linger window is over. Return its deadline if it's still pending. */
+int64_t coalesced_update_house_keep(device_management_client_t *c, int64_t now) {
+    cJSON *reported = NULL;
+    CoalescedUpdateBatch *batch = NULL;
+    uint8_t timeout = 0;
+    int64_t next = INT64_MAX;
+
+    pthread_mutex_lock(&(c->update.mutex));
+    if (c->update.reported != NULL) {
+        if (c->update.deadline > now) {
+            next = c->update.deadline;
+        } else {
+            reported = coalesced_update_take(c, &batch, &timeout);
+        }
+    }
+    pthread_mutex_unlock(&(c->update.mutex));
+
+    if (reported != NULL) {
+        coalesced_update_send(c, reported, batch, timeout);
+    }
+    return next;
+}
+
+/* Take the coalesced update still lingering, NULL if there is none. The caller holds update.mutex. */
+cJSON *coalesced_update_take(device_management_client_t *c, CoalescedUpdateBatch **batch, uint8_t *timeout) {
+    cJSON *reported = c->update.reported;
+
+    *batch = c->update.batch;
+    *timeout = c->update.timeout;
+    c->update.reported = NULL;
+    c->update.batch = NULL;
+
+    return reported;
+}
+
+/* Fan the ack of a coalesced update out to every caller merged into it. */
+void coalesced_update_ack(ShadowAction action, ShadowAckStatus status, ShadowActionAck *ack, void *context) {
+    int i;
+    CoalescedUpdateBatch *batch = context;
+
+    for (i = 0; i < batch->count; ++i) {
+        if (batch->callbacks[i] != NULL) {
+            batch->callbacks[i](action, status, ack, batch->contexts[i]);
+        }
+    }
+    free(batch);
+}
+
+/*
+ * Merge a copy of reported into the offline queue, with the callers to tell of its ack. If it's older than what is
+ * queued, the values queued are kept. Return false if the queue is off, or it would hold more properties or callers
+ * than it may.
+ */
+bool offline_queue_add(device_management_client_t *c, const cJSON *reported, const CoalescedUpdateBatch *callers,
+                       uint8_t timeout, bool older) {
+    OfflineQueue *queue = &(c->offline);
+    const cJSON *item;
+    uint32_t added = 0;
+    bool queued = false;
+
+    pthread_mutex_lock(&(queue->mutex));
+    if (queue->maxProperties > 0) {
+        for (item = reported->child; item != NULL; item = item->next) {
+            if (queue->reported == NULL || cJSON_GetObjectItemCaseSensitive(queue->reported, item->string) == NULL) {
+                added++;
+            }
+        }
+        if (queue->properties + added <= queue->maxProperties &&
+            (queue->batch != NULL ? queue->batch->count : 0) + callers->count <= MAX_COALESCED_UPDATE) {
+            if (queue->reported == NULL) {
+                queue->reported = cJSON_CreateObject();
+                queue->batch = malloc(sizeof(CoalescedUpdateBatch));
+                check_malloc_result(queue->batch);
+                queue->batch->count = 0;
+                queue->timeout = timeout;
+            }
+            if (older) {
+                json_merge_under(queue->reported, reported);
+            } else {
+                json_merge(queue->reported, reported);
+            }
+            queue->properties += added;
+            memcpy(queue->batch->callbacks + queue->batch->count, callers->callbacks,
+                   callers->count * sizeof(ShadowActionCallback));
+            memcpy(queue->batch->contexts + queue->batch->count, callers->contexts, callers->count * sizeof(void *));
+            queue->batch->count += callers->count;
+            if (timeout < queue->timeout) {
+                queue->timeout = timeout;
+            }
+            queued = true;
+        } else {
+            log4c_category_log(category, LOG4C_PRIORITY_WARN, "the offline queue of %s is full. properties=%u.",
+                               c->deviceName, queue->properties);
+        }
+    }
+    pthread_mutex_unlock(&(queue->mutex));
+
+    return queued;
+}
+
+bool offline_queue_pending(device_management_client_t *c) {
+    bool pending;
+
+    pthread_mutex_lock(&(c->offline.mutex));
+    pending = c->offline.reported != NULL;
+    pthread_mutex_unlock(&(c->offline.mutex));
+
+    return pending;
+}
+
+/* Send what was queued while disconnected as one update. */
+void offline_queue_flush(device_management_client_t *c) {
+    cJSON *reported;
+    CoalescedUpdateBatch *batch;
+    uint8_t timeout;
+
+    pthread_mutex_lock(&(c->offline.mutex));
+    reported = c->offline.reported;
+    batch = c->offline.batch;
+    timeout = c->offline.timeout;
+    c->offline.reported = NULL;
+    c->offline.batch = NULL;
+    c->offline.properties = 0;
+    pthread_mutex_unlock(&(c->offline.mutex));
+
+    if (reported != NULL) {
+        log4c_category_log(category, LOG4C_PRIORITY_INFO, "sending the offline update of %d callers.", batch->count);
+        coalesced_update_send(c, reported, batch, timeout);
+    }
+}
+
+/* Merge a copy of the members of patch into target. Objects are merged member by member, anything else replaced. */
+void json_merge(cJSON *target, const cJSON *patch) {
+    cJSON *item;
+    cJSON *existing;
+
+    for (item = patch->child; item != NULL; item = item->next) {
+        existing = cJSON_GetObjectItemCaseSensitive(target, item->string);
+        if (existing == NULL) {
+            cJSON_AddItemToObject(target, item->string, cJSON_Duplicate(item, 1));
+        } else if (cJSON_IsObject(existing) && cJSON_IsObject(item)) {
+            json_merge(existing, item);
+        } else {
+            cJSON_ReplaceItemInObjectCaseSensitive(target, item->string, cJSON_Duplicate(item, 1));
+        }
+    }
+}
+
+/* Like json_merge, except that the members target has already are kept, patch being the older one. */
+void json_merge_under(cJSON *target, const cJSON *patch) {
+    cJSON *item;
+    cJSON *existing;
+
+    for (item = patch->child; item != NULL; item = item->next) {
+        existing = cJSON_GetObjectItemCaseSensitive(target, item->string);
+        if (existing == NULL) {
+            cJSON_AddItemToObject(target, item->string, cJSON_Duplicate(item, 1));
+        } else if (cJSON_IsObject(existing) && cJSON_IsObject(item)) {
+            json_merge_under(existing, item);
+        }
+    }
+}
+
+/* Like json_merge, except that a null deletes the member, as it does in the shadow. */
+static void shadow_cache_merge(cJSON *target, const cJSON *patch) {
+    cJSON *item;
+    cJSON *existing;
+
+    for (item = patch->child; item != NULL; item = item->next) {
+        if (item->string == NULL) {
+            continue;
+        }
+        existing = cJSON_GetObjectItemCaseSensitive(target, item->string);
+        if (cJSON_IsNull(item)) {
+            if (existing != NULL) {
+                cJSON_DeleteItemFromObjectCaseSensitive(target, item->string);
+            }
+        } else if (existing == NULL) {
+            cJSON_AddItemToObject(target, item->string, cJSON_Duplicate(item, 1));
+        } else if (cJSON_IsObject(existing) && cJSON_IsObject(item)) {
+            shadow_cache_merge(existing, item);
+        } else {
+            cJSON_ReplaceItemInObjectCaseSensitive(target, item->string, cJSON_Duplicate(item, 1));
+        }
+    }
+}
+
+/* The members of reported that differ from cached, objects compared member by member. A null it hasn't is no change. */
+static cJSON *shadow_cache_diff(const cJSON *cached, const cJSON *reported) {
+    cJSON *diff = cJSON_CreateObject();
+    cJSON *item;
+    cJSON *existing;
+    cJSON *nested;
+
+    for (item = reported->child; item != NULL; item = item->next) {
+        if (item->string == NULL) {
+            continue;
+        }
+        existing = cJSON_GetObjectItemCaseSensitive(cached, item->string);
+        if (existing == NULL) {
+            if (!cJSON_IsNull(item)) {
+                cJSON_AddItemToObject(diff, item->string, cJSON_Duplicate(item, 1));
+            }
+        } else if (cJSON_IsObject(existing) && cJSON_IsObject(item)) {
+            nested = shadow_cache_diff(existing, item);
+            if (nested->child != NULL) {
+                cJSON_AddItemToObject(diff, item->string, nested);
+            } else {
+                cJSON_Delete(nested);
+            }
+        } else if (!cJSON_Compare(existing, item, 1)) {
+            cJSON_AddItemToObject(diff, item->string, cJSON_Duplicate(item, 1));
+        }
+    }
+    return diff;
+}
+
+/*
+ * The members of reported the copy doesn't have yet, counted into it as they are sent. Return NULL if the cache is off,
+ * reported then goes as it is, or else an object for the caller to delete, empty if nothing changed.
+ */
+cJSON *shadow_cache_changes(device_management_client_t *c, const cJSON *reported) {
+    cJSON *changes = NULL;
+
+    pthread_mutex_lock(&(c->cache.mutex));
+    if (c->cache.enabled) {
+        if (cJSON_IsObject(reported)) {
+            changes = shadow_cache_diff(c->cache.reported, reported);
+            shadow_cache_merge(c->cache.reported, changes);
+        } else {
+            /* Whatever it does to the shadow is unknown to the copy. */
+            shadow_cache_forget(c);
+        }
+    }
+    pthread_mutex_unlock(&(c->cache.mutex));
+
+    return changes;
+}
+
+/* Answer an update with nothing to send as the shadow would, at once. */
+void shadow_cache_unchanged(device_management_client_t *c, ShadowActionCallback callback, void *context) {
+    ShadowActionAck ack;
+
+    memset(&ack, 0, sizeof(ack));
+    pthread_mutex_lock(&(c->cache.mutex));
+    ack.accepted.response.profileVersion = c->cache.version;
+    pthread_mutex_unlock(&(c->cache.mutex));
+
+    log4c_category_log(category, LOG4C_PRIORITY_DEBUG, "the shadow of %s has the reported already.", c->deviceName);
+    if (callback != NULL) {
+        callback(SHADOW_UPDATE, SHADOW_ACK_ACCEPTED, &ack, context);
+    }
+}
+
+/* Empty the copy, its version is unknown until the next ack. */
+void shadow_cache_forget(device_management_client_t *c) {
+    pthread_mutex_lock(&(c->cache.mutex));
+    if (c->cache.enabled) {
+        cJSON_Delete(c->cache.reported);
+        cJSON_Delete(c->cache.desired);
+        c->cache.reported = cJSON_CreateObject();
+        c->cache.desired = cJSON_CreateObject();
+        c->cache.version = -1;
+        c->cache.resyncing = false;
+    }
+    pthread_mutex_unlock(&(c->cache.mutex));
+}
+
+/*
+ * Bring the copy up to date with an ack, called under the lock of the messages. A refused update leaves the copy
+ * holding what the shadow may not have, so it's emptied.
+ */
+void shadow_cache_ack(device_management_client_t *c, const uuid_t requestId, ShadowAction action,
+                      ShadowAckStatus status, cJSON *payload, ShadowDocument *document) {
+    cJSON *reported;
+    cJSON *desired;
+    cJSON *parsedReported = NULL;
+    cJSON *parsedDesired = NULL;
+    cJSON *item;
+    double version = -1;
+    bool resync;
+
+    pthread_mutex_lock(&(c->cache.mutex));
+    if (!c->cache.enabled) {
+        pthread_mutex_unlock(&(c->cache.mutex));
+        return;
+    }
+    resync = action == SHADOW_GET && c->cache.resyncing && uuid_compare(c->cache.resyncId, requestId) == 0;
+    if (resync) {
+        c->cache.resyncing = false;
+    }
+    if (status != SHADOW_ACK_ACCEPTED) {
+        if (action == SHADOW_UPDATE) {
+            shadow_cache_forget(c);
+        }
+        pthread_mutex_unlock(&(c->cache.mutex));
+        return;
     }
-    pthread_mutex_unlock(&(group->mutex));
-
-    return rc;
-}
-
 
-void in_flight_message_house_keep(device_management_client_t *c) {
-    int i;
-    time_t now;
-    time(&now);
-    pthread_mutex_lock(&(c->messages.mutex));
-    for (i = 0; i < MAX_IN_FLIGHT_MESSAGE; ++i) {
-        if (!c->messages.vault[i].free) {
-            double elipse = difftime(now, c->messages.vault[i].timestamp);
-            if (elipse > c->messages.vault[i].timeout) {
-                log4c_category_log(category, LOG4C_PRIORITY_ERROR, "%s timed out. requestId=%s.",
-                                   shadowActionStrings[c->messages.vault[i].action], c->messages.vault[i].requestId);
-                if (c->messages.vault[i].callback != NULL) {
-                    c->messages.vault[i].callback(c->messages.vault[i].action, SHADOW_ACK_TIMEOUT, NULL,
-                                                  c->messages.vault[i].callbackContext);
-                }
-                c->messages.vault[i].free = true;
-            }
+    if (document != NULL) {
+        reported = parsedReported = device_management_document_parse(document, REPORTED);
+        desired = parsedDesired = device_management_document_parse(document, DESIRED);
+        if (!device_management_document_get_number(document, "profileVersion", &version)) {
+            version = -1;
+        }
+    } else {
+        reported = cJSON_GetObjectItemCaseSensitive(payload, REPORTED);
+        desired = cJSON_GetObjectItemCaseSensitive(payload, DESIRED);
+        item = cJSON_GetObjectItemCaseSensitive(payload, "profileVersion");
+        if (cJSON_IsNumber(item)) {
+            version = item->valuedouble;
         }
     }
 
-    pthread_mutex_unlock(&(c->messages.mutex));
+    if (action == SHADOW_DELETE) {
+        shadow_cache_forget(c);
+    } else if (action == SHADOW_GET && !resync) {
+        cJSON_Delete(c->cache.reported);
+        cJSON_Delete(c->cache.desired);
+        c->cache.reported = cJSON_IsObject(reported) ? cJSON_Duplicate(reported, 1) : cJSON_CreateObject();
+        c->cache.desired = cJSON_IsObject(desired) ? cJSON_Duplicate(desired, 1) : cJSON_CreateObject();
+    } else {
+        /* An update echoes what it changed, a resync what changed since the version of the copy. */
+        if (cJSON_IsObject(reported)) {
+            shadow_cache_merge(c->cache.reported, reported);
+        }
+        if (cJSON_IsObject(desired)) {
+            shadow_cache_merge(c->cache.desired, desired);
+        }
+    }
+    if (action != SHADOW_DELETE && version >= 0) {
+        c->cache.version = (int) version;
+    }
+    pthread_mutex_unlock(&(c->cache.mutex));
 
+    cJSON_Delete(parsedReported);
+    cJSON_Delete(parsedDesired);
 }
 
-void *in_flight_message_house_keep_proc(void *ignore) {
-    while (1) {
-        client_group_iterate(&allClients, in_flight_message_house_keep);
-        sleep(1);
+/* A delta carries what desired became. */
+void shadow_cache_delta(device_management_client_t *c, cJSON *payload) {
+    cJSON *desired = cJSON_GetObjectItemCaseSensitive(payload, DESIRED);
+    cJSON *version = cJSON_GetObjectItemCaseSensitive(payload, "profileVersion");
+
+    pthread_mutex_lock(&(c->cache.mutex));
+    if (c->cache.enabled) {
+        if (cJSON_IsObject(desired)) {
+            shadow_cache_merge(c->cache.desired, desired);
+        }
+        if (cJSON_IsNumber(version)) {
+            c->cache.version = version->valueint;
+        }
     }
+    pthread_mutex_unlock(&(c->cache.mutex));
 }
 
 static const char *EMPTY_UUID = "00000000-0000-0000-0000-000000000000";
@@ -615,25 +2023,37 @@ void exit_null_pointer() {
     exit(NULL_POINTER);
 }
 
-DmReturnCode in_flight_message_add(InFlightMessageList *table, const char *requestId, ShadowAction action,
+DmReturnCode in_flight_message_add(InFlightMessageList *table, const uuid_t requestId, ShadowAction action,
                                    ShadowActionCallback callback,
-                                   void *context, uint8_t timeout) {
+                                   void *context, uint32_t timeoutMs) {
     DmReturnCode rc = TOO_MANY_IN_FLIGHT_MESSAGE;
-    int i;
+    int slot;
+    int position;
 
     pthread_mutex_lock(&(table->mutex));
-    for (i = 0; i < MAX_IN_FLIGHT_MESSAGE; ++i) {
-        if (table->vault[i].free) {
-            table->vault[i].free = false;
-            table->vault[i].action = action;
-            table->vault[i].callback = callback;
-            table->vault[i].callbackContext = context;
-            table->vault[i].timeout = timeout;
-            time(&(table->vault[i].timestamp));
-            strncpy(table->vault[i].requestId, requestId, MAX_UUID_LENGTH);
-            rc = SUCCESS;
-            break;
+    slot = table->freeHead;
+    if (slot != IN_FLIGHT_NONE) {
+        table->freeHead = table->vault[slot].nextFree;
+        table->vault[slot].free = false;
+        table->vault[slot].action = action;
+        table->vault[slot].callback = callback;
+        table->vault[slot].callbackContext = context;
+        table->vault[slot].deadline = monotonic_ms() + timeoutMs;
+        uuid_copy(table->vault[slot].requestId, requestId);
+
+        position = in_flight_message_hash(requestId);
+        while (table->index[position] != IN_FLIGHT_NONE) {
+            position = (position + 1) % IN_FLIGHT_INDEX_SIZE;
         }
+        table->index[position] = slot;
+
+        in_flight_message_heap_set(table, table->heapSize++, slot);
+        in_flight_message_heap_up(table, table->vault[slot].heapIndex);
+        rc = SUCCESS;
+    }
+    /* The keeper sleeps until the deadline that was first, wake it if this one is due earlier. */
+    if (rc == SUCCESS && table->vault[slot].heapIndex == 0) {
+        in_flight_message_kick_keeper();
     }
     pthread_mutex_unlock(&(table->mutex));
 
@@ -659,54 +2079,148 @@ bool device_management_is_connected2(device_management_client_t *c) {
     return MQTTAsync_isConnected(c->mqttClient) && c->hasSubscribed ? true : false;
 }
 
-DmReturnCode device_management_shadow_send_json(device_management_client_t *c, const char *topic,
-                                                const char *requestId, cJSON *payload) {
-    DmReturnCode dmrc = SUCCESS;
+/* Grow the send buffer of the client to at least size bytes. Call it with c->mutex held. */
+static void device_management_reserve_send_buffer(device_management_client_t *c, int size) {
+    int allocated = c->sendBuffer == NULL ? 0 : c->sendBufferSize;
+    if (c->sendBuffer == NULL) {
+        c->sendBufferSize = SEND_BUFFER_INITIAL_SIZE;
+    }
+    while (c->sendBufferSize < size) {
+        c->sendBufferSize *= 2;
+    }
+    if (c->sendBufferSize != allocated) {
+        c->sendBuffer = realloc(c->sendBuffer, c->sendBufferSize);
+        check_malloc_result(c->sendBuffer);
+    }
+}
+
+/*
+ * Start the message in the send buffer with the request id, the members of the payload follow it. Return the
+ * length written. Call it with c->mutex held.
+ */
+static int device_management_write_request_id(device_management_client_t *c, const char *requestId) {
+    int length = strlen(REQUEST_ID_KEY) + strlen(requestId) + 6;
+    device_management_reserve_send_buffer(c, length + SEND_BUFFER_INITIAL_SIZE);
+    return snprintf(c->sendBuffer, c->sendBufferSize, "{\"%s\":\"%s\"", REQUEST_ID_KEY, requestId);
+}
+
+/*
+ * Publish the first length bytes of the send buffer, without the terminating NUL. MQTTAsync copies the payload,
+ * and the response options, so they need no allocation. Call it with c->mutex held.
+ */
+static DmReturnCode device_management_publish(device_management_client_t *c, const char *topic, const char *requestId,
+                                              int length, int qos) {
     MQTTAsync_message message = MQTTAsync_message_initializer;
-    MQTTAsync_responseOptions *responseOptions;
-    char *string;
+    MQTTAsync_responseOptions responseOptions = MQTTAsync_responseOptions_initializer;
     int rc;
 
-    cJSON_AddStringToObject(payload, REQUEST_ID_KEY, requestId);
-    string = cJSON_PrintUnformatted(payload);
-
-    message.payload = string;
-    message.payloadlen = strlen(string) + 1;
-    message.qos = QOS;
+    message.payload = c->sendBuffer;
+    message.payloadlen = length;
+    message.qos = qos;
     message.retained = 0;
 
-    responseOptions = malloc(sizeof(MQTTAsync_responseOptions));
-    responseOptions->onSuccess = mqtt_on_publish_success;
-    responseOptions->onFailure = mqtt_on_publish_failure;
-    responseOptions->context = responseOptions;
+    responseOptions.onSuccess = mqtt_on_publish_success;
+    responseOptions.onFailure = mqtt_on_publish_failure;
+    responseOptions.context = NULL;
 
-    rc = MQTTAsync_sendMessage(c->mqttClient, topic, &message, responseOptions);
+    rc = MQTTAsync_sendMessage(c->mqttClient, topic, &message, &responseOptions);
     if (rc != MQTTASYNC_SUCCESS) {
         log4c_category_log(category, LOG4C_PRIORITY_ERROR, "failed to send message. MQTT rc=%d, requestId=%s.", rc,
                            requestId);
-        dmrc = FAILURE;
+        return FAILURE;
+    }
+    log4c_category_log(category, LOG4C_PRIORITY_TRACE, "sending message \n>>topic:\n%s\n>>payload:\n%s",
+                       topic,
+                       c->sendBuffer);
+    return SUCCESS;
+}
+
+/* Send the payload with the request id in front of its members. The payload is left as it is. */
+DmReturnCode device_management_shadow_send_json(device_management_client_t *c, const char *topic,
+                                                const char *requestId, cJSON *payload, int qos) {
+    DmReturnCode rc;
+    int prefix;
+    int length;
+    char *members;
+
+    pthread_mutex_lock(&(c->mutex));
+    prefix = device_management_write_request_id(c, requestId);
+    /* Print the payload after the request id, the buffer grows until it fits. */
+    while (!cJSON_PrintPreallocated(payload, c->sendBuffer + prefix, c->sendBufferSize - prefix, 0)) {
+        device_management_reserve_send_buffer(c, c->sendBufferSize * 2);
+    }
+    /* Its opening brace becomes the comma after the request id, or the closing brace if it's empty. */
+    members = c->sendBuffer + prefix;
+    if (members[1] == '}') {
+        members[0] = '}';
+        members[1] = '\0';
+        length = prefix + 1;
     } else {
-        log4c_category_log(category, LOG4C_PRIORITY_TRACE, "sending message \n>>topic:\n%s\n>>payload:\n%s",
-                           topic,
-                           string);
+        members[0] = ',';
+        length = prefix + strlen(members);
+    }
+    rc = device_management_publish(c, topic, requestId, length, qos);
+    pthread_mutex_unlock(&(c->mutex));
+
+    return rc;
+}
+
+/* Send a JSON object already serialized by the caller, with the request id in front of its members. */
+DmReturnCode device_management_shadow_send_text(device_management_client_t *c, const char *topic,
+                                                const char *requestId, const char *document, int qos) {
+    DmReturnCode rc;
+    int prefix;
+    int length;
+    const char *members = document;
+
+    /* Skip the opening brace, device_management_shadow_update_raw checked it's there. */
+    while (*members != '{') {
+        ++members;
+    }
+    ++members;
+    while (isspace((unsigned char) *members)) {
+        ++members;
+    }
+    length = strlen(members);
 
+    pthread_mutex_lock(&(c->mutex));
+    prefix = device_management_write_request_id(c, requestId);
+    device_management_reserve_send_buffer(c, prefix + length + 2);
+    if (*members == '}') {
+        c->sendBuffer[prefix] = '}';
+        c->sendBuffer[prefix + 1] = '\0';
+        length = prefix + 1;
+    } else {
+        c->sendBuffer[prefix] = ',';
+        memcpy(c->sendBuffer + prefix + 1, members, length + 1);
+        length += prefix + 1;
     }
-    free(string);
+    rc = device_management_publish(c, topic, requestId, length, qos);
+    pthread_mutex_unlock(&(c->mutex));
 
-    return dmrc;
+    return rc;
 }
 
+/* Send either the payload, or the document serialized by the caller. */
 DmReturnCode device_management_shadow_send(DeviceManagementClient client, ShadowAction action, cJSON *payload,
-                                           ShadowActionCallback callback,
-                                           void *context, uint8_t timeout) {
+                                           const char *document, ShadowActionCallback callback,
+                                           void *context, uint32_t timeoutMs) {
+    uuid_t uuid;
+    uuid_generate(uuid);
+
+    return device_management_shadow_send_as(client, uuid, action, payload, document, callback, context, timeoutMs);
+}
+
+/* Send with the request id given by the caller. */
+DmReturnCode device_management_shadow_send_as(device_management_client_t *c, const uuid_t uuid, ShadowAction action,
+                                              cJSON *payload, const char *document, ShadowActionCallback callback,
+                                              void *context, uint32_t timeoutMs) {
     const char *topic;
+    TopicGroup group;
 
     DmReturnCode rc;
-    device_management_client_t *c = client;
 
-    uuid_t uuid;
     char requestId[MAX_UUID_LENGTH];
-    uuid_generate(uuid);
     uuid_unparse(uuid, requestId);
 
     if (!device_management_is_connected2(c)) {
@@ -715,116 +2229,282 @@ DmReturnCode device_management_shadow_send(DeviceManagementClient client, Shadow
     }
 
     if (action == SHADOW_UPDATE) {
-        topic = client->topicContract->update;
+        topic = c->topicContract->update;
+        group = TOPIC_GROUP_UPDATE;
     } else if (action == SHADOW_GET) {
-        topic = client->topicContract->get;
+        topic = c->topicContract->get;
+        group = TOPIC_GROUP_GET;
     } else if (action == SHADOW_DELETE) {
-        topic = client->topicContract->delete;
+        topic = c->topicContract->delete;
+        group = TOPIC_GROUP_DELETE;
     } else {
         log4c_category_log(category, LOG4C_PRIORITY_ERROR, "Unsupported action.");
         return BAD_ARGUMENT;
     }
 
-    rc = in_flight_message_add(&(c->messages), requestId, action, callback, context, timeout);
+    /*
+     * The first use of an action subscribes its acks. The SUBSCRIBE goes out on the connection before the PUBLISH
+     * below, and the broker handles them in order, so the ack isn't missed.
+     */
+    device_management_want_topics(c, TOPIC_GROUP_BIT(group));
+
+    rc = in_flight_message_add(&(c->messages), uuid, action, callback, context, timeoutMs);
     if (rc == SUCCESS) {
-        device_management_shadow_send_json(c, topic, requestId, payload);
+        if (payload != NULL) {
+            device_management_shadow_send_json(c, topic, requestId, payload, c->qos);
+        } else {
+            device_management_shadow_send_text(c, topic, requestId, document, c->qos);
+        }
     }
 
     return rc;
 }
 
+/* The ack is read from the payload, or from the document if it's lazily parsed. */
 int device_management_shadow_handle_response(device_management_client_t *c, const char *requestId, ShadowAction action,
                                              ShadowAckStatus status,
-                                             cJSON *payload) {
+                                             cJSON *payload, ShadowDocument *document) {
     int rc = NO_MATCHING_IN_FLIGHT_MESSAGE;
+    int position;
     int i;
+    uuid_t uuid;
     ShadowActionAck ack;
+    double profileVersion;
+    const char *code;
+    const char *message;
 
+    if (uuid_parse(requestId, uuid) != 0) {
+        log4c_category_log(category, LOG4C_PRIORITY_WARN, "bad requestId %s.", requestId);
+        return rc;
+    }
+
+    memset(&ack, 0, sizeof(ack));
     pthread_mutex_lock(&(c->messages.mutex));
-    for (i = 0; i < MAX_IN_FLIGHT_MESSAGE; ++i) {
-        if (!c->messages.vault[i].free &&
-            strncasecmp(c->messages.vault[i].requestId, requestId, MAX_UUID_LENGTH) == 0) {
-            if (status == SHADOW_ACK_ACCEPTED) {
-                ack.accepted.response.reported = cJSON_GetObjectItemCaseSensitive(payload, "reported");
-                ack.accepted.response.desired = cJSON_GetObjectItemCaseSensitive(payload, "desired");
-                cJSON *lastUpdatedTime = cJSON_GetObjectItemCaseSensitive(payload, "lastUpdatedTime");
-                if (lastUpdatedTime != NULL) {
-                    ack.accepted.response.lastUpdatedTime.reported = cJSON_GetObjectItemCaseSensitive(lastUpdatedTime,
-                                                                                                      "reported");
-                    ack.accepted.response.lastUpdatedTime.desired = cJSON_GetObjectItemCaseSensitive(lastUpdatedTime,
-                                                                                                     "desired");
-                }
-                cJSON *profileVersion = cJSON_GetObjectItemCaseSensitive(payload, "profileVersion");
-                if (profileVersion != NULL) {
-                    ack.accepted.response.profileVersion = cJSON_GetObjectItemCaseSensitive(payload,
-                                                                                            "profileVersion")->valueint;
-                }
-            } else if (status == SHADOW_ACK_REJECTED) {
-                cJSON *code = cJSON_GetObjectItem(payload, CODE_KEY);
-                cJSON *message = cJSON_GetObjectItem(payload, MESSAGE_KEY);
-                if (code == NULL || message == NULL) {
-                    log4c_category_log(category, LOG4C_PRIORITY_WARN, "bad rejected message.");
-                    ack.rejected.code = NULL;
-                    ack.rejected.message = NULL;
-                } else {
-                    ack.rejected.code = code->valuestring;
-                    ack.rejected.message = message->valuestring;
-                }
+    position = in_flight_message_find(&(c->messages), uuid);
+    if (position != IN_FLIGHT_NONE) {
+        i = c->messages.index[position];
+        if (status == SHADOW_ACK_ACCEPTED && document != NULL) {
+            ack.accepted.document = document;
+            if (device_management_document_get_number(document, "profileVersion", &profileVersion)) {
+                ack.accepted.response.profileVersion = (int) profileVersion;
+            }
+        } else if (status == SHADOW_ACK_ACCEPTED) {
+            ack.accepted.response.reported = cJSON_GetObjectItemCaseSensitive(payload, "reported");
+            ack.accepted.response.desired = cJSON_GetObjectItemCaseSensitive(payload, "desired");
+            cJSON *lastUpdatedTime = cJSON_GetObjectItemCaseSensitive(payload, "lastUpdatedTime");
+            if (lastUpdatedTime != NULL) {
+                ack.accepted.response.lastUpdatedTime.reported = cJSON_GetObjectItemCaseSensitive(lastUpdatedTime,
+                                                                                                  "reported");
+                ack.accepted.response.lastUpdatedTime.desired = cJSON_GetObjectItemCaseSensitive(lastUpdatedTime,
+                                                                                                 "desired");
+            }
+            cJSON *profileVersion = cJSON_GetObjectItemCaseSensitive(payload, "profileVersion");
+            if (profileVersion != NULL) {
+                ack.accepted.response.profileVersion = cJSON_GetObjectItemCaseSensitive(payload,
+                                                                                        "profileVersion")->valueint;
+            }
+        } else if (status == SHADOW_ACK_REJECTED) {
+            if (document != NULL) {
+                code = device_management_document_get_string(document, CODE_KEY);
+                message = device_management_document_get_string(document, MESSAGE_KEY);
+            } else {
+                cJSON *codeItem = cJSON_GetObjectItem(payload, CODE_KEY);
+                cJSON *messageItem = cJSON_GetObjectItem(payload, MESSAGE_KEY);
+                code = codeItem != NULL ? codeItem->valuestring : NULL;
+                message = messageItem != NULL ? messageItem->valuestring : NULL;
+            }
+            if (code == NULL || message == NULL) {
+                log4c_category_log(category, LOG4C_PRIORITY_WARN, "bad rejected message.");
+                ack.rejected.code = NULL;
+                ack.rejected.message = NULL;
+            } else {
+                ack.rejected.code = code;
+                ack.rejected.message = message;
             }
-            c->messages.vault[i].callback(action, status, &ack, c->messages.vault[i].callbackContext);
-            c->messages.vault[i].free = true;
-            rc = SUCCESS;
-            break;
         }
+        /* The copy is up to date by the time the caller hears of the ack. */
+        shadow_cache_ack(c, uuid, action, status, payload, document);
+        c->messages.vault[i].callback(action, status, &ack, c->messages.vault[i].callbackContext);
+        in_flight_message_remove(&(c->messages), position);
+        rc = SUCCESS;
     }
     pthread_mutex_unlock(&(c->messages.mutex));
 
-    if (rc == NO_MATCHING_IN_FLIGHT_MESSAGE) {
+    if (rc == NO_MATCHING_IN_FLIGHT_MESSAGE && (uuid[8] & 0xE0) == FIRE_AND_FORGET_VARIANT) {
+        log4c_category_log(category, status == SHADOW_ACK_ACCEPTED ? LOG4C_PRIORITY_TRACE : LOG4C_PRIORITY_WARN,
+                           "fire and forget update %s is %s.", requestId,
+                           status == SHADOW_ACK_ACCEPTED ? "accepted" : "rejected");
+    } else if (rc == NO_MATCHING_IN_FLIGHT_MESSAGE) {
         log4c_category_log(category, LOG4C_PRIORITY_WARN, "no in flight payload matching %s.", requestId);
     }
     return rc;
 }
 
+void property_handler_table_init(PropertyHandlerTable *table) {
+    int i;
+    table->index = 0;
+    table->root = PROPERTY_NONE;
+    for (i = 0; i < PROPERTY_INDEX_SIZE; ++i) {
+        table->keys[i] = PROPERTY_NONE;
+    }
+}
+
+/* Return the position in keys of the handlers of the key, or of the empty entry where they'd go. */
+int property_handler_find(PropertyHandlerTable *table, const char *key) {
+    uint32_t h = 2166136261u;
+    const char *p;
+    int position;
+
+    for (p = key; *p != '\0'; ++p) {
+        h = (h ^ (unsigned char) *p) * 16777619u;
+    }
+    position = h % PROPERTY_INDEX_SIZE;
+    while (table->keys[position] != PROPERTY_NONE && strcmp(table->vault[table->keys[position]].key, key) != 0) {
+        position = (position + 1) % PROPERTY_INDEX_SIZE;
+    }
+    return position;
+}
+
+/* Queue the delta for the dispatch thread, which takes over the payload. */
 DmReturnCode device_management_delta_arrived(device_management_client_t *c, cJSON *payload) {
-    uint32_t i = 0;
+    DeltaEvent *event = malloc(sizeof(DeltaEvent));
+    check_malloc_result(event);
+    event->client = c;
+    event->payload = payload;
+    event->next = NULL;
+
+    pthread_mutex_lock(&(deltas.mutex));
+    if (deltas.tail == NULL) {
+        deltas.head = event;
+    } else {
+        deltas.tail->next = event;
+    }
+    deltas.tail = event;
+    pthread_cond_broadcast(&(deltas.cond));
+    pthread_mutex_unlock(&(deltas.mutex));
+
+    return SUCCESS;
+}
+
+void *delta_queue_proc(void *ignore) {
+    DeltaEvent *event;
+
+    pthread_mutex_lock(&(deltas.mutex));
+    while (!deltas.stop) {
+        if (deltas.head == NULL) {
+            pthread_cond_wait(&(deltas.cond), &(deltas.mutex));
+            continue;
+        }
+        event = deltas.head;
+        deltas.head = event->next;
+        if (deltas.head == NULL) {
+            deltas.tail = NULL;
+        }
+        deltas.dispatching = event->client;
+        pthread_mutex_unlock(&(deltas.mutex));
+
+        device_management_delta_dispatch(event->client, event->payload);
+        cJSON_Delete(event->payload);
+        free(event);
+
+        pthread_mutex_lock(&(deltas.mutex));
+        deltas.dispatching = NULL;
+        pthread_cond_broadcast(&(deltas.cond));
+    }
+    while (deltas.head != NULL) {
+        event = deltas.head;
+        deltas.head = event->next;
+        cJSON_Delete(event->payload);
+        free(event);
+    }
+    deltas.tail = NULL;
+    pthread_mutex_unlock(&(deltas.mutex));
+
+    return NULL;
+}
+
+/* Drop the deltas queued for the client, and wait for the one being handled unless it's a handler destroying it. */
+void delta_queue_forget(device_management_client_t *c) {
+    DeltaEvent **link;
+    DeltaEvent *event;
+
+    pthread_mutex_lock(&(deltas.mutex));
+    deltas.tail = NULL;
+    link = &(deltas.head);
+    while (*link != NULL) {
+        event = *link;
+        if (event->client == c) {
+            *link = event->next;
+            cJSON_Delete(event->payload);
+            free(event);
+        } else {
+            deltas.tail = event;
+            link = &(event->next);
+        }
+    }
+    while (deltas.dispatching == c && !pthread_equal(deltas.thread, pthread_self())) {
+        pthread_cond_wait(&(deltas.cond), &(deltas.mutex));
+    }
+    pthread_mutex_unlock(&(deltas.mutex));
+}
+
+/*
+ * Call the handlers of the whole shadow, then walk the keys of desired once and call the handlers of each. The
+ * handlers are looked up under the lock and called outside of it.
+ */
+void device_management_delta_dispatch(device_management_client_t *c, cJSON *payload) {
+    int i;
+    int count = 0;
+    int handler;
     UserDefinedError *error = NULL;
     cJSON *desired;
     cJSON *property;
+    PropertyHandlerTable *table = &(c->properties);
+    ShadowPropertyDeltaCallback callbacks[MAX_SHADOW_PROPERTY_HANDLER];
+    const char *keys[MAX_SHADOW_PROPERTY_HANDLER];
+    cJSON *properties[MAX_SHADOW_PROPERTY_HANDLER];
 
     const char *requestId = message_get_request_id(payload);
     log4c_category_log(category, LOG4C_PRIORITY_DEBUG, "received delta. requestId=%s.", requestId);
     desired = cJSON_GetObjectItemCaseSensitive(payload, "desired");
+    shadow_cache_delta(c, payload);
 
-    pthread_mutex_lock(&(c->properties.mutex));
-    for (i = 0; i < c->properties.index; ++i) {
-        if (c->properties.vault[i].key == NULL) {
-            error = c->properties.vault[i].cb(NULL, desired);
-        } else {
-            property = cJSON_GetObjectItemCaseSensitive(desired, c->properties.vault[i].key);
-            if (property != NULL) {
-                error = c->properties.vault[i].cb(c->properties.vault[i].key, property);
-            }
+    pthread_mutex_lock(&(table->mutex));
+    for (handler = table->root; handler != PROPERTY_NONE; handler = table->vault[handler].next) {
+        callbacks[count] = table->vault[handler].cb;
+        keys[count] = NULL;
+        properties[count] = desired;
+        count++;
+    }
+    for (property = desired != NULL ? desired->child : NULL; property != NULL; property = property->next) {
+        if (property->string == NULL) {
+            continue;
         }
-
-        if (error != NULL) {
-            break;
+        handler = table->keys[property_handler_find(table, property->string)];
+        for (; handler != PROPERTY_NONE; handler = table->vault[handler].next) {
+            callbacks[count] = table->vault[handler].cb;
+            keys[count] = table->vault[handler].key;
+            properties[count] = property;
+            count++;
         }
     }
+    pthread_mutex_unlock(&(table->mutex));
 
-    pthread_mutex_unlock(&(c->properties.mutex));
+    /* The keys are never freed before the client, which waits for this dispatch. */
+    for (i = 0; i < count && error == NULL; ++i) {
+        error = callbacks[i](keys[i], properties[i]);
+    }
 
     if (error != NULL) {
         cJSON *responsePayload = cJSON_CreateObject();
         cJSON_AddStringToObject(responsePayload, CODE_KEY, error->code);
         cJSON_AddStringToObject(responsePayload, MESSAGE_KEY, error->message);
-        device_management_shadow_send_json(c, c->topicContract->deltaRejected, requestId, responsePayload);
+        device_management_shadow_send_json(c, c->topicContract->deltaRejected, requestId, responsePayload, c->qos);
         if (error->destroyer != NULL) {
             error->destroyer(error);
         }
         cJSON_Delete(responsePayload);
     }
-
-    return SUCCESS;
 }
 
 void device_management_set_error(device_management_client_t *c, MQTTAsync_failureData *response) {
@@ -841,87 +2521,297 @@ void device_management_set_error(device_management_client_t *c, MQTTAsync_failur
     pthread_mutex_unlock(&(c->mutex));
 }
 
-void mqtt_on_connected(void *context, char *cause) {
+/* The topics of the groups in the mask, in topics. Return their count. */
+static int topic_contract_select(TopicContract *t, uint8_t groups, char **topics) {
+    int group;
+    int i;
+    int count = 0;
+
+    for (group = 0; group < TOPIC_GROUP_COUNT; ++group) {
+        if (groups & TOPIC_GROUP_BIT(group)) {
+            for (i = TOPIC_GROUP_FIRST[group]; i < TOPIC_GROUP_FIRST[group + 1]; ++i) {
+                topics[count++] = t->subTopics[i];
+            }
+        }
+    }
+    return count;
+}
+
+/* What the subscribe callbacks are told of. */
+typedef struct {
+    device_management_client_t *client;
+    uint8_t groups;
+} SubscribeRequest;
+
+/* Subscribe the topics of the groups, which must already be in subscribedTopics. */
+void device_management_subscribe(device_management_client_t *c, uint8_t groups) {
     int i;
     int rc;
-    MQTTAsync_responseOptions responseOptions;
+    int count;
+    int qos[SUB_TOPIC_COUNT];
+    char *topics[SUB_TOPIC_COUNT];
+    SubscribeRequest *request = malloc(sizeof(SubscribeRequest));
+    check_malloc_result(request);
+    request->client = c;
+    request->groups = groups;
+
+    MQTTAsync_responseOptions responseOptions = MQTTAsync_responseOptions_initializer;
     responseOptions.onSuccess = mqtt_on_subscribe_success;
     responseOptions.onFailure = mqtt_on_subscribe_failure;
-    responseOptions.context = context;
-    device_management_client_t *c = context;
+    responseOptions.context = request;
 
-    log4c_category_log(category, LOG4C_PRIORITY_INFO, "MQTT connected.");
-
-    // TODO: on-demand subscribe
-    int qos[SUB_TOPIC_COUNT];
-    for (i = 0; i < SUB_TOPIC_COUNT; ++i) {
-        qos[i] = 1;
+    count = topic_contract_select(c->topicContract, groups, topics);
+    for (i = 0; i < count; ++i) {
+        qos[i] = QOS;
     }
-    rc = MQTTAsync_subscribeMany(c->mqttClient, SUB_TOPIC_COUNT, c->topicContract->subTopics, qos, &responseOptions);
+    pthread_mutex_lock(&(c->mutex));
+    c->pendingTopics |= groups;
+    rc = MQTTAsync_subscribeMany(c->mqttClient, count, topics, qos, &responseOptions);
     if (rc != MQTTASYNC_SUCCESS) {
-        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "Failed to subscribe. MQTT rc=%d.", rc);
-        return;
+        c->subscribedTopics &= ~groups;
+        c->pendingTopics &= ~groups;
+        free(request);
+        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "Failed to subscribe. MQTT rc=%d, deviceName=%s.", rc,
+                           c->deviceName);
     }
-//    rc = MQTTAsync_waitForCompletion(c->mqttClient, responseOptions.token, SUBSCRIBE_TIMEOUT * 1000);
-//    if (rc != MQTTASYNC_SUCCESS) {
-//        log4c_category_log(category, LOG4C_PRIORITY_ERROR, "subscribe failed. MQTT rc=%d.", rc);
-//    } else {
-//        pthread_mutex_lock(&(c->mutex));
-//        c->hasSubscribed = true;
-//        pthread_mutex_unlock(&(c->mutex));
-//        log4c_category_log(category, LOG4C_PRIORITY_DEBUG, "MQTT subscribed.");
-//    }
+    pthread_mutex_unlock(&(c->mutex));
 }
 
-void mqtt_on_connection_lost(void *context, char *cause) {
-    log4c_category_log(category, LOG4C_PRIORITY_ERROR, "connection lost. cause=%s.", cause);
-    device_management_client_t *c = context;
+/*
+ * The client uses the topic groups from now on. Those not subscribed yet are subscribed at once if connected, or
+ * else on connect. Subscribing under c->mutex keeps a concurrent sender from publishing before the SUBSCRIBE.
+ */
+void device_management_want_topics(device_management_client_t *c, uint8_t groups) {
+    uint8_t missing;
+
+    pthread_mutex_lock(&(c->mutex));
+    c->wantedTopics |= groups;
+    missing = groups & ~c->subscribedTopics;
+    if (missing != 0 && MQTTAsync_isConnected(c->mqttClient)) {
+        c->subscribedTopics |= missing;
+        device_management_subscribe(c, missing);
+    }
+    pthread_mutex_unlock(&(c->mutex));
+}
+
+/* Once connected, subscribe what the client wants and the broker session doesn't have. */
+void device_management_resubscribe(device_management_client_t *c, bool sessionPresent) {
+    uint8_t missing;
+
+    pthread_mutex_lock(&(c->mutex));
+    if (!sessionPresent) {
+        c->subscribedTopics = 0;
+    }
+    missing = c->wantedTopics & ~c->subscribedTopics;
+    if (missing != 0) {
+        c->subscribedTopics |= missing;
+        device_management_subscribe(c, missing);
+    }
+    pthread_mutex_unlock(&(c->mutex));
+
+    if (missing == 0) {
+        device_management_on_ready(c);
+    }
+}
+
+/* The topics needed once connected are subscribed, the client can send. */
+void device_management_on_ready(device_management_client_t *c) {
+    pthread_mutex_lock(&(c->mutex));
+    c->hasSubscribed = true;
+    pthread_mutex_unlock(&(c->mutex));
+    device_management_set_error(c, NULL);
+    offline_queue_flush(c);
+    device_management_connect_done(c, SUCCESS);
+}
+
+/* Drop the subscriptions of a client sharing the connection, which is going away. */
+void device_management_unsubscribe(device_management_client_t *c) {
+    int count;
+    char *topics[SUB_TOPIC_COUNT];
+
+    pthread_mutex_lock(&(c->mutex));
+    count = topic_contract_select(c->topicContract, c->subscribedTopics, topics);
+    if (count > 0 && MQTTAsync_isConnected(c->mqttClient)) {
+        MQTTAsync_unsubscribeMany(c->mqttClient, count, topics, NULL);
+    }
+    c->subscribedTopics = 0;
+    pthread_mutex_unlock(&(c->mutex));
+}
+
+/* The connection is lost, the broker might not have got the subscriptions in flight. */
+void device_management_forget_pending_topics(device_management_client_t *c) {
     pthread_mutex_lock(&(c->mutex));
     c->hasSubscribed = false;
+    c->subscribedTopics &= ~c->pendingTopics;
+    c->pendingTopics = 0;
     pthread_mutex_unlock(&(c->mutex));
 }
 
+void mqtt_on_connected(void *context, char *cause) {
+    int i;
+    device_management_client_t *c = context;
+
+    log4c_category_log(category, LOG4C_PRIORITY_INFO, "MQTT connected. sessionPresent=%d.", c->sessionPresent);
+
+    device_management_resubscribe(c, c->sessionPresent);
+    pthread_mutex_lock(&(c->shared.mutex));
+    for (i = 0; i < c->shared.count; ++i) {
+        device_management_resubscribe(c->shared.members[i], c->sessionPresent);
+    }
+    pthread_mutex_unlock(&(c->shared.mutex));
+}
+
+void mqtt_on_connection_lost(void *context, char *cause) {
+    int i;
+    log4c_category_log(category, LOG4C_PRIORITY_ERROR, "connection lost. cause=%s.", cause);
+    device_management_client_t *c = context;
+    /* Unless the next connect says otherwise, the session is gone and everything is subscribed again. */
+    c->sessionPresent = false;
+    device_management_forget_pending_topics(c);
+    pthread_mutex_lock(&(c->shared.mutex));
+    for (i = 0; i < c->shared.count; ++i) {
+        device_management_forget_pending_topics(c->shared.members[i]);
+    }
+    pthread_mutex_unlock(&(c->shared.mutex));
+}
+
+/* Also called on the automatic reconnects, before mqtt_on_connected. */
 void mqtt_on_connect_success(void *context, MQTTAsync_successData *response) {
     device_management_client_t *c = context;
+    pthread_mutex_lock(&(c->mutex));
+    c->sessionPresent = response != NULL && response->alt.connect.sessionPresent ? true : false;
+    c->connecting = false;
+    c->connectRetry = false;
+    c->reconnectAt = 0;
+    c->reconnectDelayMs = RECONNECT_MIN_INTERVAL * 1000;
+    pthread_mutex_unlock(&(c->mutex));
     device_management_set_error(c, NULL);
 }
 
+/*
+ * The CONNACK return codes that retrying won't change: unacceptable protocol version, identifier rejected, bad user
+ * name or password, not authorized.
+ */
+static bool connect_refused(int code) {
+    return code == 1 || code == 2 || code == 4 || code == 5;
+}
+
 void mqtt_on_connect_failure(void *context, MQTTAsync_failureData *response) {
+    int i;
+    bool retry;
+    uint32_t delay;
     device_management_client_t *c = context;
-    device_management_set_error(c, response != NULL ? response : &UNKNOWN_FAILURE);
+
+    if (response == NULL) {
+        response = &UNKNOWN_FAILURE;
+    }
+    device_management_set_error(c, response);
+
+    pthread_mutex_lock(&(c->mutex));
+    c->connecting = false;
+    retry = c->connectRetry && !connect_refused(response->code);
+    if (retry) {
+        /* Half to all of the delay, so that the clients that failed together don't retry together. */
+        delay = c->reconnectDelayMs / 2 + random() % (c->reconnectDelayMs / 2 + 1);
+        c->reconnectAt = monotonic_ms() + delay;
+        c->reconnectDelayMs *= 2;
+        if (c->reconnectDelayMs > RECONNECT_MAX_INTERVAL * 1000) {
+            c->reconnectDelayMs = RECONNECT_MAX_INTERVAL * 1000;
+        }
+        log4c_category_log(category, LOG4C_PRIORITY_WARN, "retrying to connect in %u ms. deviceName=%s.", delay,
+                           c->deviceName);
+    }
+    c->connectRetry = retry;
+    pthread_mutex_unlock(&(c->mutex));
+
+    if (retry) {
+        in_flight_message_kick_keeper();
+        return;
+    }
+    /* Given up, the clients sharing the connection with it too. */
+    device_management_connect_done(c, FAILURE);
+    pthread_mutex_lock(&(c->shared.mutex));
+    for (i = 0; i < c->shared.count; ++i) {
+        device_management_connect_done(c->shared.members[i], FAILURE);
+    }
+    pthread_mutex_unlock(&(c->shared.mutex));
 }
 
 void mqtt_on_subscribe_success(void* context, MQTTAsync_successData* response) {
-    device_management_client_t *c = context;
+    SubscribeRequest *request = context;
+    device_management_client_t *c = request->client;
     pthread_mutex_lock(&(c->mutex));
-    c->hasSubscribed = true;
+    c->pendingTopics &= ~request->groups;
     pthread_mutex_unlock(&(c->mutex));
-    device_management_set_error(c, NULL);
-    log4c_category_log(category, LOG4C_PRIORITY_DEBUG, "MQTT subscribed.");
+    log4c_category_log(category, LOG4C_PRIORITY_DEBUG, "MQTT subscribed. topics=0x%x, deviceName=%s.",
+                       request->groups, c->deviceName);
+    free(request);
+    device_management_on_ready(c);
 }
 
 void mqtt_on_subscribe_failure(void* context,  MQTTAsync_failureData* response) {
-    device_management_client_t *c = context;
+    SubscribeRequest *request = context;
+    device_management_client_t *c = request->client;
+    /* They are asked for again the next time they are used. */
+    pthread_mutex_lock(&(c->mutex));
+    c->pendingTopics &= ~request->groups;
+    c->subscribedTopics &= ~request->groups;
+    pthread_mutex_unlock(&(c->mutex));
     device_management_set_error(c, response != NULL ? response : &UNKNOWN_FAILURE);
+    free(request);
+    /* Fails the connect waiting for the subscription, if any. */
+    device_management_connect_done(c, FAILURE);
 }
 
 void mqtt_on_publish_success(void *context, MQTTAsync_successData *response) {
-    free(context);
+    // Nothing to do.
 }
 
 void mqtt_on_publish_failure(void *context, MQTTAsync_failureData *response) {
     log4c_category_log(category, LOG4C_PRIORITY_ERROR, "failed to send json. code=%d, message=%s.",
-                       response->code, response->message);
-    free(context);
+                       response != NULL ? response->code : 0,
+                       response != NULL && response->message != NULL ? response->message : "unknown");
 }
 
 void mqtt_on_delivery_complete(void *context, MQTTAsync_token dt) {
     // Nothing to do.
 }
 
+/* Find the client of the device in the topic among the owner of the connection and the clients sharing it. */
+device_management_client_t *device_management_route(device_management_client_t *owner, const char *topicName) {
+    int i;
+    size_t prefixLength = strlen(TOPIC_PREFIX);
+    size_t nameLength;
+    const char *name;
+    const char *end;
+
+    if (owner->shared.count == 0 || strncmp(TOPIC_PREFIX, topicName, prefixLength) != 0 ||
+        topicName[prefixLength] != '/') {
+        return owner;
+    }
+    name = topicName + prefixLength + 1;
+    end = strchr(name, '/');
+    nameLength = end != NULL ? end - name : strlen(name);
+
+    for (i = 0; i < owner->shared.count; ++i) {
+        if (strlen(owner->shared.members[i]->deviceName) == nameLength &&
+            strncasecmp(owner->shared.members[i]->deviceName, name, nameLength) == 0) {
+            return owner->shared.members[i];
+        }
+    }
+    return owner;
+}
+
 int mqtt_on_message_arrived(void *context, char *topicName, int topicLen, MQTTAsync_message *message) {
-    device_management_client_t *c = context;
+    device_management_client_t *owner = context;
+    device_management_client_t *c;
     char *jsonString = message->payload;
+    cJSON *payload = NULL;
+    ShadowDocument *document = NULL;
+    const char *requestId = NULL;
+    ShadowAction action = SHADOW_INVALID;
+    ShadowAckStatus status = SHADOW_ACK_ACCEPTED;
+
     if (message->payloadlen < 3) {
         return -1;
     }
@@ -933,61 +2823,81 @@ int mqtt_on_message_arrived(void *context, char *topicName, int topicLen, MQTTAs
     }
     log4c_category_log(category, LOG4C_PRIORITY_TRACE, "received message \n<<topic:\n%s\n<<payload:\n%s",
                        topicName, jsonString);
-    cJSON *payload = cJSON_Parse(jsonString);
-    if (jsonString != message->payload) {
-        free(jsonString);
-    }
-
-    if (payload == NULL) {
-        /* json parsing failed. */
-        log4c_category_log(category, LOG4C_PRIORITY_WARN, "failed to parse mqtt message as json. string is:\n%s",
-                           jsonString);
-    } else {
-        ShadowAction action = SHADOW_INVALID;
-        ShadowAckStatus status = SHADOW_ACK_ACCEPTED;
 
-        if (strncasecmp(c->topicContract->delta, topicName, strlen(c->topicContract->delta)) == 0) {
+    /* Held while dispatching, so that the client isn't destroyed meanwhile. */
+    pthread_mutex_lock(&(owner->shared.mutex));
+    c = device_management_route(owner, topicName);
+    if (strncasecmp(c->topicContract->delta, topicName, strlen(c->topicContract->delta)) == 0) {
+        /* The handlers take cJSON, deltas are always parsed. */
+        payload = cJSON_Parse(jsonString);
+        if (payload == NULL) {
+            log4c_category_log(category, LOG4C_PRIORITY_WARN, "failed to parse mqtt message as json. string is:\n%s",
+                               jsonString);
+        } else {
             device_management_delta_arrived(c, payload);
+            payload = NULL;
+        }
+    } else {
+        if (strncasecmp(c->topicContract->updateAccepted, topicName, strlen(c->topicContract->updateAccepted)) ==
+            0) {
+            action = SHADOW_UPDATE;
+        } else if (strncasecmp(c->topicContract->updateRejected, topicName,
+                               strlen(c->topicContract->updateRejected)) == 0) {
+            action = SHADOW_UPDATE;
+            status = SHADOW_ACK_REJECTED;
+        } else if (strncasecmp(c->topicContract->getAccepted, topicName, strlen(c->topicContract->getAccepted)) ==
+                   0) {
+            action = SHADOW_GET;
+        } else if (strncasecmp(c->topicContract->getRejected, topicName, strlen(c->topicContract->getRejected)) ==
+                   0) {
+            action = SHADOW_GET;
+            status = SHADOW_ACK_REJECTED;
+        } else if (strncasecmp(c->topicContract->deleteAccepted, topicName, strlen(c->topicContract->deleteAccepted)) ==
+                   0) {
+            action = SHADOW_DELETE;
+        } else if (strncasecmp(c->topicContract->deleteRejected, topicName, strlen(c->topicContract->deleteRejected)) ==
+                   0) {
+            action = SHADOW_DELETE;
+            status = SHADOW_ACK_REJECTED;
         } else {
-            if (strncasecmp(c->topicContract->updateAccepted, topicName, strlen(c->topicContract->updateAccepted)) ==
-                0) {
-                action = SHADOW_UPDATE;
-            } else if (strncasecmp(c->topicContract->updateRejected, topicName,
-                                   strlen(c->topicContract->updateRejected)) == 0) {
-                action = SHADOW_UPDATE;
-                status = SHADOW_ACK_REJECTED;
-            } else if (strncasecmp(c->topicContract->getAccepted, topicName, strlen(c->topicContract->getAccepted)) ==
-                       0) {
-                action = SHADOW_GET;
-            } else if (strncasecmp(c->topicContract->getRejected, topicName, strlen(c->topicContract->getRejected)) ==
-                       0) {
-                action = SHADOW_GET;
-                status = SHADOW_ACK_REJECTED;
-            } else if (strncasecmp(c->topicContract->deleteAccepted, topicName, strlen(c->topicContract->deleteAccepted)) ==
-                       0) {
-                action = SHADOW_DELETE;
-            } else if (strncasecmp(c->topicContract->deleteRejected, topicName, strlen(c->topicContract->deleteRejected)) ==
-                       0) {
-                action = SHADOW_DELETE;
-                status = SHADOW_ACK_REJECTED;
+            log4c_category_log(category, LOG4C_PRIORITY_ERROR, "Unexpected topic %s.", topicName);
+        }
+
+        if (action != SHADOW_INVALID) {
+            if (c->lazyParse) {
+                /* The payload buffer is indexed, and read in place by the callback. */
+                if (shadow_document_tokenize(&(owner->document), jsonString, strlen(jsonString)) == 0) {
+                    document = &(owner->document);
+                    requestId = device_management_document_get_string(document, REQUEST_ID_KEY);
+                }
             } else {
-                log4c_category_log(category, LOG4C_PRIORITY_ERROR, "Unexpected topic %s.", topicName);
+                payload = cJSON_Parse(jsonString);
+                if (payload != NULL) {
+                    cJSON *requestIdItem = cJSON_GetObjectItem(payload, REQUEST_ID_KEY);
+                    requestId = requestIdItem != NULL ? requestIdItem->valuestring : NULL;
+                }
             }
 
-            if (action != SHADOW_INVALID) {
-                cJSON *requestId = cJSON_GetObjectItem(payload, REQUEST_ID_KEY);
-
-                if (requestId == NULL) {
-                    log4c_category_log(category, LOG4C_PRIORITY_ERROR, "cannot find request id.");
-                } else {
-
-                    device_management_shadow_handle_response(c, requestId->valuestring, action, status, payload);
-                }
+            if (payload == NULL && document == NULL) {
+                /* json parsing failed. */
+                log4c_category_log(category, LOG4C_PRIORITY_WARN,
+                                   "failed to parse mqtt message as json. string is:\n%s", jsonString);
+            } else if (requestId == NULL) {
+                log4c_category_log(category, LOG4C_PRIORITY_ERROR, "cannot find request id.");
+            } else {
+                device_management_shadow_handle_response(c, requestId, action, status, payload, document);
             }
         }
     }
+    pthread_mutex_unlock(&(owner->shared.mutex));
 
+    if (document != NULL) {
+        shadow_document_reset(document);
+    }
     cJSON_Delete(payload);
+    if (jsonString != message->payload) {
+        free(jsonString);
+    }
     MQTTAsync_freeMessage(&message);
     MQTTAsync_free(topicName);
 
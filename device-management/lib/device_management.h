@@ -84,9 +84,14 @@ typedef struct {
     int profileVersion;
 } ShadowResponse;
 
+/* 收到的 JSON 文档，按需读取其中的字段。参见 device_management_set_lazy_parse。 */
+typedef struct ShadowDocument ShadowDocument;
+
 /* 如果 GET/UPDATE 被服务器端接受，就会返回一个ShadowResponse */
 typedef struct {
     ShadowResponse response;
+    /* 开启延迟解析时，response 中只有 profileVersion，其它字段通过 document 读取。否则为 NULL。 */
+    ShadowDocument *document;
 } ShadowActionAccepted;
 
 typedef struct {
@@ -125,6 +130,15 @@ struct device_management_client_t;
 
 typedef struct device_management_client_t *DeviceManagementClient;
 
+/**
+ * @brief 异步连接完成的回调，在 MQTT 的线程里调用，不要在回调里销毁客户端。
+ *
+ * @param client 物管理客户端
+ * @param rc SUCCESS 表示已连接并完成订阅，可以收发消息；FAILURE 表示连接被服务器拒绝（如用户名密码错误）或订阅失败，不再重试。
+ * @param context 调用 device_management_connect_async 时传入的 context
+ */
+typedef void (*DeviceManagementConnectCallback)(DeviceManagementClient client, DmReturnCode rc, void *context);
+
 DmReturnCode device_management_init();
 
 DmReturnCode device_management_fini();
@@ -144,19 +158,49 @@ DmReturnCode device_management_fini();
 DmReturnCode device_management_create(DeviceManagementClient *client, const char *broker, const char *deviceName,
                                       const char *username, const char *password, const char *clientId, const char *trustStore);
 
+/**
+ * @brief 创建一个与已有客户端共用 MQTT 连接的物管理客户端，用于一个连接代理多个子设备的影子。
+ * 各设备订阅各自的主题，收到的消息按主题中的设备名分发。
+ * connect 这个客户端时，会连接其共用的客户端。销毁共用的客户端之前，需要先销毁共用其连接的所有客户端。
+ *
+ * @param client 返回所创建的客户端
+ * @param connection 共用其连接的客户端，由 device_management_create 创建
+ * @param deviceName 设备名字
+ * @return
+ */
+DmReturnCode device_management_create_shared(DeviceManagementClient *client, DeviceManagementClient connection,
+                                             const char *deviceName);
+
 /**
  * @brief 连接客户端至服务器
  *
+ * 影子主题按需订阅：注册 delta 回调时订阅 delta，第一次 update/get/delete 时订阅其 accepted/rejected。
+ * 使用持久会话，重连时服务端保留了会话的话不再重新订阅。
+ *
  * @param client 物管理客户端
  * @return
  */
 DmReturnCode device_management_connect(DeviceManagementClient client);
 
+/**
+ * @brief 异步连接客户端至服务器，不等连接完成就返回，多个客户端可以同时连接。
+ *
+ * 连接失败（网络不通、服务器不可用等）时自动重试，间隔从 RECONNECT_MIN_INTERVAL 秒起每次加倍，
+ * 最多 RECONNECT_MAX_INTERVAL 秒。连上之后断线也会按同样的间隔自动重连。
+ *
+ * @param client 物管理客户端
+ * @param callback 连接完成或放弃时调用一次，可以传NULL
+ * @param context 传给 callback
+ * @return SUCCESS 表示已开始连接；返回其它值时 callback 不会被调用
+ */
+DmReturnCode device_management_connect_async(DeviceManagementClient client, DeviceManagementConnectCallback callback,
+                                             void *context);
+
 /**
  * @brief 断开并销毁客户端
  *
  * @param client 物管理客户端
- * @return
+ * @return 还有客户端共用其连接时返回 FAILURE
  */
 DmReturnCode device_management_destroy(DeviceManagementClient client);
 
@@ -175,6 +219,131 @@ DmReturnCode
 device_management_shadow_update(DeviceManagementClient client, ShadowActionCallback callback, void *context,
                                 uint8_t timeout, cJSON *reported, cJSON *desired);
 
+/**
+ * @brief 用已序列化的 JSON 文本更新设备影子，省去构造和序列化 cJSON 的开销。
+ *
+ * @param client 物管理客户端
+ * @param callback 完成之后的回调
+ * @param context 传递给回调的上下文
+ * @param timeout 为这个请求指定一个超时时间。单位为秒。
+ * @param document JSON 对象，形如 {"reported":{...}}，SDK 会在其中加入 requestId。不检查其内容是否合法。
+ * @return 代码。document 不是以 { 开始时返回 BAD_ARGUMENT。
+ */
+DmReturnCode
+device_management_shadow_update_raw(DeviceManagementClient client, ShadowActionCallback callback, void *context,
+                                    uint8_t timeout, const char *document);
+
+/**
+ * @brief 开启或关闭延迟解析。开启后，收到的 accepted/rejected 消息不再解析成 cJSON 树，只建立一个指向原消息的
+ * 索引，回调中通过 device_management_document_* 按需读取字段，减少大文档的内存分配和延迟。
+ * ack 中的 document 只在回调内有效。delta 仍完整解析，以便调用 ShadowPropertyDeltaCallback。
+ *
+ * @param client 物管理客户端
+ * @param lazy 是否开启，默认关闭。
+ * @return 代码
+ */
+DmReturnCode device_management_set_lazy_parse(DeviceManagementClient client, bool lazy);
+
+/**
+ * @brief 设置 get/update/delete 等请求发送时的 MQTT 服务质量。QoS 0 省去 PUBACK 的往返，请求仍按 requestId 跟踪，
+ * 丢失时以 SHADOW_ACK_TIMEOUT 回调。订阅总是使用 QOS，收到的 delta 和 ACK 不受影响。
+ *
+ * @param client 物管理客户端
+ * @param qos 0 或 1，默认为 QOS。
+ * @return 代码。qos 不是 0 或 1 时返回 BAD_ARGUMENT。
+ */
+DmReturnCode device_management_set_qos(DeviceManagementClient client, int qos);
+
+/**
+ * @brief 以 QoS 0 上报 reported，不占用 in flight message，也没有回调，适合高频且允许丢失的属性，如实时读数。
+ * 不经过合并上报和离线队列，未连接时直接返回 NOT_CONNECTED。开启影子缓存时会清空副本，之后的 update 完整发送。
+ * 需要确认的属性仍用 device_management_shadow_update 上报。
+ *
+ * @param client 物管理客户端
+ * @param reported 要上报的内容，必须是对象。不会被修改。
+ * @return 代码。只表示消息已交给 MQTT 客户端。
+ */
+DmReturnCode device_management_shadow_report(DeviceManagementClient client, cJSON *reported);
+
+/**
+ * @brief 读取文档中的字符串。
+ *
+ * @param document 收到的文档
+ * @param path 以 . 分隔的各级对象的 key，如 "reported.temperature"。NULL 或 "" 表示整个文档。
+ * @return 字符串，在回调内有效。不存在或不是字符串时返回 NULL。
+ */
+const char *device_management_document_get_string(ShadowDocument *document, const char *path);
+
+/**
+ * @brief 读取文档中的数字。不存在或不是数字时返回 false。
+ */
+bool device_management_document_get_number(ShadowDocument *document, const char *path, double *value);
+
+/**
+ * @brief 读取文档中的布尔值。不存在或不是布尔值时返回 false。
+ */
+bool device_management_document_get_bool(ShadowDocument *document, const char *path, bool *value);
+
+/**
+ * @brief 文档中是否有这个字段。
+ */
+bool device_management_document_has(ShadowDocument *document, const char *path);
+
+/**
+ * @brief 把文档中的一部分解析成 cJSON，由调用者 cJSON_Delete。不存在时返回 NULL。
+ */
+cJSON *device_management_document_parse(ShadowDocument *document, const char *path);
+
+/**
+ * @brief 开启或关闭合并上报。开启后，只带 reported 的 device_management_shadow_update 不再立即发送，
+ * 而是在第一次调用之后的 lingerMs 毫秒内，把各次调用的 reported 深度合并（对象逐个属性合并，其它值以后来的为准），
+ * 作为一条 update 发送，占用一个 in flight message。收到 ACK 后，依次回调每一次调用的 callback。
+ * 合并的调用达到 MAX_COALESCED_UPDATE 次时立即发送。超时时间取各次调用中最短的。
+ * 若合并后的 update 发送失败，每个 callback 都会收到 SHADOW_ACK_TIMEOUT。
+ *
+ * @param client 物管理客户端
+ * @param lingerMs 合并的时间窗口，单位为毫秒。0 表示关闭，为默认值。
+ * @return 代码
+ */
+DmReturnCode device_management_shadow_set_update_linger(DeviceManagementClient client, uint32_t lingerMs);
+
+/**
+ * @brief 开启或关闭离线队列。开启后，未连接时只带 reported 的 device_management_shadow_update 不再返回 NOT_CONNECTED，
+ * 而是把 reported 按属性合并到队列中（同一属性只保留最后一次的值，对象逐个属性合并），连接并订阅完成后作为一条 update
+ * 发送，占用一个 in flight message，收到 ACK 后依次回调每一次调用的 callback，超时时间从发送时算起。
+ * 合并上报的 update 因未连接而发送失败时也进入队列。合并中尚未发送的 update 先于之后的调用进入队列，
+ * 同一属性仍以最后一次调用的值为准。
+ * 队列中的顶层属性将超过 maxProperties 个，或者调用将超过 MAX_COALESCED_UPDATE 次时，update 仍然返回 NOT_CONNECTED。
+ *
+ * @param client 物管理客户端
+ * @param maxProperties 队列中最多的顶层属性个数。0 表示关闭，为默认值。已在队列中的 update 仍在连接后发送。
+ * @return 代码
+ */
+DmReturnCode device_management_shadow_set_offline_queue(DeviceManagementClient client, uint32_t maxProperties);
+
+/**
+ * @brief 开启或关闭影子缓存。开启后，客户端在本地保存 reported 和 desired 的副本以及它的 profileVersion，
+ * device_management_shadow_update 只发送 reported 中与副本不同的字段（对象逐个属性比较），都相同且不带 desired 时
+ * 不发送消息，直接以 SHADOW_ACK_ACCEPTED 回调，ack 中的 reported 为 NULL，profileVersion 为副本的版本。
+ * 发出的字段立即计入副本；update 被拒绝或超时时副本被清空，之后的 update 完整发送。
+ * get 的 ACK 替换副本，delta 合并到副本的 desired 中，delete 清空副本。
+ * device_management_shadow_update_raw 不经过比较，也会清空副本。
+ *
+ * @param client 物管理客户端
+ * @param enable 是否开启，默认关闭。关闭时丢弃副本。
+ * @return 代码
+ */
+DmReturnCode device_management_shadow_set_cache(DeviceManagementClient client, bool enable);
+
+/**
+ * @brief 读取影子缓存的副本，形如 {"reported":{...},"desired":{...}}，由调用者 cJSON_Delete。
+ *
+ * @param client 物管理客户端
+ * @param profileVersion 返回副本的 profileVersion，未知时为 -1。可以传 NULL。
+ * @return 副本。没有开启影子缓存时返回 NULL。
+ */
+cJSON *device_management_shadow_cached(DeviceManagementClient client, int *profileVersion);
+
 /**
  * @brief 获取设备影子
  *
@@ -187,6 +356,21 @@ device_management_shadow_update(DeviceManagementClient client, ShadowActionCallb
 DmReturnCode device_management_shadow_get(DeviceManagementClient client, ShadowActionCallback callback, void *context,
                                           uint8_t timeout);
 
+/**
+ * @brief 按影子缓存的 profileVersion 重新同步设备影子，例如在重连之后代替 device_management_shadow_get。
+ * 请求中带上副本的 profileVersion，服务器端支持时只返回此后变化的字段，否则返回完整的影子，两种情况都合并到副本中，
+ * 值为 null 的字段从副本中删除。副本的版本未知时等同于 device_management_shadow_get。
+ * 回调收到的是服务器端的应答，合并后的副本通过 device_management_shadow_cached 读取。
+ *
+ * @param client 物管理客户端
+ * @param callback 完成之后的回调
+ * @param context 传递给回调的上下文
+ * @param timeout 为这个请求指定一个超时时间。单位为秒。
+ * @return 代码
+ */
+DmReturnCode device_management_shadow_resync(DeviceManagementClient client, ShadowActionCallback callback,
+                                             void *context, uint8_t timeout);
+
 /**
  * @brief 删除设备影子
  *
@@ -29,28 +29,46 @@
 extern "C" {
 #endif
 
-/* MQTT 发送/订阅 时指定的服务质量 */
+/* MQTT 订阅时指定的服务质量，也是发送请求时的默认值，可用 device_management_set_qos 修改。 */
 #define QOS 1
 
 /* MQTT 保活时间。单位是秒。 */
 #define KEEP_ALIVE 60
 
+/* SSL 连接允许的 TLS 1.2 加密套件，只用 ECDHE 和 AEAD。没有 AES 指令的 ARM 上 CHACHA20 更快，排在前面。 */
+#define TLS_CIPHERS "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:" \
+    "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:" \
+    "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384"
+
 /* MQTT 连接超时时间。单位是秒。 */
 #define CONNECT_TIMEOUT 10
 
+/* 连接失败后重试的间隔。单位是秒。从 RECONNECT_MIN_INTERVAL 开始每次失败加倍，最多 RECONNECT_MAX_INTERVAL。
+ * 断线后的自动重连也用这个区间。*/
+#define RECONNECT_MIN_INTERVAL 1
+
+#define RECONNECT_MAX_INTERVAL 60
+
 /* MQTT 订阅超时时间。单位是秒。 */
 #define SUBSCRIBE_TIMEOUT 10
 
-/* 最多能创建的客户端 */
-#define MAX_CLIENT 10
-
 /* 已发送，但还未收到服务器端 accepted/rejected 的消息，被认为是 in flight message。
- * 有超过 MAX_IN_FLIGHT_MESSAGE 之后，再尝试发送将会收到 TOO_MANY_IN_FLIGHT_MESSAGE 错误。*/
-#define MAX_IN_FLIGHT_MESSAGE 100
+ * 有超过 MAX_IN_FLIGHT_MESSAGE 之后，再尝试发送将会收到 TOO_MANY_IN_FLIGHT_MESSAGE 错误。
+ * 按 requestId 哈希索引，增删都是常数时间，窗口大小不影响性能。可在编译时用 -DMAX_IN_FLIGHT_MESSAGE=n 修改。*/
+#ifndef MAX_IN_FLIGHT_MESSAGE
+#define MAX_IN_FLIGHT_MESSAGE 1024
+#endif
+
+/* 开启合并上报（device_management_shadow_set_update_linger）后，一次合并的 update 最多包含多少次调用，
+ * 达到后立即发送。*/
+#define MAX_COALESCED_UPDATE 64
 
 /* 每个客户端可注册不多于此的handler */
 #define MAX_SHADOW_PROPERTY_HANDLER 100
 
+/* 发送消息时序列化 JSON 的缓冲区初始大小，不够时自动扩大，之后一直复用。*/
+#define SEND_BUFFER_INITIAL_SIZE 1024
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,402 @@
+/*
+* Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @brief token index over a received JSON document, read on demand.
+ *
+ * @authors Zhao Bo
+ */
+#include "device_management_json.h"
+#include "device_management_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Deeper documents are refused rather than overflowing the stack. */
+#define MAX_JSON_DEPTH 64
+
+#define INITIAL_TOKEN_CAPACITY 64
+
+void shadow_document_init(ShadowDocument *document) {
+    document->json = NULL;
+    document->length = 0;
+    document->tokens = NULL;
+    document->count = 0;
+    document->capacity = 0;
+}
+
+static int json_new_token(ShadowDocument *d, JsonType type, int start) {
+    if (d->count == d->capacity) {
+        d->capacity = d->capacity == 0 ? INITIAL_TOKEN_CAPACITY : d->capacity * 2;
+        d->tokens = realloc(d->tokens, d->capacity * sizeof(JsonToken));
+        check_malloc_result(d->tokens);
+    }
+    d->tokens[d->count].type = type;
+    d->tokens[d->count].start = start;
+    d->tokens[d->count].end = start;
+    d->tokens[d->count].span = 1;
+    d->tokens[d->count].value = NULL;
+    return d->count++;
+}
+
+static int json_skip_space(const char *json, int pos) {
+    while (json[pos] == ' ' || json[pos] == '\t' || json[pos] == '\r' || json[pos] == '\n') {
+        pos++;
+    }
+    return pos;
+}
+
+/* Parse the string starting at the opening quote at pos. Return the position past the closing quote, -1 on error. */
+static int json_parse_string(ShadowDocument *d, int pos) {
+    int token = json_new_token(d, JSON_STRING, pos + 1);
+    for (pos++; pos < d->length; pos++) {
+        if (d->json[pos] == '"') {
+            d->tokens[token].end = pos;
+            return pos + 1;
+        }
+        if (d->json[pos] == '\\') {
+            pos++;
+        } else if ((unsigned char) d->json[pos] < 0x20) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+static int json_parse_value(ShadowDocument *d, int pos, int depth) {
+    int token;
+    char close;
+
+    pos = json_skip_space(d->json, pos);
+    if (pos >= d->length) {
+        return -1;
+    }
+
+    if (d->json[pos] == '"') {
+        return json_parse_string(d, pos);
+    }
+
+    if (d->json[pos] == '{' || d->json[pos] == '[') {
+        if (depth >= MAX_JSON_DEPTH) {
+            return -1;
+        }
+        close = d->json[pos] == '{' ? '}' : ']';
+        token = json_new_token(d, close == '}' ? JSON_OBJECT : JSON_ARRAY, pos);
+        pos = json_skip_space(d->json, pos + 1);
+        if (d->json[pos] != close) {
+            while (1) {
+                if (close == '}') {
+                    pos = json_skip_space(d->json, pos);
+                    if (d->json[pos] != '"' || (pos = json_parse_string(d, pos)) < 0) {
+                        return -1;
+                    }
+                    pos = json_skip_space(d->json, pos);
+                    if (d->json[pos] != ':') {
+                        return -1;
+                    }
+                    pos++;
+                }
+                if ((pos = json_parse_value(d, pos, depth + 1)) < 0) {
+                    return -1;
+                }
+                pos = json_skip_space(d->json, pos);
+                if (d->json[pos] == close) {
+                    break;
+                }
+                if (d->json[pos] != ',') {
+                    return -1;
+                }
+                pos++;
+            }
+        }
+        d->tokens[token].end = pos + 1;
+        d->tokens[token].span = d->count - token;
+        return pos + 1;
+    }
+
+    /* A number, true, false or null. Its value is checked when it's read. */
+    if (d->json[pos] == '\0' || strchr("-0123456789tfn", d->json[pos]) == NULL) {
+        return -1;
+    }
+    token = json_new_token(d, JSON_PRIMITIVE, pos);
+    while (pos < d->length && strchr(",]} \t\r\n", d->json[pos]) == NULL) {
+        pos++;
+    }
+    d->tokens[token].end = pos;
+    return pos;
+}
+
+int shadow_document_tokenize(ShadowDocument *document, char *json, int length) {
+    int pos;
+
+    shadow_document_reset(document);
+    document->json = json;
+    document->length = length;
+    pos = json_parse_value(document, 0, 0);
+    if (pos < 0 || json_skip_space(json, pos) != length) {
+        document->count = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void shadow_document_reset(ShadowDocument *document) {
+    int i;
+    for (i = 0; i < document->count; ++i) {
+        /* Those terminated in place point into the json. */
+        if (document->tokens[i].value != NULL &&
+            document->tokens[i].value != document->json + document->tokens[i].start) {
+            free(document->tokens[i].value);
+        }
+    }
+    document->count = 0;
+    document->json = NULL;
+    document->length = 0;
+}
+
+void shadow_document_destroy(ShadowDocument *document) {
+    shadow_document_reset(document);
+    free(document->tokens);
+    shadow_document_init(document);
+}
+
+/* Return the value of the key in the object token, -1 if there's none. */
+static int json_object_get(const ShadowDocument *d, int object, const char *key, int keyLength) {
+    int i = object + 1;
+    int end = object + d->tokens[object].span;
+    const JsonToken *k;
+
+    while (i < end) {
+        k = &(d->tokens[i]);
+        if (k->end - k->start == keyLength && strncmp(d->json + k->start, key, keyLength) == 0) {
+            return i + 1;
+        }
+        i += 1 + d->tokens[i + 1].span;
+    }
+    return -1;
+}
+
+/* Return the token at the path, the keys of nested objects separated by dots. NULL or "" is the whole document. */
+static int json_find(const ShadowDocument *d, const char *path) {
+    int token = 0;
+    const char *dot;
+
+    if (d == NULL || d->count == 0) {
+        return -1;
+    }
+    while (path != NULL && *path != '\0') {
+        if (d->tokens[token].type != JSON_OBJECT) {
+            return -1;
+        }
+        dot = strchr(path, '.');
+        token = json_object_get(d, token, path, dot != NULL ? dot - path : strlen(path));
+        if (token < 0 || dot == NULL) {
+            break;
+        }
+        path = dot + 1;
+    }
+    return token;
+}
+
+static int json_hex(const char *p) {
+    int i;
+    int v = 0;
+    for (i = 0; i < 4; ++i) {
+        v <<= 4;
+        if (p[i] >= '0' && p[i] <= '9') {
+            v |= p[i] - '0';
+        } else if (p[i] >= 'a' && p[i] <= 'f') {
+            v |= p[i] - 'a' + 10;
+        } else if (p[i] >= 'A' && p[i] <= 'F') {
+            v |= p[i] - 'A' + 10;
+        } else {
+            return -1;
+        }
+    }
+    return v;
+}
+
+/* Decode the escapes of the string token into a copy of its own. Return NULL if an escape is malformed. */
+static char *json_unescape(const ShadowDocument *d, const JsonToken *t) {
+    const char *p = d->json + t->start;
+    const char *end = d->json + t->end;
+    char *value = malloc(t->end - t->start + 1);
+    char *out = value;
+    int c;
+    int low;
+
+    check_malloc_result(value);
+    while (p < end) {
+        if (*p != '\\') {
+            *out++ = *p++;
+            continue;
+        }
+        p++;
+        switch (*p) {
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'u':
+                if (end - p < 5 || (c = json_hex(p + 1)) < 0) {
+                    free(value);
+                    return NULL;
+                }
+                p += 4;
+                if (c >= 0xD800 && c <= 0xDBFF) {
+                    /* The high half of a surrogate pair, the low half must follow. */
+                    if (end - p < 7 || p[1] != '\\' || p[2] != 'u' || (low = json_hex(p + 3)) < 0xDC00 ||
+                        low > 0xDFFF) {
+                        free(value);
+                        return NULL;
+                    }
+                    c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+                /* UTF-8 takes no more octets than the escape. */
+                if (c < 0x80) {
+                    *out++ = (char) c;
+                } else if (c < 0x800) {
+                    *out++ = (char) (0xC0 | (c >> 6));
+                    *out++ = (char) (0x80 | (c & 0x3F));
+                } else if (c < 0x10000) {
+                    *out++ = (char) (0xE0 | (c >> 12));
+                    *out++ = (char) (0x80 | ((c >> 6) & 0x3F));
+                    *out++ = (char) (0x80 | (c & 0x3F));
+                } else {
+                    *out++ = (char) (0xF0 | (c >> 18));
+                    *out++ = (char) (0x80 | ((c >> 12) & 0x3F));
+                    *out++ = (char) (0x80 | ((c >> 6) & 0x3F));
+                    *out++ = (char) (0x80 | (c & 0x3F));
+                }
+                break;
+            default: /* ", \ and / */
+                *out++ = *p;
+                break;
+        }
+        p++;
+    }
+    *out = '\0';
+    return value;
+}
+
+const char *device_management_document_get_string(ShadowDocument *document, const char *path) {
+    int token = json_find(document, path);
+    JsonToken *t;
+
+    if (token < 0 || document->tokens[token].type != JSON_STRING) {
+        return NULL;
+    }
+    t = &(document->tokens[token]);
+    if (t->value == NULL) {
+        if (memchr(document->json + t->start, '\\', t->end - t->start) == NULL) {
+            /* Overwrite the closing quote, the tokens don't need it anymore. */
+            document->json[t->end] = '\0';
+            t->value = document->json + t->start;
+        } else {
+            t->value = json_unescape(document, t);
+        }
+    }
+    return t->value;
+}
+
+bool device_management_document_get_number(ShadowDocument *document, const char *path, double *value) {
+    int token = json_find(document, path);
+    char *end;
+    double v;
+
+    if (token < 0 || document->tokens[token].type != JSON_PRIMITIVE) {
+        return false;
+    }
+    v = strtod(document->json + document->tokens[token].start, &end);
+    if (end != document->json + document->tokens[token].end) {
+        return false;
+    }
+    if (value != NULL) {
+        *value = v;
+    }
+    return true;
+}
+
+bool device_management_document_get_bool(ShadowDocument *document, const char *path, bool *value) {
+    int token = json_find(document, path);
+    const JsonToken *t;
+    bool v;
+
+    if (token < 0 || document->tokens[token].type != JSON_PRIMITIVE) {
+        return false;
+    }
+    t = &(document->tokens[token]);
+    if (t->end - t->start == 4 && strncmp(document->json + t->start, "true", 4) == 0) {
+        v = true;
+    } else if (t->end - t->start == 5 && strncmp(document->json + t->start, "false", 5) == 0) {
+        v = false;
+    } else {
+        return false;
+    }
+    if (value != NULL) {
+        *value = v;
+    }
+    return true;
+}
+
+bool device_management_document_has(ShadowDocument *document, const char *path) {
+    return json_find(document, path) >= 0;
+}
+
+cJSON *device_management_document_parse(ShadowDocument *document, const char *path) {
+    int token = json_find(document, path);
+    int i;
+    int last;
+    char saved;
+    cJSON *value;
+    JsonToken *t;
+
+    if (token < 0) {
+        return NULL;
+    }
+    /* Put back the closing quotes of the strings read in place, then parse the text of the subtree alone. */
+    last = token + document->tokens[token].span;
+    for (i = token; i < last; ++i) {
+        t = &(document->tokens[i]);
+        if (t->value == document->json + t->start && t->type == JSON_STRING) {
+            document->json[t->end] = '"';
+        }
+    }
+    t = &(document->tokens[token]);
+    if (t->type == JSON_STRING) {
+        saved = document->json[t->end + 1];
+        document->json[t->end + 1] = '\0';
+        value = cJSON_Parse(document->json + t->start - 1);
+        document->json[t->end + 1] = saved;
+    } else {
+        saved = document->json[t->end];
+        document->json[t->end] = '\0';
+        value = cJSON_Parse(document->json + t->start);
+        document->json[t->end] = saved;
+    }
+    for (i = token; i < last; ++i) {
+        t = &(document->tokens[i]);
+        if (t->value == document->json + t->start && t->type == JSON_STRING) {
+            document->json[t->end] = '\0';
+        }
+    }
+    return value;
+}
@@ -0,0 +1,79 @@
+/*
+* Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @brief token index over a received JSON document, read on demand.
+ *
+ * The document is tokenized once, the way jsmn does, into an array of tokens that point into the payload buffer.
+ * Nothing is allocated per value: strings are terminated in place when they are first read, and only the strings
+ * with escapes are decoded into a copy of their own.
+ */
+#ifndef DEVICE_MANAGEMENT_JSON_H
+#define DEVICE_MANAGEMENT_JSON_H
+
+#include "device_management.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    JSON_OBJECT = 0,
+    JSON_ARRAY,
+    JSON_STRING,
+    JSON_PRIMITIVE, /* number, true, false or null */
+} JsonType;
+
+typedef struct {
+    JsonType type;
+    int start; /* The first character, past the opening quote of a string. */
+    int end; /* Past the last character, at the closing quote of a string. */
+    int span; /* The tokens of its subtree, itself included. The next sibling is span tokens away. */
+    char *value; /* The terminated value of a string once it's read, NULL before. */
+} JsonToken;
+
+struct ShadowDocument {
+    char *json;
+    int length;
+    JsonToken *tokens;
+    int count;
+    int capacity; /* The tokens are kept from one document to the next. */
+};
+
+void shadow_document_init(ShadowDocument *document);
+
+/**
+ * @brief Tokenize the json, which must be writable, NUL-terminated and outlive the reads of the document.
+ *
+ * @return 0 on success, -1 if it's not a well formed JSON value.
+ */
+int shadow_document_tokenize(ShadowDocument *document, char *json, int length);
+
+/**
+ * @brief Release the strings decoded from the last document. The tokens are kept for the next one.
+ */
+void shadow_document_reset(ShadowDocument *document);
+
+void shadow_document_destroy(ShadowDocument *document);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
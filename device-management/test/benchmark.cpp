@@ -0,0 +1,271 @@
+/*
+* Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @brief Throughput and latency of shadow updates.
+ *
+ * N clients each keep a window of W updates in flight until M updates are acked. DeviceManagementStub answers them
+ * in process, through the broker of TestConf. Reported: connect time, ack latency percentiles, updates/s, the resident
+ * memory a client takes and the CPU time of the housekeeping thread.
+ *
+ * usage: ./benchmark [clients] [updatesPerClient] [window]
+ */
+
+#include <device_management.h>
+#include <device_management_conf.h>
+#include <cjson/cJSON.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "device_management_stub.h"
+#include "test_conf.h"
+#include "test_util.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Bench;
+
+/* One slot of the window of a client, reused by the update sent after its ack. */
+struct Slot {
+    Bench *bench;
+    int client;
+    Clock::time_point sent;
+};
+
+struct Bench {
+    std::vector<DeviceManagementClient> clients;
+    std::vector<int> remaining;        // updates not sent yet, per client
+    std::vector<Slot> slots;
+    std::vector<double> latencies;     // ms
+    std::atomic<int> connected;
+    std::atomic<int> rejected;
+    std::atomic<int> timedOut;
+    int outstanding;                   // updates sent and not acked, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+static long resident_kb() {
+    long pages = 0;
+    long resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* CPU time of the thread of the library by the name it gives it, in ms. */
+static double thread_cpu_ms(const std::string &name) {
+    double ms = 0;
+    DIR *dir = opendir("/proc/self/task");
+    if (dir == NULL) {
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string task = std::string("/proc/self/task/") + entry->d_name;
+        std::string comm;
+        std::ifstream(task + "/comm") >> comm;
+        if (comm != name) {
+            continue;
+        }
+        // utime and stime are the 14th and 15th fields, after the command in parentheses.
+        std::ifstream statFile(task + "/stat");
+        std::string stat((std::istreambuf_iterator<char>(statFile)), std::istreambuf_iterator<char>());
+        size_t end = stat.rfind(')');
+        if (end == std::string::npos) {
+            continue;
+        }
+        std::vector<std::string> fields;
+        size_t pos = end + 2;
+        while (pos < stat.size()) {
+            size_t next = stat.find(' ', pos);
+            fields.push_back(stat.substr(pos, next == std::string::npos ? std::string::npos : next - pos));
+            pos = next == std::string::npos ? stat.size() : next + 1;
+        }
+        if (fields.size() > 12) {
+            ms += (atol(fields[11].data()) + atol(fields[12].data())) * 1000.0 / sysconf(_SC_CLK_TCK);
+        }
+    }
+    closedir(dir);
+    return ms;
+}
+
+static void send_update(Slot *slot);
+
+static void on_ack(ShadowAction action, ShadowAckStatus status, ShadowActionAck *ack, void *context) {
+    Slot *slot = static_cast<Slot *>(context);
+    Bench *bench = slot->bench;
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - slot->sent).count();
+    bool next = false;
+
+    if (status == SHADOW_ACK_REJECTED) {
+        bench->rejected++;
+    } else if (status == SHADOW_ACK_TIMEOUT) {
+        bench->timedOut++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(bench->mutex);
+        if (status == SHADOW_ACK_ACCEPTED) {
+            bench->latencies.push_back(ms);
+        }
+        if (bench->remaining[slot->client] > 0) {
+            bench->remaining[slot->client]--;
+            next = true;
+        } else if (--bench->outstanding == 0) {
+            bench->done.notify_all();
+        }
+    }
+    if (next) {
+        send_update(slot);
+    }
+}
+
+static void send_update(Slot *slot) {
+    cJSON *reported = cJSON_CreateObject();
+    cJSON_AddNumberToObject(reported, "value", rand() % 1000);
+    slot->sent = Clock::now();
+    DmReturnCode rc = device_management_shadow_update(slot->bench->clients[slot->client], on_ack, slot, 10, reported,
+                                                      NULL);
+    if (rc != SUCCESS) {
+        // Counted as a timeout, which also moves the window on.
+        on_ack(SHADOW_UPDATE, SHADOW_ACK_TIMEOUT, NULL, slot);
+    }
+}
+
+static void on_connected(DeviceManagementClient client, DmReturnCode rc, void *context) {
+    Bench *bench = static_cast<Bench *>(context);
+    std::lock_guard<std::mutex> lock(bench->mutex);
+    if (rc != SUCCESS) {
+        fprintf(stderr, "a client failed to connect.\n");
+        exit(1);
+    }
+    bench->connected++;
+    bench->done.notify_all();
+}
+
+static double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t i = static_cast<size_t>(p / 100 * (sorted.size() - 1));
+    return sorted[i];
+}
+
+int main(int argc, char *argv[]) {
+    int clientCount = argc > 1 ? atoi(argv[1]) : 100;
+    int updates = argc > 2 ? atoi(argv[2]) : 1000;
+    int window = argc > 3 ? atoi(argv[3]) : 16;
+    if (clientCount <= 0 || updates <= 0 || window <= 0 || window > MAX_IN_FLIGHT_MESSAGE) {
+        printf("usage: %s [clients] [updatesPerClient] [window]\n", argv[0]);
+        return 1;
+    }
+    window = std::min(window, updates);
+
+    device_management_init();
+    std::shared_ptr<DeviceManagementStub> stub = DeviceManagementStub::create();
+    stub->start();
+
+    Bench bench;
+    bench.connected = 0;
+    bench.rejected = 0;
+    bench.timedOut = 0;
+    bench.outstanding = 0;
+    bench.clients.resize(clientCount);
+    bench.remaining.assign(clientCount, updates - window);
+    bench.slots.resize(clientCount * window);
+    bench.latencies.reserve(static_cast<size_t>(clientCount) * updates);
+
+    std::string run = TestUtil::uuid().substr(0, 8);
+    long rssBefore = resident_kb();
+    for (int i = 0; i < clientCount; ++i) {
+        std::string deviceName = "bench-" + run + "-" + std::to_string(i);
+        if (device_management_create(&bench.clients[i], TestConf::getTestMqttBroker().data(), deviceName.data(),
+                                     TestConf::getTestMqttUsername().data(), TestConf::getTestMqttPassword().data(),
+                                     NULL, NULL) != SUCCESS) {
+            fprintf(stderr, "failed to create client %d.\n", i);
+            return 1;
+        }
+    }
+    long rssCreated = resident_kb();
+
+    Clock::time_point t0 = Clock::now();
+    for (int i = 0; i < clientCount; ++i) {
+        if (device_management_connect_async(bench.clients[i], on_connected, &bench) != SUCCESS) {
+            fprintf(stderr, "failed to connect client %d.\n", i);
+            return 1;
+        }
+    }
+    {
+        std::unique_lock<std::mutex> lock(bench.mutex);
+        bench.done.wait(lock, [&bench, clientCount] { return bench.connected == clientCount; });
+    }
+    double connectMs = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    long rssConnected = resident_kb();
+
+    double keeperBefore = thread_cpu_ms("dm-keeper");
+    bench.outstanding = clientCount * window;
+    t0 = Clock::now();
+    for (int i = 0; i < clientCount; ++i) {
+        for (int j = 0; j < window; ++j) {
+            Slot *slot = &bench.slots[i * window + j];
+            slot->bench = &bench;
+            slot->client = i;
+            send_update(slot);
+        }
+    }
+    {
+        std::unique_lock<std::mutex> lock(bench.mutex);
+        bench.done.wait(lock, [&bench] { return bench.outstanding == 0; });
+    }
+    double runMs = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    double keeperMs = thread_cpu_ms("dm-keeper") - keeperBefore;
+
+    std::vector<double> sorted(bench.latencies);
+    std::sort(sorted.begin(), sorted.end());
+    long total = static_cast<long>(clientCount) * updates;
+    printf("%d clients x %d updates, window %d\n", clientCount, updates, window);
+    printf("connect: %.1f ms for all clients\n", connectMs);
+    printf("memory: %.1f KB/client created, %.1f KB/client connected\n",
+           static_cast<double>(rssCreated - rssBefore) / clientCount,
+           static_cast<double>(rssConnected - rssBefore) / clientCount);
+    printf("throughput: %.0f updates/s, %ld accepted, %d rejected, %d timed out\n", total * 1000.0 / runMs,
+           static_cast<long>(sorted.size()), bench.rejected.load(), bench.timedOut.load());
+    printf("ack latency ms: p50 %.2f, p90 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n", percentile(sorted, 50),
+           percentile(sorted, 90), percentile(sorted, 99), percentile(sorted, 99.9),
+           sorted.empty() ? 0 : sorted.back());
+    printf("housekeeping: %.1f ms CPU, %.2f us/update\n", keeperMs, keeperMs * 1000 / total);
+
+    for (int i = 0; i < clientCount; ++i) {
+        device_management_destroy(bench.clients[i]);
+    }
+    stub.reset();
+    device_management_fini();
+    return bench.timedOut > 0 || bench.rejected > 0 ? 1 : 0;
+}
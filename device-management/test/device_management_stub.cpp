@@ -30,6 +30,7 @@
 #include <boost/format.hpp>
 #include <mutex>
 #include <list>
+#include <map>
 
 #include "test_conf.h"
 #include "test_util.h"
@@ -49,7 +50,12 @@ public:
 
     virtual void clearListeners() override;
 
+    virtual std::string lastReported(const std::string &device) override;
+
+    virtual void kick(const std::string &clientId) override;
+
 private:
+    std::string broker;
     std::string username;
     std::string password;
     MQTTClient client;
@@ -57,6 +63,8 @@ private:
     bool autoRespond;
     std::list<CallBack> callbacks;
     std::mutex callbackMutex;
+    std::map<std::string, std::string> reported;
+    std::mutex reportedMutex;
 
     static const std::regex topicRegex;
     static const std::string update;
@@ -88,7 +96,7 @@ const std::string DeviceManagementStubImpl::rejectedFormat = TestConf::getTopicP
 
 DeviceManagementStubImpl::DeviceManagementStubImpl(const std::string &broker, const std::string &username,
                                                    const std::string &password, const std::string &clientId) :
-        username(username), password(password) {
+        broker(broker), username(username), password(password) {
     MQTTClient_create(&client, broker.data(), clientId.data(), MQTTCLIENT_PERSISTENCE_NONE, NULL);
     autoRespond = true;
 }
@@ -124,6 +132,23 @@ void DeviceManagementStubImpl::clearListeners() {
     callbacks.clear();
 }
 
+std::string DeviceManagementStubImpl::lastReported(const std::string &device) {
+    std::lock_guard<std::mutex> lock(reportedMutex);
+    auto found = reported.find(device);
+    return found != reported.end() ? found->second : std::string();
+}
+
+void DeviceManagementStubImpl::kick(const std::string &clientId) {
+    MQTTClient other;
+    MQTTClient_connectOptions options = MQTTClient_connectOptions_initializer;
+    options.username = username.data();
+    options.password = password.data();
+    MQTTClient_create(&other, broker.data(), clientId.data(), MQTTCLIENT_PERSISTENCE_NONE, NULL);
+    MQTTClient_connect(other, &options);
+    MQTTClient_disconnect(other, 10);
+    MQTTClient_destroy(&other);
+}
+
 int DeviceManagementStubImpl::message_arrived(void *context, char *topicName, int topicLen,
                                               MQTTClient_message *message) {
     DeviceManagementStubImpl *impl = static_cast<DeviceManagementStubImpl *>(context);
@@ -172,6 +197,13 @@ void DeviceManagementStubImpl::delivery_complete(void *context, MQTTClient_deliv
 }
 
 void DeviceManagementStubImpl::processUpdate(const std::string &device, const std::string requestId, cJSON *document) {
+    cJSON *item = cJSON_GetObjectItem(document, "reported");
+    if (item != NULL) {
+        char *printed = cJSON_PrintUnformatted(item);
+        std::lock_guard<std::mutex> lock(reportedMutex);
+        reported[device] = printed;
+        free(printed);
+    }
     if (autoRespond) {
         boost::format format(acceptedFormat);
         std::string topic = boost::str(format % device % update);
@@ -44,6 +44,12 @@ public:
     virtual void addListener(CallBack f) = 0;
 
     virtual void clearListeners() = 0;
+
+    // The reported of the last update of the device, as unformatted JSON, "" if none arrived.
+    virtual std::string lastReported(const std::string &device) = 0;
+
+    // Connect with the client id of a connected client, which the broker disconnects, then go away.
+    virtual void kick(const std::string &clientId) = 0;
 };
 
 #endif //DEVICE_MANAGEMENT_DEVICEMANAGEMENTSTUB_H
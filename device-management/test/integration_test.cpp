@@ -29,6 +29,7 @@
 #include "test_conf.h"
 #include "test_util.h"
 #include <regex>
+#include <atomic>
 /*
  * Below test will fail. Seems it's a bug of log4c.
 TEST(Log4cTest, DoubleInit) {
@@ -139,3 +140,204 @@ TEST_F(UpdateTest, UpdateHappy) {
     ASSERT_EQ(2, listener.called);
     device_management_fini();
 }
+
+// Call the listener of the context, e.g. for each caller merged into one update.
+static void countingCallback(ShadowAction action, ShadowAckStatus status, ShadowActionAck *ack, void *context) {
+    MockListener *pListener = static_cast<MockListener *>(context);
+    pListener->ClientCallback(action, status, ack, context);
+    pListener->called++;
+}
+
+static void waitForCalls(MockListener &listener, int count) {
+    for (int i = 0; i < 20; ++i) {
+        if (listener.called >= count) {
+            break;
+        }
+        sleep(1);
+    }
+}
+
+static int reportedNumber(const std::string &reported, const char *key) {
+    cJSON *document = cJSON_Parse(reported.data());
+    cJSON *item = cJSON_GetObjectItem(document, key);
+    int value = cJSON_IsNumber(item) ? item->valueint : -1;
+    cJSON_Delete(document);
+    return value;
+}
+
+static void updateNumber(DeviceManagementClient client, MockListener *listener, const char *key, int value,
+                         DmReturnCode expected) {
+    cJSON *reported = cJSON_CreateObject();
+    cJSON_AddNumberToObject(reported, key, value);
+    EXPECT_EQ(expected, device_management_shadow_update(client, countingCallback, listener, 10, reported, NULL));
+    cJSON_Delete(reported);
+}
+
+TEST_F(UpdateTest, LingeringUpdateQueuedBeforeOffline) {
+    device_management_init();
+    DeviceManagementClient client;
+    std::string testDeviceName = "LingeringUpdateQueuedBeforeOffline-" + TestUtil::uuid();
+    device_management_create(&client, TestConf::getTestMqttBroker().data(), testDeviceName.data(),
+                             TestConf::getTestMqttUsername().data(), TestConf::getTestMqttPassword().data(), NULL, NULL);
+    device_management_shadow_set_update_linger(client, 3000);
+    device_management_shadow_set_offline_queue(client, 10);
+    ASSERT_EQ(SUCCESS, device_management_connect(client));
+
+    MockListener listener;
+    EXPECT_CALL(listener, ClientCallback(SHADOW_UPDATE, SHADOW_ACK_ACCEPTED, testing::_, &listener)).Times(2);
+
+    // x=1 lingers, the connection drops, x=2 goes into the offline queue.
+    updateNumber(client, &listener, "x", 1, SUCCESS);
+    stub->kick(testDeviceName);
+    usleep(300 * 1000);
+    updateNumber(client, &listener, "x", 2, SUCCESS);
+
+    // Reconnected automatically, the queue is sent. The older x=1 must not come after it.
+    waitForCalls(listener, 2);
+    ASSERT_EQ(2, listener.called);
+    EXPECT_EQ(2, reportedNumber(stub->lastReported(testDeviceName), "x"));
+    device_management_fini();
+}
+
+// Tell the listener of the updates the stub gets from the device.
+static void listenUpdates(std::shared_ptr<DeviceManagementStub> &stub, MockListener *listener,
+                          const std::string &device) {
+    stub->addListener([listener, device](const std::string &deviceName, const std::string action) {
+        if (deviceName == device) {
+            listener->ServerCallBack(deviceName, action);
+        }
+    });
+}
+
+TEST_F(UpdateTest, LingerCoalesces) {
+    device_management_init();
+    DeviceManagementClient client;
+    std::string testDeviceName = "LingerCoalesces-" + TestUtil::uuid();
+    device_management_create(&client, TestConf::getTestMqttBroker().data(), testDeviceName.data(),
+                             TestConf::getTestMqttUsername().data(), TestConf::getTestMqttPassword().data(), NULL, NULL);
+    device_management_shadow_set_update_linger(client, 500);
+    ASSERT_EQ(SUCCESS, device_management_connect(client));
+
+    MockListener listener;
+    listenUpdates(stub, &listener, testDeviceName);
+    EXPECT_CALL(listener, ServerCallBack(testDeviceName, "update")).Times(1);
+    EXPECT_CALL(listener, ClientCallback(SHADOW_UPDATE, SHADOW_ACK_ACCEPTED, testing::_, &listener)).Times(3);
+
+    updateNumber(client, &listener, "a", 1, SUCCESS);
+    updateNumber(client, &listener, "b", 2, SUCCESS);
+    updateNumber(client, &listener, "a", 3, SUCCESS);
+
+    waitForCalls(listener, 3);
+    ASSERT_EQ(3, listener.called);
+    std::string reported = stub->lastReported(testDeviceName);
+    EXPECT_EQ(3, reportedNumber(reported, "a"));
+    EXPECT_EQ(2, reportedNumber(reported, "b"));
+    device_management_fini();
+}
+
+TEST_F(UpdateTest, OfflineQueueCompacts) {
+    device_management_init();
+    DeviceManagementClient client;
+    std::string testDeviceName = "OfflineQueueCompacts-" + TestUtil::uuid();
+    device_management_create(&client, TestConf::getTestMqttBroker().data(), testDeviceName.data(),
+                             TestConf::getTestMqttUsername().data(), TestConf::getTestMqttPassword().data(), NULL, NULL);
+    device_management_shadow_set_offline_queue(client, 2);
+
+    MockListener listener;
+    listenUpdates(stub, &listener, testDeviceName);
+    EXPECT_CALL(listener, ServerCallBack(testDeviceName, "update")).Times(1);
+    EXPECT_CALL(listener, ClientCallback(SHADOW_UPDATE, SHADOW_ACK_ACCEPTED, testing::_, &listener)).Times(3);
+
+    // Not connected yet. x is queued twice as one property, z would be a third one.
+    updateNumber(client, &listener, "x", 1, SUCCESS);
+    updateNumber(client, &listener, "y", 1, SUCCESS);
+    updateNumber(client, &listener, "x", 2, SUCCESS);
+    updateNumber(client, &listener, "z", 1, NOT_CONNECTED);
+
+    ASSERT_EQ(SUCCESS, device_management_connect(client));
+    waitForCalls(listener, 3);
+    ASSERT_EQ(3, listener.called);
+    std::string reported = stub->lastReported(testDeviceName);
+    EXPECT_EQ(2, reportedNumber(reported, "x"));
+    EXPECT_EQ(1, reportedNumber(reported, "y"));
+    EXPECT_EQ(-1, reportedNumber(reported, "z"));
+    device_management_fini();
+}
+
+TEST_F(UpdateTest, CacheSkipsUnchanged) {
+    device_management_init();
+    DeviceManagementClient client;
+    std::string testDeviceName = "CacheSkipsUnchanged-" + TestUtil::uuid();
+    device_management_create(&client, TestConf::getTestMqttBroker().data(), testDeviceName.data(),
+                             TestConf::getTestMqttUsername().data(), TestConf::getTestMqttPassword().data(), NULL, NULL);
+    device_management_shadow_set_cache(client, true);
+    ASSERT_EQ(SUCCESS, device_management_connect(client));
+
+    MockListener listener;
+    listenUpdates(stub, &listener, testDeviceName);
+    EXPECT_CALL(listener, ServerCallBack(testDeviceName, "update")).Times(1);
+    EXPECT_CALL(listener, ClientCallback(SHADOW_UPDATE, SHADOW_ACK_ACCEPTED, testing::_, &listener)).Times(2);
+
+    updateNumber(client, &listener, "x", 1, SUCCESS);
+    waitForCalls(listener, 1);
+    ASSERT_EQ(1, listener.called);
+    // The shadow has it already, the ack comes without a message.
+    updateNumber(client, &listener, "x", 1, SUCCESS);
+    EXPECT_EQ(2, listener.called);
+    sleep(1);
+    device_management_fini();
+}
+
+TEST(ConnectTest, ConnectAsyncCallsOnce) {
+    DeviceManagementClient client;
+    device_management_init();
+
+    std::string testDeviceName = "ConnectAsyncCallsOnce-" + TestUtil::uuid();
+    device_management_create(&client, TestConf::getTestMqttBroker().data(), testDeviceName.data(),
+                             TestConf::getTestMqttUsername().data(), TestConf::getTestMqttPassword().data(), NULL, NULL);
+    std::atomic<int> called(0);
+    std::atomic<int> rc(-1);
+    DeviceManagementConnectCallback cb{[](DeviceManagementClient client, DmReturnCode result, void *context) {
+        std::pair<std::atomic<int> *, std::atomic<int> *> *p =
+                static_cast<std::pair<std::atomic<int> *, std::atomic<int> *> *>(context);
+        *p->second = result;
+        (*p->first)++;
+    }};
+    std::pair<std::atomic<int> *, std::atomic<int> *> context(&called, &rc);
+    ASSERT_EQ(SUCCESS, device_management_connect_async(client, cb, &context));
+
+    for (int i = 0; i < 20; ++i) {
+        if (called > 0) {
+            break;
+        }
+        sleep(1);
+    }
+    // Nothing more comes later.
+    sleep(2);
+    EXPECT_EQ(1, called);
+    EXPECT_EQ(SUCCESS, rc);
+    device_management_fini();
+}
+
+TEST_F(UpdateTest, SetQos) {
+    device_management_init();
+    DeviceManagementClient client;
+    std::string testDeviceName = "SetQos-" + TestUtil::uuid();
+    device_management_create(&client, TestConf::getTestMqttBroker().data(), testDeviceName.data(),
+                             TestConf::getTestMqttUsername().data(), TestConf::getTestMqttPassword().data(), NULL, NULL);
+    EXPECT_EQ(SUCCESS, device_management_set_qos(client, 1));
+    EXPECT_EQ(BAD_ARGUMENT, device_management_set_qos(client, 2));
+    EXPECT_EQ(BAD_ARGUMENT, device_management_set_qos(client, -1));
+    EXPECT_EQ(SUCCESS, device_management_set_qos(client, 0));
+    ASSERT_EQ(SUCCESS, device_management_connect(client));
+
+    MockListener listener;
+    listenUpdates(stub, &listener, testDeviceName);
+    EXPECT_CALL(listener, ServerCallBack(testDeviceName, "update")).Times(1);
+    EXPECT_CALL(listener, ClientCallback(SHADOW_UPDATE, SHADOW_ACK_ACCEPTED, testing::_, &listener)).Times(1);
+
+    updateNumber(client, &listener, "x", 1, SUCCESS);
+    waitForCalls(listener, 1);
+    ASSERT_EQ(1, listener.called);
+    device_management_fini();
+}
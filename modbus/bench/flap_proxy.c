@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// a tcp proxy in front of the broker which fails every now and then, for the
+// soak test of the gateway. it forwards the connections from the listen port
+// to the target, and every up ms it drops them all and stops listening for down
+// ms, so that the mqtt clients of the gateway lose the broker and reconnect.
+//
+// usage: flap_proxy -l listen port -t host:port [-u up ms] [-d down ms]
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+enum
+{
+    MAX_PAIRS = 256,
+    BUF_SIZE = 16384,
+};
+
+typedef struct
+{
+    int client;
+    int server;
+} Pair;
+
+static Pair g_pairs[MAX_PAIRS];
+static int g_pair_num = 0;
+static struct sockaddr_in g_target;
+static volatile int g_stop = 0;
+
+long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+int open_listener(int port)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0)
+    {
+        return -1;
+    }
+    int on = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 64) != 0)
+    {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+void close_pair(int i)
+{
+    close(g_pairs[i].client);
+    close(g_pairs[i].server);
+    g_pairs[i] = g_pairs[--g_pair_num];
+}
+
+void drop_all()
+{
+    while (g_pair_num > 0)
+    {
+        close_pair(g_pair_num - 1);
+    }
+}
+
+void accept_client(int listener)
+{
+    int client = accept(listener, NULL, NULL);
+    if (client < 0)
+    {
+        return;
+    }
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    if (g_pair_num >= MAX_PAIRS || server < 0
+        || connect(server, (struct sockaddr*)&g_target, sizeof(g_target)) != 0)
+    {
+        close(client);
+        if (server >= 0)
+        {
+            close(server);
+        }
+        return;
+    }
+    int on = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    g_pairs[g_pair_num].client = client;
+    g_pairs[g_pair_num].server = server;
+    g_pair_num++;
+}
+
+// copy what's readable from one side to the other, -1 once either is closed
+int forward(int from, int to)
+{
+    char buf[BUF_SIZE];
+    ssize_t n = read(from, buf, sizeof(buf));
+    if (n <= 0)
+    {
+        return -1;
+    }
+    ssize_t done = 0;
+    while (done < n)
+    {
+        ssize_t w = write(to, buf + done, n - done);
+        if (w <= 0)
+        {
+            return -1;
+        }
+        done += w;
+    }
+    return 0;
+}
+
+void on_signal(int sig)
+{
+    g_stop = 1;
+}
+
+int main(int argc, char** argv)
+{
+    int port = 0;
+    int up_ms = 60000;
+    int down_ms = 5000;
+    char target[128] = "";
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "l:t:u:d:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': port = atoi(optarg); break;
+            case 't': snprintf(target, sizeof(target), "%s", optarg); break;
+            case 'u': up_ms = atoi(optarg); break;
+            case 'd': down_ms = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s -l listen port -t host:port [-u up ms] [-d down ms]\n",
+                    argv[0]);
+                return 1;
+        }
+    }
+    char* colon = strrchr(target, ':');
+    if (port <= 0 || colon == NULL)
+    {
+        fprintf(stderr, "the listen port and the target host:port are required\n");
+        return 1;
+    }
+    *colon = 0;
+    memset(&g_target, 0, sizeof(g_target));
+    g_target.sin_family = AF_INET;
+    g_target.sin_port = htons(atoi(colon + 1));
+    if (inet_pton(AF_INET, target, &g_target.sin_addr) != 1)
+    {
+        fprintf(stderr, "the target must be an ipv4 address, not %s\n", target);
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = open_listener(port);
+    if (listener < 0)
+    {
+        fprintf(stderr, "failed to listen on %d: %s\n", port, strerror(errno));
+        return 1;
+    }
+    long long flaps = 0;
+    long long next = now_ms() + up_ms;
+    while (!g_stop)
+    {
+        long long now = now_ms();
+        if (now >= next)
+        {
+            if (listener >= 0)
+            {
+                // the broker goes away, the clients see their connections reset
+                drop_all();
+                close(listener);
+                listener = -1;
+                flaps++;
+                next = now + down_ms;
+            }
+            else
+            {
+                listener = open_listener(port);
+                next = now + (listener >= 0 ? up_ms : 1000);
+            }
+            continue;
+        }
+
+        struct pollfd fds[1 + MAX_PAIRS * 2];
+        int nfds = 0;
+        if (listener >= 0)
+        {
+            fds[nfds].fd = listener;
+            fds[nfds++].events = POLLIN;
+        }
+        int i = 0;
+        for (i = 0; i < g_pair_num; i++)
+        {
+            fds[nfds].fd = g_pairs[i].client;
+            fds[nfds++].events = POLLIN;
+            fds[nfds].fd = g_pairs[i].server;
+            fds[nfds++].events = POLLIN;
+        }
+        int wait = (int)(next - now);
+        if (poll(fds, nfds, wait < 1000 ? wait : 1000) <= 0)
+        {
+            continue;
+        }
+        int base = 0;
+        if (listener >= 0)
+        {
+            base = 1;
+        }
+        // from the last pair, so that a closed one is replaced by one already handled
+        for (i = g_pair_num - 1; i >= 0; i--)
+        {
+            short c = fds[base + i * 2].revents;
+            short s = fds[base + i * 2 + 1].revents;
+            if (((c & (POLLIN | POLLHUP | POLLERR)) && forward(g_pairs[i].client, g_pairs[i].server) != 0)
+                || ((s & (POLLIN | POLLHUP | POLLERR)) && forward(g_pairs[i].server, g_pairs[i].client) != 0))
+            {
+                close_pair(i);
+            }
+        }
+        if (listener >= 0 && (fds[0].revents & POLLIN))
+        {
+            accept_client(listener);
+        }
+    }
+    drop_all();
+    if (listener >= 0)
+    {
+        close(listener);
+    }
+    printf("broker flaps: %lld\n", flaps);
+    return 0;
+}
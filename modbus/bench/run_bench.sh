@@ -0,0 +1,120 @@
+#!/bin/bash
+# benchmark the modbus gateway against simulated slaves and a local broker.
+# it generates the gwconfig.txt and policyCache.txt of the given size in a work
+# directory, runs the gateway there for a while, and reports the requests served,
+# the scheduling lateness measured by the slaves, the messages published and the
+# cpu and memory used by the gateway.
+#
+# the settings are taken from the environment, e.g.
+#   SLAVES=16 POLICIES=2000 INTERVAL_MS=500 LATENCY_MS=2 ./run_bench.sh
+# a broker must be listening on BROKER, mosquitto_sub is used to count the
+# messages if it's installed
+
+GATEWAY=${GATEWAY:-$(cd "$(dirname "$0")/../.." && pwd)/bdModbusGateway}
+BROKER=${BROKER:-tcp://127.0.0.1:1883}
+SLAVES=${SLAVES:-8}
+POLICIES=${POLICIES:-1000}
+LENGTH=${LENGTH:-10}
+INTERVAL_MS=${INTERVAL_MS:-1000}
+LATENCY_MS=${LATENCY_MS:-0}
+JITTER_MS=${JITTER_MS:-0}
+DROP_PERCENT=${DROP_PERCENT:-0}
+EXCEPTION_PERCENT=${EXCEPTION_PERCENT:-0}
+DURATION=${DURATION:-30}
+BASE_PORT=${BASE_PORT:-15020}
+WORKERS=${WORKERS:-4}
+TOPIC=${TOPIC:-bench/data}
+WORKDIR=${WORKDIR:-$(mktemp -d)}
+
+BENCHDIR=$(cd "$(dirname "$0")" && pwd)
+if [ ! -x "$BENCHDIR/slave_sim" ]; then
+    make -C "$BENCHDIR" slave_sim || exit 1
+fi
+if [ ! -x "$GATEWAY" ]; then
+    echo "the gateway $GATEWAY is not built"
+    exit 1
+fi
+# the policies of a slave are spaced, so that they are never merged into one request
+if [ $(( (POLICIES + SLAVES - 1) / SLAVES * (LENGTH + 1) )) -ge 8192 ]; then
+    echo "too many policies per slave, add slaves or shorten the length"
+    exit 1
+fi
+
+cat > "$WORKDIR/gwconfig.txt" <<CONF
+{
+    "endpoint": "$BROKER",
+    "topic": "bench/config",
+    "user": "bench",
+    "password": "bench",
+    "workerNum": $WORKERS
+}
+CONF
+
+{
+    echo "["
+    i=0
+    while [ $i -lt $POLICIES ]; do
+        port=$((BASE_PORT + i % SLAVES))
+        addr=$((i / SLAVES * (LENGTH + 1)))
+        [ $i -gt 0 ] && echo ","
+        printf '{"gatewayid":"bench","trantable":"bench","slaveid":1,"mode":0,'
+        printf '"ip_com_addr":"127.0.0.1:%d","functioncode":3,"start_addr":%d,' $port $addr
+        printf '"length":%d,"interval":1,"intervalMs":%d,' $LENGTH $INTERVAL_MS
+        printf '"pubChannel":{"endpoint":"%s","topic":"%s","user":"bench","password":"bench"}}' \
+            "$BROKER" "$TOPIC"
+        i=$((i + 1))
+    done
+    echo "]"
+} > "$WORKDIR/policyCache.txt"
+
+"$BENCHDIR/slave_sim" -n $SLAVES -p $BASE_PORT -i $INTERVAL_MS -l $LATENCY_MS -j $JITTER_MS \
+    -e $DROP_PERCENT -x $EXCEPTION_PERCENT > "$WORKDIR/slave_sim.log" 2>&1 &
+SIM=$!
+sleep 1
+
+SUB=""
+if which mosquitto_sub > /dev/null 2>&1; then
+    host=${BROKER#*://}
+    mosquitto_sub -h ${host%:*} -p ${host##*:} -u bench -P bench -t "$TOPIC" \
+        > "$WORKDIR/messages.log" 2>/dev/null &
+    SUB=$!
+fi
+
+(cd "$WORKDIR" && exec "$GATEWAY" > gateway.log 2>&1) &
+GW=$!
+# skip the startup, connecting the buses and the broker
+sleep 3
+TICKS=$(getconf CLK_TCK)
+cpu_ticks() {
+    awk '{print $14 + $15}' /proc/$GW/stat 2>/dev/null
+}
+start_ticks=$(cpu_ticks)
+start_msgs=0
+[ -n "$SUB" ] && start_msgs=$(wc -l < "$WORKDIR/messages.log")
+sleep $DURATION
+end_ticks=$(cpu_ticks)
+end_msgs=0
+[ -n "$SUB" ] && end_msgs=$(wc -l < "$WORKDIR/messages.log")
+rss=$(awk '/VmRSS/ {print $2}' /proc/$GW/status 2>/dev/null)
+hwm=$(awk '/VmHWM/ {print $2}' /proc/$GW/status 2>/dev/null)
+
+kill $GW 2>/dev/null
+wait $GW 2>/dev/null
+kill -INT $SIM 2>/dev/null
+wait $SIM 2>/dev/null
+[ -n "$SUB" ] && kill $SUB 2>/dev/null
+
+echo "$POLICIES policies on $SLAVES slaves, interval ${INTERVAL_MS}ms, latency ${LATENCY_MS}ms," \
+    "drop ${DROP_PERCENT}%, exception ${EXCEPTION_PERCENT}%, $WORKERS workers"
+echo "expected: $(awk "BEGIN {printf \"%.1f\", $POLICIES * 1000 / $INTERVAL_MS}") polls/s"
+cat "$WORKDIR/slave_sim.log"
+if [ -n "$SUB" ]; then
+    echo "messages: $(awk "BEGIN {printf \"%.1f\", ($end_msgs - $start_msgs) / $DURATION}")/s"
+fi
+if [ -n "$start_ticks" ] && [ -n "$end_ticks" ]; then
+    echo "gateway cpu: $(awk "BEGIN {printf \"%.1f\", ($end_ticks - $start_ticks) * 100 / $TICKS / $DURATION}")%," \
+        "rss ${rss}kB, peak ${hwm}kB"
+else
+    echo "the gateway exited, see $WORKDIR/gateway.log"
+fi
+echo "logs in $WORKDIR"
@@ -0,0 +1,228 @@
+#!/bin/bash
+# soak test of the modbus gateway, hours of the disturbances a gateway sees in
+# the field, to tell a leak from the memory and the connections in use.
+# the gateway runs against simulated slaves and a local broker as in run_bench.sh,
+# its broker is reached through flap_proxy, which drops the connections every
+# FLAP_UP_S for FLAP_DOWN_S so that the mqtt clients reconnect. every CONFIG_S,
+# another set of policies is published on the config topic, full configs and
+# deltas in turn, and every FAIL_S the slaves are stopped for FAIL_DOWN_S.
+#
+# every SAMPLE_S the rss, the anonymous memory (the heaps, the arenas of the
+# threads and their stacks), the open fds and the threads of the gateway are
+# written to samples.csv. the samples of WARMUP_S are skipped, then the median of
+# the first and of the last WINDOW samples are compared, and the test fails if
+# the growth is more than MAX_RSS_KB, MAX_ANON_KB or MAX_FDS, or if the gateway
+# exited. the settings are taken from the environment, e.g.
+#   HOURS=8 POLICIES=500 CONFIG_S=60 ./run_soak.sh
+# a broker must be listening on BROKER, mosquitto_pub must be installed for the
+# configs to change
+
+GATEWAY=${GATEWAY:-$(cd "$(dirname "$0")/../.." && pwd)/bdModbusGateway}
+BROKER=${BROKER:-tcp://127.0.0.1:1883}
+HOURS=${HOURS:-4}
+DURATION=${DURATION:-$((HOURS * 3600))}
+SLAVES=${SLAVES:-8}
+POLICIES=${POLICIES:-200}
+LENGTH=${LENGTH:-10}
+INTERVAL_MS=${INTERVAL_MS:-1000}
+DROP_PERCENT=${DROP_PERCENT:-1}
+EXCEPTION_PERCENT=${EXCEPTION_PERCENT:-1}
+BASE_PORT=${BASE_PORT:-15020}
+PROXY_PORT=${PROXY_PORT:-11883}
+WORKERS=${WORKERS:-4}
+TOPIC=${TOPIC:-bench/data}
+CONFIG_S=${CONFIG_S:-120}
+FAIL_S=${FAIL_S:-300}
+FAIL_DOWN_S=${FAIL_DOWN_S:-20}
+FLAP_UP_S=${FLAP_UP_S:-600}
+FLAP_DOWN_S=${FLAP_DOWN_S:-10}
+SAMPLE_S=${SAMPLE_S:-10}
+WARMUP_S=${WARMUP_S:-600}
+WINDOW=${WINDOW:-30}
+MAX_RSS_KB=${MAX_RSS_KB:-4096}
+MAX_ANON_KB=${MAX_ANON_KB:-4096}
+MAX_FDS=${MAX_FDS:-4}
+WORKDIR=${WORKDIR:-$(mktemp -d)}
+
+BENCHDIR=$(cd "$(dirname "$0")" && pwd)
+if [ ! -x "$BENCHDIR/slave_sim" ] || [ ! -x "$BENCHDIR/flap_proxy" ]; then
+    make -C "$BENCHDIR" slave_sim flap_proxy || exit 1
+fi
+if [ ! -x "$GATEWAY" ]; then
+    echo "the gateway $GATEWAY is not built"
+    exit 1
+fi
+if [ $(( (POLICIES + SLAVES - 1) / SLAVES * (LENGTH + 1) )) -ge 8192 ]; then
+    echo "too many policies per slave, add slaves or shorten the length"
+    exit 1
+fi
+if [ $WARMUP_S -ge $DURATION ]; then
+    echo "the warmup must be shorter than the duration"
+    exit 1
+fi
+host=${BROKER#*://}
+PUB=""
+if which mosquitto_pub > /dev/null 2>&1; then
+    PUB=mosquitto_pub
+else
+    echo "mosquitto_pub is not installed, the configs are not changed"
+fi
+PROXY="tcp://127.0.0.1:$PROXY_PORT"
+
+cat > "$WORKDIR/gwconfig.txt" <<CONF
+{
+    "endpoint": "$PROXY",
+    "topic": "bench/config",
+    "user": "bench",
+    "password": "bench",
+    "workerNum": $WORKERS
+}
+CONF
+
+# the policies from first on, every step-th of them, polled every interval ms
+policies() {
+    local first=$1 step=$2 interval=$3
+    local i=$first sep=""
+    while [ $i -lt $POLICIES ]; do
+        port=$((BASE_PORT + i % SLAVES))
+        addr=$((i / SLAVES * (LENGTH + 1)))
+        printf '%s{"gatewayid":"bench","trantable":"soak%d","slaveid":1,"mode":0,' "$sep" $i
+        printf '"ip_com_addr":"127.0.0.1:%d","functioncode":3,"start_addr":%d,' $port $addr
+        printf '"length":%d,"interval":1,"intervalMs":%d,' $LENGTH $interval
+        printf '"pubChannel":{"endpoint":"%s","topic":"%s","user":"bench","password":"bench"}}' \
+            "$PROXY" "$TOPIC"
+        sep=","
+        i=$((i + step))
+    done
+}
+
+# the configs published in turn: all the policies, half of them at another
+# interval, then the other half added back by a delta
+VERSION=1
+full_config() {
+    echo "{\"version\": $VERSION, \"policies\": [$(policies 0 $1 $2)]}"
+}
+delta_config() {
+    echo "{\"version\": $VERSION, \"baseVersion\": $((VERSION - 1)), \"add\": [$(policies 1 2 $INTERVAL_MS)]}"
+}
+full_config 1 $INTERVAL_MS > "$WORKDIR/policyCache.txt"
+
+start_sim() {
+    "$BENCHDIR/slave_sim" -n $SLAVES -p $BASE_PORT -i $INTERVAL_MS \
+        -e $DROP_PERCENT -x $EXCEPTION_PERCENT >> "$WORKDIR/slave_sim.log" 2>&1 &
+    SIM=$!
+}
+start_sim
+"$BENCHDIR/flap_proxy" -l $PROXY_PORT -t "${host%:*}:${host##*:}" -u $((FLAP_UP_S * 1000)) \
+    -d $((FLAP_DOWN_S * 1000)) > "$WORKDIR/flap_proxy.log" 2>&1 &
+FLAP=$!
+sleep 1
+
+(cd "$WORKDIR" && exec "$GATEWAY" > gateway.log 2>&1) &
+GW=$!
+
+cleanup() {
+    kill $GW 2>/dev/null
+    wait $GW 2>/dev/null
+    kill -INT $SIM 2>/dev/null
+    wait $SIM 2>/dev/null
+    kill $FLAP 2>/dev/null
+    wait $FLAP 2>/dev/null
+}
+trap 'cleanup; exit 1' INT TERM
+
+echo "seconds,rss_kb,anon_kb,fds,threads" > "$WORKDIR/samples.csv"
+sample() {
+    local rss anon fds threads
+    rss=$(awk '/^VmRSS/ {print $2}' /proc/$GW/status 2>/dev/null)
+    threads=$(awk '/^Threads/ {print $2}' /proc/$GW/status 2>/dev/null)
+    anon=$(awk '/^Anonymous/ {print $2}' /proc/$GW/smaps_rollup 2>/dev/null)
+    fds=$(ls /proc/$GW/fd 2>/dev/null | wc -l)
+    [ -n "$rss" ] && echo "$1,$rss,${anon:-0},$fds,$threads" >> "$WORKDIR/samples.csv"
+}
+
+start=$(date +%s)
+next_sample=0
+next_config=$CONFIG_S
+next_fail=$FAIL_S
+sim_down=0
+configs=0
+failures=0
+elapsed=0
+while [ $elapsed -lt $DURATION ]; do
+    if ! kill -0 $GW 2>/dev/null; then
+        break
+    fi
+    if [ $elapsed -ge $next_sample ]; then
+        sample $elapsed
+        next_sample=$((next_sample + SAMPLE_S))
+    fi
+    if [ -n "$PUB" ] && [ $elapsed -ge $next_config ]; then
+        VERSION=$((VERSION + 1))
+        case $((configs % 3)) in
+            0) cfg=$(full_config 2 $((INTERVAL_MS * 2))) ;;
+            1) cfg=$(delta_config) ;;
+            2) cfg=$(full_config 1 $INTERVAL_MS) ;;
+        esac
+        echo "$cfg" > "$WORKDIR/config.json"
+        mosquitto_pub -h ${host%:*} -p ${host##*:} -u bench -P bench -q 1 \
+            -t bench/config -f "$WORKDIR/config.json" || echo "failed to publish config $VERSION"
+        configs=$((configs + 1))
+        next_config=$((next_config + CONFIG_S))
+    fi
+    if [ $sim_down -eq 0 ] && [ $elapsed -ge $next_fail ]; then
+        # the buses go offline, the gateway backs off and reconnects them
+        kill -INT $SIM 2>/dev/null
+        wait $SIM 2>/dev/null
+        sim_down=1
+        failures=$((failures + 1))
+    elif [ $sim_down -eq 1 ] && [ $elapsed -ge $((next_fail + FAIL_DOWN_S)) ]; then
+        start_sim
+        sim_down=0
+        next_fail=$((next_fail + FAIL_S))
+    fi
+    sleep 1
+    elapsed=$(( $(date +%s) - start ))
+done
+sample $elapsed
+alive=1
+kill -0 $GW 2>/dev/null || alive=0
+cleanup
+
+echo "$POLICIES policies on $SLAVES slaves for ${elapsed}s: $configs configs," \
+    "$failures bus failures, $(cat "$WORKDIR/flap_proxy.log")"
+result=0
+if [ $alive -eq 0 ]; then
+    echo "FAIL: the gateway exited, see $WORKDIR/gateway.log"
+    result=1
+fi
+# the growth from the median of the first window after the warmup to the one
+# of the last window, a median is not moved by the bursts of a reload
+growth=$(awk -F, -v warmup=$WARMUP_S -v window=$WINDOW '
+    function median(col, from, n,    i, j, t, v) {
+        for (i = 0; i < n; i++) v[i] = s[from + i, col]
+        for (i = 1; i < n; i++)
+            for (j = i; j > 0 && v[j - 1] > v[j]; j--) { t = v[j]; v[j] = v[j - 1]; v[j - 1] = t }
+        return v[int(n / 2)]
+    }
+    NR > 1 && $1 >= warmup { s[n, 2] = $2; s[n, 3] = $3; s[n, 4] = $4; n++ }
+    END {
+        if (n < 2) { print "none"; exit }
+        w = window < n / 2 ? window : int(n / 2)
+        printf "%d %d %d\n", median(2, n - w, w) - median(2, 0, w),
+            median(3, n - w, w) - median(3, 0, w), median(4, n - w, w) - median(4, 0, w)
+    }' "$WORKDIR/samples.csv")
+if [ "$growth" = "none" ]; then
+    echo "FAIL: too few samples after the warmup"
+    result=1
+else
+    set -- $growth
+    echo "growth after the warmup: rss ${1}kB, anonymous ${2}kB, fds $3"
+    if [ $1 -gt $MAX_RSS_KB ] || [ $2 -gt $MAX_ANON_KB ] || [ $3 -gt $MAX_FDS ]; then
+        echo "FAIL: the growth is over rss ${MAX_RSS_KB}kB, anonymous ${MAX_ANON_KB}kB, fds $MAX_FDS"
+        result=1
+    fi
+fi
+[ $result -eq 0 ] && echo "OK"
+echo "samples and logs in $WORKDIR"
+exit $result
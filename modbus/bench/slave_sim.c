@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// simulated modbus tcp slaves for benchmarking the gateway.
+// every slave listens on a port of its own, from the base port up, and answers
+// any unit id from the same registers, after the configured latency. a share
+// of the requests is dropped (the gateway times out) or answered with an exception.
+// the gap between two requests of the same start address is compared with the
+// polling interval, the lateness percentiles are printed on exit, so that the
+// scheduling of the gateway is measured where it matters, on the bus.
+//
+// usage: slave_sim [-n slaves] [-p base port] [-i interval ms] [-l latency ms]
+//                  [-j jitter ms] [-e drop %] [-x exception %] [-d duration s]
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <modbus/modbus.h>
+
+enum
+{
+    MAX_SLAVES = 1024,
+    ADDR_SLOTS = 8192,              // the start addresses tracked for the lateness
+    REGISTER_NUM = 10000,
+};
+
+typedef struct
+{
+    int id;
+    int port;
+    pthread_t thread;
+    unsigned int seed;
+    pthread_mutex_t lock;           // the report is taken while the slave is running
+    long long requests;
+    long long dropped;
+    long long exceptions;
+    long long* lastUs;              // the last request of every start address
+    long long* lateness;            // in us, may be negative if early
+    int latenessNum;
+    int latenessCap;
+} SimSlave;
+
+SimSlave g_slaves[MAX_SLAVES];
+int g_slave_num = 8;
+int g_base_port = 15020;
+long long g_interval_us = 1000000;
+int g_latency_ms = 0;
+int g_jitter_ms = 0;
+double g_drop_rate = 0;
+double g_exception_rate = 0;
+volatile sig_atomic_t g_stop = 0;
+
+long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void record_lateness(SimSlave* slave, int addr, long long now)
+{
+    long long* last = &slave->lastUs[addr % ADDR_SLOTS];
+    if (*last != 0)
+    {
+        if (slave->latenessNum == slave->latenessCap)
+        {
+            int cap = slave->latenessCap == 0 ? 4096 : slave->latenessCap * 2;
+            long long* grown = (long long*) realloc(slave->lateness, cap * sizeof(long long));
+            if (grown == NULL)
+            {
+                *last = now;
+                return;
+            }
+            slave->lateness = grown;
+            slave->latenessCap = cap;
+        }
+        slave->lateness[slave->latenessNum++] = now - *last - g_interval_us;
+    }
+    *last = now;
+}
+
+// serve the clients of one slave, one at a time, as the gateway keeps one
+// connection per bus
+void* slave_func(void* arg)
+{
+    SimSlave* slave = (SimSlave*) arg;
+    modbus_t* ctx = modbus_new_tcp("127.0.0.1", slave->port);
+    modbus_mapping_t* mapping = modbus_mapping_new(REGISTER_NUM, REGISTER_NUM, 
+        REGISTER_NUM, REGISTER_NUM);
+    if (ctx == NULL || mapping == NULL)
+    {
+        fprintf(stderr, "failed to create slave %d\n", slave->id);
+        return NULL;
+    }
+    int server = modbus_tcp_listen(ctx, 4);
+    if (server == -1)
+    {
+        fprintf(stderr, "failed to listen on port %d: %s\n", slave->port, modbus_strerror(errno));
+        return NULL;
+    }
+    int header = modbus_get_header_length(ctx);
+    uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
+    while (!g_stop)
+    {
+        if (modbus_tcp_accept(ctx, &server) == -1)
+        {
+            continue;
+        }
+        while (!g_stop)
+        {
+            int rc = modbus_receive(ctx, query);
+            if (rc == 0)
+            {
+                // not for this slave, e.g. a wrong unit id on rtu
+                continue;
+            }
+            if (rc < 0)
+            {
+                break;
+            }
+            long long now = now_us();
+            int addr = (query[header + 1] << 8) | query[header + 2];
+            pthread_mutex_lock(&slave->lock);
+            slave->requests++;
+            record_lateness(slave, addr, now);
+            pthread_mutex_unlock(&slave->lock);
+            int delay_ms = g_latency_ms;
+            if (g_jitter_ms > 0)
+            {
+                delay_ms += rand_r(&slave->seed) % (g_jitter_ms + 1);
+            }
+            if (delay_ms > 0)
+            {
+                usleep(delay_ms * 1000);
+            }
+            double dice = (double)rand_r(&slave->seed) / RAND_MAX;
+            if (dice < g_drop_rate)
+            {
+                slave->dropped++;
+                continue;
+            }
+            if (dice < g_drop_rate + g_exception_rate)
+            {
+                slave->exceptions++;
+                modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY);
+                continue;
+            }
+            // the values keep changing, like a real device
+            mapping->tab_registers[addr % REGISTER_NUM]++;
+            mapping->tab_input_registers[addr % REGISTER_NUM]++;
+            modbus_reply(ctx, query, rc, mapping);
+        }
+        modbus_close(ctx);
+    }
+    return NULL;
+}
+
+int compare_ll(const void* a, const void* b)
+{
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+void print_report(long long elapsed_us)
+{
+    long long requests = 0;
+    long long dropped = 0;
+    long long exceptions = 0;
+    int num = 0;
+    int i = 0;
+    for (i = 0; i < g_slave_num; i++)
+    {
+        pthread_mutex_lock(&g_slaves[i].lock);
+    }
+    for (i = 0; i < g_slave_num; i++)
+    {
+        requests += g_slaves[i].requests;
+        dropped += g_slaves[i].dropped;
+        exceptions += g_slaves[i].exceptions;
+        num += g_slaves[i].latenessNum;
+    }
+    printf("requests: %lld, %.1f/s, dropped %lld, exceptions %lld\n", requests, 
+        requests * 1000000.0 / elapsed_us, dropped, exceptions);
+    long long* all = (long long*) malloc((num > 0 ? num : 1) * sizeof(long long));
+    num = 0;
+    for (i = 0; all != NULL && i < g_slave_num; i++)
+    {
+        memcpy(all + num, g_slaves[i].lateness, g_slaves[i].latenessNum * sizeof(long long));
+        num += g_slaves[i].latenessNum;
+    }
+    for (i = 0; i < g_slave_num; i++)
+    {
+        pthread_mutex_unlock(&g_slaves[i].lock);
+    }
+    if (num > 0)
+    {
+        qsort(all, num, sizeof(long long), compare_ll);
+        printf("lateness(ms) over %d polls: p50 %.2f, p90 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n",
+            num, all[num / 2] / 1000.0, all[num * 90LL / 100] / 1000.0, 
+            all[num * 99LL / 100] / 1000.0, all[num * 999LL / 1000] / 1000.0, 
+            all[num - 1] / 1000.0);
+    }
+    free(all);
+}
+
+void on_signal(int sig)
+{
+    g_stop = 1;
+}
+
+int main(int argc, char** argv)
+{
+    int duration = 0;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "n:p:i:l:j:e:x:d:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': g_slave_num = atoi(optarg); break;
+            case 'p': g_base_port = atoi(optarg); break;
+            case 'i': g_interval_us = atoll(optarg) * 1000; break;
+            case 'l': g_latency_ms = atoi(optarg); break;
+            case 'j': g_jitter_ms = atoi(optarg); break;
+            case 'e': g_drop_rate = atof(optarg) / 100; break;
+            case 'x': g_exception_rate = atof(optarg) / 100; break;
+            case 'd': duration = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-n slaves] [-p base port] [-i interval ms] "
+                    "[-l latency ms] [-j jitter ms] [-e drop %%] [-x exception %%] "
+                    "[-d duration s]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (g_slave_num < 1 || g_slave_num > MAX_SLAVES)
+    {
+        fprintf(stderr, "the number of slaves must be in [1, %d]\n", MAX_SLAVES);
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    int i = 0;
+    for (i = 0; i < g_slave_num; i++)
+    {
+        SimSlave* slave = &g_slaves[i];
+        slave->id = i;
+        slave->port = g_base_port + i;
+        slave->seed = (unsigned int)(time(NULL) + i);
+        pthread_mutex_init(&slave->lock, NULL);
+        slave->lastUs = (long long*) calloc(ADDR_SLOTS, sizeof(long long));
+        if (slave->lastUs == NULL || pthread_create(&slave->thread, NULL, slave_func, slave) != 0)
+        {
+            fprintf(stderr, "failed to start slave %d\n", i);
+            return 1;
+        }
+    }
+    printf("%d slaves on ports %d-%d\n", g_slave_num, g_base_port, g_base_port + g_slave_num - 1);
+    fflush(stdout);
+
+    long long start = now_us();
+    while (!g_stop && (duration <= 0 || now_us() - start < duration * 1000000LL))
+    {
+        usleep(100000);
+    }
+    // the slaves may be blocked in accept or receive, they go with the process
+    print_report(now_us() - start);
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// a policy written to a snapshot by one process and loaded by the next, as on
+// a restart with an unchanged policy cache. the pointers of the record must
+// not come back: the envelope of the writer is freed, and the message rendered
+// from the policy loaded must be the one of the policy written.
+//
+// usage: snapshot_test [snapshot file]
+
+#include "snapshot.h"
+#include "json_writer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int g_failed = 0;
+
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            g_failed++; \
+        } \
+    } while (0)
+
+// the envelope as business.c renders it, see render_envelope
+static void render_envelope(SlavePolicy* policy)
+{
+    JsonWriter w;
+    jw_init(&w, NULL, 0);
+    jw_begin_object(&w, NULL);
+    JwMark mark = jw_mark(&w);
+    jw_string(&w, "gatewayid", policy->gatewayid);
+    jw_string(&w, "trantable", policy->trantable);
+    jw_begin_object(&w, "modbus");
+    jw_begin_object(&w, "request");
+    jw_int(&w, "functioncode", policy->functioncode);
+    jw_int(&w, "slaveid", policy->slaveid);
+    jw_int(&w, "startAddr", policy->start_addr);
+    jw_int(&w, "length", policy->length);
+    jw_end_object(&w);
+    CHECK(jw_take_fragment(&w, mark, &policy->envelope) == 0);
+    free(w.buf);
+}
+
+// a sample message of the policy, with its envelope as add_request_fields
+// writes it. the caller frees it
+static char* render_message(SlavePolicy* policy, const char* payload)
+{
+    JsonWriter w;
+    jw_init(&w, NULL, 0);
+    jw_begin_object(&w, NULL);
+    jw_fragment(&w, &policy->envelope);
+    jw_string(&w, "response", payload);
+    jw_end_object(&w);
+    jw_end_object(&w);
+    CHECK(jw_ok(&w));
+    return w.buf;
+}
+
+static void init_policy(SlavePolicy* policy)
+{
+    memset(policy, 0, sizeof(SlavePolicy));
+    strcpy(policy->gatewayid, "gw-1");
+    strcpy(policy->trantable, "table-1");
+    policy->functioncode = 3;
+    policy->slaveid = 7;
+    policy->start_addr = 100;
+    policy->length = 4;
+    policy->config = strdup("{\"slaveid\":7}");
+    render_envelope(policy);
+}
+
+int main(int argc, char** argv)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "snapshot_test.%d.bin", (int) getpid());
+    const char* file = argc > 1 ? argv[1] : path;
+
+    SlavePolicy written;
+    init_policy(&written);
+    char* expected = render_message(&written, "0001000200030004");
+    Channel channel;
+    memset(&channel, 0, sizeof(Channel));
+    strcpy(channel.topic, "samples");
+    written.pubChannel = &channel;
+
+    PolicySnapshotKey key;
+    memset(&key, 0, sizeof(PolicySnapshotKey));
+    memcpy(key.magic, "BDPS", 4);
+    key.policySize = sizeof(SlavePolicy);
+    key.fieldSize = sizeof(DecodeField);
+    SlavePolicy* policies[1] = {&written};
+    CHECK(snapshot_write(file, &key, 42, policies, 1) == 0);
+    // the writer is gone, its pointers with it
+    jw_free_fragment(&written.envelope);
+    free(written.config);
+
+    PolicySnapshot snap;
+    CHECK(snapshot_open(file, &key, &snap) == 0);
+    CHECK(snap.count == 1);
+    CHECK(snap.configVersion == 42);
+    SlavePolicy loaded;
+    memset(&loaded, 0, sizeof(SlavePolicy));
+    Channel loaded_channel;
+    CHECK(snap.count < 1 || snapshot_policy(&snap, 0, &loaded, &loaded_channel) == 0);
+    snapshot_close(&snap);
+    unlink(file);
+
+    CHECK(loaded.envelope.text == NULL);
+    CHECK(loaded.envelope.len == 0);
+    CHECK(loaded.payload == NULL && loaded.message == NULL && loaded.history == NULL);
+    CHECK(loaded.aggregates == NULL);
+    CHECK(loaded.config != NULL && strcmp(loaded.config, "{\"slaveid\":7}") == 0);
+    CHECK(strcmp(loaded_channel.topic, "samples") == 0);
+    if (loaded.envelope.text == NULL)
+    {
+        render_envelope(&loaded);
+        char* message = render_message(&loaded, "0001000200030004");
+        CHECK(strcmp(message, expected) == 0);
+        free(message);
+    }
+    jw_free_fragment(&loaded.envelope);
+    free(loaded.config);
+    free(loaded.fields);
+    free(expected);
+
+    printf("%s\n", g_failed == 0 ? "snapshot_test passed" : "snapshot_test failed");
+    return g_failed == 0 ? 0 : 1;
+}
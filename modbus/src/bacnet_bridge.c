@@ -0,0 +1,571 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bacnet_bridge.h"
+#include "common.h"
+#include "decode.h"
+#include "modbuslib.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bacdef.h"
+#include "bacenum.h"
+#include "address.h"
+#include "npdu.h"
+#include "apdu.h"
+#include "datalink.h"
+#include "bip.h"
+#include "dcc.h"
+#include "tsm.h"
+#include "txbuf.h"
+#include "client.h"
+#include "handlers.h"
+#include "device.h"
+#include "ai.h"
+#include "av.h"
+#include "bi.h"
+
+enum {
+    BRIDGE_RECEIVE_MS = 10,         // the longest a polled value waits to be served
+    BRIDGE_ADDRESS_SCAN_S = 60,     // how often the address cache is aged
+    DEFAULT_BACNET_PORT = 0xBAC0
+};
+
+// a polled value, served as the present value of a BACnet object
+typedef struct
+{
+    BACNET_OBJECT_TYPE type;        // MAX_BACNET_OBJECT_TYPE if the instance is taken
+    uint32_t instance;
+    char bus[ADDR_LEN];             // where the writes of the clients go
+    int slaveid;
+    int address;                    // the modbus address of the value, e.g. 40001
+    DecodeField field;              // the registers of the value, unused for the bits
+    float value;                    // the value last polled
+    int polled;                     // 1 once the value is polled
+    int dirty;                      // polled but not served yet
+} BridgePoint;
+
+// the points ordered by object, to look them up by object type and instance
+typedef struct
+{
+    int type;
+    uint32_t instance;
+    int point;
+} BridgeKey;
+
+// the point table, the values are written by the workers and served by the
+// BACnet thread, which alone calls into the BACnet stack
+pthread_mutex_t g_bridge_lock = PTHREAD_MUTEX_INITIALIZER;
+BridgePoint* g_bridge_points = NULL;
+BridgeKey* g_bridge_keys = NULL;
+int g_bridge_point_num = 0;
+int* g_bridge_dirty = NULL;         // the points polled since they were last served
+int g_bridge_dirty_num = 0;
+int g_bridge_reloaded = 1;          // the objects are to be created and deleted after a reload
+
+BridgeWriteFunc* g_bridge_write = NULL;
+pthread_t g_bridge_thread;
+int g_bridge_started = 0;
+volatile int g_bridge_stop = 0;
+
+int compare_bridge_keys(const void* a, const void* b)
+{
+    const BridgeKey* ka = (const BridgeKey*) a;
+    const BridgeKey* kb = (const BridgeKey*) b;
+    if (ka->type != kb->type)
+    {
+        return ka->type < kb->type ? -1 : 1;
+    }
+    if (ka->instance != kb->instance)
+    {
+        return ka->instance < kb->instance ? -1 : 1;
+    }
+    return ka->point - kb->point;
+}
+
+// the point serving the object in the keys, -1 if none
+int find_bridge_point(BridgeKey* keys, int num, int type, uint32_t instance)
+{
+    int lo = 0;
+    int hi = num - 1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (keys[mid].type == type && keys[mid].instance == instance)
+        {
+            return keys[mid].point;
+        }
+        if (keys[mid].type < type || (keys[mid].type == type && keys[mid].instance < instance))
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+int bridge_points_of_policy(SlavePolicy* policy)
+{
+    if (is_bit_function(policy->functioncode))
+    {
+        return policy->bacnetBinaryInputs >= 0 ? policy->length : 0;
+    }
+    if (policy->functioncode != 3 && policy->functioncode != 4)
+    {
+        return 0;
+    }
+    int num = 0;
+    int i = 0;
+    for (i = 0; i < policy->fieldNum; i++)
+    {
+        num += policy->fields[i].bacnetInstance >= 0;
+    }
+    return num;
+}
+
+void add_bridge_point(BridgePoint* pt, SlavePolicy* policy, BACNET_OBJECT_TYPE type, 
+    uint32_t instance, int address)
+{
+    pt->type = type;
+    pt->instance = instance;
+    mystrncpy(pt->bus, policy->ip_com_addr, ADDR_LEN);
+    pt->slaveid = policy->slaveid;
+    pt->address = address;
+}
+
+void bacnet_bridge_load(SlavePolicy* policies)
+{
+    int num = 0;
+    SlavePolicy* policy = NULL;
+    for (policy = policies; policy != NULL; policy = policy->next)
+    {
+        num += bridge_points_of_policy(policy);
+    }
+    BridgePoint* points = (BridgePoint*) calloc(num > 0 ? num : 1, sizeof(BridgePoint));
+    BridgeKey* keys = (BridgeKey*) malloc((num > 0 ? num : 1) * sizeof(BridgeKey));
+    int* dirty = (int*) malloc((num > 0 ? num : 1) * sizeof(int));
+    if (points == NULL || keys == NULL || dirty == NULL)
+    {
+        printf("out of memory while loading the BACnet points, none is served\n");
+        num = 0;
+    }
+
+    int n = 0;
+    for (policy = policies; policy != NULL; policy = policy->next)
+    {
+        int count = num > 0 ? bridge_points_of_policy(policy) : 0;
+        policy->bacnetPoint = n;
+        policy->bacnetPointNum = count;
+        if (count == 0)
+        {
+            continue;
+        }
+        int i = 0;
+        if (is_bit_function(policy->functioncode))
+        {
+            // coils are 00001 on, discrete inputs 10001 on
+            int base = policy->functioncode == 1 ? 1 : 10001;
+            for (i = 0; i < policy->length; i++)
+            {
+                add_bridge_point(&points[n++], policy, OBJECT_BINARY_INPUT,
+                    policy->bacnetBinaryInputs + i, base + policy->start_addr + i);
+            }
+            continue;
+        }
+        for (i = 0; i < policy->fieldNum; i++)
+        {
+            DecodeField* f = &policy->fields[i];
+            if (f->bacnetInstance < 0)
+            {
+                continue;
+            }
+            points[n].field = *f;
+            add_bridge_point(&points[n++], policy, 
+                policy->functioncode == 4 ? OBJECT_ANALOG_INPUT : OBJECT_ANALOG_VALUE,
+                f->bacnetInstance, 40001 + policy->start_addr + f->reg);
+        }
+    }
+
+    // an object is served by the first point claiming it, and keeps the value
+    // it had before the reload
+    int i = 0;
+    for (i = 0; i < n; i++)
+    {
+        keys[i].type = points[i].type;
+        keys[i].instance = points[i].instance;
+        keys[i].point = i;
+    }
+    qsort(keys, n, sizeof(BridgeKey), compare_bridge_keys);
+    int unique = 0;
+    for (i = 0; i < n; i++)
+    {
+        BridgePoint* pt = &points[keys[i].point];
+        if (unique > 0 && keys[unique - 1].type == keys[i].type 
+            && keys[unique - 1].instance == keys[i].instance)
+        {
+            printf("BACnet object %d:%u is served by another point, skipped\n", 
+                keys[i].type, keys[i].instance);
+            pt->type = MAX_BACNET_OBJECT_TYPE;
+            continue;
+        }
+        keys[unique++] = keys[i];
+        int old = find_bridge_point(g_bridge_keys, g_bridge_point_num, pt->type, pt->instance);
+        if (old >= 0)
+        {
+            pt->value = g_bridge_points[old].value;
+            pt->polled = g_bridge_points[old].polled;
+        }
+    }
+
+    pthread_mutex_lock(&g_bridge_lock);
+    BridgePoint* old_points = g_bridge_points;
+    BridgeKey* old_keys = g_bridge_keys;
+    int* old_dirty = g_bridge_dirty;
+    g_bridge_points = points;
+    g_bridge_keys = keys;
+    g_bridge_dirty = dirty;
+    g_bridge_point_num = unique;
+    g_bridge_dirty_num = 0;
+    g_bridge_reloaded = 1;
+    pthread_mutex_unlock(&g_bridge_lock);
+    free(old_points);
+    free(old_keys);
+    free(old_dirty);
+    printf("%d BACnet objects served by the bridge\n", unique);
+}
+
+void bacnet_bridge_update(SlavePolicy* policy)
+{
+    if (policy->bacnetPointNum <= 0 || policy->payload[0] == 0)
+    {
+        return;
+    }
+    // decoded without the lock, the points of the policy are contiguous
+    float values[RANGE_BUFF_LEN];
+    int count = 0;
+    if (is_bit_function(policy->functioncode))
+    {
+        uint8_t bits[RANGE_BUFF_LEN];
+        count = char2uint8(bits, RANGE_BUFF_LEN, policy->payload);
+        if (count != policy->bacnetPointNum)
+        {
+            return;
+        }
+        int i = 0;
+        for (i = 0; i < count; i++)
+        {
+            values[i] = bits[i] != 0;
+        }
+    }
+    else
+    {
+        uint16_t regs[MODBUS_MAX_READ_REGISTERS];
+        uint16_t swapped[MODBUS_MAX_READ_REGISTERS];
+        int n = char2uint16(regs, MODBUS_MAX_READ_REGISTERS, policy->payload);
+        if (n != policy->length)
+        {
+            return;
+        }
+        memcpy(swapped, regs, n * sizeof(uint16_t));
+        swap_register_bytes(swapped, n);
+        int i = 0;
+        for (i = 0; i < policy->fieldNum; i++)
+        {
+            if (policy->fields[i].bacnetInstance >= 0)
+            {
+                values[count++] = (float)decode_field(&policy->fields[i], regs, swapped);
+            }
+        }
+    }
+
+    pthread_mutex_lock(&g_bridge_lock);
+    int i = 0;
+    for (i = 0; i < count; i++)
+    {
+        int point = policy->bacnetPoint + i;
+        BridgePoint* pt = &g_bridge_points[point];
+        pt->value = values[i];
+        pt->polled = 1;
+        if (!pt->dirty)
+        {
+            pt->dirty = 1;
+            g_bridge_dirty[g_bridge_dirty_num++] = point;
+        }
+    }
+    pthread_mutex_unlock(&g_bridge_lock);
+}
+
+// the rest runs in the BACnet thread
+
+void serve_bridge_point(BridgePoint* pt)
+{
+    pt->dirty = 0;
+    if (!pt->polled)
+    {
+        return;
+    }
+    switch (pt->type)
+    {
+        case OBJECT_ANALOG_INPUT:
+            Analog_Input_Present_Value_Set(pt->instance, pt->value);
+            break;
+        case OBJECT_ANALOG_VALUE:
+            Analog_Value_Present_Value_Set(pt->instance, pt->value, BACNET_MAX_PRIORITY);
+            break;
+        case OBJECT_BINARY_INPUT:
+            Binary_Input_Present_Value_Set(pt->instance, 
+                pt->value != 0 ? BINARY_ACTIVE : BINARY_INACTIVE);
+            break;
+        default:
+            break;
+    }
+}
+
+// create the objects of the points, and delete the objects without a point.
+// an object deleted moves the last one into its index, which is checked already
+void reload_bridge_objects()
+{
+    unsigned i = 0;
+    uint32_t instance = 0;
+    for (i = Analog_Input_Count(); i > 0; i--)
+    {
+        instance = Analog_Input_Index_To_Instance(i - 1);
+        if (find_bridge_point(g_bridge_keys, g_bridge_point_num, 
+                OBJECT_ANALOG_INPUT, instance) < 0)
+        {
+            Analog_Input_Delete(instance);
+        }
+    }
+    for (i = Analog_Value_Count(); i > 0; i--)
+    {
+        instance = Analog_Value_Index_To_Instance(i - 1);
+        if (find_bridge_point(g_bridge_keys, g_bridge_point_num, 
+                OBJECT_ANALOG_VALUE, instance) < 0)
+        {
+            Analog_Value_Delete(instance);
+        }
+    }
+    for (i = Binary_Input_Count(); i > 0; i--)
+    {
+        instance = Binary_Input_Index_To_Instance(i - 1);
+        if (find_bridge_point(g_bridge_keys, g_bridge_point_num, 
+                OBJECT_BINARY_INPUT, instance) < 0)
+        {
+            Binary_Input_Delete(instance);
+        }
+    }
+    int k = 0;
+    for (k = 0; k < g_bridge_point_num; k++)
+    {
+        BridgePoint* pt = &g_bridge_points[g_bridge_keys[k].point];
+        switch (pt->type)
+        {
+            case OBJECT_ANALOG_INPUT:
+                Analog_Input_Create(pt->instance);
+                break;
+            case OBJECT_ANALOG_VALUE:
+                Analog_Value_Create(pt->instance);
+                break;
+            case OBJECT_BINARY_INPUT:
+                Binary_Input_Create(pt->instance);
+                break;
+            default:
+                break;
+        }
+        serve_bridge_point(pt);
+    }
+}
+
+// serve the values polled since the last call
+void sync_bridge_points()
+{
+    pthread_mutex_lock(&g_bridge_lock);
+    if (g_bridge_reloaded)
+    {
+        reload_bridge_objects();
+        g_bridge_reloaded = 0;
+    }
+    int i = 0;
+    for (i = 0; i < g_bridge_dirty_num; i++)
+    {
+        serve_bridge_point(&g_bridge_points[g_bridge_dirty[i]]);
+    }
+    g_bridge_dirty_num = 0;
+    pthread_mutex_unlock(&g_bridge_lock);
+}
+
+// a client wrote the value of an Analog Value, the registers are written to match
+bool bridge_analog_value_write_property(BACNET_WRITE_PROPERTY_DATA* wp_data)
+{
+    if (!Analog_Value_Write_Property(wp_data) 
+        || wp_data->object_property != PROP_PRESENT_VALUE)
+    {
+        return false;
+    }
+    pthread_mutex_lock(&g_bridge_lock);
+    int point = find_bridge_point(g_bridge_keys, g_bridge_point_num, 
+        OBJECT_ANALOG_VALUE, wp_data->object_instance);
+    BridgePoint pt;
+    if (point >= 0)
+    {
+        pt = g_bridge_points[point];
+    }
+    pthread_mutex_unlock(&g_bridge_lock);
+    if (point < 0)
+    {
+        return true;
+    }
+    uint16_t regs[4];
+    char data[4 * 4 + 1];
+    int n = encode_field(&pt.field, Analog_Value_Present_Value(wp_data->object_instance), regs);
+    short_arr_to_array(data, regs, n);
+    if (g_bridge_write(pt.bus, pt.slaveid, pt.address, data) != 0)
+    {
+        wp_data->error_class = ERROR_CLASS_DEVICE;
+        wp_data->error_code = ERROR_CODE_OPERATIONAL_PROBLEM;
+        return false;
+    }
+    return true;
+}
+
+// the objects of the bridge device, created and deleted as the policies change
+object_functions_t g_bridge_objects[] = {
+    {OBJECT_DEVICE, NULL, Device_Count, Device_Index_To_Instance,
+        Device_Valid_Object_Instance_Number, Device_Object_Name,
+        Device_Read_Property_Local, Device_Write_Property_Local,
+        Device_Property_Lists, DeviceGetRRInfo, NULL, NULL, NULL, NULL, NULL, NULL},
+    {OBJECT_ANALOG_INPUT, Analog_Input_Init, Analog_Input_Count,
+        Analog_Input_Index_To_Instance, Analog_Input_Valid_Instance,
+        Analog_Input_Object_Name, Analog_Input_Read_Property,
+        Analog_Input_Write_Property, Analog_Input_Property_Lists, NULL, NULL,
+        Analog_Input_Encode_Value_List, Analog_Input_Change_Of_Value,
+        Analog_Input_Change_Of_Value_Clear, NULL, Analog_Input_Object_Name_View},
+    {OBJECT_ANALOG_VALUE, Analog_Value_Init, Analog_Value_Count,
+        Analog_Value_Index_To_Instance, Analog_Value_Valid_Instance,
+        Analog_Value_Object_Name, Analog_Value_Read_Property,
+        bridge_analog_value_write_property, Analog_Value_Property_Lists, NULL, NULL,
+        NULL, NULL, NULL, NULL, Analog_Value_Object_Name_View},
+    {OBJECT_BINARY_INPUT, Binary_Input_Init, Binary_Input_Count,
+        Binary_Input_Index_To_Instance, Binary_Input_Valid_Instance,
+        Binary_Input_Object_Name, Binary_Input_Read_Property,
+        Binary_Input_Write_Property, Binary_Input_Property_Lists, NULL, NULL,
+        Binary_Input_Encode_Value_List, Binary_Input_Change_Of_Value,
+        Binary_Input_Change_Of_Value_Clear, NULL, Binary_Input_Object_Name_View},
+    {MAX_BACNET_OBJECT_TYPE, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 
+        NULL, NULL, NULL, NULL, NULL, NULL, NULL}
+};
+
+void* bridge_func(void* arg)
+{
+    static uint8_t rx_buf[MAX_MPDU];
+    BACNET_ADDRESS src;
+    time_t last_seconds = time(NULL);
+    uint32_t address_timer = 0;
+    while (!g_bridge_stop)
+    {
+        memset(&src, 0, sizeof(src));
+        uint16_t pdu_len = datalink_receive(&src, rx_buf, MAX_MPDU, BRIDGE_RECEIVE_MS);
+        // the values are served before the request is handled, a client
+        // reading right after a poll sees it
+        sync_bridge_points();
+        if (pdu_len > 0)
+        {
+            npdu_handler(&src, rx_buf, pdu_len);
+        }
+        time_t now = time(NULL);
+        uint32_t elapsed = (uint32_t)(now - last_seconds);
+        if (elapsed > 0)
+        {
+            last_seconds = now;
+            dcc_timer_seconds(elapsed);
+            handler_cov_timer_seconds(elapsed);
+            tsm_timer_milliseconds(elapsed * 1000);
+            address_timer += elapsed;
+            if (address_timer >= BRIDGE_ADDRESS_SCAN_S)
+            {
+                address_cache_timer(address_timer);
+                address_timer = 0;
+            }
+        }
+        handler_cov_task();
+    }
+    return NULL;
+}
+
+int bacnet_bridge_start(const GatewayConfig* conf, BridgeWriteFunc* write_func)
+{
+    g_bridge_write = write_func;
+    Device_Set_Object_Instance_Number(conf->bacnetDevice);
+    address_init();
+    Device_Init(g_bridge_objects);
+    apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_WHO_IS, handler_who_is);
+    apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_WHO_HAS, handler_who_has);
+    apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_I_AM, handler_i_am_bind);
+    apdu_set_unrecognized_service_handler_handler(handler_unrecognized_service);
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_READ_PROPERTY, handler_read_property);
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_READ_PROP_MULTIPLE, 
+        handler_read_property_multiple);
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_WRITE_PROPERTY, handler_write_property);
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_WRITE_PROP_MULTIPLE, 
+        handler_write_property_multiple);
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_SUBSCRIBE_COV, handler_cov_subscribe);
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_DEVICE_COMMUNICATION_CONTROL,
+        handler_device_communication_control);
+    apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_UTC_TIME_SYNCHRONIZATION,
+        handler_timesync_utc);
+    apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_TIME_SYNCHRONIZATION, handler_timesync);
+
+    // not dlenv_init, which exits on failure
+    bip_set_port(htons(conf->bacnetPort > 0 ? conf->bacnetPort : DEFAULT_BACNET_PORT));
+    if (!datalink_init(conf->bacnetInterface[0] != 0 ? (char*) conf->bacnetInterface : NULL))
+    {
+        printf("failed to open the BACnet/IP port %d\n", 
+            conf->bacnetPort > 0 ? conf->bacnetPort : DEFAULT_BACNET_PORT);
+        return -1;
+    }
+    Send_I_Am(&Handler_Transmit_Buffer[0]);
+    g_bridge_stop = 0;
+    if (pthread_create(&g_bridge_thread, NULL, bridge_func, NULL) != 0)
+    {
+        printf("failed to start the BACnet bridge\n");
+        datalink_cleanup();
+        return -1;
+    }
+    g_bridge_started = 1;
+    printf("BACnet bridge started, device instance %d\n", conf->bacnetDevice);
+    return 0;
+}
+
+void bacnet_bridge_stop()
+{
+    if (!g_bridge_started)
+    {
+        return;
+    }
+    g_bridge_stop = 1;
+    pthread_join(g_bridge_thread, NULL);
+    datalink_cleanup();
+    g_bridge_started = 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_MODBUS_SDK_C_BACNET_BRIDGE_H
+#define INF_BCE_IOT_MODBUS_SDK_C_BACNET_BRIDGE_H
+
+#include "data.h"
+
+#include <stdio.h>
+
+// the bridge mode, the values polled from modbus are served to BACnet/IP
+// clients as the objects of a BACnet device. every polled value is kept in a
+// point table, and a ReadProperty(Multiple) is answered from it, never
+// waiting for the bus:
+//   - a decoded field with "bacnet": instance is an Analog Input if the policy
+//     reads input registers(0x04), an Analog Value if it reads holding
+//     registers(0x03). writing the present value of the Analog Value writes
+//     the field back to the holding registers
+//   - bit i of a coil or discrete input policy with "bacnetBinaryInputs":
+//     instance is the Binary Input instance + i
+// it's enabled by the gateway config, and only built with BACNET=yes, e.g.
+//     "bacnet": {"deviceInstance": 260001, "port": 47808, "interface": "eth0"}
+
+// queue a write of the hex data to the slave, see queue_modbus_write.
+// return 0 if queued
+typedef int BridgeWriteFunc(const char* ip_com_addr, int slaveid, int address, 
+    const char* data);
+
+#ifdef BACNET_BRIDGE
+
+// start the BACnet/IP device in a thread of its own, which owns the BACnet
+// stack. the writes of the clients are handed to write. return 0 on success
+int bacnet_bridge_start(const GatewayConfig* conf, BridgeWriteFunc* write);
+
+void bacnet_bridge_stop();
+
+// rebuild the point table from the loaded policies, the objects are created
+// and deleted by the BACnet thread afterwards. the values of the points kept
+// are kept too. must be called with all the workers locked
+void bacnet_bridge_load(SlavePolicy* policies);
+
+// copy the values just polled by the policy into its points, called by the
+// worker owning the policy
+void bacnet_bridge_update(SlavePolicy* policy);
+
+#else
+
+static inline int bacnet_bridge_start(const GatewayConfig* conf, BridgeWriteFunc* write)
+{
+    printf("the gateway is built without the BACnet bridge, rebuild with BACNET=yes\n");
+    return -1;
+}
+
+static inline void bacnet_bridge_stop()
+{
+}
+
+static inline void bacnet_bridge_load(SlavePolicy* policies)
+{
+}
+
+static inline void bacnet_bridge_update(SlavePolicy* policy)
+{
+}
+
+#endif
+
+#endif
@@ -20,134 +20,511 @@
 #include "business.h"
 #include "data.h"
 #include "common.h"
+#include "modbuslib.h"
+#include "probe.h"
+#include "async_mqtt.h"
+#include "json_writer.h"
+#include "json_reader.h"
+#include "decode.h"
+#include "snapshot.h"
+#include "template.h"
+#include "bacnet_bridge.h"
+#include "modbus_server.h"
+#include "hex.h"
+#include "regdelta.h"
+#include "timefmt.h"
+#include "shm_points.h"
+#include "shadow_mirror.h"
+#include "evloop.h"
+#include "trace.h"
 
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 const char* const PEM_FILE = "root_cert.pem";
 const char* const CONFIG_FILE = "gwconfig.txt";
+// the preset dictionary of the compressed payloads, the skeleton of a sample,
+// so that even a single small sample compresses well
+const char* const ZLIB_DICT = "{\"bdModbusVer\":2,\"samples\":[{\"bdModbusVer\":1,"
+    "\"gatewayid\":\"\",\"trantable\":\"\",\"modbus\":{\"request\":{\"functioncode\":3,"
+    "\"slaveid\":1,\"startAddr\":0,\"length\":10},\"response\":\"0000\"},"
+    "\"timestamp\":\"2017-01-01 00:00:00+0800\"},";
 const char* const POLICY_CACHE = "policyCache.txt";
+// the policies compiled from POLICY_CACHE, see snapshot.h
+const char* const POLICY_SNAPSHOT = "policyCache.bin";
+// the deltas applied on top of POLICY_CACHE, one json per line
+const char* const POLICY_JOURNAL = "policyCache.delta";
+// the other tenants have policyCache.<id>.txt and policyCache.<id>.delta,
+// they are not compiled into snapshots
 
-// when worker is running, it should require this lock first
-// when policy loader is going to change policy, it also need to 
-// acquire this lock first
-pthread_mutex_t g_policy_lock = PTHREAD_MUTEX_INITIALIZER;
-SlavePolicy g_slave_header;    // the pure header node for slave polices
+// the polling workers, every worker owns the schedule of its slave policies.
+// when a worker is running, it should require its own lock first;
+// when policy loader is going to change policy, it need to 
+// acquire the locks of all workers first
+PollWorker g_workers[MAX_WORKER];
+int g_worker_num = DEFAULT_WORKER_NUM;
+SlavePolicy g_slave_header;    // the pure header node for all loaded slave polices
+// held while the policies and the mqtt clients are reloaded, so that the metrics
+// endpoint could walk them without stopping the workers
+pthread_mutex_t g_policy_list_lock = PTHREAD_MUTEX_INITIALIZER;
+GatewayMetrics g_metrics;
+
+// a config message received and not applied yet, parsed by the mqtt thread
+typedef struct StagedConfig_t
+{
+    cJSON* root;
+    char* text;                     // as received, the cache of a full config
+    int tenant;                     // whose config it is, see TenantConfig
+    struct StagedConfig_t* next;
+} StagedConfig;
 
 int g_policy_updated = 1;
+// the configs staged by handle_config_msg in order, the supervisor builds the
+// policies from them. a full config drops the ones of its tenant before it.
+// guarded by g_policy_update_lock
+StagedConfig* g_staged_head = NULL;
+StagedConfig* g_staged_tail = NULL;
 pthread_mutex_t g_policy_update_lock = PTHREAD_MUTEX_INITIALIZER;
+// the configs of every tenant, the gateway itself is the first. only the
+// supervisor changes them
+typedef struct
+{
+    // the version of the policies loaded, a delta only applies on top of it.
+    // -1 once they are out of sync, until a full config is applied
+    long long configVersion;
+    // a full config is to be asked for on the status topic
+    int resyncNeeded;
+    // the deltas in the journal
+    int journalNum;
+    int refused;                    // the last config is over the quota, it's not applied
+    char cache[MAX_LEN];            // POLICY_CACHE and POLICY_JOURNAL of the tenant
+    char journal[MAX_LEN];
+} TenantState;
+TenantState g_tenants[MAX_TENANTS];
+
+// the gateways announcing on shardTopic split the policies of the config by
+// their bus, see owns_policy. the members are updated by the mqtt thread,
+// guarded by g_shard_lock, the supervisor rebalances once they change
+char g_shard_members[MAX_SHARD_MEMBERS][FIELD_NAME_LEN];
+int g_shard_member_num = 0;
+int g_shard_changed = 0;
+pthread_mutex_t g_shard_lock = PTHREAD_MUTEX_INITIALIZER;
+// the policies of the config owned by the other members, not scheduled. they
+// are kept for the cache, the deltas and the rebalancing, guarded as the list
+SlavePolicy* g_parked_policies = NULL;
 
 int g_gateway_connected = 0;
 pthread_mutex_t g_gateway_mutex = PTHREAD_MUTEX_INITIALIZER;
-int g_mqtt_pos_with_err = -1;
+AsyncMqtt g_gateway_client;             // the client listening to the command topic
+EventLoop g_supervisor_loop;            // woken up by the config, the commands and the bus status
 
 GatewayConfig g_gateway_conf;
-char g_buff[BUFF_LEN];
 int g_stop_worker = 0;
 
-Channel* g_shared_channel[MAX_CHANNEL];
-MQTTClient g_shared_mqtt_client[MAX_CHANNEL];
+// the latest values for the local processes, see layout_shared_points
+ShmPoints g_shared_points;
+int g_shared_points_started = 0;
+// the points mirrored into a device shadow, NULL if none, see layout_shadow_points
+ShadowMirror* g_shadow_mirror = NULL;
 
-MQTTClient_SSLOptions g_sslopts = MQTTClient_SSLOptions_initializer;
+// the shared mqtt clients, the mqttClient of a policy is the slot of its
+// channel. the channels of the same connection, see same_connection, have
+// a slot each, for their batches, and all point to one client. the slots
+// grow on demand, and are only added/removed on policy reload with all the
+// workers locked
+Channel** g_shared_channel = NULL;
+AsyncMqtt** g_shared_mqtt_client = NULL;
+// samples waiting to be published together, one batch per shared mqtt client
+PubBatch** g_batches = NULL;
+int g_channel_cap = 0;              // slots allocated
+int g_channel_num = 0;              // slots ever used, [0, g_channel_num) are scanned
+int g_channel_count = 0;            // slots in use
+int g_free_channel = -1;            // the first free slot to be reused
+int* g_channel_next = NULL;         // the next slot in the same bucket, or free slot
+// the hash table of the channels, the first slot of every bucket, -1 if empty
+int* g_channel_bucket = NULL;
+int g_channel_bucket_num = 0;       // a power of 2
 
-MQTTClient find_shared_mqtt_client(Channel* ch, int* pos)
+void flush_all_batches();
+void publish_history(SlavePolicy* policy);
+void release_aggregates(SlavePolicy* policy);
+void flush_batch(int pos);
+void layout_shared_points(SlavePolicy* policies);
+void layout_shadow_points(SlavePolicy* policies);
+void add_request_fields(JsonWriter* w, SlavePolicy* policy);
+int handle_config_msg(void* context, char* topicName, int topicLen, MQTTAsync_message* message,
+    int tenant);
+int handle_back_control_msg(void* context, char* topicName, int topicLen, MQTTAsync_message* message,
+    int tenant);
+
+unsigned int channel_hash(Channel* ch)
 {
-    int i = 0;
-    for (i = 0; i < MAX_CHANNEL; i++)
+    unsigned int hash = hash_string(ch->endpoint);
+    hash = hash * 31 + hash_string(ch->topic);
+    hash = hash * 31 + hash_string(ch->user);
+    hash = hash * 31 + hash_string(ch->password);
+    return hash * 31 + (unsigned int)ch->format * 2 + (unsigned int)ch->compress;
+}
+
+int same_channel(Channel* a, Channel* b)
+{
+    return strcmp(a->endpoint, b->endpoint) == 0
+        && strcmp(a->topic, b->topic) == 0
+        && strcmp(a->user, b->user) == 0
+        && strcmp(a->password, b->password) == 0
+        && a->format == b->format
+        && a->compress == b->compress;
+}
+
+// the channels published over one mqtt connection: the same broker, account
+// and compression. the topics and the formats of their messages may differ
+int same_connection(Channel* a, Channel* b)
+{
+    return strcmp(a->endpoint, b->endpoint) == 0
+        && strcmp(a->user, b->user) == 0
+        && strcmp(a->password, b->password) == 0
+        && a->compress == b->compress;
+}
+
+// the channels of the policies are interned, the policies (and the shared
+// mqtt client) of the same channel reference one copy, instead of the four
+// strings in every policy. only the policy loader interns and releases them
+typedef struct InternedChannel_t
+{
+    Channel channel;                // first, a Channel* of the pool is its node
+    int refs;
+    struct InternedChannel_t* next; // in the same bucket
+} InternedChannel;
+
+InternedChannel* g_interned_channels[CHANNEL_INTERN_BUCKETS];
+
+// the interned copy of ch, with one more reference. NULL if out of memory
+Channel* intern_channel(Channel* ch)
+{
+    InternedChannel** bucket = &g_interned_channels[channel_hash(ch) % CHANNEL_INTERN_BUCKETS];
+    InternedChannel* node = *bucket;
+    for (; node != NULL; node = node->next)
     {
-        Channel* pch = g_shared_channel[i];
-        if (pch == NULL)
+        if (same_channel(&node->channel, ch))
         {
-            continue;
+            node->refs++;
+            return &node->channel;
         }
-        if (strcmp(pch->endpoint, ch->endpoint) == 0
-            && strcmp(pch->topic, ch->topic) == 0
-            && strcmp(pch->user, ch->user) == 0
-            && strcmp(pch->password, ch->password) == 0)
+    }
+    node = (InternedChannel*) malloc(sizeof(InternedChannel));
+    if (node == NULL)
+    {
+        return NULL;
+    }
+    node->channel = *ch;
+    node->refs = 1;
+    node->next = *bucket;
+    *bucket = node;
+    return &node->channel;
+}
+
+Channel* retain_channel(Channel* ch)
+{
+    ((InternedChannel*) ch)->refs++;
+    return ch;
+}
+
+void release_channel(Channel* ch)
+{
+    InternedChannel* node = (InternedChannel*) ch;
+    if (node == NULL || --node->refs > 0)
+    {
+        return;
+    }
+    InternedChannel** link = &g_interned_channels[channel_hash(ch) % CHANNEL_INTERN_BUCKETS];
+    while (*link != NULL && *link != node)
+    {
+        link = &(*link)->next;
+    }
+    if (*link == node)
+    {
+        *link = node->next;
+    }
+    free(node);
+}
+
+AsyncMqtt* find_shared_mqtt_client(Channel* ch, int* pos)
+{
+    if (g_channel_bucket_num == 0)
+    {
+        return NULL;
+    }
+    int i = g_channel_bucket[channel_hash(ch) & (g_channel_bucket_num - 1)];
+    for (; i >= 0; i = g_channel_next[i])
+    {
+        if (g_shared_mqtt_client[i] != NULL && same_channel(g_shared_channel[i], ch))
         {
-            if (g_shared_mqtt_client[i] != NULL)
+            if (pos != NULL)
             {
-                if (pos != NULL)
-                {
-                    *pos = i;
-                }
-                return g_shared_mqtt_client[i];
+                *pos = i;
             }
+            return g_shared_mqtt_client[i];
+        }
+    }
+    return NULL;
+}
+
+// the client of another channel on the same connection as ch, NULL if none.
+// only called for the channels seen for the first time
+AsyncMqtt* find_connection_client(Channel* ch)
+{
+    int i = 0;
+    for (i = 0; i < g_channel_num; i++)
+    {
+        if (g_shared_mqtt_client[i] != NULL && same_connection(g_shared_channel[i], ch))
+        {
+            return g_shared_mqtt_client[i];
         }
     }
     return NULL;
 }
 
-void set_ssl_option(MQTTClient_connectOptions* conn_opts, char* host)
+// double the slots, return 0 on success, -1 if out of memory
+int grow_channels()
+{
+    int cap = g_channel_cap == 0 ? CHANNEL_INIT_CAP : g_channel_cap * 2;
+    Channel** channels = (Channel**) realloc(g_shared_channel, cap * sizeof(Channel*));
+    if (channels == NULL)
+    {
+        return -1;
+    }
+    g_shared_channel = channels;
+    AsyncMqtt** clients = (AsyncMqtt**) realloc(g_shared_mqtt_client, cap * sizeof(AsyncMqtt*));
+    if (clients == NULL)
+    {
+        return -1;
+    }
+    g_shared_mqtt_client = clients;
+    // the batches are allocated one by one, their locks never move
+    PubBatch** batches = (PubBatch**) realloc(g_batches, cap * sizeof(PubBatch*));
+    if (batches == NULL)
+    {
+        return -1;
+    }
+    g_batches = batches;
+    int* next = (int*) realloc(g_channel_next, cap * sizeof(int));
+    if (next == NULL)
+    {
+        return -1;
+    }
+    g_channel_next = next;
+    int i = 0;
+    for (i = g_channel_cap; i < cap; i++)
+    {
+        PubBatch* batch = (PubBatch*) malloc(sizeof(PubBatch));
+        if (batch == NULL)
+        {
+            break;
+        }
+        pthread_mutex_init(&batch->lock, NULL);
+        batch->buff = NULL;
+        batch->len = 0;
+        batch->count = 0;
+        batch->traceId = 0;
+        batch->pressureLevel = 0;
+        batch->pressureChanged = 0;
+        g_batches[i] = batch;
+        g_shared_channel[i] = NULL;
+        g_shared_mqtt_client[i] = NULL;
+        g_channel_next[i] = -1;
+    }
+    g_channel_cap = i;
+    return i > g_channel_num ? 0 : -1;
+}
+
+// rebuild the hash table with the given number of buckets, return 0 on success,
+// -1 if out of memory, then the old one is kept
+int rehash_channels(int bucket_num)
 {
-    char* ssl = "ssl://";
-    char* ssl_upper = "SSL://";
-    if (strncmp(ssl, host, strlen(ssl)) == 0
-        || strncmp(ssl_upper, host, strlen(ssl_upper)) == 0)
+    int* buckets = (int*) malloc(bucket_num * sizeof(int));
+    if (buckets == NULL)
+    {
+        return -1;
+    }
+    int i = 0;
+    for (i = 0; i < bucket_num; i++)
+    {
+        buckets[i] = -1;
+    }
+    for (i = 0; i < g_channel_num; i++)
     {
-        g_sslopts.trustStore = PEM_FILE;
-        g_sslopts.enableServerCertAuth = 1;
-        conn_opts->ssl = &g_sslopts;
+        if (g_shared_channel[i] != NULL)
+        {
+            int b = channel_hash(g_shared_channel[i]) & (bucket_num - 1);
+            g_channel_next[i] = buckets[b];
+            buckets[b] = i;
+        }
     }
+    free(g_channel_bucket);
+    g_channel_bucket = buckets;
+    g_channel_bucket_num = bucket_num;
+    return 0;
 }
 
-void fix_broken_mqtt_client()
+// take a slot for the channel and its mqtt client, return the slot, -1 on failure
+int add_shared_channel(Channel* ch, AsyncMqtt* client)
 {
-    if (g_mqtt_pos_with_err >= 0)
+    int pos = g_free_channel;
+    if (pos >= 0)
+    {
+        g_free_channel = g_channel_next[pos];
+    }
+    else
+    {
+        if (g_channel_num == g_channel_cap && grow_channels() != 0)
+        {
+            return -1;
+        }
+        pos = g_channel_num++;
+    }
+    g_shared_channel[pos] = ch;
+    g_shared_mqtt_client[pos] = client;
+    g_batches[pos]->pressureLevel = 0;
+    g_batches[pos]->pressureChanged = 0;
+    g_channel_count++;
+    // rehashing inserts the new channel as well
+    int inserted = g_channel_count > g_channel_bucket_num && rehash_channels(
+        g_channel_bucket_num == 0 ? CHANNEL_INIT_CAP : g_channel_bucket_num * 2) == 0;
+    if (!inserted && g_channel_bucket_num > 0)
+    {
+        // the buckets just get longer if the table can't grow
+        int b = channel_hash(ch) & (g_channel_bucket_num - 1);
+        g_channel_next[pos] = g_channel_bucket[b];
+        g_channel_bucket[b] = pos;
+    }
+    else if (!inserted)
     {
-        Channel* ch = g_shared_channel[g_mqtt_pos_with_err];
-        MQTTClient_connectOptions connect_options = MQTTClient_connectOptions_initializer;
-        char clientid[MAX_LEN];
-        snprintf(clientid, MAX_LEN, "GWPubreconnected%lld", (long long)time(NULL));
-        int rc = MQTTClient_create(&g_shared_mqtt_client[g_mqtt_pos_with_err], ch->endpoint,
-             clientid, MQTTCLIENT_PERSISTENCE_NONE, NULL);
-        connect_options.keepAliveInterval = 20;  // Alive interval
-        connect_options.cleansession = 1;
-        connect_options.username = ch->user;
-        connect_options.password = ch->password;
-        set_ssl_option(&connect_options, ch->endpoint);
+        // out of memory before any table was built
+        g_shared_channel[pos] = NULL;
+        g_shared_mqtt_client[pos] = NULL;
+        g_channel_count--;
+        g_channel_next[pos] = g_free_channel;
+        g_free_channel = pos;
+        return -1;
+    }
+    return pos;
+}
 
-        rc = MQTTClient_connect(g_shared_mqtt_client[g_mqtt_pos_with_err], &connect_options);
-        if (rc == MQTTCLIENT_SUCCESS)
+// destroy the mqtt client of the slot, unless the channels of other slots
+// still publish through it
+void release_channel_client(int pos, int timeout_ms)
+{
+    AsyncMqtt* client = g_shared_mqtt_client[pos];
+    if (client == NULL)
+    {
+        return;
+    }
+    g_shared_mqtt_client[pos] = NULL;
+    int i = 0;
+    for (i = 0; i < g_channel_num; i++)
+    {
+        if (g_shared_mqtt_client[i] == client)
         {
-            g_mqtt_pos_with_err = -1;
+            return;
         }
     }
+    amqtt_destroy(client, timeout_ms);
+    free(client);
 }
 
-int load_channel(Channel* conf)
+// free the channel at pos and its slot, the mqtt client must have been released
+void remove_shared_channel(int pos)
 {
-    if (conf == NULL)
+    Channel* ch = g_shared_channel[pos];
+    if (ch == NULL)
     {
-        printf("the parameter conf is NULL\n");
-        return 0;
+        return;
     }
-    char* content = NULL;
-    long size = read_file_as_string(CONFIG_FILE, &content);
-    if (size <= 0)
+    int* link = &g_channel_bucket[channel_hash(ch) & (g_channel_bucket_num - 1)];
+    while (*link >= 0 && *link != pos)
     {
-        printf("failed to open config file %s, while trying to load gateway configuration\n",
-             CONFIG_FILE);
-        return 0;
+        link = &g_channel_next[*link];
     }
-    
-    cJSON* root = cJSON_Parse(content);
-    if (root == NULL)
+    if (*link == pos)
     {
-        printf("the config file is not a valid json object, file=%s\n", CONFIG_FILE);
-        return 0;
+        *link = g_channel_next[pos];
     }
-    mystrncpy(conf->endpoint, cJSON_GetObjectItem(root, "endpoint")->valuestring, MAX_LEN);
-    mystrncpy(conf->topic, cJSON_GetObjectItem(root, "topic")->valuestring, MAX_LEN);
-    mystrncpy(conf->user, cJSON_GetObjectItem(root, "user")->valuestring, MAX_LEN);
-    mystrncpy(conf->password, cJSON_GetObjectItem(root, "password")->valuestring, MAX_LEN);
+    release_channel(ch);
+    g_shared_channel[pos] = NULL;
+    g_shared_mqtt_client[pos] = NULL;
+    g_channel_next[pos] = g_free_channel;
+    g_free_channel = pos;
+    g_channel_count--;
+}
 
-    free(content);
-    cJSON_Delete(root);
+void lock_all_workers()
+{
+    // always lock in the same order, to avoid dead lock
+    int i = 0;
+    for (i = 0; i < g_worker_num; i++)
+    {
+        pthread_mutex_lock(&g_workers[i].lock);
+    }
+}
+
+void unlock_all_workers()
+{
+    int i = 0;
+    for (i = g_worker_num - 1; i >= 0; i--)
+    {
+        pthread_mutex_unlock(&g_workers[i].lock);
+    }
+}
+
+void wake_all_workers()
+{
+    int i = 0;
+    for (i = 0; i < g_worker_num; i++)
+    {
+        pthread_mutex_lock(&g_workers[i].lock);
+        pthread_cond_signal(&g_workers[i].wakeup);
+        pthread_mutex_unlock(&g_workers[i].lock);
+    }
+}
+
+// the supervisor handles the policy reloading and the status at once
+void wake_supervisor()
+{
+    evloop_wakeup(&g_supervisor_loop);
+}
+
+// 1 if the clients of all the channels are connected, nothing to retry
+int mqtt_clients_connected()
+{
+    int i = 0;
+    for (i = 0; i < g_channel_num; i++)
+    {
+        if (g_shared_mqtt_client[i] != NULL && !amqtt_is_connected(g_shared_mqtt_client[i]))
+        {
+            return 0;
+        }
+    }
     return 1;
 }
 
-int load_gateway_config(GatewayConfig* conf)
+// the publishing clients reconnect by themselves once connected, this
+// only retries the ones whose first connect failed, with backoff
+void connect_mqtt_clients()
+{
+    int i = 0;
+    for (i = 0; i < g_channel_num; i++)
+    {
+        if (g_shared_mqtt_client[i] != NULL)
+        {
+            amqtt_connect(g_shared_mqtt_client[i]);
+        }
+    }
+}
+
+int load_channel(Channel* conf)
 {
     if (conf == NULL)
     {
@@ -167,597 +544,5349 @@ int load_gateway_config(GatewayConfig* conf)
     if (root == NULL)
     {
         printf("the config file is not a valid json object, file=%s\n", CONFIG_FILE);
+        free(content);
         return 0;
     }
     mystrncpy(conf->endpoint, cJSON_GetObjectItem(root, "endpoint")->valuestring, MAX_LEN);
     mystrncpy(conf->topic, cJSON_GetObjectItem(root, "topic")->valuestring, MAX_LEN);
     mystrncpy(conf->user, cJSON_GetObjectItem(root, "user")->valuestring, MAX_LEN);
     mystrncpy(conf->password, cJSON_GetObjectItem(root, "password")->valuestring, MAX_LEN);
-    // backControlTopic may be missing, or may be null
-    conf->backControlTopic[0] = 0;
-    if (cJSON_HasObjectItem(root, "backControlTopic")) {
-        cJSON* backControlTopicObj = cJSON_GetObjectItem(root, "backControlTopic");
-        if (! cJSON_IsNull(backControlTopicObj)) {
-            mystrncpy(conf->backControlTopic, backControlTopicObj->valuestring, MAX_LEN);
-        }
-    }
+
     free(content);
     cJSON_Delete(root);
     return 1;
 }
 
-SlavePolicy* new_slave_policy()
+// the optional line settings of a serial bus in item, of a port or a policy,
+// the ones not given are left as they are. "rs485" is true for rts high while
+// sending, or {"rtsOnSend": "high" or "low", "delayBeforeMs": 0, "delayAfterMs": 0}
+void load_serial_line(cJSON* item, Rs485Mode* rs485, int* rtsDelayBeforeMs, 
+    int* rtsDelayAfterMs, int* lowLatency)
 {
-    SlavePolicy* sp = (SlavePolicy*) malloc(sizeof(SlavePolicy));
-    sp->nextRun = time(NULL);
-    sp->next = NULL;
-    sp->mqttClient = -1;
-
-    return sp;
+    cJSON* mode = cJSON_GetObjectItem(item, "rs485");
+    if (cJSON_IsBool(mode))
+    {
+        *rs485 = cJSON_IsTrue(mode) ? RS485_RTS_HIGH : RS485_ADAPTER;
+    }
+    else if (cJSON_IsObject(mode))
+    {
+        *rs485 = cJSON_IsString(cJSON_GetObjectItem(mode, "rtsOnSend")) 
+            && strcmp(json_string(mode, "rtsOnSend"), "low") == 0 ? RS485_RTS_LOW : RS485_RTS_HIGH;
+        if (cJSON_HasObjectItem(mode, "delayBeforeMs"))
+        {
+            *rtsDelayBeforeMs = json_int(mode, "delayBeforeMs");
+        }
+        if (cJSON_HasObjectItem(mode, "delayAfterMs"))
+        {
+            *rtsDelayAfterMs = json_int(mode, "delayAfterMs");
+        }
+    }
+    if (cJSON_HasObjectItem(item, "lowLatency"))
+    {
+        *lowLatency = cJSON_IsTrue(cJSON_GetObjectItem(item, "lowLatency"));
+    }
 }
 
-void cleanup_shared_data()
+void load_serial_ports(GatewayConfig* conf, cJSON* ports)
 {
+    int num = cJSON_GetArraySize(ports);
     int i = 0;
-    for (i = 0; i < MAX_CHANNEL; i++)
+    for (i = 0; i < num && conf->portNum < MAX_SERIAL_PORT; i++)
     {
-        if (g_shared_channel[i] != NULL)
+        cJSON* item = cJSON_GetArrayItem(ports, i);
+        if (!cJSON_IsString(cJSON_GetObjectItem(item, "name"))
+            || !cJSON_IsString(cJSON_GetObjectItem(item, "device")))
         {
-            free(g_shared_channel[i]);
-            g_shared_channel[i] = NULL;
+            printf("serial port %d without name or device, skipped\n", i);
+            continue;
         }
-
-        MQTTClient mqtt_client = g_shared_mqtt_client[i];
-        if (mqtt_client != NULL)
+        SerialPort* port = &conf->ports[conf->portNum++];
+        mystrncpy(port->name, json_string(item, "name"), FIELD_NAME_LEN);
+        mystrncpy(port->device, json_string(item, "device"), ADDR_LEN);
+        port->mode = RTU;
+        if (cJSON_IsString(cJSON_GetObjectItem(item, "protocol")) 
+            && strcmp(json_string(item, "protocol"), "ascii") == 0)
         {
-            MQTTClient_disconnect(mqtt_client, 5000L);
-            MQTTClient_destroy(&mqtt_client);
-            g_shared_mqtt_client[i] = NULL;
+            port->mode = ASCII;
         }
+        port->baud = cJSON_HasObjectItem(item, "baud") ? json_int(item, "baud") : 9600;
+        port->databits = cJSON_HasObjectItem(item, "databits") ? json_int(item, "databits") : 8;
+        port->parity = cJSON_IsString(cJSON_GetObjectItem(item, "parity")) 
+            ? json_string(item, "parity")[0] : 'N';
+        port->stopbits = cJSON_HasObjectItem(item, "stopbits") ? json_int(item, "stopbits") : 1;
+        port->responseTimeoutMs = cJSON_HasObjectItem(item, "responseTimeoutMs") 
+            ? json_int(item, "responseTimeoutMs") : 0;
+        port->byteTimeoutMs = cJSON_HasObjectItem(item, "byteTimeoutMs") 
+            ? json_int(item, "byteTimeoutMs") : 0;
+        port->turnaroundMs = cJSON_HasObjectItem(item, "turnaroundMs") 
+            ? json_int(item, "turnaroundMs") : -1;
+        port->autoTimeout = cJSON_IsTrue(cJSON_GetObjectItem(item, "autoTimeout"));
+        port->rs485 = RS485_ADAPTER;
+        port->rtsDelayBeforeMs = 0;
+        port->rtsDelayAfterMs = 0;
+        port->lowLatency = 1;
+        load_serial_line(item, &port->rs485, &port->rtsDelayBeforeMs, &port->rtsDelayAfterMs,
+            &port->lowLatency);
     }
+}
 
-    cleanup_modbus_ctxs();
-}    
-
-void destroy_slave_policy(SlavePolicy* sp)
+// the policies on the serial ports take the settings of the ports, the
+// snapshot of the policies is stale once the ports are changed
+unsigned int serial_ports_hash()
 {
-    if (sp == NULL)
+    char buff[MAX_LEN];
+    unsigned int hash = 5381;
+    int i = 0;
+    for (i = 0; i < g_gateway_conf.portNum; i++)
     {
-        return;
+        SerialPort* p = &g_gateway_conf.ports[i];
+        snprintf(buff, MAX_LEN, "%s|%s|%d|%d|%d|%c|%d|%d|%d|%d|%d|%d|%d|%d|%d", p->name, 
+            p->device, p->mode, p->baud, p->databits, p->parity, p->stopbits, 
+            p->responseTimeoutMs, p->byteTimeoutMs, p->turnaroundMs, p->autoTimeout, p->rs485,
+            p->rtsDelayBeforeMs, p->rtsDelayAfterMs, p->lowLatency);
+        hash = hash * 33 + hash_string(buff);
     }
-    // modbus context is cleaned up in a centralized place (cleanup_shared_data())
-
-    free(sp);
+    return hash;
 }
 
-void init_mqtt_client_for_policy(SlavePolicy* policy)
+SerialPort* find_serial_port(const char* name)
 {
-    if (policy == NULL)
+    int i = 0;
+    for (i = 0; i < g_gateway_conf.portNum; i++)
     {
-        return;
+        if (strcmp(g_gateway_conf.ports[i].name, name) == 0)
+        {
+            return &g_gateway_conf.ports[i];
+        }
     }
+    return NULL;
+}
 
-    // look up channle in g_shared_channel first, see if the mqtt client of the same channel
-    // is already created
+// the gateway itself is the first tenant. the others share its mqtt
+// connection, its workers, buses and publishers, and have configs of their own
+void load_tenants(GatewayConfig* conf, cJSON* tenants)
+{
+    TenantConfig* self = &conf->tenants[0];
+    memset(self, 0, sizeof(TenantConfig));
+    mystrncpy(self->topic, conf->topic, MAX_LEN);
+    mystrncpy(self->backControlTopic, conf->backControlTopic, MAX_LEN);
+    mystrncpy(self->ackTopic, conf->ackTopic, MAX_LEN);
+    mystrncpy(self->statusTopic, conf->statusTopic, MAX_LEN);
+    conf->tenantNum = 1;
+    int num = cJSON_GetArraySize(tenants);
     int i = 0;
-    MQTTClient found_client = find_shared_mqtt_client(&policy->pubChannel, &i);
-    if (found_client != NULL)
+    for (i = 0; i < num; i++)
     {
-        policy->mqttClient = i;
-        return;
-    }
-    MQTTClient new_client;
-    MQTTClient_connectOptions connect_options = MQTTClient_connectOptions_initializer;
-    char clientid[MAX_LEN];
-    snprintf(clientid, MAX_LEN, "gateway%sslave%d%lld", policy->gatewayid, policy->slaveid, 
-                    (long long)time(NULL));
-    int rc = MQTTClient_create(&new_client, policy->pubChannel.endpoint, clientid,
-                 MQTTCLIENT_PERSISTENCE_NONE, NULL);
-    connect_options.keepAliveInterval = 20;  // Alive interval
-    connect_options.cleansession = 1;
-    connect_options.username = policy->pubChannel.user;
-    connect_options.password = policy->pubChannel.password;
-    set_ssl_option(&connect_options, policy->pubChannel.endpoint);
-
-    rc = MQTTClient_connect(new_client, &connect_options);
-    if (MQTTCLIENT_SUCCESS == rc)
-    {
-        log_debug("successfully create mqtt client for policy");
-        
-        // save the mqtt client for future sharing
-        for (i = 0; i < MAX_CHANNEL; i++)
+        cJSON* item = cJSON_GetArrayItem(tenants, i);
+        // the id names the cache files of the tenant
+        if (!cJSON_IsString(cJSON_GetObjectItem(item, "id")) 
+            || !cJSON_IsString(cJSON_GetObjectItem(item, "topic"))
+            || strlen(json_string(item, "id")) == 0 || strchr(json_string(item, "id"), '/') != NULL 
+            || strlen(json_string(item, "topic")) == 0)
         {
-            Channel* pch = g_shared_channel[i];
-            if (pch == NULL)
+            printf("tenant %d without a plain id or a topic, skipped\n", i);
+            continue;
+        }
+        const char* id = json_string(item, "id");
+        const char* topic = json_string(item, "topic");
+        int j = 0;
+        for (j = 0; j < conf->tenantNum; j++)
+        {
+            if (strcmp(conf->tenants[j].id, id) == 0 || strcmp(conf->tenants[j].topic, topic) == 0)
             {
-                pch = (Channel*) malloc(sizeof(Channel));
-                mystrncpy(pch->endpoint, policy->pubChannel.endpoint, MAX_LEN);
-                mystrncpy(pch->topic, policy->pubChannel.topic, MAX_LEN);
-                mystrncpy(pch->user, policy->pubChannel.user, MAX_LEN);
-                mystrncpy(pch->password, policy->pubChannel.password, MAX_LEN);
-                
-                g_shared_channel[i] = pch;
-                g_shared_mqtt_client[i] = new_client;
-                policy->mqttClient = i;
-                
                 break;
             }
         }
-                
-    } 
-    else 
-    {
-        policy->mqttClient = -1;
-        printf("failed to create slave policy mqtt connection, rc=%d, \
-                slaveid=%d, host=%s clientid=%s, user=%s password=%s", 
-                rc, policy->slaveid, policy->pubChannel.endpoint, clientid, 
-                policy->pubChannel.user, policy->pubChannel.password);
+        if (j < conf->tenantNum)
+        {
+            printf("tenant %s has the id or the topic of another one, skipped\n", id);
+            continue;
+        }
+        if (conf->tenantNum == MAX_TENANTS)
+        {
+            printf("only %d tenants are served, %s and the ones after it are skipped\n", 
+                MAX_TENANTS - 1, id);
+            break;
+        }
+        TenantConfig* t = &conf->tenants[conf->tenantNum++];
+        memset(t, 0, sizeof(TenantConfig));
+        mystrncpy(t->id, id, FIELD_NAME_LEN);
+        mystrncpy(t->topic, topic, MAX_LEN);
+        if (cJSON_IsString(cJSON_GetObjectItem(item, "backControlTopic")))
+        {
+            mystrncpy(t->backControlTopic, json_string(item, "backControlTopic"), MAX_LEN);
+        }
+        if (cJSON_IsString(cJSON_GetObjectItem(item, "ackTopic")))
+        {
+            mystrncpy(t->ackTopic, json_string(item, "ackTopic"), MAX_LEN);
+        }
+        if (cJSON_IsString(cJSON_GetObjectItem(item, "statusTopic")))
+        {
+            mystrncpy(t->statusTopic, json_string(item, "statusTopic"), MAX_LEN);
+        }
+        if (cJSON_HasObjectItem(item, "maxPolicies"))
+        {
+            t->maxPolicies = json_int(item, "maxPolicies");
+        }
+        if (cJSON_HasObjectItem(item, "minIntervalMs"))
+        {
+            t->minIntervalMs = json_int(item, "minIntervalMs");
+        }
+        t->maxPolicies = t->maxPolicies > 0 ? t->maxPolicies : 0;
+        t->minIntervalMs = t->minIntervalMs > 0 ? t->minIntervalMs : 0;
     }
 }
 
-SlavePolicy* json_to_slave_poilicy(cJSON* root)
+// for the messages
+const char* tenant_name(int tenant)
 {
-    SlavePolicy* policy = new_slave_policy();
-    mystrncpy(policy->gatewayid, json_string(root, "gatewayid"), UUID_LEN);
-    policy->slaveid = json_int(root, "slaveid");
-    int int_mode = json_int(root, "mode");
-    policy->mode = (ModbusMode)int_mode;
-    mystrncpy(policy->ip_com_addr, json_string(root, "ip_com_addr"), ADDR_LEN);
-    policy->functioncode = (char)json_int(root, "functioncode");
-    policy->start_addr = json_int(root, "start_addr");
-    policy->length = json_int(root, "length");
-    policy->interval = json_int(root, "interval");
-    mystrncpy(policy->trantable, json_string(root, "trantable"), UUID_LEN);
-        
-    cJSON* cjch = cJSON_GetObjectItem(root, "pubChannel");
-    mystrncpy(policy->pubChannel.endpoint, json_string(cjch, "endpoint"), MAX_LEN);
-    mystrncpy(policy->pubChannel.topic, json_string(cjch, "topic"), MAX_LEN);
-    mystrncpy(policy->pubChannel.user, json_string(cjch, "user"), MAX_LEN);
-    mystrncpy(policy->pubChannel.password, json_string(cjch, "password"), MAX_LEN);
-    policy->nextRun = time(NULL) + policy->interval;
+    return tenant == 0 ? "the gateway" : g_gateway_conf.tenants[tenant].id;
+}
 
-    if (policy->mode == RTU)
+// the cache files of the tenants, the gateway itself keeps POLICY_CACHE
+void init_tenant_state()
+{
+    int t = 0;
+    for (t = 0; t < g_gateway_conf.tenantNum; t++)
     {
-        policy->baud = json_int(root, "baud");
-        policy->databits = json_int(root, "databits");
+        TenantState* ts = &g_tenants[t];
+        memset(ts, 0, sizeof(TenantState));
+        if (t == 0)
+        {
+            mystrncpy(ts->cache, POLICY_CACHE, MAX_LEN);
+            mystrncpy(ts->journal, POLICY_JOURNAL, MAX_LEN);
+        }
+        else
+        {
+            snprintf(ts->cache, MAX_LEN, "policyCache.%s.txt", g_gateway_conf.tenants[t].id);
+            snprintf(ts->journal, MAX_LEN, "policyCache.%s.delta", g_gateway_conf.tenants[t].id);
+        }
+    }
+}
+
+int load_gateway_config(GatewayConfig* conf)
+{
+    if (conf == NULL)
+    {
+        printf("the parameter conf is NULL\n");
+        return 0;
+    }
+    char* content = NULL;
+    long size = read_file_as_string(CONFIG_FILE, &content);
+    if (size <= 0)
+    {
+        printf("failed to open config file %s, while trying to load gateway configuration\n",
+             CONFIG_FILE);
+        return 0;
+    }
+    
+    cJSON* root = cJSON_Parse(content);
+    if (root == NULL)
+    {
+        printf("the config file is not a valid json object, file=%s\n", CONFIG_FILE);
+        free(content);
+        return 0;
+    }
+    mystrncpy(conf->endpoint, cJSON_GetObjectItem(root, "endpoint")->valuestring, MAX_LEN);
+    mystrncpy(conf->topic, cJSON_GetObjectItem(root, "topic")->valuestring, MAX_LEN);
+    mystrncpy(conf->user, cJSON_GetObjectItem(root, "user")->valuestring, MAX_LEN);
+    mystrncpy(conf->password, cJSON_GetObjectItem(root, "password")->valuestring, MAX_LEN);
+    // backControlTopic may be missing, or may be null
+    conf->backControlTopic[0] = 0;
+    if (cJSON_HasObjectItem(root, "backControlTopic")) {
+        cJSON* backControlTopicObj = cJSON_GetObjectItem(root, "backControlTopic");
+        if (! cJSON_IsNull(backControlTopicObj)) {
+            mystrncpy(conf->backControlTopic, backControlTopicObj->valuestring, MAX_LEN);
+        }
+    }
+    // statusTopic is optional, the gateway status is published there if present
+    conf->statusTopic[0] = 0;
+    if (cJSON_HasObjectItem(root, "statusTopic")) {
+        cJSON* statusTopicObj = cJSON_GetObjectItem(root, "statusTopic");
+        if (! cJSON_IsNull(statusTopicObj)) {
+            mystrncpy(conf->statusTopic, statusTopicObj->valuestring, MAX_LEN);
+        }
+    }
+    // ackTopic is optional, the results of the back control requests are published there
+    conf->ackTopic[0] = 0;
+    if (cJSON_HasObjectItem(root, "ackTopic")) {
+        cJSON* ackTopicObj = cJSON_GetObjectItem(root, "ackTopic");
+        if (! cJSON_IsNull(ackTopicObj)) {
+            mystrncpy(conf->ackTopic, ackTopicObj->valuestring, MAX_LEN);
+        }
+    }
+    // traceTopic is optional, {"trace": "start"}, "stop" or "dump" there traces
+    // the samples from the poll to the publish ack, see handle_trace_msg
+    conf->traceTopic[0] = 0;
+    if (cJSON_IsString(cJSON_GetObjectItem(root, "traceTopic")))
+    {
+        mystrncpy(conf->traceTopic, json_string(root, "traceTopic"), MAX_LEN);
+    }
+    // realtime is optional, the workers, which time the frames of the buses,
+    // run under SCHED_FIFO at priority on busCpus, and the other threads on
+    // otherCpus, e.g. {"priority": 50, "busCpus": "2-3", "otherCpus": "0-1",
+    // "lockMemory": true}. see realtime.h
+    conf->rtPriority = 0;
+    conf->busCpus = 0;
+    conf->otherCpus = 0;
+    conf->lockMemory = 0;
+    if (cJSON_HasObjectItem(root, "realtime"))
+    {
+        cJSON* realtime = cJSON_GetObjectItem(root, "realtime");
+        if (cJSON_HasObjectItem(realtime, "priority"))
+        {
+            conf->rtPriority = json_int(realtime, "priority");
+            if (conf->rtPriority < 0 || conf->rtPriority > RT_MAX_PRIORITY)
+            {
+                printf("realtime priority %d is not within 1 to %d, ignored\n",
+                    conf->rtPriority, RT_MAX_PRIORITY);
+                conf->rtPriority = 0;
+            }
+        }
+        if (cJSON_IsString(cJSON_GetObjectItem(realtime, "busCpus"))
+            && rt_parse_cpus(json_string(realtime, "busCpus"), &conf->busCpus) != 0)
+        {
+            printf("invalid busCpus %s, the workers are not pinned\n", json_string(realtime, "busCpus"));
+        }
+        if (cJSON_IsString(cJSON_GetObjectItem(realtime, "otherCpus"))
+            && rt_parse_cpus(json_string(realtime, "otherCpus"), &conf->otherCpus) != 0)
+        {
+            printf("invalid otherCpus %s, the other threads are not pinned\n", json_string(realtime, "otherCpus"));
+        }
+        conf->lockMemory = cJSON_IsTrue(cJSON_GetObjectItem(realtime, "lockMemory")) ? 1 : 0;
+    }
+    // shardTopic is optional, the gateways announcing on it share the policies
+    // of one config, each polls the buses it owns. instanceId tells this one
+    // from the others, it's the hostname if missing
+    conf->shardTopic[0] = 0;
+    conf->instanceId[0] = 0;
+    if (cJSON_IsString(cJSON_GetObjectItem(root, "shardTopic")))
+    {
+        mystrncpy(conf->shardTopic, json_string(root, "shardTopic"), MAX_LEN);
+    }
+    if (cJSON_IsString(cJSON_GetObjectItem(root, "instanceId")))
+    {
+        mystrncpy(conf->instanceId, json_string(root, "instanceId"), FIELD_NAME_LEN);
+    }
+    if (strlen(conf->instanceId) == 0 && gethostname(conf->instanceId, FIELD_NAME_LEN) != 0)
+    {
+        mystrncpy(conf->instanceId, "modbusGW", FIELD_NAME_LEN);
+    }
+    conf->instanceId[FIELD_NAME_LEN - 1] = 0;
+    // metricsListen is optional, like "127.0.0.1:9105", the metrics are served
+    // there in the prometheus text format
+    conf->metricsListen[0] = 0;
+    if (cJSON_IsString(cJSON_GetObjectItem(root, "metricsListen")))
+    {
+        mystrncpy(conf->metricsListen, json_string(root, "metricsListen"), ADDR_LEN);
+    }
+    // bacnet is optional, like {"deviceInstance": 260001, "port": 47808, "interface": "eth0"},
+    // the polled values are served to BACnet/IP clients as well, see bacnet_bridge.h
+    conf->bacnetDevice = -1;
+    conf->bacnetPort = 0;
+    conf->bacnetInterface[0] = 0;
+    if (cJSON_IsObject(cJSON_GetObjectItem(root, "bacnet")))
+    {
+        cJSON* bacnet = cJSON_GetObjectItem(root, "bacnet");
+        conf->bacnetDevice = json_int(bacnet, "deviceInstance");
+        if (cJSON_HasObjectItem(bacnet, "port"))
+        {
+            conf->bacnetPort = json_int(bacnet, "port");
+        }
+        if (cJSON_IsString(cJSON_GetObjectItem(bacnet, "interface")))
+        {
+            mystrncpy(conf->bacnetInterface, json_string(bacnet, "interface"), ADDR_LEN);
+        }
+    }
+    // modbusServer is optional, like {"listen": "0.0.0.0:502", "maxAgeMs": 10000},
+    // the polled data is served to local modbus tcp clients, see modbus_server.h
+    conf->modbusServerListen[0] = 0;
+    conf->modbusServerMaxAgeMs = 0;
+    if (cJSON_IsObject(cJSON_GetObjectItem(root, "modbusServer")))
+    {
+        cJSON* server = cJSON_GetObjectItem(root, "modbusServer");
+        if (cJSON_IsString(cJSON_GetObjectItem(server, "listen")))
+        {
+            mystrncpy(conf->modbusServerListen, json_string(server, "listen"), ADDR_LEN);
+        }
+        if (cJSON_HasObjectItem(server, "maxAgeMs"))
+        {
+            conf->modbusServerMaxAgeMs = json_int(server, "maxAgeMs");
+        }
+    }
+    // sharedMemory is optional, like {"name": "/bdModbusGateway", "points": 10000},
+    // the latest values are written to a shared memory table, see shm_points.h
+    conf->sharedMemory[0] = 0;
+    conf->sharedPoints = DEFAULT_SHARED_POINTS;
+    if (cJSON_IsObject(cJSON_GetObjectItem(root, "sharedMemory")))
+    {
+        cJSON* shared = cJSON_GetObjectItem(root, "sharedMemory");
+        if (cJSON_IsString(cJSON_GetObjectItem(shared, "name")))
+        {
+            mystrncpy(conf->sharedMemory, json_string(shared, "name"), FIELD_NAME_LEN);
+        }
+        if (cJSON_HasObjectItem(shared, "points"))
+        {
+            conf->sharedPoints = json_int(shared, "points");
+        }
+    }
+    // shadow is optional, the points mirrored into the reported properties of a
+    // device shadow, see shadow_mirror.h. kept as it is until the mirror starts
+    conf->shadow = NULL;
+    if (cJSON_IsObject(cJSON_GetObjectItem(root, "shadow")))
+    {
+        conf->shadow = cJSON_Duplicate(cJSON_GetObjectItem(root, "shadow"), 1);
+    }
+    // ports is optional, the serial ports of the gateway and their bus settings,
+    // so that the rtu policies only need to name the port
+    conf->portNum = 0;
+    if (cJSON_HasObjectItem(root, "ports"))
+    {
+        load_serial_ports(conf, cJSON_GetObjectItem(root, "ports"));
+    }
+    // workerNum is optional, it controls how many buses could be polled in parallel.
+    // by default every serial port gets a worker of its own
+    conf->workerNum = DEFAULT_WORKER_NUM;
+    if (cJSON_HasObjectItem(root, "workerNum"))
+    {
+        conf->workerNum = json_int(root, "workerNum");
+    }
+    else if (conf->portNum > DEFAULT_WORKER_NUM)
+    {
+        conf->workerNum = conf->portNum;
+    }
+    if (conf->workerNum < 1)
+    {
+        conf->workerNum = 1;
+    }
+    else if (conf->workerNum > MAX_WORKER)
+    {
+        conf->workerNum = MAX_WORKER;
+    }
+    // batch is optional, the samples of the same channel are published in
+    // one message, flushed by maxCount, maxBytes or lingerMs whichever first.
+    // without it every sample is published as a message, as before
+    conf->batchMaxCount = 1;
+    conf->batchMaxBytes = DEFAULT_BATCH_BYTES;
+    conf->batchLingerMs = DEFAULT_BATCH_LINGER_MS;
+    if (cJSON_HasObjectItem(root, "batch"))
+    {
+        cJSON* batch = cJSON_GetObjectItem(root, "batch");
+        if (cJSON_HasObjectItem(batch, "maxCount"))
+        {
+            conf->batchMaxCount = json_int(batch, "maxCount");
+        }
+        if (cJSON_HasObjectItem(batch, "maxBytes"))
+        {
+            conf->batchMaxBytes = json_int(batch, "maxBytes");
+        }
+        if (cJSON_HasObjectItem(batch, "lingerMs"))
+        {
+            conf->batchLingerMs = json_int(batch, "lingerMs");
+        }
+        if (conf->batchMaxBytes < MIN_BATCH_BYTES)
+        {
+            conf->batchMaxBytes = MIN_BATCH_BYTES;
+        }
+        if (conf->batchLingerMs < MIN_INTERVAL_MS)
+        {
+            conf->batchLingerMs = MIN_INTERVAL_MS;
+        }
+    }
+    // the outbound mqtt queue of every client, and the max messages in flight.
+    // pubQos is the qos of the published samples, with qos 1 the in-flight
+    // window bounds the samples waiting for ack
+    conf->mqttQueueSize = DEFAULT_MQTT_QUEUE_SIZE;
+    conf->mqttMaxInflight = DEFAULT_MQTT_MAX_INFLIGHT;
+    conf->pubQos = 0;
+    if (cJSON_HasObjectItem(root, "mqttQueueSize"))
+    {
+        conf->mqttQueueSize = json_int(root, "mqttQueueSize");
+    }
+    if (cJSON_HasObjectItem(root, "mqttMaxInflight"))
+    {
+        conf->mqttMaxInflight = json_int(root, "mqttMaxInflight");
+    }
+    if (cJSON_HasObjectItem(root, "pubQos"))
+    {
+        conf->pubQos = json_int(root, "pubQos") > 0 ? 1 : 0;
+    }
+    // mqttRateLimit is optional, the message rate quota of the broker on a
+    // connection. the bursts of the policies wait in the queue below it
+    conf->mqttRateLimit = 0;
+    conf->mqttRateBurst = 0;
+    if (cJSON_HasObjectItem(root, "mqttRateLimit"))
+    {
+        conf->mqttRateLimit = json_int(root, "mqttRateLimit");
+    }
+    if (cJSON_HasObjectItem(root, "mqttRateBurst"))
+    {
+        conf->mqttRateBurst = json_int(root, "mqttRateBurst");
+    }
+    // mqttVersion is optional, 5 gets the topic aliases of mqtt 5 if the
+    // paho library supports it, mqttMaxPacketSize is only sent with mqtt 5
+    conf->mqttVersion = 4;
+    conf->mqttMaxPacketSize = 0;
+    if (cJSON_HasObjectItem(root, "mqttVersion"))
+    {
+        conf->mqttVersion = json_int(root, "mqttVersion") == 5 ? 5 : 4;
+    }
+    if (cJSON_HasObjectItem(root, "mqttMaxPacketSize"))
+    {
+        conf->mqttMaxPacketSize = json_int(root, "mqttMaxPacketSize");
+    }
+    // spoolDir is optional, the samples which don't fit in the mqtt queue are
+    // spooled there, one sub directory per channel, and replayed later
+    conf->spoolDir[0] = 0;
+    conf->spoolMaxMB = DEFAULT_SPOOL_MAX_MB;
+    if (cJSON_HasObjectItem(root, "spoolDir"))
+    {
+        cJSON* spoolDirObj = cJSON_GetObjectItem(root, "spoolDir");
+        if (! cJSON_IsNull(spoolDirObj))
+        {
+            mystrncpy(conf->spoolDir, spoolDirObj->valuestring, MAX_LEN);
+        }
+    }
+    if (cJSON_HasObjectItem(root, "spoolMaxMB"))
+    {
+        conf->spoolMaxMB = json_int(root, "spoolMaxMB");
+    }
+    // tcpPipelineDepth is optional, not every modbus tcp device accepts more than
+    // one outstanding request, so pipelining is disabled by default
+    conf->tcpPipelineDepth = 1;
+    if (cJSON_HasObjectItem(root, "tcpPipelineDepth"))
+    {
+        conf->tcpPipelineDepth = json_int(root, "tcpPipelineDepth");
+    }
+    // probeDevices is optional, the slaves are read as the policies say unless
+    // it's true
+    conf->probeDevices = cJSON_IsTrue(cJSON_GetObjectItem(root, "probeDevices"));
+    // staggerPolls is optional, the policies of a bus are spread over their
+    // interval unless it's false
+    conf->staggerPolls = 1;
+    if (cJSON_HasObjectItem(root, "staggerPolls"))
+    {
+        conf->staggerPolls = cJSON_IsTrue(cJSON_GetObjectItem(root, "staggerPolls"));
+    }
+    // pubBackpressure is optional, the samples of a slow uplink are dropped
+    // oldest first from its queue unless it's true
+    conf->pubBackpressure = cJSON_IsTrue(cJSON_GetObjectItem(root, "pubBackpressure"));
+    // rawPassThrough is optional, the cloud may only write registers and bits
+    // unless it's true, raw pdus can do anything to the slaves
+    conf->rawPassThrough = cJSON_IsTrue(cJSON_GetObjectItem(root, "rawPassThrough"));
+    // timestampFormat is optional, the samples keep the local time in seconds
+    // of the older gateways unless it's "iso8601" or "epochMs"
+    conf->timestampFormat = TIMESTAMP_LOCAL;
+    cJSON* timestampFormatObj = cJSON_GetObjectItem(root, "timestampFormat");
+    if (cJSON_IsString(timestampFormatObj))
+    {
+        if (strcmp(timestampFormatObj->valuestring, "iso8601") == 0)
+        {
+            conf->timestampFormat = TIMESTAMP_ISO8601_MS;
+        }
+        else if (strcmp(timestampFormatObj->valuestring, "epochMs") == 0)
+        {
+            conf->timestampFormat = TIMESTAMP_EPOCH_MS;
+        }
+    }
+    // tenants is optional, the other logical gateways served by this process,
+    // e.g. [{"id": "plantB", "topic": "...", "backControlTopic": "...",
+    // "ackTopic": "...", "statusTopic": "...", "maxPolicies": 200,
+    // "minIntervalMs": 1000}]. maxPolicies and minIntervalMs are its quotas
+    load_tenants(conf, cJSON_GetObjectItem(root, "tenants"));
+    free(content);
+    cJSON_Delete(root);
+    return 1;
+}
+
+SlavePolicy* new_slave_policy()
+{
+    SlavePolicy* sp = (SlavePolicy*) malloc(sizeof(SlavePolicy));
+    sp->nextRun = monotonic_ms();
+    sp->next = NULL;
+    sp->pubChannel = NULL;
+    sp->mqttClient = -1;
+    sp->worker = 0;
+    sp->bus = -1;
+    sp->priority = DEFAULT_PRIORITY;
+    sp->shedFactor = 1;
+    sp->payload = NULL;
+    sp->message = NULL;
+    sp->messageLen = 0;
+    sp->bitEncoding = BITS_AS_BYTES;
+    sp->onChange = 0;
+    sp->deadband = 0;
+    sp->maxSilence = 0;
+    sp->lastPayload = NULL;
+    sp->lastPublish = 0;
+    sp->delta = 0;
+    sp->keyframeMs = DELTA_KEYFRAME_MS;
+    sp->deltaImage = NULL;
+    sp->deltaSeq = 0;
+    sp->lastKeyframe = 0;
+    sp->adaptiveMs = 0;
+    sp->minIntervalMs = 0;
+    sp->maxIntervalMs = 0;
+    sp->changeThreshold = 0;
+    sp->prevPayload = NULL;
+    sp->traceId = 0;
+    sp->scanGroup[0] = 0;
+    sp->scanLeader = NULL;
+    sp->scanNext = NULL;
+    sp->config = NULL;
+    sp->tenant = 0;
+    sp->envelope.text = NULL;
+    sp->envelope.len = 0;
+    sp->responseTimeoutMs = 0;
+    sp->byteTimeoutMs = 0;
+    sp->turnaroundMs = -1;
+    sp->autoTimeout = 0;
+    sp->rs485 = RS485_ADAPTER;
+    sp->rtsDelayBeforeMs = 0;
+    sp->rtsDelayAfterMs = 0;
+    sp->lowLatency = 1;
+    sp->fields = NULL;
+    sp->fieldNum = 0;
+    sp->tmpl = NULL;
+    sp->historyMs = 0;
+    sp->history = NULL;
+    sp->historyStart = 0;
+    sp->aggregateHopMs = 0;
+    sp->aggregatePanes = 1;
+    sp->aggregates = NULL;
+    sp->aggregateStart = 0;
+    sp->aggregateAlarm = 0;
+    sp->bacnetBinaryInputs = -1;
+    sp->bacnetPoint = -1;
+    sp->bacnetPointNum = 0;
+    sp->serverUnitId = -1;
+    sp->serverMaxAgeMs = 0;
+    sp->serverImage = -1;
+    sp->sharedPoint = -1;
+    sp->sharedPointNum = 0;
+    sp->shadowPoint = -1;
+    sp->shadowPointNum = 0;
+    sp->port[0] = 0;
+    sp->polls = 0;
+    sp->pollErrors = 0;
+    sp->exceptions = 0;
+    sp->lastError = 0;
+    sp->errorStreak = 0;
+
+    return sp;
+}
+
+void cleanup_shared_data()
+{
+    // the pending samples go out before their mqtt clients are destroyed
+    flush_all_batches();
+    int i = 0;
+    for (i = 0; i < g_channel_num; i++)
+    {
+        release_channel_client(i, 5000);
+        remove_shared_channel(i);
+    }
+
+    cleanup_modbus_ctxs();
+    cleanup_modbus_profiles();
+}    
+
+void destroy_slave_policy(SlavePolicy* sp)
+{
+    if (sp == NULL)
+    {
+        return;
+    }
+    // modbus context is cleaned up in a centralized place (cleanup_shared_data())
+
+    // the samples not uploaded yet go out while the mqtt client is still there
+    publish_history(sp);
+    int i = 0;
+    for (i = 0; sp->history != NULL && i < sp->fieldNum; i++)
+    {
+        tsblock_destroy(&sp->history[i]);
+    }
+    free(sp->history);
+    // the summary of a window cut short is dropped
+    release_aggregates(sp);
+    free(sp->payload);
+    free(sp->message);
+    free(sp->lastPayload);
+    free(sp->prevPayload);
+    free(sp->deltaImage);
+    free(sp->config);
+    jw_free_fragment(&sp->envelope);
+    // the fields of a template are shared by its instances
+    if (sp->tmpl == NULL || sp->fields != sp->tmpl->fields)
+    {
+        free(sp->fields);
+    }
+    release_policy_template(sp->tmpl);
+    release_channel(sp->pubChannel);
+    free(sp);
+}
+
+// switch the client to mqtt 5 if mqttVersion is 5, it stays on 3.1.1 otherwise
+void enable_mqtt5(AsyncMqtt* client)
+{
+    if (g_gateway_conf.mqttVersion == 5 
+        && amqtt_enable_mqtt5(client, g_gateway_conf.mqttMaxPacketSize) != 0)
+    {
+        printf("mqtt 5 is not supported by the paho library, using mqtt 3.1.1\n");
+    }
+}
+
+// spool the samples of the connection of the channel to disk, if spoolDir is
+// configured. the sub directory is named after the connection, so it's found
+// again after a restart
+void enable_spool_for_channel(AsyncMqtt* client, Channel* ch)
+{
+    if (strlen(g_gateway_conf.spoolDir) == 0)
+    {
+        return;
+    }
+    unsigned int hash = 5381;
+    const char* parts[4] = {ch->endpoint, ch->user, ch->password, ch->compress ? "zlib" : ""};
+    int i = 0;
+    for (i = 0; i < 4; i++)
+    {
+        const char* c = parts[i];
+        for (; *c != 0; c++)
+        {
+            hash = hash * 33 + (unsigned char)*c;
+        }
+        hash = hash * 33;
+    }
+    char dir[MAX_LEN * 2];
+    snprintf(dir, sizeof(dir), "%s/ch%08x", g_gateway_conf.spoolDir, hash);
+    mkdir(g_gateway_conf.spoolDir, 0755);
+    if (amqtt_enable_spool(client, dir, (long long)g_gateway_conf.spoolMaxMB * 1024 * 1024) != 0)
+    {
+        printf("failed to enable the spool %s, topic=%s\n", dir, ch->topic);
+    }
+}
+
+void init_mqtt_client_for_policy(SlavePolicy* policy)
+{
+    if (policy == NULL || policy->pubChannel == NULL)
+    {
+        return;
+    }
+
+    // look up channle in g_shared_channel first, see if the mqtt client of the same channel
+    // is already created
+    int i = 0;
+    AsyncMqtt* found_client = find_shared_mqtt_client(policy->pubChannel, &i);
+    if (found_client != NULL)
+    {
+        policy->mqttClient = i;
+        return;
+    }
+    // a new topic on a connection already open takes a slot, not another connection
+    found_client = find_connection_client(policy->pubChannel);
+    if (found_client != NULL)
+    {
+        Channel* pch = retain_channel(policy->pubChannel);
+        policy->mqttClient = add_shared_channel(pch, found_client);
+        if (policy->mqttClient == -1)
+        {
+            printf("out of memory while adding mqtt channel, slaveid=%d\n", policy->slaveid);
+            release_channel(pch);
+        }
+        return;
+    }
+    // one client per connection, so its id comes from the connection, not the slave
+    char seed[MAX_LEN * 4];
+    snprintf(seed, sizeof(seed), "%s %s %s %d", policy->pubChannel->endpoint, 
+        policy->pubChannel->user, policy->pubChannel->password, policy->pubChannel->compress);
+    char prefix[MAX_LEN];
+    snprintf(prefix, MAX_LEN, "gateway%sch", policy->gatewayid);
+    char clientid[MAX_LEN];
+    amqtt_clientid(clientid, MAX_LEN, prefix, seed);
+    AsyncMqtt* new_client = (AsyncMqtt*) malloc(sizeof(AsyncMqtt));
+    int rc = -1;
+    if (new_client != NULL)
+    {
+        rc = amqtt_create(new_client, policy->pubChannel->endpoint, clientid, 
+            policy->pubChannel->user, policy->pubChannel->password, PEM_FILE,
+            g_gateway_conf.mqttQueueSize, g_gateway_conf.mqttMaxInflight, 
+            g_gateway_conf.pubQos);
+    }
+    if (rc == 0)
+    {
+        enable_mqtt5(new_client);
+        // the channels sharing the connection share its quota too
+        amqtt_set_rate_limit(new_client, g_gateway_conf.mqttRateLimit, g_gateway_conf.mqttRateBurst);
+        if (policy->pubChannel->compress 
+            && amqtt_enable_compression(new_client, ZLIB_DICT, strlen(ZLIB_DICT)) != 0)
+        {
+            printf("failed to enable the compression, topic=%s\n", policy->pubChannel->topic);
+        }
+        enable_spool_for_channel(new_client, policy->pubChannel);
+        amqtt_set_latency_histogram(new_client, &g_metrics.publish);
+        // the connection is made in background, the samples published 
+        // before it's ready are queued
+        amqtt_connect(new_client);
+        log_debug("successfully create mqtt client for policy");
+        
+        // save the mqtt client for future sharing
+        Channel* pch = retain_channel(policy->pubChannel);
+        policy->mqttClient = add_shared_channel(pch, new_client);
+        if (policy->mqttClient == -1)
+        {
+            printf("out of memory while adding mqtt channel, slaveid=%d\n", policy->slaveid);
+            release_channel(pch);
+            amqtt_destroy(new_client, 0);
+            free(new_client);
+        }
+    } 
+    else 
+    {
+        free(new_client);
+        policy->mqttClient = -1;
+        printf("failed to create slave policy mqtt client, \
+                slaveid=%d, host=%s clientid=%s, user=%s\n", 
+                policy->slaveid, policy->pubChannel->endpoint, clientid, 
+                policy->pubChannel->user);
+    }
+}
+
+
+// every bit takes 2 hex chars, every register takes 4, the buffers are
+// allocated here once, so that polling doesn't allocate any more
+// the fields of the messages which never change for the policy are rendered
+// once, add_request_fields writes them as they are
+void render_envelope(SlavePolicy* policy)
+{
+    JsonWriter w;
+    jw_init(&w, NULL, 0);
+    jw_begin_object(&w, NULL);
+    JwMark mark = jw_mark(&w);
+    add_request_fields(&w, policy);
+    if (jw_take_fragment(&w, mark, &policy->envelope) != 0)
+    {
+        printf("out of memory while rendering the envelope of slaveid=%d\n", policy->slaveid);
+    }
+    free(w.buf);
+}
+
+void alloc_policy_buffers(SlavePolicy* policy)
+{
+    int payload_len = policy->length * 4 + 1;
+    policy->payload = (char*) malloc(payload_len);
+    policy->payload[0] = 0;
+    policy->messageLen = payload_len + MSG_OVERHEAD_LEN;
+    policy->message = (char*) malloc(policy->messageLen);
+    if (policy->onChange)
+    {
+        policy->lastPayload = (char*) malloc(payload_len);
+        policy->lastPayload[0] = 0;
+    }
+    if (policy->minIntervalMs > 0)
+    {
+        policy->prevPayload = (char*) malloc(payload_len);
+        policy->prevPayload[0] = 0;
+    }
+    if (policy->delta)
+    {
+        policy->deltaImage = (uint16_t*) malloc(policy->length * sizeof(uint16_t));
+    }
+    render_envelope(policy);
+}
+
+// the fields telling the policies apart, see same_policy. return the named
+// serial port of the policy, NULL if it has none
+SerialPort* json_to_policy_key(cJSON* root, SlavePolicy* policy)
+{
+    mystrncpy(policy->gatewayid, json_string(root, "gatewayid"), UUID_LEN);
+    policy->slaveid = json_int(root, "slaveid");
+    // port is optional, a policy on a named serial port takes the bus settings
+    // from the gateway config instead of repeating them
+    SerialPort* port = NULL;
+    if (cJSON_IsString(cJSON_GetObjectItem(root, "port")))
+    {
+        mystrncpy(policy->port, json_string(root, "port"), FIELD_NAME_LEN);
+        port = find_serial_port(policy->port);
+        if (port == NULL)
+        {
+            printf("unknown serial port %s of slaveid=%d\n", policy->port, policy->slaveid);
+        }
+    }
+    if (port != NULL)
+    {
+        policy->mode = port->mode;
+        mystrncpy(policy->ip_com_addr, port->device, ADDR_LEN);
+    }
+    else
+    {
+        int int_mode = json_int(root, "mode");
+        policy->mode = (ModbusMode)int_mode;
+        mystrncpy(policy->ip_com_addr, json_string(root, "ip_com_addr"), ADDR_LEN);
+    }
+    policy->functioncode = (char)json_int(root, "functioncode");
+    policy->start_addr = json_int(root, "start_addr");
+    policy->length = json_int(root, "length");
+    if (policy->length < 0)
+    {
+        policy->length = 0;
+    }
+    return port;
+}
+
+// the policy of the json, an instance expanded with its template if it has one
+SlavePolicy* compile_slave_policy(cJSON* root, PolicyTemplate* tmpl)
+{
+    SlavePolicy* policy = new_slave_policy();
+    policy->tmpl = tmpl;
+    SerialPort* port = json_to_policy_key(root, policy);
+    // report by exception is optional, enabled by onChange or deadband
+    if (cJSON_HasObjectItem(root, "onChange"))
+    {
+        policy->onChange = cJSON_IsTrue(cJSON_GetObjectItem(root, "onChange")) 
+            || json_int(root, "onChange") != 0;
+    }
+    if (cJSON_HasObjectItem(root, "deadband"))
+    {
+        policy->deadband = json_int(root, "deadband");
+        policy->onChange = 1;
+    }
+    if (cJSON_HasObjectItem(root, "maxSilence"))
+    {
+        policy->maxSilence = json_int(root, "maxSilence") * 1000;
+    }
+    // historySec is optional, the fields are kept at the edge and uploaded
+    // as compressed blocks this often, instead of a message per sample
+    if (cJSON_HasObjectItem(root, "historySec"))
+    {
+        policy->historyMs = json_int(root, "historySec") * 1000;
+        if (policy->historyMs < 0)
+        {
+            policy->historyMs = 0;
+        }
+    }
+    // aggregateSec is optional, the fields are published as their min, max,
+    // avg and last over windows of aggregateSec instead of a message per
+    // sample. the windows slide by aggregateHopSec, they are tumbling without it
+    if (cJSON_HasObjectItem(root, "aggregateSec"))
+    {
+        int windowMs = json_int(root, "aggregateSec") * 1000;
+        policy->aggregateHopMs = windowMs;
+        if (cJSON_HasObjectItem(root, "aggregateHopSec"))
+        {
+            policy->aggregateHopMs = json_int(root, "aggregateHopSec") * 1000;
+        }
+        if (windowMs <= 0 || policy->aggregateHopMs <= 0 || policy->aggregateHopMs > windowMs)
+        {
+            policy->aggregateHopMs = windowMs > 0 ? windowMs : 0;
+        }
+        else
+        {
+            policy->aggregatePanes = windowMs / policy->aggregateHopMs;
+        }
+        if (policy->aggregatePanes > AGG_MAX_PANES)
+        {
+            policy->aggregatePanes = AGG_MAX_PANES;
+        }
+    }
+    // interval is in seconds, intervalMs (optional) allows sub-second polling
+    policy->interval = json_int(root, "interval") * 1000;
+    if (cJSON_HasObjectItem(root, "intervalMs"))
+    {
+        policy->interval = json_int(root, "intervalMs");
+    }
+    if (policy->interval < MIN_INTERVAL_MS)
+    {
+        policy->interval = MIN_INTERVAL_MS;
+    }
+    // minIntervalMs and maxIntervalMs are optional, either enables adaptive
+    // sampling: the interval starts at interval and moves between them with
+    // the changes of the samples beyond changeThreshold, see adapt_policy_interval
+    if (cJSON_HasObjectItem(root, "minIntervalMs") || cJSON_HasObjectItem(root, "maxIntervalMs"))
+    {
+        policy->minIntervalMs = policy->interval;
+        policy->maxIntervalMs = policy->interval;
+        if (cJSON_HasObjectItem(root, "minIntervalMs"))
+        {
+            policy->minIntervalMs = json_int(root, "minIntervalMs");
+        }
+        if (cJSON_HasObjectItem(root, "maxIntervalMs"))
+        {
+            policy->maxIntervalMs = json_int(root, "maxIntervalMs");
+        }
+        if (policy->minIntervalMs < MIN_INTERVAL_MS)
+        {
+            policy->minIntervalMs = MIN_INTERVAL_MS;
+        }
+        if (policy->minIntervalMs > policy->interval)
+        {
+            policy->minIntervalMs = policy->interval;
+        }
+        if (policy->maxIntervalMs < policy->interval)
+        {
+            policy->maxIntervalMs = policy->interval;
+        }
+        if (cJSON_HasObjectItem(root, "changeThreshold"))
+        {
+            policy->changeThreshold = json_int(root, "changeThreshold");
+        }
+        policy->adaptiveMs = policy->interval;
+    }
+    // delta is optional, the registers are published as the ones changed
+    // since the last sample published, with a full sample every keyframeMs,
+    // see publish_policy_data
+    if (cJSON_HasObjectItem(root, "delta") && (policy->functioncode == 3 || policy->functioncode == 4))
+    {
+        policy->delta = cJSON_IsTrue(cJSON_GetObjectItem(root, "delta")) 
+            || json_int(root, "delta") != 0;
+        if (cJSON_HasObjectItem(root, "keyframeMs"))
+        {
+            policy->keyframeMs = json_int(root, "keyframeMs");
+        }
+        if (policy->keyframeMs < policy->interval)
+        {
+            policy->keyframeMs = policy->interval;
+        }
+        if (policy->length > MODBUS_MAX_READ_REGISTERS)
+        {
+            policy->delta = 0;
+        }
+    }
+    // the envelope rendered with the buffers holds the trantable
+    mystrncpy(policy->trantable, json_string(root, "trantable"), UUID_LEN);
+    alloc_policy_buffers(policy);
+    // priority is optional, while the bus is overloaded the intervals of the
+    // low priorities are stretched first
+    if (cJSON_HasObjectItem(root, "priority"))
+    {
+        policy->priority = json_int(root, "priority");
+        if (policy->priority < 0)
+        {
+            policy->priority = 0;
+        }
+        if (policy->priority > MAX_PRIORITY)
+        {
+            policy->priority = MAX_PRIORITY;
+        }
+    }
+    // scanGroup is optional, the policies of the same gateway and scan group
+    // are read back to back at the interval of the first of them, and published
+    // as one message with one acquisition time
+    if (cJSON_IsString(cJSON_GetObjectItem(root, "scanGroup")))
+    {
+        mystrncpy(policy->scanGroup, json_string(root, "scanGroup"), FIELD_NAME_LEN);
+    }
+    // bitEncoding is optional, "hex" or "base64" publish the coils and the
+    // discrete inputs 8 per byte instead of a byte per bit
+    if (is_bit_function(policy->functioncode) 
+        && cJSON_IsString(cJSON_GetObjectItem(root, "bitEncoding")))
+    {
+        const char* encoding = json_string(root, "bitEncoding");
+        if (strcmp(encoding, "hex") == 0)
+        {
+            policy->bitEncoding = BITS_PACKED_HEX;
+        }
+        else if (strcmp(encoding, "base64") == 0)
+        {
+            policy->bitEncoding = BITS_PACKED_BASE64;
+        }
+    }
+    // fields are optional, the typed values decoded from the registers. the
+    // ones of a template are compiled once for its length
+    cJSON* fields = cJSON_GetObjectItem(root, "fields");
+    if (fields == NULL && tmpl != NULL)
+    {
+        fields = cJSON_GetObjectItem(tmpl->root, "fields");
+    }
+    if (fields != NULL && !is_bit_function(policy->functioncode))
+    {
+        if (tmpl != NULL && fields == cJSON_GetObjectItem(tmpl->root, "fields") 
+            && policy->length == tmpl->length)
+        {
+            policy->fields = tmpl->fields;
+            policy->fieldNum = tmpl->fieldNum;
+        }
+        else
+        {
+            policy->fieldNum = parse_decode_fields(fields, policy->length, &policy->fields);
+        }
+    }
+    if (policy->historyMs > 0 && (policy->fieldNum == 0 
+        || policy->fieldNum > MODBUS_MAX_READ_REGISTERS))
+    {
+        printf("historySec of slaveid=%d needs 1 to %d fields, the samples are published one by one\n",
+            policy->slaveid, MODBUS_MAX_READ_REGISTERS);
+        policy->historyMs = 0;
+    }
+    if (policy->aggregateHopMs > 0 && (policy->fieldNum == 0 
+        || policy->fieldNum > MODBUS_MAX_READ_REGISTERS || policy->historyMs > 0))
+    {
+        printf("aggregateSec of slaveid=%d needs 1 to %d fields and no historySec, the samples are published one by one\n",
+            policy->slaveid, MODBUS_MAX_READ_REGISTERS);
+        policy->aggregateHopMs = 0;
+    }
+    // bacnetBinaryInputs is optional, in the bridge mode bit i of the policy is
+    // served as the Binary Input bacnetBinaryInputs + i
+    if (cJSON_HasObjectItem(root, "bacnetBinaryInputs") && is_bit_function(policy->functioncode))
+    {
+        policy->bacnetBinaryInputs = json_int(root, "bacnetBinaryInputs");
+        if (policy->bacnetBinaryInputs < 0)
+        {
+            policy->bacnetBinaryInputs = -1;
+        }
+    }
+    // serverUnitId and serverMaxAgeMs are optional, the unit id and the age
+    // limit of the data served by the modbus server, see modbus_server.h
+    if (cJSON_HasObjectItem(root, "serverUnitId"))
+    {
+        policy->serverUnitId = json_int(root, "serverUnitId");
+        if (policy->serverUnitId < 0 || policy->serverUnitId > 255)
+        {
+            printf("serverUnitId of slaveid=%d should be 0 to 255, the slaveid is served\n",
+                policy->slaveid);
+            policy->serverUnitId = -1;
+        }
+    }
+    if (cJSON_HasObjectItem(root, "serverMaxAgeMs"))
+    {
+        policy->serverMaxAgeMs = json_int(root, "serverMaxAgeMs");
+    }
+        
+    cJSON* cjch = cJSON_GetObjectItem(root, "pubChannel");
+    Channel ch;
+    mystrncpy(ch.endpoint, json_string(cjch, "endpoint"), MAX_LEN);
+    mystrncpy(ch.topic, json_string(cjch, "topic"), MAX_LEN);
+    mystrncpy(ch.user, json_string(cjch, "user"), MAX_LEN);
+    mystrncpy(ch.password, json_string(cjch, "password"), MAX_LEN);
+    // format is optional, "binary" saves the bandwidth of metered links
+    ch.format = PAYLOAD_JSON;
+    if (cJSON_HasObjectItem(cjch, "format") && strcmp(json_string(cjch, "format"), "binary") == 0)
+    {
+        ch.format = PAYLOAD_BINARY;
+    }
+    // compress is optional, only "zlib" is supported
+    ch.compress = cJSON_HasObjectItem(cjch, "compress") 
+        && strcmp(json_string(cjch, "compress"), "zlib") == 0;
+    policy->pubChannel = intern_channel(&ch);
+    if (policy->pubChannel == NULL)
+    {
+        printf("out of memory while loading the channel of slaveid=%d\n", policy->slaveid);
+    }
+    policy->nextRun = monotonic_ms() + policy->interval;
+
+    if (port != NULL)
+    {
+        policy->baud = port->baud;
+        policy->databits = port->databits;
+        policy->parity = port->parity;
+        policy->stopbits = port->stopbits;
+        policy->turnaroundMs = port->turnaroundMs;
+        policy->responseTimeoutMs = port->responseTimeoutMs;
+        policy->byteTimeoutMs = port->byteTimeoutMs;
+        policy->autoTimeout = port->autoTimeout;
+        policy->rs485 = port->rs485;
+        policy->rtsDelayBeforeMs = port->rtsDelayBeforeMs;
+        policy->rtsDelayAfterMs = port->rtsDelayAfterMs;
+        policy->lowLatency = port->lowLatency;
+        return policy;
+    }
+    if (policy->mode == RTU || policy->mode == ASCII)
+    {
+        policy->baud = json_int(root, "baud");
+        policy->databits = json_int(root, "databits");
         policy->parity = json_string(root, "parity")[0];
         policy->stopbits = json_int(root, "stopbits");
     }
-    return policy;
+    if (policy->mode != TCP && cJSON_HasObjectItem(root, "turnaroundMs"))
+    {
+        policy->turnaroundMs = json_int(root, "turnaroundMs");
+    }
+    if (policy->mode == RTU || policy->mode == ASCII)
+    {
+        load_serial_line(root, &policy->rs485, &policy->rtsDelayBeforeMs, 
+            &policy->rtsDelayAfterMs, &policy->lowLatency);
+    }
+    // the timing of the bus is optional, and taken from the first policy on it
+    if (cJSON_HasObjectItem(root, "responseTimeoutMs"))
+    {
+        policy->responseTimeoutMs = json_int(root, "responseTimeoutMs");
+    }
+    if (cJSON_HasObjectItem(root, "byteTimeoutMs"))
+    {
+        policy->byteTimeoutMs = json_int(root, "byteTimeoutMs");
+    }
+    if (cJSON_HasObjectItem(root, "autoTimeout"))
+    {
+        policy->autoTimeout = cJSON_IsTrue(cJSON_GetObjectItem(root, "autoTimeout")) 
+            || json_int(root, "autoTimeout") != 0;
+    }
+    return policy;
+}
+
+// the key of a policy which may be an instance of a template, see json_to_policy_key
+void json_to_instance_key(cJSON* root, SlavePolicy* policy)
+{
+    PolicyTemplate* tmpl = NULL;
+    cJSON* expanded = NULL;
+    if (cJSON_IsString(cJSON_GetObjectItem(root, "template")))
+    {
+        tmpl = take_policy_template(json_string(root, "template"));
+        expanded = tmpl != NULL ? expand_policy_template(root, tmpl) : NULL;
+    }
+    json_to_policy_key(expanded != NULL ? expanded : root, policy);
+    cJSON_Delete(expanded);
+    release_policy_template(tmpl);
+}
+
+SlavePolicy* json_to_slave_poilicy(cJSON* root)
+{
+    // an instance of a template only has what tells it apart, e.g. the slaveid
+    // and the bus, and keeps its own json only as the config
+    PolicyTemplate* tmpl = NULL;
+    cJSON* expanded = NULL;
+    if (cJSON_IsString(cJSON_GetObjectItem(root, "template")))
+    {
+        tmpl = take_policy_template(json_string(root, "template"));
+        expanded = tmpl != NULL ? expand_policy_template(root, tmpl) : NULL;
+        if (expanded == NULL)
+        {
+            printf("unknown policy template %s of slaveid=%d\n", 
+                json_string(root, "template"), json_int(root, "slaveid"));
+            release_policy_template(tmpl);
+            tmpl = NULL;
+        }
+    }
+    SlavePolicy* policy = compile_slave_policy(expanded != NULL ? expanded : root, tmpl);
+    policy->config = cJSON_PrintUnformatted(root);
+    cJSON_Delete(expanded);
+    return policy;
+}
+
+void cleanup_data()
+{
+    int i = 0;
+    for (i = 0; i < g_worker_num; i++)
+    {
+        sched_clear(&g_workers[i].schedule);
+    }
+
+    SlavePolicy* sp = g_slave_header.next;
+    g_slave_header.next = NULL;
+    SlavePolicy* next_policy = NULL;
+    while (sp != NULL)
+    {
+        next_policy = sp->next;
+        destroy_slave_policy(sp);
+        sp = next_policy;
+    }
+    cleanup_policy_templates();
+    cleanup_shared_data();
+}
+
+// policies on the same bus(serial port or tcp endpoint) must be polled by
+// the same worker, so that a bus is never accessed concurrently.
+// a new bus goes to the worker with the least buses, so that the uarts of
+// a multi-port gateway are polled in parallel instead of sharing a worker
+// by chance of the hash. the map only grows, so a bus never moves to another
+// worker across the reloads, it falls back to the hash once full
+// the bus also keeps the overload state, which is only changed by its worker
+typedef struct
+{
+    char addr[ADDR_LEN];
+    int worker;
+    long long windowStart;          // monotonic time(ms) the current overload window started
+    int runs;                       // policies run in the current window
+    int misses;                     // of which started by more than half an interval late
+    int missPercent;                // of the last window
+    int cleanWindows;               // windows in a row without a miss
+    int shedLevel;                  // 0 if not overloaded, see shed_factor
+} BusWorker;
+
+BusWorker g_bus_workers[MAX_MODBUS_CONN];
+int g_bus_worker_num = 0;
+pthread_mutex_t g_bus_worker_lock = PTHREAD_MUTEX_INITIALIZER;
+int g_shedding_changed = 0;
+
+// index of the bus in the map, the bus is added if new. -1 if the map is full
+int find_bus(const char* ip_com_addr)
+{
+    int i = 0;
+    int bus = -1;
+    pthread_mutex_lock(&g_bus_worker_lock);
+    for (i = 0; i < g_bus_worker_num; i++)
+    {
+        if (strcmp(g_bus_workers[i].addr, ip_com_addr) == 0)
+        {
+            bus = i;
+            break;
+        }
+    }
+    if (bus < 0 && g_bus_worker_num < MAX_MODBUS_CONN)
+    {
+        int buses[MAX_WORKER] = {0};
+        for (i = 0; i < g_bus_worker_num; i++)
+        {
+            buses[g_bus_workers[i].worker]++;
+        }
+        int worker = 0;
+        for (i = 1; i < g_worker_num; i++)
+        {
+            if (buses[i] < buses[worker])
+            {
+                worker = i;
+            }
+        }
+        bus = g_bus_worker_num;
+        memset(&g_bus_workers[bus], 0, sizeof(BusWorker));
+        mystrncpy(g_bus_workers[bus].addr, ip_com_addr, ADDR_LEN);
+        g_bus_workers[bus].worker = worker;
+        g_bus_worker_num++;
+    }
+    pthread_mutex_unlock(&g_bus_worker_lock);
+    return bus;
+}
+
+int worker_of_bus(const char* ip_com_addr)
+{
+    int bus = find_bus(ip_com_addr);
+    if (bus < 0)
+    {
+        return (int)(hash_string(ip_com_addr) % (unsigned int)g_worker_num);
+    }
+    return g_bus_workers[bus].worker;
+}
+
+int pick_worker(SlavePolicy* policy)
+{
+    policy->bus = find_bus(policy->ip_com_addr);
+    return worker_of_bus(policy->ip_com_addr);
+}
+
+// the shed level of the bus of the policy, or of its channel if higher: a
+// channel backing up sheds the same way as a bus
+int shed_level(SlavePolicy* policy)
+{
+    int level = policy->bus >= 0 ? g_bus_workers[policy->bus].shedLevel : 0;
+    if (policy->mqttClient >= 0 && g_batches[policy->mqttClient]->pressureLevel > level)
+    {
+        level = g_batches[policy->mqttClient]->pressureLevel;
+    }
+    return level;
+}
+
+// the interval the policy is polled at before it's shed, the adaptive one if any
+int policy_interval(SlavePolicy* policy)
+{
+    return policy->adaptiveMs > 0 ? policy->adaptiveMs : policy->interval;
+}
+
+// how many times the interval of the policy is stretched at the shed level
+// of its bus. every level stretches the lowest priority once more and starts
+// on the next priority, so the intervals degrade one priority at a time, and
+// the critical policies (priority 0) keep their rate
+int shed_factor(SlavePolicy* policy)
+{
+    if (policy->bus < 0 || policy->priority <= 0)
+    {
+        return 1;
+    }
+    int level = shed_level(policy);
+    int steps = level - (MAX_PRIORITY - policy->priority);
+    if (steps <= 0)
+    {
+        return 1;
+    }
+    if (steps > MAX_SHED_STEPS)
+    {
+        steps = MAX_SHED_STEPS;
+    }
+    return 1 << steps;
+}
+
+// count the run of a due policy against the overload window of its bus, and
+// shed or restore one level at the end of every window. only the worker of
+// the bus calls this, so no lock is needed
+void note_policy_deadline(SlavePolicy* policy, long long now)
+{
+    if (policy->bus < 0)
+    {
+        return;
+    }
+    BusWorker* bus = &g_bus_workers[policy->bus];
+    if (bus->windowStart == 0)
+    {
+        bus->windowStart = now;
+    }
+    bus->runs++;
+    if (now - policy->nextRun > (long long)policy_interval(policy) * policy->shedFactor / 2)
+    {
+        bus->misses++;
+    }
+    if (now - bus->windowStart < OVERLOAD_WINDOW_MS)
+    {
+        return;
+    }
+
+    bus->missPercent = bus->misses * 100 / bus->runs;
+    int level = bus->shedLevel;
+    if (bus->missPercent > OVERLOAD_MISS_PERCENT)
+    {
+        bus->cleanWindows = 0;
+        if (level < MAX_PRIORITY - 1 + MAX_SHED_STEPS)
+        {
+            level++;
+        }
+    }
+    else if (bus->misses == 0 && ++bus->cleanWindows >= OVERLOAD_RECOVER_WINDOWS && level > 0)
+    {
+        bus->cleanWindows = 0;
+        level--;
+    }
+    else if (bus->misses > 0)
+    {
+        bus->cleanWindows = 0;
+    }
+    if (level != bus->shedLevel)
+    {
+        printf("bus %s missed %d%% of the deadlines, shed level %d -> %d\n",
+            bus->addr, bus->missPercent, bus->shedLevel, level);
+        bus->shedLevel = level;
+        g_shedding_changed = 1;
+        wake_supervisor();
+    }
+    bus->windowStart = now;
+    bus->runs = 0;
+    bus->misses = 0;
+}
+
+pthread_mutex_t g_pressure_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// with pubBackpressure, a channel whose queue fills up sheds its policies as an
+// overloaded bus does: a level every PUB_PRESSURE_STEP_MS while more than
+// PUB_HIGH_WATERMARK_PERCENT of the queue is pending, and one restored while
+// less than PUB_LOW_WATERMARK_PERCENT is. so the critical samples keep their
+// rate instead of being dropped from the queue along with the rest.
+// called by the workers after publishing, and by the supervisor for the
+// channels which don't publish any more
+void note_publish_pressure(int pos)
+{
+    if (!g_gateway_conf.pubBackpressure || g_gateway_conf.mqttQueueSize <= 0
+        || g_shared_mqtt_client[pos] == NULL)
+    {
+        return;
+    }
+    int percent = amqtt_pending(g_shared_mqtt_client[pos]) * 100 / g_gateway_conf.mqttQueueSize;
+    PubBatch* batch = g_batches[pos];
+    long long now = monotonic_ms();
+    pthread_mutex_lock(&g_pressure_lock);
+    int level = batch->pressureLevel;
+    if (now - batch->pressureChanged >= PUB_PRESSURE_STEP_MS)
+    {
+        if (percent > PUB_HIGH_WATERMARK_PERCENT && level < MAX_PRIORITY - 1 + MAX_SHED_STEPS)
+        {
+            level++;
+        }
+        else if (percent < PUB_LOW_WATERMARK_PERCENT && level > 0)
+        {
+            level--;
+        }
+    }
+    int changed = level != batch->pressureLevel;
+    if (changed)
+    {
+        printf("channel %s has %d%% of its queue pending, shed level %d -> %d\n",
+            g_shared_channel[pos]->topic, percent, batch->pressureLevel, level);
+        batch->pressureLevel = level;
+        batch->pressureChanged = now;
+    }
+    pthread_mutex_unlock(&g_pressure_lock);
+    if (changed)
+    {
+        g_shedding_changed = 1;
+        wake_supervisor();
+    }
+}
+
+// the overload state of every bus, as a json array
+cJSON* shedding_status()
+{
+    cJSON* arr = cJSON_CreateArray();
+    int i = 0;
+    pthread_mutex_lock(&g_bus_worker_lock);
+    for (i = 0; i < g_bus_worker_num; i++)
+    {
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "bus", g_bus_workers[i].addr);
+        cJSON_AddNumberToObject(item, "shedLevel", g_bus_workers[i].shedLevel);
+        cJSON_AddNumberToObject(item, "missPercent", g_bus_workers[i].missPercent);
+        cJSON_AddItemToArray(arr, item);
+    }
+    pthread_mutex_unlock(&g_bus_worker_lock);
+    return arr;
+}
+
+int is_bus_of_worker(const char* ip_com_addr, void* arg)
+{
+    return worker_of_bus(ip_com_addr) == ((PollWorker*) arg)->id;
+}
+
+void schedule_slave_policy(PollWorker* worker, SlavePolicy* policy)
+{
+    // (re)schedule the policy in the schedule of its worker, ordered by the nextRun asc
+    // so that the top of the schedule is always the next slave need to execute
+    // note, this function could be involked in a different thread, make sure 
+    // add lock before modifying the schedule
+
+    if (policy == NULL)
+    {
+        return;
+    }
+
+    // we already have the lock here.
+    if (sched_push(&worker->schedule, policy->nextRun, policy) != 0)
+    {
+        printf("out of memory while scheduling policy of slaveid=%d\n", policy->slaveid);
+    }
+}
+
+// the policies of the same tenant, slave, bus and register range are the
+// same policy, the rest of the config may be changed by the reload
+int same_policy(SlavePolicy* a, SlavePolicy* b)
+{
+    return a->tenant == b->tenant
+        && strcmp(a->gatewayid, b->gatewayid) == 0
+        && a->slaveid == b->slaveid
+        && a->mode == b->mode
+        && strcmp(a->ip_com_addr, b->ip_com_addr) == 0
+        && a->functioncode == b->functioncode
+        && a->start_addr == b->start_addr
+        && a->length == b->length;
+}
+
+// the policy same as the given one in the list, NULL if not found
+SlavePolicy* find_same_policy(SlavePolicy* list, SlavePolicy* policy)
+{
+    for (; list != NULL; list = list->next)
+    {
+        if (same_policy(list, policy))
+        {
+            return list;
+        }
+    }
+    return NULL;
+}
+
+// take the policy same as the given one out of the list, NULL if not found
+SlavePolicy* take_same_policy(SlavePolicy** list, SlavePolicy* policy)
+{
+    SlavePolicy** link = list;
+    while (*link != NULL)
+    {
+        SlavePolicy* sp = *link;
+        if (same_policy(sp, policy))
+        {
+            *link = sp->next;
+            sp->next = NULL;
+            return sp;
+        }
+        link = &sp->next;
+    }
+    return NULL;
+}
+
+static int compare_policy_phase(const void* a, const void* b)
+{
+    const SlavePolicy* pa = *(const SlavePolicy* const*) a;
+    const SlavePolicy* pb = *(const SlavePolicy* const*) b;
+    int rc = strcmp(pa->ip_com_addr, pb->ip_com_addr);
+    if (rc != 0)
+    {
+        return rc;
+    }
+    if (pa->interval != pb->interval)
+    {
+        return pa->interval < pb->interval ? -1 : 1;
+    }
+    return pa->slaveid - pb->slaveid;
+}
+
+// spread the first polls of the policies of the same bus and interval evenly
+// over the interval, each group from its own hashed offset. otherwise the
+// policies loaded together are all due in the same tick, and stay so, which
+// bursts the bus and the broker and then leaves them idle. the policies that
+// keep the schedule of the ones they replace are not moved
+void stagger_slave_policies(SlavePolicy** policies, int num, long long now)
+{
+    SlavePolicy** sorted = (SlavePolicy**) malloc(num * sizeof(SlavePolicy*));
+    if (sorted == NULL)
+    {
+        return;
+    }
+    memcpy(sorted, policies, num * sizeof(SlavePolicy*));
+    qsort(sorted, num, sizeof(SlavePolicy*), compare_policy_phase);
+    int start = 0;
+    while (start < num)
+    {
+        int end = start + 1;
+        while (end < num && sorted[end]->interval == sorted[start]->interval
+            && strcmp(sorted[end]->ip_com_addr, sorted[start]->ip_com_addr) == 0)
+        {
+            end++;
+        }
+        unsigned int group = hash_string(sorted[start]->ip_com_addr) * 31 + (unsigned int)sorted[start]->interval;
+        int k = 0;
+        for (k = 0; k < end - start; k++)
+        {
+            sorted[start + k]->nextRun = sched_phase(now, sorted[start + k]->interval, group, k, end - start);
+        }
+        start = end;
+    }
+    free(sorted);
+}
+
+// the modified policy keeps the pace and the report by exception state of
+// the one it replaces, as long as they still apply
+void inherit_policy_state(SlavePolicy* policy, SlavePolicy* old)
+{
+    if (policy->interval == old->interval)
+    {
+        policy->nextRun = old->nextRun;
+        policy->shedFactor = old->shedFactor;
+    }
+    if (policy->onChange && old->onChange)
+    {
+        strcpy(policy->lastPayload, old->lastPayload);
+    }
+    // the receivers hold the image of the old one, the deltas go on against it
+    if (policy->delta && old->delta && policy->length == old->length)
+    {
+        memcpy(policy->deltaImage, old->deltaImage, policy->length * sizeof(uint16_t));
+        policy->deltaSeq = old->deltaSeq;
+        policy->lastKeyframe = old->lastKeyframe;
+    }
+    if (policy->adaptiveMs > 0 && old->adaptiveMs > 0 && policy->interval == old->interval
+        && policy->minIntervalMs == old->minIntervalMs && policy->maxIntervalMs == old->maxIntervalMs)
+    {
+        policy->adaptiveMs = old->adaptiveMs;
+        strcpy(policy->prevPayload, old->prevPayload);
+    }
+    policy->lastPublish = old->lastPublish;
+    policy->polls = old->polls;
+    policy->pollErrors = old->pollErrors;
+    policy->exceptions = old->exceptions;
+}
+
+// the policy is read and published as a part of a scan group
+int in_scan_group(SlavePolicy* policy)
+{
+    return policy->scanLeader != NULL || policy->scanNext != NULL;
+}
+
+// link the policies of every scan group to the first of them, which is the
+// only one scheduled, the rest are read along with it by its worker. a group
+// has up to MAX_POLL_BATCH policies, to be read in one batch. must be called
+// on reload with all the workers locked
+void link_scan_groups(SlavePolicy* list)
+{
+    int num = 0;
+    SlavePolicy* p = NULL;
+    for (p = list; p != NULL; p = p->next)
+    {
+        if (p->scanLeader != NULL)
+        {
+            // it was read along with its group, scheduled again unless it still is
+            p->scanLeader = NULL;
+            schedule_slave_policy(&g_workers[p->worker], p);
+        }
+        p->scanNext = NULL;
+        num += p->scanGroup[0] != 0;
+    }
+    // the first and the last policy of every group, and its size
+    SlavePolicy** leaders = (SlavePolicy**) malloc(num * 2 * sizeof(SlavePolicy*) + 1);
+    int* sizes = (int*) malloc(num * sizeof(int) + 1);
+    if (leaders == NULL || sizes == NULL)
+    {
+        printf("out of memory while linking the scan groups\n");
+        free(leaders);
+        free(sizes);
+        return;
+    }
+    int groups = 0;
+    for (p = list; p != NULL; p = p->next)
+    {
+        if (p->scanGroup[0] == 0)
+        {
+            continue;
+        }
+        int g = 0;
+        while (g < groups && (strcmp(leaders[2 * g]->scanGroup, p->scanGroup) != 0
+            || strcmp(leaders[2 * g]->gatewayid, p->gatewayid) != 0))
+        {
+            g++;
+        }
+        if (g == groups)
+        {
+            leaders[2 * g] = p;
+            leaders[2 * g + 1] = p;
+            sizes[g] = 1;
+            groups++;
+        }
+        else if (sizes[g] < MAX_POLL_BATCH)
+        {
+            sched_remove(&g_workers[p->worker].schedule, p);
+            p->scanLeader = leaders[2 * g];
+            leaders[2 * g + 1]->scanNext = p;
+            leaders[2 * g + 1] = p;
+            sizes[g]++;
+        }
+        else
+        {
+            printf("scan group %s has more than %d policies, slaveid=%d is read alone\n",
+                p->scanGroup, MAX_POLL_BATCH, p->slaveid);
+        }
+    }
+    free(leaders);
+    free(sizes);
+}
+
+// destroy the mqtt clients which no policy publishes to any more, 
+// their pending samples go out first
+void release_unused_mqtt_clients()
+{
+    if (g_channel_num == 0)
+    {
+        return;
+    }
+    char* used = (char*) calloc(g_channel_num, 1);
+    if (used == NULL)
+    {
+        return;
+    }
+    SlavePolicy* sp = NULL;
+    for (sp = g_slave_header.next; sp != NULL; sp = sp->next)
+    {
+        if (sp->mqttClient >= 0)
+        {
+            used[sp->mqttClient] = 1;
+        }
+    }
+    int i = 0;
+    for (i = 0; i < g_channel_num; i++)
+    {
+        if (used[i] || g_shared_channel[i] == NULL)
+        {
+            continue;
+        }
+        pthread_mutex_lock(&g_batches[i]->lock);
+        flush_batch(i);
+        pthread_mutex_unlock(&g_batches[i]->lock);
+        release_channel_client(i, 5000);
+        remove_shared_channel(i);
+    }
+    free(used);
+}
+
+// the policies of the snapshot, the runtime state is reset as if they were
+// parsed from the json. return the number of policies, -1 if the snapshot
+// is missing or stale
+int load_policy_snapshot(const PolicySnapshotKey* key, SlavePolicy*** policies, 
+    long long* version)
+{
+    PolicySnapshot snap;
+    if (snapshot_open(POLICY_SNAPSHOT, key, &snap) != 0)
+    {
+        return -1;
+    }
+    SlavePolicy** result = (SlavePolicy**) malloc((snap.count + 1) * sizeof(SlavePolicy*));
+    int num = 0;
+    while (result != NULL && num < snap.count)
+    {
+        SlavePolicy* policy = new_slave_policy();
+        SlavePolicy runtime = *policy;
+        Channel channel;
+        if (snapshot_policy(&snap, num, policy, &channel) != 0)
+        {
+            free(policy);
+            break;
+        }
+        policy->pubChannel = intern_channel(&channel);
+        policy->mqttClient = runtime.mqttClient;
+        policy->worker = runtime.worker;
+        policy->bus = runtime.bus;
+        policy->shedFactor = runtime.shedFactor;
+        policy->lastPublish = runtime.lastPublish;
+        policy->polls = runtime.polls;
+        policy->pollErrors = runtime.pollErrors;
+        policy->exceptions = runtime.exceptions;
+        policy->lastError = runtime.lastError;
+        policy->errorStreak = runtime.errorStreak;
+        policy->scanLeader = runtime.scanLeader;
+        policy->scanNext = runtime.scanNext;
+        policy->nextRun = monotonic_ms() + policy->interval;
+        if (policy->adaptiveMs > 0)
+        {
+            policy->adaptiveMs = policy->interval;
+        }
+        alloc_policy_buffers(policy);
+        result[num++] = policy;
+    }
+    int count = snap.count;
+    *version = snap.configVersion;
+    snapshot_close(&snap);
+    if (result == NULL || num < count)
+    {
+        printf("out of memory while loading the policy snapshot\n");
+        while (num > 0)
+        {
+            destroy_slave_policy(result[--num]);
+        }
+        free(result);
+        return -1;
+    }
+    *policies = result;
+    return num;
+}
+
+// the policy is of the tenant, and polled no faster than the tenant may
+void assign_tenant(SlavePolicy* policy, int tenant)
+{
+    policy->tenant = tenant;
+    int floor = g_gateway_conf.tenants[tenant].minIntervalMs;
+    if (policy->interval < floor)
+    {
+        policy->interval = floor;
+        if (policy->adaptiveMs > 0)
+        {
+            policy->adaptiveMs = floor;
+        }
+    }
+    if (policy->minIntervalMs > 0 && policy->minIntervalMs < floor)
+    {
+        policy->minIntervalMs = floor;
+    }
+    if (policy->maxIntervalMs > 0 && policy->maxIntervalMs < floor)
+    {
+        policy->maxIntervalMs = floor;
+    }
+}
+
+// the policies of a parsed config of the tenant, return the number of policies
+int policies_from_json(cJSON* root, SlavePolicy*** policies, int tenant)
+{
+    int num = cJSON_GetArraySize(root);
+    SlavePolicy** result = (SlavePolicy**) malloc((num + 1) * sizeof(SlavePolicy*));
+    int i = 0;
+    for (i = 0; i < num; i++)
+    {
+        result[i] = json_to_slave_poilicy(cJSON_GetArrayItem(root, i));
+        assign_tenant(result[i], tenant);
+    }
+    *policies = result;
+    return num;
+}
+
+// a full config is the policy array, or {"version": n, "policies": [...]}.
+// return the policy array, NULL if it's not a full config
+cJSON* config_policies(cJSON* root)
+{
+    if (cJSON_IsArray(root))
+    {
+        return root;
+    }
+    cJSON* policies = cJSON_GetObjectItem(root, "policies");
+    return cJSON_IsObject(root) && cJSON_IsArray(policies) ? policies : NULL;
+}
+
+// the version of a config, 0 if it has none
+long long config_version(cJSON* root)
+{
+    cJSON* version = cJSON_IsObject(root) ? cJSON_GetObjectItem(root, "version") : NULL;
+    return cJSON_IsNumber(version) ? (long long) version->valuedouble : 0;
+}
+
+// a delta config changes the policies of baseVersion into the ones of version:
+// {"version": n, "baseVersion": m, "add": [...], "update": [...], "remove": [...]}.
+// the policies are told apart as in the reloading, a removed one only needs
+// the fields of same_policy
+int is_delta_config(cJSON* root)
+{
+    const char* items[3] = {"add", "update", "remove"};
+    if (!cJSON_IsObject(root) || !cJSON_IsNumber(cJSON_GetObjectItem(root, "version"))
+        || !cJSON_IsNumber(cJSON_GetObjectItem(root, "baseVersion")))
+    {
+        return 0;
+    }
+    int i = 0;
+    for (i = 0; i < 3; i++)
+    {
+        cJSON* item = cJSON_GetObjectItem(root, items[i]);
+        if (item != NULL && !cJSON_IsArray(item))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// the templates are of the gateway itself, the other tenants may only use them.
+// templates is the member of the config, NULL if it has none
+void load_tenant_template_list(cJSON* templates, int tenant)
+{
+    if (tenant == 0)
+    {
+        load_policy_templates(templates);
+    }
+    else if (templates != NULL)
+    {
+        printf("the templates of %s are ignored, only the gateway has templates\n", 
+            tenant_name(tenant));
+    }
+}
+
+// the same, of the config
+void load_tenant_templates(cJSON* root, int tenant)
+{
+    cJSON* templates = cJSON_IsObject(root) ? cJSON_GetObjectItem(root, "templates") : NULL;
+    load_tenant_template_list(templates, tenant);
+}
+
+// the policies streamed out of a policy cache, see read_policy_cache
+typedef struct
+{
+    SlavePolicy** policies;
+    int num;
+    int cap;
+    long long version;
+    int tenant;
+    int templates;                  // the templates of the cache are loaded
+} PolicyCacheReader;
+
+int policy_cache_member(void* ctx, const char* key, cJSON* value)
+{
+    PolicyCacheReader* reader = (PolicyCacheReader*) ctx;
+    if (strcmp(key, "version") == 0 && cJSON_IsNumber(value))
+    {
+        reader->version = (long long) value->valuedouble;
+    }
+    else if (strcmp(key, "templates") == 0 && !reader->templates)
+    {
+        load_tenant_template_list(value, reader->tenant);
+        reader->templates = 1;
+    }
+    return 0;
+}
+
+int policy_cache_element(void* ctx, cJSON* element)
+{
+    PolicyCacheReader* reader = (PolicyCacheReader*) ctx;
+    if (!reader->templates)
+    {
+        load_tenant_template_list(NULL, reader->tenant);
+        reader->templates = 1;
+    }
+    if (reader->num == reader->cap)
+    {
+        int cap = reader->cap > 0 ? reader->cap * 2 : 64;
+        SlavePolicy** policies = (SlavePolicy**) realloc(reader->policies, 
+            (cap + 1) * sizeof(SlavePolicy*));
+        if (policies == NULL)
+        {
+            return -1;
+        }
+        reader->policies = policies;
+        reader->cap = cap;
+    }
+    SlavePolicy* policy = json_to_slave_poilicy(element);
+    assign_tenant(policy, reader->tenant);
+    reader->policies[reader->num++] = policy;
+    return 0;
+}
+
+// parse the json policy cache of the tenant from fp, return the number of
+// policies, -1 if it's invalid. the policies are built as the file is read,
+// one json policy at a time, so a large cache never has its whole text or
+// tree in memory, see json_reader.h
+int read_policy_cache(FILE* fp, SlavePolicy*** policies, long long* version, int tenant)
+{
+    PolicyCacheReader reader;
+    memset(&reader, 0, sizeof(PolicyCacheReader));
+    reader.tenant = tenant;
+    int num = jr_read(fp, "policies", policy_cache_member, policy_cache_element, &reader);
+    if (num < 0 || (reader.policies == NULL 
+        && (reader.policies = (SlavePolicy**) malloc(sizeof(SlavePolicy*))) == NULL))
+    {
+        int i = 0;
+        for (i = 0; i < reader.num; i++)
+        {
+            destroy_slave_policy(reader.policies[i]);
+        }
+        free(reader.policies);
+        return -1;
+    }
+    if (!reader.templates)
+    {
+        load_tenant_template_list(NULL, tenant);
+    }
+    *policies = reader.policies;
+    *version = reader.version;
+    return reader.num;
+}
+
+// the weight of a member for a bus, the bus goes to the heaviest member
+unsigned int shard_weight(const char* member, const char* bus)
+{
+    char buff[MAX_LEN];
+    snprintf(buff, MAX_LEN, "%s|%s", member, bus);
+    // the string hash alone is too regular to be compared across members
+    unsigned int h = hash_string(buff);
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+// whether this gateway polls the policy, it polls all of them unless sharded.
+// a serial port declared in gwconfig is wired to this gateway, the policies on
+// it are its own. the other buses go to the member of the highest weight, i.e.
+// rendezvous hashing, so a member joining or leaving only moves the buses it
+// takes over or leaves behind
+int owns_policy(SlavePolicy* policy)
+{
+    if (strlen(g_gateway_conf.shardTopic) == 0
+        || (strlen(policy->port) > 0 && find_serial_port(policy->port) != NULL))
+    {
+        return 1;
+    }
+    pthread_mutex_lock(&g_shard_lock);
+    const char* owner = g_gateway_conf.instanceId;
+    unsigned int best = shard_weight(owner, policy->ip_com_addr);
+    int i = 0;
+    for (i = 0; i < g_shard_member_num; i++)
+    {
+        unsigned int weight = shard_weight(g_shard_members[i], policy->ip_com_addr);
+        if (weight > best || (weight == best && strcmp(g_shard_members[i], owner) < 0))
+        {
+            best = weight;
+            owner = g_shard_members[i];
+        }
+    }
+    int own = strcmp(owner, g_gateway_conf.instanceId) == 0;
+    pthread_mutex_unlock(&g_shard_lock);
+    return own;
+}
+
+// the parked policies of the tenant, of all of them if it's -1
+void release_parked_policies(int tenant)
+{
+    SlavePolicy** link = &g_parked_policies;
+    while (*link != NULL)
+    {
+        SlavePolicy* sp = *link;
+        if (tenant >= 0 && sp->tenant != tenant)
+        {
+            link = &sp->next;
+            continue;
+        }
+        *link = sp->next;
+        destroy_slave_policy(sp);
+    }
+}
+
+// the policies of the tenant loaded, scheduled or parked
+int tenant_policy_num(int tenant)
+{
+    SlavePolicy* lists[2] = {g_slave_header.next, g_parked_policies};
+    int num = 0;
+    int l = 0;
+    for (l = 0; l < 2; l++)
+    {
+        SlavePolicy* sp = NULL;
+        for (sp = lists[l]; sp != NULL; sp = sp->next)
+        {
+            num += sp->tenant == tenant;
+        }
+    }
+    return num;
+}
+
+// the policy of the same slave, bus and range loaded, scheduled or parked
+SlavePolicy* find_loaded_policy(SlavePolicy* policy)
+{
+    SlavePolicy* found = find_same_policy(g_slave_header.next, policy);
+    return found != NULL ? found : find_same_policy(g_parked_policies, policy);
+}
+
+// put the policy in place of the old one of the same slave, bus and range,
+// old is NULL for a new policy. return the one to be listed, that's the old
+// one if the config is unchanged, the new one is destroyed then
+SlavePolicy* install_policy(SlavePolicy* policy, SlavePolicy* old)
+{
+    if (old != NULL && policy->config != NULL && old->config != NULL
+        && strcmp(policy->config, old->config) == 0 && policy->tmpl == old->tmpl)
+    {
+        destroy_slave_policy(policy);
+        if (old->mqttClient == -1)
+        {
+            init_mqtt_client_for_policy(old);
+        }
+        return old;
+    }
+    if (old != NULL)
+    {
+        inherit_policy_state(policy, old);
+        sched_remove(&g_workers[old->worker].schedule, old);
+        destroy_slave_policy(old);
+    }
+    init_mqtt_client_for_policy(policy);
+    policy->worker = pick_worker(policy);
+    schedule_slave_policy(&g_workers[policy->worker], policy);
+    return policy;
+}
+
+// the bus groups, the mqtt clients, the modbus connections and the servers
+// follow the policy list once it's changed
+void relink_policies()
+{
+    link_scan_groups(g_slave_header.next);
+    release_unused_mqtt_clients();
+    release_unused_modbus_conns();
+    bacnet_bridge_load(g_slave_header.next);
+    modbus_server_load(g_slave_header.next);
+    layout_shared_points(g_slave_header.next);
+    layout_shadow_points(g_slave_header.next);
+}
+
+// swap in the policies of the tenant, -1 for the policies of all of them.
+// the array is freed
+void apply_slave_policies(SlavePolicy** policies, int num, int tenant)
+{
+    if (g_gateway_conf.staggerPolls)
+    {
+        stagger_slave_policies(policies, num, monotonic_ms());
+    }
+
+    lock_all_workers();
+    pthread_mutex_lock(&g_policy_list_lock);
+
+    // compare the new policies with the loaded ones, only the added, modified
+    // and removed ones are touched. the unchanged policies keep their schedule,
+    // and the mqtt clients and modbus connections still in use are kept. the
+    // policies of the other tenants stay as they are
+    SlavePolicy* old_list = NULL;
+    SlavePolicy** link = &g_slave_header.next;
+    mark_modbus_conns_unused();
+    while (*link != NULL)
+    {
+        SlavePolicy* sp = *link;
+        if (tenant >= 0 && sp->tenant != tenant)
+        {
+            init_modbus_context(sp);
+            link = &sp->next;
+            continue;
+        }
+        *link = sp->next;
+        sp->next = old_list;
+        old_list = sp;
+    }
+    // the ones of the other members are parked, an owned one parked now is
+    // left in the old list and removed
+    release_parked_policies(tenant);
+    int added = 0;
+    int modified = 0;
+    int unchanged = 0;
+    int removed = 0;
+    int parked = 0;
+    int i = 0;
+    for(i = 0; i < num; i++)
+    {
+        if (!owns_policy(policies[i]))
+        {
+            policies[i]->next = g_parked_policies;
+            g_parked_policies = policies[i];
+            parked++;
+            continue;
+        }
+        SlavePolicy* old = take_same_policy(&old_list, policies[i]);
+        SlavePolicy* policy = install_policy(policies[i], old);
+        if (old == NULL)
+        {
+            added++;
+        }
+        else if (policy == old)
+        {
+            unchanged++;
+        }
+        else
+        {
+            modified++;
+        }
+        init_modbus_context(policy);
+
+        // add the policy into list
+        policy->next = g_slave_header.next;
+        g_slave_header.next = policy;
+    }
+    while (old_list != NULL)
+    {
+        SlavePolicy* old = old_list;
+        old_list = old->next;
+        sched_remove(&g_workers[old->worker].schedule, old);
+        destroy_slave_policy(old);
+        removed++;
+    }
+    relink_policies();
+    pthread_mutex_unlock(&g_policy_list_lock);
+    unlock_all_workers();
+    printf("policies %s reloaded, %d added, %d modified, %d removed, %d unchanged, %d parked\n",
+        tenant >= 0 ? tenant_name(tenant) : "of every tenant", added, modified, removed, 
+        unchanged, parked);
+    wake_all_workers();
+
+    free(policies);
+}
+
+// apply the policies added, updated and removed by a delta of the tenant in
+// place, the rest of the policies are not touched. return -1 if the delta
+// doesn't fit the policies loaded or the quota of the tenant, nothing is
+// changed then
+int apply_policy_delta(cJSON* delta, int tenant)
+{
+    cJSON* adds = cJSON_GetObjectItem(delta, "add");
+    cJSON* updates = cJSON_GetObjectItem(delta, "update");
+    cJSON* removes = cJSON_GetObjectItem(delta, "remove");
+    int add_num = cJSON_GetArraySize(adds);
+    int num = add_num + cJSON_GetArraySize(updates);
+    int remove_num = cJSON_GetArraySize(removes);
+    int max = g_gateway_conf.tenants[tenant].maxPolicies;
+    if (max > 0 && tenant_policy_num(tenant) + add_num - remove_num > max)
+    {
+        printf("policy delta of %s goes over its maxPolicies %d\n", tenant_name(tenant), max);
+        g_tenants[tenant].refused = 1;
+        return -1;
+    }
+    // the templates added come first, the instances added may be of them
+    if (tenant == 0 && add_policy_templates(cJSON_GetObjectItem(delta, "templates")) != 0)
+    {
+        return -1;
+    }
+    if (tenant != 0 && cJSON_GetObjectItem(delta, "templates") != NULL)
+    {
+        printf("the templates of %s are ignored, only the gateway has templates\n", 
+            tenant_name(tenant));
+    }
+    SlavePolicy** policies = (SlavePolicy**) malloc((num + 1) * sizeof(SlavePolicy*));
+    SlavePolicy* keys = (SlavePolicy*) calloc(remove_num + 1, sizeof(SlavePolicy));
+    if (policies == NULL || keys == NULL)
+    {
+        free(policies);
+        free(keys);
+        return -1;
+    }
+    int i = 0;
+    for (i = 0; i < num; i++)
+    {
+        policies[i] = json_to_slave_poilicy(i < add_num 
+            ? cJSON_GetArrayItem(adds, i) : cJSON_GetArrayItem(updates, i - add_num));
+        assign_tenant(policies[i], tenant);
+    }
+    for (i = 0; i < remove_num; i++)
+    {
+        json_to_instance_key(cJSON_GetArrayItem(removes, i), &keys[i]);
+        keys[i].tenant = tenant;
+    }
+    if (g_gateway_conf.staggerPolls)
+    {
+        stagger_slave_policies(policies, num, monotonic_ms());
+    }
+
+    lock_all_workers();
+    pthread_mutex_lock(&g_policy_list_lock);
+    // the added policies must be new, the updated and removed ones loaded
+    int fits = 1;
+    for (i = 0; fits && i < num; i++)
+    {
+        fits = (find_loaded_policy(policies[i]) == NULL) == (i < add_num);
+    }
+    for (i = 0; fits && i < remove_num; i++)
+    {
+        fits = find_loaded_policy(&keys[i]) != NULL;
+    }
+    if (fits)
+    {
+        mark_modbus_conns_unused();
+        for (i = 0; i < remove_num; i++)
+        {
+            SlavePolicy* old = take_same_policy(&g_slave_header.next, &keys[i]);
+            if (old != NULL)
+            {
+                sched_remove(&g_workers[old->worker].schedule, old);
+                destroy_slave_policy(old);
+            }
+            else
+            {
+                destroy_slave_policy(take_same_policy(&g_parked_policies, &keys[i]));
+            }
+        }
+        for (i = 0; i < num; i++)
+        {
+            SlavePolicy* parked = take_same_policy(&g_parked_policies, policies[i]);
+            if (parked != NULL)
+            {
+                destroy_slave_policy(parked);
+            }
+            SlavePolicy* old = take_same_policy(&g_slave_header.next, policies[i]);
+            if (!owns_policy(policies[i]))
+            {
+                if (old != NULL)
+                {
+                    sched_remove(&g_workers[old->worker].schedule, old);
+                    destroy_slave_policy(old);
+                }
+                policies[i]->next = g_parked_policies;
+                g_parked_policies = policies[i];
+                continue;
+            }
+            SlavePolicy* policy = install_policy(policies[i], old);
+            policy->next = g_slave_header.next;
+            g_slave_header.next = policy;
+        }
+        // the connections of every policy are claimed again, as in the reloading
+        SlavePolicy* sp = NULL;
+        for (sp = g_slave_header.next; sp != NULL; sp = sp->next)
+        {
+            init_modbus_context(sp);
+        }
+        relink_policies();
+    }
+    pthread_mutex_unlock(&g_policy_list_lock);
+    unlock_all_workers();
+    free(keys);
+    if (!fits)
+    {
+        for (i = 0; i < num; i++)
+        {
+            destroy_slave_policy(policies[i]);
+        }
+        free(policies);
+        return -1;
+    }
+    printf("policy delta of %s applied, %d added, %d updated, %d removed\n",
+        tenant_name(tenant), add_num, num - add_num, remove_num);
+    wake_all_workers();
+    free(policies);
+    return 0;
+}
+
+// build the policies again from their configs once the members changed, the
+// ones still owned keep their schedule, see apply_slave_policies
+void rebalance_policies()
+{
+    pthread_mutex_lock(&g_shard_lock);
+    g_shard_changed = 0;
+    pthread_mutex_unlock(&g_shard_lock);
+    // the lists are only changed by the supervisor, this thread
+    SlavePolicy* lists[2] = {g_slave_header.next, g_parked_policies};
+    int num = 0;
+    SlavePolicy* sp = NULL;
+    int l = 0;
+    for (l = 0; l < 2; l++)
+    {
+        for (sp = lists[l]; sp != NULL; sp = sp->next)
+        {
+            num++;
+        }
+    }
+    SlavePolicy** policies = (SlavePolicy**) malloc((num + 1) * sizeof(SlavePolicy*));
+    if (policies == NULL)
+    {
+        printf("out of memory while rebalancing the policies\n");
+        return;
+    }
+    num = 0;
+    for (l = 0; l < 2; l++)
+    {
+        for (sp = lists[l]; sp != NULL; sp = sp->next)
+        {
+            cJSON* root = sp->config != NULL ? cJSON_Parse(sp->config) : NULL;
+            if (root != NULL)
+            {
+                policies[num] = json_to_slave_poilicy(root);
+                assign_tenant(policies[num++], sp->tenant);
+                cJSON_Delete(root);
+            }
+        }
+    }
+    printf("the shard members changed, rebalancing %d policies\n", num);
+    apply_slave_policies(policies, num, -1);
+}
+
+// write the policies of the tenant loaded as the full config of their
+// version, and empty its journal. the configs of the policies are kept as
+// they were received
+void rewrite_policy_cache(int tenant)
+{
+    TenantState* ts = &g_tenants[tenant];
+    // the parked policies are a part of the config too
+    SlavePolicy* lists[2] = {g_slave_header.next, g_parked_policies};
+    long long len = MAX_LEN;
+    SlavePolicy* sp = NULL;
+    int l = 0;
+    for (l = 0; l < 2; l++)
+    {
+        for (sp = lists[l]; sp != NULL; sp = sp->next)
+        {
+            len += sp->config == NULL || sp->tenant != tenant ? 0 : strlen(sp->config) + 1;
+        }
+    }
+    char* templates = tenant == 0 ? policy_templates_json() : NULL;
+    len += templates == NULL ? 0 : strlen(templates);
+    char* text = (char*) malloc(len);
+    if (text == NULL)
+    {
+        free(templates);
+        return;
+    }
+    long long off = snprintf(text, len, "{\"version\":%lld,", ts->configVersion);
+    if (templates != NULL)
+    {
+        off += snprintf(text + off, len - off, "\"templates\":%s,", templates);
+        free(templates);
+    }
+    off += snprintf(text + off, len - off, "\"policies\":[");
+    for (l = 0; l < 2; l++)
+    {
+        for (sp = lists[l]; sp != NULL; sp = sp->next)
+        {
+            if (sp->config != NULL && sp->tenant == tenant)
+            {
+                off += snprintf(text + off, len - off, "%s%s", 
+                    text[off - 1] == '[' ? "" : ",", sp->config);
+            }
+        }
+    }
+    off += snprintf(text + off, len - off, "]}");
+    if (write_file_atomic(ts->cache, text, off) == 0)
+    {
+        unlink(ts->journal);
+        ts->journalNum = 0;
+    }
+    else
+    {
+        printf("failed to write the policy cache %s\n", ts->cache);
+    }
+    free(text);
+}
+
+// append the delta applied to the journal of the tenant, so that it's applied
+// again on the next start. the cache is rewritten once the journal is long
+void journal_policy_delta(cJSON* delta, int tenant)
+{
+    TenantState* ts = &g_tenants[tenant];
+    if (ts->journalNum + 1 >= MAX_POLICY_JOURNAL)
+    {
+        rewrite_policy_cache(tenant);
+        return;
+    }
+    char* line = cJSON_PrintUnformatted(delta);
+    FILE* fp = fopen(ts->journal, "a");
+    int ok = fp != NULL && line != NULL && fprintf(fp, "%s\n", line) > 0
+        && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fp != NULL)
+    {
+        ok = fclose(fp) == 0 && ok;
+    }
+    free(line);
+    if (!ok)
+    {
+        // the journal may end with a partial line now, the cache is complete
+        rewrite_policy_cache(tenant);
+        return;
+    }
+    ts->journalNum++;
+}
+
+// apply a full or a delta config of the tenant. a delta of a version already
+// loaded is skipped, one on top of another version makes the gateway ask for
+// a full config. a full config over the quota of the tenant is refused, its
+// policies loaded are kept. return 0 if the config is applied
+int apply_config(cJSON* root, int tenant)
+{
+    TenantState* ts = &g_tenants[tenant];
+    cJSON* list = config_policies(root);
+    if (list != NULL)
+    {
+        int max = g_gateway_conf.tenants[tenant].maxPolicies;
+        if (max > 0 && cJSON_GetArraySize(list) > max)
+        {
+            printf("the config of %s has %d policies, more than its maxPolicies %d, refused\n",
+                tenant_name(tenant), cJSON_GetArraySize(list), max);
+            ts->refused = 1;
+            return -1;
+        }
+        SlavePolicy** policies = NULL;
+        load_tenant_templates(root, tenant);
+        int num = policies_from_json(list, &policies, tenant);
+        apply_slave_policies(policies, num, tenant);
+        ts->configVersion = config_version(root);
+        ts->resyncNeeded = 0;
+        ts->refused = 0;
+        return 0;
+    }
+    long long version = config_version(root);
+    long long base = (long long) cJSON_GetObjectItem(root, "baseVersion")->valuedouble;
+    if (ts->configVersion >= 0 && version <= ts->configVersion)
+    {
+        printf("policy delta %lld of %s is already applied, skipping it\n", 
+            version, tenant_name(tenant));
+        return -1;
+    }
+    if (ts->configVersion < 0 || base != ts->configVersion || apply_policy_delta(root, tenant) != 0)
+    {
+        printf("policy delta %lld of version %lld doesn't fit the policies of version %lld "
+            "of %s, asking for a full config\n", version, base, ts->configVersion, 
+            tenant_name(tenant));
+        ts->configVersion = -1;
+        ts->resyncNeeded = 1;
+        return -1;
+    }
+    ts->configVersion = version;
+    ts->refused = 0;
+    return 0;
+}
+
+// apply the configs staged by handle_config_msg in order, the cache file
+// isn't read again. a full config is cached as it was received, a delta is
+// journaled. the snapshot goes stale with the cache, it's compiled again on
+// the next start
+void apply_staged_configs()
+{
+    pthread_mutex_lock(&g_policy_update_lock);
+    g_policy_updated = 0;
+    StagedConfig* staged = g_staged_head;
+    g_staged_head = NULL;
+    g_staged_tail = NULL;
+    pthread_mutex_unlock(&g_policy_update_lock);
+    while (staged != NULL)
+    {
+        StagedConfig* next = staged->next;
+        TenantState* ts = &g_tenants[staged->tenant];
+        if (apply_config(staged->root, staged->tenant) == 0)
+        {
+            if (config_policies(staged->root) == NULL)
+            {
+                journal_policy_delta(staged->root, staged->tenant);
+            }
+            else if (write_file_atomic(ts->cache, staged->text, strlen(staged->text)) == 0)
+            {
+                unlink(ts->journal);
+                ts->journalNum = 0;
+            }
+            else
+            {
+                printf("failed to write the policy cache %s\n", ts->cache);
+            }
+        }
+        cJSON_Delete(staged->root);
+        free(staged->text);
+        free(staged);
+        staged = next;
+    }
+}
+
+// the configs staged of the tenant, of all of them if it's -1
+void release_staged_configs(int tenant)
+{
+    StagedConfig** link = &g_staged_head;
+    g_staged_tail = NULL;
+    while (*link != NULL)
+    {
+        StagedConfig* staged = *link;
+        if (tenant >= 0 && staged->tenant != tenant)
+        {
+            g_staged_tail = staged;
+            link = &staged->next;
+            continue;
+        }
+        *link = staged->next;
+        cJSON_Delete(staged->root);
+        free(staged->text);
+        free(staged);
+    }
+}
+
+// apply the deltas journaled on top of the cache loaded of the tenant, stop
+// at the first one that's incomplete or doesn't fit
+void replay_policy_journal(int tenant)
+{
+    TenantState* ts = &g_tenants[tenant];
+    char* content = NULL;
+    if (read_file_as_string(ts->journal, &content) <= 0)
+    {
+        return;
+    }
+    int applied = 0;
+    char* line = content;
+    while (*line != 0)
+    {
+        char* end = strchr(line, '\n');
+        if (end == NULL)
+        {
+            break;
+        }
+        *end = 0;
+        cJSON* delta = cJSON_Parse(line);
+        line = end + 1;
+        if (!is_delta_config(delta))
+        {
+            cJSON_Delete(delta);
+            break;
+        }
+        ts->journalNum++;
+        if (config_version(delta) <= ts->configVersion)
+        {
+            cJSON_Delete(delta);
+            continue;
+        }
+        int rc = apply_config(delta, tenant);
+        cJSON_Delete(delta);
+        if (rc != 0)
+        {
+            break;
+        }
+        applied++;
+    }
+    free(content);
+    printf("%d policy deltas replayed from %s, now at version %lld\n", 
+        applied, ts->journal, ts->configVersion);
+}
+
+// the policies cached of one of the other tenants, they are always parsed
+// from the json. return the number of policies
+int load_tenant_policy_cache(int tenant)
+{
+    TenantState* ts = &g_tenants[tenant];
+    FILE* fp = fopen(ts->cache, "rb");
+    if (fp == NULL)
+    {
+        printf("no policy cache %s of %s, waiting for its config\n", ts->cache, tenant_name(tenant));
+        return 0;
+    }
+    SlavePolicy** policies = NULL;
+    long long version = 0;
+    int num = read_policy_cache(fp, &policies, &version, tenant);
+    fclose(fp);
+    if (num < 0)
+    {
+        printf("invalid config detected from cache file %s, skipping it\n", ts->cache);
+        return 0;
+    }
+    apply_slave_policies(policies, num, tenant);
+    ts->configVersion = version;
+    replay_policy_journal(tenant);
+    return num;
+}
+
+int load_slave_policy_from_cache()
+{
+    // in case gateway can't retrieve SlavePolicy from cloud immediately,
+    // we should cache the polices in a local file. Whenever gateway startup,
+    // it should load polices form this local cache first, and in the mean time
+    // listen any policy change pushed from cloud.
+    log_debug("enter loadSlavePolicy");
+    // anyway we will clear the flag that need reload policy
+    pthread_mutex_lock(&g_policy_update_lock);
+
+    g_policy_updated = 0;
+
+    // the cache is written to a temp file and renamed, the one opened is read
+    // to its end even if it's replaced meanwhile
+    long long start = monotonic_ms();
+    PolicySnapshotKey key;
+    FILE* fp = fopen(POLICY_CACHE, "rb");
+    if (fp == NULL || snapshot_key(&key, fp, serial_ports_hash()) != 0)
+    {
+        printf("failed to open policy cache file %s, skipping policy cache loading\n",
+                 POLICY_CACHE);
+        pthread_mutex_unlock(&g_policy_update_lock);
+        if (fp != NULL)
+        {
+            fclose(fp);
+        }
+        return 0;
+    }
+    pthread_mutex_unlock(&g_policy_update_lock);
+    // the json is only parsed if the snapshot compiled from it is stale
+    SlavePolicy** policies = NULL;
+    long long version = 0;
+    int num = load_policy_snapshot(&key, &policies, &version);
+    if (num >= 0)
+    {
+        printf("%d policies loaded from the snapshot %s in %lld ms\n", 
+            num, POLICY_SNAPSHOT, monotonic_ms() - start);
+    }
+    else
+    {
+        num = read_policy_cache(fp, &policies, &version, 0);
+        if (num < 0)
+        {
+            printf("invalid config detected from cache file %s, skipping policy cache loading\n", 
+                    POLICY_CACHE);
+            fclose(fp);
+            return 0;
+        }
+        // the instances of templates are built from the templates, which are
+        // only in the json
+        if (policy_template_num() == 0)
+        {
+            snapshot_write(POLICY_SNAPSHOT, &key, version, policies, num);
+        }
+    }
+    fclose(fp);
+    apply_slave_policies(policies, num, 0);
+    g_tenants[0].configVersion = version;
+    replay_policy_journal(0);
+    return num;
+}
+
+// announce this gateway on shardTopic/<instanceId>, or that it's gone. it's
+// retained, so the members joining later know it
+void announce_shard_member(int alive)
+{
+    char topic[MAX_LEN];
+    char text[MAX_LEN];
+    snprintf(topic, MAX_LEN, "%s/%s", g_gateway_conf.shardTopic, g_gateway_conf.instanceId);
+    snprintf(text, MAX_LEN, "{\"instance\":\"%s\",\"alive\":%s}", 
+        g_gateway_conf.instanceId, alive ? "true" : "false");
+    amqtt_publish(&g_gateway_client, topic, text, strlen(text), 1);
+}
+
+// a member announced itself, or its will told it's gone
+int handle_shard_msg(char* topicName, MQTTAsync_message* message)
+{
+    char* buf = (char*) malloc(message->payloadlen + 1);
+    cJSON* root = NULL;
+    if (buf != NULL)
+    {
+        memcpy(buf, message->payload, message->payloadlen);
+        buf[message->payloadlen] = 0;
+        root = cJSON_Parse(buf);
+        free(buf);
+    }
+    int alive = cJSON_IsTrue(cJSON_GetObjectItem(root, "alive"));
+    cJSON_Delete(root);
+    char instance[FIELD_NAME_LEN];
+    mystrncpy(instance, topicName + strlen(g_gateway_conf.shardTopic) + 1, FIELD_NAME_LEN);
+    MQTTAsync_freeMessage(&message);
+    MQTTAsync_free(topicName);
+    if (strcmp(instance, g_gateway_conf.instanceId) == 0)
+    {
+        // the will of a connection lost earlier, while this gateway is still up
+        if (!alive)
+        {
+            announce_shard_member(1);
+        }
+        return 1;
+    }
+    pthread_mutex_lock(&g_shard_lock);
+    int found = -1;
+    int i = 0;
+    for (i = 0; i < g_shard_member_num && found < 0; i++)
+    {
+        if (strcmp(g_shard_members[i], instance) == 0)
+        {
+            found = i;
+        }
+    }
+    int changed = 0;
+    if (alive && found < 0 && g_shard_member_num < MAX_SHARD_MEMBERS)
+    {
+        mystrncpy(g_shard_members[g_shard_member_num++], instance, FIELD_NAME_LEN);
+        changed = 1;
+    }
+    else if (!alive && found >= 0)
+    {
+        g_shard_member_num--;
+        mystrncpy(g_shard_members[found], g_shard_members[g_shard_member_num], FIELD_NAME_LEN);
+        changed = 1;
+    }
+    g_shard_changed |= changed;
+    int num = g_shard_member_num;
+    pthread_mutex_unlock(&g_shard_lock);
+    if (changed)
+    {
+        printf("shard member %s %s, %d members\n", instance, alive ? "joined" : "left", num + 1);
+        wake_supervisor();
+    }
+    return 1;
+}
+
+void publish_trace_part(const char* text, int len, int part, void* arg)
+{
+    const char* topic = (const char*) arg;
+    pthread_mutex_lock(&g_gateway_mutex);
+    if (g_gateway_connected == 1)
+    {
+        amqtt_publish(&g_gateway_client, topic, text, len, 0);
+    }
+    pthread_mutex_unlock(&g_gateway_mutex);
+}
+
+// {"trace": "start"} records the spans of every sample polled from now on,
+// "stop" stops, and "dump" publishes the spans recorded to traceTopic/dump,
+// in parts of TRACE_PART_BYTES, each a chrome trace of its own
+int handle_trace_msg(MQTTAsync_message* message, char* topicName)
+{
+    char* buf = (char*) malloc(message->payloadlen + 1);
+    cJSON* root = NULL;
+    if (buf != NULL)
+    {
+        memcpy(buf, message->payload, message->payloadlen);
+        buf[message->payloadlen] = 0;
+        root = cJSON_Parse(buf);
+        free(buf);
+    }
+    MQTTAsync_freeMessage(&message);
+    MQTTAsync_free(topicName);
+    const char* command = cJSON_IsString(cJSON_GetObjectItem(root, "trace")) 
+        ? json_string(root, "trace") : "";
+    if (strcmp(command, "start") == 0)
+    {
+        trace_set_enabled(1);
+        printf("tracing the samples\n");
+    }
+    else if (strcmp(command, "stop") == 0)
+    {
+        trace_set_enabled(0);
+        printf("stopped tracing the samples\n");
+    }
+    else if (strcmp(command, "dump") == 0)
+    {
+        char topic[MAX_LEN];
+        snprintf(topic, MAX_LEN, "%s/dump", g_gateway_conf.traceTopic);
+        int parts = trace_dump(TRACE_PART_BYTES, publish_trace_part, topic);
+        printf("dumped the trace in %d part(s) to %s\n", parts, topic);
+    }
+    else
+    {
+        printf("unknown trace command, expecting start, stop or dump\n");
+    }
+    cJSON_Delete(root);
+    return 1;
+}
+
+int msg_arrived(void* context, char* topicName, int topicLen, MQTTAsync_message* message)
+{
+    // sometime we receive strange message with topic name like "\300\005@\267"
+    // let's filter those message that with topic other than expected
+    if (message == NULL)
+    {
+        return 1;
+    }
+    int shardLen = strlen(g_gateway_conf.shardTopic);
+    int t = 0;
+    for (t = 0; t < g_gateway_conf.tenantNum; t++) {
+        TenantConfig* tenant = &g_gateway_conf.tenants[t];
+        if (strcmp(tenant->topic, topicName) == 0) {
+            return handle_config_msg(context, topicName, topicLen, message, t);
+        } else if (strlen(tenant->backControlTopic) > 0 
+            && strcmp(tenant->backControlTopic, topicName) == 0) {
+            return handle_back_control_msg(context, topicName, topicLen, message, t);
+        }
+    }
+    if (shardLen > 0 && strncmp(g_gateway_conf.shardTopic, topicName, shardLen) == 0
+        && topicName[shardLen] == '/') {
+        return handle_shard_msg(topicName, message);
+    } else if (strlen(g_gateway_conf.traceTopic) > 0
+        && strcmp(g_gateway_conf.traceTopic, topicName) == 0) {
+        return handle_trace_msg(message, topicName);
+    } else {
+        logger_debug("received unrelevant message in command topic, skipping it. topic=%s", topicName);
+    
+        MQTTAsync_freeMessage(&message);
+        MQTTAsync_free(topicName);
+
+        return 1;
+    }
+}
+
+// a back control message being written, the results of its requests are
+// published to the ack topic once all of them are done
+typedef struct
+{
+    pthread_mutex_t lock;
+    int remaining;                  // the writes not done yet, +1 while queuing
+    cJSON* results;                 // the result of every request, by the request key
+    char* id;                       // the optional id of the message, echoed in the ack
+    int tenant;                     // whose back control it is, the ack goes to its ackTopic
+} BackControlMsg;
+
+// a request of a back control message
+typedef struct
+{
+    char key[16];
+    int slaveid;
+    int address;
+    char* data;
+    char* addr;                     // the bus, NULL for the bus where the slave is first seen
+    int readback;
+    int num;                        // registers or bits to write
+    char bus[ADDR_LEN];             // the bus of the slave of a tenant, see find_tenant_slave
+} BackControlReq;
+
+// one modbus write of a back control message, merged from the contiguous requests
+typedef struct
+{
+    BackControlMsg* msg;
+    int count;
+    char keys[MAX_BACK_CONTROL_REQUESTS][16];
+} BackControlWrite;
+
+void add_back_control_result(BackControlMsg* msg, const char* key, int rc, 
+    long long latencyUs, const char* readback)
+{
+    cJSON* result = cJSON_CreateObject();
+    cJSON_AddBoolToObject(result, "ok", rc == 0);
+    cJSON_AddNumberToObject(result, "latencyMs", latencyUs / 1000.0);
+    if (readback != NULL)
+    {
+        cJSON_AddStringToObject(result, "data", readback);
+    }
+    pthread_mutex_lock(&msg->lock);
+    cJSON_AddItemToObject(msg->results, key, result);
+    pthread_mutex_unlock(&msg->lock);
+}
+
+// one more write of the message is done, publish the ack after the last one
+void finish_back_control(BackControlMsg* msg)
+{
+    pthread_mutex_lock(&msg->lock);
+    int remaining = --msg->remaining;
+    pthread_mutex_unlock(&msg->lock);
+    if (remaining > 0)
+    {
+        return;
+    }
+    const char* ackTopic = g_gateway_conf.tenants[msg->tenant].ackTopic;
+    if (strlen(ackTopic) > 0)
+    {
+        cJSON* root = cJSON_CreateObject();
+        if (msg->id != NULL)
+        {
+            cJSON_AddStringToObject(root, "id", msg->id);
+        }
+        cJSON_AddItemToObject(root, "results", msg->results);
+        msg->results = NULL;
+        char* text = cJSON_PrintUnformatted(root);
+        cJSON_Delete(root);
+        pthread_mutex_lock(&g_gateway_mutex);
+        if (g_gateway_connected == 1)
+        {
+            amqtt_publish(&g_gateway_client, ackTopic, text, strlen(text), 0);
+        }
+        pthread_mutex_unlock(&g_gateway_mutex);
+        free(text);
+    }
+    cJSON_Delete(msg->results);
+    free(msg->id);
+    pthread_mutex_destroy(&msg->lock);
+    free(msg);
+}
+
+void back_control_write_done(void* arg, int rc, long long latencyUs, const char* readback)
+{
+    BackControlWrite* w = (BackControlWrite*) arg;
+    int i = 0;
+    for (i = 0; i < w->count; i++)
+    {
+        printf("%s %s in %lld us\n", w->keys[i], rc == 0 ? "written" : "failed", latencyUs);
+        add_back_control_result(w->msg, w->keys[i], rc, latencyUs, readback);
+    }
+    finish_back_control(w->msg);
+    free(w);
+}
+
+// the request b continues the write a of count registers/bits, on the same bus and slave
+int can_merge_write(BackControlReq* a, BackControlReq* b, int count)
+{
+    int reg = a->address >= 40001;
+    int chars = reg ? 4 : 2;
+    return a->data != NULL && b->data != NULL
+        && a->slaveid == b->slaveid
+        && ((a->addr == NULL && b->addr == NULL) 
+            || (a->addr != NULL && b->addr != NULL && strcmp(a->addr, b->addr) == 0))
+        && !a->readback && !b->readback
+        && reg == (b->address >= 40001)
+        && (int)strlen(a->data) == a->num * chars
+        && b->address == a->address + a->num
+        && count + b->num <= MAX_MODBUS_DATA_TO_WRITE;
+}
+
+// whether a policy polled here is on the bus given, or of the slave if no bus
+int serves_write(const char* addr, int slaveid)
+{
+    int found = 0;
+    SlavePolicy* sp = NULL;
+    pthread_mutex_lock(&g_policy_list_lock);
+    for (sp = g_slave_header.next; sp != NULL && !found; sp = sp->next)
+    {
+        found = addr != NULL && strlen(addr) > 0 
+            ? strcmp(sp->ip_com_addr, addr) == 0 : sp->slaveid == slaveid;
+    }
+    pthread_mutex_unlock(&g_policy_list_lock);
+    return found;
+}
+
+// the bus of a policy of the tenant reading the slave, on the bus given if
+// any, into bus. return 1 if it's polled here, 0 if by another member of the
+// shard, -1 if the tenant polls no such slave. a tenant doesn't broadcast
+int find_tenant_slave(int tenant, const char* addr, int slaveid, char* bus)
+{
+    SlavePolicy* lists[2] = {g_slave_header.next, g_parked_policies};
+    int found = -1;
+    int l = 0;
+    pthread_mutex_lock(&g_policy_list_lock);
+    for (l = 0; l < 2 && found < 0 && slaveid != 0; l++)
+    {
+        SlavePolicy* sp = NULL;
+        for (sp = lists[l]; sp != NULL && found < 0; sp = sp->next)
+        {
+            if (sp->tenant == tenant && sp->slaveid == slaveid 
+                && (addr == NULL || strlen(addr) == 0 || strcmp(sp->ip_com_addr, addr) == 0))
+            {
+                mystrncpy(bus, sp->ip_com_addr, ADDR_LEN);
+                found = l == 0;
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_policy_list_lock);
+    return found;
+}
+
+// a back control message of raw pdus being run, the responses are published
+// to the ack topic in one message once all of them are done
+typedef struct
+{
+    pthread_mutex_t lock;
+    int remaining;                  // the batches not done yet, +1 while queuing
+    int count;
+    ModbusRaw reqs[MAX_BACK_CONTROL_REQUESTS];
+    char skipped[MAX_BACK_CONTROL_REQUESTS];    // left to another member of the shard
+    char* id;
+    int tenant;
+} RawMsg;
+
+// one more batch of the message is done, publish the ack after the last one
+void finish_raw_msg(RawMsg* msg)
+{
+    pthread_mutex_lock(&msg->lock);
+    int remaining = --msg->remaining;
+    pthread_mutex_unlock(&msg->lock);
+    if (remaining > 0)
+    {
+        return;
+    }
+    const char* ackTopic = g_gateway_conf.tenants[msg->tenant].ackTopic;
+    if (strlen(ackTopic) > 0)
+    {
+        cJSON* root = cJSON_CreateObject();
+        if (msg->id != NULL)
+        {
+            cJSON_AddStringToObject(root, "id", msg->id);
+        }
+        cJSON* results = cJSON_CreateArray();
+        cJSON_AddItemToObject(root, "raw", results);
+        char pdu[MODBUS_MAX_PDU_LENGTH * 2 + 1];
+        int i = 0;
+        for (i = 0; i < msg->count; i++)
+        {
+            ModbusRaw* r = &msg->reqs[i];
+            if (msg->skipped[i])
+            {
+                continue;
+            }
+            cJSON* result = cJSON_CreateObject();
+            cJSON_AddNumberToObject(result, "index", r->index);
+            cJSON_AddBoolToObject(result, "ok", r->rspLen >= 0);
+            if (r->rspLen > 0)
+            {
+                hex_encode(pdu, r->rsp, r->rspLen);
+                cJSON_AddStringToObject(result, "pdu", pdu);
+                if (r->rsp[0] & 0x80)
+                {
+                    cJSON_AddNumberToObject(result, "exception", r->rspLen > 1 ? r->rsp[1] : 0);
+                }
+            }
+            else if (r->rspLen < 0)
+            {
+                cJSON_AddStringToObject(result, "error", modbus_strerror(r->err));
+            }
+            cJSON_AddNumberToObject(result, "latencyMs", r->latencyUs / 1000.0);
+            cJSON_AddItemToArray(results, result);
+        }
+        char* text = cJSON_PrintUnformatted(root);
+        cJSON_Delete(root);
+        pthread_mutex_lock(&g_gateway_mutex);
+        if (g_gateway_connected == 1)
+        {
+            amqtt_publish(&g_gateway_client, ackTopic, text, strlen(text), 0);
+        }
+        pthread_mutex_unlock(&g_gateway_mutex);
+        free(text);
+    }
+    free(msg->id);
+    pthread_mutex_destroy(&msg->lock);
+    free(msg);
+}
+
+void raw_done(void* arg, ModbusRaw* reqs, int count)
+{
+    int i = 0;
+    for (i = 0; i < count; i++)
+    {
+        printf("raw request %d to slaveid=%d %s in %lld us\n", reqs[i].index, reqs[i].slaveid, 
+            reqs[i].rspLen >= 0 ? "done" : "failed", reqs[i].latencyUs);
+    }
+    finish_raw_msg((RawMsg*) arg);
+}
+
+// the raw pdus of a back control message, which looks like
+// {
+//     "id": "optional, echoed in the ack",
+//     "priority": 2,
+//     "raw": [
+//         {"slaveid": 1, "pdu": "0300000002"},
+//         {"slaveid": 2, "ip_com_addr": "/dev/ttyS1", "pdu": "2b0e0100"}
+//     ]
+// }
+// the pdus to the same bus are run in the order of the message, nothing else
+// is run on the bus between the ones next to each other. the priority is of
+// the queue of the bus(0 first, the writes are 0), DEFAULT_PRIORITY if not given
+void handle_raw_msg(cJSON* root, int tenant)
+{
+    cJSON* raw = cJSON_GetObjectItem(root, "raw");
+    RawMsg* msg = (RawMsg*) calloc(1, sizeof(RawMsg));
+    if (msg == NULL || !cJSON_IsArray(raw))
+    {
+        printf("invalid raw back control message\n");
+        free(msg);
+        return;
+    }
+    pthread_mutex_init(&msg->lock, NULL);
+    // held until all the batches are queued
+    msg->remaining = 1;
+    msg->id = cJSON_IsString(cJSON_GetObjectItem(root, "id")) ? strdup(json_string(root, "id")) : NULL;
+    msg->tenant = tenant;
+    int priority = DEFAULT_PRIORITY;
+    if (cJSON_HasObjectItem(root, "priority"))
+    {
+        priority = json_int(root, "priority");
+        priority = priority < 0 ? 0 : (priority > MAX_PRIORITY ? MAX_PRIORITY : priority);
+    }
+
+    // the bus of every request, NULL for the bus where the slave is first seen
+    const char* addrs[MAX_BACK_CONTROL_REQUESTS];
+    char buses[MAX_BACK_CONTROL_REQUESTS][ADDR_LEN];
+    cJSON* item = NULL;
+    for (item = raw->child; item != NULL && msg->count < MAX_BACK_CONTROL_REQUESTS; item = item->next)
+    {
+        int i = msg->count++;
+        ModbusRaw* r = &msg->reqs[i];
+        r->index = i;
+        r->slaveid = json_int(item, "slaveid");
+        r->rspLen = -1;
+        r->err = EINVAL;
+        addrs[i] = cJSON_HasObjectItem(item, "ip_com_addr") ? json_string(item, "ip_com_addr") : NULL;
+        const char* pdu = json_string(item, "pdu");
+        r->reqLen = pdu != NULL ? hex_decode(r->req, MODBUS_MAX_PDU_LENGTH - 1, pdu, strlen(pdu)) : -1;
+        if (r->reqLen < 1 || r->slaveid < 0 || r->slaveid > 247 || !g_gateway_conf.rawPassThrough)
+        {
+            // refused, unless it's queued below
+            r->err = g_gateway_conf.rawPassThrough ? EINVAL : EPERM;
+            r->reqLen = 0;
+            continue;
+        }
+        if (tenant > 0)
+        {
+            // a tenant only talks to the slaves of its own policies, like its writes
+            int where = find_tenant_slave(tenant, addrs[i], r->slaveid, buses[i]);
+            if (where < 0)
+            {
+                printf("raw request %d of %s refused, slaveid=%d is not one of its slaves\n", i,
+                    tenant_name(tenant), r->slaveid);
+                r->err = EACCES;
+                r->reqLen = 0;
+                continue;
+            }
+            msg->skipped[i] = where == 0;
+            addrs[i] = buses[i];
+        }
+        else if (strlen(g_gateway_conf.shardTopic) > 0 && !serves_write(addrs[i], r->slaveid))
+        {
+            // the bus is polled by another member of the shard, which acks it
+            msg->skipped[i] = 1;
+        }
+    }
+
+    // the requests next to each other to the same bus are queued as one batch
+    char bus[ADDR_LEN];
+    int i = 0;
+    while (i < msg->count)
+    {
+        if (msg->reqs[i].reqLen == 0 || msg->skipped[i])
+        {
+            i++;
+            continue;
+        }
+        int j = i + 1;
+        while (j < msg->count && msg->reqs[j].reqLen > 0 && !msg->skipped[j]
+            && (addrs[i] != NULL ? addrs[j] != NULL && strcmp(addrs[i], addrs[j]) == 0 
+                : addrs[j] == NULL && msg->reqs[j].slaveid == msg->reqs[i].slaveid))
+        {
+            j++;
+        }
+        pthread_mutex_lock(&msg->lock);
+        msg->remaining++;
+        pthread_mutex_unlock(&msg->lock);
+        if (queue_modbus_raw(addrs[i], msg->reqs[i].slaveid, &msg->reqs[i], j - i, priority, 
+                raw_done, msg, bus) == 0)
+        {
+            PollWorker* worker = &g_workers[worker_of_bus(bus)];
+            pthread_mutex_lock(&worker->lock);
+            pthread_cond_signal(&worker->wakeup);
+            pthread_mutex_unlock(&worker->lock);
+        }
+        else
+        {
+            printf("failed to queue raw request %d, slaveid=%d, no such bus\n", i, 
+                msg->reqs[i].slaveid);
+            int k = 0;
+            for (k = i; k < j; k++)
+            {
+                msg->reqs[k].err = ENODEV;
+            }
+            finish_raw_msg(msg);
+        }
+        i = j;
+    }
+    finish_raw_msg(msg);
+}
+
+int handle_back_control_msg(void* context, char* topicName, int topicLen, MQTTAsync_message* message,
+    int tenant) {
+    int i = 1;
+    char* payloadptr = NULL;
+
+    payloadptr = message->payload;
+    int buflen = message->payloadlen + 1;
+    char* buf = (char*)malloc(buflen);
+    if (buf == NULL)
+    {
+        printf("no memory for the message of %d bytes on %s\n", message->payloadlen, topicName);
+        MQTTAsync_freeMessage(&message);
+        MQTTAsync_free(topicName);
+        return 1;
+    }
+    buf[buflen - 1] = 0;
+    for(i = 0; i<message->payloadlen; i++)
+    {
+        buf[i] = payloadptr[i];
+    }
+
+    MQTTAsync_freeMessage(&message);
+    MQTTAsync_free(topicName);
+    cJSON* root = cJSON_Parse(buf);
+    if (root == NULL)
+    {
+        printf("received invalid json config for writing modbus:%s\n", buf);
+        free(buf);
+        return 1;
+    }
+    free(buf);
+    if (cJSON_HasObjectItem(root, "raw")) {
+        handle_raw_msg(root, tenant);
+        cJSON_Delete(root);
+        return 1;
+    }
+    
+    // the control config looks like
+    // {
+    //     "id": "optional, echoed in the ack",
+    //     "request1": {
+    //         "slaveid": 1,
+    //         "address": 40001,
+    //         "data": "00ff1234"
+    //     },
+    //     "request2": {
+    //         "slaveid": 2,
+    //         "address": 10020,
+    //         "data": "00ff1234",
+    //         "readback": true
+    //     },
+    //     "request3": {
+    //         "slaveid": 0,
+    //         "ip_com_addr": "/dev/ttyS1",
+    //         "address": 40010,
+    //         "data": "0190"
+    //     }
+    // }
+    // slaveid 0 is a broadcast to all the slaves on the serial bus given, in one frame
+    BackControlReq reqs[MAX_BACK_CONTROL_REQUESTS];
+    int count = 0;
+    // lets limit the max data point to write to 100
+    for (i = 1; i <= MAX_BACK_CONTROL_REQUESTS; i++) {
+        BackControlReq* r = &reqs[count];
+        sprintf(r->key, "request%d", i);
+        if (cJSON_HasObjectItem(root, r->key)) {
+            cJSON* req = cJSON_GetObjectItem(root, r->key);
+            r->slaveid = json_int(req, "slaveid");
+            r->address = json_int(req, "address");
+            r->data = json_string(req, "data");
+            // optional, to tell apart the slaves with the same id on different buses
+            r->addr = NULL;
+            if (cJSON_HasObjectItem(req, "ip_com_addr")) {
+                r->addr = json_string(req, "ip_com_addr");
+            }
+            // optional, the registers are read back in the same request(0x17)
+            r->readback = cJSON_HasObjectItem(req, "readback") 
+                && cJSON_IsTrue(cJSON_GetObjectItem(req, "readback"));
+            r->num = r->data != NULL ? strlen(r->data) / (r->address >= 40001 ? 4 : 2) : 0;
+            count++;
+        } else {
+            break;
+        }
+    }
+
+    BackControlMsg* msg = (BackControlMsg*) malloc(sizeof(BackControlMsg));
+    if (msg == NULL) {
+        cJSON_Delete(root);
+        return 1;
+    }
+    pthread_mutex_init(&msg->lock, NULL);
+    // held until all the writes are queued
+    msg->remaining = 1;
+    msg->results = cJSON_CreateObject();
+    msg->id = cJSON_IsString(cJSON_GetObjectItem(root, "id")) ? strdup(json_string(root, "id")) : NULL;
+    msg->tenant = tenant;
+
+    // the other tenants only write to the slaves of their own policies, on
+    // the buses of the policies, the ones of the other members are left to them
+    if (tenant > 0) {
+        int kept = 0;
+        for (i = 0; i < count; i++) {
+            int where = find_tenant_slave(tenant, reqs[i].addr, reqs[i].slaveid, reqs[i].bus);
+            if (where < 0) {
+                printf("%s of %s refused, slaveid=%d is not one of its slaves\n", reqs[i].key,
+                    tenant_name(tenant), reqs[i].slaveid);
+                add_back_control_result(msg, reqs[i].key, -1, 0, NULL);
+            } else if (where > 0) {
+                reqs[kept] = reqs[i];
+                reqs[kept].addr = reqs[kept].bus;
+                kept++;
+            }
+        }
+        count = kept;
+    }
+
+    // the contiguous requests to the same slave are merged into one write, 
+    // in the order they are in the message. writes are done by the worker of
+    // the bus ahead of its reads, and the worker is woken up in case it's idle
+    char data[MAX_MODBUS_DATA_TO_WRITE * 4 + 1];
+    char bus[ADDR_LEN];
+    i = 0;
+    while (i < count) {
+        if (tenant == 0 && strlen(g_gateway_conf.shardTopic) > 0 
+            && !serves_write(reqs[i].addr, reqs[i].slaveid)) {
+            // the bus is polled by another member of the shard, which acks it
+            i++;
+            continue;
+        }
+        BackControlWrite* w = (BackControlWrite*) malloc(sizeof(BackControlWrite));
+        if (w == NULL) {
+            break;
+        }
+        w->msg = msg;
+        w->count = 1;
+        mystrncpy(w->keys[0], reqs[i].key, sizeof(w->keys[0]));
+        int num = reqs[i].num;
+        int j = i + 1;
+        const char* wdata = reqs[i].data;
+        if (j < count && can_merge_write(&reqs[i], &reqs[j], num)) {
+            int chars = reqs[i].address >= 40001 ? 4 : 2;
+            int len = 0;
+            for (j = i; j < count && (j == i || can_merge_write(&reqs[j - 1], &reqs[j], num)); j++) {
+                if (j > i) {
+                    num += reqs[j].num;
+                    mystrncpy(w->keys[w->count++], reqs[j].key, sizeof(w->keys[0]));
+                }
+                memcpy(data + len, reqs[j].data, reqs[j].num * chars);
+                len += reqs[j].num * chars;
+            }
+            data[len] = 0;
+            wdata = data;
+        }
+        pthread_mutex_lock(&msg->lock);
+        msg->remaining++;
+        pthread_mutex_unlock(&msg->lock);
+        if (queue_modbus_write(reqs[i].addr, reqs[i].slaveid, reqs[i].address, wdata, 
+                reqs[i].readback, back_control_write_done, w, bus) == 0) {
+            PollWorker* worker = &g_workers[worker_of_bus(bus)];
+            pthread_mutex_lock(&worker->lock);
+            pthread_cond_signal(&worker->wakeup);
+            pthread_mutex_unlock(&worker->lock);
+        } else {
+            printf("failed to write %s, slaveid=%d, address=%d\n", reqs[i].key, 
+                reqs[i].slaveid, reqs[i].address);
+            back_control_write_done(w, -1, 0, NULL);
+        }
+        i = j;
+    }
+    finish_back_control(msg);
+
+    cJSON_Delete(root);
+    return 1;
+}
+
+int handle_config_msg(void* context, char* topicName, int topicLen, MQTTAsync_message* message,
+    int tenant) {
+    int i = 0;
+    char* payloadptr = NULL;
+
+    payloadptr = message->payload;
+    int buflen = message->payloadlen + 1;
+    char* buf = (char*)malloc(buflen);
+    if (buf == NULL)
+    {
+        printf("no memory for the message of %d bytes on %s\n", message->payloadlen, topicName);
+        MQTTAsync_freeMessage(&message);
+        MQTTAsync_free(topicName);
+        return 1;
+    }
+    buf[buflen - 1] = 0;
+    for(i = 0; i<message->payloadlen; i++)
+    {
+        buf[i] = payloadptr[i];
+    }
+
+    MQTTAsync_freeMessage(&message);
+    MQTTAsync_free(topicName);
+    cJSON* root = cJSON_Parse(buf);
+    int full = config_policies(root) != NULL;
+    StagedConfig* staged = NULL;
+    if (full || is_delta_config(root))
+    {
+        staged = (StagedConfig*) malloc(sizeof(StagedConfig));
+    }
+    if (staged == NULL)
+    {
+        printf("received invalid json config:%s\n", buf);
+        cJSON_Delete(root);
+        free(buf);
+        return 1;
+    }
+    printf("recived following config of %s:\n%s\n", tenant_name(tenant), buf);
+
+    // the supervisor applies the parsed configs in order, the ones of the
+    // tenant not applied yet are of no use once a full config comes
+    staged->root = root;
+    staged->text = buf;
+    staged->tenant = tenant;
+    staged->next = NULL;
+    pthread_mutex_lock(&g_policy_update_lock);
+    if (full)
+    {
+        release_staged_configs(tenant);
+    }
+    if (g_staged_tail != NULL)
+    {
+        g_staged_tail->next = staged;
+    }
+    else
+    {
+        g_staged_head = staged;
+    }
+    g_staged_tail = staged;
+    g_policy_updated = 1;
+    pthread_mutex_unlock(&g_policy_update_lock);
+    wake_supervisor();
+    return 1;
+}
+
+void connection_lost(void* context, char* cause)
+{
+    // the client reconnects, and renews the subscriptions by itself
+    printf("\nConnection lost, caused by %s, will reconnect later\n", cause);
+}
+
+void start_listen_command()
+{
+    printf("connecting gateway to cloud...\n");
+    pthread_mutex_lock(&g_gateway_mutex);
+    // sub to config mqtt topic, to receive slave policy from cloud
+    char seed[MAX_LEN * 2];
+    snprintf(seed, sizeof(seed), "%s %s", g_gateway_conf.endpoint, g_gateway_conf.topic);
+    char clientid[MAX_LEN];
+    amqtt_clientid(clientid, MAX_LEN, "modbusGW", seed);
+    int rc = amqtt_create(&g_gateway_client, g_gateway_conf.endpoint, clientid,
+        g_gateway_conf.user, g_gateway_conf.password, PEM_FILE, 
+        g_gateway_conf.mqttQueueSize, g_gateway_conf.mqttMaxInflight, 0);
+    if (rc != 0)
+    {
+        printf("Failed to create the gateway mqtt client\n");
+        pthread_mutex_unlock(&g_gateway_mutex);
+        return;
+    }
+    enable_mqtt5(&g_gateway_client);
+
+    // the tenants share the connection of the gateway
+    char* topics[3 + 2 * MAX_TENANTS];
+    int count = 0;
+    int t = 0;
+    for (t = 0; t < g_gateway_conf.tenantNum; t++)
+    {
+        topics[count++] = g_gateway_conf.tenants[t].topic;
+        if (strlen(g_gateway_conf.tenants[t].backControlTopic) > 0)
+        {
+            topics[count++] = g_gateway_conf.tenants[t].backControlTopic;
+        }
+    }
+    if (strlen(g_gateway_conf.traceTopic) > 0)
+    {
+        topics[count++] = g_gateway_conf.traceTopic;
+    }
+    // the members of the shard, the broker tells the ones gone by their will
+    char shardSub[MAX_LEN];
+    if (strlen(g_gateway_conf.shardTopic) > 0)
+    {
+        snprintf(shardSub, MAX_LEN, "%s/+", g_gateway_conf.shardTopic);
+        topics[count++] = shardSub;
+        char willTopic[MAX_LEN];
+        char will[MAX_LEN];
+        snprintf(willTopic, MAX_LEN, "%s/%s", g_gateway_conf.shardTopic, g_gateway_conf.instanceId);
+        snprintf(will, MAX_LEN, "{\"instance\":\"%s\",\"alive\":false}", g_gateway_conf.instanceId);
+        amqtt_set_will(&g_gateway_client, willTopic, will, 1);
+    }
+    amqtt_set_subscriptions(&g_gateway_client, topics, count, NULL, 
+        connection_lost, msg_arrived);
+    amqtt_connect(&g_gateway_client);
+    if (strlen(g_gateway_conf.shardTopic) > 0)
+    {
+        // queued until connected
+        announce_shard_member(1);
+    }
+
+    // connected or not, the client keeps trying to connect from now on
+    g_gateway_connected = 1;
+    pthread_mutex_unlock(&g_gateway_mutex);
+}
+
+void reschedule_policy(PollWorker* worker, SlavePolicy* policy)
+{
+    // recaculate the next run time, against the absolute deadline so that
+    // the I/O latency does not accumulate. if we are more than one interval
+    // late, skip the missed runs instead of bursting
+    policy->shedFactor = shed_factor(policy);
+    long long interval = (long long)policy_interval(policy) * policy->shedFactor;
+    policy->nextRun += interval;
+    long long now = monotonic_ms();
+    if (policy->nextRun <= now)
+    {
+        policy->nextRun += ((now - policy->nextRun) / interval + 1) * interval;
+    }
+
+    // re-schedule, in order of nextRun
+    schedule_slave_policy(worker, policy);
+}
+
+// whether the payload cur of the policy differs from last by more than band
+// in a register, the payload of registers has 4 hex chars per register
+int payload_differs(SlavePolicy* policy, const char* cur, const char* last, int band)
+{
+    if (band <= 0 || policy->functioncode == MODBUS_FC_READ_COILS 
+        || policy->functioncode == MODBUS_FC_READ_DISCRETE_INPUTS)
+    {
+        return strcmp(cur, last) != 0;
+    }
+
+    int len = strlen(cur);
+    if (len != strlen(last))
+    {
+        return 1;
+    }
+    int i = 0;
+    for (i = 0; i + 3 < len; i += 4)
+    {
+        int a = (char2dec(cur[i]) << 12) | (char2dec(cur[i + 1]) << 8) 
+            | (char2dec(cur[i + 2]) << 4) | char2dec(cur[i + 3]);
+        int b = (char2dec(last[i]) << 12) | (char2dec(last[i + 1]) << 8) 
+            | (char2dec(last[i + 2]) << 4) | char2dec(last[i + 3]);
+        if (abs(a - b) > band)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// whether the data of the policy differs from the last published by more
+// than the deadband
+int payload_changed(SlavePolicy* policy)
+{
+    return payload_differs(policy, policy->payload, policy->lastPayload, policy->deadband);
+}
+
+// adaptive sampling: a sample changed beyond changeThreshold from the one
+// before halves the interval of the policy, down to minIntervalMs, while its
+// bus has room for it, and a stable one relaxes it by a quarter up to
+// maxIntervalMs. the bus has room while neither it nor the channel is shed and
+// it missed at most half the overload threshold in its last window, so the
+// adaptive policies only take the spare time of the bus and give it back
+// first. only the worker of the bus calls this, after the policy is rescheduled
+void adapt_policy_interval(PollWorker* worker, SlavePolicy* policy)
+{
+    if (policy->adaptiveMs <= 0 || policy->payload[0] == 0 || in_scan_group(policy))
+    {
+        return;
+    }
+    int changed = policy->prevPayload[0] != 0 
+        && payload_differs(policy, policy->payload, policy->prevPayload, policy->changeThreshold);
+    strcpy(policy->prevPayload, policy->payload);
+    int room = shed_level(policy) == 0 && (policy->bus < 0 
+        || g_bus_workers[policy->bus].missPercent <= OVERLOAD_MISS_PERCENT / 2);
+    int old = policy->adaptiveMs;
+    if (changed && room)
+    {
+        policy->adaptiveMs = old / 2 > policy->minIntervalMs ? old / 2 : policy->minIntervalMs;
+    }
+    else
+    {
+        int relaxed = old + old * ADAPTIVE_RELAX_PERCENT / 100 + 1;
+        policy->adaptiveMs = relaxed < policy->maxIntervalMs ? relaxed : policy->maxIntervalMs;
+    }
+    if (policy->adaptiveMs >= old)
+    {
+        return;
+    }
+    // it's rescheduled for the old interval already, the next sample of a
+    // change is taken sooner
+    long long now = monotonic_ms();
+    sched_remove(&worker->schedule, policy);
+    policy->nextRun -= (long long)(old - policy->adaptiveMs) * policy->shedFactor;
+    if (policy->nextRun < now)
+    {
+        policy->nextRun = now;
+    }
+    schedule_slave_policy(worker, policy);
+}
+
+// report by exception: skip the data which doesn't change (beyond
+// the deadband), unless it has been silent for maxSilence
+int should_publish(SlavePolicy* policy, long long now)
+{
+    if (!policy->onChange || policy->lastPayload[0] == 0)
+    {
+        return 1;
+    }
+    if (policy->maxSilence > 0 && now - policy->lastPublish >= policy->maxSilence)
+    {
+        return 1;
+    }
+    return payload_changed(policy);
+}
+
+// the sample of a delta policy as it's published: a keyframe carries all the
+// registers, a delta only the ones changed since the sample before
+typedef struct
+{
+    unsigned int seq;
+    int keyframe;
+    int count;                                  // the registers changed
+    uint8_t map[REGDELTA_MAP_BYTES(MODBUS_MAX_READ_REGISTERS)];
+    uint16_t words[MODBUS_MAX_READ_REGISTERS];  // the registers changed, in order
+    uint16_t regs[MODBUS_MAX_READ_REGISTERS];   // the sample, the image once published
+} SampleDelta;
+
+// the sample of a delta policy against the registers last published. it's a
+// keyframe, the whole sample, for the first sample, once keyframeMs passed
+// since the last keyframe, and when the delta would be no smaller. return 0,
+// -1 if the payload is not the registers of the policy
+int diff_sample(SlavePolicy* policy, char* raw, long long now, SampleDelta* delta)
+{
+    int n = policy->length;
+    if ((int)strlen(raw) != n * 4 
+        || hex_decode_u16(delta->regs, MODBUS_MAX_READ_REGISTERS, raw, n * 4) != n)
+    {
+        return -1;
+    }
+    // 0 is before the first sample, a wrapped seq skips it
+    delta->seq = policy->deltaSeq + 1 != 0 ? policy->deltaSeq + 1 : 1;
+    delta->keyframe = policy->deltaSeq == 0 || now - policy->lastKeyframe >= policy->keyframeMs;
+    delta->count = 0;
+    if (!delta->keyframe)
+    {
+        delta->count = regdelta_diff(delta->map, delta->words, policy->deltaImage, delta->regs, n);
+        delta->keyframe = REGDELTA_MAP_BYTES(n) + 2 * delta->count >= 2 * n;
+    }
+    return 0;
+}
+
+// the sample is published, the next delta is against it
+void commit_sample(SlavePolicy* policy, SampleDelta* delta, long long now)
+{
+    memcpy(policy->deltaImage, delta->regs, policy->length * sizeof(uint16_t));
+    policy->deltaSeq = delta->seq;
+    if (delta->keyframe)
+    {
+        policy->lastKeyframe = now;
+    }
+}
+
+// decode the fields of the policy from the hex of the registers into values,
+// which holds fieldNum doubles. return 0 on success, -1 if raw doesn't match
+int decode_policy_fields(SlavePolicy* policy, char* raw, double* values)
+{
+    uint16_t regs[MODBUS_MAX_READ_REGISTERS];
+    uint16_t swapped[MODBUS_MAX_READ_REGISTERS];
+    if ((int)strlen(raw) != policy->length * 4 || policy->length > MODBUS_MAX_READ_REGISTERS)
+    {
+        return -1;
+    }
+    int n = char2uint16(regs, MODBUS_MAX_READ_REGISTERS, raw);
+    if (n < 0)
+    {
+        return -1;
+    }
+    int i = 0;
+    for (i = 0; i < policy->fieldNum; i++)
+    {
+        if (policy->fields[i].swapBytes)
+        {
+            // swapped once for all the fields
+            memcpy(swapped, regs, n * sizeof(uint16_t));
+            swap_register_bytes(swapped, n);
+            break;
+        }
+    }
+    for (i = 0; i < policy->fieldNum; i++)
+    {
+        values[i] = decode_field(&policy->fields[i], regs, swapped);
+    }
+    return 0;
+}
+
+// the fields of one sample, shared by the single and the batched message
+void add_decoded_values(JsonWriter* w, SlavePolicy* policy, char* raw)
+{
+    double* values = (double*) malloc(policy->fieldNum * sizeof(double));
+    if (values == NULL || decode_policy_fields(policy, raw, values) != 0)
+    {
+        free(values);
+        return;
+    }
+    jw_begin_object(w, "values");
+    int i = 0;
+    for (i = 0; i < policy->fieldNum; i++)
+    {
+        jw_double(w, policy->fields[i].name, values[i]);
+    }
+    jw_end_object(w);
+    free(values);
+}
+
+// pack the bits of the payload, a byte per bit as hex, into packed which must
+// hold MODBUS_MAX_READ_BITS / 8 bytes. return the number of bytes, -1 if invalid
+int pack_payload_bits(const char* raw, uint8_t* packed)
+{
+    uint8_t bits[MODBUS_MAX_READ_BITS];
+    int nb = hex_decode(bits, MODBUS_MAX_READ_BITS, raw, strlen(raw));
+    return nb < 0 ? -1 : pack_bits(packed, bits, nb);
+}
+
+// the gatewayid, the trantable and the request of the policy, the modbus
+// object is left open for the response
+void add_request_fields(JsonWriter* w, SlavePolicy* policy)
+{
+    if (policy->envelope.text != NULL)
+    {
+        jw_fragment(w, &policy->envelope);
+        return;
+    }
+    jw_string(w, "gatewayid", policy->gatewayid);
+    jw_string(w, "trantable", policy->trantable);
+    jw_begin_object(w, "modbus");
+    jw_begin_object(w, "request");
+    jw_int(w, "functioncode", policy->functioncode);
+    jw_int(w, "slaveid", policy->slaveid);
+    jw_int(w, "startAddr", policy->start_addr);
+    jw_int(w, "length", policy->length);
+    jw_end_object(w);
+}
+
+// at_ms is in ms since epoch, written in the timestampFormat of the gateway
+void add_timestamp(JsonWriter* w, long long at_ms)
+{
+    if (g_gateway_conf.timestampFormat == TIMESTAMP_EPOCH_MS)
+    {
+        jw_int(w, "timestamp", at_ms);
+    }
+    else
+    {
+        char timestamp[TIMEFMT_SIZE];
+        timefmt_format(timestamp, at_ms, g_gateway_conf.timestampFormat == TIMESTAMP_ISO8601_MS
+            ? TIMEFMT_ISO8601_MS : TIMEFMT_LOCAL);
+        jw_string(w, "timestamp", timestamp);
+    }
+}
+
+// the sample is read at the time at_ms, which is in ms since epoch. delta is
+// the sample of a delta policy, NULL to publish the registers as they are
+void add_sample_fields(JsonWriter* w, SlavePolicy* policy, char* raw, long long at_ms, 
+    SampleDelta* delta)
+{
+    // the id of the sample in the spans of the trace, see trace.h
+    if (policy->traceId != 0)
+    {
+        jw_int(w, "traceId", (long long)policy->traceId);
+    }
+    add_request_fields(w, policy);
+    uint8_t packed[MODBUS_MAX_READ_BITS / 8];
+    int bytes = policy->bitEncoding != BITS_AS_BYTES ? pack_payload_bits(raw, packed) : -1;
+    if (bytes >= 0)
+    {
+        // the encoding tells the packed bits from the bytes of the older gateways
+        char text[BASE64_LEN(MODBUS_MAX_READ_BITS / 8) + 1];
+        if (policy->bitEncoding == BITS_PACKED_HEX)
+        {
+            hex_encode(text, packed, bytes);
+        }
+        else
+        {
+            base64_encode(text, packed, bytes);
+        }
+        jw_string(w, "response", text);
+        jw_string(w, "encoding", policy->bitEncoding == BITS_PACKED_HEX ? "hex" : "base64");
+    }
+    else if (delta != NULL && !delta->keyframe)
+    {
+        // the changes apply to the sample seq - 1, the registers of
+        // the bits set in changeMap take the words of changes in order
+        char text[MODBUS_MAX_READ_REGISTERS * 4 + 1];
+        jw_int(w, "seq", delta->seq);
+        hex_encode(text, delta->map, REGDELTA_MAP_BYTES(policy->length));
+        jw_string(w, "changeMap", text);
+        hex_encode_u16(text, delta->words, delta->count);
+        jw_string(w, "changes", text);
+    }
+    else
+    {
+        if (delta != NULL)
+        {
+            jw_int(w, "seq", delta->seq);
+        }
+        jw_string(w, "response", raw);
+    }
+    jw_end_object(w);
+    if (policy->fieldNum > 0)
+    {
+        add_decoded_values(w, policy, raw);
+    }
+    add_timestamp(w, at_ms);
+}
+
+// pack the sample into policy->message, which grows if needed. the version
+// is held by the batch for the batched samples. return the length, 0 on failure
+int pack_json_sample(SlavePolicy* policy, char* raw, int with_version, SampleDelta* delta)
+{
+    JsonWriter w;
+    jw_init(&w, policy->message, policy->messageLen);
+    jw_begin_object(&w, NULL);
+    if (with_version)
+    {
+        jw_int(&w, "bdModbusVer", 1);
+    }
+    add_sample_fields(&w, policy, raw, timefmt_now_ms(), delta);
+    jw_end_object(&w);
+    policy->message = w.buf;
+    policy->messageLen = w.cap;
+    return jw_ok(&w) ? w.len : 0;
+}
+
+void put_be(char* dest, unsigned long long value, int bytes)
+{
+    int i = 0;
+    for (i = bytes - 1; i >= 0; i--)
+    {
+        dest[i] = (char)(value & 0xff);
+        value >>= 8;
+    }
+}
+
+// pack one sample into dest as a binary frame, return its length, 0 if dest
+// is too small. the numbers are big endian, the frame is:
+//   0xBD, version 3, functioncode, slaveid, startAddr(2), length(2),
+//   timestamp in ms since epoch(8), gatewayid length(1), gatewayid,
+//   trantable length(1), trantable, response length(2), response bytes.
+// the frames are self delimited, a batch is the frames one after another.
+// with the bits packed(bitEncoding), the frame is version 4 and the response
+// is the bitset, 8 bits per byte. the sample of a delta policy(delta) is a
+// version 5 frame, with seq(4) and flags(1) after the trantable: flags 0 is a
+// keyframe, the response is all the registers, and flags 1 a delta, the
+// response is the bitmap of the registers changed since the sample seq - 1
+// and their words. the sample is read at epoch_ms
+int pack_binary_sample(SlavePolicy* policy, char* raw, long long epoch_ms, char* dest, int len,
+    SampleDelta* delta)
+{
+    int idLen = strlen(policy->gatewayid);
+    int tableLen = strlen(policy->trantable);
+    uint8_t packed[MODBUS_MAX_READ_BITS / 8];
+    int packedLen = policy->bitEncoding != BITS_AS_BYTES ? pack_payload_bits(raw, packed) : -1;
+    int dataLen = packedLen >= 0 ? packedLen : (int)strlen(raw) / 2;
+    int mapLen = REGDELTA_MAP_BYTES(policy->length);
+    if (delta != NULL && !delta->keyframe)
+    {
+        dataLen = mapLen + 2 * delta->count;
+    }
+    int size = 16 + 1 + idLen + 1 + tableLen + (delta != NULL ? 5 : 0) + 2 + dataLen;
+    if (size > len || idLen > 0xff || tableLen > 0xff)
+    {
+        return 0;
+    }
+
+    char* p = dest;
+    *p++ = (char)0xbd;
+    *p++ = delta != NULL ? 5 : packedLen >= 0 ? 4 : 3;
+    *p++ = policy->functioncode;
+    *p++ = (char)policy->slaveid;
+    put_be(p, policy->start_addr, 2);
+    put_be(p + 2, policy->length, 2);
+    put_be(p + 4, epoch_ms, 8);
+    p += 12;
+    *p++ = (char)idLen;
+    memcpy(p, policy->gatewayid, idLen);
+    p += idLen;
+    *p++ = (char)tableLen;
+    memcpy(p, policy->trantable, tableLen);
+    p += tableLen;
+    if (delta != NULL)
+    {
+        put_be(p, delta->seq, 4);
+        p[4] = delta->keyframe ? 0 : 1;
+        p += 5;
+    }
+    put_be(p, dataLen, 2);
+    p += 2;
+    // the response is kept as hex text, the frame carries the raw bytes
+    if (delta != NULL && !delta->keyframe)
+    {
+        memcpy(p, delta->map, mapLen);
+        p += mapLen;
+        int i = 0;
+        for (i = 0; i < delta->count; i++)
+        {
+            put_be(p + 2 * i, delta->words[i], 2);
+        }
+    }
+    else if (packedLen >= 0)
+    {
+        memcpy(p, packed, packedLen);
+    }
+    else
+    {
+        char2uint8((uint8_t*)p, dataLen, raw);
+    }
+    return size;
+}
+
+// traceId is the sample traced, or 0
+int publish_to_channel(int pos, char* topic, char* msg, int len, unsigned long long traceId)
+{
+    // queued, the sampling never waits for the broker
+    long long start = traceId != 0 ? trace_now_ns() : 0;
+    int rc = amqtt_publish_traced(g_shared_mqtt_client[pos], topic, msg, len, 0, traceId);
+    if (rc != 0)
+    {
+        printf("mqtt client at pos %d failed to queue message\n", pos);
+    }
+    note_publish_pressure(pos);
+    if (traceId != 0)
+    {
+        trace_span("enqueue", traceId, start, trace_now_ns());
+    }
+    return rc;
+}
+
+// upload the blocks of the fields of the policy as one frame, and start new
+// blocks. the numbers are big endian, the frame is:
+//   0xBC, version 1, kind 1(modbus), functioncode, slaveid, startAddr(2),
+//   length(2), gatewayid length(1), gatewayid, trantable length(1),
+//   trantable, field count(1), then for every field: name length(1), name,
+//   sample count(2), block length(2), block(see tsblock.h)
+// it goes out as it is, the blocks are already a batch
+void publish_history(SlavePolicy* policy)
+{
+    if (policy->history == NULL || policy->history[0].count == 0)
+    {
+        return;
+    }
+    int idLen = strlen(policy->gatewayid);
+    int tableLen = strlen(policy->trantable);
+    int size = 11 + idLen + 1 + tableLen;
+    int i = 0;
+    for (i = 0; i < policy->fieldNum; i++)
+    {
+        size += 1 + strlen(policy->fields[i].name) + 4 + tsblock_bytes(&policy->history[i]);
+    }
+    char* frame = (char*) malloc(size);
+    if (frame != NULL && policy->mqttClient != -1)
+    {
+        char* p = frame;
+        *p++ = (char)0xbc;
+        *p++ = 1;
+        *p++ = 1;
+        *p++ = policy->functioncode;
+        *p++ = (char)policy->slaveid;
+        put_be(p, policy->start_addr, 2);
+        put_be(p + 2, policy->length, 2);
+        p += 4;
+        *p++ = (char)idLen;
+        memcpy(p, policy->gatewayid, idLen);
+        p += idLen;
+        *p++ = (char)tableLen;
+        memcpy(p, policy->trantable, tableLen);
+        p += tableLen;
+        *p++ = (char)policy->fieldNum;
+        for (i = 0; i < policy->fieldNum; i++)
+        {
+            int nameLen = strlen(policy->fields[i].name);
+            *p++ = (char)nameLen;
+            memcpy(p, policy->fields[i].name, nameLen);
+            p += nameLen;
+            p += tsblock_pack(&policy->history[i], p, size - (p - frame));
+        }
+        publish_to_channel(policy->mqttClient, policy->pubChannel->topic, frame, p - frame, 0);
+    }
+    else
+    {
+        printf("failed to upload the history of slaveid=%d, %d samples dropped\n",
+            policy->slaveid, policy->history[0].count);
+    }
+    free(frame);
+    for (i = 0; i < policy->fieldNum; i++)
+    {
+        tsblock_reset(&policy->history[i]);
+    }
+}
+
+// keep the fields of the sample in the blocks of the policy, the blocks are
+// uploaded once historyMs has passed since their first sample, or one is full
+void record_history(SlavePolicy* policy, char* raw, long long now)
+{
+    int i = 0;
+    if (policy->history == NULL)
+    {
+        policy->history = (TsBlock*) calloc(policy->fieldNum, sizeof(TsBlock));
+        for (i = 0; policy->history != NULL && i < policy->fieldNum; i++)
+        {
+            if (tsblock_init(&policy->history[i], HISTORY_BLOCK_BYTES) != 0)
+            {
+                while (--i >= 0)
+                {
+                    tsblock_destroy(&policy->history[i]);
+                }
+                free(policy->history);
+                policy->history = NULL;
+            }
+        }
+        if (policy->history == NULL)
+        {
+            printf("out of memory while keeping the history of slaveid=%d\n", policy->slaveid);
+            return;
+        }
+    }
+    double values[MODBUS_MAX_READ_REGISTERS];
+    if (decode_policy_fields(policy, raw, values) != 0)
+    {
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    long long epoch_ms = (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    // the fields always hold the same samples, all of them are uploaded
+    // once any is full
+    for (i = 0; i < policy->fieldNum; i++)
+    {
+        if (tsblock_full(&policy->history[i]))
+        {
+            publish_history(policy);
+            break;
+        }
+    }
+    for (i = 0; i < policy->fieldNum; i++)
+    {
+        tsblock_append(&policy->history[i], epoch_ms, values[i]);
+    }
+    if (policy->history[0].count == 1)
+    {
+        policy->historyStart = now;
+    }
+    if (now - policy->historyStart >= policy->historyMs)
+    {
+        publish_history(policy);
+    }
+}
+
+void release_aggregates(SlavePolicy* policy)
+{
+    int i = 0;
+    for (i = 0; policy->aggregates != NULL && i < policy->fieldNum; i++)
+    {
+        agg_destroy(&policy->aggregates[i]);
+    }
+    free(policy->aggregates);
+    policy->aggregates = NULL;
+}
+
+// publish the summaries of the windows of the fields ending at the monotonic
+// time end, like
+// {"bdModbusVer": 1, "gatewayid": ..., "trantable": ..., "modbus": {"request": {...}},
+//  "windowMs": 60000, "aggregates": {"temp": {"count": 60, "min": 20.5, "max": 21,
+//  "avg": 20.7, "last": 20.9}}, "timestamp": ...}
+// it goes out as it is, a message a window is already few
+void publish_aggregates(SlavePolicy* policy, long long end)
+{
+    AggStats stats;
+    agg_summary(&policy->aggregates[0], &stats);
+    if (stats.count == 0 || policy->mqttClient == -1)
+    {
+        return;
+    }
+    JsonWriter w;
+    jw_init(&w, policy->message, policy->messageLen);
+    jw_begin_object(&w, NULL);
+    jw_int(&w, "bdModbusVer", 1);
+    add_request_fields(&w, policy);
+    jw_end_object(&w);
+    jw_int(&w, "windowMs", (long long)policy->aggregateHopMs * policy->aggregatePanes);
+    jw_begin_object(&w, "aggregates");
+    int i = 0;
+    for (i = 0; i < policy->fieldNum; i++)
+    {
+        // the fields are decoded together, they all have the same samples
+        agg_summary(&policy->aggregates[i], &stats);
+        jw_begin_object(&w, policy->fields[i].name);
+        jw_int(&w, "count", stats.count);
+        jw_double(&w, "min", stats.min);
+        jw_double(&w, "max", stats.max);
+        jw_double(&w, "avg", stats.sum / stats.count);
+        jw_double(&w, "last", stats.last);
+        jw_end_object(&w);
+    }
+    jw_end_object(&w);
+    add_timestamp(&w, timefmt_now_ms() - (monotonic_ms() - end));
+    jw_end_object(&w);
+    policy->message = w.buf;
+    policy->messageLen = w.cap;
+    if (!jw_ok(&w) || publish_to_channel(policy->mqttClient, policy->pubChannel->topic, 
+        policy->message, w.len, 0) != 0)
+    {
+        printf("failed to publish the summaries of slaveid=%d\n", policy->slaveid);
+    }
+}
+
+// add the fields of the sample to the windows of the policy, the summaries
+// go out with the first sample after each hop. return 1 if the sample is to
+// be published as it is, because a field is out of its alarm limits or just
+// came back in, 0 if it's only kept in the windows
+int aggregate_sample(SlavePolicy* policy, char* raw, long long now)
+{
+    int i = 0;
+    if (policy->aggregates == NULL)
+    {
+        policy->aggregates = (AggWindow*) calloc(policy->fieldNum, sizeof(AggWindow));
+        for (i = 0; policy->aggregates != NULL && i < policy->fieldNum; i++)
+        {
+            if (agg_init(&policy->aggregates[i], policy->aggregatePanes) != 0)
+            {
+                release_aggregates(policy);
+            }
+        }
+        if (policy->aggregates == NULL)
+        {
+            printf("out of memory while aggregating the fields of slaveid=%d\n", policy->slaveid);
+            return 1;
+        }
+        policy->aggregateStart = now;
+    }
+    double values[MODBUS_MAX_READ_REGISTERS];
+    if (decode_policy_fields(policy, raw, values) != 0)
+    {
+        return 0;
+    }
+    long long hops = (now - policy->aggregateStart) / policy->aggregateHopMs;
+    if (hops > 0)
+    {
+        // the window ended with the hop of its last sample
+        publish_aggregates(policy, policy->aggregateStart + policy->aggregateHopMs);
+        policy->aggregateStart += hops * policy->aggregateHopMs;
+        // the hops without samples, e.g. while the slave is down, are empty
+        for (i = 0; i < policy->fieldNum; i++)
+        {
+            long long slid = 0;
+            for (slid = 0; slid < hops && slid < policy->aggregatePanes; slid++)
+            {
+                agg_slide(&policy->aggregates[i]);
+            }
+        }
+    }
+    int alarm = 0;
+    for (i = 0; i < policy->fieldNum; i++)
+    {
+        agg_add(&policy->aggregates[i], values[i]);
+        alarm |= values[i] < policy->fields[i].alarmLow || values[i] > policy->fields[i].alarmHigh;
+    }
+    int publish = alarm || policy->aggregateAlarm;
+    policy->aggregateAlarm = alarm;
+    return publish;
 }
 
-void cleanup_data()
+// publish the samples in the batch of the channel at pos as one message, like
+// {"bdModbusVer": 2, "samples": [{...}, {...}]}.
+// must be called with the batch lock held
+void flush_batch(int pos)
 {
-    SlavePolicy* sp = g_slave_header.next;
-    g_slave_header.next = NULL;
-    SlavePolicy* next_policy = NULL;
-    while (sp != NULL)
+    PubBatch* batch = g_batches[pos];
+    if (batch->count == 0)
     {
-        next_policy = sp->next;
-        destroy_slave_policy(sp);
-        sp = next_policy;
+        return;
     }
-    cleanup_shared_data();
+    if (g_shared_channel[pos] != NULL && g_shared_channel[pos]->format == PAYLOAD_JSON)
+    {
+        batch->buff[batch->len++] = ']';
+        batch->buff[batch->len++] = '}';
+        batch->buff[batch->len] = 0;
+    }
+    if (g_shared_mqtt_client[pos] != NULL && g_shared_channel[pos] != NULL)
+    {
+        publish_to_channel(pos, g_shared_channel[pos]->topic, batch->buff, batch->len, batch->traceId);
+    }
+    batch->count = 0;
+    batch->len = 0;
 }
 
-int load_slave_policy_from_cache(SlavePolicy* header)
+// flush the batches that have lingered long enough
+void flush_expired_batches()
 {
-    // in case gateway can't retrieve SlavePolicy from cloud immediately,
-    // we should cache the polices in a local file. Whenever gateway startup,
-    // it should load polices form this local cache first, and in the mean time
-    // listen any policy change pushed from cloud.
-    log_debug("enter loadSlavePolicy");
-    int rc = -1;
-    // anyway we will clear the flag that need reload policy
-    rc = pthread_mutex_lock(&g_policy_update_lock);
-
-    g_policy_updated = 0;
+    if (g_gateway_conf.batchMaxCount <= 1)
+    {
+        return;
+    }
+    long long now = monotonic_ms();
+    int i = 0;
+    for (i = 0; i < g_channel_num; i++)
+    {
+        PubBatch* batch = g_batches[i];
+        if (batch->count == 0)
+        {
+            continue;
+        }
+        pthread_mutex_lock(&batch->lock);
+        if (batch->count > 0 && now - batch->firstSample >= g_gateway_conf.batchLingerMs)
+        {
+            flush_batch(i);
+        }
+        pthread_mutex_unlock(&batch->lock);
+    }
+}
 
-    char* content = NULL;
+void flush_all_batches()
+{
+    int i = 0;
+    for (i = 0; i < g_channel_num; i++)
+    {
+        pthread_mutex_lock(&g_batches[i]->lock);
+        flush_batch(i);
+        pthread_mutex_unlock(&g_batches[i]->lock);
+    }
+}
 
-    long filesize = read_file_as_string(POLICY_CACHE, &content);
-    if (filesize <= 0)
+// add the sample(policy->message, sample_len) into the batch of its channel,
+// the batch is flushed when it reaches the max count or max bytes
+void append_to_batch(SlavePolicy* policy, int sample_len)
+{
+    // the binary frames are simply concatenated
+    int binary = policy->pubChannel->format == PAYLOAD_BINARY;
+    const char* head = binary ? "" : "{\"bdModbusVer\":2,\"samples\":[";
+    int head_len = strlen(head);
+    int pos = policy->mqttClient;
+    PubBatch* batch = g_batches[pos];
+    long long start = policy->traceId != 0 ? trace_now_ns() : 0;
+    pthread_mutex_lock(&batch->lock);
+    if (batch->buff == NULL)
     {
-        printf("failed to open policy cache file %s, skipping policy cache loading\n",
-                 POLICY_CACHE);
-        rc = pthread_mutex_unlock(&g_policy_update_lock);
-        return 0;
+        batch->buff = (char*) malloc(g_gateway_conf.batchMaxBytes + 3);
     }
-    if (content == NULL)
+    // room for the separator and the closing "]}"
+    if (batch->count > 0 && batch->len + 1 + sample_len > g_gateway_conf.batchMaxBytes)
     {
-        return 0;
+        flush_batch(pos);
     }
-
-    rc = pthread_mutex_unlock(&g_policy_update_lock);
-    cJSON* fileroot = cJSON_Parse(content);
-    if (fileroot == NULL)
+    if (batch->count == 0)
     {
-        printf("invalid config detected from cache file %s, skipping policy cache loading\n", 
-                POLICY_CACHE);
-        free(content);
-        return 0;
+        if (head_len + sample_len > g_gateway_conf.batchMaxBytes)
+        {
+            // too large to be batched at all
+            pthread_mutex_unlock(&batch->lock);
+            printf("sample of slaveid=%d is larger than batchMaxBytes, dropped\n", 
+                policy->slaveid);
+            return;
+        }
+        memcpy(batch->buff, head, head_len);
+        batch->len = head_len;
+        batch->firstSample = monotonic_ms();
+        // the message is traced as its first sample
+        batch->traceId = policy->traceId;
     }
-    int num = cJSON_GetArraySize(fileroot);
-    if (num < 0)
+    else if (!binary)
     {
-        printf("no slave policy is loaded from cache file %s\n", POLICY_CACHE);
-        free(content);
-        return 1;
+        batch->buff[batch->len++] = ',';
     }
+    memcpy(batch->buff + batch->len, policy->message, sample_len);
+    batch->len += sample_len;
+    batch->count++;
+    if (policy->traceId != 0)
+    {
+        trace_span("batch", policy->traceId, start, trace_now_ns());
+    }
+    if (batch->count >= g_gateway_conf.batchMaxCount)
+    {
+        flush_batch(pos);
+    }
+    pthread_mutex_unlock(&batch->lock);
+}
 
-    rc = pthread_mutex_lock(&g_policy_lock);
-
-    // clear all the existing data 
-    cleanup_data();
+void publish_policy_data(SlavePolicy* policy)
+{
+    char* payload = policy->payload;
+    long long now = monotonic_ms();
+    if (policy->aggregateHopMs > 0 && strlen(payload) > 0 
+        && aggregate_sample(policy, payload, now) == 0)
+    {
+        return;
+    }
+    if (policy->historyMs > 0 && policy->fieldNum > 0)
+    {
+        if (strlen(payload) > 0)
+        {
+            record_history(policy, payload, now);
+        }
+        return;
+    }
+    if (strlen(payload) > 0 && !should_publish(policy, now))
+    {
+        return;
+    }
+    if (policy->mqttClient != -1 && strlen(payload) > 0)
+    {
+        int rc = 0;
+        int batched = g_gateway_conf.batchMaxCount > 1;
+        int msg_len = 0;
+        long long encodeStart = policy->traceId != 0 ? trace_now_ns() : 0;
+        SampleDelta sample;
+        SampleDelta* delta = policy->delta && diff_sample(policy, payload, now, &sample) == 0 
+            ? &sample : NULL;
+        if (policy->pubChannel->format == PAYLOAD_BINARY)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            msg_len = pack_binary_sample(policy, payload, 
+                (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000, policy->message, policy->messageLen,
+                delta);
+        }
+        else
+        {
+            msg_len = pack_json_sample(policy, payload, !batched, delta);
+        }
+        if (msg_len == 0)
+        {
+            printf("failed to pack the message of slaveid=%d\n", policy->slaveid);
+            return;
+        }
+        if (policy->traceId != 0)
+        {
+            trace_span("encode", policy->traceId, encodeStart, trace_now_ns());
+        }
+        if (batched)
+        {
+            // the sample counts as published once it's in the batch
+            append_to_batch(policy, msg_len);
+        }
+        else
+        {
+            rc = publish_to_channel(policy->mqttClient, policy->pubChannel->topic, 
+                policy->message, msg_len, policy->traceId);
+        }
+        if (rc == 0)
+        {
+            log_debug(payload);
+            if (policy->onChange)
+            {
+                strcpy(policy->lastPayload, payload);
+            }
+            if (delta != NULL)
+            {
+                commit_sample(policy, delta, now);
+            }
+            policy->lastPublish = now;
+        }
+    }
+    else 
+    {
+        log_debug("failed to init mqtt client");
+    }
+}
 
+// a policy failing on a working bus, e.g. reading an illegal data address or
+// a dead slave, waits twice as long after every failure in a row, so that it
+// doesn't take the bus from the other policies. the first success resets it
+void backoff_policy(PollWorker* worker, SlavePolicy* policy)
+{
+    long long interval = (long long)policy_interval(policy) * policy->shedFactor;
+    long long cap = interval > POLICY_BACKOFF_MAX_MS ? interval : POLICY_BACKOFF_MAX_MS;
+    long long delay = interval;
     int i = 0;
-    for(i = 0; i < num; i++)
+    for (i = 0; i < policy->errorStreak && delay < cap; i++)
     {
-        cJSON* root = cJSON_GetArrayItem(fileroot, i);
-        SlavePolicy* policy = json_to_slave_poilicy(root);
-        init_mqtt_client_for_policy(policy);
-        init_modbus_context(policy);
-
-        // add the policy into list
-        policy->next = g_slave_header.next;
-        g_slave_header.next = policy;
+        delay *= 2;
     }
-    rc = pthread_mutex_unlock(&g_policy_lock);
-
-    cJSON_Delete(fileroot);
-    free(content);
+    if (delay > cap)
+    {
+        delay = cap;
+    }
+    if (delay <= interval)
+    {
+        return;
+    }
+    // it's rescheduled for one interval already
+    sched_remove(&worker->schedule, policy);
+    policy->nextRun += delay - interval;
+    schedule_slave_policy(worker, policy);
 }
 
-void insert_slave_policy(SlavePolicy* policy)
+// publish the samples of the scan group of leader as one message, every
+// sample with the time at the group is read, like
+// {"bdModbusVer": 2, "scanGroup": "...", "acquiredUs": ..., "samples": [{...}, {...}]}
+// or the binary frames one after another. the policies failed are left out
+void publish_scan_group(SlavePolicy* leader, const struct timespec* at)
 {
-    // insert a new slave policy into the list, ordered by the nextRun asc
-    // so that the head of the list is always the next slave need to execute
-    // note, this function could be involked in a different thread, make sure 
-    // add lock before modifying the list
-
-    if (policy == NULL)
+    if (leader->mqttClient == -1)
     {
+        log_debug("failed to init mqtt client");
         return;
     }
-
-    // we already have the lock here.
-    SlavePolicy* itr = &g_slave_header;
-    while (itr->next != NULL && itr->next->nextRun < policy->nextRun)
+    SlavePolicy* p = NULL;
+    int len = 0;
+    long long epoch_ms = (long long)at->tv_sec * 1000 + at->tv_nsec / 1000000;
+    long long encodeStart = leader->traceId != 0 ? trace_now_ns() : 0;
+    if (leader->pubChannel->format == PAYLOAD_BINARY)
+    {
+        // every frame fits in the message buffer of its policy
+        int cap = 0;
+        for (p = leader; p != NULL; p = p->scanNext)
+        {
+            cap += p->messageLen;
+        }
+        if (cap > leader->messageLen)
+        {
+            char* message = (char*) realloc(leader->message, cap);
+            if (message == NULL)
+            {
+                return;
+            }
+            leader->message = message;
+            leader->messageLen = cap;
+        }
+        for (p = leader; p != NULL; p = p->scanNext)
+        {
+            if (p->payload[0] != 0)
+            {
+                len += pack_binary_sample(p, p->payload, epoch_ms, leader->message + len, 
+                    leader->messageLen - len, NULL);
+            }
+        }
+    }
+    else
     {
-        itr = itr->next;
+        JsonWriter w;
+        jw_init(&w, leader->message, leader->messageLen);
+        jw_begin_object(&w, NULL);
+        jw_int(&w, "bdModbusVer", 2);
+        jw_string(&w, "scanGroup", leader->scanGroup);
+        jw_int(&w, "acquiredUs", (long long)at->tv_sec * 1000000 + at->tv_nsec / 1000);
+        jw_begin_array(&w, "samples");
+        int samples = 0;
+        for (p = leader; p != NULL; p = p->scanNext)
+        {
+            if (p->payload[0] != 0)
+            {
+                jw_begin_object(&w, NULL);
+                add_sample_fields(&w, p, p->payload, epoch_ms, NULL);
+                jw_end_object(&w);
+                samples++;
+            }
+        }
+        jw_end_array(&w);
+        jw_end_object(&w);
+        leader->message = w.buf;
+        leader->messageLen = w.cap;
+        len = jw_ok(&w) && samples > 0 ? w.len : 0;
+    }
+    if (len == 0)
+    {
+        return;
+    }
+    if (leader->traceId != 0)
+    {
+        trace_span("encode", leader->traceId, encodeStart, trace_now_ns());
+    }
+    if (publish_to_channel(leader->mqttClient, leader->pubChannel->topic, leader->message, 
+            len, leader->traceId) == 0)
+    {
+        long long now = monotonic_ms();
+        for (p = leader; p != NULL; p = p->scanNext)
+        {
+            p->lastPublish = now;
+        }
     }
-    policy->next = itr->next;
-    itr->next = policy;
 }
 
-void delivered(void* context, MQTTClient_deliveryToken dt)
+// the points of the policy in the shared memory table, every decoded field,
+// or every bit of a coil or discrete input policy
+int shared_points_of_policy(SlavePolicy* policy)
 {
-    printf("Message with token value %d delivery confirmed\n", dt);
+    if (is_bit_function(policy->functioncode))
+    {
+        return policy->slaveid != 0 ? policy->length : 0;
+    }
+    return policy->fieldNum <= MODBUS_MAX_READ_REGISTERS ? policy->fieldNum : 0;
 }
 
-int msg_arrived(void* context, char* topicName, int topicLen, MQTTClient_message* message)
+// the name of point i of the policy, like 192.168.1.10:502/1/temperature
+// after the bus, the slaveid and the field, or 192.168.1.10:502/1/10017
+// after the modbus address of the bit
+void shared_point_name(SlavePolicy* policy, int i, char* name, int len)
 {
-    // sometime we receive strange message with topic name like "\300\005@\267"
-    // let's filter those message that with topic other than expected
-    if (message == NULL)
+    if (is_bit_function(policy->functioncode))
     {
-        return 1;
+        // coils are 00001 on, discrete inputs 10001 on
+        int base = policy->functioncode == 1 ? 1 : 10001;
+        snprintf(name, len, "%s/%d/%05d", policy->ip_com_addr, policy->slaveid,
+            base + policy->start_addr + i);
     }
-    if (strcmp(g_gateway_conf.topic, topicName) == 0) {
-        return handle_config_msg(context, topicName, topicLen, message);
-    } else if (strlen(g_gateway_conf.backControlTopic) > 0
-        && strcmp(g_gateway_conf.backControlTopic, topicName) == 0) {
-        return handle_back_control_msg(context, topicName, topicLen, message);
-    } else {
-        snprintf(g_buff, BUFF_LEN, 
-                "received unrelevant message in command topic, skipping it. topic=%s, payload=", 
-                topicName);
-        log_debug(g_buff);
-    
-        MQTTClient_freeMessage(&message);
-        MQTTClient_free(topicName);
+    else
+    {
+        snprintf(name, len, "%s/%d/%s", policy->ip_com_addr, policy->slaveid,
+            policy->fields[i].name);
+    }
+}
 
-        return 1;
+// lay out the points of the policies in the shared memory table, named by
+// shared_point_name. must be called with all the workers locked
+void layout_shared_points(SlavePolicy* policies)
+{
+    SlavePolicy* policy = NULL;
+    if (g_shared_points_started)
+    {
+        shmp_begin_layout(&g_shared_points);
+    }
+    int full = 0;
+    for (policy = policies; policy != NULL; policy = policy->next)
+    {
+        policy->sharedPoint = -1;
+        policy->sharedPointNum = 0;
+        int count = g_shared_points_started ? shared_points_of_policy(policy) : 0;
+        int i = 0;
+        for (i = 0; i < count && !full; i++)
+        {
+            char name[SHMP_NAME_LEN];
+            shared_point_name(policy, i, name, sizeof(name));
+            int point = shmp_add(&g_shared_points, name);
+            full = point < 0;
+            if (i == 0)
+            {
+                policy->sharedPoint = point;
+            }
+        }
+        if (full)
+        {
+            // the points of a policy are contiguous, none or all of them
+            policy->sharedPoint = -1;
+            printf("the shared memory table is full, the points of slaveid=%d are left out\n",
+                policy->slaveid);
+            continue;
+        }
+        policy->sharedPointNum = count;
+    }
+    if (g_shared_points_started)
+    {
+        shmp_end_layout(&g_shared_points);
     }
 }
 
-int handle_back_control_msg(void* context, char* topicName, int topicLen, MQTTClient_message* message) {
-    int i = 1;
-    char* payloadptr = NULL;
+// lay out the points of the policies in the shadow mirror, named as in the
+// shared memory table. the policies with none of their points mirrored are
+// left out. must be called with all the workers locked
+void layout_shadow_points(SlavePolicy* policies)
+{
+    SlavePolicy* policy = NULL;
+    shadow_mirror_begin_layout(g_shadow_mirror);
+    for (policy = policies; policy != NULL; policy = policy->next)
+    {
+        policy->shadowPoint = -1;
+        policy->shadowPointNum = 0;
+        int count = g_shadow_mirror != NULL ? shared_points_of_policy(policy) : 0;
+        char name[SHMP_NAME_LEN];
+        int mirrored = 0;
+        int i = 0;
+        for (i = 0; i < count && !mirrored; i++)
+        {
+            shared_point_name(policy, i, name, sizeof(name));
+            mirrored = shadow_mirror_has(g_shadow_mirror, name);
+        }
+        if (!mirrored)
+        {
+            continue;
+        }
+        // the points of a policy are contiguous
+        for (i = 0; i < count; i++)
+        {
+            shared_point_name(policy, i, name, sizeof(name));
+            int point = shadow_mirror_add(g_shadow_mirror, name);
+            if (point < 0)
+            {
+                break;
+            }
+            if (i == 0)
+            {
+                policy->shadowPoint = point;
+            }
+        }
+        policy->shadowPointNum = i == count ? count : 0;
+    }
+    shadow_mirror_end_layout(g_shadow_mirror);
+}
 
-    payloadptr = message->payload;
-    int buflen = message->payloadlen + 1;
-    char* buf = (char*)malloc(buflen);
-    buf[buflen - 1] = 0;
-    for(i = 0; i<message->payloadlen; i++)
+// write the values just polled by the policy into its points in the shared
+// memory table and in the shadow mirror, called by the worker owning the policy
+void share_policy_values(SlavePolicy* policy, long long epoch_ms)
+{
+    if ((policy->sharedPointNum <= 0 && policy->shadowPointNum <= 0) || policy->payload[0] == 0)
     {
-        buf[i] = payloadptr[i];
+        return;
     }
+    int count = policy->sharedPointNum > 0 ? policy->sharedPointNum : policy->shadowPointNum;
+    int i = 0;
+    double values[RANGE_BUFF_LEN];
+    if (is_bit_function(policy->functioncode))
+    {
+        uint8_t bits[RANGE_BUFF_LEN];
+        if (char2uint8(bits, RANGE_BUFF_LEN, policy->payload) != count)
+        {
+            return;
+        }
+        for (i = 0; i < count; i++)
+        {
+            values[i] = bits[i] != 0;
+        }
+    }
+    else if (decode_policy_fields(policy, policy->payload, values) != 0)
+    {
+        return;
+    }
+    for (i = 0; i < policy->sharedPointNum; i++)
+    {
+        shmp_write(&g_shared_points, policy->sharedPoint + i, values[i], epoch_ms);
+    }
+    for (i = 0; i < policy->shadowPointNum; i++)
+    {
+        shadow_mirror_write(g_shadow_mirror, policy->shadowPoint + i, values[i]);
+    }
+}
 
-    MQTTClient_freeMessage(&message);
-    MQTTClient_free(topicName);
-    cJSON* root = cJSON_Parse(buf);
-    if (root == NULL)
+void start_shared_points()
+{
+    if (strlen(g_gateway_conf.sharedMemory) == 0)
     {
-        free(buf);
-        printf("received invalid json config for writing modbus:%s\n", buf);
-        return 1;
+        return;
     }
-    
-    // the control config looks like
-    // {
-    //     "request1": {
-    //         "slaveid": 1,
-    //         "address": 40001,
-    //         "data": "00ff1234"
-    //     },
-    //     "request2": {
-    //         "slaveid": 2,
-    //         "address": 10020,
-    //         "data": "00ff1234"
-    //     }
-    // }
-    char key[11];
-    // lets limit the max data point to write to 100
-    for (i = 1; i <= 100; i++) {
-        sprintf(key, "request%d", i);
-        if (cJSON_HasObjectItem(root, key)) {
-            cJSON* req = cJSON_GetObjectItem(root, key);
-            int slaveid = json_int(req, "slaveid");
-            int address = json_int(req, "address");
-            char* data = json_string(req, "data");
-            write_modbus(slaveid, address, data);
-        } else {
-            break;
+    if (shmp_create(&g_shared_points, g_gateway_conf.sharedMemory, g_gateway_conf.sharedPoints) != 0)
+    {
+        printf("failed to create the shared memory table %s\n", g_gateway_conf.sharedMemory);
+        return;
+    }
+    g_shared_points_started = 1;
+    printf("writing the latest values to the shared memory table %s\n", g_gateway_conf.sharedMemory);
+}
+
+// execute the policies that are due at the same time, their modbus reads
+// are coalesced when possible. a scan group is in the same batch, right
+// after its first policy
+void execute_policies(PollWorker* worker, SlavePolicy** policies, int count)
+{
+    // 1 query modbus data, into the payload of every policy
+    struct timespec acquired;
+    clock_gettime(CLOCK_REALTIME, &acquired);
+    long long busStart = trace_enabled() ? trace_now_ns() : 0;
+    read_modbus_coalesced(policies, count, worker->rangeBuff);
+
+    // 2 pub modbus data
+    int i = 0;
+    if (busStart != 0)
+    {
+        // the reads of the batch are coalesced, they share the span
+        long long busEnd = trace_now_ns();
+        for (i = 0; i < count; i++)
+        {
+            if (policies[i]->traceId != 0)
+            {
+                trace_span("bus", policies[i]->traceId, busStart, busEnd);
+            }
+        }
+    }
+    for (i = 0; i < count; i++)
+    {
+        counter_add(&policies[i]->polls, 1);
+        counter_add(&g_metrics.polls, 1);
+        if (policies[i]->payload[0] == 0)
+        {
+            counter_add(&policies[i]->pollErrors, 1);
+            counter_add(&g_metrics.pollErrors, 1);
+            // a scan group keeps its pace, it's one snapshot of its policies
+            if (!in_scan_group(policies[i]))
+            {
+                backoff_policy(worker, policies[i]);
+            }
+        }
+        adapt_policy_interval(worker, policies[i]);
+        bacnet_bridge_update(policies[i]);
+        modbus_server_update(policies[i]);
+        share_policy_values(policies[i], (long long)acquired.tv_sec * 1000 + acquired.tv_nsec / 1000000);
+        if (!in_scan_group(policies[i]))
+        {
+            publish_policy_data(policies[i]);
+        }
+        else if (policies[i]->scanLeader == NULL)
+        {
+            publish_scan_group(policies[i], &acquired);
         }
     }
-
-    cJSON_Delete(root);
-    return 1;
 }
 
-int handle_config_msg(void* context, char* topicName, int topicLen, MQTTClient_message* message) {
+// the health of every shared mqtt client, as a json array.
+// must be called in the supervisor thread, which is the only one reloading them
+cJSON* mqtt_client_status()
+{
+    cJSON* status = cJSON_CreateArray();
     int i = 0;
-    char* payloadptr = NULL;
-
-    payloadptr = message->payload;
-    int buflen = message->payloadlen + 1;
-    char* buf = (char*)malloc(buflen);
-    buf[buflen - 1] = 0;
-    for(i = 0; i<message->payloadlen; i++)
+    for (i = 0; i < g_channel_num; i++)
     {
-        buf[i] = payloadptr[i];
+        if (g_shared_mqtt_client[i] == NULL)
+        {
+            continue;
+        }
+        AmqttHealth health;
+        amqtt_health(g_shared_mqtt_client[i], &health);
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "endpoint", g_shared_channel[i]->endpoint);
+        cJSON_AddStringToObject(item, "topic", g_shared_channel[i]->topic);
+        cJSON_AddBoolToObject(item, "online", health.connected);
+        cJSON_AddNumberToObject(item, "offlineMs", health.downMs);
+        cJSON_AddNumberToObject(item, "disconnects", health.disconnects);
+        cJSON_AddNumberToObject(item, "pending", health.pending);
+        cJSON_AddNumberToObject(item, "dropped", health.dropped);
+        cJSON_AddNumberToObject(item, "throttled", health.throttled);
+        cJSON_AddNumberToObject(item, "shedLevel", g_batches[i]->pressureLevel);
+        cJSON_AddItemToArray(status, item);
     }
+    return status;
+}
 
-    MQTTClient_freeMessage(&message);
-    MQTTClient_free(topicName);
-    cJSON* root = cJSON_Parse(buf);
-    if (root == NULL)
+// publish the state of the modbus buses and the mqtt clients to the status topic, if configured
+// this gateway, the members known, and the policies polled and parked here
+cJSON* shard_status()
+{
+    cJSON* shard = cJSON_CreateObject();
+    cJSON_AddStringToObject(shard, "instance", g_gateway_conf.instanceId);
+    cJSON* members = cJSON_CreateArray();
+    cJSON_AddItemToArray(members, cJSON_CreateString(g_gateway_conf.instanceId));
+    pthread_mutex_lock(&g_shard_lock);
+    int i = 0;
+    for (i = 0; i < g_shard_member_num; i++)
     {
-        free(buf);
-        printf("received invalid json config:%s\n", buf);
-        return 1;
+        cJSON_AddItemToArray(members, cJSON_CreateString(g_shard_members[i]));
     }
-    cJSON_Delete(root);
-    pthread_mutex_lock(&g_policy_update_lock);
-    FILE* fp = fopen(POLICY_CACHE, "w");
-    if (! fp)
+    pthread_mutex_unlock(&g_shard_lock);
+    cJSON_AddItemToObject(shard, "members", members);
+    int owned = 0;
+    int parked = 0;
+    SlavePolicy* sp = NULL;
+    pthread_mutex_lock(&g_policy_list_lock);
+    for (sp = g_slave_header.next; sp != NULL; sp = sp->next)
     {
-        free(buf);
-        snprintf(g_buff, BUFF_LEN, "failed to open %s for write", POLICY_CACHE);
-        log_debug(g_buff);
-        pthread_mutex_unlock(&g_policy_update_lock);
-        return 0;
+        owned++;
     }
-    fprintf(fp, "%s", buf);
-    fclose(fp);
-    printf("recived following config:\n%s\n", buf);
-    free(buf);
+    for (sp = g_parked_policies; sp != NULL; sp = sp->next)
+    {
+        parked++;
+    }
+    pthread_mutex_unlock(&g_policy_list_lock);
+    cJSON_AddNumberToObject(shard, "policies", owned);
+    cJSON_AddNumberToObject(shard, "parked", parked);
+    return shard;
+}
 
-    g_policy_updated = 1;
-    pthread_mutex_unlock(&g_policy_update_lock);
-    return 1;
+// the config and the polls of a tenant
+cJSON* tenant_status(int tenant)
+{
+    cJSON* status = cJSON_CreateObject();
+    cJSON_AddStringToObject(status, "tenant", g_gateway_conf.tenants[tenant].id);
+    cJSON_AddNumberToObject(status, "configVersion", g_tenants[tenant].configVersion);
+    cJSON_AddBoolToObject(status, "refused", g_tenants[tenant].refused);
+    unsigned long long polls = 0;
+    unsigned long long pollErrors = 0;
+    int num = 0;
+    SlavePolicy* sp = NULL;
+    pthread_mutex_lock(&g_policy_list_lock);
+    for (sp = g_slave_header.next; sp != NULL; sp = sp->next)
+    {
+        if (sp->tenant == tenant)
+        {
+            polls += sp->polls;
+            pollErrors += sp->pollErrors;
+            num++;
+        }
+    }
+    pthread_mutex_unlock(&g_policy_list_lock);
+    cJSON_AddNumberToObject(status, "policies", num);
+    cJSON_AddNumberToObject(status, "polls", polls);
+    cJSON_AddNumberToObject(status, "pollErrors", pollErrors);
+    return status;
 }
 
-void connection_lost(void* context, char* cause)
+// the status of one of the other tenants on its statusTopic, if configured
+void publish_tenant_status(int tenant)
 {
-    printf("\nConnection lost, caused by %s, will reconnect later\n", cause);
+    const char* topic = g_gateway_conf.tenants[tenant].statusTopic;
+    if (strlen(topic) == 0)
+    {
+        return;
+    }
+    cJSON* root = tenant_status(tenant);
+    cJSON_AddNumberToObject(root, "ts", time(NULL));
+    char* text = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
     pthread_mutex_lock(&g_gateway_mutex);
-    g_gateway_connected = 0;
+    if (g_gateway_connected == 1)
+    {
+        amqtt_publish(&g_gateway_client, topic, text, strlen(text), 1);
+    }
     pthread_mutex_unlock(&g_gateway_mutex);
+    free(text);
 }
 
-void start_listen_command()
+void publish_gateway_status()
 {
-    printf("connecting gateway to cloud...\n");
-    pthread_mutex_lock(&g_gateway_mutex);
-    // sub to config mqtt topic, to receive slave policy from cloud
-    MQTTClient client;
-    MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
-    int rc = 0;
-    int ch = 0;
-
-    char clientid[MAX_LEN];
-    snprintf(clientid, MAX_LEN, "modbusGW%lld", (long long)time(NULL));
-    MQTTClient_create(&client, g_gateway_conf.endpoint, clientid,
-        MQTTCLIENT_PERSISTENCE_NONE, NULL);
-
-    conn_opts.keepAliveInterval = 50;
-    conn_opts.cleansession = 1;
-    conn_opts.username = g_gateway_conf.user;
-    conn_opts.password = g_gateway_conf.password;
-    set_ssl_option(&conn_opts, g_gateway_conf.endpoint);
-
-    MQTTClient_setCallbacks(client, NULL, connection_lost, msg_arrived, delivered);
-
-    if ((rc = MQTTClient_connect(client, &conn_opts)) != MQTTCLIENT_SUCCESS)
+    if (strlen(g_gateway_conf.statusTopic) == 0)
     {
-        printf("Failed to connect, return code %d\n", rc);
-        pthread_mutex_unlock(&g_gateway_mutex);
-
         return;
     }
-    if (strlen(g_gateway_conf.backControlTopic) > 0) {
-        char* topics[2];
-        topics[0] = g_gateway_conf.topic;
-        topics[1] = g_gateway_conf.backControlTopic;
-        int qoss[2];
-        qoss[0] = 0;
-        qoss[1] = 0;
-        MQTTClient_subscribeMany(client, 2, topics, qoss);
-    } else {
-        MQTTClient_subscribe(client, g_gateway_conf.topic, 0);
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "ts", time(NULL));
+    cJSON_AddNumberToObject(root, "configVersion", g_tenants[0].configVersion);
+    cJSON_AddItemToObject(root, "modbus", modbus_conn_status());
+    cJSON_AddItemToObject(root, "mqtt", mqtt_client_status());
+    cJSON* metrics = cJSON_CreateObject();
+    cJSON_AddNumberToObject(metrics, "polls", counter_get(&g_metrics.polls));
+    cJSON_AddNumberToObject(metrics, "pollErrors", counter_get(&g_metrics.pollErrors));
+    cJSON_AddItemToObject(metrics, "lateness", histogram_json(&g_metrics.lateness));
+    cJSON_AddItemToObject(metrics, "publishLatency", histogram_json(&g_metrics.publish));
+    cJSON* jitter = cJSON_CreateArray();
+    int i = 0;
+    for (i = 0; i < g_worker_num; i++)
+    {
+        cJSON_AddItemToArray(jitter, histogram_json(&g_workers[i].jitter));
+    }
+    cJSON_AddItemToObject(metrics, "workerJitter", jitter);
+    cJSON_AddItemToObject(root, "metrics", metrics);
+    cJSON_AddItemToObject(root, "shedding", shedding_status());
+    if (strlen(g_gateway_conf.shardTopic) > 0)
+    {
+        cJSON_AddItemToObject(root, "shard", shard_status());
     }
+    if (g_gateway_conf.tenantNum > 1)
+    {
+        cJSON* tenants = cJSON_CreateArray();
+        for (i = 1; i < g_gateway_conf.tenantNum; i++)
+        {
+            cJSON_AddItemToArray(tenants, tenant_status(i));
+        }
+        cJSON_AddItemToObject(root, "tenants", tenants);
+    }
+    char* text = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
 
-    g_gateway_connected = 1;
+    pthread_mutex_lock(&g_gateway_mutex);
+    if (g_gateway_connected == 1)
+    {
+        amqtt_publish(&g_gateway_client, g_gateway_conf.statusTopic, text, strlen(text), 1);
+    }
     pthread_mutex_unlock(&g_gateway_mutex);
-}
-
-void pack_pub_msg(SlavePolicy* policy, char* raw, char* dest)
-{
-    cJSON* root = cJSON_CreateObject(); 
-    cJSON_AddNumberToObject(root, "bdModbusVer", 1);
-    cJSON_AddStringToObject(root, "gatewayid", policy->gatewayid);
-    cJSON_AddStringToObject(root, "trantable", policy->trantable);
-    cJSON* modbus = NULL;
-    cJSON_AddItemToObject(root, "modbus", modbus = cJSON_CreateObject());
-    
-    cJSON* request = NULL;
-    cJSON_AddItemToObject(modbus, "request", request = cJSON_CreateObject());
-    cJSON_AddNumberToObject(request, "functioncode", policy->functioncode);
-    cJSON_AddNumberToObject(request, "slaveid", policy->slaveid);
-    cJSON_AddNumberToObject(request, "startAddr", policy->start_addr);
-    cJSON_AddNumberToObject(request, "length", policy->length);
-    
-    cJSON_AddStringToObject(modbus, "response", raw);
-    
-    time_t now = time(NULL);
-    struct tm* info = localtime(&now);
-    char timestamp[40];
-    strftime(timestamp, 39, "%Y-%m-%d %X%z", info);
-    cJSON_AddStringToObject(root, "timestamp", timestamp);
-    char* text = cJSON_Print(root);
-    mystrncpy(dest, text, BUFF_LEN);
     free(text);
-    cJSON_Delete(root);
 }
 
-void execute_policy(SlavePolicy* policy)
+// ask for a full config of the tenant on its status topic, its policies are
+// out of sync
+void request_full_config(int tenant)
 {
-    // 3 recaculate the next run time
-    policy->nextRun = policy->interval + time(NULL);
-
-    // 4 re-insert into the list, in order of nextRun
-    insert_slave_policy(policy);
-    
-    if (policy == NULL)
+    TenantState* ts = &g_tenants[tenant];
+    const char* topic = g_gateway_conf.tenants[tenant].statusTopic;
+    if (strlen(topic) == 0)
     {
+        printf("no statusTopic of %s to ask for a full config, waiting for one\n", 
+            tenant_name(tenant));
+        ts->resyncNeeded = 0;
         return;
     }
+    char text[MAX_LEN];
+    if (tenant == 0)
+    {
+        snprintf(text, MAX_LEN, "{\"ts\":%lld,\"configVersion\":%lld,\"resync\":true}",
+            (long long)time(NULL), ts->configVersion);
+    }
+    else
+    {
+        snprintf(text, MAX_LEN, "{\"ts\":%lld,\"tenant\":\"%s\",\"configVersion\":%lld,"
+            "\"resync\":true}", (long long)time(NULL), g_gateway_conf.tenants[tenant].id, 
+            ts->configVersion);
+    }
+    pthread_mutex_lock(&g_gateway_mutex);
+    if (g_gateway_connected == 1 && amqtt_is_connected(&g_gateway_client))
+    {
+        amqtt_publish(&g_gateway_client, topic, text, strlen(text), 1);
+        ts->resyncNeeded = 0;
+    }
+    pthread_mutex_unlock(&g_gateway_mutex);
+}
 
-    // 1 query modbus data
-    char payload[1024];
-    read_modbus(policy, payload);
+// the metrics of the gateway in the prometheus text format, on every scrape
+void render_metrics(MetricsText* t, void* arg)
+{
+    char labels[MAX_LEN * 2];
+    int i = 0;
+    mt_type(t, "modbus_polls_total", "counter");
+    mt_value(t, "modbus_polls_total", NULL, counter_get(&g_metrics.polls));
+    mt_type(t, "modbus_poll_errors_total", "counter");
+    mt_value(t, "modbus_poll_errors_total", NULL, counter_get(&g_metrics.pollErrors));
+    mt_type(t, "modbus_poll_lateness_seconds", "histogram");
+    mt_histogram(t, "modbus_poll_lateness_seconds", NULL, &g_metrics.lateness);
+    mt_type(t, "modbus_publish_latency_seconds", "histogram");
+    mt_histogram(t, "modbus_publish_latency_seconds", NULL, &g_metrics.publish);
+    mt_type(t, "modbus_worker_scheduled", "gauge");
+    for (i = 0; i < g_worker_num; i++)
+    {
+        snprintf(labels, sizeof(labels), "worker=\"%d\"", i);
+        mt_value(t, "modbus_worker_scheduled", labels, sched_size(&g_workers[i].schedule));
+    }
+    mt_type(t, "modbus_worker_wakeup_jitter_seconds", "histogram");
+    for (i = 0; i < g_worker_num; i++)
+    {
+        snprintf(labels, sizeof(labels), "worker=\"%d\"", i);
+        mt_histogram(t, "modbus_worker_wakeup_jitter_seconds", labels, &g_workers[i].jitter);
+    }
+    modbus_conn_metrics(t);
+    modbus_server_metrics(t);
+    mt_type(t, "modbus_bus_shed_level", "gauge");
+    pthread_mutex_lock(&g_bus_worker_lock);
+    for (i = 0; i < g_bus_worker_num; i++)
+    {
+        snprintf(labels, sizeof(labels), "bus=\"%s\"", g_bus_workers[i].addr);
+        mt_value(t, "modbus_bus_shed_level", labels, g_bus_workers[i].shedLevel);
+    }
+    mt_type(t, "modbus_bus_deadline_miss_percent", "gauge");
+    for (i = 0; i < g_bus_worker_num; i++)
+    {
+        snprintf(labels, sizeof(labels), "bus=\"%s\"", g_bus_workers[i].addr);
+        mt_value(t, "modbus_bus_deadline_miss_percent", labels, g_bus_workers[i].missPercent);
+    }
+    pthread_mutex_unlock(&g_bus_worker_lock);
 
-    // 2 pub modbus data
-    if (policy->mqttClient != -1 && strlen(payload) > 0)
+    pthread_mutex_lock(&g_policy_list_lock);
+    mt_type(t, "modbus_mqtt_pending", "gauge");
+    for (i = 0; i < g_channel_num; i++)
     {
-        MQTTClient_message pubmsg = MQTTClient_message_initializer;
-        MQTTClient_deliveryToken delivery_token;
-        char msgcontent[BUFF_LEN];
-        pack_pub_msg(policy, payload, msgcontent);
-        pubmsg.payload = msgcontent;
-        pubmsg.payloadlen = strlen(msgcontent);
-        pubmsg.qos = 0;
-        pubmsg.retained = 0;
-
-        int rc = MQTTClient_publishMessage(g_shared_mqtt_client[policy->mqttClient],
-                 policy->pubChannel.topic, &pubmsg, &delivery_token);
-        if (rc == MQTTCLIENT_SUCCESS)
-        {
-            MQTTClient_waitForCompletion(g_shared_mqtt_client[policy->mqttClient], 
-                delivery_token, 1000L);
-            log_debug(payload);
+        if (g_shared_mqtt_client[i] != NULL)
+        {
+            AmqttHealth health;
+            amqtt_health(g_shared_mqtt_client[i], &health);
+            snprintf(labels, sizeof(labels), "topic=\"%s\"", g_shared_channel[i]->topic);
+            mt_value(t, "modbus_mqtt_pending", labels, health.pending);
         }
-        else
+    }
+    mt_type(t, "modbus_mqtt_throttled_total", "counter");
+    for (i = 0; i < g_channel_num; i++)
+    {
+        if (g_shared_mqtt_client[i] != NULL)
         {
-            g_mqtt_pos_with_err = policy->mqttClient;
-            printf("mqtt client at pos %d failed to publish message with rc=%d\n", 
-                g_mqtt_pos_with_err, rc);
+            AmqttHealth health;
+            amqtt_health(g_shared_mqtt_client[i], &health);
+            snprintf(labels, sizeof(labels), "topic=\"%s\"", g_shared_channel[i]->topic);
+            mt_value(t, "modbus_mqtt_throttled_total", labels, health.throttled);
         }
     }
-    else 
+    mt_type(t, "modbus_mqtt_shed_level", "gauge");
+    for (i = 0; i < g_channel_num; i++)
     {
-        log_debug("failed to init mqtt client");
+        if (g_shared_mqtt_client[i] != NULL)
+        {
+            snprintf(labels, sizeof(labels), "topic=\"%s\"", g_shared_channel[i]->topic);
+            mt_value(t, "modbus_mqtt_shed_level", labels, g_batches[i]->pressureLevel);
+        }
+    }
+    const char* names[3] = {"modbus_policy_polls_total", "modbus_policy_poll_errors_total",
+        "modbus_policy_exceptions_total"};
+    unsigned long long* counters[3];
+    int k = 0;
+    for (k = 0; k < 3; k++)
+    {
+        mt_type(t, names[k], "counter");
+        SlavePolicy* sp = NULL;
+        for (sp = g_slave_header.next; sp != NULL; sp = sp->next)
+        {
+            snprintf(labels, sizeof(labels),
+                "bus=\"%s\",slaveid=\"%d\",functioncode=\"%d\",start_addr=\"%d\"",
+                sp->ip_com_addr, sp->slaveid, sp->functioncode, sp->start_addr);
+            counters[0] = &sp->polls;
+            counters[1] = &sp->pollErrors;
+            counters[2] = &sp->exceptions;
+            mt_value(t, names[k], labels, counter_get(counters[k]));
+        }
     }
+    pthread_mutex_unlock(&g_policy_list_lock);
 }
 
-//TODO: fire up a few more workers, and precess in parallel, to speed up.
-void* worker_func(void* arg)
+void start_metrics_endpoint()
+{
+    if (strlen(g_gateway_conf.metricsListen) == 0)
+    {
+        return;
+    }
+    char host[ADDR_LEN];
+    mystrncpy(host, g_gateway_conf.metricsListen, ADDR_LEN);
+    char* colon = strrchr(host, ':');
+    if (colon == NULL)
+    {
+        printf("metricsListen should be ip:port, got %s\n", host);
+        return;
+    }
+    *colon = 0;
+    if (metrics_http_start(host, atoi(colon + 1), render_metrics, NULL) == 0)
+    {
+        printf("serving the metrics on http://%s/metrics\n", g_gateway_conf.metricsListen);
+    }
+}
+
+// the supervisor takes care of policy reloading and the mqtt connections,
+// so that the workers only need to poll the modbus slaves. it runs from its
+// event loop, see wake_supervisor
+void* supervisor_func(void* arg)
 {
+    long long last_status = 0;
     while (g_stop_worker != 1)
     {
         // load slave policy if it's updated
         if (g_policy_updated)
         {
-            load_slave_policy_from_cache(&g_slave_header);
+            apply_staged_configs();
+        }
+        if (g_shard_changed)
+        {
+            rebalance_policies();
         }
         
         if (g_gateway_connected == 0)
         {
             start_listen_command();
         }
+        else
+        {
+            amqtt_connect(&g_gateway_client);
+        }
+
+        // retry the mqtt clients which never got connected, the clients are
+        // only replaced by the policy reloading above, in this thread
+        connect_mqtt_clients();
+
+        int t = 0;
+        for (t = 0; t < g_gateway_conf.tenantNum; t++)
+        {
+            if (g_tenants[t].resyncNeeded)
+            {
+                request_full_config(t);
+            }
+        }
+
+        // a channel shed by its backpressure may have stopped publishing, it's
+        // restored from here once its queue drained
+        int shed_channels = 0;
+        int i = 0;
+        for (i = 0; i < g_channel_num; i++)
+        {
+            note_publish_pressure(i);
+            shed_channels += g_shared_mqtt_client[i] != NULL && g_batches[i]->pressureLevel > 0;
+        }
+
+        long long now = monotonic_ms();
+        int shedding_changed = g_shedding_changed;
+        g_shedding_changed = 0;
+        if (modbus_status_changed() || shedding_changed || now - last_status >= STATUS_INTERVAL_MS)
+        {
+            publish_gateway_status();
+            for (t = 1; t < g_gateway_conf.tenantNum; t++)
+            {
+                publish_tenant_status(t);
+            }
+            last_status = now;
+        }
+
+        // it sleeps until it's woken up, the next status, or the retry of
+        // the mqtt clients not connected
+        long long wake = last_status + STATUS_INTERVAL_MS;
+        if ((g_gateway_connected == 0 || !amqtt_is_connected(&g_gateway_client)
+            || !mqtt_clients_connected()) && now + SUPERVISOR_RETRY_MS < wake)
+        {
+            wake = now + SUPERVISOR_RETRY_MS;
+        }
+        if (shed_channels > 0 && now + PUB_PRESSURE_STEP_MS < wake)
+        {
+            wake = now + PUB_PRESSURE_STEP_MS;
+        }
+        evloop_set_deadline(&g_supervisor_loop, wake);
+        if (evloop_run_once(&g_supervisor_loop, -1) < 0)
+        {
+            // without the loop, see init_static_data
+            sleep(1);
+        }
+    }
+    log_debug("exiting supervisor thread...");
+    return NULL;
+}
+
+// wait until the next deadline of the worker, or until the schedule is changed.
+// must be called with the worker lock held
+void wait_for_next_deadline(PollWorker* worker)
+{
+    long long deadline = 0;
+    long long wait = MAX_IDLE_WAIT_MS;
+    // wake up in time to flush the lingering batches
+    if (g_gateway_conf.batchMaxCount > 1 && g_gateway_conf.batchLingerMs < wait)
+    {
+        wait = g_gateway_conf.batchLingerMs;
+    }
+    if (sched_peek(&worker->schedule, &deadline) != NULL)
+    {
+        long long left = deadline - monotonic_ms();
+        if (left <= 0)
+        {
+            return;
+        }
+        if (left < wait)
+        {
+            wait = left;
+        }
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += wait / 1000;
+    ts.tv_nsec += (wait % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    if (pthread_cond_timedwait(&worker->wakeup, &worker->lock, &ts) == ETIMEDOUT)
+    {
+        // the jitter of the thread, the time between the timer and the
+        // worker running again
+        hist_record(&worker->jitter, monotonic_us() - (ts.tv_sec * 1000000LL + ts.tv_nsec / 1000));
+    }
+}
+
+void* worker_func(void* arg)
+{
+    PollWorker* worker = (PollWorker*) arg;
+    long long deadline = 0;
+    SlavePolicy* batch[MAX_POLL_BATCH];
+    // allocated once for the life of the worker, the polling doesn't allocate
+    worker->rangeBuff = (uint8_t*) malloc(MAX_POLL_BATCH * RANGE_BUFF_LEN);
+    char name[TRACE_NAME_LEN];
+    snprintf(name, TRACE_NAME_LEN, "worker %d", worker->id);
+    trace_name_thread(name);
+    // off the cpus of the other threads, which the worker inherited
+    int rc = rt_apply(g_gateway_conf.rtPriority, g_gateway_conf.busCpus);
+    if (rc != 0)
+    {
+        printf("worker %d stays on the normal scheduler: %s\n", worker->id, strerror(rc));
+    }
+    // we have something to do, acquire the lock here, it's released
+    // while waiting for the next deadline
+    pthread_mutex_lock(&worker->lock);
+    while (g_stop_worker != 1)
+    {
+        // pick the policies whose nextRun is due from the top of the schedule
+        // of this worker, calculate the new next run, schedule them again, 
+        // and execute them in one batch, so that their reads can be merged.
+        // policies due shortly are taken as well, otherwise policies loaded
+        // a few ms apart would never be merged
+        // the back control writes go first
+        run_queued_modbus_writes(is_bus_of_worker, worker);
 
-        if (g_mqtt_pos_with_err >= 0)
+        long long now = monotonic_ms();
+        int count = 0;
+        SlavePolicy* top = NULL;
+        while (count < MAX_POLL_BATCH 
+            && (top = (SlavePolicy*) sched_peek(&worker->schedule, &deadline)) != NULL 
+            && deadline <= now + COALESCE_WINDOW_MS)
         {
-            fix_broken_mqtt_client();
+            // the whole scan group goes into the batch, or waits for the next one
+            int size = 0;
+            SlavePolicy* member = NULL;
+            for (member = top; member != NULL; member = member->scanNext)
+            {
+                size++;
+            }
+            if (count + size > MAX_POLL_BATCH)
+            {
+                break;
+            }
+            batch[count++] = (SlavePolicy*) sched_pop(&worker->schedule);
+            for (member = top->scanNext; member != NULL; member = member->scanNext)
+            {
+                member->nextRun = top->nextRun;
+                batch[count++] = member;
+            }
         }
-        // iterate from the beginning of the policy list
-        // and pick those whose nextRun is due, and execute them, 
-        // calculate the new next run, and insert into the list
-        time_t now = time(NULL);
-        // we have something to do, acquire the lock here
-        int rc = pthread_mutex_lock(&g_policy_lock);
-        if (g_slave_header.next != NULL && g_slave_header.next->nextRun <= now)
-        {    
-            while (g_slave_header.next != NULL && g_slave_header.next->nextRun <= now)
+        if (count > 0)
+        {
+            // reschedule after all are popped, a policy with a short interval
+            // could otherwise be picked twice in the same batch
+            long long start_us = monotonic_us();
+            int traced = trace_enabled();
+            int i = 0;
+            for (i = 0; i < count; i++)
             {
-                // detach from the list
-                SlavePolicy* policy = g_slave_header.next;
-                g_slave_header.next = g_slave_header.next->next;
-                execute_policy(policy);
+                hist_record(&g_metrics.lateness, start_us - batch[i]->nextRun * 1000);
+                // from due to picked by the worker
+                batch[i]->traceId = traced ? trace_next_id() : 0;
+                if (traced)
+                {
+                    trace_span("schedule", batch[i]->traceId, batch[i]->nextRun * 1000000, 
+                        start_us * 1000);
+                }
+                // the rest of a scan group go with the first, which may be on another bus
+                if (batch[i]->scanLeader == NULL)
+                {
+                    note_policy_deadline(batch[i], start_us / 1000);
+                    reschedule_policy(worker, batch[i]);
+                }
             }
+            execute_policies(worker, batch, count);
+            flush_expired_batches();
+            continue;
         }
-        rc = pthread_mutex_unlock(&g_policy_lock);    
+        flush_expired_batches();
 
-        sleep(1);
+        wait_for_next_deadline(worker);
     }
-    log_debug("exiting worker thread...\n");
+    pthread_mutex_unlock(&worker->lock);
+    free(worker->rangeBuff);
+    worker->rangeBuff = NULL;
+    logger_debug("exiting worker thread %d...", worker->id);
+    return NULL;
 }
 
-pthread_t g_worker_thread;
+pthread_t g_supervisor_thread;
 
 void start_worker()
 {
-    pthread_create(&g_worker_thread, NULL, worker_func, NULL);
+    int i = 0;
+    for (i = 0; i < g_worker_num; i++)
+    {
+        pthread_create(&g_workers[i].thread, NULL, worker_func, &g_workers[i]);
+    }
+    pthread_create(&g_supervisor_thread, NULL, supervisor_func, NULL);
+    start_modbus_reconnector();
+}
+
+void bridge_write_done(void* arg, int rc, long long latencyUs, const char* readback)
+{
+    if (rc != 0)
+    {
+        printf("failed to write the value written by a BACnet client\n");
+    }
+}
+
+// a BACnet client wrote a bridged value, it's queued like a back control write
+int bridge_write(const char* ip_com_addr, int slaveid, int address, const char* data)
+{
+    char bus[ADDR_LEN];
+    if (queue_modbus_write(ip_com_addr, slaveid, address, data, 0, bridge_write_done, 
+            NULL, bus) != 0)
+    {
+        return -1;
+    }
+    PollWorker* worker = &g_workers[worker_of_bus(bus)];
+    pthread_mutex_lock(&worker->lock);
+    pthread_cond_signal(&worker->wakeup);
+    pthread_mutex_unlock(&worker->lock);
+    return 0;
 }
 
 void init_static_data()
 {
     init_modbus_ctxs();
+    // the bridge mode stays off if the gateway config can't be loaded
+    g_gateway_conf.bacnetDevice = -1;
+    g_gateway_conf.tenantNum = 1;
+
+    // the workers wait for deadlines on the monotonic clock
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
     
     int i = 0; 
-    for (i = 0; i < MAX_CHANNEL; i++)
+    for (i = 0; i < MAX_WORKER; i++)
     {
-        g_shared_channel[i] = NULL;
-        g_shared_mqtt_client[i] = NULL;
+        g_workers[i].id = i;
+        sched_init(&g_workers[i].schedule, 0);
+        g_workers[i].rangeBuff = NULL;
+        pthread_mutex_init(&g_workers[i].lock, NULL);
+        pthread_cond_init(&g_workers[i].wakeup, &cond_attr);
+    }
+    pthread_condattr_destroy(&cond_attr);
+
+    // the mqtt callbacks may wake the supervisor up before it starts
+    if (evloop_init(&g_supervisor_loop) != 0)
+    {
+        printf("failed to create the event loop of the supervisor, it checks every second\n");
     }
+    modbus_set_status_listener(wake_supervisor);
 }
 
 void init_and_start()
 {
     printf("Baidu IoT Edge SDK v0.1.1\n");
 
+    logger_start(stdout);
     init_static_data();
 
     // 
@@ -769,16 +5898,53 @@ void init_and_start()
     if (load_gateway_config(&g_gateway_conf))
     {
         printf("successfully loaded gateway config from file %s\n", CONFIG_FILE);
+        g_worker_num = g_gateway_conf.workerNum;
+        set_modbus_pipeline_depth(g_gateway_conf.tcpPipelineDepth);
+        set_modbus_probing(g_gateway_conf.probeDevices);
     } 
     else 
     {
         printf("failed to load gateway configuration from file %s\n", CONFIG_FILE);
     }
+    printf("polling with %d worker(s)\n", g_worker_num);
+    if (g_gateway_conf.lockMemory && rt_lock_memory() != 0)
+    {
+        printf("failed to lock the memory of the gateway, it may be paged out\n");
+    }
+    // every thread created from now on inherits the cpus, the workers pin themselves
+    // to busCpus. the logger was started before and stays on any cpu
+    if (g_gateway_conf.otherCpus != 0 && rt_apply(0, g_gateway_conf.otherCpus) != 0)
+    {
+        printf("failed to pin the gateway to otherCpus\n");
+    }
                 
+    // the modbus server and the shared memory table take the policies as they are loaded
+    if (strlen(g_gateway_conf.modbusServerListen) > 0)
+    {
+        modbus_server_start(&g_gateway_conf);
+    }
+    start_shared_points();
+    if (g_gateway_conf.shadow != NULL)
+    {
+        g_shadow_mirror = shadow_mirror_start(g_gateway_conf.shadow);
+    }
+
     // 2 receive device(slave) polling config from cloud, or local cache
     g_slave_header.next = NULL;
-    load_slave_policy_from_cache(&g_slave_header);
+    init_tenant_state();
+    load_slave_policy_from_cache();
+    // the other tenants after the gateway, their policies may be of its templates
+    int t = 0;
+    for (t = 1; t < g_gateway_conf.tenantNum; t++)
+    {
+        load_tenant_policy_cache(t);
+    }
 
+    start_metrics_endpoint();
+    if (g_gateway_conf.bacnetDevice >= 0)
+    {
+        bacnet_bridge_start(&g_gateway_conf, bridge_write);
+    }
     start_listen_command();
     start_worker();
 }
@@ -798,11 +5964,68 @@ void wait_user_input()
         }
     } while(ch!='Q' && ch != 'q'); 
     g_stop_worker = 1;
+    wake_all_workers();
+    wake_supervisor();
     printf("exiting...\n");
 }
 
 void clean_and_exit()
 {
-    pthread_join(g_worker_thread, NULL);
+    int i = 0;
+    pthread_join(g_supervisor_thread, NULL);
+    evloop_destroy(&g_supervisor_loop);
+    stop_modbus_reconnector();
+    for (i = 0; i < g_worker_num; i++)
+    {
+        pthread_join(g_workers[i].thread, NULL);
+    }
+    metrics_http_stop();
+    bacnet_bridge_stop();
+    modbus_server_stop();
+    if (g_shared_points_started)
+    {
+        shmp_destroy(&g_shared_points);
+        g_shared_points_started = 0;
+    }
+    shadow_mirror_stop(g_shadow_mirror);
+    g_shadow_mirror = NULL;
+    cJSON_Delete(g_gateway_conf.shadow);
+    g_gateway_conf.shadow = NULL;
     cleanup_data();
+    if (g_gateway_connected == 1)
+    {
+        // the other members take over the buses without waiting for the will
+        if (strlen(g_gateway_conf.shardTopic) > 0)
+        {
+            announce_shard_member(0);
+        }
+        amqtt_destroy(&g_gateway_client, 1000);
+        g_gateway_connected = 0;
+    }
+    release_staged_configs(-1);
+    release_parked_policies(-1);
+    for (i = 0; i < MAX_WORKER; i++)
+    {
+        sched_destroy(&g_workers[i].schedule);
+    }
+    for (i = 0; i < g_channel_cap; i++)
+    {
+        free(g_batches[i]->buff);
+        pthread_mutex_destroy(&g_batches[i]->lock);
+        free(g_batches[i]);
+    }
+    free(g_batches);
+    free(g_shared_channel);
+    free(g_shared_mqtt_client);
+    free(g_channel_next);
+    free(g_channel_bucket);
+    g_batches = NULL;
+    g_shared_channel = NULL;
+    g_shared_mqtt_client = NULL;
+    g_channel_next = NULL;
+    g_channel_bucket = NULL;
+    g_channel_cap = 0;
+    g_channel_num = 0;
+    g_channel_bucket_num = 0;
+    logger_stop();
 }
@@ -18,10 +18,12 @@
  */
 
 #include "common.h"
+#include "hex.h"
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 // common function section
 long read_file_as_string(char const* path, char** buf)
@@ -38,20 +40,24 @@ long read_file_as_string(char const* path, char** buf)
     }
 
     rc = fseek(fp, 0L, SEEK_END);
-    if(0 != rc)
+    if(0 != rc || 0 > (off_end = ftell(fp)))
     {
+        fclose(fp);
         return -1L;
     }
-
-    if(0 > (off_end = ftell(fp)))
+    fsz = (size_t)off_end;
+    if(0 == fsz)
     {
-        return -1L;
+        // nothing is allocated for an empty file
+        fclose(fp);
+        *buf = NULL;
+        return 0L;
     }
-    fsz = (size_t)off_end;
 
     *buf = malloc(fsz + 1);
     if(NULL == *buf)
     {
+        fclose(fp);
         return -1L;
     }
 
@@ -59,40 +65,61 @@ long read_file_as_string(char const* path, char** buf)
 
     if(fsz != fread(*buf, 1, fsz, fp))
     {
+        fclose(fp);
         free(*buf);
+        *buf = NULL;
         return -1L;
     }
+    (*buf)[fsz] = 0;
 
     if(EOF == fclose(fp))
     {
         free(*buf);
+        *buf = NULL;
         return -1L;
     }
 
     return (long)fsz;
 }
 
-int g_debug = 0;
+// write a temporary file next to path and rename it over path, so that a
+// reader never sees a half written file. return 0 on success
+int write_file_atomic(const char* path, const char* content, long len)
+{
+    char tmp[MAX_LEN];
+    snprintf(tmp, MAX_LEN, "%s.tmp", path);
+    FILE* fp = fopen(tmp, "wb");
+    if (fp == NULL)
+    {
+        return -1;
+    }
+    int ok = len == 0 || fwrite(content, len, 1, fp) == 1;
+    ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fclose(fp) != 0 || !ok || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
 void toggle_debug()
 {
-    g_debug = g_debug == 0 ? 1 : 0;
-    if (g_debug == 1)
+    if (logger_enabled(LOGGER_DEBUG))
     {
-        printf("debug info is on\n");
+        logger_set_level(LOGGER_INFO);
+        printf("debug info is off\n");
     }
     else
     {
-        printf("debug info is off\n");
+        logger_set_level(LOGGER_DEBUG);
+        printf("debug info is on\n");
     }
 }
 
 void log_debug(char* msg)
 {
-    if (g_debug == 1)
-    {
-        time_t now = time(NULL);
-        printf("%s %s\n", ctime(&now), msg);
-    } 
+    logger_debug("%s", msg);
 }
 
 void mystrncpy(char* desc, const char* src, int len)
@@ -140,25 +167,12 @@ char char2dec(char data)
 // convert char* to hex, like 0A126F...
 void byte_arr_to_hex(char* dest, char* src, int len)
 {
-    int i = 0; 
-    for (; i < len; i++)
-    {
-        char2hex(src[i], &dest[i << 1], &dest[(i << 1) + 1]);
-    }
-    dest[len << 1] = '\0';
+    hex_encode(dest, (const uint8_t*)src, len);
 }
 
 void short_arr_to_array(char* dest, uint16_t* src, int len)
 {
-    int i = 0; 
-    for (; i < len; i++)
-    {
-        char high = (src[i] & 0XFF00) >> 8;
-        char low = src[i] & 0XFF;
-        char2hex(high, &dest[i << 2], &dest[(i << 2) +1]);
-        char2hex(low, &dest[(i << 2) + 2], &dest[(i << 2) +3]);
-    }
-    dest[len << 2] = '\0';
+    hex_encode_u16(dest, src, len);
 }
 
 void channel_to_json(Channel* ch, int maxlen, char* dest)
@@ -179,39 +193,69 @@ void channel_to_json(Channel* ch, int maxlen, char* dest)
 };
 
 // convert "00ff1234" to 0x00ff, 0x1234, ...
-// return the number of data converted
-int char2uint16(uint16_t* dest, const char* src)
+// return the number of data converted, -1 if src is not hex or too long
+int char2uint16(uint16_t* dest, int cap, const char* src)
 {
-    int len = strlen(src);
-    int i = 0 ;
-    int cnt = 0;
-    for (i = 0; i < len / 4; i++)
+    return hex_decode_u16(dest, cap, src, strlen(src));
+}
+
+// convert "00ff" to 0x00, 0xff, ....
+// return the number of data converted, -1 if src is not hex or too long
+int char2uint8(uint8_t* dest, int cap, const char* src)
+{
+    return hex_decode(dest, cap, src, strlen(src));
+}
+
+// milliseconds from a monotonic clock, not affected by wall clock changes
+long long monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long long monotonic_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+cJSON* histogram_json(const Histogram* h)
+{
+    cJSON* item = cJSON_CreateObject();
+    cJSON_AddNumberToObject(item, "count", counter_get(&h->count));
+    cJSON_AddNumberToObject(item, "meanMs", hist_mean(h) / 1000);
+    cJSON_AddNumberToObject(item, "p50Ms", hist_percentile(h, 50) / 1000.0);
+    cJSON_AddNumberToObject(item, "p90Ms", hist_percentile(h, 90) / 1000.0);
+    cJSON_AddNumberToObject(item, "p99Ms", hist_percentile(h, 99) / 1000.0);
+    cJSON_AddNumberToObject(item, "maxMs", hist_percentile(h, 100) / 1000.0);
+    return item;
+}
+
+// djb2 hash of a string, used to spread policies/buses over buckets
+unsigned int hash_string(const char* str)
+{
+    unsigned int hash = HASH_START;
+    if (str == NULL)
     {
-        uint16_t data = 0;
-        data |= char2dec(src[4 * i]) << 12;
-        data |= char2dec(src[4 * i + 1]) << 8;
-        data |= char2dec(src[4 * i + 2]) << 4;
-        data |= char2dec(src[4 * i + 3]);
-        dest[cnt++] = data;
+        return hash;
+    }
+    while (*str != '\0')
+    {
+        hash = ((hash << 5) + hash) + (unsigned char)*str;
+        str++;
     }
 
-    return cnt;
+    return hash;
 }
 
-// convert "00ff" to 0x00, 0xff, ....
-// return the number of data converted
-int char2uint8(uint8_t* dest, const char* src)
+unsigned int hash_bytes(unsigned int hash, const char* buf, long len)
 {
-    int len = strlen(src);
-    int i = 0 ;
-    int cnt = 0;
-    for (i = 0; i < len / 2; i++)
+    long i = 0;
+    for (i = 0; i < len; i++)
     {
-        uint8_t data = 0;
-        data |= char2dec(src[2 * i]) << 4;
-        data |= char2dec(src[2 * i + 1]);
-        dest[cnt++] = data;
+        hash = ((hash << 5) + hash) + (unsigned char)buf[i];
     }
-
-    return cnt;
-}
\ No newline at end of file
+    return hash;
+}
@@ -21,15 +21,24 @@
 #define INF_BCE_IOT_MODBUS_SDK_C_COMMON_H
 
 #include "data.h"
+#include "logger.h"
 
 #include <cjson/cJSON.h>
 #include <modbus/modbus.h>
 
 // common function section
+// read the whole file into a malloc'ed, nul terminated *buf, return its size,
+// -1 on error. nothing is allocated if it's empty or on error
 long read_file_as_string(char const* path, char** buf);
 
+// replace the file by a rename, a reader sees the old or the new content.
+// return 0 on success
+int write_file_atomic(const char* path, const char* content, long len);
+
 void toggle_debug();
 
+// the message is queued for the writer of the log, see logger.h. prefer
+// logger_debug() for formatted lines, it's only formatted if debug is on
 void log_debug(char* msg);
 
 void mystrncpy(char* desc, const char* src, int len);
@@ -41,6 +50,9 @@ char* json_string(cJSON* root, char* item);
 // convert byte 0x01 to char '0' and '1'
 void char2hex(char c, char* hex1, char* hex2);
 
+// convert 'A' to 10, or '2' to 2
+char char2dec(char data);
+
 // convert char* to hex, like 0A126F...
 void byte_arr_to_hex(char* dest, char* src, int len);
 
@@ -48,8 +60,26 @@ void short_arr_to_array(char* dest, uint16_t* src, int len);
 
 void channel_to_json(Channel* ch, int maxlen, char* dest);
 
-// convert "00ff1234" to 0x00ff, 0x1234 ...
-int char2uint16(uint16_t* dest, const char* src);
+// convert "00ff1234" to 0x00ff, 0x1234 ..., at most cap of them.
+// return the number converted, -1 if src is not hex or too long
+int char2uint16(uint16_t* dest, int cap, const char* src);
 // convert "00ff" to 0x00, 0xff, ....
-int char2uint8(uint8_t* dest, const char* src);
+int char2uint8(uint8_t* dest, int cap, const char* src);
+
+// milliseconds from a monotonic clock, not affected by wall clock changes
+long long monotonic_ms();
+
+// microseconds from the same clock, for timing the modbus requests
+long long monotonic_us();
+
+// the summary of a histogram of us, in ms: count, mean, p50, p90, p99 and max
+cJSON* histogram_json(const Histogram* h);
+
+// djb2 hash of a string, used to spread policies/buses over buckets
+unsigned int hash_string(const char* str);
+
+// the djb2 hash carried on over len more bytes, from HASH_START for the first
+// ones, e.g. of a file read in pieces. it's hash_string of them as one string
+enum {HASH_START = 5381};
+unsigned int hash_bytes(unsigned int hash, const char* buf, long len);
 #endif
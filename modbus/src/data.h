@@ -21,19 +21,77 @@
 #define INF_BCE_IOT_MODBUS_SDK_C_DATA_H
 
 #include <time.h>
+#include <stdint.h>
 #include <pthread.h>
-#include <MQTTClient.h>
+#include <MQTTAsync.h>
+#include <cjson/cJSON.h>
+
+#include "metrics.h"
+#include "realtime.h"
+#include "scheduler.h"
+#include "tsblock.h"
+#include "aggregate.h"
+#include "json_writer.h"
 
 // constants
 enum {
     UUID_LEN = 38,
     MAX_SLAVE_ID = 247,
     MODBUS_DATA_COUNT = 248,
-    MAX_CHANNEL = 256, 
+    CHANNEL_INIT_CAP = 16,          // the initial slots of the shared mqtt channels, doubled on demand
+    CHANNEL_INTERN_BUCKETS = 256,   // buckets of the interned channels of the policies
     MAX_LEN = 512,
     BUFF_LEN = 2018,
     ADDR_LEN = 64,
-    MAX_MODBUS_DATA_TO_WRITE = 123
+    MAX_MODBUS_DATA_TO_WRITE = 123,
+    MAX_BACK_CONTROL_REQUESTS = 100,    // max requests in one back control message
+    FIELD_NAME_LEN = 64,
+    MAX_SERIAL_PORT = 32,           // max serial ports declared in the gateway config
+    MAX_WORKER = 32,
+    DEFAULT_WORKER_NUM = 4,
+    MIN_INTERVAL_MS = 10,
+    MAX_IDLE_WAIT_MS = 1000,        // the longest a worker waits before re-checking stop flag
+    RANGE_BUFF_LEN = 2000,          // bytes of one read, 2000 bits or 125 registers at most
+    MSG_OVERHEAD_LEN = 1024,        // the size of the json envelope around the payload
+    MAX_POLL_BATCH = 64,            // max policies a worker executes (and coalesces) in one pass
+    COALESCE_WINDOW_MS = 20,        // policies due within this window are executed together
+    MAX_PRIORITY = 7,               // priority of a policy, 0 is critical and never shed
+    DEFAULT_PRIORITY = 4,
+    MAX_SHED_STEPS = 4,             // the interval of a shed policy is stretched up to 2^4 times
+    OVERLOAD_WINDOW_MS = 10000,     // the deadline misses of a bus are counted over this window
+    OVERLOAD_MISS_PERCENT = 10,     // a bus missing more deadlines than this sheds one more level
+    OVERLOAD_RECOVER_WINDOWS = 3,   // windows without a miss before a level is restored
+    PUB_HIGH_WATERMARK_PERCENT = 50,    // of the queue pending, a channel over it sheds one more level
+    PUB_LOW_WATERMARK_PERCENT = 10,     // a channel under it restores one level
+    PUB_PRESSURE_STEP_MS = 5000,    // the least time between two levels of a channel
+    ADAPTIVE_RELAX_PERCENT = 25,    // a stable sample relaxes an adaptive interval by this much
+    DELTA_KEYFRAME_MS = 60000,      // a delta policy publishes a full sample at least this often
+    MAX_MODBUS_CONN = 256,          // max buses(tcp endpoints or serial ports) to connect
+    MAX_PIPELINE_DEPTH = 16,        // max outstanding requests on one modbus tcp connection
+    RECONNECT_MIN_MS = 1000,        // the backoff of the first reconnect of a bus
+    RECONNECT_MAX_MS = 60000,
+    RECONNECT_CHECK_MS = 100,       // how often the reconnector looks for buses to reconnect
+    MAX_PARALLEL_CONNECTS = 32,     // the tcp buses the reconnector connects at once
+    LINK_TIMEOUT_LIMIT = 3,         // timeouts in a row before a tcp connection is reset
+    POLICY_BACKOFF_MAX_MS = 60000,  // the longest a failing policy waits, unless its interval is longer
+    DEFAULT_RESPONSE_TIMEOUT_MS = 500,  // the libmodbus default, the cap of autoTimeout
+    MIN_RESPONSE_TIMEOUT_MS = 20,   // the floor of autoTimeout
+    BROADCAST_TURNAROUND_MS = 100,  // the bus is idle this long after a broadcast, per the spec
+    RAW_FRAME_GAP_MS = 20,          // the silence ending a raw rtu response, without a byteTimeoutMs
+    STATUS_INTERVAL_MS = 60000,     // the gateway status is published at least this often
+    SUPERVISOR_RETRY_MS = 1000,     // how often the mqtt clients not connected are retried
+    MAX_POLICY_JOURNAL = 64,        // the deltas journaled before the policy cache is rewritten
+    MAX_SHARD_MEMBERS = 64,         // the gateways sharing the policies of a config
+    MAX_TENANTS = 64,               // the logical gateways served by one process
+    TRACE_PART_BYTES = 65536,       // the largest part of a trace dump, see handle_trace_msg
+    DEFAULT_BATCH_BYTES = 65536,
+    MIN_BATCH_BYTES = 4096,
+    DEFAULT_BATCH_LINGER_MS = 200,
+    DEFAULT_MQTT_QUEUE_SIZE = 1000,
+    DEFAULT_MQTT_MAX_INFLIGHT = 10,
+    DEFAULT_SPOOL_MAX_MB = 64,              // disk used by the spool of every channel
+    HISTORY_BLOCK_BYTES = 4096,     // the block of one field, uploaded early once full
+    DEFAULT_SHARED_POINTS = 10000   // the points of the shared memory table, see shm_points.h
 };
 
 // types
@@ -41,17 +99,112 @@ typedef enum
 {
     TCP = 0,
     RTU,
-    ASCII
+    ASCII,
+    RTU_OVER_TCP        // rtu frames to a serial device server, ip_com_addr is ip:port
 } ModbusMode;
 
+typedef enum
+{
+    PAYLOAD_JSON = 0,               // {"bdModbusVer":1, ...}, or the v2 batch
+    PAYLOAD_BINARY                  // the compact binary frame, see pack_binary_sample
+} PayloadFormat;
+
+// who switches the rs485 transceiver of a serial bus between sending and
+// receiving, and the level of rts while sending
+typedef enum
+{
+    RS485_ADAPTER = 0,              // the adapter itself, or the port is rs232
+    RS485_RTS_HIGH,                 // the kernel, with rts(TIOCSRS485)
+    RS485_RTS_LOW
+} Rs485Mode;
+
+// how the coils and the discrete inputs of a sample are published
+typedef enum
+{
+    BITS_AS_BYTES = 0,              // a byte(2 hex chars) per bit, as read
+    BITS_PACKED_HEX,                // 8 bits per byte in the order of the modbus frames, as hex
+    BITS_PACKED_BASE64              // the same bitset, as base64
+} BitEncoding;
+
+// how the timestamp of a sample is published
+typedef enum
+{
+    TIMESTAMP_LOCAL = 0,            // 2017-01-01 08:00:00+0800, the seconds only
+    TIMESTAMP_ISO8601_MS,           // 2017-01-01T08:00:00.123+08:00
+    TIMESTAMP_EPOCH_MS              // 1483228800123, a number
+} TimestampFormat;
+
+typedef enum
+{
+    FIELD_INT16 = 0,
+    FIELD_UINT16,
+    FIELD_INT32,
+    FIELD_UINT32,
+    FIELD_FLOAT32,
+    FIELD_INT64,
+    FIELD_UINT64,
+    FIELD_FLOAT64
+} FieldType;
+
+// a typed value decoded from the registers at the edge, see decode.h
+typedef struct
+{
+    char name[FIELD_NAME_LEN];
+    int reg;                        // offset of the first register in the range of the policy
+    FieldType type;
+    int swapBytes;                  // the low byte of every register comes first
+    int swapWords;                  // the least significant register comes first
+    double scale;                   // value = raw * scale + offset
+    double offset;
+    int bacnetInstance;             // bridge mode: the object serving the value, -1 if none
+    double alarmLow;                // with aggregateSec, the samples out of these are published
+    double alarmHigh;               // as they are, -inf and inf if not set
+} DecodeField;
+
 typedef struct
 {
     char endpoint[MAX_LEN];
     char topic[MAX_LEN];
     char user[MAX_LEN];
     char password[MAX_LEN];
+    PayloadFormat format;
+    int compress;                   // 1 if the payloads are compressed by zlib
 } Channel;
 
+// a serial port of the gateway, the bus level settings of the policies on it
+typedef struct
+{
+    char name[FIELD_NAME_LEN];      // referred by the "port" of the policies
+    char device[ADDR_LEN];          // e.g. /dev/ttyS1
+    ModbusMode mode;                // RTU(the default) or ASCII
+    int baud;
+    int databits;
+    char parity;
+    int stopbits;
+    int responseTimeoutMs;          // see SlavePolicy
+    int byteTimeoutMs;
+    int turnaroundMs;
+    int autoTimeout;
+    Rs485Mode rs485;                // see SlavePolicy
+    int rtsDelayBeforeMs;
+    int rtsDelayAfterMs;
+    int lowLatency;
+} SerialPort;
+
+// a logical gateway served by the process, with configs, a policy cache and
+// back control of its own. the first is the gateway of gwconfig itself, the
+// others are its "tenants", see load_tenants
+typedef struct
+{
+    char id[FIELD_NAME_LEN];        // names its policy cache, empty for the gateway itself
+    char topic[MAX_LEN];            // where its configs come from
+    char backControlTopic[MAX_LEN]; // optional, as the topics of the gateway
+    char ackTopic[MAX_LEN];
+    char statusTopic[MAX_LEN];
+    int maxPolicies;                // a config with more policies is refused, 0 if not limited
+    int minIntervalMs;              // its policies are polled at most this often, 0 if not limited
+} TenantConfig;
+
 typedef struct
 {
     char endpoint[MAX_LEN];
@@ -59,27 +212,174 @@ typedef struct
     char user[MAX_LEN];
     char password[MAX_LEN];
     char backControlTopic[MAX_LEN];
+    char statusTopic[MAX_LEN];      // optional, where the gateway status is published
+    char ackTopic[MAX_LEN];         // optional, where the back control results are published
+    int workerNum;                  // number of polling worker threads
+    int tcpPipelineDepth;           // max outstanding requests on one modbus tcp connection
+    int probeDevices;               // 1 to learn the read limits of the slaves, see probe.h
+    int staggerPolls;               // 1 to spread the first polls of a bus over their interval
+    TimestampFormat timestampFormat;    // the timestamp of the published samples
+    int batchMaxCount;              // max samples in one message, 1 disables batching
+    int batchMaxBytes;              // max bytes of one batched message
+    int batchLingerMs;              // max time a sample waits in the batch
+    int mqttQueueSize;              // max messages queued by every mqtt client
+    int pubBackpressure;            // 1 to shed the policies of a channel whose queue fills up
+    int rawPassThrough;             // 1 to run the raw pdus of the back control messages
+    int mqttMaxInflight;            // max messages sent but not acknowledged
+    int mqttRateLimit;              // the publishes a second of one connection, 0 if not limited
+    int mqttRateBurst;              // sent at once within the rate limit, 0 for a tenth of it
+    int pubQos;                     // qos of the published samples, 0 or 1
+    int mqttVersion;                // 5 for mqtt 5, 4 for the default 3.1.1
+    int mqttMaxPacketSize;          // with mqtt 5, the largest packet from the broker, 0 if not limited
+    char spoolDir[MAX_LEN];         // optional, where the samples are spooled while offline
+    int spoolMaxMB;                 // max disk used by the spool of one channel
+    SerialPort ports[MAX_SERIAL_PORT];  // optional, the serial ports of the gateway
+    int portNum;
+    char metricsListen[ADDR_LEN];   // optional, ip:port to serve the prometheus metrics
+    int bacnetDevice;               // bridge mode: the BACnet device instance, -1 if disabled
+    int bacnetPort;                 // the BACnet/IP udp port, 0 for the default 47808
+    char bacnetInterface[ADDR_LEN]; // the interface BACnet/IP binds to, empty for the default
+    char modbusServerListen[ADDR_LEN];  // optional, ip:port to serve the polled data on modbus tcp
+    int modbusServerMaxAgeMs;       // how long the data polled is served, 0 for 3 intervals
+    char sharedMemory[FIELD_NAME_LEN];  // optional, the shared memory table of the latest values
+    int sharedPoints;               // the points the table has room for
+    cJSON* shadow;                  // optional, the points mirrored into a device shadow, see shadow_mirror.h
+    int rtPriority;                 // SCHED_FIFO priority of the workers, 0 for the normal scheduler
+    RtCpus busCpus;                 // the cpus of the workers, 0 if not pinned
+    RtCpus otherCpus;               // the cpus of the other threads, 0 if not pinned
+    int lockMemory;                 // 1 to lock the pages of the process, see rt_lock_memory
+    char traceTopic[MAX_LEN];       // optional, the trace commands, the dump goes to traceTopic/dump
+    char shardTopic[MAX_LEN];       // optional, the gateways announcing there share the policies
+    char instanceId[FIELD_NAME_LEN];    // this gateway among them, the hostname by default
+    TenantConfig tenants[MAX_TENANTS];  // the logical gateways served, the gateway itself first
+    int tenantNum;
 } GatewayConfig;
 
 typedef struct SlavePolicy_t
 {
-    char gatewayid[UUID_LEN]; 		// the cloud logic gateway id, used to distinguish slaves
+    // the fields used by the scheduling and the coalescing come first, they
+    // share the first cache line of the policy
+    long long nextRun;    			// monotonic time(ms) for next execution of this policy
+    int interval;    				// in milliseconds
+    int adaptiveMs;                 // the interval of adaptive sampling now, 0 if the interval is fixed
+    int shedFactor;                 // the interval is stretched by this while the bus is overloaded
+    int worker;                     // index of the worker that polls this policy
+    int bus;                        // index of the bus in the bus map, -1 if not mapped
+    int modbusConn;                 // index of the bus connection in the modbus connection pool
     int slaveid;
-    ModbusMode mode;    			// tcp, rtu, ascii
-    char ip_com_addr[ADDR_LEN];
     char functioncode;
     int start_addr;
     int length;
-    int interval;    				// in seconds
-    char trantable[UUID_LEN];
-    Channel pubChannel;    			// which channel to upload(pub) data
-    time_t nextRun;    				//  time for next execution of this policy
-    struct SlavePolicy_t* next;    	// the next salve policy that need to execute
     int mqttClient;
+    int priority;                   // 0(critical) to MAX_PRIORITY, the lowest are shed first
+    struct SlavePolicy_t* next;    	// the next salve policy in the list of all loaded policies
+    char* payload;                  // hex of the data read, sized from length on load
+    char* message;                  // the message published, sized from length on load
+    int messageLen;
+    BitEncoding bitEncoding;        // of the bit functions, the payload itself is kept as read
+    int onChange;                   // report by exception, only publish when the data changes
+    int deadband;                   // with onChange, min change of a register to publish
+    int maxSilence;                 // with onChange, publish anyway after this long(ms), 0 never
+    char* lastPayload;              // the payload last published, for onChange
+    int minIntervalMs;              // with adaptive sampling, the interval shortens down to this
+    int maxIntervalMs;              // while the samples change beyond changeThreshold, and relaxes
+    int changeThreshold;            // up to this while they don't, see adapt_policy_interval
+    char* prevPayload;              // the payload of the last poll, for adaptive sampling
+    int delta;                      // publish the registers changed since the last sample published
+    int keyframeMs;                 // with delta, a full sample(keyframe) at least this often
+    uint16_t* deltaImage;           // with delta, the registers last published
+    unsigned int deltaSeq;          // with delta, the number of the last sample published, 0 before the first
+    long long lastKeyframe;         // with delta, monotonic time(ms) of the last keyframe
+    long long lastPublish;          // monotonic time(ms) of the last publish
+    char scanGroup[FIELD_NAME_LEN]; // optional, the policies of a scan group are read and published together
+    struct SlavePolicy_t* scanLeader;   // the first policy of its scan group, NULL for the first itself
+    struct SlavePolicy_t* scanNext;     // the next policy of the scan group, chained from the first
+    unsigned long long polls;       // metrics, kept across the reloads
+    unsigned long long pollErrors;
+    unsigned long long exceptions;  // the polls answered with a modbus exception
+    int lastError;                  // errno of the last poll, 0 if it succeeded
+    int errorStreak;                // polls in a row failed on a working bus, for the backoff
+    DecodeField* fields;            // optional, decoded and published along with the raw data
+    struct PolicyTemplate_t* tmpl;  // the template of the policy, NULL if none, see template.h
+    int fieldNum;
+    int historyMs;                  // optional, the fields are uploaded as blocks this often, 0 disables
+    TsBlock* history;               // a block per field, allocated on the first sample
+    long long historyStart;         // monotonic time(ms) of the first sample in the blocks
+    int aggregateHopMs;             // optional, the fields are published as summaries this often, 0 disables
+    int aggregatePanes;             // the window is this many hops, 1 for tumbling windows
+    AggWindow* aggregates;          // a window per field, allocated on the first sample
+    long long aggregateStart;       // monotonic time(ms) the current hop started
+    int aggregateAlarm;             // the last sample had a field out of its alarm limits
+    int bacnetBinaryInputs;         // bridge mode: the Binary Input of the first bit, -1 if none
+    int bacnetPoint;                // bridge mode: the first point of the policy in the point
+    int bacnetPointNum;             // table and the number of them, see bacnet_bridge.h
+    int serverUnitId;               // the unit id served by the modbus server, -1 for the slaveid
+    int serverMaxAgeMs;             // how long the data polled is served, 0 for the server default
+    int serverImage;                // the image in the modbus server, -1 if none, see modbus_server.h
+    int sharedPoint;                // the first point in the shared memory table and the
+    int sharedPointNum;             // number of them, see layout_shared_points
+    int shadowPoint;                // the first point in the shadow mirror and the number
+    int shadowPointNum;             // of them, see layout_shadow_points
+
+    // the config of the bus and the channel, only used on load and on publish
+    Channel* pubChannel;    		// which channel to upload(pub) data, interned, see intern_channel
+    ModbusMode mode;    			// tcp, rtu, ascii, rtu over tcp
     int baud;
     int databits;
     char parity;
     int stopbits;
+    int responseTimeoutMs;          // 0 for the libmodbus default, the cap with autoTimeout
+    int byteTimeoutMs;              // 0 for the libmodbus default
+    int turnaroundMs;               // rtu: idle time between requests, -1 for the 3.5 char time
+    int autoTimeout;                // the response timeout follows the measured response times
+    Rs485Mode rs485;                // rtu and ascii: the kernel switches the transceiver, no gap of its own
+    int rtsDelayBeforeMs;           // with rs485, rts is set this long before a frame
+    int rtsDelayAfterMs;            // and kept this long after it
+    int lowLatency;                 // rtu and ascii: 1(the default) for ASYNC_LOW_LATENCY on the port
+    char gatewayid[UUID_LEN]; 		// the cloud logic gateway id, used to distinguish slaves
+    char trantable[UUID_LEN];
+    char ip_com_addr[ADDR_LEN];
+    char port[FIELD_NAME_LEN];      // the serial port in the gateway config, empty if not used
+    char* config;                   // the policy as loaded, to tell if it's changed on reload
+    int tenant;                     // the logical gateway of the policy, see TenantConfig
+    JwFragment envelope;            // the gatewayid, the trantable and the request, see add_request_fields
+    unsigned long long traceId;     // the sample of the last poll, 0 if not traced, see trace.h
 } SlavePolicy;
 
+// the samples waiting to be published together on one channel
+typedef struct
+{
+    pthread_mutex_t lock;
+    char* buff;                     // the message being built, batchMaxBytes long
+    int len;
+    int count;                      // samples in the batch
+    long long firstSample;          // monotonic time(ms) the first sample was added
+    unsigned long long traceId;     // of the first sample, 0 if not traced
+    int pressureLevel;              // the shed level of the channel as its queue fills, see pubBackpressure
+    long long pressureChanged;      // monotonic time(ms) the level last changed
+} PubBatch;
+
+// a polling worker owns the policies of one or more buses, policies that
+// share the same ip_com_addr always land on the same worker, so a bus is
+// never accessed concurrently
+typedef struct
+{
+    int id;
+    pthread_t thread;
+    pthread_mutex_t lock;           // guards the schedule of this worker
+    pthread_cond_t wakeup;          // signaled when the schedule is changed by others
+    Scheduler schedule;             // policies of this worker, ordered by nextRun
+    uint8_t* rangeBuff;             // scratch for the reads of one batch, see read_modbus_coalesced
+    Histogram jitter;               // how late the worker woke up after its timer, us
+} PollWorker;
+
+// the metrics of the gateway, updated without locks, see metrics.h
+typedef struct
+{
+    Histogram lateness;             // when a poll starts minus its nextRun, us
+    Histogram publish;              // queued to acknowledged by the broker, us
+    unsigned long long polls;
+    unsigned long long pollErrors;
+} GatewayMetrics;
+
 #endif 
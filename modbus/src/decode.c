@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "decode.h"
+#include "common.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* const FIELD_TYPE_NAMES[] = {
+    "int16", "uint16", "int32", "uint32", "float32", "int64", "uint64", "float64"
+};
+
+int field_registers(FieldType type)
+{
+    switch (type)
+    {
+        case FIELD_INT32:
+        case FIELD_UINT32:
+        case FIELD_FLOAT32:
+            return 2;
+        case FIELD_INT64:
+        case FIELD_UINT64:
+        case FIELD_FLOAT64:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+int parse_field_type(const char* name)
+{
+    int i = 0;
+    for (i = 0; i < (int)(sizeof(FIELD_TYPE_NAMES) / sizeof(FIELD_TYPE_NAMES[0])); i++)
+    {
+        if (strcmp(name, FIELD_TYPE_NAMES[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int is_little(cJSON* item, const char* key)
+{
+    cJSON* value = cJSON_GetObjectItem(item, key);
+    return cJSON_IsString(value) && strcmp(value->valuestring, "little") == 0;
+}
+
+int parse_decode_fields(cJSON* array, int length, DecodeField** fields)
+{
+    *fields = NULL;
+    int num = cJSON_GetArraySize(array);
+    if (num <= 0)
+    {
+        return 0;
+    }
+    DecodeField* result = (DecodeField*) calloc(num, sizeof(DecodeField));
+    if (result == NULL)
+    {
+        return 0;
+    }
+    int count = 0;
+    int i = 0;
+    for (i = 0; i < num; i++)
+    {
+        cJSON* item = cJSON_GetArrayItem(array, i);
+        cJSON* name = cJSON_GetObjectItem(item, "name");
+        cJSON* type = cJSON_GetObjectItem(item, "type");
+        int t = cJSON_IsString(type) ? parse_field_type(type->valuestring) : -1;
+        int reg = cJSON_HasObjectItem(item, "reg") ? json_int(item, "reg") : 0;
+        if (!cJSON_IsString(name) || t < 0 || reg < 0 
+            || reg + field_registers((FieldType)t) > length)
+        {
+            printf("invalid field %d of the policy, skipped\n", i);
+            continue;
+        }
+        DecodeField* f = &result[count++];
+        mystrncpy(f->name, name->valuestring, FIELD_NAME_LEN);
+        f->reg = reg;
+        f->type = (FieldType)t;
+        f->swapBytes = is_little(item, "byteOrder");
+        f->swapWords = is_little(item, "wordOrder");
+        cJSON* scale = cJSON_GetObjectItem(item, "scale");
+        f->scale = cJSON_IsNumber(scale) ? scale->valuedouble : 1;
+        cJSON* offset = cJSON_GetObjectItem(item, "offset");
+        f->offset = cJSON_IsNumber(offset) ? offset->valuedouble : 0;
+        cJSON* bacnet = cJSON_GetObjectItem(item, "bacnet");
+        f->bacnetInstance = cJSON_IsNumber(bacnet) && bacnet->valueint >= 0 ? bacnet->valueint : -1;
+        cJSON* low = cJSON_GetObjectItem(item, "alarmLow");
+        f->alarmLow = cJSON_IsNumber(low) ? low->valuedouble : -INFINITY;
+        cJSON* high = cJSON_GetObjectItem(item, "alarmHigh");
+        f->alarmHigh = cJSON_IsNumber(high) ? high->valuedouble : INFINITY;
+    }
+    if (count == 0)
+    {
+        free(result);
+        return 0;
+    }
+    *fields = result;
+    return count;
+}
+
+void swap_register_bytes(uint16_t* regs, int count)
+{
+    int i = 0;
+    for (i = 0; i < count; i++)
+    {
+        regs[i] = (uint16_t)((regs[i] << 8) | (regs[i] >> 8));
+    }
+}
+
+double decode_field(const DecodeField* field, const uint16_t* regs, const uint16_t* swapped)
+{
+    const uint16_t* src = (field->swapBytes ? swapped : regs) + field->reg;
+    int n = field_registers(field->type);
+    // the registers combined, the most significant first
+    uint64_t bits = 0;
+    int i = 0;
+    for (i = 0; i < n; i++)
+    {
+        bits = (bits << 16) | src[field->swapWords ? n - 1 - i : i];
+    }
+
+    double value = 0;
+    switch (field->type)
+    {
+        case FIELD_INT16:
+            value = (int16_t)bits;
+            break;
+        case FIELD_UINT16:
+            value = (uint16_t)bits;
+            break;
+        case FIELD_INT32:
+            value = (int32_t)bits;
+            break;
+        case FIELD_UINT32:
+            value = (uint32_t)bits;
+            break;
+        case FIELD_FLOAT32:
+        {
+            uint32_t b32 = (uint32_t)bits;
+            float f = 0;
+            memcpy(&f, &b32, sizeof(f));
+            value = f;
+            break;
+        }
+        case FIELD_INT64:
+            value = (double)(int64_t)bits;
+            break;
+        case FIELD_UINT64:
+            value = (double)bits;
+            break;
+        case FIELD_FLOAT64:
+            memcpy(&value, &bits, sizeof(value));
+            break;
+    }
+    return value * field->scale + field->offset;
+}
+
+// round and saturate to [lo, hi]
+double round_saturate(double value, double lo, double hi)
+{
+    value = round(value);
+    if (value < lo)
+    {
+        return lo;
+    }
+    return value > hi ? hi : value;
+}
+
+int encode_field(const DecodeField* field, double value, uint16_t* regs)
+{
+    double raw = field->scale != 0 ? (value - field->offset) / field->scale : 0;
+    uint64_t bits = 0;
+    switch (field->type)
+    {
+        case FIELD_INT16:
+            bits = (uint16_t)(int16_t)round_saturate(raw, INT16_MIN, INT16_MAX);
+            break;
+        case FIELD_UINT16:
+            bits = (uint16_t)round_saturate(raw, 0, UINT16_MAX);
+            break;
+        case FIELD_INT32:
+            bits = (uint32_t)(int32_t)round_saturate(raw, INT32_MIN, INT32_MAX);
+            break;
+        case FIELD_UINT32:
+            bits = (uint32_t)round_saturate(raw, 0, UINT32_MAX);
+            break;
+        case FIELD_FLOAT32:
+        {
+            float f = (float)raw;
+            uint32_t b32 = 0;
+            memcpy(&b32, &f, sizeof(b32));
+            bits = b32;
+            break;
+        }
+        case FIELD_INT64:
+            // the doubles next to the limits don't fit, 2^63 is the first one out
+            raw = round_saturate(raw, -9223372036854775808.0, 9223372036854774784.0);
+            bits = (uint64_t)(int64_t)raw;
+            break;
+        case FIELD_UINT64:
+            bits = (uint64_t)round_saturate(raw, 0, 18446744073709549568.0);
+            break;
+        case FIELD_FLOAT64:
+            memcpy(&bits, &raw, sizeof(bits));
+            break;
+    }
+    int n = field_registers(field->type);
+    int i = 0;
+    for (i = 0; i < n; i++)
+    {
+        // the most significant first, as decode_field combines them
+        uint16_t reg = (uint16_t)(bits >> (16 * (n - 1 - i)));
+        if (field->swapBytes)
+        {
+            reg = (uint16_t)((reg << 8) | (reg >> 8));
+        }
+        regs[field->swapWords ? n - 1 - i : i] = reg;
+    }
+    return n;
+}
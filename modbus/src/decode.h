@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_MODBUS_SDK_C_DECODE_H
+#define INF_BCE_IOT_MODBUS_SDK_C_DECODE_H
+
+#include "data.h"
+
+#include <stdint.h>
+#include <cjson/cJSON.h>
+
+// typed values decoded from the registers at the edge, so that the cloud
+// doesn't have to parse the hex of simple devices. a policy may list them as
+//     "fields": [{"name": "temperature", "reg": 0, "type": "float32",
+//                 "byteOrder": "big", "wordOrder": "little", 
+//                 "scale": 0.1, "offset": -40}]
+// type is one of int16, uint16, int32, uint32, float32, int64, uint64, float64.
+// byteOrder is the order of the 2 bytes in a register, wordOrder the order of
+// the registers of a 32/64 bit value, both "big"(the default) or "little".
+// "bacnet": instance is optional, the BACnet object serving the field in the
+// bridge mode, see bacnet_bridge.h
+
+// parse the fields of a policy reading length registers, the invalid ones are
+// skipped. return the number of fields, *fields should be freed by the caller
+int parse_decode_fields(cJSON* array, int length, DecodeField** fields);
+
+// the number of registers taken by the type
+int field_registers(FieldType type);
+
+// swap the 2 bytes of every register in place. it's a plain loop over the
+// whole buffer, which the compiler vectorizes
+void swap_register_bytes(uint16_t* regs, int count);
+
+// decode the field from the registers read, swapped is a copy of regs with the
+// bytes swapped, only needed if any field has swapBytes
+double decode_field(const DecodeField* field, const uint16_t* regs, const uint16_t* swapped);
+
+// the reverse of decode_field, the registers of value are put into regs as
+// they are sent on the bus, the integers are rounded and saturated.
+// return the number of registers
+int encode_field(const DecodeField* field, double value, uint16_t* regs);
+
+#endif
@@ -0,0 +1,495 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "modbus_server.h"
+#include "common.h"
+#include "modbuslib.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+enum {
+    SERVER_MAX_CLIENTS = 16,        // the clients connected at once, the next ones are closed
+    SERVER_SELECT_MS = 100,         // the longest the server waits before re-checking stop flag
+    SERVER_ADDRESSES = 0x10000,     // the addresses of every table
+    DEFAULT_SERVED_INTERVALS = 3    // the image of a policy is served for 3 intervals by default
+};
+
+// the data last polled by a policy, served at the addresses it's read from
+typedef struct
+{
+    int unit;
+    int functioncode;               // 1 to 4, the table of the image
+    int start;
+    int count;
+    int maxAgeMs;
+    long long polledAt;             // monotonic time(ms) of the poll, 0 if not polled yet
+    uint16_t* values;               // the registers, or 0 and 1 for the bits
+    SlavePolicy* policy;            // only used on load
+} ServedImage;
+
+// the images ordered by unit, table and start address, the values are
+// written by the workers and served by the server thread
+pthread_mutex_t g_server_lock = PTHREAD_MUTEX_INITIALIZER;
+ServedImage* g_server_images = NULL;
+int g_server_image_num = 0;
+uint16_t* g_server_values = NULL;   // the values of all the images
+
+// the response of a read is built in a mapping of the whole address space,
+// only touched by the server thread
+modbus_t* g_server_ctx = NULL;
+modbus_mapping_t* g_server_mapping = NULL;
+int g_server_socket = -1;
+int g_server_clients[SERVER_MAX_CLIENTS];
+int g_server_client_num = 0;
+pthread_t g_server_thread;
+int g_server_started = 0;
+volatile int g_server_stop = 0;
+int g_server_max_age_ms = 0;        // the age limit of the policies without their own
+
+// metrics
+unsigned long long g_server_served = 0;
+unsigned long long g_server_stale = 0;
+unsigned long long g_server_rejected = 0;
+
+int compare_served_images(const void* a, const void* b)
+{
+    const ServedImage* ia = (const ServedImage*) a;
+    const ServedImage* ib = (const ServedImage*) b;
+    if (ia->unit != ib->unit)
+    {
+        return ia->unit - ib->unit;
+    }
+    if (ia->functioncode != ib->functioncode)
+    {
+        return ia->functioncode - ib->functioncode;
+    }
+    return ia->start - ib->start;
+}
+
+// the first image of the table of the unit starting at or after start,
+// num if none
+int find_served_image(ServedImage* images, int num, int unit, int functioncode, int start)
+{
+    ServedImage key;
+    key.unit = unit;
+    key.functioncode = functioncode;
+    key.start = start;
+    int lo = 0;
+    int hi = num;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (compare_served_images(&images[mid], &key) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int is_served_policy(SlavePolicy* policy)
+{
+    return policy->functioncode >= 1 && policy->functioncode <= 4 && policy->slaveid != 0
+        && policy->length > 0;
+}
+
+void modbus_server_load(SlavePolicy* policies)
+{
+    int num = 0;
+    int values = 0;
+    SlavePolicy* policy = NULL;
+    for (policy = policies; policy != NULL; policy = policy->next)
+    {
+        policy->serverImage = -1;
+        if (is_served_policy(policy))
+        {
+            num++;
+            values += policy->length;
+        }
+    }
+    if (!g_server_started)
+    {
+        return;
+    }
+    ServedImage* images = (ServedImage*) calloc(num > 0 ? num : 1, sizeof(ServedImage));
+    uint16_t* data = (uint16_t*) calloc(values > 0 ? values : 1, sizeof(uint16_t));
+    if (images == NULL || data == NULL)
+    {
+        printf("out of memory while loading the images of the modbus server, none is served\n");
+        free(images);
+        free(data);
+        return;
+    }
+
+    int n = 0;
+    uint16_t* next = data;
+    for (policy = policies; policy != NULL; policy = policy->next)
+    {
+        if (!is_served_policy(policy))
+        {
+            continue;
+        }
+        ServedImage* image = &images[n++];
+        image->unit = policy->serverUnitId >= 0 ? policy->serverUnitId : policy->slaveid;
+        image->functioncode = policy->functioncode;
+        image->start = policy->start_addr;
+        image->count = policy->length;
+        image->maxAgeMs = policy->serverMaxAgeMs > 0 ? policy->serverMaxAgeMs 
+            : g_server_max_age_ms > 0 ? g_server_max_age_ms 
+            : DEFAULT_SERVED_INTERVALS * (policy->maxIntervalMs > policy->interval 
+                ? policy->maxIntervalMs : policy->interval);
+        image->values = next;
+        image->policy = policy;
+        next += policy->length;
+    }
+    qsort(images, n, sizeof(ServedImage), compare_served_images);
+
+    pthread_mutex_lock(&g_server_lock);
+    // an image keeps the data of the same range polled before the reload
+    int i = 0;
+    for (i = 0; i < n; i++)
+    {
+        ServedImage* image = &images[i];
+        image->policy->serverImage = i;
+        int old = find_served_image(g_server_images, g_server_image_num, image->unit,
+            image->functioncode, image->start);
+        for (; old < g_server_image_num && compare_served_images(&g_server_images[old], image) == 0;
+            old++)
+        {
+            if (g_server_images[old].count == image->count)
+            {
+                memcpy(image->values, g_server_images[old].values, image->count * sizeof(uint16_t));
+                image->polledAt = g_server_images[old].polledAt;
+                break;
+            }
+        }
+    }
+    ServedImage* old_images = g_server_images;
+    uint16_t* old_values = g_server_values;
+    g_server_images = images;
+    g_server_values = data;
+    g_server_image_num = n;
+    pthread_mutex_unlock(&g_server_lock);
+    free(old_images);
+    free(old_values);
+    printf("%d policies served by the modbus server\n", n);
+}
+
+void modbus_server_update(SlavePolicy* policy)
+{
+    if (policy->serverImage < 0 || policy->payload[0] == 0)
+    {
+        return;
+    }
+    // decoded without the lock
+    uint16_t values[RANGE_BUFF_LEN];
+    int count = 0;
+    if (is_bit_function(policy->functioncode))
+    {
+        uint8_t bits[RANGE_BUFF_LEN];
+        count = char2uint8(bits, RANGE_BUFF_LEN, policy->payload);
+        int i = 0;
+        for (i = 0; i < count; i++)
+        {
+            values[i] = bits[i] != 0;
+        }
+    }
+    else
+    {
+        count = char2uint16(values, MODBUS_MAX_READ_REGISTERS, policy->payload);
+    }
+    if (count != policy->length)
+    {
+        return;
+    }
+
+    long long now = monotonic_ms();
+    pthread_mutex_lock(&g_server_lock);
+    ServedImage* image = &g_server_images[policy->serverImage];
+    memcpy(image->values, values, count * sizeof(uint16_t));
+    image->polledAt = now;
+    pthread_mutex_unlock(&g_server_lock);
+}
+
+// the rest runs in the server thread
+
+// copy the values of the addresses read into the mapping, each from the
+// freshest image holding it. return the modbus exception of the read, 0 if none.
+// must be called with the server lock held
+int copy_served_values(int unit, int functioncode, int addr, int nb, long long now)
+{
+    int first = find_served_image(g_server_images, g_server_image_num, unit, functioncode, 0);
+    int end = addr + nb;
+    int stale = 0;
+    while (addr < end)
+    {
+        ServedImage* best = NULL;
+        int i = 0;
+        for (i = first; i < g_server_image_num && g_server_images[i].unit == unit
+            && g_server_images[i].functioncode == functioncode 
+            && g_server_images[i].start <= addr; i++)
+        {
+            ServedImage* image = &g_server_images[i];
+            if (addr < image->start + image->count && (best == NULL || image->polledAt > best->polledAt))
+            {
+                best = image;
+            }
+        }
+        if (best == NULL)
+        {
+            return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        }
+        if (best->polledAt == 0 || now - best->polledAt > best->maxAgeMs)
+        {
+            stale = 1;
+        }
+        int stop = best->start + best->count < end ? best->start + best->count : end;
+        for (; addr < stop; addr++)
+        {
+            uint16_t value = best->values[addr - best->start];
+            switch (functioncode)
+            {
+                case 1:
+                    g_server_mapping->tab_bits[addr] = (uint8_t) value;
+                    break;
+                case 2:
+                    g_server_mapping->tab_input_bits[addr] = (uint8_t) value;
+                    break;
+                case 3:
+                    g_server_mapping->tab_registers[addr] = value;
+                    break;
+                default:
+                    g_server_mapping->tab_input_registers[addr] = value;
+                    break;
+            }
+        }
+    }
+    return stale ? MODBUS_EXCEPTION_GATEWAY_TARGET : 0;
+}
+
+void serve_request(const uint8_t* query, int len)
+{
+    int offset = modbus_get_header_length(g_server_ctx);
+    int unit = query[offset - 1];
+    int functioncode = query[offset];
+    int exception = 0;
+    if (functioncode < 1 || functioncode > 4 || len < offset + 5)
+    {
+        exception = MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+    }
+    else
+    {
+        int addr = (query[offset + 1] << 8) | query[offset + 2];
+        int nb = (query[offset + 3] << 8) | query[offset + 4];
+        int max = is_bit_function((char) functioncode) ? MODBUS_MAX_READ_BITS 
+            : MODBUS_MAX_READ_REGISTERS;
+        if (nb < 1 || nb > max)
+        {
+            exception = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+        }
+        else if (addr + nb > SERVER_ADDRESSES)
+        {
+            exception = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        }
+        else
+        {
+            long long now = monotonic_ms();
+            pthread_mutex_lock(&g_server_lock);
+            exception = copy_served_values(unit, functioncode, addr, nb, now);
+            pthread_mutex_unlock(&g_server_lock);
+        }
+    }
+    if (exception == 0)
+    {
+        // the mapping is only touched by this thread, so the reply is sent
+        // without the lock
+        modbus_reply(g_server_ctx, query, len, g_server_mapping);
+        counter_add(&g_server_served, 1);
+        return;
+    }
+    modbus_reply_exception(g_server_ctx, query, exception);
+    counter_add(exception == MODBUS_EXCEPTION_GATEWAY_TARGET ? &g_server_stale 
+        : &g_server_rejected, 1);
+}
+
+void accept_server_client()
+{
+    // not modbus_tcp_accept, some versions close the listening socket on failure
+    int client = accept(g_server_socket, NULL, NULL);
+    if (client < 0)
+    {
+        return;
+    }
+    if (g_server_client_num == SERVER_MAX_CLIENTS)
+    {
+        log_debug("too many modbus server clients, the new one is closed");
+        close(client);
+        return;
+    }
+    g_server_clients[g_server_client_num++] = client;
+}
+
+void* server_func(void* arg)
+{
+    uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
+    while (!g_server_stop)
+    {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(g_server_socket, &fds);
+        int max_fd = g_server_socket;
+        int i = 0;
+        for (i = 0; i < g_server_client_num; i++)
+        {
+            FD_SET(g_server_clients[i], &fds);
+            max_fd = g_server_clients[i] > max_fd ? g_server_clients[i] : max_fd;
+        }
+        struct timeval timeout = {0, SERVER_SELECT_MS * 1000};
+        if (select(max_fd + 1, &fds, NULL, NULL, &timeout) <= 0)
+        {
+            continue;
+        }
+        if (FD_ISSET(g_server_socket, &fds))
+        {
+            accept_server_client();
+        }
+        for (i = 0; i < g_server_client_num; i++)
+        {
+            if (!FD_ISSET(g_server_clients[i], &fds))
+            {
+                continue;
+            }
+            modbus_set_socket(g_server_ctx, g_server_clients[i]);
+            int len = modbus_receive(g_server_ctx, query);
+            if (len > 0)
+            {
+                serve_request(query, len);
+            }
+            else if (len == -1)
+            {
+                // closed by the client, or a broken request
+                close(g_server_clients[i]);
+                g_server_clients[i--] = g_server_clients[--g_server_client_num];
+            }
+        }
+    }
+    return NULL;
+}
+
+int modbus_server_start(const GatewayConfig* conf)
+{
+    char host[ADDR_LEN];
+    mystrncpy(host, conf->modbusServerListen, ADDR_LEN);
+    char* colon = strrchr(host, ':');
+    if (colon == NULL)
+    {
+        printf("the listen of modbusServer should be ip:port, got %s\n", host);
+        return -1;
+    }
+    *colon = 0;
+    g_server_ctx = modbus_new_tcp(host, atoi(colon + 1));
+    g_server_mapping = modbus_mapping_new(SERVER_ADDRESSES, SERVER_ADDRESSES, 
+        SERVER_ADDRESSES, SERVER_ADDRESSES);
+    if (g_server_ctx == NULL || g_server_mapping == NULL)
+    {
+        printf("failed to create the modbus server\n");
+        modbus_server_stop();
+        return -1;
+    }
+    g_server_socket = modbus_tcp_listen(g_server_ctx, SERVER_MAX_CLIENTS);
+    if (g_server_socket < 0)
+    {
+        printf("failed to listen on %s for the modbus server: %s\n", conf->modbusServerListen,
+            modbus_strerror(errno));
+        modbus_server_stop();
+        return -1;
+    }
+    g_server_stop = 0;
+    g_server_client_num = 0;
+    g_server_max_age_ms = conf->modbusServerMaxAgeMs;
+    if (pthread_create(&g_server_thread, NULL, server_func, NULL) != 0)
+    {
+        printf("failed to start the modbus server\n");
+        modbus_server_stop();
+        return -1;
+    }
+    g_server_started = 1;
+    printf("serving the polled data on modbus tcp %s\n", conf->modbusServerListen);
+    return 0;
+}
+
+void modbus_server_stop()
+{
+    if (g_server_started)
+    {
+        g_server_stop = 1;
+        pthread_join(g_server_thread, NULL);
+        g_server_started = 0;
+    }
+    while (g_server_client_num > 0)
+    {
+        close(g_server_clients[--g_server_client_num]);
+    }
+    if (g_server_socket >= 0)
+    {
+        close(g_server_socket);
+        g_server_socket = -1;
+    }
+    if (g_server_ctx != NULL)
+    {
+        modbus_free(g_server_ctx);
+        g_server_ctx = NULL;
+    }
+    if (g_server_mapping != NULL)
+    {
+        modbus_mapping_free(g_server_mapping);
+        g_server_mapping = NULL;
+    }
+    pthread_mutex_lock(&g_server_lock);
+    free(g_server_images);
+    free(g_server_values);
+    g_server_images = NULL;
+    g_server_values = NULL;
+    g_server_image_num = 0;
+    pthread_mutex_unlock(&g_server_lock);
+}
+
+void modbus_server_metrics(MetricsText* t)
+{
+    if (!g_server_started)
+    {
+        return;
+    }
+    mt_type(t, "modbus_server_requests_total", "counter");
+    mt_value(t, "modbus_server_requests_total", "result=\"served\"", counter_get(&g_server_served));
+    mt_value(t, "modbus_server_requests_total", "result=\"stale\"", counter_get(&g_server_stale));
+    mt_value(t, "modbus_server_requests_total", "result=\"rejected\"", 
+        counter_get(&g_server_rejected));
+}
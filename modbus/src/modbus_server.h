@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef INF_BCE_IOT_MODBUS_SDK_C_MODBUS_SERVER_H
+#define INF_BCE_IOT_MODBUS_SDK_C_MODBUS_SERVER_H
+
+#include "data.h"
+
+// the local modbus tcp server, the registers and bits last polled are served
+// to the local clients(hmi, historian, ...), so that a slow bus is polled once
+// for all of them. a read is answered from the images kept of the polls,
+// never waiting for the bus:
+//   - the unit id of a request is the slaveid of the policies, or the
+//     "serverUnitId" of a policy, to tell apart the slaves of the buses
+//   - the image of a policy is served for "serverMaxAgeMs" after the poll,
+//     the "maxAgeMs" of the server, or 3 intervals of the policy by default.
+//     once older, the read gets exception 0x0B(gateway target failed to
+//     respond), and a read of any address not polled gets 0x02
+//   - the server is read only, the other functions get exception 0x01
+// it's enabled by the gateway config, e.g.
+//     "modbusServer": {"listen": "0.0.0.0:502", "maxAgeMs": 10000}
+
+// start serving in a thread of its own, before the policies are loaded.
+// return 0 on success
+int modbus_server_start(const GatewayConfig* conf);
+
+void modbus_server_stop();
+
+// rebuild the images from the loaded policies, the images of the policies
+// kept are kept too, nothing is served if the server isn't started.
+// must be called with all the workers locked
+void modbus_server_load(SlavePolicy* policies);
+
+// copy the data just polled by the policy into its image, called by the
+// worker owning the policy
+void modbus_server_update(SlavePolicy* policy);
+
+// the prometheus metrics of the server
+void modbus_server_metrics(MetricsText* t);
+
+#endif
@@ -18,233 +18,1776 @@
  */
 
 #include "modbuslib.h"
+#include "common.h"
+#include "transport.h"
+#include "probe.h"
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <modbus/modbus.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
-modbus_t* g_modbus_ctxs[MODBUS_DATA_COUNT];
+// a write queued by queue_modbus_write, run on the bus by the worker polling it
+typedef struct ModbusWrite_t
+{
+    int slaveid;
+    int address;
+    char* data;
+    int readback;                   // read the registers back in the same request
+    long long queuedUs;             // monotonic time(us) it's queued, for the latency
+    ModbusWriteDone* done;
+    void* arg;
+    // instead of the write, the raw requests of queue_modbus_raw
+    ModbusRaw* raw;
+    int rawNum;
+    ModbusRawDone* rawDone;
+    int priority;                   // the queue is sorted by it, see queue_modbus_raw
+    struct ModbusWrite_t* next;
+} ModbusWrite;
 
-void init_modbus_context(SlavePolicy* policy)
+// a connection to a bus, i.e. a tcp endpoint or a serial port. it's shared
+// by all the slaves(unit ids) behind it, the unit id is set per request
+typedef struct
 {
-    if (policy == NULL)
+    ModbusMode mode;
+    char ip_com_addr[ADDR_LEN];
+    int baud;
+    int databits;
+    char parity;
+    int stopbits;
+    Rs485Mode rs485;                // the line settings of a serial bus, see SlavePolicy
+    int rtsDelayBeforeMs;
+    int rtsDelayAfterMs;
+    int lowLatency;
+    modbus_t* ctx;                  // NULL if not connected
+    pthread_mutex_t lock;           // serializes the requests on this bus
+    uint16_t tid;                   // the last transaction id of pipelined requests
+    int failures;                   // consecutive failed connects, 0 when online
+    int timeouts;                   // consecutive requests timed out, 0 after any reply
+    long long nextRetry;            // monotonic time(ms) to try reconnecting
+    unsigned int seed;              // for the jitter of the reconnect backoff
+    int inUse;                      // 0 if no policy is on the bus since the last reload
+    int responseTimeoutMs;          // as configured, see SlavePolicy
+    int byteTimeoutMs;
+    int autoTimeout;
+    long long turnaroundUs;         // the bus is left idle this long between requests
+    long long timeoutUs;            // the response timeout in effect, 0 for the default
+    long long srttUs;               // smoothed response time and its variation, for autoTimeout
+    long long rttvarUs;
+    long long lastEndUs;            // monotonic time(us) the last request on the bus is done
+    long long quietUntilUs;         // the bus is kept idle until then after a broadcast
+    pthread_mutex_t writeLock;      // guards the write queue, it's not held while writing
+    ModbusWrite* writeHead;         // the queued writes, run before any read on the bus
+    ModbusWrite* writeTail;
+    int pendingWrites;
+    long long writes;               // statistics of the queued writes
+    long long writeLatencyUs;       // the sum of the latencies, queued to done
+    char name[FIELD_NAME_LEN];      // the serial port in the gateway config, may be empty
+    long long busyUs;               // time spent in requests since statSinceUs
+    long long requests;
+    long long statSinceUs;
+    Histogram transaction;          // the durations of the requests, us
+    unsigned long long errors;      // the failed requests
+    unsigned long long connects;    // the successful connects, the first one included
+} ModbusConn;
+
+int write_modbus_conn(ModbusConn* conn, int slaveid, int startAddress, char* data);
+
+int write_and_read_modbus_conn(ModbusConn* conn, int slaveid, int startAddress, char* data, 
+    char* readback);
+
+int broadcast_modbus_conn(ModbusConn* conn, int startAddress, char* data);
+
+void run_modbus_raw(ModbusConn* conn, ModbusWrite* w);
+
+// a merged range of the policies due at the same time, read in one request
+typedef struct
+{
+    SlavePolicy* first;             // the slave and function code to read with
+    int begin;                      // the merged policies are sorted[begin, end)
+    int end;
+    int start_addr;
+    int nb;
+    void* data;
+    int rc;                         // 0 on success, -1 otherwise
+    int err;                        // the errno of the failure
+} ReadRange;
+
+// how a request failed, told by the errno left by libmodbus or the ascii transport
+typedef enum
+{
+    MODBUS_FAIL_LINK = 0,           // the connection is broken or out of sync, reset it
+    MODBUS_FAIL_TIMEOUT,            // the slave didn't answer, or the frame is garbled
+    MODBUS_FAIL_EXCEPTION           // the slave answered with an exception
+} ModbusFailure;
+
+ModbusConn g_modbus_conns[MAX_MODBUS_CONN];
+int g_modbus_conn_num = 0;
+// guards the pool itself, the connections are only added/released on policy reload.
+// a released connection keeps its slot, so the indexes held by the policies stay valid
+pthread_mutex_t g_modbus_conn_lock = PTHREAD_MUTEX_INITIALIZER;
+// the bus a slave is seen first, for the back control requests without address
+int g_slave_conn[MODBUS_DATA_COUNT];
+// max outstanding requests on one modbus tcp connection, 1 disables pipelining
+int g_pipeline_depth = 1;
+// bumped whenever the pool is cleaned up, so the reconnector can tell
+// that the connection it was connecting is gone
+int g_modbus_conn_generation = 0;
+// set when any connection goes offline or comes back, cleared by the reader
+int g_modbus_status_changed = 0;
+int g_stop_reconnector = 0;
+pthread_t g_reconnector_thread;
+void (*g_status_listener)(void) = NULL;
+
+void note_status_changed()
+{
+    g_modbus_status_changed = 1;
+    if (g_status_listener != NULL)
     {
-        return;
+        g_status_listener();
     }
+}
 
-    if (g_modbus_ctxs[policy->slaveid] != NULL)
+// set the timeouts of the bus on the context
+void apply_modbus_timeouts(ModbusConn* conn, modbus_t* ctx)
+{
+    if (conn->timeoutUs > 0)
+    {
+        modbus_set_response_timeout(ctx, conn->timeoutUs / 1000000, conn->timeoutUs % 1000000);
+    }
+    if (conn->byteTimeoutMs > 0)
     {
-        return; // already initialized
+        modbus_set_byte_timeout(ctx, conn->byteTimeoutMs / 1000, (conn->byteTimeoutMs % 1000) * 1000);
     }
+}
 
-    modbus_t* ctx = NULL;
-    if (policy->mode == TCP)
+// the host and the port of a tcp bus, from its ip:port, 502 by default
+void tcp_addr_of(ModbusConn* conn, char* ip, int len, int* port)
+{
+    mystrncpy(ip, conn->ip_com_addr, len < ADDR_LEN ? len : ADDR_LEN);
+    *port = 502;
+    char* colon = strchr(ip, ':');
+    if (colon != NULL)
     {
-        char ip[256];
-        mystrncpy(ip, policy->ip_com_addr, ADDR_LEN);
-        int len = strlen(ip);
-        int i = 0;
-        while (i < len && ip[i] != ':')
+        *colon = '\0';
+        if (colon[1] != '\0')
         {
-            i++;
+            *port = atoi(colon + 1);
         }
+    }
+}
+
+// how long a connect to a tcp bus may take, the response timeout like libmodbus
+int connect_timeout_ms(ModbusConn* conn)
+{
+    return conn->timeoutUs > 0 ? conn->timeoutUs / 1000 : DEFAULT_RESPONSE_TIMEOUT_MS;
+}
+
+// the modbus context of a tcp bus on the socket s connected to it, NULL on
+// failure, s is closed then
+modbus_t* tcp_modbus_context(ModbusConn* conn, const char* ip, int port, int s)
+{
+    modbus_t* ctx = NULL;
+    if (conn->mode == TCP)
+    {
+        ctx = modbus_new_tcp(ip, port);
+    }
+    else
+    {
+        // the rtu backend of libmodbus reads and writes the socket like a serial
+        // port, the frames are the same, only the port is never opened by it
+        ctx = modbus_new_rtu(conn->ip_com_addr, 9600, 'N', 8, 1);
+    }
+    if (ctx == NULL)
+    {
+        close(s);
+        return NULL;
+    }
+    modbus_set_socket(ctx, s);
+    apply_modbus_timeouts(conn, ctx);
+    return ctx;
+}
 
-        int port = 502;
-        if (i < len)
+// the kernel switches the transceiver of the serial bus, instead of the
+// adapter guessing when a frame is over or libmodbus toggling rts around a
+// sleep, so the bus turns around as soon as the last char is out. the line
+// works as before if the driver can't
+void setup_serial_line(ModbusConn* conn, modbus_t* ctx)
+{
+    int fd = modbus_get_socket(ctx);
+    if (conn->rs485 != RS485_ADAPTER)
+    {
+        // libmodbus only enables the mode, the rts level and the delays are
+        // left to the driver's defaults
+        if (modbus_rtu_set_serial_mode(ctx, MODBUS_RTU_RS485) == -1 
+            || serial_set_rs485(fd, conn->rs485 == RS485_RTS_HIGH, conn->rtsDelayBeforeMs, 
+                conn->rtsDelayAfterMs) != 0)
         {
-            ip[i] = '\0';
-            i++;
-            if (i < len)
-            {
-                port = atoi(ip + i);
-            }
+            fprintf(stderr, "no kernel rs485 mode on %s (%s), the adapter switches the line\n",
+                conn->ip_com_addr, strerror(errno));
         }
-        ctx = modbus_new_tcp(ip, port);
-        if (modbus_connect(ctx) == -1) 
+    }
+    // a pty or a driver without the flag is as fast as it gets already
+    serial_set_low_latency(fd, conn->lowLatency);
+}
+
+// the line settings of the bus are the ones of the policy
+int same_serial_line(ModbusConn* conn, SlavePolicy* policy)
+{
+    return conn->rs485 == policy->rs485
+        && conn->rtsDelayBeforeMs == policy->rtsDelayBeforeMs
+        && conn->rtsDelayAfterMs == policy->rtsDelayAfterMs
+        && conn->lowLatency == policy->lowLatency;
+}
+
+void set_serial_line(ModbusConn* conn, SlavePolicy* policy)
+{
+    conn->rs485 = policy->rs485;
+    conn->rtsDelayBeforeMs = policy->rtsDelayBeforeMs;
+    conn->rtsDelayAfterMs = policy->rtsDelayAfterMs;
+    conn->lowLatency = policy->lowLatency;
+}
+
+// make the modbus connection of the bus, return NULL on failure.
+// it may block up to the connect timeout, so it's only called by the reconnector,
+// without holding the conn lock (the parameters of a connection never change).
+// the reconnector connects the tcp buses in parallel instead, see reconnect_modbus_conns
+modbus_t* connect_modbus(ModbusConn* conn)
+{
+    modbus_t* ctx = NULL;
+    if (conn->mode == TCP || conn->mode == RTU_OVER_TCP)
+    {
+        char ip[ADDR_LEN];
+        int port = 0;
+        tcp_addr_of(conn, ip, sizeof(ip), &port);
+        int s = connect_tcp_socket(ip, port, connect_timeout_ms(conn));
+        if (s < 0)
         {
-            fprintf(stderr, "Failed to connect modbus slave: %s, ip=%s, port=%d\n",
-                    modbus_strerror(errno), ip, port);
-            modbus_free(ctx);
-            ctx = NULL ;
+            fprintf(stderr, "Failed to connect modbus slave: %s, %sip=%s, port=%d\n",
+                strerror(errno), conn->mode == RTU_OVER_TCP ? "rtu over tcp, " : "", ip, port);
+            return NULL;
         }
+        ctx = tcp_modbus_context(conn, ip, port, s);
     }
-    else if (policy->mode == RTU)
+    else if (conn->mode == RTU || conn->mode == ASCII)
     {
-        ctx = modbus_new_rtu(policy->ip_com_addr, policy->baud, policy->parity, 
-                policy->databits, policy->stopbits);
+        // for ascii, libmodbus only opens and configures the serial port,
+        // the frames are sent and received by transport.c
+        ctx = modbus_new_rtu(conn->ip_com_addr, conn->baud, conn->parity, 
+                conn->databits, conn->stopbits);
+        apply_modbus_timeouts(conn, ctx);
         if (modbus_connect(ctx) == -1) 
         {
             fprintf(stderr, "Failed to connect modbus slave: %s, serial port=%s, baud=%d"
                     " parity=%c, databits=%d, stopbits=%d\n",
-                    modbus_strerror(errno), policy->ip_com_addr, policy->baud, policy->parity,
-                    policy->databits, policy->stopbits);
+                    modbus_strerror(errno), conn->ip_com_addr, conn->baud, conn->parity,
+                    conn->databits, conn->stopbits);
             modbus_free(ctx);
             ctx = NULL ;
         }
+        else
+        {
+            setup_serial_line(conn, ctx);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Not supported modbus mode %d\n", (int)conn->mode);
+    }
+    return ctx;
+}
+
+// close the modbus connection of the bus, must be called with the conn lock held
+void close_modbus(ModbusConn* conn)
+{
+    if (conn->ctx != NULL)
+    {
+        // in case there is error when read modbus, we need
+        // to close the current context, otherwise, the 
+        // port/serial port is still be occupied.
+        modbus_close(conn->ctx);
+        modbus_free(conn->ctx);
+        conn->ctx = NULL;
+    }
+}
+
+// schedule the next reconnect of the bus with exponential backoff, the delay
+// is randomized in [backoff/2, backoff] so that the buses which go offline 
+// together don't reconnect together. must be called with the conn lock held
+void schedule_reconnect(ModbusConn* conn)
+{
+    long long backoff = RECONNECT_MIN_MS;
+    int i = 0;
+    for (i = 1; i < conn->failures && backoff < RECONNECT_MAX_MS; i++)
+    {
+        backoff *= 2;
+    }
+    if (backoff > RECONNECT_MAX_MS)
+    {
+        backoff = RECONNECT_MAX_MS;
+    }
+    long long delay = backoff / 2 + rand_r(&conn->seed) % (backoff / 2 + 1);
+    conn->nextRetry = monotonic_ms() + delay;
+}
+
+// the bus failed, close the connection and leave the reconnecting to the
+// reconnector, the policies on the bus are skipped until it's back.
+// must be called with the conn lock held
+void mark_modbus_offline(ModbusConn* conn)
+{
+    close_modbus(conn);
+    conn->timeouts = 0;
+    if (conn->failures == 0)
+    {
+        printf("modbus connection to %s is offline, will reconnect in background\n",
+            conn->ip_com_addr);
+        note_status_changed();
+    }
+    conn->failures++;
+    schedule_reconnect(conn);
+}
+
+// the bus is a local serial port, rtu or ascii
+int is_serial_mode(ModbusMode mode)
+{
+    return mode == RTU || mode == ASCII;
+}
+
+// the slave answered the request with an exception, e.g. EMBXILADD or EMBXSBUSY.
+// EMBMDATA is counted as well, the request is rejected before it's sent
+int is_modbus_exception(int err)
+{
+    return (err > MODBUS_ENOBASE && err <= EMBXGTAR) || err == EMBMDATA;
+}
+
+// a request on the bus failed with err, tell whether the bus should be reset.
+// the exceptions and the timeouts are of the slave, the other slaves on the
+// bus are fine, so they never reset it. but a dead tcp peer only shows as
+// timeouts, so a tcp connection is reset after LINK_TIMEOUT_LIMIT timeouts in
+// a row without any reply. a garbled frame on a serial line is noise, while
+// on tcp it means the stream is out of sync. must be called with the conn lock held
+ModbusFailure modbus_failure_of(ModbusConn* conn, int err)
+{
+    if (is_modbus_exception(err))
+    {
+        conn->timeouts = 0;
+        return MODBUS_FAIL_EXCEPTION;
+    }
+    int garbled = err == EMBBADCRC || err == EMBBADDATA || err == EMBBADEXC 
+        || err == EMBUNKEXC || err == EMBBADSLAVE;
+    if (err != ETIMEDOUT && !(garbled && is_serial_mode(conn->mode)))
+    {
+        return MODBUS_FAIL_LINK;
+    }
+    conn->timeouts++;
+    if (conn->mode == TCP && conn->timeouts >= LINK_TIMEOUT_LIMIT)
+    {
+        return MODBUS_FAIL_LINK;
+    }
+    return MODBUS_FAIL_TIMEOUT;
+}
+
+// the time of 3.5 chars of 11 bits at the baud rate, the silent interval
+// between two rtu frames, fixed to 1.75ms above 19200 by the spec
+long long rtu_frame_gap_us(int baud)
+{
+    if (baud <= 0)
+    {
+        return 0;
+    }
+    if (baud > 19200)
+    {
+        return 1750;
+    }
+    return 38500000LL / baud;
+}
+
+// the idle time between requests on the bus of the policy. by default it's
+// only needed by rtu, the ascii frames are delimited, and a device server
+// keeps the gaps on its serial side
+long long turnaround_us(SlavePolicy* policy)
+{
+    if (policy->mode == TCP)
+    {
+        return 0;
+    }
+    if (policy->turnaroundMs >= 0)
+    {
+        return policy->turnaroundMs * 1000LL;
+    }
+    return policy->mode == RTU ? rtu_frame_gap_us(policy->baud) : 0;
+}
+
+// take the timing of the bus from the policy, must be called with the conn lock held
+void set_modbus_timing(ModbusConn* conn, SlavePolicy* policy)
+{
+    conn->responseTimeoutMs = policy->responseTimeoutMs;
+    conn->byteTimeoutMs = policy->byteTimeoutMs;
+    conn->autoTimeout = policy->autoTimeout;
+    conn->turnaroundUs = turnaround_us(policy);
+    conn->timeoutUs = conn->responseTimeoutMs * 1000LL;
+    conn->srttUs = 0;
+    conn->rttvarUs = 0;
+    conn->lastEndUs = 0;
+    conn->quietUntilUs = 0;
+}
+
+int same_modbus_timing(ModbusConn* conn, SlavePolicy* policy)
+{
+    return conn->responseTimeoutMs == policy->responseTimeoutMs
+        && conn->byteTimeoutMs == policy->byteTimeoutMs
+        && conn->autoTimeout == policy->autoTimeout
+        && conn->turnaroundUs == turnaround_us(policy);
+}
+
+// keep the bus idle for the turnaround time since the last request, so that
+// the slaves see the end of the frame, and for the broadcast turnaround after
+// a broadcast. must be called with the conn lock held
+void wait_modbus_turnaround(ModbusConn* conn)
+{
+    long long until = conn->quietUntilUs;
+    if (conn->turnaroundUs > 0 && conn->lastEndUs != 0 
+        && conn->lastEndUs + conn->turnaroundUs > until)
+    {
+        until = conn->lastEndUs + conn->turnaroundUs;
+    }
+    long long left = until - monotonic_us();
+    if (left > 0)
+    {
+        usleep(left);
+    }
+}
+
+// a request started at start_us is done, successful or not, the bus is counted
+// as busy for its time. must be called with the conn lock held
+void end_modbus_request(ModbusConn* conn, long long start_us, int ok)
+{
+    conn->lastEndUs = monotonic_us();
+    conn->busyUs += conn->lastEndUs - start_us;
+    conn->requests++;
+    hist_record(&conn->transaction, conn->lastEndUs - start_us);
+    if (!ok)
+    {
+        counter_add(&conn->errors, 1);
+    }
+}
+
+// a request started at start_us is done. with autoTimeout, the response timeout
+// is set to the smoothed response time plus 4 times its variation, plus the time
+// of the longest frame, like the retransmission timeout of tcp; it's doubled on
+// every failure. it's kept in [MIN_RESPONSE_TIMEOUT_MS, responseTimeoutMs or
+// DEFAULT_RESPONSE_TIMEOUT_MS]. must be called with the conn lock held
+void modbus_request_done(ModbusConn* conn, long long start_us, int ok)
+{
+    end_modbus_request(conn, start_us, ok);
+    long long now = conn->lastEndUs;
+    if (!conn->autoTimeout)
+    {
+        return;
+    }
+    long long cap = (conn->responseTimeoutMs > 0 ? conn->responseTimeoutMs 
+        : DEFAULT_RESPONSE_TIMEOUT_MS) * 1000LL;
+    long long timeout = 0;
+    if (ok)
+    {
+        long long rtt = now - start_us;
+        if (conn->srttUs == 0)
+        {
+            conn->srttUs = rtt;
+            conn->rttvarUs = rtt / 2;
+        }
+        else
+        {
+            long long err = rtt - conn->srttUs;
+            conn->srttUs += err / 8;
+            conn->rttvarUs += ((err < 0 ? -err : err) - conn->rttvarUs) / 4;
+        }
+        // the response of a request may be longer than the ones measured
+        // of 11 bits per char, an ascii frame takes 2 chars per byte
+        long long frame = 0;
+        if (is_serial_mode(conn->mode) && conn->baud > 0)
+        {
+            frame = (conn->mode == ASCII ? 513 : 256) * 11 * 1000000LL / conn->baud;
+        }
+        timeout = conn->srttUs + 4 * conn->rttvarUs + frame;
+    }
+    else
+    {
+        timeout = (conn->timeoutUs > 0 ? conn->timeoutUs : cap) * 2;
+    }
+    if (timeout < MIN_RESPONSE_TIMEOUT_MS * 1000LL)
+    {
+        timeout = MIN_RESPONSE_TIMEOUT_MS * 1000LL;
+    }
+    if (timeout > cap)
+    {
+        timeout = cap;
+    }
+    conn->timeoutUs = timeout;
+    if (conn->ctx != NULL)
+    {
+        modbus_set_response_timeout(conn->ctx, timeout / 1000000, timeout % 1000000);
+    }
+}
+
+// find the connection of the bus, -1 if not found. 
+// must be called with g_modbus_conn_lock held
+int find_modbus_conn(ModbusMode mode, const char* ip_com_addr)
+{
+    int i = 0;
+    for (i = 0; i < g_modbus_conn_num; i++)
+    {
+        if (g_modbus_conns[i].mode == mode 
+            && strcmp(g_modbus_conns[i].ip_com_addr, ip_com_addr) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// find the connection of the bus in any mode, -1 if not found.
+// must be called with g_modbus_conn_lock held
+int find_modbus_conn_by_addr(const char* ip_com_addr)
+{
+    int i = 0;
+    for (i = 0; i < g_modbus_conn_num; i++)
+    {
+        if (strcmp(g_modbus_conns[i].ip_com_addr, ip_com_addr) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void init_modbus_context(SlavePolicy* policy)
+{
+    if (policy == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&g_modbus_conn_lock);
+    int pos = find_modbus_conn(policy->mode, policy->ip_com_addr);
+    if (pos >= 0 && !g_modbus_conns[pos].inUse)
+    {
+        // the first policy on the bus after a reload, the connection is kept
+        // unless the serial parameters are changed
+        ModbusConn* conn = &g_modbus_conns[pos];
+        pthread_mutex_lock(&conn->lock);
+        conn->inUse = 1;
+        mystrncpy(conn->name, policy->port, FIELD_NAME_LEN);
+        if ((is_serial_mode(conn->mode) && (conn->baud != policy->baud 
+            || conn->databits != policy->databits || conn->parity != policy->parity 
+            || conn->stopbits != policy->stopbits || !same_serial_line(conn, policy))) 
+            || !same_modbus_timing(conn, policy))
+        {
+            close_modbus(conn);
+            conn->baud = policy->baud;
+            conn->databits = policy->databits;
+            conn->parity = policy->parity;
+            conn->stopbits = policy->stopbits;
+            set_serial_line(conn, policy);
+            set_modbus_timing(conn, policy);
+            conn->failures = 0;
+            conn->nextRetry = 0;
+            // a connect in progress is made with the old parameters
+            g_modbus_conn_generation++;
+        }
+        pthread_mutex_unlock(&conn->lock);
+    }
+    else if (pos < 0)
+    {
+        pos = g_modbus_conn_num;
+        if (pos >= MAX_MODBUS_CONN)
+        {
+            // take over the slot of a released connection
+            for (pos = 0; pos < g_modbus_conn_num && g_modbus_conns[pos].inUse; pos++)
+            {
+            }
+        }
+        if (pos >= MAX_MODBUS_CONN)
+        {
+            fprintf(stderr, "too many modbus connections, skipping %s\n", policy->ip_com_addr);
+            policy->modbusConn = -1;
+            pthread_mutex_unlock(&g_modbus_conn_lock);
+            return;
+        }
+        ModbusConn* conn = &g_modbus_conns[pos];
+        if (pos == g_modbus_conn_num)
+        {
+            pthread_mutex_init(&conn->lock, NULL);
+            pthread_mutex_init(&conn->writeLock, NULL);
+            conn->writeHead = NULL;
+            conn->writeTail = NULL;
+            conn->pendingWrites = 0;
+            g_modbus_conn_num++;
+        }
+        else
+        {
+            g_modbus_conn_generation++;
+        }
+        // the serial parameters of a port are taken from the first policy on it
+        conn->mode = policy->mode;
+        mystrncpy(conn->ip_com_addr, policy->ip_com_addr, ADDR_LEN);
+        conn->baud = policy->baud;
+        conn->databits = policy->databits;
+        conn->parity = policy->parity;
+        conn->stopbits = policy->stopbits;
+        set_serial_line(conn, policy);
+        set_modbus_timing(conn, policy);
+        conn->ctx = NULL;
+        conn->tid = 0;
+        // connected by the reconnector right away, so that loading policies
+        // never blocks on a slow or dead bus
+        conn->failures = 0;
+        conn->timeouts = 0;
+        conn->nextRetry = 0;
+        conn->seed = hash_string(conn->ip_com_addr) ^ (unsigned int)time(NULL);
+        conn->inUse = 1;
+        conn->writes = 0;
+        conn->writeLatencyUs = 0;
+        mystrncpy(conn->name, policy->port, FIELD_NAME_LEN);
+        conn->busyUs = 0;
+        conn->requests = 0;
+        conn->statSinceUs = monotonic_us();
+        memset(&conn->transaction, 0, sizeof(Histogram));
+        conn->errors = 0;
+        conn->connects = 0;
+    }
+    policy->modbusConn = pos;
+    if (policy->slaveid >= 0 && policy->slaveid < MODBUS_DATA_COUNT
+        && g_slave_conn[policy->slaveid] < 0)
+    {
+        g_slave_conn[policy->slaveid] = pos;
+    }
+    pthread_mutex_unlock(&g_modbus_conn_lock);
+}
+
+// run the queued writes of the bus, in the order they are queued. the writes
+// fail right away if the bus is offline. must be called with the conn lock held
+void run_modbus_writes(ModbusConn* conn)
+{
+    if (conn->pendingWrites == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&conn->writeLock);
+    ModbusWrite* w = conn->writeHead;
+    conn->writeHead = NULL;
+    conn->writeTail = NULL;
+    conn->pendingWrites = 0;
+    pthread_mutex_unlock(&conn->writeLock);
+    while (w != NULL)
+    {
+        ModbusWrite* next = w->next;
+        if (w->raw != NULL)
+        {
+            run_modbus_raw(conn, w);
+            conn->writes++;
+            conn->writeLatencyUs += monotonic_us() - w->queuedUs;
+            w->rawDone(w->arg, w->raw, w->rawNum);
+            free(w);
+            w = next;
+            continue;
+        }
+        int rc = -1;
+        // registers read back, 4 hex chars each
+        char readback[MAX_MODBUS_DATA_TO_WRITE * 4 + 1];
+        readback[0] = 0;
+        if (conn->ctx != NULL)
+        {
+            modbus_set_slave(conn->ctx, w->slaveid);
+            wait_modbus_turnaround(conn);
+            long long start_us = monotonic_us();
+            if (w->slaveid == MODBUS_BROADCAST_ADDRESS)
+            {
+                rc = broadcast_modbus_conn(conn, w->address, w->data);
+            }
+            else if (w->readback)
+            {
+                rc = write_and_read_modbus_conn(conn, w->slaveid, w->address, w->data, readback);
+            }
+            else
+            {
+                rc = write_modbus_conn(conn, w->slaveid, w->address, w->data);
+            }
+            // a broadcast is never answered, there is no response time to learn from
+            if (rc == 0 && w->slaveid != MODBUS_BROADCAST_ADDRESS)
+            {
+                modbus_request_done(conn, start_us, 1);
+            }
+            else
+            {
+                end_modbus_request(conn, start_us, rc == 0);
+            }
+        }
+        long long latency = monotonic_us() - w->queuedUs;
+        conn->writes++;
+        conn->writeLatencyUs += latency;
+        if (w->done != NULL)
+        {
+            w->done(w->arg, rc, latency, w->readback && rc == 0 ? readback : NULL);
+        }
+        free(w->data);
+        free(w);
+        w = next;
+    }
+}
+
+// fail the queued writes of a bus which is closed for good
+void drop_modbus_writes(ModbusConn* conn)
+{
+    pthread_mutex_lock(&conn->writeLock);
+    ModbusWrite* w = conn->writeHead;
+    conn->writeHead = NULL;
+    conn->writeTail = NULL;
+    conn->pendingWrites = 0;
+    pthread_mutex_unlock(&conn->writeLock);
+    while (w != NULL)
+    {
+        ModbusWrite* next = w->next;
+        int i = 0;
+        for (i = 0; i < w->rawNum; i++)
+        {
+            w->raw[i].rspLen = -1;
+            w->raw[i].err = ENOTCONN;
+        }
+        if (w->raw != NULL)
+        {
+            w->rawDone(w->arg, w->raw, w->rawNum);
+        }
+        else if (w->done != NULL)
+        {
+            w->done(w->arg, -1, monotonic_us() - w->queuedUs, NULL);
+        }
+        free(w->data);
+        free(w);
+        w = next;
+    }
+}
+
+// the ascii transport of the connected bus to the slave,
+// must be called with the conn lock held
+void ascii_link_of(ModbusConn* conn, int slaveid, AsciiLink* link)
+{
+    link->fd = modbus_get_socket(conn->ctx);
+    link->slaveid = slaveid;
+    link->timeoutUs = conn->timeoutUs;
+    link->byteTimeoutUs = conn->byteTimeoutMs * 1000LL;
+}
+
+// get the connected context of the bus, NULL if the bus is offline.
+// must be called with the conn lock held
+modbus_t* get_modbus_context(ModbusConn* conn, int slaveid)
+{
+    if (conn->ctx == NULL)
+    {
+        // the reconnector is taking care of it, skip cheaply
+        return NULL;
+    }
+    // all the slaves behind the bus share the context
+    modbus_set_slave(conn->ctx, slaveid);
+    return conn->ctx;
+}
+
+// a connect of the reconnector in progress
+typedef struct
+{
+    int index;                      // of the connection in the pool
+    int generation;                 // of the pool when it started
+    ModbusConn target;              // the copy connected, without any lock
+    char ip[ADDR_LEN];
+    int port;
+    int fd;
+    long long deadline;             // monotonic time(ms) it times out
+} PendingConnect;
+
+// only used by the reconnector thread
+static PendingConnect g_pending_connects[MAX_PARALLEL_CONNECTS];
+
+// copy the bus i out if it's due for a reconnect, so that the connect is done
+// without any lock. return 1 if it's due, 0 if not, -1 past the end of the pool
+int take_due_conn(int i, ModbusConn* target, int* generation)
+{
+    pthread_mutex_lock(&g_modbus_conn_lock);
+    if (i >= MAX_MODBUS_CONN || i >= g_modbus_conn_num)
+    {
+        pthread_mutex_unlock(&g_modbus_conn_lock);
+        return -1;
+    }
+    ModbusConn* conn = &g_modbus_conns[i];
+    pthread_mutex_lock(&conn->lock);
+    int due = conn->inUse && conn->ctx == NULL && conn->nextRetry <= monotonic_ms();
+    if (due)
+    {
+        *target = *conn;
+    }
+    pthread_mutex_unlock(&conn->lock);
+    *generation = g_modbus_conn_generation;
+    pthread_mutex_unlock(&g_modbus_conn_lock);
+    return due;
+}
+
+// the reconnect of the bus i is over, ctx is NULL if it failed. it's dropped
+// if the pool was reloaded meanwhile
+void reconnect_done(int i, int generation, modbus_t* ctx)
+{
+    pthread_mutex_lock(&g_modbus_conn_lock);
+    if (generation != g_modbus_conn_generation || i >= g_modbus_conn_num)
+    {
+        pthread_mutex_unlock(&g_modbus_conn_lock);
+        if (ctx != NULL)
+        {
+            modbus_close(ctx);
+            modbus_free(ctx);
+        }
+        return;
+    }
+    ModbusConn* conn = &g_modbus_conns[i];
+    pthread_mutex_lock(&conn->lock);
+    if (ctx != NULL)
+    {
+        if (conn->failures > 0)
+        {
+            printf("modbus connection to %s is back online after %d retries\n",
+                conn->ip_com_addr, conn->failures);
+        }
+        conn->ctx = ctx;
+        conn->failures = 0;
+        counter_add(&conn->connects, 1);
+        note_status_changed();
+    }
+    else
+    {
+        if (conn->failures == 0)
+        {
+            note_status_changed();
+        }
+        conn->failures++;
+        schedule_reconnect(conn);
+    }
+    pthread_mutex_unlock(&conn->lock);
+    pthread_mutex_unlock(&g_modbus_conn_lock);
+}
+
+// try to reconnect the offline buses whose backoff is over. the serial ports
+// open right away, the tcp buses are connected without blocking, up to
+// MAX_PARALLEL_CONNECTS at once, so that the dead ones don't hold up the
+// others for a connect timeout each. a bus polls as soon as it's connected
+void reconnect_modbus_conns()
+{
+    struct pollfd fds[MAX_PARALLEL_CONNECTS];
+    int pending = 0;
+    int next = 0;
+    int more = 1;
+    while (g_stop_reconnector != 1 && (more || pending > 0))
+    {
+        // 1 start the connects of the due buses, as many as there is room for
+        while (more && pending < MAX_PARALLEL_CONNECTS && g_stop_reconnector != 1)
+        {
+            PendingConnect* p = &g_pending_connects[pending];
+            int due = take_due_conn(next, &p->target, &p->generation);
+            if (due < 0)
+            {
+                more = 0;
+                break;
+            }
+            p->index = next++;
+            if (!due)
+            {
+                continue;
+            }
+            if (p->target.mode != TCP && p->target.mode != RTU_OVER_TCP)
+            {
+                reconnect_done(p->index, p->generation, connect_modbus(&p->target));
+                continue;
+            }
+            tcp_addr_of(&p->target, p->ip, sizeof(p->ip), &p->port);
+            p->fd = start_tcp_connect(p->ip, p->port);
+            if (p->fd < 0)
+            {
+                fprintf(stderr, "Failed to connect modbus slave: %s, ip=%s, port=%d\n",
+                    strerror(errno), p->ip, p->port);
+                reconnect_done(p->index, p->generation, NULL);
+                continue;
+            }
+            p->deadline = monotonic_ms() + connect_timeout_ms(&p->target);
+            pending++;
+        }
+        if (pending == 0)
+        {
+            continue;
+        }
+
+        // 2 wait for any of them to be over, or the first to time out
+        long long now = monotonic_ms();
+        long long wait = RECONNECT_CHECK_MS;
+        int k = 0;
+        for (k = 0; k < pending; k++)
+        {
+            fds[k].fd = g_pending_connects[k].fd;
+            fds[k].events = POLLOUT;
+            fds[k].revents = 0;
+            if (g_pending_connects[k].deadline - now < wait)
+            {
+                wait = g_pending_connects[k].deadline - now;
+            }
+        }
+        poll(fds, pending, wait > 0 ? (int)wait : 0);
+        now = monotonic_ms();
+
+        // 3 finish the ones over, from the last so that a finished one is
+        // replaced by one already looked at
+        for (k = pending - 1; k >= 0; k--)
+        {
+            PendingConnect* p = &g_pending_connects[k];
+            if (fds[k].revents == 0 && now < p->deadline)
+            {
+                continue;
+            }
+            modbus_t* ctx = NULL;
+            if (finish_tcp_connect(p->fd, fds[k].revents == 0) == 0)
+            {
+                ctx = tcp_modbus_context(&p->target, p->ip, p->port, p->fd);
+            }
+            else
+            {
+                fprintf(stderr, "Failed to connect modbus slave: %s, %sip=%s, port=%d\n",
+                    strerror(errno), p->target.mode == RTU_OVER_TCP ? "rtu over tcp, " : "",
+                    p->ip, p->port);
+            }
+            reconnect_done(p->index, p->generation, ctx);
+            g_pending_connects[k] = g_pending_connects[--pending];
+        }
+    }
+    // stopping
+    while (pending > 0)
+    {
+        close(g_pending_connects[--pending].fd);
+    }
+}
+
+void* reconnector_func(void* arg)
+{
+    while (g_stop_reconnector != 1)
+    {
+        reconnect_modbus_conns();
+        usleep(RECONNECT_CHECK_MS * 1000);
+    }
+    return NULL;
+}
+
+void start_modbus_reconnector()
+{
+    g_stop_reconnector = 0;
+    pthread_create(&g_reconnector_thread, NULL, reconnector_func, NULL);
+}
+
+void stop_modbus_reconnector()
+{
+    g_stop_reconnector = 1;
+    pthread_join(g_reconnector_thread, NULL);
+}
+
+const char* modbus_mode_name(ModbusMode mode)
+{
+    switch (mode)
+    {
+        case TCP:
+            return "tcp";
+        case RTU:
+            return "rtu";
+        case ASCII:
+            return "ascii";
+        case RTU_OVER_TCP:
+            return "rtuovertcp";
+        default:
+            return "unknown";
+    }
+}
+
+void modbus_set_status_listener(void (*listener)(void))
+{
+    g_status_listener = listener;
+}
+
+int modbus_status_changed()
+{
+    int changed = g_modbus_status_changed;
+    g_modbus_status_changed = 0;
+    return changed;
+}
+
+cJSON* modbus_conn_status()
+{
+    cJSON* status = cJSON_CreateArray();
+    long long now = monotonic_ms();
+    long long now_us = monotonic_us();
+    pthread_mutex_lock(&g_modbus_conn_lock);
+    int i = 0;
+    for (i = 0; i < g_modbus_conn_num; i++)
+    {
+        ModbusConn* conn = &g_modbus_conns[i];
+        if (!conn->inUse)
+        {
+            continue;
+        }
+        pthread_mutex_lock(&conn->lock);
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "ip_com_addr", conn->ip_com_addr);
+        if (conn->name[0] != 0)
+        {
+            cJSON_AddStringToObject(item, "name", conn->name);
+        }
+        cJSON_AddStringToObject(item, "mode", modbus_mode_name(conn->mode));
+        // the share of time the bus is busy and the request rate since the last
+        // status, a port close to 1 can't be polled faster by adding workers
+        long long elapsed = now_us - conn->statSinceUs;
+        if (elapsed > 0)
+        {
+            cJSON_AddNumberToObject(item, "utilization", (double)conn->busyUs / elapsed);
+            cJSON_AddNumberToObject(item, "requestsPerSec", conn->requests * 1000000.0 / elapsed);
+        }
+        conn->busyUs = 0;
+        conn->requests = 0;
+        conn->statSinceUs = now_us;
+        cJSON_AddBoolToObject(item, "online", conn->ctx != NULL);
+        cJSON_AddNumberToObject(item, "failures", conn->failures);
+        cJSON_AddItemToObject(item, "transaction", histogram_json(&conn->transaction));
+        cJSON_AddNumberToObject(item, "errors", counter_get(&conn->errors));
+        cJSON_AddNumberToObject(item, "reconnects", 
+            conn->connects > 0 ? counter_get(&conn->connects) - 1 : 0);
+        cJSON_AddNumberToObject(item, "pendingWrites", conn->pendingWrites);
+        if (conn->writes > 0)
+        {
+            cJSON_AddNumberToObject(item, "writes", conn->writes);
+            cJSON_AddNumberToObject(item, "avgWriteLatencyMs", 
+                conn->writeLatencyUs / conn->writes / 1000.0);
+        }
+        if (conn->timeoutUs > 0)
+        {
+            cJSON_AddNumberToObject(item, "responseTimeoutMs", conn->timeoutUs / 1000);
+        }
+        if (conn->ctx == NULL)
+        {
+            long long wait = conn->nextRetry - now;
+            cJSON_AddNumberToObject(item, "nextRetryMs", wait > 0 ? wait : 0);
+        }
+        pthread_mutex_unlock(&conn->lock);
+        cJSON_AddItemToArray(status, item);
+    }
+    pthread_mutex_unlock(&g_modbus_conn_lock);
+    return status;
+}
+
+// the labels of the bus, for the prometheus metrics
+void modbus_conn_labels(ModbusConn* conn, char* labels, int len)
+{
+    snprintf(labels, len, "bus=\"%s\",mode=\"%s\"", conn->ip_com_addr, 
+        modbus_mode_name(conn->mode));
+}
+
+void modbus_conn_metrics(MetricsText* t)
+{
+    char labels[ADDR_LEN + 64];
+    int i = 0;
+    pthread_mutex_lock(&g_modbus_conn_lock);
+    mt_type(t, "modbus_bus_online", "gauge");
+    for (i = 0; i < g_modbus_conn_num; i++)
+    {
+        if (g_modbus_conns[i].inUse)
+        {
+            modbus_conn_labels(&g_modbus_conns[i], labels, sizeof(labels));
+            mt_value(t, "modbus_bus_online", labels, g_modbus_conns[i].ctx != NULL);
+        }
+    }
+    mt_type(t, "modbus_bus_errors_total", "counter");
+    for (i = 0; i < g_modbus_conn_num; i++)
+    {
+        if (g_modbus_conns[i].inUse)
+        {
+            modbus_conn_labels(&g_modbus_conns[i], labels, sizeof(labels));
+            mt_value(t, "modbus_bus_errors_total", labels, counter_get(&g_modbus_conns[i].errors));
+        }
+    }
+    mt_type(t, "modbus_bus_reconnects_total", "counter");
+    for (i = 0; i < g_modbus_conn_num; i++)
+    {
+        if (g_modbus_conns[i].inUse)
+        {
+            unsigned long long connects = counter_get(&g_modbus_conns[i].connects);
+            modbus_conn_labels(&g_modbus_conns[i], labels, sizeof(labels));
+            mt_value(t, "modbus_bus_reconnects_total", labels, connects > 0 ? connects - 1 : 0);
+        }
+    }
+    mt_type(t, "modbus_bus_pending_writes", "gauge");
+    for (i = 0; i < g_modbus_conn_num; i++)
+    {
+        if (g_modbus_conns[i].inUse)
+        {
+            modbus_conn_labels(&g_modbus_conns[i], labels, sizeof(labels));
+            mt_value(t, "modbus_bus_pending_writes", labels, g_modbus_conns[i].pendingWrites);
+        }
+    }
+    mt_type(t, "modbus_bus_transaction_seconds", "histogram");
+    for (i = 0; i < g_modbus_conn_num; i++)
+    {
+        if (g_modbus_conns[i].inUse)
+        {
+            modbus_conn_labels(&g_modbus_conns[i], labels, sizeof(labels));
+            mt_histogram(t, "modbus_bus_transaction_seconds", labels, &g_modbus_conns[i].transaction);
+        }
+    }
+    pthread_mutex_unlock(&g_modbus_conn_lock);
+}
+
+// the max number of bits/registers could be read by one request of the function code
+int max_read_count(char functioncode)
+{
+    switch(functioncode)
+    {
+        case MODBUS_FC_READ_COILS:
+        case MODBUS_FC_READ_DISCRETE_INPUTS:
+            return MODBUS_MAX_READ_BITS;
+        case MODBUS_FC_READ_HOLDING_REGISTERS:
+        case MODBUS_FC_READ_INPUT_REGISTERS:
+            return MODBUS_MAX_READ_REGISTERS;
+        default:
+            return 0;
+    }
+}
+
+int is_bit_function(char functioncode)
+{
+    return functioncode == MODBUS_FC_READ_COILS 
+        || functioncode == MODBUS_FC_READ_DISCRETE_INPUTS;
+}
+
+// read nb bits/registers starting from start_addr, with the function code and
+// the slave of the policy. the bits are stored as one byte per bit in dest,
+// and the registers as uint16_t. 
+// return 0 on success, -1 otherwise with errno set. the connection is only
+// reset if the link failed, see modbus_failure_of
+int read_modbus_range(SlavePolicy* policy, int start_addr, int nb, void* dest)
+{
+    if (policy->modbusConn < 0)
+    {
+        errno = ENOTCONN;
+        return -1;
+    }
+    ModbusConn* conn = &g_modbus_conns[policy->modbusConn];
+    pthread_mutex_lock(&conn->lock);
+    // the writes go before the reads
+    run_modbus_writes(conn);
+    modbus_t* ctx = get_modbus_context(conn, policy->slaveid);
+    if (ctx == NULL)
+    {
+        pthread_mutex_unlock(&conn->lock);
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    int rc = -1;
+    int err = 0;
+    wait_modbus_turnaround(conn);
+    long long start_us = monotonic_us();
+    if (conn->mode == ASCII && max_read_count(policy->functioncode) > 0)
+    {
+        AsciiLink link;
+        ascii_link_of(conn, policy->slaveid, &link);
+        rc = ascii_read(&link, policy->functioncode, start_addr, nb, dest);
+        if (rc != nb)
+        {
+            err = errno;
+            printf("ERROR modbus ascii read (%s) slaveid=%d, functioncode=%d\n",
+                 modbus_strerror(err), policy->slaveid, policy->functioncode);
+        }
+    }
+    else
+    {
+        switch(policy->functioncode)
+        {
+            case MODBUS_FC_READ_COILS:
+                // just store every bit as a byte, for easy of use
+                rc = modbus_read_bits(ctx, start_addr, nb, (uint8_t*)dest);
+                if (rc != nb)
+                {
+                    err = errno;
+                    printf("ERROR modbus_read_bits (%s) slaveid=%d\n",
+                         modbus_strerror(err), policy->slaveid);
+                }
+                break;
+
+            case MODBUS_FC_READ_DISCRETE_INPUTS:
+                rc = modbus_read_input_bits(ctx, start_addr, nb, (uint8_t*)dest);
+                if (rc != nb)
+                {
+                    err = errno;
+                    printf("ERROR modbus_read_input_bits (%s) slaveid=%d\n",
+                         modbus_strerror(err), policy->slaveid);
+                }
+                break;
+    
+            case MODBUS_FC_READ_HOLDING_REGISTERS:
+                rc = modbus_read_registers(ctx, start_addr, nb, (uint16_t*)dest);
+                if (rc != nb)
+                {
+                    err = errno;
+                    printf("ERROR modbus_read_registers (%s) slaveid=%d\n",
+                         modbus_strerror(err), policy->slaveid);
+                }
+                break;
+
+            case MODBUS_FC_READ_INPUT_REGISTERS:
+                rc = modbus_read_input_registers(ctx, start_addr, nb, (uint16_t*)dest);
+                if (rc != nb)
+                {
+                    err = errno;
+                    printf("ERROR modbus_read_input_registers (%s) slaveid=%d\n",
+                         modbus_strerror(err), policy->slaveid);
+                }
+                break;
+
+            default:
+                fprintf(stderr, "not supported function code:%d\n", policy->functioncode);
+                pthread_mutex_unlock(&conn->lock);
+                errno = EMBXILFUN;
+                return -1;
+        }
+    }
+
+    if (rc == nb)
+    {
+        conn->timeouts = 0;
+        modbus_request_done(conn, start_us, 1);
+        pthread_mutex_unlock(&conn->lock);
+        return 0;
+    }
+    // an exception is a reply in time, it tells the response time as well
+    ModbusFailure failure = modbus_failure_of(conn, err);
+    modbus_request_done(conn, start_us, failure == MODBUS_FAIL_EXCEPTION);
+    if (failure == MODBUS_FAIL_LINK)
+    {
+        mark_modbus_offline(conn);
+    }
+    pthread_mutex_unlock(&conn->lock);
+    errno = err;
+    return -1;
+}
+
+// the bytes needed to hold nb bits/registers read by read_modbus_range
+int range_bytes(char functioncode, int nb)
+{
+    return is_bit_function(functioncode) ? nb * sizeof(uint8_t) : nb * sizeof(uint16_t);
+}
+
+// convert count bits/registers at offset of the data read by read_modbus_range 
+// into the payload
+void range_to_payload(char functioncode, void* data, int offset, int count, char* payload)
+{
+    if (is_bit_function(functioncode))
+    {
+        byte_arr_to_hex(payload, (char*)data + offset, count * sizeof(uint8_t));
+    }
+    else
+    {
+        short_arr_to_array(payload, (uint16_t*)data + offset, count);
+    }
+}
+
+int read_modbus(SlavePolicy* policy, char* payload)
+{
+    if (policy == NULL)
+    {
+        fprintf(stderr, "NULL policy in read_modbus\n");
+        return -1;
+    }
+
+    payload[0] = 0;    // empty the payload first
+    int nb = policy->length;
+    uint16_t data[RANGE_BUFF_LEN / sizeof(uint16_t)];
+    if (range_bytes(policy->functioncode, nb) > RANGE_BUFF_LEN)
+    {
+        printf("ERROR length %d of slaveid=%d exceeds the protocol limit\n", nb, policy->slaveid);
+        return -1;
+    }
+
+    int rc = read_modbus_range(policy, policy->start_addr, nb, data);
+    if (rc == 0)
+    {
+        range_to_payload(policy->functioncode, data, 0, nb, payload);
+    }
+    return rc;
+}
+
+// order the policies by the slave they target first, then the start address,
+// so that the mergeable policies are adjacent
+int compare_policy_range(const void* a, const void* b)
+{
+    SlavePolicy* pa = *(SlavePolicy**)a;
+    SlavePolicy* pb = *(SlavePolicy**)b;
+    int rc = strcmp(pa->ip_com_addr, pb->ip_com_addr);
+    if (rc != 0)
+    {
+        return rc;
+    }
+    if (pa->slaveid != pb->slaveid)
+    {
+        return pa->slaveid - pb->slaveid;
+    }
+    if (pa->functioncode != pb->functioncode)
+    {
+        return pa->functioncode - pb->functioncode;
+    }
+    return pa->start_addr - pb->start_addr;
+}
+
+int same_slave_and_function(SlavePolicy* pa, SlavePolicy* pb)
+{
+    return pa->mode == pb->mode
+        && pa->slaveid == pb->slaveid
+        && pa->functioncode == pb->functioncode
+        && strcmp(pa->ip_com_addr, pb->ip_com_addr) == 0;
+}
+
+void set_modbus_pipeline_depth(int depth)
+{
+    if (depth < 1)
+    {
+        depth = 1;
+    }
+    else if (depth > MAX_PIPELINE_DEPTH)
+    {
+        depth = MAX_PIPELINE_DEPTH;
+    }
+    g_pipeline_depth = depth;
+}
+
+// build the modbus tcp request(MBAP header + PDU) of the range into req,
+// return the length of the request
+int build_tcp_read_request(uint8_t* req, uint16_t tid, ReadRange* range)
+{
+    req[0] = tid >> 8;
+    req[1] = tid & 0xFF;
+    req[2] = 0;             // protocol id
+    req[3] = 0;
+    req[4] = 0;             // length of the rest
+    req[5] = 6;
+    req[6] = range->first->slaveid;
+    req[7] = range->first->functioncode;
+    req[8] = range->start_addr >> 8;
+    req[9] = range->start_addr & 0xFF;
+    req[10] = range->nb >> 8;
+    req[11] = range->nb & 0xFF;
+    return 12;
+}
+
+// parse the response of the range, in the same layout as read_modbus_range.
+// on failure the errno is stored into the range, the exception if it's one
+int parse_tcp_read_response(uint8_t* rsp, int len, ReadRange* range)
+{
+    int is_bit = is_bit_function(range->first->functioncode);
+    int bytes = is_bit ? (range->nb + 7) / 8 : range->nb * 2;
+    if (range->data == NULL)
+    {
+        range->err = EMBMDATA;
+        return -1;
+    }
+    if (len >= 9 && rsp[6] == range->first->slaveid 
+        && rsp[7] == (range->first->functioncode | 0x80))
+    {
+        range->err = MODBUS_ENOBASE + rsp[8];
+        printf("ERROR pipelined read (%s) slaveid=%d, functioncode=%d\n",
+            modbus_strerror(range->err), range->first->slaveid, range->first->functioncode);
+        return -1;
+    }
+    if (len < 9 || rsp[6] != range->first->slaveid || rsp[7] != range->first->functioncode)
+    {
+        // not the reply we expected
+        range->err = EMBBADDATA;
+        printf("ERROR pipelined read, slaveid=%d, functioncode=%d, response functioncode=%d\n",
+            range->first->slaveid, range->first->functioncode, len > 7 ? rsp[7] : -1);
+        return -1;
+    }
+    if (rsp[8] != bytes || len < 9 + bytes)
+    {
+        range->err = EMBBADDATA;
+        printf("ERROR pipelined read, slaveid=%d, unexpected length %d\n", 
+            range->first->slaveid, rsp[8]);
+        return -1;
+    }
+
+    int i = 0;
+    if (is_bit)
+    {
+        uint8_t* dest = (uint8_t*)range->data;
+        for (i = 0; i < range->nb; i++)
+        {
+            dest[i] = (rsp[9 + i / 8] >> (i % 8)) & 0x01;
+        }
+    }
+    else
+    {
+        uint16_t* dest = (uint16_t*)range->data;
+        for (i = 0; i < range->nb; i++)
+        {
+            dest[i] = (rsp[9 + 2 * i] << 8) | rsp[10 + 2 * i];
+        }
+    }
+    return 0;
+}
+
+// read the ranges on one modbus tcp connection, keeping up to g_pipeline_depth
+// requests in flight, the replies are matched to the requests by transaction id.
+// on a timeout, the outstanding ranges fail and the rest are still sent, their
+// late replies match no request any more. on a communication error, the ranges
+// not answered yet fail and the connection is reset
+void read_ranges_pipelined(ModbusConn* conn, ReadRange* ranges, int count)
+{
+    int i = 0;
+    for (i = 0; i < count; i++)
+    {
+        ranges[i].rc = -1;
+        ranges[i].err = ENOTCONN;
+    }
+
+    pthread_mutex_lock(&conn->lock);
+    run_modbus_writes(conn);
+    modbus_t* ctx = get_modbus_context(conn, ranges[0].first->slaveid);
+    if (ctx == NULL)
+    {
+        pthread_mutex_unlock(&conn->lock);
+        return;
+    }
+    int sock = modbus_get_socket(ctx);
+
+    uint16_t tids[MAX_PIPELINE_DEPTH];
+    int pending[MAX_PIPELINE_DEPTH];    // index of the range, -1 for a free slot
+    int inflight = 0;
+    for (i = 0; i < MAX_PIPELINE_DEPTH; i++)
+    {
+        pending[i] = -1;
+    }
+
+    uint8_t req[MODBUS_TCP_MAX_ADU_LENGTH];
+    uint8_t rsp[MODBUS_TCP_MAX_ADU_LENGTH];
+    int sent = 0;
+    int broken = 0;
+    long long start_us = monotonic_us();
+    while (!broken && (sent < count || inflight > 0))
+    {
+        // 1 fill the pipeline
+        while (sent < count && inflight < g_pipeline_depth)
+        {
+            int slot = 0;
+            while (pending[slot] != -1)
+            {
+                slot++;
+            }
+            conn->tid++;
+            int len = build_tcp_read_request(req, conn->tid, &ranges[sent]);
+            if (send(sock, req, len, MSG_NOSIGNAL) != len)
+            {
+                printf("ERROR failed to send pipelined request to %s, will reconnect\n",
+                    conn->ip_com_addr);
+                ranges[sent].err = errno;
+                broken = 1;
+                break;
+            }
+            tids[slot] = conn->tid;
+            pending[slot] = sent;
+            inflight++;
+            sent++;
+        }
+        if (broken)
+        {
+            break;
+        }
+
+        // 2 receive one reply, in whatever order the slaves answer
+        int len = modbus_receive_confirmation(ctx, rsp);
+        if (len == -1)
+        {
+            int err = errno;
+            broken = modbus_failure_of(conn, err) == MODBUS_FAIL_LINK;
+            printf("ERROR pipelined receive (%s) from %s%s\n", modbus_strerror(err), 
+                conn->ip_com_addr, broken ? ", will reconnect" : "");
+            for (i = 0; i < MAX_PIPELINE_DEPTH; i++)
+            {
+                if (pending[i] != -1)
+                {
+                    ranges[pending[i]].err = err;
+                    pending[i] = -1;
+                }
+            }
+            inflight = 0;
+            continue;
+        }
+        conn->timeouts = 0;
+        uint16_t tid = (rsp[0] << 8) | rsp[1];
+        for (i = 0; i < MAX_PIPELINE_DEPTH; i++)
+        {
+            if (pending[i] != -1 && tids[i] == tid)
+            {
+                ReadRange* range = &ranges[pending[i]];
+                range->rc = parse_tcp_read_response(rsp, len, range);
+                pending[i] = -1;
+                inflight--;
+                break;
+            }
+        }
+        // a reply matching no request is a late one of a timed out request, drop it
+    }
+
+    // the whole pipeline keeps the bus busy, counted as the requests sent
+    end_modbus_request(conn, start_us, !broken);
+    conn->requests += sent - 1;
+    if (broken)
+    {
+        mark_modbus_offline(conn);
+    }
+    pthread_mutex_unlock(&conn->lock);
+}
+
+// record the result of a poll of the policy, err is 0 on success. the polls
+// failed on a working bus, i.e. the exceptions and the timeouts, are counted
+// in a row, for the backoff of the policy
+void note_policy_result(SlavePolicy* policy, int err)
+{
+    policy->lastError = err;
+    if (err == 0)
+    {
+        policy->errorStreak = 0;
+        return;
     }
-    else
+    if (is_modbus_exception(err))
     {
-        fprintf(stderr, "Not supported modbus mode %d, only support modbus TCP and RTU now\n",
-                 (int)policy->mode);
+        counter_add(&policy->exceptions, 1);
     }
-    
-    if (ctx != NULL)
+    if (is_modbus_exception(err) || err == ETIMEDOUT || err == EMBBADCRC)
     {
-        modbus_set_slave(ctx, policy->slaveid);
+        policy->errorStreak++;
     }
-    g_modbus_ctxs[policy->slaveid] = ctx;
 }
 
-int read_modbus(SlavePolicy* policy, char* payload)
+void read_modbus_coalesced(SlavePolicy** policies, int count, uint8_t* scratch)
 {
-    if (policy == NULL)
+    if (count <= 0)
     {
-        fprintf(stderr, "NULL policy in read_modbus\n");
-        return -1;
+        return;
     }
 
-    // 1 query modbus data
-    // parse the host and port first
-    modbus_t* ctx = g_modbus_ctxs[policy->slaveid];
-    if (ctx == NULL)
+    // sort a copy, leave the batch of the caller untouched
+    SlavePolicy* sorted[MAX_POLL_BATCH];
+    if (count > MAX_POLL_BATCH)
     {
-        // slave could be offline when we initialize the modbus context,
-        // we need to recover this, by trying to re-connect
-        fprintf(stderr, 
-            "modbus context is NULL in execution phase, trying to reconnect slaveid=%d\n", 
-            policy->slaveid);
-        init_modbus_context(policy);
-    
-        // Ask: slave may disconnect, leaving a non-NULL ctx, how should we recover?    
-        // Answer: reconnect on communication error
+        count = MAX_POLL_BATCH;
     }
-    ctx = g_modbus_ctxs[policy->slaveid];
-    if (ctx == NULL)
+    int i = 0;
+    for (i = 0; i < count; i++)
     {
-        fprintf(stderr, "can't make connection to modbus slave#%d\n", policy->slaveid);
-        return -1;
+        sorted[i] = policies[i];
+        sorted[i]->payload[0] = 0;
     }
+    qsort(sorted, count, sizeof(SlavePolicy*), compare_policy_range);
 
-    int start_addr = policy->start_addr;
-    int nb = policy->length;
-
-    uint16_t* tab_rq_registers = NULL;
-    uint8_t* tab_rq_bits = NULL;
+    // 0 probe the slaves whose ranges aren't known yet, the scratch is free
+    DeviceProfile* profiles[MAX_POLL_BATCH];
+    for (i = 0; i < count; i++)
+    {
+        profiles[i] = probe_modbus_device(sorted[i], scratch);
+    }
 
-    int rc = -1;
-    payload[0] = 0;    // empty the payload first
-    int need_reconnect_modbus = 0;
-    switch(policy->functioncode)
+    // 1 plan the merged ranges
+    ReadRange ranges[MAX_POLL_BATCH];
+    DeviceProfile* bridged[MAX_POLL_BATCH];    // the profile of a range merged over a gap
+    int range_num = 0;
+    i = 0;
+    while (i < count)
     {
-        case MODBUS_FC_READ_COILS:
-            // just store every bit as a byte, for easy of use
-            tab_rq_bits = (uint8_t*) malloc(nb * sizeof(uint8_t));
-            memset(tab_rq_bits, 0, nb * sizeof(uint8_t));
-            rc = modbus_read_bits(ctx, start_addr, nb, tab_rq_bits);
-            if (rc != nb) 
+        // grow the range [start, end) as long as the next policy overlaps or
+        // is contiguous with it, or the probe read the gap too, and the
+        // merged range fits in one request
+        SlavePolicy* first = sorted[i];
+        DeviceProfile* profile = profiles[i];
+        int limit = profile_read_limit(profile, first->functioncode);
+        int start = first->start_addr;
+        int end = first->start_addr + first->length;
+        int gap = 0;
+        int j = i + 1;
+        while (j < count && same_slave_and_function(first, sorted[j]))
+        {
+            int next_end = sorted[j]->start_addr + sorted[j]->length;
+            if (next_end < end)
             {
-                printf("ERROR modbus_read_bits (%d) slaveid=%d, will reconnect\n",
-                     rc, policy->slaveid);
-                need_reconnect_modbus = 1;
-                break;
+                next_end = end;
             }
-            byte_arr_to_hex(payload, (char*)tab_rq_bits, nb * sizeof(uint8_t));
-            break;
-
-        case MODBUS_FC_READ_DISCRETE_INPUTS:
-            tab_rq_bits = (uint8_t*) malloc(nb * sizeof(uint8_t));
-            memset(tab_rq_bits, 0, nb * sizeof(uint8_t));
-            rc = modbus_read_input_bits(ctx, start_addr, nb, tab_rq_bits);
-            if (rc != nb)
+            if (sorted[j]->start_addr > end
+                && (profile == NULL || !profile_covers(profile, start, next_end - start)))
             {
-                printf("ERROR modbus_read_input_bits (%d) slaveid=%d, will reconnect\n",
-                     rc, policy->slaveid);
-                need_reconnect_modbus = 1;
                 break;
             }
-            byte_arr_to_hex(payload, (char*)tab_rq_bits, nb * sizeof(uint8_t));
-            break;
-    
-        case MODBUS_FC_READ_HOLDING_REGISTERS:
-            tab_rq_registers = (uint16_t*) malloc(nb * sizeof(uint16_t));
-            memset(tab_rq_registers, 0, nb * sizeof(uint16_t));
-            rc = modbus_read_registers(ctx, start_addr, nb, tab_rq_registers);
-            if (rc != nb)
+            if (next_end - start > limit)
             {
-                printf("ERROR modbus_read_registers (%d) slaveid=%d, will reconnect\n",
-                     rc, policy->slaveid);
-                need_reconnect_modbus = 1;
                 break;
             }
-            short_arr_to_array(payload, tab_rq_registers, nb);
-            break;
+            gap = gap || sorted[j]->start_addr > end;
+            end = next_end;
+            j++;
+        }
 
-        case MODBUS_FC_READ_INPUT_REGISTERS:
-            tab_rq_registers = (uint16_t*) malloc(nb * sizeof(uint16_t));
-            memset(tab_rq_registers, 0, nb * sizeof(uint16_t));
-            rc = modbus_read_input_registers(ctx, start_addr, nb, tab_rq_registers);
-            if (rc != nb)
+        bridged[range_num] = gap ? profile : NULL;
+        ReadRange* range = &ranges[range_num++];
+        range->first = first;
+        range->begin = i;
+        range->end = j;
+        range->start_addr = start;
+        range->nb = end - start;
+        range->data = scratch + (range_num - 1) * RANGE_BUFF_LEN;
+        if (range_bytes(first->functioncode, range->nb) > RANGE_BUFF_LEN)
+        {
+            // only a single policy longer than the protocol allows gets here
+            printf("ERROR length %d of slaveid=%d exceeds the protocol limit\n", 
+                range->nb, first->slaveid);
+            range->data = NULL;
+        }
+        range->rc = -1;
+        range->err = EMBMDATA;
+        if (profile != NULL && profile->unsupported)
+        {
+            // not sent, the policies back off as on the exception
+            range->data = NULL;
+            range->err = EMBXILFUN;
+        }
+        i = j;
+    }
+
+    // 2 read them. the ranges on the same tcp connection are adjacent, and 
+    // pipelined if enabled, the others are read one by one
+    i = 0;
+    while (i < range_num)
+    {
+        SlavePolicy* first = ranges[i].first;
+        int j = i + 1;
+        if (g_pipeline_depth > 1 && first->mode == TCP && first->modbusConn >= 0)
+        {
+            while (j < range_num && ranges[j].first->modbusConn == first->modbusConn)
             {
-                printf("ERROR modbus_read_input_registers (%d) slaveid=%d, will reconnect\n",
-                     rc, policy->slaveid);
-                need_reconnect_modbus = 1;
-                break;
+                j++;
             }
-            short_arr_to_array(payload, tab_rq_registers, nb);
-            break;
+        }
 
-        default:
-            fprintf(stderr, "not supported function code:%d\n", policy->functioncode);
-            break;
-    }
-    if (tab_rq_bits != NULL)
-    {
-        free(tab_rq_bits);
+        if (j - i > 1)
+        {
+            read_ranges_pipelined(&g_modbus_conns[first->modbusConn], &ranges[i], j - i);
+        }
+        else if (ranges[i].data != NULL)
+        {
+            ranges[i].rc = read_modbus_range(first, ranges[i].start_addr, 
+                ranges[i].nb, ranges[i].data);
+            ranges[i].err = ranges[i].rc == 0 ? 0 : errno;
+        }
+        i = j;
     }
 
-    if (tab_rq_registers != NULL)
-    {
-        free(tab_rq_registers);
-    }
-    
-    if (need_reconnect_modbus == 1)
+    // 3 slice the responses back into the payload of each policy
+    for (i = 0; i < range_num; i++)
     {
-        if (g_modbus_ctxs[policy->slaveid] != NULL)
+        ReadRange* range = &ranges[i];
+        if (range->rc != 0 && bridged[i] != NULL
+            && (range->err == EMBXILADD || range->err == EMBXILVAL))
+        {
+            forget_modbus_profile(bridged[i]);
+        }
+        int k = 0;
+        for (k = range->begin; k < range->end; k++)
         {
-            // in case there is error when read modbus, we need
-            // to close the current context, otherwise, the 
-            // port/serial port is still be occupied.
-            modbus_close(g_modbus_ctxs[policy->slaveid]);
-            modbus_free(g_modbus_ctxs[policy->slaveid]);
+            note_policy_result(sorted[k], range->rc == 0 ? 0 : range->err);
+            if (range->rc == 0)
+            {
+                range_to_payload(range->first->functioncode, range->data, 
+                    sorted[k]->start_addr - range->start_addr, sorted[k]->length, 
+                    sorted[k]->payload);
+            }
         }
-        g_modbus_ctxs[policy->slaveid] = NULL;
-        init_modbus_context(policy);
     }
 }
 
 void cleanup_modbus_ctxs()
 {
     // clean modbus context
+    pthread_mutex_lock(&g_modbus_conn_lock);
     int i = 0;
-    for(i = 0; i < MODBUS_DATA_COUNT; i++)
+    for(i = 0; i < g_modbus_conn_num; i++)
     {
-        modbus_t* ctx = g_modbus_ctxs[i];
-        if (ctx != NULL)
+        ModbusConn* conn = &g_modbus_conns[i];
+        pthread_mutex_lock(&conn->lock);
+        close_modbus(conn);
+        pthread_mutex_unlock(&conn->lock);
+        drop_modbus_writes(conn);
+        pthread_mutex_destroy(&conn->lock);
+        pthread_mutex_destroy(&conn->writeLock);
+    }
+    g_modbus_conn_num = 0;
+    g_modbus_conn_generation++;
+    for (i = 0; i < MODBUS_DATA_COUNT; i++)
+    {
+        g_slave_conn[i] = -1;
+    }
+    pthread_mutex_unlock(&g_modbus_conn_lock);
+}
+
+void mark_modbus_conns_unused()
+{
+    pthread_mutex_lock(&g_modbus_conn_lock);
+    int i = 0;
+    for (i = 0; i < g_modbus_conn_num; i++)
+    {
+        g_modbus_conns[i].inUse = 0;
+    }
+    for (i = 0; i < MODBUS_DATA_COUNT; i++)
+    {
+        g_slave_conn[i] = -1;
+    }
+    pthread_mutex_unlock(&g_modbus_conn_lock);
+}
+
+void release_unused_modbus_conns()
+{
+    pthread_mutex_lock(&g_modbus_conn_lock);
+    int i = 0;
+    for (i = 0; i < g_modbus_conn_num; i++)
+    {
+        ModbusConn* conn = &g_modbus_conns[i];
+        if (!conn->inUse)
         {
-            modbus_close(ctx);
-            modbus_free(ctx);
-            g_modbus_ctxs[i] = NULL;
+            pthread_mutex_lock(&conn->lock);
+            if (conn->ctx != NULL)
+            {
+                printf("modbus connection to %s is no longer used, closing it\n",
+                    conn->ip_com_addr);
+            }
+            close_modbus(conn);
+            pthread_mutex_unlock(&conn->lock);
+            drop_modbus_writes(conn);
         }
     }
+    pthread_mutex_unlock(&g_modbus_conn_lock);
 }
 
 void init_modbus_ctxs()
 {
     int i = 0;
+    g_modbus_conn_num = 0;
     for (i = 0; i < MODBUS_DATA_COUNT; i++)
     {
-        g_modbus_ctxs[i] = NULL;
+        g_slave_conn[i] = -1;
     }
 }
 
@@ -252,6 +1795,8 @@ void init_modbus_ctxs()
 *   write data into the specified slaveid, the slaveid must 
 *   within the slaveis that the gateway is pulling data from
 *
+*   ip_com_addr: the bus of the slave, as in the policies, NULL or empty for
+*       the bus where the slaveid is first seen
 *   slaveid: the target modbus slave
 *   startAddress: the address of the first register/bit to be written, e.g 40003, 00005
 *   data: the data to write, e.g "00ff12cd", presented as string
@@ -262,18 +1807,13 @@ void init_modbus_ctxs()
 *
 *   return: 0 on sucess, -1 otherwise
 **/
-int write_modbus(int slaveid, int startAddress, char* data)
+int write_modbus(const char* ip_com_addr, int slaveid, int startAddress, char* data)
 {
     // check if slave is connected or not
     if (slaveid < 1 || slaveid >= MODBUS_DATA_COUNT)
     {
         return -1;
     }
-    modbus_t* ctx = g_modbus_ctxs[slaveid];
-    if (ctx == NULL)
-    {
-        return -1;
-    }
 
     // check data
     if (data == NULL || strlen(data) < 2)
@@ -281,17 +1821,222 @@ int write_modbus(int slaveid, int startAddress, char* data)
         return -1;  // expects at least 2 chars, like "01"
     }
 
+    pthread_mutex_lock(&g_modbus_conn_lock);
+    int pos = g_slave_conn[slaveid];
+    if (ip_com_addr != NULL && strlen(ip_com_addr) > 0)
+    {
+        pos = find_modbus_conn_by_addr(ip_com_addr);
+    }
+    if (pos < 0)
+    {
+        pthread_mutex_unlock(&g_modbus_conn_lock);
+        return -1;
+    }
+    ModbusConn* conn = &g_modbus_conns[pos];
+    pthread_mutex_lock(&conn->lock);
+    modbus_t* ctx = conn->ctx;
+    if (ctx != NULL)
+    {
+        modbus_set_slave(ctx, slaveid);
+        wait_modbus_turnaround(conn);
+    }
+    long long start_us = monotonic_us();
+    int rc = write_modbus_conn(conn, slaveid, startAddress, data);
+    if (ctx != NULL && rc == 0)
+    {
+        modbus_request_done(conn, start_us, 1);
+    }
+    else if (ctx != NULL)
+    {
+        // may be rejected before sending, it tells nothing about the timeout
+        end_modbus_request(conn, start_us, 0);
+    }
+    pthread_mutex_unlock(&conn->lock);
+    pthread_mutex_unlock(&g_modbus_conn_lock);
+    return rc;
+}
+
+// put the write into the queue of the bus after the ones of its priority or
+// a higher one, and copy the address of the bus into bus if not NULL. must be
+// called with the pool lock held
+static void enqueue_modbus_write(ModbusConn* conn, ModbusWrite* w, char* bus)
+{
+    pthread_mutex_lock(&conn->writeLock);
+    if (conn->writeTail == NULL || conn->writeTail->priority <= w->priority)
+    {
+        if (conn->writeTail != NULL)
+        {
+            conn->writeTail->next = w;
+        }
+        else
+        {
+            conn->writeHead = w;
+        }
+        conn->writeTail = w;
+    }
+    else
+    {
+        ModbusWrite** link = &conn->writeHead;
+        while ((*link)->priority <= w->priority)
+        {
+            link = &(*link)->next;
+        }
+        w->next = *link;
+        *link = w;
+    }
+    conn->pendingWrites++;
+    pthread_mutex_unlock(&conn->writeLock);
+    if (bus != NULL)
+    {
+        mystrncpy(bus, conn->ip_com_addr, ADDR_LEN);
+    }
+}
+
+int queue_modbus_write(const char* ip_com_addr, int slaveid, int startAddress, 
+    const char* data, int readback, ModbusWriteDone* done, void* arg, char* bus)
+{
+    if (slaveid < 0 || slaveid >= MODBUS_DATA_COUNT || data == NULL || strlen(data) < 2)
+    {
+        return -1;
+    }
+    // a broadcast goes to the bus given, and can't be read back
+    int broadcast = slaveid == MODBUS_BROADCAST_ADDRESS;
+    if (broadcast && (ip_com_addr == NULL || strlen(ip_com_addr) == 0 || readback))
+    {
+        return -1;
+    }
+    // 4 hex chars per register, 2 per bit
+    int chars = startAddress >= 40001 ? 4 : 2;
+    if ((int)strlen(data) / chars > MAX_MODBUS_DATA_TO_WRITE)
+    {
+        return -1;
+    }
+    ModbusWrite* w = (ModbusWrite*) malloc(sizeof(ModbusWrite));
+    if (w == NULL)
+    {
+        return -1;
+    }
+    w->slaveid = slaveid;
+    w->address = startAddress;
+    w->data = strdup(data);
+    // only the registers could be read back
+    w->readback = readback && startAddress >= 40001 && startAddress < 49999;
+    w->queuedUs = monotonic_us();
+    w->done = done;
+    w->arg = arg;
+    w->raw = NULL;
+    w->rawNum = 0;
+    w->rawDone = NULL;
+    w->priority = 0;
+    w->next = NULL;
+
+    pthread_mutex_lock(&g_modbus_conn_lock);
+    int pos = g_slave_conn[slaveid];
+    if (ip_com_addr != NULL && strlen(ip_com_addr) > 0)
+    {
+        pos = find_modbus_conn_by_addr(ip_com_addr);
+    }
+    if (pos < 0 || !g_modbus_conns[pos].inUse || w->data == NULL
+        || (broadcast && g_modbus_conns[pos].mode == TCP))
+    {
+        pthread_mutex_unlock(&g_modbus_conn_lock);
+        free(w->data);
+        free(w);
+        return -1;
+    }
+    enqueue_modbus_write(&g_modbus_conns[pos], w, bus);
+    pthread_mutex_unlock(&g_modbus_conn_lock);
+    return 0;
+}
+
+int queue_modbus_raw(const char* ip_com_addr, int slaveid, ModbusRaw* reqs, int count,
+    int priority, ModbusRawDone* done, void* arg, char* bus)
+{
+    if (slaveid < 0 || slaveid >= MODBUS_DATA_COUNT || count <= 0 || done == NULL)
+    {
+        return -1;
+    }
+    ModbusWrite* w = (ModbusWrite*) calloc(1, sizeof(ModbusWrite));
+    if (w == NULL)
+    {
+        return -1;
+    }
+    w->queuedUs = monotonic_us();
+    w->raw = reqs;
+    w->rawNum = count;
+    w->rawDone = done;
+    w->arg = arg;
+    w->priority = priority;
+
+    pthread_mutex_lock(&g_modbus_conn_lock);
+    int pos = g_slave_conn[slaveid];
+    if (ip_com_addr != NULL && strlen(ip_com_addr) > 0)
+    {
+        pos = find_modbus_conn_by_addr(ip_com_addr);
+    }
+    if (pos < 0 || !g_modbus_conns[pos].inUse)
+    {
+        pthread_mutex_unlock(&g_modbus_conn_lock);
+        free(w);
+        return -1;
+    }
+    enqueue_modbus_write(&g_modbus_conns[pos], w, bus);
+    pthread_mutex_unlock(&g_modbus_conn_lock);
+    return 0;
+}
+
+void run_queued_modbus_writes(ModbusBusFilter* owned, void* arg)
+{
+    // the connections only change on policy reload, which never runs along
+    // with the polling, so the pool lock is not held while writing
+    pthread_mutex_lock(&g_modbus_conn_lock);
+    int num = g_modbus_conn_num;
+    pthread_mutex_unlock(&g_modbus_conn_lock);
+    int i = 0;
+    for (i = 0; i < num; i++)
+    {
+        ModbusConn* conn = &g_modbus_conns[i];
+        if (conn->pendingWrites > 0 && owned(conn->ip_com_addr, arg))
+        {
+            pthread_mutex_lock(&conn->lock);
+            run_modbus_writes(conn);
+            pthread_mutex_unlock(&conn->lock);
+        }
+    }
+}
+
+// write data to the slave on the connected bus, in the transport of the bus.
+// must be called with the conn lock held
+int write_modbus_conn(ModbusConn* conn, int slaveid, int startAddress, char* data)
+{
+    modbus_t* ctx = conn->ctx;
+    if (ctx == NULL)
+    {
+        return -1;
+    }
+    AsciiLink link;
+    if (conn->mode == ASCII)
+    {
+        ascii_link_of(conn, slaveid, &link);
+    }
+
     int rc = 0;
 
     // check start address
     if (startAddress >= 1 && startAddress < 9999)
     {        
         uint8_t data8[MAX_MODBUS_DATA_TO_WRITE];
-        int num = char2uint8(data8, data);
+        int num = char2uint8(data8, MAX_MODBUS_DATA_TO_WRITE, data);
         int startOffset = startAddress - 1;
+        if (num < 0)
+        {
+            printf("invalid data to write, slaveid=%d, address=%d\n", slaveid, startAddress);
+            return -1;
+        }
         if (num > 0)
         {
-            rc = modbus_write_bits(ctx, startOffset, num, data8);
+            rc = conn->mode == ASCII ? ascii_write_bits(&link, startOffset, num, data8)
+                : modbus_write_bits(ctx, startOffset, num, data8);
             if (rc == -1)
             {
                 printf("write bits failed, slaveid=%d, address=%d, data=%s\n", slaveid, startAddress, data);
@@ -303,11 +2048,17 @@ int write_modbus(int slaveid, int startAddress, char* data)
     else if (startAddress >= 40001 && startAddress < 49999)
     {
         uint16_t data16[MAX_MODBUS_DATA_TO_WRITE];
-        int num = char2uint16(data16, data);
+        int num = char2uint16(data16, MAX_MODBUS_DATA_TO_WRITE, data);
         int startOffset = startAddress - 40001;
+        if (num < 0)
+        {
+            printf("invalid data to write, slaveid=%d, address=%d\n", slaveid, startAddress);
+            return -1;
+        }
         if (num > 0)
         {
-            rc = modbus_write_registers(ctx, startOffset, num, data16);
+            rc = conn->mode == ASCII ? ascii_write_registers(&link, startOffset, num, data16)
+                : modbus_write_registers(ctx, startOffset, num, data16);
             if (rc == -1)
             {
                 printf("write registers failed, slaveid=%d, address=%d, data=%s\n", slaveid, startAddress, data);
@@ -322,4 +2073,221 @@ int write_modbus(int slaveid, int startAddress, char* data)
     }
 
     return -1;
-}
\ No newline at end of file
+}
+
+// broadcast the write to all the slaves on the serial bus(slave 0), in the
+// transport of the bus. the slaves don't answer a broadcast, so it's only sent,
+// and the bus is then kept idle for the broadcast turnaround, the time the
+// slaves need to process it. return 0 if sent, -1 otherwise.
+// must be called with the conn lock held
+int broadcast_modbus_conn(ModbusConn* conn, int startAddress, char* data)
+{
+    modbus_t* ctx = conn->ctx;
+    if (ctx == NULL || conn->mode == TCP)
+    {
+        return -1;
+    }
+    uint8_t req[MODBUS_MAX_PDU_LENGTH + 1];   // the slave and the pdu
+    int len = -1;
+    if (startAddress >= 1 && startAddress < 9999)
+    {
+        uint8_t data8[MAX_MODBUS_DATA_TO_WRITE];
+        int num = char2uint8(data8, MAX_MODBUS_DATA_TO_WRITE, data);
+        len = num > 0 ? write_bits_pdu(req + 1, startAddress - 1, num, data8) : -1;
+    }
+    else if (startAddress >= 40001 && startAddress < 49999)
+    {
+        uint16_t data16[MAX_MODBUS_DATA_TO_WRITE];
+        int num = char2uint16(data16, MAX_MODBUS_DATA_TO_WRITE, data);
+        len = num > 0 ? write_registers_pdu(req + 1, startAddress - 40001, num, data16) : -1;
+    }
+    if (len < 0)
+    {
+        printf("invalid broadcast on %s, address=%d, data=%s\n", conn->ip_com_addr, 
+            startAddress, data);
+        return -1;
+    }
+
+    int rc = 0;
+    // the chars of the frame, to tell when it's on the wire
+    int chars = len + 3;
+    if (conn->mode == ASCII)
+    {
+        AsciiLink link;
+        ascii_link_of(conn, MODBUS_BROADCAST_ADDRESS, &link);
+        rc = ascii_send(&link, req + 1, len);
+        chars = 2 * (len + 2) + 3;
+    }
+    else
+    {
+        // libmodbus adds the crc, and doesn't wait for any response
+        req[0] = MODBUS_BROADCAST_ADDRESS;
+        rc = modbus_send_raw_request(ctx, req, len + 1) < 0 ? -1 : 0;
+    }
+    if (rc != 0)
+    {
+        printf("broadcast failed on %s (%s), address=%d, data=%s\n", conn->ip_com_addr, 
+            modbus_strerror(errno), startAddress, data);
+        return -1;
+    }
+    long long frame = conn->baud > 0 ? chars * 11 * 1000000LL / conn->baud : 0;
+    conn->quietUntilUs = monotonic_us() + frame + BROADCAST_TURNAROUND_MS * 1000LL;
+    return 0;
+}
+
+// one raw request on the connected bus, in the transport of the bus. libmodbus
+// sends the rtu frames, but only knows the length of the responses of its own
+// function codes, so the responses are framed here. return the length of the
+// response pdu, 0 for a broadcast, -1 on error. must be called with the conn lock held
+static int raw_modbus_conn(ModbusConn* conn, ModbusRaw* r)
+{
+    modbus_t* ctx = conn->ctx;
+    long long timeout = conn->timeoutUs > 0 ? conn->timeoutUs 
+        : DEFAULT_RESPONSE_TIMEOUT_MS * 1000LL;
+    // the unit 0 of a tcp slave is answered like any other
+    int broadcast = conn->mode != TCP && r->slaveid == MODBUS_BROADCAST_ADDRESS;
+    // the chars of the frame, to tell when a broadcast is on the wire
+    int chars = r->reqLen + 3;
+    int rc = 0;
+    if (conn->mode == TCP)
+    {
+        conn->tid++;
+        return tcp_raw_transact(modbus_get_socket(ctx), conn->tid, r->slaveid, r->req, 
+            r->reqLen, r->rsp, timeout);
+    }
+    else if (conn->mode == ASCII)
+    {
+        AsciiLink link;
+        ascii_link_of(conn, r->slaveid, &link);
+        if (!broadcast)
+        {
+            return ascii_raw(&link, r->req, r->reqLen, r->rsp);
+        }
+        rc = ascii_send(&link, r->req, r->reqLen);
+        chars = 2 * (r->reqLen + 2) + 3;
+    }
+    else
+    {
+        uint8_t adu[MODBUS_MAX_PDU_LENGTH + 1];
+        adu[0] = (uint8_t) r->slaveid;
+        memcpy(adu + 1, r->req, r->reqLen);
+        // drop whatever is left of a late response before asking
+        modbus_flush(ctx);
+        if (modbus_send_raw_request(ctx, adu, r->reqLen + 1) < 0)
+        {
+            return -1;
+        }
+        if (!broadcast)
+        {
+            // the end of the frame of an unknown function code is a silence
+            // longer than the gap between its chars
+            long long gap = conn->byteTimeoutMs > 0 ? conn->byteTimeoutMs * 1000LL 
+                : RAW_FRAME_GAP_MS * 1000LL;
+            return rtu_raw_receive(modbus_get_socket(ctx), r->slaveid, r->rsp, timeout, gap);
+        }
+    }
+    if (rc != 0)
+    {
+        return -1;
+    }
+    long long frame = conn->baud > 0 ? chars * 11 * 1000000LL / conn->baud : 0;
+    conn->quietUntilUs = monotonic_us() + frame + BROADCAST_TURNAROUND_MS * 1000LL;
+    return 0;
+}
+
+// run the raw requests queued together, in their order. after a failure
+// which breaks the connection, the rest fail as well.
+// must be called with the conn lock held
+void run_modbus_raw(ModbusConn* conn, ModbusWrite* w)
+{
+    int i = 0;
+    for (i = 0; i < w->rawNum; i++)
+    {
+        ModbusRaw* r = &w->raw[i];
+        r->rspLen = -1;
+        r->err = ENOTCONN;
+        r->latencyUs = 0;
+        if (conn->ctx == NULL)
+        {
+            continue;
+        }
+        if (r->reqLen < 1 || r->reqLen >= MODBUS_MAX_PDU_LENGTH)
+        {
+            r->err = EMBMDATA;
+            continue;
+        }
+        modbus_set_slave(conn->ctx, r->slaveid);
+        wait_modbus_turnaround(conn);
+        long long start_us = monotonic_us();
+        int len = raw_modbus_conn(conn, r);
+        r->latencyUs = monotonic_us() - start_us;
+        if (len > 0)
+        {
+            conn->timeouts = 0;
+            r->rspLen = len;
+            r->err = 0;
+            modbus_request_done(conn, start_us, 1);
+            continue;
+        }
+        if (len == 0)
+        {
+            // a broadcast is never answered, there is no response time to learn from
+            r->rspLen = 0;
+            r->err = 0;
+            end_modbus_request(conn, start_us, 1);
+            continue;
+        }
+        r->err = errno;
+        ModbusFailure failure = modbus_failure_of(conn, r->err);
+        modbus_request_done(conn, start_us, 0);
+        if (failure == MODBUS_FAIL_LINK)
+        {
+            printf("ERROR raw request (%s) on %s, will reconnect\n", modbus_strerror(r->err),
+                conn->ip_com_addr);
+            mark_modbus_offline(conn);
+        }
+    }
+}
+
+// write the registers and read them back in one request(function code 0x17),
+// for the writes which need to be confirmed. the registers read are stored
+// as hex into readback, which must hold 4 chars per register and the '\0'.
+// return 0 on success, -1 otherwise
+int write_and_read_modbus_conn(ModbusConn* conn, int slaveid, int startAddress, char* data, 
+    char* readback)
+{
+    modbus_t* ctx = conn->ctx;
+    if (ctx == NULL || startAddress < 40001 || startAddress >= 49999)
+    {
+        return -1;
+    }
+    uint16_t data16[MAX_MODBUS_DATA_TO_WRITE];
+    uint16_t read16[MAX_MODBUS_DATA_TO_WRITE];
+    int num = char2uint16(data16, MAX_MODBUS_DATA_TO_WRITE, data);
+    int startOffset = startAddress - 40001;
+    if (num <= 0)
+    {
+        return -1;
+    }
+    int rc = -1;
+    if (conn->mode == ASCII)
+    {
+        AsciiLink link;
+        ascii_link_of(conn, slaveid, &link);
+        rc = ascii_write_and_read_registers(&link, startOffset, num, data16, 
+            startOffset, num, read16);
+    }
+    else
+    {
+        rc = modbus_write_and_read_registers(ctx, startOffset, num, data16, 
+            startOffset, num, read16);
+    }
+    if (rc != num)
+    {
+        printf("write and read registers failed, slaveid=%d, address=%d, data=%s\n", 
+            slaveid, startAddress, data);
+        return -1;
+    }
+    short_arr_to_array(readback, read16, num);
+    return 0;
+}
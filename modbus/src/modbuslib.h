@@ -21,9 +21,13 @@
 #define INF_BCE_IOT_MODBUS_SDK_C_MODBUSLIB_H
 
 #include "data.h"
+#include "metrics.h"
+#include <cjson/cJSON.h>
+#include <modbus/modbus.h>
 
-// make modbus connection to modbus slave, and 
-// store the context in g_modbus_ctxs
+// make modbus connection to the bus(tcp endpoint or serial port) of the
+// policy, unless it's already in the pool. the slaves behind the same 
+// bus share one connection
 void init_modbus_context(SlavePolicy* policy);
 
 // issue a modbus request to modbus slave, and receive
@@ -32,8 +36,118 @@ void init_modbus_context(SlavePolicy* policy);
 // and auto reconnect if necessary
 int read_modbus(SlavePolicy* policy, char* payload);
 
+// read the data of several policies which are due at the same time.
+// policies with the same slave and function code, whose address ranges are
+// overlapping or contiguous, are merged into one modbus request as long as
+// the merged range is within the protocol limits (125 registers or 2000 bits),
+// the response is then sliced back into the payload of each policy.
+// with probing, see probe.h, the learned limit of the slave is used instead,
+// and the policies separated by a gap are merged too if the merged range was
+// read at once by the probe.
+// the payload of each policy receives its data, it's empty on failure.
+// scratch holds the raw data of the merged ranges, it must have at least
+// MAX_POLL_BATCH * RANGE_BUFF_LEN bytes, so that no allocation is needed
+void read_modbus_coalesced(SlavePolicy** policies, int count, uint8_t* scratch);
+
+// return 1 if the function code reads bits(coils or discrete inputs), 0 for registers
+int is_bit_function(char functioncode);
+
+// the max number of bits/registers one request of the function code reads
+int max_read_count(char functioncode);
+
+// read nb bits/registers of the slave and the function code of the policy from
+// start_addr into dest, as bytes per bit or uint16_t per register. return 0 on
+// success, -1 otherwise with errno set
+int read_modbus_range(SlavePolicy* policy, int start_addr, int nb, void* dest);
+
+// return 1 if err tells the slave answered with an exception
+int is_modbus_exception(int err);
+
+// allow up to depth outstanding requests on one modbus tcp connection, for
+// the slaves behind a tcp gateway. 1(the default) disables the pipelining
+void set_modbus_pipeline_depth(int depth);
+
+// the buses are connected and reconnected in a background thread, with
+// exponential backoff and jitter per bus; the policies on an offline bus
+// are skipped without blocking the workers
+void start_modbus_reconnector();
+
+void stop_modbus_reconnector();
+
+// return 1 if any bus went offline or came back since the last call
+int modbus_status_changed();
+
+// listener is called, by the thread that noticed, once a bus goes offline
+// or comes back
+void modbus_set_status_listener(void (*listener)(void));
+
+// the state of every bus, as a json array, the caller should free it
+cJSON* modbus_conn_status();
+
+// the metrics of every bus, in the prometheus text format
+void modbus_conn_metrics(MetricsText* t);
+
 void cleanup_modbus_ctxs();
 
+// policy reloading: mark all the connections unused, claim the ones still
+// needed by init_modbus_context() of every policy, then close the rest.
+// the connections claimed again are kept as is, without reconnecting
+void mark_modbus_conns_unused();
+
+void release_unused_modbus_conns();
+
 void init_modbus_ctxs();
 
+// write data into the specified slave, see modbuslib.c for the details
+int write_modbus(const char* ip_com_addr, int slaveid, int startAddress, char* data);
+
+// called when a queued write is done, rc is 0 on success, -1 otherwise.
+// latencyUs is the time from queued to done, readback is the hex of the registers
+// read back, NULL unless asked for. it's called with the bus locked, so it must
+// not call into modbuslib
+typedef void ModbusWriteDone(void* arg, int rc, long long latencyUs, const char* readback);
+
+// return nonzero if the bus is polled by the caller
+typedef int ModbusBusFilter(const char* ip_com_addr, void* arg);
+
+// queue a write to the bus of the slave, the arguments are as write_modbus.
+// with readback, the registers are written and read back in one request(0x17). the
+// queued writes of a bus are run by the thread polling it, ahead of its next read,
+// so they never wait for a polling cycle and never race with the reads.
+// the address of the bus is copied into bus(ADDR_LEN) if not NULL, so that
+// the caller can wake up the thread owning it.
+// return 0 if queued, -1 if the bus is unknown or the arguments are invalid
+int queue_modbus_write(const char* ip_com_addr, int slaveid, int startAddress, 
+    const char* data, int readback, ModbusWriteDone* done, void* arg, char* bus);
+
+// a raw request of the pass-through, the pdu(the function code and its data)
+// is sent to the slave as is, and the pdu of the response is given back as is,
+// an exception response included
+typedef struct
+{
+    int index;                      // of the caller, e.g. in its message
+    int slaveid;                    // 0 broadcasts it on a serial bus
+    uint8_t req[MODBUS_MAX_PDU_LENGTH];
+    int reqLen;
+    uint8_t rsp[MODBUS_MAX_PDU_LENGTH];
+    int rspLen;                     // -1 if it failed, 0 for a broadcast
+    int err;                        // the errno of the failure
+    long long latencyUs;            // of the request on the bus
+} ModbusRaw;
+
+// called when the raw requests queued together are done, with the bus locked
+// like ModbusWriteDone
+typedef void ModbusRawDone(void* arg, ModbusRaw* reqs, int count);
+
+// queue the raw requests to the bus of the slave, as queue_modbus_write. they
+// are run one after the other, nothing else goes on the bus in between. the
+// queue of the bus is run by priority, 0 first, the writes are of priority 0,
+// and in the order queued for the same priority. the reqs are the caller's
+// until done. return 0 if queued, -1 if the bus is unknown
+int queue_modbus_raw(const char* ip_com_addr, int slaveid, ModbusRaw* reqs, int count,
+    int priority, ModbusRawDone* done, void* arg, char* bus);
+
+// run the queued writes of the buses the caller owns, when it's not reading
+void run_queued_modbus_writes(ModbusBusFilter* owned, void* arg);
+
 #endif
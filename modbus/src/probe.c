@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "probe.h"
+#include "modbuslib.h"
+#include "common.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <modbus/modbus.h>
+
+enum {PROFILE_BUCKETS = 256};
+
+static DeviceProfile* g_profiles[PROFILE_BUCKETS];
+// guards the buckets, a profile itself is only changed by the worker of its bus
+static pthread_mutex_t g_profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_probing = 0;
+
+void set_modbus_probing(int enabled)
+{
+    g_probing = enabled;
+}
+
+int modbus_probing_enabled()
+{
+    return g_probing;
+}
+
+static unsigned int profile_hash(const char* ip_com_addr, int slaveid, char functioncode)
+{
+    // fnv-1a
+    unsigned int h = 2166136261u;
+    const char* c = ip_com_addr;
+    for (; *c != 0; c++)
+    {
+        h = (h ^ (unsigned char)*c) * 16777619u;
+    }
+    h = (h ^ (unsigned int)slaveid) * 16777619u;
+    h = (h ^ (unsigned char)functioncode) * 16777619u;
+    return h % PROFILE_BUCKETS;
+}
+
+// the profile of the slave and the function code of the policy, created empty
+// the first time. NULL if out of memory
+static DeviceProfile* find_profile(SlavePolicy* policy)
+{
+    unsigned int h = profile_hash(policy->ip_com_addr, policy->slaveid, policy->functioncode);
+    pthread_mutex_lock(&g_profile_lock);
+    DeviceProfile* p = g_profiles[h];
+    while (p != NULL && (p->slaveid != policy->slaveid || p->functioncode != policy->functioncode
+        || strcmp(p->ip_com_addr, policy->ip_com_addr) != 0))
+    {
+        p = p->next;
+    }
+    if (p == NULL)
+    {
+        p = (DeviceProfile*) calloc(1, sizeof(DeviceProfile));
+        if (p != NULL)
+        {
+            mystrncpy(p->ip_com_addr, policy->ip_com_addr, ADDR_LEN);
+            p->slaveid = policy->slaveid;
+            p->functioncode = policy->functioncode;
+            p->next = g_profiles[h];
+            g_profiles[h] = p;
+        }
+    }
+    pthread_mutex_unlock(&g_profile_lock);
+    return p;
+}
+
+int profile_covers(DeviceProfile* profile, int start, int count)
+{
+    int i = 0;
+    for (i = 0; i < profile->spanNum; i++)
+    {
+        ProbeSpan* s = &profile->spans[i];
+        if (start >= s->start && start + count <= s->start + s->count)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// return 1 if the policy starts where a probe started already
+static int probed_from(DeviceProfile* profile, int start)
+{
+    int i = 0;
+    for (i = 0; i < profile->spanNum; i++)
+    {
+        if (profile->spans[i].start == start)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int profile_read_limit(DeviceProfile* profile, char functioncode)
+{
+    int limit = max_read_count(functioncode);
+    if (profile != NULL && profile->maxCount > 0 && profile->maxCount < limit)
+    {
+        limit = profile->maxCount;
+    }
+    return limit;
+}
+
+void forget_modbus_profile(DeviceProfile* profile)
+{
+    printf("the reads planned for slaveid=%d, functioncode=%d on %s failed, probing it again\n",
+        profile->slaveid, profile->functioncode, profile->ip_com_addr);
+    profile->unsupported = 0;
+    profile->maxCount = 0;
+    profile->spanNum = 0;
+    profile->probedAt = 0;
+}
+
+// the result of one probe read: 1 if it succeeded, 0 if the slave refused it
+// or didn't answer in time, -1 if the bus failed
+static int probe_read(SlavePolicy* policy, DeviceProfile* profile, int start, int nb, 
+    void* scratch, int* timeouts)
+{
+    if (read_modbus_range(policy, start, nb, scratch) == 0)
+    {
+        *timeouts = 0;
+        return 1;
+    }
+    int err = errno;
+    if (err == EMBXILFUN)
+    {
+        profile->unsupported = 1;
+        return 0;
+    }
+    if (is_modbus_exception(err))
+    {
+        return 0;
+    }
+    if (err == ETIMEDOUT)
+    {
+        (*timeouts)++;
+        return 0;
+    }
+    return -1;
+}
+
+DeviceProfile* probe_modbus_device(SlavePolicy* policy, void* scratch)
+{
+    if (!g_probing || max_read_count(policy->functioncode) == 0)
+    {
+        return NULL;
+    }
+    DeviceProfile* p = find_profile(policy);
+    if (p == NULL)
+    {
+        return NULL;
+    }
+    long long now = monotonic_ms();
+    if (p->probedAt != 0 && now - p->probedAt >= PROBE_REFRESH_MS)
+    {
+        p->unsupported = 0;
+        p->maxCount = 0;
+        p->spanNum = 0;
+        p->probedAt = 0;
+    }
+    if (p->unsupported || p->spanNum >= MAX_PROBE_SPANS
+        || profile_covers(p, policy->start_addr, policy->length) || probed_from(p, policy->start_addr))
+    {
+        return p;
+    }
+
+    // the longest read from the start of the policy: ok reads succeeded, bad
+    // ones didn't. the policy itself is tried first, it's most likely fine
+    int start = policy->start_addr;
+    int bad = max_read_count(policy->functioncode) + 1;
+    if (start + bad - 1 > 65536)
+    {
+        bad = 65536 - start + 1;
+    }
+    int ok = 0;
+    int timeouts = 0;
+    int nb = policy->length > 0 && policy->length < bad ? policy->length : 1;
+    while (bad - ok > 1 && !p->unsupported && timeouts < PROBE_MAX_TIMEOUTS)
+    {
+        int rc = probe_read(policy, p, start, nb, scratch, &timeouts);
+        if (rc < 0)
+        {
+            // retried with the next poll, once the bus is back
+            return p->spanNum > 0 ? p : NULL;
+        }
+        if (rc > 0)
+        {
+            ok = nb;
+            // the slave may well take the whole protocol limit, so the first
+            // success goes for the top
+            nb = ok == policy->length ? bad - 1 : (ok + bad) / 2;
+        }
+        else
+        {
+            bad = nb;
+            nb = (ok + bad) / 2;
+        }
+        if (nb <= ok)
+        {
+            nb = ok + 1;
+        }
+    }
+    if (p->probedAt == 0)
+    {
+        p->probedAt = now;
+    }
+    if (p->unsupported)
+    {
+        printf("functioncode=%d is not supported by slaveid=%d on %s\n", policy->functioncode,
+            policy->slaveid, policy->ip_com_addr);
+        return p;
+    }
+    if (ok > 0)
+    {
+        p->spans[p->spanNum].start = start;
+        p->spans[p->spanNum].count = ok;
+        p->spanNum++;
+        if (ok > p->maxCount)
+        {
+            p->maxCount = ok;
+        }
+        printf("probed slaveid=%d, functioncode=%d on %s: %d from %d in one read\n",
+            policy->slaveid, policy->functioncode, policy->ip_com_addr, ok, start);
+    }
+    else
+    {
+        // nothing to learn from here, it's not probed on every poll
+        p->spans[p->spanNum].start = start;
+        p->spans[p->spanNum].count = 0;
+        p->spanNum++;
+    }
+    return p;
+}
+
+void cleanup_modbus_profiles()
+{
+    pthread_mutex_lock(&g_profile_lock);
+    int i = 0;
+    for (i = 0; i < PROFILE_BUCKETS; i++)
+    {
+        while (g_profiles[i] != NULL)
+        {
+            DeviceProfile* p = g_profiles[i];
+            g_profiles[i] = p->next;
+            free(p);
+        }
+    }
+    pthread_mutex_unlock(&g_profile_lock);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_MODBUS_SDK_C_PROBE_H
+#define INF_BCE_IOT_MODBUS_SDK_C_PROBE_H
+
+#include "data.h"
+
+// the capabilities of the slaves, learned by probing them, so that the reads
+// of read_modbus_coalesced are as few as the slaves allow. the policies fix
+// their windows, yet many slaves take less than the protocol maximum in one
+// request, or fail a read spanning a gap of their register map.
+// with probeDevices, every slave and function code polled is probed the first
+// time a policy of it is due whose range isn't known yet: a policy starting
+// outside the spans learned so far gets the longest read succeeding from its
+// start, found by halving. an ILLEGAL_FUNCTION exception marks the function
+// code unsupported. the profiles are kept across the reloads and probed again
+// after PROBE_REFRESH_MS. the probing runs on the worker owning the bus, ahead
+// of the reads, it takes a few requests per span once
+
+enum {
+    MAX_PROBE_SPANS = 32,           // the spans learned of one slave and function code
+    PROBE_REFRESH_MS = 6 * 3600 * 1000,
+    PROBE_MAX_TIMEOUTS = 1          // a tcp bus is reset after LINK_TIMEOUT_LIMIT in a row
+};
+
+// the addresses read at once with success
+typedef struct
+{
+    int start;
+    int count;
+} ProbeSpan;
+
+// the profile of a slave and a function code on a bus
+typedef struct DeviceProfile_t
+{
+    char ip_com_addr[ADDR_LEN];
+    int slaveid;
+    char functioncode;
+    int unsupported;                // the slave answered ILLEGAL_FUNCTION
+    int maxCount;                   // the longest read that succeeded, 0 if none yet
+    ProbeSpan spans[MAX_PROBE_SPANS];
+    int spanNum;
+    long long probedAt;             // monotonic time(ms) of the first probe
+    struct DeviceProfile_t* next;   // in the bucket
+} DeviceProfile;
+
+// enable or disable the probing, it's disabled by default
+void set_modbus_probing(int enabled);
+
+int modbus_probing_enabled();
+
+// the profile of the slave and the function code of the policy, probed first
+// from the start of the policy unless a span covers its range. scratch holds
+// a read, RANGE_BUFF_LEN bytes. must be called by the thread polling the bus.
+// return NULL if the probing is disabled, or the bus failed before any read
+DeviceProfile* probe_modbus_device(SlavePolicy* policy, void* scratch);
+
+// return 1 if [start, start + count) was read at once from the slave
+int profile_covers(DeviceProfile* profile, int start, int count);
+
+// the max bits/registers the planner reads at once from the slave
+int profile_read_limit(DeviceProfile* profile, char functioncode);
+
+// a read planned from the profile failed with an address exception, the slave
+// changed: its spans are learned again
+void forget_modbus_profile(DeviceProfile* profile);
+
+void cleanup_modbus_profiles();
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "snapshot.h"
+#include "common.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum
+{
+    SNAPSHOT_VERSION = 2
+};
+
+#define SNAPSHOT_HEADER_LEN (sizeof(PolicySnapshotKey) + sizeof(long long) + sizeof(int))
+
+int snapshot_key(PolicySnapshotKey* key, FILE* fp, unsigned int ports_hash)
+{
+    char buf[4096];
+    long long len = 0;
+    unsigned int hash = HASH_START;
+    size_t n = 0;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    {
+        hash = hash_bytes(hash, buf, n);
+        len += n;
+    }
+    if (ferror(fp) || len == 0 || fseek(fp, 0L, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+    memset(key, 0, sizeof(PolicySnapshotKey));
+    memcpy(key->magic, "BDPS", 4);
+    key->version = SNAPSHOT_VERSION;
+    key->build = hash_string(__DATE__ " " __TIME__);
+    key->policySize = sizeof(SlavePolicy);
+    key->fieldSize = sizeof(DecodeField);
+    key->sourceLen = len;
+    key->sourceHash = hash;
+    key->portsHash = ports_hash;
+    return 0;
+}
+
+int snapshot_write(const char* path, const PolicySnapshotKey* key, 
+    long long config_version, SlavePolicy** policies, int count)
+{
+    char tmp[MAX_LEN];
+    snprintf(tmp, MAX_LEN, "%s.tmp", path);
+    FILE* fp = fopen(tmp, "wb");
+    if (fp == NULL)
+    {
+        printf("failed to open %s for write\n", tmp);
+        return -1;
+    }
+    int ok = fwrite(key, sizeof(PolicySnapshotKey), 1, fp) == 1
+        && fwrite(&config_version, sizeof(long long), 1, fp) == 1
+        && fwrite(&count, sizeof(int), 1, fp) == 1;
+    int i = 0;
+    for (i = 0; ok && i < count; i++)
+    {
+        SlavePolicy* policy = policies[i];
+        int config_len = policy->config == NULL ? 0 : strlen(policy->config) + 1;
+        Channel channel;
+        memset(&channel, 0, sizeof(Channel));
+        if (policy->pubChannel != NULL)
+        {
+            channel = *policy->pubChannel;
+        }
+        ok = fwrite(policy, sizeof(SlavePolicy), 1, fp) == 1
+            && fwrite(&channel, sizeof(Channel), 1, fp) == 1
+            && fwrite(&config_len, sizeof(int), 1, fp) == 1
+            && (config_len == 0 || fwrite(policy->config, config_len, 1, fp) == 1)
+            && (policy->fieldNum <= 0 
+                || fwrite(policy->fields, sizeof(DecodeField), policy->fieldNum, fp) 
+                    == (size_t)policy->fieldNum);
+    }
+    ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fclose(fp) != 0 || !ok || rename(tmp, path) != 0)
+    {
+        printf("failed to write the policy snapshot %s\n", path);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// walk the records, none of them may reach over the end of the file
+int index_snapshot(PolicySnapshot* snap)
+{
+    long long off = SNAPSHOT_HEADER_LEN;
+    int i = 0;
+    for (i = 0; i < snap->count; i++)
+    {
+        SlavePolicy policy;
+        int config_len = 0;
+        long long head = sizeof(SlavePolicy) + sizeof(Channel) + sizeof(int);
+        if (off + head > snap->size)
+        {
+            return -1;
+        }
+        memcpy(&policy, snap->base + off, sizeof(SlavePolicy));
+        memcpy(&config_len, snap->base + off + head - sizeof(int), sizeof(int));
+        long long len = head + (long long)config_len 
+            + (long long)(policy.fieldNum > 0 ? policy.fieldNum : 0) * sizeof(DecodeField);
+        if (config_len < 0 || policy.fieldNum > policy.length || off + len > snap->size
+            || (config_len > 0 && snap->base[off + head + config_len - 1] != 0))
+        {
+            return -1;
+        }
+        snap->offsets[i] = off;
+        off += len;
+    }
+    return off == snap->size ? 0 : -1;
+}
+
+int snapshot_open(const char* path, const PolicySnapshotKey* key, PolicySnapshot* snap)
+{
+    memset(snap, 0, sizeof(PolicySnapshot));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)SNAPSHOT_HEADER_LEN)
+    {
+        close(fd);
+        return -1;
+    }
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        return -1;
+    }
+    snap->base = (char*) base;
+    snap->size = st.st_size;
+    memcpy(&snap->configVersion, snap->base + sizeof(PolicySnapshotKey), sizeof(long long));
+    memcpy(&snap->count, snap->base + sizeof(PolicySnapshotKey) + sizeof(long long), sizeof(int));
+    if (memcmp(snap->base, key, sizeof(PolicySnapshotKey)) != 0 || snap->count < 0
+        || snap->count > snap->size / (long long)sizeof(SlavePolicy))
+    {
+        snapshot_close(snap);
+        return -1;
+    }
+    snap->offsets = (long long*) malloc((snap->count + 1) * sizeof(long long));
+    if (snap->offsets == NULL || index_snapshot(snap) != 0)
+    {
+        printf("the policy snapshot %s is corrupted\n", path);
+        snapshot_close(snap);
+        return -1;
+    }
+    return 0;
+}
+
+int snapshot_policy(PolicySnapshot* snap, int i, SlavePolicy* dest, Channel* channel)
+{
+    // the records are not aligned, they are only accessed by memcpy
+    char* p = snap->base + snap->offsets[i];
+    SlavePolicy policy;
+    int config_len = 0;
+    memcpy(&policy, p, sizeof(SlavePolicy));
+    p += sizeof(SlavePolicy);
+    memcpy(channel, p, sizeof(Channel));
+    p += sizeof(Channel);
+    memcpy(&config_len, p, sizeof(int));
+    p += sizeof(int);
+    char* config = NULL;
+    DecodeField* fields = NULL;
+    if (config_len > 0)
+    {
+        config = (char*) malloc(config_len);
+        if (config == NULL)
+        {
+            return -1;
+        }
+        memcpy(config, p, config_len);
+        p += config_len;
+    }
+    if (policy.fieldNum > 0)
+    {
+        fields = (DecodeField*) malloc(policy.fieldNum * sizeof(DecodeField));
+        if (fields == NULL)
+        {
+            free(config);
+            return -1;
+        }
+        memcpy(fields, p, policy.fieldNum * sizeof(DecodeField));
+    }
+    policy.payload = dest->payload;
+    policy.traceId = 0;
+    policy.message = dest->message;
+    policy.lastPayload = dest->lastPayload;
+    policy.prevPayload = dest->prevPayload;
+    policy.deltaImage = dest->deltaImage;
+    policy.deltaSeq = 0;
+    policy.history = dest->history;
+    policy.aggregates = dest->aggregates;
+    policy.envelope.text = NULL;
+    policy.envelope.len = 0;
+    policy.next = dest->next;
+    policy.pubChannel = dest->pubChannel;
+    policy.config = config;
+    policy.fields = fields;
+    *dest = policy;
+    return 0;
+}
+
+void snapshot_close(PolicySnapshot* snap)
+{
+    if (snap->base != NULL)
+    {
+        munmap(snap->base, snap->size);
+    }
+    free(snap->offsets);
+    memset(snap, 0, sizeof(PolicySnapshot));
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_MODBUS_SDK_C_SNAPSHOT_H
+#define INF_BCE_IOT_MODBUS_SDK_C_SNAPSHOT_H
+
+#include "data.h"
+#include <stdio.h>
+
+// the policies compiled from the json policy cache, written after the cache
+// is parsed and mapped on the next start, so that the gateway polls without
+// parsing the json again. the records are the SlavePolicy structs as they
+// are in memory, followed by the config and the decode fields, hence a
+// snapshot is only valid for the same build and the same source:
+//   header: PolicySnapshotKey, long long configVersion, int count
+//   record: SlavePolicy, Channel, int configLen, config(configLen bytes,
+//           with the nul, 0 if no config), DecodeField[fieldNum]
+// the pointers in the records are meaningless and replaced on load
+
+// what the snapshot is compiled from, a snapshot with a different key is stale
+typedef struct
+{
+    char magic[4];                  // "BDPS"
+    int version;
+    unsigned int build;             // hash of the build time, the layout of the records
+    int policySize;                 // sizeof(SlavePolicy)
+    int fieldSize;                  // sizeof(DecodeField)
+    long long sourceLen;            // length of the json policy cache
+    unsigned int sourceHash;        // hash of the json policy cache
+    unsigned int portsHash;         // hash of the serial ports in the gateway config
+} PolicySnapshotKey;
+
+// a snapshot mapped into memory
+typedef struct
+{
+    char* base;
+    long long size;
+    long long configVersion;        // the version of the config compiled
+    int count;
+    long long* offsets;             // of every record
+} PolicySnapshot;
+
+// fill the key of the source, the json policy cache read from fp, and the
+// ports hash. the cache is hashed through a small buffer, then fp is rewound
+// for the parsing. return 0 on success, -1 if it can't be read or is empty
+int snapshot_key(PolicySnapshotKey* key, FILE* fp, unsigned int ports_hash);
+
+// write the snapshot to a temp file then rename it to path, so a crash never
+// leaves a partial snapshot. return 0 on success
+int snapshot_write(const char* path, const PolicySnapshotKey* key, 
+    long long config_version, SlavePolicy** policies, int count);
+
+// map the snapshot and check it against the key, return 0 if it's valid
+int snapshot_open(const char* path, const PolicySnapshotKey* key, PolicySnapshot* snap);
+
+// copy the i-th record into dest, with the config and the fields allocated,
+// and its channel into channel, to be interned by the caller. the rest of the
+// pointers are left as they were in dest. return 0 on success
+int snapshot_policy(PolicySnapshot* snap, int i, SlavePolicy* dest, Channel* channel);
+
+void snapshot_close(PolicySnapshot* snap);
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "template.h"
+#include "decode.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static PolicyTemplate* g_templates = NULL;
+
+static PolicyTemplate* find_template(PolicyTemplate* list, const char* name)
+{
+    for (; list != NULL; list = list->next)
+    {
+        if (strcmp(list->name, name) == 0)
+        {
+            return list;
+        }
+    }
+    return NULL;
+}
+
+void release_policy_template(PolicyTemplate* tmpl)
+{
+    if (tmpl == NULL || --tmpl->refs > 0)
+    {
+        return;
+    }
+    free(tmpl->config);
+    cJSON_Delete(tmpl->root);
+    free(tmpl->fields);
+    free(tmpl);
+}
+
+static PolicyTemplate* new_template(cJSON* item)
+{
+    PolicyTemplate* tmpl = (PolicyTemplate*) calloc(1, sizeof(PolicyTemplate));
+    if (tmpl == NULL)
+    {
+        return NULL;
+    }
+    mystrncpy(tmpl->name, item->string, FIELD_NAME_LEN);
+    tmpl->config = cJSON_PrintUnformatted(item);
+    tmpl->root = cJSON_Duplicate(item, 1);
+    tmpl->refs = 1;
+    if (tmpl->config == NULL || tmpl->root == NULL)
+    {
+        release_policy_template(tmpl);
+        return NULL;
+    }
+    tmpl->length = cJSON_HasObjectItem(item, "length") ? json_int(item, "length") : 0;
+    if (tmpl->length < 0)
+    {
+        tmpl->length = 0;
+    }
+    if (cJSON_HasObjectItem(item, "fields"))
+    {
+        tmpl->fieldNum = parse_decode_fields(cJSON_GetObjectItem(item, "fields"), 
+            tmpl->length, &tmpl->fields);
+    }
+    return tmpl;
+}
+
+// the template of the item, the loaded one if it's unchanged. NULL if it's
+// invalid or out of memory
+static PolicyTemplate* template_of(cJSON* item)
+{
+    if (!cJSON_IsObject(item) || item->string == NULL || item->string[0] == 0
+        || cJSON_HasObjectItem(item, "template"))
+    {
+        printf("invalid policy template %s\n", item->string != NULL ? item->string : "");
+        return NULL;
+    }
+    PolicyTemplate* loaded = find_template(g_templates, item->string);
+    char* config = cJSON_PrintUnformatted(item);
+    int same = loaded != NULL && config != NULL && strcmp(loaded->config, config) == 0;
+    free(config);
+    if (same)
+    {
+        loaded->refs++;
+        return loaded;
+    }
+    PolicyTemplate* tmpl = new_template(item);
+    if (tmpl == NULL)
+    {
+        printf("out of memory while loading the policy template %s\n", item->string);
+    }
+    return tmpl;
+}
+
+int load_policy_templates(cJSON* templates)
+{
+    PolicyTemplate* list = NULL;
+    int num = 0;
+    cJSON* items = cJSON_IsObject(templates) ? templates : NULL;
+    cJSON* item = NULL;
+    cJSON_ArrayForEach(item, items)
+    {
+        PolicyTemplate* tmpl = template_of(item);
+        if (tmpl != NULL)
+        {
+            tmpl->next = list;
+            list = tmpl;
+            num++;
+        }
+    }
+    // the instances loaded keep the templates replaced until they're destroyed
+    cleanup_policy_templates();
+    g_templates = list;
+    return num;
+}
+
+int add_policy_templates(cJSON* templates)
+{
+    cJSON* items = cJSON_IsObject(templates) ? templates : NULL;
+    cJSON* item = NULL;
+    cJSON_ArrayForEach(item, items)
+    {
+        PolicyTemplate* loaded = item->string != NULL ? find_template(g_templates, item->string) : NULL;
+        char* config = loaded != NULL ? cJSON_PrintUnformatted(item) : NULL;
+        int changed = loaded != NULL && (config == NULL || strcmp(loaded->config, config) != 0);
+        free(config);
+        if (changed)
+        {
+            printf("policy template %s is changed by a delta, a full config is needed\n", item->string);
+            return -1;
+        }
+    }
+    cJSON_ArrayForEach(item, items)
+    {
+        if (find_template(g_templates, item->string) != NULL)
+        {
+            continue;
+        }
+        PolicyTemplate* tmpl = template_of(item);
+        if (tmpl != NULL)
+        {
+            tmpl->next = g_templates;
+            g_templates = tmpl;
+        }
+    }
+    return 0;
+}
+
+PolicyTemplate* take_policy_template(const char* name)
+{
+    PolicyTemplate* tmpl = find_template(g_templates, name);
+    if (tmpl != NULL)
+    {
+        tmpl->refs++;
+    }
+    return tmpl;
+}
+
+cJSON* expand_policy_template(cJSON* instance, PolicyTemplate* tmpl)
+{
+    cJSON* expanded = cJSON_Duplicate(instance, 1);
+    cJSON* items = expanded != NULL ? tmpl->root : NULL;
+    cJSON* item = NULL;
+    cJSON_ArrayForEach(item, items)
+    {
+        if (strcmp(item->string, "fields") == 0)
+        {
+            continue;
+        }
+        cJSON* own = cJSON_GetObjectItem(expanded, item->string);
+        if (own == NULL)
+        {
+            cJSON_AddItemToObject(expanded, item->string, cJSON_Duplicate(item, 1));
+            continue;
+        }
+        // one level down, e.g. the endpoint of the pubChannel of the instance
+        cJSON* subs = cJSON_IsObject(own) && cJSON_IsObject(item) ? item : NULL;
+        cJSON* sub = NULL;
+        cJSON_ArrayForEach(sub, subs)
+        {
+            if (!cJSON_HasObjectItem(own, sub->string))
+            {
+                cJSON_AddItemToObject(own, sub->string, cJSON_Duplicate(sub, 1));
+            }
+        }
+    }
+    return expanded;
+}
+
+int policy_template_num()
+{
+    int num = 0;
+    PolicyTemplate* tmpl = g_templates;
+    for (; tmpl != NULL; tmpl = tmpl->next)
+    {
+        num++;
+    }
+    return num;
+}
+
+char* policy_templates_json()
+{
+    cJSON* root = g_templates != NULL ? cJSON_CreateObject() : NULL;
+    PolicyTemplate* tmpl = NULL;
+    for (tmpl = g_templates; root != NULL && tmpl != NULL; tmpl = tmpl->next)
+    {
+        cJSON_AddItemToObject(root, tmpl->name, cJSON_Duplicate(tmpl->root, 1));
+    }
+    char* text = root != NULL ? cJSON_PrintUnformatted(root) : NULL;
+    cJSON_Delete(root);
+    return text;
+}
+
+void cleanup_policy_templates()
+{
+    while (g_templates != NULL)
+    {
+        PolicyTemplate* tmpl = g_templates;
+        g_templates = tmpl->next;
+        release_policy_template(tmpl);
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_MODBUS_SDK_C_TEMPLATE_H
+#define INF_BCE_IOT_MODBUS_SDK_C_TEMPLATE_H
+
+#include "data.h"
+
+#include <cjson/cJSON.h>
+
+// the templates of the policies, so that a fleet of identical devices carries
+// its register plan once. a full config may have them by name,
+//     {"version": n, "templates": {"meter": {"functioncode": 3, "start_addr": 0,
+//         "length": 20, "interval": 5, "fields": [...], "pubChannel": {...}}},
+//      "policies": [{"template": "meter", "slaveid": 7, "ip_com_addr": "10.0.0.7:502",
+//         "trantable": "m7"}, ...]}
+// an instance takes every item of its template it doesn't have itself, the
+// items of an object such as pubChannel are taken the same way, so that an
+// instance may only change its endpoint. the fields of a template are
+// compiled once and shared by the instances of its length, the config kept
+// by an instance is its own json only.
+// a full config replaces the templates, a template unchanged keeps its
+// instances as they are. a delta may add templates, changing one takes a full
+// config, as its instances loaded would have to be built again. the templates
+// are only used by the thread loading the configs
+
+typedef struct PolicyTemplate_t
+{
+    char name[FIELD_NAME_LEN];
+    char* config;                   // the template as loaded, to tell if it's changed
+    cJSON* root;
+    int length;
+    DecodeField* fields;            // compiled for length registers, shared by the instances
+    int fieldNum;
+    int refs;                       // the instances and the list of the templates
+    struct PolicyTemplate_t* next;
+} PolicyTemplate;
+
+// replace the templates with the ones of a full config, NULL for none.
+// return the number of templates
+int load_policy_templates(cJSON* templates);
+
+// add the templates of a delta, return -1 if one of them changes a template
+// loaded, in which case none is added
+int add_policy_templates(cJSON* templates);
+
+// the template of the name, NULL if not found. the caller takes a reference
+PolicyTemplate* take_policy_template(const char* name);
+
+void release_policy_template(PolicyTemplate* tmpl);
+
+// the instance with the items of its template, to be deleted by the caller.
+// the fields of the template are left out, see PolicyTemplate
+cJSON* expand_policy_template(cJSON* instance, PolicyTemplate* tmpl);
+
+int policy_template_num();
+
+// the templates as the json object of a full config, NULL if there are none.
+// to be freed by the caller
+char* policy_templates_json();
+
+void cleanup_policy_templates();
+
+#endif
@@ -0,0 +1,713 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "transport.h"
+#include "common.h"
+#include "hex.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+#include <linux/serial.h>
+#include <modbus/modbus.h>
+
+enum
+{
+    ASCII_MAX_PDU = 253,            // as rtu, without the slave and the crc
+    RTU_MAX_ADU = ASCII_MAX_PDU + 3,    // the slave, the pdu and the crc
+    TCP_MBAP_LEN = 7,               // the transaction, the protocol, the length and the unit
+    ASCII_MAX_FRAME = 2 * (ASCII_MAX_PDU + 2) + 3,  // ':', the hex of slave + pdu + lrc, "\r\n"
+    ASCII_DEFAULT_TIMEOUT_US = 500000,
+    ASCII_DEFAULT_BYTE_TIMEOUT_US = 1000000,    // the inter char timeout of the spec
+};
+
+// the longitudinal redundancy check, the two's complement of the sum of the bytes
+static uint8_t ascii_lrc(const uint8_t* data, int len)
+{
+    uint8_t sum = 0;
+    int i = 0;
+    for (i = 0; i < len; i++)
+    {
+        sum += data[i];
+    }
+    return (uint8_t)(-sum);
+}
+
+static int write_all(int fd, const char* buf, int len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// wait up to timeout_us for fd to be readable, return 1 if readable, 0 on
+// timeout, -1 on error
+static int wait_readable(int fd, long long timeout_us)
+{
+    fd_set rset;
+    struct timeval tv;
+    int rc = 0;
+    do
+    {
+        FD_ZERO(&rset);
+        FD_SET(fd, &rset);
+        tv.tv_sec = timeout_us / 1000000;
+        tv.tv_usec = timeout_us % 1000000;
+        rc = select(fd + 1, &rset, NULL, NULL, &tv);
+    } while (rc < 0 && errno == EINTR);
+    return rc;
+}
+
+// receive one frame into frame, from the ':' to the '\n' excluded.
+// the chars before the ':' are dropped, they are noise or the tail of a late response.
+// return the number of chars after the ':', -1 on error or timeout
+static int receive_ascii_frame(AsciiLink* link, char* frame)
+{
+    long long timeout = link->timeoutUs > 0 ? link->timeoutUs : ASCII_DEFAULT_TIMEOUT_US;
+    long long byte_timeout = link->byteTimeoutUs > 0 ? link->byteTimeoutUs 
+        : ASCII_DEFAULT_BYTE_TIMEOUT_US;
+    long long deadline = monotonic_us() + timeout;
+    int started = 0;
+    int len = 0;
+    char buf[ASCII_MAX_FRAME];
+    while (1)
+    {
+        long long wait = byte_timeout;
+        if (!started)
+        {
+            wait = deadline - monotonic_us();
+            if (wait < 0)
+            {
+                wait = 0;
+            }
+        }
+        int rc = wait_readable(link->fd, wait);
+        if (rc <= 0)
+        {
+            errno = rc == 0 ? ETIMEDOUT : errno;
+            return -1;
+        }
+        ssize_t n = read(link->fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            errno = n == 0 ? ECONNRESET : errno;
+            return -1;
+        }
+        int i = 0;
+        for (i = 0; i < n; i++)
+        {
+            if (buf[i] == ':')
+            {
+                // a new frame starts over
+                started = 1;
+                len = 0;
+            }
+            else if (!started)
+            {
+                continue;
+            }
+            else if (buf[i] == '\n')
+            {
+                return len;
+            }
+            else if (len < ASCII_MAX_FRAME)
+            {
+                frame[len++] = buf[i];
+            }
+            else
+            {
+                errno = EMBBADDATA;
+                return -1;
+            }
+        }
+    }
+}
+
+// send the request pdu to the slave and receive the response pdu into rsp,
+// which must hold ASCII_MAX_PDU bytes. return the length of the response pdu,
+// -1 on error, an exception response sets errno to the exception
+int ascii_send(AsciiLink* link, const uint8_t* req, int req_len)
+{
+    uint8_t adu[ASCII_MAX_PDU + 2];
+    char frame[ASCII_MAX_FRAME + 1];
+    if (req_len > ASCII_MAX_PDU)
+    {
+        errno = EMBMDATA;
+        return -1;
+    }
+    adu[0] = (uint8_t)link->slaveid;
+    memcpy(adu + 1, req, req_len);
+    adu[req_len + 1] = ascii_lrc(adu, req_len + 1);
+    frame[0] = ':';
+    hex_encode(frame + 1, adu, req_len + 2);
+    int len = 1 + 2 * (req_len + 2);
+    frame[len++] = '\r';
+    frame[len++] = '\n';
+
+    // drop whatever is left of a late response before asking again
+    tcflush(link->fd, TCIOFLUSH);
+    return write_all(link->fd, frame, len);
+}
+
+int ascii_raw(AsciiLink* link, const uint8_t* req, int req_len, uint8_t* rsp)
+{
+    uint8_t adu[ASCII_MAX_PDU + 2];
+    char frame[ASCII_MAX_FRAME + 1];
+    if (ascii_send(link, req, req_len) != 0)
+    {
+        return -1;
+    }
+
+    int len = receive_ascii_frame(link, frame);
+    if (len < 0)
+    {
+        return -1;
+    }
+    if (len > 0 && frame[len - 1] == '\r')
+    {
+        len--;
+    }
+    int n = hex_decode(adu, sizeof(adu), frame, len);
+    if (n < 3 || (len & 1) != 0)
+    {
+        errno = EMBBADDATA;
+        return -1;
+    }
+    if (ascii_lrc(adu, n - 1) != adu[n - 1])
+    {
+        errno = EMBBADCRC;
+        return -1;
+    }
+    if (adu[0] != (uint8_t)link->slaveid)
+    {
+        errno = EMBBADSLAVE;
+        return -1;
+    }
+    memcpy(rsp, adu + 1, n - 2);
+    return n - 2;
+}
+
+static int ascii_transact(AsciiLink* link, const uint8_t* req, int req_len, uint8_t* rsp)
+{
+    int len = ascii_raw(link, req, req_len, rsp);
+    if (len < 0)
+    {
+        return -1;
+    }
+    if (len >= 2 && rsp[0] == (req[0] | 0x80))
+    {
+        errno = MODBUS_ENOBASE + rsp[1];
+        return -1;
+    }
+    if (len < 1 || rsp[0] != req[0])
+    {
+        errno = EMBBADDATA;
+        return -1;
+    }
+    return len;
+}
+
+static void put_u16(uint8_t* p, int value)
+{
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+int write_bits_pdu(uint8_t* req, int addr, int nb, const uint8_t* src)
+{
+    if (nb < 1 || nb > MODBUS_MAX_WRITE_BITS)
+    {
+        errno = EMBMDATA;
+        return -1;
+    }
+    int bytes = (nb + 7) / 8;
+    req[0] = MODBUS_FC_WRITE_MULTIPLE_COILS;
+    put_u16(req + 1, addr);
+    put_u16(req + 3, nb);
+    req[5] = (uint8_t)bytes;
+    memset(req + 6, 0, bytes);
+    int i = 0;
+    for (i = 0; i < nb; i++)
+    {
+        if (src[i])
+        {
+            req[6 + i / 8] |= (uint8_t)(1 << (i % 8));
+        }
+    }
+    return 6 + bytes;
+}
+
+int write_registers_pdu(uint8_t* req, int addr, int nb, const uint16_t* src)
+{
+    if (nb < 1 || nb > MODBUS_MAX_WRITE_REGISTERS)
+    {
+        errno = EMBMDATA;
+        return -1;
+    }
+    req[0] = MODBUS_FC_WRITE_MULTIPLE_REGISTERS;
+    put_u16(req + 1, addr);
+    put_u16(req + 3, nb);
+    req[5] = (uint8_t)(2 * nb);
+    int i = 0;
+    for (i = 0; i < nb; i++)
+    {
+        put_u16(req + 6 + 2 * i, src[i]);
+    }
+    return 6 + 2 * nb;
+}
+
+// unpack the registers of a read response, whose byte count must match
+static int unpack_registers(const uint8_t* rsp, int len, int nb, uint16_t* dest)
+{
+    if (len != 2 + 2 * nb || rsp[1] != 2 * nb)
+    {
+        errno = EMBBADDATA;
+        return -1;
+    }
+    int i = 0;
+    for (i = 0; i < nb; i++)
+    {
+        dest[i] = (uint16_t)((rsp[2 + 2 * i] << 8) | rsp[3 + 2 * i]);
+    }
+    return nb;
+}
+
+int ascii_read(AsciiLink* link, int functioncode, int addr, int nb, void* dest)
+{
+    uint8_t req[5];
+    uint8_t rsp[ASCII_MAX_PDU];
+    int bits = functioncode == MODBUS_FC_READ_COILS 
+        || functioncode == MODBUS_FC_READ_DISCRETE_INPUTS;
+    if (nb < 1 || nb > (bits ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS))
+    {
+        errno = EMBMDATA;
+        return -1;
+    }
+    req[0] = (uint8_t)functioncode;
+    put_u16(req + 1, addr);
+    put_u16(req + 3, nb);
+    int len = ascii_transact(link, req, sizeof(req), rsp);
+    if (len < 0)
+    {
+        return -1;
+    }
+    if (!bits)
+    {
+        return unpack_registers(rsp, len, nb, (uint16_t*)dest);
+    }
+    int bytes = (nb + 7) / 8;
+    if (len != 2 + bytes || rsp[1] != bytes)
+    {
+        errno = EMBBADDATA;
+        return -1;
+    }
+    // one byte per bit, the lowest bit first
+    uint8_t* out = (uint8_t*)dest;
+    int i = 0;
+    for (i = 0; i < nb; i++)
+    {
+        out[i] = (rsp[2 + i / 8] >> (i % 8)) & 1;
+    }
+    return nb;
+}
+
+// check the echo of the address and the quantity of a write response
+static int check_write_response(const uint8_t* rsp, int len, int addr, int nb)
+{
+    if (len != 5 || ((rsp[1] << 8) | rsp[2]) != addr || ((rsp[3] << 8) | rsp[4]) != nb)
+    {
+        errno = EMBBADDATA;
+        return -1;
+    }
+    return nb;
+}
+
+int ascii_write_bits(AsciiLink* link, int addr, int nb, const uint8_t* src)
+{
+    uint8_t req[ASCII_MAX_PDU];
+    uint8_t rsp[ASCII_MAX_PDU];
+    int req_len = write_bits_pdu(req, addr, nb, src);
+    if (req_len < 0)
+    {
+        return -1;
+    }
+    int len = ascii_transact(link, req, req_len, rsp);
+    return len < 0 ? -1 : check_write_response(rsp, len, addr, nb);
+}
+
+int ascii_write_registers(AsciiLink* link, int addr, int nb, const uint16_t* src)
+{
+    uint8_t req[ASCII_MAX_PDU];
+    uint8_t rsp[ASCII_MAX_PDU];
+    int req_len = write_registers_pdu(req, addr, nb, src);
+    if (req_len < 0)
+    {
+        return -1;
+    }
+    int len = ascii_transact(link, req, req_len, rsp);
+    return len < 0 ? -1 : check_write_response(rsp, len, addr, nb);
+}
+
+int ascii_write_and_read_registers(AsciiLink* link, int waddr, int wnb, 
+    const uint16_t* src, int raddr, int rnb, uint16_t* dest)
+{
+    uint8_t req[ASCII_MAX_PDU];
+    uint8_t rsp[ASCII_MAX_PDU];
+    if (wnb < 1 || wnb > MODBUS_MAX_WR_WRITE_REGISTERS 
+        || rnb < 1 || rnb > MODBUS_MAX_WR_READ_REGISTERS)
+    {
+        errno = EMBMDATA;
+        return -1;
+    }
+    req[0] = MODBUS_FC_WRITE_AND_READ_REGISTERS;
+    put_u16(req + 1, raddr);
+    put_u16(req + 3, rnb);
+    put_u16(req + 5, waddr);
+    put_u16(req + 7, wnb);
+    req[9] = (uint8_t)(2 * wnb);
+    int i = 0;
+    for (i = 0; i < wnb; i++)
+    {
+        put_u16(req + 10 + 2 * i, src[i]);
+    }
+    int len = ascii_transact(link, req, 10 + 2 * wnb, rsp);
+    return len < 0 ? -1 : unpack_registers(rsp, len, rnb, dest);
+}
+
+// the crc of the rtu frames, polynomial 0xa001 reflected, low byte first on the wire
+static uint16_t rtu_crc(const uint8_t* data, int len)
+{
+    uint16_t crc = 0xFFFF;
+    int i = 0;
+    int bit = 0;
+    for (i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+// the length of the response frame of the function codes whose length is
+// known from the frame itself, 0 if it's told by the silence after it
+static int rtu_frame_len(const uint8_t* adu, int len)
+{
+    if (len < 2)
+    {
+        return 0;
+    }
+    if (adu[1] & 0x80)
+    {
+        return 5;
+    }
+    switch (adu[1])
+    {
+        case 0x01: case 0x02: case 0x03: case 0x04:
+        case 0x0C: case 0x11: case 0x14: case 0x15: case 0x17:
+            return len >= 3 ? 5 + adu[2] : 0;
+        case 0x05: case 0x06: case 0x08: case 0x0F: case 0x10:
+            return 8;
+        case 0x16:
+            return 10;
+        default:
+            return 0;
+    }
+}
+
+int rtu_raw_receive(int fd, int slaveid, uint8_t* rsp, long long timeout_us, long long gap_us)
+{
+    uint8_t adu[RTU_MAX_ADU];
+    long long deadline = monotonic_us() + timeout_us;
+    int len = 0;
+    while (1)
+    {
+        long long wait = gap_us;
+        if (len == 0)
+        {
+            wait = deadline - monotonic_us();
+            if (wait < 0)
+            {
+                wait = 0;
+            }
+        }
+        int rc = wait_readable(fd, wait);
+        if (rc < 0)
+        {
+            return -1;
+        }
+        if (rc == 0)
+        {
+            if (len == 0)
+            {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            break;
+        }
+        ssize_t n = read(fd, adu + len, sizeof(adu) - len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            errno = n == 0 ? ECONNRESET : errno;
+            return -1;
+        }
+        len += n;
+        int expected = rtu_frame_len(adu, len);
+        if ((expected > 0 && len >= expected) || len == (int) sizeof(adu))
+        {
+            if (expected > 0 && expected <= len)
+            {
+                len = expected;
+            }
+            break;
+        }
+    }
+    if (len < 4)
+    {
+        errno = EMBBADDATA;
+        return -1;
+    }
+    uint16_t crc = rtu_crc(adu, len - 2);
+    if (adu[len - 2] != (crc & 0xFF) || adu[len - 1] != (crc >> 8))
+    {
+        errno = EMBBADCRC;
+        return -1;
+    }
+    if (adu[0] != (uint8_t)slaveid)
+    {
+        errno = EMBBADSLAVE;
+        return -1;
+    }
+    memcpy(rsp, adu + 1, len - 3);
+    return len - 3;
+}
+
+// read exactly len bytes by the deadline
+static int read_full(int fd, uint8_t* buf, int len, long long deadline)
+{
+    int got = 0;
+    while (got < len)
+    {
+        long long wait = deadline - monotonic_us();
+        int rc = wait_readable(fd, wait > 0 ? wait : 0);
+        if (rc <= 0)
+        {
+            errno = rc == 0 ? ETIMEDOUT : errno;
+            return -1;
+        }
+        ssize_t n = recv(fd, buf + got, len - got, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            errno = n == 0 ? ECONNRESET : errno;
+            return -1;
+        }
+        got += n;
+    }
+    return 0;
+}
+
+int tcp_raw_transact(int fd, uint16_t tid, int slaveid, const uint8_t* req, int req_len,
+    uint8_t* rsp, long long timeout_us)
+{
+    uint8_t adu[TCP_MBAP_LEN + ASCII_MAX_PDU];
+    if (req_len < 1 || req_len > ASCII_MAX_PDU)
+    {
+        errno = EMBMDATA;
+        return -1;
+    }
+    adu[0] = tid >> 8;
+    adu[1] = tid & 0xFF;
+    adu[2] = 0;
+    adu[3] = 0;
+    adu[4] = (req_len + 1) >> 8;
+    adu[5] = (req_len + 1) & 0xFF;
+    adu[6] = (uint8_t)slaveid;
+    memcpy(adu + TCP_MBAP_LEN, req, req_len);
+    if (send(fd, adu, TCP_MBAP_LEN + req_len, MSG_NOSIGNAL) != TCP_MBAP_LEN + req_len)
+    {
+        return -1;
+    }
+    long long deadline = monotonic_us() + timeout_us;
+    while (1)
+    {
+        if (read_full(fd, adu, TCP_MBAP_LEN, deadline) != 0)
+        {
+            return -1;
+        }
+        int len = ((adu[4] << 8) | adu[5]) - 1;
+        if (adu[2] != 0 || adu[3] != 0 || len < 1 || len > ASCII_MAX_PDU)
+        {
+            // the stream is out of sync
+            errno = EMBBADDATA;
+            return -1;
+        }
+        uint16_t got = (adu[0] << 8) | adu[1];
+        if (read_full(fd, rsp, len, deadline) != 0)
+        {
+            return -1;
+        }
+        // a late response of a request timed out before, read past it
+        if (got == tid)
+        {
+            return len;
+        }
+    }
+}
+
+int connect_tcp_socket(const char* host, int port, int timeout_ms)
+{
+    int s = start_tcp_connect(host, port);
+    if (s < 0)
+    {
+        return -1;
+    }
+    struct pollfd pfd;
+    pfd.fd = s;
+    pfd.events = POLLOUT;
+    return finish_tcp_connect(s, poll(&pfd, 1, timeout_ms) != 1) == 0 ? s : -1;
+}
+
+int start_tcp_connect(const char* host, int port)
+{
+    struct addrinfo hints;
+    struct addrinfo* res = NULL;
+    char service[16];
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0)
+    {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    // the next address is only tried if the connect fails right away
+    int s = -1;
+    struct addrinfo* ai = NULL;
+    for (ai = res; ai != NULL && s < 0; ai = ai->ai_next)
+    {
+        s = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, ai->ai_protocol);
+        if (s < 0)
+        {
+            continue;
+        }
+        if (connect(s, ai->ai_addr, ai->ai_addrlen) != 0 && errno != EINPROGRESS)
+        {
+            close(s);
+            s = -1;
+        }
+    }
+    int err = errno;
+    freeaddrinfo(res);
+    errno = err;
+    return s;
+}
+
+int finish_tcp_connect(int s, int timedout)
+{
+    int err = 0;
+    socklen_t errlen = sizeof(err);
+    if (timedout)
+    {
+        err = ETIMEDOUT;
+    }
+    else if (getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &errlen) != 0)
+    {
+        err = errno;
+    }
+    if (err != 0)
+    {
+        close(s);
+        errno = err;
+        return -1;
+    }
+    int flags = fcntl(s, F_GETFL, 0);
+    fcntl(s, F_SETFL, flags & ~O_NONBLOCK);
+    // the requests are small and waited for, don't delay them
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return 0;
+}
+
+int serial_set_rs485(int fd, int rtsOnSend, int delayBeforeMs, int delayAfterMs)
+{
+    struct serial_rs485 rs485;
+    memset(&rs485, 0, sizeof(rs485));
+    if (ioctl(fd, TIOCGRS485, &rs485) < 0)
+    {
+        return -1;
+    }
+    rs485.flags |= SER_RS485_ENABLED;
+    // the level after the frame is the other one, the transceiver receives then
+    rs485.flags &= ~(SER_RS485_RTS_ON_SEND | SER_RS485_RTS_AFTER_SEND | SER_RS485_RX_DURING_TX);
+    rs485.flags |= rtsOnSend ? SER_RS485_RTS_ON_SEND : SER_RS485_RTS_AFTER_SEND;
+    rs485.delay_rts_before_send = delayBeforeMs > 0 ? delayBeforeMs : 0;
+    rs485.delay_rts_after_send = delayAfterMs > 0 ? delayAfterMs : 0;
+    return ioctl(fd, TIOCSRS485, &rs485) < 0 ? -1 : 0;
+}
+
+int serial_set_low_latency(int fd, int on)
+{
+    struct serial_struct serial;
+    if (ioctl(fd, TIOCGSERIAL, &serial) < 0)
+    {
+        return -1;
+    }
+    if (((serial.flags & ASYNC_LOW_LATENCY) != 0) == (on != 0))
+    {
+        return 0;
+    }
+    serial.flags = on ? (serial.flags | ASYNC_LOW_LATENCY) : (serial.flags & ~ASYNC_LOW_LATENCY);
+    return ioctl(fd, TIOCSSERIAL, &serial) < 0 ? -1 : 0;
+}
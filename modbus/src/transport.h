@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2016 Baidu, Inc. All Rights Reserved.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INF_BCE_IOT_MODBUS_SDK_C_TRANSPORT_H
+#define INF_BCE_IOT_MODBUS_SDK_C_TRANSPORT_H
+
+#include <stdint.h>
+
+// the transports libmodbus doesn't have, used by modbuslib behind the same
+// connection pool:
+//   modbus ascii, on a serial port opened and configured by libmodbus(rtu),
+//   the frames are ':', the hex of slave + pdu + lrc, then "\r\n"
+//   modbus rtu over tcp, the rtu frames(with crc) on a tcp connection to a
+//   serial device server, a libmodbus rtu context on the connected socket
+// the functions return -1 on error with errno set like libmodbus, so that
+// modbus_strerror() works on it
+
+// a modbus ascii bus and the slave of the request
+typedef struct
+{
+    int fd;                         // the serial port
+    int slaveid;
+    long long timeoutUs;            // for the first char of the response
+    long long byteTimeoutUs;        // between the chars of the response
+} AsciiLink;
+
+// read nb bits/registers from addr, with one of the read function codes.
+// the bits are stored as one byte per bit, the registers as uint16_t.
+// return nb on success
+int ascii_read(AsciiLink* link, int functioncode, int addr, int nb, void* dest);
+
+// write nb coils(0x0f), return nb on success
+int ascii_write_bits(AsciiLink* link, int addr, int nb, const uint8_t* src);
+
+// write nb registers(0x10), return nb on success
+int ascii_write_registers(AsciiLink* link, int addr, int nb, const uint16_t* src);
+
+// write and read the registers in one request(0x17), return rnb on success
+int ascii_write_and_read_registers(AsciiLink* link, int waddr, int wnb, 
+    const uint16_t* src, int raddr, int rnb, uint16_t* dest);
+
+// send the pdu to the slave without waiting for the response, for the
+// broadcasts(slave 0) which are never answered. return 0 on success
+int ascii_send(AsciiLink* link, const uint8_t* req, int req_len);
+
+// send the request pdu to the slave and receive its response pdu into rsp,
+// whatever the function code, for the pass-through of the raw requests. an
+// exception response is a response as well. rsp must hold 253 bytes.
+// return the length of the response pdu, -1 on error
+int ascii_raw(AsciiLink* link, const uint8_t* req, int req_len, uint8_t* rsp);
+
+// receive the rtu response of the slave to a raw request, which libmodbus
+// only frames for the function codes it knows. the frame ends with the
+// length its function code tells, or with a silence of gap_us if it tells none.
+// the pdu, without the slave and the crc, is stored into rsp(253 bytes).
+// return its length, -1 on error
+int rtu_raw_receive(int fd, int slaveid, uint8_t* rsp, long long timeout_us, long long gap_us);
+
+// send the raw request pdu on the modbus tcp connection with the transaction
+// id tid, and receive its response pdu into rsp(253 bytes), framed by the
+// length in the header. return its length, -1 on error
+int tcp_raw_transact(int fd, uint16_t tid, int slaveid, const uint8_t* req, int req_len,
+    uint8_t* rsp, long long timeout_us);
+
+// build the pdu writing nb coils(0x0f) or registers(0x10) from addr into req,
+// which must hold MODBUS_MAX_PDU_LENGTH bytes. return the length of the pdu
+int write_bits_pdu(uint8_t* req, int addr, int nb, const uint8_t* src);
+
+int write_registers_pdu(uint8_t* req, int addr, int nb, const uint16_t* src);
+
+// connect to host:port within timeout_ms, return the socket, -1 on failure
+int connect_tcp_socket(const char* host, int port, int timeout_ms);
+
+// start connecting to host:port without blocking, so that many connects go on
+// at once. return the socket, its connect in progress or done, -1 on failure.
+// the socket is writable once the connect is over, see finish_tcp_connect
+int start_tcp_connect(const char* host, int port);
+
+// the connect of the socket of start_tcp_connect is over, or timed out.
+// return 0 if it's connected, the socket is blocking then, -1 with errno set
+// otherwise, the socket is closed then
+int finish_tcp_connect(int s, int timedout);
+
+// have the kernel switch the rs485 transceiver of the serial port with rts
+// (TIOCSRS485), at the level rtsOnSend(1 high, 0 low) while sending, set
+// delayBeforeMs before a frame and kept delayAfterMs after it. return 0 on
+// success, -1 with errno set if the driver doesn't support it
+int serial_set_rs485(int fd, int rtsOnSend, int delayBeforeMs, int delayAfterMs);
+
+// ASYNC_LOW_LATENCY on the serial port or off: the driver passes on the
+// received chars at once, not after its latency timer(16ms on the ftdi usb
+// adapters). return 0 on success, -1 with errno set
+int serial_set_low_latency(int fd, int on);
+
+#endif
@@ -25,9 +25,10 @@ sudo apt-get --yes --force-yes install git
 echo "2, install auto conf"
 sudo apt-get --yes --force-yes install autoconf
 
-# 3, install libtool
-echo "3, install libtool"
+# 3, install libtool and zlib
+echo "3, install libtool and zlib"
 sudo apt-get --yes --force-yes install libtool
+sudo apt-get --yes --force-yes install zlib1g-dev
 
 # 4, make a temp dir
 echo "4, make a temp dir"